@@ -9,3 +9,37 @@ macro( CreateMethodCallFile filename namespace function symbols)
     endforeach()
     file(APPEND ${filename} "    return true;\n}\n\n} // ${namespace}\n")
 endmacro()
+
+# Source for a plugin library exporting extern "C" ${entry}(), which calls symbols
+macro( CreatePluginEntryFile filename namespace entry symbols)
+    file(WRITE ${filename} "// CMake generated file. Do Not Edit.\n\nnamespace ${namespace} {\n\n")
+    foreach( symbol ${symbols} )
+        file(APPEND ${filename} "void ${symbol}();\n")
+    endforeach()
+    file(APPEND ${filename} "\n} // ${namespace}\n\n#ifdef _WIN32\n#  define PLUGIN_ENTRY_EXPORT __declspec(dllexport)\n#else\n#  define PLUGIN_ENTRY_EXPORT __attribute__((visibility(\"default\")))\n#endif\n\n")
+    file(APPEND ${filename} "extern \"C\" PLUGIN_ENTRY_EXPORT void ${entry}()\n{\n")
+    foreach( symbol ${symbols} )
+        file(APPEND ${filename} "    ${namespace}::${symbol}();\n")
+    endforeach()
+    file(APPEND ${filename} "}\n")
+endmacro()
+
+# Header defining ${function}(), which adds the plugin search paths and
+# registers each plugin in plugins for the schemes listed in ${plugin}_SCHEMES
+macro( CreatePluginIndexFile filename namespace function include paths plugins)
+    file(WRITE ${filename} "// CMake generated file. Do Not Edit.\n\n#pragma once\n\n#include <${include}>\n\nnamespace ${namespace} {\n\ninline bool ${function}()\n{\n")
+    foreach( path ${paths} )
+        file(APPEND ${filename} "    AddVideoPluginPath(\"${path}\");\n")
+    endforeach()
+    foreach( plugin ${plugins} )
+        set( _schemes "" )
+        foreach( scheme ${${plugin}_SCHEMES} )
+            if( _schemes )
+                set( _schemes "${_schemes}, " )
+            endif()
+            set( _schemes "${_schemes}\"${scheme}\"" )
+        endforeach()
+        file(APPEND ${filename} "    RegisterVideoPlugin(\"${plugin}\", {${_schemes}});\n")
+    endforeach()
+    file(APPEND ${filename} "    return true;\n}\n\n} // ${namespace}\n")
+endmacro()
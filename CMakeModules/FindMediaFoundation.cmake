@@ -5,7 +5,7 @@
 # MediaFoundation_FOUND       - True if MediaFoundation found
 
 IF (MSVC)
-  SET( MediaFoundation_LIBRARIES mf.lib mfplat.lib mfreadwrite.lib mfuuid.lib strmiids.lib )
+  SET( MediaFoundation_LIBRARIES mf.lib mfplat.lib mfreadwrite.lib mfuuid.lib strmiids.lib d3d11.lib )
   SET( MediaFoundation_FOUND true )
 ENDIF (MSVC)
 
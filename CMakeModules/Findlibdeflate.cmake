@@ -0,0 +1,34 @@
+###############################################################################
+# Find libdeflate
+#
+# This sets the following variables:
+# libdeflate_FOUND - True if libdeflate was found.
+# libdeflate_INCLUDE_DIRS - Directories containing the libdeflate include files.
+# libdeflate_LIBRARIES - Libraries needed to use libdeflate.
+
+find_path(
+    libdeflate_INCLUDE_DIR libdeflate.h
+    PATHS
+        /opt/local/include
+        /usr/local/include
+        /usr/include
+)
+
+find_library(
+    libdeflate_LIBRARY
+    NAMES deflate
+    PATHS
+        /opt/local/lib
+        /usr/local/lib
+        /usr/lib
+)
+
+# Plural forms
+set(libdeflate_INCLUDE_DIRS ${libdeflate_INCLUDE_DIR})
+set(libdeflate_LIBRARIES ${libdeflate_LIBRARY})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args( libdeflate
+  FOUND_VAR libdeflate_FOUND
+  REQUIRED_VARS libdeflate_INCLUDE_DIR libdeflate_LIBRARY
+)
@@ -24,6 +24,14 @@ find_library(
         /usr/lib
 )
 
+if(zstd_INCLUDE_DIR AND EXISTS "${zstd_INCLUDE_DIR}/zstd.h")
+    file(STRINGS "${zstd_INCLUDE_DIR}/zstd.h" zstd_version_lines REGEX "#define ZSTD_VERSION_(MAJOR|MINOR|RELEASE) ")
+    string(REGEX REPLACE ".*ZSTD_VERSION_MAJOR +([0-9]+).*" "\\1" zstd_VERSION_MAJOR "${zstd_version_lines}")
+    string(REGEX REPLACE ".*ZSTD_VERSION_MINOR +([0-9]+).*" "\\1" zstd_VERSION_MINOR "${zstd_version_lines}")
+    string(REGEX REPLACE ".*ZSTD_VERSION_RELEASE +([0-9]+).*" "\\1" zstd_VERSION_RELEASE "${zstd_version_lines}")
+    set(zstd_VERSION "${zstd_VERSION_MAJOR}.${zstd_VERSION_MINOR}.${zstd_VERSION_RELEASE}")
+endif()
+
 # Plural forms
 set(zstd_INCLUDE_DIRS ${zstd_INCLUDE_DIR})
 set(zstd_LIBRARIES ${zstd_LIBRARY})
@@ -32,4 +40,5 @@ include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args( zstd
   FOUND_VAR zstd_FOUND
   REQUIRED_VARS zstd_INCLUDE_DIR zstd_LIBRARY
+  VERSION_VAR zstd_VERSION
 )
@@ -1,15 +1,16 @@
 #include <pangolin/pangolin.h>
 
-#include <pangolin/utils/posix/condition_variable.h>
-#include <pangolin/utils/posix/shared_memory_buffer.h>
+#include <pangolin/video/drivers/shared_memory_output.h>
 #include <pangolin/utils/timer.h>
 
 #include <cmath>
 #include <memory>
 
-// This sample acts as a soft camera. It writes a pattern of GRAY8 pixels to the
-// shared memory space. It can be seen in Pangolin's SimpleVideo sample using
-// the shmem:[size=640x480]//example video URI.
+// This sample acts as a soft camera. It writes a pattern of GRAY8 pixels
+// straight into a shared memory ring. Any number of processes can view it,
+// e.g. with Pangolin's SimpleVideo sample using the shmem://example video URI.
+// Capture processes can publish any VideoInput the same way by recording to
+// the shmem://name output URI.
 
 using namespace pangolin;
 
@@ -22,31 +23,23 @@ unsigned char generate_value(double t)
 
 int main(/*int argc, char *argv[]*/)
 {
-  std::string shmem_name = "/example";
+  const size_t w = 640, h = 480;
+  SharedMemoryVideoOutput ring("/example", 4, 4096);
 
-  std::shared_ptr<SharedMemoryBufferInterface> shmem_buffer =
-    create_named_shared_memory_buffer(shmem_name, 640 * 480);
-  if (!shmem_buffer) {
-    perror("Unable to create shared memory buffer");
-    exit(1);
-  }
-
-  std::string cond_name = shmem_name + "_cond";
-  std::shared_ptr<ConditionVariableInterface> buffer_full =
-    create_named_condition_variable(cond_name);
+  std::vector<StreamInfo> streams;
+  streams.push_back(StreamInfo(PixelFormatFromString("GRAY8"), w, h, w, 0));
+  ring.SetStreams(streams, "", picojson::value());
 
   // Sit in a loop and write gray values based on some timing pattern.
   while (true) {
-    shmem_buffer->lock();
-    unsigned char *ptr = shmem_buffer->ptr();
+    unsigned char *ptr = ring.BeginFrame();
     unsigned char value = generate_value(std::chrono::system_clock::now().time_since_epoch().count());
 
-    for (int i = 0; i < 640*480; ++i) {
+    for (size_t i = 0; i < w*h; ++i) {
       ptr[i] = value;
     }
 
-    shmem_buffer->unlock();
-    buffer_full->signal();
+    ring.PublishFrame();
 
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
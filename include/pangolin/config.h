@@ -49,6 +49,7 @@
 /* #undef HAVE_OCULUS */
 
 #define HAVE_PNG
+/* #undef HAVE_LIBDEFLATE */
 #define HAVE_JPEG
 #define HAVE_TIFF
 #define HAVE_OPENEXR
@@ -75,6 +75,18 @@ public:
         const std::string& cmd, int max_options = 20
     ) = 0;
 
+    // Abandon the running command, and any queued behind it, if the
+    // interpreter runs them asynchronously.
+    virtual void Cancel()
+    {
+    }
+
+    // True whilst commands are queued or running
+    virtual bool Busy() const
+    {
+        return false;
+    }
+
 };
 
 }
@@ -47,16 +47,21 @@ public:
     struct Line
     {
         Line()
+            : linetype(ConsoleLineTypeCmd), laid_out(false)
         {
         }
 
-        Line(const GlText& text, ConsoleLineType linetype = ConsoleLineTypeCmd )
-            : text(text), linetype(linetype)
+        Line(const std::string& str, ConsoleLineType linetype = ConsoleLineTypeCmd )
+            : str(str), linetype(linetype), laid_out(false)
         {
         }
 
-        GlText text;
+        std::string str;
         ConsoleLineType linetype;
+
+        // Laid out when first drawn, since most lines of a long log never are
+        GlText text;
+        bool laid_out;
     };
 
 
@@ -80,13 +85,38 @@ public:
 
     void Keyboard(View&, unsigned char key, int x, int y, bool pressed) override;
 
+    // Cap on the memory held by past lines, oldest lines being dropped first
+    void SetMaxBufferBytes(size_t bytes);
+
 private:
-    void DrawLine(const ConsoleView::Line& l);
+    struct Vertex
+    {
+        GLfloat x, y;
+        GLfloat tu, tv;
+        GLfloat r, g, b, a;
+    };
 
+    void LayOut(ConsoleView::Line& l);
+
+    void DrawLine(ConsoleView::Line& l);
+
+    // Draw the first num_lines of line_buffer upwards from the origin
+    void DrawLines(size_t num_lines, GLfloat line_space);
+
+    // Gather glyphs of the lines into vbo, in runs sharing a font texture
+    void BuildLinesVbo(size_t num_lines, GLfloat line_space);
+
+    // Move all queued output into line_buffer at once
     void ProcessOutputLines();
 
     void AddLine(const std::string& text, ConsoleLineType linetype = ConsoleLineTypeCmd);
 
+    // Bytes accounted to a line of text str, as though it were laid out
+    static size_t LineBytes(const std::string& str);
+
+    // Drop the oldest lines until line_buffer holds at most max_bytes
+    void EvictLines(size_t max_bytes);
+
     Line* GetLine(int id, ConsoleLineType line_type, const std::string& prefix = "");
 
     ConsoleInterpreter* interpreter;
@@ -96,7 +126,19 @@ private:
     std::map<ConsoleLineType, GlText> prompts;
 
     Line current_line;
+    // Most recent first
     std::deque<Line> line_buffer;
+    size_t line_buffer_bytes;
+    size_t max_buffer_bytes;
+
+    // Glyphs of the visible lines, rebuilt only when lines arrive or the
+    // colours or number shown change
+    GlBuffer lines_vbo;
+    std::vector<std::pair<const GlTexture*, GLsizei>> lines_vbo_runs;
+    bool lines_vbo_dirty;
+    size_t lines_vbo_count;
+    GLfloat lines_vbo_space;
+    std::map<ConsoleLineType,pangolin::Colour> lines_vbo_colours;
 
     bool hiding;
     GLfloat bottom;
@@ -0,0 +1,103 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/display/display_internal.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <EGL/egl.h>
+
+namespace pangolin
+{
+
+struct EglDisplay
+{
+    // Initialise EGL on GPU device (enumeration order of EGL_EXT_device_enum),
+    // or on the first device, falling back to the default display, if < 0.
+    EglDisplay(int device = -1);
+
+    ~EglDisplay();
+
+    // Shared between all windows on the same device, since terminating a
+    // display invalidates every context created on it.
+    static std::shared_ptr<EglDisplay> Get(int device);
+
+    // Owns the initialised display
+    ::EGLDisplay display;
+};
+
+// Window without a windowing system, rendering to a pbuffer surface so that
+// the default framebuffer can be read back by SaveRenderNow / RecordOnRender.
+// Each window has an independent context and may be used on its own thread.
+struct EglWindow : public PangolinGl
+{
+    EglWindow(
+        int width, int height, std::shared_ptr<EglDisplay>& display,
+        int sample_buffers, int samples
+    );
+
+    ~EglWindow();
+
+    void ToggleFullscreen() override;
+
+    void Move(int x, int y) override;
+
+    void Resize(unsigned int w, unsigned int h) override;
+
+    void MakeCurrent() override;
+
+    void SwapBuffers() override;
+
+    void ProcessEvents() override;
+
+    void WaitEvents(double timeout_s) override;
+
+    void Wake() override;
+
+    bool SetSwapInterval(int interval) override;
+
+    std::unique_ptr<GlContextInterface> CreateSharedContext() override;
+
+    std::shared_ptr<EglDisplay> display;
+
+    // Owns the context and pbuffer surface
+    ::EGLConfig config;
+    ::EGLContext glcontext;
+    ::EGLSurface surface;
+
+    // Signalled by Wake()
+    std::mutex wake_mutex;
+    std::condition_variable wake_cond;
+    bool woken;
+};
+
+}
@@ -56,6 +56,8 @@ struct OsxWindow : public PangolinGl
 
     void SwapBuffers() override;
 
+    std::unique_ptr<GlContextInterface> CreateSharedContext() override;
+
     void ProcessEvents() override;
 
 private:
@@ -59,8 +59,16 @@ struct WinWindow : public PangolinGl
 
     void SwapBuffers() override;
 
+    std::unique_ptr<GlContextInterface> CreateSharedContext() override;
+
     void ProcessEvents() override;
 
+    void WaitEvents(double timeout_s) override;
+
+    void Wake() override;
+
+    bool SetSwapInterval(int interval) override;
+
     HGLRC GetGLRenderContext()
     {
         return hGLRC;
@@ -32,6 +32,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <GL/glx.h>
@@ -93,6 +94,18 @@ struct X11Window : public PangolinGl
 
     void ProcessEvents() override;
 
+    void WaitEvents(double timeout_s) override;
+
+    void Wake() override;
+
+    bool SetSwapInterval(int interval) override;
+
+    std::unique_ptr<GlContextInterface> CreateSharedContext() override;
+
+    // Receive pointer input through XInput2, with subpixel positions and
+    // smooth scrolling, instead of core events. False if unavailable.
+    bool EnableXInput2();
+
     // References the X11 display and context.
     std::shared_ptr<X11Display> display;
     std::shared_ptr<X11GlContext> glcontext;
@@ -101,7 +114,28 @@ struct X11Window : public PangolinGl
     ::Window win;
     ::Colormap cmap;
 
+    // Framebuffer config the window and its contexts were created with
+    ::GLXFBConfig fbconfig;
+
     Atom delete_message;
+
+    // Self-pipe written by Wake()
+    int wake_pipe[2];
+
+    // XInput2 extension opcode, or -1 whilst using core pointer events
+    int xi_opcode;
+
+    // Smooth scrolling axes of the master pointers, with their last values
+    struct ScrollValuator
+    {
+        int deviceid;
+        int number;
+        bool vertical;
+        double increment;
+        double last;
+        bool valid;
+    };
+    std::vector<ScrollValuator> scroll_valuators;
 };
 
 }
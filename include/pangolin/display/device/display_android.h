@@ -35,8 +35,10 @@
 #include <android/looper.h>
 #include <android/native_activity.h>
 #include <android/log.h>
+#include <memory>
 #include <string>
 
+#include <pangolin/display/window.h>
 #include <pangolin/utils/type_convert.h>
 
 #define LOGI(...) ((void)__android_log_print(ANDROID_LOG_INFO,  "pango", __VA_ARGS__))
@@ -69,6 +71,9 @@ namespace pangolin
     void CreateAndroidWindowAndBind(std::string name);
     void ProcessAndroidEvents();
     void FinishAndroidFrame();
+
+    // Context sharing objects with the activity's, for GlLoader
+    std::unique_ptr<GlContextInterface> CreateAndroidSharedContext();
 }
 
 
@@ -51,6 +51,8 @@ namespace pangolin
   extern const char* PARAM_SAMPLE_BUFFERS; // int
   extern const char* PARAM_SAMPLES;        // int
   extern const char* PARAM_HIGHRES;        // bool - Apple Retina screens only
+  extern const char* PARAM_EGL_DEVICE;     // int  - headless EGL GPU index only
+  extern const char* PARAM_XINPUT2;        // bool - X11 only, subpixel / smooth scroll input
 
   // Forward Declarations
   struct View;
@@ -88,6 +90,24 @@ namespace pangolin
   PANGOLIN_EXPORT
   void FinishFrame();
 
+  /// Mark the current window as needing to be redrawn, or every window when
+  /// called from a thread without a bound window, for instance one
+  /// receiving video frames. Safe to call from any thread.
+  PANGOLIN_EXPORT
+  void PostRedisplay();
+
+  /// With on_demand set, FinishFrame() returns only once the window needs
+  /// redrawing: after input, a Var change, PostRedisplay(), or max_idle_s
+  /// without any of those. Otherwise FinishFrame() returns immediately so
+  /// that every iteration of the render loop draws a frame.
+  PANGOLIN_EXPORT
+  void SetRedrawOnDemand(bool on_demand, double max_idle_s = 0.5);
+
+  /// Set the number of vertical refreshes to wait between buffer swaps
+  /// (0 disables vsync). Returns false if the window doesn't support it.
+  PANGOLIN_EXPORT
+  bool SetSwapInterval(int interval);
+
   /// Request that the window close.
   PANGOLIN_EXPORT
   void Quit();
@@ -32,14 +32,21 @@
 
 #include <pangolin/display/view.h>
 #include <pangolin/display/user_app.h>
+#include <pangolin/gl/gltext.h>
+#include <pangolin/gl/gltexturecache.h>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 
+#include <algorithm>
+#include <chrono>
 #include <map>
 #include <queue>
 
 #ifdef BUILD_PANGOLIN_VIDEO
-#  include <pangolin/video/video_output.h>
+#  include <pangolin/display/framebuffer_recorder.h>
 #endif // BUILD_PANGOLIN_VIDEO
 
 
@@ -89,7 +96,7 @@ struct PANGOLIN_EXPORT PangolinGl : public WindowInterface
     
 #ifdef BUILD_PANGOLIN_VIDEO
     View* record_view;
-    VideoOutput recorder;
+    FramebufferRecorder recorder;
 #endif
 
 #ifdef HAVE_PYTHON
@@ -98,6 +105,43 @@ struct PANGOLIN_EXPORT PangolinGl : public WindowInterface
 
     std::shared_ptr<GlFont> font;
 
+    // Scratch textures for this context
+    TextureCache texture_cache;
+
+    // Text queued by widgets for drawing together
+    GlTextBatch text_batch;
+
+    // On-demand redraw. redraw_requested may be set from any thread.
+    bool redraw_on_demand;
+    double redraw_max_idle_s;
+    std::atomic<bool> redraw_requested;
+    uint64_t redraw_var_changes;
+    std::mutex redraw_mutex;
+    std::condition_variable redraw_cond;
+
+    // Block for up to timeout_s, returning early once window events are
+    // pending or Wake() is called. Windows which can't wait on their event
+    // source wake up periodically to let ProcessEvents() poll.
+    virtual void WaitEvents(double timeout_s) {
+        const double poll_s = 1.0 / 60.0;
+        std::unique_lock<std::mutex> l(redraw_mutex);
+        redraw_cond.wait_for(l, std::chrono::duration<double>(std::min(timeout_s, poll_s)), [this](){
+            return redraw_requested.load();
+        });
+    }
+
+    // Interrupt WaitEvents(). Safe to call from any thread.
+    virtual void Wake() {
+        { std::lock_guard<std::mutex> l(redraw_mutex); }
+        redraw_cond.notify_all();
+    }
+
+    // Vertical refreshes between buffer swaps, 0 to disable vsync.
+    // Returns false if the window can't control it.
+    virtual bool SetSwapInterval(int /*interval*/) {
+        return false;
+    }
+
     virtual void ToggleFullscreen() override {
         pango_print_warn("ToggleFullscreen: Not available with non-pangolin window.\n");
     }
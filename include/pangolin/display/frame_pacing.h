@@ -0,0 +1,83 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <cstdint>
+
+namespace pangolin
+{
+
+//! Timing of the buffer swaps made by FinishFrame() whilst pacing
+struct PANGOLIN_EXPORT FramePacingStats
+{
+    FramePacingStats()
+        : frames(0), missed(0), refresh_ms(0.0), work_ms(0.0), latch_to_vsync_ms(0.0)
+    {
+    }
+
+    uint64_t frames;
+    uint64_t missed;            // frames which reached the screen a refresh later than planned
+    double refresh_ms;          // estimated vsync period, 0 until known
+    double work_ms;             // allowed from WaitForLatchPoint() to the swap, GPU work included
+    double latch_to_vsync_ms;   // of the latest frame, the age of data picked up at the latch point when shown
+};
+
+//! Late latching. With pacing enabled, FinishFrame() waits for the GPU
+//! before and after each buffer swap, timing the vsyncs it lands on and the
+//! work of the frame, and WaitForLatchPoint() sleeps the render loop until
+//! that work, plus margin_ms, will only just make the next vsync. Grabbing
+//! the newest data (e.g. VideoInput::GrabNewest()) and uploading it after
+//! the latch point, rather than straight after the previous swap, shows it
+//! up to a refresh sooner. Needs vsync (see SetSwapInterval()). Pacing is
+//! per render thread.
+PANGOLIN_EXPORT
+void EnableFramePacing(bool enable = true, double margin_ms = 1.0);
+
+PANGOLIN_EXPORT
+bool FramePacingEnabled();
+
+//! Sleep until the latest point from which this frame still makes the next
+//! vsync. Returns immediately with pacing disabled, or until the refresh
+//! period has been measured.
+PANGOLIN_EXPORT
+void WaitForLatchPoint();
+
+PANGOLIN_EXPORT
+FramePacingStats GetFramePacingStats();
+
+namespace detail {
+
+PANGOLIN_EXPORT void FramePacingBeforeSwap();
+PANGOLIN_EXPORT void FramePacingAfterSwap();
+
+}
+
+}
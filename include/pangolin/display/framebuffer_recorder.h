@@ -0,0 +1,111 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/display/viewport.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/video/video_output.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Record a region of the framebuffer to a VideoOutput without stalling
+//! rendering. Each Capture reads into the next of a ring of pixel pack
+//! buffers and returns immediately. Earlier readbacks are handed on as soon
+//! as their fences have signalled, normally a frame later, and at the latest
+//! when the ring comes back around to them. Frames are then encoded on a
+//! background thread, and dropped rather than stalling the render thread if
+//! more than max_queued are waiting.
+class PANGOLIN_EXPORT FramebufferRecorder
+{
+public:
+    FramebufferRecorder(size_t num_buffers = 3, size_t max_queued = 8);
+    ~FramebufferRecorder();
+
+    //! Open uri for w x h RGB24 frames. Requires a current GL context.
+    void Open(const std::string& uri, int w, int h);
+
+    bool IsOpen() const;
+
+    //! Encode outstanding frames and close the output
+    void Close();
+
+    //! Queue readback of v from the back buffer. Closes the recording if
+    //! v no longer matches the size it was opened with.
+    void Capture(const Viewport& v);
+
+    size_t FramesDropped() const;
+
+    //! Take the oldest input event sent back by viewers of the recording,
+    //! if the output accepts any (see VideoOutputRemoteInputInterface)
+    bool PopInputEvent(picojson::value& event);
+
+private:
+    struct Readback
+    {
+        GlBuffer pbo;
+        void* fence = nullptr;
+        int64_t time_us = 0;
+    };
+
+    struct Frame
+    {
+        FramePool::Buffer buffer;
+        int64_t time_us;
+    };
+
+    void Collect(Readback& r);
+    void WriterLoop();
+
+    size_t num_buffers;
+    size_t max_queued;
+    int width;
+    int height;
+    size_t frame_bytes;
+
+    std::vector<Readback> readbacks;
+    size_t next_readback;
+
+    VideoOutput video;
+    std::thread writer;
+    mutable std::mutex lock;
+    std::condition_variable cond;
+    std::deque<Frame> queue;
+    bool finishing;
+    size_t dropped;
+};
+
+}
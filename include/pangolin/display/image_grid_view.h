@@ -0,0 +1,96 @@
+#pragma once
+
+#include <pangolin/display/display.h>
+#include <pangolin/display/view.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/managed_image.h>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace pangolin
+{
+
+// Grid of equally sized images of one format, such as the streams of a
+// camera rig. The images are layers of one texture array, uploaded together
+// through a ring of pixel buffers with a single glTexSubImage3D, and every
+// tile is drawn by one instanced draw call, so that the cost per frame
+// hardly grows with the number of images. Needs OpenGL 3.1.
+class ImageGridView : public pangolin::View
+{
+  public:
+    static const size_t default_num_buffers = 3;
+
+    ImageGridView();
+
+    ~ImageGridView();
+
+    // True iff the current context can draw the grid
+    static bool Supported();
+
+    void Render() override;
+
+    // Show imgs, which must all have the same size. With delayed_upload the
+    // images are copied and uploaded on the next Render(), so this may be
+    // called from any thread. Throws std::runtime_error for sizes that
+    // differ or formats a texture array can't hold.
+    ImageGridView& SetImages(const std::vector<pangolin::Image<unsigned char>>& imgs, const pangolin::GlPixFormat& fmt, bool delayed_upload = false);
+
+    ImageGridView& Clear();
+
+    size_t NumImages() const;
+
+    // Index of the image drawn at window pixel (x,y), or -1
+    int ImageAt(int x, int y) const;
+
+    std::pair<float, float>& GetOffsetScale();
+
+//  private:
+    struct Layout
+    {
+        int cols, rows;
+        // Fraction of each cell the image covers, keeping its aspect
+        float fill_x, fill_y;
+    };
+
+    static Layout ComputeLayout(size_t n, size_t img_w, size_t img_h, int view_w, int view_h);
+
+    // Copy imgs into dst as tightly packed layers
+    static void Pack(unsigned char* dst, const std::vector<pangolin::Image<unsigned char>>& imgs, size_t row_bytes);
+
+    // (Re)allocate the array for n layers of w x h in fmt
+    void Reinitialise(size_t n, size_t w, size_t h, const pangolin::GlPixFormat& fmt);
+
+    // Upload every layer at once, packed from imgs, or from packed if imgs is null
+    void Upload(const std::vector<pangolin::Image<unsigned char>>* imgs, const unsigned char* packed);
+
+    void Release();
+
+    void Initialise();
+
+    std::pair<float, float> offset_scale;
+
+    pangolin::GlSlProgram prog;
+    pangolin::GlBuffer corners;
+    std::vector<pangolin::GlBuffer> pbos;
+    size_t next_pbo;
+
+    GLuint tex;
+    size_t tex_w, tex_h, tex_layers;
+    size_t pixel_bytes;
+    GLenum tex_format;
+    pangolin::GlPixFormat fmt;
+    Layout layout;
+
+    // Images awaiting upload by Render(), packed as layers
+    std::mutex pending_lock;
+    pangolin::ManagedImage<unsigned char> pending;
+    size_t pending_w, pending_h, pending_layers;
+    pangolin::GlPixFormat pending_fmt;
+    bool has_pending;
+};
+
+}
@@ -21,6 +21,9 @@ class ImageView : public pangolin::View, public pangolin::ImageViewHandler
 
     void Render() override;
 
+    // True whilst an image is pending upload or the view is animating
+    bool ContentChanged() override;
+
     void Mouse(View& view, pangolin::MouseButton button, int x, int y, bool pressed, int button_state) override;
 
     void Keyboard(View& view, unsigned char key, int x, int y, bool pressed) override;
@@ -56,7 +59,7 @@ class ImageView : public pangolin::View, public pangolin::ImageViewHandler
 
     std::pair<float, float> offset_scale;
     pangolin::GlPixFormat fmt;
-    pangolin::GlTexture tex;
+    pangolin::GlStreamingTexture tex;
     bool lastPressed;
     bool mouseReleased;
     bool mousePressed;
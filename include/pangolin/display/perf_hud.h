@@ -0,0 +1,101 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/display/render_stats.h>
+#include <pangolin/display/view.h>
+#include <pangolin/handler/handler_enums.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+struct VideoInput;
+
+//! Overlay of frame time, GPU time, the costliest views (CPU and GPU), texture upload
+//! bandwidth and the stats of any videos added. Figures are averaged over
+//! half second windows so they can be read as they change.
+class PANGOLIN_EXPORT PerfHud : public View
+{
+public:
+    PerfHud();
+
+    //! Show the counters and latency of video, and the timings of each
+    //! stage of its chain (enabling them).
+    PerfHud& AddVideo(VideoInput& video, const std::string& label = "video");
+
+    //! Show an extra line of text, evaluated once per window
+    PerfHud& AddLine(const std::function<std::string()>& line);
+
+    //! Number of views listed, costliest first
+    PerfHud& SetMaxViews(size_t n);
+
+    void Render() override;
+
+protected:
+    struct ViewTotal
+    {
+        std::string name;
+        int depth = 0;
+        double cpu_ms = 0.0;
+        double gpu_ms = 0.0;
+        size_t gpu_frames = 0;
+    };
+
+    void Accumulate(const RenderStats& stats);
+    void Summarise();
+
+    std::vector<std::function<std::string()>> lines;
+    size_t max_views;
+
+    // The current window
+    uint64_t last_frame;
+    double window_start_s;
+    size_t frames;
+    double frame_ms;
+    double render_cpu_ms;
+    double gpu_ms;
+    size_t gpu_frames;
+    double upload_bytes;
+    std::map<const View*, ViewTotal> view_totals;
+
+    // The previous window, as displayed
+    std::vector<std::string> text;
+};
+
+//! Create a PerfHud at the top right of the window, registered as the
+//! named view "perf_hud" and shown or hidden with toggle_key (or not
+//! bound if negative). Enables render stats.
+PANGOLIN_EXPORT
+PerfHud& CreatePerfHud(int toggle_key = PANGO_SPECIAL + PANGO_KEY_F2);
+
+}
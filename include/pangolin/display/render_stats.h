@@ -0,0 +1,107 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+class View;
+
+struct PANGOLIN_EXPORT ViewRenderStats
+{
+    const View* view;
+    std::string name;   // as given to Display(), or its type
+    int depth;          // 0 for children of DisplayBase()
+    double cpu_ms;      // rendering the view and its children
+    double gpu_ms;      // as cpu_ms, a few frames old. -1 if not timed
+};
+
+//! Timings of one frame drawn by RenderViews() (and so FinishFrame())
+struct PANGOLIN_EXPORT RenderStats
+{
+    RenderStats()
+        : frame(0), frame_ms(0.0), render_cpu_ms(0.0), gpu_ms(-1.0),
+          upload_bytes(0), upload_mb_per_s(0.0)
+    {
+    }
+
+    uint64_t frame;
+    double frame_ms;        // since the previous frame
+    double render_cpu_ms;   // within RenderViews()
+    double gpu_ms;          // GPU time of RenderViews(), a few frames old. -1 if unsupported
+    uint64_t upload_bytes;  // by GlTexture since the previous frame
+    double upload_mb_per_s;
+    std::vector<ViewRenderStats> views;
+};
+
+//! Start timing frames, views, GPU work (with GL timer queries, where
+//! available) and texture uploads. Off by default, costing a flag check
+//! per view rendered. With view_gpu_times, a pair of timestamp queries is
+//! also issued around each view, whose results are read back a few frames
+//! later so that rendering never waits on them.
+PANGOLIN_EXPORT
+void EnableRenderStats(bool enable = true, bool view_gpu_times = false);
+
+PANGOLIN_EXPORT
+bool RenderStatsEnabled();
+
+//! GPU time of view and its children, or -1 if not timed
+PANGOLIN_EXPORT
+double GetViewGpuTime(const View& view);
+
+//! Stats of the latest complete frame
+PANGOLIN_EXPORT
+RenderStats GetRenderStats();
+
+namespace detail {
+
+PANGOLIN_EXPORT void RenderStatsBeginFrame();
+PANGOLIN_EXPORT void RenderStatsEndFrame();
+
+//! Times one view within RenderViews(), when stats are enabled
+class PANGOLIN_EXPORT ViewRenderTimer
+{
+public:
+    ViewRenderTimer(const View& view);
+    ~ViewRenderTimer();
+
+private:
+    size_t index;
+    int64_t start_ns;
+    unsigned int gpu_end_query;
+};
+
+}
+
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <pangolin/display/display.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/handler/handler_image.h>
+#include <pangolin/image/typed_image.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pangolin
+{
+
+// Image view for images too large for a single texture, such as stitched
+// panoramas. The image is split into tiles of a pyramid of halving
+// resolutions, and only the tiles visible at the level matching the zoom are
+// uploaded, least recently used tiles being evicted to stay within a budget
+// of texture memory. Levels are built on demand on a worker thread, with
+// coarser tiles already uploaded standing in whilst finer ones arrive.
+class TiledImageView : public pangolin::View, public pangolin::ImageViewHandler
+{
+  public:
+    TiledImageView(size_t tile_size = 512, size_t vram_budget_bytes = 256*1024*1024);
+
+    ~TiledImageView();
+
+    void Render() override;
+
+    // True whilst visible tiles are pending upload or the view is animating
+    bool ContentChanged() override;
+
+    // Show img, which is shared rather than copied and must not change whilst shown
+    TiledImageView& SetImage(const std::shared_ptr<const pangolin::TypedImage>& img);
+
+    TiledImageView& SetImage(pangolin::TypedImage&& img);
+
+    TiledImageView& Clear();
+
+    // Bytes of texture memory tiles may occupy
+    void SetVramBudget(size_t bytes);
+
+    // Limit on tiles uploaded per Render(), to keep the view responsive
+    void SetMaxUploadsPerFrame(size_t max_tiles);
+
+    std::pair<float, float>& GetOffsetScale();
+
+//  private:
+    struct Tile
+    {
+        pangolin::GlTexture tex;
+        size_t size_bytes;
+        size_t last_frame;
+        std::list<uint64_t>::iterator lru;
+        // Texture coordinates of the tile within its texture, which has a
+        // border of neighbouring pixels for seamless linear interpolation
+        float u0, v0, u1, v1;
+    };
+
+    static uint64_t TileKey(size_t level, size_t tx, size_t ty);
+
+    // Draw tile (tx,ty) of level, uploading it if upload is set and the
+    // budget allows. Returns false if the tile isn't resident.
+    bool DrawTile(const pangolin::TypedImage& level_img, size_t level, size_t tx, size_t ty, bool upload);
+
+    // Upload tile (tx,ty) of level, evicting older tiles to make room.
+    // Returns null if every tile is in use by the current frame.
+    Tile* UploadTile(const pangolin::TypedImage& level_img, size_t level, size_t tx, size_t ty);
+
+    void DeleteTiles();
+
+    void BuildLoop();
+
+    const size_t tile_size;
+    size_t vram_budget;
+    size_t max_uploads_per_frame;
+
+    std::pair<float, float> offset_scale;
+    pangolin::GlPixFormat fmt;
+    size_t width, height;
+    size_t num_levels;
+
+    // Resident tiles, by TileKey, and their keys, most recently used first
+    std::map<uint64_t, Tile> tiles;
+    std::list<uint64_t> lru;
+    size_t vram_used;
+    size_t frame;
+    size_t uploads;
+    bool pending;
+
+    // Guards the members below, shared with the worker
+    std::mutex lock;
+    std::condition_variable cv;
+    // Levels built so far, halving in resolution from the image itself
+    std::vector<std::shared_ptr<const pangolin::TypedImage>> levels;
+    size_t requested_level;
+    size_t generation;
+    bool tiles_stale;
+    bool quit;
+    std::thread worker;
+};
+
+}
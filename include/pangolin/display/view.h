@@ -28,6 +28,7 @@
 #pragma once
 
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include <pangolin/display/viewport.h>
@@ -59,12 +60,16 @@ struct Handler;
 
 class OpenGlRenderState;
 
+struct ViewCache;
+
+struct ViewRenderScale;
+
 /// A Display manages the location and resizing of an OpenGl viewport.
 struct PANGOLIN_EXPORT View
 {
     View(double aspect=0.0)
         : aspect(aspect), top(1.0),left(0.0),right(1.0),bottom(0.0), hlock(LockCenter),vlock(LockCenter),
-          layout(LayoutOverlay), scroll_offset(0), show(1), zorder(0), handler(0) {}
+          layout(LayoutOverlay), scroll_offset(0), show(1), zorder(0), handler(0), invalidated(true) {}
     
     virtual ~View() {}
     
@@ -115,6 +120,41 @@ struct PANGOLIN_EXPORT View
     
     //! Instruct all children to render themselves if appropriate
     virtual void RenderChildren();
+
+    //! Render(), or for a cached view, composite its offscreen copy if
+    //! nothing within the view has changed since it was last rendered.
+    void RenderCached();
+
+    //! Render this view and its children to an offscreen buffer which is
+    //! composited into the window on subsequent frames. The view is only
+    //! rendered again after Invalidate(), input over the view, a change in
+    //! its bounds, or ContentChanged() reporting a change within it.
+    View& SetCached(bool cached = true);
+
+    //! Returns true if this view is composited from an offscreen copy
+    bool IsCached() const;
+
+    //! Render this view's own content at scale times its resolution to an
+    //! offscreen buffer which is upscaled into the window. Children, such
+    //! as panels and overlays, are still rendered at native resolution.
+    //! A scale of 1 (without a budget) renders directly again.
+    View& SetRenderScale(float scale);
+
+    //! Adjust the render scale, within [min_scale,1], to bring the GPU time
+    //! of this view's own content towards budget_ms. Requires GL timer
+    //! queries, otherwise the scale stays as set. A budget of 0 disables.
+    View& SetRenderBudget(double budget_ms, float min_scale = 0.25f);
+
+    //! Scale this view's own content is currently rendered at
+    float GetRenderScale() const;
+
+    //! Have this view, and any cached view containing it, rendered again
+    void Invalidate();
+
+    //! Views whose content changes without input or Invalidate(), for
+    //! instance by following a data source, should return true when it has
+    //! since the last call.
+    virtual bool ContentChanged();
     
     //! Set this view as the active View to receive input
     View& SetFocus();
@@ -170,7 +210,9 @@ struct PANGOLIN_EXPORT View
     void SaveOnRender(const std::string& filename_prefix);
     
     //! Specify that this views region in the framebuffer should be saved to
-    //! a video just before the buffer is flipped
+    //! a video just before the buffer is flipped. Streamed to a tcp:// output
+    //! opened with input=1, input sent back by viewers (e.g. RemoteView) is
+    //! replayed on this window.
     void RecordOnRender(const std::string& record_uri);
     
     //! Uses the views default render method to draw into an FBO 'scale' times
@@ -224,6 +266,15 @@ struct PANGOLIN_EXPORT View
     
     // External draw function
     std::function<void(View&)> extern_draw_function;
+
+    // Set by Invalidate(), cleared once a cached view containing it renders
+    bool invalidated;
+
+    // Offscreen copy of this view, if cached
+    std::shared_ptr<ViewCache> cache;
+
+    // Reduced resolution target for this view's content, if scaled
+    std::shared_ptr<ViewRenderScale> render_scale;
     
 private:
     // Private copy constructor
@@ -40,6 +40,10 @@ namespace pangolin
 PANGOLIN_EXPORT
 View& CreatePanel(const std::string& name);
 
+// Panels are cached (see View::SetCached), so are only rendered again on
+// input, layout or a change to a displayed var. Only the widgets within the
+// panel are laid out and rendered, and their rectangles are drawn together
+// from one buffer, so that panels of thousands of vars remain cheap.
 struct PANGOLIN_EXPORT Panel : public View
 {
     Panel();
@@ -47,6 +51,9 @@ struct PANGOLIN_EXPORT Panel : public View
     void Render();
     void ResizeChildren();
     static void AddVariable(void* data, const std::string& name, VarValueGeneric& var, bool brand_new);
+
+    // Widget geometry of the last render
+    GlBuffer geometry;
 };
 
 template<typename T>
@@ -92,12 +99,14 @@ struct PANGOLIN_EXPORT Checkbox : public Widget<bool>
     Checkbox(std::string title, VarValueGeneric& tv);
     void Mouse(View&, MouseButton button, int x, int y, bool pressed, int mouse_state);
     void Render();
+    bool ContentChanged();
     
     //Cache params on resize
     void ResizeChildren();
     GlText gltext;
     GLfloat raster[2];
     Viewport vcb;
+    bool rendered_val;
 };
 
 struct PANGOLIN_EXPORT Slider : public Widget<double>
@@ -107,11 +116,13 @@ struct PANGOLIN_EXPORT Slider : public Widget<double>
     void MouseMotion(View&, int x, int y, int mouse_state);
     void Keyboard(View&, unsigned char key, int x, int y, bool pressed);
     void Render();
+    bool ContentChanged();
     
     //Cache params on resize
     void ResizeChildren();
     GlText gltext;
     GLfloat raster[2];
+    double rendered_val;
     bool lock_bounds;
     bool logscale;
     bool is_integral_type;
@@ -124,6 +135,7 @@ struct PANGOLIN_EXPORT TextInput : public Widget<std::string>
     void MouseMotion(View&, int x, int y, int mouse_state);
     void Keyboard(View&, unsigned char key, int x, int y, bool pressed);
     void Render();
+    bool ContentChanged();
     
     std::string edit;
     GlText gledit;
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <memory>
+
 namespace pangolin
 {
 
@@ -34,6 +36,11 @@ class GlContextInterface
 {
 public:
     virtual ~GlContextInterface() {}
+
+    // Bind / unbind the context on the calling thread. Implemented by the
+    // contexts returned from WindowInterface::CreateSharedContext().
+    virtual void MakeCurrent() {}
+    virtual void ReleaseCurrent() {}
 };
 
 class WindowInterface
@@ -47,6 +54,13 @@ public:
     virtual void MakeCurrent() = 0;
     virtual void ProcessEvents() = 0;
     virtual void SwapBuffers() = 0;
+
+    // New context sharing textures, buffers etc with this window's, for use
+    // on another thread (e.g. by GlLoader). Null where unsupported.
+    virtual std::unique_ptr<GlContextInterface> CreateSharedContext()
+    {
+        return std::unique_ptr<GlContextInterface>();
+    }
 };
 
 }
@@ -30,6 +30,7 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <functional>
 
 #include <pangolin/utils/uri.h>
 
@@ -62,6 +63,14 @@ public:
         std::sort(factories.begin(), factories.end());
     }
 
+    // Call loader before the first Open of scheme_name, e.g. to register
+    // the factories of a plugin only once they are needed.
+    void RegisterLoader(const std::string& scheme_name, std::function<void()> loader)
+    {
+        LoaderItem item = {scheme_name, loader};
+        loaders.push_back( item );
+    }
+
     void UnregisterFactory(FactoryInterface<T>* factory)
     {
         for( auto i = factories.end()-1; i != factories.begin(); --i)
@@ -75,10 +84,13 @@ public:
     void UnregisterAllFactories()
     {
         factories.clear();
+        loaders.clear();
     }
 
     std::unique_ptr<T> Open(const Uri& uri)
     {
+        RunLoaders(uri.scheme);
+
         // Iterate over all registered factories in order of precedence.
         for(auto& item : factories) {
             if( item.scheme == uri.scheme) {
@@ -93,6 +105,29 @@ public:
     }
 
 private:
+    struct LoaderItem
+    {
+        std::string scheme;
+        std::function<void()> loader;
+    };
+
+    void RunLoaders(const std::string& scheme)
+    {
+        // Taken out first, since loaders register factories (and maybe loaders)
+        std::vector<LoaderItem> pending;
+        for(auto i = loaders.begin(); i != loaders.end(); ) {
+            if(i->scheme == scheme) {
+                pending.push_back(*i);
+                i = loaders.erase(i);
+            }else{
+                ++i;
+            }
+        }
+        for(auto& item : pending) {
+            item.loader();
+        }
+    }
+
     struct FactoryItem
     {
         uint32_t precedence;
@@ -106,6 +141,7 @@ private:
 
     // Priority, Factory tuple
     std::vector<FactoryItem> factories;
+    std::vector<LoaderItem> loaders;
 };
 
 #define PANGOLIN_REGISTER_FACTORY(x) void Register ## x ## Factory()
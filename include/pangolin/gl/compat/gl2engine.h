@@ -28,12 +28,19 @@
 #pragma once
 
 #include <stack>
+#include <vector>
 
-#include <pangolin/opengl_render_state.h>
-#include <pangolin/glsl.h>
+#include <pangolin/display/opengl_render_state.h>
+#include <pangolin/gl/glsl.h>
 
 namespace pangolin {
 
+// Emulates the fixed function pipeline with one shader. Small draws from
+// client side arrays are accumulated into a single dynamic buffer whilst
+// they share matrices, primitive type and GL state, and drawn together when
+// that changes (see the wrappers at the end of this file) or the frame ends.
+// Matrices and texturing are uploaded to the shader only when they have
+// changed, and the current colour is baked into each batched vertex.
 class GlEngine
 {
 public:
@@ -42,14 +49,13 @@ public:
             "attribute vec4 a_color;\n"
             "attribute vec3 a_normal;\n"
             "attribute vec2 a_texcoord;\n"
-            "uniform vec4 u_color;\n"
             "uniform mat4 u_modelViewMatrix;\n"
             "uniform mat4 u_modelViewProjectionMatrix;\n"
             "varying vec4 v_frontColor;\n"
             "varying vec2 v_texcoord;\n"
             "void main() {\n"
             "    gl_Position = u_modelViewProjectionMatrix * a_position;\n"
-            "    v_frontColor = u_color;\n"
+            "    v_frontColor = a_color;\n"
             "    v_texcoord = a_texcoord;\n"
             "}\n";
 
@@ -68,7 +74,35 @@ public:
             "  }\n"
             "}\n";
 
+    // Array set with glVertexPointer and friends
+    struct ClientArray
+    {
+        ClientArray()
+            : enabled(false), size(4), type(GL_FLOAT), stride(0), pointer(0), buffer(0)
+        {
+        }
+
+        bool enabled;
+        GLint size;
+        GLenum type;
+        GLsizei stride;
+        const GLvoid* pointer;
+        GLuint buffer;      // GL_ARRAY_BUFFER pointer is an offset into, if any
+    };
+
+    struct BatchVertex
+    {
+        GLfloat position[4];
+        GLfloat color[4];
+    };
+
+    // Draws of more vertices than this are cheaper to make directly
+    static const GLsizei max_batched_draw = 1024;
+    static const size_t max_batch = 65536;
+
     GlEngine()
+        : matrices_dirty(true), texturing(false), texturing_dirty(true), color_dirty(true),
+          batch_mode(GL_POINTS), batch_vbo(0), flushes(0), batched_draws(0)
     {
         // Initialise default state
         projection.push(IdentityMatrix());
@@ -84,41 +118,236 @@ public:
         prog_fixed.BindPangolinDefaultAttribLocationsAndLink();
 
         // Save locations of uniforms
-        u_color = prog_fixed.GetUniformHandle("u_color");
         u_modelViewMatrix = prog_fixed.GetUniformHandle("u_modelViewMatrix");
         u_modelViewProjectionMatrix = prog_fixed.GetUniformHandle("u_modelViewProjectionMatrix");
         u_texture = prog_fixed.GetUniformHandle("u_texture");
         u_textureEnable = prog_fixed.GetUniformHandle("u_textureEnable");
 
-        // Initialise default uniform values
-        UpdateMatrices();
+        glGenBuffers(1, &batch_vbo);
         SetColor(1.0,1.0,1.0,1.0);
     }
 
+    // Matrices changed, to be uploaded before the next draw. Batched draws
+    // must be flushed before the matrices are changed.
     void UpdateMatrices()
     {
-        OpenGlMatrix pmv = projection.top() * modelview.top();
-        prog_fixed.SaveBind();
-        glUniformMatrix4fv( u_modelViewMatrix, 1, false, modelview.top().m );
-        glUniformMatrix4fv( u_modelViewProjectionMatrix, 1, false, pmv.m );
-        prog_fixed.Unbind();
+        matrices_dirty = true;
     }
 
+    // The current colour is a generic vertex attribute, replaced by colour arrays
     void SetColor(float r, float g, float b, float a)
     {
-        prog_fixed.SaveBind();
-        glUniform4f( u_color, r, g, b, a);
-        prog_fixed.Unbind();
+        color[0] = r; color[1] = g; color[2] = b; color[3] = a;
+        color_dirty = true;
     }
 
     void EnableTexturing(GLboolean v)
     {
+        Flush();
+        texturing = v != GL_FALSE;
+        texturing_dirty = true;
+    }
+
+    // Upload state which has changed to the bound emulation shader
+    void ApplyState()
+    {
+        if(matrices_dirty) {
+            const OpenGlMatrix pmv = projection.top() * modelview.top();
+            glUniformMatrix4fv( u_modelViewMatrix, 1, false, modelview.top().m );
+            glUniformMatrix4fv( u_modelViewProjectionMatrix, 1, false, pmv.m );
+            matrices_dirty = false;
+        }
+        if(texturing_dirty) {
+            glUniform1i( u_textureEnable, texturing);
+            texturing_dirty = false;
+        }
+        if(color_dirty) {
+            glVertexAttrib4fv(DEFAULT_LOCATION_COLOUR, color);
+            color_dirty = false;
+        }
+    }
+
+    void SetClientArray(ClientArray& a, GLuint location, GLint size, GLenum type, GLsizei stride, const GLvoid* pointer)
+    {
+        GLint buffer = 0;
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &buffer);
+        a.size = size;
+        a.type = type;
+        a.stride = stride;
+        a.pointer = pointer;
+        a.buffer = (GLuint)buffer;
+        glVertexAttribPointer(location, size, type, type == GL_UNSIGNED_BYTE ? GL_TRUE : GL_FALSE, stride, pointer);
+    }
+
+    void EnableClientArray(ClientArray& a, GLuint location, bool enable)
+    {
+        a.enabled = enable;
+        if(enable) glEnableVertexAttribArray(location);
+        else glDisableVertexAttribArray(location);
+    }
+
+    // Emulated glDrawArrays, batched when possible
+    void DrawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        const bool fixed = GlStateCache::I().CurrentProgram() == (GLuint)prog_fixed.ProgramId();
+        if(fixed && count <= max_batched_draw && Batchable()) {
+            const GLenum list_mode = ListMode(mode);
+            if(list_mode != batch_mode || batch.size() + 3*(size_t)count > max_batch) {
+                Flush();
+                batch_mode = list_mode;
+            }
+            AppendAsList(mode, first, count);
+            ++batched_draws;
+        }else{
+            Flush();
+            if(fixed) ApplyState();
+            ::glDrawArrays(mode, first, count);
+        }
+    }
+
+    void DrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+    {
+        Flush();
+        if(GlStateCache::I().CurrentProgram() == (GLuint)prog_fixed.ProgramId()) {
+            ApplyState();
+        }
+        ::glDrawElements(mode, count, type, indices);
+    }
+
+    // Draw what has been batched. Called before anything which would
+    // change how it is drawn, or read what has been drawn.
+    void Flush()
+    {
+        if(batch.empty()) return;
+
+        GLint prev_buffer = 0;
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &prev_buffer);
         prog_fixed.SaveBind();
-        glUniform1i( u_textureEnable, v);
+        ApplyState();
+
+        // Orphaned each time, so that the driver needn't wait for the last draw
+        glBindBuffer(GL_ARRAY_BUFFER, batch_vbo);
+        glBufferData(GL_ARRAY_BUFFER, batch.size() * sizeof(BatchVertex), batch.data(), GL_STREAM_DRAW);
+        glVertexAttribPointer(DEFAULT_LOCATION_POSITION, 4, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid*)0);
+        glVertexAttribPointer(DEFAULT_LOCATION_COLOUR, 4, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid*)(4*sizeof(GLfloat)));
+        glEnableVertexAttribArray(DEFAULT_LOCATION_POSITION);
+        glEnableVertexAttribArray(DEFAULT_LOCATION_COLOUR);
+        ::glDrawArrays(batch_mode, 0, (GLsizei)batch.size());
+        batch.clear();
+        ++flushes;
+
+        // Restore the client arrays the batched draws were made from
+        RestoreClientArray(vertex_array, DEFAULT_LOCATION_POSITION);
+        RestoreClientArray(color_array, DEFAULT_LOCATION_COLOUR);
+        glBindBuffer(GL_ARRAY_BUFFER, (GLuint)prev_buffer);
         prog_fixed.Unbind();
     }
 
 //protected:
+    // True if the draw reads only client side arrays this can copy
+    bool Batchable() const
+    {
+        if(texturing || texcoord_array.enabled) return false;
+        const ClientArray& v = vertex_array;
+        if(!v.enabled || v.buffer || v.type != GL_FLOAT || v.size < 2) return false;
+        const ClientArray& c = color_array;
+        if(c.enabled && (c.buffer || c.size < 3 ||
+                         !(c.type == GL_FLOAT || (c.type == GL_UNSIGNED_BYTE && c.size == 4))))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    static GLenum ListMode(GLenum mode)
+    {
+        switch(mode) {
+        case GL_LINES: case GL_LINE_STRIP: case GL_LINE_LOOP: return GL_LINES;
+        case GL_TRIANGLES: case GL_TRIANGLE_STRIP: case GL_TRIANGLE_FAN: return GL_TRIANGLES;
+        default: return GL_POINTS;
+        }
+    }
+
+    void AppendVertex(GLint i)
+    {
+        BatchVertex bv;
+        const ClientArray& v = vertex_array;
+        const GLfloat* p = (const GLfloat*)((const char*)v.pointer + i * (v.stride ? v.stride : v.size * sizeof(GLfloat)));
+        bv.position[0] = p[0];
+        bv.position[1] = p[1];
+        bv.position[2] = v.size > 2 ? p[2] : 0.0f;
+        bv.position[3] = v.size > 3 ? p[3] : 1.0f;
+
+        const ClientArray& c = color_array;
+        if(c.enabled) {
+            if(c.type == GL_FLOAT) {
+                const GLfloat* f = (const GLfloat*)((const char*)c.pointer + i * (c.stride ? c.stride : c.size * sizeof(GLfloat)));
+                bv.color[0] = f[0]; bv.color[1] = f[1]; bv.color[2] = f[2];
+                bv.color[3] = c.size > 3 ? f[3] : 1.0f;
+            }else{
+                const GLubyte* b = (const GLubyte*)c.pointer + i * (c.stride ? c.stride : 4);
+                for(int k=0; k < 4; ++k) bv.color[k] = b[k] / 255.0f;
+            }
+        }else{
+            std::copy(color, color+4, bv.color);
+        }
+        batch.push_back(bv);
+    }
+
+    // Strips, loops and fans are unrolled so that draws can be joined
+    void AppendAsList(GLenum mode, GLint first, GLsizei count)
+    {
+        switch(mode) {
+        case GL_LINE_STRIP:
+        case GL_LINE_LOOP:
+            for(GLint i=0; i + 1 < count; ++i) {
+                AppendVertex(first + i);
+                AppendVertex(first + i + 1);
+            }
+            if(mode == GL_LINE_LOOP && count > 2) {
+                AppendVertex(first + count - 1);
+                AppendVertex(first);
+            }
+            break;
+        case GL_TRIANGLE_STRIP:
+            for(GLint i=0; i + 2 < count; ++i) {
+                // Keep the winding of odd triangles
+                AppendVertex(first + i + (i % 2));
+                AppendVertex(first + i + 1 - (i % 2));
+                AppendVertex(first + i + 2);
+            }
+            break;
+        case GL_TRIANGLE_FAN:
+            for(GLint i=1; i + 1 < count; ++i) {
+                AppendVertex(first);
+                AppendVertex(first + i);
+                AppendVertex(first + i + 1);
+            }
+            break;
+        case GL_LINES:
+            count -= count % 2;
+            for(GLint i=0; i < count; ++i) AppendVertex(first + i);
+            break;
+        case GL_TRIANGLES:
+            count -= count % 3;
+            for(GLint i=0; i < count; ++i) AppendVertex(first + i);
+            break;
+        default:
+            for(GLint i=0; i < count; ++i) AppendVertex(first + i);
+            break;
+        }
+    }
+
+    void RestoreClientArray(const ClientArray& a, GLuint location)
+    {
+        if(a.enabled) {
+            glBindBuffer(GL_ARRAY_BUFFER, a.buffer);
+            glVertexAttribPointer(location, a.size, a.type, a.type == GL_UNSIGNED_BYTE ? GL_TRUE : GL_FALSE, a.stride, a.pointer);
+        }else{
+            glDisableVertexAttribArray(location);
+        }
+    }
+
     std::stack<OpenGlMatrix> projection;
     std::stack<OpenGlMatrix> modelview;
     std::stack<OpenGlMatrix>* currentmatrix;
@@ -129,11 +358,29 @@ public:
 
     GlSlProgram  prog_fixed;
 
-    GLint u_color;
     GLint u_modelViewMatrix;
     GLint u_modelViewProjectionMatrix;
     GLint u_texture;
     GLint u_textureEnable;
+
+    // Which uniforms and attributes need uploading before the next draw
+    bool matrices_dirty;
+    bool texturing;
+    bool texturing_dirty;
+    bool color_dirty;
+
+    ClientArray vertex_array;
+    ClientArray color_array;
+    ClientArray normal_array;
+    ClientArray texcoord_array;
+
+    std::vector<BatchVertex> batch;
+    GLenum batch_mode;
+    GLuint batch_vbo;
+
+    // Draws made and draws batched into them, for profiling
+    size_t flushes;
+    size_t batched_draws;
 };
 
 GlEngine& glEngine();
@@ -181,13 +428,13 @@ inline void glEnableClientState(GLenum cap)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
     if(cap == GL_VERTEX_ARRAY) {
-        glEnableVertexAttribArray(pangolin::DEFAULT_LOCATION_POSITION);
+        gl.EnableClientArray(gl.vertex_array, pangolin::DEFAULT_LOCATION_POSITION, true);
     }else if(cap == GL_COLOR_ARRAY) {
-        glEnableVertexAttribArray(pangolin::DEFAULT_LOCATION_COLOUR);
+        gl.EnableClientArray(gl.color_array, pangolin::DEFAULT_LOCATION_COLOUR, true);
     }else if(cap == GL_NORMAL_ARRAY) {
-        glEnableVertexAttribArray(pangolin::DEFAULT_LOCATION_NORMAL);
+        gl.EnableClientArray(gl.normal_array, pangolin::DEFAULT_LOCATION_NORMAL, true);
     }else if(cap == GL_TEXTURE_COORD_ARRAY) {
-        glEnableVertexAttribArray(pangolin::DEFAULT_LOCATION_TEXCOORD);
+        gl.EnableClientArray(gl.texcoord_array, pangolin::DEFAULT_LOCATION_TEXCOORD, true);
         gl.EnableTexturing(true);
     }else{
         pango_print_error("Not Implemented: %s, %s, %d", __FUNCTION__, __FILE__, __LINE__);
@@ -198,13 +445,13 @@ inline void glDisableClientState(GLenum cap)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
     if(cap == GL_VERTEX_ARRAY) {
-        glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_POSITION);
+        gl.EnableClientArray(gl.vertex_array, pangolin::DEFAULT_LOCATION_POSITION, false);
     }else if(cap == GL_COLOR_ARRAY) {
-        glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_COLOUR);
+        gl.EnableClientArray(gl.color_array, pangolin::DEFAULT_LOCATION_COLOUR, false);
     }else if(cap == GL_NORMAL_ARRAY) {
-        glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_NORMAL);
+        gl.EnableClientArray(gl.normal_array, pangolin::DEFAULT_LOCATION_NORMAL, false);
     }else if(cap == GL_TEXTURE_COORD_ARRAY) {
-        glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_TEXCOORD);
+        gl.EnableClientArray(gl.texcoord_array, pangolin::DEFAULT_LOCATION_TEXCOORD, false);
         gl.EnableTexturing(false);
     }else{
         pango_print_error("Not Implemented: %s, %s, %d", __FUNCTION__, __FILE__, __LINE__);
@@ -213,12 +460,26 @@ inline void glDisableClientState(GLenum cap)
 
 inline void glVertexPointer( GLint size, GLenum type, GLsizei stride, const GLvoid * pointer)
 {
-    glVertexAttribPointer(pangolin::DEFAULT_LOCATION_POSITION, size, type, GL_FALSE, stride, pointer);
+    pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.SetClientArray(gl.vertex_array, pangolin::DEFAULT_LOCATION_POSITION, size, type, stride, pointer);
+}
+
+inline void glColorPointer( GLint size, GLenum type, GLsizei stride, const GLvoid * pointer)
+{
+    pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.SetClientArray(gl.color_array, pangolin::DEFAULT_LOCATION_COLOUR, size, type, stride, pointer);
+}
+
+inline void glNormalPointer( GLenum type, GLsizei stride, const GLvoid * pointer)
+{
+    pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.SetClientArray(gl.normal_array, pangolin::DEFAULT_LOCATION_NORMAL, 3, type, stride, pointer);
 }
 
 inline void glTexCoordPointer( GLint size, GLenum type, GLsizei stride, const GLvoid * pointer)
 {
-    glVertexAttribPointer(pangolin::DEFAULT_LOCATION_TEXCOORD, size, type, GL_FALSE, stride, pointer);
+    pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.SetClientArray(gl.texcoord_array, pangolin::DEFAULT_LOCATION_TEXCOORD, size, type, stride, pointer);
 }
 
 inline void glMatrixMode(GLenum mode)
@@ -230,6 +491,7 @@ inline void glMatrixMode(GLenum mode)
 inline void glLoadIdentity()
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     gl.currentmatrix->top() = pangolin::IdentityMatrix();
     gl.UpdateMatrices();
 }
@@ -237,6 +499,7 @@ inline void glLoadIdentity()
 inline void glLoadMatrixf(const GLfloat* m)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     pangolin::GLprecision* cm = gl.currentmatrix->top().m;
     for(int i=0; i<16; ++i) cm[i] = (pangolin::GLprecision)m[i];
     gl.UpdateMatrices();
@@ -245,6 +508,7 @@ inline void glLoadMatrixf(const GLfloat* m)
 inline void glLoadMatrixd(const GLdouble* m)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     pangolin::GLprecision* cm = gl.currentmatrix->top().m;
     for(int i=0; i<16; ++i) cm[i] = (pangolin::GLprecision)m[i];
     gl.UpdateMatrices();
@@ -273,6 +537,7 @@ inline void glPushMatrix(void)
 inline void glPopMatrix(void)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     gl.currentmatrix->pop();
     gl.UpdateMatrices();
 }
@@ -280,6 +545,7 @@ inline void glPopMatrix(void)
 inline void glTranslatef(GLfloat x, GLfloat y, GLfloat z )
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     pangolin::GLprecision* cm = gl.currentmatrix->top().m;
     cm[12] += x;
     cm[13] += y;
@@ -293,6 +559,7 @@ inline void glOrtho(
     GLdouble n, GLdouble f)
 {
     pangolin::GlEngine& gl = pangolin::glEngine();
+    gl.Flush();
     gl.currentmatrix->top() = pangolin::ProjectionMatrixOrthographic(l,r,b,t,n,f);
     gl.UpdateMatrices();
 }
@@ -318,3 +585,55 @@ inline void glTexEnvf(	GLenum target,
 {
     pango_print_error("Not Implemented: %s, %s, %d", __FUNCTION__, __FILE__, __LINE__);
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Draws go through GlEngine's batching, which is flushed ahead of calls
+// changing how batched draws would be drawn, or reading what was drawn
+///////////////////////////////////////////////////////////////////////////////
+
+inline void pango_glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    pangolin::glEngine().DrawArrays(mode, first, count);
+}
+
+inline void pango_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+{
+    pangolin::glEngine().DrawElements(mode, count, type, indices);
+}
+
+#define PANGO_GL_FLUSH_BEFORE(fn, params, args) \
+    inline void pango_##fn params { pangolin::glEngine().Flush(); fn args; }
+
+PANGO_GL_FLUSH_BEFORE(glClear, (GLbitfield mask), (mask))
+PANGO_GL_FLUSH_BEFORE(glEnable, (GLenum cap), (cap))
+PANGO_GL_FLUSH_BEFORE(glDisable, (GLenum cap), (cap))
+PANGO_GL_FLUSH_BEFORE(glBlendFunc, (GLenum s, GLenum d), (s, d))
+PANGO_GL_FLUSH_BEFORE(glDepthFunc, (GLenum func), (func))
+PANGO_GL_FLUSH_BEFORE(glDepthMask, (GLboolean flag), (flag))
+PANGO_GL_FLUSH_BEFORE(glColorMask, (GLboolean r, GLboolean g, GLboolean b, GLboolean a), (r, g, b, a))
+PANGO_GL_FLUSH_BEFORE(glLineWidth, (GLfloat width), (width))
+PANGO_GL_FLUSH_BEFORE(glViewport, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h))
+PANGO_GL_FLUSH_BEFORE(glScissor, (GLint x, GLint y, GLsizei w, GLsizei h), (x, y, w, h))
+PANGO_GL_FLUSH_BEFORE(glBindFramebuffer, (GLenum target, GLuint fb), (target, fb))
+PANGO_GL_FLUSH_BEFORE(glReadPixels, (GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLvoid* data), (x, y, w, h, format, type, data))
+PANGO_GL_FLUSH_BEFORE(glFlush, (), ())
+PANGO_GL_FLUSH_BEFORE(glFinish, (), ())
+
+#undef PANGO_GL_FLUSH_BEFORE
+
+#define glDrawArrays        pango_glDrawArrays
+#define glDrawElements      pango_glDrawElements
+#define glClear             pango_glClear
+#define glEnable            pango_glEnable
+#define glDisable           pango_glDisable
+#define glBlendFunc         pango_glBlendFunc
+#define glDepthFunc         pango_glDepthFunc
+#define glDepthMask         pango_glDepthMask
+#define glColorMask         pango_glColorMask
+#define glLineWidth         pango_glLineWidth
+#define glViewport          pango_glViewport
+#define glScissor           pango_glScissor
+#define glBindFramebuffer   pango_glBindFramebuffer
+#define glReadPixels        pango_glReadPixels
+#define glFlush             pango_glFlush
+#define glFinish            pango_glFinish
@@ -29,6 +29,7 @@
 
 #include <pangolin/display/viewport.h>
 #include <pangolin/gl/glinclude.h>
+#include <pangolin/gl/glstate.h>
 #include <pangolin/image/image_io.h>
 
 #if defined(HAVE_EIGEN) && !defined(__CUDACC__) //prevent including Eigen in cuda files
@@ -39,9 +40,12 @@
 #include <Eigen/Core>
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <math.h>
+#include <vector>
 
 namespace pangolin
 {
@@ -168,7 +172,9 @@ enum GlBufferType
 #ifndef HAVE_GLES
     GlPixelPackBuffer = GL_PIXEL_PACK_BUFFER,           // PBO's
     GlPixelUnpackBuffer = GL_PIXEL_UNPACK_BUFFER,
-    GlShaderStorageBuffer = GL_SHADER_STORAGE_BUFFER
+    GlShaderStorageBuffer = GL_SHADER_STORAGE_BUFFER,
+    GlUniformBuffer = GL_UNIFORM_BUFFER,
+    GlDrawIndirectBuffer = GL_DRAW_INDIRECT_BUFFER      // glMultiDraw*Indirect commands
 #endif
 };
 
@@ -208,6 +214,55 @@ private:
     GlBuffer(const GlBuffer&) {}
 };
 
+//! Texture streamed from client memory through a ring of pixel unpack
+//! buffers (persistently mapped where ARB_buffer_storage is available).
+//! Upload returns once the image has been copied into the next buffer, and
+//! the transfer into the texture overlaps rendering rather than stalling on
+//! client memory. Images smaller than min_stream_bytes are uploaded directly.
+class PANGOLIN_EXPORT GlStreamingTexture : public GlTexture
+{
+public:
+    static const size_t default_num_buffers = 3;
+    static const size_t default_min_stream_bytes = 256*1024;
+
+    GlStreamingTexture();
+    GlStreamingTexture(GLint width, GLint height, GLint internal_format = GL_RGBA8, bool sampling_linear = true, int border = 0, GLenum glformat = GL_RGBA, GLenum gltype = GL_UNSIGNED_BYTE, GLvoid* data = NULL );
+    ~GlStreamingTexture();
+
+    void Reinitialise(GLsizei width, GLsizei height, GLint internal_format = GL_RGBA8, bool sampling_linear = true, int border = 0, GLenum glformat = GL_RGBA, GLenum gltype = GL_UNSIGNED_BYTE, GLvoid* data = NULL ) override;
+
+    //! Ring size (0 to always upload directly) and smallest image to stream
+    void SetStreaming(size_t num_buffers, size_t min_stream_bytes = default_min_stream_bytes);
+
+    using GlTexture::Upload;
+
+    //! As GlTexture::Upload, respecting GL_UNPACK_ROW_LENGTH and GL_UNPACK_ALIGNMENT.
+    //! image may be reused as soon as this returns.
+    void Upload(const void* image, GLenum data_format = GL_LUMINANCE, GLenum data_type = GL_FLOAT);
+
+private:
+    struct StreamBuffer
+    {
+        GlBuffer pbo;
+        void* mapped = nullptr;
+        void* fence = nullptr;
+    };
+
+    void AllocateBuffers(size_t size_bytes);
+    void ReleaseBuffers();
+
+    size_t num_buffers;
+    size_t min_stream_bytes;
+    size_t buffer_bytes;
+    size_t next_buffer;
+    bool persistent;
+    std::vector<StreamBuffer> buffers;
+};
+
+//! Buffer of elements appended over time, growing geometrically as needed
+//! (with the existing contents copied on the GPU). In ring mode it instead
+//! keeps only the most recent elements, starting from start() and wrapping
+//! around the end of the buffer.
 class PANGOLIN_EXPORT GlSizeableBuffer
         : public pangolin::GlBuffer
 {
@@ -215,15 +270,35 @@ public:
     GlSizeableBuffer(pangolin::GlBufferType buffer_type, GLuint initial_num_elements, GLenum datatype, GLuint count_per_element, GLenum gluse = GL_DYNAMIC_DRAW );
     
     void Clear();
+
+    //! Keep at most capacity elements, overwriting the oldest once full.
+    //! 0 returns to growing without bound. Clears the buffer.
+    void SetRing(size_t capacity);
+
+    bool IsRing() const;
+
+    //! Append num_elements packed elements with a single upload
+    void Append(const void* data, size_t num_elements);
+
+#ifndef HAVE_GLES
+    //! Map space at the end of the buffer for up to num_elements elements
+    //! to be written in place, then EndAppend with the number written.
+    //! In ring mode num_elements is reduced to the space before the buffer
+    //! wraps; call again for the rest.
+    void* BeginAppend(size_t& num_elements);
+    void EndAppend(size_t num_written);
+#endif
     
 #ifdef USE_EIGEN
     template<typename Derived>
     void Add(const Eigen::DenseBase<Derived>& vec);
     
+    //! Overwrite elements from storage index position (not meant for ring mode)
     template<typename Derived>
     void Update(const Eigen::DenseBase<Derived>& vec, size_t position = 0);
 #endif
     
+    //! Storage index of the oldest element
     size_t start() const;
     
     size_t size() const;
@@ -232,14 +307,34 @@ protected:
     void CheckResize(size_t num_verts);
     
     size_t NextSize(size_t min_size) const;
+
+    size_t ElementBytes() const;
+
+    // Storage index the next element is appended at
+    size_t AppendPosition() const;
+
+    void Commit(size_t position, size_t num_elements);
     
     size_t  m_num_verts;    
+    size_t  m_ring_capacity;
+    size_t  m_ring_start;
+
+    // Elements from here on have never been written since allocation, so no
+    // previous draw can still be reading them
+    size_t  m_fresh_from;
+
+    size_t  m_map_position;
+    size_t  m_map_elements;
 };
 
 size_t GlFormatChannels(GLenum data_layout);
 
 size_t GlDataTypeBytes(GLenum type);
 
+//! Bytes of pixel data sent through GlTexture uploads since startup, for
+//! measuring upload bandwidth. Rows are assumed tightly packed.
+std::atomic<uint64_t>& GlTextureUploadBytes();
+
 }
 
 // Include implementation
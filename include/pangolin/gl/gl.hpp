@@ -32,6 +32,7 @@
 #include <pangolin/display/display.h>
 #include <pangolin/image/image_io.h>
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 namespace pangolin
@@ -95,6 +96,24 @@ inline size_t GlFormatChannels(GLenum data_layout)
     return format_channels[data_layout - GL_RED];
 }
 
+inline std::atomic<uint64_t>& GlTextureUploadBytes()
+{
+    static std::atomic<uint64_t> bytes(0);
+    return bytes;
+}
+
+inline void GlCountTextureUpload(GLsizei w, GLsizei h, GLenum data_format, GLenum data_type)
+{
+    size_t channels = 4;
+    if(GL_RED <= data_format && data_format <= GL_LUMINANCE_ALPHA) {
+        channels = GlFormatChannels(data_format);
+    }else if(data_format == GL_BGR) {
+        channels = 3;
+    }
+    const size_t type_bytes = (GL_BYTE <= data_type && data_type <= GL_DOUBLE) ? GlDataTypeBytes(data_type) : 2;
+    GlTextureUploadBytes().fetch_add((uint64_t)w * h * channels * type_bytes, std::memory_order_relaxed);
+}
+
 //template<typename T>
 //struct GlDataTypeTrait {};
 //template<> struct GlDataTypeTrait<float>{ static const GLenum type = GL_FLOAT; };
@@ -135,6 +154,7 @@ inline void GlTexture::Delete()
 {
     // We have no GL context whilst exiting.
     if(internal_format!=0 && !pangolin::ShouldQuit() ) {
+        GlStateCache::I().TextureDeleted(tid);
         glDeleteTextures(1,&tid);
         internal_format = 0;
         tid = 0;
@@ -147,23 +167,25 @@ inline GlTexture::~GlTexture()
 {
     // We have no GL context whilst exiting.
     if(internal_format!=0 && !pangolin::ShouldQuit() ) {
+        GlStateCache::I().TextureDeleted(tid);
         glDeleteTextures(1,&tid);
     }
 }
 
 inline void GlTexture::Bind() const
 {
-    glBindTexture(GL_TEXTURE_2D, tid);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D, tid);
 }
 
 inline void GlTexture::Unbind() const
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D, 0);
 }
 
 inline void GlTexture::Reinitialise(GLsizei w, GLsizei h, GLint int_format, bool sampling_linear, int border, GLenum glformat, GLenum gltype, GLvoid* data )
 {
     if(tid!=0) {
+        GlStateCache::I().TextureDeleted(tid);
         glDeleteTextures(1,&tid);
     }
 
@@ -177,6 +199,9 @@ inline void GlTexture::Reinitialise(GLsizei w, GLsizei h, GLint int_format, bool
     // GL_LUMINANCE and GL_FLOAT don't seem to actually affect buffer, but some values are required
     // for call to succeed.
     glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, border, glformat, gltype, data);
+    if(data) {
+        GlCountTextureUpload(width, height, glformat, gltype);
+    }
 
     if(sampling_linear) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -198,6 +223,7 @@ inline void GlTexture::Upload(
 ) {
     Bind();
     glTexSubImage2D(GL_TEXTURE_2D,0,0,0,width,height,data_format,data_type,data);
+    GlCountTextureUpload(width, height, data_format, data_type);
     CheckGlDieOnError();
 }
 
@@ -209,6 +235,7 @@ inline void GlTexture::Upload(
 {
     Bind();
     glTexSubImage2D(GL_TEXTURE_2D,0,tex_x_offset,tex_y_offset,data_w,data_h,data_format,data_type,data);
+    GlCountTextureUpload(data_w, data_h, data_format, data_type);
     CheckGlDieOnError();
 }
 
@@ -325,7 +352,7 @@ inline void GlTexture::RenderToViewport() const
     glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     Bind();
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -333,7 +360,7 @@ inline void GlTexture::RenderToViewport() const
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
 }
 
 inline void GlTexture::RenderToViewport(Viewport tex_vp, bool flipx, bool flipy) const
@@ -359,7 +386,7 @@ inline void GlTexture::RenderToViewport(Viewport tex_vp, bool flipx, bool flipy)
     glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     Bind();
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -367,7 +394,7 @@ inline void GlTexture::RenderToViewport(Viewport tex_vp, bool flipx, bool flipy)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
 }
 
 inline void GlTexture::RenderToViewportFlipY() const
@@ -385,7 +412,7 @@ inline void GlTexture::RenderToViewportFlipY() const
     glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     Bind();
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -393,7 +420,7 @@ inline void GlTexture::RenderToViewportFlipY() const
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
 }
 
 inline void GlTexture::RenderToViewportFlipXFlipY() const
@@ -411,7 +438,7 @@ inline void GlTexture::RenderToViewportFlipXFlipY() const
     glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     Bind();
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -419,7 +446,7 @@ inline void GlTexture::RenderToViewportFlipXFlipY() const
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -461,12 +488,13 @@ inline GlRenderBuffer::~GlRenderBuffer()
 inline void GlRenderBuffer::Reinitialise(GLint width, GLint height, GLint internal_format)
 {
     if( width!=0 ) {
+        GlStateCache::I().TextureDeleted(rbid);
         glDeleteTextures(1, &rbid);
     }
 
     // Use a texture instead...
     glGenTextures(1, &rbid);
-    glBindTexture(GL_TEXTURE_2D, rbid);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D, rbid);
 
     glTexImage2D(GL_TEXTURE_2D, 0, internal_format,
             width, height,
@@ -482,6 +510,7 @@ inline GlRenderBuffer::~GlRenderBuffer()
 {
     // We have no GL context whilst exiting.
     if( width!=0 && !pangolin::ShouldQuit() ) {
+        GlStateCache::I().TextureDeleted(rbid);
         glDeleteTextures(1, &rbid);
     }
 }
@@ -644,16 +673,29 @@ inline void GlBuffer::Resize(GLuint new_num_elements)
 {
     if(bo!=0) {
 #ifndef HAVE_GLES
-        // Backup current data, reinit memory, restore old data
+        // Copy current data aside on the GPU, reinit memory, copy it back.
+        // bo is kept so that vertex array objects referring to it stay valid.
         const size_t backup_elements = std::min(new_num_elements,num_elements);
         const size_t backup_size_bytes = backup_elements*GlDataTypeBytes(datatype)*count_per_element;
-        unsigned char* backup = new unsigned char[backup_size_bytes];
+        GLuint backup = 0;
+        if(backup_size_bytes) {
+            glGenBuffers(1, &backup);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, backup);
+            glBufferData(GL_COPY_WRITE_BUFFER, backup_size_bytes, 0, GL_STREAM_COPY);
+            glBindBuffer(GL_COPY_READ_BUFFER, bo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, backup_size_bytes);
+        }
         Bind();
-        glGetBufferSubData(buffer_type, 0, backup_size_bytes, backup);
         glBufferData(buffer_type, new_num_elements*GlDataTypeBytes(datatype)*count_per_element, 0, gluse);
-        glBufferSubData(buffer_type, 0, backup_size_bytes, backup);
         Unbind();
-        delete[] backup;
+        if(backup_size_bytes) {
+            glBindBuffer(GL_COPY_READ_BUFFER, backup);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, bo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, backup_size_bytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &backup);
+        }
 #else
         throw std::exception();
 #endif
@@ -696,8 +738,160 @@ inline void GlBuffer::Download(GLvoid* data, GLsizeiptr size_bytes, GLintptr off
 
 ////////////////////////////////////////////////////////////////////////////
 
+inline GlStreamingTexture::GlStreamingTexture()
+    : num_buffers(default_num_buffers), min_stream_bytes(default_min_stream_bytes),
+      buffer_bytes(0), next_buffer(0), persistent(false)
+{
+}
+
+inline GlStreamingTexture::GlStreamingTexture(GLint width, GLint height, GLint internal_format, bool sampling_linear, int border, GLenum glformat, GLenum gltype, GLvoid* data )
+    : num_buffers(default_num_buffers), min_stream_bytes(default_min_stream_bytes),
+      buffer_bytes(0), next_buffer(0), persistent(false)
+{
+    Reinitialise(width, height, internal_format, sampling_linear, border, glformat, gltype, data);
+}
+
+inline GlStreamingTexture::~GlStreamingTexture()
+{
+    ReleaseBuffers();
+}
+
+inline void GlStreamingTexture::Reinitialise(GLsizei w, GLsizei h, GLint int_format, bool sampling_linear, int border, GLenum glformat, GLenum gltype, GLvoid* data )
+{
+    GlTexture::Reinitialise(w, h, int_format, sampling_linear, border, glformat, gltype, data);
+    ReleaseBuffers();
+}
+
+inline void GlStreamingTexture::SetStreaming(size_t num_buffers, size_t min_stream_bytes)
+{
+    ReleaseBuffers();
+    this->num_buffers = num_buffers;
+    this->min_stream_bytes = min_stream_bytes;
+}
+
+inline void GlStreamingTexture::ReleaseBuffers()
+{
+#ifndef HAVE_GLES
+    for(StreamBuffer& b : buffers) {
+        if(b.fence) {
+            glDeleteSync((GLsync)b.fence);
+        }
+        if(b.mapped) {
+            b.pbo.Bind();
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            b.pbo.Unbind();
+        }
+    }
+#endif
+    buffers.clear();
+    buffer_bytes = 0;
+    next_buffer = 0;
+}
+
+inline void GlStreamingTexture::AllocateBuffers(size_t size_bytes)
+{
+    ReleaseBuffers();
+#ifndef HAVE_GLES
+    persistent = false;
+#if defined(HAVE_GLEW) && defined(GL_ARB_buffer_storage)
+    persistent = GLEW_ARB_buffer_storage;
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+#endif
+
+    buffers.resize(num_buffers);
+    for(StreamBuffer& b : buffers) {
+#if defined(HAVE_GLEW) && defined(GL_ARB_buffer_storage)
+        if(persistent) {
+            // Immutable storage, mapped once for the life of the buffer
+            b.pbo.buffer_type = GlPixelUnpackBuffer;
+            b.pbo.gluse = GL_STREAM_DRAW;
+            b.pbo.datatype = GL_UNSIGNED_BYTE;
+            b.pbo.num_elements = (GLuint)size_bytes;
+            b.pbo.count_per_element = 1;
+            glGenBuffers(1, &b.pbo.bo);
+            b.pbo.Bind();
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size_bytes, 0, flags);
+            b.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size_bytes, flags);
+            b.pbo.Unbind();
+            continue;
+        }
+#endif
+        b.pbo.Reinitialise(GlPixelUnpackBuffer, (GLuint)size_bytes, GL_UNSIGNED_BYTE, 1, GL_STREAM_DRAW);
+    }
+    buffer_bytes = size_bytes;
+    CheckGlDieOnError();
+#endif
+}
+
+inline void GlStreamingTexture::Upload(const void* image, GLenum data_format, GLenum data_type)
+{
+#ifndef HAVE_GLES
+    // Bytes glTexSubImage2D reads for the current unpack state
+    GLint row_length = 0;
+    GLint alignment = 4;
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    const size_t channels = data_format == GL_BGR ? 3 : (data_format == GL_BGRA ? 4 : GlFormatChannels(data_format));
+    const size_t pix_bytes = channels * GlDataTypeBytes(data_type);
+    const size_t row_bytes = ((row_length > 0 ? row_length : width) * pix_bytes + alignment - 1) / alignment * alignment;
+    const size_t size_bytes = row_bytes * (height - 1) + width * pix_bytes;
+
+    if(num_buffers == 0 || size_bytes < min_stream_bytes || height == 0) {
+        GlTexture::Upload(image, data_format, data_type);
+        return;
+    }
+
+    if(buffer_bytes != size_bytes) {
+        AllocateBuffers(size_bytes);
+    }
+
+    StreamBuffer& b = buffers[next_buffer];
+    next_buffer = (next_buffer + 1) % buffers.size();
+
+    b.pbo.Bind();
+    void* dst = b.mapped;
+    if(dst) {
+        // With num_buffers in flight this almost never has to wait
+        if(b.fence) {
+            glClientWaitSync((GLsync)b.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync((GLsync)b.fence);
+            b.fence = nullptr;
+        }
+    }else{
+        // Orphan the storage the driver may still be reading rather than wait for it
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size_bytes, 0, GL_STREAM_DRAW);
+        dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+
+    if(!dst) {
+        b.pbo.Unbind();
+        GlTexture::Upload(image, data_format, data_type);
+        return;
+    }
+
+    std::memcpy(dst, image, size_bytes);
+    if(!b.mapped) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    Bind();
+    glTexSubImage2D(GL_TEXTURE_2D,0,0,0,width,height,data_format,data_type,0);
+    GlTextureUploadBytes().fetch_add(size_bytes, std::memory_order_relaxed);
+    if(b.mapped) {
+        b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    b.pbo.Unbind();
+    CheckGlDieOnError();
+#else
+    GlTexture::Upload(image, data_format, data_type);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////
+
 inline GlSizeableBuffer::GlSizeableBuffer(GlBufferType buffer_type, GLuint initial_num_elements, GLenum datatype, GLuint count_per_element, GLenum gluse )
-    : GlBuffer(buffer_type, initial_num_elements, datatype, count_per_element, gluse), m_num_verts(0)
+    : GlBuffer(buffer_type, initial_num_elements, datatype, count_per_element, gluse), m_num_verts(0),
+      m_ring_capacity(0), m_ring_start(0), m_fresh_from(0), m_map_position(0), m_map_elements(0)
 {
 
 }
@@ -705,19 +899,124 @@ inline GlSizeableBuffer::GlSizeableBuffer(GlBufferType buffer_type, GLuint initi
 inline void GlSizeableBuffer::Clear()
 {
     m_num_verts = 0;
+    m_ring_start = 0;
+}
+
+inline void GlSizeableBuffer::SetRing(size_t capacity)
+{
+    if(capacity && capacity != GlBuffer::num_elements) {
+        GlBuffer::Reinitialise(buffer_type, (GLuint)capacity, datatype, count_per_element, gluse);
+        m_fresh_from = 0;
+    }
+    m_ring_capacity = capacity;
+    Clear();
+}
+
+inline bool GlSizeableBuffer::IsRing() const
+{
+    return m_ring_capacity != 0;
+}
+
+inline size_t GlSizeableBuffer::ElementBytes() const
+{
+    return GlDataTypeBytes(datatype) * count_per_element;
 }
 
+inline size_t GlSizeableBuffer::AppendPosition() const
+{
+    return m_ring_capacity ? (m_ring_start + m_num_verts) % m_ring_capacity : m_num_verts;
+}
+
+inline void GlSizeableBuffer::Commit(size_t position, size_t num_elements)
+{
+    m_fresh_from = std::max(m_fresh_from, position + num_elements);
+    const size_t total = m_num_verts + num_elements;
+    if(m_ring_capacity && total > m_ring_capacity) {
+        m_ring_start = (m_ring_start + total - m_ring_capacity) % m_ring_capacity;
+        m_num_verts = m_ring_capacity;
+    }else{
+        m_num_verts = total;
+    }
+}
+
+inline void GlSizeableBuffer::Append(const void* data, size_t num_elements)
+{
+    const unsigned char* src = (const unsigned char*)data;
+    const size_t element_bytes = ElementBytes();
+
+    if(m_ring_capacity) {
+        if(num_elements > m_ring_capacity) {
+            // Only the newest capacity elements would survive
+            src += (num_elements - m_ring_capacity) * element_bytes;
+            num_elements = m_ring_capacity;
+            Clear();
+        }
+        // At most two uploads, either side of the wrap
+        while(num_elements) {
+            const size_t position = AppendPosition();
+            const size_t n = std::min(num_elements, m_ring_capacity - position);
+            Upload(src, n * element_bytes, position * element_bytes);
+            Commit(position, n);
+            src += n * element_bytes;
+            num_elements -= n;
+        }
+    }else if(num_elements) {
+        CheckResize(m_num_verts + num_elements);
+        Upload(src, num_elements * element_bytes, m_num_verts * element_bytes);
+        Commit(m_num_verts, num_elements);
+    }
+}
+
+#ifndef HAVE_GLES
+inline void* GlSizeableBuffer::BeginAppend(size_t& num_elements)
+{
+    if(m_ring_capacity) {
+        num_elements = std::min(num_elements, m_ring_capacity - AppendPosition());
+    }else{
+        CheckResize(m_num_verts + num_elements);
+    }
+    m_map_position = AppendPosition();
+    m_map_elements = num_elements;
+    if(!num_elements) {
+        return nullptr;
+    }
+
+    // Nothing in flight can be drawing from storage that was never written
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+    if(m_map_position >= m_fresh_from) {
+        access |= GL_MAP_UNSYNCHRONIZED_BIT;
+    }
+
+    const size_t element_bytes = ElementBytes();
+    Bind();
+    void* ptr = glMapBufferRange(buffer_type, m_map_position * element_bytes, num_elements * element_bytes, access);
+    Unbind();
+    return ptr;
+}
+
+inline void GlSizeableBuffer::EndAppend(size_t num_written)
+{
+    if(!m_map_elements) {
+        return;
+    }
+    Bind();
+    glUnmapBuffer(buffer_type);
+    Unbind();
+    Commit(m_map_position, std::min(num_written, m_map_elements));
+    m_map_elements = 0;
+}
+#endif
+
 #ifdef USE_EIGEN
 template<typename Derived> inline
 void GlSizeableBuffer::Add(const Eigen::DenseBase<Derived>& vec)
 {
     typedef typename Eigen::DenseBase<Derived>::Scalar Scalar;
     assert(vec.rows()==GlBuffer::count_per_element);
-    CheckResize(m_num_verts + 1);
+    assert(sizeof(Scalar)*vec.rows() == ElementBytes());
     // TODO: taking address of first element is really dodgey. Need to work out
     // when this is okay!
-    Upload(&vec(0,0), sizeof(Scalar)*vec.rows()*vec.cols(), sizeof(Scalar)*vec.rows()*m_num_verts);
-    m_num_verts += vec.cols();
+    Append(&vec(0,0), vec.cols());
 }
 
 template<typename Derived> inline
@@ -730,11 +1029,12 @@ void GlSizeableBuffer::Update(const Eigen::DenseBase<Derived>& vec, size_t posit
     // when this is okay!
     Upload(&vec(0,0), sizeof(Scalar)*vec.rows()*vec.cols(), sizeof(Scalar)*vec.rows()*position );
     m_num_verts = std::max(position+vec.cols(), m_num_verts);
+    m_fresh_from = std::max(m_fresh_from, position+vec.cols());
 }
 #endif
 
 inline size_t GlSizeableBuffer::start() const {
-    return 0;
+    return m_ring_capacity ? m_ring_start : 0;
 }
 
 inline size_t GlSizeableBuffer::size() const {
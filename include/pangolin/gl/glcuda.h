@@ -28,6 +28,8 @@
 #pragma once
 
 #include <algorithm>
+#include <initializer_list>
+#include <vector>
 #include <cuda_runtime.h>
 #include <cuda_gl_interop.h>
 
@@ -76,12 +78,16 @@ struct GlTextureCudaArray : GlTexture
     cudaGraphicsResource* cuda_res;
 };
 
+// Map buffer for access by CUDA on stream. GL commands issued before
+// mapping complete before work on stream, and work on stream before unmapping
+// completes before GL commands issued after.
 struct CudaScopedMappedPtr
 {
-    CudaScopedMappedPtr(const GlBufferCudaPtr& buffer);
+    CudaScopedMappedPtr(const GlBufferCudaPtr& buffer, cudaStream_t stream = 0);
     ~CudaScopedMappedPtr();
     void* operator*();
     cudaGraphicsResource* res;
+    cudaStream_t stream;
     
 private:
     CudaScopedMappedPtr(const CudaScopedMappedPtr&) {}
@@ -89,15 +95,56 @@ private:
 
 struct CudaScopedMappedArray
 {
-    CudaScopedMappedArray(const GlTextureCudaArray& tex);
+    CudaScopedMappedArray(const GlTextureCudaArray& tex, cudaStream_t stream = 0);
     ~CudaScopedMappedArray();
     cudaArray* operator*();
     cudaGraphicsResource* res;
+    cudaStream_t stream;
     
 private:
     CudaScopedMappedArray(const CudaScopedMappedArray&) {}
 };
 
+// Map several buffers and textures on stream with a single
+// cudaGraphicsMapResources call, rather than synchronizing with GL once per
+// resource. Ptr(i) / Array(i) access the i'th buffer / texture.
+struct CudaScopedMappedResources
+{
+    CudaScopedMappedResources(
+        std::initializer_list<const GlBufferCudaPtr*> buffers,
+        std::initializer_list<const GlTextureCudaArray*> textures = {},
+        cudaStream_t stream = 0
+    );
+    ~CudaScopedMappedResources();
+    void* Ptr(size_t i);
+    cudaArray* Array(size_t i);
+    std::vector<cudaGraphicsResource*> res;
+    size_t num_buffers;
+    cudaStream_t stream;
+
+private:
+    CudaScopedMappedResources(const CudaScopedMappedResources&) {}
+};
+
+// Pair of interop objects (GlBufferCudaPtr or GlTextureCudaArray) so that
+// CUDA can map and write Back() for frame N+1 while GL draws Front() from
+// frame N, neither waiting on the other. Call Swap() after Back() is unmapped.
+template<typename Interop>
+struct GlCudaDoubleBuffered
+{
+    GlCudaDoubleBuffered();
+
+    template<typename... Args>
+    void Reinitialise(const Args&... args);
+
+    Interop& Front();
+    Interop& Back();
+    void Swap();
+
+    Interop objects[2];
+    size_t front;
+};
+
 void CopyPboToTex(GlBufferCudaPtr& buffer, GlTexture& tex);
 
 void swap(GlBufferCudaPtr& a, GlBufferCudaPtr& b);
@@ -194,15 +241,15 @@ inline void GlTextureCudaArray::Reinitialise(int width, int height, GLint intern
     }
 }
 
-inline CudaScopedMappedPtr::CudaScopedMappedPtr(const GlBufferCudaPtr& buffer)
-    : res(buffer.cuda_res)
+inline CudaScopedMappedPtr::CudaScopedMappedPtr(const GlBufferCudaPtr& buffer, cudaStream_t stream)
+    : res(buffer.cuda_res), stream(stream)
 {
-    cudaGraphicsMapResources(1, &res, 0);
+    cudaGraphicsMapResources(1, &res, stream);
 }
 
 inline CudaScopedMappedPtr::~CudaScopedMappedPtr()
 {
-    cudaGraphicsUnmapResources(1, &res, 0);
+    cudaGraphicsUnmapResources(1, &res, stream);
 }
 
 inline void* CudaScopedMappedPtr::operator*()
@@ -213,15 +260,15 @@ inline void* CudaScopedMappedPtr::operator*()
     return d_ptr;
 }
 
-inline CudaScopedMappedArray::CudaScopedMappedArray(const GlTextureCudaArray& tex)
-    : res(tex.cuda_res)
+inline CudaScopedMappedArray::CudaScopedMappedArray(const GlTextureCudaArray& tex, cudaStream_t stream)
+    : res(tex.cuda_res), stream(stream)
 {
-    cudaGraphicsMapResources(1, &res);
+    cudaGraphicsMapResources(1, &res, stream);
 }
 
 inline CudaScopedMappedArray::~CudaScopedMappedArray()
 {
-    cudaGraphicsUnmapResources(1, &res);
+    cudaGraphicsUnmapResources(1, &res, stream);
 }
 
 inline cudaArray* CudaScopedMappedArray::operator*()
@@ -231,6 +278,75 @@ inline cudaArray* CudaScopedMappedArray::operator*()
     return array;
 }
 
+inline CudaScopedMappedResources::CudaScopedMappedResources(
+    std::initializer_list<const GlBufferCudaPtr*> buffers,
+    std::initializer_list<const GlTextureCudaArray*> textures,
+    cudaStream_t stream
+    ) : num_buffers(buffers.size()), stream(stream)
+{
+    res.reserve(buffers.size() + textures.size());
+    for(const GlBufferCudaPtr* b : buffers) res.push_back(b->cuda_res);
+    for(const GlTextureCudaArray* t : textures) res.push_back(t->cuda_res);
+    if(!res.empty()) {
+        cudaGraphicsMapResources((int)res.size(), res.data(), stream);
+    }
+}
+
+inline CudaScopedMappedResources::~CudaScopedMappedResources()
+{
+    if(!res.empty()) {
+        cudaGraphicsUnmapResources((int)res.size(), res.data(), stream);
+    }
+}
+
+inline void* CudaScopedMappedResources::Ptr(size_t i)
+{
+    size_t num_bytes;
+    void* d_ptr;
+    cudaGraphicsResourceGetMappedPointer(&d_ptr, &num_bytes, res[i]);
+    return d_ptr;
+}
+
+inline cudaArray* CudaScopedMappedResources::Array(size_t i)
+{
+    cudaArray* array;
+    cudaGraphicsSubResourceGetMappedArray(&array, res[num_buffers + i], 0, 0);
+    return array;
+}
+
+template<typename Interop>
+inline GlCudaDoubleBuffered<Interop>::GlCudaDoubleBuffered()
+    : front(0)
+{
+}
+
+template<typename Interop>
+template<typename... Args>
+inline void GlCudaDoubleBuffered<Interop>::Reinitialise(const Args&... args)
+{
+    objects[0].Reinitialise(args...);
+    objects[1].Reinitialise(args...);
+    front = 0;
+}
+
+template<typename Interop>
+inline Interop& GlCudaDoubleBuffered<Interop>::Front()
+{
+    return objects[front];
+}
+
+template<typename Interop>
+inline Interop& GlCudaDoubleBuffered<Interop>::Back()
+{
+    return objects[1 - front];
+}
+
+template<typename Interop>
+inline void GlCudaDoubleBuffered<Interop>::Swap()
+{
+    front = 1 - front;
+}
+
 inline void CopyPboToTex(const GlBufferCudaPtr& buffer, GlTexture& tex, GLenum buffer_layout, GLenum buffer_data_type )
 {
     buffer.Bind();
@@ -241,10 +357,10 @@ inline void CopyPboToTex(const GlBufferCudaPtr& buffer, GlTexture& tex, GLenum b
 }
 
 template<typename T>
-inline void CopyDevMemtoTex(T* d_img, size_t pitch, GlTextureCudaArray& tex )
+inline void CopyDevMemtoTex(T* d_img, size_t pitch, GlTextureCudaArray& tex, cudaStream_t stream = 0 )
 {
-    CudaScopedMappedArray arr_tex(tex);
-    cudaMemcpy2DToArray(*arr_tex, 0, 0, d_img, pitch, tex.width*sizeof(T), tex.height, cudaMemcpyDeviceToDevice );
+    CudaScopedMappedArray arr_tex(tex, stream);
+    cudaMemcpy2DToArrayAsync(*arr_tex, 0, 0, d_img, pitch, tex.width*sizeof(T), tex.height, cudaMemcpyDeviceToDevice, stream );
 }
 
 inline void swap(GlBufferCudaPtr& a, GlBufferCudaPtr& b)
@@ -0,0 +1,97 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/image.h>
+#include <pangolin/image/pixel_format.h>
+
+namespace pangolin
+{
+
+//! Pinhole intrinsics of a depth image, in pixels
+struct PANGOLIN_EXPORT DepthIntrinsics
+{
+    DepthIntrinsics(float fx = 1.0f, float fy = 1.0f, float cx = 0.0f, float cy = 0.0f)
+        : fx(fx), fy(fy), cx(cx), cy(cy)
+    {
+    }
+
+    float fx, fy, cx, cy;
+};
+
+//! Back-projects depth images into vertex, normal and colour buffers on the
+//! GPU with a GLSL compute shader, so only the images themselves are
+//! uploaded each frame. Points are in the camera frame (x right, y down,
+//! z forward); pixels without depth become NaN vertices and are not drawn.
+//! Draw with Render(), or RenderVboIboCboNbo(vbo, ibo, cbo, nbo).
+//! Requires OpenGL 4.3 (compute shaders and shader storage buffers).
+class PANGOLIN_EXPORT GlDepthCloud
+{
+public:
+    GlDepthCloud();
+
+    //! True iff the current context supports the compute shader
+    bool IsAvailable();
+
+    //! Generate the cloud from single channel texture depth, whose sampled
+    //! values multiplied by depth_scale give depth (normalised, i.e. in
+    //! [0,1], for integer textures). colour, when given, is sampled over
+    //! the same field of view. Returns false if not available.
+    bool Process(const GlTexture& depth, const DepthIntrinsics& K, float depth_scale = 1.0f, const GlTexture* colour = nullptr);
+
+    //! As above, first uploading depth (e.g. a depth stream from VideoInput)
+    //! of GRAY16LE or GRAY32F format, whose values multiplied by depth_scale
+    //! give depth (e.g. 0.001 for millimetres to metres).
+    bool Process(const Image<unsigned char>& depth, const PixelFormat& fmt, const DepthIntrinsics& K, float depth_scale = 1.0f, const GlTexture* colour = nullptr);
+
+    //! Draw the last generated cloud, as a mesh or points.
+    void Render(bool draw_mesh = true, bool draw_colour = true, bool draw_normals = true);
+
+    // Buffers of width * height elements in row major order: 3 floats per
+    // vertex / normal and RGBA8 colours. ibo holds the triangle strips.
+    GlBuffer vbo;
+    GlBuffer nbo;
+    GlBuffer cbo;
+    GlBuffer ibo;
+
+    // Size of the depth image last processed
+    GLint width;
+    GLint height;
+
+protected:
+    void Resize(GLint w, GLint h);
+
+    // 0 until first use, 1 compiled, -1 unavailable
+    int status;
+    GlSlProgram prog;
+    GlTexture depth_tex;
+};
+
+}
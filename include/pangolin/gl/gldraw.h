@@ -28,7 +28,9 @@
 #pragma once
 
 #include <pangolin/gl/glinclude.h>
+#include <pangolin/gl/glstate.h>
 #include <pangolin/gl/glformattraits.h>
+#include <pangolin/gl/glvbo.h>
 #include <pangolin/display/opengl_render_state.h>
 
 #include <vector>
@@ -271,8 +273,8 @@ inline void glDrawFrustrum( GLfloat u0, GLfloat v0, GLfloat fu, GLfloat fv, int
 
 inline void glDrawTexture(GLenum target, GLuint texid)
 {
-    glBindTexture(target, texid);
-    glEnable(target);
+    GlStateCache::I().BindTexture(target, texid);
+    GlStateCache::I().Enable(target);
     
     const GLfloat sq_vert[] = { -1,-1,  1,-1,  1, 1,  -1, 1 };
     glVertexPointer(2, GL_FLOAT, 0, sq_vert);
@@ -288,13 +290,13 @@ inline void glDrawTexture(GLenum target, GLuint texid)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(target);
+    GlStateCache::I().Disable(target);
 }
 
 inline void glDrawTextureFlipY(GLenum target, GLuint texid)
 {
-    glBindTexture(target, texid);
-    glEnable(target);
+    GlStateCache::I().BindTexture(target, texid);
+    GlStateCache::I().Enable(target);
     
     const GLfloat sq_vert[] = { -1,-1,  1,-1,  1, 1,  -1, 1 };
     glVertexPointer(2, GL_FLOAT, 0, sq_vert);
@@ -310,10 +312,115 @@ inline void glDrawTextureFlipY(GLenum target, GLuint texid)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(target);
+    GlStateCache::I().Disable(target);
 }
 
 
+#ifndef HAVE_GLES
+////////////////////////////////////////////////
+// Instanced variants: draw the shape once per column major 4x4 float
+// matrix in T_wi (see RenderVboInstanced) with a single draw call,
+// coloured per instance by cbo if given.
+////////////////////////////////////////////////
+
+inline void glDrawVerticesInstanced(
+    size_t num_vertices, const GLfloat* verts, size_t elements_per_vertex, GLenum mode,
+    GlBuffer& T_wi, GlBuffer* cbo = nullptr, const GLfloat* vertex_cols = nullptr)
+{
+    if(num_vertices == 0 || T_wi.num_elements == 0) return;
+
+    glVertexPointer(elements_per_vertex, GL_FLOAT, 0, verts);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    if(vertex_cols) {
+        glColorPointer(3, GL_FLOAT, 0, vertex_cols);
+        glEnableClientState(GL_COLOR_ARRAY);
+    }
+
+    BindInstanceAttributes(T_wi, cbo);
+    glDrawArraysInstanced(mode, 0, num_vertices, T_wi.num_elements);
+    UnbindInstanceAttributes(cbo != nullptr);
+
+    if(vertex_cols) {
+        glDisableClientState(GL_COLOR_ARRAY);
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+inline void glDrawAxisInstanced(GlBuffer& T_wi, float s)
+{
+    const GLfloat cols[]  = { 1,0,0, 1,0,0, 0,1,0, 0,1,0, 0,0,1, 0,0,1 };
+    const GLfloat verts[] = { 0,0,0, s,0,0, 0,0,0, 0,s,0, 0,0,0, 0,0,s };
+    glDrawVerticesInstanced(6, verts, 3, GL_LINES, T_wi, nullptr, cols);
+}
+
+inline void glDrawFrustrumInstanced( GLfloat u0, GLfloat v0, GLfloat fu, GLfloat fv, int w, int h, GLfloat scale, GlBuffer& T_wi, GlBuffer* cbo = nullptr )
+{
+    const GLfloat xl = scale * u0;
+    const GLfloat xh = scale * (w*fu + u0);
+    const GLfloat yl = scale * v0;
+    const GLfloat yh = scale * (h*fv + v0);
+
+    const GLfloat verts[] = {
+        xl,yl,scale,  xh,yl,scale,
+        xh,yh,scale,  xl,yh,scale,
+        xl,yl,scale,  0,0,0,
+        xh,yl,scale,  0,0,0,
+        xl,yh,scale,  0,0,0,
+        xh,yh,scale
+    };
+
+    glDrawVerticesInstanced(11, verts, 3, GL_LINE_STRIP, T_wi, cbo);
+}
+
+inline void glDrawColouredCubeInstanced(GlBuffer& T_wi, GLfloat axis_min=-0.5f, GLfloat axis_max = +0.5f)
+{
+    const GLfloat l = axis_min;
+    const GLfloat h = axis_max;
+
+    // As glDrawColouredCube, with each face's strip as two triangles so
+    // that every instance is drawn by the one call
+    const GLfloat strips[] = {
+        l,l,h,  h,l,h,  l,h,h,  h,h,h,  // FRONT
+        l,l,l,  l,h,l,  h,l,l,  h,h,l,  // BACK
+        l,l,h,  l,h,h,  l,l,l,  l,h,l,  // LEFT
+        h,l,l,  h,h,l,  h,l,h,  h,h,h,  // RIGHT
+        l,h,h,  h,h,h,  l,h,l,  h,h,l,  // TOP
+        l,l,h,  l,l,l,  h,l,h,  h,l,l   // BOTTOM
+    };
+    const int strip_to_tris[] = {0,1,2, 2,1,3};
+
+    GLfloat verts[6*6*3];
+    GLfloat cols[6*6*3];
+    for(int f=0; f < 6; ++f) {
+        for(int v=0; v < 6; ++v) {
+            for(int d=0; d < 3; ++d) {
+                verts[(f*6+v)*3+d] = strips[(f*4+strip_to_tris[v])*3+d];
+                cols[(f*6+v)*3+d] = (d == f/2) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    glDrawVerticesInstanced(36, verts, 3, GL_TRIANGLES, T_wi, nullptr, cols);
+}
+
+inline void glDrawCircleInstanced( GlBuffer& T_wi, GLfloat rad, GlBuffer* cbo = nullptr )
+{
+    const int N = 50;
+    GLfloat verts[N*2];
+
+    // Draw vertices anticlockwise for front face
+    const float TAU_DIV_N = 2*(float)M_PI/N;
+    for(int i = 0; i < N*2; i+=2) {
+        verts[i] =   rad * cos(-i*TAU_DIV_N);
+        verts[i+1] = rad * sin(-i*TAU_DIV_N);
+    }
+
+    // Render filled shape and outline (to make it look smooth)
+    glDrawVerticesInstanced(N, verts, 2, GL_TRIANGLE_FAN, T_wi, cbo);
+    glDrawVerticesInstanced(N, verts, 2, GL_LINE_STRIP, T_wi, cbo);
+}
+#endif // HAVE_GLES
+
 #ifdef USE_EIGEN
 
 #ifndef HAVE_GLES
@@ -29,8 +29,13 @@
 
 #include <pangolin/gl/gltext.h>
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdarg>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace pangolin {
 
@@ -41,14 +46,26 @@ public:
     static GlFont& I();
 
     // Load GL Font data. Delay uploading as texture until first use.
+    // The baked glyph atlas is reused from CacheDirectory() if present.
     GlFont(const unsigned char* ttf_buffer, float pixel_height, int tex_w=512, int tex_h=512);
     GlFont(const std::string& filename, float pixel_height, int tex_w=512, int tex_h=512);
 
     virtual ~GlFont();
 
+    // Load font at each of pixel_heights, baking them concurrently. Fonts
+    // can be created off the GL thread, the texture being made on first use.
+    static std::vector<std::shared_ptr<GlFont>> Load(const unsigned char* ttf_buffer, const std::vector<float>& pixel_heights, int tex_w=512, int tex_h=512);
+
+    // Directory baked atlases are kept in between runs: $PANGOLIN_FONT_CACHE
+    // if set (empty disables caching), otherwise ~/.cache/pangolin/fonts.
+    static std::string CacheDirectory();
+    static void SetCacheDirectory(const std::string& dir);
+
     // Generate renderable GlText object from this font.
     GlText Text( const char* fmt, ... );
 
+    // Layouts of recently requested strings are cached and copied out, so
+    // strings redrawn every frame are only laid out once.
     GlText Text( const std::string& str );
 
     inline float Height() const {
@@ -57,6 +74,9 @@ public:
     
 protected:
     void InitialiseFont(const unsigned char* ttf_buffer, float pixel_height, int tex_w, int tex_h);
+    void BakeFont(const unsigned char* ttf_buffer);
+    bool LoadCachedFont(const std::string& filename);
+    void SaveCachedFont(const std::string& filename) const;
 
     // This can only be called once GL context is initialised
     void InitialiseGlTexture();
@@ -71,8 +91,13 @@ protected:
     unsigned char* font_bitmap;
     GlTexture mTex;
 
+    uint64_t ttf_hash;
     GlChar chardata[NUM_CHARS];
     GLfloat kern_table[NUM_CHARS*NUM_CHARS];
+
+    // Bounded cache of layouts by string, cleared when full
+    const static size_t MAX_CACHED_LAYOUTS = 1024;
+    std::unordered_map<std::string, GlText> layout_cache;
 };
 
 }
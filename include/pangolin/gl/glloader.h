@@ -0,0 +1,149 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/gl/gl.h>
+#include <pangolin/display/window.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace pangolin
+{
+
+//! Thread owning a GL context that shares objects with a window's, to create
+//! and fill textures, buffers etc without stalling the render loop.
+//! Each task runs in order on the loader thread, after which its commands are
+//! fenced and waited upon, so objects received through the returned future
+//! are complete and ready to bind from any context in the share group.
+//! Objects are best destroyed from the render thread or via another task.
+class PANGOLIN_EXPORT GlLoader
+{
+public:
+    //! Share with the currently bound window.
+    GlLoader();
+
+    //! Share with window. Throws std::runtime_error if its backend can't
+    //! create shared contexts (e.g. GLUT).
+    explicit GlLoader(WindowInterface& window);
+
+    //! Use context, created sharing with the intended window, on the loader
+    //! thread (e.g. from CreateAndroidSharedContext()).
+    explicit GlLoader(std::unique_ptr<GlContextInterface> context);
+
+    //! Complete any queued tasks before joining the loader thread.
+    ~GlLoader();
+
+    //! Queue f() to run on the loader thread. The future is ready, holding
+    //! the value or exception of f(), once its GL commands have completed.
+    template<typename F>
+    auto Async(F f) -> std::future<decltype(f())>;
+
+    //! Load and upload an image file as a texture.
+    std::future<GlTexture> LoadTexture(const std::string& filename, bool sampling_linear = true);
+
+    //! Upload a copy of image as a texture.
+    std::future<GlTexture> UploadTexture(TypedImage image, bool sampling_linear = true);
+
+    //! Number of tasks queued or running.
+    size_t Pending() const;
+
+    //! Block until the loader thread has completed all tasks queued so far.
+    void Flush();
+
+    //! Wait for the GL commands issued so far in the current context to
+    //! complete (glFinish where fence sync objects are unavailable).
+    static void FenceAndWait();
+
+private:
+    template<typename R>
+    struct Task
+    {
+        template<typename F>
+        static void Run(F& f, std::promise<R>& promise)
+        {
+            R r = f();
+            FenceAndWait();
+            promise.set_value(std::move(r));
+        }
+    };
+
+    void Enqueue(std::function<void()> task);
+
+    void Run();
+
+    std::unique_ptr<GlContextInterface> context;
+
+    mutable std::mutex mutex;
+    std::condition_variable cond_queued;
+    std::condition_variable cond_done;
+    std::deque<std::function<void()>> queue;
+    size_t running;
+    bool should_quit;
+
+    std::thread thread;
+};
+
+template<>
+struct GlLoader::Task<void>
+{
+    template<typename F>
+    static void Run(F& f, std::promise<void>& promise)
+    {
+        f();
+        FenceAndWait();
+        promise.set_value();
+    }
+};
+
+template<typename F>
+auto GlLoader::Async(F f) -> std::future<decltype(f())>
+{
+    typedef decltype(f()) R;
+    // std::function requires copyable targets, so share the promise
+    std::shared_ptr<std::promise<R>> promise = std::make_shared<std::promise<R>>();
+    std::future<R> future = promise->get_future();
+    Enqueue([f, promise]() mutable {
+        try {
+            Task<R>::Run(f, *promise);
+        }catch(...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return future;
+}
+
+}
@@ -43,19 +43,19 @@ struct GlPixFormat
     {
         switch( fmt.channels) {
         case 1: glformat = GL_LUMINANCE; break;
-        case 3: glformat = (fmt.format == "BGR24" || fmt.format == "BGR48")  ? GL_BGR  : GL_RGB;  break;
-        case 4: glformat = (fmt.format == "BGRA24" || fmt.format == "BGRA32" || fmt.format == "BGRA48") ? GL_BGRA : GL_RGBA; break;
-        default: throw std::runtime_error("Unable to form OpenGL format from video format: '" + fmt.format + "'.");
+        case 3: glformat = fmt.IsBgr() ? GL_BGR  : GL_RGB;  break;
+        case 4: glformat = fmt.IsBgr() ? GL_BGRA : GL_RGBA; break;
+        default: throw std::runtime_error("Unable to form OpenGL format from video format: '" + fmt.Name() + "'.");
         }
 
-        const bool is_integral = fmt.format.find('F') == std::string::npos;
+        const bool is_integral = !fmt.IsFloat();
 
         switch (fmt.channel_bits[0]) {
         case 8: gltype = GL_UNSIGNED_BYTE; break;
         case 16: gltype = GL_UNSIGNED_SHORT; break;
         case 32: gltype = (is_integral ? GL_UNSIGNED_INT : GL_FLOAT); break;
         case 64: gltype = (is_integral ? GL_UNSIGNED_INT64_NV : GL_DOUBLE); break;
-        default: throw std::runtime_error("Unknown OpenGL data type for video format: '" + fmt.format + "'.");
+        default: throw std::runtime_error("Unknown OpenGL data type for video format: '" + fmt.Name() + "'.");
         }
 
         if(glformat == GL_LUMINANCE) {
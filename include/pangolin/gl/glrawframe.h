@@ -0,0 +1,255 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/image.h>
+#include <pangolin/image/pixel_format.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace pangolin
+{
+
+// Performs unpack, shift and demosaic of raw camera frames on the GPU.
+// The raw frame is uploaded once as bytes and a single fragment shader pass
+// renders the displayable result straight into a GlTexture, so viewers can
+// skip unpack:, shift: and debayer: on the CPU entirely.
+//
+// Supported raw formats are single channel 8, 10 (packed, 4 pixels in 5 bytes),
+// 12 (packed, 2 pixels in 3 bytes) and 16 bit little endian (GRAY8, GRAY10,
+// GRAY12 and GRAY16LE). Requires an OpenGL context with framebuffer objects.
+class GlRawFrameProcessor
+{
+public:
+    struct Params
+    {
+        Params()
+            : shift_right_bits(-1), mask(0)
+        {
+        }
+
+        // Bayer tile ("RGGB", "GBRG", "GRBG" or "BGGR"), or empty for mono
+        std::string tile;
+
+        // As shift:, output = (raw >> shift_right_bits) & mask, interpreted as
+        // 8 bit, where mask is of the form 2^k-1 (0 for 0xFF).
+        // If negative, the raw range is instead normalised to [0,1].
+        int shift_right_bits;
+        unsigned int mask;
+    };
+
+    GlRawFrameProcessor();
+
+    // Process raw image with format raw_fmt into out, which is (re)initialised
+    // to raw.w x raw.h with out_internal_format as necessary.
+    void Process(
+        const Image<unsigned char>& raw, const PixelFormat& raw_fmt,
+        GlTexture& out, const Params& params = Params(),
+        GLint out_internal_format = GL_RGBA8
+    );
+
+protected:
+    static int TileIndex(const std::string& tile);
+
+    GlSlProgram prog;
+    GlTexture raw_tex;
+    GlRenderBuffer depth;
+    std::unique_ptr<GlFramebuffer> fbo;
+    GLuint fbo_tex_id;
+};
+
+////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////
+
+inline GlRawFrameProcessor::GlRawFrameProcessor()
+    : fbo_tex_id(0)
+{
+    const char* source =
+        "uniform sampler2D raw;\n"
+        "uniform vec2 size;\n"        // raw image in pixels
+        "uniform vec2 raw_size;\n"    // raw texture in bytes per row, rows
+        "uniform float bits;\n"
+        "uniform float tile;\n"       // < 0: mono, else one of RGGB, GBRG, GRBG, BGGR
+        "uniform float shift_div;\n"
+        "uniform float wrap;\n"
+        "uniform float scale;\n"
+        "float Byte(float bx, float y) {\n"
+        "  return floor(texture2D(raw, (vec2(bx, y) + 0.5) / raw_size).r * 255.0 + 0.5);\n"
+        "}\n"
+        "float Raw(vec2 p) {\n"
+        // Mirror at borders, preserving the bayer pattern
+        "  p = abs(p);\n"
+        "  p = (size - 1.0) - abs((size - 1.0) - p);\n"
+        "  float v;\n"
+        "  if(bits == 8.0) {\n"
+        "    v = Byte(p.x, p.y);\n"
+        "  }else if(bits == 16.0) {\n"
+        "    v = Byte(2.0*p.x, p.y) + 256.0*Byte(2.0*p.x+1.0, p.y);\n"
+        "  }else if(bits == 12.0) {\n"
+        "    float b = 3.0*floor(p.x/2.0);\n"
+        "    if(mod(p.x, 2.0) < 0.5) {\n"
+        "      v = Byte(b, p.y) + 256.0*mod(Byte(b+1.0, p.y), 16.0);\n"
+        "    }else{\n"
+        "      v = floor(Byte(b+1.0, p.y) / 16.0) + 16.0*Byte(b+2.0, p.y);\n"
+        "    }\n"
+        "  }else{\n"
+        "    float g = floor(p.x/4.0);\n"
+        "    float j = p.x - 4.0*g;\n"
+        "    float b = 5.0*g + j;\n"
+        "    float w = Byte(b, p.y) + 256.0*Byte(b+1.0, p.y);\n"
+        "    v = mod(floor(w / pow(4.0, j)), 1024.0);\n"
+        "  }\n"
+        "  v = floor(v / shift_div);\n"
+        "  if(wrap > 0.0) v = mod(v, wrap);\n"
+        "  return v * scale;\n"
+        "}\n"
+        // 0 = R, 1 = G, 2 = B
+        "float TileColour(vec2 p) {\n"
+        "  float i = 2.0*mod(p.y, 2.0) + mod(p.x, 2.0);\n"
+        "  bool rggb_like = (tile == 0.0 || tile == 3.0);\n"
+        "  bool green = rggb_like ? (i == 1.0 || i == 2.0) : (i == 0.0 || i == 3.0);\n"
+        "  if(green) return 1.0;\n"
+        "  float red = (tile == 0.0) ? 0.0 : (tile == 1.0) ? 2.0 : (tile == 2.0) ? 1.0 : 3.0;\n"
+        "  return (i == red) ? 0.0 : 2.0;\n"
+        "}\n"
+        "void main() {\n"
+        "  vec2 p = floor(gl_FragCoord.xy);\n"
+        "  float c = Raw(p);\n"
+        "  if(tile < 0.0) {\n"
+        "    gl_FragColor = vec4(c, c, c, 1.0);\n"
+        "    return;\n"
+        "  }\n"
+        "  float h = 0.5*(Raw(p+vec2(-1.0,0.0)) + Raw(p+vec2(1.0,0.0)));\n"
+        "  float v = 0.5*(Raw(p+vec2(0.0,-1.0)) + Raw(p+vec2(0.0,1.0)));\n"
+        "  float d = 0.25*(Raw(p+vec2(-1.0,-1.0)) + Raw(p+vec2(1.0,-1.0)) + Raw(p+vec2(-1.0,1.0)) + Raw(p+vec2(1.0,1.0)));\n"
+        "  float x = 0.5*(h + v);\n"
+        "  float col = TileColour(p);\n"
+        "  vec3 rgb;\n"
+        "  if(col == 1.0) {\n"
+        "    float hc = TileColour(p + vec2(1.0, 0.0));\n"
+        "    rgb = vec3(hc == 0.0 ? h : v, c, hc == 2.0 ? h : v);\n"
+        "  }else if(col == 0.0) {\n"
+        "    rgb = vec3(c, x, d);\n"
+        "  }else{\n"
+        "    rgb = vec3(d, x, c);\n"
+        "  }\n"
+        "  gl_FragColor = vec4(rgb, 1.0);\n"
+        "}\n";
+
+    prog.AddShader(GlSlFragmentShader, source);
+    prog.Link();
+}
+
+inline int GlRawFrameProcessor::TileIndex(const std::string& tile)
+{
+    if(tile.empty()) return -1;
+    std::string t = tile;
+    std::transform(t.begin(), t.end(), t.begin(), ::toupper);
+    if(t == "RGGB") return 0;
+    if(t == "GBRG") return 1;
+    if(t == "GRBG") return 2;
+    if(t == "BGGR") return 3;
+    throw std::runtime_error("GlRawFrameProcessor: Unknown bayer tile '" + tile + "'.");
+}
+
+inline void GlRawFrameProcessor::Process(
+    const Image<unsigned char>& raw, const PixelFormat& raw_fmt,
+    GlTexture& out, const Params& params, GLint out_internal_format
+) {
+    const int bits = (int)raw_fmt.bpp;
+    if(raw_fmt.channels != 1 || (bits != 8 && bits != 10 && bits != 12 && bits != 16)) {
+        throw std::runtime_error("GlRawFrameProcessor: Unsupported raw format '" + raw_fmt.Name() + "'.");
+    }
+
+    // Upload raw bytes, unmodified, one texel per byte.
+    const GLsizei row_bytes = (GLsizei)raw.pitch;
+    if(raw_tex.width != row_bytes || raw_tex.height != (GLint)raw.h) {
+#ifdef HAVE_GLES
+        raw_tex.Reinitialise(row_bytes, (GLsizei)raw.h, GL_LUMINANCE, false, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+#else
+        raw_tex.Reinitialise(row_bytes, (GLsizei)raw.h, GL_LUMINANCE8, false, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+#endif
+    }
+    GLint unpack_alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    raw_tex.Upload(raw.ptr, 0, 0, row_bytes, (GLsizei)raw.h, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    // Render target
+    if(out.width != (GLint)raw.w || out.height != (GLint)raw.h || out.internal_format != out_internal_format) {
+        out.Reinitialise((GLsizei)raw.w, (GLsizei)raw.h, out_internal_format, true);
+    }
+    if(!fbo || fbo_tex_id != out.tid || depth.width != out.width || depth.height != out.height) {
+        depth.Reinitialise(out.width, out.height);
+        fbo.reset(new GlFramebuffer(out, depth));
+        fbo_tex_id = out.tid;
+    }
+
+    float shift_div = 1.0f, wrap = 0.0f, scale = 1.0f / (float)((1u << bits) - 1);
+    if(params.shift_right_bits >= 0) {
+        shift_div = (float)(1u << params.shift_right_bits);
+        wrap = 256.0f;
+        scale = 1.0f / 255.0f;
+        if(params.mask) {
+            // Contiguous low bit masks only, e.g. 0xFF, 0x3F
+            wrap = (float)(std::min(params.mask, 0xFFu) + 1);
+        }
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    fbo->Bind();
+    GlStateCache::I().Viewport(0, 0, out.width, out.height);
+
+    prog.Bind();
+    prog.SetUniform("raw", 0);
+    prog.SetUniform("size", (float)raw.w, (float)raw.h);
+    prog.SetUniform("raw_size", (float)row_bytes, (float)raw.h);
+    prog.SetUniform("bits", (float)bits);
+    prog.SetUniform("tile", (float)TileIndex(params.tile));
+    prog.SetUniform("shift_div", shift_div);
+    prog.SetUniform("wrap", wrap);
+    prog.SetUniform("scale", scale);
+
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    raw_tex.RenderToViewport();
+
+    prog.Unbind();
+    fbo->Unbind();
+
+    GlStateCache::I().Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+}
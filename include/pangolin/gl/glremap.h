@@ -0,0 +1,174 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/image.h>
+#include <pangolin/image/image_remap.h>
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace pangolin
+{
+
+// Applies a RemapTable (e.g. undistortion / rectification, see rectify:) on
+// the GPU. The table is uploaded once as a texture of source coordinates and
+// each frame is resampled by the texture unit in a single fragment shader
+// pass into a GlTexture, for viewers which only display the result.
+// Requires an OpenGL context with framebuffer objects and float textures.
+class GlRemapProcessor
+{
+public:
+    GlRemapProcessor();
+
+    // Upload table, used by subsequent calls to Process
+    void SetTable(const RemapTable& table);
+
+    // Resample in (table.src_w x table.src_h) into out, which is
+    // (re)initialised to table.w x table.h with out_internal_format as necessary.
+    void Process(const GlTexture& in, GlTexture& out, GLint out_internal_format = GL_RGBA8);
+
+    // As above, first uploading src of format fmt (tightly packed rows).
+    void Process(const Image<unsigned char>& src, const PixelFormat& fmt, GlTexture& out, GLint out_internal_format = GL_RGBA8);
+
+protected:
+    GlSlProgram prog;
+    GlTexture map_tex;
+    GlTexture src_tex;
+    GlRenderBuffer depth;
+    std::unique_ptr<GlFramebuffer> fbo;
+    GLuint fbo_tex_id;
+    size_t src_w, src_h;
+};
+
+////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////
+
+inline GlRemapProcessor::GlRemapProcessor()
+    : fbo_tex_id(0), src_w(0), src_h(0)
+{
+    const char* source =
+        "uniform sampler2D img;\n"
+        "uniform sampler2D map;\n"    // normalised source coordinate, valid
+        "uniform vec2 size;\n"        // output in pixels
+        "void main() {\n"
+        "  vec4 m = texture2D(map, gl_FragCoord.xy / size);\n"
+        "  gl_FragColor = (m.b > 0.5) ? texture2D(img, m.rg) : vec4(0.0);\n"
+        "}\n";
+
+    prog.AddShader(GlSlFragmentShader, source);
+    prog.Link();
+}
+
+inline void GlRemapProcessor::SetTable(const RemapTable& table)
+{
+    std::vector<float> map(table.w * table.h * 4);
+    for(size_t i = 0; i < table.entries.size(); ++i) {
+        const RemapEntry& q = table.entries[i];
+        float* m = &map[4 * i];
+        m[0] = (q.x + float(q.fx) / RemapFracOne + 0.5f) / table.src_w;
+        m[1] = (q.y + float(q.fy) / RemapFracOne + 0.5f) / table.src_h;
+        m[2] = q.valid ? 1.0f : 0.0f;
+        m[3] = 1.0f;
+    }
+
+#ifdef HAVE_GLES
+    map_tex.Reinitialise((GLsizei)table.w, (GLsizei)table.h, GL_RGBA, false, 0, GL_RGBA, GL_FLOAT, map.data());
+#else
+    map_tex.Reinitialise((GLsizei)table.w, (GLsizei)table.h, GL_RGBA32F, false, 0, GL_RGBA, GL_FLOAT, map.data());
+#endif
+    src_w = table.src_w;
+    src_h = table.src_h;
+}
+
+inline void GlRemapProcessor::Process(const GlTexture& in, GlTexture& out, GLint out_internal_format)
+{
+    if(!map_tex.IsValid()) {
+        throw std::runtime_error("GlRemapProcessor: No table set.");
+    }
+    if(in.width != (GLint)src_w || in.height != (GLint)src_h) {
+        throw std::runtime_error("GlRemapProcessor: Input doesn't match table.");
+    }
+
+    // Render target
+    if(out.width != map_tex.width || out.height != map_tex.height || out.internal_format != out_internal_format) {
+        out.Reinitialise(map_tex.width, map_tex.height, out_internal_format, true);
+    }
+    if(!fbo || fbo_tex_id != out.tid || depth.width != out.width || depth.height != out.height) {
+        depth.Reinitialise(out.width, out.height);
+        fbo.reset(new GlFramebuffer(out, depth));
+        fbo_tex_id = out.tid;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    fbo->Bind();
+    GlStateCache::I().Viewport(0, 0, out.width, out.height);
+
+    prog.Bind();
+    prog.SetUniform("img", 0);
+    prog.SetUniform("map", 1);
+    prog.SetUniform("size", (float)out.width, (float)out.height);
+
+    GlStateCache::I().ActiveTexture(GL_TEXTURE1);
+    map_tex.Bind();
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    in.RenderToViewport();
+    GlStateCache::I().ActiveTexture(GL_TEXTURE1);
+    map_tex.Unbind();
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+
+    prog.Unbind();
+    fbo->Unbind();
+
+    GlStateCache::I().Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+inline void GlRemapProcessor::Process(const Image<unsigned char>& src, const PixelFormat& fmt, GlTexture& out, GLint out_internal_format)
+{
+    const GlPixFormat glfmt(fmt);
+    if(src_tex.width != (GLint)src.w || src_tex.height != (GLint)src.h || src_tex.internal_format != glfmt.scalable_internal_format) {
+        src_tex.Reinitialise((GLsizei)src.w, (GLsizei)src.h, glfmt.scalable_internal_format, true, 0, glfmt.glformat, glfmt.gltype);
+    }
+    GLint unpack_alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    src_tex.Upload(src.ptr, glfmt.glformat, glfmt.gltype);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    Process(src_tex, out, out_internal_format);
+}
+
+}
@@ -32,10 +32,18 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
 
 #include <pangolin/gl/glplatform.h>
 #include <pangolin/gl/colour.h>
+#include <pangolin/gl/glstate.h>
+#include <pangolin/utils/assert.h>
 #include <pangolin/utils/file_utils.h>
 #include <pangolin/display/opengl_render_state.h>
 
@@ -62,11 +70,15 @@ const GLuint DEFAULT_LOCATION_POSITION = 0;
 const GLuint DEFAULT_LOCATION_COLOUR   = 1;
 const GLuint DEFAULT_LOCATION_NORMAL   = 2;
 const GLuint DEFAULT_LOCATION_TEXCOORD = 3;
+const GLuint DEFAULT_LOCATION_INSTANCE_COLOUR    = 4;
+const GLuint DEFAULT_LOCATION_INSTANCE_TRANSFORM = 5; // 4 locations, one per column
 
 const char DEFAULT_NAME_POSITION[] = "a_position";
 const char DEFAULT_NAME_COLOUR[]   = "a_color";
 const char DEFAULT_NAME_NORMAL[]   = "a_normal";
 const char DEFAULT_NAME_TEXCOORD[] = "a_texcoord";
+const char DEFAULT_NAME_INSTANCE_COLOUR[]    = "a_instance_color";
+const char DEFAULT_NAME_INSTANCE_TRANSFORM[] = "a_instance_T";
 
 ////////////////////////////////////////////////
 // Interface
@@ -104,12 +116,30 @@ public:
         const std::vector<std::string>& search_path = std::vector<std::string>()
     );
 
+    // Link the program. With a BinaryCacheDirectory(), shaders are compiled
+    // here rather than by AddShader, and only if the linked program isn't
+    // already cached from an earlier run on the same driver.
     bool Link();
+
+    // Use in place of glBindAttribLocation(ProgramId(),...) before Link(),
+    // so that the binding is part of the binary cache key.
+    void BindAttribLocation(GLuint location, const std::string& name);
+
+    // Directory linked program binaries are kept in between runs:
+    // $PANGOLIN_SHADER_CACHE if set (empty disables caching), otherwise
+    // ~/.cache/pangolin/shaders. Binaries are keyed by the preprocessed
+    // shader sources, attribute bindings, and the GL vendor, renderer and version.
+    static std::string BinaryCacheDirectory();
+    static void SetBinaryCacheDirectory(const std::string& dir);
     
+    // Locations are looked up once per name and remembered until the next Link().
     GLint GetAttributeHandle(const std::string& name);
     GLint GetUniformHandle(const std::string& name);
 
     // Before setting uniforms, be sure to Bind() the GlSl program first.
+    // Values are remembered per location, and setting a uniform to the value it
+    // already holds is skipped. Call InvalidateUniformCache() after writing
+    // uniforms of this program other than through SetUniform.
     void SetUniform(const std::string& name, int x);
     void SetUniform(const std::string& name, int x1, int x2);
     void SetUniform(const std::string& name, int x1, int x2, int x3);
@@ -124,6 +154,15 @@ public:
 
     void SetUniform(const std::string& name, const OpenGlMatrix& m);
 
+    void InvalidateUniformCache();
+
+#ifndef HAVE_GLES
+    // Connect uniform block name to a uniform buffer binding point, for values
+    // shared by many programs (see GlSlUniformBlock). Returns false if the
+    // program has no such block.
+    bool SetUniformBlock(const std::string& name, GLuint binding);
+#endif
+
 #if GL_VERSION_4_3
     GLint GetProgramResourceIndex(const std::string& name);
     void SetShaderStorageBlock(const std::string& name, const int& bindingIndex);
@@ -162,13 +201,90 @@ protected:
         const std::string& current_path
     );
 
+    // Value last written to a uniform location
+    struct UniformValue
+    {
+        GLenum type;
+        unsigned char bytes[16*sizeof(GLfloat)];
+    };
+
+    // Remember value for location, returning false if it already held it
+    bool UniformChanged(GLint location, GLenum type, const void* value, size_t size_bytes);
+
+    bool CompileAndAttach(GlSlShaderType shader_type, const std::string& source_code, const std::string& name_for_errors);
+
+    struct ShaderSource
+    {
+        GlSlShaderType type;
+        std::string source;
+        std::string name_for_errors;
+        bool compiled;
+    };
+
+    static std::mutex& BinaryCacheMutex();
+    static std::string& BinaryCacheDir();
+
+    // Program binaries are only cached where the driver supports retrieving them
+    static bool BinaryCacheSupported();
+#ifndef HAVE_GLES
+    bool LinkCached();
+    uint64_t BinaryCacheKey() const;
+    bool LoadProgramBinary(const std::string& filename, uint64_t key);
+    void SaveProgramBinary(const std::string& filename, uint64_t key) const;
+#endif
+
     bool linked;
     std::vector<GLhandleARB> shaders;
     GLenum prog;
 
     GLint prev_prog;
+
+    std::unordered_map<std::string,GLint> attribute_locations;
+    std::unordered_map<std::string,GLint> uniform_locations;
+    std::unordered_map<GLint,UniformValue> uniform_values;
+
+    // Sources and attribute bindings making up the program, whilst caching binaries
+    std::vector<ShaderSource> sources;
+    std::vector<std::pair<GLuint,std::string>> attrib_bindings;
+};
+
+#ifndef HAVE_GLES
+//! Uniform buffer for values shared by many programs, such as the camera
+//! matrices. Upload once per frame and bind to the binding point each
+//! program's block was connected to with GlSlProgram::SetUniformBlock.
+class GlSlUniformBlock
+{
+public:
+    GlSlUniformBlock();
+    GlSlUniformBlock(GLsizeiptr size_bytes);
+    ~GlSlUniformBlock();
+
+    void Reinitialise(GLsizeiptr size_bytes);
+    void Upload(const void* data, GLsizeiptr size_bytes, GLintptr offset = 0);
+    void Bind(GLuint binding) const;
+
+    GLuint BufferId() const { return ubo; }
+
+private:
+    GlSlUniformBlock(const GlSlUniformBlock&) = delete;
+
+    GLuint ubo;
+    GLsizeiptr size_bytes;
 };
 
+//! Camera matrices of an OpenGlRenderState laid out to match the std140 block
+//!   layout(std140) uniform Camera { mat4 u_projection; mat4 u_modelview; mat4 u_mvp; };
+class GlSlCameraBlock : public GlSlUniformBlock
+{
+public:
+    static constexpr GLuint default_binding = 0;
+
+    GlSlCameraBlock();
+
+    void Upload(const OpenGlRenderState& state);
+};
+#endif
+
 class GlSlUtilities
 {
 public:
@@ -188,9 +304,18 @@ public:
         return prog;
     }
     
+    //! Fixed function style program drawing gl_Vertex transformed by a per
+    //! instance a_instance_T, coloured by gl_Color or a per instance a_instance_color.
+    inline static GlSlProgram& Instanced(bool instance_colour) {
+        GlSlProgram& prog = Instance().prog_instanced;
+        prog.Bind();
+        prog.SetUniform("use_instance_color", instance_colour ? 1 : 0);
+        return prog;
+    }
+
     inline static void UseNone()
     {
-        glUseProgram(0);
+        GlStateCache::I().UseProgram(0);
     }
     
 protected:
@@ -243,10 +368,33 @@ protected:
                 "}";
         prog_offsetscale.AddShader(GlSlFragmentShader, source_offsetscale);
         prog_offsetscale.Link();
+
+#ifndef HAVE_GLES
+        const char* source_instanced_vert =
+                "#version 120\n"
+                "attribute vec4 a_instance_color;"
+                "attribute mat4 a_instance_T;"
+                "uniform bool use_instance_color;"
+                "void main() {"
+                "  gl_Position = gl_ModelViewProjectionMatrix * (a_instance_T * gl_Vertex);"
+                "  gl_FrontColor = use_instance_color ? a_instance_color : gl_Color;"
+                "}";
+        const char* source_instanced_frag =
+                "#version 120\n"
+                "void main() {"
+                "  gl_FragColor = gl_Color;"
+                "}";
+        prog_instanced.AddShader(GlSlVertexShader, source_instanced_vert);
+        prog_instanced.AddShader(GlSlFragmentShader, source_instanced_frag);
+        prog_instanced.BindAttribLocation(DEFAULT_LOCATION_INSTANCE_COLOUR, DEFAULT_NAME_INSTANCE_COLOUR);
+        prog_instanced.BindAttribLocation(DEFAULT_LOCATION_INSTANCE_TRANSFORM, DEFAULT_NAME_INSTANCE_TRANSFORM);
+        prog_instanced.Link();
+#endif
     }
     
     GlSlProgram prog_scale;
     GlSlProgram prog_offsetscale;
+    GlSlProgram prog_instanced;
 };
 
 
@@ -301,7 +449,11 @@ inline GlSlProgram::GlSlProgram()
 
 //! Move Constructor
 inline GlSlProgram::GlSlProgram(GlSlProgram&& o)
-    : linked(o.linked), shaders(o.shaders), prog(o.prog), prev_prog(o.prev_prog)
+    : linked(o.linked), shaders(o.shaders), prog(o.prog), prev_prog(o.prev_prog),
+      attribute_locations(std::move(o.attribute_locations)),
+      uniform_locations(std::move(o.uniform_locations)),
+      uniform_values(std::move(o.uniform_values)),
+      sources(std::move(o.sources)), attrib_bindings(std::move(o.attrib_bindings))
 {
     o.prog = 0;
 }
@@ -314,6 +466,7 @@ inline GlSlProgram::~GlSlProgram()
             glDetachShader(prog, shaders[i]);
             glDeleteShader(shaders[i]);
         }
+        GlStateCache::I().ProgramDeleted(prog);
         glDeleteProgram(prog);
     }
 }
@@ -327,6 +480,21 @@ inline bool GlSlProgram::AddPreprocessedShader(
         prog = glCreateProgram();
     }
 
+    if(BinaryCacheSupported() && !BinaryCacheDirectory().empty()) {
+        // Compilation is deferred to Link(), in case the program is cached
+        sources.push_back({shader_type, source_code, name_for_errors, false});
+        linked = false;
+        return true;
+    }
+
+    return CompileAndAttach(shader_type, source_code, name_for_errors);
+}
+
+inline bool GlSlProgram::CompileAndAttach(
+    GlSlShaderType shader_type,
+    const std::string& source_code,
+    const std::string& name_for_errors
+) {
     GLhandleARB shader = glCreateShader(shader_type);
     const char* source = source_code.c_str();
     glShaderSource(shader, 1, &source, NULL);
@@ -453,80 +621,337 @@ inline bool GlSlProgram::AddShaderFromFile(
 
 inline bool GlSlProgram::Link()
 {
+    // Locations and values don't survive relinking
+    attribute_locations.clear();
+    uniform_locations.clear();
+    uniform_values.clear();
+
+#ifndef HAVE_GLES
+    if(!sources.empty()) {
+        return LinkCached();
+    }
+#endif
     glLinkProgram(prog);
-    return IsLinkSuccessPrintLog(prog);
+    linked = IsLinkSuccessPrintLog(prog);
+    return linked;
 }
 
+#ifndef HAVE_GLES
+inline bool GlSlProgram::LinkCached()
+{
+    // The directory may have been cleared since shaders were added
+    const std::string dir = BinaryCacheDirectory();
+    const uint64_t key = BinaryCacheKey();
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    const std::string filename = dir + "/" + name;
+
+    if(!dir.empty() && LoadProgramBinary(filename, key)) {
+        linked = true;
+        return true;
+    }
+
+    for(ShaderSource& s : sources) {
+        if(!s.compiled) {
+            if(!CompileAndAttach(s.type, s.source, s.name_for_errors)) {
+                return false;
+            }
+            s.compiled = true;
+        }
+    }
+
+    glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(prog);
+    linked = IsLinkSuccessPrintLog(prog);
+    if(linked && !dir.empty()) {
+        SaveProgramBinary(filename, key);
+    }
+    return linked;
+}
+#endif
+
+inline void GlSlProgram::BindAttribLocation(GLuint location, const std::string& name)
+{
+    if(!prog) {
+        prog = glCreateProgram();
+    }
+    attrib_bindings.emplace_back(location, name);
+    glBindAttribLocation(prog, location, name.c_str());
+}
+
+inline std::mutex& GlSlProgram::BinaryCacheMutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+inline std::string& GlSlProgram::BinaryCacheDir()
+{
+    static std::string dir = [](){
+        const char* env = std::getenv("PANGOLIN_SHADER_CACHE");
+        if(env) return std::string(env);
+#ifdef _WIN_
+        return std::string();
+#else
+        const char* home = std::getenv("HOME");
+        return home ? std::string(home) + "/.cache/pangolin/shaders" : std::string();
+#endif
+    }();
+    return dir;
+}
+
+inline std::string GlSlProgram::BinaryCacheDirectory()
+{
+    std::lock_guard<std::mutex> l(BinaryCacheMutex());
+    return BinaryCacheDir();
+}
+
+inline void GlSlProgram::SetBinaryCacheDirectory(const std::string& dir)
+{
+    std::lock_guard<std::mutex> l(BinaryCacheMutex());
+    BinaryCacheDir() = dir;
+}
+
+inline bool GlSlProgram::BinaryCacheSupported()
+{
+#ifdef HAVE_GLES
+    return false;
+#else
+    // Asked of the current context, leaving GL_INVALID_ENUM on drivers predating program binaries
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    while(glGetError() != GL_NO_ERROR);
+    return num_formats > 0;
+#endif
+}
+
+#ifndef HAVE_GLES
+inline uint64_t GlSlProgram::BinaryCacheKey() const
+{
+    // 64-bit FNV-1a over everything that determines the linked result
+    uint64_t h = 14695981039346656037ull;
+    auto hash = [&h](const void* data, size_t size) {
+        for(size_t i=0; i < size; ++i) {
+            h = (h ^ ((const unsigned char*)data)[i]) * 1099511628211ull;
+        }
+    };
+    auto hash_str = [&hash](const char* str) {
+        const std::string s = str ? str : "";
+        hash(s.c_str(), s.size()+1);
+    };
+
+    hash_str((const char*)glGetString(GL_VENDOR));
+    hash_str((const char*)glGetString(GL_RENDERER));
+    hash_str((const char*)glGetString(GL_VERSION));
+    for(const ShaderSource& s : sources) {
+        hash(&s.type, sizeof(s.type));
+        hash_str(s.source.c_str());
+    }
+    for(const auto& b : attrib_bindings) {
+        hash(&b.first, sizeof(b.first));
+        hash_str(b.second.c_str());
+    }
+    return h;
+}
+
+struct GlSlProgramBinaryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint64_t key;
+    uint64_t size_bytes;
+};
+
+const char glsl_program_binary_magic[8] = {'P','A','N','G','O','P','B','\0'};
+const uint32_t glsl_program_binary_version = 1;
+
+inline bool GlSlProgram::LoadProgramBinary(const std::string& filename, uint64_t key)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if(!f.is_open()) {
+        return false;
+    }
+
+    GlSlProgramBinaryHeader header;
+    f.read((char*)&header, sizeof(header));
+    if( !f || std::memcmp(header.magic, glsl_program_binary_magic, sizeof(glsl_program_binary_magic)) ||
+        header.version != glsl_program_binary_version || header.key != key )
+    {
+        return false;
+    }
+
+    std::vector<char> binary(header.size_bytes);
+    f.read(binary.data(), binary.size());
+    if(!f) {
+        return false;
+    }
+
+    // Drivers reject binaries from before an update, in which case we link from source
+    glProgramBinary(prog, header.format, binary.data(), (GLsizei)binary.size());
+    GLint status = GL_FALSE;
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    return status == GL_TRUE;
+}
+
+inline void GlSlProgram::SaveProgramBinary(const std::string& filename, uint64_t key) const
+{
+    GLint size = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if(size <= 0 || !MakeDirectories(PathParent(filename))) {
+        return;
+    }
+
+    std::vector<char> binary(size);
+    GLenum format = 0;
+    glGetProgramBinary(prog, size, &size, &format, binary.data());
+
+    GlSlProgramBinaryHeader header;
+    std::memcpy(header.magic, glsl_program_binary_magic, sizeof(glsl_program_binary_magic));
+    header.version = glsl_program_binary_version;
+    header.format = format;
+    header.key = key;
+    header.size_bytes = (uint64_t)size;
+
+    // Written aside and renamed so concurrent processes never see a partial file
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%p.tmp", (const void*)this);
+    const std::string tmp = filename + suffix;
+    {
+        std::ofstream f(tmp, std::ios::binary);
+        f.write((const char*)&header, sizeof(header));
+        f.write(binary.data(), size);
+        if(!f) {
+            f.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    if(std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+#endif
+
 inline void GlSlProgram::Bind()
 {
     prev_prog = 0;
-    glUseProgram(prog);
+    GlStateCache::I().UseProgram(prog);
 }
 
 inline void GlSlProgram::SaveBind()
 {
-    glGetIntegerv(GL_CURRENT_PROGRAM, &prev_prog);
-    glUseProgram(prog);
+    prev_prog = (GLint)GlStateCache::I().CurrentProgram();
+    GlStateCache::I().UseProgram(prog);
 }
 
 inline void GlSlProgram::Unbind()
 {
-    glUseProgram(prev_prog);
+    GlStateCache::I().UseProgram(prev_prog);
 }
 
 inline GLint GlSlProgram::GetAttributeHandle(const std::string& name)
 {
-    return glGetAttribLocation(prog, name.c_str());
+    auto it = attribute_locations.find(name);
+    if(it == attribute_locations.end()) {
+        it = attribute_locations.emplace(name, glGetAttribLocation(prog, name.c_str())).first;
+    }
+    return it->second;
 }
 
 inline GLint GlSlProgram::GetUniformHandle(const std::string& name)
 {
-    return glGetUniformLocation(prog, name.c_str());
+    auto it = uniform_locations.find(name);
+    if(it == uniform_locations.end()) {
+        it = uniform_locations.emplace(name, glGetUniformLocation(prog, name.c_str())).first;
+    }
+    return it->second;
+}
+
+inline void GlSlProgram::InvalidateUniformCache()
+{
+    uniform_values.clear();
+}
+
+inline bool GlSlProgram::UniformChanged(GLint location, GLenum type, const void* value, size_t size_bytes)
+{
+    // Writes to location -1 are ignored by GL anyway
+    if(location < 0) return false;
+
+    UniformValue& v = uniform_values[location];
+    if(v.type == type && !std::memcmp(v.bytes, value, size_bytes)) {
+        return false;
+    }
+    v.type = type;
+    std::memcpy(v.bytes, value, size_bytes);
+    return true;
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, int x)
 {
-    glUniform1i( GetUniformHandle(name), x);
+    const GLint loc = GetUniformHandle(name);
+    if(UniformChanged(loc, GL_INT, &x, sizeof(x)))
+        glUniform1i( loc, x);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, int x1, int x2)
 {
-    glUniform2i( GetUniformHandle(name), x1, x2);
+    const GLint loc = GetUniformHandle(name);
+    const int v[] = {x1, x2};
+    if(UniformChanged(loc, GL_INT_VEC2, v, sizeof(v)))
+        glUniform2i( loc, x1, x2);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, int x1, int x2, int x3)
 {
-    glUniform3i( GetUniformHandle(name), x1, x2, x3);
+    const GLint loc = GetUniformHandle(name);
+    const int v[] = {x1, x2, x3};
+    if(UniformChanged(loc, GL_INT_VEC3, v, sizeof(v)))
+        glUniform3i( loc, x1, x2, x3);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, int x1, int x2, int x3, int x4)
 {
-    glUniform4i( GetUniformHandle(name), x1, x2, x3, x4);
+    const GLint loc = GetUniformHandle(name);
+    const int v[] = {x1, x2, x3, x4};
+    if(UniformChanged(loc, GL_INT_VEC4, v, sizeof(v)))
+        glUniform4i( loc, x1, x2, x3, x4);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, float f)
 {
-    glUniform1f( GetUniformHandle(name), f);
+    const GLint loc = GetUniformHandle(name);
+    if(UniformChanged(loc, GL_FLOAT, &f, sizeof(f)))
+        glUniform1f( loc, f);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, float f1, float f2)
 {
-    glUniform2f( GetUniformHandle(name), f1,f2);
+    const GLint loc = GetUniformHandle(name);
+    const float v[] = {f1, f2};
+    if(UniformChanged(loc, GL_FLOAT_VEC2, v, sizeof(v)))
+        glUniform2f( loc, f1,f2);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, float f1, float f2, float f3)
 {
-    glUniform3f( GetUniformHandle(name), f1,f2,f3);
+    const GLint loc = GetUniformHandle(name);
+    const float v[] = {f1, f2, f3};
+    if(UniformChanged(loc, GL_FLOAT_VEC3, v, sizeof(v)))
+        glUniform3f( loc, f1,f2,f3);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, float f1, float f2, float f3, float f4)
 {
-    glUniform4f( GetUniformHandle(name), f1,f2,f3,f4);
+    const GLint loc = GetUniformHandle(name);
+    const float v[] = {f1, f2, f3, f4};
+    if(UniformChanged(loc, GL_FLOAT_VEC4, v, sizeof(v)))
+        glUniform4f( loc, f1,f2,f3,f4);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, Colour c)
 {
-    glUniform4f( GetUniformHandle(name), c.r, c.g, c.b, c.a);
+    SetUniform(name, c.r, c.g, c.b, c.a);
 }
 
 inline void GlSlProgram::SetUniform(const std::string& name, const OpenGlMatrix& mat)
@@ -536,15 +961,27 @@ inline void GlSlProgram::SetUniform(const std::string& name, const OpenGlMatrix&
     for (int i = 0; i < 16; ++i) {
         m[i] = (float)mat.m[i];
     }
-    glUniformMatrix4fv( GetUniformHandle(name), 1, GL_FALSE, m);
+    const GLint loc = GetUniformHandle(name);
+    if(UniformChanged(loc, GL_FLOAT_MAT4, m, sizeof(m)))
+        glUniformMatrix4fv( loc, 1, GL_FALSE, m);
 }
 
+#ifndef HAVE_GLES
+inline bool GlSlProgram::SetUniformBlock(const std::string& name, GLuint binding)
+{
+    const GLuint index = glGetUniformBlockIndex(prog, name.c_str());
+    if(index == GL_INVALID_INDEX) return false;
+    glUniformBlockBinding(prog, index, binding);
+    return true;
+}
+#endif
+
 inline void GlSlProgram::BindPangolinDefaultAttribLocationsAndLink()
 {
-    glBindAttribLocation(prog, DEFAULT_LOCATION_POSITION, DEFAULT_NAME_POSITION);
-    glBindAttribLocation(prog, DEFAULT_LOCATION_COLOUR,   DEFAULT_NAME_COLOUR);
-    glBindAttribLocation(prog, DEFAULT_LOCATION_NORMAL,   DEFAULT_NAME_NORMAL);
-    glBindAttribLocation(prog, DEFAULT_LOCATION_TEXCOORD, DEFAULT_NAME_TEXCOORD);
+    BindAttribLocation(DEFAULT_LOCATION_POSITION, DEFAULT_NAME_POSITION);
+    BindAttribLocation(DEFAULT_LOCATION_COLOUR,   DEFAULT_NAME_COLOUR);
+    BindAttribLocation(DEFAULT_LOCATION_NORMAL,   DEFAULT_NAME_NORMAL);
+    BindAttribLocation(DEFAULT_LOCATION_TEXCOORD, DEFAULT_NAME_TEXCOORD);
     Link();
 }
 
@@ -560,4 +997,61 @@ inline void GlSlProgram::SetShaderStorageBlock(const std::string& name, const in
 }
 #endif
 
+#ifndef HAVE_GLES
+inline GlSlUniformBlock::GlSlUniformBlock()
+    : ubo(0), size_bytes(0)
+{
+}
+
+inline GlSlUniformBlock::GlSlUniformBlock(GLsizeiptr size_bytes)
+    : ubo(0), size_bytes(0)
+{
+    Reinitialise(size_bytes);
+}
+
+inline GlSlUniformBlock::~GlSlUniformBlock()
+{
+    if(ubo) glDeleteBuffers(1, &ubo);
+}
+
+inline void GlSlUniformBlock::Reinitialise(GLsizeiptr size)
+{
+    if(!ubo) glGenBuffers(1, &ubo);
+    size_bytes = size;
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, size_bytes, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+inline void GlSlUniformBlock::Upload(const void* data, GLsizeiptr size, GLintptr offset)
+{
+    PANGO_ASSERT(offset + size <= size_bytes);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+inline void GlSlUniformBlock::Bind(GLuint binding) const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+}
+
+inline GlSlCameraBlock::GlSlCameraBlock()
+    : GlSlUniformBlock(3*16*sizeof(GLfloat))
+{
+}
+
+inline void GlSlCameraBlock::Upload(const OpenGlRenderState& state)
+{
+    const OpenGlMatrix mats[] = {
+        state.GetProjectionMatrix(), state.GetModelViewMatrix(), state.GetProjectionModelViewMatrix()
+    };
+    GLfloat m[3*16];
+    for(int i=0; i < 3*16; ++i) {
+        m[i] = (GLfloat)mats[i/16].m[i%16];
+    }
+    GlSlUniformBlock::Upload(m, sizeof(m));
+}
+#endif
+
 }
@@ -28,11 +28,251 @@
 #pragma once
 
 #include <pangolin/gl/glinclude.h>
+#include <pangolin/platform.h>
+#include <algorithm>
 #include <stack>
+#include <vector>
 
 namespace pangolin
 {
 
+//! Shadow of GL state set through it, to skip calls which wouldn't change
+//! anything. Calls are only filtered within a GlStateCache::Scope, which
+//! RenderViews() opens around drawing Pangolin's views; elsewhere they are
+//! passed straight through. Within a scope, state the cache tracks must only
+//! be changed through it: user draw functions run within a Suspend, and
+//! glPopAttrib should be replaced by PopAttrib().
+class GlStateCache
+{
+public:
+    //! Cache for the context current on this thread
+    static GlStateCache& I()
+    {
+#ifndef PANGO_NO_THREADLOCAL
+        thread_local
+#else
+        static
+#endif
+        GlStateCache instance;
+        return instance;
+    }
+
+    //! Filter redundant calls until destroyed, starting from unknown state
+    struct Scope
+    {
+        Scope() : cache(I())
+        {
+            if(cache.scope_depth++ == 0) cache.Invalidate();
+        }
+        ~Scope()
+        {
+            if(--cache.scope_depth == 0) cache.Invalidate();
+        }
+        GlStateCache& cache;
+    };
+
+    //! Pass calls through whilst other code may change GL state directly,
+    //! forgetting all state afterwards
+    struct Suspend
+    {
+        Suspend() : cache(I())
+        {
+            ++cache.suspend_depth;
+        }
+        ~Suspend()
+        {
+            if(--cache.suspend_depth == 0) cache.Invalidate();
+        }
+        GlStateCache& cache;
+    };
+
+    bool Filtering() const
+    {
+        return scope_depth > 0 && suspend_depth == 0;
+    }
+
+    //! Forget all state, for after it has been changed behind our back
+    void Invalidate()
+    {
+        capabilities.clear();
+        textures.clear();
+        active_texture = 0;
+        program_known = false;
+        blend_known = false;
+        viewport_known = false;
+    }
+
+    //! Calls skipped as redundant since the cache was created
+    size_t Skipped() const
+    {
+        return skipped;
+    }
+
+    void Enable(GLenum cap)
+    {
+        SetCapability(cap, true);
+    }
+
+    void Disable(GLenum cap)
+    {
+        SetCapability(cap, false);
+    }
+
+    void SetCapability(GLenum cap, bool enable)
+    {
+        if(Filtering()) {
+            auto it = FindCapability(cap);
+            if(it != capabilities.end()) {
+                if(it->second == enable) { ++skipped; return; }
+                it->second = enable;
+            }else{
+                capabilities.emplace_back(cap, enable);
+            }
+        }
+        if(enable) ::glEnable(cap); else ::glDisable(cap);
+    }
+
+    //! True, setting enabled, iff cap is known whilst filtering
+    bool KnownCapability(GLenum cap, GLboolean& enabled) const
+    {
+        if(!Filtering()) return false;
+        for(const auto& c : capabilities) {
+            if(c.first == cap) { enabled = c.second; return true; }
+        }
+        return false;
+    }
+
+    void BlendFunc(GLenum sfactor, GLenum dfactor)
+    {
+        if(Filtering()) {
+            if(blend_known && blend[0] == sfactor && blend[1] == dfactor) { ++skipped; return; }
+            blend_known = true;
+            blend[0] = sfactor;
+            blend[1] = dfactor;
+        }
+        ::glBlendFunc(sfactor, dfactor);
+    }
+
+    void Viewport(GLint x, GLint y, GLsizei w, GLsizei h)
+    {
+        if(Filtering()) {
+            const GLint v[4] = {x, y, w, h};
+            if(viewport_known && std::equal(v, v+4, viewport)) { ++skipped; return; }
+            viewport_known = true;
+            std::copy(v, v+4, viewport);
+        }
+        ::glViewport(x, y, w, h);
+    }
+
+    void ActiveTexture(GLenum unit)
+    {
+        if(Filtering()) {
+            if(active_texture == unit) { ++skipped; return; }
+            active_texture = unit;
+        }
+        glActiveTexture(unit);
+    }
+
+    void BindTexture(GLenum target, GLuint texture)
+    {
+        if(Filtering()) {
+            if(!active_texture) {
+                // Asked once per scope, as it's rarely changed
+                GLint unit = 0;
+                glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+                active_texture = (GLenum)unit;
+            }
+            auto it = std::find_if(textures.begin(), textures.end(), [&](const TextureBinding& b){
+                return b.unit == active_texture && b.target == target;
+            });
+            if(it != textures.end()) {
+                if(it->texture == texture) { ++skipped; return; }
+                it->texture = texture;
+            }else{
+                textures.push_back({active_texture, target, texture});
+            }
+        }
+        ::glBindTexture(target, texture);
+    }
+
+    void UseProgram(GLuint program)
+    {
+        if(Filtering()) {
+            if(program_known && current_program == program) { ++skipped; return; }
+            program_known = true;
+            current_program = program;
+        }
+        glUseProgram(program);
+    }
+
+    //! Program in use, asking GL only if it isn't known
+    GLuint CurrentProgram() const
+    {
+        if(Filtering() && program_known) return current_program;
+        GLint program = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        return (GLuint)program;
+    }
+
+    //! Deleting a bound object unbinds it, and its name may be reused
+    void TextureDeleted(GLuint texture)
+    {
+        for(auto& b : textures) {
+            if(b.texture == texture) b.texture = 0;
+        }
+    }
+
+    void ProgramDeleted(GLuint program)
+    {
+        if(program_known && current_program == program) program_known = false;
+    }
+
+#ifndef HAVE_GLES
+    void PopAttrib()
+    {
+        ::glPopAttrib();
+        Invalidate();
+    }
+#endif
+
+private:
+    GlStateCache()
+        : scope_depth(0), suspend_depth(0), skipped(0), active_texture(0),
+          program_known(false), current_program(0), blend_known(false), viewport_known(false)
+    {
+    }
+
+    struct TextureBinding
+    {
+        GLenum unit;
+        GLenum target;
+        GLuint texture;
+    };
+
+    std::vector<std::pair<GLenum,bool>>::iterator FindCapability(GLenum cap)
+    {
+        return std::find_if(capabilities.begin(), capabilities.end(), [cap](const std::pair<GLenum,bool>& c){
+            return c.first == cap;
+        });
+    }
+
+    int scope_depth;
+    int suspend_depth;
+    size_t skipped;
+
+    // Few distinct capabilities and bindings are used, so these are searched linearly
+    std::vector<std::pair<GLenum,bool>> capabilities;
+    std::vector<TextureBinding> textures;
+    GLenum active_texture;  // 0 if unknown
+
+    bool program_known;
+    GLuint current_program;
+    bool blend_known;
+    GLenum blend[2];
+    bool viewport_known;
+    GLint viewport[4];
+};
+
 class GlState {
 
     class CapabilityState {
@@ -45,19 +285,11 @@ class GlState {
         }
 
         void Apply() {
-            if(m_enable) {
-                ::glEnable(m_cap);
-            }else{
-                ::glDisable(m_cap);
-            }
+            GlStateCache::I().SetCapability(m_cap, m_enable);
         }
 
         void UnApply() {
-            if(m_enable) {
-                ::glDisable(m_cap);
-            }else{
-                ::glEnable(m_cap);
-            }
+            GlStateCache::I().SetCapability(m_cap, !m_enable);
         }
 
     protected:
@@ -109,14 +341,16 @@ public:
         }
 
         if (m_ViewportCalled) {
-            ::glViewport(m_OriginalViewport[0], m_OriginalViewport[1], m_OriginalViewport[2], m_OriginalViewport[3]);
+            GlStateCache::I().Viewport(m_OriginalViewport[0], m_OriginalViewport[1], m_OriginalViewport[2], m_OriginalViewport[3]);
         }
     }
 
     static inline GLboolean IsEnabled(GLenum cap)
     {
         GLboolean curVal;
-        glGetBooleanv(cap, &curVal);
+        if(!GlStateCache::I().KnownCapability(cap, curVal)) {
+            glGetBooleanv(cap, &curVal);
+        }
         return curVal;
     }
 
@@ -124,7 +358,7 @@ public:
     {
         if(!IsEnabled(cap)) {
             m_history.push(CapabilityState(cap,true));
-            ::glEnable(cap);
+            GlStateCache::I().Enable(cap);
         }
     }
 
@@ -132,7 +366,7 @@ public:
     {
         if(IsEnabled(cap)) {
             m_history.push(CapabilityState(cap,false));
-           ::glDisable(cap);
+            GlStateCache::I().Disable(cap);
         }
     }
 
@@ -211,7 +445,7 @@ public:
             m_ViewportCalled = true;
             glGetIntegerv(GL_VIEWPORT, m_OriginalViewport);
         }
-        ::glViewport(x, y, width, height);
+        GlStateCache::I().Viewport(x, y, width, height);
     }
 
     std::stack<CapabilityState> m_history;
@@ -49,6 +49,10 @@ public:
     // Add specified charector to this string.
     void Add(unsigned char c, const GlChar& glc);
 
+    // Add glyphs of txt with its origin at (x,y)' relative to this one,
+    // so that many labels sharing a font can be drawn in one call.
+    void Append(const GlText& txt, GLfloat x, GLfloat y);
+
     // Clear text
     void Clear();
 
@@ -95,4 +99,51 @@ public:
     std::vector<XYUV> vs;
 };
 
+// Collects text drawn with GlText::DrawWindow between Begin() and End()
+// into a single vertex buffer against the font atlas, drawing it all with
+// one call when the outermost End() is reached (or the atlas changes).
+// Text is drawn in the current colour at the time of DrawWindow, and on
+// top of anything else rendered within the batch.
+class PANGOLIN_EXPORT GlTextBatch
+{
+public:
+    // Batch of the current context
+    static GlTextBatch& I();
+
+    GlTextBatch();
+
+    // Begin / End may be nested, text is drawn at the outermost End.
+    void Begin();
+    void End();
+
+    bool Active() const {
+        return depth > 0;
+    }
+
+    // Queue txt at (x,y,z)' in window coordinates with colour rgba
+    void Add(const GlText& txt, GLfloat x, GLfloat y, GLfloat z, const GLfloat rgba[4]);
+
+    // Draw and forget everything queued so far
+    void Flush();
+
+    // Glyph quads drawn since construction and the number of draw calls
+    // they took, for profiling.
+    size_t GlyphsDrawn() const { return glyphs_drawn; }
+    size_t DrawCalls() const { return draw_calls; }
+
+protected:
+    struct Vertex {
+        GLfloat x, y, z;
+        GLfloat tu, tv;
+        GLfloat r, g, b, a;
+    };
+
+    int depth;
+    const GlTexture* tex;
+    std::vector<Vertex> vs;
+    GlBuffer vbo;
+    size_t glyphs_drawn;
+    size_t draw_calls;
+};
+
 }
@@ -32,41 +32,41 @@
 #include <pangolin/gl/glpixformat.h>
 #include <pangolin/image/image.h>
 
-#include <memory>
+#include <list>
 #include <map>
+#include <memory>
+#include <tuple>
 
 namespace pangolin
 {
 
+struct TextureCacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes = 0;
+    size_t textures = 0;
+};
+
+//! Pool of scratch textures for drawing images of varying size.
+//! Textures are keyed by format and by size rounded up to a bucket (within
+//! 1/8th of the next power of two), so similar sizes share a texture.
+//! Least recently used textures are deleted to stay within a VRAM budget.
 class PANGOLIN_EXPORT TextureCache
 {
 public:
+    static const size_t default_budget_bytes = 256 * 1024 * 1024;
+
+    //! Cache belonging to the Pangolin window bound to this thread, or a
+    //! shared cache if there is none.
     static TextureCache& I();
 
-    GlTexture& GlTex(GLsizei w, GLsizei h, GLint internal_format, GLint glformat, GLenum gltype)
-    {
-        const long key =
-            (((long)internal_format)<<20) ^
-            (((long)glformat)<<10) ^ gltype;
-
-        // Lookup texture
-        std::shared_ptr<GlTexture>& ptex = texture_map[key];
-        if(!ptex) {
-            ptex = std::shared_ptr<GlTexture>(new GlTexture());
-        }
-        GlTexture& tex = *ptex;
-
-        // Initialise if it didn't already exist or the size was too small
-        if(!tex.tid || tex.width < w || tex.height < h) {
-            tex.Reinitialise(
-                std::max(tex.width,w), std::max(tex.height,h),
-                internal_format, default_sampling_linear, 0,
-                glformat, gltype
-            );
-        }
-
-        return tex;
-    }
+    TextureCache(size_t budget_bytes = default_budget_bytes);
+
+    //! Texture at least w x h of the given format. It remains valid until a
+    //! later call evicts it; the most recently returned one never is.
+    GlTexture& GlTex(GLsizei w, GLsizei h, GLint internal_format, GLint glformat, GLenum gltype);
 
     template<typename T>
     GlTexture& GlTex(GLsizei w, GLsizei h)
@@ -78,15 +78,40 @@ public:
         );
     }
 
+    //! Evicts textures immediately if over the new budget
+    void SetBudgetBytes(size_t budget_bytes);
+
+    size_t BudgetBytes() const;
+
+    const TextureCacheStats& Stats() const;
+
+    //! Zero the hit, miss and eviction counters
+    void ResetStats();
+
+    //! Delete all cached textures
+    void Clear();
+
 protected:
-    bool default_sampling_linear;
-    std::map<long, std::shared_ptr<GlTexture> > texture_map;
+    // internal_format, glformat, gltype, bucket width, bucket height
+    typedef std::tuple<GLint, GLint, GLenum, GLsizei, GLsizei> Key;
 
-    // Protected constructor
-    TextureCache()
-        : default_sampling_linear(true)
+    struct Entry
     {
-    }
+        Key key;
+        std::unique_ptr<GlTexture> tex;
+        size_t bytes;
+    };
+
+    static GLsizei Bucket(GLsizei size);
+    void Evict();
+
+    bool default_sampling_linear;
+    size_t budget_bytes;
+    TextureCacheStats stats;
+
+    // Most recently used at the front
+    std::list<Entry> lru;
+    std::map<Key, std::list<Entry>::iterator> textures;
 };
 
 template<typename T>
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <pangolin/gl/gl.h>
+#include <pangolin/gl/glsl.h>
 
 namespace pangolin
 {
@@ -42,6 +43,10 @@ GlBuffer MakeTriangleStripIboForVbo(int w, int h);
 
 void RenderVbo(GlBuffer& vbo, GLenum mode = GL_POINTS);
 
+// Draws only the elements appended so far, oldest first. A ring's strips
+// and loops are broken where it wraps.
+void RenderVbo(GlSizeableBuffer& vbo, GLenum mode = GL_POINTS);
+
 void RenderVboCbo(GlBuffer& vbo, GlBuffer& cbo, bool draw_color = true, GLenum mode = GL_POINTS);
 
 void RenderVboIbo(GlBuffer& vbo, GlBuffer& ibo, bool draw_mesh = true);
@@ -52,6 +57,42 @@ void RenderVboIboNbo(GlBuffer& vbo, GlBuffer& ibo, GlBuffer& nbo, bool draw_mesh
 
 void RenderVboIboCboNbo(GlBuffer& vbo, GlBuffer& ibo, GlBuffer& cbo, GlBuffer& nbo, bool draw_mesh = true, bool draw_color = true, bool draw_normals = true);
 
+#ifndef HAVE_GLES
+// Instanced drawing. instance_T is a GlArrayBuffer of column major 4x4
+// GL_FLOAT matrices (count_per_element 16), one per instance, applied
+// before the current modelview. instance_cbo optionally holds a colour
+// per instance. Each draws all instances with a single call.
+
+// Bind the instancing program and per instance attributes for use with
+// glDrawArraysInstanced and friends, restore with UnbindInstanceAttributes.
+void BindInstanceAttributes(GlBuffer& instance_T, GlBuffer* instance_cbo = nullptr);
+
+void UnbindInstanceAttributes(bool instance_colour = false);
+
+void RenderVboInstanced(GlBuffer& vbo, GlBuffer& instance_T, GLenum mode = GL_POINTS);
+
+void RenderVboInstanced(GlBuffer& vbo, GlBuffer& instance_T, GlBuffer& instance_cbo, GLenum mode = GL_POINTS);
+
+#if GL_VERSION_4_3
+// Layout of each command in a GlDrawIndirectBuffer
+struct GlDrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instance_count;
+    GLuint first;
+    GLuint base_instance;
+};
+
+// Draw a batch of different ranges of vbo, e.g. several shapes packed into
+// one buffer, in one call. indirect holds num_elements GlDrawArraysIndirectCommand.
+void RenderVboMultiDrawIndirect(GlBuffer& vbo, GlBuffer& indirect, GLenum mode = GL_POINTS);
+
+// As above with instancing, each command's base_instance indexing its own
+// transforms (and colours) in instance_T (and instance_cbo).
+void RenderVboMultiDrawIndirect(GlBuffer& vbo, GlBuffer& indirect, GlBuffer& instance_T, GlBuffer* instance_cbo = nullptr, GLenum mode = GL_POINTS);
+#endif // GL_VERSION_4_3
+#endif // HAVE_GLES
+
 ////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////
@@ -103,6 +144,22 @@ inline void RenderVbo(GlBuffer& vbo, GLenum mode)
     vbo.Unbind();
 }
 
+inline void RenderVbo(GlSizeableBuffer& vbo, GLenum mode)
+{
+    vbo.Bind();
+    glVertexPointer(vbo.count_per_element, vbo.datatype, 0, 0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    const size_t first = std::min(vbo.size(), vbo.num_elements - vbo.start());
+    glDrawArrays(mode, (GLint)vbo.start(), (GLsizei)first);
+    if(first < vbo.size()) {
+        glDrawArrays(mode, 0, (GLsizei)(vbo.size() - first));
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    vbo.Unbind();
+}
+
 inline void RenderVboCbo(GlBuffer& vbo, GlBuffer& cbo, bool draw_color, GLenum mode )
 {
     if(draw_color) {
@@ -222,4 +279,93 @@ inline void RenderVboIboNbo(GlBuffer& vbo, GlBuffer& ibo, GlBuffer& nbo, bool dr
     vbo.Unbind();
 }
 
+#ifndef HAVE_GLES
+inline void BindInstanceAttributes(GlBuffer& instance_T, GlBuffer* instance_cbo)
+{
+    GlSlUtilities::Instanced(instance_cbo != nullptr);
+
+    instance_T.Bind();
+    for(GLuint c=0; c < 4; ++c) {
+        const GLuint loc = DEFAULT_LOCATION_INSTANCE_TRANSFORM + c;
+        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (GLvoid*)(c*4*sizeof(GLfloat)));
+        glVertexAttribDivisor(loc, 1);
+        glEnableVertexAttribArray(loc);
+    }
+    instance_T.Unbind();
+
+    if(instance_cbo) {
+        const GLboolean normalise = instance_cbo->datatype != GL_FLOAT && instance_cbo->datatype != GL_DOUBLE;
+        instance_cbo->Bind();
+        glVertexAttribPointer(DEFAULT_LOCATION_INSTANCE_COLOUR, instance_cbo->count_per_element, instance_cbo->datatype, normalise, 0, 0);
+        glVertexAttribDivisor(DEFAULT_LOCATION_INSTANCE_COLOUR, 1);
+        glEnableVertexAttribArray(DEFAULT_LOCATION_INSTANCE_COLOUR);
+        instance_cbo->Unbind();
+    }
+}
+
+inline void UnbindInstanceAttributes(bool instance_colour)
+{
+    for(GLuint c=0; c < 4; ++c) {
+        glDisableVertexAttribArray(DEFAULT_LOCATION_INSTANCE_TRANSFORM + c);
+        glVertexAttribDivisor(DEFAULT_LOCATION_INSTANCE_TRANSFORM + c, 0);
+    }
+    if(instance_colour) {
+        glDisableVertexAttribArray(DEFAULT_LOCATION_INSTANCE_COLOUR);
+        glVertexAttribDivisor(DEFAULT_LOCATION_INSTANCE_COLOUR, 0);
+    }
+    GlSlUtilities::UseNone();
+}
+
+inline void RenderVboInstanced(GlBuffer& vbo, GlBuffer& instance_T, GLenum mode)
+{
+    vbo.Bind();
+    glVertexPointer(vbo.count_per_element, vbo.datatype, 0, 0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    vbo.Unbind();
+
+    BindInstanceAttributes(instance_T);
+    glDrawArraysInstanced(mode, 0, vbo.num_elements, instance_T.num_elements);
+    UnbindInstanceAttributes();
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+inline void RenderVboInstanced(GlBuffer& vbo, GlBuffer& instance_T, GlBuffer& instance_cbo, GLenum mode)
+{
+    vbo.Bind();
+    glVertexPointer(vbo.count_per_element, vbo.datatype, 0, 0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    vbo.Unbind();
+
+    BindInstanceAttributes(instance_T, &instance_cbo);
+    glDrawArraysInstanced(mode, 0, vbo.num_elements, instance_T.num_elements);
+    UnbindInstanceAttributes(true);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+#if GL_VERSION_4_3
+inline void RenderVboMultiDrawIndirect(GlBuffer& vbo, GlBuffer& indirect, GLenum mode)
+{
+    vbo.Bind();
+    glVertexPointer(vbo.count_per_element, vbo.datatype, 0, 0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    vbo.Unbind();
+
+    indirect.Bind();
+    glMultiDrawArraysIndirect(mode, 0, indirect.num_elements, sizeof(GlDrawArraysIndirectCommand));
+    indirect.Unbind();
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+inline void RenderVboMultiDrawIndirect(GlBuffer& vbo, GlBuffer& indirect, GlBuffer& instance_T, GlBuffer* instance_cbo, GLenum mode)
+{
+    BindInstanceAttributes(instance_T, instance_cbo);
+    RenderVboMultiDrawIndirect(vbo, indirect, mode);
+    UnbindInstanceAttributes(instance_cbo != nullptr);
+}
+#endif // GL_VERSION_4_3
+#endif // HAVE_GLES
+
 }
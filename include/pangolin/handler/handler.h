@@ -30,6 +30,8 @@
 #include <pangolin/display/opengl_render_state.h>
 #include <pangolin/handler/handler_enums.h>
 
+#include <memory>
+
 #if defined(HAVE_EIGEN) && !defined(__CUDACC__) //prevent including Eigen in cuda files
 #define USE_EIGEN
 #endif
@@ -49,6 +51,7 @@ namespace pangolin
 
 // Forward declarations
 struct View;
+struct AsyncDepthReader;
 
 /// Input Handler base class.
 /// Virtual methods which recurse into sub-displays.
@@ -79,6 +82,7 @@ struct PANGOLIN_EXPORT Handler3D : Handler
     void Keyboard(View&, unsigned char key, int x, int y, bool pressed);
     void Mouse(View&, MouseButton button, int x, int y, bool pressed, int button_state);
     void MouseMotion(View&, int x, int y, int button_state);
+    void PassiveMouseMotion(View&, int x, int y, int button_state);
     void Special(View&, InputSpecial inType, float x, float y, float p1, float p2, float p3, float p4, int button_state);
     
 #ifdef USE_EIGEN
@@ -103,6 +107,9 @@ protected:
     GLprecision Pw[3];
     GLprecision Pc[3];
     GLprecision n[3];
+
+    // Depth around the cursor, read ahead of the next click or scroll
+    std::shared_ptr<AsyncDepthReader> depth_reader;
 };
 
 static Handler StaticHandler;
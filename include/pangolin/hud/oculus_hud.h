@@ -31,10 +31,26 @@ protected:
 };
 
 
+// How OculusHud renders its extern draw function for both eyes
+enum OculusStereoMode
+{
+    // Call the draw function once per eye, each with its eye's matrices
+    // loaded into the fixed function pipeline (the default).
+    OculusStereoMultiPass,
+
+    // Call the draw function once, rendering both eyes into the layers of a
+    // texture array via GL_OVR_multiview. Shaders of the draw function must
+    // declare '#extension GL_OVR_multiview : require' and
+    // 'layout(num_views = 2) in;', and pick their eye's transform with
+    // gl_ViewID_OVR, e.g. from SetMultiviewUniform.
+    OculusStereoMultiview
+};
+
 class OculusHud : public View
 {
 public:
     OculusHud();
+    ~OculusHud();
 
     void Render();
     void RenderFramebuffer();
@@ -56,6 +72,17 @@ public:
 
     void UnwarpPoint(unsigned int view, const float in[2], float out[2]);
 
+    // Returns false, leaving the mode unchanged, if the context doesn't
+    // support it.
+    bool SetStereoMode(OculusStereoMode mode);
+
+    OculusStereoMode StereoMode() const;
+
+    // Set the mat4[2] uniform name of prog to the projection * modelview
+    // of each eye from DefaultRenderState(), times model, for indexing
+    // with gl_ViewID_OVR.
+    void SetMultiviewUniform(GlSlProgram& prog, const std::string& name, const OpenGlMatrix& model = IdentityMatrix());
+
 protected:
     // Oculus SDK Shader for applying lens and chromatic distortion.
     static const char* PostProcessFullFragShaderSrc;
@@ -63,6 +90,12 @@ protected:
     void InitialiseOculus();
     void InitialiseFramebuffer();
     void InitialiseShader();
+    bool InitialiseMultiview();
+    void ReleaseMultiview();
+
+    // Draw both eyes into the multiview layers in one pass, then copy each
+    // layer into its half of colourbuffer.
+    void RenderMultiview();
 
     pangolin::GlTexture colourbuffer;
     pangolin::GlRenderBuffer depthbuffer;
@@ -70,6 +103,13 @@ protected:
     pangolin::GlSlProgram occ;
     bool post_unwarp;
 
+    // Per eye layers of colour and depth for OculusStereoMultiview
+    OculusStereoMode stereo_mode;
+    GLuint mv_colour;
+    GLuint mv_depth;
+    GLuint mv_fbo;
+    GLuint mv_read_fbo;
+
     OVR::Ptr<OVR::DeviceManager> pManager;
     OVR::Ptr<OVR::HMDDevice> pHMD;
     OVR::Ptr<OVR::SensorDevice> pSensor;
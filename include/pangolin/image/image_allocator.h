@@ -0,0 +1,181 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2011 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace pangolin {
+
+//! Allocate size_bytes aligned to alignment (a power of two). Buffers of
+//! whole huge pages are also advised for transparent huge pages on Linux.
+//! Throws std::bad_alloc on failure. Free with FreeImageBuffer.
+PANGOLIN_EXPORT
+void* AllocateImageBuffer(size_t size_bytes, size_t alignment);
+
+PANGOLIN_EXPORT
+void FreeImageBuffer(void* ptr);
+
+//! Counters of an ImageBufferPool
+struct ImageBufferPoolStats
+{
+    uint64_t hits;          // allocations served from idle buffers
+    uint64_t misses;        // allocations which had to allocate
+    size_t bytes_allocated; // held by the pool, idle and in use
+    size_t bytes_idle;
+};
+
+//! Process wide pool of image buffers by size class, from which
+//! PooledImageAllocator (and so ManagedImage and TypedImage by default)
+//! allocate. Released buffers are kept for reuse, up to a budget of idle
+//! bytes, so that images of a size seen before cost no heap allocation.
+//! Classes are whole cache lines, pages from a page up and huge pages from
+//! a huge page up, aligned to match.
+class PANGOLIN_EXPORT ImageBufferPool
+{
+public:
+    static const size_t default_budget_bytes = 512 * 1024 * 1024;
+
+    //! Pool of ManagedImage's default allocator
+    static ImageBufferPool& I();
+
+    //! Pool of page locked buffers, see AllocatePinned
+    static ImageBufferPool& Pinned();
+
+    explicit ImageBufferPool(bool pinned = false, size_t budget_bytes = default_budget_bytes);
+    ~ImageBufferPool();
+
+    ImageBufferPool(const ImageBufferPool&) = delete;
+
+    //! Buffer of at least size_bytes, aligned to its size class
+    void* Allocate(size_t size_bytes);
+
+    //! Return a buffer from Allocate with the size it was allocated with
+    void Release(void* ptr, size_t size_bytes);
+
+    //! Idle bytes kept for reuse. Frees idle buffers if over the new budget.
+    void SetBudgetBytes(size_t budget_bytes);
+
+    size_t BudgetBytes() const;
+
+    //! Free all idle buffers
+    void Trim();
+
+    ImageBufferPoolStats Stats() const;
+
+    //! Bytes actually allocated for a request of size_bytes
+    static size_t SizeClass(size_t size_bytes);
+
+private:
+    void Free(void* ptr, size_t class_bytes);
+    void TrimTo(size_t budget_bytes);
+
+    const bool pinned;
+    mutable std::mutex mutex;
+    size_t budget_bytes;
+    std::multimap<size_t, void*> idle;
+    ImageBufferPoolStats stats;
+};
+
+//! Allocator interface over an ImageBufferPool, which must be given the
+//! same size on deallocate as on allocate (as ManagedImage does).
+template<typename T, ImageBufferPool& (*Pool)() = &ImageBufferPool::I>
+struct PooledImageAllocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef PooledImageAllocator<U, Pool> other; };
+
+    PooledImageAllocator() {}
+
+    template<typename U>
+    PooledImageAllocator(const PooledImageAllocator<U, Pool>&) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(Pool().Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        Pool().Release(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PooledImageAllocator<U, Pool>&) const { return true; }
+
+    template<typename U>
+    bool operator!=(const PooledImageAllocator<U, Pool>&) const { return false; }
+};
+
+//! Pooled, page locked memory, for images copied to the GPU asynchronously
+template<typename T>
+using PinnedImageAllocator = PooledImageAllocator<T, &ImageBufferPool::Pinned>;
+
+//! Allocates every buffer afresh, aligned to Alignment bytes. Use 64 for
+//! cache lines, 4096 for pages, or 2MB for (transparent) huge pages.
+template<typename T, size_t Alignment = 64>
+struct AlignedImageAllocator
+{
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef AlignedImageAllocator<U, Alignment> other; };
+
+    AlignedImageAllocator() {}
+
+    template<typename U>
+    AlignedImageAllocator(const AlignedImageAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(AllocateImageBuffer(n * sizeof(T), Alignment));
+    }
+
+    void deallocate(T* p, size_t /*n*/)
+    {
+        FreeImageBuffer(p);
+    }
+
+    template<typename U>
+    bool operator==(const AlignedImageAllocator<U, Alignment>&) const { return true; }
+
+    template<typename U>
+    bool operator!=(const AlignedImageAllocator<U, Alignment>&) const { return false; }
+};
+
+template<typename T>
+using HugePageImageAllocator = AlignedImageAllocator<T, 2 * 1024 * 1024>;
+
+}
@@ -40,12 +40,54 @@ TypedImage LoadImage(std::istream& in, ImageFileType file_type);
 PANGOLIN_EXPORT
 TypedImage LoadImage(const std::string& filename, ImageFileType file_type);
 
+/// Decode into existing image dst of format dst_fmt, which must match the encoded
+/// size and format (std::runtime_error otherwise). PNG, JPEG, PPM, TGA and zstd
+/// decode straight into the rows of dst; other formats decode and copy.
+PANGOLIN_EXPORT
+void LoadImageInto(std::istream& in, ImageFileType file_type, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+
+PANGOLIN_EXPORT
+void LoadImageInto(const std::string& filename, ImageFileType file_type, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+
+/// Decode at 1/downscale of full size (rounded up) for downscale in {1, 2, 4, 8},
+/// e.g. for previews. JPEG is reduced in the DCT domain at a fraction of the cost
+/// of a full decode; other formats decode at full size and are subsampled.
+PANGOLIN_EXPORT
+TypedImage LoadImage(std::istream& in, ImageFileType file_type, size_t downscale);
+
+PANGOLIN_EXPORT
+TypedImage LoadImage(const std::string& filename, ImageFileType file_type, size_t downscale);
+
+/// Decode only the region [x, x+w) x [y, y+h), clipped to the image, e.g. to
+/// inspect part of a very large frame. PNG and JPEG stop after the last row
+/// needed (JPEG also skips the rows above and columns beside it with
+/// libjpeg-turbo), EXR reads only the lines or tiles covering the region and
+/// PPM seeks to each row. Other formats decode fully and crop.
+PANGOLIN_EXPORT
+TypedImage LoadImageRegion(std::istream& in, ImageFileType file_type, size_t x, size_t y, size_t w, size_t h);
+
+PANGOLIN_EXPORT
+TypedImage LoadImageRegion(const std::string& filename, ImageFileType file_type, size_t x, size_t y, size_t w, size_t h);
+
+/// Decode the region at (x, y) the size of dst into dst, which must lie
+/// within the image and match its format.
+PANGOLIN_EXPORT
+void LoadImageRegionInto(std::istream& in, ImageFileType file_type, size_t x, size_t y, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+
 PANGOLIN_EXPORT
 TypedImage LoadImage(const std::string& filename);
 
 PANGOLIN_EXPORT
 TypedImage LoadImage(const std::string& filename, const PixelFormat& raw_fmt, size_t raw_width, size_t raw_height, size_t raw_pitch);
 
+/// Read only the region [x, x+w) x [y, y+h) of a headerless image, seeking past the rest.
+PANGOLIN_EXPORT
+TypedImage LoadImageRegion(const std::string& filename, const PixelFormat& raw_fmt, size_t raw_width, size_t raw_height, size_t raw_pitch, size_t x, size_t y, size_t w, size_t h);
+
+/// Read a headerless image of raw_fmt into dst, which must be raw_width x raw_height.
+PANGOLIN_EXPORT
+void LoadImageInto(const std::string& filename, const PixelFormat& raw_fmt, size_t raw_width, size_t raw_height, size_t raw_pitch, const Image<unsigned char>& dst);
+
 /// Quality \in [0..100] for lossy formats
 PANGOLIN_EXPORT
 void SaveImage(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, ImageFileType file_type, bool top_line_first = true, float quality = 100.0f);
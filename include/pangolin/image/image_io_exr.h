@@ -0,0 +1,74 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <pangolin/image/typed_image.h>
+
+#include <iosfwd>
+#include <string>
+
+namespace pangolin {
+
+/// OpenEXR compression schemes. Zip and Piz suit most float images, Dwaa
+/// and Dwab are lossy and much faster on large HDR frames.
+enum class ExrCompression
+{
+    None, Rle, Zips, Zip, Piz, Pxr24, B44, B44a, Dwaa, Dwab
+};
+
+/// e.g. "piz", "dwaa" (case insensitive). Throws for unknown names.
+PANGOLIN_EXPORT
+ExrCompression ExrCompressionFromString(const std::string& name);
+
+struct ExrOptions
+{
+    ExrOptions() : compression(ExrCompression::Zip), threads(0) {}
+
+    ExrCompression compression;
+
+    /// OpenEXR worker threads to compress with, 0 for the current global
+    /// thread count. The global OpenEXR thread pool grows to this size.
+    size_t threads;
+};
+
+/// OpenEXR writes through memory, so out needn't be seekable (e.g. a
+/// packetstream encoder). Channels are written as R, G, B, A in order.
+PANGOLIN_EXPORT
+void SaveExr(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first, const ExrOptions& options = ExrOptions());
+
+/// Loads GRAY32F, RGB96F or RGBA128F depending on the channels present.
+/// Reads in place when in is backed by a memreadbuf.
+PANGOLIN_EXPORT
+TypedImage LoadExr(std::istream& in);
+
+PANGOLIN_EXPORT
+void LoadExr(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+
+}
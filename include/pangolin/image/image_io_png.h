@@ -0,0 +1,61 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <pangolin/image/typed_image.h>
+
+#include <iosfwd>
+
+namespace pangolin {
+
+struct PngOptions
+{
+    PngOptions() : compression_level(6), fast(false), threads(1) {}
+
+    /// zlib compression level [0..9]
+    int compression_level;
+
+    /// Fixed Up filter and run-length deflate instead of trying every filter
+    /// on every row, for several times faster encoding of camera streams.
+    /// The zlib level then has little effect (libdeflate still honours it).
+    bool fast;
+
+    /// Filter and compress horizontal strips of the image on this many
+    /// threads. Strips are joined into one standard deflate stream, at a small
+    /// cost in compression ratio.
+    size_t threads;
+};
+
+/// Writes PNG without libpng, which fast mode, threads > 1 and libdeflate
+/// (when available, single strip only) need. Read back with LoadImage as normal.
+PANGOLIN_EXPORT
+void SavePng(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first, const PngOptions& options);
+
+}
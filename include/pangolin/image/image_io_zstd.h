@@ -0,0 +1,101 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <pangolin/image/typed_image.h>
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pangolin {
+
+/// Trained zstd dictionary, shared by many small images such as the frames
+/// of one stream. Digested compression / decompression tables are built on
+/// first use and cached, so one instance should be reused across images.
+class PANGOLIN_EXPORT ZstdDictionary
+{
+public:
+    /// bytes as produced by TrainZstdDictionary or `zstd --train`
+    explicit ZstdDictionary(const std::string& bytes);
+    ~ZstdDictionary();
+
+    const std::string& Bytes() const { return bytes; }
+
+    struct Digested;
+    Digested& Digest() const { return *digested; }
+
+private:
+    std::string bytes;
+    std::unique_ptr<Digested> digested;
+};
+
+struct ZstdOptions
+{
+    ZstdOptions() : workers(0) {}
+
+    /// Compression worker threads, 0 to compress on the calling thread.
+    /// Ignored with a warning if libzstd was built without multithreading.
+    int workers;
+
+    /// Optional dictionary. Images must be decoded with the one they were encoded with.
+    std::shared_ptr<const ZstdDictionary> dictionary;
+};
+
+PANGOLIN_EXPORT
+void SaveZstd(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, int compression_level, const ZstdOptions& options);
+
+PANGOLIN_EXPORT
+TypedImage LoadZstd(std::istream& in, const ZstdOptions& options);
+
+PANGOLIN_EXPORT
+void LoadZstd(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt, const ZstdOptions& options);
+
+/// Compress size bytes of data as one zstd frame, replacing the contents of out.
+PANGOLIN_EXPORT
+void ZstdCompress(const void* data, size_t size, std::string& out, int compression_level, const ZstdOptions& options);
+
+/// Decompressed size of the zstd frame held by the size bytes of data.
+/// Throws std::runtime_error if it isn't a frame written by ZstdCompress.
+PANGOLIN_EXPORT
+size_t ZstdDecompressedSize(const void* data, size_t size);
+
+/// Decompress the zstd frame held by the size bytes of data into exactly
+/// dst_size bytes of dst.
+PANGOLIN_EXPORT
+void ZstdDecompress(const void* data, size_t size, void* dst, size_t dst_size, const ZstdOptions& options);
+
+/// Train a dictionary of at most max_dict_bytes from the pixel data of samples,
+/// which should be representative frames of the stream it will be used for.
+PANGOLIN_EXPORT
+std::string TrainZstdDictionary(const std::vector<Image<unsigned char>>& samples, const PixelFormat& fmt, size_t max_dict_bytes = 112640);
+
+}
@@ -0,0 +1,96 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/image/image.h>
+#include <pangolin/image/pixel_format.h>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace pangolin
+{
+
+// Fixed point bilinear lookup of one output pixel into the source image:
+// samples (x,y), (x+1,y), (x,y+1) and (x+1,y+1) weighted by the fractions
+// fx / fy of RemapFracOne. Invalid entries (outside the source) output 0.
+struct RemapEntry
+{
+    uint16_t x, y;
+    uint8_t fx, fy;
+    uint8_t valid;
+    uint8_t reserved;
+};
+
+const int RemapFracBits = 7;
+const int RemapFracOne = 1 << RemapFracBits;
+
+// Output to source lookup, computed once and applied per frame by RemapImage
+// (or on the GPU by GlRemapProcessor).
+struct PANGOLIN_EXPORT RemapTable
+{
+    RemapTable()
+        : w(0), h(0), src_w(0), src_h(0)
+    {
+    }
+
+    // Tabulate map, which returns false if output pixel (x,y) has no source,
+    // else its source pixel coordinates (sx,sy). Pixel centres lie on
+    // integer coordinates. Sources within half a pixel of the image border
+    // are clamped to it, and src_w and src_h must be at least 2.
+    static RemapTable FromFunction(
+        size_t w, size_t h, size_t src_w, size_t src_h,
+        const std::function<bool(double x, double y, double& sx, double& sy)>& map
+    );
+
+    const RemapEntry& operator()(size_t x, size_t y) const
+    {
+        return entries[y * w + x];
+    }
+
+    size_t w, h;
+    size_t src_w, src_h;
+    std::vector<RemapEntry> entries;
+};
+
+//! True iff RemapImage supports fmt: interleaved formats of 1 to 4 8 or 16
+//! bit integer or 32 bit float channels.
+PANGOLIN_EXPORT
+bool CanRemapPixelFormat(const PixelFormat& fmt);
+
+//! Resample src into dst (table.w x table.h), both of format fmt, through
+//! table (built for src of table.src_w x table.src_h), splitting rows across
+//! up to num_threads tasks (0 for one per core).
+//! Throws std::runtime_error if fmt isn't supported or sizes don't match.
+PANGOLIN_EXPORT
+void RemapImage(
+    const Image<unsigned char>& dst, const Image<unsigned char>& src,
+    const PixelFormat& fmt, const RemapTable& table, size_t num_threads = 1
+);
+
+}
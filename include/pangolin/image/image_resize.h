@@ -0,0 +1,62 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/image/image.h>
+#include <pangolin/image/pixel_format.h>
+
+#include <string>
+
+namespace pangolin
+{
+
+enum ResizeMethod
+{
+    ResizeMethodArea,       // average over the covered source area (bilinear when enlarging)
+    ResizeMethodBilinear    // interpolate the nearest 2x2 source pixels
+};
+
+PANGOLIN_EXPORT
+ResizeMethod ResizeMethodFromString(const std::string& str);
+
+//! True iff ResizeImage supports fmt: every format with byte aligned
+//! channels. Bit packed formats such as GRAY10 must be unpacked first.
+PANGOLIN_EXPORT
+bool CanResizePixelFormat(const PixelFormat& fmt);
+
+//! Resample src into dst, both of format fmt, splitting rows across up to
+//! num_threads tasks (0 for one per core). Pixel centres are aligned, and
+//! each plane of planar formats is resampled separately. YUYV422 / UYVY422
+//! are resampled in pairs of pixels, so both widths must be even.
+//! Throws std::runtime_error if fmt isn't supported.
+PANGOLIN_EXPORT
+void ResizeImage(
+    const Image<unsigned char>& dst, const Image<unsigned char>& src,
+    const PixelFormat& fmt, ResizeMethod method = ResizeMethodArea,
+    size_t num_threads = 1
+);
+
+}
@@ -81,6 +81,11 @@ std::pair<float, float> GetMinMax(const Image<T>& img, size_t channels)
     return mm;
 }
 
+// Vectorised where available, and preferred over the template above
+PANGOLIN_EXPORT std::pair<float, float> GetMinMax(const Image<unsigned char>& img, size_t channels);
+PANGOLIN_EXPORT std::pair<float, float> GetMinMax(const Image<unsigned short>& img, size_t channels);
+PANGOLIN_EXPORT std::pair<float, float> GetMinMax(const Image<float>& img, size_t channels);
+
 template<typename T>
 pangolin::Image<T> GetImageRoi( pangolin::Image<T> img, size_t channels, const pangolin::XYRangei& roi )
 {
@@ -95,7 +100,7 @@ template<typename T>
 std::pair<float,float> GetOffsetScale(const pangolin::Image<T>& img, size_t channels, float type_max, float format_max)
 {
     // Find min / max of all channels, ignoring 4th alpha channel
-    const std::pair<float,float> mm = internal::GetMinMax<T>(img,channels);
+    const std::pair<float,float> mm = internal::GetMinMax(img,channels);
     const float type_scale = format_max / type_max;
     const float offset = -type_scale* mm.first;
     const float scale = type_max / (mm.second - mm.first);
@@ -29,16 +29,30 @@
 
 #include <pangolin/image/image.h>
 #include <pangolin/image/copy.h>
+#include <pangolin/image/image_allocator.h>
+
+#include <memory>
+#include <type_traits>
 
 namespace pangolin {
 
-template<class T> using DefaultImageAllocator = std::allocator<T>;
+// Buffers come from the process wide ImageBufferPool, so that images of a
+// size allocated before are handed an idle buffer rather than a new one.
+template<class T> using DefaultImageAllocator = PooledImageAllocator<T>;
 
-// Image that manages it's own memory, storing a strong pointer to it's memory
+// Image that manages it's own memory, storing a strong pointer to it's memory.
+// Allocator may be any of image_allocator.h, or a std::allocator like type.
 template<typename T, class Allocator = DefaultImageAllocator<T> >
 class ManagedImage : public Image<T>
 {
 public:
+    // Elements allocated for h rows of pitch_bytes, as given to the allocator
+    // both to allocate and deallocate
+    static size_t AllocationSize(size_t h, size_t pitch_bytes)
+    {
+        return std::max<size_t>(1, (h * pitch_bytes + sizeof(T) - 1) / sizeof(T));
+    }
+
     // Destructor
     inline
     ~ManagedImage()
@@ -56,7 +70,7 @@ public:
     inline
     ManagedImage(size_t w)
         : Image<T>(
-              Allocator().allocate(w),
+              Allocator().allocate(AllocationSize(1, w*sizeof(T))),
                w, 1, w*sizeof(T)
               )
     {
@@ -65,7 +79,7 @@ public:
     inline
     ManagedImage(size_t w, size_t h)
         : Image<T>(
-              Allocator().allocate(w*h),
+              Allocator().allocate(AllocationSize(h, w*sizeof(T))),
                w, h, w*sizeof(T)
               )
     {
@@ -74,7 +88,7 @@ public:
     inline
     ManagedImage(size_t w, size_t h, size_t pitch_bytes)
         : Image<T>(
-              Allocator().allocate( (h*pitch_bytes) / sizeof(T) + 1),
+              Allocator().allocate(AllocationSize(h, pitch_bytes)),
                w, h, pitch_bytes
               )
     {
@@ -154,15 +168,18 @@ public:
     inline void Deallocate()
     {
         if (Image<T>::ptr) {
-            Allocator().deallocate(Image<T>::ptr, (Image<T>::h * Image<T>::pitch) / sizeof(T) );
+            Allocator().deallocate(Image<T>::ptr, AllocationSize(Image<T>::h, Image<T>::pitch));
             Image<T>::ptr = nullptr;
         }
     }
 
-    // Move asignment
+    // Move asignment. img must come from the same kind of allocator, which
+    // is then given the same size in bytes, so the layout must divide evenly.
     template<typename TOther, typename AllocOther> inline
     void OwnAndReinterpret(ManagedImage<TOther,AllocOther>&& img)
     {
+        static_assert(std::is_same<typename std::allocator_traits<AllocOther>::template rebind_alloc<T>, Allocator>::value,
+                      "OwnAndReinterpret needs images of the same allocator");
         Deallocate();
         Image<T>::pitch = img.pitch;
         Image<T>::ptr   = (T*)img.ptr;
@@ -87,6 +87,65 @@ void PitchedCopy(char* dst, unsigned int dst_pitch_bytes, const char* src, unsig
 #endif
 }
 
+// Tuning of FrameCopy / FramePitchedCopy, for copies of whole frames into
+// buffers which won't be read again soon (recording queues, frame slots).
+struct PANGOLIN_EXPORT FrameCopySettings
+{
+    FrameCopySettings()
+        : stream_threshold(4 << 20), parallel_threshold(4 << 20), max_threads(4)
+    {
+    }
+
+    // Copies of at least this many bytes bypass the cache with streaming stores
+    size_t stream_threshold;
+    // Copies of at least this many bytes are split across up to max_threads
+    size_t parallel_threshold;
+    size_t max_threads;
+};
+
+//! Process wide settings used by FrameCopy / FramePitchedCopy
+PANGOLIN_EXPORT
+FrameCopySettings& FrameCopyConfig();
+
+//! Copy with non-temporal (streaming) stores where supported, leaving the
+//! destination out of the cache. Host memory only.
+PANGOLIN_EXPORT
+void MemCopyStreaming(void* dst, const void* src, size_t size_bytes);
+
+//! As PitchedCopy, splitting rows across up to num_threads tasks (0 for one
+//! per core) and optionally using streaming stores. Host memory only.
+PANGOLIN_EXPORT
+void PitchedCopyParallel(char* dst, size_t dst_pitch_bytes, const char* src, size_t src_pitch_bytes, size_t width_bytes, size_t height, size_t num_threads = 0, bool streaming = false);
+
+//! Copy choosing plain, streaming and / or parallel copies by size according
+//! to FrameCopyConfig(). Host memory only.
+PANGOLIN_EXPORT
+void FrameCopy(void* dst, const void* src, size_t size_bytes);
+
+PANGOLIN_EXPORT
+void FramePitchedCopy(char* dst, size_t dst_pitch_bytes, const char* src, size_t src_pitch_bytes, size_t width_bytes, size_t height);
+
+//! Allocate size_bytes of page locked (pinned) host memory, from which copies
+//! to the device can run asynchronously. Uses cudaHostAlloc with HAVE_CUDA,
+//! otherwise page aligned memory locked with LockMemory where permitted.
+//! Throws std::bad_alloc on failure. Free with FreePinned.
+PANGOLIN_EXPORT
+unsigned char* AllocatePinned(size_t size_bytes);
+
+PANGOLIN_EXPORT
+void FreePinned(unsigned char* ptr, size_t size_bytes);
+
+#ifdef HAVE_CUDA
+//! Enqueue a copy on stream, returning immediately. The copy is only
+//! asynchronous from host memory when it is pinned (see AllocatePinned), and
+//! src must remain valid until the stream has completed it.
+inline
+bool MemCopyAsync(void *dst, const void *src, size_t size_bytes, cudaStream_t stream)
+{
+    return cudaMemcpyAsync(dst, src, size_bytes, cudaMemcpyDefault, stream) == cudaSuccess;
+}
+#endif
+
 PANGO_HOST_DEVICE inline
 void Memset(char* ptr, unsigned char v, size_t size_bytes)
 {
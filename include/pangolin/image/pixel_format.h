@@ -28,18 +28,139 @@
 #pragma once
 
 #include <pangolin/platform.h>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 
 namespace pangolin
 {
 
+// Supported pixel formats, in FFMPEG notation (not to exceed 8 byte format code):
+//  X(name, channels, channel bits..., bpp, planar, floating point, blue first)
+// Planar formats store their full resolution luma plane first, as described
+// by an image's w, h and pitch, followed by 4:2:0 chroma: interleaved UV rows
+// of the same pitch for NV12, or U then V planes of half the pitch for YUV420P.
+#define PANGOLIN_PIXEL_FORMATS(X) \
+    X(GRAY8,    1,  8, 0, 0, 0,   8, false, false, false) \
+    X(GRAY10,   1, 10, 0, 0, 0,  10, false, false, false) \
+    X(GRAY12,   1, 12, 0, 0, 0,  12, false, false, false) \
+    X(GRAY16LE, 1, 16, 0, 0, 0,  16, false, false, false) \
+    X(GRAY32,   1, 32, 0, 0, 0,  32, false, false, false) \
+    X(Y400A,    2,  8, 8, 0, 0,  16, false, false, false) \
+    X(RGB24,    3,  8, 8, 8, 0,  24, false, false, false) \
+    X(BGR24,    3,  8, 8, 8, 0,  24, false, false, true ) \
+    X(RGB48,    3, 16,16,16, 0,  48, false, false, false) \
+    X(BGR48,    3, 16,16,16, 0,  48, false, false, true ) \
+    X(YUYV422,  3,  4, 2, 2, 0,  16, false, false, false) \
+    X(RGBA32,   4,  8, 8, 8, 8,  32, false, false, false) \
+    X(BGRA32,   4,  8, 8, 8, 8,  32, false, false, true ) \
+    X(GRAY32F,  1, 32, 0, 0, 0,  32, false, true,  false) \
+    X(GRAY64F,  1, 64, 0, 0, 0,  64, false, true,  false) \
+    X(RGB96F,   3, 32,32,32, 0,  96, false, true,  false) \
+    X(RGBA128F, 4, 32,32,32,32, 128, false, true,  false) \
+    X(UYVY422,  3,  4, 2, 2, 0,  16, false, false, false) \
+    X(NV12,     3,  4, 2, 0, 0,  12, true,  false, false) \
+    X(YUV420P,  3,  4, 2, 0, 0,  12, true,  false, false)
+
+//! Interned identifier of a supported pixel format
+enum class PixelFormatId : uint8_t
+{
+    Unknown = 0,
+#define PANGOLIN_PIXEL_FORMAT_ID(name, ...) name,
+    PANGOLIN_PIXEL_FORMATS(PANGOLIN_PIXEL_FORMAT_ID)
+#undef PANGOLIN_PIXEL_FORMAT_ID
+    Count
+};
+
+namespace detail
+{
+struct PixelFormatInfo
+{
+    unsigned int channels;
+    unsigned int channel_bits[4];
+    unsigned int bpp;
+    bool planar;
+    bool floating;
+    bool bgr;
+};
+
+constexpr PixelFormatInfo pixel_format_info[] =
+{
+    {0, {0,0,0,0}, 0, false, false, false},
+#define PANGOLIN_PIXEL_FORMAT_INFO(name, ch, b0, b1, b2, b3, bpp, planar, floating, bgr) {ch, {b0,b1,b2,b3}, bpp, planar, floating, bgr},
+    PANGOLIN_PIXEL_FORMATS(PANGOLIN_PIXEL_FORMAT_INFO)
+#undef PANGOLIN_PIXEL_FORMAT_INFO
+};
+
+// Type holding one channel of bits, or void if channels aren't byte aligned
+template<unsigned int bits, bool floating> struct PixelChannelType { using type = void; };
+template<> struct PixelChannelType<8,false>  { using type = uint8_t; };
+template<> struct PixelChannelType<16,false> { using type = uint16_t; };
+template<> struct PixelChannelType<32,false> { using type = uint32_t; };
+template<> struct PixelChannelType<32,true>  { using type = float; };
+template<> struct PixelChannelType<64,true>  { using type = double; };
+}
+
+//! Properties of pixel format F known at compile time, for conversion kernels
+template<PixelFormatId F>
+struct PixelFormatTraits
+{
+    static constexpr PixelFormatId id = F;
+    static constexpr unsigned int channels = detail::pixel_format_info[size_t(F)].channels;
+    static constexpr unsigned int bpp = detail::pixel_format_info[size_t(F)].bpp;
+    static constexpr unsigned int channel_bits = detail::pixel_format_info[size_t(F)].channel_bits[0];
+    static constexpr bool planar = detail::pixel_format_info[size_t(F)].planar;
+    static constexpr bool floating = detail::pixel_format_info[size_t(F)].floating;
+    static constexpr bool bgr = detail::pixel_format_info[size_t(F)].bgr;
+
+    // Type of the first channel of a pixel
+    using ChannelType = typename detail::PixelChannelType<channel_bits, floating>::type;
+};
+
+template<PixelFormatId F> constexpr PixelFormatId PixelFormatTraits<F>::id;
+template<PixelFormatId F> constexpr unsigned int PixelFormatTraits<F>::channels;
+template<PixelFormatId F> constexpr unsigned int PixelFormatTraits<F>::bpp;
+template<PixelFormatId F> constexpr unsigned int PixelFormatTraits<F>::channel_bits;
+template<PixelFormatId F> constexpr bool PixelFormatTraits<F>::planar;
+template<PixelFormatId F> constexpr bool PixelFormatTraits<F>::floating;
+template<PixelFormatId F> constexpr bool PixelFormatTraits<F>::bgr;
+
 struct PANGOLIN_EXPORT PixelFormat
 {
+    PixelFormat()
+        : id(PixelFormatId::Unknown), channels(0), channel_bits{0,0,0,0}, bpp(0), planar(false)
+    {
+    }
+
+    PixelFormat(PixelFormatId id)
+        : id(id),
+          channels(detail::pixel_format_info[size_t(id)].channels),
+          channel_bits{detail::pixel_format_info[size_t(id)].channel_bits[0], detail::pixel_format_info[size_t(id)].channel_bits[1],
+                       detail::pixel_format_info[size_t(id)].channel_bits[2], detail::pixel_format_info[size_t(id)].channel_bits[3]},
+          bpp(detail::pixel_format_info[size_t(id)].bpp),
+          planar(detail::pixel_format_info[size_t(id)].planar)
+    {
+    }
+
+    //! Format code in FFMPEG notation, for serialization and messages
+    const std::string& Name() const;
+
     // Previously, VideoInterface::PixFormat returned a string.
     // For compatibility, make this string convertable
-    inline operator std::string() const { return format; }
-    
-    std::string  format;
+    inline operator std::string() const { return Name(); }
+
+    //! Channels hold floating point values
+    bool IsFloat() const { return detail::pixel_format_info[size_t(id)].floating; }
+
+    //! Colour channels are in blue, green, red order
+    bool IsBgr() const { return detail::pixel_format_info[size_t(id)].bgr; }
+
+    bool operator==(const PixelFormat& o) const { return id == o.id; }
+    bool operator!=(const PixelFormat& o) const { return id != o.id; }
+
+    PixelFormatId id;
     unsigned int channels;
     unsigned int channel_bits[4];
     unsigned int bpp;
@@ -52,6 +173,22 @@ struct PANGOLIN_EXPORT PixelFormat
 PANGOLIN_EXPORT
 PixelFormat PixelFormatFromString(const std::string& format);
 
+//! Call f with std::integral_constant<PixelFormatId,id>, so that kernels
+//! written against PixelFormatTraits are selected by a single switch
+//! rather than per pixel. Every format's instantiation of f must compile.
+template<typename F>
+auto DispatchPixelFormat(PixelFormatId id, F&& f)
+    -> decltype(f(std::integral_constant<PixelFormatId, PixelFormatId::GRAY8>()))
+{
+    switch(id) {
+#define PANGOLIN_PIXEL_FORMAT_CASE(name, ...) \
+    case PixelFormatId::name: return f(std::integral_constant<PixelFormatId, PixelFormatId::name>());
+    PANGOLIN_PIXEL_FORMATS(PANGOLIN_PIXEL_FORMAT_CASE)
+#undef PANGOLIN_PIXEL_FORMAT_CASE
+    default: throw std::runtime_error("DispatchPixelFormat: Unknown pixel format");
+    }
+}
+
 ////////////////////////////////////////////////////////////////////
 /// Deprecated aliases for above
 
@@ -0,0 +1,65 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/image/image.h>
+#include <pangolin/image/pixel_format.h>
+
+namespace pangolin
+{
+
+// Conversion between pixel formats, vectorized for SSE2 / SSSE3 and NEON
+// where the CPU supports it. Supported conversions are:
+//   YUYV422, UYVY422, NV12, YUV420P -> RGB24, BGR24, RGBA32, BGRA32, GRAY8
+//   RGB24, BGR24, RGBA32, BGRA32    -> RGB24, BGR24, RGBA32, BGRA32
+//   GRAY8, GRAY16LE                 -> GRAY32F (multiplied by scale)
+// along with copies between images of the same format. YUV is taken to be
+// limited range BT.601, and its luma is passed through unchanged to GRAY8.
+// Planar images are laid out as described by PANGOLIN_PIXEL_FORMATS.
+
+//! True iff ConvertPixelFormat can convert images of src_fmt into dst_fmt
+PANGOLIN_EXPORT
+bool CanConvertPixelFormat(const PixelFormat& dst_fmt, const PixelFormat& src_fmt);
+
+//! Convert src into dst, which must have the same dimensions, splitting rows
+//! across up to num_threads tasks (0 for one per core).
+//! Throws std::runtime_error if the conversion isn't supported.
+PANGOLIN_EXPORT
+void ConvertPixelFormat(
+    const Image<unsigned char>& dst, const PixelFormat& dst_fmt,
+    const Image<unsigned char>& src, const PixelFormat& src_fmt,
+    float scale = 1.0f, size_t num_threads = 1
+);
+
+//! Convert a single row of w pixels. src_fmt must not be planar.
+PANGOLIN_EXPORT
+void ConvertPixelFormatRow(
+    unsigned char* dst_row, const PixelFormat& dst_fmt,
+    const unsigned char* src_row, const PixelFormat& src_fmt,
+    size_t w, float scale = 1.0f
+);
+
+}
@@ -29,13 +29,23 @@
 
 #include <pangolin/log/packetstream.h>
 #include <pangolin/log/packetstream_source.h>
+#include <pangolin/utils/memory_mapped_file.h>
+
+#include <memory>
+#include <vector>
 
 namespace pangolin {
 
+// Packet of src as written, from the size bytes stored of a source which
+// declares compression (see PacketStreamSource::compression).
+PANGOLIN_EXPORT
+std::shared_ptr<std::vector<unsigned char>> DecompressPacket(const PacketStreamSource& src, const unsigned char* data, size_t size);
+
 // Encapsulate serialized reading of Packet from stream.
 struct Packet
 {
-    Packet(PacketStream& s, std::unique_lock<std::recursive_mutex>&& mutex, std::vector<PacketStreamSource>& srcs);
+    Packet(PacketStream& s, std::unique_lock<std::recursive_mutex>&& mutex, std::vector<PacketStreamSource>& srcs,
+           const std::shared_ptr<MemoryMappedFile>& mapping = nullptr);
     Packet(const Packet&) = delete;
     Packet(Packet&& o);
     ~Packet();
@@ -48,18 +58,41 @@ struct Packet
         return _stream;
     }
 
+    // Packet data in place within the memory mapped log, or nullptr if the
+    // reader isn't mapped. Reading through Data() does not advance Stream().
+    // Packets of compressed sources are always decompressed up front, and
+    // must be read through Data() rather than Stream().
+    unsigned char* Data() const;
+
+    // Mapping of the log, or nullptr if the reader isn't mapped.
+    const std::shared_ptr<MemoryMappedFile>& Mapping() const
+    {
+        return _mapping;
+    }
+
+    // Hold onto the owner to keep Data() valid beyond the life of the packet.
+    std::shared_ptr<void> Owner() const
+    {
+        if(_decompressed) return _decompressed;
+        return _mapping;
+    }
+
     PacketStreamSourceId src;
     int64_t time;
     size_t size;
     size_t sequence_num;
     picojson::value meta;
+    std::string binary_meta;    // empty unless written with the packet
     std::streampos frame_streampos;
 
 private:
     void ParsePacketHeader(PacketStream& s, std::vector<PacketStreamSource>& srcs);
     void ReadRemaining();
+    unsigned char* MappedData() const;
 
     PacketStream& _stream;
+    std::shared_ptr<MemoryMappedFile> _mapping;
+    std::shared_ptr<std::vector<unsigned char>> _decompressed;
 
     std::unique_lock<std::recursive_mutex> lock;
 
@@ -67,4 +100,25 @@ private:
     size_t _data_len;
 };
 
+// Packet demultiplexed by a PacketStreamReader for one of its subscribers
+// (see PacketStreamReader::Subscribe). The data is held in place within the
+// mapped log, or copied out of the stream, and stays valid whilst owner is held.
+struct QueuedPacket
+{
+    QueuedPacket()
+        : src(0), time(0), size(0), sequence_num(0), data(nullptr)
+    {
+    }
+
+    PacketStreamSourceId src;
+    int64_t time;
+    size_t size;
+    size_t sequence_num;
+    picojson::value meta;
+    std::string binary_meta;
+
+    unsigned char* data;
+    std::shared_ptr<void> owner;
+};
+
 }
@@ -35,6 +35,12 @@
 namespace pangolin
 {
 
+// Name of the n'th file of a rotated log. The first keeps the requested name,
+// later ones insert a sequence number before the extension:
+// rec.pango, rec.0001.pango, rec.0002.pango, ...
+PANGOLIN_EXPORT
+std::string PacketStreamChunkFilename(const std::string& filename, size_t chunk);
+
 class PacketStream: public std::ifstream
 {
 public:
@@ -25,7 +25,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <fstream>
+#include <map>
 #include <mutex>
 #include <thread>
 
@@ -33,11 +36,67 @@
 
 #include <pangolin/log/sync_time.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/memory_mapped_file.h>
 #include <pangolin/utils/timer.h>
 
 namespace pangolin
 {
 
+// Snapshot of a log's files and index shared by its cursors
+struct PacketStreamCursorLog;
+
+// Reads the packets of one source of a log through its index, independently
+// of the PacketStreamReader it came from and of any other cursor, so that
+// threads may each read and seek their own cursor at once without locking.
+// Packets are read in place from the memory mapped log, or through a file
+// handle of the cursor's own where the log can't be mapped.
+class PANGOLIN_EXPORT PacketStreamCursor
+{
+public:
+    PacketStreamCursor(const std::shared_ptr<const PacketStreamCursorLog>& log, PacketStreamSourceId src);
+    PacketStreamCursor(PacketStreamCursor&&) = default;
+    PacketStreamCursor& operator=(PacketStreamCursor&&) = default;
+    ~PacketStreamCursor();
+
+    PacketStreamSourceId Source() const
+    {
+        return _src;
+    }
+
+    // Packets of the source within the index
+    size_t NumPackets() const;
+
+    // Id of the packet Next() will return
+    size_t Tell() const
+    {
+        return _next_id;
+    }
+
+    bool AtEnd() const
+    {
+        return _next_id >= NumPackets();
+    }
+
+    void Seek(size_t packet_id);
+
+    // Jumps to the first packet with time >= time, returning its id
+    size_t Seek(SyncTime::TimePoint time);
+
+    // Read the next packet. Throws at the end of the source.
+    QueuedPacket Next();
+
+    // Read any packet of the source, without moving the cursor.
+    QueuedPacket Read(size_t packet_id);
+
+private:
+    std::shared_ptr<const PacketStreamCursorLog> _log;
+    PacketStreamSourceId _src;
+    size_t _next_id;
+
+    // Opened on demand for files of the log which aren't mapped
+    std::vector<std::unique_ptr<PacketStream>> _streams;
+};
+
 class PANGOLIN_EXPORT PacketStreamReader
 {
 public:
@@ -47,22 +106,86 @@ public:
 
     ~PacketStreamReader();
 
+    // Opening the first file of a rotated log (see PacketStreamWriter::SetRotation)
+    // reads the whole set as one stream, with packets numbered and seekable across files.
     void Open(const std::string& filename);
 
     void Close();
 
+    // Also map the (seekable) log into memory so that packets expose their data
+    // in place through Packet::Data(). Returns false if the file can't be mapped.
+    bool MemoryMap();
+
+    bool IsMemoryMapped() const
+    {
+        return _mapping != nullptr;
+    }
+
+    // Files making up the log, more than one if it was rotated
+    size_t NumChunks() const
+    {
+        return std::max<size_t>(1, _chunks.size());
+    }
+
     const std::vector<PacketStreamSource>&
     Sources() const
     {
         return _sources;
     }
 
+    // Added to packet times to give the shared time base of a coordinated
+    // recording (see RecordCoordinator), 0 for logs recorded on their own
+    int64_t ClockOffsetUs() const
+    {
+        return _clock_offset_us;
+    }
+
     // Grab Next available frame packetstream
     Packet NextFrame();
 
     // Grab Next available frame in packetstream from src, discarding other frames.
     Packet NextFrame(PacketStreamSourceId src);
 
+    // Demultiplexing, for several consumers sharing the reader: packets read
+    // whilst looking for one subscriber's source are queued for the others,
+    // so that any number of sources are replayed reading the log once, in order.
+    // Subscribers are fed from src's next packet, and the oldest of up to
+    // max_queue packets are dropped for subscribers which fall behind.
+    // Returns an id for the other subscriber methods.
+    size_t Subscribe(PacketStreamSourceId src, size_t max_queue = 256);
+
+    void Unsubscribe(size_t subscriber);
+
+    // Next packet of the subscriber's source. Throws at the end of the stream.
+    QueuedPacket NextSubscribedFrame(size_t subscriber);
+
+    // Id of the next packet NextSubscribedFrame() will return to the subscriber
+    size_t NextPacketId(size_t subscriber);
+
+    // Restart the subscriber at a packet of its source, returning its id. The
+    // log is only rewound as far as the earliest packet still to be queued.
+    size_t SeekSubscriber(size_t subscriber, size_t framenum);
+
+    // As above, at the first packet with time >= time
+    size_t SeekSubscriber(size_t subscriber, SyncTime::TimePoint time);
+
+    // Cursor over the packets of src, for reading from other threads without
+    // contending with this reader or each other (see PacketStreamCursor).
+    // Needs a seekable log. Cursors keep reading the index as it was when
+    // they were made.
+    PacketStreamCursor Cursor(PacketStreamSourceId src);
+
+    // Read any packet of src through the index, without moving the reader,
+    // its subscribers or anything synchronised to it. Safe to call from any
+    // number of threads at once: each read borrows an idle cursor of the
+    // source, making another if none are free. Needs a seekable log.
+    QueuedPacket ReadPacket(PacketStreamSourceId src, size_t packet_id);
+
+    // Read several packets of src as above, in the order they lie within the
+    // log rather than as asked for, so that the file is read sequentially.
+    // Packets are returned in the order asked for.
+    std::vector<QueuedPacket> ReadPackets(PacketStreamSourceId src, const std::vector<size_t>& packet_ids);
+
     bool Good() const
     {
         return _stream.good();
@@ -74,9 +197,37 @@ public:
     // Jumps to the first packet with time >= time
     size_t Seek(PacketStreamSourceId src, SyncTime::TimePoint time);
 
-    void FixFileIndex();
+    // Rebuild the index by scanning the packets of the log, for logs which lost
+    // their footer. Large logs are split into byte ranges scanned on num_threads
+    // threads (0 for one per core), whose results are stitched together.
+    void RebuildIndex(size_t num_threads = 0);
+
+    // Rebuild the index as above and append it to the file.
+    void FixFileIndex(size_t num_threads = 0);
 
 private:
+    struct Chunk
+    {
+        std::string filename;
+        std::streamoff base;    // added to positions within the file to index the set
+    };
+
+    void OpenFile(const std::string& filename);
+
+    // Find later files of a rotated log starting with the open file
+    bool FindChunks();
+
+    // Index every chunk after the first, appending to the open file's index
+    void IndexChunks();
+
+    void OpenChunk(size_t chunk);
+
+    // Move on to the next chunk at the end of one, if there is one
+    bool NextChunk();
+
+    // Seek to a position in the index, which may be in another chunk
+    void SeekIndexPos(int64_t pos);
+
     bool GoodToRead();
 
     bool SetupIndex();
@@ -87,7 +238,20 @@ private:
 
     bool ParseIndex();
 
-    void RebuildIndex();
+    bool ParseJsonIndex();
+
+    bool ParseBinaryIndex();
+
+    std::shared_ptr<MemoryMappedFile> FileMapping();
+
+    // Load the index from checkpoints left by the writer, returning the
+    // position to continue indexing from, or -1 if there are no usable checkpoints.
+    std::streampos LoadIndexCheckpoints();
+
+    std::streampos FindLastCheckpoint();
+
+    // Read checkpoint at the current position, appending entries to the index when append is set
+    bool ParseCheckpoint(uint64_t& prev_pos, bool append);
 
     void AppendIndex();
 
@@ -95,6 +259,8 @@ private:
 
     void SkipSync();
 
+    void SkipPadding();
+
     void ReSync() {
         _stream.syncToTag();
     }
@@ -102,12 +268,48 @@ private:
     std::string _filename;
     std::vector<PacketStreamSource> _sources;
     SyncTime::TimePoint packet_stream_start;
+    std::streampos _data_start;     // first packet, following the header and initial sources
 
     PacketStream _stream;
     std::recursive_mutex _mutex;
 
     bool _is_pipe;
     int _pipe_fd;
+
+    bool _memory_map;
+    std::shared_ptr<MemoryMappedFile> _mapping;
+    std::shared_ptr<MemoryMappedFile> _file_mapping;
+
+    std::vector<Chunk> _chunks;     // empty unless reading a rotated log
+    size_t _chunk;
+
+    struct Subscriber
+    {
+        PacketStreamSourceId src;
+        size_t max_queue;
+        size_t next_id;     // next packet to hand out
+        size_t read_id;     // next packet to queue, ignoring those before
+        std::deque<QueuedPacket> queue;
+    };
+
+    // Queue a packet for every subscriber to its source
+    void Dispatch(Packet& packet);
+
+    std::map<size_t, Subscriber> _subscribers;
+    size_t _next_subscriber;
+
+    // Shared by cursors, made on demand and dropped when the index changes
+    std::shared_ptr<const PacketStreamCursorLog> _cursor_log;
+
+    // Forget cursors of an outdated index. Caller must hold _mutex.
+    void ResetCursorLog();
+
+    // Cursors lent by ReadPacket, per source, made for _idle_generation
+    std::mutex _idle_mutex;
+    std::map<PacketStreamSourceId, std::vector<std::unique_ptr<PacketStreamCursor>>> _idle_cursors;
+    size_t _idle_generation;
+
+    int64_t _clock_offset_us;
 };
 
 
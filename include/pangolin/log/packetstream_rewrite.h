@@ -0,0 +1,89 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/log/packetstream_source.h>
+#include <pangolin/utils/picojson.h>
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+struct PANGOLIN_EXPORT PacketStreamRewriteOptions
+{
+    //! Sources to keep, all if empty. Kept sources are renumbered in order.
+    std::vector<PacketStreamSourceId> sources;
+
+    //! Range of packets to keep, by their number within each source
+    size_t first_packet = 0;
+    size_t end_packet = std::numeric_limits<size_t>::max();
+
+    //! Range of packet times to keep, in microseconds
+    int64_t start_time_us = std::numeric_limits<int64_t>::min();
+    int64_t end_time_us = std::numeric_limits<int64_t>::max();
+
+    //! Edit each kept source, such as its device properties, given its
+    //! number in the input
+    std::function<void(PacketStreamSourceId src, PacketStreamSource& source)> edit_source;
+
+    //! Edit the frame properties of each kept packet, given its source and
+    //! packet number in the input
+    std::function<void(PacketStreamSourceId src, size_t packet, picojson::value& meta)> edit_meta;
+
+    //! Called after each packet written, with the packets kept so far
+    std::function<void(size_t packets)> progress;
+
+    //! Write buffer, and O_DIRECT depth (see PacketStreamWriter)
+    size_t buffer_size = 100 * 1024 * 1024;
+    size_t direct_depth = 0;
+};
+
+struct PANGOLIN_EXPORT PacketStreamRewriteStats
+{
+    std::vector<size_t> packets_per_source;
+    uint64_t payload_bytes = 0;
+    bool memory_mapped = false;
+};
+
+//! Copy the packets of a log (which may be rotated) into a new log,
+//! trimmed to a range of packets or times and to a selection of sources,
+//! writing a fresh index. Payloads are never decoded: where the input can
+//! be memory mapped they go straight from the mapping into the write
+//! buffer, so the copy is bound by I/O rather than CPU.
+PANGOLIN_EXPORT
+PacketStreamRewriteStats PacketStreamRewrite(
+    const std::string& filename_in, const std::string& filename_out,
+    const PacketStreamRewriteOptions& options = PacketStreamRewriteOptions()
+);
+
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include <pangolin/platform.h>
 #include <pangolin/utils/picojson.h>
 
@@ -8,6 +11,8 @@ namespace pangolin {
 
 using PacketStreamSourceId = size_t;
 
+class ZstdDictionary;
+
 struct PANGOLIN_EXPORT PacketStreamSource
 {
     struct PacketInfo
@@ -16,11 +21,116 @@ struct PANGOLIN_EXPORT PacketStreamSource
         int64_t capture_time;
     };
 
+    // Stream position and capture time of every packet, held as fixed width
+    // columns. These are either owned, or a view onto a binary index within a
+    // memory mapped log which is copied only if the index is modified.
+    class PacketIndex
+    {
+    public:
+        PacketIndex()
+            : _view_pos(nullptr), _view_time(nullptr), _view_size(0)
+        {
+        }
+
+        size_t size() const
+        {
+            return _view_pos ? _view_size : _pos.size();
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+        int64_t Pos(size_t i) const
+        {
+            return _view_pos ? _view_pos[i] : _pos[i];
+        }
+
+        int64_t Time(size_t i) const
+        {
+            return _view_pos ? _view_time[i] : _time[i];
+        }
+
+        PacketInfo operator[](size_t i) const
+        {
+            return { std::streampos(Pos(i)), Time(i) };
+        }
+
+        void push_back(const PacketInfo& info)
+        {
+            Own();
+            _pos.push_back(std::streamoff(info.pos));
+            _time.push_back(info.capture_time);
+        }
+
+        void clear()
+        {
+            ResetView();
+            _pos.clear();
+            _time.clear();
+        }
+
+        // Take ownership of columns
+        void Assign(std::vector<int64_t>&& pos, std::vector<int64_t>&& time)
+        {
+            ResetView();
+            _pos = std::move(pos);
+            _time = std::move(time);
+        }
+
+        // Refer to n entries of external columns, kept valid by owner.
+        void SetView(const int64_t* pos, const int64_t* time, size_t n, const std::shared_ptr<const void>& owner)
+        {
+            clear();
+            _view_pos = pos;
+            _view_time = time;
+            _view_size = n;
+            _view_owner = owner;
+        }
+
+        // Index of the first packet with capture time >= time, or size() if none.
+        size_t LowerBoundTime(int64_t time) const
+        {
+            if(_view_pos) {
+                return std::lower_bound(_view_time, _view_time + _view_size, time) - _view_time;
+            }
+            return std::lower_bound(_time.begin(), _time.end(), time) - _time.begin();
+        }
+
+    private:
+        void Own()
+        {
+            if(_view_pos) {
+                std::vector<int64_t> pos(_view_pos, _view_pos + _view_size);
+                std::vector<int64_t> time(_view_time, _view_time + _view_size);
+                Assign(std::move(pos), std::move(time));
+            }
+        }
+
+        void ResetView()
+        {
+            _view_pos = nullptr;
+            _view_time = nullptr;
+            _view_size = 0;
+            _view_owner.reset();
+        }
+
+        std::vector<int64_t> _pos;
+        std::vector<int64_t> _time;
+
+        const int64_t* _view_pos;
+        const int64_t* _view_time;
+        size_t _view_size;
+        std::shared_ptr<const void> _view_owner;
+    };
+
     PacketStreamSource()
         : id(static_cast<PacketStreamSourceId>(-1)),
           version(0),
           data_alignment_bytes(1),
           data_size_bytes(0),
+          compression_level(3),
           next_packet_id(0)
     {
     }
@@ -28,17 +138,29 @@ struct PANGOLIN_EXPORT PacketStreamSource
     std::streampos FindSeekLocation(size_t packet_id)
     {
         if(packet_id < index.size()) {
-            return index[packet_id].pos;
+            return std::streampos(index.Pos(packet_id));
         }else{
             return std::streampos(-1);
         }
 
     }
 
+    bool Compressed() const
+    {
+        return !compression.empty();
+    }
+
+    // Size of each packet as stored, 0 if written with every packet. Always 0
+    // for compressed sources, as compressed packets vary in size.
+    int64_t StoredSizeBytes() const
+    {
+        return Compressed() ? 0 : data_size_bytes;
+    }
+
     int64_t NextPacketTime() const
     {
         if(next_packet_id < index.size()) {
-            return index[next_packet_id].capture_time;
+            return index.Time(next_packet_id);
         }else{
             return 0;
         }
@@ -49,12 +171,24 @@ struct PANGOLIN_EXPORT PacketStreamSource
     std::string     uri;
     picojson::value info;
     int64_t         version;
+    // Packet data is padded to start at a multiple of this many bytes into
+    // the log, such as 4096 for O_DIRECT or 64 for aligned vector loads from
+    // the memory mapped log. 1 (the default) for no padding.
     int64_t         data_alignment_bytes;
     std::string     data_definitions;
     int64_t         data_size_bytes;
 
+    // Optional compression of every packet of the source, "zstd" or empty to
+    // store packets as they are. Packets are compressed by PacketStreamWriter
+    // and decompressed again on reading, so data_size_bytes, Packet::size and
+    // Packet::Data() describe the packet as written. A dictionary trained on
+    // typical packets (see ZstdDictionary) helps most with small packets.
+    std::string     compression;
+    int             compression_level;
+    std::shared_ptr<const ZstdDictionary> compression_dictionary;
+
     // Index keyed by packet_id
-    std::vector<PacketInfo> index;
+    PacketIndex index;
 
     // Based on current position in stream
     size_t          next_packet_id;
@@ -18,6 +18,11 @@ const static std::string pss_pkt_alignment_bytes = "alignment_bytes";
 const static std::string pss_pkt_definitions = "definitions";
 const static std::string pss_pkt_size_bytes = "size_bytes";
 const static std::string pss_pkt_format_written = "format_written";
+const static std::string pss_pkt_compression = "compression";
+const static std::string pss_cmp_codec = "codec";
+const static std::string pss_cmp_level = "level";
+const static std::string pss_cmp_dictionary = "dictionary";
+const static std::string pss_cmp_size_bytes = "size_bytes";
 
 const unsigned int TAG_LENGTH = 3;
 
@@ -27,12 +32,25 @@ const uint32_t TAG_PANGO_MAGIC  = PANGO_TAG('P', 'A', 'N');
 const uint32_t TAG_PANGO_SYNC   = PANGO_TAG('S', 'Y', 'N');
 const uint32_t TAG_PANGO_STATS  = PANGO_TAG('S', 'T', 'A');
 const uint32_t TAG_PANGO_FOOTER = PANGO_TAG('F', 'T', 'R');
+const uint32_t TAG_PANGO_INDEX  = PANGO_TAG('I', 'D', 'X');
+const uint32_t TAG_PANGO_CHECKPOINT = PANGO_TAG('C', 'K', 'P');
 const uint32_t TAG_ADD_SOURCE   = PANGO_TAG('S', 'R', 'C');
 const uint32_t TAG_SRC_JSON     = PANGO_TAG('J', 'S', 'N');
+const uint32_t TAG_SRC_META     = PANGO_TAG('M', 'E', 'T');
 const uint32_t TAG_SRC_PACKET   = PANGO_TAG('P', 'K', 'T');
+const uint32_t TAG_PANGO_PAD    = PANGO_TAG('P', 'A', 'D');
 const uint32_t TAG_END          = PANGO_TAG('E', 'N', 'D');
 #undef PANGO_TAG
 
+// Version of binary index following TAG_PANGO_INDEX
+const uint32_t PANGO_INDEX_VERSION = 1;
+
+// Padding ahead of a packet, so that its data starts at a multiple of the
+// source's data_alignment_bytes: TAG_PANGO_PAD, then the number of bytes of
+// padding following as a varint of exactly PANGO_PAD_LENGTH_BYTES bytes.
+const unsigned int PANGO_PAD_LENGTH_BYTES = 3;
+const size_t PANGO_MAX_ALIGNMENT = size_t(1) << (7 * PANGO_PAD_LENGTH_BYTES - 1);
+
 inline std::string tagName(int v)
 {
     char b[4];
@@ -30,24 +30,43 @@
 #include <pangolin/log/packetstream.h>
 #include <pangolin/log/packetstream_source.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/memstreambuf.h>
 #include <pangolin/utils/threadedfilebuf.h>
 
 namespace pangolin
 {
 
+struct PANGOLIN_EXPORT PacketStreamWriterStats
+{
+    threadedfilebuf::Stats buffer;
+    std::vector<size_t> packets_per_source;
+    size_t packet_bytes;    // payload bytes over all sources, as stored
+};
+
 class PANGOLIN_EXPORT PacketStreamWriter
 {
 public:
     PacketStreamWriter()
-        : _stream(&_buffer), _indexable(false), _open(false), _bytes_written(0)
+        : _stream(&_buffer), _indexable(false), _open(false), _bytes_written(0), _header(256), _reserved(nullptr),
+          _checkpoint_packets(10000), _checkpoint_bytes(64*1024*1024),
+          _buffer_size(0), _direct_depth(0), _lock_free(false),
+          _rotate_bytes(0), _rotate_us(0), _chunk(0), _chunk_of_us(0), _chunk_start_us(-1)
     {
+        ResetCheckpoints();
         _stream.exceptions(std::ostream::badbit);
     }
 
-    PacketStreamWriter(const std::string& filename, size_t buffer_size  = 100*1024*1024)
-        : _buffer(pangolin::PathExpand(filename), buffer_size), _stream(&_buffer),
-          _indexable(!IsPipe(filename)), _open(_stream.good()), _bytes_written(0)
+    // direct_depth > 0 writes with O_DIRECT, and lock_free avoids locking the
+    // buffer on every write, see threadedfilebuf::open. Packets are written
+    // under _lock, so the buffer only ever has one writer at a time.
+    PacketStreamWriter(const std::string& filename, size_t buffer_size  = 100*1024*1024, size_t direct_depth = 0, bool lock_free = false)
+        : _buffer(pangolin::PathExpand(filename), buffer_size, direct_depth, lock_free), _stream(&_buffer),
+          _indexable(!IsPipe(filename)), _open(_stream.good()), _bytes_written(0), _header(256), _reserved(nullptr),
+          _checkpoint_packets(10000), _checkpoint_bytes(64*1024*1024),
+          _filename(pangolin::PathExpand(filename)), _buffer_size(buffer_size), _direct_depth(direct_depth), _lock_free(lock_free),
+          _rotate_bytes(0), _rotate_us(0), _chunk(0), _chunk_of_us(0), _chunk_start_us(-1)
     {
+        ResetCheckpoints();
         _stream.exceptions(std::ostream::badbit);
         WriteHeader();
     }
@@ -56,13 +75,21 @@ public:
         Close();
     }
 
-    void Open(const std::string& filename, size_t buffer_size = 100 * 1024 * 1024)
+    void Open(const std::string& filename, size_t buffer_size = 100 * 1024 * 1024, size_t direct_depth = 0, bool lock_free = false)
     {
         Close();
-        _buffer.open(filename, buffer_size);
+        _buffer.open(filename, buffer_size, direct_depth, lock_free);
         _open = _stream.good();
         _bytes_written = 0;
         _indexable = !IsPipe(filename);
+        _filename = filename;
+        _buffer_size = buffer_size;
+        _direct_depth = direct_depth;
+        _lock_free = lock_free;
+        _chunk = 0;
+        _chunk_start_us = -1;
+        _rotated_packets.clear();
+        ResetCheckpoints();
         WriteHeader();
     }
 
@@ -96,11 +123,32 @@ public:
     // If constructor is called inline
     PacketStreamSourceId AddSource(const PacketStreamSource& source);
 
+    // binary_meta is an opaque block of metadata (such as a serialized
+    // FrameMetadata) stored compactly ahead of the packet, alongside or
+    // instead of JSON meta. See Packet::binary_meta. Packets of sources
+    // declaring compression are compressed here.
     void WriteSourcePacket(
         PacketStreamSourceId src, const char* source,const int64_t receive_time_us,
-        size_t sourcelen, const picojson::value& meta = picojson::value()
+        size_t sourcelen, const picojson::value& meta = picojson::value(),
+        const std::string& binary_meta = std::string()
     );
 
+    // Write a packet of up to max_bytes in place, saving the copy through
+    // WriteSourcePacket: fill the returned memory, then CommitSourcePacket
+    // with the bytes used, or CancelSourcePacket. The writer stays locked in
+    // between. Returns nullptr, with nothing written, where the packet has to
+    // be staged instead: for compressed or aligned sources, or when the
+    // buffer has no contiguous space (see threadedfilebuf::reserve).
+    char* ReserveSourcePacket(
+        PacketStreamSourceId src, const int64_t receive_time_us, size_t max_bytes,
+        const picojson::value& meta = picojson::value(),
+        const std::string& binary_meta = std::string()
+    );
+
+    void CommitSourcePacket(size_t sourcelen);
+
+    void CancelSourcePacket();
+
     // For stream read/write synchronization. Note that this is NOT the same as
     // time synchronization on playback of iPacketStreams.
     void WriteSync();
@@ -109,6 +157,45 @@ public:
     // the underlying ostream.
     void WriteEnd();
 
+    // Append the index of packets written since the last checkpoint after
+    // every_n_packets packets or every_n_bytes bytes of packet data, whichever
+    // comes first, so that a reader can recover an unterminated log without
+    // scanning it all. 0 disables either trigger.
+    void SetIndexCheckpoints(size_t every_n_packets, size_t every_n_bytes) {
+        _checkpoint_packets = every_n_packets;
+        _checkpoint_bytes = every_n_bytes;
+    }
+
+    // Continue in a new file once the current one holds max_bytes, or packets
+    // spanning max_duration_us, whichever comes first. 0 disables either
+    // trigger. Each file is a complete log with its own header and index,
+    // named by PacketStreamChunkFilename(), and PacketStreamReader plays the
+    // set back as one stream when opening the first. Not used for pipes.
+    void SetRotation(size_t max_bytes, int64_t max_duration_us) {
+        _rotate_bytes = max_bytes;
+        _rotate_us = max_duration_us;
+    }
+
+    // Extra members for the header of every file written from now on, e.g.
+    // the clock_offset_us of a coordinated recording (see RecordCoordinator),
+    // which PlaybackSession adds to packet times to align logs of several
+    // machines. Set before opening to have them in the first file.
+    void SetHeaderProperties(const picojson::value& properties) {
+        _header_properties = properties;
+    }
+
+    // Smooth writeback of the page cache, starting to write out every
+    // interval_bytes and dropping earlier intervals from the cache, see
+    // threadedfilebuf::set_writeback. 0 leaves it to the kernel.
+    void SetWriteback(size_t interval_bytes) {
+        _buffer.set_writeback(interval_bytes);
+    }
+
+    // Files written so far, including the one being written
+    size_t NumChunks() const {
+        return _chunk + 1;
+    }
+
     const std::vector<PacketStreamSource>& Sources() const {
         return _sources;
     }
@@ -117,10 +204,29 @@ public:
         return _open;
     }
 
+    // Waits for any packet being written, which may itself be waiting on a
+    // full buffer. Use BufferStats() to monitor back-pressure without blocking.
+    PacketStreamWriterStats Stats();
+
+    threadedfilebuf::Stats BufferStats() const {
+        return _buffer.stats();
+    }
+
 private:
     void WriteHeader();
     void Write(const PacketStreamSource&);
-    void WriteMeta(PacketStreamSourceId src, const picojson::value& data);
+    void WriteMeta(PacketStreamSourceId src, const std::string& json);
+    void WritePadding(size_t header_bytes, size_t alignment);
+    void WriteCheckpoint();
+    void CheckpointIfDue();
+    bool ShouldRotate(int64_t time_us);
+    void Rotate();
+
+    void ResetCheckpoints() {
+        _checkpoint_last_pos = 0;
+        _checkpoint_last_bytes = 0;
+        _checkpoint_first.clear();
+    }
 
     threadedfilebuf _buffer;
     std::ostream _stream;
@@ -128,7 +234,37 @@ private:
 
     std::vector<PacketStreamSource> _sources;
     size_t _bytes_written;
+    std::string _compressed;    // packet of a compressed source, as written
+
+    // Packet between ReserveSourcePacket and its commit
+    memstreambuf _header;
+    char* _reserved;
+    size_t _reserved_length_bytes;
+    size_t _reserved_max_bytes;
+    PacketStreamSourceId _reserved_src;
+    int64_t _reserved_time_us;
+    std::streampos _reserved_pos;
     std::recursive_mutex _lock;
+
+    size_t _checkpoint_packets;
+    size_t _checkpoint_bytes;
+    uint64_t _checkpoint_last_pos;
+    size_t _checkpoint_last_bytes;
+    // Per source, first packet not yet covered by a checkpoint
+    std::vector<size_t> _checkpoint_first;
+
+    // Rotation, reopening the buffer with the same options
+    std::string _filename;
+    size_t _buffer_size;
+    size_t _direct_depth;
+    bool _lock_free;
+    size_t _rotate_bytes;
+    int64_t _rotate_us;
+    size_t _chunk;
+    int64_t _chunk_of_us;       // header time of the first file, identifying the set
+    int64_t _chunk_start_us;    // time of the first packet in this file, or -1
+    std::vector<size_t> _rotated_packets;   // per source, packets in previous files
+    picojson::value _header_properties;
 };
 
 inline void writeCompressedUnsignedInt(std::ostream& writer, size_t n)
@@ -141,6 +277,17 @@ inline void writeCompressedUnsignedInt(std::ostream& writer, size_t n)
     writer.put(static_cast<unsigned char>(n));
 }
 
+inline size_t compressedUnsignedIntBytes(size_t n)
+{
+    size_t bytes = 1;
+    while (n >= 0x80)
+    {
+    n >>= 7;
+    ++bytes;
+    }
+    return bytes;
+}
+
 inline void writeTimestamp(std::ostream& writer, int64_t time_us)
 {
     writer.write(reinterpret_cast<const char*>(&time_us), sizeof(decltype(time_us)));
@@ -160,9 +307,9 @@ inline picojson::value SourceStats(const std::vector<PacketStreamSource>& srcs)
 
     for(auto& src : srcs) {
         picojson::array pkt_index, pkt_times;
-        for (const PacketStreamSource::PacketInfo& frame : src.index) {
-            pkt_index.emplace_back(frame.pos);
-            pkt_times.emplace_back(frame.capture_time);
+        for (size_t i = 0; i < src.index.size(); ++i) {
+            pkt_index.emplace_back(src.index.Pos(i));
+            pkt_times.emplace_back(src.index.Time(i));
         }
         stat["src_packet_index"].push_back(std::move(pkt_index));
         stat["src_packet_times"].push_back(std::move(pkt_times));
@@ -170,4 +317,77 @@ inline picojson::value SourceStats(const std::vector<PacketStreamSource>& srcs)
     return stat;
 }
 
+// Checkpoint of the index for packets written since the previous checkpoint.
+// Following TAG_PANGO_CHECKPOINT, all little endian:
+//   uint64 pos (offset of this tag, to validate a backwards search),
+//   uint64 prev_pos (offset of the previous checkpoint, 0 for none),
+//   uint32 num_sources, uint64 first_packet[num_sources], uint64 num_packets[num_sources],
+//   then for each source int64 pos[num_packets], int64 capture_time_us[num_packets].
+inline void writeIndexCheckpoint(std::ostream& writer, const std::vector<PacketStreamSource>& srcs,
+                                 const std::vector<size_t>& first_packet, uint64_t pos, uint64_t prev_pos)
+{
+    writeTag(writer, TAG_PANGO_CHECKPOINT);
+    writer.write(reinterpret_cast<const char*>(&pos), sizeof(pos));
+    writer.write(reinterpret_cast<const char*>(&prev_pos), sizeof(prev_pos));
+
+    const uint32_t num_sources = (uint32_t)srcs.size();
+    writer.write(reinterpret_cast<const char*>(&num_sources), sizeof(num_sources));
+    for(size_t s=0; s < srcs.size(); ++s) {
+        const uint64_t first = s < first_packet.size() ? first_packet[s] : 0;
+        writer.write(reinterpret_cast<const char*>(&first), sizeof(first));
+    }
+    for(size_t s=0; s < srcs.size(); ++s) {
+        const uint64_t first = s < first_packet.size() ? first_packet[s] : 0;
+        const uint64_t n = srcs[s].index.size() - first;
+        writer.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    }
+
+    for(size_t s=0; s < srcs.size(); ++s) {
+        const size_t first = s < first_packet.size() ? first_packet[s] : 0;
+        for (size_t i = first; i < srcs[s].index.size(); ++i) {
+            const int64_t p = srcs[s].index.Pos(i);
+            writer.write(reinterpret_cast<const char*>(&p), sizeof(p));
+        }
+        for (size_t i = first; i < srcs[s].index.size(); ++i) {
+            const int64_t t = srcs[s].index.Time(i);
+            writer.write(reinterpret_cast<const char*>(&t), sizeof(t));
+        }
+    }
+}
+
+// Compact alternative to SourceStats(), readable in place from a memory
+// mapped log. Following TAG_PANGO_INDEX, all little endian:
+//   uint32 version, uint32 num_sources, uint64 num_packets[num_sources],
+//   zero padding to an 8 byte file offset, then for each source
+//   int64 pos[num_packets], int64 capture_time_us[num_packets].
+// start_pos is the current offset of writer within the file.
+inline void writeBinaryIndex(std::ostream& writer, const std::vector<PacketStreamSource>& srcs, uint64_t start_pos)
+{
+    writeTag(writer, TAG_PANGO_INDEX);
+
+    const uint32_t version = PANGO_INDEX_VERSION;
+    const uint32_t num_sources = (uint32_t)srcs.size();
+    writer.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    writer.write(reinterpret_cast<const char*>(&num_sources), sizeof(num_sources));
+    for(auto& src : srcs) {
+        const uint64_t n = src.index.size();
+        writer.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    }
+
+    const uint64_t header_end = start_pos + TAG_LENGTH + sizeof(version) + sizeof(num_sources) + srcs.size() * sizeof(uint64_t);
+    const char padding[8] = {0};
+    writer.write(padding, (8 - header_end % 8) % 8);
+
+    for(auto& src : srcs) {
+        for (size_t i = 0; i < src.index.size(); ++i) {
+            const int64_t pos = src.index.Pos(i);
+            writer.write(reinterpret_cast<const char*>(&pos), sizeof(pos));
+        }
+        for (size_t i = 0; i < src.index.size(); ++i) {
+            const int64_t time = src.index.Time(i);
+            writer.write(reinterpret_cast<const char*>(&time), sizeof(time));
+        }
+    }
+}
+
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <pangolin/log/packetstream_reader.h>
@@ -11,9 +12,71 @@ namespace pangolin {
 
 class Params;
 
-class PlaybackSession
+// Packet of one source of a log opened in a PlaybackSession, as ordered in
+// the session's merged time index.
+struct PlaybackSessionPacket
+{
+    int64_t time_us;
+    uint32_t reader;            // PlaybackSession::Reader(), in the order logs were opened
+    uint32_t src;
+    size_t packet_id;           // within the source
+};
+
+// Merged time index of a PlaybackSession, shared by its cursors
+struct PlaybackSessionIndex;
+
+// Reads every packet of every log of a PlaybackSession in capture time order,
+// through PacketStreamCursors of its own, so that analysis tools may walk the
+// whole session without disturbing playback or other cursors.
+class PANGOLIN_EXPORT PlaybackSessionCursor
+{
+public:
+    PlaybackSessionCursor(const std::shared_ptr<const PlaybackSessionIndex>& index);
+    PlaybackSessionCursor(PlaybackSessionCursor&&) = default;
+    PlaybackSessionCursor& operator=(PlaybackSessionCursor&&) = default;
+    ~PlaybackSessionCursor();
+
+    // Packets of all sources of all logs
+    size_t NumPackets() const;
+
+    // Position in the merged index of the packet Next() will return
+    size_t Tell() const
+    {
+        return _next;
+    }
+
+    bool AtEnd() const
+    {
+        return _next >= NumPackets();
+    }
+
+    void Seek(size_t pos);
+
+    // Jumps to the first packet with time >= time, returning its position
+    size_t Seek(SyncTime::TimePoint time);
+
+    // Which log, source and packet Next() will return. Throws at the end.
+    PlaybackSessionPacket Peek() const;
+
+    // Read the next packet in time order. Throws at the end.
+    QueuedPacket Next();
+
+private:
+    std::shared_ptr<const PlaybackSessionIndex> _index;
+    size_t _next;
+
+    // Per source of every log, opened on demand
+    std::vector<std::unique_ptr<PacketStreamCursor>> _cursors;
+};
+
+class PANGOLIN_EXPORT PlaybackSession
 {
 public:
+    PlaybackSession()
+        : positions_time_us(0)
+    {
+    }
+
     // Singleton Instance
     static std::shared_ptr<PlaybackSession> Default();
 
@@ -23,10 +86,14 @@ public:
     {
         const std::string path = SanitizePath(PathExpand(filename));
 
+        std::lock_guard<std::mutex> l(index_mutex);
         auto i = readers.find(path);
         if(i == readers.end()) {
             auto psr = std::make_shared<PacketStreamReader>(path);
             readers[path] = psr;
+            opened.push_back(psr);
+            index.reset();
+            positions.clear();
             return psr;
         }else{
             return i->second;
@@ -38,11 +105,51 @@ public:
         return time;
     }
 
+    // Logs opened in the session, in the order they were opened
+    size_t NumReaders() const;
+
+    std::shared_ptr<PacketStreamReader> Reader(size_t reader) const;
+
+    // Merged index of every packet of every source of the logs opened so
+    // far, ordered by capture time. Built on first use after an Open, so
+    // positions are only stable until the next log is opened.
+    size_t NumIndexedPackets();
+
+    PlaybackSessionPacket IndexedPacket(size_t pos);
+
+    // Position in the merged index of the first packet with time >= time
+    size_t LowerBound(SyncTime::TimePoint time);
+
+    // Id of the first packet of src in reader with time >= time, or the
+    // number of packets of the source if there are none. One search of the
+    // merged index positions every source of every log at once, and is
+    // shared by all sources asking after the same time.
+    size_t PacketAtTime(const PacketStreamReader& reader, PacketStreamSourceId src, SyncTime::TimePoint time);
+
+    // Jump every participant of the session to time, see SyncTime::Seek
+    void Seek(SyncTime::TimePoint time);
+
+    // Cursor over every packet of the session in time order, for analysis.
+    // Needs seekable logs, and keeps reading the index as it was when made.
+    PlaybackSessionCursor Cursor();
+
     static std::shared_ptr<PlaybackSession> ChooseFromParams(const Params& params);
 
 private:
+    // Build the merged index if logs were opened since it was last built
+    const PlaybackSessionIndex& Index();
+
+    // Next packet id of every source at time, cached for the last time asked
+    const std::vector<size_t>& PositionsAtTime(int64_t time_us);
+
     std::map<std::string,std::shared_ptr<PacketStreamReader>> readers;
     SyncTime time;
+
+    mutable std::mutex index_mutex;
+    std::vector<std::shared_ptr<PacketStreamReader>> opened;
+    std::shared_ptr<const PlaybackSessionIndex> index;
+    int64_t positions_time_us;
+    std::vector<size_t> positions;
 };
 
 }
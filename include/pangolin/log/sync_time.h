@@ -29,10 +29,12 @@
 #include <pangolin/utils/signal_slot.h>
 #include <pangolin/utils/timer.h>
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <map>
 #include <mutex>
-#include <queue>
+#include <vector>
 
 namespace pangolin
 {
@@ -41,6 +43,12 @@ namespace pangolin
 // All playback functions called with the same SyncTime will be time-synchronized, and will remain synchronized on seek() if the SyncTime is passed in when seeking.
 // Playback with multiple SyncTimes (on the same or different streams) should also be synced, even in different processes or systems (underlying clock sync is not required).
 // However, playback with multiple SyncTimes will break on seek().
+//
+// Events are released strictly in timestamp order, and only once every
+// registered participant has queued its next event, so playback order is
+// deterministic. By default events are released as soon as they are next
+// (a discrete event clock, as fast as possible). SetRate() paces releases
+// against the wall clock at a multiple of the recorded rate instead.
 class PANGOLIN_EXPORT SyncTime
 {
 public:
@@ -54,7 +62,7 @@ public:
     };
 
     SyncTime(Duration virtual_clock_offset = std::chrono::milliseconds(0))
-        : seeking(false)
+        : rate(0.0), anchored(false), anchor_event_us(0), last_event_us(0), pending(0), seeking(false)
     {
         SetOffset(virtual_clock_offset);
     }
@@ -92,6 +100,44 @@ public:
         std::this_thread::sleep_until( ToReal(virtual_time) );
     }
 
+    // Multiple of recorded time to play back at, e.g. 1.0 for realtime.
+    // 0 releases each event as soon as it is next in order.
+    void SetRate(double playback_rate)
+    {
+        std::unique_lock<std::mutex> l(time_mutex);
+        rate = std::max(0.0, playback_rate);
+        anchored = false;
+        NotifyHead();
+    }
+
+    double Rate() const
+    {
+        return rate;
+    }
+
+    // Timestamp of the most recently released event, i.e. the current time
+    // of the log being played back.
+    int64_t EventTimeUs() const
+    {
+        return last_event_us;
+    }
+
+    // Participants hold back all events until they have queued their first.
+    void AddParticipant()
+    {
+        std::unique_lock<std::mutex> l(time_mutex);
+        ++pending;
+    }
+
+    void ParticipantQueued()
+    {
+        std::unique_lock<std::mutex> l(time_mutex);
+        PANGO_ENSURE(pending > 0);
+        if(--pending == 0) {
+            NotifyHead();
+        }
+    }
+
     int64_t QueueEvent(int64_t new_event_time_us)
     {
         return WaitDequeueAndQueueEvent(0, new_event_time_us);
@@ -100,10 +146,11 @@ public:
     void DequeueEvent(int64_t event_time_us)
     {
         std::unique_lock<std::mutex> l(time_mutex);
-
-        auto i = std::find(time_queue_us.begin(), time_queue_us.end(), event_time_us);
-        PANGO_ENSURE(i != time_queue_us.end());
-        time_queue_us.erase(i);
+        const bool was_head = !events.empty() && events.begin()->first == event_time_us;
+        RemoveEvent(event_time_us);
+        if(was_head) {
+            NotifyHead();
+        }
     }
 
     int64_t WaitDequeueAndQueueEvent(int64_t event_time_us, int64_t new_event_time_us =0 )
@@ -111,41 +158,67 @@ public:
         std::unique_lock<std::mutex> l(time_mutex);
 
         if(event_time_us) {
-            PANGO_ENSURE(time_queue_us.size());
-
-            // Wait until we're top the priority-queue
-            queue_changed.wait(l, [&](){
-                if(seeking) {
-                    // Time queue will be invalidated on seek.
-                    // Unblock without action
-                    throw SeekInterruption();
+            PANGO_ENSURE(events.count(event_time_us));
+
+            {
+                // Only woken when our event becomes the head, or on seek
+                Waiter waiter(*this, event_time_us);
+
+                // Wait until we're top the priority-queue, and every participant
+                // has queued an event which could precede ours.
+                waiter.cond.wait(l, [&](){
+                    if(seeking) {
+                        // Time queue will be invalidated on seek.
+                        // Unblock without action
+                        throw SeekInterruption();
+                    }
+                    return pending == 0 && events.begin()->first == event_time_us;
+                });
+
+                if(rate > 0.0) {
+                    // Pace against the wall clock, relative to the first event released.
+                    if(!anchored) {
+                        anchored = true;
+                        anchor_event_us = event_time_us;
+                        anchor_real = Clock::now();
+                    }
+                    const auto delay = std::chrono::microseconds(int64_t((event_time_us - anchor_event_us) / rate));
+                    waiter.cond.wait_until(l, anchor_real + delay, [&](){
+                        if(seeking) throw SeekInterruption();
+                        return false;
+                    });
                 }
-                return time_queue_us.back() == event_time_us;
-            });
+            }
 
             // Dequeue
-            time_queue_us.pop_back();
+            RemoveEvent(event_time_us);
+            last_event_us = event_time_us;
         }
 
         if(new_event_time_us) {
             // Add the new event whilst we still hold the lock, so that our
             // event can't be missed
-            insert_sorted(time_queue_us, new_event_time_us, std::greater<int64_t>());
+            ++events[new_event_time_us].count;
 
-            if(time_queue_us.back() == new_event_time_us) {
+            if(events.begin()->first == new_event_time_us) {
                 // Return to avoid yielding when we're next.
                 return new_event_time_us;
             }
         }
 
         // Only yield if another device is next
-        queue_changed.notify_all();
+        if(event_time_us) {
+            NotifyHead();
+        }
         return new_event_time_us;
     }
 
     void NotifyAll()
     {
-        queue_changed.notify_all();
+        std::unique_lock<std::mutex> l(time_mutex);
+        for(auto& e : events) {
+            for(std::condition_variable* c : e.second.waiters) c->notify_all();
+        }
     }
 
     std::mutex& TimeMutex()
@@ -155,14 +228,21 @@ public:
 
     void Stop()
     {
-        seeking = true;
+        {
+            std::unique_lock<std::mutex> l(time_mutex);
+            seeking = true;
+        }
         OnTimeStop();
-        queue_changed.notify_all();
+        NotifyAll();
     }
 
     void Start()
     {
         OnTimeStart();
+        {
+            std::unique_lock<std::mutex> l(time_mutex);
+            anchored = false;
+        }
         seeking=false;
     }
 
@@ -180,33 +260,89 @@ public:
     Signal<TimePoint> OnSeek;
 
 private:
-    template< typename T, typename Pred >
-    static typename std::vector<T>::iterator
-    insert_sorted( std::vector<T> & vec, T const& item, Pred pred )
+    struct Event
+    {
+        Event() : count(0) {}
+
+        // Number of participants which queued this timestamp
+        size_t count;
+
+        // Participants blocked until this timestamp is at the head
+        std::vector<std::condition_variable*> waiters;
+    };
+
+    // Registers a condition variable against an event for the duration of a wait
+    struct Waiter
+    {
+        Waiter(SyncTime& sync, int64_t time_us)
+            : sync(sync), time_us(time_us)
+        {
+            sync.events[time_us].waiters.push_back(&cond);
+        }
+
+        ~Waiter()
+        {
+            auto e = sync.events.find(time_us);
+            if(e != sync.events.end()) {
+                auto& w = e->second.waiters;
+                w.erase(std::find(w.begin(), w.end(), &cond));
+            }
+        }
+
+        SyncTime& sync;
+        int64_t time_us;
+        std::condition_variable cond;
+    };
+
+    // Called with time_mutex held
+    void RemoveEvent(int64_t time_us)
+    {
+        auto e = events.find(time_us);
+        PANGO_ENSURE(e != events.end());
+        if(--e->second.count == 0) {
+            events.erase(e);
+        }
+    }
+
+    // Called with time_mutex held
+    void NotifyHead()
     {
-        return vec.insert (
-           std::upper_bound( vec.begin(), vec.end(), item, pred ), item
-        );
+        if(!events.empty()) {
+            for(std::condition_variable* c : events.begin()->second.waiters) c->notify_one();
+        }
     }
 
-    std::vector<int64_t> time_queue_us;
+    // Outstanding events by timestamp. The earliest (head) is next to be released.
+    std::map<int64_t, Event> events;
     Duration virtual_offset;
+    double rate;
+    bool anchored;
+    int64_t anchor_event_us;
+    TimePoint anchor_real;
+    std::atomic<int64_t> last_event_us;
+    int pending;
     std::mutex time_mutex;
-    std::condition_variable queue_changed;
     bool seeking;
 };
 
 struct SyncTimeEventPromise
 {
     SyncTimeEventPromise(SyncTime& sync, int64_t time_us = 0)
-        : sync(sync), time_us(time_us)
+        : sync(sync), time_us(time_us), waiting_first(!time_us)
     {
-        sync.QueueEvent(time_us);
+        if(waiting_first) {
+            sync.AddParticipant();
+        }else{
+            sync.QueueEvent(time_us);
+        }
     }
 
     ~SyncTimeEventPromise()
     {
         Cancel();
+        if(waiting_first) {
+            sync.ParticipantQueued();
+        }
     }
 
     void Cancel()
@@ -220,11 +356,16 @@ struct SyncTimeEventPromise
     void WaitAndRenew(int64_t new_time_us)
     {
         time_us = sync.WaitDequeueAndQueueEvent(time_us, new_time_us);
+        if(waiting_first) {
+            waiting_first = false;
+            sync.ParticipantQueued();
+        }
     }
 
 private:
     SyncTime& sync;
     int64_t time_us;
+    bool waiting_first;
 };
 
 }
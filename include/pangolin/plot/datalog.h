@@ -30,6 +30,9 @@
 #include <pangolin/platform.h>
 
 #include <algorithm> // std::min, std::max
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <limits>
 #include <memory>
 #include <mutex>
@@ -48,6 +51,25 @@
 namespace pangolin
 {
 
+class PacketStreamWriter;
+class MemoryMappedFile;
+
+// PacketStreamSource driver of DataLog blocks spilled by a rolling window
+PANGOLIN_EXPORT extern const std::string pango_datalog_type;
+
+class DataLog;
+
+/// Type each logged dimension is held as. Every dimension is also viewed as
+/// float (DataLogBlock::DimData) for plotting, from which stats and LOD are
+/// computed; 64 bit dimensions keep their exact values alongside.
+enum DataLogType
+{
+    DataLogFloat32,     // the default
+    DataLogFloat64,     // exact double, e.g. time in seconds
+    DataLogInt64,       // exact integer, e.g. time in microseconds or counters
+    DataLogFloat16      // rounded to half precision, packed in 2 bytes once sealed
+};
+
 /// Simple statistics recorded for a logged input dimension.
 struct DimensionStats
 {
@@ -65,8 +87,10 @@ struct DimensionStats
         max = std::numeric_limits<float>::lowest();
     }
 
+    /// NaN marks a missing value and is ignored.
     void Add(const float v)
     {
+        if(v != v) return;
         isMonotonic = isMonotonic && (v >= max);
         sum += v;
         sum_sq += v*v;
@@ -74,6 +98,16 @@ struct DimensionStats
         max = std::max(max, v);
     }
 
+    /// Combine with the statistics of values logged after these.
+    void Merge(const DimensionStats& o)
+    {
+        isMonotonic = isMonotonic && o.isMonotonic && (o.min >= max);
+        sum += o.sum;
+        sum_sq += o.sum_sq;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+    }
+
     bool isMonotonic;
     float sum;
     float sum_sq;
@@ -81,18 +115,39 @@ struct DimensionStats
     float max;
 };
 
+/// Samples are only ever appended to a block by a single writer, which
+/// publishes the sample count, LOD rows and following block with release
+/// semantics. Readers may therefore use Samples(), the sample and LOD data
+/// it covers, Stats() and NextBlock() whilst the block is being written.
+///
+/// Blocks the writer has moved on from may be sealed (see
+/// DataLog::SetSealedCompression), keeping their stats and LOD but packing
+/// their samples, which are unpacked again on demand.
 class DataLogBlock
 {
 public:
     /// @param dim: dimension of sample
     /// @param max_samples: maximum number of samples this block can hold
     /// @param start_id: index of first sample (from entire dataset) in this buffer
-    DataLogBlock(size_t dim, size_t max_samples, size_t start_id)
+    /// @param types: type of each dimension, DataLogFloat32 for those omitted
+    DataLogBlock(size_t dim, size_t max_samples, size_t start_id,
+                 const std::vector<DataLogType>& types = std::vector<DataLogType>())
         : dim(dim), max_samples(max_samples), samples(0),
-          start_id(start_id)
+          start_id(start_id), uid(NextUid()), exact_data(nullptr),
+          sealed(false), packed_zstd(false), owner(nullptr), next(nullptr)
     {
-        sample_buffer = std::unique_ptr<float[]>(new float[dim*max_samples]);
-//        stats = std::unique_ptr<DimensionStats[]>(new DimensionStats[dim]);
+        // Samples followed by each LOD level, preallocated so that readers
+        // never see the storage move
+        const size_t floats = StorageFloats(dim, max_samples);
+        buffer = std::unique_ptr<float[]>(new float[floats]);
+        SetStorage(buffer.get());
+        std::fill(buffer.get() + dim*max_samples, buffer.get() + floats, std::numeric_limits<float>::quiet_NaN());
+        stats = std::unique_ptr<DimensionStats[]>(new DimensionStats[dim]);
+        SetTypes(types);
+        if(num_exact) {
+            exact_buffer = std::unique_ptr<int64_t[]>(new int64_t[num_exact * max_samples]);
+            exact_data = exact_buffer.get();
+        }
     }
 
     ~DataLogBlock()
@@ -101,7 +156,7 @@ public:
 
     size_t Samples() const
     {
-        return samples;
+        return samples.load(std::memory_order_acquire);
     }
 
     size_t MaxSamples() const
@@ -120,19 +175,25 @@ public:
         return Samples() >= MaxSamples();
     }
 
-    /// Add data to block
-    void AddSamples(size_t num_samples, size_t dimensions, const float* data_dim_major );
+    /// Add data to block. Values of 64 bit dimensions are taken from
+    /// exact_dim_major if given (see DataLog::Log(size_t, const double*)),
+    /// or otherwise from data_dim_major.
+    void AddSamples(size_t num_samples, size_t dimensions, const float* data_dim_major,
+                    const int64_t* exact_dim_major = nullptr );
 
-    /// Delete all samples
+    /// Delete all samples. Not safe whilst the block is being read.
     void ClearLinked()
     {
-        samples = 0;
+        samples.store(0, std::memory_order_relaxed);
+        std::fill(sample_data + dim*max_samples, sample_data + StorageFloats(dim, max_samples), std::numeric_limits<float>::quiet_NaN());
+        for(size_t d=0; d < dim; ++d) stats[d].Reset();
+        next.store(nullptr, std::memory_order_relaxed);
         nextBlock.reset();
     }
 
     DataLogBlock* NextBlock() const
     {
-        return nextBlock.get();
+        return next.load(std::memory_order_acquire);
     }
 
     size_t StartId() const
@@ -140,9 +201,61 @@ public:
         return start_id;
     }
 
+    /// Levels of min/max decimation available (see LodData)
+    size_t LodLevels() const
+    {
+        return lod.size();
+    }
+
+    /// Floats of sample and LOD storage needed for max_samples samples
+    static size_t StorageFloats(size_t dim, size_t max_samples);
+
+    /// Samples summarised by each entry of LOD level (level 0 is the samples themselves)
+    static size_t LodFactor(size_t level)
+    {
+        size_t f = 1;
+        for(size_t l=0; l < level; ++l) f *= lod_base;
+        return f;
+    }
+
+    /// Number of rows in LOD level >= 1: two for every complete run of
+    /// LodFactor(level) samples.
+    size_t LodSamples(size_t level) const
+    {
+        return 2 * (Samples() / LodFactor(level));
+    }
+
+    /// LOD level >= 1 as rows of Dimensions() values, a row of the
+    /// per-dimension minima of each run of samples followed by a row of
+    /// the maxima. Kept up to date as samples are added.
+    const float* LodData(size_t level) const
+    {
+        return lod[level-1];
+    }
+
+    /// Identifier unique to this block for the life of the process, so that
+    /// copies of it (e.g. on the GPU) aren't confused with a later block
+    /// allocated at the same address.
+    size_t Uid() const
+    {
+        return uid;
+    }
+
+    /// Statistics of dimension d over the samples in this block, ignoring
+    /// NaNs. Kept up to date as samples are added.
+    DimensionStats Stats(size_t d) const
+    {
+        std::lock_guard<std::mutex> l(stats_mutex);
+        return stats[d];
+    }
+
+    /// Float view of the samples, from dimension d. Sealed blocks are
+    /// unpacked, which readers must hold DataLog::access_mutex for; the
+    /// data is then valid until other sealed blocks are unpacked.
     float* DimData(size_t d) const
     {
-        return sample_buffer.get() + d;
+        if(!sample_data) Unpack();
+        return sample_data + d;
     }
 
     size_t Dimensions() const
@@ -150,38 +263,131 @@ public:
         return dim;
     }
 
+    DataLogType Type(size_t d) const
+    {
+        return types[d];
+    }
+
+    /// True once the writer has moved on and the samples were packed
+    bool IsSealed() const
+    {
+        return sealed;
+    }
+
+    /// Bytes of packed samples of a sealed block
+    size_t PackedBytes() const
+    {
+        return packed.size();
+    }
+
     const float* Sample(size_t n) const
     {
-        const int id = (int)n - (int)start_id;
+        const DataLogBlock* b = Holding(n);
+        return b->DimData(0) + b->dim*(n - b->start_id);
+    }
 
-        if( 0 <= id && id < (int)samples ) {
-            return sample_buffer.get() + dim*id;
-        }else{
-            if(nextBlock) {
-                return nextBlock->Sample(n);
-            }else{
-                throw std::out_of_range("Index out of range.");
+    /// Dimension d of sample n, exact for 64 bit dimensions. NaN or
+    /// std::numeric_limits<int64_t>::min() mark missing values.
+    double SampleDouble(size_t n, size_t d) const;
+    int64_t SampleInt64(size_t n, size_t d) const;
+
+protected:
+    friend class DataLog;
+    friend class SharedDataLogWriter;
+    friend class SharedDataLogView;
+
+    /// Full block of samples stored at storage, as written by DataLog::Save,
+    /// with the exact values of its 64 bit dimensions at exact.
+    DataLogBlock(size_t dim, size_t samples, size_t start_id, float* storage,
+                 const std::shared_ptr<MemoryMappedFile>& mapping,
+                 const std::vector<DataLogType>& types = std::vector<DataLogType>(),
+                 int64_t* exact = nullptr);
+
+    void SetTypes(const std::vector<DataLogType>& types);
+
+    /// This or following block holding sample n
+    const DataLogBlock* Holding(size_t n) const
+    {
+        for(const DataLogBlock* b = this; b; b = b->NextBlock()) {
+            if( b->start_id <= n && n < b->start_id + b->Samples() ) {
+                return b;
             }
         }
+        throw std::out_of_range("Index out of range.");
     }
 
-protected:
+    /// Raw exact value of 64 bit dimension d of local sample s
+    int64_t Exact(size_t s, size_t d) const
+    {
+        if(!sample_data) Unpack();
+        return exact_data[exact_col[d] * max_samples + s];
+    }
+
+    /// Round half precision dimensions and derive the float view of 64 bit
+    /// ones for new samples [first_sample, end_sample).
+    void ApplyTypes(size_t first_sample, size_t end_sample, size_t dimensions, const int64_t* exact_dim_major);
+
+    /// Pack the samples, keeping stats and LOD, once the writer moves on
+    void Seal();
+
+    /// Restore the samples of a sealed block, or drop them again
+    void Unpack() const;
+    void Release() const;
+
+    void SetStorage(float* storage);
+
+    /// Reuse this (unlinked) block for samples from start_id
+    void Recycle(size_t start_id);
+
+    static const size_t lod_base = 8;
+
+    static size_t NextUid();
+    void UpdateLod(size_t first_sample, size_t end_sample);
+    void UpdateStats(size_t first_sample, size_t end_sample);
+
     size_t dim;
     size_t max_samples;
-    size_t samples;
+    std::atomic<size_t> samples;
     size_t start_id;
-    std::unique_ptr<float[]> sample_buffer;
-//    std::unique_ptr<DimensionStats[]> stats;
+    size_t uid;
+    mutable std::unique_ptr<float[]> buffer;
+    std::shared_ptr<MemoryMappedFile> mapping;
+    mutable float* sample_data;
+    std::vector<float*> lod;
+    std::unique_ptr<float[]> lod_buffer;
+
+    // Type of each dimension, and the column of 64 bit ones in exact_data
+    std::vector<DataLogType> types;
+    std::vector<size_t> exact_col;
+    size_t num_exact;
+    mutable std::unique_ptr<int64_t[]> exact_buffer;
+    mutable int64_t* exact_data;
+
+    // Samples of a sealed block, packed column by column
+    bool sealed;
+    bool packed_zstd;
+    std::string packed;
+    DataLog* owner;
+
+    std::unique_ptr<DimensionStats[]> stats;
+    mutable std::mutex stats_mutex;
     std::unique_ptr<DataLogBlock> nextBlock;
+    std::atomic<DataLogBlock*> next;
 };
 
 /// A DataLog can efficiently record floating point sample data of any size.
 /// Memory is allocated in blocks is transparent to the user.
+///
+/// By default Log() holds access_mutex. With single_writer set, Log() must
+/// only be called from one thread and never takes the lock, so it isn't held
+/// up by readers. Readers then only need access_mutex to exclude Clear() and
+/// SetLabels(), and see a consistent snapshot from each block's Samples().
 class PANGOLIN_EXPORT DataLog
 {
 public:
     /// @param block_samples_alloc number of samples each memory block can hold.
-    DataLog(unsigned int block_samples_alloc = 10000 );
+    /// @param single_writer Log() is only called from one thread and is lock free.
+    DataLog(unsigned int block_samples_alloc = 10000, bool single_writer = false );
 
     ~DataLog();
 
@@ -203,6 +409,11 @@ public:
     void Log(float v1, float v2, float v3, float v4, float v5, float v6, float v7, float v8, float v9, float v10);
     void Log(const std::vector<float> & vals);
 
+    /// Log samples of wider types. Values of 64 bit dimensions (see
+    /// SetTypes) are kept exactly, and others converted to float.
+    void Log(size_t dimension, const double * vals, unsigned int samples = 1);
+    void Log(size_t dimension, const int64_t * vals, unsigned int samples = 1);
+
 #ifdef USE_EIGEN
     template<typename Derived>
     void Log(const Eigen::MatrixBase<Derived>& M)
@@ -212,8 +423,29 @@ public:
 #endif
 
     void Clear();
+
+    /// Type of each dimension, DataLogFloat32 for those omitted. Takes
+    /// effect from the next sample logged, which starts a new block.
+    void SetTypes(const std::vector<DataLogType>& types);
+    const std::vector<DataLogType>& Types() const;
+
+    /// Pack the samples of blocks the writer has finished with, column by
+    /// column at their own type (zstd compressed if available), keeping
+    /// stats and LOD so that zoomed out plots don't need them. Up to
+    /// max_unpacked blocks are unpacked on demand at a time. Readers walking
+    /// blocks must then hold access_mutex, which single writers take when
+    /// a block is sealed.
+    void SetSealedCompression(bool enable, size_t max_unpacked = 4);
+
+    /// Write samples and labels to a binary file which Load() maps back
+    /// into memory as blocks without parsing or copying.
     void Save(std::string filename);
 
+    /// Replace the log with that saved to filename, throwing
+    /// std::runtime_error if it can't be read. Samples logged afterwards
+    /// follow those loaded.
+    void Load(const std::string& filename);
+
     // Return first block of stored data
     const DataLogBlock* FirstBlock() const;
 
@@ -223,21 +455,63 @@ public:
     // Return number of samples stored in this DataLog
     size_t Samples() const;
 
-    // Return pointer to stored sample n
+    // Return pointer to stored sample n in constant time, throwing
+    // std::out_of_range if it isn't held. Hold access_mutex if single_writer.
     const float* Sample(int n) const;
 
-    // Return stats computed for each dimension if enabled.
+    // Dimension d of sample n, exact for 64 bit dimensions (see SetTypes)
+    double SampleDouble(int n, size_t d) const;
+    int64_t SampleInt64(int n, size_t d) const;
+
+    /// Hold at least the most recent max_samples samples in a fixed number of
+    /// blocks, recycling the oldest as new ones are needed. Evicted blocks
+    /// are appended to a packetstream file if spill_filename is given. Readers
+    /// walking blocks must then hold access_mutex, which single writers
+    /// take when a block is evicted. 0 removes the limit.
+    void SetRollingWindow(size_t max_samples, const std::string& spill_filename = "");
+
+    // Return stats for dimension dim, merged from those of each block held.
+    // Callers should hold access_mutex if samples are being logged.
     const DimensionStats& Stats(size_t dim) const;
 
     std::mutex access_mutex;
 
 protected:
+    friend class DataLogBlock;
+
+    void Append(size_t dimension, const float * vals, unsigned int samples);
+    template<typename T>
+    void AppendTyped(size_t dimension, const T * vals, unsigned int samples);
+    DataLogBlock* WritableBlock(size_t dimension);
+    DataLogBlock* AddBlock(size_t dimension, size_t start_id);
+    const DataLogBlock* FindBlock(size_t id) const;
+    void Unpacked(const DataLogBlock* block) const;
+    std::unique_ptr<DataLogBlock> EvictFirstBlock();
+    void Spill(const DataLogBlock& block);
+
     unsigned int block_samples_alloc;
+    bool single_writer;
+    size_t max_blocks;
     std::vector<std::string> labels;
     std::unique_ptr<DataLogBlock> block0;
-    DataLogBlock* blockn;
-    std::vector<DimensionStats> stats;
-    bool record_stats;
+    std::atomic<DataLogBlock*> first;
+    std::atomic<DataLogBlock*> blockn;
+    std::deque<DataLogBlock*> block_table;
+    std::unique_ptr<PacketStreamWriter> spill;
+    int spill_src;
+    mutable std::vector<DimensionStats> stats;
+
+    // Types of new blocks, and the version of them the last block has
+    std::vector<DataLogType> types;
+    std::atomic<size_t> types_version;
+    size_t block_types_version;
+    std::vector<float> typed_view;
+    std::vector<int64_t> typed_exact;
+
+    // Sealed blocks currently unpacked, oldest first
+    bool compress_sealed;
+    size_t max_unpacked;
+    mutable std::deque<const DataLogBlock*> unpacked;
 };
 
 }
@@ -29,6 +29,8 @@
 #define PLOTTER_H
 
 #include <limits>
+#include <map>
+#include <memory>
 
 #include <pangolin/display/view.h>
 #include <pangolin/gl/colour.h>
@@ -113,6 +115,9 @@ public:
 
     void Render();
 
+    // True once logs have grown or the view is still animating
+    bool ContentChanged() override;
+
     XYRangef& GetSelection();
 
     XYRangef& GetDefaultView();
@@ -165,6 +170,12 @@ public:
 
     std::string PlotTitleFromExpr(const std::string& expr) const;
 
+    /// Draw series of the same form (e.g. '$i','$0' and '$i','$1') from the
+    /// same log together, with one program and one instanced draw per
+    /// block. Series using more than four sequences are drawn individually.
+    /// Ignored unless OpenGL 3.1 is available.
+    void SetBatchSeries(bool batch = true);
+
     /// Remove all current markers
     void ClearMarkers();
 
@@ -203,7 +214,8 @@ protected:
         PlotSeries();
         void CreatePlot(const std::string& x, const std::string& y, Colour c, std::string title);
 
-        GlSlProgram prog;
+        // Shared by series of the same form, which bind their own sequences
+        std::shared_ptr<GlSlProgram> prog;
         GlText title;
         bool contains_id;
         std::vector<PlotAttrib> attribs;
@@ -211,6 +223,38 @@ protected:
         GLenum drawing_mode;
         Colour colour;
         bool used;
+
+        // Sequence x is plotted directly from ($i is -1), or x_expression
+        // if x is computed, in which case blocks can't be culled by extent
+        int x_id;
+        static const int x_expression = std::numeric_limits<int>::min();
+
+        // Batched program source, empty if the series can't be batched, and
+        // the sequence read for each of its inputs.
+        std::string batch_vs;
+        std::shared_ptr<GlSlProgram> batch_prog;
+        int batch_dims[4];
+        static const size_t max_batch = 256;
+    };
+
+    // GPU copy of one level of detail of a DataLogBlock
+    struct PANGOLIN_EXPORT PlotLevel
+    {
+        GlBuffer vbo;
+        size_t uploaded = 0;
+    };
+
+    // GPU copy of a DataLogBlock, appended to as the block fills up
+    struct PANGOLIN_EXPORT PlotBlock
+    {
+        GlBuffer vbo;
+        size_t uploaded = 0;
+        // Min/max decimated levels 1..n, uploaded once first drawn
+        std::vector<PlotLevel> lod;
+        // Extent of each dimension over the uploaded samples
+        std::vector<float> min;
+        std::vector<float> max;
+        size_t last_render = 0;
     };
 
     struct PANGOLIN_EXPORT PlotImplicit
@@ -227,11 +271,18 @@ protected:
         // Expression uses x,y and evaluates to a number
         void CreateDistancePlot(const std::string& dist);
 
-        GlSlProgram prog;
+        std::shared_ptr<GlSlProgram> prog;
     };
 
     void FixSelection();
     void UpdateView();
+    PlotBlock& UploadBlock(const DataLogBlock& block);
+    bool BlockInView(const PlotSeries& ps, const DataLogBlock& block, const PlotBlock& pb) const;
+    size_t SelectLod(const PlotSeries& ps, const DataLogBlock& block) const;
+    const GlBuffer& UploadLod(const DataLogBlock& block, PlotBlock& pb, size_t level);
+    const GlBuffer& PlotIds(const DataLogBlock& block, size_t level);
+    bool BatchSupported() const;
+    void RenderSeriesBatch(const std::vector<PlotSeries*>& batch, float sx, float sy, float ox, float oy);
     Tick FindTickFactor(float tick);
 
     DataLog* default_log;
@@ -248,6 +299,18 @@ protected:
     std::vector<Marker> plotmarkers;
     std::vector<PlotImplicit> plotimplicits;
 
+    // Blocks drawn in the last render by DataLogBlock::Uid(), and the
+    // sample ids for $i at each level of detail
+    std::map<size_t, PlotBlock> plotblocks;
+    std::vector<GlBuffer> plot_ids;
+    size_t render_count;
+
+    // Per series uniforms and sample texture for batched series
+    bool batch_series;
+    GlBuffer batch_ubo;
+    GLuint batch_tex;
+    size_t changed_samples;
+
     Tick tick[2];
     XYRangef rview_default;
     XYRangef rview;
@@ -0,0 +1,148 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/plot/datalog.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pangolin
+{
+
+class SharedMemoryBufferInterface;
+
+// A DataLog shared between processes through a named POSIX shared memory
+// segment, so that a process can plot another's samples without them being
+// formatted, piped and parsed. The segment holds a header followed by a
+// ring of num_blocks slots, each the samples and LOD levels of one block
+// laid out as in DataLogBlock:
+//
+//   shared_datalog_header (magic, dimensions, block layout, labels,
+//                          atomic count of samples published)
+//   num_blocks x { atomic start_id of the block held, padding to
+//                  64 bytes, DataLogBlock::StorageFloats floats }
+//
+// Block k of block_samples samples lives in slot k % num_blocks. The writer
+// fills a block and its LOD before publishing the samples, and recycles the
+// oldest slot once a block is full, so that no locks are shared between
+// processes. SharedDataLogView maps the segment read-only and presents its
+// blocks in place as a DataLog for Plotter, hiding the oldest slot, which is
+// the next to be recycled.
+
+const char shared_datalog_magic[8] = {'P','A','N','G','O','S','D','L'};
+const uint32_t shared_datalog_version = 1;
+const size_t shared_datalog_label_bytes = 4096;
+
+struct shared_datalog_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint64_t block_samples;
+    uint64_t num_blocks;
+    uint64_t slot_bytes;            // stride of the slots following the header
+    uint64_t header_bytes;          // offset of the first slot
+    std::atomic<uint64_t> samples;  // published so far, all held in the ring
+    char labels[shared_datalog_label_bytes];    // '\n' terminated each
+};
+
+struct shared_datalog_slot
+{
+    std::atomic<uint64_t> start_id; // of the block held, or -1 whilst recycled
+};
+
+// Appends samples of a fixed number of float dimensions to a shared DataLog
+// segment, created as name (e.g. "/telemetry") and removed when destroyed.
+// Log() must only be called from one thread and takes no locks: it costs
+// a copy into the ring, the LOD and stats of the block.
+class PANGOLIN_EXPORT SharedDataLogWriter
+{
+public:
+    // The ring holds between (num_blocks-1) and num_blocks blocks of
+    // block_samples samples. Readers may draw garbage from a block if the
+    // writer laps them by a whole block between their polls, so make it
+    // hold well over a frame's worth of samples.
+    SharedDataLogWriter(
+        const std::string& name, size_t dim, const std::vector<std::string>& labels = std::vector<std::string>(),
+        size_t block_samples = 10000, size_t num_blocks = 8
+    );
+    ~SharedDataLogWriter();
+
+    // Append samples of up to Dimensions() values each, missing ones NaN
+    void Log(size_t dimension, const float* vals, unsigned int samples = 1);
+    void Log(const std::vector<float>& vals);
+
+    size_t Dimensions() const;
+
+    // Samples logged so far
+    size_t Samples() const;
+
+    const std::string& Name() const;
+
+protected:
+    std::string name;
+    std::shared_ptr<SharedMemoryBufferInterface> shm;
+    shared_datalog_header* header;
+    // Writer's view of each slot, computing its LOD and stats in place
+    std::vector<std::unique_ptr<DataLogBlock>> blocks;
+    size_t samples;
+};
+
+// DataLog of the blocks of a SharedDataLogWriter in another process, mapped
+// read-only and followed by a thread polling for new samples every poll_ms,
+// which adds and evicts blocks as the writer fills and recycles them.
+// Readers walking blocks hold access_mutex, as with a rolling window.
+// Logging to the view itself is not supported.
+class PANGOLIN_EXPORT SharedDataLogView : public DataLog
+{
+public:
+    // Throws std::runtime_error if name isn't a shared DataLog segment
+    SharedDataLogView(const std::string& name, int poll_ms = 5);
+    ~SharedDataLogView();
+
+    // Poll the writer now, as the thread does
+    void Update();
+
+protected:
+    void Follow(int poll_ms);
+
+    std::shared_ptr<SharedMemoryBufferInterface> shm;
+    const shared_datalog_header* header;
+    std::mutex update_mutex;
+    size_t next_block;
+    std::atomic<bool> quit;
+    std::thread thread;
+};
+
+}
@@ -31,6 +31,10 @@
 #include <pangolin/var/varextra.h>
 #include <pangolin/python/PyUniqueObj.h>
 #include <pangolin/console/ConsoleInterpreter.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <thread>
@@ -38,6 +42,9 @@
 namespace pangolin
 {
 
+// Python console interpreter. Commands run on a dedicated thread that
+// owns the interpreter, so long running commands don't hold up the thread
+// that pushes them; output is collected for PullLine as it's produced.
 class PyInterpreter : public ConsoleInterpreter
 {
 public:
@@ -45,26 +52,50 @@ public:
 
     ~PyInterpreter() override;
 
+    // Queue cmd to be run after any already queued
     void PushCommand(const std::string &cmd) override;
 
     bool PullLine(ConsoleLine& line) override;
 
+    // Returns no options rather than wait whilst a command runs
     std::vector<std::string> Complete(
         const std::string& cmd, int max_options
     ) override;
 
+    // Raise KeyboardInterrupt in the running command and drop queued ones
+    void Cancel() override;
+
+    bool Busy() const override;
+
     static void AttachPrefix(void* data, const std::string& name, VarValueGeneric& var, bool brand_new );
 
 private:
     PyObject* pycompleter;
     PyObject* pycomplete;
 
+    void Run();
+    void Initialise();
+    void Post(const std::function<void()>& task);
+    void PushLine(const ConsoleLine& line);
+
     std::string ToString(PyObject* py);
     void CheckPrintClearError();
     PyUniqueObj EvalExec(const std::string& cmd);
 
+    std::mutex line_mutex;
     std::queue<ConsoleLine> line_queue;
     std::set<std::string> base_prefixes;
+
+    // Work for the interpreter thread, guarded by task_mutex. Internal
+    // tasks run ahead of user commands and survive Cancel().
+    mutable std::mutex task_mutex;
+    std::condition_variable task_cond;
+    std::deque<std::function<void()>> tasks;
+    std::deque<std::string> commands;
+    bool running_command;
+    bool initialised;
+    bool should_quit;
+    std::thread interpreter_thread;
 };
 
 }
@@ -29,6 +29,7 @@
 
 #include <Python.h>
 #include <iomanip>
+#include <mutex>
 #include <queue>
 
 #include <structmember.h>
@@ -45,8 +46,8 @@ struct PyPangoIO {
     static PyTypeObject Py_type;
     static PyMethodDef Py_methods[];
 
-    PyPangoIO(PyTypeObject *type, std::queue<ConsoleLine>& line_queue, ConsoleLineType line_type)
-        : line_queue(line_queue), line_type(line_type)
+    PyPangoIO(PyTypeObject *type, std::queue<ConsoleLine>& line_queue, std::mutex& line_mutex, ConsoleLineType line_type)
+        : line_queue(line_queue), line_mutex(line_mutex), line_type(line_type)
     {
 #if PY_MAJOR_VERSION >= 3
         ob_base.ob_refcnt = 1;
@@ -101,7 +102,10 @@ struct PyPangoIO {
             size_t nl = self->buffer.find_first_of('\n');
             while(nl != std::string::npos) {
                 const std::string line = self->buffer.substr(0,nl);
-                self->line_queue.push(ConsoleLine(line,self->line_type));
+                {
+                    std::lock_guard<std::mutex> l(self->line_mutex);
+                    self->line_queue.push(ConsoleLine(line,self->line_type));
+                }
                 self->buffer = self->buffer.substr(nl+1);
                 nl = self->buffer.find_first_of('\n');
             }
@@ -111,6 +115,7 @@ struct PyPangoIO {
 
     std::string buffer;
     std::queue<ConsoleLine>& line_queue;
+    std::mutex& line_mutex;
     ConsoleLineType line_type;
 };
 
@@ -39,6 +39,7 @@ namespace pangolin
 
 PyObject* GetPangoVarAsPython(const std::string& name)
 {
+    std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
     VarState::VarStoreContainer::iterator i = VarState::I().vars.find(name);
     if(i != VarState::I().vars.end()) {
         VarValueGeneric* var = i->second;
@@ -177,6 +178,7 @@ struct PyVar {
         } else if( !strcmp(name, "__members__") ) {
             const int nss = prefix.size();
             PyObject* l = PyList_New(0);
+            std::lock_guard<std::recursive_mutex> lock(VarState::I().mutex);
             for(const std::string& s : VarState::I().var_adds) {
                 if(!s.compare(0, nss, prefix)) {
                     size_t dot = s.find_first_of('.', nss);
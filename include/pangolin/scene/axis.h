@@ -6,6 +6,7 @@
 
 #include <pangolin/scene/renderable.h>
 #include <pangolin/scene/interactive_index.h>
+#include <pangolin/scene/pickbuffer.h>
 
 #ifdef HAVE_EIGEN
 #  include <Eigen/Geometry>
@@ -25,19 +26,19 @@ struct Axis : public Renderable, public Interactive
 
     void Render(const RenderParams&) override {
         glColor4f(1,0,0,1);
-        glPushName(label_x.Id());
+        PushPickName(label_x.Id());
         glDrawLine(0,0,0, axis_length,0,0);
-        glPopName();
+        PopPickName();
 
         glColor4f(0,1,0,1);
-        glPushName(label_y.Id());
+        PushPickName(label_y.Id());
         glDrawLine(0,0,0, 0,axis_length,0);
-        glPopName();
+        PopPickName();
 
         glColor4f(0,0,1,1);
-        glPushName(label_z.Id());
+        PushPickName(label_z.Id());
         glDrawLine(0,0,0, 0,0,axis_length);
-        glPopName();
+        PopPickName();
     }
 
     bool Mouse(
@@ -52,11 +52,21 @@ struct Interactive
 struct RenderParams
 {
     RenderParams()
-      : render_mode(GL_RENDER)
+      : render_mode(GL_RENDER), cull(false)
     {
     }
 
+    // Skip Renderables whose bounds lie outside the view frustum of cam,
+    // which should be the state the scene root is rendered with.
+    void CullTo(const OpenGlRenderState& cam)
+    {
+        T_clip_scene = cam.GetProjectionModelViewMatrix();
+        cull = true;
+    }
+
     GLint render_mode;
+    bool cull;
+    OpenGlMatrix T_clip_scene;
 };
 
 struct Manipulator : public Interactive
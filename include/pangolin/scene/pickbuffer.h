@@ -0,0 +1,254 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <limits>
+#include <map>
+#include <vector>
+
+#include <pangolin/display/view.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/scene/renderable.h>
+#include <pangolin/scene/interactive_index.h>
+
+namespace pangolin {
+
+inline void gluPickMatrix(
+    GLdouble x, GLdouble y,
+    GLdouble width, GLdouble height,
+    GLint viewport[4]
+) {
+    GLfloat m[16];
+    GLfloat sx, sy;
+    GLfloat tx, ty;
+    sx = viewport[2] / (GLfloat)width;
+    sy = viewport[3] / (GLfloat)height;
+    tx = (viewport[2] + 2.0f * (viewport[0] - (GLfloat)x)) / (GLfloat)width;
+    ty = (viewport[3] + 2.0f * (viewport[1] - (GLfloat)y)) / (GLfloat)height;
+#define M(row, col) m[col*4+row]
+    M(0, 0) = sx;
+    M(0, 1) = 0.0f;
+    M(0, 2) = 0.0f;
+    M(0, 3) = tx;
+    M(1, 0) = 0.0f;
+    M(1, 1) = sy;
+    M(1, 2) = 0.0f;
+    M(1, 3) = ty;
+    M(2, 0) = 0.0f;
+    M(2, 1) = 0.0f;
+    M(2, 2) = 1.0f;
+    M(2, 3) = 0.0f;
+    M(3, 0) = 0.0f;
+    M(3, 1) = 0.0f;
+    M(3, 2) = 0.0f;
+    M(3, 3) = 1.0f;
+#undef M
+    glMultMatrixf(m);
+}
+
+// Name stack for picking, used in place of glPushName / glPopName. Outside of
+// a PickBuffer pass it forwards to the GL name stack for GL_SELECT picking.
+struct PickNames
+{
+    static PickNames& I()
+    {
+        static thread_local PickNames names;
+        return names;
+    }
+
+    void Push(GLuint id)
+    {
+        if(id_location >= 0) {
+            stack.push_back(id);
+            glUniform1ui(id_location, id);
+        }else{
+            glPushName(id);
+        }
+    }
+
+    void Pop()
+    {
+        if(id_location >= 0) {
+            if(!stack.empty()) stack.pop_back();
+            glUniform1ui(id_location, stack.empty() ? 0 : stack.back());
+        }else{
+            glPopName();
+        }
+    }
+
+    // Location of the id uniform during a PickBuffer pass, otherwise -1
+    GLint id_location = -1;
+    std::vector<GLuint> stack;
+};
+
+// Name subsequent geometry with an InteractiveIndex id until PopPickName()
+inline void PushPickName(GLuint id)
+{
+    PickNames::I().Push(id);
+}
+
+inline void PopPickName()
+{
+    PickNames::I().Pop();
+}
+
+// Picks by rendering the innermost pick name of each fragment into an
+// integer (R32UI) target. The projection is narrowed to the grab window, as
+// for GL_SELECT, so the target is only grab_width^2 texels and the nearest
+// hit is exact however many objects are named.
+struct PickBuffer
+{
+    PickBuffer()
+        : size(0), prog_valid(false), prog_tried(false)
+    {
+    }
+
+    // Returns false if ID buffer picking isn't supported by this context,
+    // for instance if the pick shader doesn't compile.
+    bool ComputeHits(Renderable& scene, const View& view,
+                     const OpenGlRenderState& cam_state,
+                     int x, int y, int grab_width,
+                     std::map<GLuint, Interactive*>& hit_objects)
+    {
+        if(!InitProgram()) {
+            return false;
+        }
+        const int w = std::max(grab_width, 1);
+        Resize(w);
+
+        GLint prev_fbid = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prev_fbid);
+        glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_PIXEL_MODE_BIT);
+
+        fb.Bind();
+        GlStateCache::I().Viewport(0, 0, w, w);
+        GlStateCache::I().Disable(GL_SCISSOR_TEST);
+        GlStateCache::I().Disable(GL_BLEND);
+        GlStateCache::I().Enable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        const GLuint no_id[4] = {0, 0, 0, 0};
+        glClearBufferuiv(GL_COLOR, 0, no_id);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        // Load and adjust modelview projection matrices
+        GLint viewport[4] = {view.v.l, view.v.b, view.v.w, view.v.h};
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        gluPickMatrix(x, y, w, w, viewport);
+        cam_state.GetProjectionMatrix().Multiply();
+        glMatrixMode(GL_MODELVIEW);
+        cam_state.GetModelViewMatrix().Load();
+
+        // Render scenegraph writing pick names
+        PickNames& names = PickNames::I();
+        prog.Bind();
+        names.stack.clear();
+        names.id_location = prog.GetUniformHandle("pick_id");
+        glUniform1ui(names.id_location, 0);
+        RenderParams select;
+        select.render_mode = GL_SELECT;
+        scene.Render(select);
+        names.id_location = -1;
+        names.stack.clear();
+        prog.Unbind();
+
+        std::vector<GLuint> id_pixels(w*w);
+        std::vector<GLfloat> depth_pixels(w*w);
+        glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+        glReadPixels(0, 0, w, w, GL_RED_INTEGER, GL_UNSIGNED_INT, id_pixels.data());
+        glReadPixels(0, 0, w, w, GL_DEPTH_COMPONENT, GL_FLOAT, depth_pixels.data());
+
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prev_fbid);
+        GlStateCache::I().PopAttrib();
+
+        // Closest named fragment within the grab window
+        GLuint closest_id = 0;
+        GLfloat closest_depth = std::numeric_limits<GLfloat>::max();
+        for(size_t i = 0; i < id_pixels.size(); ++i) {
+            if(id_pixels[i] && depth_pixels[i] < closest_depth) {
+                closest_id = id_pixels[i];
+                closest_depth = depth_pixels[i];
+            }
+        }
+        if(closest_id) {
+            hit_objects[closest_id] = InteractiveIndex::I().Find(closest_id);
+        }
+        return true;
+    }
+
+protected:
+    bool InitProgram()
+    {
+        if(!prog_tried) {
+            prog_tried = true;
+            const char* source_vert =
+                    "#version 130\n"
+                    "void main() {"
+                    "  gl_Position = ftransform();"
+                    "}";
+            const char* source_frag =
+                    "#version 130\n"
+                    "uniform uint pick_id;"
+                    "out uint frag_id;"
+                    "void main() {"
+                    "  frag_id = pick_id;"
+                    "}";
+            prog_valid = prog.AddShader(GlSlVertexShader, source_vert) &&
+                         prog.AddShader(GlSlFragmentShader, source_frag);
+            if(prog_valid) {
+                glBindFragDataLocation(prog.ProgramId(), 0, "frag_id");
+                prog_valid = prog.Link();
+            }
+        }
+        return prog_valid;
+    }
+
+    void Resize(int w)
+    {
+        if(w != size) {
+            size = w;
+            ids.Reinitialise(w, w, GL_R32UI, false, 0, GL_RED_INTEGER, GL_UNSIGNED_INT);
+            depth.Reinitialise(w, w, GL_DEPTH_COMPONENT24);
+            fb.Reinitialise();
+            fb.attachments = 0;
+            fb.AttachColour(ids);
+            fb.AttachDepth(depth);
+        }
+    }
+
+    int size;
+    bool prog_valid;
+    bool prog_tried;
+    GlSlProgram prog;
+    GlTexture ids;
+    GlRenderBuffer depth;
+    GlFramebuffer fb;
+};
+
+}
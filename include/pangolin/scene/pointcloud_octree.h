@@ -0,0 +1,509 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glvbo.h>
+#include <pangolin/scene/renderable.h>
+
+namespace pangolin {
+
+// Octree file layout, written by BuildPointCloudOctree and streamed by
+// PointCloudOctree: PointCloudOctreeHeader, then num_nodes
+// PointCloudOctreeNode, then the points of each node at its offset as
+// num_points xyz floats followed, if has_colour, by num_points RGBA8.
+// Each point is stored once. Nodes nearer the root hold spatially uniform
+// subsamples of their subtree, so drawing any subtree containing the root
+// gives an even, progressively finer, cover of the cloud.
+struct PointCloudOctreeHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t has_colour;
+    uint32_t num_nodes;
+    uint32_t reserved;
+};
+
+struct PointCloudOctreeNode
+{
+    float center[3];
+    float half_size;
+    // Typical distance between the node's points
+    float spacing;
+    uint32_t num_points;
+    uint64_t offset;
+    // Index of each octant's node, or -1
+    int32_t children[8];
+};
+
+const char PointCloudOctreeMagic[8] = {'P','G','O','C','T','R','E','E'};
+const uint32_t PointCloudOctreeVersion = 1;
+
+// Write num_points points (xyz) with optional colours (rgba, or nullptr) to
+// filename as an octree whose nodes hold at most max_node_points each.
+// Points are partitioned in memory, so very large clouds should be built
+// from tiles of at most a few hundred million points.
+inline void BuildPointCloudOctree(
+    const std::string& filename, const float* xyz, const uint8_t* rgba,
+    size_t num_points, size_t max_node_points = 32768)
+{
+    if(num_points > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("BuildPointCloudOctree: Too many points.");
+    }
+    max_node_points = std::max<size_t>(max_node_points, 64);
+
+    // Bounding cube
+    float lo[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float hi[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    for(size_t i = 0; i < num_points; ++i) {
+        for(int d = 0; d < 3; ++d) {
+            lo[d] = std::min(lo[d], xyz[3*i+d]);
+            hi[d] = std::max(hi[d], xyz[3*i+d]);
+        }
+    }
+    float half = 0;
+    for(int d = 0; d < 3; ++d) half = std::max(half, (hi[d] - lo[d]) / 2);
+    half = half * 1.0001f + 1e-6f;
+
+    std::vector<PointCloudOctreeNode> nodes;
+    std::vector<std::vector<uint32_t>> node_points;
+
+    // Subsample to the first point in each cell of a grid with about
+    // max_node_points cells over a surface through the node.
+    const uint64_t grid = (uint64_t)std::ceil(std::sqrt((double)max_node_points));
+
+    struct Builder {
+        static int32_t Build(
+            std::vector<PointCloudOctreeNode>& nodes, std::vector<std::vector<uint32_t>>& node_points,
+            std::vector<uint32_t>& idx, const float* xyz, const float c[3], float half,
+            size_t max_node_points, uint64_t grid, int depth)
+        {
+            const int32_t id = (int32_t)nodes.size();
+            nodes.push_back(PointCloudOctreeNode());
+            node_points.push_back(std::vector<uint32_t>());
+            PointCloudOctreeNode n;
+            std::copy(c, c + 3, n.center);
+            n.half_size = half;
+            std::fill(n.children, n.children + 8, -1);
+
+            std::vector<uint32_t> keep;
+            std::vector<uint32_t> octants[8];
+            if(idx.size() <= max_node_points || depth >= 24) {
+                keep.swap(idx);
+                n.spacing = 2 * half / std::max(1.0f, std::sqrt((float)keep.size()));
+            }else{
+                const float cell = 2 * half / grid;
+                std::unordered_set<uint64_t> occupied;
+                for(uint32_t i : idx) {
+                    const float* p = xyz + 3 * (size_t)i;
+                    uint64_t key = 0;
+                    for(int d = 0; d < 3; ++d) {
+                        const uint64_t g = (uint64_t)std::min<float>((float)grid - 1, std::max(0.0f, (p[d] - c[d] + half) / cell));
+                        key = key * grid + g;
+                    }
+                    if(keep.size() < max_node_points && occupied.insert(key).second) {
+                        keep.push_back(i);
+                    }else{
+                        octants[(p[0] >= c[0] ? 1 : 0) | (p[1] >= c[1] ? 2 : 0) | (p[2] >= c[2] ? 4 : 0)].push_back(i);
+                    }
+                }
+                n.spacing = cell;
+                std::vector<uint32_t>().swap(idx);
+
+                for(int o = 0; o < 8; ++o) {
+                    if(octants[o].empty()) continue;
+                    const float h = half / 2;
+                    const float cc[3] = { c[0] + (o & 1 ? h : -h), c[1] + (o & 2 ? h : -h), c[2] + (o & 4 ? h : -h) };
+                    n.children[o] = Build(nodes, node_points, octants[o], xyz, cc, h, max_node_points, grid, depth + 1);
+                }
+            }
+            n.num_points = (uint32_t)keep.size();
+            nodes[id] = n;
+            node_points[id].swap(keep);
+            return id;
+        }
+    };
+
+    std::vector<uint32_t> all(num_points);
+    for(size_t i = 0; i < num_points; ++i) all[i] = (uint32_t)i;
+    const float c[3] = { (lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2 };
+    if(num_points) {
+        Builder::Build(nodes, node_points, all, xyz, c, half, max_node_points, grid, 0);
+    }
+
+    const size_t point_bytes = 3 * sizeof(float) + (rgba ? 4 : 0);
+    uint64_t offset = sizeof(PointCloudOctreeHeader) + nodes.size() * sizeof(PointCloudOctreeNode);
+    for(PointCloudOctreeNode& n : nodes) {
+        n.offset = offset;
+        offset += n.num_points * point_bytes;
+    }
+
+    std::ofstream f(filename, std::ios::binary);
+    if(!f) {
+        throw std::runtime_error("BuildPointCloudOctree: Unable to open '" + filename + "' for writing.");
+    }
+    PointCloudOctreeHeader header;
+    std::memcpy(header.magic, PointCloudOctreeMagic, sizeof(header.magic));
+    header.version = PointCloudOctreeVersion;
+    header.has_colour = rgba ? 1 : 0;
+    header.num_nodes = (uint32_t)nodes.size();
+    header.reserved = 0;
+    f.write((const char*)&header, sizeof(header));
+    f.write((const char*)nodes.data(), nodes.size() * sizeof(PointCloudOctreeNode));
+
+    std::vector<char> buffer;
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        const std::vector<uint32_t>& pts = node_points[i];
+        buffer.resize(pts.size() * point_bytes);
+        float* out_xyz = (float*)buffer.data();
+        uint8_t* out_rgba = (uint8_t*)(out_xyz + 3 * pts.size());
+        for(size_t j = 0; j < pts.size(); ++j) {
+            std::memcpy(out_xyz + 3 * j, xyz + 3 * (size_t)pts[j], 3 * sizeof(float));
+            if(rgba) std::memcpy(out_rgba + 4 * j, rgba + 4 * (size_t)pts[j], 4);
+        }
+        f.write(buffer.data(), buffer.size());
+    }
+    if(!f) {
+        throw std::runtime_error("BuildPointCloudOctree: Error writing '" + filename + "'.");
+    }
+}
+
+// Renderable drawing an out-of-core point cloud octree file. Each frame the
+// nodes whose point spacing projects to more than max_screen_error pixels
+// are refined, as far as their children are resident on the GPU. Missing
+// nodes are read from disk by a background thread, most visible first, and
+// the least recently drawn nodes are evicted to stay within
+// gpu_budget_bytes. Uses the current GL modelview / projection, so works
+// within any scene graph rendered with an OpenGlRenderState.
+class PointCloudOctree : public Renderable
+{
+public:
+    PointCloudOctree(const std::string& filename, size_t gpu_budget_bytes = 512 << 20)
+        : max_screen_error(2.0f), gpu_budget_bytes(gpu_budget_bytes),
+          upload_budget_bytes(32 << 20), point_size(1.0f),
+          frame(0), gpu_bytes(0), points_drawn(0), quit(false)
+    {
+        std::ifstream f(filename, std::ios::binary);
+        PointCloudOctreeHeader header;
+        if(!f.read((char*)&header, sizeof(header)) ||
+           std::memcmp(header.magic, PointCloudOctreeMagic, sizeof(header.magic)) ||
+           header.version != PointCloudOctreeVersion) {
+            throw std::runtime_error("PointCloudOctree: '" + filename + "' isn't a point cloud octree.");
+        }
+        has_colour = header.has_colour != 0;
+        nodes.resize(header.num_nodes);
+        if(!f.read((char*)nodes.data(), nodes.size() * sizeof(PointCloudOctreeNode))) {
+            throw std::runtime_error("PointCloudOctree: '" + filename + "' is truncated.");
+        }
+        resident.resize(nodes.size());
+        view_dependent = true;
+
+        bounds = nodes.empty() ? BoundingSphere::Empty() :
+            BoundingSphere(nodes[0].center[0], nodes[0].center[1], nodes[0].center[2], nodes[0].half_size * std::sqrt(3.0f));
+
+        loader = std::thread(&PointCloudOctree::LoaderThread, this, filename);
+    }
+
+    ~PointCloudOctree()
+    {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        loader.join();
+    }
+
+    void Render(const RenderParams& params) override
+    {
+        ++frame;
+        points_drawn = 0;
+        ReceiveLoaded();
+
+        if(!nodes.empty()) {
+            View view;
+            ReadView(view);
+
+            std::vector<std::pair<float,int32_t>> wanted;
+            glPointSize(point_size);
+            Traverse(0, view, wanted);
+            glPointSize(1.0f);
+            Request(wanted);
+        }
+
+        Evict();
+        RenderChildren(params);
+    }
+
+    // Refine nodes whose points are further apart than this on screen, in pixels
+    float max_screen_error;
+    size_t gpu_budget_bytes;
+    // Bytes uploaded to the GPU per frame at most (beyond the first node)
+    size_t upload_budget_bytes;
+    float point_size;
+
+    size_t NumNodes() const { return nodes.size(); }
+    size_t GpuBytes() const { return gpu_bytes; }
+    size_t PointsDrawn() const { return points_drawn; }
+
+protected:
+    struct View
+    {
+        OpenGlMatrix mv;
+        Frustum frustum;
+        // Pixels per unit length at unit distance (perspective) or at any
+        // distance (orthographic)
+        float pixels_per_unit;
+        bool perspective;
+    };
+
+    struct Resident
+    {
+        Resident() : bytes(0), last_used(0) {}
+        GlBuffer vbo;
+        GlBuffer cbo;
+        size_t bytes;
+        uint64_t last_used;
+    };
+
+    struct Loaded
+    {
+        int32_t node;
+        std::vector<float> xyz;
+        std::vector<uint8_t> rgba;
+    };
+
+    static void ReadView(View& view)
+    {
+        GLfloat mv[16], p[16];
+        GLint viewport[4];
+        glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+        glGetFloatv(GL_PROJECTION_MATRIX, p);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        OpenGlMatrix P;
+        for(int i = 0; i < 16; ++i) {
+            view.mv.m[i] = mv[i];
+            P.m[i] = p[i];
+        }
+        view.frustum = Frustum(P * view.mv);
+        view.perspective = p[15] == 0.0f;
+        view.pixels_per_unit = std::abs(p[5]) * viewport[3] / 2.0f;
+    }
+
+    // Projected spacing of node's points in pixels
+    float ScreenError(const PointCloudOctreeNode& n, const View& view) const
+    {
+        if(!view.perspective) return n.spacing * view.pixels_per_unit;
+        const GLprecision* m = view.mv.m;
+        const float ex = float(m[0]*n.center[0] + m[4]*n.center[1] + m[8]*n.center[2] + m[12]);
+        const float ey = float(m[1]*n.center[0] + m[5]*n.center[1] + m[9]*n.center[2] + m[13]);
+        const float ez = float(m[2]*n.center[0] + m[6]*n.center[1] + m[10]*n.center[2] + m[14]);
+        // Distance to the nearest point of the node's bounds
+        const float dist = std::sqrt(ex*ex + ey*ey + ez*ez) - n.half_size * std::sqrt(3.0f);
+        return n.spacing * view.pixels_per_unit / std::max(dist, 1e-3f * n.half_size);
+    }
+
+    void Traverse(int32_t id, const View& view, std::vector<std::pair<float,int32_t>>& wanted)
+    {
+        const PointCloudOctreeNode& n = nodes[id];
+        const BoundingSphere b(n.center[0], n.center[1], n.center[2], n.half_size * std::sqrt(3.0f));
+        if(view.frustum.Classify(b) < 0) return;
+
+        const float error = ScreenError(n, view);
+        Resident& r = resident[id];
+        if(!r.vbo.IsValid()) {
+            // Parents are drawn before children can be, so the root comes first
+            wanted.push_back(std::make_pair(id == 0 ? std::numeric_limits<float>::max() : error, id));
+            return;
+        }
+
+        r.last_used = frame;
+        if(r.cbo.IsValid()) {
+            RenderVboCbo(r.vbo, r.cbo, true);
+        }else{
+            RenderVbo(r.vbo);
+        }
+        points_drawn += n.num_points;
+
+        if(error > max_screen_error) {
+            for(int32_t c : n.children) {
+                if(c >= 0) Traverse(c, view, wanted);
+            }
+        }
+    }
+
+    // Replace the loader's queue with the nodes wanted this frame
+    void Request(std::vector<std::pair<float,int32_t>>& wanted)
+    {
+        std::sort(wanted.begin(), wanted.end());
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            queue.clear();
+            for(const auto& w : wanted) {
+                // Already read, or being read
+                if(w.second == loading || in_ready.count(w.second)) continue;
+                queue.push_back(w.second);
+            }
+        }
+        cv.notify_one();
+    }
+
+    // Upload nodes read by the loader, within the per frame budget
+    void ReceiveLoaded()
+    {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            for(Loaded& n : loaded) ready.push_back(std::move(n));
+            loaded.clear();
+        }
+
+        size_t uploaded = 0;
+        size_t i = 0;
+        for(; i < ready.size() && (i == 0 || uploaded < upload_budget_bytes); ++i) {
+            Loaded& n = ready[i];
+            Resident& r = resident[n.node];
+            const GLuint num = (GLuint)(n.xyz.size() / 3);
+            if(num) {
+                r.vbo.Reinitialise(GlArrayBuffer, num, GL_FLOAT, 3, GL_STATIC_DRAW);
+                r.vbo.Upload(n.xyz.data(), n.xyz.size() * sizeof(float));
+                if(!n.rgba.empty()) {
+                    r.cbo.Reinitialise(GlArrayBuffer, num, GL_UNSIGNED_BYTE, 4, GL_STATIC_DRAW);
+                    r.cbo.Upload(n.rgba.data(), n.rgba.size());
+                }
+            }else{
+                // Keep a valid buffer to mark the node resident
+                r.vbo.Reinitialise(GlArrayBuffer, 0, GL_FLOAT, 3, GL_STATIC_DRAW);
+            }
+            r.last_used = frame;
+            r.bytes = n.xyz.size() * sizeof(float) + n.rgba.size();
+            gpu_bytes += r.bytes;
+            uploaded += r.bytes;
+        }
+
+        std::lock_guard<std::mutex> l(mutex);
+        for(size_t j = 0; j < i; ++j) in_ready.erase(ready[j].node);
+        ready.erase(ready.begin(), ready.begin() + i);
+    }
+
+    // Free least recently drawn nodes not drawn this frame until within budget
+    void Evict()
+    {
+        if(gpu_bytes <= gpu_budget_bytes) return;
+
+        std::vector<std::pair<uint64_t,int32_t>> candidates;
+        for(size_t i = 0; i < resident.size(); ++i) {
+            if(resident[i].vbo.IsValid() && resident[i].last_used < frame) {
+                candidates.push_back(std::make_pair(resident[i].last_used, (int32_t)i));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for(const auto& c : candidates) {
+            if(gpu_bytes <= gpu_budget_bytes) break;
+            Resident& r = resident[c.second];
+            gpu_bytes -= r.bytes;
+            r.vbo = GlBuffer();
+            r.cbo = GlBuffer();
+            r.bytes = 0;
+        }
+    }
+
+    void LoaderThread(const std::string filename)
+    {
+        std::ifstream f(filename, std::ios::binary);
+        while(true) {
+            int32_t id;
+            {
+                std::unique_lock<std::mutex> l(mutex);
+                cv.wait(l, [this](){ return quit || !queue.empty(); });
+                if(quit) return;
+                // Sorted by increasing error
+                id = queue.back();
+                queue.pop_back();
+                loading = id;
+            }
+
+            const PointCloudOctreeNode& n = nodes[id];
+            Loaded out;
+            out.node = id;
+            out.xyz.resize(3 * (size_t)n.num_points);
+            if(has_colour) out.rgba.resize(4 * (size_t)n.num_points);
+            f.seekg((std::streamoff)n.offset);
+            f.read((char*)out.xyz.data(), out.xyz.size() * sizeof(float));
+            f.read((char*)out.rgba.data(), out.rgba.size());
+            if(!f) {
+                // Truncated file: draw the node empty rather than retrying
+                f.clear();
+                out.xyz.clear();
+                out.rgba.clear();
+            }
+
+            std::lock_guard<std::mutex> l(mutex);
+            loaded.push_back(std::move(out));
+            in_ready.insert(id);
+            loading = -1;
+        }
+    }
+
+    std::vector<PointCloudOctreeNode> nodes;
+    bool has_colour;
+
+    // Main thread only
+    std::vector<Resident> resident;
+    std::vector<Loaded> ready;
+    uint64_t frame;
+    size_t gpu_bytes;
+    size_t points_drawn;
+
+    // Shared with the loader thread
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<int32_t> queue;
+    std::vector<Loaded> loaded;
+    // Nodes in loaded or ready
+    std::unordered_set<int32_t> in_ready;
+    int32_t loading = -1;
+    bool quit;
+    std::thread loader;
+};
+
+}
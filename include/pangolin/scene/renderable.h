@@ -27,15 +27,130 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <functional>
 #include <memory>
-#include <map>
+#include <mutex>
 #include <random>
+#include <unordered_map>
+#include <vector>
 
 #include <pangolin/display/opengl_render_state.h>
 #include <pangolin/scene/interactive.h>
 
 namespace pangolin {
 
+// Sphere bounding the geometry of a Renderable, in its own frame. A
+// negative radius bounds nothing, and an infinite one everything.
+struct BoundingSphere
+{
+    static BoundingSphere Empty() {
+        return BoundingSphere(0,0,0, -1.0);
+    }
+
+    static BoundingSphere Unbounded() {
+        return BoundingSphere(0,0,0, std::numeric_limits<GLprecision>::infinity());
+    }
+
+    BoundingSphere(GLprecision x = 0, GLprecision y = 0, GLprecision z = 0,
+                   GLprecision radius = std::numeric_limits<GLprecision>::infinity())
+        : radius(radius)
+    {
+        center[0] = x; center[1] = y; center[2] = z;
+    }
+
+    bool IsEmpty() const { return radius < 0; }
+    bool IsUnbounded() const { return std::isinf(radius); }
+
+    bool operator!=(const BoundingSphere& o) const {
+        return radius != o.radius || center[0] != o.center[0] ||
+               center[1] != o.center[1] || center[2] != o.center[2];
+    }
+
+    // Bounds of this sphere after transformation by T
+    BoundingSphere Transform(const OpenGlMatrix& T) const
+    {
+        if(IsEmpty() || IsUnbounded()) return *this;
+        const GLprecision* m = T.m;
+        GLprecision scale2 = 0;
+        for(int c=0; c<3; ++c) {
+            scale2 = std::max(scale2, m[4*c]*m[4*c] + m[4*c+1]*m[4*c+1] + m[4*c+2]*m[4*c+2]);
+        }
+        return BoundingSphere(
+            m[0]*center[0] + m[4]*center[1] + m[8]*center[2] + m[12],
+            m[1]*center[0] + m[5]*center[1] + m[9]*center[2] + m[13],
+            m[2]*center[0] + m[6]*center[1] + m[10]*center[2] + m[14],
+            radius * std::sqrt(scale2)
+        );
+    }
+
+    // Smallest sphere containing this one and o
+    void Extend(const BoundingSphere& o)
+    {
+        if(o.IsEmpty() || IsUnbounded()) return;
+        if(IsEmpty() || o.IsUnbounded()) { *this = o; return; }
+
+        const GLprecision d[3] = {o.center[0]-center[0], o.center[1]-center[1], o.center[2]-center[2]};
+        const GLprecision dist = std::sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+        if(dist + o.radius <= radius) return;
+        if(dist + radius <= o.radius) { *this = o; return; }
+
+        const GLprecision r = (dist + radius + o.radius) / 2;
+        const GLprecision t = (r - radius) / dist;
+        center[0] += t*d[0]; center[1] += t*d[1]; center[2] += t*d[2];
+        radius = r;
+    }
+
+    GLprecision center[3];
+    GLprecision radius;
+};
+
+// Planes of a view frustum, from the matrix taking points to clip space
+struct Frustum
+{
+    Frustum() {}
+
+    Frustum(const OpenGlMatrix& T_clip)
+    {
+        // Gribb & Hartmann: rows of T_clip combined pairwise with the last
+        const GLprecision* m = T_clip.m;
+        for(int i=0; i<3; ++i) {
+            for(int s=0; s<2; ++s) {
+                GLprecision* p = plane[2*i+s];
+                const GLprecision sign = s ? -1 : 1;
+                for(int c=0; c<4; ++c) {
+                    p[c] = m[4*c+3] + sign * m[4*c+i];
+                }
+                const GLprecision n = std::sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+                if(n > 0) for(int c=0; c<4; ++c) p[c] /= n;
+            }
+        }
+    }
+
+    // -1 if sphere is entirely outside, +1 if entirely inside, 0 otherwise
+    int Classify(const BoundingSphere& b) const
+    {
+        if(b.IsEmpty()) return -1;
+        if(b.IsUnbounded()) return 0;
+        int inside = 1;
+        for(int i=0; i<6; ++i) {
+            const GLprecision* p = plane[i];
+            const GLprecision d = p[0]*b.center[0] + p[1]*b.center[1] + p[2]*b.center[2] + p[3];
+            if(d < -b.radius) return -1;
+            if(d < b.radius) inside = 0;
+        }
+        return inside;
+    }
+
+    GLprecision plane[6][4];
+};
+
+class SceneUpdateQueue;
+class SceneDrawList;
+
 class Renderable
 {
 public:
@@ -49,7 +164,8 @@ public:
     }
 
     Renderable(const std::weak_ptr<Renderable>& parent = std::weak_ptr<Renderable>())
-        : guid(UniqueGuid()), parent(parent), T_pc(IdentityMatrix()), should_show(true)
+        : guid(UniqueGuid()), parent(parent), T_pc(IdentityMatrix()), should_show(true),
+          bounds(BoundingSphere::Unbounded()), view_dependent(false), world_valid(false)
     {
     }
 
@@ -62,32 +178,63 @@ public:
         RenderChildren(params);
     }
 
+    // Render visible children. Called from the root of a scene this first
+    // brings the cached scene from child transforms and subtree bounds up
+    // to date; those of unchanged subtrees are reused. With params.cull,
+    // subtrees whose bounds lie outside the view frustum are skipped, and
+    // those entirely within it aren't tested further.
     void RenderChildren(const RenderParams& params)
     {
+        Traversal& t = CurrentTraversal();
+        const bool root = t.depth == 0;
+        if(root) {
+            ApplyUpdates();
+            UpdateChildren(IdentityMatrix(), false);
+            t.cull = params.cull;
+            t.inside = !params.cull;
+            if(params.cull) t.frustum = Frustum(params.T_clip_scene);
+        }
+
+        ++t.depth;
+        const bool parent_inside = t.inside;
         for(auto& p : children) {
-            Renderable& r = *p.second;
+            Renderable& r = *p;
             if(r.should_show) {
+                t.inside = parent_inside;
+                if(t.cull && !t.inside) {
+                    const int c = t.frustum.Classify(r.world_bounds);
+                    if(c < 0) continue;
+                    t.inside = c > 0;
+                }
+
                 glPushMatrix();
                 r.T_pc.Multiply();
-                r.Render(params);
-                if(r.manipulator) {
-                    r.manipulator->Render(params);
+                if(r.view_dependent && t.record_live) {
+                    t.record_live(r);
+                }else{
+                    r.Render(params);
+                    if(r.manipulator) {
+                        r.manipulator->Render(params);
+                    }
                 }
                 glPopMatrix();
             }
         }
+        t.inside = parent_inside;
+        --t.depth;
+        if(root) t.cull = false;
     }
 
     std::shared_ptr<Renderable> FindChild(guid_t guid)
     {
-        auto o = children.find(guid);
-        if(o != children.end()) {
-            return o->second;
+        auto o = child_index.find(guid);
+        if(o != child_index.end()) {
+            return children[o->second];
         }
 
-        for(auto& kv : children ) {
-            std::shared_ptr<Renderable> c = kv.second->FindChild(guid);
-            if(c) return c;
+        for(auto& c : children ) {
+            std::shared_ptr<Renderable> r = c->FindChild(guid);
+            if(r) return r;
         }
 
         return std::shared_ptr<Renderable>();
@@ -96,11 +243,44 @@ public:
     Renderable& Add(const std::shared_ptr<Renderable>& child)
     {
         if(child) {
-            children[child->guid] = child;
+            auto o = child_index.find(child->guid);
+            if(o != child_index.end()) {
+                children[o->second] = child;
+            }else{
+                child_index[child->guid] = children.size();
+                children.push_back(child);
+            }
+            child->world_valid = false;
+            world_valid = false;
         };
         return *this;
     }
 
+    // Remove direct child by guid, returning true if it was found.
+    bool Remove(guid_t guid)
+    {
+        auto o = child_index.find(guid);
+        if(o == child_index.end()) {
+            return false;
+        }
+
+        // Swap with the last child to keep storage contiguous
+        const size_t i = o->second;
+        child_index.erase(o);
+        if(i + 1 != children.size()) {
+            children[i] = std::move(children.back());
+            child_index[children[i]->guid] = i;
+        }
+        children.pop_back();
+        world_valid = false;
+        return true;
+    }
+
+    // Pose of this node relative to the root of the scene it was last
+    // rendered in, and the bounds of it and its descendants in that frame.
+    const OpenGlMatrix& SceneFromChild() const { return T_sc; }
+    const BoundingSphere& SceneBounds() const { return world_bounds; }
+
     // Renderable properties
     const guid_t guid;
     std::weak_ptr<Renderable> parent;
@@ -108,11 +288,261 @@ public:
     std::shared_ptr<Renderable> child;
     bool should_show;
 
+    // Bounds of what Render() draws in this node's frame, excluding
+    // children. Unbounded by default so that nodes are never culled.
+    BoundingSphere bounds;
+
+    // Set by nodes whose drawing depends on the view they're rendered in
+    // (reading back GL matrices, say), so that a SceneDrawList renders them
+    // afresh for each view rather than recording them once.
+    bool view_dependent;
+
     // Children
-    std::map<guid_t, std::shared_ptr<Renderable>> children;
+    std::vector<std::shared_ptr<Renderable>> children;
+    std::unordered_map<guid_t, size_t> child_index;
 
     // Manipulator (handler, thing)
     std::shared_ptr<Manipulator> manipulator;
+
+    // Changes queued by other threads, applied when this node starts to
+    // render as the root of a scene.
+    std::shared_ptr<SceneUpdateQueue> updates;
+
+protected:
+    friend class SceneDrawList;
+
+    struct Traversal
+    {
+        int depth = 0;
+        bool cull = false;
+        bool inside = true;
+        Frustum frustum;
+        // Whilst a SceneDrawList records, called in place of rendering
+        // view dependent nodes
+        std::function<void(Renderable&)> record_live;
+    };
+
+    static Traversal& CurrentTraversal()
+    {
+        static thread_local Traversal t;
+        return t;
+    }
+
+    // Refresh cached transforms and bounds given the scene pose of the
+    // parent, returning true if anything beneath changed.
+    bool UpdateWorld(const OpenGlMatrix& T_sp, bool parent_changed)
+    {
+        const bool changed = parent_changed || !world_valid ||
+            std::memcmp(T_pc.m, T_pc_cached.m, sizeof(T_pc.m)) || bounds != bounds_cached;
+        if(changed) {
+            T_pc_cached = T_pc;
+            bounds_cached = bounds;
+            T_sc = T_sp * T_pc;
+        }
+        const bool children_changed = UpdateChildren(T_sc, changed);
+        if(changed || children_changed) {
+            world_bounds = bounds.Transform(T_sc);
+            for(auto& c : children) {
+                world_bounds.Extend(c->world_bounds);
+            }
+            world_valid = true;
+        }
+        return changed || children_changed;
+    }
+
+    bool UpdateChildren(const OpenGlMatrix& T_sn, bool changed)
+    {
+        bool children_changed = false;
+        for(auto& c : children) {
+            children_changed |= c->UpdateWorld(T_sn, changed);
+        }
+        return children_changed;
+    }
+
+    inline void ApplyUpdates();
+
+    // Cached scene state, refreshed from the root on render
+    OpenGlMatrix T_pc_cached;
+    BoundingSphere bounds_cached;
+    OpenGlMatrix T_sc;
+    BoundingSphere world_bounds;
+    bool world_valid;
+};
+
+// Double buffered changes to a tree of Renderables, letting other threads
+// (say a SLAM back end adding keyframes and correcting their poses) edit a
+// scene without locking it for the length of a render. Producers queue
+// changes to nodes they hold, taking a lock only to append them, and the
+// render thread swaps buffers and applies everything queued so far at the
+// start of its next frame. Changes submitted in one Batch are seen together,
+// and poses of a node which haven't yet been applied replace one another, so
+// the queue stays bounded however quickly poses are streamed.
+class SceneUpdateQueue
+{
+    struct Op
+    {
+        enum Type { OpAdd, OpRemove, OpPose, OpShow, OpModify };
+
+        Type type;
+        std::shared_ptr<Renderable> node;
+        std::shared_ptr<Renderable> child;
+        Renderable::guid_t guid;
+        OpenGlMatrix T_pc;
+        bool show;
+        std::function<void(Renderable&)> modify;
+    };
+
+public:
+    // Changes to be applied together
+    class Batch
+    {
+    public:
+        void Add(const std::shared_ptr<Renderable>& parent, const std::shared_ptr<Renderable>& child)
+        {
+            Op op = Make(Op::OpAdd, parent);
+            op.child = child;
+            ops.push_back(std::move(op));
+        }
+
+        void Remove(const std::shared_ptr<Renderable>& parent, Renderable::guid_t guid)
+        {
+            Op op = Make(Op::OpRemove, parent);
+            op.guid = guid;
+            ops.push_back(std::move(op));
+        }
+
+        void SetPose(const std::shared_ptr<Renderable>& node, const OpenGlMatrix& T_pc)
+        {
+            Op op = Make(Op::OpPose, node);
+            op.T_pc = T_pc;
+            ops.push_back(std::move(op));
+        }
+
+        void SetShow(const std::shared_ptr<Renderable>& node, bool show)
+        {
+            Op op = Make(Op::OpShow, node);
+            op.show = show;
+            ops.push_back(std::move(op));
+        }
+
+        // Any other change, run on the render thread
+        void Modify(const std::shared_ptr<Renderable>& node, const std::function<void(Renderable&)>& modify)
+        {
+            Op op = Make(Op::OpModify, node);
+            op.modify = modify;
+            ops.push_back(std::move(op));
+        }
+
+        bool empty() const { return ops.empty(); }
+        size_t size() const { return ops.size(); }
+
+    private:
+        friend class SceneUpdateQueue;
+
+        static Op Make(Op::Type type, const std::shared_ptr<Renderable>& node)
+        {
+            Op op;
+            op.type = type;
+            op.node = node;
+            op.guid = 0;
+            op.show = true;
+            return op;
+        }
+
+        std::vector<Op> ops;
+    };
+
+    // Queue a single change
+    void Add(const std::shared_ptr<Renderable>& parent, const std::shared_ptr<Renderable>& child)
+    {
+        Batch b; b.Add(parent, child); Submit(std::move(b));
+    }
+
+    void Remove(const std::shared_ptr<Renderable>& parent, Renderable::guid_t guid)
+    {
+        Batch b; b.Remove(parent, guid); Submit(std::move(b));
+    }
+
+    void SetPose(const std::shared_ptr<Renderable>& node, const OpenGlMatrix& T_pc)
+    {
+        Batch b; b.SetPose(node, T_pc); Submit(std::move(b));
+    }
+
+    void SetShow(const std::shared_ptr<Renderable>& node, bool show)
+    {
+        Batch b; b.SetShow(node, show); Submit(std::move(b));
+    }
+
+    void Modify(const std::shared_ptr<Renderable>& node, const std::function<void(Renderable&)>& modify)
+    {
+        Batch b; b.Modify(node, modify); Submit(std::move(b));
+    }
+
+    // Queue changes to be applied within the same frame. Callable from any thread.
+    void Submit(Batch&& batch)
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        for(Op& op : batch.ops) {
+            if(!op.node) continue;
+            if(op.type == Op::OpPose) {
+                // Only the latest pose of a node matters
+                auto p = pending_pose.find(op.node.get());
+                if(p != pending_pose.end()) {
+                    pending[p->second].T_pc = op.T_pc;
+                    continue;
+                }
+                pending_pose[op.node.get()] = pending.size();
+            }
+            pending.push_back(std::move(op));
+        }
+        batch.ops.clear();
+    }
+
+    // Changes queued since the last Apply()
+    size_t Pending() const
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        return pending.size();
+    }
+
+    // Apply all queued changes in order, returning how many there were. Called
+    // by the root of a scene as it starts to render, on the render thread.
+    size_t Apply()
+    {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if(pending.empty()) return 0;
+            std::swap(pending, applying);
+            pending_pose.clear();
+        }
+
+        for(Op& op : applying) {
+            Renderable& r = *op.node;
+            switch(op.type) {
+            case Op::OpAdd:    r.Add(op.child); break;
+            case Op::OpRemove: r.Remove(op.guid); break;
+            case Op::OpPose:   r.T_pc = op.T_pc; break;
+            case Op::OpShow:   r.should_show = op.show; break;
+            case Op::OpModify: if(op.modify) op.modify(r); break;
+            }
+        }
+
+        // Keep capacity for the next swap, but not the nodes
+        const size_t n = applying.size();
+        applying.clear();
+        return n;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Op> pending;
+    std::unordered_map<const Renderable*, size_t> pending_pose;
+    std::vector<Op> applying;
 };
 
+inline void Renderable::ApplyUpdates()
+{
+    if(updates) updates->Apply();
+}
+
 }
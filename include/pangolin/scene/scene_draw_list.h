@@ -0,0 +1,168 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2011 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <pangolin/display/opengl_render_state.h>
+#include <pangolin/gl/glstate.h>
+#include <pangolin/scene/renderable.h>
+
+namespace pangolin {
+
+// A scene traversed once per frame and drawn from several views. Record()
+// walks the tree of Renderables, compiling what they draw into GL display
+// lists, and Replay() draws the result for one camera without visiting
+// the tree again, so a scene shown in N views costs one traversal rather
+// than N. Nodes marked view_dependent are left out of the recording and
+// rendered afresh within each Replay(), at their place in the tree.
+//
+// Recorded commands are fixed at Record(): replay within the frame they
+// were recorded in, and mark as view_dependent any node which reads GL
+// state, or sets camera dependent uniforms, as it draws. Renderables must
+// not compile display lists of their own. The view frustum differs
+// between views, so nothing is culled whilst recording.
+//
+//   SceneDrawList draw_list;
+//   while(!pangolin::ShouldQuit()) {
+//       draw_list.Record(scene);
+//       for(size_t i=0; i < views.size(); ++i) {
+//           views[i]->Activate();
+//           draw_list.Replay(cams[i]);
+//       }
+//       pangolin::FinishFrame();
+//   }
+class SceneDrawList
+{
+public:
+    SceneDrawList()
+        : root(nullptr), lists_used(0)
+    {
+    }
+
+    ~SceneDrawList()
+    {
+#ifndef HAVE_GLES
+        for(GLuint l : lists) glDeleteLists(l, 1);
+#endif
+    }
+
+    SceneDrawList(const SceneDrawList&) = delete;
+    SceneDrawList& operator=(const SceneDrawList&) = delete;
+
+    // Traverse root, replacing anything recorded before
+    void Record(Renderable& root, const RenderParams& params = RenderParams())
+    {
+        this->root = &root;
+        this->params = params;
+        this->params.cull = false;
+        segments.clear();
+        lists_used = 0;
+
+#ifndef HAVE_GLES
+        GlStateCache::Suspend suspend;
+        Renderable::Traversal& t = Renderable::CurrentTraversal();
+        t.record_live = [this](Renderable& r) {
+            // Split the recording around r, which renders at replay
+            glEndList();
+            segments.back().live = &r;
+            BeginSegment();
+        };
+
+        BeginSegment();
+        root.Render(this->params);
+        glEndList();
+        t.record_live = nullptr;
+#endif
+    }
+
+    // Draw what was last recorded, seen through cam
+    void Replay(const OpenGlRenderState& cam)
+    {
+        if(!root) return;
+
+        GlStateCache::Suspend suspend;
+        cam.Apply();
+
+#ifndef HAVE_GLES
+        Renderable::Traversal& t = Renderable::CurrentTraversal();
+        for(const Segment& s : segments) {
+            glCallList(s.list);
+            if(s.live) {
+                // Not the root of a scene, whose updates were applied at Record()
+                ++t.depth;
+                s.live->Render(params);
+                if(s.live->manipulator) {
+                    s.live->manipulator->Render(params);
+                }
+                --t.depth;
+            }
+        }
+#else
+        // Without display lists, traverse once per view as before
+        root->Render(params);
+#endif
+    }
+
+    // Nodes rendered within each Replay(), in traversal order
+    size_t NumLive() const
+    {
+        size_t n = 0;
+        for(const Segment& s : segments) n += s.live ? 1 : 0;
+        return n;
+    }
+
+protected:
+    struct Segment
+    {
+        GLuint list;
+        // Rendered after list, if set
+        Renderable* live;
+    };
+
+#ifndef HAVE_GLES
+    void BeginSegment()
+    {
+        // List names are kept between frames and recompiled
+        if(lists_used == lists.size()) {
+            lists.push_back(glGenLists(1));
+        }
+        const GLuint l = lists[lists_used++];
+        segments.push_back({l, nullptr});
+        glNewList(l, GL_COMPILE);
+    }
+#endif
+
+    Renderable* root;
+    RenderParams params;
+    std::vector<Segment> segments;
+    std::vector<GLuint> lists;
+    size_t lists_used;
+};
+
+}
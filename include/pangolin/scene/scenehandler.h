@@ -3,44 +3,10 @@
 #include <pangolin/handler/handler.h>
 #include <pangolin/scene/renderable.h>
 #include <pangolin/scene/interactive_index.h>
+#include <pangolin/scene/pickbuffer.h>
 
 namespace pangolin {
 
-inline void gluPickMatrix(
-    GLdouble x, GLdouble y,
-    GLdouble width, GLdouble height,
-    GLint viewport[4]
-) {
-    GLfloat m[16];
-    GLfloat sx, sy;
-    GLfloat tx, ty;
-    sx = viewport[2] / (GLfloat)width;
-    sy = viewport[3] / (GLfloat)height;
-    tx = (viewport[2] + 2.0f * (viewport[0] - (GLfloat)x)) / (GLfloat)width;
-    ty = (viewport[3] + 2.0f * (viewport[1] - (GLfloat)y)) / (GLfloat)height;
-#define M(row, col) m[col*4+row]
-    M(0, 0) = sx;
-    M(0, 1) = 0.0f;
-    M(0, 2) = 0.0f;
-    M(0, 3) = tx;
-    M(1, 0) = 0.0f;
-    M(1, 1) = sy;
-    M(1, 2) = 0.0f;
-    M(1, 3) = ty;
-    M(2, 0) = 0.0f;
-    M(2, 1) = 0.0f;
-    M(2, 2) = 1.0f;
-    M(2, 3) = 0.0f;
-    M(3, 0) = 0.0f;
-    M(3, 1) = 0.0f;
-    M(3, 2) = 0.0f;
-    M(3, 3) = 1.0f;
-#undef M
-    glMultMatrixf(m);
-}
-
-
-
 struct SceneHandler : public Handler3D
 {
     SceneHandler(
@@ -75,6 +41,11 @@ struct SceneHandler : public Handler3D
                      int x, int y, int grab_width,
                      std::map<GLuint, Interactive*>& hit_objects )
     {
+        // Prefer the ID buffer, otherwise fall back to GL_SELECT
+        if(pick_buffer.ComputeHits(scene, view, cam_state, x, y, grab_width, hit_objects)) {
+            return;
+        }
+
         // Get views viewport / modelview /projection
         GLint viewport[4] = {view.v.l, view.v.b, view.v.w, view.v.h};
         pangolin::OpenGlMatrix mv = cam_state.GetModelViewMatrix();
@@ -175,6 +146,7 @@ struct SceneHandler : public Handler3D
     }
 
     std::map<GLuint, Interactive*> m_selected_objects;
+    PickBuffer pick_buffer;
     Renderable& scene;
     unsigned int grab_width;
 };
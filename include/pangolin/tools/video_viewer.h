@@ -2,7 +2,9 @@
 #include <pangolin/platform.h>
 #include <pangolin/video/video_input.h>
 
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -19,6 +21,9 @@ public:
                                const picojson::value& properties)> FrameChangedCallbackFn;
 
     static constexpr int FRAME_SKIP = 30;
+    // Decoded frames kept by inputs which support it, unless their uri asked for a cache itself
+    static constexpr size_t FRAME_CACHE_MB = 512;
+    static constexpr size_t FRAME_CACHE_AHEAD = 8;
 
     VideoViewer(const std::string& window_name, const std::string& input_uri, const std::string& output_uri = "video.pango" );
     VideoViewer(const VideoViewer&) = delete;
@@ -40,6 +45,12 @@ public:
     void OpenInput(const std::string& input_uri);
     void CloseInput();
 
+    // Replace the input with input_uri, keeping open the drivers it shares
+    // with the current one (see VideoInput::Reconfigure), e.g. to change the
+    // filters over a camera without reopening it. Streams beyond those shown
+    // when Run() started are not shown. Also made by setting ui.video_uri.
+    void ReconfigureInput(const std::string& input_uri);
+
     // Control recording
     void Record();
     void RecordOneFrame();
@@ -50,6 +61,11 @@ public:
     void ToggleRecord();
     void ToggleDiscardBufferedFrames();
     void ToggleWaitForFrames();
+    void ToggleShowStats();
+    // Pick up the newest frame as late as possible before each vsync,
+    // rather than straight after the last (see EnableFramePacing)
+    void ToggleLateLatch();
+    void SetLateLatch(bool new_state);
     void SetDiscardBufferedFrames(bool new_state);
     void SetWaitForFrames(bool new_state);
     void Skip(int frames);
@@ -59,7 +75,8 @@ public:
     void DrawEveryNFrames(int n);
 
 
-    // Register to be notified of new image data
+    // Register to be notified of new image data. The callback is made from
+    // the capture thread as soon as each frame is grabbed.
     void SetFrameChangedCallback(FrameChangedCallbackFn cb);
 
     void WaitUntilExit();
@@ -76,14 +93,37 @@ public:
 protected:
     void RegisterDefaultKeyShortcutsAndPangoVariables();
 
+    // Grab (and record) frames at the camera's rate, independent of drawing
+    void Capture();
+
+    // Report the streams of the input just opened and find its interfaces
+    void InputOpened();
+
     std::mutex control_mutex;
     std::string window_name;
     std::thread vv_thread;
+    std::thread capture_thread;
+    std::atomic<bool> capturing;
+
+    // Newest grabbed frame, waiting to be picked up by the render thread.
+    // Buffers are swapped in and out rather than copied.
+    std::mutex mailbox_mutex;
+    // Buffers grow with the input when reconfigured, and carry the formats
+    // of the streams they were grabbed with.
+    std::vector<unsigned char> mailbox_buffer;
+    std::vector<Image<unsigned char> > mailbox_images;
+    std::vector<PixelFormat> mailbox_formats;
+    uint64_t mailbox_seq;
 
     VideoInput video;
     VideoPlaybackInterface* video_playback;
+    VideoThumbnailInterface* video_thumbnails;
     VideoInterface* video_interface;
 
+    // Frame for the capture thread to seek to, or -1. Seeks are made (and
+    // the frame decoded) there, so that the UI can show thumbnails meanwhile.
+    std::atomic<int> seek_request;
+
     std::string output_uri;
 
     int current_frame;
@@ -93,6 +133,8 @@ protected:
     bool video_grab_wait;
     bool video_grab_newest;
     bool should_run;
+    bool show_stats;
+    bool late_latch;
     uint16_t active_cam;
 
     FrameChangedCallbackFn frame_changed_callback;
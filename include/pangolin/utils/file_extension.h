@@ -45,6 +45,7 @@ enum ImageFileType
     ImageFileTypePango,
     ImageFileTypePvn,
     ImageFileTypeZstd,
+    ImageFileTypeDepth,
     ImageFileTypeUnknown
 };
 
@@ -60,6 +60,11 @@ std::string FindPath(const std::string& child_path, const std::string& signature
 PANGOLIN_EXPORT
 std::string PathExpand(const std::string& sPath);
 
+// Create directory path and any missing parents. Returns true if path is
+// a directory afterwards.
+PANGOLIN_EXPORT
+bool MakeDirectories(const std::string& path);
+
 PANGOLIN_EXPORT
 bool MatchesWildcard(const std::string& str, const std::string& wildcard);
 
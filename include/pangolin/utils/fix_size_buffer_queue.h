@@ -33,6 +33,8 @@
 #include <mutex>
 #include <thread>
 
+#include <pangolin/utils/lockfree_ring.h>
+
 namespace pangolin
 {
 
@@ -41,7 +43,7 @@ class FixSizeBuffersQueue
 {
 
 public:
-    FixSizeBuffersQueue() {}
+    FixSizeBuffersQueue() : dropped(0), overwritten(0) {}
 
     ~FixSizeBuffersQueue() {
     }
@@ -57,6 +59,7 @@ public:
             while(validBuffers.size() > 1) {
                 emptyBuffers.push_back(std::move(validBuffers.front()));
                 validBuffers.pop_front();
+                ++dropped;
             }
             // Return newest buffer.
             BufPType bp = std::move(validBuffers.front());
@@ -91,10 +94,13 @@ public:
                 // Queue not yet initialized.
                 throw std::runtime_error("Queue not yet initialised.");
             } else {
-                std::cerr << "Out of free buffers." << std::endl;
+                if(!overwritten) {
+                    std::cerr << "Out of free buffers, overwriting the oldest (see OverwrittenFrames())." << std::endl;
+                }
                 // No free buffers return oldest among the valid buffers.
                 BufPType bp = std::move(validBuffers.front());
                 validBuffers.pop_front();
+                ++overwritten;
                 return bp;
             }
         }
@@ -133,10 +139,23 @@ public:
                 emptyBuffers.push_back(std::move(validBuffers.front()));
                 validBuffers.pop_front();
             }
+            dropped += n;
             return true;
         }
     }
 
+    // Valid buffers requeued unread by getNewest() and DropNFrames()
+    uint64_t DroppedFrames() const {
+        std::lock_guard<std::mutex> vlock(vMtx);
+        return dropped;
+    }
+
+    // Valid buffers handed out unread by getFreeBuffer() when none were free
+    uint64_t OverwrittenFrames() const {
+        std::lock_guard<std::mutex> vlock(vMtx);
+        return overwritten;
+    }
+
 //    unsigned int BufferSizeBytes(){
 //        return bufferSizeBytes;
 //    }
@@ -146,8 +165,120 @@ private:
     std::list<BufPType> emptyBuffers;
     mutable std::mutex vMtx;
     mutable std::mutex eMtx;
+    uint64_t dropped;
+    uint64_t overwritten;
 //    unsigned int maxNumBuffers;
 //    unsigned int bufferSizeBytes;
 };
 
+// Lock-free alternative to FixSizeBuffersQueue. All buffers are owned by one
+// of two pre-allocated rings (valid / empty) whenever they are not checked out,
+// so neither producer nor consumers take a lock on the fast path. Blocking
+// waits are woken by the publish that satisfies them rather than by polling.
+// BufPType must be default constructible and move assignable.
+template<typename BufPType>
+class FixSizeBuffersRing
+{
+
+public:
+    FixSizeBuffersRing(size_t max_buffers)
+        : validBuffers(max_buffers), emptyBuffers(max_buffers)
+    {
+    }
+
+    // Return newest valid buffer, requeuing all older ones as empty and
+    // counting them into dropped if given.
+    bool getNewest(BufPType& bp, size_t* dropped = nullptr) {
+        if(!validBuffers.TryPop(bp)) {
+            // Empty queue.
+            return false;
+        }
+        BufPType next;
+        while(validBuffers.TryPop(next)) {
+            returnOrAddUsedBuffer(std::move(bp));
+            bp = std::move(next);
+            if(dropped) ++*dropped;
+        }
+        return true;
+    }
+
+    // Return oldest valid buffer.
+    bool getNext(BufPType& bp) {
+        return validBuffers.TryPop(bp);
+    }
+
+    bool getFreeBuffer(BufPType& bp) {
+        return emptyBuffers.TryPop(bp);
+    }
+
+    // Block until a valid buffer is available, or timeout elapses.
+    template<typename Rep, typename Period>
+    bool waitForValidBuffer(const std::chrono::duration<Rep,Period>& timeout) {
+        return WaitFor(validEvent, validBuffers, timeout);
+    }
+
+    // Block until an empty buffer can be taken, or timeout elapses.
+    template<typename Rep, typename Period>
+    bool waitForFreeBuffer(BufPType& bp, const std::chrono::duration<Rep,Period>& timeout) {
+        const auto end = std::chrono::steady_clock::now() + timeout;
+        while(!getFreeBuffer(bp)) {
+            const auto now = std::chrono::steady_clock::now();
+            if(now >= end || !WaitFor(emptyEvent, emptyBuffers, end - now)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void addValidBuffer(BufPType&& bp) {
+        if(!validBuffers.TryPush(std::move(bp))) {
+            throw std::runtime_error("More buffers added than queue capacity.");
+        }
+        validEvent.Notify();
+    }
+
+    void returnOrAddUsedBuffer(BufPType&& bp) {
+        if(!emptyBuffers.TryPush(std::move(bp))) {
+            throw std::runtime_error("More buffers added than queue capacity.");
+        }
+        emptyEvent.Notify();
+    }
+
+    size_t AvailableFrames() const {
+        return validBuffers.Size();
+    }
+
+    size_t EmptyBuffers() const {
+        return emptyBuffers.Size();
+    }
+
+    bool DropNFrames(size_t n) {
+        if(validBuffers.Size() < n) {
+            return false;
+        }
+        BufPType bp;
+        for(size_t i=0; i<n && validBuffers.TryPop(bp); ++i) {
+            returnOrAddUsedBuffer(std::move(bp));
+        }
+        return true;
+    }
+
+private:
+    template<typename Rep, typename Period>
+    static bool WaitFor(RingEventCount& event, const MpmcRing<BufPType>& ring, const std::chrono::duration<Rep,Period>& timeout) {
+        if(ring.Size() > 0) return true;
+        const uint64_t key = event.PrepareWait();
+        if(ring.Size() > 0) {
+            event.CancelWait();
+            return true;
+        }
+        return event.Wait(key, timeout) || ring.Size() > 0;
+    }
+
+    MpmcRing<BufPType> validBuffers;
+    MpmcRing<BufPType> emptyBuffers;
+    RingEventCount validEvent;
+    RingEventCount emptyEvent;
+};
+
 }
@@ -0,0 +1,147 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace pangolin
+{
+
+// Counts of latencies (or any non-negative integers) in log-linear buckets,
+// eight per doubling, so that percentiles are within 12.5% of the true value
+// at a fixed size of a few KB. Not thread safe.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        std::fill(counts, counts + num_buckets, 0);
+        count = 0;
+        sum = 0.0;
+        min_value = std::numeric_limits<int64_t>::max();
+        max_value = 0;
+    }
+
+    // Negative values are counted as 0.
+    void Add(int64_t value)
+    {
+        value = std::max<int64_t>(value, 0);
+        ++counts[Bucket((uint64_t)value)];
+        ++count;
+        sum += (double)value;
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+    }
+
+    void Merge(const LatencyHistogram& o)
+    {
+        for(int i=0; i < num_buckets; ++i) counts[i] += o.counts[i];
+        count += o.count;
+        sum += o.sum;
+        min_value = std::min(min_value, o.min_value);
+        max_value = std::max(max_value, o.max_value);
+    }
+
+    uint64_t Count() const
+    {
+        return count;
+    }
+
+    double Mean() const
+    {
+        return count ? sum / (double)count : 0.0;
+    }
+
+    int64_t Min() const
+    {
+        return count ? min_value : 0;
+    }
+
+    int64_t Max() const
+    {
+        return max_value;
+    }
+
+    // Value below which fraction p of those added fall, rounded up to the
+    // top of its bucket (and no more than Max()).
+    int64_t Percentile(double p) const
+    {
+        if(!count) return 0;
+        const uint64_t rank = (uint64_t)std::max(1.0, std::min(1.0, p) * (double)count + 0.5);
+        uint64_t seen = 0;
+        for(int i=0; i < num_buckets; ++i) {
+            seen += counts[i];
+            if(seen >= rank) {
+                return std::min<int64_t>((int64_t)BucketTop(i), max_value);
+            }
+        }
+        return max_value;
+    }
+
+private:
+    static const int sub_bits = 3;
+    static const int sub_buckets = 1 << sub_bits;
+    static const int num_buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    static int Log2(uint64_t v)
+    {
+        int e = 0;
+        while(v >>= 1) ++e;
+        return e;
+    }
+
+    static int Bucket(uint64_t v)
+    {
+        if(v < (uint64_t)sub_buckets) return (int)v;
+        const int e = Log2(v);
+        return (e - sub_bits + 1) * sub_buckets + (int)((v >> (e - sub_bits)) & (sub_buckets - 1));
+    }
+
+    static uint64_t BucketTop(int b)
+    {
+        if(b < sub_buckets) return (uint64_t)b;
+        const int shift = b / sub_buckets - 1;
+        const uint64_t bottom = (uint64_t)(sub_buckets + b % sub_buckets) << shift;
+        return bottom + (((uint64_t)1 << shift) - 1);
+    }
+
+    uint64_t counts[num_buckets];
+    uint64_t count;
+    double sum;
+    int64_t min_value;
+    int64_t max_value;
+};
+
+}
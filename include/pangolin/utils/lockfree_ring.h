@@ -0,0 +1,258 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace pangolin
+{
+
+// Number of bytes used to keep independently written atomics on separate cache lines.
+const size_t ring_cache_line_bytes = 64;
+
+inline size_t RoundUpPowerOfTwo(size_t n)
+{
+    size_t p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+// Lightweight blocking primitive for use alongside lock-free containers.
+// Publishers only touch the mutex when a thread is actually waiting, and
+// waiters are woken by the exact publish rather than by polling.
+class RingEventCount
+{
+public:
+    RingEventCount()
+        : epoch(0), waiters(0)
+    {
+    }
+
+    // Register intent to wait. The container should be checked again after
+    // this call and CancelWait() called if the wait is no longer needed.
+    uint64_t PrepareWait()
+    {
+        waiters.fetch_add(1);
+        return epoch.load();
+    }
+
+    void CancelWait()
+    {
+        waiters.fetch_sub(1);
+    }
+
+    // Block until Notify() is called after PrepareWait() returned key.
+    // Returns false on timeout.
+    template<typename Rep, typename Period>
+    bool Wait(uint64_t key, const std::chrono::duration<Rep,Period>& timeout)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        const bool notified = cv.wait_for(l, timeout, [&](){ return epoch.load() != key; });
+        waiters.fetch_sub(1);
+        return notified;
+    }
+
+    void Notify()
+    {
+        epoch.fetch_add(1);
+        if(waiters.load() > 0) {
+            // Acquire mutex so that the epoch change can't be missed between
+            // a waiters predicate check and it going to sleep.
+            { std::lock_guard<std::mutex> l(mutex); }
+            cv.notify_all();
+        }
+    }
+
+private:
+    std::atomic<uint64_t> epoch;
+    std::atomic<int> waiters;
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// Bounded, pre-allocated single-producer / single-consumer ring.
+// Exactly one thread may call TryPush() and exactly one TryPop().
+// Elements are moved in and out of storage allocated at construction.
+template<typename T>
+class SpscRing
+{
+public:
+    SpscRing(size_t capacity)
+        : mask(RoundUpPowerOfTwo(capacity+1)-1), storage(mask+1), pad0(), head(0), pad1(), tail(0), pad2()
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+
+    size_t Capacity() const
+    {
+        return mask;
+    }
+
+    bool TryPush(T&& v)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t next = (t + 1) & mask;
+        if(next == head.load(std::memory_order_acquire)) {
+            // full
+            return false;
+        }
+        storage[t] = std::move(v);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& v)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) {
+            // empty
+            return false;
+        }
+        v = std::move(storage[h]);
+        head.store((h + 1) & mask, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate when called concurrently with push / pop.
+    size_t Size() const
+    {
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t t = tail.load(std::memory_order_acquire);
+        return (t - h) & mask;
+    }
+
+private:
+    const size_t mask;
+    std::vector<T> storage;
+    // Padding rather than alignas, which C++14 won't honour for heap allocations.
+    char pad0[ring_cache_line_bytes];
+    std::atomic<size_t> head;
+    char pad1[ring_cache_line_bytes - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[ring_cache_line_bytes - sizeof(std::atomic<size_t>)];
+};
+
+// Bounded, pre-allocated multi-producer / multi-consumer ring, using a
+// per-cell sequence number to hand elements between threads without locks.
+template<typename T>
+class MpmcRing
+{
+public:
+    MpmcRing(size_t capacity)
+        : mask(RoundUpPowerOfTwo(capacity)-1), cells(mask+1), pad0(), enqueue_pos(0), pad1(), dequeue_pos(0), pad2()
+    {
+        for(size_t i=0; i < cells.size(); ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRing(const MpmcRing&) = delete;
+
+    size_t Capacity() const
+    {
+        return mask + 1;
+    }
+
+    bool TryPush(T&& v)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = cells[pos & mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0) {
+                if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(v);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }else if(diff < 0) {
+                // full
+                return false;
+            }else{
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& v)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell& cell = cells[pos & mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0) {
+                if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    v = std::move(cell.data);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }else if(diff < 0) {
+                // empty
+                return false;
+            }else{
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate when called concurrently with push / pop.
+    size_t Size() const
+    {
+        const size_t d = dequeue_pos.load(std::memory_order_acquire);
+        const size_t e = enqueue_pos.load(std::memory_order_acquire);
+        return e > d ? e - d : 0;
+    }
+
+private:
+    struct Cell
+    {
+        Cell() : sequence(0) {}
+        Cell(Cell&& o) : sequence(o.sequence.load()), data(std::move(o.data)) {}
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    const size_t mask;
+    std::vector<Cell> cells;
+    // Padding rather than alignas, which C++14 won't honour for heap allocations.
+    char pad0[ring_cache_line_bytes];
+    std::atomic<size_t> enqueue_pos;
+    char pad1[ring_cache_line_bytes - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeue_pos;
+    char pad2[ring_cache_line_bytes - sizeof(std::atomic<size_t>)];
+};
+
+}
@@ -0,0 +1,81 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <string>
+
+namespace pangolin
+{
+
+// Read-only view of a whole file mapped into memory. The mapping is private
+// (copy-on-write) so callers may scribble on the pages without modifying the
+// file. Only available on POSIX platforms; Open() fails elsewhere.
+class PANGOLIN_EXPORT MemoryMappedFile
+{
+public:
+    MemoryMappedFile();
+
+    ~MemoryMappedFile();
+
+    MemoryMappedFile(const MemoryMappedFile&) = delete;
+    MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+    // Map filename. Returns false if it isn't a regular file or can't be mapped.
+    bool Open(const std::string& filename);
+
+    void Close();
+
+    bool IsOpen() const
+    {
+        return ptr != nullptr;
+    }
+
+    unsigned char* data() const
+    {
+        return ptr;
+    }
+
+    size_t size() const
+    {
+        return size_bytes;
+    }
+
+    // Hint that the mapping will mostly be read front to back.
+    void AdviseSequential() const;
+
+    // Hint that [offset, offset+len) will be read soon, so the OS can prefetch it.
+    void AdviseWillNeed(size_t offset, size_t len) const;
+
+private:
+    unsigned char* ptr;
+    size_t size_bytes;
+};
+
+}
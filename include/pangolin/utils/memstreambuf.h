@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <streambuf>
 #include <vector>
 
@@ -24,6 +25,12 @@ public:
         return buffer.data();
     }
 
+    // Empty the buffer, keeping its capacity for reuse
+    void clear()
+    {
+        buffer.clear();
+    }
+
 protected:
     std::streamsize xsputn(const char_type* __s, std::streamsize __n) override
     {
@@ -40,4 +47,75 @@ protected:
     std::vector<unsigned char> buffer;
 };
 
+// Write only streambuf over existing memory of fixed capacity, such as space
+// reserved in an output buffer. Writes beyond the capacity fail and mark the
+// buffer as overflowed, after which its contents are incomplete.
+struct memwritebuf : public std::streambuf
+{
+public:
+    memwritebuf(unsigned char* data, size_t capacity)
+        : overflowed_(false)
+    {
+        char* p = reinterpret_cast<char*>(data);
+        setp(p, p + capacity);
+    }
+
+    size_t size() const { return pptr() - pbase(); }
+    bool overflowed() const { return overflowed_; }
+
+protected:
+    std::streamsize xsputn(const char_type* s, std::streamsize n) override
+    {
+        if(n > epptr() - pptr()) {
+            overflowed_ = true;
+            return 0;
+        }
+        std::copy(s, s + n, pptr());
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+    int_type overflow(int_type /*c*/) override
+    {
+        overflowed_ = true;
+        return traits_type::eof();
+    }
+
+    bool overflowed_;
+};
+
+// Read only streambuf over existing memory, e.g. for decoding from a buffer
+struct memreadbuf : public std::streambuf
+{
+public:
+    memreadbuf(const unsigned char* data, size_t size)
+    {
+        char* p = const_cast<char*>(reinterpret_cast<const char*>(data));
+        setg(p, p, p + size);
+    }
+
+    // Unread bytes, for decoders which can consume memory in place
+    const unsigned char* unread() const { return reinterpret_cast<const unsigned char*>(gptr()); }
+    size_t unread_size() const { return egptr() - gptr(); }
+    void consume(size_t bytes) { setg(eback(), gptr() + std::min(bytes, unread_size()), egptr()); }
+
+protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode /*which*/) override
+    {
+        char* target = (dir == std::ios_base::beg) ? eback() + off :
+                       (dir == std::ios_base::cur) ? gptr() + off :
+                                                     egptr() + off;
+        if(target < eback() || target > egptr()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), target, egptr());
+        return pos_type(target - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
 }
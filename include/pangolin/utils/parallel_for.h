@@ -0,0 +1,116 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/utils/thread_affinity.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace pangolin
+{
+
+// Process wide, work stealing pool of worker threads shared by ParallelFor,
+// ParallelAsync and everything built on them (filters, codecs, image IO),
+// so that nested and concurrent users don't oversubscribe the machine.
+struct PANGOLIN_EXPORT ParallelPoolSettings
+{
+    ParallelPoolSettings()
+        : num_workers(-1)
+    {
+    }
+
+    // Worker threads, besides the threads waiting on work, or negative for
+    // one less than the number of cores.
+    int num_workers;
+
+    // Placement of the workers. With explicit cpus, each worker is pinned
+    // to one of them in turn.
+    ThreadPlacement placement;
+};
+
+// Configure the pool. Only possible before its first use, returning false
+// (and changing nothing) once the workers have started.
+PANGOLIN_EXPORT
+bool ConfigureParallelPool(const ParallelPoolSettings& settings);
+
+// Number of worker threads available to ParallelFor (including the caller).
+PANGOLIN_EXPORT
+size_t ParallelConcurrency();
+
+// Split [begin, end) into at most num_tasks contiguous ranges and call
+// f(range_begin, range_end) for each, using a process wide set of worker
+// threads. The calling thread takes part and the call returns once all
+// ranges are complete. num_tasks = 0 uses ParallelConcurrency().
+// Safe to call recursively from within f.
+PANGOLIN_EXPORT
+void ParallelFor(size_t begin, size_t end, size_t num_tasks, const std::function<void(size_t,size_t)>& f);
+
+// As ParallelFor over the tiles of a w x h image, calling f(x0, y0, x1, y1)
+// for each tile of up to tile_w x tile_h.
+PANGOLIN_EXPORT
+void ParallelForTiles(size_t w, size_t h, size_t tile_w, size_t tile_h, size_t num_tasks, const std::function<void(size_t,size_t,size_t,size_t)>& f);
+
+// Queue task to run on the pool. Tasks queued from a worker go to its own
+// queue, to be run by it most recently first, or stolen by idle workers.
+PANGOLIN_EXPORT
+void ParallelSubmit(std::function<void()>&& task);
+
+// Run one queued task on the calling thread, returning false if none were waiting.
+PANGOLIN_EXPORT
+bool ParallelRunOne();
+
+// Run f on the pool, returning its result (or exception) through a future.
+template<typename F>
+auto ParallelAsync(F&& f) -> std::future<decltype(f())>
+{
+    using R = decltype(f());
+    std::shared_ptr<std::packaged_task<R()>> task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> future = task->get_future();
+    ParallelSubmit([task](){ (*task)(); });
+    return future;
+}
+
+// Wait for future, running queued tasks meanwhile rather than blocking, so
+// that it is safe to wait from within pool tasks.
+template<typename T>
+T ParallelWait(std::future<T>& future)
+{
+    while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        if(!ParallelRunOne()) {
+            future.wait_for(std::chrono::milliseconds(1));
+        }
+    }
+    return future.get();
+}
+
+}
@@ -0,0 +1,77 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <string>
+
+namespace pangolin
+{
+
+// Dynamically loaded library (dlopen / LoadLibrary), unloaded on destruction.
+class PANGOLIN_EXPORT SharedLibrary
+{
+public:
+    SharedLibrary();
+    ~SharedLibrary();
+
+    SharedLibrary(SharedLibrary&& o);
+    SharedLibrary& operator=(SharedLibrary&& o);
+
+    // Load library at path, returning false on failure (see Error()).
+    bool Open(const std::string& path);
+
+    void Close();
+
+    bool IsOpen() const
+    {
+        return handle != nullptr;
+    }
+
+    // Address of symbol, or null if not found.
+    void* Symbol(const std::string& name) const;
+
+    // Description of the last failure to load
+    const std::string& Error() const
+    {
+        return error;
+    }
+
+    // File name of module name on this platform, e.g. name.so or name.dll
+    static std::string FileName(const std::string& name);
+
+private:
+    SharedLibrary(const SharedLibrary&) = delete;
+    SharedLibrary& operator=(const SharedLibrary&) = delete;
+
+    void* handle;
+    std::string error;
+};
+
+}
@@ -0,0 +1,93 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+// Where and how a worker thread (and the memory it owns) should be placed.
+// Default constructed placement leaves everything to the OS.
+struct PANGOLIN_EXPORT ThreadPlacement
+{
+    ThreadPlacement()
+        : numa_node(-1), rt_priority(0), lock_memory(false)
+    {
+    }
+
+    bool IsDefault() const
+    {
+        return cpus.empty() && numa_node < 0 && rt_priority <= 0 && !lock_memory;
+    }
+
+    // Explicit CPUs to pin to. If empty and numa_node >= 0, the CPUs of that node are used.
+    std::vector<int> cpus;
+
+    // NUMA node on which to pin and to allocate memory (-1 for any)
+    int numa_node;
+
+    // SCHED_FIFO priority (1-99), 0 to keep the default scheduler
+    int rt_priority;
+
+    // Lock memory owned by the thread into RAM
+    bool lock_memory;
+};
+
+// Parse a Linux style cpu list, e.g. "0-3,8,10-11"
+PANGOLIN_EXPORT
+std::vector<int> ParseCpuList(const std::string& list);
+
+// Return the CPUs belonging to NUMA node, or empty if unknown.
+PANGOLIN_EXPORT
+std::vector<int> NumaNodeCpus(int node);
+
+// Pin the calling thread to cpus. Returns false if unsupported or not permitted.
+PANGOLIN_EXPORT
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus);
+
+// Switch the calling thread to SCHED_FIFO at priority. Returns false if unsupported or not permitted.
+PANGOLIN_EXPORT
+bool SetCurrentThreadRealtimePriority(int priority);
+
+// Apply cpu / numa_node / rt_priority of placement to the calling thread,
+// warning about anything which couldn't be applied.
+PANGOLIN_EXPORT
+void ApplyThreadPlacement(const ThreadPlacement& placement);
+
+// Lock / unlock [ptr, ptr+size_bytes) into physical memory.
+PANGOLIN_EXPORT
+bool LockMemory(const void* ptr, size_t size_bytes);
+
+PANGOLIN_EXPORT
+bool UnlockMemory(const void* ptr, size_t size_bytes);
+
+}
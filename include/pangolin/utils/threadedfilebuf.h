@@ -32,9 +32,12 @@
 #include <fstream>
 
 #include <pangolin/platform.h>
+#include <atomic>
+#include <cstdint>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 namespace pangolin
 {
@@ -42,19 +45,87 @@ namespace pangolin
 class PANGOLIN_EXPORT threadedfilebuf : public std::streambuf
 {
 public:
+    //! Buffer occupancy and throughput, see stats()
+    struct Stats
+    {
+        size_t buffer_bytes;        // ring buffer capacity
+        size_t queued_bytes;        // accepted but not yet written to the file
+        size_t high_water_bytes;    // most ever queued since open
+        uint64_t written_bytes;     // written to the file since open
+        double write_mb_per_s;      // mean write rate since open
+        double blocked_s;           // total time writers waited for buffer space
+        uint64_t blocked_writes;    // number of writes which had to wait
+    };
+
     ~threadedfilebuf();
     threadedfilebuf();
-    threadedfilebuf(const std::string& filename, size_t buffer_size_bytes);
-    
-    void open(const std::string& filename, size_t buffer_size_bytes);
+    threadedfilebuf(const std::string& filename, size_t buffer_size_bytes, size_t direct_depth = 0, bool lock_free = false);
+
+    //! With direct_depth > 0, bypass the page cache using block aligned O_DIRECT
+    //! writes with up to direct_depth blocks in flight. Linux only, and falls
+    //! back to buffered writes where the filesystem doesn't support it.
+    //!
+    //! With lock_free, buffered writes reserve and commit ring space with atomic
+    //! cursors instead of taking a mutex, and the write thread is only woken once
+    //! enough data is pending. Callers must not write from more than one thread
+    //! at a time (as PacketStreamWriter ensures). Ignored for O_DIRECT writes.
+    //!
+    //! On Linux the ring is backed by huge pages where available, reserved or
+    //! transparent, and faulted in up front rather than by the first writes.
+    void open(const std::string& filename, size_t buffer_size_bytes, size_t direct_depth = 0, bool lock_free = false);
     void close();
     void force_close();
     
     void operator()();
-    
+
+    bool is_direct() const;
+
+    //! Rather than leave the kernel to write back dirty pages in bursts, start
+    //! writing back every interval_bytes as they are written, then wait for the
+    //! previous interval and drop it from the page cache. Keeps the dirty data
+    //! (and so the stalls of writing it back) bounded for sustained recording.
+    //! 0 (default) leaves writeback to the kernel. Linux only, and not needed
+    //! for O_DIRECT writes. May be called at any time, and holds across open().
+    void set_writeback(size_t interval_bytes);
+
+    //! Snapshot of the buffer's state, which may be taken from any thread
+    //! without waiting on blocked writers.
+    Stats stats() const;
+
+    //! Reserve n contiguous bytes at the end of the ring to be filled in place,
+    //! waiting for the write thread to make space as xsputn would. Returns
+    //! nullptr where that isn't possible without copying: for O_DIRECT writes,
+    //! requests larger than the ring, or when the free space wraps around its
+    //! end. Nothing else may be written until the matching commit().
+    char* reserve(std::streamsize n);
+
+    //! Queue the first n bytes of the last reserve() for writing, n <= the
+    //! size reserved. commit(0) gives the reservation up.
+    void commit(std::streamsize n);
+
 protected:
     void soft_close();
 
+    void note_queued(std::streamsize queued);
+    void note_blocked(int64_t start_us);
+
+    void allocate_buffer(std::streamsize size);
+    void free_buffer();
+
+    //! Called by the write thread after handing bytes_written to file
+    void writeback(std::streamsize bytes_written);
+
+    //! Mutex free equivalents of xsputn and operator() for lock_free mode
+    std::streamsize lock_free_put(const char* s, std::streamsize n);
+    void lock_free_wait_for_space(int64_t head, std::streamsize bytes);
+    void lock_free_write_loop();
+
+    //! Write whole blocks from the ring buffer, one of direct_depth threads
+    void direct_write_loop();
+
+    //! Write the final partial block and close the file
+    void direct_finish();
+
     //! Override streambuf::xsputn for asynchronous write
     std::streamsize xsputn(const char * s, std::streamsize n) override;
 
@@ -68,6 +139,7 @@ protected:
     
     std::filebuf file;
     char* mem_buffer;
+    size_t mem_mapped;      // length of the mapping holding mem_buffer, if mapped
     std::streamsize mem_size;
     std::streamsize mem_max_size;
     std::streamsize mem_start;
@@ -75,13 +147,49 @@ protected:
 
     std::streampos input_pos;
     
-    std::mutex update_mutex;
+    mutable std::mutex update_mutex;
     std::condition_variable cond_queued;
     std::condition_variable cond_dequeued;
     std::thread write_thread;
 
     bool should_run;
     bool is_pipe;
+
+    // O_DIRECT writer state, mem_start is always block aligned in this mode
+    int direct_fd;
+    std::streamsize direct_block;
+    std::streamsize direct_claim;       // ring position of the next block to write
+    std::streamsize direct_claimed;     // bytes from mem_start written or being written
+    std::streamoff direct_file_pos;     // file offset of the block at direct_claim
+    std::vector<char> direct_done;      // per ring block, written but not yet released
+    std::vector<std::thread> direct_threads;
+    std::string direct_error;
+
+    // Lock free ring state: cursors count bytes ever committed / written,
+    // and index the ring modulo mem_max_size
+    bool lock_free;
+    std::atomic<int64_t> lf_head;
+    std::atomic<int64_t> lf_tail;
+    std::atomic<bool> lf_writer_sleeping;
+    std::atomic<bool> lf_producer_waiting;
+    std::atomic<bool> lf_discard;
+    std::streamsize lf_wake_bytes;
+
+    // Writeback smoothing state, only touched by the write thread. wb_fd is a
+    // second descriptor of the file, as std::filebuf doesn't expose its own.
+    std::atomic<size_t> wb_interval;
+    int wb_fd;
+    int64_t wb_written;     // file offset written up to
+    int64_t wb_started;     // file offset writeback has been started up to
+    int64_t wb_dropped;     // file offset dropped from the page cache up to
+
+    // Statistics, readable from any thread
+    std::atomic<int64_t> stat_open_us;
+    std::atomic<int64_t> stat_buffer_bytes;
+    std::atomic<int64_t> stat_high_water;
+    std::atomic<uint64_t> stat_written;
+    std::atomic<int64_t> stat_blocked_us;
+    std::atomic<uint64_t> stat_blocked_writes;
 };
 
 }
@@ -0,0 +1,121 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace pangolin
+{
+
+// Lightweight timeline tracing. Scopes record their start and duration into
+// a ring buffer owned by the calling thread, keeping the most recent events
+// of each thread, and are exported as Chrome trace-event JSON (loadable in
+// chrome://tracing and ui.perfetto.dev). Tracing is off until TraceEnable()
+// or PANGOLIN_TRACE=<filename> is set in the environment, in which case the
+// trace is written out at exit. Disabled scopes cost one relaxed load.
+
+// Start (true) or stop recording events. Switching on sizes each thread's
+// ring (of 64K events, default) for threads which record from then on.
+PANGOLIN_EXPORT
+void TraceEnable(bool enable, size_t events_per_thread = 1 << 16);
+
+// Discard all recorded events
+PANGOLIN_EXPORT
+void TraceClear();
+
+// Name the calling thread in exported traces
+PANGOLIN_EXPORT
+void TraceSetThreadName(const std::string& name);
+
+// Record a complete event. name and category must outlive the trace, as
+// string literals do. Times are nanoseconds from TraceNow_ns().
+PANGOLIN_EXPORT
+void TraceEvent(const char* name, const char* category, int64_t start_ns, int64_t duration_ns);
+
+// Record a counter, such as a queue depth, as a track of its own
+PANGOLIN_EXPORT
+void TraceCounter(const char* name, int64_t value);
+
+// Recorded events of all threads as Chrome trace-event JSON
+PANGOLIN_EXPORT
+std::string TraceChromeJson();
+
+// Write TraceChromeJson() to filename, returning false on failure
+PANGOLIN_EXPORT
+bool TraceWriteChrome(const std::string& filename);
+
+// Nanoseconds since the epoch, from pangolin::TimeNow()
+PANGOLIN_EXPORT
+int64_t TraceNow_ns();
+
+namespace detail {
+PANGOLIN_EXPORT extern std::atomic<bool> trace_enabled;
+}
+
+inline bool TraceEnabled()
+{
+    return detail::trace_enabled.load(std::memory_order_relaxed);
+}
+
+// Records the lifetime of the scope as an event, if tracing is enabled when
+// it is entered.
+class TraceScope
+{
+public:
+    TraceScope(const char* name, const char* category = "pangolin")
+        : name(name), category(category), start_ns(TraceEnabled() ? TraceNow_ns() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if(start_ns) {
+            TraceEvent(name, category, start_ns, TraceNow_ns() - start_ns);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    int64_t start_ns;
+};
+
+}
+
+#define PANGO_TRACE_CONCAT_(a, b) a##b
+#define PANGO_TRACE_CONCAT(a, b) PANGO_TRACE_CONCAT_(a, b)
+
+// Trace the enclosing scope, e.g. PANGO_TRACE_SCOPE("PangoVideo::GrabNext")
+#define PANGO_TRACE_SCOPE(...) pangolin::TraceScope PANGO_TRACE_CONCAT(pango_trace_scope_, __LINE__)(__VA_ARGS__)
@@ -33,6 +33,7 @@
 #include <cmath>
 
 #include <pangolin/var/varvalue.h>
+#include <pangolin/var/varvalueatomic.h>
 #include <pangolin/var/varwrapper.h>
 #include <pangolin/var/varstate.h>
 
@@ -58,9 +59,9 @@ inline void InitialiseNewVarMetaGeneric(
 }
 
 template<typename T>
-inline void InitialiseNewVarMeta(
-    VarValue<T>& v, const std::string& name,
-    double min = 0, double max = 0, int flags = 1, bool logscale = false
+inline void InitialiseNewVarMetaT(
+    VarValueGeneric& v, const std::string& name,
+    double min, double max, int flags, bool logscale
 ) {
     // Initialise meta parameters
     const std::vector<std::string> parts = pangolin::Split(name,'.');
@@ -80,6 +81,22 @@ inline void InitialiseNewVarMeta(
     VarState::I().NotifyNewVar<T>(name, v);
 }
 
+template<typename T>
+inline void InitialiseNewVarMeta(
+    VarValue<T>& v, const std::string& name,
+    double min = 0, double max = 0, int flags = 1, bool logscale = false
+) {
+    InitialiseNewVarMetaT<T>(v, name, min, max, flags, logscale);
+}
+
+template<typename T>
+inline void InitialiseNewVarMeta(
+    VarValueAtomic<T>& v, const std::string& name,
+    double min = 0, double max = 0, int flags = 1, bool logscale = false
+) {
+    InitialiseNewVarMetaT<T>(v, name, min, max, flags, logscale);
+}
+
 template<typename T>
 class Var
 {
@@ -89,6 +106,7 @@ public:
         double min, double max, bool logscale = false
     ) {
         // Find name in VarStore
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
         VarValueGeneric*& v = VarState::I()[name];
         //std::shared_ptr<VarValueGeneric>& v = VarState::I()[name];
         if(v) {
@@ -106,6 +124,7 @@ public:
         const std::string& name, T& variable, bool toggle = false
         ) {
         // Find name in VarStore
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
         VarValueGeneric*& v = VarState::I()[name];
         //std::shared_ptr<VarValueGeneric>& v = VarState::I()[name];
         if (v) {
@@ -120,6 +139,34 @@ public:
         return variable;
     }
 
+    //! Create var name as a VarValueAtomic, so that worker threads can Set
+    //! it (or Store() to the returned value directly) whilst the GUI reads
+    //! it. Var<T>(name) objects constructed later refer to the same value.
+    static VarValueAtomic<T>& Atomic(
+        const std::string& name, const T& value,
+        double min = 0, double max = 0
+    ) {
+        // Find name in VarStore
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        VarValueGeneric*& v = VarState::I()[name];
+        if(v && !v->Meta().generic) {
+            throw std::runtime_error("Var with that name already exists.");
+        }
+
+        // new VarValueAtomic<T> (owned by VarStore)
+        VarValueAtomic<T>* nv;
+        if(v) {
+            // Specialise generic variable
+            nv = new VarValueAtomic<T>( Convert<T,std::string>::Do( v->str->Get() ) );
+            delete v;
+        }else{
+            nv = new VarValueAtomic<T>(value);
+        }
+        v = nv;
+        InitialiseNewVarMeta(*nv, name, min, max);
+        return *nv;
+    }
+
     ~Var()
     {
         delete ptr;
@@ -136,48 +183,30 @@ public:
         : ptr(0)
     {
         // Find name in VarStore
-        VarValueGeneric*& v = VarState::I()[name];
-        //std::shared_ptr<VarValueGeneric>& v = VarState::I()[name];
-        if(v && !v->Meta().generic) {
-            InitialiseFromGeneric(v);
-        }else{
-            // new VarValue<T> (owned by VarStore)
-            VarValue<T>* nv;
-            if(v) {
-                // Specialise generic variable
-                nv = new VarValue<T>( Convert<T,std::string>::Do( v->str->Get() ) );
-                delete v;
-            }else{
-                nv = new VarValue<T>( T() );
-            }
-            v = nv;
-            var = nv;
-            InitialiseNewVarMeta(*nv, name);
-        }
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        InitialiseNamed(VarState::I()[name], name, T(), 0, 0, 1);
     }
 
     Var( const std::string& name, const T& value, bool toggle = false )
         : ptr(0)
     {
         // Find name in VarStore
-        VarValueGeneric*& v = VarState::I()[name];
-        //std::shared_ptr<VarValueGeneric>& v = VarState::I()[name];
-        if(v && !v->Meta().generic) {
-            InitialiseFromGeneric(v);
-        }else{
-            // new VarValue<T> (owned by VarStore)
-            VarValue<T>* nv;
-            if(v) {
-                // Specialise generic variable
-                nv = new VarValue<T>( Convert<T,std::string>::Do( v->str->Get() ) );
-                delete v;
-            }else{
-                nv = new VarValue<T>(value);
-            }
-            v = nv;
-            var = nv;
-            InitialiseNewVarMeta(*nv, name, 0, 1, toggle);
-        }
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        InitialiseNamed(VarState::I()[name], name, value, 0, 1, toggle);
+    }
+
+    Var( const VarHandle& handle )
+        : ptr(0)
+    {
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        InitialiseNamed(handle.Slot(), handle.Name(), T(), 0, 0, 1);
+    }
+
+    Var( const VarHandle& handle, const T& value, bool toggle = false )
+        : ptr(0)
+    {
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        InitialiseNamed(handle.Slot(), handle.Name(), value, 0, 1, toggle);
     }
 
     Var(
@@ -186,6 +215,7 @@ public:
     ) : ptr(0)
     {
         // Find name in VarStore
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
         VarValueGeneric*& v = VarState::I()[name];
         //std::shared_ptr<VarValueGeneric>& v = VarState::I()[name];
         if(v && !v->Meta().generic) {
@@ -275,6 +305,28 @@ public:
     }
 
 protected:
+    // Initialise from the VarState slot v for name, creating or
+    // specialising the variable it holds if need be. Hold VarState's mutex.
+    void InitialiseNamed(VarValueGeneric*& v, const std::string& name, const T& value, double min, double max, int flags)
+    {
+        if(v && !v->Meta().generic) {
+            InitialiseFromGeneric(v);
+        }else{
+            // new VarValue<T> (owned by VarStore)
+            VarValue<T>* nv;
+            if(v) {
+                // Specialise generic variable
+                nv = new VarValue<T>( Convert<T,std::string>::Do( v->str->Get() ) );
+                delete v;
+            }else{
+                nv = new VarValue<T>(value);
+            }
+            v = nv;
+            var = nv;
+            InitialiseNewVarMeta(*nv, name, min, max, flags);
+        }
+    }
+
     // Initialise from existing variable, obtain data / accessor
     void InitialiseFromGeneric(VarValueGeneric* v)
     //void InitialiseFromGeneric(std::shared_ptr<VarValueGeneric> v)
@@ -0,0 +1,118 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/log/packetstream_reader.h>
+#include <pangolin/log/packetstream_writer.h>
+#include <pangolin/var/var.h>
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+// PacketStreamSource driver of var change packets
+PANGOLIN_EXPORT extern const std::string pango_var_changes_type;
+
+//! Records changes to vars as a source of the PacketStreamWriter it is given,
+//! typically that of a PangoVideoOutput, so that they are logged alongside
+//! video. Changes are batched into compact binary packets, each of which
+//! names the vars it holds so that playback can start from any packet.
+//! GUI changes to vars beginning with prefix are recorded automatically;
+//! Record() others, such as those set by the program.
+class PANGOLIN_EXPORT VarChangeRecorder
+{
+public:
+    VarChangeRecorder(PacketStreamWriter& writer, const std::string& prefix = "",
+                      int64_t batch_us = 100000, size_t batch_bytes = 64*1024);
+    ~VarChangeRecorder();
+
+    //! Record var name taking value at time_us, as for frames written at the
+    //! same time (PANGO_HOST_RECEPTION_TIME_US).
+    void Record(const std::string& name, const std::string& value, int64_t time_us);
+
+    //! Record the current value of var name, now.
+    void Record(const std::string& name);
+
+    //! Write any batched changes. Batches are otherwise written once they
+    //! span batch_us or hold batch_bytes, and on destruction.
+    void Flush();
+
+protected:
+    static void GuiVarChanged(void* data, const std::string& name, VarValueGeneric& var);
+    void FlushLocked();
+
+    PacketStreamWriter& writer;
+    const std::string prefix;
+    const int64_t batch_us;
+    const size_t batch_bytes;
+    PacketStreamSourceId src_id;
+
+    std::mutex lock;
+    std::vector<std::string> batch_names;
+    std::vector<char> batch_changes;
+    size_t batch_count;
+    int64_t batch_start_us;
+};
+
+//! Replays var changes recorded by VarChangeRecorder in a log.
+class PANGOLIN_EXPORT VarChangePlayer
+{
+public:
+    VarChangePlayer(const std::string& filename);
+
+    //! False if the log holds no var changes (or isn't seekable)
+    bool IsValid() const;
+
+    //! Set vars to the values they held at time_us, for example the capture
+    //! time of the frame being shown. Playing backwards replays from the
+    //! start of the log.
+    void PlayUntil(int64_t time_us);
+
+protected:
+    struct Change
+    {
+        int64_t time_us;
+        std::string name;
+        std::string value;
+    };
+
+    void ReadPacket();
+
+    PacketStreamReader reader;
+    int src_id;
+    int64_t time_us;
+
+    // Changes read from the log but not yet due
+    std::deque<Change> pending;
+};
+
+}
@@ -52,6 +52,10 @@ void RegisterNewVarCallback(NewVarCallbackFn callback, void* data, const std::st
 PANGOLIN_EXPORT
 void RegisterGuiVarChangedCallback(GuiVarChangedCallbackFn callback, void* data, const std::string& filter = "");
 
+// Stop calling callbacks registered with data, e.g. before data is destroyed
+PANGOLIN_EXPORT
+void UnregisterGuiVarChangedCallbacks(void* data);
+
 template<typename T>
 struct SetVarFunctor
 {
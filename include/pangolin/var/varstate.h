@@ -27,8 +27,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <pangolin/platform.h>
 #include <pangolin/var/varvalue.h>
@@ -58,6 +62,58 @@ struct PANGOLIN_EXPORT GuiVarChangedCallback
     void* data;
 };
 
+// Prefix trie of callback filters, matching a name against all of them in
+// a single pass over its characters.
+class VarFilterTrie
+{
+public:
+    VarFilterTrie()
+        : nodes(1)
+    {
+    }
+
+    void Insert(const std::string& filter, size_t index)
+    {
+        size_t n = 0;
+        for(char c : filter) {
+            auto child = nodes[n].children.find(c);
+            if(child == nodes[n].children.end()) {
+                nodes[n].children[c] = nodes.size();
+                n = nodes.size();
+                nodes.emplace_back();
+            }else{
+                n = child->second;
+            }
+        }
+        nodes[n].indices.push_back(index);
+    }
+
+    // Indices inserted with a filter that name starts with, in insertion order
+    void Match(const std::string& name, std::vector<size_t>& indices) const
+    {
+        indices.clear();
+        size_t n = 0;
+        for(size_t i = 0; ; ++i) {
+            indices.insert(indices.end(), nodes[n].indices.begin(), nodes[n].indices.end());
+            if(i == name.size()) break;
+            auto child = nodes[n].children.find(name[i]);
+            if(child == nodes[n].children.end()) break;
+            n = child->second;
+        }
+        std::sort(indices.begin(), indices.end());
+    }
+
+private:
+    struct Node
+    {
+        std::vector<size_t> indices;
+        std::map<char, size_t> children;
+    };
+    std::vector<Node> nodes;
+};
+
+// Registry of all vars by name. Its members are guarded by mutex, which is
+// held whilst callbacks are invoked.
 class PANGOLIN_EXPORT VarState
 {
 public:
@@ -69,47 +125,137 @@ public:
     void Clear();
 
     template<typename T>
-    void NotifyNewVar(const std::string& name, VarValue<T>& var )
+    void NotifyNewVar(const std::string& name, VarValueGeneric& var )
     {
+        std::lock_guard<std::recursive_mutex> l(mutex);
         var_adds.push_back(name);
+        ++change_count;
+
+        if(batch_depth) {
+            deferred_new_vars.push_back(name);
+            return;
+        }
 
         // notify those watching new variables
-        for(std::vector<NewVarCallback>::iterator invc = new_var_callbacks.begin(); invc != new_var_callbacks.end(); ++invc) {
-            if( StartsWith(name,invc->filter) ) {
-               invc->fn( invc->data, name, var, true);
+        std::vector<size_t> matches;
+        new_var_filters.Match(name, matches);
+        for(size_t i : matches) {
+            const NewVarCallback& nvc = new_var_callbacks[i];
+            nvc.fn( nvc.data, name, var, true);
+        }
+    }
+
+    // Whilst a Batch exists, mutex is held and new var callbacks are deferred
+    // until it (the outermost, if nested) is destroyed, e.g. for loading
+    // many vars at once.
+    struct Batch
+    {
+        Batch() { VarState::I().BeginBatch(); }
+        ~Batch() { VarState::I().EndBatch(); }
+    };
+
+    void BeginBatch()
+    {
+        mutex.lock();
+        ++batch_depth;
+    }
+
+    void EndBatch()
+    {
+        if(--batch_depth == 0 && !deferred_new_vars.empty()) {
+            std::vector<std::string> names;
+            names.swap(deferred_new_vars);
+            std::vector<size_t> matches;
+            for(const std::string& name : names) {
+                VarStoreContainer::iterator v = vars.find(name);
+                if(v == vars.end() || !v->second) continue;
+                new_var_filters.Match(name, matches);
+                for(size_t i : matches) {
+                    const NewVarCallback& nvc = new_var_callbacks[i];
+                    nvc.fn( nvc.data, name, *v->second, true);
+                }
             }
         }
+        mutex.unlock();
+    }
+
+    void AddNewVarCallback(const NewVarCallback& nvc)
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex);
+        new_var_filters.Insert(nvc.filter, new_var_callbacks.size());
+        new_var_callbacks.push_back(nvc);
     }
 
+    void AddGuiVarChangedCallback(const GuiVarChangedCallback& gvc)
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex);
+        gui_var_changed_filters.Insert(gvc.filter, gui_var_changed_callbacks.size());
+        gui_var_changed_callbacks.push_back(gvc);
+    }
+
+    // Removed entries are left empty, keeping the indices of the rest
+    void RemoveGuiVarChangedCallbacks(void* data)
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex);
+        for(GuiVarChangedCallback& gvc : gui_var_changed_callbacks) {
+            if(gvc.data == data) gvc.fn = nullptr;
+        }
+    }
+
+    void NotifyGuiVarChanged(const std::string& name, VarValueGeneric& var)
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex);
+        std::vector<size_t> matches;
+        gui_var_changed_filters.Match(name, matches);
+        for(size_t i : matches) {
+            const GuiVarChangedCallback& gvc = gui_var_changed_callbacks[i];
+            if(gvc.fn) gvc.fn( gvc.data, name, var );
+        }
+    }
+
+    // Slot for the var called str, created empty if need be. Slots stay
+    // valid until Clear(), but hold mutex whilst reading or assigning one.
     VarValueGeneric*& operator[](const std::string& str)
     //std::shared_ptr<VarValueGeneric>& operator[](const std::string& str)
     {
-        VarStoreContainer::iterator it = vars.find(str);
-        if (it == vars.end()) {
-            vars[str] = nullptr;
-        }
-        return vars[str];
+        std::lock_guard<std::recursive_mutex> l(mutex);
+        return vars.emplace(str, nullptr).first->second;
     }
 
     bool Exists(const std::string& str) const
     {
+        std::lock_guard<std::recursive_mutex> l(mutex);
         return vars.find(str) != vars.end();
     }
 
+    // Incremented by Clear(), invalidating any slots held
+    uint64_t Generation() const
+    {
+        return generation;
+    }
+
     void FlagVarChanged()
     {
-        varHasChanged = true;
+        ++gui_change_count;
+        ++change_count;
+    }
+
+    // Incremented whenever a var is added, flagged as changed or set through
+    // a VarValueAtomic. Unlike VarHasChanged() it isn't reset by reading it.
+    uint64_t ChangeCount() const
+    {
+        return change_count;
     }
 
+    // True if FlagVarChanged() was called since the last call
     bool VarHasChanged()
     {
-        const bool has_changed = varHasChanged;
-        varHasChanged = false;
-        return has_changed;
+        const uint64_t count = gui_change_count;
+        return gui_change_seen.exchange(count) != count;
     }
 
 //protected:
-    typedef std::map<std::string, VarValueGeneric*> VarStoreContainer;
+    typedef std::unordered_map<std::string, VarValueGeneric*> VarStoreContainer;
     //typedef std::map<std::string, std::shared_ptr<VarValueGeneric>> VarStoreContainer;
     typedef std::vector<std::string> VarStoreAdditions;
 
@@ -118,8 +264,55 @@ public:
 
     std::vector<NewVarCallback> new_var_callbacks;
     std::vector<GuiVarChangedCallback> gui_var_changed_callbacks;
+    VarFilterTrie new_var_filters;
+    VarFilterTrie gui_var_changed_filters;
+
+    // FlagVarChanged() calls, and the count VarHasChanged() last saw
+    std::atomic<uint64_t> gui_change_count;
+    std::atomic<uint64_t> gui_change_seen;
+    std::atomic<uint64_t> change_count;
+    std::atomic<uint64_t> generation;
+
+    int batch_depth;
+    std::vector<std::string> deferred_new_vars;
+
+    mutable std::recursive_mutex mutex;
+};
+
+// Var name resolved once, so that Var<T> objects can be constructed from it
+// repeatedly (e.g. each iteration of a loop) without looking it up again:
+//   static const VarHandle h("ui.gain");
+//   Var<double> gain(h, 1.0);
+class VarHandle
+{
+public:
+    explicit VarHandle(const std::string& name)
+        : name(name), slot(nullptr), generation(0)
+    {
+    }
+
+    const std::string& Name() const
+    {
+        return name;
+    }
+
+    // Slot in VarState, looked up again only if it has been cleared since.
+    // Hold VarState::I().mutex whilst using it.
+    VarValueGeneric*& Slot() const
+    {
+        VarState& state = VarState::I();
+        const uint64_t g = state.Generation();
+        if(!slot || generation != g) {
+            slot = &state[name];
+            generation = g;
+        }
+        return *slot;
+    }
 
-    bool varHasChanged;
+private:
+    std::string name;
+    mutable VarValueGeneric** slot;
+    mutable uint64_t generation;
 };
 
 inline bool GuiVarHasChanged() {
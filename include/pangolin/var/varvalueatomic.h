@@ -0,0 +1,162 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include <pangolin/var/varvaluet.h>
+#include <pangolin/var/varwrapper.h>
+#include <pangolin/var/varstate.h>
+
+namespace pangolin
+{
+
+//! VarValue for trivially copyable T which can be Set from worker threads
+//! whilst the GUI reads it, without locks or torn values. The value is held
+//! behind a sequence lock: readers copy it out and retry if a write
+//! overlapped, and writers exclude one another by taking the sequence odd.
+template<typename T>
+class VarValueAtomic : public VarValueT<T>
+{
+public:
+    typedef T VarT;
+
+    static_assert(std::is_trivially_copyable<T>::value, "VarValueAtomic requires a trivially copyable type");
+
+    ~VarValueAtomic()
+    {
+        delete str_ptr;
+    }
+
+    VarValueAtomic(const T& value = T())
+        : default_value(value), seq(0)
+    {
+        Write(value);
+        str_ptr = new VarWrapper<std::string,VarT>(*this);
+        this->str = str_ptr;
+    }
+
+    const char* TypeId() const override
+    {
+        return typeid(VarT).name();
+    }
+
+    void Reset() override
+    {
+        Store(default_value);
+    }
+
+    VarMeta& Meta() override
+    {
+        return meta;
+    }
+
+    //! Copy of the value, never torn by a concurrent Store()
+    T Load() const
+    {
+        uint64_t buf[num_words];
+        for(;;) {
+            const uint64_t s0 = seq.load(std::memory_order_acquire);
+            if(s0 & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for(size_t i = 0; i < num_words; ++i) {
+                buf[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(seq.load(std::memory_order_relaxed) == s0) {
+                break;
+            }
+        }
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type val;
+        std::memcpy(&val, buf, sizeof(T));
+        return *reinterpret_cast<const T*>(&val);
+    }
+
+    //! Publish val to readers on any thread
+    void Store(const T& val)
+    {
+        uint64_t s = seq.load(std::memory_order_relaxed);
+        while((s & 1) || !seq.compare_exchange_weak(s, s + 1, std::memory_order_acquire)) {
+            if(s & 1) {
+                std::this_thread::yield();
+                s = seq.load(std::memory_order_relaxed);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        Write(val);
+        seq.store(s + 2, std::memory_order_release);
+
+        // Let on-demand displays know without flagging a GUI change
+        ++VarState::I().change_count;
+    }
+
+    //! A Load() into storage local to the calling thread. The reference is
+    //! only good until a few more Get()s of this type on the same thread, so
+    //! prefer Load() when keeping the value.
+    const VarT& Get() const override
+    {
+        static const size_t num_snapshots = 8;
+        static thread_local T snapshots[num_snapshots];
+        static thread_local size_t next = 0;
+        T& snapshot = snapshots[next++ % num_snapshots];
+        snapshot = Load();
+        return snapshot;
+    }
+
+    void Set(const VarT& val) override
+    {
+        Store(val);
+    }
+
+protected:
+    static const size_t num_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // Words are accessed atomically so that racing readers are well defined
+    void Write(const T& val)
+    {
+        uint64_t buf[num_words] = {};
+        std::memcpy(buf, &val, sizeof(T));
+        for(size_t i = 0; i < num_words; ++i) {
+            words[i].store(buf[i], std::memory_order_relaxed);
+        }
+    }
+
+    VarValueT<std::string>* str_ptr;
+    const T default_value;
+    VarMeta meta;
+
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> words[num_words];
+};
+
+}
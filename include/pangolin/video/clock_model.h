@@ -0,0 +1,94 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace pangolin
+{
+
+// Running fit of the linear map from a device clock (capture timestamps, or
+// frame counters) to host time, from pairs of device time and host time of
+// reception. Reception lags capture by a transfer delay which varies but is
+// never negative, so the map follows the lower envelope of the samples in a
+// sliding window rather than their mean. The skew is fit by least squares
+// over the same window.
+class PANGOLIN_EXPORT ClockModel
+{
+public:
+    // reset_us: residual beyond which the device clock is taken to have
+    // jumped, and fitting starts over.
+    ClockModel(size_t window = 256, int64_t reset_us = 1000000);
+
+    void Reset();
+
+    // Add a sample, returning the host time estimated for device_time
+    int64_t Update(double device_time, int64_t host_time_us);
+
+    // Host time at which the device clock read device_time. Valid() or not,
+    // this is the best guess from the samples so far.
+    int64_t ToHost(double device_time) const;
+
+    // Whether the skew has been fit, which needs two distinct device times
+    bool Valid() const { return valid; }
+
+    // Host microseconds per device unit
+    double Skew() const { return skew; }
+
+    // Mean delay of reception above the envelope, in us
+    double JitterUs() const { return jitter_us; }
+
+    size_t Samples() const { return samples.size(); }
+
+    // Number of times fitting started over
+    size_t Resets() const { return resets; }
+
+protected:
+    void Fit();
+
+    size_t window;
+    int64_t reset_us;
+
+    // Relative to the origin, to keep precision with large timestamps
+    std::deque<std::pair<double,double>> samples;
+    double origin_device;
+    int64_t origin_host_us;
+
+    bool valid;
+    double skew;
+    double offset_us;
+    double jitter_us;
+    size_t resets;
+};
+
+}
@@ -0,0 +1,216 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video/video.h>
+
+#include <camera/NdkCameraDevice.h>
+#include <camera/NdkCameraManager.h>
+#include <media/NdkImageReader.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace pangolin
+{
+
+struct AndroidCameraOptions
+{
+    AndroidCameraOptions()
+        : max_images(4), gpu(true)
+    {
+    }
+
+    // Images the AImageReader may have in flight, shared between frames
+    // waiting to be grabbed and frames still leased by consumers.
+    size_t max_images;
+
+    // Allocate buffers which may be sampled by the GPU, for GrabNextTexture.
+    // Without, buffers are only CPU readable and texture grabs fail.
+    bool gpu;
+};
+
+//! Frame of an AndroidCameraVideo imported as an external texture, to be
+//! sampled in shaders through samplerExternalOES (GL_OES_EGL_image_external),
+//! which also converts from YUV. The camera keeps the buffer behind the
+//! texture until the last copy of the lease is released, after which the
+//! texture may show a newer frame.
+class PANGOLIN_EXPORT AndroidCameraTexture
+{
+public:
+    AndroidCameraTexture()
+        : id(0), target(0), width(0), height(0), capture_time_us(0)
+    {
+    }
+
+    AndroidCameraTexture(uint32_t id, uint32_t target, int width, int height, int64_t capture_time_us, const std::shared_ptr<void>& hold)
+        : id(id), target(target), width(width), height(height), capture_time_us(capture_time_us), hold(hold)
+    {
+    }
+
+    //! True iff the lease refers to a frame
+    bool IsValid() const { return hold != nullptr; }
+
+    explicit operator bool() const { return IsValid(); }
+
+    //! Give up this reference to the camera buffer
+    void Release() { hold.reset(); }
+
+    uint32_t id;            // GL texture name
+    uint32_t target;        // GL_TEXTURE_EXTERNAL_OES
+    int width;
+    int height;
+    int64_t capture_time_us;
+
+private:
+    std::shared_ptr<void> hold;
+};
+
+// Camera2 capture through the NDK (API 26+). Frames are AHardwareBuffers
+// owned by an AImageReader. GrabNextTexture imports them into GL via
+// EGLImage without touching their contents, caching one texture per buffer
+// of the reader. Only GrabNext / GrabNextLease, for consumers which need
+// host memory, copy the frame out as NV12.
+class PANGOLIN_EXPORT AndroidCameraVideo : public VideoInterface, public VideoPropertiesInterface,
+        public BufferAwareVideoInterface, public VideoLeaseInterface
+{
+public:
+    // camera is an index into the ids of ACameraManager, or -1 for the
+    // first facing the given way ("back", "front" or "external").
+    AndroidCameraVideo(int camera, const std::string& facing, int width, int height,
+                       const AndroidCameraOptions& options = AndroidCameraOptions());
+    ~AndroidCameraVideo();
+
+    //! Implement VideoInput::Start()
+    void Start();
+
+    //! Implement VideoInput::Stop()
+    void Stop();
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
+    //! Lease the next frame as a texture, without copying. Must be called
+    //! with the EGL context current which is to sample the texture.
+    AndroidCameraTexture GrabNextTexture( bool wait = true );
+
+    //! As GrabNextTexture, discarding all older frames.
+    AndroidCameraTexture GrabNewestTexture( bool wait = true );
+
+    //! Delete the cached textures and EGLImages. Call with the context of
+    //! GrabNextTexture current, once no texture leases are outstanding.
+    void ReleaseTextures();
+
+    //! Implement BufferAwareVideoInterface::AvailableFrames()
+    uint32_t AvailableFrames() const;
+
+    //! Implement BufferAwareVideoInterface::DropNFrames()
+    bool DropNFrames(uint32_t n);
+
+    //! Access JSON properties of device
+    const picojson::value& DeviceProperties() const;
+
+    //! Access JSON properties of most recently captured frame
+    const picojson::value& FrameProperties() const;
+
+protected:
+    // Texture bound to one AHardwareBuffer of the reader
+    struct ImportedBuffer
+    {
+        AHardwareBuffer* buffer;
+        EGLImageKHR image;
+        uint32_t texture;
+    };
+
+    void OpenCamera(int camera, const std::string& facing);
+    void CreateSession();
+    void DestroySession();
+
+    static void OnImageAvailable(void* context, AImageReader* reader);
+
+    // Acquire the next (or newest) image from the reader, or nullptr
+    AImage* AcquireImage(bool newest, bool wait);
+
+    // Image to be deleted, returning its buffer to the reader, once released
+    std::shared_ptr<AImage> Hold(AImage* image);
+
+    // Copy image into dst as NV12, laid out as streams[0]
+    void CopyToHost(AImage* image, unsigned char* dst) const;
+
+    AndroidCameraTexture Import(AImage* image);
+
+    void SetFrameProperties(AImage* image);
+
+    std::vector<StreamInfo> streams;
+    size_t size_bytes;
+    AndroidCameraOptions options;
+
+    ACameraManager* manager;
+    ACameraDevice* device;
+    AImageReader* reader;
+    ANativeWindow* window;
+    ACaptureSessionOutputContainer* outputs;
+    ACaptureSessionOutput* output;
+    ACameraOutputTarget* target;
+    ACaptureRequest* request;
+    ACameraCaptureSession* session;
+    bool is_streaming;
+
+    picojson::value device_properties;
+    picojson::value frame_properties;
+
+    // Images signalled by the reader which haven't been acquired yet
+    mutable std::mutex available_mutex;
+    std::condition_variable available_cond;
+    size_t available;
+
+    // Imported buffers, by the AHardwareBuffer they wrap
+    EGLDisplay egl_display;
+    std::map<AHardwareBuffer*, ImportedBuffer> imported;
+};
+
+}
@@ -0,0 +1,132 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/clock_model.h>
+
+namespace pangolin
+{
+
+enum ClockSyncSource
+{
+    ClockSyncAuto,          // capture time where given, otherwise frame counter
+    ClockSyncCaptureTime,   // PANGO_CAPTURE_TIME_US
+    ClockSyncFrameCounter   // PANGO_FRAME_COUNTER
+};
+
+struct PANGOLIN_EXPORT ClockSyncOptions
+{
+    ClockSyncOptions()
+        : source(ClockSyncAuto), window(256), reset_us(1000000),
+          latency_us(0), half_exposure(false)
+    {
+    }
+
+    ClockSyncSource source;
+
+    // Frames fit at once, and residual at which the fit starts over
+    size_t window;
+    int64_t reset_us;
+
+    // Least delay from the center of capture to host reception, taken off
+    // the envelope. With half_exposure, half of each frame's exposure too.
+    int64_t latency_us;
+    bool half_exposure;
+};
+
+// Video class that fits a running map from device timestamps to host time
+// (see ClockModel) and publishes PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US
+// from it, free of the jitter in host reception times. JoinVideo syncs on
+// this estimate when it's present.
+class PANGOLIN_EXPORT ClockSyncVideo :
+    public VideoInterface,
+    public VideoFilterInterface,
+    public VideoPropertiesInterface,
+    public VideoFrameMetadataInterface
+{
+public:
+    ClockSyncVideo(std::unique_ptr<VideoInterface>& videoin, const ClockSyncOptions& options = ClockSyncOptions());
+    ~ClockSyncVideo();
+
+    static ClockSyncSource ClockSyncSourceFromString(const std::string& str);
+
+    //! Implement VideoInput::Start()
+    void Start();
+
+    //! Implement VideoInput::Stop()
+    void Stop();
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoFilterInterface method
+    std::vector<VideoInterface*>& InputStreams();
+
+    const picojson::value& DeviceProperties() const;
+
+    // Input frame properties with the estimate, and the state of the fit under "clock_sync"
+    const picojson::value& FrameProperties() const;
+
+    //! Implement VideoFrameMetadataInterface::Metadata()
+    const FrameMetadata& Metadata() const;
+
+    //! Implement VideoFrameMetadataInterface::HasNativeMetadata()
+    bool HasNativeMetadata() const;
+
+    const ClockModel& Model() const { return model; }
+
+protected:
+    void UpdateTiming();
+
+    std::unique_ptr<VideoInterface> src;
+    std::vector<VideoInterface*> videoin;
+    ClockSyncOptions options;
+    ClockModel model;
+
+    bool native_metadata;
+    bool warned_untimed;
+    FrameMetadata metadata;
+
+    picojson::value device_properties;
+    mutable picojson::value frame_properties;
+    mutable bool properties_stale;
+};
+
+}
@@ -0,0 +1,101 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/fused_row_filter.h>
+
+namespace pangolin
+{
+
+// Video class converting every stream of its input to one pixel format using
+// the built in (vectorized) conversions of ConvertPixelFormat.
+class PANGOLIN_EXPORT ConvertVideo :
+    public VideoInterface,
+    public VideoFilterInterface,
+    public VideoRowFilterInterface,
+    public BufferAwareVideoInterface,
+    public VideoStageTimer
+{
+public:
+    // scale multiplies values converted to floating point. Rows of each
+    // stream are split across threads (0 for one per core).
+    ConvertVideo(std::unique_ptr<VideoInterface>& videoin, PixelFormat out_fmt, float scale = 1.0f, size_t threads = 1);
+    ~ConvertVideo();
+
+    //! True iff every stream of videoin can be converted to out_fmt
+    static bool CanConvert(const VideoInterface& videoin, PixelFormat out_fmt);
+
+    //! Implement VideoInput::Start()
+    void Start();
+
+    //! Implement VideoInput::Stop()
+    void Stop();
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoFilterInterface method
+    std::vector<VideoInterface*>& InputStreams();
+
+    //! Implement VideoRowFilterInterface::RowFilterInputRow()
+    size_t RowFilterInputRow(size_t stream, size_t y) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterProcess()
+    void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
+    //! Implement VideoRowFilterInterface::RowFilterSupported()
+    bool RowFilterSupported() const;
+
+    uint32_t AvailableFrames() const;
+
+    bool DropNFrames(uint32_t n);
+
+protected:
+    void Process(unsigned char* image, const unsigned char* buffer);
+
+    std::unique_ptr<VideoInterface> src;
+    std::vector<VideoInterface*> videoin;
+    std::vector<StreamInfo> streams;
+    size_t size_bytes;
+    float scale;
+    size_t threads;
+
+    std::unique_ptr<FusedRowFilter> fused;
+};
+
+}
@@ -29,6 +29,7 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
 
 namespace pangolin
 {
@@ -47,7 +48,9 @@ typedef enum {
     // Pangolin custom defines
     BAYER_METHOD_NONE = 512,
     BAYER_METHOD_DOWNSAMPLE,
-    BAYER_METHOD_DOWNSAMPLE_MONO
+    BAYER_METHOD_DOWNSAMPLE_MONO,
+    BAYER_METHOD_LINEAR,      // Vectorized bilinear, no DC1394 required
+    BAYER_METHOD_EDGEAWARE    // Vectorized gradient directed green, no DC1394 required
 } bayer_method_t;
 
 // Enum to match libdc1394's dc1394_color_filter_t
@@ -62,10 +65,11 @@ typedef enum {
 class PANGOLIN_EXPORT DebayerVideo :
         public VideoInterface,
         public VideoFilterInterface,
-        public BufferAwareVideoInterface
+        public BufferAwareVideoInterface,
+        public VideoStageTimer
 {
 public:
-    DebayerVideo(std::unique_ptr<VideoInterface>& videoin, const std::vector<bayer_method_t> &method, color_filter_t tile);
+    DebayerVideo(std::unique_ptr<VideoInterface>& videoin, const std::vector<bayer_method_t> &method, color_filter_t tile, size_t threads = 1);
     ~DebayerVideo();
 
     //! Implement VideoInput::Start()
@@ -104,10 +108,10 @@ protected:
     std::vector<StreamInfo> streams;
 
     size_t size_bytes;
-    std::unique_ptr<unsigned char[]> buffer;
 
     std::vector<bayer_method_t> methods;
     color_filter_t tile;
+    size_t threads;
 
     picojson::value device_properties;
     picojson::value frame_properties;
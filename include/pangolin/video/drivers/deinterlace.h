@@ -27,36 +27,93 @@
 
 #pragma once
 
+#include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/fused_row_filter.h>
+
+#include <string>
 #include <vector>
 
 namespace pangolin
 {
 
-class PANGOLIN_EXPORT DeinterlaceVideo
-    : public VideoInterface
+enum DeinterlaceMethod
+{
+    DeinterlaceStereo,  // split pixels interleaving two cameras (e.g. Bumblebee) into two streams
+    DeinterlaceFields,  // split even and odd rows into two half height streams
+    DeinterlaceDouble,  // repeat each row of one field, keeping the full height
+    DeinterlaceBob,     // interpolate the rows of the other field from those of one field
+    DeinterlaceWeave,   // interleave the two fields stored one above the other
+};
+
+PANGOLIN_EXPORT
+DeinterlaceMethod DeinterlaceMethodFromString(const std::string& str);
+
+// Video class deinterlacing every stream of its input with built in,
+// vectorized kernels. Stereo and fields give two output streams per input.
+class PANGOLIN_EXPORT DeinterlaceVideo :
+    public VideoInterface,
+    public VideoFilterInterface,
+    public VideoRowFilterInterface,
+    public BufferAwareVideoInterface,
+    public VideoStageTimer
 {
 public:
-    DeinterlaceVideo(std::unique_ptr<VideoInterface>& videoin);
+    // field (0 for even rows, 1 for odd) is the one kept by double and bob.
+    // Rows of each stream are split across threads (0 for one per core).
+    DeinterlaceVideo(std::unique_ptr<VideoInterface>& videoin, DeinterlaceMethod method = DeinterlaceStereo, size_t field = 0, size_t threads = 1);
     ~DeinterlaceVideo();
-    
-    size_t SizeBytes() const;
-    
-    const std::vector<StreamInfo>& Streams() const;
-    
+
+    //! Implement VideoInput::Start()
     void Start();
-    
+
+    //! Implement VideoInput::Stop()
     void Stop();
-    
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
     bool GrabNext( unsigned char* image, bool wait = true );
-    
-    bool GrabNewest( unsigned char* image, bool wait = true );    
-    
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoFilterInterface method
+    std::vector<VideoInterface*>& InputStreams();
+
+    //! Implement VideoRowFilterInterface::RowFilterInputStream()
+    size_t RowFilterInputStream(size_t stream) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterInputRow()
+    size_t RowFilterInputRow(size_t stream, size_t y) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterProcess()
+    void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
+    //! Implement VideoRowFilterInterface::RowFilterSupported()
+    bool RowFilterSupported() const;
+
+    uint32_t AvailableFrames() const;
+
+    bool DropNFrames(uint32_t n);
+
 protected:
-    std::unique_ptr<VideoInterface> videoin;
+    void Process(unsigned char* image, const unsigned char* buffer);
+
+    std::unique_ptr<VideoInterface> src;
+    std::vector<VideoInterface*> videoin;
     std::vector<StreamInfo> streams;
-    unsigned char* buffer;
-};
+    DeinterlaceMethod method;
+    size_t field;
+    size_t threads;
+    size_t size_bytes;
 
+    std::unique_ptr<FusedRowFilter> fused;
+};
 
 }
@@ -49,13 +49,28 @@ extern "C"
 #  define AVPixelFormat PixelFormat
 #endif
 
+// Decode through avcodec_send_packet / avcodec_receive_frame
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 64, 100)
+#  define PANGO_FFMPEG_SEND_RECEIVE
+#endif
+
 namespace pangolin
 {
 
+AVPixelFormat FfmpegFmtFromString(const std::string fmt);
+
 class PANGOLIN_EXPORT FfmpegVideo : public VideoInterface
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    , public VideoPlaybackInterface
+#endif
 {
 public:
-    FfmpegVideo(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false, int user_video_stream = -1);
+    //! hwaccel is none, auto (first device the decoder supports) or an FFmpeg
+    //! device type such as vaapi, cuda or videotoolbox. threads=0 lets FFmpeg
+    //! choose. fmtout NV12 hands decoded frames over as GRAY8 luma and Y400A
+    //! chroma streams without conversion where the decoder produces NV12.
+    //! The keyframe index used for seeking is cached in index_file if given.
+    FfmpegVideo(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false, int user_video_stream = -1, const std::string hwaccel = "none", int threads = 0, const std::string index_filename = "");
     ~FfmpegVideo();
     
     //! Implement VideoInput::Start()
@@ -75,9 +90,39 @@ public:
     
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
+
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    //! Implement VideoPlaybackInterface::GetCurrentFrameId()
+    size_t GetCurrentFrameId() const override;
+
+    //! Implement VideoPlaybackInterface::GetTotalFrames()
+    size_t GetTotalFrames() const override;
+
+    //! Implement VideoPlaybackInterface::Seek()
+    size_t Seek(size_t frameid) override;
+#endif
     
 protected:
-    void InitUrl(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false , int user_video_stream = -1);
+    void InitUrl(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false , int user_video_stream = -1, const std::string hwaccel = "none", int threads = 0);
+
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    void InitHwAccel(const std::string& hwaccel);
+    void OutputFrame(unsigned char* image);
+    bool DecodeFrame();
+    bool SeekToKeyframe(int64_t ts, int flags = AVSEEK_FLAG_BACKWARD);
+    void BuildIndex() const;
+    bool LoadIndex() const;
+    void SaveIndex() const;
+    static AVPixelFormat GetHwFormat(AVCodecContext* ctx, const AVPixelFormat* fmts);
+
+    // Video stream packet, in presentation order
+    struct IndexEntry
+    {
+        int64_t pts;
+        int64_t dts;
+        bool    keyframe;
+    };
+#endif
     
     std::vector<StreamInfo> streams;
     
@@ -95,6 +140,21 @@ protected:
     int             numBytesOut;
     uint8_t         *buffer;
     AVPixelFormat     fmtout;
+
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    AVFrame         *pSwFrame;
+    AVBufferRef     *hw_device_ctx;
+    AVPixelFormat   hw_pix_fmt;
+    bool            draining;
+
+    std::string     video_url;
+    std::string     index_file;
+    mutable std::vector<IndexEntry> index;
+    mutable bool    index_built;
+    mutable bool    index_has_pts;
+    size_t          next_frame_id;
+    bool            have_pending;
+#endif
 };
 
 enum FfmpegMethod
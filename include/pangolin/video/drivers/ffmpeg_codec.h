@@ -0,0 +1,47 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/video/stream_encoder_factory.h>
+
+namespace pangolin {
+
+/// Stateful encoder for the inter-frame codec "h264", "h265" or "av1".
+/// Frames must be passed in stream order; frame i is encoded as a keyframe
+/// whenever i is a multiple of the keyframe interval. See
+/// StreamEncoderFactory::GetEncoder for params.
+PANGOLIN_EXPORT
+ImageEncoderFunc FfmpegStreamEncoder(const std::string& codec, const PixelFormat& fmt, const picojson::value& params);
+
+/// Decoder for streams from FfmpegStreamEncoder. Frames must be passed in
+/// order, although decoding may restart at any keyframe.
+PANGOLIN_EXPORT
+ImageDecoderIntoFunc FfmpegStreamDecoder(const std::string& codec, const PixelFormat& fmt);
+
+}
@@ -32,6 +32,8 @@
 
 #include <dc1394/dc1394.h>
 
+#include <atomic>
+
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -73,7 +75,7 @@ struct PANGOLIN_EXPORT Guid
     uint64_t guid;
 };
 
-class PANGOLIN_EXPORT FirewireVideo : public VideoInterface
+class PANGOLIN_EXPORT FirewireVideo : public VideoInterface, public VideoLeaseInterface
 {
 public:
     const static int MAX_FR = -1;
@@ -88,7 +90,8 @@ public:
             dc1394video_mode_t video_mode = DC1394_VIDEO_MODE_640x480_RGB8,
             dc1394framerate_t framerate = DC1394_FRAMERATE_30,
             dc1394speed_t iso_speed = DC1394_ISO_SPEED_400,
-            int dma_buffers = 10
+            int dma_buffers = 10,
+            int bus_cameras = 1
             );
     
     FirewireVideo(
@@ -96,7 +99,8 @@ public:
             dc1394video_mode_t video_mode = DC1394_VIDEO_MODE_640x480_RGB8,
             dc1394framerate_t framerate = DC1394_FRAMERATE_30,
             dc1394speed_t iso_speed = DC1394_ISO_SPEED_400,
-            int dma_buffers = 10
+            int dma_buffers = 10,
+            int bus_cameras = 1
             );
     
     FirewireVideo(
@@ -106,7 +110,8 @@ public:
             uint32_t width, uint32_t height,
             uint32_t left, uint32_t top,
             dc1394speed_t iso_speed,
-            int dma_buffers, bool reset_at_boot=false
+            int dma_buffers, bool reset_at_boot=false,
+            int bus_cameras = 1
             );
     
     FirewireVideo(
@@ -116,7 +121,8 @@ public:
             uint32_t width, uint32_t height,
             uint32_t left, uint32_t top,
             dc1394speed_t iso_speed,
-            int dma_buffers, bool reset_at_boot=false
+            int dma_buffers, bool reset_at_boot=false,
+            int bus_cameras = 1
             );
     
     ~FirewireVideo();
@@ -139,6 +145,13 @@ public:
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    //! The DMA buffer itself is leased, and re-enqueued once released.
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
     //! (deprecated: use Streams[i].Width())
     //! Return image width
     unsigned Width() const { return width; }
@@ -223,7 +236,8 @@ protected:
             uint64_t guid, int dma_frames,
             dc1394speed_t iso_speed,
             dc1394video_mode_t video_mode,
-            dc1394framerate_t framerate
+            dc1394framerate_t framerate,
+            int bus_cameras
             );
     
     void init_format7_camera(
@@ -232,14 +246,28 @@ protected:
             dc1394video_mode_t video_mode,
             float framerate,
             uint32_t width, uint32_t height,
-            uint32_t left, uint32_t top, bool reset_at_boot
+            uint32_t left, uint32_t top, bool reset_at_boot,
+            int bus_cameras
             );
     
     static int nearest_value(int value, int step, int min, int max);
     static double bus_period_from_iso_speed(dc1394speed_t iso_speed);
+
+    //! Smallest format7 packet size which delivers frames at framerate (if
+    //! positive), and no more than a fair share of the bus between bus_cameras
+    static uint32_t format7_packet_size(const dc1394format7mode_t& info, dc1394speed_t iso_speed, float framerate, int bus_cameras);
+
+    //! Dequeue the most recent frame, re-enqueueing any older ones
+    dc1394video_frame_t* dequeue_newest(bool wait);
+
+    //! Lease frame out of the DMA ring, or a copy of it when the ring would
+    //! otherwise run short of buffers for the camera to fill
+    FrameLease lease_frame(dc1394video_frame_t* frame);
     
     size_t frame_size_bytes;
     std::vector<StreamInfo> streams;
+    int dma_frames;
+    std::atomic<int> leased_frames;
     
     bool running;
     dc1394camera_t *camera;
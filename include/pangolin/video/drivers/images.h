@@ -31,18 +31,52 @@
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
 
+#include <condition_variable>
 #include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace pangolin
 {
 
+// Uncompressed tar archive holding the images of an ImagesVideo
+class ImageArchiveFile;
+
+// Copy the files matched by an images:// wildcard_path into an uncompressed
+// tar archive, led by an index of where each frame of each channel lies so
+// that ImagesVideo can open it without scanning it. Members are named by
+// their paths beneath the directory common to every channel. Returns the
+// number of frames archived.
+PANGOLIN_EXPORT
+size_t WriteImageArchive(const std::string& wildcard_path, const std::string& archive_filename);
+
 // Video class that outputs test video signal.
 class PANGOLIN_EXPORT ImagesVideo : public VideoInterface, public VideoPlaybackInterface
 {
 public:
-    ImagesVideo(const std::string& wildcard_path);
-    ImagesVideo(const std::string& wildcard_path, const PixelFormat& raw_fmt, size_t raw_width, size_t raw_height);
+    // Prefetch options. frames = 0 disables prefetching; threads = 0 picks a
+    // thread count automatically. At most max_bytes of decoded frames are held
+    // (0 for no limit beyond the frame window).
+    struct PrefetchOptions
+    {
+        PrefetchOptions(size_t frames = 0, size_t threads = 0, size_t max_bytes = 0)
+            : frames(frames), threads(threads), max_bytes(max_bytes)
+        {}
+        size_t frames;
+        size_t threads;
+        size_t max_bytes;
+    };
+
+    // If manifest is non-empty, the file list and stream layout are read from
+    // that file when it is still valid for wildcard_path, and written to it otherwise.
+    // If archive is non-empty, images are instead read from the members of that
+    // uncompressed tar file matching wildcard_path, mapped into memory where
+    // possible. An empty wildcard_path then takes the channels given by the
+    // index of a WriteImageArchive() archive, or else all members as one.
+    ImagesVideo(const std::string& wildcard_path, const PrefetchOptions& prefetch = PrefetchOptions(), const std::string& manifest = "", const std::string& archive = "");
+    ImagesVideo(const std::string& wildcard_path, const PixelFormat& raw_fmt, size_t raw_width, size_t raw_height, const PrefetchOptions& prefetch = PrefetchOptions(), const std::string& manifest = "", const std::string& archive = "");
 
     // Explicitly delete copy ctor and assignment operator.
     // See http://stackoverflow.com/questions/29565299/how-to-use-a-vector-of-unique-pointers-in-a-dll-exported-class-with-visual-studi
@@ -87,11 +121,37 @@ protected:
         return filenames[channelNum][frameNum];
     }
     
+    void Open(const std::string& wildcard_path, const std::string& manifest, const std::string& archive_filename);
+
     void PopulateFilenames(const std::string& wildcard_path);
 
+    // Channels of the open archive matching wildcard_path
+    void PopulateArchiveMembers(const std::string& wildcard_path);
+
+    // Decode (channel c of) frame i from file or archive
+    TypedImage LoadChannel(size_t i, size_t c);
+    void LoadChannelInto(size_t i, size_t c, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+
+    bool LoadManifest(const std::string& manifest, const std::string& wildcard_path);
+
+    void SaveManifest(const std::string& manifest, const std::string& wildcard_path) const;
+
     bool LoadFrame(size_t i);
 
+    bool LoadFrameInto(size_t i, unsigned char* image);
+
+    // Decode all channels of frame i into frame
+    void DecodeFrame(size_t i, Frame& frame);
+
+    // Copy decoded frame into image, returning false if it doesn't match the streams
+    bool CopyFrame(const Frame& frame, unsigned char* image) const;
+
     void ConfigureStreamSizes();
+
+    void StartPrefetch(const PrefetchOptions& options);
+    void StopPrefetch();
+    void PrefetchLoop();
+    bool GrabPrefetched(unsigned char* image);
     
     std::vector<StreamInfo> streams;
     size_t size_bytes;
@@ -102,10 +162,26 @@ protected:
     std::vector<std::vector<std::string> > filenames;
     std::vector<Frame> loaded;
 
+    // With an archive, where each file named above lies within it
+    std::shared_ptr<ImageArchiveFile> archive;
+    std::vector<std::vector<std::pair<uint64_t,uint64_t>>> archive_members;
+
     bool unknowns_are_raw;
     PixelFormat raw_fmt;
     size_t raw_width;
     size_t raw_height;
+
+    // Frames are decoded by prefetch_threads into prefetch_ready, covering
+    // [next_frame_id, next_frame_id + prefetch.frames). Guarded by prefetch_mutex.
+    PrefetchOptions prefetch;
+    std::vector<std::thread> prefetch_threads;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cv;
+    std::map<size_t, Frame> prefetch_ready;
+    size_t prefetch_next_load;
+    size_t prefetch_bytes;
+    size_t prefetch_generation;
+    bool prefetch_quit;
 };
 
 }
@@ -29,15 +29,25 @@
 
 #include <fstream>
 #include <pangolin/video/video_output.h>
+#include <pangolin/video/frame_pool.h>
 #include <pangolin/log/packetstream_writer.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 namespace pangolin
 {
 
 class PANGOLIN_EXPORT ImagesVideoOutput : public VideoOutputInterface
 {
 public:
-    ImagesVideoOutput(const std::string& image_folder, const std::string& json_file_out);
+    // With threads > 0, images are encoded and written by a pool of workers,
+    // each stream of a frame in parallel, with at most queue frames in flight
+    // (default 2*threads) before WriteStreams blocks.
+    ImagesVideoOutput(const std::string& image_folder, const std::string& json_file_out, size_t threads = 0, size_t queue = 0);
     ~ImagesVideoOutput();
 
     const std::vector<StreamInfo>& Streams() const override;
@@ -45,7 +55,20 @@ public:
     int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
     bool IsPipe() const override;
 
+    // Frames whose images have all been written, counting from the first
+    // frame with none outstanding before them
+    size_t FramesWritten() const;
+
+    // Block until every frame passed to WriteStreams has been written
+    void Flush();
+
 protected:
+    struct WriteJob;
+
+    void WriteLoop();
+    void StopWorkers();
+    void RethrowError();
+
     std::vector<StreamInfo> streams;
     std::string input_uri;
     picojson::value device_properties;
@@ -54,6 +77,17 @@ protected:
     size_t image_index;
     std::string image_folder;
     std::ofstream file;
+
+    size_t write_queue;
+    mutable std::mutex write_mutex;
+    std::condition_variable write_cv;
+    std::condition_variable done_cv;
+    std::deque<std::shared_ptr<WriteJob>> write_jobs;
+    std::deque<std::pair<std::shared_ptr<WriteJob>, size_t>> write_tasks;
+    std::vector<std::thread> write_workers;
+    std::exception_ptr write_error;
+    size_t frames_written;
+    bool write_quit;
 };
 
 }
@@ -28,12 +28,15 @@
 #pragma once
 
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+
+#include <deque>
 
 namespace pangolin
 {
 
 class PANGOLIN_EXPORT JoinVideo
-    : public VideoInterface, public VideoFilterInterface
+    : public VideoInterface, public VideoFilterInterface, public VideoPropertiesInterface, public VideoStageTimer
 {
 public:
     JoinVideo(std::vector<std::unique_ptr<VideoInterface>> &src);
@@ -56,15 +59,62 @@ public:
 
     bool Sync(int64_t tolerance_us, double transfer_bandwidth_gbps = 0);
 
+    // Grab from every source concurrently, each on its own worker thread,
+    // so that latency is that of the slowest source rather than the sum.
+    void SetParallelGrab(bool parallel);
+
+    // Queue up to depth timestamped frames per source and emit the best aligned
+    // tuple within the sync tolerance, instead of dropping and regrabbing until
+    // the latest frames agree. Requires Sync(). 0 disables.
+    void SetMatchDepth(size_t depth);
+
     bool GrabNext( unsigned char* image, bool wait = true );
 
     bool GrabNewest( unsigned char* image, bool wait = true );
 
     std::vector<VideoInterface*>& InputStreams();
 
+    const picojson::value& DeviceProperties() const;
+
+    // Per source frame properties under "streams", and when matching, statistics under "join".
+    // With stage timing enabled, timings of the whole chain under PANGO_STAGE_TIMING.
+    const picojson::value& FrameProperties() const;
+
 protected:
+    struct PendingFrame
+    {
+        FramePool::Buffer buffer;
+        int64_t capture_us;
+        FrameMetadata metadata;
+        // Only captured from sources without native metadata
+        picojson::value frame_properties;
+    };
+
     int64_t GetAdjustedCaptureTime(size_t src_index);
 
+    int64_t GetAdjustedCaptureTime(const FrameMetadata& metadata, size_t src_index) const;
+
+    bool PullFrame(size_t src_index, bool wait);
+
+    void TopUpFrames(size_t src_index);
+
+    bool MatchPending(bool wait);
+
+    bool GrabNextMatched(unsigned char* image, bool wait);
+
+    // GrabNext() and GrabNewest() without stage timing
+    bool GrabNextJoined(unsigned char* image, bool wait);
+
+    bool GrabNewestJoined(unsigned char* image, bool wait);
+
+    // Run grab(s) for each s in sources, concurrently if parallel grab is enabled.
+    void ForEachSource(const std::vector<size_t>& sources, const std::function<void(size_t)>& grab);
+
+    bool GrabNextParallel(unsigned char* image, bool wait);
+
+    struct GrabWorker;
+    std::vector<std::unique_ptr<GrabWorker>> workers;
+
     std::vector<std::unique_ptr<VideoInterface>> storage;
     std::vector<VideoInterface*> src;
     std::vector<StreamInfo> streams;
@@ -72,6 +122,19 @@ protected:
 
     int64_t sync_tolerance_us;
     int64_t transfer_bandwidth_bytes_per_us;
+
+    size_t match_depth;
+    std::vector<std::deque<PendingFrame>> pending;
+    // Most recently matched frames (without their buffers), whose properties
+    // are only turned into JSON if asked for
+    std::vector<PendingFrame> matched;
+    uint64_t frames_matched;
+    uint64_t frames_dropped;
+    double skew_sum_us;
+    int64_t last_skew_us;
+
+    mutable picojson::value device_properties;
+    mutable picojson::value frame_properties;
 };
 
 
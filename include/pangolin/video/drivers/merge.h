@@ -29,16 +29,21 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
 #include <pangolin/video/iostream_operators.h>
 
 namespace pangolin
 {
 
 // Take N streams, and place them into one big buffer.
-class PANGOLIN_EXPORT MergeVideo : public VideoInterface, public VideoFilterInterface
+// When view is requested and the source streams already sit at the
+// requested positions within a common pitch of the source buffer, the merged
+// stream is described over the source buffer and frames are passed through
+// without copying. Otherwise each row is copied into a contiguous image.
+class PANGOLIN_EXPORT MergeVideo : public VideoInterface, public VideoFilterInterface, public VideoLeaseInterface, public VideoStageTimer
 {
 public:
-    MergeVideo(std::unique_ptr<VideoInterface>& src, const std::vector<Point>& stream_pos, size_t w, size_t h);
+    MergeVideo(std::unique_ptr<VideoInterface>& src, const std::vector<Point>& stream_pos, size_t w, size_t h, bool view = false);
     ~MergeVideo();
     
     void Start() override;
@@ -54,17 +59,28 @@ public:
     bool GrabNewest( unsigned char* image, bool wait = true ) override;
 
     std::vector<VideoInterface*>& InputStreams() override;
-    
+
+    FrameLease GrabNextLease( bool wait = true ) override;
+
+    FrameLease GrabNewestLease( bool wait = true ) override;
+
+    //! True iff frames are passed through as a view of the source buffer
+    bool IsView() const { return view; }
+
 protected:
+    bool ViewLayout(const PixelFormat& fmt, size_t w, size_t h, StreamInfo& layout) const;
+
     void CopyBuffer(unsigned char* dst_bytes, unsigned char* src_bytes);
 
+    FrameLease CopyLease(const FrameLease& in);
+
     std::unique_ptr<VideoInterface> src;
     std::vector<VideoInterface*> videoin;
-    std::unique_ptr<uint8_t[]> buffer;
     std::vector<Point> stream_pos;
 
     std::vector<StreamInfo> streams;
     size_t size_bytes;
+    bool view;
 };
 
 }
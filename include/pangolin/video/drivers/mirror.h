@@ -29,6 +29,8 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/fused_row_filter.h>
 
 namespace pangolin
 {
@@ -39,13 +41,18 @@ enum MirrorOptions
     MirrorOptionsFlipX,
     MirrorOptionsFlipY,
     MirrorOptionsFlipXY,
+    MirrorOptionsTranspose,     // swap x and y
+    MirrorOptionsRotate90,      // clockwise
+    MirrorOptionsRotate270,     // anticlockwise
 };
 
 // Video class that debayers its video input using the given method.
 class PANGOLIN_EXPORT MirrorVideo :
     public VideoInterface,
     public VideoFilterInterface,
-    public BufferAwareVideoInterface
+    public VideoRowFilterInterface,
+    public BufferAwareVideoInterface,
+    public VideoStageTimer
 {
 public:
     MirrorVideo(std::unique_ptr<VideoInterface>& videoin, const std::vector<MirrorOptions>& flips);
@@ -72,6 +79,15 @@ public:
     //! Implement VideoFilterInterface method
     std::vector<VideoInterface*>& InputStreams();
 
+    //! Implement VideoRowFilterInterface::RowFilterInputRow()
+    size_t RowFilterInputRow(size_t stream, size_t y) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterProcess()
+    void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
+    //! Implement VideoRowFilterInterface::RowFilterSupported()
+    bool RowFilterSupported() const;
+
     uint32_t AvailableFrames() const;
 
     bool DropNFrames(uint32_t n);
@@ -84,7 +100,8 @@ protected:
     std::vector<StreamInfo> streams;
     std::vector<MirrorOptions> flips;
     size_t size_bytes;
-    unsigned char* buffer;
+
+    std::unique_ptr<FusedRowFilter> fused;
 
     picojson::value device_properties;
     picojson::value frame_properties;
@@ -0,0 +1,150 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/video/video.h>
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/video/stream_encoder_factory.h>
+#include <pangolin/video/drivers/net_video_protocol.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace pangolin
+{
+
+// Receives video streamed by NetVideoOutput (tcp://, udp://)
+class PANGOLIN_EXPORT NetVideo : public VideoInterface, public VideoPropertiesInterface, public VideoLeaseInterface
+{
+public:
+    // Over tcp, connect to a NetVideoOutput listening on address. Over udp,
+    // listen on address (or just its port, joining it if it is a multicast
+    // group). Frames are received and decoded in the background, holding at
+    // most queue of them and dropping the oldest when the consumer falls
+    // behind. Waits up to timeout_s for the stream description to arrive.
+    NetVideo(
+        const std::string& address, bool udp, size_t queue = 2, double timeout_s = 5.0,
+        size_t rcvbuf_bytes = 8*1024*1024, const std::string& multicast_iface = ""
+    );
+    ~NetVideo();
+
+    // Implement VideoInterface
+
+    size_t SizeBytes() const override;
+
+    const std::vector<StreamInfo>& Streams() const override;
+
+    void Start() override;
+
+    void Stop() override;
+
+    bool GrabNext( unsigned char* image, bool wait = true ) override;
+
+    bool GrabNewest( unsigned char* image, bool wait = true ) override;
+
+    // Implement VideoPropertiesInterface
+
+    const picojson::value& DeviceProperties() const override {
+        return _device_properties;
+    }
+
+    const picojson::value& FrameProperties() const override {
+        return _frame_properties;
+    }
+
+    // Implement VideoLeaseInterface
+
+    FrameLease GrabNextLease( bool wait = true ) override;
+
+    FrameLease GrabNewestLease( bool wait = true ) override;
+
+    // Frames lost in transit, undecodable or dropped for falling behind
+    size_t DroppedFrames() const;
+
+    // Send an input event (see net_video_protocol.h) back to the output,
+    // which only acts on it if opened with input=1. False over udp, or if
+    // the connection has closed.
+    bool SendInput(const picojson::value& event);
+
+protected:
+    struct Frame
+    {
+        std::shared_ptr<FramePool::Buffer> buffer;
+        picojson::value frame_properties;
+    };
+
+    void OpenTcp(const std::string& address);
+    void OpenUdp(const std::string& address, size_t rcvbuf_bytes, const std::string& multicast_iface);
+
+    // Receive the next whole message into _msg (header, props and payload),
+    // false if none arrived within timeout_ms or the connection closed.
+    bool ReceiveMessage(int timeout_ms);
+    bool ReceiveStreamMessage(int timeout_ms);
+    bool ReceiveDatagrams(int timeout_ms);
+    bool ValidMessage() const;
+
+    void SetupStreams(const picojson::value& json_header);
+    void DecodeStreams(const unsigned char* data, size_t size, unsigned char* image);
+    void ReceiveLoop();
+
+    bool PopFrame(Frame& frame, bool newest, bool wait);
+
+    const bool _udp;
+    const size_t _queue;
+    int _fd;
+    std::mutex _send_mutex;
+
+    std::vector<unsigned char> _msg;
+    std::string _header_json;
+    bool _disconnected;
+
+    // udp message reassembly
+    std::vector<unsigned char> _datagram;
+    bool _partial;
+    uint32_t _partial_id;
+    size_t _partial_received;
+
+    size_t _size_bytes;
+    std::vector<StreamInfo> _streams;
+    std::vector<ImageDecoderIntoFunc> _stream_decoders;
+    bool _inter_frame;
+    picojson::value _device_properties;
+    picojson::value _frame_properties;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Frame> _ready;
+    size_t _dropped_frames;
+    bool _closed;
+    bool _quit;
+    std::thread _thread;
+};
+
+}
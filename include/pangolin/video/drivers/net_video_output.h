@@ -0,0 +1,129 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/video/video_output.h>
+#include <pangolin/video/stream_encoder_factory.h>
+#include <pangolin/video/drivers/net_video_protocol.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace pangolin
+{
+
+// Streams video to NetVideo receivers (tcp://, udp://) on other machines,
+// with streams optionally compressed through StreamEncoderFactory. Tcp
+// receivers may send input events back (see net_video_protocol.h), which
+// are queued for PopInputEvent when accept_input is set.
+class PANGOLIN_EXPORT NetVideoOutput : public VideoOutputInterface, public VideoOutputRemoteInputInterface
+{
+public:
+    // Over tcp, listen on address for any number of receivers. Over udp, send
+    // to address, which may be a multicast group for many receivers at once.
+    // Each receiver is sent at most queue frames behind the newest; older
+    // frames are dropped, along with any that depend on them.
+    NetVideoOutput(
+        const std::string& address, bool udp, const std::map<size_t, std::string>& stream_encoder_uris,
+        size_t queue = 4, size_t datagram_bytes = net_video_default_datagram_bytes,
+        int multicast_ttl = 1, const std::string& multicast_iface = "", bool accept_input = false
+    );
+    ~NetVideoOutput();
+
+    const std::vector<StreamInfo>& Streams() const override;
+    void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri, const picojson::value& device_properties) override;
+    int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
+    bool IsPipe() const override;
+
+    // Implement VideoOutputRemoteInputInterface
+    bool PopInputEvent(picojson::value& event) override;
+
+    // Codec parameters for stream i, see StreamEncoderFactory::GetEncoder.
+    // Must be called before SetStreams.
+    void SetStreamEncoderParams(size_t i, const picojson::value& params);
+
+    // Receivers currently connected (tcp), or 1 for udp
+    size_t NumReceivers() const;
+
+    // Frames not sent to a receiver because it fell behind
+    size_t DroppedFrames() const;
+
+protected:
+    struct Receiver;
+
+    void AddReceiver(int fd);
+    void Queue(Receiver& r, const std::shared_ptr<const NetVideoMessage>& msg, bool frame);
+    void AcceptLoop();
+    void SendLoop(std::shared_ptr<Receiver> r);
+    void InputLoop(std::shared_ptr<Receiver> r);
+    void CloseReceiver(Receiver& r);
+    void SendDatagrams(const NetVideoMessage& msg);
+
+    void ResetInterFrameEncoders();
+    void EncodeStream(size_t i, const unsigned char* data, std::ostream& os);
+    // Fill in msg's header once its payload is written
+    void FinishMessage(NetVideoMessage& msg, NetVideoMsgType type, const std::string& props, int64_t time_us) const;
+
+    const std::string address;
+    const bool udp;
+    const size_t queue_frames;
+    const size_t datagram_bytes;
+    const bool accept_input;
+    int fd;
+    sockaddr_storage dest;
+    socklen_t dest_len;
+    uint32_t next_msg_id;
+
+    std::vector<StreamInfo> streams;
+    size_t total_frame_size;
+    std::map<size_t, std::string> stream_encoder_uris;
+    std::map<size_t, picojson::value> stream_encoder_params;
+    std::vector<ImageEncoderFunc> stream_encoders;
+    std::vector<size_t> keyframe_intervals;
+    bool inter_frame;
+    size_t frames_since_reset;
+    uint64_t seq;
+
+    std::shared_ptr<const NetVideoMessage> header;
+    int64_t header_sent_us;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<Receiver>> receivers;
+    std::thread accept_thread;
+    bool reset_encoders;
+    size_t dropped_frames;
+    std::deque<picojson::value> input_events;
+    bool quit;
+};
+
+}
@@ -0,0 +1,141 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/utils/memstreambuf.h>
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+// Video sent between NetVideoOutput and NetVideo (tcp:// and udp://) is a
+// series of messages, each a net_video_msg_header followed by props_bytes
+// of JSON frame properties and payload_bytes of payload. A header message
+// carries the stream description JSON, laid out as a pango log's video
+// source info. A frame message carries each stream in turn, raw or
+// encoded as that description says.
+//
+// Over tcp, messages follow each other on the connection. Over udp, each
+// message is split into datagrams starting with a net_video_fragment_header.
+// A message missing fragments is dropped as soon as a later one arrives,
+// and the header message is repeated so that receivers can join at any time.
+//
+// Tcp receivers may send input messages back, carrying one input event as
+// their JSON properties and no payload. The output only acts on them when
+// opened with input=1. Events are in pixels of the streamed frame, with y
+// counting its rows as sent (so from the bottom, for framebuffer captures):
+//   {"event":"mouse", "button":b, "pressed":true|false, "x":x, "y":y}
+//   {"event":"motion", "x":x, "y":y}
+//   {"event":"scroll", "dx":dx, "dy":dy, "x":x, "y":y}
+//   {"event":"key", "key":k, "pressed":true|false, "x":x, "y":y}
+// with buttons numbered as MouseButton bits (0 left, 1 middle, 2 right, 3 and
+// 4 wheel) and keys as passed to Handler::Keyboard (PANGO_SPECIAL + code for
+// special keys).
+
+const char net_video_magic[4] = {'P','N','E','T'};
+const uint16_t net_video_version = 1;
+
+// Largest udp payload that doesn't fragment over 1500 byte ethernet frames
+const size_t net_video_default_datagram_bytes = 1472;
+
+enum NetVideoMsgType
+{
+    NetVideoMsgHeader = 0,
+    NetVideoMsgFrame = 1,
+    NetVideoMsgInput = 2
+};
+
+struct net_video_msg_header
+{
+    char magic[4];
+    uint8_t type;
+    uint8_t keyframe;       // frame decodes without any earlier frames
+    uint16_t version;
+    uint32_t props_bytes;
+    uint32_t reserved;
+    uint64_t seq;           // frames sent since the output started
+    int64_t time_us;
+    uint64_t payload_bytes;
+};
+
+struct net_video_fragment_header
+{
+    char magic[4];
+    uint32_t msg_id;
+    uint32_t msg_bytes;
+    uint32_t offset;
+};
+
+// Message ready to send: header and properties, then payload
+struct NetVideoMessage
+{
+    NetVideoMessage(size_t payload_reserve = 0) : payload(payload_reserve), type(NetVideoMsgFrame), keyframe(true) {}
+
+    size_t SizeBytes() const { return head.size() + payload.size(); }
+
+    std::vector<unsigned char> head;
+    memstreambuf payload;
+    NetVideoMsgType type;
+    bool keyframe;
+};
+
+// Largest input message accepted, to bound what a receiver can make us allocate
+const size_t net_video_max_input_bytes = 4096;
+
+// Split "host:port", "[ipv6 host]:port", ":port" or "port" into host and port
+PANGOLIN_EXPORT
+void NetVideoParseAddress(const std::string& address, std::string& host, std::string& port);
+
+// Resolve address for socket type (SOCK_STREAM or SOCK_DGRAM). An empty host
+// resolves to the wildcard address when passive, for binding to.
+PANGOLIN_EXPORT
+socklen_t NetVideoResolve(const std::string& address, int socktype, bool passive, sockaddr_storage& addr);
+
+PANGOLIN_EXPORT
+bool NetVideoIsMulticast(const sockaddr_storage& addr);
+
+// Wait up to timeout_ms for fd to become readable
+PANGOLIN_EXPORT
+bool NetVideoPoll(int fd, int timeout_ms);
+
+// Write all of data to a connected stream socket, false if the connection failed
+PANGOLIN_EXPORT
+bool NetVideoSendAll(int fd, const unsigned char* data, size_t size, bool more = false);
+
+// Read exactly size bytes from a stream socket, false on error or end of stream
+PANGOLIN_EXPORT
+bool NetVideoRecvAll(int fd, unsigned char* data, size_t size);
+
+}
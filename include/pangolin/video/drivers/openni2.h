@@ -35,6 +35,8 @@
 
 #include <OpenNI.h>
 
+#include <deque>
+
 namespace pangolin
 {
 const int MAX_OPENNI2_STREAMS = 2 * ONI_MAX_SENSORS;
@@ -69,6 +71,9 @@ public:
     void SetPlaybackSpeed(float speed);
     void SetPlaybackRepeat(bool enabled);
 
+    // Frames held per stream while waiting for the other streams to deliver
+    void SetQueueFrames(size_t frames);
+
     ~OpenNi2Video();
 
     //! Implement VideoInput::Start()
@@ -118,6 +123,22 @@ protected:
     void PrintOpenNI2Modes(openni::SensorType sensorType);
     openni::VideoMode FindOpenNI2Mode(openni::Device &device, openni::SensorType sensorType, int width, int height, int fps, openni::PixelFormat fmt );
 
+    struct QueuedFrame
+    {
+        openni::VideoFrameRef frame;
+        int64_t host_reception_time_us;
+    };
+
+    // Read one frame from whichever stream is ready first into its queue.
+    bool ReadAnyStream(int timeout_ms);
+
+    // Read each stream in turn, for IR and RGB which can't stream together.
+    bool GrabSequential(unsigned char* image);
+
+    bool GrabQueued(unsigned char* image, bool wait, bool newest);
+
+    void SetStreamProperties(size_t i, const QueuedFrame& queued);
+
     size_t numDevices;
     size_t numStreams;
 
@@ -125,7 +146,6 @@ protected:
     OpenNiStreamMode sensor_type[ONI_MAX_SENSORS];
 
     openni::VideoStream video_stream[ONI_MAX_SENSORS];
-    openni::VideoFrameRef video_frame[ONI_MAX_SENSORS];
 
     std::vector<StreamInfo> streams;
     size_t sizeBytes;
@@ -142,6 +162,14 @@ protected:
 
     size_t current_frame_index;
     size_t total_frames;
+
+    std::deque<QueuedFrame> frame_queue[ONI_MAX_SENSORS];
+    size_t queue_frames;
+
+    // Device to host clock offset per stream, estimated by the minimum
+    // observed reception delay.
+    int64_t clock_offset_us[ONI_MAX_SENSORS];
+    bool clock_offset_valid[ONI_MAX_SENSORS];
 };
 
 }
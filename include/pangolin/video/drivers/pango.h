@@ -29,17 +29,34 @@
 
 #include <pangolin/log/packetstream_reader.h>
 #include <pangolin/log/playback_session.h>
+#include <pangolin/video/frame_cache.h>
 #include <pangolin/video/stream_encoder_factory.h>
 #include <pangolin/video/video.h>
 
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
 namespace pangolin
 {
 
 class PANGOLIN_EXPORT PangoVideo
-    : public VideoInterface, public VideoPropertiesInterface, public VideoPlaybackInterface
+    : public VideoInterface, public VideoPropertiesInterface, public VideoFrameMetadataInterface,
+      public VideoPlaybackInterface, public VideoLeaseInterface, public VideoThumbnailInterface,
+      public VideoFrameCacheInterface
 {
 public:
-    PangoVideo(const std::string& filename, std::shared_ptr<PlaybackSession> playback_session);
+    // With memory_map, seekable logs are mapped into memory and frames are read in place.
+    // With readahead > 0, up to that many frames are read and decoded ahead on background threads.
+    // With demux, packets are read through the session's shared reader as one of its
+    // subscribers, so that videos replaying different sources of one log (or the same
+    // source) read it once, in order, without taking each others packets.
+    // src picks the video source within the log, or -1 for the first.
+    // With cache_bytes > 0, decoded frames are kept for stepping back and forth
+    // (see SetFrameCache).
+    PangoVideo(const std::string& filename, std::shared_ptr<PlaybackSession> playback_session, bool memory_map = false, size_t readahead = 0,
+               bool demux = true, int src = -1, size_t cache_bytes = 0, size_t cache_ahead = 0);
     ~PangoVideo();
 
     // Implement VideoInterface
@@ -62,9 +79,15 @@ public:
         return _device_properties;
     }
 
-    const picojson::value& FrameProperties() const override {
-        return _frame_properties;
-    }
+    // JSON written with the frame, plus any binary metadata
+    const picojson::value& FrameProperties() const override;
+
+    // Implement VideoFrameMetadataInterface
+
+    const FrameMetadata& Metadata() const override;
+
+    // True whilst frames were recorded with binary metadata alone
+    bool HasNativeMetadata() const override;
 
     // Implement VideoPlaybackInterface
 
@@ -74,26 +97,182 @@ public:
 
     size_t Seek(size_t frameid) override;
 
+    // Implement VideoLeaseInterface
+
+    FrameLease GrabNextLease( bool wait = true ) override;
+
+    FrameLease GrabNewestLease( bool wait = true ) override;
+
+    // Implement VideoThumbnailInterface, when recorded with thumbnails
+    // (see PangoVideoOutput::SetThumbnails)
+
+    size_t ThumbnailInterval() const override;
+
+    size_t GetThumbnails(size_t frameid, std::vector<TypedImage>& thumbs) override;
+
+    // Implement VideoFrameCacheInterface. Frames are cached only when seekable
+    // logs are read without readahead, and there is decoding to save.
+
+    size_t FrameCacheBudget() const override;
+
+    void SetFrameCache(size_t max_bytes, size_t ahead) override;
+
+    // Random access, for data loaders sampling the frames of seekable logs
+
+    // Read and decode frame frameid into image (of SizeBytes()), and its
+    // properties if asked, without moving playback or the session's time.
+    // Safe to call from any number of threads at once, and whilst grabbing.
+    // Returns false if there is no such frame.
+    bool ReadFrame(size_t frameid, unsigned char* image, picojson::value* frame_properties = nullptr);
+
+    // Read frameids[i] into images[i] for each i, in the order frames lie
+    // within the log, split among threads in contiguous runs. Throws if
+    // any frame doesn't exist.
+    void ReadFrames(const std::vector<size_t>& frameids, const std::vector<unsigned char*>& images,
+                    std::vector<picojson::value>* frame_properties = nullptr);
+
 private:
     void HandlePipeClosed();
 
 protected:
-    int FindPacketStreamSource();
+    int FindPacketStreamSource(int src);
+    int FindThumbnailSource() const;
     void SetupStreams(const PacketStreamSource& src);
 
+    // Decoder of each stream of src, or null for those stored raw
+    static std::vector<ImageDecoderIntoFunc> CreateStreamDecoders(const PacketStreamSource& src);
+
+    struct ReadAheadFrame
+    {
+        ReadAheadFrame() : valid(false), packet_id(0), next_packet_time(0) {}
+
+        bool valid;
+        std::shared_ptr<FramePool::Buffer> buffer;
+        picojson::value frame_properties;
+        std::string binary_meta;
+        size_t packet_id;
+        int64_t next_packet_time;
+    };
+
+    // Decode a variable size packet already in memory into image, in
+    // parallel when the packet records where each stream starts.
+    void DecodePacket(const unsigned char* data, size_t size, unsigned char* image, const std::vector<ImageDecoderIntoFunc>& decoders);
+
+    // Decode streams one after another from is into image
+    void DecodeStreams(std::istream& is, unsigned char* image, const std::vector<ImageDecoderIntoFunc>& decoders);
+
+    // Metadata of the frame just read, as JSON and / or binary FrameMetadata
+    void SetFrameMeta(const picojson::value& meta, const std::string& binary_meta);
+
+    // Read the next packet from the log and decode it into image, returning its metadata
+    void ReadFrame(unsigned char* image, picojson::value& meta, std::string& binary_meta);
+
+    // Id and capture time of the next packet to be read, from the
+    // subscriber's position with demux, or otherwise the reader's
+    size_t NextPacketId() const;
+    int64_t NextPacketTime() const;
+
+    // Position the next packet to be read at packet_id
+    void SeekPacket(size_t packet_id);
+
+    // Whether every inter-frame stream has a keyframe in packet packet_id
+    bool IsKeyframe(size_t packet_id) const;
+
+    // Inter-frame streams only decode in order from a keyframe, so when seeks
+    // or the cache have skipped packets, bring the decoders up to the next
+    // packet from the previous keyframe (or from where they are, if nearer).
+    void DecodeFromKeyframe();
+
+    // Whether grabs go through the frame cache
+    bool UseCache() const;
+
+    // Next frame from the cache, or read, decoded and added to it. Returns
+    // null if there are no more frames.
+    std::shared_ptr<FramePool::Buffer> GrabCached();
+
+    // Ask the background thread to decode frames past packet_id in the direction
+    // travelled since the last frame grabbed.
+    void Speculate(size_t packet_id);
+    void StopSpeculation();
+    void SpeculateLoop();
+
+    void StartReadAhead(size_t frames);
+    void StopReadAhead();
+    void ReadAheadLoop();
+    // Discard everything read ahead. Caller must hold _readahead_read_mutex.
+    void ResetReadAhead();
+    ReadAheadFrame NextReadAheadFrame();
+
     const std::string _filename;
     std::shared_ptr<PlaybackSession> _playback_session;
     std::shared_ptr<PacketStreamReader> _reader;
     SyncTimeEventPromise _event_promise;
     int _src_id;
     const PacketStreamSource* _source;
+    bool _demux;
+    size_t _subscriber;
 
     size_t _size_bytes;
     bool _fixed_size;
     std::vector<StreamInfo> _streams;
-    std::vector<ImageDecoderFunc> stream_decoder;
+    std::vector<ImageDecoderIntoFunc> stream_decoder;
+    bool _stream_offsets;
+    // Whether any stream is inter-frame coded, and each stream's keyframe interval (0 for others)
+    bool _inter_frame;
+    std::vector<size_t> _keyframe_intervals;
     picojson::value _device_properties;
-    picojson::value _frame_properties;
+    mutable picojson::value _frame_properties;
+    mutable FrameMetadata _metadata;
+    // Which of the above is yet to be filled in from the other
+    mutable bool _properties_stale;
+    mutable bool _metadata_stale;
+    bool _native_metadata;
+
+    size_t _readahead;
+    size_t _readahead_packet_id;
+    std::vector<std::thread> _readahead_threads;
+    // Serialises reads from the log between workers and seeks
+    std::mutex _readahead_read_mutex;
+    // Guards the members below
+    std::mutex _readahead_mutex;
+    std::condition_variable _readahead_cv;
+    // Frames ready to be handed out, keyed by the order in which they were read
+    std::map<size_t, ReadAheadFrame> _readahead_ready;
+    size_t _readahead_next_read;
+    size_t _readahead_next_grab;
+    size_t _readahead_generation;
+    bool _readahead_quit;
+
+    // Thumbnail source of the video, or -1, read through its own cursor
+    int _thumb_src_id;
+    std::mutex _thumb_mutex;
+    std::unique_ptr<PacketStreamCursor> _thumb_cursor;
+
+    // Next packet the decoders in stream_decoder are ready for, or -1 if unknown
+    size_t _decoded_packet_id;
+
+    FrameCache _cache;
+    // Whether there is decoding (or decompression) for the cache to save
+    bool _cacheable;
+    size_t _cache_last_id;
+    // Speculative decoding into the cache, through its own cursor and decoders
+    std::thread _spec_thread;
+    std::unique_ptr<PacketStreamCursor> _spec_cursor;
+    std::vector<ImageDecoderIntoFunc> _spec_decoders;
+    // Guards the members below
+    std::mutex _spec_mutex;
+    std::condition_variable _spec_cv;
+    size_t _spec_ahead;
+    size_t _spec_from;
+    bool _spec_forward;
+    size_t _spec_generation;
+    bool _spec_quit;
+
+    // Decoders of ReadFrame, a set per call in flight
+    std::vector<ImageDecoderIntoFunc> AcquireRandomDecoders();
+    void ReleaseRandomDecoders(std::vector<ImageDecoderIntoFunc>&& decoders);
+    std::mutex _random_mutex;
+    std::vector<std::vector<ImageDecoderIntoFunc>> _random_decoders;
 
     Registration<size_t> session_seek;
 };
@@ -31,26 +31,119 @@
 #include <pangolin/video/video_output.h>
 
 #include <pangolin/video/stream_encoder_factory.h>
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/utils/memstreambuf.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <mutex>
+#include <thread>
 
 namespace pangolin
 {
 
+// What WriteStreams does when encode_queue frames are already in flight
+enum class EncodeDropPolicy
+{
+    Block,      // wait for the oldest frame to be written
+    DropNewest, // discard the frame being written
+    DropOldest  // discard the oldest frame whose encoding hasn't started
+};
+
 class PANGOLIN_EXPORT PangoVideoOutput : public VideoOutputInterface
 {
 public:
-    PangoVideoOutput(const std::string& filename, size_t buffer_size_bytes, const std::map<size_t, std::string> &stream_encoder_uris);
+    // With encode_threads > 0, encoded streams are compressed in parallel by a
+    // pool of workers and packets are written in order by a writer thread,
+    // which also encodes inter-frame (h264, h265, av1) streams in order.
+    // At most encode_queue frames are held in flight.
+    // header_properties are added to the header of every file written, see
+    // PacketStreamWriter::SetHeaderProperties.
+    PangoVideoOutput(
+        const std::string& filename, size_t buffer_size_bytes, const std::map<size_t, std::string> &stream_encoder_uris,
+        size_t encode_threads = 0, size_t encode_queue = 0, EncodeDropPolicy drop_policy = EncodeDropPolicy::Block,
+        size_t direct_depth = 0, bool lock_free = false, const picojson::value& header_properties = picojson::value()
+    );
     ~PangoVideoOutput();
 
     const std::vector<StreamInfo>& Streams() const override;
     void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri, const picojson::value& device_properties) override;
     int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
+    // Metadata is stored in binary ahead of each packet, rather than as JSON
+    int WriteStreams(const unsigned char* data, const FrameMetadata& metadata) override;
     bool IsPipe() const override;
 
+    // Number of frames discarded by the drop policy
+    size_t DroppedFrames() const;
+
+    // Writer and buffer statistics, see PacketStreamWriter::Stats()
+    PacketStreamWriterStats Stats();
+
+    // Split the recording into files of at most max_bytes or max_duration_us,
+    // see PacketStreamWriter::SetRotation
+    void SetRotation(size_t max_bytes, int64_t max_duration_us);
+
+    // Write back and drop from the page cache every interval_bytes written,
+    // see PacketStreamWriter::SetWriteback
+    void SetWriteback(size_t interval_bytes);
+
+    // Start the data of every frame at a multiple of bytes into the log,
+    // see PacketStreamSource::data_alignment_bytes. Must be called before SetStreams.
+    void SetPacketAlignment(size_t bytes);
+
+    // Also record a JPEG thumbnail of every stream, at most max_dim pixels
+    // across, every interval frames, for scrubbing through the recording
+    // (see VideoThumbnailInterface). 0 disables. Must be called before SetStreams.
+    void SetThumbnails(size_t interval, size_t max_dim = 160, float quality = 75.0f);
+
+    // Codec parameters for stream i, see StreamEncoderFactory::GetEncoder.
+    // Must be called before SetStreams.
+    void SetStreamEncoderParams(size_t i, const picojson::value& params);
+
+    // Underlying log, for instance to record other sources alongside the
+    // video with VarChangeRecorder
+    PacketStreamWriter& Writer() { return packetstream; }
+
+    // Publish buffer occupancy, throughput and drops as Vars named
+    // prefix.*, updated from WriteStreams. Empty prefix disables.
+    void PublishStatsAsVars(const std::string& prefix);
+
+    // For streams given a ladder of encoders (see StreamEncoderFactory::IsAdaptive),
+    // step one level down the ladder when the write buffer or encode queue is
+    // more than high full, and back up once it's less than low full. Levels
+    // are held for at least dwell_frames, unless the buffer is all but full.
+    void SetAdaptiveQuality(double high, double low, size_t dwell_frames);
+
+    // Level of the ladders frames are currently encoded at, 0 for best
+    size_t QualityLevel() const;
+
 protected:
+    struct EncodeJob;
+
 //    void WriteHeader();
 
+    // Write a frame, with either or both of JSON and binary metadata
+    int WriteFrame(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta);
+    void EncodeStream(size_t i, const unsigned char* data, std::ostream& os, size_t level);
+    void UpdateQualityLevel();
+    void ResetInterFrameEncoders();
+    // Encode the frame straight into the log's buffer. False, with nothing
+    // written, where it has to be encoded into scratch instead.
+    bool EncodeInPlace(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta);
+    void WritePacket(const std::vector<std::unique_ptr<memstreambuf>>& encoded, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta);
+
+    void QueueFrame(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta);
+    bool DropOldestFrame();
+    void EncodeLoop();
+    void WriteLoop();
+    void StopPipeline();
+    void PublishStats();
+    void AddThumbnailSource();
+    void WriteThumbnail(const unsigned char* data, int64_t time_us);
+
     std::vector<StreamInfo> streams;
     std::string input_uri;
     const std::string filename;
@@ -58,13 +151,69 @@ protected:
 
     PacketStreamWriter packetstream;
     size_t packetstream_buffer_size_bytes;
+    size_t packetstream_direct_depth;
+    bool packetstream_lock_free;
     int packetstreamsrcid;
+    size_t packet_alignment;
+
+    // Thumbnails written alongside the video, see SetThumbnails
+    struct ThumbnailStream
+    {
+        size_t w, h;    // 0 if the stream's format can't be thumbnailed
+        PixelFormat fmt;
+    };
+    size_t thumbnail_interval;
+    size_t thumbnail_max_dim;
+    float thumbnail_quality;
+    int thumbnail_srcid;
+    size_t thumbnail_countdown;
+    std::vector<ThumbnailStream> thumbnail_streams;
+
     size_t total_frame_size;
     bool is_pipe;
 
     bool fixed_size;
     std::map<size_t, std::string> stream_encoder_uris;
+    std::map<size_t, picojson::value> stream_encoder_params;
     std::vector<ImageEncoderFunc> stream_encoders;
+    // Encoders of adaptive streams from best to lowest quality, else empty
+    std::vector<std::vector<ImageEncoderFunc>> stream_levels;
+    // Streams which must be encoded in frame order, see StreamEncoderFactory::IsInterFrame
+    std::vector<bool> stream_inter_frame;
+    size_t worker_streams;
+
+    size_t encode_threads;
+    size_t encode_queue;
+    EncodeDropPolicy drop_policy;
+
+    mutable std::mutex encode_mutex;
+    std::condition_variable encode_cv;
+    std::condition_variable write_cv;
+    std::condition_variable space_cv;
+    std::deque<std::shared_ptr<EncodeJob>> encode_jobs;
+    std::deque<std::pair<std::shared_ptr<EncodeJob>, size_t>> encode_tasks;
+    std::vector<std::thread> encode_workers;
+    std::thread write_worker;
+    std::exception_ptr encode_error;
+    size_t dropped_frames;
+    bool encode_quit;
+
+    // Adaptive quality, see SetAdaptiveQuality
+    double adapt_high;
+    double adapt_low;
+    size_t adapt_dwell;
+    size_t adapt_max_level;
+    size_t adapt_countdown;
+    std::atomic<size_t> adapt_level;
+
+    std::string stats_vars;
+    int64_t stats_published_us;
+
+    // Reused staging for packets that can't be written in place, and the
+    // per stream buffers of written frames, for the next queued frame
+    memstreambuf encode_scratch;
+    memstreambuf packet_scratch;
+    std::vector<std::unique_ptr<memstreambuf>> spare_encoded;
 };
 
 }
@@ -42,6 +42,8 @@
 
 #include <stdlib.h>
 #include <list>
+#include <mutex>
+#include <set>
 
 namespace pangolin
 {
@@ -64,7 +66,8 @@ typedef std::list<GrabbedBuffer> GrabbedBufferList;
 typedef std::list<PvBuffer *> BufferList;
 
 class PANGOLIN_EXPORT PleoraVideo : public VideoInterface, public VideoPropertiesInterface,
-        public BufferAwareVideoInterface, public GenicamVideoInterface
+        public BufferAwareVideoInterface, public GenicamVideoInterface, public VideoLeaseInterface,
+        public VideoReadoutInterface
 {
 public:
 
@@ -86,6 +89,12 @@ public:
 
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Lease the next PvBuffer without copying. The buffer is queued back
+    //! to the stream once the lease is released.
+    FrameLease GrabNextLease( bool wait = true );
+
+    FrameLease GrabNewestLease( bool wait = true );
+
     std::string GetParameter(const std::string& name);
 
     void SetParameter(const std::string& name, const std::string& value);
@@ -110,6 +119,13 @@ public:
 
     void SetupTrigger(bool triggerActive, int64_t triggerSource, int64_t acquisitionMode);
 
+    //! Implement VideoReadoutInterface::SetReadout(), through the GenICam
+    //! OffsetX/Y, Width, Height, Binning* and Decimation* features.
+    VideoReadout SetReadout(const VideoReadout& readout);
+
+    //! Implement VideoReadoutInterface::GetReadout()
+    VideoReadout GetReadout() const;
+
     const picojson::value& DeviceProperties() const {
         return device_properties;
     }
@@ -154,7 +170,21 @@ protected:
     template<typename T>
     bool SetStreamParam(const char* name, T val);
 
-    bool ParseBuffer(PvBuffer* lBuffer,  unsigned char* image);
+    // Set integer feature name to the nearest valid value at or below (or
+    // above, with round_up) val, returning the value taken or -1 without it
+    int64_t SetAlignedParam(const char* name, int64_t val, bool round_up);
+
+    // Integer feature name, or def if the device hasn't got it
+    int64_t DeviceParamOr(const char* name, int64_t def);
+
+    // Readout as configured on the device
+    VideoReadout QueryReadout();
+
+    bool ParseBuffer(PvBuffer* lBuffer);
+
+    FrameLease LeaseFront();
+
+    void ReleaseBuffer(PvBuffer* lBuffer);
 
     void RetriveAllAvailableBuffers(uint32_t timeout);
 
@@ -191,6 +221,13 @@ protected:
     BufferList lBufferList;
     GrabbedBufferList lGrabbedBuffList;
     uint32_t validGrabbedBuffers;
+
+    // Buffers held by outstanding leases, which mustn't be queued on Start()
+    std::mutex lease_mutex;
+    std::set<PvBuffer*> leased_buffers;
+    bool streaming;
+
+    VideoReadout readout;
 };
 
 }
@@ -30,16 +30,22 @@
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
 #include <pangolin/utils/timer.h>
+#include <pangolin/utils/memory_mapped_file.h>
 
 #include <fstream>
+#include <memory>
 
 namespace pangolin
 {
 
-class PANGOLIN_EXPORT PvnVideo : public VideoInterface
+// Raw fixed size frames following a short text header. Where possible the
+// file is memory mapped: frames are leased straight out of the mapping, the
+// next few frames are advised to the OS for read-ahead, and seeking is a
+// matter of arithmetic on the frame size.
+class PANGOLIN_EXPORT PvnVideo : public VideoInterface, public VideoPlaybackInterface, public VideoLeaseInterface
 {
 public:
-    PvnVideo(const std::string& filename, bool realtime = false);
+    PvnVideo(const std::string& filename, bool realtime = false, bool memory_map = true, size_t prefetch_frames = 4);
     ~PvnVideo();
     
     //! Implement VideoInput::Start()
@@ -59,19 +65,44 @@ public:
     
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
-    
+
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
+    //! Implement VideoPlaybackInterface::GetCurrentFrameId()
+    size_t GetCurrentFrameId() const;
+
+    //! Implement VideoPlaybackInterface::GetTotalFrames()
+    size_t GetTotalFrames() const;
+
+    //! Implement VideoPlaybackInterface::Seek()
+    size_t Seek(size_t frameid);
+
 protected:
-    int frames;
     std::ifstream file;
+    std::shared_ptr<MemoryMappedFile> mapping;
 
     std::vector<StreamInfo> streams;
     size_t frame_size_bytes;
+    size_t header_bytes;
+    size_t total_frames;
+    size_t next_frame;
+    size_t prefetch_frames;
     
     bool realtime;
     pangolin::basetime frame_interval;
     pangolin::basetime last_frame;
     
     void ReadFileHeader();
+
+    size_t FrameOffset(size_t frameid) const { return header_bytes + frameid * frame_size_bytes; }
+
+    void Prefetch(size_t frameid) const;
+
+    void WaitForFrameTime();
 };
 
 }
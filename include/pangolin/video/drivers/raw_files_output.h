@@ -0,0 +1,101 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2011 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/log/packetstream_writer.h>
+#include <pangolin/video/video_output.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace pangolin
+{
+
+// Records raw frames at the full rate of the disks they're written to.
+// Each stream is written to a file of its own, perhaps on a different
+// disk, by a thread of its own, in fixed size slots which are preallocated
+// ahead of time and, with O_DIRECT, block aligned and unbuffered. Capture
+// times, frame properties and where each frame lies within the stream
+// files go to a small index, a pango log which PangoVideo and
+// PlaybackSession open like any other. Stream files are named in the
+// index by absolute path, so should stay where they were recorded.
+class PANGOLIN_EXPORT RawFilesVideoOutput : public VideoOutputInterface
+{
+public:
+    // Stream i of index_filename 'dir/name.pango' is written to
+    // dirs[i % dirs.size()]/name.i.raw, or into dir if dirs is empty.
+    // Files grow prealloc_frames at a time, and up to queue frames of
+    // each stream wait to be written before WriteStreams blocks.
+    RawFilesVideoOutput(const std::string& index_filename, const std::vector<std::string>& dirs,
+                        size_t prealloc_frames = 256, bool direct = true, size_t queue = 8);
+    ~RawFilesVideoOutput();
+
+    const std::vector<StreamInfo>& Streams() const override;
+    void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri, const picojson::value& device_properties) override;
+    int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
+    int WriteStreams(const unsigned char* data, const FrameMetadata& metadata) override;
+    bool IsPipe() const override;
+
+    // Frames of which every stream has been written
+    size_t FramesWritten() const;
+
+    // Block until every frame passed to WriteStreams has been written
+    void Flush();
+
+protected:
+    struct StreamFile;
+
+    int WriteFrame(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta);
+    void WriteLoop(StreamFile& file);
+    void StopWriters();
+
+    std::string index_filename;
+    std::vector<std::string> dirs;
+    size_t prealloc_frames;
+    bool direct;
+    size_t queue;
+
+    std::vector<StreamInfo> streams;
+    PacketStreamWriter index;
+    int index_srcid;
+    size_t frames;
+    std::vector<uint64_t> packet;
+
+    std::vector<std::unique_ptr<StreamFile>> files;
+    mutable std::mutex write_mutex;
+    std::condition_variable write_cv;
+    std::condition_variable done_cv;
+    std::exception_ptr write_error;
+    bool write_quit;
+};
+
+}
@@ -5,10 +5,16 @@
 #include <pangolin/video/video.h>
 
 #include <pangolin/video/iostream_operators.h>
+#include <pangolin/video/frame_pool.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
 namespace rs {
 class context;
 class device;
+class frame;
 }
 
 namespace pangolin
@@ -19,8 +25,12 @@ struct RealSenseVideo : public VideoInterface, public VideoPropertiesInterface,
 {
 public:
 
-    // Open all RGB and Depth streams from all devices
-    RealSenseVideo(ImageDim dim=ImageDim(640,480), int fps=30);
+    // Open all RGB and Depth streams from all devices, or those listed in
+    // devices by index or serial number. Each device delivers frames through
+    // callbacks into queues of at most queue frames per stream, dropping the
+    // oldest. With native, colour is passed through as captured (YUYV422)
+    // rather than converted to RGB24 on the host.
+    RealSenseVideo(ImageDim dim=ImageDim(640,480), int fps=30, const std::vector<std::string>& devices = std::vector<std::string>(), bool native = false, size_t queue = 4);
 
     // Open streams specified
     // TODO
@@ -66,6 +76,33 @@ public:
     size_t Seek(size_t frameid) override;
 
 protected:
+    struct Capture
+    {
+        std::shared_ptr<FramePool::Buffer> buffer;
+        int64_t hw_time_us;
+        int64_t host_time_us;
+        int64_t capture_time_us;
+        uint64_t frame_number;
+        picojson::value metadata;
+    };
+
+    // Hardware timestamps run on each device's own clock. Track the smallest
+    // host minus device offset seen, allowing for drift, to map them onto
+    // the host clock with the transfer latency taken out.
+    struct DeviceClock
+    {
+        DeviceClock() : valid(false), offset_us(0.0), last_hw_us(0) {}
+        int64_t ToHost(int64_t hw_us, int64_t host_us);
+
+        bool valid;
+        double offset_us;
+        int64_t last_hw_us;
+    };
+
+    void OnFrame(size_t stream, size_t dev, rs::frame& f);
+    bool PopFrames(std::vector<Capture>& frames, bool newest, bool wait);
+    bool GrabFrames(unsigned char* image, bool newest, bool wait);
+
     size_t sizeBytes;
 
     std::vector<StreamInfo> streams;
@@ -82,6 +119,13 @@ protected:
 
     ImageDim  dim_;
     size_t fps_;
+    size_t queue_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::deque<Capture>> captured_;
+    std::vector<DeviceClock> clocks_;
+    size_t dropped_;
 };
 
 }
@@ -0,0 +1,145 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/utils/picojson.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pangolin
+{
+
+class VideoInput;
+
+// Synchronised recording over several machines. Each machine records its
+// own VideoInput to a pango:// file, driven by a RecordNode connected over
+// tcp to one RecordCoordinator. The coordinator's clock is the shared time
+// base: it estimates each node's clock offset from the round trip of a
+// handful of pings (keeping the quickest, as NTP does), and has every node
+// start and stop on the same instant of that base. Nodes stamp their offset
+// into the header of their recording, so that opening all the files
+// together through the default PlaybackSession, e.g.
+// "join://{pango:[OrderedPlayback=1]//a.pango}{pango:[OrderedPlayback=1]//b.pango}",
+// plays them back aligned (see PlaybackSession).
+//
+// Messages are a uint32 length (host order) followed by that many bytes of
+// JSON, with "cmd" one of:
+//   node:  {"cmd":"hello", "node":name}
+//   coord: {"cmd":"ping"}        node: {"cmd":"pong", "time_us":t}
+//   coord: {"cmd":"record", "start_us":t, "clock_offset_us":o, "session":s}
+//   coord: {"cmd":"stop", "stop_us":t, "clock_offset_us":o}
+// with times on the coordinator's clock, and o the coordinator's clock
+// minus the node's.
+
+struct PANGOLIN_EXPORT RecordNodeInfo
+{
+    std::string name;
+    int64_t clock_offset_us;    // coordinator's clock minus the node's
+    int64_t rtt_us;             // round trip of the ping the offset is from
+};
+
+class PANGOLIN_EXPORT RecordCoordinator
+{
+public:
+    // Listen for nodes on address ("host:port", ":port" or "port")
+    RecordCoordinator(const std::string& address);
+    ~RecordCoordinator();
+
+    // Wait until at least n nodes have connected, false on timeout
+    bool WaitForNodes(size_t n, double timeout_s);
+
+    // Nodes connected, as of their last clock estimate
+    std::vector<RecordNodeInfo> Nodes() const;
+
+    // Re-estimate every node's clock, then have them all start recording at
+    // lead_s from now, which must cover the slowest node's round trip.
+    // Returns the start time on the coordinator's clock (TimeNow_us), for a
+    // VideoInput on this machine to ScheduleRecording() with offset 0.
+    // Nodes which fail to answer are dropped.
+    int64_t Record(double lead_s = 0.5);
+
+    // Have every node stop recording at lead_s from now, returning the stop time
+    int64_t Stop(double lead_s = 0.5);
+
+    // Name of the current (or last) recording, stamped into every node's file
+    std::string Session() const;
+
+protected:
+    struct Connection;
+
+    void AcceptLoop();
+    // Clock offset of the node on fd, false if it failed to answer
+    static bool Measure(int fd, RecordNodeInfo& info);
+    // Send msg, with each node's clock_offset_us, to every node, dropping
+    // those which fail. Caller holds mutex.
+    void Broadcast(picojson::value msg);
+
+    int fd;
+    std::thread accept_thread;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<Connection>> nodes;
+    std::string session;
+    bool quit;
+};
+
+// Records video as scheduled by the RecordCoordinator at address, from a
+// thread of its own which (re)connects until destroyed. video must outlive
+// the node, and be grabbed from for recording to start and stop.
+class PANGOLIN_EXPORT RecordNode
+{
+public:
+    RecordNode(VideoInput& video, const std::string& address, const std::string& name);
+    ~RecordNode();
+
+    bool Connected() const;
+
+protected:
+    void Run();
+    // Serve one connection until it fails or we quit
+    void Serve(int fd);
+
+    VideoInput& video;
+    const std::string address;
+    const std::string name;
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    int fd;
+    bool quit;
+};
+
+}
@@ -0,0 +1,134 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/pangolin.h>
+#include <pangolin/image/image_remap.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+
+namespace pangolin
+{
+
+// Pinhole intrinsics and lens distortion of one camera
+struct PANGOLIN_EXPORT CameraCalibration
+{
+    enum DistortionModel
+    {
+        DistortionNone,
+        DistortionRadTan,       // k1, k2, p1, p2, k3 (as OpenCV)
+        DistortionEquidistant   // k1, k2, k3, k4 (as OpenCV fisheye)
+    };
+
+    CameraCalibration();
+
+    static DistortionModel DistortionModelFromString(const std::string& str);
+
+    // Intrinsics for the same camera with images of w x h
+    CameraCalibration Scaled(size_t w, size_t h) const;
+
+    // Distorted normalised coordinates of undistorted (x,y)
+    void Distort(double x, double y, double& xd, double& yd) const;
+
+    // Resolution calibrated at, or 0 for that of the stream
+    size_t width, height;
+    double fx, fy, cx, cy;
+    DistortionModel model;
+    double dist[5];
+    // Rotation from camera to rectified frame (row major), identity by default
+    double R[9];
+};
+
+// Video class undistorting (and optionally rotating, for stereo rectification)
+// every stream of its input. The lookup is tabulated once per stream in fixed
+// point (see RemapImage), so each frame costs one bilinear sample per pixel.
+// With gpu set, frames pass through untouched and viewers are expected to
+// apply Table() on the GPU through GlRemapProcessor instead.
+class PANGOLIN_EXPORT RectifyVideo :
+    public VideoInterface,
+    public VideoFilterInterface,
+    public BufferAwareVideoInterface,
+    public VideoStageTimer
+{
+public:
+    // calib holds one calibration per stream, or one for all of them. The
+    // rectified streams have the same intrinsics as their input, with focal
+    // lengths multiplied by zoom. Rows are split across threads (0 for one
+    // per core).
+    RectifyVideo(std::unique_ptr<VideoInterface>& videoin, const std::vector<CameraCalibration>& calib, double zoom = 1.0, size_t threads = 1, bool gpu = false);
+    ~RectifyVideo();
+
+    // Calibrations from a json file holding one object (or an array, or an
+    // object with a "cameras" array) with members width, height, fx, fy, cx,
+    // cy, model ("none", "radtan" or "equidistant"), distortion (array) and R
+    // (array of 9, row major).
+    static std::vector<CameraCalibration> LoadCalibration(const std::string& filename);
+
+    //! Output to input lookup of stream
+    const RemapTable& Table(size_t stream) const;
+
+    //! True iff frames pass through for rectification on the GPU
+    bool GpuRemap() const;
+
+    //! Implement VideoInput::Start()
+    void Start();
+
+    //! Implement VideoInput::Stop()
+    void Stop();
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoFilterInterface method
+    std::vector<VideoInterface*>& InputStreams();
+
+    uint32_t AvailableFrames() const;
+
+    bool DropNFrames(uint32_t n);
+
+protected:
+    void Process(unsigned char* image, const unsigned char* buffer);
+
+    std::unique_ptr<VideoInterface> src;
+    std::vector<VideoInterface*> videoin;
+    std::vector<StreamInfo> streams;
+    std::vector<RemapTable> tables;
+    size_t size_bytes;
+    size_t threads;
+    bool gpu;
+};
+
+}
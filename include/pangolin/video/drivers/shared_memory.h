@@ -4,6 +4,7 @@
 #include <pangolin/video/video.h>
 #include <pangolin/utils/posix/condition_variable.h>
 #include <pangolin/utils/posix/shared_memory_buffer.h>
+#include <pangolin/video/drivers/shared_memory_ring.h>
 
 #include <memory>
 #include <vector>
@@ -11,12 +12,22 @@
 namespace pangolin
 {
 
-class SharedMemoryVideo : public VideoInterface
+class SharedMemoryVideo : public VideoInterface, public VideoLeaseInterface, public VideoPropertiesInterface
 {
 public:
+  //! Single frame segment of w x h pix_fmt, written under its file lock.
   SharedMemoryVideo(size_t w, size_t h, std::string pix_fmt,
     const std::shared_ptr<SharedMemoryBufferInterface>& shared_memory,
     const std::shared_ptr<ConditionVariableInterface>& buffer_full);
+
+  //! Multi-slot ring from SharedMemoryVideoOutput (see shared_memory_ring.h),
+  //! which describes its own streams. Frames of a CUDA ring are leased in
+  //! place as device memory only with device_leases, for consumers which
+  //! expect it. Otherwise they are copied out, into host or device memory.
+  SharedMemoryVideo(
+    const std::shared_ptr<SharedMemoryBufferInterface>& shared_memory,
+    const std::shared_ptr<ConditionVariableInterface>& buffer_full,
+    bool device_leases = false);
   ~SharedMemoryVideo();
 
   size_t SizeBytes() const;
@@ -26,12 +37,42 @@ public:
   bool GrabNext(unsigned char *image, bool wait);
   bool GrabNewest(unsigned char *image, bool wait);
 
+  //! Lease the frame in place. For a ring, the producer is only blocked if
+  //! it comes round to the leased slot before the lease is released. For a
+  //! single frame segment it is blocked until then.
+  FrameLease GrabNextLease(bool wait = true);
+  FrameLease GrabNewestLease(bool wait = true);
+
+  //! Implement VideoPropertiesInterface
+  const picojson::value& DeviceProperties() const;
+  const picojson::value& FrameProperties() const;
+
 private:
+  bool WaitForFrame(bool wait);
+  bool WaitForRingFrame(bool wait);
+  uint64_t NextRingFrame(bool newest) const;
+  std::string RingSlotProperties(shmem_ring_slot* slot) const;
+  void ReadRingProperties(const std::string& props, int64_t timestamp_us);
+  bool ReadRing(unsigned char* image, bool newest, bool wait);
+  FrameLease LeaseRing(bool newest, bool wait);
+  void OpenDeviceFrames(const picojson::value& layout);
+  unsigned char* SlotFrame(uint64_t frame_seq, shmem_ring_slot* slot) const;
+  void CopyFrame(unsigned char* image, const unsigned char* frame) const;
+
   PixelFormat _fmt;
   size_t _frame_size;
   std::vector<StreamInfo> _streams;
   std::shared_ptr<SharedMemoryBufferInterface> _shared_memory;
   std::shared_ptr<ConditionVariableInterface> _buffer_full;
+
+  bool _ring;
+  uint64_t _next_seq;
+  bool _device_leases;
+  // Frames of a CUDA ring, mapped from the producer
+  std::shared_ptr<unsigned char> _cuda_frames;
+  size_t _cuda_slot_bytes;
+  picojson::value _device_properties;
+  picojson::value _frame_properties;
 };
 
 }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <pangolin/video/video_output.h>
+#include <pangolin/utils/posix/condition_variable.h>
+#include <pangolin/utils/posix/shared_memory_buffer.h>
+#include <pangolin/video/drivers/shared_memory_ring.h>
+
+#include <memory>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Publish frames to a named shared memory ring for SharedMemoryVideo
+//! ("shmem://name") consumers in other processes. Any number of consumers
+//! can attach, and consumers leasing frames read them in place.
+class SharedMemoryVideoOutput : public VideoOutputInterface
+{
+public:
+  //! With cuda, frames are held in device memory shared by CUDA IPC handle
+  //! (see shared_memory_ring.h), which needs Pangolin built with CUDA.
+  SharedMemoryVideoOutput(const std::string& name, size_t num_slots, size_t props_bytes, double pin_timeout_s = 1.0, bool cuda = false);
+  ~SharedMemoryVideoOutput();
+
+  const std::vector<StreamInfo>& Streams() const override;
+  void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri, const picojson::value& properties) override;
+  int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
+  bool IsPipe() const override;
+
+  //! Next slot's frame buffer, laid out as the streams passed to SetStreams,
+  //! so that producers can capture or render straight into shared memory.
+  //! Consumers see the frame once PublishFrame is called. For a CUDA ring
+  //! this is device memory, and PublishFrame synchronizes the device first.
+  unsigned char* BeginFrame();
+  int PublishFrame(const picojson::value& frame_properties = picojson::value());
+
+private:
+  void WaitForReaders(shmem_ring_slot* slot);
+  void AllocateDeviceFrames(picojson::value& layout);
+  unsigned char* SlotFrame(uint64_t frame_seq, shmem_ring_slot* slot);
+
+  std::string _name;
+  size_t _num_slots;
+  size_t _props_bytes;
+  double _pin_timeout_s;
+  size_t _frame_size;
+  uint64_t _write_seq;
+  bool _writing;
+  bool _warned_props;
+  bool _cuda;
+  unsigned char* _cuda_frames;
+  size_t _cuda_slot_bytes;
+  std::vector<StreamInfo> _streams;
+  std::shared_ptr<SharedMemoryBufferInterface> _shared_memory;
+  std::shared_ptr<ConditionVariableInterface> _buffer_full;
+};
+
+}
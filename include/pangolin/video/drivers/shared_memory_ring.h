@@ -0,0 +1,139 @@
+#pragma once
+
+#include <pangolin/utils/posix/shared_memory_buffer.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifdef HAVE_CUDA
+#  include <cuda_runtime.h>
+#endif
+
+namespace pangolin
+{
+
+// Shared memory segment holding a ring of video frames:
+//
+//   shmem_ring_header | layout JSON | slot 0 | slot 1 | ... | slot num_slots-1
+//
+// The layout JSON describes the streams within a frame and the device
+// properties. Each slot is a shmem_ring_slot followed by props_bytes of
+// frame properties JSON and then frame_bytes of image data.
+//
+// Frame n is written to slot n % num_slots seqlock style: the slot seq is
+// odd while the producer writes and 2n+2 once frame n is complete, after
+// which write_seq becomes n+1. A reader that sees seq == 2n+2 both before
+// and after copying knows the copy didn't tear. Readers working in place
+// increment the slot's readers count and recheck seq; the producer waits
+// for it to return to zero before overwriting the slot.
+//
+// A ring of device memory (version shmem_ring_version_cuda) keeps its frames
+// in one CUDA allocation of the producer, frame n at offset
+// (n % num_slots) * cuda_slot_bytes, exported by the CUDA IPC handle in the
+// layout JSON ("memory":"cuda"). Slots in the segment then hold only their
+// header and properties, and frames move between processes without copies.
+// Older readers don't recognise such rings.
+
+const char shmem_ring_magic[8] = {'P','A','N','G','R','I','N','G'};
+const uint32_t shmem_ring_version = 1;
+const uint32_t shmem_ring_version_cuda = 2;
+
+struct shmem_ring_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t num_slots;
+  uint64_t frame_bytes;
+  uint64_t props_bytes;
+  uint64_t slot_bytes;
+  uint64_t layout_bytes;
+  uint64_t slots_offset;
+  std::atomic<uint64_t> write_seq;
+};
+
+struct shmem_ring_slot
+{
+  std::atomic<uint64_t> seq;
+  std::atomic<uint32_t> readers;
+  uint32_t props_size;
+  int64_t timestamp_us;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "shared memory ring needs address free 64 bit atomics");
+
+// Slots start on cache line boundaries so that slot headers are not shared
+// with the previous slot's image data.
+inline uint64_t ShmemRingAlign(uint64_t bytes)
+{
+  return (bytes + 63) & ~uint64_t(63);
+}
+
+inline uint64_t ShmemRingSlotBytes(uint64_t frame_bytes, uint64_t props_bytes)
+{
+  return ShmemRingAlign(sizeof(shmem_ring_slot) + props_bytes + frame_bytes);
+}
+
+inline bool IsSharedMemoryRing(SharedMemoryBufferInterface& shared_memory)
+{
+  const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(shared_memory.ptr());
+  const bool is_ring = !std::memcmp(header->magic, shmem_ring_magic, sizeof(shmem_ring_magic))
+      && (header->version == shmem_ring_version || header->version == shmem_ring_version_cuda);
+  // Pairs with the release fence before the producer writes magic
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return is_ring;
+}
+
+inline shmem_ring_slot* ShmemRingSlot(unsigned char* base, uint64_t frame_seq)
+{
+  const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(base);
+  return reinterpret_cast<shmem_ring_slot*>(
+    base + header->slots_offset + (frame_seq % header->num_slots) * header->slot_bytes);
+}
+
+inline char* ShmemRingSlotProps(shmem_ring_slot* slot)
+{
+  return reinterpret_cast<char*>(slot) + sizeof(shmem_ring_slot);
+}
+
+inline unsigned char* ShmemRingSlotData(unsigned char* base, shmem_ring_slot* slot)
+{
+  const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(base);
+  return reinterpret_cast<unsigned char*>(slot) + sizeof(shmem_ring_slot) + header->props_bytes;
+}
+
+#ifdef HAVE_CUDA
+// CUDA IPC handles are opaque bytes, held hex encoded in the layout JSON
+inline std::string ShmemRingEncodeHandle(const cudaIpcMemHandle_t& handle)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&handle);
+  std::string str;
+  for(size_t i=0; i < sizeof(handle); ++i) {
+    str += hex[bytes[i] >> 4];
+    str += hex[bytes[i] & 0xf];
+  }
+  return str;
+}
+
+inline bool ShmemRingDecodeHandle(const std::string& str, cudaIpcMemHandle_t& handle)
+{
+  if(str.size() != 2 * sizeof(handle)) {
+    return false;
+  }
+  unsigned char* bytes = reinterpret_cast<unsigned char*>(&handle);
+  for(size_t i=0; i < sizeof(handle); ++i) {
+    const std::string byte = str.substr(2*i, 2);
+    char* end = nullptr;
+    bytes[i] = (unsigned char)std::strtoul(byte.c_str(), &end, 16);
+    if(end != byte.c_str() + 2) {
+      return false;
+    }
+  }
+  return true;
+}
+#endif
+
+}
@@ -29,17 +29,63 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/fused_row_filter.h>
 
 namespace pangolin
 {
 
-// Video class that debayers its video input using the given method.
-class PANGOLIN_EXPORT ShiftVideo : public VideoInterface, public VideoFilterInterface
+// How 16 bit input is mapped to 8 bits
+enum ShiftMode
+{
+    ShiftModeShift,     // (in >> shift_right_bits) & mask
+    ShiftModeLinear,    // window [min, max] mapped linearly onto [0, 255]
+    ShiftModeGamma,     // as linear, followed by a 1/gamma power curve
+    ShiftModeEqualize   // histogram equalization
+};
+
+struct PANGOLIN_EXPORT ShiftOptions
+{
+    ShiftOptions()
+        : mode(ShiftModeShift), shift_right_bits(0), mask(0xFFFF),
+          auto_range(false), min(0), max(0xFFFF),
+          low_fraction(0.01f), high_fraction(0.99f), gamma(2.2f), decay(0.9f)
+    {
+    }
+
+    ShiftMode mode;
+
+    // For ShiftModeShift
+    int shift_right_bits;
+    unsigned int mask;
+
+    // Window for linear and gamma modes. With auto_range it instead spans
+    // low_fraction to high_fraction of the pixels seen in recent frames.
+    bool auto_range;
+    int min;
+    int max;
+    float low_fraction;
+    float high_fraction;
+
+    float gamma;
+
+    // Weight of earlier frames in the histogram used for auto_range and
+    // equalization, which is updated with each frame.
+    float decay;
+};
+
+// Video class that reduces 16 bit single channel video to 8 bits.
+class PANGOLIN_EXPORT ShiftVideo : public VideoInterface, public VideoFilterInterface, public VideoRowFilterInterface, public VideoStageTimer
 {
 public:
     ShiftVideo(std::unique_ptr<VideoInterface>& videoin, PixelFormat new_fmt, int shift_right_bits = 0, unsigned int mask = 0xFFFF);
+
+    ShiftVideo(std::unique_ptr<VideoInterface>& videoin, PixelFormat new_fmt, const ShiftOptions& options);
+
     ~ShiftVideo();
 
+    static ShiftMode ShiftModeFromString(const std::string& str);
+
     //! Implement VideoInput::Start()
     void Start();
 
@@ -60,14 +106,39 @@ public:
 
     std::vector<VideoInterface*>& InputStreams();
 
+    //! Implement VideoRowFilterInterface::RowFilterInputRow()
+    size_t RowFilterInputRow(size_t stream, size_t y) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterProcess()
+    void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
 protected:
+    // Mapping of one stream, updated at the end of each frame for modes
+    // which depend on what's been seen.
+    struct StreamMap
+    {
+        uint16_t lo;                    // window
+        uint16_t hi;
+        std::vector<uint8_t> lut;       // empty when applied directly by kernel
+        std::vector<uint32_t> frame_hist;
+        std::vector<float> hist;        // decayed over frames
+        size_t row;                     // rows processed of current frame
+    };
+
+    void Init(PixelFormat out_fmt);
+
+    void ProcessRow(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
+    void UpdateMap(size_t stream);
+
     std::unique_ptr<VideoInterface> src;
     std::vector<VideoInterface*> videoin;
     std::vector<StreamInfo> streams;
     size_t size_bytes;
-    unsigned char* buffer;
-    int shift_right_bits;
-    unsigned int mask;
+    ShiftOptions options;
+    std::vector<StreamMap> maps;
+
+    std::unique_ptr<FusedRowFilter> fused;
 };
 
 }
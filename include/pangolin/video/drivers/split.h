@@ -33,8 +33,10 @@
 namespace pangolin
 {
 
+// Describe regions of the input buffer as separate streams. Frames are
+// passed through untouched, so each stream is a view over the input frame.
 class PANGOLIN_EXPORT SplitVideo
-    : public VideoInterface, public VideoFilterInterface
+    : public VideoInterface, public VideoFilterInterface, public VideoLeaseInterface
 {
 public:
     SplitVideo(std::unique_ptr<VideoInterface>& videoin, const std::vector<StreamInfo>& streams);
@@ -54,7 +56,11 @@ public:
     bool GrabNewest( unsigned char* image, bool wait = true );
 
     std::vector<VideoInterface*>& InputStreams();
-    
+
+    FrameLease GrabNextLease( bool wait = true );
+
+    FrameLease GrabNewestLease( bool wait = true );
+
 protected:
     std::unique_ptr<VideoInterface> src;
     std::vector<VideoInterface*> videoin;
@@ -0,0 +1,189 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace pangolin
+{
+
+class TeeVideo;
+
+// Frame grabbed once by a TeeHub and shared by each of its consumers
+struct TeeFrame
+{
+    FrameLease lease;
+    bool native_metadata;
+    FrameMetadata metadata;
+    picojson::value frame_properties;
+};
+
+// Grabs frames from one upstream video on a thread of its own, handing every
+// consumer attached a reference to each frame, so that N consumers cost one
+// capture and no copies. Frames are returned upstream once all consumers
+// have released them.
+class PANGOLIN_EXPORT TeeHub : public std::enable_shared_from_this<TeeHub>
+{
+public:
+    TeeHub(std::unique_ptr<VideoInterface>& videoin);
+    ~TeeHub();
+
+    // New consumer queueing up to depth frames. Once full, its oldest frame
+    // is dropped for it alone, so that slow consumers don't stall the others.
+    std::unique_ptr<TeeVideo> AddConsumer(size_t depth);
+
+    VideoInterface& Source();
+
+    // Hub previously opened with "tee:[name=...]", or null
+    static std::shared_ptr<TeeHub> Named(const std::string& name);
+
+    // Make hub available to tee URIs with this name whilst it exists
+    static void SetNamed(const std::string& name, const std::shared_ptr<TeeHub>& hub);
+
+protected:
+    friend class TeeVideo;
+
+    // Called by consumers as they are started and stopped. The grab thread
+    // runs whilst any consumer is started.
+    void ConsumerStarted();
+    void ConsumerStopped();
+
+    void Attach(TeeVideo* consumer);
+    void Detach(TeeVideo* consumer);
+
+    void GrabLoop();
+
+    std::unique_ptr<VideoInterface> src;
+
+    std::mutex consumers_mutex;
+    std::vector<TeeVideo*> consumers;
+
+    std::mutex thread_mutex;
+    size_t started_consumers;
+    std::atomic<bool> quit_grab_thread;
+    std::thread grab_thread;
+};
+
+// Consumer endpoint of a TeeHub with its own queue, from which frames can be
+// grabbed next or newest independently of other consumers.
+class PANGOLIN_EXPORT TeeVideo :
+    public VideoInterface,
+    public VideoPropertiesInterface,
+    public VideoFrameMetadataInterface,
+    public BufferAwareVideoInterface,
+    public VideoFilterInterface,
+    public VideoLeaseInterface,
+    public VideoStageTimer
+{
+public:
+    TeeVideo(const std::shared_ptr<TeeHub>& hub, size_t depth);
+    ~TeeVideo();
+
+    //! Hub this consumer is attached to, for adding further consumers
+    std::shared_ptr<TeeHub> Hub() const;
+
+    //! Implement VideoInput::Start()
+    void Start();
+
+    //! Implement VideoInput::Stop()
+    void Stop();
+
+    //! Implement VideoInput::SizeBytes()
+    size_t SizeBytes() const;
+
+    //! Implement VideoInput::Streams()
+    const std::vector<StreamInfo>& Streams() const;
+
+    //! Implement VideoInput::GrabNext()
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Implement VideoInput::GrabNewest()
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
+    const picojson::value& DeviceProperties() const;
+
+    const picojson::value& FrameProperties() const;
+
+    //! Implement VideoFrameMetadataInterface::Metadata()
+    const FrameMetadata& Metadata() const;
+
+    //! Implement VideoFrameMetadataInterface::HasNativeMetadata()
+    bool HasNativeMetadata() const;
+
+    uint32_t AvailableFrames() const;
+
+    bool DropNFrames(uint32_t n);
+
+    std::vector<VideoInterface*>& InputStreams();
+
+protected:
+    friend class TeeHub;
+
+    // Called from the hubs grab thread with each new frame
+    void Push(const std::shared_ptr<TeeFrame>& frame);
+
+    // Wait for a frame if need be, returning false if there is none
+    bool WaitForFrame(std::unique_lock<std::mutex>& l, bool wait);
+
+    FrameLease LeaseFrame(const std::shared_ptr<TeeFrame>& frame);
+
+    std::shared_ptr<TeeHub> hub;
+    std::vector<VideoInterface*> videoin;
+    const size_t depth;
+
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_cond;
+    std::deque<std::shared_ptr<TeeFrame>> queue;
+    bool started;
+
+    mutable picojson::value device_properties;
+
+    // Whichever of these the input doesn't provide is converted on demand
+    bool native_metadata;
+    mutable FrameMetadata metadata;
+    mutable picojson::value frame_properties;
+    mutable bool metadata_stale;
+    mutable bool properties_stale;
+};
+
+}
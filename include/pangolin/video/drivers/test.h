@@ -33,11 +33,32 @@
 namespace pangolin
 {
 
+enum class TestPattern
+{
+    Random,     // fresh noise every frame
+    Gradient,   // diagonal colour gradient, scrolling down each frame
+    Bars        // colour bars, scrolling down each frame
+};
+
 // Video class that outputs test video signal.
-class PANGOLIN_EXPORT TestVideo : public VideoInterface
+class PANGOLIN_EXPORT TestVideo : public VideoInterface, public VideoPropertiesInterface, public VideoFrameMetadataInterface
 {
 public:
     TestVideo(size_t w, size_t h, size_t n, std::string pix_fmt);
+
+    // Emulate a camera producing streams (laid out by their offsets).
+    // With fps > 0, frame i is captured at exactly offset_us + i/fps after
+    // Start() and received latency_us plus up to jitter_us (uniformly
+    // distributed) later. In realtime, GrabNext waits for each frame's
+    // reception time; otherwise frames are returned as fast as they're
+    // asked for, with the same timestamps. Single channel streams with a
+    // bayer tile (e.g. RGGB) carry the pattern as a colour filter mosaic.
+    // Content and jitter are reproducible for a given seed.
+    TestVideo(
+        const std::vector<StreamInfo>& streams, TestPattern pattern = TestPattern::Random, const std::string& bayer = "",
+        double fps = 0.0, double jitter_us = 0.0, double latency_us = 0.0, double offset_us = 0.0,
+        bool realtime = true, uint64_t seed = 0
+    );
     ~TestVideo();
     
     //! Implement VideoInput::Start()
@@ -57,10 +78,55 @@ public:
     
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true ) override;
-    
+
+    //! Implement VideoPropertiesInterface::DeviceProperties()
+    const picojson::value& DeviceProperties() const override {
+        return device_properties;
+    }
+
+    //! Implement VideoPropertiesInterface::FrameProperties()
+    const picojson::value& FrameProperties() const override {
+        if(properties_stale) {
+            frame_properties = picojson::value();
+            metadata.AddToJson(frame_properties);
+            properties_stale = false;
+        }
+        return frame_properties;
+    }
+
+    //! Implement VideoFrameMetadataInterface::Metadata()
+    const FrameMetadata& Metadata() const override {
+        return metadata;
+    }
+
 protected:
+    void RenderTemplate(size_t s);
+    void RenderFrame(unsigned char* image);
+    int64_t CaptureTime(uint64_t frame) const;
+    int64_t ReceptionTime(uint64_t frame) const;
+
     std::vector<StreamInfo> streams;
     size_t size_bytes;
+
+    TestPattern pattern;
+    std::string bayer;
+    double period_us;
+    double jitter_us;
+    double latency_us;
+    double offset_us;
+    bool realtime;
+    uint64_t seed;
+
+    // Scrolling patterns copy from a template twice the height of each stream
+    std::vector<std::vector<unsigned char>> templates;
+
+    int64_t start_us;
+    uint64_t frame;
+    picojson::value device_properties;
+    FrameMetadata metadata;
+    // JSON view of metadata, built on request
+    mutable picojson::value frame_properties;
+    mutable bool properties_stale;
 };
 
 }
@@ -29,9 +29,12 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/frame_pool.h>
 
 #include <memory>
 #include <pangolin/utils/fix_size_buffer_queue.h>
+#include <pangolin/utils/thread_affinity.h>
 
 namespace pangolin
 {
@@ -39,10 +42,15 @@ namespace pangolin
 
 // Video class that creates a thread that keeps pulling frames and processing from its children.
 class PANGOLIN_EXPORT ThreadVideo :  public VideoInterface, public VideoPropertiesInterface,
-        public BufferAwareVideoInterface, public VideoFilterInterface
+        public VideoFrameMetadataInterface,
+        public BufferAwareVideoInterface, public VideoFilterInterface,
+        public VideoLeaseInterface, public VideoStageTimer
 {
 public:
-    ThreadVideo(std::unique_ptr<VideoInterface>& videoin, size_t num_buffers);
+    // With pinned, frame buffers are page locked (cudaHostAlloc with
+    // HAVE_CUDA) so that leased frames can be uploaded asynchronously.
+    ThreadVideo(std::unique_ptr<VideoInterface>& videoin, size_t num_buffers,
+                const ThreadPlacement& placement = ThreadPlacement(), bool pinned = false);
     ~ThreadVideo();
 
     //! Implement VideoInput::Start()
@@ -63,10 +71,22 @@ public:
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
     const picojson::value& DeviceProperties() const;
 
     const picojson::value& FrameProperties() const;
 
+    //! Implement VideoFrameMetadataInterface::Metadata()
+    const FrameMetadata& Metadata() const;
+
+    //! Implement VideoFrameMetadataInterface::HasNativeMetadata()
+    bool HasNativeMetadata() const;
+
     uint32_t AvailableFrames() const;
 
     bool DropNFrames(uint32_t n);
@@ -76,11 +96,19 @@ public:
     std::vector<VideoInterface*>& InputStreams();
 
 protected:
+    bool WaitForFrame(bool wait);
+
     struct GrabResult
     {
-        GrabResult(const size_t buffer_size)
-            : return_status(false),
-              buffer(new unsigned char[buffer_size])
+        // Empty result, used for pre-allocated queue slots.
+        GrabResult()
+            : return_status(false), native_metadata(false)
+        {
+        }
+
+        GrabResult(FramePool::Buffer&& buffer)
+            : return_status(false), native_metadata(false),
+              buffer(std::move(buffer))
         {
         }
 
@@ -90,23 +118,43 @@ protected:
         // Default move constructor
         GrabResult(GrabResult&& o) = default;
 
+        // Default move assignment
+        GrabResult& operator=(GrabResult&& o) = default;
+
         bool return_status;
-        std::unique_ptr<unsigned char[]> buffer;
+        bool native_metadata;
+        FramePool::Buffer buffer;
+        // JSON properties are only captured from inputs without native metadata
+        FrameMetadata metadata;
         picojson::value frame_properties;
     };
 
     std::unique_ptr<VideoInterface> src;
     std::vector<VideoInterface*> videoin;
 
+    FrameLease LeaseSlot(GrabResult&& grab);
+
+    void AllocateBuffers(size_t num_buffers);
+
     bool quit_grab_thread;
-    FixSizeBuffersQueue<GrabResult> queue;
 
-    std::condition_variable cv;
-    std::mutex cvMtx;
+    // Owns the frame buffers, so must outlive queue
+    FramePool buffer_pool;
+    FixSizeBuffersRing<GrabResult> queue;
+
     std::thread grab_thread;
 
+    ThreadPlacement placement;
+    std::vector<unsigned char*> locked_buffers;
+
     mutable picojson::value device_properties;
-    picojson::value frame_properties;
+
+    // Whichever of these the input doesn't provide is converted on demand
+    bool native_metadata;
+    mutable FrameMetadata metadata;
+    mutable picojson::value frame_properties;
+    mutable bool metadata_stale;
+    mutable bool properties_stale;
 };
 
 }
@@ -29,6 +29,8 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video/video.h>
+#include <pangolin/video/video_stage_timer.h>
+#include <pangolin/video/fused_row_filter.h>
 
 namespace pangolin
 {
@@ -37,10 +39,12 @@ namespace pangolin
 class PANGOLIN_EXPORT UnpackVideo :
     public VideoInterface,
     public VideoFilterInterface,
-    public BufferAwareVideoInterface
+    public VideoRowFilterInterface,
+    public BufferAwareVideoInterface,
+    public VideoStageTimer
 {
 public:
-    UnpackVideo(std::unique_ptr<VideoInterface>& videoin, PixelFormat new_fmt);
+    UnpackVideo(std::unique_ptr<VideoInterface>& videoin, PixelFormat new_fmt, size_t threads = 1);
     ~UnpackVideo();
 
     //! Implement VideoInput::Start()
@@ -64,6 +68,12 @@ public:
     //! Implement VideoFilterInterface method
     std::vector<VideoInterface*>& InputStreams();
 
+    //! Implement VideoRowFilterInterface::RowFilterInputRow()
+    size_t RowFilterInputRow(size_t stream, size_t y) const;
+
+    //! Implement VideoRowFilterInterface::RowFilterProcess()
+    void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row);
+
     uint32_t AvailableFrames() const;
 
     bool DropNFrames(uint32_t n);
@@ -71,11 +81,15 @@ public:
 protected:
     void Process(unsigned char* image, const unsigned char* buffer);
 
+    void ProcessStream(size_t s, Image<unsigned char>& img_out, const Image<unsigned char>& img_in, size_t threads);
+
     std::unique_ptr<VideoInterface> src;
     std::vector<VideoInterface*> videoin;
     std::vector<StreamInfo> streams;
     size_t size_bytes;
-    unsigned char* buffer;
+    size_t threads;
+
+    std::unique_ptr<FusedRowFilter> fused;
 
     picojson::value device_properties;
     picojson::value frame_properties;
@@ -41,13 +41,38 @@ typedef struct timeval {
 
 #include <libuvc/libuvc.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 namespace pangolin
 {
 
-class PANGOLIN_EXPORT UvcVideo : public VideoInterface, public VideoUvcInterface, public VideoPropertiesInterface
+struct PANGOLIN_EXPORT UvcOptions
+{
+    UvcOptions()
+        : queue_frames(2), max_payload_bytes(0)
+    {
+    }
+
+    // Frames held by the driver before the oldest is dropped
+    size_t queue_frames;
+
+    // Cap on bytes per isochronous packet requested from the device, which
+    // selects a lower bandwidth alternate setting. 0 uses the device value.
+    uint32_t max_payload_bytes;
+};
+
+// Frames are delivered by libuvc's transfer thread into a short driver queue,
+// dropping the oldest when the consumer falls behind. MJPEG modes are decoded
+// to RGB24 on a separate worker thread.
+class PANGOLIN_EXPORT UvcVideo : public VideoInterface, public VideoUvcInterface, public VideoPropertiesInterface,
+        public BufferAwareVideoInterface, public VideoLeaseInterface
 {
 public:
-    UvcVideo(int vendor_id, int product_id, const char* sn, int deviceid, int width, int height, int fps);
+    UvcVideo(int vendor_id, int product_id, const char* sn, int deviceid, int width, int height, int fps,
+             const UvcOptions& options = UvcOptions());
     ~UvcVideo();
     
     void InitDevice(int vid, int pid, const char* sn, int deviceid, int width, int height, int fps);
@@ -71,6 +96,18 @@ public:
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
+    //! Implement BufferAwareVideoInterface::AvailableFrames()
+    uint32_t AvailableFrames() const;
+
+    //! Implement BufferAwareVideoInterface::DropNFrames()
+    bool DropNFrames(uint32_t n);
+
     //! Implement VideoUvcInterface::GetCtrl()
     int IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, UvcRequestCode req_code);
 
@@ -81,23 +118,51 @@ public:
     const picojson::value& FrameProperties() const;
 
 protected:
+    struct QueuedFrame
+    {
+        std::shared_ptr<FramePool::Buffer> buffer;
+        size_t size_bytes;
+        int64_t host_reception_time_us;
+    };
+
     void InitPangoDeviceProperties();
     static uvc_error_t FindDevice(
         uvc_context_t *ctx, uvc_device_t **dev,
         int vid, int pid, const char *sn, int device_id);
 
+    static void FrameCallback(uvc_frame_t* frame, void* user_ptr);
+
+    void DecodeLoop();
+
+    // Push onto a bounded queue, dropping the oldest frame if it is full.
+    void Push(std::deque<QueuedFrame>& queue, QueuedFrame&& frame);
+
+    bool WaitForFrame(std::unique_lock<std::mutex>& lock, bool wait);
+
+    // Called with queue_mutex held
+    FrameLease PopFront();
+
     std::vector<StreamInfo> streams;
     size_t size_bytes;
-    
+    UvcOptions options;
+    bool decode_mjpeg;
+
     uvc_context* ctx_;
     uvc_device*  dev_;
     uvc_device_handle* devh_;
     uvc_stream_handle* strm_;
     uvc_stream_ctrl_t ctrl_;
-    uvc_frame_t* frame_;
     picojson::value device_properties;
     picojson::value frame_properties;
     bool is_streaming;
+
+    // Compressed frames waiting on the decode thread, and frames ready to grab
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_cond;
+    std::deque<QueuedFrame> compressed;
+    std::deque<QueuedFrame> ready;
+    bool quit_decode;
+    std::thread decode_thread;
 };
 
 }
@@ -4,20 +4,50 @@
 #include <pangolin/video/video.h>
 #include <pangolin/video/video_interface.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 struct IMFActivate;
 struct IMFMediaSource;
 struct IMFSourceReader;
+struct IMFSample;
+struct IMFDXGIDeviceManager;
+struct ID3D11Device;
 struct IBaseFilter;
 struct IKsControl;
 
 namespace pangolin
 {
 
+struct UvcMediaFoundationOptions
+{
+    UvcMediaFoundationOptions()
+        : async(true), queue(4), hw_decode(true)
+    {
+    }
+
+    // Read through an IMFSourceReaderCallback, keeping the next read in
+    // flight while frames wait in the driver's queue. Otherwise every grab
+    // blocks on a synchronous ReadSample.
+    bool async;
+
+    // Samples held by the driver in async mode, oldest dropped when full.
+    // Leased samples count against the source reader's own sample pool.
+    size_t queue;
+
+    // Decode MJPEG and H.264 cameras to NV12 with hardware (DXVA) decoders,
+    // falling back to software MFTs when no D3D11 device is available.
+    bool hw_decode;
+};
+
 class PANGOLIN_EXPORT UvcMediaFoundationVideo
-    : public pangolin::VideoInterface, public pangolin::VideoUvcInterface, public pangolin::VideoPropertiesInterface
+    : public pangolin::VideoInterface, public pangolin::VideoUvcInterface, public pangolin::VideoPropertiesInterface,
+      public pangolin::BufferAwareVideoInterface, public pangolin::VideoLeaseInterface
 {
   public:
-    UvcMediaFoundationVideo(int vendorId, int productId, int deviceId, size_t width, size_t height, int fps);
+    UvcMediaFoundationVideo(int vendorId, int productId, int deviceId, size_t width, size_t height, int fps,
+                            const UvcMediaFoundationOptions& options = UvcMediaFoundationOptions());
     ~UvcMediaFoundationVideo();
 
     //! Implement VideoInput::Start()
@@ -38,6 +68,18 @@ class PANGOLIN_EXPORT UvcMediaFoundationVideo
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest(unsigned char* image, bool wait = true);
 
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease(bool wait = true);
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease(bool wait = true);
+
+    //! Implement BufferAwareVideoInterface::AvailableFrames()
+    uint32_t AvailableFrames() const;
+
+    //! Implement BufferAwareVideoInterface::DropNFrames()
+    bool DropNFrames(uint32_t n);
+
     //! Implement VideoUvcInterface::GetCtrl()
     int IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, pangolin::UvcRequestCode req_code);
 
@@ -48,23 +90,70 @@ class PANGOLIN_EXPORT UvcMediaFoundationVideo
     const picojson::value& FrameProperties() const;
 
   protected:
+    class ReaderCallback;
+    friend class ReaderCallback;
+
+    // Sample delivered by the source reader, with its host arrival time
+    struct QueuedSample
+    {
+        IMFSample* sample;
+        int64_t host_time_us;
+        uint64_t frame_counter;
+    };
+
     bool FindDevice(int vendorId, int productId, int deviceId);
     void InitDevice(size_t width, size_t height, int fps);
     void DeinitDevice();
 
+    // D3D11 device and DXGI manager through which the reader uses DXVA
+    bool CreateDxgiManager();
+
+    // Called by the reader callback on a Media Foundation work queue thread
+    void OnSample(HRESULT status, DWORD flags, IMFSample* sample);
+    void OnFlushed();
+
+    // Issue the next asynchronous ReadSample
+    void RequestSample();
+
+    // Next (or newest) sample, owned by the caller, or false
+    bool NextSample(QueuedSample& next, bool newest, bool wait);
+
+    // Copy sample into image, laid out as streams[0]
+    bool CopySample(IMFSample* sample, unsigned char* image);
+
+    // Lease of s, taking over its reference. Points into the locked media
+    // buffer when that is laid out as streams[0], otherwise at a copy.
+    FrameLease LeaseSample(const QueuedSample& s);
+
+    void SetFrameProperties(const QueuedSample& s);
+
     static bool DeviceMatches(const std::wstring& symLink, int vendorId, int productId);
     static bool SymLinkIDMatches(const std::wstring& symLink, const wchar_t* idStr, int id);
 
     std::vector<pangolin::StreamInfo> streams;
     size_t size_bytes;
+    UvcMediaFoundationOptions options;
 
     IMFMediaSource* mediaSource;
     IMFSourceReader* sourceReader;
+    ReaderCallback* readerCallback;
+    ID3D11Device* d3dDevice;
+    IMFDXGIDeviceManager* dxgiManager;
     IBaseFilter* baseFilter;
     IKsControl* ksControl;
     DWORD ksControlNodeId;
 
+    // Async mode: samples waiting to be grabbed, newest at the back
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_cond;
+    std::deque<QueuedSample> queue;
+    bool streaming;
+    bool read_pending;
+    bool flushing;
+    bool end_of_stream;
+    uint64_t frame_counter;
+
     picojson::value device_properties;
     picojson::value frame_properties;
 };
-}
\ No newline at end of file
+}
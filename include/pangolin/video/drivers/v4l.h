@@ -32,10 +32,36 @@
 
 #include <asm/types.h>
 #include <linux/videodev2.h>
+#include <sys/ioctl.h>
+
+#include <cerrno>
+#include <string>
 
 namespace pangolin
 {
 
+//! ioctl, retried whilst interrupted by signals
+inline int V4lIoctl(int fd, unsigned long request, void* arg)
+{
+    int r;
+    do r = ioctl (fd, request, arg);
+    while (-1 == r && EINTR == errno);
+    return r;
+}
+
+//! Four character code of a V4L2 pixel format, e.g. "YUYV"
+inline std::string V4lToString(int32_t v)
+{
+    //	v = ((__u32)(a) | ((__u32)(b) << 8) | ((__u32)(c) << 16) | ((__u32)(d) << 24))
+    char cc[5];
+    cc[0] = v       & 0xff;
+    cc[1] = (v>>8)  & 0xff;
+    cc[2] = (v>>16) & 0xff;
+    cc[3] = (v>>24) & 0xff;
+    cc[4] = 0;
+    return std::string(cc);
+}
+
 typedef enum {
     IO_METHOD_READ,
     IO_METHOD_MMAP,
@@ -47,10 +73,32 @@ struct buffer {
     size_t length;
 };
 
-class PANGOLIN_EXPORT V4lVideo : public VideoInterface, public VideoUvcInterface, public VideoPropertiesInterface
+//! Image plane of a driver buffer exported as a DMABUF (VIDIOC_EXPBUF), for
+//! importing frames into GL (EGL_EXT_image_dma_buf_import) or CUDA without
+//! touching them on the CPU. Planes are listed per stream, so the Y and UV
+//! planes of NV12 may share a file descriptor at different offsets.
+struct V4lDmaBufPlane {
+    int    fd;      //!< Owned by V4lVideo, dup() to keep it beyond the device
+    size_t offset;  //!< Start of the plane within fd
+    size_t pitch;
+    size_t length;  //!< Bytes of this plane
+};
+
+struct V4lDmaBufFrame {
+    //! Holds the buffer out of the driver queue until released. Points at
+    //! the first plane, which is the whole frame unless the format has
+    //! several memory planes (e.g. NV12M).
+    FrameLease lease;
+    std::vector<V4lDmaBufPlane> planes;
+};
+
+class PANGOLIN_EXPORT V4lVideo : public VideoInterface, public VideoUvcInterface, public VideoPropertiesInterface,
+    public VideoFrameMetadataInterface, public VideoLeaseInterface, public VideoReadoutInterface
 {
 public:
-    V4lVideo(const char* dev_name, io_method io = IO_METHOD_MMAP, unsigned iwidth=0, unsigned iheight=0);
+    //! v4l_format fourcc, 0 to keep the device's current format.
+    //! num_buffers driver buffers are requested for mmap / userptr I/O.
+    V4lVideo(const char* dev_name, io_method io = IO_METHOD_MMAP, unsigned iwidth=0, unsigned iheight=0, unsigned v4l_format=0, unsigned num_buffers=4);
     ~V4lVideo();
     
     //! Implement VideoInput::Start()
@@ -71,6 +119,24 @@ public:
     //! Implement VideoInput::GrabNewest()
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Implement VideoLeaseInterface::GrabNextLease()
+    FrameLease GrabNextLease( bool wait = true );
+
+    //! Implement VideoLeaseInterface::GrabNewestLease()
+    FrameLease GrabNewestLease( bool wait = true );
+
+    //! Lease the next frame as DMABUF file descriptors (method=mmap only).
+    //! Buffers are exported on first use; throws if the driver can't.
+    V4lDmaBufFrame GrabNextDmaBuf( bool wait = true );
+
+    //! Implement VideoReadoutInterface::SetReadout(). The window is set
+    //! through the V4L2 selection API, and binning or decimation by asking
+    //! for a format smaller than the window.
+    VideoReadout SetReadout(const VideoReadout& readout);
+
+    //! Implement VideoReadoutInterface::GetReadout()
+    VideoReadout GetReadout() const;
+
     //! Implement VideoUvcInterface::IoCtrl()
     int IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, UvcRequestCode req_code);
 
@@ -78,6 +144,8 @@ public:
 
     void SetGain(double gain);
 
+    //! Device file descriptor, readable (EPOLLIN) when a frame is ready. Add
+    //! it to an epoll set to wait on many sources, then GrabNext(.., false).
     int GetFileDescriptor() const{
         return fd;
     }
@@ -87,19 +155,30 @@ public:
 
     //! Access JSON properties of most recently captured frame
     const picojson::value& FrameProperties() const;
+
+    //! Implement VideoFrameMetadataInterface::Metadata()
+    const FrameMetadata& Metadata() const;
     
 protected:
     void InitPangoDeviceProperties();
 
 
+    bool WaitForFrame(bool wait = true);
+    void SetFrameTiming(const v4l2_buffer& buf);
     int ReadFrame(unsigned char* image);
+    int DequeueFrame(v4l2_buffer& buf, unsigned char*& ptr);
+    int EnqueueFrame(v4l2_buffer& buf);
+    void ExportDmaBufs();
     void Mainloop();
     
     void init_read(unsigned int buffer_size);
-    void init_mmap(const char* dev_name);
-    void init_userp(const char* dev_name, unsigned int buffer_size);
+    void init_mmap(const char* dev_name, unsigned int num_buffers);
+    void init_userp(const char* dev_name, unsigned int buffer_size, unsigned int num_buffers);
     
-    void init_device(const char* dev_name, unsigned iwidth, unsigned iheight, unsigned ifps, unsigned v4l_format = V4L2_PIX_FMT_YUYV, v4l2_field field = V4L2_FIELD_INTERLACED);
+    void init_device(const char* dev_name, unsigned iwidth, unsigned iheight, unsigned ifps, unsigned v4l_format = V4L2_PIX_FMT_YUYV, v4l2_field field = V4L2_FIELD_INTERLACED, unsigned num_buffers = 4);
+    // Allocate buffers and describe streams for fmt, as set on the device
+    void init_format(v4l2_format& fmt);
+    void init_streams(unsigned pixelformat, const unsigned* bytesperline, const unsigned* plane_sizes);
     void uninit_device();
     
     void open_device(const char* dev_name);
@@ -109,16 +188,28 @@ protected:
     
     io_method io;
     int       fd;
+    int       epoll_fd;
+    v4l2_buf_type buf_type;
+    // n_buffers * num_planes, the memory planes of each buffer in turn
     buffer*   buffers;
     unsigned  int n_buffers;
+    unsigned  int num_planes;
+    unsigned  int requested_buffers;
+    // Bytes of each memory plane copied into frames, one after another
+    std::vector<size_t> plane_bytes;
+    std::vector<int> dmabuf_fds;
     bool running;
     unsigned width;
     unsigned height;
     float fps;
     size_t image_size;
+    VideoReadout readout;
 
     picojson::value device_properties;
-    picojson::value frame_properties;
+    FrameMetadata metadata;
+    // JSON view of metadata, built on request
+    mutable picojson::value frame_properties;
+    mutable bool properties_stale;
 };
 
 }
@@ -0,0 +1,89 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/video/video_output.h>
+#include <pangolin/video/drivers/v4l.h>
+
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Writes frames to a V4L2 output device, typically a v4l2loopback device
+//! which other programs (and browsers) then open as a webcam, through
+//! mmap'd driver buffers. A single stream of GRAY8, GRAY16LE, YUYV422,
+//! UYVY422, RGB24 or BGR24 is written as GREY, Y16, YUYV, UYVY, RGB3 or
+//! BGR3, and the GRAY8 luma and Y400A chroma streams of an NV12 v4l:// input
+//! as NV12. Other formats can be converted first, e.g. with convert://.
+class PANGOLIN_EXPORT V4lVideoOutput : public VideoOutputInterface
+{
+public:
+    //! Frames are dropped rather than wait longer than timeout_ms for one of
+    //! num_buffers buffers to come back from the device. fps, if > 0, is
+    //! advertised to readers as the frame interval.
+    V4lVideoOutput(const std::string& dev_name, unsigned num_buffers = 4, double fps = 0.0, int timeout_ms = 100);
+    ~V4lVideoOutput();
+
+    const std::vector<StreamInfo>& Streams() const override;
+    void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri, const picojson::value& device_properties) override;
+    int WriteStreams(const unsigned char* data, const picojson::value& frame_properties) override;
+    bool IsPipe() const override;
+
+    //! Frames dropped because no buffer came back from the device in time
+    size_t DroppedFrames() const;
+
+protected:
+    //! Set the device format for streams, returning its fourcc
+    unsigned SetFormat(const std::vector<StreamInfo>& streams);
+    void InitBuffers();
+    void UninitBuffers();
+    //! Index of a buffer free to be filled, or -1 if none came back in time
+    int FreeBuffer();
+
+    const std::string dev_name;
+    int fd;
+    unsigned requested_buffers;
+    double fps;
+    int timeout_ms;
+
+    std::vector<StreamInfo> streams;
+    v4l2_format fmt;
+    std::vector<buffer> buffers;
+    //! Buffers never yet queued are handed out before any are dequeued
+    unsigned next_unqueued;
+    bool streaming;
+    size_t dropped_frames;
+    //! Where the rows of each stream go in a buffer
+    std::vector<size_t> plane_offset;
+    std::vector<size_t> plane_pitch;
+};
+
+}
@@ -0,0 +1,99 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/utils/picojson.h>
+#include <pangolin/video/frame_pool.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace pangolin
+{
+
+// Least recently used set of decoded frames, keyed by frame id, holding at
+// most a budget of bytes. Frames are immutable once inserted and shared with
+// whoever found them, so evicting a frame never invalidates one in use.
+// Thread safe.
+class PANGOLIN_EXPORT FrameCache
+{
+public:
+    struct Frame
+    {
+        std::shared_ptr<FramePool::Buffer> buffer;
+        picojson::value frame_properties;
+        std::string binary_meta;
+    };
+
+    explicit FrameCache(size_t max_bytes = 0);
+
+    FrameCache(const FrameCache&) = delete;
+
+    // Change the budget, evicting frames beyond it. 0 disables the cache.
+    void SetBudget(size_t max_bytes);
+
+    size_t Budget() const;
+
+    // Bytes of the frames currently held
+    size_t BytesUsed() const;
+
+    bool Contains(size_t id) const;
+
+    // Find frame id, marking it most recently used. Returns false if absent.
+    bool Find(size_t id, Frame& frame);
+
+    // Add or replace frame id of size_bytes, evicting the least recently used
+    // frames to make room. Frames larger than the budget aren't kept.
+    void Insert(size_t id, const Frame& frame, size_t size_bytes);
+
+    void Clear();
+
+private:
+    struct Entry
+    {
+        Frame frame;
+        size_t size_bytes;
+        std::list<size_t>::iterator lru;
+    };
+
+    // Caller must hold mutex
+    void Evict(size_t max_bytes);
+
+    mutable std::mutex mutex;
+    std::unordered_map<size_t, Entry> entries;
+    // Frame ids, most recently used first
+    std::list<size_t> lru;
+    size_t budget;
+    size_t bytes_used;
+};
+
+}
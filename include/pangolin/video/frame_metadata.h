@@ -0,0 +1,125 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/utils/picojson.h>
+
+#include <cstdint>
+#include <string>
+
+namespace pangolin
+{
+
+// Fixed layout metadata of a single frame, for drivers to hand on the commonly
+// used frame properties without building (and consumers parsing) a JSON object
+// per frame. Only fields flagged as set are meaningful. ToJson() / FromJson()
+// convert to and from the PANGO_* keys of the JSON frame properties, which
+// remain available from every driver as a compatibility view.
+struct PANGOLIN_EXPORT FrameMetadata
+{
+    enum Field : uint32_t
+    {
+        CaptureTime                 = 1 << 0,
+        HostReceptionTime           = 1 << 1,
+        EstimatedCenterCaptureTime  = 1 << 2,
+        Exposure                    = 1 << 3,
+        AnalogGain                  = 1 << 4,
+        AnalogBlackLevel            = 1 << 5,
+        Gamma                       = 1 << 6,
+        SensorTemperature           = 1 << 7,
+        FrameCounter                = 1 << 8,
+        Extension                   = 1 << 9,
+    };
+
+    FrameMetadata()
+        : fields(0),
+          capture_time_us(0), host_reception_time_us(0), estimated_center_capture_time_us(0),
+          exposure_us(0), analog_gain(0.0), analog_black_level(0.0), gamma(0.0),
+          sensor_temperature_C(0.0), frame_counter(0)
+    {
+    }
+
+    bool Has(Field f) const { return (fields & f) != 0; }
+
+    void Clear() { fields = 0; extension.clear(); }
+
+    void SetCaptureTime(int64_t us)                 { capture_time_us = us; fields |= CaptureTime; }
+    void SetHostReceptionTime(int64_t us)           { host_reception_time_us = us; fields |= HostReceptionTime; }
+    void SetEstimatedCenterCaptureTime(int64_t us)  { estimated_center_capture_time_us = us; fields |= EstimatedCenterCaptureTime; }
+    void SetExposure(int64_t us)                    { exposure_us = us; fields |= Exposure; }
+    void SetAnalogGain(double gain)                 { analog_gain = gain; fields |= AnalogGain; }
+    void SetAnalogBlackLevel(double level)          { analog_black_level = level; fields |= AnalogBlackLevel; }
+    void SetGamma(double g)                         { gamma = g; fields |= Gamma; }
+    void SetSensorTemperature(double c)             { sensor_temperature_C = c; fields |= SensorTemperature; }
+    void SetFrameCounter(int64_t counter)           { frame_counter = counter; fields |= FrameCounter; }
+    void SetExtension(const std::string& blob)      { extension = blob; fields |= Extension; }
+
+    // Add the set fields to json (an object, or null to start one) under the PANGO_* keys.
+    // The extension blob is driver specific and isn't part of the JSON view.
+    void AddToJson(picojson::value& json) const;
+
+    picojson::value ToJson() const
+    {
+        picojson::value json;
+        AddToJson(json);
+        return json;
+    }
+
+    // Fields found under the PANGO_* keys of json, or of its first "streams"
+    // entry for joined videos which only report them per stream.
+    static FrameMetadata FromJson(const picojson::value& json);
+
+    // Compact binary encoding holding only the set fields, as written into
+    // logs ahead of each packet (see PacketStreamWriter::WriteSourcePacket)
+    void Serialize(std::string& out) const;
+
+    std::string Serialize() const
+    {
+        std::string out;
+        Serialize(out);
+        return out;
+    }
+
+    // Returns false, leaving no fields set, if data isn't a valid encoding.
+    bool Deserialize(const void* data, size_t size);
+
+    uint32_t fields;
+    int64_t capture_time_us;
+    int64_t host_reception_time_us;
+    int64_t estimated_center_capture_time_us;
+    int64_t exposure_us;
+    double analog_gain;
+    double analog_black_level;
+    double gamma;
+    double sensor_temperature_C;
+    int64_t frame_counter;
+    std::string extension;
+};
+
+}
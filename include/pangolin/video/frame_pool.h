@@ -0,0 +1,161 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace pangolin
+{
+
+// Process wide pool of frame sized buffers, shared by all video filter chains.
+// Buffers are aligned (and on Linux, advised for transparent huge pages) and are
+// returned to the pool for reuse rather than freed, so a chain only holds the
+// intermediate buffers it actually has in flight at any one time.
+class PANGOLIN_EXPORT FramePool
+{
+public:
+    // Buffer checked out of the pool, returned automatically when destroyed.
+    class PANGOLIN_EXPORT Buffer
+    {
+    public:
+        Buffer()
+            : pool(nullptr), ptr(nullptr), size_bytes(0)
+        {
+        }
+
+        Buffer(Buffer&& o)
+            : pool(o.pool), ptr(o.ptr), size_bytes(o.size_bytes)
+        {
+            o.pool = nullptr;
+            o.ptr = nullptr;
+            o.size_bytes = 0;
+        }
+
+        Buffer& operator=(Buffer&& o)
+        {
+            if(this != &o) {
+                Reset();
+                std::swap(pool, o.pool);
+                std::swap(ptr, o.ptr);
+                std::swap(size_bytes, o.size_bytes);
+            }
+            return *this;
+        }
+
+        Buffer(const Buffer&) = delete;
+
+        ~Buffer()
+        {
+            Reset();
+        }
+
+        unsigned char* get() const
+        {
+            return ptr;
+        }
+
+        size_t SizeBytes() const
+        {
+            return size_bytes;
+        }
+
+        explicit operator bool() const
+        {
+            return ptr != nullptr;
+        }
+
+        // Return buffer to the pool early.
+        void Reset()
+        {
+            if(pool) pool->Release(ptr, size_bytes);
+            pool = nullptr;
+            ptr = nullptr;
+            size_bytes = 0;
+        }
+
+    private:
+        friend class FramePool;
+
+        Buffer(FramePool* pool, unsigned char* ptr, size_t size_bytes)
+            : pool(pool), ptr(ptr), size_bytes(size_bytes)
+        {
+        }
+
+        FramePool* pool;
+        unsigned char* ptr;
+        size_t size_bytes;
+    };
+
+    // Global pool shared across video chains.
+    static FramePool& I();
+
+    // Global pool of pinned buffers (see AllocatePinned), from which frames
+    // can be copied to the GPU asynchronously.
+    static FramePool& Pinned();
+
+    explicit FramePool(bool pinned = false);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+
+    // Check out a buffer of at least size_bytes, reusing any idle buffer of that size class.
+    Buffer Acquire(size_t size_bytes);
+
+    // Free all idle buffers.
+    void Trim();
+
+    // True iff buffers from this pool are pinned.
+    bool IsPinned() const
+    {
+        return pinned;
+    }
+
+    // Bytes currently allocated by the pool (idle and checked out).
+    size_t BytesAllocated() const;
+
+    // Bytes currently idle within the pool.
+    size_t BytesIdle() const;
+
+private:
+    void Release(unsigned char* ptr, size_t size_bytes);
+
+    unsigned char* Allocate(size_t size_bytes);
+    void Free(unsigned char* ptr, size_t size_bytes);
+
+    const bool pinned;
+    mutable std::mutex mutex;
+    std::multimap<size_t, unsigned char*> idle;
+    size_t bytes_allocated;
+    size_t bytes_idle;
+};
+
+}
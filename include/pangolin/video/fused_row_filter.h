@@ -0,0 +1,77 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/video/video.h>
+
+#include <memory>
+#include <vector>
+
+namespace pangolin
+{
+
+// Composes a run of adjacent VideoRowFilterInterface filters into one pass.
+// Rather than each filter reading and writing a whole frame in turn, every
+// output row is computed by pushing a single source row through all stages
+// using small, cache resident, intermediate row buffers.
+class PANGOLIN_EXPORT FusedRowFilter
+{
+public:
+    // Collect the run of row filters starting at outer (which must implement
+    // VideoRowFilterInterface and VideoFilterInterface) down to the first
+    // video which can't be fused.
+    FusedRowFilter(VideoInterface& outer);
+
+    // True iff at least two filters were fused, so that Grab methods save work
+    // over running outer normally.
+    bool IsFused() const;
+
+    // Grab from the first non-fused video and run all fused stages into image,
+    // laid out as outer's Streams().
+    bool GrabNext(unsigned char* image, bool wait = true);
+
+    bool GrabNewest(unsigned char* image, bool wait = true);
+
+protected:
+    void Process(unsigned char* image, const unsigned char* src_image);
+
+    struct Stage
+    {
+        VideoInterface* video;
+        VideoRowFilterInterface* filter;
+    };
+
+    // Outermost first
+    std::vector<Stage> stages;
+    VideoInterface* source;
+
+    // rows[i][s] holds output row of stream s from stages[i+1]
+    std::vector<std::vector<std::unique_ptr<unsigned char[]>>> rows;
+};
+
+}
@@ -1,13 +1,18 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <pangolin/image/image_io.h>
+#include <pangolin/utils/picojson.h>
 
 namespace pangolin {
 
 using ImageEncoderFunc = std::function<void(std::ostream&, const Image<unsigned char>&)>;
 using ImageDecoderFunc = std::function<TypedImage(std::istream&)>;
+// Decodes into an existing image of the decoded format
+using ImageDecoderIntoFunc = std::function<void(std::istream&, const Image<unsigned char>&)>;
 
 class StreamEncoderFactory
 {
@@ -17,6 +22,36 @@ public:
     ImageEncoderFunc GetEncoder(const std::string& encoder_spec, const PixelFormat& fmt);
 
     ImageDecoderFunc GetDecoder(const std::string& encoder_spec, const PixelFormat& fmt);
+
+    ImageDecoderIntoFunc GetDecoderInto(const std::string& encoder_spec, const PixelFormat& fmt);
+
+    // Per-stream codec parameters, as stored in the stream's json properties:
+    //   zstd_dictionary   - base64 encoded zstd dictionary (encoder and decoder)
+    //   zstd_workers      - zstd compression threads (encoder only)
+    //   keyframe_interval - frames between keyframes of inter-frame codecs (default 30)
+    //   hwaccel           - auto (default), none, nvenc, qsv or vaapi (encoder only)
+    //   vaapi_device      - e.g. /dev/dri/renderD128 (encoder only)
+    //   bitrate           - target bits per second, 0 for the encoder default (encoder only)
+    ImageEncoderFunc GetEncoder(const std::string& encoder_spec, const PixelFormat& fmt, const picojson::value& params);
+
+    ImageDecoderIntoFunc GetDecoderInto(const std::string& encoder_spec, const PixelFormat& fmt, const picojson::value& params);
+
+    // Inter-frame codecs (h264, h265, av1 through FFmpeg) predict frames from
+    // earlier ones of the same stream, so each stream must be encoded and
+    // decoded in order. Frame i is a keyframe whenever i is a multiple of
+    // KeyframeInterval(params), from which decoding can restart.
+    static bool IsInterFrame(const std::string& encoder_spec);
+
+    static size_t KeyframeInterval(const picojson::value& params);
+
+    // Ladders of encoders from best to lowest quality, separated by '|' (e.g.
+    // png|jpg90|jpg70), from which PangoVideoOutput picks a level per frame
+    // under write back-pressure. Their streams have the encoding "adaptive",
+    // listing the ladder under "levels", and each frame of the stream starts
+    // with the uint8 index of the level it was encoded with.
+    static bool IsAdaptive(const std::string& encoder_spec);
+
+    static std::vector<std::string> AdaptiveLevels(const std::string& encoder_spec);
 };
 
 }
@@ -60,8 +60,8 @@ public:
 
     //! Number of contiguous bytes in memory that the image occupies
     inline size_t RowBytes() const {
-        // Row size without padding
-        return (fmt.bpp*img_offset.w)/8;
+        // Row size without padding, of the luma plane for planar formats
+        return fmt.planar ? img_offset.w : (fmt.bpp*img_offset.w)/8;
     }
 
     //! Returns true iff image contains padding or stridded access
@@ -72,6 +72,10 @@ public:
 
     //! Number of contiguous bytes in memory that the image occupies
     inline size_t SizeBytes() const {
+        if(fmt.planar) {
+            // Luma followed by half height chroma (see PANGOLIN_PIXEL_FORMATS)
+            return (img_offset.h + (img_offset.h+1)/2) * img_offset.pitch;
+        }
         return (img_offset.h-1) * img_offset.pitch + RowBytes();
     }
 
@@ -33,18 +33,51 @@
 // Video URI's take the following form:
 //  scheme:[param1=value1,param2=value2,...]//device
 //
-// scheme = file | files | pango | shmem | dc1394 | uvc | v4l | openni2 |
-//          openni | depthsense | pleora | teli | mjpeg | test |
-//          thread | convert | debayer | split | join | shift | mirror | unpack
+// scheme = file | files | pango | shmem | tcp | udp | dc1394 | uvc | v4l | openni2 |
+//          openni | depthsense | realsense | pleora | teli | mjpeg | test |
+//          thread | convert | scale | rectify | debayer | split | join | clocksync | shift | mirror | unpack
+//
+// When built with BUILD_PANGOLIN_VIDEO_PLUGINS, the SDK drivers (realsense,
+// openni, openni2, uvc, depthsense, teli, pleora) are plugins loaded on first
+// use of their scheme from PANGOLIN_PLUGIN_PATH or the build / install tree.
 //
 // file/files - read one or more streams from image file(s) / video
 //  e.g. "files://~/data/dataset/img_*.jpg"
 //  e.g. "files://~/data/dataset/img_[left,right]_*.pgm"
 //  e.g. "files:///home/user/sequence/foo%03d.jpeg"
+//  e.g. "files:[prefetch=16,threads=8,prefetch_mb=512]//~/data/dataset/img_*.png" (decode up to 16 frames ahead on 8 threads, holding at most 512MB)
+//  e.g. "files:[manifest=~/data/dataset/img.manifest]//~/data/dataset/img_*.png" (cache the file list and stream layout in img.manifest)
+//  e.g. "tar://~/data/dataset.tar" (image members of an uncompressed tar, mapped in place, channels from the ImageArchive index)
+//  e.g. "images:[archive=~/data/dataset.tar]//[left,right]/*.png" (members of the archive matching each wildcard)
 //
 //  e.g. "file:[fmt=GRAY8,size=640x480]///home/user/raw_image.bin"
 //  e.g. "file:[realtime=1]///home/user/video/movie.pango"
+//  e.g. "pango:[mmap=1]///home/user/video/movie.pango" (map log into memory, frames read in place)
+//  e.g. "pango:[readahead=8]///home/user/video/movie.pango" (read and decode up to 8 frames ahead in the background)
+//  e.g. "pango:[cache_mb=512,cache_ahead=8]///home/user/video/movie.pango" (keep 512MB of decoded frames for stepping back and forth, decoding 8 ahead in the direction of travel)
+//  e.g. "pango:///home/user/video/movie.pango" (also plays movie.0001.pango, ... if the recording was rotated)
+//  e.g. "join://{pango:[OrderedPlayback=1]//node1.pango}{pango:[OrderedPlayback=1]//node2.pango}" (recordings of
+//        several machines made through a RecordCoordinator, interleaved on its shared time base)
 //  e.g. "file:[stream=1]///home/user/video/movie.avi"
+//  e.g. "ffmpeg:[hwaccel=auto,threads=4]///home/user/video/drive.mp4" (hwaccel=none|auto|vaapi|cuda|videotoolbox|..., threads=0 for FFmpeg's choice)
+//  e.g. "ffmpeg:[hwaccel=vaapi,fmt=NV12]///home/user/video/drive.mp4" (GRAY8 luma + Y400A chroma streams, copied without conversion)
+//  e.g. "ffmpeg:[index=/tmp/drive.idx]///home/user/video/drive.mp4" (cache the keyframe index used for seeking in /tmp/drive.idx)
+//
+// shmem - read frames from a named POSIX shared memory segment (Linux)
+//  A ring written by the shmem video output describes its own streams and carries per frame properties.
+//  Otherwise the segment holds a single frame of the given size and fmt.
+//  e.g. "shmem://camera0"
+//  e.g. "shmem:[size=640x480,fmt=RGB24]//camera0"
+//  e.g. "shmem:[device=1]//camera0" (lease frames of a memory=cuda ring in place as device pointers, rather than copies in host memory)
+//
+// tcp / udp - receive video streamed by the tcp / udp video output on another machine (Unix)
+//  tcp connects to host:port. udp listens on port, joining host if it is a multicast group.
+//           queue=N decoded frames held for the consumer, dropping the oldest beyond that (default 2)
+//           timeout_s=S to wait for the stream to start (default 5)
+//           rcvbuf_mb=N udp socket buffer (default 8). iface=address (IPv4) or name (IPv6) to join the group on
+//  e.g. "tcp://rig0:5600"
+//  e.g. "udp://:5600"
+//  e.g. "udp:[queue=1]//239.255.0.1:5600"
 //
 // dc1394 - capture video through a firewire camera
 //  e.g. "dc1394:[fmt=RGB24,size=640x480,fps=30,iso=400,dma=10]//0"
@@ -53,8 +86,30 @@
 //
 // v4l - capture video from a Video4Linux (USB) camera (normally YUVY422 format)
 //           method=mmap|read|userptr
+//           format=fourcc (with size), e.g. YUYV, NV12. Multi-planar devices need method=mmap
+//           NV12 / NV16 are split into a GRAY8 luma stream and a Y400A (interleaved UV) chroma stream
+//           buffers=N driver buffers for mmap / userptr (default 4). More buffers absorb consumer stalls
+//           Frames carry the driver timestamp and sequence as capture_time_us and frame_counter
 //  e.g. "v4l:///dev/video0"
 //  e.g. "v4l[method=mmap]:///dev/video0"
+//  e.g. "v4l:[size=1920x1080,format=NV12]///dev/video0"
+//  e.g. "v4l:[buffers=8]///dev/video0"
+//
+// camera2 - capture from an Android camera through the Camera2 NDK (API 26+), as one NV12 stream.
+//           Optionally the index of the camera, otherwise the first facing=back|front|external (default back).
+//           images=N buffers shared by queued and leased frames (default 4). gpu=0 for CPU only buffers.
+//           AndroidCameraVideo::GrabNextTexture imports frames as GL_TEXTURE_EXTERNAL_OES without copying;
+//           GrabNext and leases copy to host memory.
+//  e.g. "camera2://"
+//  e.g. "camera2:[facing=front,size=1920x1080]//"
+//
+// uvc - capture from a UVC camera, on Windows through Media Foundation.
+//           vid=0x..., pid=0x... and num=N select the device, size=WxH the closest native mode.
+//           async=0 reads synchronously in GrabNext, otherwise reads are queued ahead (queue=N, default 4, oldest dropped).
+//           MJPEG / H.264 cameras are decoded to NV12, with DXVA unless decode=sw. Leases point into the locked
+//           media buffer when its layout matches Streams().
+//  e.g. "uvc:[vid=0x05a9,pid=0x0581,size=1280x720]//"
+//  e.g. "uvc:[num=1,queue=8]//"
 //
 // openni2 - capture video / depth from OpenNI2 SDK  (Kinect / Xtrion etc)
 //           imgN=grey|rgb|ir|ir8|ir24|depth|reg_depth
@@ -80,6 +135,15 @@
 //  e.g. "depthsense://"
 //  e.g. "depthsense:[img1=depth,img2=rgb]//"
 //
+// realsense - capture depth (GRAY16LE) and colour from every librealsense device, or those listed by index / serial
+//              size=WxH, fps=N for all streams
+//              native=1 passes colour through as YUYV422 rather than converting to RGB24 on the host
+//              queue=N frames held per stream, dropping the oldest beyond that (default 4)
+//              Frames carry device timestamps mapped to the host clock as capture_time_us, per stream under "streams"
+//  e.g. "realsense://"
+//  e.g. "realsense:[size=848x480,fps=60,native=1]//0,1,2,3"
+//  e.g. "join:[sync_tolerance_us=5000,match_depth=4]//{realsense://0}{realsense://1}"
+//
 // pleora - USB 3 vision cameras accepts any option in the same format reported by eBUSPlayer
 //  e.g. for lightwise cameras: "pleora:[size=512x256,pos=712x512,sn=00000274,ExposureTime=10000,PixelFormat=Mono12p,AcquisitionMode=SingleFrame,TriggerSource=Line0,TriggerMode=On]//"
 //  e.g. for toshiba cameras: "pleora:[size=512x256,pos=712x512,sn=0300056,PixelSize=Bpp12,ExposureTime=10000,ImageFormatSelector=Format1,BinningHorizontal=2,BinningVertical=2]//"
@@ -90,16 +154,50 @@
 // thread - thread that continuously pulls from the child streams so that data in, unpacking, debayering etc can be decoupled from the main application thread
 //  e.g. thread://pleora://
 //  e.g. thread://unpack://pleora:[PixelFormat=Mono12p]//
+//  Options: num_buffers=30, cpu=0-3,8 (pin grab thread), numa_node=N (pin and allocate buffers on node),
+//           rt_priority=1..99 (SCHED_FIFO where permitted), mlock=1 (lock buffers into RAM),
+//           pinned=1 (page locked buffers, via cudaHostAlloc with CUDA, for GrabNextAsync uploads)
+//  e.g. thread:[numa_node=1,rt_priority=50,mlock=1]//v4l:///dev/video0
 //
-// convert - use FFMPEG to convert between video pixel formats
+// convert - convert every stream to fmt (default RGB24) with built in, vectorized conversions:
+//           YUYV422 / UYVY422 / NV12 / YUV420P to RGB24 / BGR24 / RGBA32 / BGRA32 / GRAY8,
+//           between RGB24 / BGR24 / RGBA32 / BGRA32, and GRAY8 / GRAY16LE to GRAY32F multiplied by scale.
+//           threads=N splits rows across N threads. Other conversions fall back to FFMPEG.
 //  e.g. "convert:[fmt=RGB24]//v4l:///dev/video0"
 //  e.g. "convert:[fmt=GRAY8]//v4l:///dev/video0"
+//  e.g. "convert:[fmt=GRAY32F,scale=0.001,threads=4]//realsense://"
+//
+// deinterlace - deinterlace every stream with built in, vectorized kernels. method:
+//           stereo (default) splits 16 / 32 bit pixels interleaving two cameras into GRAY8 / GRAY16LE streams,
+//           fields splits even and odd rows into two half height streams, double repeats the rows of field=0|1,
+//           bob interpolates the other field from field=0|1 (8 / 16 bit channels), and weave interleaves
+//           two fields stored one above the other. threads=N splits rows across N threads.
+//  e.g. "deinterlace://dc1394:[fmt=FORMAT7_3]//0"
+//  e.g. "deinterlace:[method=bob,field=1,threads=4]//v4l:///dev/video0"
+//
+// scale - resize every stream to w x h (or size=WxH) with built in, vectorized resampling.
+//         Given only one of w / h, the other keeps the aspect of each stream.
+//         method: area (default, averages when shrinking) or bilinear. threads=N splits rows across N threads.
+//         Bit packed formats (GRAY10 / GRAY12) must be unpacked first.
+//  e.g. "scale:[w=640]//v4l:///dev/video0"
+//  e.g. "scale:[size=320x240,method=bilinear,threads=4]//convert:[fmt=RGB24]//v4l:///dev/video0"
+//
+// rectify - undistort (and rotate, for stereo rectification) every stream through a lookup tabulated once.
+//           Intrinsics from calib=file.json (see RectifyVideo::LoadCalibration) or fx,fy,cx,cy with
+//           model=radtan (k1,k2,p1,p2,k3) or model=equidistant (k1,k2,k3,k4). zoom scales the output focal length.
+//           threads=N splits rows across N threads. gpu=1 passes frames through, to be rectified by GlRemapProcessor.
+//  e.g. "rectify:[fx=520,fy=520,cx=319.5,cy=239.5,k1=-0.28,k2=0.07]//v4l:///dev/video0"
+//  e.g. "rectify:[calib=~/stereo.json,threads=4]//join://{v4l:///dev/video0}{v4l:///dev/video1}"
 //
 // mjpeg - capture from (possibly networked) motion jpeg stream using FFMPEG
 //  e.g. "mjpeg://http://127.0.0.1/?action=stream"
 //
 // debayer - debayer an input video stream
 //  e.g.  "debayer:[tile="BGGR",method="downsample"]//v4l:///dev/video0
+//  method: none, downsample, mono, linear, edgeaware (built in, vectorized)
+//          or nearest, simple, bilinear, hqlinear, edgesense, vng, ahd (requires DC1394)
+//  threads=N splits rows of the built in methods across N threads
+//  e.g.  "debayer:[tile="RGGB",method="edgeaware",threads=4]//pleora://
 //
 // split - split an input video into a one or more streams based on Region of Interest / memory specification
 //           roiN=X+Y+WxH
@@ -108,14 +206,38 @@
 //  e.g. "split:[mem1=307200:640x480:1280:GRAY8,roi2=640+0+640x480]//files:///home/user/sequence/foo%03d.jpeg"
 //  e.g. "split:[stream1=2,stream2=1]//pango://video.pango"
 //
+// unpack - unpack packed 8/10/12 bit mono streams to GRAY16LE or GRAY32F, optionally splitting rows across threads
+//  e.g. "unpack:[fmt=GRAY16LE,threads=4]//pleora:[PixelFormat=Mono12p]//"
+//
 // join - join streams
 //  e.g. "join:[sync_tolerance_us=100, sync_continuously=true]//{pleora:[sn=00000274]//}{pleora:[sn=00000275]//}"
+//  parallel=true grabs from every source concurrently so latency is that of the slowest source
+//  e.g. "join:[parallel=true,sync_tolerance_us=500]//{v4l:///dev/video0}{v4l:///dev/video1}"
+//  match_depth=N queues N frames per source and emits the best aligned tuple within sync_tolerance_us,
+//  reporting matched, dropped, drop_rate, skew_us and mean_skew_us under "join" in the frame properties
+//  e.g. "join:[sync_tolerance_us=2000,match_depth=4]//{thread:[size=4]//v4l:///dev/video0}{thread:[size=4]//v4l:///dev/video1}"
+//  clock_sync=true wraps each source in clocksync, so that sync uses capture times fit to the device clocks
+//  e.g. "join:[clock_sync=true,sync_tolerance_us=500,match_depth=4]//{uvc://0}{uvc://1}"
+//
+// clocksync - estimate center capture times by fitting the device clock (capture time, or frame counter) to host time
+//           source=auto|capture|counter, window=N frames fit (default 256), reset_us=U residual at which the fit
+//           starts over (default 1000000), latency_us=U least transfer delay, half_exposure=1 to subtract exposure/2
+//  e.g. "clocksync:[latency_us=1500,half_exposure=1]//uvc://0"
 //
 // test - output test video sequence
 //  e.g. "test://"
 //  e.g. "test:[size=640x480,fmt=RGB24]//"
+//  e.g. "test:[n=2,fmt=GRAY8,size2=320x240,fmt2=GRAY12,pattern=bars]//"
+//  e.g. "debayer:[tile=RGGB]//test:[fmt=GRAY8,pattern=gradient,bayer=RGGB]//"
+//  e.g. "join:[sync_tolerance_us=500]//test:[fps=60,jitter_us=200]//&test:[fps=60,offset_us=100]//"
+//  pattern is random (default), gradient or bars. With fps, frames carry
+//  capture and reception timestamps spaced 1/fps apart, delayed by
+//  latency_us plus up to jitter_us. realtime=0 returns frames without
+//  waiting for them. seed makes content and jitter reproducible.
 
+#include <pangolin/image/memcpy.h>
 #include <pangolin/utils/uri.h>
+#include <pangolin/video/frame_pool.h>
 #include <pangolin/video/video_exception.h>
 #include <pangolin/video/video_interface.h>
 #include <pangolin/video/video_output_interface.h>
@@ -127,7 +249,9 @@ namespace pangolin
 PANGOLIN_EXPORT
 std::unique_ptr<VideoInterface> OpenVideo(const std::string& uri);
 
-//! Open Video Interface from Uri specification
+//! Open Video Interface from Uri specification. Drivers already held by the
+//! VideoSourcePool in scope on this thread, if any, are shared rather than
+//! reopened (see VideoInput::Reconfigure).
 PANGOLIN_EXPORT
 std::unique_ptr<VideoInterface> OpenVideo(const Uri& uri);
 
@@ -216,6 +340,38 @@ picojson::value GetVideoFrameProperties(VideoInterface* video)
     return picojson::value();
 }
 
+//! Metadata of the most recent frame from video, held in fixed layout by the
+//! driver when it supports VideoFrameMetadataInterface, or otherwise parsed
+//! from its frame properties.
+inline
+FrameMetadata GetVideoFrameMetadata(VideoInterface* video)
+{
+    VideoFrameMetadataInterface* mi = dynamic_cast<VideoFrameMetadataInterface*>(video);
+    VideoPropertiesInterface* pi = dynamic_cast<VideoPropertiesInterface*>(video);
+    VideoFilterInterface* fi = dynamic_cast<VideoFilterInterface*>(video);
+
+    if(mi) {
+        return mi->Metadata();
+    }else if(!pi && fi && fi->InputStreams().size() == 1) {
+        return GetVideoFrameMetadata(fi->InputStreams()[0]);
+    }
+    return FrameMetadata::FromJson(GetVideoFrameProperties(video));
+}
+
+//! Whether video (or the single input behind filters) holds its frame
+//! metadata in fixed layout, such that GetVideoFrameMetadata() needn't
+//! go through JSON.
+inline
+bool HasVideoFrameMetadata(VideoInterface* video)
+{
+    if(VideoFrameMetadataInterface* mi = dynamic_cast<VideoFrameMetadataInterface*>(video)) {
+        return mi->HasNativeMetadata();
+    }
+    VideoFilterInterface* fi = dynamic_cast<VideoFilterInterface*>(video);
+    return !dynamic_cast<VideoPropertiesInterface*>(video) && fi && fi->InputStreams().size() == 1 &&
+           HasVideoFrameMetadata(fi->InputStreams()[0]);
+}
+
 inline
 picojson::value GetVideoDeviceProperties(VideoInterface* video)
 {
@@ -254,4 +410,138 @@ picojson::value GetVideoDeviceProperties(VideoInterface* video)
     return picojson::value();
 }
 
+inline
+void GetVideoStageStats(VideoInterface* video, std::vector<VideoStageStats>& stats, bool latest_frame, const std::string& path)
+{
+    std::string here = path;
+    VideoStageStatsInterface* si = dynamic_cast<VideoStageStatsInterface*>(video);
+    if(si) {
+        here = path.empty() ? si->StageName() : path + "/" + si->StageName();
+        stats.push_back(si->StageStats(latest_frame));
+        stats.back().stage = here;
+    }
+
+    VideoFilterInterface* fi = dynamic_cast<VideoFilterInterface*>(video);
+    if(fi) {
+        const std::vector<VideoInterface*>& inputs = fi->InputStreams();
+        for(size_t i=0; i < inputs.size(); ++i) {
+            const std::string input_path = inputs.size() > 1 ? here + "[" + std::to_string(i) + "]" : here;
+            GetVideoStageStats(inputs[i], stats, latest_frame, input_path);
+        }
+    }
+}
+
+//! Timings of every stage in the chain rooted at video which implements
+//! VideoStageStatsInterface, outermost first. Totals since enabled, or
+//! those of each stage's latest frame.
+inline
+std::vector<VideoStageStats> GetVideoStageStats(VideoInterface* video, bool latest_frame = false)
+{
+    std::vector<VideoStageStats> stats;
+    GetVideoStageStats(video, stats, latest_frame, "");
+    return stats;
+}
+
+//! Start or stop timing every stage in the chain rooted at video
+inline
+void EnableVideoStageStats(VideoInterface* video, bool enable = true)
+{
+    VideoStageStatsInterface* si = dynamic_cast<VideoStageStatsInterface*>(video);
+    if(si) {
+        si->EnableStageStats(enable);
+    }
+
+    VideoFilterInterface* fi = dynamic_cast<VideoFilterInterface*>(video);
+    if(fi) {
+        for(VideoInterface* input : fi->InputStreams()) {
+            EnableVideoStageStats(input, enable);
+        }
+    }
+}
+
+//! Stage timings in microseconds, as added to frame properties under
+//! PANGO_STAGE_TIMING by stages which have timing enabled.
+inline
+picojson::value VideoStageStatsJson(const std::vector<VideoStageStats>& stats)
+{
+    picojson::value json = picojson::value(picojson::array_type, false);
+    for(const VideoStageStats& s : stats) {
+        picojson::value stage;
+        stage["stage"] = s.stage;
+        stage["frames"] = s.frames;
+        stage["grab_us"] = 1e6 * s.grab_s;
+        stage["wait_us"] = 1e6 * s.wait_s;
+        stage["process_us"] = 1e6 * s.process_s;
+        stage["copy_us"] = 1e6 * s.copy_s;
+        stage["queue_depth"] = s.queue_depth;
+        stage["max_queue_depth"] = s.max_queue_depth;
+        stage["dropped"] = s.dropped;
+        stage["overwritten"] = s.overwritten;
+        stage["rejected"] = s.rejected;
+        json.push_back(stage);
+    }
+    return json;
+}
+
+//! Readout control (see VideoReadoutInterface) of video, for filters wanting
+//! only part of their input, or null if it has none. Only a driver opened
+//! directly beneath the filter is offered: filters in between have already
+//! sized their streams and buffers for the readout they were opened with.
+//! Filters should leave a readout they didn't ask for alone.
+inline
+VideoReadoutInterface* GetVideoReadoutInterface(VideoInterface& video)
+{
+    return dynamic_cast<VideoReadoutInterface*>(&video);
+}
+
+//! Lease the next frame from video without copying when the video supports
+//! VideoLeaseInterface, otherwise copy it into a buffer from pool.
+inline
+FrameLease GrabNextLease(VideoInterface& video, bool wait = true, FramePool& pool = FramePool::I())
+{
+    VideoLeaseInterface* vl = dynamic_cast<VideoLeaseInterface*>(&video);
+    if(vl) {
+        return vl->GrabNextLease(wait);
+    }
+
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(pool.Acquire(video.SizeBytes()));
+    if(video.GrabNext(buffer->get(), wait)) {
+        return FrameLease(buffer->get(), video.SizeBytes(), [buffer](){});
+    }
+    return FrameLease();
+}
+
+//! Lease the newest frame from video without copying when the video supports
+//! VideoLeaseInterface, otherwise copy it into a buffer from pool.
+inline
+FrameLease GrabNewestLease(VideoInterface& video, bool wait = true, FramePool& pool = FramePool::I())
+{
+    VideoLeaseInterface* vl = dynamic_cast<VideoLeaseInterface*>(&video);
+    if(vl) {
+        return vl->GrabNewestLease(wait);
+    }
+
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(pool.Acquire(video.SizeBytes()));
+    if(video.GrabNewest(buffer->get(), wait)) {
+        return FrameLease(buffer->get(), video.SizeBytes(), [buffer](){});
+    }
+    return FrameLease();
+}
+#ifdef HAVE_CUDA
+//! Enqueue an asynchronous copy of the leased frame to device_image on
+//! stream, holding the lease until the stream has completed the copy.
+//! The copy only overlaps with the caller when the frame is pinned, e.g.
+//! from "thread:[pinned=1]//..." or VideoInput::SetPinnedMemory(true).
+PANGOLIN_EXPORT
+bool UploadFrameAsync(const FrameLease& lease, unsigned char* device_image, cudaStream_t stream);
+
+//! Grab the next frame of video into pinned memory and enqueue its upload
+//! to device_image on stream, as UploadFrameAsync.
+PANGOLIN_EXPORT
+bool GrabNextAsync(VideoInterface& video, unsigned char* device_image, cudaStream_t stream, bool wait = true);
+
+PANGOLIN_EXPORT
+bool GrabNewestAsync(VideoInterface& video, unsigned char* device_image, cudaStream_t stream, bool wait = true);
+#endif
+
 }
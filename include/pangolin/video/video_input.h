@@ -27,15 +27,66 @@
 
 #pragma once
 
+#include <pangolin/utils/latency_histogram.h>
+#include <pangolin/video/stream_encoder_factory.h>
 #include <pangolin/video/video.h>
 #include <pangolin/video/video_output.h>
+#include <pangolin/video/video_source_pool.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
 
 namespace pangolin
 {
 
+struct PANGOLIN_EXPORT VideoInputStats
+{
+    VideoInputStats()
+        : frames(0), untimed_frames(0), dropped(0), overwritten(0), rejected(0),
+          record_queued(0), record_dropped(0)
+    {
+    }
+
+    // Frames grabbed through the VideoInput since opened or ResetStats()
+    uint64_t frames;
+
+    // Microseconds from PANGO_CAPTURE_TIME_US (or failing that,
+    // PANGO_HOST_RECEPTION_TIME_US) to each grab returning
+    LatencyHistogram latency_us;
+
+    // Frames without a capture time on the host clock
+    uint64_t untimed_frames;
+
+    // Frames lost within the chain since it was opened, summed over stages
+    uint64_t dropped;
+    uint64_t overwritten;
+    uint64_t rejected;
+
+    // Frames waiting for the recorder thread, and those it had no room for
+    // (see VideoInput::SetAsyncRecording())
+    size_t record_queued;
+    uint64_t record_dropped;
+
+    // Counters and timings of each stage, see GetVideoStageStats()
+    std::vector<VideoStageStats> stages;
+};
+
+// What an asynchronous recorder does with a frame when its queue is full
+enum RecordQueuePolicy
+{
+    RecordQueueDrop,    // don't record the frame, counting it as record_dropped
+    RecordQueueBlock    // wait for room, stalling the grabbing thread
+};
+
 struct PANGOLIN_EXPORT VideoInput
     : public VideoInterface,
-      public VideoFilterInterface
+      public VideoFilterInterface,
+      public VideoLeaseInterface
 {
     /////////////////////////////////////////////////////////////
     // VideoInterface Methods
@@ -48,6 +99,14 @@ struct PANGOLIN_EXPORT VideoInput
     bool GrabNext( unsigned char* image, bool wait = true ) override;
     bool GrabNewest( unsigned char* image, bool wait = true ) override;
 
+    /////////////////////////////////////////////////////////////
+    // VideoLeaseInterface Methods
+    /////////////////////////////////////////////////////////////
+
+    // Forwards to the source video, copying only if it can't lease frames.
+    FrameLease GrabNextLease( bool wait = true ) override;
+    FrameLease GrabNewestLease( bool wait = true ) override;
+
     /////////////////////////////////////////////////////////////
     // VideoFilterInterface Methods
     /////////////////////////////////////////////////////////////
@@ -90,10 +149,23 @@ struct PANGOLIN_EXPORT VideoInput
         Open(uri_input.full_uri, uri_output.full_uri);
     }
 
+    // Replace the input with input_uri, rebuilding the chain of filters but
+    // keeping open the drivers it shares with the current input, so that
+    // filters can be added, removed or re-parameterised while the hardware
+    // keeps streaming. Streams() and SizeBytes() may change, and recording
+    // stops. If input_uri can't be opened, the current input is restored
+    // and the exception rethrown.
+    void Reconfigure(const std::string& input_uri);
+
     // Return pointer to inner video class as VideoType
     template<typename VideoType>
     VideoType* Cast() {
-        return dynamic_cast<VideoType*>(video_src.get());
+        VideoType* video = dynamic_cast<VideoType*>(video_src.get());
+        if(!video) {
+            // Look through the view of a pooled driver
+            video = dynamic_cast<VideoType*>(VideoSourcePool::Driver(video_src.get()));
+        }
+        return video;
     }
 
     const std::string& LogFilename() const;
@@ -111,12 +183,106 @@ struct PANGOLIN_EXPORT VideoInput
     // True iff grabbed live frames are being logged to file
     bool IsRecording() const;
 
+    // Record() from the first frame grabbed at or after start_us, and stop
+    // before the first at or after stop_us, times on the host clock
+    // (TimeNow_us) compared with each frame's capture time. Used by
+    // RecordNode so that several machines start and stop on the same frame
+    // time: clock_offset_us (the shared time base minus the host clock),
+    // session and node are stamped into pango:// recordings for PlaybackSession
+    // to align them. Safe to call from any thread whilst another grabs.
+    void ScheduleRecording(
+        int64_t start_us, int64_t stop_us = std::numeric_limits<int64_t>::max(),
+        int64_t clock_offset_us = 0, const std::string& session = "", const std::string& node = ""
+    );
+
+    // Stop a scheduled or current recording before the first frame at or
+    // after stop_us. Safe to call from any thread whilst another grabs.
+    void ScheduleStop(int64_t stop_us);
+
+    // Whilst not recording, hold the frames grabbed within the last seconds
+    // (and within max_bytes) in memory, to be written ahead of live frames
+    // when Record() is next called. Frames are held raw, or compressed per
+    // stream with an intra-frame encoder (e.g. "jpg90", "png", "zstd").
+    // A duration of 0 disables pre-roll and frees the frames held.
+    void SetPreRoll(double seconds, size_t max_bytes, const std::string& encoder = "");
+
+    // Number and total size of the frames held for pre-roll
+    size_t PreRollFrames() const;
+    size_t PreRollBytes() const;
+
+    // Write recorded frames from a thread of their own, so that a slow
+    // encoder or disk doesn't stall grabbing. Up to max_queued frames wait to
+    // be written, held by lease or copied into pooled buffers. 0 writes
+    // frames synchronously from the grabbing thread (the default).
+    void SetAsyncRecording(size_t max_queued, RecordQueuePolicy policy = RecordQueueDrop);
+
+    // Copy frames which the source can't lease into pinned rather than
+    // pageable buffers, so that they can be uploaded asynchronously (see
+    // GrabNextAsync). Frames leased from the source are pinned only if it
+    // allocated them so, e.g. "thread:[pinned=1]//...".
+    void SetPinnedMemory(bool pinned);
+
+    // Frames lost and capture-to-grab latency. Safe to call while another
+    // thread grabs.
+    VideoInputStats Stats() const;
+
+    // Clear frame count and latencies. Stage counters are never reset.
+    void ResetStats();
+
 protected:
     void InitialiseRecorder();
 
+    FramePool& LeasePool() const;
+
+    // Record latency of the frame just grabbed, and write it out if recording.
+    // lease, if valid, holds image for the asynchronous recorder.
+    void GrabbedFrame(const unsigned char* image, bool should_record, const FrameLease& lease = FrameLease());
+
+    struct RecordFrame
+    {
+        FrameLease frame;
+        bool typed;
+        FrameMetadata meta;
+        picojson::value props;
+    };
+
+    // Hand a frame to the recorder thread, starting it if need be
+    void QueueRecordFrame(const unsigned char* image, const FrameLease& lease, bool typed, const FrameMetadata& meta, const picojson::value& props);
+
+    void RecordThread();
+
+    // Write out the frames queued and join the recorder thread
+    void StopRecordThread();
+
+    // Start or stop recording as scheduled for a frame with metadata meta,
+    // returning whether it is to be recorded
+    bool ScheduledRecord(const FrameMetadata& meta, int64_t now_us, bool should_record);
+
+    struct PreRollFrame
+    {
+        int64_t time_us;
+        std::vector<unsigned char> data;
+        // Encoded size of each stream, empty when held raw
+        std::vector<size_t> stream_bytes;
+        bool typed;
+        FrameMetadata meta;
+        picojson::value props;
+    };
+
+    // Add a grabbed frame to the pre-roll, dropping those too old or too many
+    void HoldPreRoll(const unsigned char* image, bool typed, const FrameMetadata& meta, const picojson::value& props, int64_t time_us);
+
+    // Write out (and then forget) the frames held for pre-roll
+    void WritePreRoll();
+
+    void ClearPreRoll();
+
     Uri uri_input;
     Uri uri_output;
 
+    // Drivers under video_src, kept open by Reconfigure()
+    VideoSourcePool source_pool;
+
     std::unique_ptr<VideoInterface> video_src;
     std::unique_ptr<VideoOutputInterface> video_recorder;
 
@@ -131,6 +297,43 @@ protected:
 
     bool record_once;
     bool record_continuous;
+
+    bool pinned_memory;
+
+    double preroll_seconds;
+    size_t preroll_max_bytes;
+    std::string preroll_encoder;
+    std::vector<ImageEncoderFunc> preroll_encoders;
+    std::vector<ImageDecoderIntoFunc> preroll_decoders;
+    std::deque<PreRollFrame> preroll;
+    size_t preroll_bytes;
+    // Buffers of dropped frames, reused for those grabbed next
+    std::vector<std::vector<unsigned char>> preroll_spare;
+
+    size_t record_max_queued;
+    RecordQueuePolicy record_policy;
+    std::thread record_thread;
+    mutable std::mutex record_mutex;
+    std::condition_variable record_cond;
+    std::deque<RecordFrame> record_queue;
+    bool record_quit;
+    uint64_t record_dropped;
+
+    // ScheduleRecording(), checked by the grabbing thread whilst pending
+    std::mutex schedule_mutex;
+    std::atomic<bool> schedule_pending;
+    int64_t schedule_start_us;
+    int64_t schedule_stop_us;
+    int64_t schedule_clock_offset_us;
+    std::string schedule_session;
+    std::string schedule_node;
+    // Whilst Record() starts a schedule, for InitialiseRecorder() to stamp
+    bool schedule_starting;
+
+    mutable std::mutex stats_mutex;
+    uint64_t frames_grabbed;
+    uint64_t untimed_frames;
+    LatencyHistogram latency_us;
 };
 
 // VideoInput subsumes the previous VideoRecordRepeat class.
@@ -27,10 +27,15 @@
 
 #pragma once
 
+#include <pangolin/image/typed_image.h>
 #include <pangolin/utils/picojson.h>
+#include <pangolin/video/frame_metadata.h>
 #include <pangolin/video/stream_info.h>
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #define PANGO_HAS_TIMING_DATA        "has_timing_data"
@@ -43,6 +48,7 @@
 #define PANGO_SENSOR_TEMPERATURE_C   "sensor_temperature_C"
 #define PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US "estimated_center_capture_time_us"
 #define PANGO_FRAME_COUNTER          "frame_counter"
+#define PANGO_STAGE_TIMING           "stage_timing"
 
 namespace pangolin {
 
@@ -75,6 +81,63 @@ struct PANGOLIN_EXPORT VideoInterface
     virtual bool GrabNewest( unsigned char* image, bool wait = true ) = 0;
 };
 
+//! Reference counted handle to a frame which remains owned by the video
+//! driver that produced it. The frame is laid out as described by the
+//! drivers Streams() and is handed back to the driver once the last copy
+//! of the lease is released. Leases must be released before the driver
+//! that granted them is destroyed.
+class PANGOLIN_EXPORT FrameLease
+{
+public:
+    FrameLease()
+        : size_bytes(0)
+    {
+    }
+
+    FrameLease(unsigned char* ptr, size_t size_bytes, const std::function<void()>& on_release = std::function<void()>())
+        : frame(ptr, [on_release](unsigned char*){ if(on_release) on_release(); }),
+          size_bytes(size_bytes)
+    {
+    }
+
+    //! Pointer to the start of the leased frame
+    unsigned char* data() const { return frame.get(); }
+
+    //! Number of bytes covered by the lease
+    size_t SizeBytes() const { return size_bytes; }
+
+    //! True iff the lease refers to a frame
+    bool IsValid() const { return frame.get() != nullptr; }
+
+    explicit operator bool() const { return IsValid(); }
+
+    //! Give up this reference. The frame is returned to the driver once
+    //! all references are released.
+    void Release() { frame.reset(); size_bytes = 0; }
+
+private:
+    std::shared_ptr<unsigned char> frame;
+    size_t size_bytes;
+};
+
+//! Optional interface for video sources which can grant access to their
+//! own frame buffers without copying.
+struct PANGOLIN_EXPORT VideoLeaseInterface
+{
+    virtual ~VideoLeaseInterface() {}
+
+    //! Lease the next frame from the driver without copying.
+    //! Optionally wait for a frame if one isn't ready
+    //! Returns an invalid lease if no frame was available
+    virtual FrameLease GrabNextLease( bool wait = true ) = 0;
+
+    //! Lease the newest frame from the driver without copying,
+    //! discarding all older frames.
+    //! Optionally wait for a frame if one isn't ready
+    //! Returns an invalid lease if no frame was available
+    virtual FrameLease GrabNewestLease( bool wait = true ) = 0;
+};
+
 //! Interface to GENICAM video capture sources
 struct PANGOLIN_EXPORT GenicamVideoInterface
 {
@@ -86,6 +149,51 @@ struct PANGOLIN_EXPORT GenicamVideoInterface
 
 };
 
+//! Part of the sensor a driver reads out: a window of w x h full resolution
+//! sensor pixels at (x,y), or the whole sensor with w or h of 0, binned
+//! (summed or averaged) and then decimated (skipped) over that many pixels
+//! in each direction.
+struct PANGOLIN_EXPORT VideoReadout
+{
+    VideoReadout()
+        : x(0), y(0), w(0), h(0), binning(1), decimation(1)
+    {
+    }
+
+    bool IsFullSensor() const
+    {
+        return !w || !h;
+    }
+
+    //! Full resolution sensor pixels per output pixel, in each direction
+    size_t Factor() const
+    {
+        return binning * decimation;
+    }
+
+    size_t x, y, w, h;
+    size_t binning;
+    size_t decimation;
+};
+
+//! Optional interface for drivers which can crop, bin or decimate on the
+//! device, so that filters needing less than the full frame save the bus
+//! bandwidth and host processing of the rest (see GetVideoReadoutInterface).
+struct PANGOLIN_EXPORT VideoReadoutInterface
+{
+    virtual ~VideoReadoutInterface() {}
+
+    //! Reconfigure the device for readout as closely as it allows, which may
+    //! grow the window to meet alignment constraints. Streams() and
+    //! SizeBytes() change to match, so this must be called before anything
+    //! downstream sizes its buffers, and with no frames leased.
+    //! Returns the readout applied.
+    virtual VideoReadout SetReadout(const VideoReadout& readout) = 0;
+
+    //! Readout currently applied
+    virtual VideoReadout GetReadout() const = 0;
+};
+
 struct PANGOLIN_EXPORT BufferAwareVideoInterface
 {
     virtual ~BufferAwareVideoInterface() {}
@@ -109,6 +217,21 @@ struct PANGOLIN_EXPORT VideoPropertiesInterface
     virtual const picojson::value& FrameProperties() const = 0;
 };
 
+//! Optional interface for drivers which keep the metadata of their frames
+//! in fixed layout (see FrameMetadata). Their FrameProperties() offer the
+//! same fields as JSON, built only when asked for.
+struct PANGOLIN_EXPORT VideoFrameMetadataInterface
+{
+    virtual ~VideoFrameMetadataInterface() {}
+
+    //! Metadata of most recently captured frame
+    virtual const FrameMetadata& Metadata() const = 0;
+
+    //! False for filters passing on metadata their input only gave as JSON,
+    //! whose frame properties may then hold more than Metadata()
+    virtual bool HasNativeMetadata() const { return true; }
+};
+
 enum UvcRequestCode {
   UVC_RC_UNDEFINED = 0x00,
   UVC_SET_CUR = 0x01,
@@ -121,6 +244,49 @@ enum UvcRequestCode {
   UVC_GET_DEF = 0x87
 };
 
+//! Time spent within one stage of a video chain, see VideoStageStatsInterface
+struct PANGOLIN_EXPORT VideoStageStats
+{
+    VideoStageStats()
+        : frames(0), grab_s(0.0), wait_s(0.0), process_s(0.0), copy_s(0.0),
+          queue_depth(0), max_queue_depth(0), dropped(0), overwritten(0), rejected(0)
+    {
+    }
+
+    std::string stage;      // path through the chain, e.g. "thread/join[1]/debayer"
+    uint64_t frames;        // frames delivered
+    double grab_s;          // within GrabNext / GrabNewest, including the below
+    double wait_s;          // waiting on the input, device or queue
+    double process_s;       // transforming frames
+    double copy_s;          // copying frames out
+    size_t queue_depth;     // frames buffered at the latest grab, for stages with a queue
+    size_t max_queue_depth;
+
+    // Frames lost at this stage, counted whether or not timing is enabled
+    uint64_t dropped;       // skipped over by GrabNewest or DropNFrames
+    uint64_t overwritten;   // reused before being grabbed, for want of free buffers
+    uint64_t rejected;      // discarded for failing to synchronise with other inputs
+};
+
+//! Optional interface for drivers which time their grabs, to find the slow
+//! stage of a chain (see GetVideoStageStats). Timing is off until enabled,
+//! costing one relaxed atomic load per grab.
+struct PANGOLIN_EXPORT VideoStageStatsInterface
+{
+    virtual ~VideoStageStatsInterface() {}
+
+    //! Start (resetting totals) or stop timing grabs
+    virtual void EnableStageStats(bool enable) = 0;
+
+    virtual bool StageStatsEnabled() const = 0;
+
+    //! Totals since timing was enabled, or those of the latest frame alone
+    virtual VideoStageStats StageStats(bool latest_frame = false) const = 0;
+
+    //! Short name of this stage, such as its uri scheme
+    virtual std::string StageName() const = 0;
+};
+
 struct PANGOLIN_EXPORT VideoFilterInterface
 {
     virtual ~VideoFilterInterface() {}
@@ -148,6 +314,27 @@ struct PANGOLIN_EXPORT VideoFilterInterface
     virtual std::vector<VideoInterface*>& InputStreams() = 0;
 };
 
+//! Optional interface for single input filters where each output row depends
+//! only on one row of the same stream in its input. Adjacent row filters can
+//! then be fused into a single pass over the frame (see FusedRowFilter).
+//! Each stream must keep its height through the filter.
+struct PANGOLIN_EXPORT VideoRowFilterInterface
+{
+    virtual ~VideoRowFilterInterface() {}
+
+    //! Input stream from which output stream is computed
+    virtual size_t RowFilterInputStream(size_t stream) const { return stream; }
+
+    //! Input row (of RowFilterInputStream(stream)) from which output row y of stream is computed
+    virtual size_t RowFilterInputRow(size_t stream, size_t y) const = 0;
+
+    //! Compute one output row of stream from its corresponding input row
+    virtual void RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row) = 0;
+
+    //! False if, as configured, output rows don't each follow from a single input row
+    virtual bool RowFilterSupported() const { return true; }
+};
+
 struct PANGOLIN_EXPORT VideoUvcInterface
 {
     virtual ~VideoUvcInterface() {}
@@ -169,4 +356,35 @@ struct PANGOLIN_EXPORT VideoPlaybackInterface
     virtual size_t Seek(size_t frameid) = 0;
 };
 
+/// Small previews recorded alongside some frames of a video, to show where
+/// a seek is headed whilst the frame itself is decoded.
+struct PANGOLIN_EXPORT VideoThumbnailInterface
+{
+    virtual ~VideoThumbnailInterface() {}
+
+    /// Frames between thumbnails, or 0 if there are none
+    virtual size_t ThumbnailInterval() const = 0;
+
+    /// Decode the thumbnail of each stream nearest at or before frameid into
+    /// thumbs, empty for streams without one. Return the id of the frame
+    /// shown, or -1 if there is no such thumbnail. May be called from any
+    /// thread, without interrupting playback.
+    virtual size_t GetThumbnails(size_t frameid, std::vector<TypedImage>& thumbs) = 0;
+};
+
+/// Keeps recently decoded frames of a seekable video, so that stepping back
+/// and forth over them doesn't decode them again.
+struct PANGOLIN_EXPORT VideoFrameCacheInterface
+{
+    virtual ~VideoFrameCacheInterface() {}
+
+    /// Bytes of decoded frames kept, or 0 if the cache is disabled
+    virtual size_t FrameCacheBudget() const = 0;
+
+    /// Keep up to max_bytes of the most recently used frames, 0 to disable.
+    /// Frames up to ahead frames on in the direction of travel are decoded
+    /// speculatively in the background.
+    virtual void SetFrameCache(size_t max_bytes, size_t ahead) = 0;
+};
+
 }
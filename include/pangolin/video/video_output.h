@@ -33,7 +33,7 @@
 // VideoOutput URI's take the following form:
 //  scheme:[param1=value1,param2=value2,...]//device
 //
-// scheme = ffmpeg
+// scheme = ffmpeg | pango | rawfiles | images | shmem | tcp | udp | v4l
 //
 // ffmpeg - encode to compressed file using ffmpeg
 //  fps : fps to embed in encoded file.
@@ -42,6 +42,106 @@
 //
 //  e.g. ffmpeg://output_file.avi
 //  e.g. ffmpeg:[fps=30,bps=1000000,unique_filename]//output_file.avi
+//
+// pango - record to pangolin packetstream log
+//  buffer_size_mb : write buffer size
+//  encoder, encoderN : image codec for all streams / the Nth stream, e.g. jpg90, png, zstd3, depth (lossless 16 bit),
+//                      or an inter-frame video codec through ffmpeg: h264, h265, av1.
+//                      Append :fast for a fixed PNG filter and speed tuned deflate, and :tN to
+//                      compress each png / zstd / exr image on N threads, e.g. png:fast:t4.
+//                      exr takes its compression too: none, rle, zips, zip (default), piz, pxr24,
+//                      b44, b44a, dwaa or dwab, e.g. exr:piz:t4 for float depth / HDR streams
+//                      A ladder of codecs from best to lowest quality separated by '|', e.g. png|jpg95|jpg80|jpg60,
+//                      steps down under write back-pressure and back up once it clears. Each frame records its level.
+//  adapt_high, adapt_low : write buffer / encode queue occupancy at which ladders step down / up (default 0.5 / 0.1)
+//  adapt_frames : least frames between steps of a ladder (default 30)
+//  encode_threads : encode streams in parallel on this many workers (0: on the calling thread)
+//  encode_queue : maximum frames in flight when encode_threads > 0 (default 2*encode_threads)
+//  drop : block | newest | oldest, what to do when encode_queue is full
+//  direct : bypass the page cache with O_DIRECT writes, this many 1MB blocks in flight (Linux)
+//  lock_free : hand packets to the file writer thread without taking a lock per write
+//  writeback_mb : write back and drop from the page cache every this many MB, for steady
+//                 write latency when recording for long periods (Linux, default 0: left to the kernel)
+//  rotate_mb, rotate_s : continue in a new file (rec.0001.pango, ...) after this size / duration
+//  align : start each frame at a multiple of this many bytes into the file, e.g. 4096
+//  thumbnails : also record jpeg thumbnails every this many frames, for scrubbing in VideoViewer
+//  thumbnail_size, thumbnail_quality : largest thumbnail dimension (default 160) and jpeg quality (default 75)
+//  zstd_workers : compression threads per zstd encoded image
+//  zstd_dict, zstd_dictN : trained zstd dictionary file (zstd --train) for all streams / the Nth stream
+//  keyframe_interval : frames between h264 / h265 / av1 keyframes, from which seeks resume decoding (default 30)
+//  hwaccel : auto | none | nvenc | qsv | vaapi, video encoder to use (auto tries hardware first)
+//  vaapi_device : render node for hwaccel=vaapi, e.g. /dev/dri/renderD128
+//  bitrate : video encoder target bits per second (default: encoder's constant quality mode)
+//  vars : publish buffer occupancy, write rate, blocked time and drops as Vars under this prefix
+//  clock_offset_us : shared time base minus this machine's clock, stamped in the header for playback
+//                    of several machines' recordings aligned (set by RecordNode, see record_coordinator.h)
+//  clock_session, clock_node : names of the coordinated recording and of this machine, stamped in the header
+//  unique_filename : append unique suffix if file already exists
+//
+//  e.g. pango:[encoder=jpg90,encode_threads=8,drop=oldest]//output_file.pango
+//  e.g. pango:[direct=8,buffer_size_mb=512]//output_file.pango
+//  e.g. pango:[vars=record]//output_file.pango (shows record.queued_mb, record.write_mb_per_s, ...)
+//  e.g. pango:[rotate_mb=4096,rotate_s=3600]//output_file.pango (open output_file.pango to play back all files)
+//  e.g. pango:[encoder=zstd3,zstd_workers=4,zstd_dict=depth.dict]//output_file.pango (dictionary is stored in the file)
+//  e.g. pango:[encoder1=h264,encoder2=depth,keyframe_interval=60,encode_threads=2]//output_file.pango
+//  e.g. pango:[encoder=png:fast:t4]//output_file.pango
+//  e.g. pango:[encoder=h264,thumbnails=30]//output_file.pango
+//  e.g. pango:[encoder=zstd3|jpg95|jpg75,encode_threads=4,vars=record]//output_file.pango (shows record.quality_level)
+//
+// rawfiles - record uncompressed, each stream to a preallocated file of its own (name.N.raw) by a thread
+//  of its own, with a pango log indexing them which opens like any other (Unix)
+//  dir1, dir2, ... : directories (disks) to spread the streams over in turn (default: beside the index)
+//  prealloc : grow stream files this many frames at a time (default 256)
+//  direct : write block aligned frames with O_DIRECT, bypassing the page cache (Linux, default 1)
+//  queue : frames of each stream waiting to be written before WriteStreams blocks (default 8)
+//  unique_filename : append unique suffix if file already exists
+//
+//  e.g. rawfiles:[dir1=/mnt/ssd0,dir2=/mnt/ssd1]//capture.pango (open capture.pango to play back)
+//
+// images - write each stream of each frame as a png, plus archive.json describing them
+//  threads : encode and write images on this many workers (default: all cores, 0 on the calling thread)
+//  queue : maximum frames in flight before WriteStreams blocks (default 2*threads)
+//
+//  e.g. images:[threads=8]///home/user/export
+//
+// shmem - publish frames to a named shared memory ring for shmem:// readers in other processes (Linux)
+//  slots : frames held in the ring (default 4). Readers that fall this far behind skip frames
+//  props_bytes : space for each frame's JSON properties (default 4096)
+//  pin_timeout_s : how long to wait for a reader leasing a slot in place before overwriting it (default 1)
+//  memory : host, or cuda to keep frames in device memory shared with readers by CUDA IPC handle (needs CUDA)
+//
+//  e.g. shmem:[slots=8]//camera0
+//  e.g. shmem:[memory=cuda]//camera0 (WriteStreams from host or device memory, frames never leave the GPU)
+//  e.g. VideoInput video("v4l:///dev/video0", "shmem://camera0"); video.Record(); then open shmem://camera0
+//       from any number of viewer / recorder / detector processes
+//
+// tcp / udp - stream to tcp:// / udp:// video inputs on other machines (Unix)
+//  tcp listens on [host:]port for any number of receivers. udp sends to host:port, which may be a
+//  multicast group so that one sender feeds every receiver that joins it.
+//  encoder, encoderN, keyframe_interval, bitrate, hwaccel, vaapi_device : as for pango
+//  queue : frames a receiver may fall behind before the oldest are dropped (default 4). Frames of
+//          h264 / h265 / av1 streams are dropped up to the next keyframe, and tcp receivers joining
+//          restart encoding from a keyframe
+//  datagram : udp datagram size (default 1472, for a 1500 byte MTU)
+//  ttl : multicast hops (default 1, the local network)
+//  iface : address (IPv4) or name (IPv6) of the interface to send multicast from
+//  input : accept mouse and keyboard events sent back by tcp receivers (default 0). Given to
+//          View::RecordOnRender, they drive the window as if local
+//
+//  e.g. tcp:[encoder=jpg85]//5600 (open tcp://this_host:5600 to view)
+//  e.g. udp:[encoder1=h264,keyframe_interval=15]//239.255.0.1:5600 (open udp://239.255.0.1:5600 to view)
+//  e.g. View::RecordOnRender("tcp:[encoder=h264,keyframe_interval=60,input=1]//5600"), then
+//       RemoteView tcp://this_host:5600 to watch and operate the window from elsewhere
+//
+// v4l - write to a V4L2 output device, such as one created by 'modprobe v4l2loopback', which other
+//       programs then open as a webcam (Linux). Writes a single GRAY8, GRAY16LE, YUYV422, UYVY422,
+//       RGB24 or BGR24 stream, or the two streams of an NV12 v4l:// input; convert:// others first
+//  buffers : driver buffers to cycle through (default 4)
+//  fps : frame interval to advertise to readers (default unset)
+//  timeout_ms : how long to wait for a buffer to come back from readers before dropping the frame (default 100)
+//
+//  e.g. v4l:///dev/video10
+//  e.g. VideoInput video("convert:[fmt=RGB24]//test://", "v4l:[fps=30]///dev/video10"); video.Record();
 
 #include <pangolin/video/video_output_interface.h>
 #include <pangolin/utils/uri.h>
@@ -67,9 +167,17 @@ public:
     void SetStreams(const std::vector<StreamInfo>& streams, const std::string& uri = "", const picojson::value& properties = picojson::value() ) override;
 
     int WriteStreams(const unsigned char* data, const picojson::value& frame_properties = picojson::value() ) override;
+
+    int WriteStreams(const unsigned char* data, const FrameMetadata& metadata) override;
     
     bool IsPipe() const override;
 
+    // Return pointer to inner output class as OutputType
+    template<typename OutputType>
+    OutputType* Cast() {
+        return dynamic_cast<OutputType*>(recorder.get());
+    }
+
 protected:
     Uri uri;
     std::unique_ptr<VideoOutputInterface> recorder;
@@ -29,6 +29,7 @@
 
 #include <vector>
 #include <pangolin/platform.h>
+#include <pangolin/video/frame_metadata.h>
 #include <pangolin/video/stream_info.h>
 #include <pangolin/utils/picojson.h>
 
@@ -46,7 +47,25 @@ struct PANGOLIN_EXPORT VideoOutputInterface
 
     virtual int WriteStreams(const unsigned char* data, const picojson::value& frame_properties = picojson::value() ) = 0;
 
+    //! Write a frame with fixed layout metadata. Outputs which can store it
+    //! compactly override this, others record it as JSON frame properties.
+    virtual int WriteStreams(const unsigned char* data, const FrameMetadata& metadata)
+    {
+        return WriteStreams(data, metadata.ToJson());
+    }
+
     virtual bool IsPipe() const = 0;
 };
 
+//! Optional interface for outputs whose remote viewers may send input back,
+//! such as mouse and keyboard events for a streamed window.
+struct PANGOLIN_EXPORT VideoOutputRemoteInputInterface
+{
+    virtual ~VideoOutputRemoteInputInterface() {}
+
+    //! Take the oldest input event received, false if there are none. Events
+    //! are JSON objects as described in net_video_protocol.h.
+    virtual bool PopInputEvent(picojson::value& event) = 0;
+};
+
 }
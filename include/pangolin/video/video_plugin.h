@@ -0,0 +1,58 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/platform.h>
+
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+// Video drivers can be built as plugins (BUILD_PANGOLIN_VIDEO_PLUGINS), which
+// are loaded, along with the SDKs they link, on the first OpenVideo or
+// OpenVideoOutput of one of their schemes. A plugin exports
+// extern "C" void PangolinRegisterVideoPlugin(), registering its factories.
+
+// Directory to search for plugins, after those listed in the
+// PANGOLIN_PLUGIN_PATH environment variable and before the system search path.
+PANGOLIN_EXPORT
+void AddVideoPluginPath(const std::string& dir);
+
+// Load plugin name (file name without extension, e.g. "pango_video_pleora")
+// on first use of any of schemes.
+PANGOLIN_EXPORT
+void RegisterVideoPlugin(const std::string& name, const std::vector<std::string>& schemes);
+
+// Load plugin name now if it isn't already, returning false (with a warning)
+// if it can't be loaded.
+PANGOLIN_EXPORT
+bool LoadVideoPlugin(const std::string& name);
+
+}
@@ -0,0 +1,111 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <pangolin/utils/uri.h>
+#include <pangolin/video/video_interface.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace pangolin
+{
+
+//! Drivers opened by OpenVideo() on a thread while a pool is in scope, kept by
+//! URI so that a chain of filters reopened over the same drivers shares them
+//! instead of reopening the hardware (see VideoInput::Reconfigure()).
+//! Each chain sees a driver through a view of its own, whose Stop() and
+//! Start() are ignored once Detach()ed, so that destroying the chain leaves
+//! the driver streaming. Filters, which hold no hardware, are never pooled.
+class PANGOLIN_EXPORT VideoSourcePool
+{
+public:
+    //! Makes pool the one consulted by OpenVideo() on this thread for the
+    //! lifetime of the scope.
+    class PANGOLIN_EXPORT Scope
+    {
+    public:
+        Scope(VideoSourcePool& pool);
+        ~Scope();
+
+    private:
+        VideoSourcePool* previous;
+    };
+
+    VideoSourcePool();
+    ~VideoSourcePool();
+
+    //! A new view of the driver pooled for uri, or null if there is none or
+    //! it is already in use by the chain being opened.
+    std::unique_ptr<VideoInterface> Reuse(const Uri& uri);
+
+    //! Keep video, just opened for uri, and return a view of it. Filters and
+    //! videos of unnamed or already pooled URIs are returned unchanged.
+    std::unique_ptr<VideoInterface> Share(const Uri& uri, std::unique_ptr<VideoInterface> video);
+
+    //! Cut the views handed out so far off from Stop() and Start() of their
+    //! drivers, and make the drivers available to Reuse() again.
+    void Detach();
+
+    //! Close drivers which no view holds anymore.
+    void Prune();
+
+    //! Close all drivers no view holds, and forget the rest.
+    void Clear();
+
+    //! Number of drivers held.
+    size_t Size() const;
+
+    //! Pool consulted by OpenVideo() on this thread, or null.
+    static VideoSourcePool* Current();
+
+    //! Driver seen through video if it is a view handed out by a pool,
+    //! otherwise null.
+    static VideoInterface* Driver(VideoInterface* video);
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<VideoInterface> video;
+        // Readout of the driver when opened, restored before reuse
+        bool has_readout;
+        VideoReadout readout;
+        // Handed to the chain being opened since the last Detach()
+        bool claimed;
+    };
+
+    std::unique_ptr<VideoInterface> View(Entry& entry);
+
+    std::map<std::string, Entry> entries;
+    // Shared by views handed out since the last Detach(), set once detached
+    std::shared_ptr<bool> detached;
+};
+
+}
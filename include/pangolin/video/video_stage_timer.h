@@ -0,0 +1,243 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <pangolin/video/video_interface.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace pangolin
+{
+
+//! Implements VideoStageStatsInterface for drivers, which mark the sections
+//! of each grab with a VideoStageTimer::Grab. Sections are accumulated with
+//! relaxed atomics so that stats can be read from any thread, though each
+//! stage is expected to be grabbed from one thread at a time.
+class PANGOLIN_EXPORT VideoStageTimer : public VideoStageStatsInterface
+{
+public:
+    enum Section
+    {
+        StageWait = 0,
+        StageProcess,
+        StageCopy,
+        StageSections
+    };
+
+    //! Times one grab, from construction to destruction. Time between marks
+    //! is attributed to the section marked at the end of it.
+    class Grab
+    {
+    public:
+        Grab(VideoStageTimer& timer)
+            : timer(timer.StageStatsEnabled() ? &timer : nullptr),
+              delivered(false)
+        {
+            if(this->timer) {
+                start = mark = Now();
+                std::fill(sections, sections + StageSections, 0);
+            }
+        }
+
+        ~Grab()
+        {
+            if(timer) {
+                timer->Commit(Now() - start, sections, delivered);
+            }
+        }
+
+        void Mark(Section s)
+        {
+            if(timer) {
+                const int64_t now = Now();
+                sections[s] += now - mark;
+                mark = now;
+            }
+        }
+
+        //! Mark the final section, counting the grab as a delivered frame
+        void Frame(Section s)
+        {
+            Mark(s);
+            delivered = true;
+        }
+
+    private:
+        VideoStageTimer* timer;
+        bool delivered;
+        int64_t start;
+        int64_t mark;
+        int64_t sections[StageSections];
+    };
+
+    VideoStageTimer(const std::string& stage_name)
+        : stage_name(stage_name), enabled(false), dropped(0), overwritten(0), rejected(0)
+    {
+        Reset();
+    }
+
+    void EnableStageStats(bool enable) override
+    {
+        if(enable && !enabled) {
+            Reset();
+        }
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    bool StageStatsEnabled() const override
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    VideoStageStats StageStats(bool latest_frame = false) const override
+    {
+        const Totals& t = latest_frame ? latest : totals;
+        VideoStageStats stats;
+        stats.stage = stage_name;
+        stats.frames = latest_frame ? 1 : t.frames.load(std::memory_order_relaxed);
+        stats.grab_s = Seconds(t.grab_ns);
+        stats.wait_s = Seconds(t.section_ns[StageWait]);
+        stats.process_s = Seconds(t.section_ns[StageProcess]);
+        stats.copy_s = Seconds(t.section_ns[StageCopy]);
+        stats.queue_depth = queue_depth.load(std::memory_order_relaxed);
+        stats.max_queue_depth = max_queue_depth.load(std::memory_order_relaxed);
+        stats.dropped = dropped.load(std::memory_order_relaxed);
+        stats.overwritten = overwritten.load(std::memory_order_relaxed);
+        stats.rejected = rejected.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    std::string StageName() const override
+    {
+        return stage_name;
+    }
+
+protected:
+    //! Time since an earlier StageNow() to add to section s of the latest
+    //! frame, for work done outside of a Grab. 0 while disabled.
+    int64_t StageNow() const
+    {
+        return StageStatsEnabled() ? Now() : 0;
+    }
+
+    void StageAdd(Section s, int64_t since)
+    {
+        if(since) {
+            const int64_t ns = Now() - since;
+            totals.grab_ns.fetch_add(ns, std::memory_order_relaxed);
+            totals.section_ns[s].fetch_add(ns, std::memory_order_relaxed);
+            latest.grab_ns.fetch_add(ns, std::memory_order_relaxed);
+            latest.section_ns[s].fetch_add(ns, std::memory_order_relaxed);
+        }
+    }
+
+    //! Count frames lost at this stage, whether or not timing is enabled
+    void StageDropped(uint64_t n)
+    {
+        if(n) dropped.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void StageOverwritten(uint64_t n)
+    {
+        if(n) overwritten.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void StageRejected(uint64_t n)
+    {
+        if(n) rejected.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void StageQueueDepth(size_t depth)
+    {
+        if(StageStatsEnabled()) {
+            queue_depth.store(depth, std::memory_order_relaxed);
+            if(depth > max_queue_depth.load(std::memory_order_relaxed)) {
+                max_queue_depth.store(depth, std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Totals
+    {
+        std::atomic<uint64_t> frames;
+        std::atomic<int64_t> grab_ns;
+        std::atomic<int64_t> section_ns[StageSections];
+    };
+
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static double Seconds(const std::atomic<int64_t>& ns)
+    {
+        return 1e-9 * (double)ns.load(std::memory_order_relaxed);
+    }
+
+    void Reset()
+    {
+        for(Totals* t : {&totals, &latest}) {
+            t->frames = 0;
+            t->grab_ns = 0;
+            for(auto& ns : t->section_ns) ns = 0;
+        }
+        queue_depth = 0;
+        max_queue_depth = 0;
+    }
+
+    void Commit(int64_t grab_ns, const int64_t* sections, bool delivered)
+    {
+        totals.grab_ns.fetch_add(grab_ns, std::memory_order_relaxed);
+        for(int s=0; s < StageSections; ++s) {
+            totals.section_ns[s].fetch_add(sections[s], std::memory_order_relaxed);
+        }
+        if(delivered) {
+            totals.frames.fetch_add(1, std::memory_order_relaxed);
+            latest.grab_ns.store(grab_ns, std::memory_order_relaxed);
+            for(int s=0; s < StageSections; ++s) {
+                latest.section_ns[s].store(sections[s], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::string stage_name;
+    std::atomic<bool> enabled;
+    Totals totals;
+    Totals latest;
+    std::atomic<size_t> queue_depth;
+    std::atomic<size_t> max_queue_depth;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> overwritten;
+    std::atomic<uint64_t> rejected;
+};
+
+}
@@ -2,6 +2,10 @@
 #include <pybind11/stl.h>
 
 #include <pangolin/pangolin.h>
+#include <pangolin/gl/gldraw.h>
+#include <pangolin/gl/glvbo.h>
+
+#include <vector>
 
 
 namespace py = pybind11;
@@ -223,6 +227,157 @@ void DrawBoxes(py::array_t<double> cameras, py::array_t<double> sizes) {
 }
 
 
+// Points or line vertices kept on the GPU, so that unchanged arrays are
+// uploaded once and drawn each frame without touching the numpy data.
+class ArrayVbo
+{
+public:
+    // points and colors (optional) are Nx3
+    void Upload(py::array_t<float, py::array::c_style | py::array::forcecast> points,
+                py::object colors)
+    {
+        CheckShape(points, 3, "points");
+        UploadTo(vbo, points);
+
+        has_colors = !colors.is_none();
+        if(has_colors) {
+            auto c = py::array_t<float, py::array::c_style | py::array::forcecast>::ensure(colors);
+            if(!c) throw std::invalid_argument("colors must be an Nx3 array");
+            CheckShape(c, 3, "colors");
+            if(c.shape(0) != points.shape(0)) {
+                throw std::invalid_argument("colors must have as many rows as points");
+            }
+            UploadTo(cbo, c);
+        }
+    }
+
+    void Draw(GLenum mode, float point_size) const
+    {
+        if(!vbo.IsValid() || vbo.num_elements == 0) return;
+        if(point_size > 0) glPointSize(point_size);
+
+        vbo.Bind();
+        glVertexPointer(3, GL_FLOAT, 0, 0);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        if(has_colors) {
+            cbo.Bind();
+            glColorPointer(3, GL_FLOAT, 0, 0);
+            glEnableClientState(GL_COLOR_ARRAY);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glDrawArrays(mode, 0, vbo.num_elements);
+
+        if(has_colors) glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    size_t Size() const
+    {
+        return vbo.num_elements;
+    }
+
+protected:
+    static void CheckShape(const py::array& a, ssize_t cols, const char* name)
+    {
+        if(a.ndim() != 2 || a.shape(1) != cols) {
+            throw std::invalid_argument(std::string(name) + " must be an Nx" + std::to_string(cols) + " array");
+        }
+    }
+
+    template<typename Array>
+    static void UploadTo(GlBuffer& buffer, const Array& a)
+    {
+        const GLuint n = (GLuint)a.shape(0);
+        if(!buffer.IsValid() || buffer.num_elements != n) {
+            buffer.Reinitialise(GlArrayBuffer, n, GL_FLOAT, 3, GL_STATIC_DRAW);
+        }
+        if(n) buffer.Upload(a.data(), n * 3 * sizeof(float));
+    }
+
+    GlBuffer vbo;
+    GlBuffer cbo;
+    bool has_colors = false;
+};
+
+// Camera or box poses held on the GPU as column major float matrices for
+// instanced drawing: one draw call however many poses there are.
+class PoseVbo
+{
+public:
+    // poses are Nx4x4 row major (as DrawCameras), colors optional Nx3
+    void Upload(py::array_t<double, py::array::c_style | py::array::forcecast> poses, py::object colors)
+    {
+        if(poses.ndim() != 3 || poses.shape(1) != 4 || poses.shape(2) != 4) {
+            throw std::invalid_argument("poses must be an Nx4x4 array");
+        }
+
+        auto r = poses.unchecked<3>();
+        std::vector<float> T(r.shape(0) * 16);
+        for(ssize_t i = 0; i < r.shape(0); ++i) {
+            for(int c = 0; c < 4; ++c) {
+                for(int rr = 0; rr < 4; ++rr) {
+                    T[i*16 + c*4 + rr] = (float)r(i, rr, c);
+                }
+            }
+        }
+        const GLuint n = (GLuint)r.shape(0);
+        if(!T_wi.IsValid() || T_wi.num_elements != n) {
+            T_wi.Reinitialise(GlArrayBuffer, n, GL_FLOAT, 16, GL_STATIC_DRAW);
+        }
+        if(n) T_wi.Upload(T.data(), T.size() * sizeof(float));
+
+        has_colors = !colors.is_none();
+        if(has_colors) {
+            auto c = py::array_t<float, py::array::c_style | py::array::forcecast>::ensure(colors);
+            if(!c || c.ndim() != 2 || c.shape(1) != 3 || c.shape(0) != poses.shape(0)) {
+                throw std::invalid_argument("colors must be an Nx3 array with a row per pose");
+            }
+            if(!cbo.IsValid() || cbo.num_elements != n) {
+                cbo.Reinitialise(GlArrayBuffer, n, GL_FLOAT, 3, GL_STATIC_DRAW);
+            }
+            if(n) cbo.Upload(c.data(), n * 3 * sizeof(float));
+        }
+    }
+
+    void DrawCameras(float w, float h_ratio, float z_ratio)
+    {
+        if(!T_wi.IsValid()) return;
+        const float h = w * h_ratio;
+        const float z = w * z_ratio;
+        const GLfloat verts[] = {
+            0,0,0, w,h,z,    0,0,0, w,-h,z,
+            0,0,0, -w,-h,z,  0,0,0, -w,h,z,
+            w,h,z, w,-h,z,   -w,h,z, -w,-h,z,
+            -w,h,z, w,h,z,   -w,-h,z, w,-h,z
+        };
+        glDrawVerticesInstanced(16, verts, 3, GL_LINES, T_wi, has_colors ? &cbo : nullptr);
+    }
+
+    void DrawAxes(float scale)
+    {
+        if(!T_wi.IsValid()) return;
+        glDrawAxisInstanced(T_wi, scale);
+    }
+
+    size_t Size() const
+    {
+        return T_wi.num_elements;
+    }
+
+protected:
+    GlBuffer T_wi;
+    GlBuffer cbo;
+    bool has_colors = false;
+};
+
+// Draw every pose in one instanced call, through a temporary buffer
+void DrawCamerasInstanced(py::array_t<double, py::array::c_style | py::array::forcecast> cameras, float w=1.0, float h_ratio=0.75, float z_ratio=0.6) {
+    PoseVbo poses;
+    poses.Upload(cameras, py::none());
+    poses.DrawCameras(w, h_ratio, z_ratio);
+}
+
 // TODO:
 // draw surface
 
@@ -253,6 +408,25 @@ void declareContrib(py::module & m) {
     m.def("DrawBoxes", &DrawBoxes,
         "poses"_a, "sizes"_a);
 
+    m.def("DrawCamerasInstanced", &DrawCamerasInstanced,
+        "poses"_a, "w"_a=1.0, "h_ratio"_a=0.75, "z_ratio"_a=0.6);
+
+    py::class_<ArrayVbo, std::shared_ptr<ArrayVbo>>(m, "ArrayVbo")
+        .def(py::init<>(), "Nx3 points (and colors) kept on the GPU, drawn with a single call")
+        .def("Upload", &ArrayVbo::Upload, "points"_a, "colors"_a = py::none(),
+            "Replace contents, only needed when the arrays change")
+        .def("Draw", &ArrayVbo::Draw, "mode"_a = GL_POINTS, "point_size"_a = 0,
+            "mode normally one of GL_POINTS, GL_LINES, GL_LINE_STRIP")
+        .def("Size", &ArrayVbo::Size);
+
+    py::class_<PoseVbo, std::shared_ptr<PoseVbo>>(m, "PoseVbo")
+        .def(py::init<>(), "Nx4x4 poses kept on the GPU for instanced drawing")
+        .def("Upload", &PoseVbo::Upload, "poses"_a, "colors"_a = py::none(),
+            "Replace contents, only needed when the poses change")
+        .def("DrawCameras", &PoseVbo::DrawCameras, "w"_a=1.0, "h_ratio"_a=0.75, "z_ratio"_a=0.6)
+        .def("DrawAxes", &PoseVbo::DrawAxes, "scale"_a=1.0)
+        .def("Size", &PoseVbo::Size);
+
 }
 
 }
\ No newline at end of file
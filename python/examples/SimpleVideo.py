@@ -0,0 +1,46 @@
+# https://github.com/stevenlovegrove/Pangolin/blob/master/examples/SimpleVideo
+
+import sys
+import threading
+import queue
+
+import pangolin
+
+import numpy as np
+
+
+
+def main(uri):
+    video = pangolin.VideoInput(uri)
+    print('Opened {}: {} streams'.format(uri, video.GetNumStreams()))
+    for s in video.Streams():
+        print('  {}x{} {}'.format(s.Width(), s.Height(), s.PixFormat()))
+
+    # Grabbing releases the GIL, so frames can be read in one thread while
+    # they are processed in another.
+    frames = queue.Queue(maxsize=4)
+
+    def grab():
+        while True:
+            images = video.Grab()
+            frames.put(images)
+            if images is None:
+                break
+
+    threading.Thread(target=grab, daemon=True).start()
+
+    count = 0
+    while True:
+        images = frames.get()
+        if images is None:
+            break
+        # Arrays view the frame buffer the driver wrote into, without copies
+        means = [float(np.mean(im)) for im in images]
+        count += 1
+        if count % 30 == 0:
+            print('frame {}: mean {}'.format(count, means))
+
+
+
+if __name__ == '__main__':
+    main(sys.argv[1] if len(sys.argv) > 1 else 'test://')
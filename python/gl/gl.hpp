@@ -1,3 +1,4 @@
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
@@ -12,6 +13,80 @@ using namespace pybind11::literals;
 
 namespace pangolin {
 
+// GL data type matching the elements of img, or 0 if there is none
+inline GLenum GlTypeFromDtype(const py::array& img)
+{
+    const py::dtype dt = img.dtype();
+    const char kind = dt.kind();
+    const ssize_t bytes = dt.itemsize();
+    if(kind == 'u' || kind == 'b') {
+        return bytes == 1 ? GL_UNSIGNED_BYTE : bytes == 2 ? GL_UNSIGNED_SHORT : bytes == 4 ? GL_UNSIGNED_INT : 0;
+    }else if(kind == 'i') {
+        return bytes == 1 ? GL_BYTE : bytes == 2 ? GL_SHORT : bytes == 4 ? GL_INT : 0;
+    }else if(kind == 'f') {
+#ifdef GL_HALF_FLOAT
+        if(bytes == 2) return GL_HALF_FLOAT;
+#endif
+        return bytes == 4 ? GL_FLOAT : 0;
+    }
+    return 0;
+}
+
+// GL pixel format of an h x w or h x w x channels array, or 0 if there is none
+inline GLenum GlFormatFromShape(const py::array& img)
+{
+    const ssize_t channels = img.ndim() == 2 ? 1 : img.ndim() == 3 ? img.shape(2) : 0;
+    switch(channels) {
+    case 1: return GL_LUMINANCE;
+    case 2: return GL_LUMINANCE_ALPHA;
+    case 3: return GL_RGB;
+    case 4: return GL_RGBA;
+    default: return 0;
+    }
+}
+
+// Upload numpy array img, of data_w x data_h pixels, into tex at (x,y)
+// without copying or converting it. data_format and data_type are deduced
+// from the array's shape and dtype where 0. Rows may be padded, but pixels
+// within rows must be packed. The GIL is released whilst uploading.
+template<typename Tex>
+void UploadArray(Tex& tex, const py::array& img, GLenum data_format, GLenum data_type, GLsizei x, GLsizei y, bool whole)
+{
+    if(img.ndim() != 2 && img.ndim() != 3) {
+        throw std::invalid_argument("Upload: expected an h x w or h x w x channels array");
+    }
+    if(!data_type) data_type = GlTypeFromDtype(img);
+    if(!data_format) data_format = GlFormatFromShape(img);
+    if(!data_type || !data_format) {
+        throw std::invalid_argument("Upload: no OpenGL format for this array, convert it with astype() first");
+    }
+
+    const GLsizei h = (GLsizei)img.shape(0);
+    const GLsizei w = (GLsizei)img.shape(1);
+    const ssize_t item_bytes = img.itemsize();
+    const ssize_t pixel_bytes = item_bytes * (img.ndim() == 3 ? img.shape(2) : 1);
+    if( (img.ndim() == 3 && img.strides(2) != item_bytes) || img.strides(1) != pixel_bytes ||
+        img.strides(0) < w * pixel_bytes || img.strides(0) % pixel_bytes ) {
+        throw std::invalid_argument("Upload: pixels of each row must be contiguous, use numpy.ascontiguousarray()");
+    }
+    if(whole ? (w != tex.width || h != tex.height) : (x < 0 || y < 0 || x + w > tex.width || y + h > tex.height)) {
+        throw std::invalid_argument("Upload: array doesn't fit the texture");
+    }
+
+    const void* data = img.data();
+    const GLint row_length = (GLint)(img.strides(0) / pixel_bytes);
+    py::gil_scoped_release release;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length == w ? 0 : row_length);
+    if(whole) {
+        tex.Upload(data, data_format, data_type);
+    }else{
+        tex.Upload(data, x, y, w, h, data_format, data_type);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
 void declareGL(py::module & m) {
 
     declareColour(m);
@@ -47,12 +122,17 @@ void declareGL(py::module & m) {
             "image"_a, "data_layout"_a = GL_LUMINANCE, "data_type"_a = GL_FLOAT)
         .def("Download", (void (GlTexture::*) (TypedImage&) const) &GlTexture::Download, "image"_a)
 
-        .def("Upload", [](GlTexture &t, py::array_t<unsigned char> img, GLenum data_format, GLenum data_type) {
-                auto buf = img.request();
-                unsigned char* data = (unsigned char*) buf.ptr;
-                t.Upload(data, data_format, data_type);
+        .def("Upload", [](GlTexture &t, py::array img, GLenum data_format, GLenum data_type) {
+                UploadArray(t, img, data_format, data_type, 0, 0, true);
+            },
+            "image"_a, "data_format"_a = 0, "data_type"_a = 0,
+            "Upload numpy array image (h x w or h x w x channels) as is. data_format\n"
+            "and data_type follow its shape and dtype unless given.")
+        .def("Upload", [](GlTexture &t, py::array img, GLsizei tex_x_offset, GLsizei tex_y_offset, GLenum data_format, GLenum data_type) {
+                UploadArray(t, img, data_format, data_type, tex_x_offset, tex_y_offset, false);
             },
-            "image"_a, "data_format"_a = GL_RGB, "data_type"_a = GL_UNSIGNED_BYTE)
+            "image"_a, "tex_x_offset"_a, "tex_y_offset"_a, "data_format"_a = 0, "data_type"_a = 0,
+            "Upload numpy array image into the region of the texture at (tex_x_offset, tex_y_offset).")
 
         .def("Load", &GlTexture::Load, "image"_a, "sampling_linear"_a = true)
         .def("LoadFromFile", &GlTexture::LoadFromFile, "filename"_a, "sampling_linear"_a)
@@ -79,6 +159,23 @@ void declareGL(py::module & m) {
     
     ;
 
+    py::class_<GlStreamingTexture, GlTexture, std::shared_ptr<GlStreamingTexture>>(m, "GlStreamingTexture")
+        .def(py::init<>())
+        .def(py::init<GLint, GLint, GLint, bool, int, GLenum, GLenum, GLvoid*>(),
+            "width"_a, "height"_a, "internal_format"_a = GL_RGBA8, "sampling_linear"_a = true, "border"_a = 0,
+            "glformat"_a = GL_RGBA, "gltype"_a = GL_UNSIGNED_BYTE, "data"_a = nullptr,
+            "Texture uploaded through a ring of pixel buffers, so that uploads don't stall on the GPU")
+        .def("SetStreaming", &GlStreamingTexture::SetStreaming,
+            "num_buffers"_a, "min_stream_bytes"_a = GlStreamingTexture::default_min_stream_bytes,
+            "Ring size (0 to always upload directly) and smallest image to stream")
+        .def("Upload", [](GlStreamingTexture &t, py::array img, GLenum data_format, GLenum data_type) {
+                UploadArray(t, img, data_format, data_type, 0, 0, true);
+            },
+            "image"_a, "data_format"_a = 0, "data_type"_a = 0,
+            "As GlTexture.Upload, streamed through the pixel buffer ring. image may be\n"
+            "reused as soon as this returns.")
+    ;
+
     // GlRenderBuffer
     // GlFramebuffer
     // GlBufferType
@@ -23,6 +23,7 @@
 #include "plot/plotter.hpp"
 #include "gl/gl.hpp"
 #include "gl/gldraw.hpp"
+#include "video/video.hpp"
 #include "contrib.hpp"
 
 
@@ -96,6 +97,9 @@ PYBIND11_MODULE(pangolin, m) {
     // gl/gldraw
     declareGLDraw(m);
 
+    // video
+    declareVideo(m);
+
     // contrib
     declareContrib(m);
 
@@ -1,4 +1,5 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 #include <pangolin/plot/datalog.h>
@@ -37,19 +38,34 @@ void declareDataLog(py::module & m) {
         .def("AddSamples", &DataLogBlock::AddSamples,
             "num_samples"_a, "dimensions"_a, "data_dim_major"_a)
         .def("ClearLinked", &DataLogBlock::ClearLinked)
-        .def("NextBlock", &DataLogBlock::NextBlock)   // ->DataLogBlock*
+        .def("NextBlock", &DataLogBlock::NextBlock,
+            py::return_value_policy::reference_internal)   // ->DataLogBlock*
         .def("StartId", &DataLogBlock::StartId)   // -> size_t
         .def("DimData", &DataLogBlock::DimData,
             "d"_a)                                    // -> float*
         .def("Dimensions", &DataLogBlock::Dimensions)  // -> size_t
+        .def("Stats", &DataLogBlock::Stats,
+            "d"_a)                                    // -> DimensionStats
         .def("Sample", &DataLogBlock::Sample,
             "n"_a)                                    // -> const float*
+
+        // Read only samples x dims view of the block, valid while the log is
+        .def("Data", [](py::object self) {
+                const DataLogBlock& b = self.cast<const DataLogBlock&>();
+                const ssize_t dims = (ssize_t)b.Dimensions();
+                py::array_t<float> a(
+                    { (ssize_t)b.Samples(), dims },
+                    { dims * (ssize_t)sizeof(float), (ssize_t)sizeof(float) },
+                    b.DimData(0), self);
+                a.attr("setflags")("write"_a = false);
+                return a;
+            })
     ;
 
 
     py::class_<DataLog>(m, "DataLog")
-        .def(py::init<unsigned int>(),
-            "block_samples_alloc"_a=10000)
+        .def(py::init<unsigned int, bool>(),
+            "block_samples_alloc"_a=10000, "single_writer"_a=false)
 
         .def("SetLabels", &DataLog::SetLabels,
             "labels"_a)   // (const std::vector<std::string> &) -> void
@@ -67,14 +83,29 @@ void declareDataLog(py::module & m) {
         .def("Log", (void (DataLog::*) (float, float, float, float, float, float, float, float)) &DataLog::Log)
         .def("Log", (void (DataLog::*) (float, float, float, float, float, float, float, float, float)) &DataLog::Log)
         .def("Log", (void (DataLog::*) (float, float, float, float, float, float, float, float, float, float)) &DataLog::Log)
+        // samples x dims array (or a single sample) logged in one call
+        .def("Log", [](DataLog& log, py::array_t<float, py::array::c_style | py::array::forcecast> vals) {
+                if(vals.ndim() == 0 || vals.ndim() > 2) {
+                    throw std::invalid_argument("Log expects a 1D sample or 2D samples x dims array");
+                }
+                const size_t samples = vals.ndim() == 2 ? vals.shape(0) : 1;
+                const size_t dims = vals.shape(vals.ndim() - 1);
+                const float* data = vals.data();
+                py::gil_scoped_release release;
+                log.Log(dims, data, (unsigned int)samples);
+            }, "vals"_a)
         .def("Log", (void (DataLog::*) (const std::vector<float> &)) &DataLog::Log)
 
         .def("Clear", &DataLog::Clear)
+        .def("SetRollingWindow", &DataLog::SetRollingWindow,
+            "max_samples"_a, "spill_filename"_a="")   // (size_t, std::string) ->
         .def("Save", &DataLog::Save,
             "filename"_a)   // std::string ->
 
-        .def("FirstBlock", &DataLog::FirstBlock)   // () -> const DataLogBlock*
-        .def("LastBlock", &DataLog::LastBlock)    // () -> const DataLogBlock*
+        .def("FirstBlock", &DataLog::FirstBlock,
+            py::return_value_policy::reference_internal)   // () -> const DataLogBlock*
+        .def("LastBlock", &DataLog::LastBlock,
+            py::return_value_policy::reference_internal)    // () -> const DataLogBlock*
         .def("Samples", &DataLog::Samples)   // () -> size_t
         .def("Sample", &DataLog::Sample,
             "n"_a)     // (int) -> const float*
@@ -112,6 +112,7 @@ void declarePlotter(py::module & m) {
         .def("MouseMotion", &Plotter::MouseMotion)
         .def("PassiveMouseMotion", &Plotter::PassiveMouseMotion)
         .def("Special", &Plotter::Special)
+        .def("SetBatchSeries", &Plotter::SetBatchSeries, "batch"_a=true)
         .def("ClearSeries", &Plotter::ClearSeries)
         .def("AddSeries", &Plotter::AddSeries, 
             "x_expr"_a, "y_expr"_a, "mode"_a=DrawingModeLine, "colour"_a=Colour::Unspecified(),
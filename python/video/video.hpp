@@ -0,0 +1,404 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <pangolin/platform.h>
+
+#ifdef BUILD_PANGOLIN_VIDEO
+#include <pangolin/log/packetstream_reader.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_input.h>
+#include <pangolin/video/video_output.h>
+#endif
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+
+namespace pangolin {
+
+#ifdef BUILD_PANGOLIN_VIDEO
+
+namespace {
+
+py::object JsonToPython(const picojson::value& v)
+{
+    if(v.is<picojson::null>()) {
+        return py::none();
+    }
+    return py::module::import("json").attr("loads")(v.serialize());
+}
+
+picojson::value JsonFromPython(const py::object& o)
+{
+    picojson::value v;
+    if(!o.is_none()) {
+        const std::string s = py::str(py::module::import("json").attr("dumps")(o));
+        const std::string err = picojson::parse(v, s);
+        if(!err.empty()) throw std::invalid_argument(err);
+    }
+    return v;
+}
+
+// numpy dtype of each channel, or none if the format has no per pixel,
+// byte aligned channels (packed, bayer or sub-sampled formats).
+bool ChannelDtype(const PixelFormat& fmt, py::dtype& dtype)
+{
+    const unsigned int bits = fmt.channel_bits[0];
+    for(unsigned int c=1; c < fmt.channels; ++c) {
+        if(fmt.channel_bits[c] != bits) return false;
+    }
+    if(fmt.planar || bits % 8 || fmt.bpp != bits * fmt.channels) {
+        return false;
+    }
+
+    const bool is_float = fmt.IsFloat();
+    switch(bits) {
+    case 8:  dtype = py::dtype::of<uint8_t>(); return !is_float;
+    case 16: dtype = py::dtype::of<uint16_t>(); return !is_float;
+    case 32: dtype = is_float ? py::dtype::of<float>() : py::dtype::of<uint32_t>(); return true;
+    case 64: dtype = is_float ? py::dtype::of<double>() : py::dtype::of<uint64_t>(); return true;
+    default: return false;
+    }
+}
+
+// View of stream si within frame, keeping owner alive for as long as the
+// array is. Formats without a natural dtype are viewed as rows of bytes.
+py::array StreamArray(const StreamInfo& si, unsigned char* frame, py::handle owner)
+{
+    unsigned char* data = frame + (size_t)si.Offset();
+    const PixelFormat& fmt = si.PixFormat();
+    py::dtype dtype;
+    if(ChannelDtype(fmt, dtype)) {
+        const ssize_t channel_bytes = fmt.channel_bits[0] / 8;
+        return py::array(dtype,
+            { (ssize_t)si.Height(), (ssize_t)si.Width(), (ssize_t)fmt.channels },
+            { (ssize_t)si.Pitch(), (ssize_t)fmt.channels * channel_bytes, channel_bytes },
+            data, owner);
+    }
+    return py::array(py::dtype::of<uint8_t>(),
+        { (ssize_t)si.Height(), (ssize_t)si.RowBytes() },
+        { (ssize_t)si.Pitch(), (ssize_t)1 },
+        data, owner);
+}
+
+py::list FrameArrays(const std::vector<StreamInfo>& streams, unsigned char* frame, py::handle owner)
+{
+    py::list arrays;
+    for(const StreamInfo& si : streams) {
+        arrays.append(StreamArray(si, frame, owner));
+    }
+    return arrays;
+}
+
+// Pixel format written for an array by VideoOutput.WriteStreams
+std::string FormatForArray(const py::array& a)
+{
+    const ssize_t channels = a.ndim() == 3 ? a.shape(2) : 1;
+    const char kind = a.dtype().kind();
+    const ssize_t bytes = a.itemsize();
+    if(kind == 'u' && bytes == 1) {
+        if(channels == 1) return "GRAY8";
+        if(channels == 3) return "RGB24";
+        if(channels == 4) return "RGBA32";
+    }else if(kind == 'u' && bytes == 2) {
+        if(channels == 1) return "GRAY16LE";
+        if(channels == 3) return "RGB48";
+        if(channels == 4) return "RGBA64";
+    }else if(kind == 'f' && bytes == 4) {
+        if(channels == 1) return "GRAY32F";
+        if(channels == 3) return "RGB96F";
+        if(channels == 4) return "RGBA128F";
+    }else if(kind == 'f' && bytes == 8 && channels == 1) {
+        return "GRAY64F";
+    }
+    throw std::invalid_argument("No pixel format for array of this shape and dtype");
+}
+
+// Python side state for a VideoInput: the frame buffer reused by Grab(reuse=True)
+struct PyVideoInput
+{
+    PyVideoInput(const std::string& uri, const std::string& output_uri)
+        : video(uri, output_uri)
+    {
+    }
+
+    VideoPlaybackInterface* Playback()
+    {
+        return FindFirstMatchingVideoInterface<VideoPlaybackInterface>(video);
+    }
+
+    VideoInput video;
+    std::shared_ptr<std::vector<unsigned char>> reused;
+};
+
+}
+
+void declareVideo(py::module & m) {
+
+    py::class_<PixelFormat>(m, "PixelFormat")
+        .def(py::init(&PixelFormatFromString), "format"_a)
+        .def_property_readonly("format", &PixelFormat::Name)
+        .def_readonly("channels", &PixelFormat::channels)
+        .def_property_readonly("channel_bits", [](const PixelFormat& f){
+                return std::vector<unsigned int>(f.channel_bits, f.channel_bits + f.channels);
+            })
+        .def_readonly("bpp", &PixelFormat::bpp)
+        .def_readonly("planar", &PixelFormat::planar)
+        .def("__repr__", [](const PixelFormat& f){ return f.Name(); });
+
+    py::class_<StreamInfo>(m, "StreamInfo")
+        .def("PixFormat", &StreamInfo::PixFormat)
+        .def("Width", &StreamInfo::Width)
+        .def("Height", &StreamInfo::Height)
+        .def("Pitch", &StreamInfo::Pitch)
+        .def("RowBytes", &StreamInfo::RowBytes)
+        .def("SizeBytes", &StreamInfo::SizeBytes)
+        .def("Offset", [](const StreamInfo& si){ return (size_t)si.Offset(); });
+
+    py::class_<PyVideoInput, std::shared_ptr<PyVideoInput>>(m, "VideoInput")
+        .def(py::init<const std::string&, const std::string&>(),
+            "uri"_a, "output_uri"_a = "pango:[buffer_size_mb=100]//video_log.pango")
+        .def("Start", [](PyVideoInput& v){ v.video.Start(); })
+        .def("Stop", [](PyVideoInput& v){ v.video.Stop(); })
+        .def("Close", [](PyVideoInput& v){ v.video.Close(); })
+        .def("Width", [](PyVideoInput& v){ return v.video.Width(); })
+        .def("Height", [](PyVideoInput& v){ return v.video.Height(); })
+        .def("PixFormat", [](PyVideoInput& v){ return v.video.PixFormat(); })
+        .def("SizeBytes", [](PyVideoInput& v){ return v.video.SizeBytes(); })
+        .def("Streams", [](PyVideoInput& v){ return v.video.Streams(); })
+        .def("GetNumStreams", [](PyVideoInput& v){ return v.video.Streams().size(); })
+        .def("GetStreamsBitDepth", [](PyVideoInput& v){
+                std::vector<unsigned int> bits;
+                for(const StreamInfo& si : v.video.Streams()) bits.push_back(si.PixFormat().channel_bits[0]);
+                return bits;
+            })
+
+        .def("GetCurrentFrameId", [](PyVideoInput& v) -> py::object {
+                VideoPlaybackInterface* p = v.Playback();
+                if(!p) return py::none();
+                return py::cast(p->GetCurrentFrameId());
+            })
+        .def("GetTotalFrames", [](PyVideoInput& v) -> py::object {
+                VideoPlaybackInterface* p = v.Playback();
+                if(!p) return py::none();
+                return py::cast(p->GetTotalFrames());
+            })
+        .def("Seek", [](PyVideoInput& v, size_t frameid) -> py::object {
+                VideoPlaybackInterface* p = v.Playback();
+                if(!p) return py::none();
+                size_t f;
+                {
+                    py::gil_scoped_release release;
+                    f = p->Seek(frameid);
+                }
+                return py::cast(f);
+            }, "frameid"_a)
+
+        .def("DeviceProperties", [](PyVideoInput& v) -> py::object {
+                VideoPropertiesInterface* p = FindFirstMatchingVideoInterface<VideoPropertiesInterface>(v.video);
+                if(!p) return py::none();
+                return JsonToPython(p->DeviceProperties());
+            })
+        .def("FrameProperties", [](PyVideoInput& v) -> py::object {
+                VideoPropertiesInterface* p = FindFirstMatchingVideoInterface<VideoPropertiesInterface>(v.video);
+                if(!p) return py::none();
+                return JsonToPython(p->FrameProperties());
+            })
+
+        .def("Stats", [](PyVideoInput& v) -> py::object {
+                const VideoInputStats s = v.video.Stats();
+                picojson::value json;
+                json["frames"] = s.frames;
+                json["untimed_frames"] = s.untimed_frames;
+                json["dropped"] = s.dropped;
+                json["overwritten"] = s.overwritten;
+                json["rejected"] = s.rejected;
+                json["latency_p50_us"] = s.latency_us.Percentile(0.5);
+                json["latency_p99_us"] = s.latency_us.Percentile(0.99);
+                json["latency_max_us"] = s.latency_us.Max();
+                json["latency_mean_us"] = s.latency_us.Mean();
+                json["stages"] = VideoStageStatsJson(s.stages);
+                return JsonToPython(json);
+            })
+        .def("ResetStats", [](PyVideoInput& v){ v.video.ResetStats(); })
+
+        .def("Grab", [](PyVideoInput& v, bool wait, bool newest, bool reuse) -> py::object {
+                // With reuse, frames land in the same buffer as the last
+                // reuse Grab unless arrays viewing it are still alive.
+                std::shared_ptr<std::vector<unsigned char>> buffer = reuse ? v.reused : nullptr;
+                if(!buffer || buffer.use_count() > 2 || buffer->size() != v.video.SizeBytes()) {
+                    buffer = std::make_shared<std::vector<unsigned char>>(v.video.SizeBytes());
+                }
+                if(reuse) v.reused = buffer;
+
+                bool ok;
+                {
+                    py::gil_scoped_release release;
+                    ok = newest ? v.video.GrabNewest(buffer->data(), wait) : v.video.GrabNext(buffer->data(), wait);
+                }
+                if(!ok) return py::none();
+
+                py::capsule owner(new std::shared_ptr<std::vector<unsigned char>>(buffer), [](void* p){
+                    delete reinterpret_cast<std::shared_ptr<std::vector<unsigned char>>*>(p);
+                });
+                return FrameArrays(v.video.Streams(), buffer->data(), owner);
+            }, "wait"_a = true, "newest"_a = false, "reuse"_a = false,
+            "List of per stream numpy arrays for the next frame, or None. The driver\n"
+            "writes straight into the arrays' memory. With reuse that memory is\n"
+            "recycled once the arrays of the previous reuse Grab have been freed.")
+
+        .def("GrabLease", [](PyVideoInput& v, bool wait, bool newest) -> py::object {
+                std::shared_ptr<FrameLease> lease;
+                {
+                    py::gil_scoped_release release;
+                    lease = std::make_shared<FrameLease>(newest ? v.video.GrabNewestLease(wait) : v.video.GrabNextLease(wait));
+                }
+                if(!*lease) return py::none();
+
+                py::capsule owner(new std::shared_ptr<FrameLease>(lease), [](void* p){
+                    delete reinterpret_cast<std::shared_ptr<FrameLease>*>(p);
+                });
+                return FrameArrays(v.video.Streams(), lease->data(), owner);
+            }, "wait"_a = true, "newest"_a = false,
+            "As Grab, with arrays viewing the driver's own buffer where it supports\n"
+            "leasing. The buffer returns to the driver once all the arrays are freed.")
+
+        .def("Record", [](PyVideoInput& v){ v.video.Record(); })
+        .def("RecordOneFrame", [](PyVideoInput& v){ v.video.RecordOneFrame(); })
+        .def("IsRecording", [](PyVideoInput& v){ return v.video.IsRecording(); })
+        .def("SetTimelapse", [](PyVideoInput& v, size_t n){ v.video.SetTimelapse(n); }, "one_in_n_frames"_a);
+
+    py::class_<VideoOutput, std::shared_ptr<VideoOutput>>(m, "VideoOutput")
+        .def(py::init<const std::string&>(), "uri"_a)
+        .def("IsOpen", &VideoOutput::IsOpen)
+        .def("Open", &VideoOutput::Open, "uri"_a)
+        .def("Close", &VideoOutput::Close)
+        .def("Streams", &VideoOutput::Streams)
+        .def("WriteStreams", [](VideoOutput& vout, std::vector<py::array> arrays, py::object formats, py::object properties){
+                // Streams are laid out back to back by the first frame written
+                if(vout.Streams().empty()) {
+                    std::vector<StreamInfo> streams;
+                    size_t offset = 0;
+                    for(size_t i=0; i < arrays.size(); ++i) {
+                        const py::array& a = arrays[i];
+                        if(a.ndim() < 2 || a.ndim() > 3) throw std::invalid_argument("arrays must be HxW or HxWxC");
+                        const std::string fmt = formats.is_none() ? FormatForArray(a) : formats.cast<std::vector<std::string>>().at(i);
+                        const PixelFormat pf = PixelFormatFromString(fmt);
+                        const size_t pitch = a.shape(1) * pf.bpp / 8;
+                        streams.push_back(StreamInfo(pf, a.shape(1), a.shape(0), pitch, (unsigned char*)0 + offset));
+                        offset += pitch * a.shape(0);
+                    }
+                    vout.SetStreams(streams);
+                }
+
+                const std::vector<StreamInfo>& streams = vout.Streams();
+                if(streams.size() != arrays.size()) throw std::invalid_argument("expected an array for every stream");
+
+                size_t frame_bytes = 0;
+                for(const StreamInfo& si : streams) frame_bytes = std::max(frame_bytes, (size_t)si.Offset() + si.SizeBytes());
+                std::vector<unsigned char> frame(frame_bytes);
+                for(size_t i=0; i < arrays.size(); ++i) {
+                    const StreamInfo& si = streams[i];
+                    py::array a = py::array::ensure(arrays[i], py::array::c_style);
+                    if(!a || (size_t)a.nbytes() != si.Height() * si.RowBytes()) {
+                        throw std::invalid_argument("array does not match its stream");
+                    }
+                    Image<unsigned char> dst = si.StreamImage(frame.data());
+                    const unsigned char* src = reinterpret_cast<const unsigned char*>(a.data());
+                    for(size_t y=0; y < si.Height(); ++y) {
+                        std::memcpy(dst.RowPtr(y), src + y * si.RowBytes(), si.RowBytes());
+                    }
+                }
+
+                const picojson::value props = JsonFromPython(properties);
+                py::gil_scoped_release release;
+                return vout.WriteStreams(frame.data(), props);
+            }, "streams"_a, "formats"_a = py::none(), "properties"_a = py::none(),
+            "Write a frame given an array per stream. Stream formats are taken on\n"
+            "the first write from formats, or else from the arrays' dtype and shape.");
+
+    py::class_<PacketStreamReader, std::shared_ptr<PacketStreamReader>>(m, "PacketStreamReader")
+        .def(py::init<const std::string&>(), "filename"_a)
+        .def("Close", &PacketStreamReader::Close)
+        .def("MemoryMap", &PacketStreamReader::MemoryMap)
+        .def("IsMemoryMapped", &PacketStreamReader::IsMemoryMapped)
+        .def("NumChunks", &PacketStreamReader::NumChunks)
+        .def("Good", &PacketStreamReader::Good)
+        .def("Sources", [](PacketStreamReader& r){
+                py::list sources;
+                for(const PacketStreamSource& s : r.Sources()) {
+                    py::dict d;
+                    d["id"] = s.id;
+                    d["driver"] = s.driver;
+                    d["uri"] = s.uri;
+                    d["info"] = JsonToPython(s.info);
+                    d["packets"] = s.index.size();
+                    sources.append(d);
+                }
+                return sources;
+            })
+        .def("Seek", [](PacketStreamReader& r, PacketStreamSourceId src, size_t framenum){
+                py::gil_scoped_release release;
+                return r.Seek(src, framenum);
+            }, "src"_a, "framenum"_a)
+        .def("NextFrame", [](std::shared_ptr<PacketStreamReader> r, py::object src) -> py::object {
+                const bool any_src = src.is_none();
+                const PacketStreamSourceId src_id = any_src ? PacketStreamSourceId() : src.cast<PacketStreamSourceId>();
+
+                PacketStreamSourceId id;
+                int64_t time;
+                size_t sequence_num;
+                size_t size;
+                picojson::value meta;
+                unsigned char* ptr;
+                std::shared_ptr<const void> owner;
+                {
+                    py::gil_scoped_release release;
+                    Packet p = any_src ? r->NextFrame() : r->NextFrame(src_id);
+                    id = p.src;
+                    time = p.time;
+                    sequence_num = p.sequence_num;
+                    size = p.size;
+                    meta = p.meta;
+
+                    // Packets of a memory mapped log are viewed in place
+                    ptr = p.Data();
+                    if(ptr) {
+                        owner = p.Mapping();
+                    }else{
+                        auto buffer = std::make_shared<std::vector<unsigned char>>(size);
+                        p.Stream().read(reinterpret_cast<char*>(buffer->data()), size);
+                        ptr = buffer->data();
+                        owner = buffer;
+                    }
+                }
+
+                py::capsule cap(new std::shared_ptr<const void>(owner), [](void* o){
+                    delete reinterpret_cast<std::shared_ptr<const void>*>(o);
+                });
+                py::dict d;
+                d["src"] = id;
+                d["time"] = time;
+                d["sequence_num"] = sequence_num;
+                d["data"] = py::array(py::dtype::of<uint8_t>(), { (ssize_t)size }, { (ssize_t)1 }, ptr, cap);
+                d["meta"] = JsonToPython(meta);
+                return std::move(d);
+            }, "src"_a = py::none(),
+            "Next packet, of src if given, as a dict with its data as a uint8 array.\n"
+            "Data of a memory mapped log is not copied.");
+}
+
+#else
+
+void declareVideo(py::module & /*m*/) {
+}
+
+#endif // BUILD_PANGOLIN_VIDEO
+
+}
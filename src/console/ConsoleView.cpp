@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <iterator>
 #include <pangolin/console/ConsoleView.h>
 #include <pangolin/utils/picojson.h>
@@ -47,6 +50,11 @@ inline void glColour(const Colour& c)
 ConsoleView::ConsoleView(ConsoleInterpreter* interpreter)
     : interpreter(interpreter),
       font(GlFont::I()),
+      line_buffer_bytes(0),
+      max_buffer_bytes(16*1024*1024),
+      lines_vbo_dirty(true),
+      lines_vbo_count(0),
+      lines_vbo_space(0.0f),
       hiding(false),
       bottom(1.0f),
       background_colour(0.2f, 0.0f, 0.0f, 0.6f),
@@ -82,10 +90,50 @@ ConsoleView::~ConsoleView() {
 void ConsoleView::ProcessOutputLines()
 {
     // empty output queue
+    std::vector<ConsoleLine> lines_in;
     ConsoleLine line_in;
     while(interpreter->PullLine(line_in))
     {
-        AddLine(line_in.text, line_in.linetype);
+        lines_in.push_back(std::move(line_in));
+    }
+    if(lines_in.empty()) return;
+
+    // Skip the oldest of a burst which wouldn't survive the cap anyway
+    size_t first = lines_in.size();
+    size_t bytes = 0;
+    while(first > 0) {
+        const size_t line_bytes = LineBytes(lines_in[first-1].text);
+        if(bytes + line_bytes > max_buffer_bytes) break;
+        bytes += line_bytes;
+        --first;
+    }
+
+    EvictLines(max_buffer_bytes - bytes);
+    for(size_t i=first; i < lines_in.size(); ++i) {
+        line_buffer.push_front( Line(lines_in[i].text, lines_in[i].linetype) );
+    }
+    line_buffer_bytes += bytes;
+    lines_vbo_dirty = true;
+}
+
+void ConsoleView::SetMaxBufferBytes(size_t bytes)
+{
+    max_buffer_bytes = bytes;
+    EvictLines(max_buffer_bytes);
+}
+
+size_t ConsoleView::LineBytes(const std::string& str)
+{
+    // Text, and two triangles of glyph geometry per character
+    return sizeof(Line) + str.size() * (1 + 6 * sizeof(XYUV));
+}
+
+void ConsoleView::EvictLines(size_t max_bytes)
+{
+    while(line_buffer_bytes > max_bytes && !line_buffer.empty()) {
+        line_buffer_bytes -= LineBytes(line_buffer.back().str);
+        line_buffer.pop_back();
+        lines_vbo_dirty = true;
     }
 }
 
@@ -116,12 +164,100 @@ bool ConsoleView::IsShown() const
     return show && !hiding;
 }
 
-void ConsoleView::DrawLine(const ConsoleView::Line& l)
+void ConsoleView::LayOut(ConsoleView::Line& l)
+{
+    if(!l.laid_out) {
+        l.text = font.Text(l.str);
+        l.laid_out = true;
+    }
+}
+
+void ConsoleView::DrawLine(ConsoleView::Line& l)
 {
+    LayOut(l);
     glColour(line_colours[l.linetype]);
     l.text.Draw();
 }
 
+void ConsoleView::BuildLinesVbo(size_t num_lines, GLfloat line_space)
+{
+    std::vector<Vertex> vs;
+    lines_vbo_runs.clear();
+    for(size_t i=0; i < num_lines; ++i) {
+        Line& l = line_buffer[i];
+        LayOut(l);
+        if(l.text.vs.empty()) continue;
+
+        if(lines_vbo_runs.empty() || lines_vbo_runs.back().first != l.text.tex) {
+            lines_vbo_runs.emplace_back(l.text.tex, 0);
+        }
+        lines_vbo_runs.back().second += (GLsizei)l.text.vs.size();
+
+        const Colour& c = line_colours[l.linetype];
+        const GLfloat y = i * line_space;
+        for(const XYUV& g : l.text.vs) {
+            vs.push_back(Vertex{g.x, g.y + y, g.tu, g.tv, c.r, c.g, c.b, c.a});
+        }
+    }
+
+    if(!vs.empty()) {
+        const GLuint floats = (GLuint)(vs.size() * sizeof(Vertex) / sizeof(GLfloat));
+        if(!lines_vbo.IsValid() || lines_vbo.num_elements < floats) {
+            lines_vbo.Reinitialise(GlArrayBuffer, floats, GL_FLOAT, 1, GL_STATIC_DRAW);
+        }
+        lines_vbo.Upload(vs.data(), vs.size() * sizeof(Vertex));
+    }
+}
+
+void ConsoleView::DrawLines(size_t num_lines, GLfloat line_space)
+{
+#ifndef HAVE_GLES
+    const bool colours_changed = lines_vbo_colours.size() != line_colours.size() ||
+        !std::equal(line_colours.begin(), line_colours.end(), lines_vbo_colours.begin(),
+            [](const std::pair<const ConsoleLineType,Colour>& a, const std::pair<const ConsoleLineType,Colour>& b){
+                return a.first == b.first && a.second.r == b.second.r && a.second.g == b.second.g &&
+                       a.second.b == b.second.b && a.second.a == b.second.a;
+            });
+    if(lines_vbo_dirty || colours_changed || num_lines != lines_vbo_count || line_space != lines_vbo_space) {
+        BuildLinesVbo(num_lines, line_space);
+        lines_vbo_dirty = false;
+        lines_vbo_count = num_lines;
+        lines_vbo_space = line_space;
+        lines_vbo_colours = line_colours;
+    }
+    if(lines_vbo_runs.empty()) return;
+
+    lines_vbo.Bind();
+    glVertexPointer(2, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,x));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,tu));
+    glColorPointer(4, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,r));
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    lines_vbo.Unbind();
+
+    GLint first = 0;
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
+    for(const auto& run : lines_vbo_runs) {
+        if(run.first) {
+            run.first->Bind();
+            glDrawArrays(GL_TRIANGLES, first, run.second);
+        }
+        first += run.second;
+    }
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+#else
+    for(size_t l=0; l < num_lines; ++l) {
+        DrawLine(line_buffer[l]);
+        glTranslated(0.0, line_space, 0.0);
+    }
+#endif
+}
+
 void ConsoleView::Render()
 {
     if(hiding) {
@@ -147,15 +283,15 @@ void ConsoleView::Render()
 #endif
 
     this->ActivatePixelOrthographic();
-    glDisable(GL_DEPTH_TEST );
-    glDisable(GL_LIGHTING);
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_LINE_SMOOTH);
-    glDisable( GL_COLOR_MATERIAL );
+    GlStateCache::I().Disable(GL_DEPTH_TEST );
+    GlStateCache::I().Disable(GL_LIGHTING);
+    GlStateCache::I().Disable(GL_SCISSOR_TEST);
+    GlStateCache::I().Disable(GL_LINE_SMOOTH);
+    GlStateCache::I().Disable( GL_COLOR_MATERIAL );
     glLineWidth(1.0);
 
-    glEnable(GL_BLEND);
-    glBlendFunc( GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA );
+    GlStateCache::I().Enable(GL_BLEND);
+    GlStateCache::I().BlendFunc( GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA );
 
     glColour(background_colour);
 
@@ -173,13 +309,13 @@ void ConsoleView::Render()
     glTranslated(10.0, 10.0 + bottom*v.h, 0.0 );
     DrawLine(current_line);
     glTranslated(0.0, line_space, 0.0);
-    for(size_t l=0; l < line_buffer.size(); ++l) {
-        DrawLine(line_buffer[l]);
-        glTranslated(0.0, line_space, 0.0);
-    }
+
+    // Only lines which fit within the view, whatever the animation
+    const size_t visible = line_space > 0 ? (size_t)std::ceil(std::max(0.0, v.h - 10.0) / line_space) : 0;
+    DrawLines(std::min(visible, line_buffer.size()), (GLfloat)line_space);
 
 #ifndef HAVE_GLES
-    glPopAttrib();
+    GlStateCache::I().PopAttrib();
 #endif
 }
 
@@ -210,24 +346,23 @@ void ConsoleView::Keyboard(View&, unsigned char key, int /*x*/, int /*y*/, bool
     if(pressed) {
         if(key=='\r') key = '\n';
 
-        GlText& txt = current_line.text;
-        const std::string cmd = txt.Text();
+        const std::string cmd = current_line.str;
 
         if(key=='`') {
             ToggleShow();
         } else if(key=='\n') {
             interpreter->PushCommand(cmd);
-            line_buffer.push_front(current_line);
+            AddLine(cmd, ConsoleLineTypeCmd);
             hist_id = -1;
             prefix = "";
             edited = true;
-            txt.Clear();
+            current_line = Line();
         }else if(key=='\t') {
             std::vector<std::string> options = interpreter->Complete(cmd,100);
             if(options.size()) {
                 const std::string common = CommonPrefix(options);
                 if(common != cmd) {
-                    current_line = font.Text("%s", common.c_str());
+                    current_line = Line(common);
                 }else{
                     std::stringstream s;
                     std::copy(options.begin(), options.end(), std::ostream_iterator<std::string>(s,", "));
@@ -254,11 +389,14 @@ void ConsoleView::Keyboard(View&, unsigned char key, int /*x*/, int /*y*/, bool
                 current_line = *hist_line;
                 hist_id--;
             }
+        }else if(key==3) {
+            // Ctrl-C
+            interpreter->Cancel();
         }else if(key=='\b') {
-            txt = font.Text("%s", txt.Text().substr(0,txt.Text().size()-1).c_str() );
+            current_line = Line(cmd.substr(0, cmd.empty() ? 0 : cmd.size()-1));
             edited = true;
         }else if(key < PANGO_SPECIAL){
-            txt = font.Text("%s%c", txt.Text().c_str(), key);
+            current_line = Line(cmd + (char)key);
             edited = true;
         }
     }
@@ -266,7 +404,11 @@ void ConsoleView::Keyboard(View&, unsigned char key, int /*x*/, int /*y*/, bool
 
 void ConsoleView::AddLine(const std::string& text, ConsoleLineType linetype )
 {
-    line_buffer.push_front( Line( font.Text("%s",text.c_str()), linetype) );
+    const size_t bytes = LineBytes(text);
+    EvictLines(max_buffer_bytes > bytes ? max_buffer_bytes - bytes : 0);
+    line_buffer.push_front( Line(text, linetype) );
+    line_buffer_bytes += bytes;
+    lines_vbo_dirty = true;
 }
 
 ConsoleView::Line* ConsoleView::GetLine(int id, ConsoleLineType line_type, const std::string& prefix )
@@ -274,7 +416,7 @@ ConsoleView::Line* ConsoleView::GetLine(int id, ConsoleLineType line_type, const
     int match = 0;
     for(Line& l : line_buffer)
     {
-        if(l.linetype == line_type && l.text.Text().substr(0,prefix.size()) == prefix  ) {
+        if(l.linetype == line_type && l.str.substr(0,prefix.size()) == prefix  ) {
             if(id == match) {
                 return &l;
             }else{
@@ -75,6 +75,7 @@ struct engine {
     EGLDisplay display;
     EGLSurface surface;
     EGLContext context;
+    EGLConfig config;
     int32_t width;
     int32_t height;
 //    struct saved_state state;
@@ -143,6 +144,7 @@ static int engine_init_display(struct engine* engine) {
     engine->display = display;
     engine->context = context;
     engine->surface = surface;
+    engine->config = config;
     engine->width = w;
     engine->height = h;
     
@@ -966,11 +968,79 @@ void ProcessAndroidEvents()
     } while (g_engine.display == NULL);
 }
 
+// Context sharing objects with the activity's, current on a 1x1 pbuffer
+// surface so that it can be bound on another thread.
+struct EglSharedGlContext : public GlContextInterface
+{
+    EglSharedGlContext(EGLDisplay display, EGLConfig config, EGLContext share)
+        : display(display), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT)
+    {
+        const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        const EGLint context_attribs[] = {
+#ifdef HAVE_GLES_2
+            EGL_CONTEXT_CLIENT_VERSION, 2,
+#endif
+            EGL_NONE
+        };
+        surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+        context = eglCreateContext(display, config, share, context_attribs);
+        if(surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT) {
+            if(surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+            if(context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+            throw std::runtime_error("Pangolin EGL: Failed to create shared context");
+        }
+    }
+
+    ~EglSharedGlContext()
+    {
+        eglDestroyContext(display, context);
+        eglDestroySurface(display, surface);
+    }
+
+    void MakeCurrent() override
+    {
+        eglMakeCurrent(display, surface, surface, context);
+    }
+
+    void ReleaseCurrent() override
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+};
+
+std::unique_ptr<GlContextInterface> CreateAndroidSharedContext()
+{
+    // The pbuffer needs a config supporting it alongside the window surface
+    const EGLint attribs[] = {
+            EGL_SURFACE_TYPE, EGL_WINDOW_BIT | EGL_PBUFFER_BIT,
+            EGL_BLUE_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_RED_SIZE, 8,
+            EGL_NONE
+    };
+    EGLConfig config = g_engine.config;
+    EGLint numConfigs = 0;
+    if(eglChooseConfig(g_engine.display, attribs, &config, 1, &numConfigs) != EGL_TRUE || numConfigs < 1) {
+        config = g_engine.config;
+    }
+    return std::unique_ptr<GlContextInterface>(
+        new EglSharedGlContext(g_engine.display, config, g_engine.context)
+    );
+}
+
 void FinishAndroidFrame()
 {
     ProcessAndroidEvents();
     RenderViews();
     PostRender();
+#ifdef HAVE_GLES_2
+    // Draw anything still batched by the compatibility layer
+    pangolin::glEngine().Flush();
+#endif
     eglSwapBuffers(g_engine.display, g_engine.surface);    
 }
 
@@ -0,0 +1,310 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/platform.h>
+#include <pangolin/gl/glinclude.h>
+#include <pangolin/display/display.h>
+#include <pangolin/display/display_internal.h>
+#include <pangolin/display/window.h>
+
+#include <pangolin/display/device/EglWindow.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <EGL/eglext.h>
+
+namespace pangolin
+{
+extern __thread PangolinGl* context;
+
+const int MAX_EGL_DEVICES = 32;
+
+::EGLDisplay GetDeviceDisplay(int device)
+{
+    PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    EGLDeviceEXT devices[MAX_EGL_DEVICES];
+    EGLint num_devices = 0;
+    if(!eglQueryDevicesEXT || !eglGetPlatformDisplayEXT ||
+       !eglQueryDevicesEXT(MAX_EGL_DEVICES, devices, &num_devices) || num_devices == 0)
+    {
+        if(device > 0) {
+            throw std::runtime_error("Pangolin EGL: Device selection requires EGL_EXT_device_enumeration and EGL_EXT_platform_device");
+        }
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    if(device >= num_devices) {
+        throw std::runtime_error("Pangolin EGL: Device " + std::to_string(device) + " requested but only " + std::to_string(num_devices) + " found");
+    }
+    return eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, devices[std::max(device,0)], 0);
+}
+
+EglDisplay::EglDisplay(int device)
+{
+    display = GetDeviceDisplay(device);
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0)) {
+        throw std::runtime_error("Pangolin EGL: Failed to initialise display");
+    }
+}
+
+EglDisplay::~EglDisplay()
+{
+    eglTerminate(display);
+}
+
+std::shared_ptr<EglDisplay> EglDisplay::Get(int device)
+{
+    static std::mutex displays_mutex;
+    static std::map<int,std::weak_ptr<EglDisplay>> displays;
+
+    std::lock_guard<std::mutex> l(displays_mutex);
+    std::shared_ptr<EglDisplay> d = displays[device].lock();
+    if(!d) {
+        d = std::make_shared<EglDisplay>(device);
+        displays[device] = d;
+    }
+    return d;
+}
+
+::EGLConfig ChooseConfig(::EGLDisplay display, int sample_buffers, int samples)
+{
+    const EGLint attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_SAMPLE_BUFFERS, sample_buffers,
+        EGL_SAMPLES, sample_buffers ? samples : 0,
+        EGL_NONE
+    };
+
+    ::EGLConfig config;
+    EGLint num_configs = 0;
+    if(!eglChooseConfig(display, attribs, &config, 1, &num_configs) || num_configs < 1) {
+        if(sample_buffers) {
+            // Multisampling is optional
+            return ChooseConfig(display, 0, 0);
+        }
+        throw std::runtime_error("Pangolin EGL: No matching framebuffer configuration");
+    }
+    return config;
+}
+
+::EGLSurface CreatePbuffer(::EGLDisplay display, ::EGLConfig config, int width, int height)
+{
+    const EGLint attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    ::EGLSurface surface = eglCreatePbufferSurface(display, config, attribs);
+    if(surface == EGL_NO_SURFACE) {
+        throw std::runtime_error("Pangolin EGL: Failed to create pbuffer surface");
+    }
+    return surface;
+}
+
+::EGLContext CreateGlContext(::EGLDisplay display, ::EGLConfig config, ::EGLContext share_context)
+{
+    // The bound API is per thread
+    eglBindAPI(EGL_OPENGL_API);
+    ::EGLContext ctx = eglCreateContext(display, config, share_context, 0);
+    if(ctx == EGL_NO_CONTEXT) {
+        throw std::runtime_error("Pangolin EGL: Failed to create an OpenGL context");
+    }
+    return ctx;
+}
+
+EglWindow::EglWindow(
+    int width, int height, std::shared_ptr<EglDisplay>& display,
+    int sample_buffers, int samples
+) : display(display), glcontext(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE), woken(false)
+{
+    PangolinGl::windowed_size[0] = width;
+    PangolinGl::windowed_size[1] = height;
+
+    config = ChooseConfig(display->display, sample_buffers, samples);
+    surface = CreatePbuffer(display->display, config, width, height);
+    glcontext = CreateGlContext(display->display, config, EGL_NO_CONTEXT);
+}
+
+EglWindow::~EglWindow()
+{
+    if(eglGetCurrentContext() == glcontext) {
+        eglMakeCurrent(display->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+    eglDestroyContext(display->display, glcontext);
+    eglDestroySurface(display->display, surface);
+}
+
+void EglWindow::ToggleFullscreen()
+{
+    // No screen to fill
+}
+
+void EglWindow::Move(int /*x*/, int /*y*/)
+{
+    // No screen to move on
+}
+
+void EglWindow::Resize(unsigned int w, unsigned int h)
+{
+    ::EGLSurface old_surface = surface;
+    surface = CreatePbuffer(display->display, config, w, h);
+    if(eglGetCurrentContext() == glcontext) {
+        eglMakeCurrent(display->display, surface, surface, glcontext);
+    }
+    eglDestroySurface(display->display, old_surface);
+
+    // There is no event loop to report the change, so report it directly
+    if(context == this) {
+        process::Resize(w, h);
+    }else{
+        PangolinGl::windowed_size[0] = w;
+        PangolinGl::windowed_size[1] = h;
+    }
+}
+
+void EglWindow::MakeCurrent()
+{
+    eglBindAPI(EGL_OPENGL_API);
+    eglMakeCurrent(display->display, surface, surface, glcontext);
+    context = this;
+}
+
+void EglWindow::SwapBuffers()
+{
+    // A no-op for single buffered pbuffers, but completes the frame
+    eglSwapBuffers(display->display, surface);
+}
+
+void EglWindow::ProcessEvents()
+{
+    // No windowing system to receive input from
+}
+
+void EglWindow::WaitEvents(double timeout_s)
+{
+    std::unique_lock<std::mutex> l(wake_mutex);
+    if(!redraw_requested) {
+        wake_cond.wait_for(l, std::chrono::duration<double>(timeout_s), [this](){ return woken; });
+    }
+    woken = false;
+}
+
+void EglWindow::Wake()
+{
+    {
+        std::lock_guard<std::mutex> l(wake_mutex);
+        woken = true;
+    }
+    wake_cond.notify_all();
+}
+
+bool EglWindow::SetSwapInterval(int interval)
+{
+    return eglSwapInterval(display->display, interval) == EGL_TRUE;
+}
+
+// Context sharing objects with the window's, current on a 1x1 pbuffer.
+struct EglSharedGlContext : public GlContextInterface
+{
+    EglSharedGlContext(std::shared_ptr<EglDisplay>& d, ::EGLConfig config, ::EGLContext share_context)
+        : display(d), surface(CreatePbuffer(d->display, config, 1, 1)), glcontext(EGL_NO_CONTEXT)
+    {
+        try {
+            glcontext = CreateGlContext(display->display, config, share_context);
+        }catch(...) {
+            eglDestroySurface(display->display, surface);
+            throw;
+        }
+    }
+
+    ~EglSharedGlContext()
+    {
+        eglDestroyContext(display->display, glcontext);
+        eglDestroySurface(display->display, surface);
+    }
+
+    void MakeCurrent() override
+    {
+        eglBindAPI(EGL_OPENGL_API);
+        eglMakeCurrent(display->display, surface, surface, glcontext);
+    }
+
+    void ReleaseCurrent() override
+    {
+        eglMakeCurrent(display->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+    std::shared_ptr<EglDisplay> display;
+    ::EGLSurface surface;
+    ::EGLContext glcontext;
+};
+
+std::unique_ptr<GlContextInterface> EglWindow::CreateSharedContext()
+{
+    return std::unique_ptr<GlContextInterface>(new EglSharedGlContext(display, config, glcontext));
+}
+
+WindowInterface& CreateWindowAndBind(std::string window_title, int w, int h, const Params &params)
+{
+    const int device         = params.Get(PARAM_EGL_DEVICE, -1);
+    const int sample_buffers = params.Get(PARAM_SAMPLE_BUFFERS, 1);
+    const int samples        = params.Get(PARAM_SAMPLES, 1);
+
+    std::shared_ptr<EglDisplay> display = EglDisplay::Get(device);
+    EglWindow* win = new EglWindow(w, h, display, sample_buffers, samples);
+
+    // Add to context map
+    AddNewContext(window_title, std::shared_ptr<PangolinGl>(win) );
+    BindToContext(window_title);
+
+    // GLEW built for GLX also fails to find an X display, but by then has
+    // loaded the GL entry points from the current EGL context.
+    const GLenum err = glewInit();
+    if(err != GLEW_OK
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+       && err != GLEW_ERROR_NO_GLX_DISPLAY
+#endif
+    ) {
+        pango_print_warn("Pangolin EGL: glewInit failed (%d)\n", (int)err);
+    }
+
+    return *context;
+}
+
+}
@@ -209,6 +209,43 @@ void OsxWindow::SwapBuffers()
 //    [view setNeedsDisplay:YES];
 }
 
+// Context sharing objects with the window's. Without a view it has no
+// drawable, which is fine for uploads and offscreen rendering.
+struct OsxSharedGlContext : public GlContextInterface
+{
+    OsxSharedGlContext(NSOpenGLPixelFormat* format, NSOpenGLContext* share)
+    {
+        glcontext = [[NSOpenGLContext alloc] initWithFormat:format shareContext:share];
+        if(!glcontext) {
+            throw std::runtime_error("Pangolin OSX: Failed to create shared context");
+        }
+    }
+
+    ~OsxSharedGlContext()
+    {
+        [glcontext release];
+    }
+
+    void MakeCurrent() override
+    {
+        [glcontext makeCurrentContext];
+    }
+
+    void ReleaseCurrent() override
+    {
+        [NSOpenGLContext clearCurrentContext];
+    }
+
+    NSOpenGLContext* glcontext;
+};
+
+std::unique_ptr<GlContextInterface> OsxWindow::CreateSharedContext()
+{
+    return std::unique_ptr<GlContextInterface>(
+        new OsxSharedGlContext([view pixelFormat], [view openGLContext])
+    );
+}
+
 void OsxWindow::ProcessEvents()
 {
     [NSApp run_step];
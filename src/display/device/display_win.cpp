@@ -309,6 +309,7 @@ LRESULT WinWindow::HandleWinMessages(UINT message, WPARAM wParam, LPARAM lParam)
         //}
         //EndPaint(hWnd, &ps);
         //return 0;
+        redraw_requested = true;
     }
         break;
     case WM_KEYDOWN:
@@ -433,11 +434,69 @@ void WinWindow::MakeCurrent()
     Resize(rect.right - rect.left, rect.bottom - rect.top);
 }
 
+// Context sharing objects with the window's. It binds to the window's device
+// context, which is valid from any thread given matching pixel formats.
+struct WinSharedGlContext : public GlContextInterface
+{
+    WinSharedGlContext(HDC hDC, HGLRC share)
+        : hDC(hDC), hGLRC(wglCreateContext(hDC))
+    {
+        if(!hGLRC || !wglShareLists(share, hGLRC)) {
+            if(hGLRC) wglDeleteContext(hGLRC);
+            throw std::runtime_error("Pangolin Windows: Failed to create shared context");
+        }
+    }
+
+    ~WinSharedGlContext()
+    {
+        wglDeleteContext(hGLRC);
+    }
+
+    void MakeCurrent() override
+    {
+        wglMakeCurrent(hDC, hGLRC);
+    }
+
+    void ReleaseCurrent() override
+    {
+        wglMakeCurrent(NULL, NULL);
+    }
+
+    HDC hDC;
+    HGLRC hGLRC;
+};
+
+std::unique_ptr<GlContextInterface> WinWindow::CreateSharedContext()
+{
+    return std::unique_ptr<GlContextInterface>(new WinSharedGlContext(hDC, hGLRC));
+}
+
 void WinWindow::SwapBuffers()
 {
     ::SwapBuffers(hDC);
 }
 
+void WinWindow::WaitEvents(double timeout_s)
+{
+    if(!redraw_requested) {
+        MsgWaitForMultipleObjects(0, NULL, FALSE, (DWORD)(timeout_s * 1000.0), QS_ALLINPUT);
+    }
+}
+
+void WinWindow::Wake()
+{
+    // Any posted message ends MsgWaitForMultipleObjects
+    PostMessage(hWnd, WM_NULL, 0, 0);
+}
+
+bool WinWindow::SetSwapInterval(int interval)
+{
+    typedef BOOL (WINAPI *wglSwapIntervalEXTProc)(int);
+    const wglSwapIntervalEXTProc wglSwapIntervalEXT =
+        (wglSwapIntervalEXTProc)wglGetProcAddress("wglSwapIntervalEXT");
+    return wglSwapIntervalEXT && wglSwapIntervalEXT(interval);
+}
+
 void WinWindow::ProcessEvents()
 {
     MSG msg;
@@ -43,10 +43,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/select.h>
 #include <unistd.h>
 
 #include <GL/glx.h>
 
+#ifdef HAVE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
+
 namespace pangolin
 {
 extern __thread PangolinGl* context;
@@ -54,11 +60,14 @@ extern __thread PangolinGl* context;
 std::mutex window_mutex;
 std::weak_ptr<X11GlContext> global_gl_context;
 
-const long EVENT_MASKS = ButtonPressMask|ButtonReleaseMask|StructureNotifyMask|ButtonMotionMask|PointerMotionMask|KeyPressMask|KeyReleaseMask|FocusChangeMask;
+const long EVENT_MASKS = ButtonPressMask|ButtonReleaseMask|StructureNotifyMask|ButtonMotionMask|PointerMotionMask|KeyPressMask|KeyReleaseMask|FocusChangeMask|ExposureMask;
 
 #define GLX_CONTEXT_MAJOR_VERSION_ARB       0x2091
 #define GLX_CONTEXT_MINOR_VERSION_ARB       0x2092
 typedef GLXContext (*glXCreateContextAttribsARBProc)(::Display*, ::GLXFBConfig, ::GLXContext, Bool, const int*);
+typedef void (*glXSwapIntervalEXTProc)(::Display*, ::GLXDrawable, int);
+typedef int (*glXSwapIntervalMESAProc)(unsigned int);
+typedef int (*glXSwapIntervalSGIProc)(int);
 
 // Adapted from: http://www.opengl.org/resources/features/OGLextensions/
 bool isExtensionSupported(const char *extList, const char *extension)
@@ -263,7 +272,7 @@ X11GlContext::~X11GlContext()
 X11Window::X11Window(
     const std::string& title, int width, int height,
     std::shared_ptr<X11Display>& display, ::GLXFBConfig chosenFbc
-) : display(display), glcontext(0), win(0), cmap(0)
+) : display(display), glcontext(0), win(0), cmap(0), fbconfig(chosenFbc), xi_opcode(-1)
 {
     PangolinGl::windowed_size[0] = width;
     PangolinGl::windowed_size[1] = height;
@@ -300,10 +309,22 @@ X11Window::X11Window(
 
     delete_message = XInternAtom(display->display, "WM_DELETE_WINDOW", False);
     XSetWMProtocols(display->display, win, &delete_message, 1);
+
+    // Lets other threads interrupt WaitEvents()
+    if(pipe(wake_pipe) == 0) {
+        fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    }else{
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
 }
 
 X11Window::~X11Window()
 {
+    if(wake_pipe[0] >= 0) {
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+    }
     glXMakeCurrent( display->display, 0, 0 );
     XDestroyWindow( display->display, win );
     XFreeColormap( display->display, cmap );
@@ -320,6 +341,49 @@ void X11Window::MakeCurrent()
     MakeCurrent(glcontext ? glcontext->glcontext : global_gl_context.lock()->glcontext);
 }
 
+// Context sharing objects with the window's, current on a 1x1 pbuffer so
+// that it can be bound on another thread without a drawable of its own.
+struct X11SharedGlContext : public GlContextInterface
+{
+    X11SharedGlContext(std::shared_ptr<X11Display>& d, ::GLXFBConfig fbc, GLXContext share_context)
+        : display(d), glcontext(0), pbuffer(0)
+    {
+        const int pbuffer_attribs[] = { GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None };
+        pbuffer = glXCreatePbuffer(display->display, fbc, pbuffer_attribs);
+        if(!pbuffer) {
+            throw std::runtime_error("Pangolin X11: Failed to create pbuffer for shared context");
+        }
+        glcontext = CreateGlContext(display->display, fbc, share_context);
+    }
+
+    ~X11SharedGlContext()
+    {
+        glXDestroyContext(display->display, glcontext);
+        glXDestroyPbuffer(display->display, pbuffer);
+    }
+
+    void MakeCurrent() override
+    {
+        glXMakeContextCurrent(display->display, pbuffer, pbuffer, glcontext);
+    }
+
+    void ReleaseCurrent() override
+    {
+        glXMakeContextCurrent(display->display, None, None, 0);
+    }
+
+    std::shared_ptr<X11Display> display;
+    ::GLXContext glcontext;
+    ::GLXPbuffer pbuffer;
+};
+
+std::unique_ptr<GlContextInterface> X11Window::CreateSharedContext()
+{
+    return std::unique_ptr<GlContextInterface>(new X11SharedGlContext(
+        display, fbconfig, glcontext ? glcontext->glcontext : global_gl_context.lock()->glcontext
+    ));
+}
+
 void X11Window::ToggleFullscreen()
 {
     const Atom _NET_WM_STATE_FULLSCREEN = XInternAtom(display->display, "_NET_WM_STATE_FULLSCREEN", True);
@@ -349,17 +413,188 @@ void X11Window::Resize(unsigned int w, unsigned int h)
     XResizeWindow(display->display, win, w, h);
 }
 
+// Pointer input accumulated over one ProcessEvents() call, so that handlers
+// see the latest position and the summed scroll once per frame rather than
+// once per event.
+struct PendingPointer
+{
+    PendingPointer()
+        : motion(false), active(false), x(0), y(0)
+    {
+        scroll[0] = scroll[1] = 0.0f;
+    }
+
+    void Motion(int px, int py, bool buttons_held)
+    {
+        // Keep the transition between passive and active motion
+        if(motion && active != buttons_held) {
+            Flush();
+        }
+        motion = true;
+        active = buttons_held;
+        x = px;
+        y = py;
+    }
+
+    void Flush()
+    {
+        if(motion) {
+            if(active) {
+                pangolin::process::MouseMotion(x, y);
+            }else{
+                pangolin::process::PassiveMouseMotion(x, y);
+            }
+            motion = false;
+        }
+        if(scroll[0] != 0.0f || scroll[1] != 0.0f) {
+            pangolin::process::Scroll(scroll[0], scroll[1]);
+            scroll[0] = scroll[1] = 0.0f;
+        }
+    }
+
+    bool motion;
+    bool active;
+    int x, y;
+    float scroll[2];
+};
+
+#ifdef HAVE_XINPUT2
+void QueryScrollValuators(X11Window& w)
+{
+    w.scroll_valuators.clear();
+    int ndevices = 0;
+    XIDeviceInfo* devices = XIQueryDevice(w.display->display, XIAllMasterDevices, &ndevices);
+    for(int d = 0; d < ndevices; ++d) {
+        for(int c = 0; c < devices[d].num_classes; ++c) {
+            if(devices[d].classes[c]->type == XIScrollClass) {
+                const XIScrollClassInfo* s = (const XIScrollClassInfo*)devices[d].classes[c];
+                X11Window::ScrollValuator sv;
+                sv.deviceid = devices[d].deviceid;
+                sv.number = s->number;
+                sv.vertical = s->scroll_type == XIScrollTypeVertical;
+                sv.increment = s->increment != 0.0 ? s->increment : 1.0;
+                sv.last = 0.0;
+                sv.valid = false;
+                w.scroll_valuators.push_back(sv);
+            }
+        }
+    }
+    XIFreeDeviceInfo(devices);
+}
+
+void ProcessXInput2Event(X11Window& w, int evtype, const void* data, PendingPointer& pending)
+{
+    switch(evtype) {
+    case XI_Enter:
+        // Scroll valuators are absolute, and may have moved whilst away
+        for(X11Window::ScrollValuator& sv : w.scroll_valuators) {
+            sv.valid = false;
+        }
+        break;
+    case XI_DeviceChanged:
+        QueryScrollValuators(w);
+        break;
+    case XI_Motion:
+    {
+        const XIDeviceEvent* e = (const XIDeviceEvent*)data;
+        const double* value = e->valuators.values;
+        for(int i = 0; i < e->valuators.mask_len * 8; ++i) {
+            if(!XIMaskIsSet(e->valuators.mask, i)) continue;
+            const double v = *value++;
+            for(X11Window::ScrollValuator& sv : w.scroll_valuators) {
+                if(sv.deviceid == e->deviceid && sv.number == i) {
+                    // One increment matches a wheel click, or 10 scroll units
+                    if(sv.valid) {
+                        pending.scroll[sv.vertical ? 1 : 0] += (float)(10.0 * (v - sv.last) / sv.increment);
+                    }
+                    sv.last = v;
+                    sv.valid = true;
+                }
+            }
+        }
+        const bool held = XIMaskIsSet(e->buttons.mask, 1) || XIMaskIsSet(e->buttons.mask, 2) || XIMaskIsSet(e->buttons.mask, 3);
+        pending.Motion((int)e->event_x, (int)e->event_y, held);
+        break;
+    }
+    case XI_ButtonPress:
+    case XI_ButtonRelease:
+    {
+        const XIDeviceEvent* e = (const XIDeviceEvent*)data;
+        // Wheel clicks emulated from smooth scrolling arrive as motion too
+        if(e->flags & XIPointerEmulated) break;
+        pending.Flush();
+        pangolin::process::Mouse(e->detail - 1, evtype == XI_ButtonRelease, (int)e->event_x, (int)e->event_y);
+        break;
+    }
+    }
+}
+#endif // HAVE_XINPUT2
+
+bool X11Window::EnableXInput2()
+{
+#ifdef HAVE_XINPUT2
+    int event, error;
+    int major = 2, minor = 1;
+    if(!XQueryExtension(display->display, "XInputExtension", &xi_opcode, &event, &error) ||
+       XIQueryVersion(display->display, &major, &minor) != Success)
+    {
+        xi_opcode = -1;
+        return false;
+    }
+
+    unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {};
+    XISetMask(mask_bits, XI_ButtonPress);
+    XISetMask(mask_bits, XI_ButtonRelease);
+    XISetMask(mask_bits, XI_Motion);
+    XISetMask(mask_bits, XI_Enter);
+    XISetMask(mask_bits, XI_DeviceChanged);
+
+    XIEventMask mask;
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(mask_bits);
+    mask.mask = mask_bits;
+    XISelectEvents(display->display, win, &mask, 1);
+
+    QueryScrollValuators(*this);
+    return true;
+#else
+    return false;
+#endif
+}
+
 void X11Window::ProcessEvents()
 {
     XEvent ev;
+    PendingPointer pending;
     while(!pangolin::ShouldQuit() && XPending(display->display) > 0)
     {
         XNextEvent(display->display, &ev);
 
+#ifdef HAVE_XINPUT2
+        if(ev.type == GenericEvent && ev.xcookie.extension == xi_opcode) {
+            if(XGetEventData(display->display, &ev.xcookie)) {
+                ProcessXInput2Event(*this, ev.xcookie.evtype, ev.xcookie.data, pending);
+                XFreeEventData(display->display, &ev.xcookie);
+            }
+            continue;
+        }
+#endif
+
+        if(ev.type == MotionNotify) {
+            pending.Motion(ev.xmotion.x, ev.xmotion.y, ev.xmotion.state & (Button1Mask|Button2Mask|Button3Mask));
+            continue;
+        }
+
+        // Anything else is handled in order after the motion preceding it
+        pending.Flush();
+
         switch(ev.type){
         case ConfigureNotify:
             pangolin::process::Resize(ev.xconfigure.width, ev.xconfigure.height);
             break;
+        case Expose:
+            redraw_requested = true;
+            break;
         case ClientMessage:
             // We've only registered to receive WM_DELETE_WINDOW, so no further checks needed.
             pangolin::Quit();
@@ -379,13 +614,6 @@ void X11Window::ProcessEvents()
         case FocusOut:
             pangolin::context->mouse_state = 0;
             break;
-        case MotionNotify:
-            if(ev.xmotion.state & (Button1Mask|Button2Mask|Button3Mask) ) {
-                pangolin::process::MouseMotion(ev.xmotion.x, ev.xmotion.y);
-            }else{
-                pangolin::process::PassiveMouseMotion(ev.xmotion.x, ev.xmotion.y);
-            }
-            break;
         case KeyPress:
         case KeyRelease:
             int key;
@@ -468,12 +696,75 @@ void X11Window::ProcessEvents()
             break;
         }
     }
+
+    if(!pangolin::ShouldQuit()) {
+        pending.Flush();
+    }
 }
 
 void X11Window::SwapBuffers() {
     glXSwapBuffers(display->display, win);
 }
 
+void X11Window::WaitEvents(double timeout_s)
+{
+    // XPending also flushes our requests, which we'll otherwise be waiting on
+    if(XPending(display->display) > 0 || redraw_requested) {
+        return;
+    }
+
+    const int xfd = ConnectionNumber(display->display);
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(xfd, &fds);
+    if(wake_pipe[0] >= 0) {
+        FD_SET(wake_pipe[0], &fds);
+    }
+
+    timeval tv;
+    tv.tv_sec = (time_t)timeout_s;
+    tv.tv_usec = (suseconds_t)((timeout_s - tv.tv_sec) * 1e6);
+    if(select(std::max(xfd, wake_pipe[0]) + 1, &fds, 0, 0, &tv) > 0 && wake_pipe[0] >= 0 && FD_ISSET(wake_pipe[0], &fds)) {
+        char buffer[64];
+        while(read(wake_pipe[0], buffer, sizeof(buffer)) > 0) {}
+    }
+}
+
+void X11Window::Wake()
+{
+    if(wake_pipe[1] >= 0) {
+        const char c = 0;
+        if(write(wake_pipe[1], &c, 1) < 0) {
+            // Pipe is full, so WaitEvents() will return anyway
+        }
+    }
+}
+
+bool X11Window::SetSwapInterval(int interval)
+{
+    const glXSwapIntervalEXTProc glXSwapIntervalEXT =
+        (glXSwapIntervalEXTProc) glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalEXT");
+    if(glXSwapIntervalEXT) {
+        glXSwapIntervalEXT(display->display, win, interval);
+        return true;
+    }
+
+    const glXSwapIntervalMESAProc glXSwapIntervalMESA =
+        (glXSwapIntervalMESAProc) glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+    if(glXSwapIntervalMESA) {
+        return glXSwapIntervalMESA(interval) == 0;
+    }
+
+    // SGI variant can't disable vsync
+    const glXSwapIntervalSGIProc glXSwapIntervalSGI =
+        (glXSwapIntervalSGIProc) glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+    if(glXSwapIntervalSGI && interval > 0) {
+        return glXSwapIntervalSGI(interval) == 0;
+    }
+
+    return false;
+}
+
 WindowInterface& CreateWindowAndBind(std::string window_title, int w, int h, const Params &params)
 {
     const std::string display_name = params.Get(PARAM_DISPLAYNAME, std::string());
@@ -500,6 +791,9 @@ WindowInterface& CreateWindowAndBind(std::string window_title, int w, int h, con
     X11Window* win = new X11Window(window_title, w, h, newdisplay, newfbc);
     win->glcontext = newglcontext;
     win->is_double_buffered = double_buffered;
+    if(params.Get(PARAM_XINPUT2, false) && !win->EnableXInput2()) {
+        pango_print_warn("Pangolin X11: XInput2 unavailable, using core pointer events\n");
+    }
 
     // Add to context map
     AddNewContext(window_title, std::shared_ptr<PangolinGl>(win) );
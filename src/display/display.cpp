@@ -43,9 +43,12 @@
 #include <pangolin/gl/gldraw.h>
 #include <pangolin/display/display.h>
 #include <pangolin/display/display_internal.h>
+#include <pangolin/display/frame_pacing.h>
+#include <pangolin/display/render_stats.h>
 #include <pangolin/handler/handler.h>
 #include <pangolin/utils/simple_math.h>
 #include <pangolin/utils/timer.h>
+#include <pangolin/utils/trace.h>
 #include <pangolin/utils/type_convert.h>
 #include <pangolin/image/image_io.h>
 
@@ -56,16 +59,13 @@
 namespace pangolin
 {
 
-#ifdef BUILD_PANGOLIN_VIDEO
-  // Forward declaration.
-  void SaveFramebuffer(VideoOutput& video, const Viewport& v);
-#endif // BUILD_PANGOLIN_VIDEO
-
 const char* PARAM_DISPLAYNAME    = "DISPLAYNAME";
 const char* PARAM_DOUBLEBUFFER   = "DOUBLEBUFFER";
 const char* PARAM_SAMPLE_BUFFERS = "SAMPLE_BUFFERS";
 const char* PARAM_SAMPLES        = "SAMPLES";
 const char* PARAM_HIGHRES        = "HIGHRES";
+const char* PARAM_EGL_DEVICE     = "EGL_DEVICE";
+const char* PARAM_XINPUT2        = "XINPUT2";
 
 
 typedef std::map<std::string,std::shared_ptr<PangolinGl> > ContextMap;
@@ -85,6 +85,7 @@ PangolinGl::PangolinGl()
 #ifdef HAVE_PYTHON
     , console_view(0)
 #endif
+    , redraw_on_demand(false), redraw_max_idle_s(0.5), redraw_requested(true), redraw_var_changes(0)
 {
 }
 
@@ -188,6 +189,7 @@ WindowInterface& BindToContext(std::string name)
         return *(newcontext.get());
     }else{
         context_to_bind->MakeCurrent();
+        GlStateCache::I().Invalidate();
         return *context_to_bind;
     }
 }
@@ -195,15 +197,44 @@ WindowInterface& BindToContext(std::string name)
 void Quit()
 {
     context->quit = true;
+    context->Wake();
 }
 
 void QuitAll()
 {
+    std::lock_guard<std::mutex> l(contexts_mutex);
     for(auto nc : contexts) {
         nc.second->quit = true;
+        nc.second->Wake();
+    }
+}
+
+void PostRedisplay()
+{
+    if(context) {
+        context->redraw_requested = true;
+        context->Wake();
+    }else{
+        std::lock_guard<std::mutex> l(contexts_mutex);
+        for(auto nc : contexts) {
+            nc.second->redraw_requested = true;
+            nc.second->Wake();
+        }
     }
 }
 
+void SetRedrawOnDemand(bool on_demand, double max_idle_s)
+{
+    context->redraw_on_demand = on_demand;
+    context->redraw_max_idle_s = max_idle_s;
+    context->redraw_requested = true;
+}
+
+bool SetSwapInterval(int interval)
+{
+    return context->SetSwapInterval(interval);
+}
+
 bool ShouldQuit()
 {
     return !context || context->quit;
@@ -254,8 +285,12 @@ void SetFullscreen(bool fullscreen)
 
 void RenderViews()
 {
+    // Skip redundant state changes whilst drawing our own views
+    GlStateCache::Scope filter_gl_state;
+    detail::RenderStatsBeginFrame();
     Viewport::DisableScissor();
     DisplayBase().Render();
+    detail::RenderStatsEndFrame();
 }
 
 void RenderRecordGraphic(const Viewport& v)
@@ -265,6 +300,10 @@ void RenderRecordGraphic(const Viewport& v)
     glRecordGraphic(v.w-2*r, v.h-2*r, r);
 }
 
+#ifdef BUILD_PANGOLIN_VIDEO
+static void ProcessRemoteInput(const Viewport& v);
+#endif
+
 void PostRender()
 {
     while(context->screen_capture.size()) {
@@ -275,8 +314,9 @@ void PostRender()
     
 #ifdef BUILD_PANGOLIN_VIDEO
     if(context->recorder.IsOpen()) {
-        SaveFramebuffer(context->recorder, context->record_view->GetBounds() );
+        context->recorder.Capture(context->record_view->GetBounds());
         RenderRecordGraphic(context->record_view->GetBounds());
+        ProcessRemoteInput(context->record_view->GetBounds());
     }
 #endif // BUILD_PANGOLIN_VIDEO
 
@@ -284,12 +324,39 @@ void PostRender()
     Viewport::DisableScissor();
 }
 
+// Wait until something has changed which needs the window redrawn
+static void WaitForRedraw()
+{
+    const basetime start = TimeNow();
+    while(!ShouldQuit() && !context->redraw_requested.exchange(false)) {
+#ifdef BUILD_PANGOLIN_VARS
+        const uint64_t var_changes = VarState::I().ChangeCount();
+        if(var_changes != context->redraw_var_changes) {
+            context->redraw_var_changes = var_changes;
+            break;
+        }
+#endif
+        const double idle_s = context->redraw_max_idle_s - TimeDiff_s(start, TimeNow());
+        if(idle_s <= 0.0) {
+            break;
+        }
+        context->WaitEvents(idle_s);
+        context->ProcessEvents();
+    }
+}
+
 void FinishFrame()
 {
+    PANGO_TRACE_SCOPE("FinishFrame", "display");
     RenderViews();
     PostRender();
+    detail::FramePacingBeforeSwap();
     context->SwapBuffers();
+    detail::FramePacingAfterSwap();
     context->ProcessEvents();
+    if(context->redraw_on_demand) {
+        WaitForRedraw();
+    }
 }
 
 View& DisplayBase()
@@ -374,31 +441,23 @@ void SaveFramebuffer(std::string prefix, const Viewport& v)
 #endif // HAVE_GLES
 }
 
-#ifdef BUILD_PANGOLIN_VIDEO
-void SaveFramebuffer(VideoOutput& video, const Viewport& v)
-{
-#ifndef HAVE_GLES    
-    const StreamInfo& si = video.Streams()[0];
-    if(video.Streams().size()==0 || (int)si.Width() != v.w || (int)si.Height() != v.h) {
-        video.Close();
-        return;
-    }
 
-    static basetime last_time = TimeNow();
-    const basetime time_now = TimeNow();
-    last_time = time_now;
-    
-    static std::vector<unsigned char> img;
-    img.resize(v.w*v.h*4);
 
-    glReadBuffer(GL_BACK);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1); // TODO: Avoid this?
-    glReadPixels(v.l, v.b, v.w, v.h, GL_RGB, GL_UNSIGNED_BYTE, &img[0] );
-    video.WriteStreams(&img[0]);
-#endif // HAVE_GLES
+// Views that input at window coords (x,y) may have changed need redrawing
+static void InvalidateInput(int x, int y)
+{
+    if(context->activeDisplay) {
+        context->activeDisplay->Invalidate();
+    }
+#ifdef HAVE_PYTHON
+    if(context->console_view) {
+        context->console_view->Invalidate();
+    }
+#endif
+    for(View* v = &context->base; v; v = v->FindChild(x,y)) {
+        v->Invalidate();
+    }
 }
-#endif // BUILD_PANGOLIN_VIDEO
-
 
 namespace process
 {
@@ -420,6 +479,8 @@ void Keyboard( unsigned char key, int x, int y)
 #endif
 
     context->had_input = context->is_double_buffered ? 2 : 1;
+    context->redraw_requested = true;
+    InvalidateInput(x, y);
 
     // Check if global key hook exists
     const KeyhookMap::iterator hook = context->keypress_hooks.find(key);
@@ -446,6 +507,8 @@ void KeyboardUp(unsigned char key, int x, int y)
     {
         context->activeDisplay->handler->Keyboard(*(context->activeDisplay),key,x,y,false);
     }
+    context->redraw_requested = true;
+    InvalidateInput(x, y);
 }
 
 void SpecialFunc(int key, int x, int y)
@@ -471,6 +534,8 @@ void Mouse( int button_raw, int state, int x, int y)
     const bool pressed = (state == 0);
     
     context->had_input = context->is_double_buffered ? 2 : 1;
+    context->redraw_requested = true;
+    InvalidateInput(x, y);
     
     const bool fresh_input = ( (context->mouse_state & 7) == 0);
     
@@ -504,6 +569,8 @@ void MouseMotion( int x, int y)
     last_y = (float)y;
     
     context->had_input = context->is_double_buffered ? 2 : 1;
+    context->redraw_requested = true;
+    InvalidateInput(x, y);
     
     if( context->activeDisplay)
     {
@@ -520,6 +587,8 @@ void PassiveMouseMotion(int x, int y)
     y = context->base.v.h - y;
     
     context->base.handler->PassiveMouseMotion(context->base,x,y,context->mouse_state);
+    context->redraw_requested = true;
+    InvalidateInput(x, y);
     
     last_x = (float)x;
     last_y = (float)y;
@@ -539,6 +608,7 @@ void Resize( int width, int height )
     }
     // TODO: Fancy display managers seem to cause this to mess up?
     context->had_input = 20; //context->is_double_buffered ? 2 : 1;
+    context->redraw_requested = true;
     context->has_resized = 20; //context->is_double_buffered ? 2 : 1;
     Viewport win(0,0,width,height);
     context->base.Resize(win);
@@ -549,6 +619,8 @@ void SpecialInput(InputSpecial inType, float x, float y, float p1, float p2, flo
     // Assume coords already match OpenGl Window Coords
 
     context->had_input = context->is_double_buffered ? 2 : 1;
+    context->redraw_requested = true;
+    InvalidateInput((int)x, (int)y);
     
     const bool fresh_input = (context->mouse_state == 0);
     
@@ -597,11 +669,54 @@ void SubpixMotion(float x, float y, float pressure, float rotation, float tiltx,
 }
 }
 
+#ifdef BUILD_PANGOLIN_VIDEO
+// Replay input sent back by viewers of the recording (e.g. a tcp:// stream
+// opened with input=1) as if it were local, with coordinates relative to the
+// bottom left of the recorded area v.
+static void ProcessRemoteInput(const Viewport& v)
+{
+    picojson::value event;
+    while(context->recorder.PopInputEvent(event)) {
+        try {
+            const std::string type = event.get_value<std::string>("event", "");
+            const int x = v.l + (int)event.get_value<double>("x", 0.0);
+            const int y = v.b + (int)event.get_value<double>("y", 0.0);
+            // process:: takes window coordinates from the top left
+            const int win_y = context->base.v.h - y;
+
+            if(type == "mouse") {
+                const int button = (int)event.get_value<double>("button", 0.0);
+                process::Mouse(button, event.get_value<bool>("pressed", false) ? 0 : 1, x, win_y);
+            }else if(type == "motion") {
+                if(context->mouse_state & 7) {
+                    process::MouseMotion(x, win_y);
+                }else{
+                    process::PassiveMouseMotion(x, win_y);
+                }
+            }else if(type == "scroll") {
+                process::last_x = (float)x;
+                process::last_y = (float)y;
+                process::Scroll((float)event.get_value<double>("dx", 0.0), (float)event.get_value<double>("dy", 0.0));
+            }else if(type == "key") {
+                const unsigned char key = (unsigned char)event.get_value<double>("key", 0.0);
+                if(event.get_value<bool>("pressed", true)) {
+                    process::Keyboard(key, x, win_y);
+                }else{
+                    process::KeyboardUp(key, x, win_y);
+                }
+            }
+        }catch(const std::exception&) {
+            // Malformed event from a remote viewer, skip it
+        }
+    }
+}
+#endif // BUILD_PANGOLIN_VIDEO
+
 void DrawTextureToViewport(GLuint texid)
 {
     OpenGlRenderState::ApplyIdentity();
-    glBindTexture(GL_TEXTURE_2D, texid);
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D, texid);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     
     GLfloat sq_vert[] = { -1,-1,  1,-1,  1, 1,  -1, 1 };
     glVertexPointer(2, GL_FLOAT, 0, sq_vert);
@@ -616,7 +731,7 @@ void DrawTextureToViewport(GLuint texid)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
 }
 
 ToggleViewFunctor::ToggleViewFunctor(View& view)
@@ -0,0 +1,200 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/display/frame_pacing.h>
+#include <pangolin/gl/gl.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace pangolin
+{
+
+namespace {
+
+int64_t Now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Swap intervals kept for the median refresh period, robust to missed vsyncs
+const size_t num_intervals = 15;
+
+// Sleeps overshoot, so the last stretch before the latch point is spun
+const int64_t spin_ns = 500000;
+
+struct FramePacingState
+{
+    FramePacingState()
+        : enabled(false), margin_ns(1000000), num_valid(0), next_interval(0),
+          refresh_ns(0), work_ns(0), last_vsync_ns(0), latch_ns(0), target_vsync_ns(0), before_swap_ns(0)
+    {
+        intervals.fill(0);
+    }
+
+    bool enabled;
+    int64_t margin_ns;
+
+    std::array<int64_t,num_intervals> intervals;
+    size_t num_valid;
+    size_t next_interval;
+    int64_t refresh_ns;
+
+    // Peak work per frame, decaying slowly so that an occasional slow frame
+    // doesn't make every later one miss its vsync
+    int64_t work_ns;
+
+    int64_t last_vsync_ns;
+    // Of the current frame, 0 if WaitForLatchPoint() wasn't called
+    int64_t latch_ns;
+    int64_t target_vsync_ns;
+    int64_t before_swap_ns;
+
+    FramePacingStats stats;
+};
+
+FramePacingState& State()
+{
+    static thread_local FramePacingState state;
+    return state;
+}
+
+void AddInterval(FramePacingState& s, int64_t interval_ns)
+{
+    s.intervals[s.next_interval] = interval_ns;
+    s.next_interval = (s.next_interval + 1) % num_intervals;
+    s.num_valid = std::min(s.num_valid + 1, num_intervals);
+
+    // Too few swaps and the median could be of missed vsyncs
+    if(s.num_valid >= 5) {
+        std::array<int64_t,num_intervals> sorted = s.intervals;
+        std::nth_element(sorted.begin(), sorted.begin() + s.num_valid / 2, sorted.begin() + s.num_valid);
+        s.refresh_ns = sorted[s.num_valid / 2];
+    }
+}
+
+}
+
+void EnableFramePacing(bool enable, double margin_ms)
+{
+    FramePacingState& s = State();
+    if(enable && !s.enabled) {
+        s = FramePacingState();
+    }
+    s.enabled = enable;
+    s.margin_ns = (int64_t)(margin_ms * 1e6);
+}
+
+bool FramePacingEnabled()
+{
+    return State().enabled;
+}
+
+void WaitForLatchPoint()
+{
+    FramePacingState& s = State();
+    if(!s.enabled || s.refresh_ns <= 0) {
+        s.latch_ns = s.enabled ? Now_ns() : 0;
+        s.target_vsync_ns = 0;
+        return;
+    }
+
+    // The first vsync far enough ahead for this frame's work
+    const int64_t lead_ns = s.work_ns + s.margin_ns;
+    const int64_t now_ns = Now_ns();
+    const int64_t periods = std::max<int64_t>(1, (now_ns + lead_ns - s.last_vsync_ns + s.refresh_ns - 1) / s.refresh_ns);
+    s.target_vsync_ns = s.last_vsync_ns + periods * s.refresh_ns;
+
+    const int64_t latch_at_ns = s.target_vsync_ns - lead_ns;
+    if(latch_at_ns - now_ns > spin_ns) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(latch_at_ns - now_ns - spin_ns));
+    }
+    while(Now_ns() < latch_at_ns) {
+        std::this_thread::yield();
+    }
+    s.latch_ns = Now_ns();
+}
+
+FramePacingStats GetFramePacingStats()
+{
+    return State().stats;
+}
+
+namespace detail {
+
+void FramePacingBeforeSwap()
+{
+    FramePacingState& s = State();
+    if(!s.enabled) return;
+
+    // Include the GPU's share of the frame's work
+    glFinish();
+    s.before_swap_ns = Now_ns();
+}
+
+void FramePacingAfterSwap()
+{
+    FramePacingState& s = State();
+    if(!s.enabled) return;
+
+    // Returns once the swap has been made, on the vsync with vsync enabled
+    glFinish();
+    const int64_t vsync_ns = Now_ns();
+
+    if(s.last_vsync_ns) {
+        AddInterval(s, vsync_ns - s.last_vsync_ns);
+    }
+
+    if(s.latch_ns) {
+        const int64_t sample_ns = s.before_swap_ns - s.latch_ns;
+        s.work_ns = std::max(sample_ns, s.work_ns - (s.work_ns - sample_ns) / 32);
+
+        if(s.target_vsync_ns && vsync_ns > s.target_vsync_ns + s.refresh_ns / 2) {
+            // Too late for the vsync planned, so latch earlier from now on
+            s.work_ns = std::min(s.work_ns + s.work_ns / 4 + s.margin_ns, s.refresh_ns);
+            ++s.stats.missed;
+        }
+        s.stats.latch_to_vsync_ms = (vsync_ns - s.latch_ns) / 1e6;
+    }
+
+    ++s.stats.frames;
+    s.stats.refresh_ms = s.refresh_ns / 1e6;
+    s.stats.work_ms = s.work_ns / 1e6;
+
+    s.last_vsync_ns = vsync_ns;
+    s.latch_ns = 0;
+    s.target_vsync_ns = 0;
+}
+
+}
+
+}
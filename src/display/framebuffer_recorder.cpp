@@ -0,0 +1,237 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/platform.h>
+
+#ifdef BUILD_PANGOLIN_VIDEO
+
+#include <pangolin/display/framebuffer_recorder.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/video_interface.h>
+
+#include <cstring>
+
+namespace pangolin
+{
+
+FramebufferRecorder::FramebufferRecorder(size_t num_buffers, size_t max_queued)
+    : num_buffers(std::max<size_t>(1, num_buffers)), max_queued(max_queued),
+      width(0), height(0), frame_bytes(0), next_readback(0), finishing(false), dropped(0)
+{
+}
+
+FramebufferRecorder::~FramebufferRecorder()
+{
+    Close();
+}
+
+void FramebufferRecorder::Open(const std::string& uri, int w, int h)
+{
+    Close();
+
+    video.Open(uri);
+    std::vector<StreamInfo> streams;
+    const PixelFormat fmt = PixelFormatFromString("RGB24");
+    streams.push_back( StreamInfo(fmt, w, h, w * fmt.bpp / 8) );
+    video.SetStreams(streams);
+
+    width = w;
+    height = h;
+    frame_bytes = w * h * fmt.bpp / 8;
+    dropped = 0;
+
+#ifndef HAVE_GLES
+    readbacks.resize(num_buffers);
+    for(Readback& r : readbacks) {
+        r.pbo.Reinitialise(GlPixelPackBuffer, (GLuint)frame_bytes, GL_UNSIGNED_BYTE, 1, GL_STREAM_READ);
+    }
+#endif
+    next_readback = 0;
+
+    finishing = false;
+    writer = std::thread(&FramebufferRecorder::WriterLoop, this);
+}
+
+bool FramebufferRecorder::IsOpen() const
+{
+    return video.IsOpen();
+}
+
+void FramebufferRecorder::Close()
+{
+    if(!IsOpen()) {
+        return;
+    }
+
+    // Oldest first, so that frames reach the writer in order
+    for(size_t i=0; i < readbacks.size(); ++i) {
+        Collect(readbacks[(next_readback + i) % readbacks.size()]);
+    }
+    readbacks.clear();
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        finishing = true;
+    }
+    cond.notify_all();
+    if(writer.joinable()) {
+        writer.join();
+    }
+
+    video.Close();
+    if(dropped) {
+        pango_print_warn("FramebufferRecorder: dropped %zu frames that couldn't be encoded in time.\n", dropped);
+    }
+}
+
+size_t FramebufferRecorder::FramesDropped() const
+{
+    std::lock_guard<std::mutex> l(lock);
+    return dropped;
+}
+
+bool FramebufferRecorder::PopInputEvent(picojson::value& event)
+{
+    VideoOutputRemoteInputInterface* input = video.Cast<VideoOutputRemoteInputInterface>();
+    return input && input->PopInputEvent(event);
+}
+
+void FramebufferRecorder::Capture(const Viewport& v)
+{
+    if(!IsOpen()) {
+        return;
+    }
+    if(v.w != width || v.h != height) {
+        Close();
+        return;
+    }
+
+#ifndef HAVE_GLES
+    // Pass on, oldest first, the readbacks which have already completed, so
+    // that streamed frames don't lag a whole ring behind rendering
+    for(size_t i=0; i < readbacks.size(); ++i) {
+        Readback& done = readbacks[(next_readback + i) % readbacks.size()];
+        if(!done.fence) {
+            continue;
+        }
+        const GLenum status = glClientWaitSync((GLsync)done.fence, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        Collect(done);
+    }
+
+    Readback& r = readbacks[next_readback];
+    next_readback = (next_readback + 1) % readbacks.size();
+
+    // Frame from num_buffers captures ago if it hasn't completed yet
+    Collect(r);
+
+    r.pbo.Bind();
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(v.l, v.b, v.w, v.h, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    r.pbo.Unbind();
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r.time_us = Time_us(TimeNow());
+#endif
+}
+
+void FramebufferRecorder::Collect(Readback& r)
+{
+#ifndef HAVE_GLES
+    if(!r.fence) {
+        return;
+    }
+    glClientWaitSync((GLsync)r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync((GLsync)r.fence);
+    r.fence = nullptr;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if(max_queued && queue.size() >= max_queued) {
+            ++dropped;
+            return;
+        }
+    }
+
+    Frame frame{FramePool::I().Acquire(frame_bytes), r.time_us};
+    r.pbo.Bind();
+    const void* src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_bytes, GL_MAP_READ_BIT);
+    if(src) {
+        std::memcpy(frame.buffer.get(), src, frame_bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    r.pbo.Unbind();
+    if(!src) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        queue.push_back(std::move(frame));
+    }
+    cond.notify_one();
+#else
+    PANGOLIN_UNUSED(r);
+#endif
+}
+
+void FramebufferRecorder::WriterLoop()
+{
+    bool failed = false;
+    for(;;) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            cond.wait(l, [this](){ return finishing || !queue.empty(); });
+            if(queue.empty()) {
+                return;
+            }
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        if(failed) {
+            continue;
+        }
+
+        try {
+            picojson::value props;
+            props[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(frame.time_us);
+            video.WriteStreams(frame.buffer.get(), props);
+        }catch(const std::exception& e) {
+            pango_print_warn("FramebufferRecorder: unable to write frame (%s), discarding the rest of the recording.\n", e.what());
+            failed = true;
+        }
+    }
+}
+
+}
+
+#endif // BUILD_PANGOLIN_VIDEO
@@ -0,0 +1,337 @@
+#include <pangolin/display/image_grid_view.h>
+#include <pangolin/gl/glstate.h>
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace pangolin
+{
+
+namespace
+{
+const char* grid_vs =
+        "#version 140\n"
+        "in vec2 a_corner;\n"
+        "uniform vec2 u_grid;\n"
+        "uniform vec2 u_fill;\n"
+        "out vec3 v_uv;\n"
+        "void main() {\n"
+        "  float i = float(gl_InstanceID);\n"
+        "  vec2 cell = vec2(mod(i, u_grid.x), floor(i / u_grid.x));\n"
+        "  vec2 p = (cell + 0.5 + (a_corner - 0.5) * u_fill) / u_grid;\n"
+        "  gl_Position = vec4(2.0 * p.x - 1.0, 1.0 - 2.0 * p.y, 0.0, 1.0);\n"
+        "  v_uv = vec3(a_corner, i);\n"
+        "}\n";
+
+const char* grid_fs =
+        "#version 140\n"
+        "uniform sampler2DArray u_images;\n"
+        "uniform vec2 u_offset_scale;\n"
+        "in vec3 v_uv;\n"
+        "out vec4 frag_color;\n"
+        "void main() {\n"
+        "  vec4 c = texture(u_images, v_uv);\n"
+        "  frag_color = vec4((c.rgb + u_offset_scale.x) * u_offset_scale.y, c.a);\n"
+        "}\n";
+
+// Texture array formats have no luminance, so those are stored as red
+// (and green) channels, swizzled back to grey on sampling.
+GLint ArrayInternalFormat(GLenum format, GLenum type)
+{
+    const size_t channels =
+        (format == GL_LUMINANCE) ? 1 : (format == GL_LUMINANCE_ALPHA) ? 2 :
+        (format == GL_RGB || format == GL_BGR) ? 3 : 4;
+    switch(type) {
+    case GL_UNSIGNED_BYTE:  { const GLint f[] = {GL_R8,   GL_RG8,   GL_RGB8,   GL_RGBA8};   return f[channels-1]; }
+    case GL_UNSIGNED_SHORT: { const GLint f[] = {GL_R16,  GL_RG16,  GL_RGB16,  GL_RGBA16};  return f[channels-1]; }
+    case GL_FLOAT:          { const GLint f[] = {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F}; return f[channels-1]; }
+    default:
+        throw std::runtime_error("ImageGridView: Unsupported pixel type");
+    }
+}
+
+size_t FormatChannels(GLenum format)
+{
+    return (format == GL_BGR) ? 3 : (format == GL_BGRA) ? 4 : GlFormatChannels(format);
+}
+}
+
+ImageGridView::ImageGridView()
+    : offset_scale(0.0, 1.0), pbos(default_num_buffers), next_pbo(0),
+      tex(0), tex_w(0), tex_h(0), tex_layers(0), pixel_bytes(0), tex_format(0),
+      layout{1, 1, 1.0f, 1.0f},
+      pending_w(0), pending_h(0), pending_layers(0), has_pending(false)
+{
+}
+
+ImageGridView::~ImageGridView()
+{
+    Release();
+}
+
+bool ImageGridView::Supported()
+{
+#if !defined(HAVE_GLES) && defined(HAVE_GLEW)
+    return GLEW_VERSION_3_1;
+#else
+    return false;
+#endif
+}
+
+ImageGridView::Layout ImageGridView::ComputeLayout(size_t n, size_t img_w, size_t img_h, int view_w, int view_h)
+{
+    // The number of columns showing the images largest
+    Layout best = {1, (int)n, 1.0f, 1.0f};
+    float best_scale = -1.0f;
+    for(size_t cols = 1; cols <= n; ++cols) {
+        const size_t rows = (n + cols - 1) / cols;
+        const float cell_w = (float)view_w / cols;
+        const float cell_h = (float)view_h / rows;
+        const float scale = std::min(cell_w / img_w, cell_h / img_h);
+        if(scale > best_scale) {
+            best_scale = scale;
+            best = {(int)cols, (int)rows, scale * img_w / cell_w, scale * img_h / cell_h};
+        }
+    }
+    return best;
+}
+
+void ImageGridView::Pack(unsigned char* dst, const std::vector<Image<unsigned char>>& imgs, size_t row_bytes)
+{
+    for(const Image<unsigned char>& img : imgs) {
+        if(img.pitch == row_bytes) {
+            std::memcpy(dst, img.ptr, row_bytes * img.h);
+            dst += row_bytes * img.h;
+        }else{
+            for(size_t y = 0; y < img.h; ++y) {
+                std::memcpy(dst, img.RowPtr(y), row_bytes);
+                dst += row_bytes;
+            }
+        }
+    }
+}
+
+ImageGridView& ImageGridView::SetImages(const std::vector<Image<unsigned char>>& imgs, const GlPixFormat& img_fmt, bool delayed_upload)
+{
+    if(imgs.empty()) {
+        return Clear();
+    }
+    for(const Image<unsigned char>& img : imgs) {
+        if(img.w != imgs[0].w || img.h != imgs[0].h) {
+            throw std::runtime_error("ImageGridView: Images must all be the same size");
+        }
+    }
+    ArrayInternalFormat(img_fmt.glformat, img_fmt.gltype);
+
+    const size_t w = imgs[0].w;
+    const size_t h = imgs[0].h;
+    const size_t row_bytes = w * FormatChannels(img_fmt.glformat) * GlDataTypeBytes(img_fmt.gltype);
+
+    if(delayed_upload) {
+        std::lock_guard<std::mutex> l(pending_lock);
+        pending.Reinitialise(row_bytes, h * imgs.size());
+        Pack(pending.ptr, imgs, row_bytes);
+        pending_w = w;
+        pending_h = h;
+        pending_layers = imgs.size();
+        pending_fmt = img_fmt;
+        has_pending = true;
+    }else{
+        Reinitialise(imgs.size(), w, h, img_fmt);
+        Upload(&imgs, nullptr);
+    }
+    return *this;
+}
+
+ImageGridView& ImageGridView::Clear()
+{
+    std::lock_guard<std::mutex> l(pending_lock);
+    has_pending = false;
+    tex_layers = 0;
+    return *this;
+}
+
+size_t ImageGridView::NumImages() const
+{
+    return tex_layers;
+}
+
+std::pair<float, float>& ImageGridView::GetOffsetScale()
+{
+    return offset_scale;
+}
+
+int ImageGridView::ImageAt(int x, int y) const
+{
+    if(!tex_layers || !v.Contains(x, y)) return -1;
+    const float cell_w = (float)v.w / layout.cols;
+    const float cell_h = (float)v.h / layout.rows;
+    const int col = (int)((x - v.l) / cell_w);
+    const int row = (int)((v.t() - y) / cell_h);
+    const float fx = ((x - v.l) - (col + 0.5f) * cell_w) / cell_w;
+    const float fy = ((v.t() - y) - (row + 0.5f) * cell_h) / cell_h;
+    const int i = row * layout.cols + col;
+    if(std::abs(fx) * 2.0f > layout.fill_x || std::abs(fy) * 2.0f > layout.fill_y || i >= (int)tex_layers) {
+        return -1;
+    }
+    return i;
+}
+
+void ImageGridView::Initialise()
+{
+    prog.AddShader(GlSlVertexShader, grid_vs);
+    prog.AddShader(GlSlFragmentShader, grid_fs);
+    prog.BindAttribLocation(0, "a_corner");
+    prog.Link();
+
+    const float quad[] = {0,0, 1,0, 0,1, 1,1};
+    corners.Reinitialise(GlArrayBuffer, 4, GL_FLOAT, 2, GL_STATIC_DRAW);
+    corners.Upload(quad, sizeof(quad));
+}
+
+void ImageGridView::Reinitialise(size_t n, size_t w, size_t h, const GlPixFormat& img_fmt)
+{
+    const bool same = tex && n == tex_layers && w == tex_w && h == tex_h &&
+        img_fmt.glformat == fmt.glformat && img_fmt.gltype == fmt.gltype;
+    if(same) return;
+
+#ifndef HAVE_GLES
+    if(!tex) {
+        glGenTextures(1, &tex);
+    }
+    const GLint internal = ArrayInternalFormat(img_fmt.glformat, img_fmt.gltype);
+    const size_t channels = FormatChannels(img_fmt.glformat);
+    tex_format = img_fmt.glformat;
+    if(channels == 1) tex_format = GL_RED;
+    if(channels == 2 && img_fmt.glformat == GL_LUMINANCE_ALPHA) tex_format = GL_RG;
+
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal, (GLsizei)w, (GLsizei)h, (GLsizei)n, 0, tex_format, img_fmt.gltype, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if(img_fmt.glformat == GL_LUMINANCE) {
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }else if(img_fmt.glformat == GL_LUMINANCE_ALPHA) {
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    CheckGlDieOnError();
+#endif
+
+    fmt = img_fmt;
+    tex_w = w;
+    tex_h = h;
+    tex_layers = n;
+    pixel_bytes = FormatChannels(img_fmt.glformat) * GlDataTypeBytes(img_fmt.gltype);
+}
+
+void ImageGridView::Upload(const std::vector<Image<unsigned char>>* imgs, const unsigned char* packed)
+{
+#ifndef HAVE_GLES
+    const size_t row_bytes = tex_w * pixel_bytes;
+    const size_t size_bytes = row_bytes * tex_h * tex_layers;
+
+    // Orphan the storage the driver may still be reading rather than wait,
+    // and stage every layer in one mapping
+    GlBuffer& pbo = pbos[next_pbo];
+    next_pbo = (next_pbo + 1) % pbos.size();
+    if(!pbo.IsValid()) {
+        pbo.Reinitialise(GlPixelUnpackBuffer, (GLuint)size_bytes, GL_UNSIGNED_BYTE, 1, GL_STREAM_DRAW);
+    }
+    pbo.Bind();
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size_bytes, nullptr, GL_STREAM_DRAW);
+    unsigned char* dst = (unsigned char*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+    );
+    if(!dst) {
+        pbo.Unbind();
+        pango_print_warn("ImageGridView: Unable to map pixel buffer\n");
+        return;
+    }
+    if(imgs) {
+        Pack(dst, *imgs, row_bytes);
+    }else{
+        std::memcpy(dst, packed, size_bytes);
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, tex);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, (GLsizei)tex_w, (GLsizei)tex_h, (GLsizei)tex_layers, tex_format, fmt.gltype, nullptr);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    pbo.Unbind();
+    GlTextureUploadBytes().fetch_add(size_bytes, std::memory_order_relaxed);
+    CheckGlDieOnError();
+#else
+    PANGOLIN_UNUSED(imgs); PANGOLIN_UNUSED(packed);
+#endif
+}
+
+void ImageGridView::Release()
+{
+    if(tex) {
+        glDeleteTextures(1, &tex);
+        tex = 0;
+    }
+    tex_layers = 0;
+}
+
+void ImageGridView::Render()
+{
+    {
+        std::lock_guard<std::mutex> l(pending_lock);
+        if(has_pending) {
+            Reinitialise(pending_layers, pending_w, pending_h, pending_fmt);
+            Upload(nullptr, pending.ptr);
+            has_pending = false;
+        }
+    }
+
+    if(!tex || !tex_layers) return;
+
+#ifndef HAVE_GLES
+    if(!corners.IsValid()) {
+        Initialise();
+    }
+
+    glPushAttrib(GL_DEPTH_BITS);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+    Activate();
+
+    layout = ComputeLayout(tex_layers, tex_w, tex_h, v.w, v.h);
+
+    prog.SaveBind();
+    prog.SetUniform("u_grid", (float)layout.cols, (float)layout.rows);
+    prog.SetUniform("u_fill", layout.fill_x, layout.fill_y);
+    prog.SetUniform("u_offset_scale", offset_scale.first, offset_scale.second);
+    prog.SetUniform("u_images", 0);
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, tex);
+
+    corners.Bind();
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)tex_layers);
+    glDisableVertexAttribArray(0);
+    corners.Unbind();
+
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    prog.Unbind();
+
+    if(extern_draw_function)
+    {
+        GlStateCache::Suspend user_gl;
+        extern_draw_function(*this);
+    }
+
+    GlStateCache::I().PopAttrib();
+#endif
+}
+
+}
@@ -1,10 +1,37 @@
 #include <pangolin/display/image_view.h>
 #include <pangolin/image/image_utils.h>
 #include <pangolin/image/image_convert.h>
+#include <pangolin/gl/glreduce.h>
 
 namespace pangolin
 {
 
+namespace
+{
+
+// GlTextureMinMax() samples integer formats normalised to [0,1]
+float SampleScale(GLint internal_format)
+{
+    switch(internal_format) {
+    case GL_LUMINANCE8:
+    case GL_R8:
+    case GL_RG8:
+    case GL_RGB8:
+    case GL_RGBA8:
+        return 255.0f;
+    case GL_LUMINANCE16:
+    case GL_R16:
+    case GL_RG16:
+    case GL_RGB16:
+    case GL_RGBA16:
+        return 65535.0f;
+    default:
+        return 1.0f;
+    }
+}
+
+}
+
 ImageView::ImageView()
     : offset_scale(0.0, 1.0), lastPressed(false), mouseReleased(false), mousePressed(false), overlayRender(true)
 {
@@ -20,7 +47,7 @@ void ImageView::Render()
     LoadPending();
 
     glPushAttrib(GL_DEPTH_BITS);
-    glDisable(GL_DEPTH_TEST);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
 
     Activate();
     this->UpdateView();
@@ -48,10 +75,11 @@ void ImageView::Render()
 
     if(extern_draw_function)
     {
+        GlStateCache::Suspend user_gl;
         extern_draw_function(*this);
     }
 
-    glPopAttrib();
+    GlStateCache::I().PopAttrib();
 }
 
 void ImageView::Mouse(View& view, pangolin::MouseButton button, int x, int y, bool pressed, int button_state)
@@ -77,10 +105,15 @@ void ImageView::Keyboard(View& view, unsigned char key, int x, int y, bool press
         const bool have_selection = std::isfinite(GetSelection().Area()) && std::abs(GetSelection().Area()) >= 4;
         const pangolin::XYRangef froi = have_selection ? GetSelection() : GetViewToRender();
 
-        // Download texture so that we can take min / max
-        pangolin::TypedImage img;
-        tex.Download(img);
-        offset_scale = pangolin::GetOffsetScale(img, pangolin::Round(froi), img.fmt);
+        // Reduce on the GPU if we can, otherwise download texture to take min / max
+        std::pair<float, float> mm;
+        if(pangolin::GlTextureMinMax(tex, pangolin::Round(froi), mm)) {
+            offset_scale = std::pair<float, float>(-mm.first, 1.0f / (mm.second - mm.first));
+        }else{
+            pangolin::TypedImage img;
+            tex.Download(img);
+            offset_scale = pangolin::GetOffsetScale(img, pangolin::Round(froi), img.fmt);
+        }
     }
     else if(key == 'b')
     {
@@ -94,10 +127,17 @@ void ImageView::Keyboard(View& view, unsigned char key, int x, int y, bool press
         const bool have_selection = std::isfinite(GetSelection().Area()) && std::abs(GetSelection().Area()) >= 4;
         const pangolin::XYRangef froi = have_selection ? GetSelection() : GetViewToRender();
 
-        // Download texture so that we can take min / max
-        pangolin::TypedImage img;
-        tex.Download(img);
-        std::pair<float, float> mm = pangolin::GetMinMax(img, pangolin::Round(froi), img.fmt);
+        // Reduce on the GPU if we can, otherwise download texture to take min / max
+        std::pair<float, float> mm;
+        if(pangolin::GlTextureMinMax(tex, pangolin::Round(froi), mm)) {
+            const float sample_scale = SampleScale(tex.internal_format);
+            mm.first *= sample_scale;
+            mm.second *= sample_scale;
+        }else{
+            pangolin::TypedImage img;
+            tex.Download(img);
+            mm = pangolin::GetMinMax(img, pangolin::Round(froi), img.fmt);
+        }
 
         printf("Min / Max in Region: %f / %f\n", mm.first, mm.second);
     }
@@ -133,6 +173,7 @@ ImageView& ImageView::SetImage(void* ptr, size_t w, size_t h, size_t pitch, pang
             pango_print_warn("TextureView: Unable to display image.\n");
         }
         texlock.unlock();
+        Invalidate();
         return *this;
     }
 
@@ -155,6 +196,7 @@ ImageView& ImageView::SetImage(void* ptr, size_t w, size_t h, size_t pitch, pang
     }
 
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    Invalidate();
     return *this;
 }
 
@@ -182,9 +224,21 @@ ImageView& ImageView::SetImage(const pangolin::GlTexture& texture)
     glCopyImageSubData(
             texture.tid, GL_TEXTURE_2D, 0, 0, 0, 0, tex.tid, GL_TEXTURE_2D, 0, 0, 0, 0, tex.width, tex.height, 1);
 
+    Invalidate();
     return *this;
 }
 
+bool ImageView::ContentChanged()
+{
+    // Linked views share their target, so animate alongside each other
+    const pangolin::XYRangef& want = target;
+    const float eps = 1e-4f * std::max(rview.x.AbsSize(), rview.y.AbsSize());
+    const bool animating =
+        std::abs(want.x.min - rview.x.min) > eps || std::abs(want.x.max - rview.x.max) > eps ||
+        std::abs(want.y.min - rview.y.min) > eps || std::abs(want.y.max - rview.y.max) > eps;
+    return img_to_load.ptr || animating;
+}
+
 void ImageView::LoadPending()
 {
     if(img_to_load.ptr)
@@ -27,6 +27,7 @@
 
 #include <pangolin/display/opengl_render_state.h>
 #include <pangolin/gl/glinclude.h>
+#include <pangolin/gl/glstate.h>
 
 #include <stdexcept>
 
@@ -312,10 +313,10 @@ void OpenGlRenderState::EnableProjectiveTexturing() const
 {
 #ifndef HAVE_GLES
     const pangolin::OpenGlMatrix projmattrans = GetProjectiveTextureMatrix().Transpose();
-    glEnable(GL_TEXTURE_GEN_S);
-    glEnable(GL_TEXTURE_GEN_T);
-    glEnable(GL_TEXTURE_GEN_R);
-    glEnable(GL_TEXTURE_GEN_Q);
+    GlStateCache::I().Enable(GL_TEXTURE_GEN_S);
+    GlStateCache::I().Enable(GL_TEXTURE_GEN_T);
+    GlStateCache::I().Enable(GL_TEXTURE_GEN_R);
+    GlStateCache::I().Enable(GL_TEXTURE_GEN_Q);
     glTexGendv(GL_S, GL_EYE_PLANE, projmattrans.m);
     glTexGendv(GL_T, GL_EYE_PLANE, projmattrans.m+4);
     glTexGendv(GL_R, GL_EYE_PLANE, projmattrans.m+8);
@@ -330,10 +331,10 @@ void OpenGlRenderState::EnableProjectiveTexturing() const
 void OpenGlRenderState::DisableProjectiveTexturing() const
 {
 #ifndef HAVE_GLES
-    glDisable(GL_TEXTURE_GEN_S);
-    glDisable(GL_TEXTURE_GEN_T);
-    glDisable(GL_TEXTURE_GEN_R);
-    glDisable(GL_TEXTURE_GEN_Q);
+    GlStateCache::I().Disable(GL_TEXTURE_GEN_S);
+    GlStateCache::I().Disable(GL_TEXTURE_GEN_T);
+    GlStateCache::I().Disable(GL_TEXTURE_GEN_R);
+    GlStateCache::I().Disable(GL_TEXTURE_GEN_Q);
 #endif
 }
 
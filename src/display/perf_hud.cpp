@@ -0,0 +1,286 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/display/display.h>
+#include <pangolin/display/display_internal.h>
+#include <pangolin/display/perf_hud.h>
+#include <pangolin/gl/gldraw.h>
+#include <pangolin/gl/glfont.h>
+#include <pangolin/utils/timer.h>
+
+#ifdef BUILD_PANGOLIN_VIDEO
+#  include <pangolin/video/video_input.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace pangolin
+{
+
+// Pointer to context defined in display.cpp
+extern __thread PangolinGl* context;
+
+namespace {
+
+const double window_s = 0.5;
+const float margin = 4.0f;
+
+std::string Format(const char* fmt, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+}
+
+PerfHud::PerfHud()
+    : max_views(6), last_frame(0), window_start_s(TimeNow_s()), frames(0),
+      frame_ms(0.0), render_cpu_ms(0.0), gpu_ms(0.0), gpu_frames(0), upload_bytes(0.0)
+{
+    text.push_back("perf: waiting for frames");
+}
+
+PerfHud& PerfHud::AddVideo(VideoInput& video, const std::string& label)
+{
+#ifdef BUILD_PANGOLIN_VIDEO
+    EnableVideoStageStats(&video, true);
+
+    // Totals are differenced between windows
+    struct Previous {
+        uint64_t frames = 0;
+        double t = 0.0;
+        std::map<std::string, VideoStageStats> stages;
+    };
+    std::shared_ptr<Previous> prev = std::make_shared<Previous>();
+    prev->t = TimeNow_s();
+
+    VideoInput* v = &video;
+    lines.push_back([v, label, prev]() {
+        const VideoInputStats stats = v->Stats();
+        const double t = TimeNow_s();
+        const uint64_t frames = stats.frames >= prev->frames ? stats.frames - prev->frames : stats.frames;
+        const double fps = t > prev->t ? frames / (t - prev->t) : 0.0;
+        prev->frames = stats.frames;
+        prev->t = t;
+
+        std::ostringstream os;
+        os << Format("%s: %.1f fps  dropped %llu  overwritten %llu  rejected %llu",
+                     label.c_str(), fps, (unsigned long long)stats.dropped,
+                     (unsigned long long)stats.overwritten, (unsigned long long)stats.rejected);
+        if(stats.latency_us.Count()) {
+            os << "\n" << Format("  latency p50 %.1fms  p99 %.1fms",
+                                 stats.latency_us.Percentile(0.5) / 1e3, stats.latency_us.Percentile(0.99) / 1e3);
+        }
+        for(const VideoStageStats& s : stats.stages) {
+            VideoStageStats& p = prev->stages[s.stage];
+            const uint64_t n = s.frames >= p.frames ? s.frames - p.frames : s.frames;
+            if(n) {
+                const double scale = 1e3 / n;
+                const bool reset = s.frames < p.frames;
+                os << "\n" << Format("  %s: grab %.2fms wait %.2fms process %.2fms copy %.2fms",
+                                     s.stage.c_str(),
+                                     scale * (s.grab_s - (reset ? 0.0 : p.grab_s)),
+                                     scale * (s.wait_s - (reset ? 0.0 : p.wait_s)),
+                                     scale * (s.process_s - (reset ? 0.0 : p.process_s)),
+                                     scale * (s.copy_s - (reset ? 0.0 : p.copy_s)));
+                if(s.max_queue_depth) {
+                    os << Format(" queue %zu/%zu", s.queue_depth, s.max_queue_depth);
+                }
+            }
+            p = s;
+        }
+        return os.str();
+    });
+#else
+    (void)video;
+    (void)label;
+    throw std::runtime_error("PerfHud::AddVideo: Pangolin built without video support.");
+#endif
+    return *this;
+}
+
+PerfHud& PerfHud::AddLine(const std::function<std::string()>& line)
+{
+    lines.push_back(line);
+    return *this;
+}
+
+PerfHud& PerfHud::SetMaxViews(size_t n)
+{
+    max_views = n;
+    return *this;
+}
+
+void PerfHud::Accumulate(const RenderStats& stats)
+{
+    if(stats.frame == last_frame || stats.frame_ms <= 0.0) return;
+    last_frame = stats.frame;
+
+    ++frames;
+    frame_ms += stats.frame_ms;
+    render_cpu_ms += stats.render_cpu_ms;
+    if(stats.gpu_ms >= 0.0) {
+        gpu_ms += stats.gpu_ms;
+        ++gpu_frames;
+    }
+    upload_bytes += (double)stats.upload_bytes;
+
+    for(const ViewRenderStats& v : stats.views) {
+        // The HUD's own cost is left for the frame total to show
+        if(v.view == this) continue;
+        ViewTotal& t = view_totals[v.view];
+        t.name = v.name;
+        t.depth = v.depth;
+        t.cpu_ms += v.cpu_ms;
+        if(v.gpu_ms >= 0.0) {
+            t.gpu_ms += v.gpu_ms;
+            ++t.gpu_frames;
+        }
+    }
+}
+
+void PerfHud::Summarise()
+{
+    text.clear();
+    if(frames) {
+        const double n = (double)frames;
+        text.push_back(Format("frame %.2fms (%.1f fps)  render %.2fms",
+                              frame_ms / n, 1e3 * n / frame_ms, render_cpu_ms / n));
+        std::string gpu = gpu_frames ? Format("gpu %.2fms", gpu_ms / gpu_frames) : std::string("gpu n/a");
+        text.push_back(gpu + Format("  upload %.1fMB/s", upload_bytes / (1024.0 * 1024.0) / (1e-3 * frame_ms)));
+
+        std::vector<ViewTotal> views;
+        for(const auto& vt : view_totals) views.push_back(vt.second);
+        std::sort(views.begin(), views.end(), [](const ViewTotal& a, const ViewTotal& b) {
+            return a.cpu_ms > b.cpu_ms;
+        });
+        for(size_t i = 0; i < views.size() && i < max_views; ++i) {
+            const ViewTotal& t = views[i];
+            std::string line = Format("%*s%s %.2fms", 2 * (t.depth + 1), "", t.name.c_str(), t.cpu_ms / n);
+            if(t.gpu_frames) {
+                line += Format("  gpu %.2fms", t.gpu_ms / t.gpu_frames);
+            }
+            text.push_back(line);
+        }
+    }else{
+        text.push_back("perf: no frames timed");
+    }
+
+    for(const auto& line : lines) {
+        std::istringstream is(line());
+        std::string l;
+        while(std::getline(is, l)) text.push_back(l);
+    }
+
+    frames = 0;
+    frame_ms = render_cpu_ms = gpu_ms = 0.0;
+    gpu_frames = 0;
+    upload_bytes = 0.0;
+    view_totals.clear();
+}
+
+void PerfHud::Render()
+{
+    Accumulate(GetRenderStats());
+    const double now = TimeNow_s();
+    if(now - window_start_s >= window_s) {
+        Summarise();
+        window_start_s = now;
+    }
+
+    GlFont& font = GlFont::I();
+    const float line_h = std::ceil(font.Height());
+    std::vector<GlText> glyphs;
+    float w = 0.0f;
+    for(const std::string& s : text) {
+        glyphs.push_back(font.Text(s));
+        w = std::max(w, glyphs.back().Width());
+    }
+    const int hud_w = (int)(w + 2 * margin);
+    const int hud_h = (int)(line_h * glyphs.size() + 2 * margin);
+
+    // Fit the text, so that views beneath still get input elsewhere
+    if(hud_w != v.w || hud_h != v.h) {
+        SetBounds(Attach::Pix(-hud_h), 1.0, Attach::Pix(-hud_w), 1.0);
+        Resize(DisplayBase().v);
+    }
+
+#ifndef HAVE_GLES
+    glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT | GL_SCISSOR_BIT | GL_COLOR_BUFFER_BIT);
+#endif
+    GlStateCache::I().Enable(GL_BLEND);
+    GlStateCache::I().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+    GlStateCache::I().Disable(GL_SCISSOR_TEST);
+
+    DisplayBase().ActivatePixelOrthographic();
+    glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+    glDrawRect((GLfloat)v.l, (GLfloat)v.b, (GLfloat)v.r(), (GLfloat)v.t());
+
+    GlTextBatch::I().Begin();
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    for(size_t i = 0; i < glyphs.size(); ++i) {
+        glyphs[i].DrawWindow(v.l + margin, v.t() - margin - line_h * (i + 1) + 0.25f * line_h);
+    }
+    GlTextBatch::I().End();
+
+#ifndef HAVE_GLES
+    GlStateCache::I().PopAttrib();
+#else
+    GlStateCache::I().Enable(GL_DEPTH_TEST);
+#endif
+}
+
+PerfHud& CreatePerfHud(int toggle_key)
+{
+    const std::string name = "perf_hud";
+    if(context->named_managed_views.find(name) != context->named_managed_views.end()) {
+        throw std::runtime_error("PerfHud already registered with this name.");
+    }
+    PerfHud* hud = new PerfHud();
+    context->named_managed_views[name] = hud;
+    context->base.views.push_back(hud);
+    hud->SetBounds(Attach::Pix(-1), 1.0, Attach::Pix(-1), 1.0);
+
+    if(toggle_key >= 0) {
+        RegisterKeyPressCallback(toggle_key, [hud]() { hud->ToggleShow(); });
+    }
+    EnableRenderStats(true, true);
+    return *hud;
+}
+
+}
@@ -0,0 +1,305 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/display/display_internal.h>
+#include <pangolin/display/render_stats.h>
+#include <pangolin/display/view.h>
+#include <pangolin/gl/gl.h>
+
+#include <chrono>
+#include <map>
+#include <typeinfo>
+
+#ifdef __GNUG__
+#  include <cxxabi.h>
+#  include <cstdlib>
+#endif
+
+namespace pangolin
+{
+
+// Pointer to context defined in display.cpp
+extern __thread PangolinGl* context;
+
+namespace {
+
+int64_t Now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Timestamp queries in flight, so results are read without stalling
+const int gpu_frames = 4;
+
+#ifndef HAVE_GLES
+// Timestamp pairs around one view, a pair per frame in flight
+struct ViewGpuTimer
+{
+    GLuint queries[2 * gpu_frames];
+    bool issued[gpu_frames] = {};
+    uint64_t last_frame = 0;
+    double gpu_ms = -1.0;
+};
+
+// Read a pair of timestamps, if ready, without waiting on the GPU
+bool ReadTimestamps(const GLuint* q, double& ms)
+{
+    GLint available = 0;
+    glGetQueryObjectiv(q[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(available) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(q[0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(q[1], GL_QUERY_RESULT, &end);
+        ms = 1e-6 * (double)(end - begin);
+    }
+    return available != 0;
+}
+#endif
+
+struct RenderStatsState
+{
+    bool enabled = false;
+    bool view_gpu_times = false;
+    int depth = 0;
+
+    int64_t last_frame_ns = 0;
+    int64_t frame_start_ns = 0;
+    uint64_t last_upload_bytes = 0;
+    uint64_t frames = 0;
+
+    RenderStats current;
+    RenderStats last;
+
+#ifndef HAVE_GLES
+    bool gpu_initialised = false;
+    bool gpu_supported = false;
+    GLuint queries[2 * gpu_frames];
+    int gpu_next = 0;
+    int gpu_pending = 0;
+    double gpu_ms = -1.0;
+    std::map<const View*, ViewGpuTimer> view_gpu;
+#endif
+};
+
+RenderStatsState& State()
+{
+    static RenderStatsState state;
+    return state;
+}
+
+std::string TypeName(const View& view)
+{
+    const char* name = typeid(view).name();
+#ifdef __GNUG__
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if(demangled) {
+        std::string s = status == 0 ? demangled : name;
+        std::free(demangled);
+        return s;
+    }
+#endif
+    return name;
+}
+
+}
+
+void EnableRenderStats(bool enable, bool view_gpu_times)
+{
+    RenderStatsState& s = State();
+    if(enable && !s.enabled) {
+        s.last_frame_ns = 0;
+        s.last_upload_bytes = GlTextureUploadBytes().load(std::memory_order_relaxed);
+    }
+    s.enabled = enable;
+    s.view_gpu_times = enable && view_gpu_times;
+}
+
+bool RenderStatsEnabled()
+{
+    return State().enabled;
+}
+
+RenderStats GetRenderStats()
+{
+    RenderStats stats = State().last;
+
+    std::map<const View*, std::string> names;
+    if(context) {
+        for(const auto& nv : context->named_managed_views) {
+            names[nv.second] = nv.first;
+        }
+    }
+    for(ViewRenderStats& v : stats.views) {
+        const auto it = names.find(v.view);
+        v.name = it != names.end() ? it->second : TypeName(*v.view);
+        v.gpu_ms = GetViewGpuTime(*v.view);
+    }
+    return stats;
+}
+
+double GetViewGpuTime(const View& view)
+{
+#ifndef HAVE_GLES
+    const RenderStatsState& s = State();
+    const auto it = s.view_gpu.find(&view);
+    if(it != s.view_gpu.end()) {
+        return it->second.gpu_ms;
+    }
+#else
+    (void)view;
+#endif
+    return -1.0;
+}
+
+namespace detail {
+
+void RenderStatsBeginFrame()
+{
+    RenderStatsState& s = State();
+    if(!s.enabled) return;
+
+    const int64_t now = Now_ns();
+    const uint64_t uploaded = GlTextureUploadBytes().load(std::memory_order_relaxed);
+
+    s.current = RenderStats();
+    s.current.frame = s.frames++;
+    if(s.last_frame_ns) {
+        s.current.frame_ms = 1e-6 * (double)(now - s.last_frame_ns);
+        s.current.upload_bytes = uploaded - s.last_upload_bytes;
+        if(s.current.frame_ms > 0.0) {
+            s.current.upload_mb_per_s = (double)s.current.upload_bytes / (1024.0 * 1024.0) / (1e-3 * s.current.frame_ms);
+        }
+    }
+    s.last_frame_ns = now;
+    s.last_upload_bytes = uploaded;
+    s.frame_start_ns = now;
+    s.depth = 0;
+
+#ifndef HAVE_GLES
+    if(!s.gpu_initialised) {
+        s.gpu_initialised = true;
+        s.gpu_supported = GLEW_ARB_timer_query;
+        if(s.gpu_supported) {
+            glGenQueries(2 * gpu_frames, s.queries);
+        }
+    }
+    if(s.gpu_supported) {
+        glQueryCounter(s.queries[2 * s.gpu_next], GL_TIMESTAMP);
+    }
+#endif
+}
+
+void RenderStatsEndFrame()
+{
+    RenderStatsState& s = State();
+    if(!s.enabled) return;
+
+    s.current.render_cpu_ms = 1e-6 * (double)(Now_ns() - s.frame_start_ns);
+
+#ifndef HAVE_GLES
+    if(s.gpu_supported) {
+        glQueryCounter(s.queries[2 * s.gpu_next + 1], GL_TIMESTAMP);
+        s.gpu_next = (s.gpu_next + 1) % gpu_frames;
+        s.gpu_pending = std::min(s.gpu_pending + 1, gpu_frames);
+
+        // The oldest frame in flight, whose queries are reused next frame
+        if(s.gpu_pending == gpu_frames) {
+            ReadTimestamps(s.queries + 2 * s.gpu_next, s.gpu_ms);
+        }
+        s.current.gpu_ms = s.gpu_ms;
+    }
+
+    // Forget views which are no longer drawn, or may have been deleted
+    for(auto it = s.view_gpu.begin(); it != s.view_gpu.end();) {
+        if(it->second.last_frame + 2 * gpu_frames < s.current.frame) {
+            glDeleteQueries(2 * gpu_frames, it->second.queries);
+            it = s.view_gpu.erase(it);
+        }else{
+            ++it;
+        }
+    }
+#endif
+
+    s.last = std::move(s.current);
+}
+
+ViewRenderTimer::ViewRenderTimer(const View& view)
+    : index(0), start_ns(0), gpu_end_query(0)
+{
+    RenderStatsState& s = State();
+    if(s.enabled && s.frame_start_ns) {
+        index = s.current.views.size();
+        s.current.views.push_back(ViewRenderStats{&view, std::string(), s.depth, 0.0, -1.0});
+        ++s.depth;
+        start_ns = Now_ns();
+
+#ifndef HAVE_GLES
+        if(s.view_gpu_times && s.gpu_supported) {
+            const bool added = s.view_gpu.find(&view) == s.view_gpu.end();
+            ViewGpuTimer& t = s.view_gpu[&view];
+            if(added) {
+                glGenQueries(2 * gpu_frames, t.queries);
+            }else if(t.last_frame == s.current.frame) {
+                // Only the first draw of a view within a frame is timed
+                return;
+            }
+            t.last_frame = s.current.frame;
+
+            // Collect the result of this slot's last use before reusing it
+            const size_t slot = s.current.frame % gpu_frames;
+            if(t.issued[slot]) {
+                ReadTimestamps(t.queries + 2 * slot, t.gpu_ms);
+            }
+            glQueryCounter(t.queries[2 * slot], GL_TIMESTAMP);
+            gpu_end_query = t.queries[2 * slot + 1];
+            t.issued[slot] = true;
+        }
+#endif
+    }
+}
+
+ViewRenderTimer::~ViewRenderTimer()
+{
+#ifndef HAVE_GLES
+    if(gpu_end_query) {
+        glQueryCounter(gpu_end_query, GL_TIMESTAMP);
+    }
+#endif
+    if(start_ns) {
+        RenderStatsState& s = State();
+        if(index < s.current.views.size()) {
+            s.current.views[index].cpu_ms = 1e-6 * (double)(Now_ns() - start_ns);
+        }
+        --s.depth;
+    }
+}
+
+}
+
+}
@@ -0,0 +1,349 @@
+#include <pangolin/display/tiled_image_view.h>
+#include <pangolin/gl/glsl.h>
+#include <pangolin/image/image_resize.h>
+#include <pangolin/utils/trace.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace pangolin
+{
+
+TiledImageView::TiledImageView(size_t tile_size, size_t vram_budget_bytes)
+    : tile_size(std::max<size_t>(tile_size, 16)), vram_budget(vram_budget_bytes), max_uploads_per_frame(16),
+      offset_scale(0.0, 1.0), width(0), height(0), num_levels(0),
+      vram_used(0), frame(0), uploads(0), pending(false),
+      requested_level(0), generation(0), tiles_stale(false), quit(false)
+{
+    SetHandler(this);
+}
+
+TiledImageView::~TiledImageView()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quit = true;
+    }
+    cv.notify_all();
+    if(worker.joinable()) {
+        worker.join();
+    }
+}
+
+uint64_t TiledImageView::TileKey(size_t level, size_t tx, size_t ty)
+{
+    return (uint64_t(level) << 48) | (uint64_t(ty) << 24) | uint64_t(tx);
+}
+
+TiledImageView& TiledImageView::SetImage(pangolin::TypedImage&& img)
+{
+    return SetImage(std::make_shared<const TypedImage>(std::move(img)));
+}
+
+TiledImageView& TiledImageView::SetImage(const std::shared_ptr<const pangolin::TypedImage>& img)
+{
+    if(!img || !img->IsValid()) {
+        return Clear();
+    }
+    if(!CanResizePixelFormat(img->fmt) || img->fmt.channel_bits[0] == 64) {
+        pango_print_warn("TiledImageView: Unable to display %s image.\n", img->fmt.Name().c_str());
+        return *this;
+    }
+
+    // Levels halve until the whole image fits within one tile
+    size_t levels_needed = 1;
+    for(size_t w = img->w, h = img->h; w > tile_size || h > tile_size; ++levels_needed) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        levels.assign(1, img);
+        requested_level = 0;
+        ++generation;
+        tiles_stale = true;
+        if(!worker.joinable()) {
+            worker = std::thread(&TiledImageView::BuildLoop, this);
+        }
+    }
+
+    fmt = GlPixFormat(img->fmt);
+    width = img->w;
+    height = img->h;
+    num_levels = levels_needed;
+    SetDimensions(width, height);
+    SetAspect((float)width / (float)height);
+    Invalidate();
+    return *this;
+}
+
+TiledImageView& TiledImageView::Clear()
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        levels.clear();
+        ++generation;
+        tiles_stale = true;
+    }
+    num_levels = 0;
+    Invalidate();
+    return *this;
+}
+
+void TiledImageView::SetVramBudget(size_t bytes)
+{
+    vram_budget = bytes;
+}
+
+void TiledImageView::SetMaxUploadsPerFrame(size_t max_tiles)
+{
+    max_uploads_per_frame = std::max<size_t>(max_tiles, 1);
+}
+
+std::pair<float, float>& TiledImageView::GetOffsetScale() {
+    return offset_scale;
+}
+
+void TiledImageView::BuildLoop()
+{
+    TraceSetThreadName("TiledImageView");
+    std::unique_lock<std::mutex> l(lock);
+    while(true) {
+        cv.wait(l, [this](){
+            return quit || (!levels.empty() && levels.size() <= requested_level);
+        });
+        if(quit) return;
+
+        const size_t gen = generation;
+        const std::shared_ptr<const TypedImage> src = levels.back();
+        l.unlock();
+
+        PANGO_TRACE_SCOPE("TiledImageView::BuildLevel", "display");
+        std::shared_ptr<TypedImage> dst = std::make_shared<TypedImage>(
+            std::max<size_t>(1, (src->w + 1) / 2), std::max<size_t>(1, (src->h + 1) / 2), src->fmt
+        );
+        ResizeImage(*dst, *src, src->fmt, ResizeMethodArea, 0);
+
+        l.lock();
+        if(gen == generation) {
+            levels.push_back(dst);
+        }
+        PostRedisplay();
+    }
+}
+
+void TiledImageView::DeleteTiles()
+{
+    tiles.clear();
+    lru.clear();
+    vram_used = 0;
+}
+
+TiledImageView::Tile* TiledImageView::UploadTile(const pangolin::TypedImage& level_img, size_t level, size_t tx, size_t ty)
+{
+    const size_t pix_bytes = level_img.fmt.bpp / 8;
+
+    // Tile pixels, plus a border of one pixel where there are neighbours
+    const size_t x0 = tx * tile_size;
+    const size_t y0 = ty * tile_size;
+    const size_t x1 = std::min(x0 + tile_size, level_img.w);
+    const size_t y1 = std::min(y0 + tile_size, level_img.h);
+    const size_t bx0 = x0 > 0 ? x0 - 1 : x0;
+    const size_t by0 = y0 > 0 ? y0 - 1 : y0;
+    const size_t bx1 = std::min(x1 + 1, level_img.w);
+    const size_t by1 = std::min(y1 + 1, level_img.h);
+    const size_t tw = bx1 - bx0;
+    const size_t th = by1 - by0;
+    const size_t size_bytes = tw * th * pix_bytes;
+
+    // Make room, but never by evicting what this frame has drawn
+    while(vram_used + size_bytes > vram_budget && !lru.empty()) {
+        auto it = tiles.find(lru.back());
+        if(it->second.last_frame == frame) {
+            return nullptr;
+        }
+        vram_used -= it->second.size_bytes;
+        tiles.erase(it);
+        lru.pop_back();
+    }
+
+    const uint64_t key = TileKey(level, tx, ty);
+    Tile& tile = tiles[key];
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, level_img.pitch / pix_bytes);
+    tile.tex.Reinitialise(
+        tw, th, fmt.scalable_internal_format, true, 0, fmt.glformat, fmt.gltype,
+        (GLvoid*)(level_img.ptr + by0 * level_img.pitch + bx0 * pix_bytes)
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    tile.tex.Bind();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    tile.tex.Unbind();
+
+    tile.size_bytes = size_bytes;
+    tile.u0 = float(x0 - bx0) / tw;
+    tile.v0 = float(y0 - by0) / th;
+    tile.u1 = float(x1 - bx0) / tw;
+    tile.v1 = float(y1 - by0) / th;
+    lru.push_front(key);
+    tile.lru = lru.begin();
+    vram_used += size_bytes;
+    ++uploads;
+    return &tile;
+}
+
+bool TiledImageView::DrawTile(const pangolin::TypedImage& level_img, size_t level, size_t tx, size_t ty, bool upload)
+{
+    Tile* tile = nullptr;
+    auto it = tiles.find(TileKey(level, tx, ty));
+    if(it != tiles.end()) {
+        tile = &it->second;
+        lru.splice(lru.begin(), lru, tile->lru);
+    }else if(upload) {
+        if(uploads < max_uploads_per_frame) {
+            tile = UploadTile(level_img, level, tx, ty);
+        }
+        pending = pending || !tile;
+    }
+    if(!tile) {
+        return false;
+    }
+    tile->last_frame = frame;
+
+    // Tile extent in (discrete) coordinates of the full image
+    const float sx = float(width) / level_img.w;
+    const float sy = float(height) / level_img.h;
+    const GLfloat l = -0.5f + sx * (tx * tile_size);
+    const GLfloat r = -0.5f + sx * std::min((tx + 1) * tile_size, level_img.w);
+    const GLfloat t = -0.5f + sy * (ty * tile_size);
+    const GLfloat b = -0.5f + sy * std::min((ty + 1) * tile_size, level_img.h);
+
+    GLfloat tn = tile->v0;
+    GLfloat bn = tile->v1;
+    if(flipTextureY) {
+        tn = 1 - tn;
+        bn = 1 - bn;
+    }
+
+    const GLfloat sq_vert[] = { l,t,  r,t,  r,b,  l,b };
+    const GLfloat sq_tex[]  = { tile->u0,tn,  tile->u1,tn,  tile->u1,bn,  tile->u0,bn };
+
+    GlStateCache::I().BindTexture(GL_TEXTURE_2D, tile->tex.tid);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, UseNN() ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, UseNN() ? GL_NEAREST : GL_LINEAR);
+    glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
+    glVertexPointer(2, GL_FLOAT, 0, sq_vert);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    return true;
+}
+
+void TiledImageView::Render()
+{
+    std::vector<std::shared_ptr<const TypedImage>> built;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        if(tiles_stale) {
+            DeleteTiles();
+            tiles_stale = false;
+        }
+        built = levels;
+    }
+
+    glPushAttrib(GL_DEPTH_BITS);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+
+    Activate();
+    this->UpdateView();
+    this->glSetViewOrtho();
+
+    ++frame;
+    uploads = 0;
+    pending = false;
+
+    if(!built.empty() && num_levels)
+    {
+        if(offset_scale.first != 0.0 || offset_scale.second != 1.0) {
+            pangolin::GlSlUtilities::OffsetAndScale(offset_scale.first, offset_scale.second);
+        }else{
+            glColor4f(1, 1, 1, 1);
+        }
+
+        const pangolin::XYRangef& xy = GetViewToRender();
+        const float xmin = std::min(xy.x.min, xy.x.max), xmax = std::max(xy.x.min, xy.x.max);
+        const float ymin = std::min(xy.y.min, xy.y.max), ymax = std::max(xy.y.min, xy.y.max);
+
+        // Finest level with no more than one of its pixels per screen pixel
+        const float density = std::max((xmax - xmin) / std::max(v.w, 1), (ymax - ymin) / std::max(v.h, 1));
+        const size_t want_level = std::min<size_t>(
+            num_levels - 1, density > 1.0f ? (size_t)std::floor(std::log2(density)) : 0
+        );
+
+        if(built.size() <= want_level) {
+            {
+                std::lock_guard<std::mutex> l(lock);
+                requested_level = std::max(requested_level, want_level);
+            }
+            // The worker posts a redisplay as each level is built
+            cv.notify_all();
+        }
+
+        GlStateCache::I().Enable(GL_TEXTURE_2D);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+        // Coarser tiles already resident first, beneath those of the target level
+        for(size_t level = num_levels; level-- > want_level;) {
+            const bool upload = level == want_level;
+            const TypedImage* level_img = level < built.size() ? built[level].get() : nullptr;
+            if(!level_img) {
+                // Not yet built, so nothing of it can be resident either
+                continue;
+            }
+
+            const float sx = float(level_img->w) / width;
+            const float sy = float(level_img->h) / height;
+            const size_t tx0 = (size_t)std::max(0.0f, std::floor((xmin + 0.5f) * sx / tile_size));
+            const size_t ty0 = (size_t)std::max(0.0f, std::floor((ymin + 0.5f) * sy / tile_size));
+            const size_t tx1 = std::min((level_img->w + tile_size - 1) / tile_size, (size_t)std::max(0.0f, std::ceil((xmax + 0.5f) * sx / tile_size)));
+            const size_t ty1 = std::min((level_img->h + tile_size - 1) / tile_size, (size_t)std::max(0.0f, std::ceil((ymax + 0.5f) * sy / tile_size)));
+
+            for(size_t ty = ty0; ty < ty1; ++ty) {
+                for(size_t tx = tx0; tx < tx1; ++tx) {
+                    DrawTile(*level_img, level, tx, ty, upload);
+                }
+            }
+        }
+
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        GlStateCache::I().Disable(GL_TEXTURE_2D);
+        GlStateCache::I().BindTexture(GL_TEXTURE_2D, 0);
+        pangolin::GlSlUtilities::UseNone();
+    }
+
+    this->glRenderOverlay();
+
+    if(extern_draw_function)
+    {
+        GlStateCache::Suspend user_gl;
+        extern_draw_function(*this);
+    }
+
+    GlStateCache::I().PopAttrib();
+}
+
+bool TiledImageView::ContentChanged()
+{
+    // Linked views share their target, so animate alongside each other
+    const pangolin::XYRangef& want = target;
+    const float eps = 1e-4f * std::max(rview.x.AbsSize(), rview.y.AbsSize());
+    const bool animating =
+        std::abs(want.x.min - rview.x.min) > eps || std::abs(want.x.max - rview.x.max) > eps ||
+        std::abs(want.y.min - rview.y.min) > eps || std::abs(want.y.max - rview.y.max) > eps;
+    return pending || animating;
+}
+
+}
@@ -28,11 +28,14 @@
 #include <pangolin/display/display.h>
 #include <pangolin/display/display_internal.h>
 #include <pangolin/display/opengl_render_state.h>
+#include <pangolin/display/render_stats.h>
 #include <pangolin/display/view.h>
 #include <pangolin/display/viewport.h>
 #include <pangolin/gl/gl.h>
 #include <pangolin/platform.h>
 
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 namespace pangolin
@@ -291,6 +294,7 @@ void View::ResizeChildren()
 void View::Render()
 {
     if(extern_draw_function && show) {
+        GlStateCache::Suspend user_gl;
         extern_draw_function(*this);
     }
     RenderChildren();
@@ -300,10 +304,337 @@ void View::RenderChildren()
 {
     for(std::vector<View*>::iterator iv = views.begin(); iv != views.end(); ++iv )
     {
-        if((*iv)->show) (*iv)->Render();
+        if((*iv)->show) (*iv)->RenderCached();
     }
 }
 
+struct ViewCache
+{
+    Viewport bounds;
+    GlTexture colour;
+    GlRenderBuffer depth;
+    GlFramebuffer fbo;
+};
+
+// Flags, rather than returns early, so that cached views further down see
+// ContentChanged() results too.
+static bool SubtreeChanged(View& view)
+{
+    if(view.ContentChanged()) {
+        view.invalidated = true;
+    }
+    bool changed = view.invalidated;
+    for(View* child : view.views) {
+        if(child->show && SubtreeChanged(*child)) {
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void ClearInvalidated(View& view)
+{
+    view.invalidated = false;
+    for(View* child : view.views) {
+        ClearInvalidated(*child);
+    }
+}
+
+static void ShiftSubtree(View& view, int dx, int dy)
+{
+    view.v.l += dx;
+    view.v.b += dy;
+    view.vp.l += dx;
+    view.vp.b += dy;
+    for(View* child : view.views) {
+        ShiftSubtree(*child, dx, dy);
+    }
+}
+
+// Timestamp queries in flight per scaled view, so results are read back
+// without stalling
+const int render_scale_frames = 4;
+
+struct ViewRenderScale
+{
+    float scale = 1.0f;
+    double budget_ms = 0.0;
+    float min_scale = 0.25f;
+
+    // Allocated at the view's full size, with scaled renders using the
+    // bottom left, so that changing scale doesn't reallocate
+    GlTexture colour;
+    GlRenderBuffer depth;
+    GlFramebuffer fbo;
+
+#ifndef HAVE_GLES
+    bool timer_initialised = false;
+    bool timer_supported = false;
+    GLuint queries[2 * render_scale_frames];
+    float query_scale[render_scale_frames];
+    int next = 0;
+    int pending = 0;
+#endif
+};
+
+#ifndef HAVE_GLES
+// Bring the scale towards the view's budget from the GPU time of a render
+// a few frames old, assuming cost proportional to the pixels rendered.
+static void UpdateRenderScale(ViewRenderScale& rs)
+{
+    if(rs.pending < render_scale_frames) return;
+
+    const GLuint* q = rs.queries + 2 * rs.next;
+    GLint available = 0;
+    glGetQueryObjectiv(q[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available) return;
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(q[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(q[1], GL_QUERY_RESULT, &end);
+    const double ms = 1e-6 * (double)(end - begin);
+    if(ms <= 0.0) return;
+
+    const float measured = rs.query_scale[rs.next];
+    const float target = std::min(1.0f, std::max(rs.min_scale,
+        measured * (float)std::sqrt(rs.budget_ms / ms)
+    ));
+
+    // Damped, and with a dead band, so the scale doesn't oscillate
+    const float scale = rs.scale + 0.5f * (target - rs.scale);
+    if(std::abs(scale - rs.scale) > 0.02f || target == 1.0f || target == rs.min_scale) {
+        rs.scale = std::min(1.0f, std::max(rs.min_scale, scale));
+    }
+}
+#endif
+
+// Render view's own content at its render scale, upscaled into the bound
+// framebuffer, followed by its children at native resolution.
+static void RenderAtScale(View& view)
+{
+#ifndef HAVE_GLES
+    const Viewport bounds = view.GetBounds();
+    if(!view.render_scale || bounds.w <= 0 || bounds.h <= 0) {
+        view.Render();
+        return;
+    }
+
+    ViewRenderScale& rs = *view.render_scale;
+    if(rs.budget_ms > 0.0) {
+        if(!rs.timer_initialised) {
+            rs.timer_initialised = true;
+            rs.timer_supported = GLEW_ARB_timer_query;
+            if(rs.timer_supported) {
+                glGenQueries(2 * render_scale_frames, rs.queries);
+            }
+        }
+        if(rs.timer_supported) {
+            UpdateRenderScale(rs);
+        }
+    }
+
+    if(rs.colour.width != bounds.w || rs.colour.height != bounds.h) {
+        rs.colour.Reinitialise(bounds.w, bounds.h);
+        rs.depth.Reinitialise(bounds.w, bounds.h);
+        rs.fbo.Reinitialise();
+        rs.fbo.attachments = 0;
+        rs.fbo.AttachColour(rs.colour);
+        rs.fbo.AttachDepth(rs.depth);
+    }
+
+    const float s = rs.scale;
+    const Viewport scaled(0, 0,
+        std::max(1, (int)(bounds.w * s + 0.5f)),
+        std::max(1, (int)(bounds.h * s + 0.5f))
+    );
+
+    GLint prev_fbo = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prev_fbo);
+    rs.fbo.Bind();
+
+    GLfloat clear_colour[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_colour);
+    Viewport::DisableScissor();
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(clear_colour[0], clear_colour[1], clear_colour[2], clear_colour[3]);
+
+    float line_width, point_size;
+    glGetFloatv(GL_LINE_WIDTH, &line_width);
+    glGetFloatv(GL_POINT_SIZE, &point_size);
+    glLineWidth(std::max(1.0f, line_width * s));
+    glPointSize(std::max(1.0f, point_size * s));
+
+    // Map the view onto the scaled region at the buffer's origin, leaving
+    // out children to render them at native resolution afterwards.
+    const Viewport orig_v = view.v;
+    const Viewport orig_vp = view.vp;
+    const auto scale_vp = [&](const Viewport& p) {
+        return Viewport(
+            (int)((p.l - bounds.l) * s + 0.5f), (int)((p.b - bounds.b) * s + 0.5f),
+            std::max(1, (int)(p.w * s + 0.5f)), std::max(1, (int)(p.h * s + 0.5f))
+        );
+    };
+    view.v = scale_vp(orig_v);
+    view.vp = scale_vp(orig_vp);
+    std::vector<View*> children;
+    std::swap(children, view.views);
+
+    const bool timed = rs.budget_ms > 0.0 && rs.timer_supported;
+    if(timed) glQueryCounter(rs.queries[2 * rs.next], GL_TIMESTAMP);
+    view.Render();
+    if(timed) {
+        glQueryCounter(rs.queries[2 * rs.next + 1], GL_TIMESTAMP);
+        rs.query_scale[rs.next] = s;
+        rs.next = (rs.next + 1) % render_scale_frames;
+        rs.pending = std::min(rs.pending + 1, render_scale_frames);
+    }
+
+    std::swap(children, view.views);
+    view.v = orig_v;
+    view.vp = orig_vp;
+    glLineWidth(line_width);
+    glPointSize(point_size);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prev_fbo);
+
+    // Content was drawn over transparent black, so is premultiplied
+    Viewport::DisableScissor();
+    bounds.Activate();
+    glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+    GlStateCache::I().Enable(GL_BLEND);
+    GlStateCache::I().BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    rs.colour.RenderToViewport(scaled);
+    GlStateCache::I().PopAttrib();
+
+    view.RenderChildren();
+#else
+    view.Render();
+#endif // HAVE_GLES
+}
+
+void View::RenderCached()
+{
+    detail::ViewRenderTimer timer(*this);
+#ifndef HAVE_GLES
+    if(cache) {
+        const Viewport bounds = GetBounds();
+        if(bounds.w <= 0 || bounds.h <= 0) {
+            return;
+        }
+
+        ViewCache& c = *cache;
+        bool redraw = SubtreeChanged(*this) ||
+            bounds.l != c.bounds.l || bounds.b != c.bounds.b;
+
+        // Cached views may nest, so put back whichever buffer was bound
+        GLint prev_fbo = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prev_fbo);
+
+        if(c.colour.width != bounds.w || c.colour.height != bounds.h) {
+            c.colour.Reinitialise(bounds.w, bounds.h);
+            c.depth.Reinitialise(bounds.w, bounds.h);
+            c.fbo.Reinitialise();
+            c.fbo.attachments = 0;
+            c.fbo.AttachColour(c.colour);
+            c.fbo.AttachDepth(c.depth);
+            redraw = true;
+        }
+
+        if(redraw) {
+            c.bounds = bounds;
+            c.fbo.Bind();
+
+            GLfloat clear_colour[4];
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_colour);
+            Viewport::DisableScissor();
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(clear_colour[0], clear_colour[1], clear_colour[2], clear_colour[3]);
+
+            // Render with the buffer's origin at the bottom left of the view
+            ShiftSubtree(*this, -bounds.l, -bounds.b);
+            RenderAtScale(*this);
+            ShiftSubtree(*this, bounds.l, bounds.b);
+            ClearInvalidated(*this);
+        }
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prev_fbo);
+
+        // Content was drawn over transparent black, so is premultiplied
+        Viewport::DisableScissor();
+        bounds.Activate();
+        glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+        GlStateCache::I().Disable(GL_DEPTH_TEST);
+        GlStateCache::I().Enable(GL_BLEND);
+        GlStateCache::I().BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+        c.colour.RenderToViewport();
+        GlStateCache::I().PopAttrib();
+        return;
+    }
+#endif // HAVE_GLES
+    RenderAtScale(*this);
+}
+
+View& View::SetCached(bool cached)
+{
+    if(!cached) {
+        cache.reset();
+    }else if(!cache) {
+        cache = std::make_shared<ViewCache>();
+        invalidated = true;
+    }
+    return *this;
+}
+
+bool View::IsCached() const
+{
+    return (bool)cache;
+}
+
+View& View::SetRenderScale(float scale)
+{
+    scale = std::min(1.0f, std::max(0.01f, scale));
+    if(scale == 1.0f && !(render_scale && render_scale->budget_ms > 0.0)) {
+        render_scale.reset();
+    }else{
+        if(!render_scale) render_scale = std::make_shared<ViewRenderScale>();
+        render_scale->scale = scale;
+    }
+    return *this;
+}
+
+View& View::SetRenderBudget(double budget_ms, float min_scale)
+{
+    if(budget_ms <= 0.0) {
+        if(render_scale) {
+            render_scale->budget_ms = 0.0;
+            SetRenderScale(render_scale->scale);
+        }
+    }else{
+        if(!render_scale) render_scale = std::make_shared<ViewRenderScale>();
+        render_scale->budget_ms = budget_ms;
+        render_scale->min_scale = std::min(1.0f, std::max(0.01f, min_scale));
+    }
+    return *this;
+}
+
+float View::GetRenderScale() const
+{
+    return render_scale ? render_scale->scale : 1.0f;
+}
+
+void View::Invalidate()
+{
+    invalidated = true;
+}
+
+bool View::ContentChanged()
+{
+    return false;
+}
+
 void View::Activate() const
 {
     v.Activate();
@@ -505,11 +836,7 @@ void View::RecordOnRender(const std::string& record_uri)
     if(!context->recorder.IsOpen()) {
         Viewport area = GetBounds();
         context->record_view = this;
-        context->recorder.Open(record_uri);
-        std::vector<StreamInfo> streams;
-        const PixelFormat fmt = PixelFormatFromString("RGB24");
-        streams.push_back( StreamInfo(fmt, area.w, area.h, area.w * fmt.bpp / 8) );
-        context->recorder.SetStreams(streams);
+        context->recorder.Open(record_uri, area.w, area.h);
     }else{
         context->recorder.Close();
     }
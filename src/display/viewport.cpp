@@ -26,32 +26,33 @@
  */
 
 #include <pangolin/display/viewport.h>
+#include <pangolin/gl/glstate.h>
 #include <algorithm>
 
 namespace pangolin {
 
 void Viewport::Activate() const
 {
-    glViewport(l,b,w,h);
+    GlStateCache::I().Viewport(l,b,w,h);
 }
 
 void Viewport::Scissor() const
 {
-    glEnable(GL_SCISSOR_TEST);
+    GlStateCache::I().Enable(GL_SCISSOR_TEST);
     glScissor(l,b,w,h);
 }
 
 void Viewport::ActivateAndScissor() const
 {
-    glViewport(l,b,w,h);
-    glEnable(GL_SCISSOR_TEST);
+    GlStateCache::I().Viewport(l,b,w,h);
+    GlStateCache::I().Enable(GL_SCISSOR_TEST);
     glScissor(l,b,w,h);
 }
 
 
 void Viewport::DisableScissor()
 {
-    glDisable(GL_SCISSOR_TEST);
+    GlStateCache::I().Disable(GL_SCISSOR_TEST);
 }
 
 bool Viewport::Contains(int x, int y) const
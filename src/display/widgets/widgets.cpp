@@ -37,6 +37,7 @@
 #include <mutex>
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
 using namespace std;
 
@@ -76,16 +77,95 @@ void GuiVarChanged( Var<T>& var)
 {
     VarState::I().FlagVarChanged();
     var.Meta().gui_changed = true;
-    
-    for(std::vector<GuiVarChangedCallback>::iterator igvc = VarState::I().gui_var_changed_callbacks.begin(); igvc != VarState::I().gui_var_changed_callbacks.end(); ++igvc) {
-        if( StartsWith(var.Meta().full_name, igvc->filter) ) {
-           igvc->fn( igvc->data, var.Meta().full_name, var.Ref() );
-        }
+    VarState::I().NotifyGuiVarChanged(var.Meta().full_name, var.Ref());
+}
+
+#ifndef HAVE_GLES
+// Widget rectangles and outlines collected whilst a Panel renders, so that
+// they're uploaded to the panel's buffer and drawn with two calls.
+struct WidgetBatch
+{
+    struct Vertex {
+        GLfloat x, y;
+        GLfloat r, g, b, a;
+    };
+
+    WidgetBatch() : active(false) {
+        std::copy(colour_tx, colour_tx + 4, colour);
+    }
+
+    void Add(std::vector<Vertex>& vs, GLfloat x, GLfloat y) {
+        const Vertex vert = { x, y, colour[0], colour[1], colour[2], colour[3] };
+        vs.push_back(vert);
+    }
+
+    void Line(GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2) {
+        Add(lines, x1, y1);
+        Add(lines, x2, y2);
+    }
+
+    bool active;
+    GLfloat colour[4];
+    std::vector<Vertex> tris;
+    std::vector<Vertex> lines;
+};
+
+static WidgetBatch& Batch()
+{
+    static thread_local WidgetBatch batch;
+    return batch;
+}
+
+static void DrawBatch(GlBuffer& buffer)
+{
+    WidgetBatch& b = Batch();
+    const size_t num_verts = b.tris.size() + b.lines.size();
+    if(num_verts) {
+        const GLuint floats = (GLuint)(num_verts * sizeof(WidgetBatch::Vertex) / sizeof(GLfloat));
+        buffer.Reinitialise(GlArrayBuffer, std::max(floats, buffer.num_elements), GL_FLOAT, 1, GL_STREAM_DRAW);
+        buffer.Upload(b.tris.data(), b.tris.size() * sizeof(WidgetBatch::Vertex));
+        buffer.Upload(b.lines.data(), b.lines.size() * sizeof(WidgetBatch::Vertex), b.tris.size() * sizeof(WidgetBatch::Vertex));
+
+        buffer.Bind();
+        glVertexPointer(2, GL_FLOAT, sizeof(WidgetBatch::Vertex), (GLvoid*)offsetof(WidgetBatch::Vertex,x));
+        glColorPointer(4, GL_FLOAT, sizeof(WidgetBatch::Vertex), (GLvoid*)offsetof(WidgetBatch::Vertex,r));
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        buffer.Unbind();
+
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)b.tris.size());
+        glDrawArrays(GL_LINES, (GLint)b.tris.size(), (GLsizei)b.lines.size());
+
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
     }
+    b.tris.clear();
+    b.lines.clear();
+}
+#endif // HAVE_GLES
+
+// glColor4fv, also setting the colour of batched widget geometry
+static void SetColour(const GLfloat* colour)
+{
+    glColor4fv(colour);
+#ifndef HAVE_GLES
+    std::copy(colour, colour + 4, Batch().colour);
+#endif
 }
 
 void glRect(Viewport v)
 {
+#ifndef HAVE_GLES
+    WidgetBatch& b = Batch();
+    if(b.active) {
+        const GLfloat l = (GLfloat)v.l, r = (GLfloat)v.r();
+        const GLfloat bt = (GLfloat)v.b, t = (GLfloat)v.t();
+        b.Add(b.tris, l, bt); b.Add(b.tris, l, t); b.Add(b.tris, r, t);
+        b.Add(b.tris, l, bt); b.Add(b.tris, r, t); b.Add(b.tris, r, bt);
+        return;
+    }
+#endif
+
     GLfloat vs[] = { (float)v.l,(float)v.b,
                      (float)v.l,(float)v.t(),
                      (float)v.r(),(float)v.t(),
@@ -104,7 +184,19 @@ void glRect(Viewport v, int inset)
 
 void DrawShadowRect(Viewport& v)
 {
-    glColor4fv(colour_s2);
+    SetColour(colour_s2);
+#ifndef HAVE_GLES
+    WidgetBatch& b = Batch();
+    if(b.active) {
+        const GLfloat l = (GLfloat)v.l, r = (GLfloat)v.r();
+        const GLfloat bt = (GLfloat)v.b, t = (GLfloat)v.t();
+        b.Line(l, bt, l, t);
+        b.Line(l, t, r, t);
+        b.Line(r, t, r, bt);
+        b.Line(r, bt, l, bt);
+        return;
+    }
+#endif
     glDrawRectPerimeter((GLfloat)v.l, (GLfloat)v.b, (GLfloat)v.r(), (GLfloat)v.t());
 }
 
@@ -112,6 +204,21 @@ void DrawShadowRect(Viewport& v, bool pushed)
 {
     const GLfloat* c1 = pushed ? colour_s1 : colour_s2;
     const GLfloat* c2 = pushed ? colour_s2 : colour_s1;
+
+#ifndef HAVE_GLES
+    WidgetBatch& b = Batch();
+    if(b.active) {
+        const GLfloat l = (GLfloat)v.l, r = (GLfloat)v.r();
+        const GLfloat bt = (GLfloat)v.b, t = (GLfloat)v.t();
+        SetColour(c1);
+        b.Line(l, bt, l, t);
+        b.Line(l, t, r, t);
+        SetColour(c2);
+        b.Line(r, t, r, bt);
+        b.Line(r, bt, l, bt);
+        return;
+    }
+#endif
     
     GLfloat vs[] = { (float)v.l,(float)v.b,
                      (float)v.l,(float)v.t(),
@@ -121,10 +228,10 @@ void DrawShadowRect(Viewport& v, bool pushed)
     
     glEnableClientState(GL_VERTEX_ARRAY);
     glVertexPointer(2, GL_FLOAT, 0, vs);
-    glColor4fv(c1);
+    SetColour(c1);
     glDrawArrays(GL_LINE_STRIP, 0, 3);
     
-    glColor4fv(c2);
+    SetColour(c2);
     glDrawArrays(GL_LINE_STRIP, 2, 3);
     glDisableClientState(GL_VERTEX_ARRAY);    
 
@@ -134,12 +241,14 @@ Panel::Panel()
 {
     handler = &StaticHandlerScroll;
     layout = LayoutVertical;
+    SetCached();
 }
 
 Panel::Panel(const std::string& auto_register_var_prefix)
 {
     handler = &StaticHandlerScroll;
     layout = LayoutVertical;
+    SetCached();
     RegisterNewVarCallback(&Panel::AddVariable,(void*)this,auto_register_var_prefix);
     ProcessHistoricCallbacks(&Panel::AddVariable,(void*)this,auto_register_var_prefix);
 }
@@ -187,34 +296,66 @@ void Panel::Render()
 #ifndef HAVE_GLES
     glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_SCISSOR_BIT | GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_TRANSFORM_BIT);
 #endif
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GlStateCache::I().Enable(GL_BLEND);
+    GlStateCache::I().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
     DisplayBase().ActivatePixelOrthographic();
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_LINE_SMOOTH);
-    glDisable( GL_COLOR_MATERIAL );
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+    GlStateCache::I().Disable(GL_LIGHTING);
+    GlStateCache::I().Disable(GL_SCISSOR_TEST);
+    GlStateCache::I().Disable(GL_LINE_SMOOTH);
+    GlStateCache::I().Disable( GL_COLOR_MATERIAL );
     glLineWidth(1.0);
     
-    glColor4fv(colour_bg);
+#ifndef HAVE_GLES
+    Batch().active = true;
+#endif
+    SetColour(colour_bg);
     glRect(v);
     DrawShadowRect(v);
     
+    // Widgets place their contents from v as they render, since it moves
+    // whilst rendering into the panel's cache. Labels of all widgets are
+    // drawn together once they've rendered
+    GlTextBatch::I().Begin();
     RenderChildren();
+#ifndef HAVE_GLES
+    Batch().active = false;
+    DrawBatch(geometry);
+#endif
+    GlTextBatch::I().End();
     
 #ifndef HAVE_GLES
-    glPopAttrib();
+    GlStateCache::I().PopAttrib();
 #else
-    glEnable(GL_LINE_SMOOTH);
-    glEnable(GL_DEPTH_TEST);    
+    GlStateCache::I().Enable(GL_LINE_SMOOTH);
+    GlStateCache::I().Enable(GL_DEPTH_TEST);    
 #endif
 }
 
 void Panel::ResizeChildren()
 {
-    View::ResizeChildren();
+    if(layout != LayoutVertical) {
+        View::ResizeChildren();
+        return;
+    }
+
+    // As View's vertical layout, but stopping once the panel is full so
+    // that only widgets within it are laid out and shown.
+    const int margin = 6;
+    scroll_offset = std::max(0, std::min(scroll_offset, (int)views.size()));
+    Viewport space = v.Inset(margin);
+    for(size_t i = 0; i < views.size(); ++i) {
+        View& child = *views[i];
+        if((int)i + 1 < scroll_offset || space.h <= 0) {
+            child.show = false;
+        }else{
+            child.show = true;
+            child.Resize(space);
+            space.h = child.v.b - margin - space.b;
+        }
+    }
+    Invalidate();
 }
 
 
@@ -253,9 +394,10 @@ void Button::Mouse(View&, MouseButton button, int /*x*/, int /*y*/, bool pressed
 
 void Button::Render()
 {
-    glColor4fv(colour_fg );
+    ResizeChildren();
+    SetColour(colour_fg );
     glRect(v);
-    glColor4fv(colour_tx);
+    SetColour(colour_tx);
     gltext.DrawWindow(raster[0],raster[1]-down);
     DrawShadowRect(v, down);
 }
@@ -290,9 +432,10 @@ void FunctionButton::Mouse(View&, MouseButton button, int /*x*/, int /*y*/, bool
 
 void FunctionButton::Render()
 {
-    glColor4fv(colour_fg);
+    ResizeChildren();
+    SetColour(colour_fg);
     glRect(v);
-    glColor4fv(colour_tx);
+    SetColour(colour_tx);
     gltext.DrawWindow(raster[0],raster[1]-down);
     DrawShadowRect(v, down);
 }
@@ -304,7 +447,7 @@ void FunctionButton::ResizeChildren()
 }
 
 Checkbox::Checkbox(std::string title, VarValueGeneric& tv)
-    : Widget<bool>(title,tv)
+    : Widget<bool>(title,tv), rendered_val(false)
 {
     top = 1.0; bottom = Attach::Pix(-tab_h());
     left = 0.0; right = 1.0;
@@ -331,16 +474,23 @@ void Checkbox::ResizeChildren()
     vcb = Viewport(v.l,v.b+t,cb_height(),cb_height());
 }
 
+bool Checkbox::ContentChanged()
+{
+    return var->Get() != rendered_val;
+}
+
 void Checkbox::Render()
 {
+    ResizeChildren();
     const bool val = var->Get();
+    rendered_val = val;
     
     if( val )
     {
-        glColor4fv(colour_dn);
+        SetColour(colour_dn);
         glRect(vcb);
     }
-    glColor4fv(colour_tx);
+    SetColour(colour_tx);
     gltext.DrawWindow(raster[0],raster[1]);
     DrawShadowRect(vcb, val);
 }
@@ -359,7 +509,7 @@ inline bool IsIntegral(const char* typeidname)
 }
 
 Slider::Slider(std::string title, VarValueGeneric& tv)
-    : Widget<double>(title+":", tv), lock_bounds(true)
+    : Widget<double>(title+":", tv), rendered_val(0.0), lock_bounds(true)
 {
     top = 1.0; bottom = Attach::Pix(-tab_h());
     left = 0.0; right = 1.0;
@@ -466,9 +616,16 @@ void Slider::ResizeChildren()
     raster[1] = v.b + (v.h-gltext.Height())/2.0f;
 }
 
+bool Slider::ContentChanged()
+{
+    return var->Get() != rendered_val;
+}
+
 void Slider::Render()
 {
+    ResizeChildren();
     const double val = var->Get();
+    rendered_val = val;
     
     if( var->Meta().range[0] != var->Meta().range[1] )
     {
@@ -477,15 +634,15 @@ void Slider::Render()
         {
             rval = log(val);
         }
-        glColor4fv(colour_fg);
+        SetColour(colour_fg);
         glRect(v);
-        glColor4fv(colour_dn);
+        SetColour(colour_dn);
         const double norm_val = max(0.0,min(1.0,(rval - var->Meta().range[0]) / (var->Meta().range[1] - var->Meta().range[0])));
         glRect(Viewport(v.l,v.b, (int)(v.w*norm_val),v.h));
         DrawShadowRect(v);
     }
     
-    glColor4fv(colour_tx);
+    SetColour(colour_tx);
     gltext.DrawWindow(raster[0], raster[1]);
 
     std::ostringstream oss;
@@ -648,13 +805,19 @@ void TextInput::ResizeChildren()
     raster[1] = v.b + (v.h-gltext.Height()) / 2.0f;
 }
 
+bool TextInput::ContentChanged()
+{
+    return !do_edit && var->Get() != edit;
+}
+
 void TextInput::Render()
 {
+    ResizeChildren();
     if(!do_edit) edit = var->Get();
 
     gledit = font().Text(edit);
     
-    glColor4fv(colour_fg);
+    SetColour(colour_fg);
     glRect(v);
     
     const int sl = (int)gledit.Width() + 2;
@@ -664,11 +827,11 @@ void TextInput::Render()
     {
         const int tl = (int)(rl + font().Text(edit.substr(0,sel[0])).Width());
         const int tr = (int)(rl + font().Text(edit.substr(0,sel[1])).Width());
-        glColor4fv(colour_dn);
+        SetColour(colour_dn);
         glRect(Viewport(tl,v.b,tr-tl,v.h));
     }
     
-    glColor4fv(colour_tx);
+    SetColour(colour_tx);
     gltext.DrawWindow(raster[0], raster[1]);
 
     gledit.DrawWindow((GLfloat)(rl), raster[1]);
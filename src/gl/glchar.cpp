@@ -26,6 +26,7 @@
  */
 
 #include <pangolin/gl/glchar.h>
+#include <pangolin/gl/glstate.h>
 
 namespace pangolin
 {
@@ -60,9 +61,9 @@ void GlChar::Draw() const
     glEnableClientState(GL_VERTEX_ARRAY);
     glTexCoordPointer(2, GL_FLOAT, sizeof(XYUV), &vs[0].tu);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-    glEnable(GL_TEXTURE_2D);
+    GlStateCache::I().Enable(GL_TEXTURE_2D);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    glDisable(GL_TEXTURE_2D);
+    GlStateCache::I().Disable(GL_TEXTURE_2D);
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 }
@@ -0,0 +1,206 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/gl/gldepthcloud.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/gl/glvbo.h>
+
+#include <stdexcept>
+
+namespace pangolin
+{
+
+#ifndef HAVE_GLES
+
+namespace {
+
+const int local_size = 16;
+
+const char* source_depth_cloud =
+        "#version 430\n"
+        "layout(local_size_x = 16, local_size_y = 16) in;\n"
+        "layout(binding = 0) uniform sampler2D depth;\n"
+        "layout(binding = 1) uniform sampler2D colour;\n"
+        "uniform vec4 K;\n"            // fx, fy, cx, cy
+        "uniform float depth_scale;\n"
+        "uniform int has_colour;\n"
+        "layout(std430, binding = 0) writeonly buffer Vertices { float v[]; };\n"
+        "layout(std430, binding = 1) writeonly buffer Normals { float n[]; };\n"
+        "layout(std430, binding = 2) writeonly buffer Colours { uint c[]; };\n"
+        "vec3 Unproject(ivec2 p) {\n"
+        "  float d = texelFetch(depth, p, 0).r * depth_scale;\n"
+        "  return d > 0.0 ? vec3((vec2(p) - K.zw) / K.xy * d, d) : vec3(uintBitsToFloat(0x7fc00000u));\n"
+        "}\n"
+        "void main() {\n"
+        "  ivec2 size = textureSize(depth, 0);\n"
+        "  ivec2 p = ivec2(gl_GlobalInvocationID.xy);\n"
+        "  if(any(greaterThanEqual(p, size))) return;\n"
+        "  uint i = uint(p.y * size.x + p.x);\n"
+        "  vec3 P = Unproject(p);\n"
+        "  vec3 dx = p.x + 1 < size.x ? Unproject(p + ivec2(1,0)) - P : P - Unproject(p - ivec2(1,0));\n"
+        "  vec3 dy = p.y + 1 < size.y ? Unproject(p + ivec2(0,1)) - P : P - Unproject(p - ivec2(0,1));\n"
+        // Towards the camera
+        "  vec3 N = normalize(cross(dy, dx));\n"
+        "  v[3*i] = P.x; v[3*i+1] = P.y; v[3*i+2] = P.z;\n"
+        "  n[3*i] = N.x; n[3*i+1] = N.y; n[3*i+2] = N.z;\n"
+        "  vec4 rgba = has_colour != 0 ? vec4(texture(colour, (vec2(p) + 0.5) / vec2(size)).rgb, 1.0) : vec4(1.0);\n"
+        "  c[i] = packUnorm4x8(rgba);\n"
+        "}\n";
+
+}
+
+GlDepthCloud::GlDepthCloud()
+    : width(0), height(0), status(0)
+{
+}
+
+bool GlDepthCloud::IsAvailable()
+{
+    if(status == 0) {
+        status = (prog.AddShader(GlSlComputeShader, source_depth_cloud) && prog.Link()) ? 1 : -1;
+    }
+    return status > 0;
+}
+
+void GlDepthCloud::Resize(GLint w, GLint h)
+{
+    if(vbo.IsValid() && w == width && h == height) {
+        return;
+    }
+    width = w;
+    height = h;
+    const GLuint num = (GLuint)(w * h);
+    vbo.Reinitialise(GlArrayBuffer, num, GL_FLOAT, 3, GL_DYNAMIC_DRAW);
+    nbo.Reinitialise(GlArrayBuffer, num, GL_FLOAT, 3, GL_DYNAMIC_DRAW);
+    cbo.Reinitialise(GlArrayBuffer, num, GL_UNSIGNED_BYTE, 4, GL_DYNAMIC_DRAW);
+    // The grid is fixed, so its strips are only built when the size changes
+    MakeTriangleStripIboForVbo(ibo, w, h);
+}
+
+bool GlDepthCloud::Process(const GlTexture& depth, const DepthIntrinsics& K, float depth_scale, const GlTexture* colour)
+{
+    if(!depth.IsValid() || !IsAvailable()) {
+        return false;
+    }
+    Resize(depth.width, depth.height);
+
+    prog.Bind();
+    prog.SetUniform("K", K.fx, K.fy, K.cx, K.cy);
+    prog.SetUniform("depth_scale", depth_scale);
+    prog.SetUniform("has_colour", colour && colour->IsValid() ? 1 : 0);
+
+    GlStateCache::I().ActiveTexture(GL_TEXTURE1);
+    if(colour && colour->IsValid()) colour->Bind();
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    depth.Bind();
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo.bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nbo.bo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cbo.bo);
+
+    glDispatchCompute((depth.width + local_size - 1) / local_size, (depth.height + local_size - 1) / local_size, 1);
+    // Buffers are next read as vertex attributes
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    for(GLuint b = 0; b < 3; ++b) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+    }
+    depth.Unbind();
+    if(colour && colour->IsValid()) {
+        GlStateCache::I().ActiveTexture(GL_TEXTURE1);
+        colour->Unbind();
+        GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    }
+    prog.Unbind();
+    return true;
+}
+
+bool GlDepthCloud::Process(const Image<unsigned char>& depth, const PixelFormat& fmt, const DepthIntrinsics& K, float depth_scale, const GlTexture* colour)
+{
+    if(fmt.channels != 1 || (fmt.Name() != "GRAY16LE" && fmt.Name() != "GRAY32F")) {
+        throw std::runtime_error("GlDepthCloud: Depth must be GRAY16LE or GRAY32F, not " + fmt.Name());
+    }
+
+    // Sampled 16 bit depth is normalised, so undo that in the scale
+    const bool is16 = fmt.bpp == 16;
+    const GLint internal_format = is16 ? GL_R16 : GL_R32F;
+    if(depth_tex.width != (GLint)depth.w || depth_tex.height != (GLint)depth.h || depth_tex.internal_format != internal_format) {
+        depth_tex.Reinitialise((GLsizei)depth.w, (GLsizei)depth.h, internal_format, false, 0, GL_RED, is16 ? GL_UNSIGNED_SHORT : GL_FLOAT);
+    }
+
+    GLint unpack_alignment, unpack_row_length;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &unpack_row_length);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(depth.pitch / (fmt.bpp / 8)));
+    depth_tex.Upload(depth.ptr, GL_RED, is16 ? GL_UNSIGNED_SHORT : GL_FLOAT);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, unpack_row_length);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+
+    return Process(depth_tex, K, is16 ? depth_scale * 65535.0f : depth_scale, colour);
+}
+
+void GlDepthCloud::Render(bool draw_mesh, bool draw_colour, bool draw_normals)
+{
+    if(vbo.IsValid()) {
+        RenderVboIboCboNbo(vbo, ibo, cbo, nbo, draw_mesh, draw_colour, draw_normals);
+    }
+}
+
+#else // HAVE_GLES
+
+GlDepthCloud::GlDepthCloud()
+    : width(0), height(0), status(-1)
+{
+}
+
+bool GlDepthCloud::IsAvailable()
+{
+    return false;
+}
+
+void GlDepthCloud::Resize(GLint, GLint)
+{
+}
+
+bool GlDepthCloud::Process(const GlTexture&, const DepthIntrinsics&, float, const GlTexture*)
+{
+    return false;
+}
+
+bool GlDepthCloud::Process(const Image<unsigned char>&, const PixelFormat&, const DepthIntrinsics&, float, const GlTexture*)
+{
+    return false;
+}
+
+void GlDepthCloud::Render(bool, bool, bool)
+{
+}
+
+#endif // HAVE_GLES
+
+}
@@ -39,11 +39,11 @@ void glRecordGraphic(float x, float y, float radius)
     {
         // now, render a little red "recording" dot
         glPushAttrib(GL_ENABLE_BIT);
-        glDisable(GL_LIGHTING);
-        glDisable(GL_DEPTH_TEST);
+        GlStateCache::I().Disable(GL_LIGHTING);
+        GlStateCache::I().Disable(GL_DEPTH_TEST);
         glColor3ub( 255, 0, 0 );
         glDrawCircle( x, y, radius );
-        glPopAttrib();
+        GlStateCache::I().PopAttrib();
     }
 
 }
@@ -32,8 +32,16 @@
 #include <pangolin/gl/glfont.h>
 #include <pangolin/gl/glstate.h>
 #include <pangolin/image/image_io.h>
+#include <pangolin/utils/file_utils.h>
 #include <pangolin/utils/type_convert.h>
 
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <type_traits>
+
 #if !defined(HAVE_GLES) || defined(HAVE_GLES_2)
 #include <pangolin/gl/glsl.h>
 #endif
@@ -63,8 +71,13 @@ GlFont::GlFont(const unsigned char* ttf_buffer, float pixel_height, int tex_w, i
 
 GlFont::GlFont(const std::string& filename, float pixel_height, int tex_w, int tex_h)
 {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if(!file) {
+        throw std::runtime_error("Unable to open font file.");
+    }
     unsigned char* ttf_buffer = new unsigned char[1<<20];
-    const size_t bytes_read = fread(ttf_buffer, 1, 1<<20, fopen(filename.c_str(), "rb"));
+    const size_t bytes_read = fread(ttf_buffer, 1, 1<<20, file);
+    fclose(file);
     if(bytes_read > 0) {
         InitialiseFont(ttf_buffer, pixel_height, tex_w, tex_h);
     }else{
@@ -78,12 +91,196 @@ GlFont::~GlFont()
     delete[] font_bitmap;
 }
 
+namespace {
+
+const char font_cache_magic[8] = {'P','A','N','G','F','O','N','T'};
+const uint32_t font_cache_version = 1;
+
+struct FontCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sizeof_glchar;
+    uint64_t ttf_hash;
+    float pixel_height;
+    int32_t tex_w;
+    int32_t tex_h;
+    int32_t first_char;
+    int32_t num_chars;
+};
+
+std::mutex& FontCacheMutex()
+{
+    static std::mutex m;
+    return m;
+}
+
+std::string& FontCacheDirectory()
+{
+    static std::string dir = [](){
+        const char* env = getenv("PANGOLIN_FONT_CACHE");
+        if(env) return std::string(env);
+#ifdef _WIN_
+        return std::string();
+#else
+        const char* home = getenv("HOME");
+        return home ? std::string(home) + "/.cache/pangolin/fonts" : std::string();
+#endif
+    }();
+    return dir;
+}
+
+uint32_t ReadBigEndian32(const unsigned char* p)
+{
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// Bytes spanned by the tables of an sfnt font, since embedded fonts
+// come without a length.
+size_t TtfSizeBytes(const unsigned char* ttf)
+{
+    const size_t num_tables = (size_t(ttf[4]) << 8) | ttf[5];
+    size_t end = 12 + 16*num_tables;
+    for(size_t t=0; t < num_tables; ++t) {
+        const unsigned char* record = ttf + 12 + 16*t;
+        end = std::max<size_t>(end, (size_t)ReadBigEndian32(record+8) + ReadBigEndian32(record+12));
+    }
+    return end;
+}
+
+// 64-bit FNV-1a
+uint64_t HashBytes(const unsigned char* data, size_t size)
+{
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i=0; i < size; ++i) {
+        h = (h ^ data[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+}
+
+std::string GlFont::CacheDirectory()
+{
+    std::lock_guard<std::mutex> l(FontCacheMutex());
+    return FontCacheDirectory();
+}
+
+void GlFont::SetCacheDirectory(const std::string& dir)
+{
+    std::lock_guard<std::mutex> l(FontCacheMutex());
+    FontCacheDirectory() = dir;
+}
+
+std::vector<std::shared_ptr<GlFont>> GlFont::Load(const unsigned char* ttf_buffer, const std::vector<float>& pixel_heights, int tex_w, int tex_h)
+{
+    std::vector<std::future<std::shared_ptr<GlFont>>> baking;
+    for(float pixel_height : pixel_heights) {
+        baking.push_back(std::async(std::launch::async, [=](){
+            return std::make_shared<GlFont>(ttf_buffer, pixel_height, tex_w, tex_h);
+        }));
+    }
+
+    std::vector<std::shared_ptr<GlFont>> fonts;
+    for(auto& f : baking) {
+        fonts.push_back(f.get());
+    }
+    return fonts;
+}
+
 void GlFont::InitialiseFont(const unsigned char* ttf_buffer, float pixel_height, int tex_w, int tex_h)
 {
     font_height_px = pixel_height;
     this->tex_w = tex_w;
     this->tex_h = tex_h;
     font_bitmap = new unsigned char[tex_w*tex_h];
+    ttf_hash = 0;
+
+    const std::string dir = CacheDirectory();
+    if(dir.empty()) {
+        BakeFont(ttf_buffer);
+        return;
+    }
+
+    // Keyed by everything that determines the baked result
+    ttf_hash = HashBytes(ttf_buffer, TtfSizeBytes(ttf_buffer));
+    char key[128];
+    snprintf(key, sizeof(key), "%016llx_%g_%dx%d_%d_%d.atlas",
+             (unsigned long long)ttf_hash, pixel_height, tex_w, tex_h, FIRST_CHAR, NUM_CHARS);
+    const std::string filename = dir + "/" + key;
+
+    if(!LoadCachedFont(filename)) {
+        BakeFont(ttf_buffer);
+        SaveCachedFont(filename);
+    }
+}
+
+bool GlFont::LoadCachedFont(const std::string& filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if(!f.is_open()) {
+        return false;
+    }
+
+    FontCacheHeader header;
+    f.read((char*)&header, sizeof(header));
+    if( !f || std::memcmp(header.magic, font_cache_magic, sizeof(font_cache_magic)) ||
+        header.version != font_cache_version || header.sizeof_glchar != sizeof(GlChar) ||
+        header.ttf_hash != ttf_hash || header.pixel_height != font_height_px ||
+        header.tex_w != tex_w || header.tex_h != tex_h ||
+        header.first_char != FIRST_CHAR || header.num_chars != NUM_CHARS )
+    {
+        return false;
+    }
+
+    f.read((char*)chardata, sizeof(chardata));
+    f.read((char*)kern_table, sizeof(kern_table));
+    f.read((char*)font_bitmap, tex_w*tex_h);
+    return (bool)f;
+}
+
+void GlFont::SaveCachedFont(const std::string& filename) const
+{
+    static_assert(std::is_trivially_copyable<GlChar>::value, "GlChar is written to the font cache as bytes");
+
+    if(!MakeDirectories(PathParent(filename))) {
+        return;
+    }
+
+    FontCacheHeader header;
+    std::memcpy(header.magic, font_cache_magic, sizeof(font_cache_magic));
+    header.version = font_cache_version;
+    header.sizeof_glchar = sizeof(GlChar);
+    header.ttf_hash = ttf_hash;
+    header.pixel_height = font_height_px;
+    header.tex_w = tex_w;
+    header.tex_h = tex_h;
+    header.first_char = FIRST_CHAR;
+    header.num_chars = NUM_CHARS;
+
+    // Written aside and renamed so concurrent processes never see a partial file
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%p.tmp", (const void*)this);
+    const std::string tmp = filename + suffix;
+    {
+        std::ofstream f(tmp, std::ios::binary);
+        f.write((const char*)&header, sizeof(header));
+        f.write((const char*)chardata, sizeof(chardata));
+        f.write((const char*)kern_table, sizeof(kern_table));
+        f.write((const char*)font_bitmap, tex_w*tex_h);
+        if(!f) {
+            f.close();
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    if(std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+    }
+}
+
+void GlFont::BakeFont(const unsigned char* ttf_buffer)
+{
     const int offset = 0;
 
     stbtt_fontinfo f;
@@ -91,7 +288,7 @@ void GlFont::InitialiseFont(const unsigned char* ttf_buffer, float pixel_height,
        throw std::runtime_error("Unable to initialise font");
     }
 
-    float scale = stbtt_ScaleForPixelHeight(&f, pixel_height);
+    float scale = stbtt_ScaleForPixelHeight(&f, font_height_px);
 
     STBTT_memset(font_bitmap, 0, tex_w*tex_h);
     int x = 1;
@@ -142,44 +339,30 @@ void GlFont::InitialiseGlTexture()
 
 GlText GlFont::Text( const char* fmt, ... )
 {
-    if(!mTex.IsValid()) InitialiseGlTexture();
-
-    GlText ret(mTex);
-    
-    char text[MAX_TEXT_LENGTH];          
+    char text[MAX_TEXT_LENGTH];
     va_list ap;
-    
-    if( fmt != NULL ) {
-        va_start( ap, fmt );
-        vsnprintf( text, MAX_TEXT_LENGTH, fmt, ap );
-        va_end( ap );
-        
-        const size_t len = strlen(text);
-        char lc = ' ' - FIRST_CHAR;
-        for(size_t i=0; i < len; ++i) {
-            char c = text[i];
-            if( !(FIRST_CHAR <= c /*&& c <FIRST_CHAR+NUM_CHARS*/) ) {
-                c = ' ';
-            }
-            GlChar& ch = chardata[c-32];
-
-            // Kerning
-            if(i) {
-                const GLfloat kern = kern_table[ (lc-32)*NUM_CHARS + (c-32) ];
-                ret.AddSpace(kern);
-            }
-
-            ret.Add(c,ch);
-            lc = c;
-        }
+
+    if( fmt == NULL ) {
+        if(!mTex.IsValid()) InitialiseGlTexture();
+        return GlText(mTex);
     }
-    return ret;
+
+    va_start( ap, fmt );
+    vsnprintf( text, MAX_TEXT_LENGTH, fmt, ap );
+    va_end( ap );
+
+    return Text(std::string(text));
 }
 
 GlText GlFont::Text( const std::string& str )
 {
     if(!mTex.IsValid()) InitialiseGlTexture();
 
+    auto cached = layout_cache.find(str);
+    if(cached != layout_cache.end()) {
+        return cached->second;
+    }
+
     GlText ret(mTex);
 
     char lc = ' ' - FIRST_CHAR;
@@ -199,6 +382,11 @@ GlText GlFont::Text( const std::string& str )
         ret.Add(c,ch);
         lc = c;
     }
+
+    if(layout_cache.size() >= MAX_CACHED_LAYOUTS) {
+        layout_cache.clear();
+    }
+    layout_cache.emplace(str, ret);
     return ret;
 }
 
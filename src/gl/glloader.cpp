@@ -0,0 +1,161 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/gl/glloader.h>
+#include <pangolin/display/display.h>
+
+#include <stdexcept>
+
+namespace pangolin
+{
+
+namespace
+{
+
+std::unique_ptr<GlContextInterface> SharedContextOf(WindowInterface* window)
+{
+    if(!window) {
+        throw std::runtime_error("GlLoader: No window is bound to share with");
+    }
+    std::unique_ptr<GlContextInterface> context = window->CreateSharedContext();
+    if(!context) {
+        throw std::runtime_error("GlLoader: Window backend doesn't support shared contexts");
+    }
+    return context;
+}
+
+}
+
+GlLoader::GlLoader()
+    : GlLoader(SharedContextOf(GetBoundWindow()))
+{
+}
+
+GlLoader::GlLoader(WindowInterface& window)
+    : GlLoader(SharedContextOf(&window))
+{
+}
+
+GlLoader::GlLoader(std::unique_ptr<GlContextInterface> context)
+    : context(std::move(context)), running(0), should_quit(false)
+{
+    if(!this->context) {
+        throw std::runtime_error("GlLoader: context must not be null");
+    }
+    thread = std::thread(&GlLoader::Run, this);
+}
+
+GlLoader::~GlLoader()
+{
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        should_quit = true;
+    }
+    cond_queued.notify_all();
+    thread.join();
+}
+
+std::future<GlTexture> GlLoader::LoadTexture(const std::string& filename, bool sampling_linear)
+{
+    return Async([filename, sampling_linear]() {
+        GlTexture tex;
+        tex.LoadFromFile(filename, sampling_linear);
+        return tex;
+    });
+}
+
+std::future<GlTexture> GlLoader::UploadTexture(TypedImage image, bool sampling_linear)
+{
+    std::shared_ptr<TypedImage> shared = std::make_shared<TypedImage>(std::move(image));
+    return Async([shared, sampling_linear]() {
+        GlTexture tex;
+        tex.Load(*shared, sampling_linear);
+        return tex;
+    });
+}
+
+size_t GlLoader::Pending() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return queue.size() + running;
+}
+
+void GlLoader::Flush()
+{
+    std::unique_lock<std::mutex> l(mutex);
+    cond_done.wait(l, [this](){ return queue.empty() && running == 0; });
+}
+
+void GlLoader::FenceAndWait()
+{
+#ifndef HAVE_GLES
+    if(glFenceSync) {
+        GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(sync);
+        return;
+    }
+#endif
+    glFinish();
+}
+
+void GlLoader::Enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        queue.push_back(std::move(task));
+    }
+    cond_queued.notify_one();
+}
+
+void GlLoader::Run()
+{
+    context->MakeCurrent();
+#ifdef HAVE_GLEW
+    // Entry points are per context on some platforms
+    glewInit();
+#endif
+
+    std::unique_lock<std::mutex> l(mutex);
+    while(true) {
+        cond_queued.wait(l, [this](){ return should_quit || !queue.empty(); });
+        if(queue.empty()) break;
+
+        std::function<void()> task = std::move(queue.front());
+        queue.pop_front();
+        ++running;
+        l.unlock();
+        task();
+        l.lock();
+        --running;
+        cond_done.notify_all();
+    }
+
+    context->ReleaseCurrent();
+}
+
+}
@@ -0,0 +1,243 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/gl/glreduce.h>
+#include <pangolin/gl/glsl.h>
+
+#include <algorithm>
+
+namespace pangolin
+{
+
+#ifndef HAVE_GLES
+
+namespace {
+
+// Each pass takes the min / max of blocks of reduce_block^2 texels (block in
+// the shader below)
+const int reduce_block = 8;
+
+// channels > 0 reads the first channels of a colour texture, and
+// channels == 0 reads (min,max) pairs written by a previous pass.
+const char* source_reduce =
+        "#version 130\n"
+        "uniform sampler2D tex;"
+        "uniform ivec2 origin;"
+        "uniform ivec2 size;"
+        "uniform int channels;"
+        "const int block = 8;"
+        "void main() {"
+        "  ivec2 start = origin + ivec2(gl_FragCoord.xy) * block;"
+        "  ivec2 end = min(start + ivec2(block), origin + size);"
+        "  vec2 mm = vec2(3.402823e38, -3.402823e38);"
+        "  for(int y = start.y; y < end.y; ++y) {"
+        "    for(int x = start.x; x < end.x; ++x) {"
+        "      vec4 t = texelFetch(tex, ivec2(x,y), 0);"
+        "      if(channels == 0) {"
+        "        mm = vec2(min(mm.x, t.r), max(mm.y, t.g));"
+        "      }else{"
+        "        vec3 c = channels == 1 ? t.rrr : (channels == 2 ? t.rgg : t.rgb);"
+        "        mm = vec2(min(mm.x, min(c.r, min(c.g, c.b))), max(mm.y, max(c.r, max(c.g, c.b))));"
+        "      }"
+        "    }"
+        "  }"
+        "  gl_FragColor = vec4(mm, 0.0, 1.0);"
+        "}";
+
+// Colour channels considered for textures of internal_format, or 0 if unsupported
+int ReduceChannels(GLint internal_format)
+{
+    switch(internal_format) {
+    case GL_LUMINANCE8:
+    case GL_LUMINANCE16:
+    case GL_LUMINANCE:
+    case GL_LUMINANCE32F_ARB:
+    case GL_R8:
+    case GL_R16:
+    case GL_R32F:
+        return 1;
+    case GL_RG8:
+    case GL_RG16:
+    case GL_RG32F:
+        return 2;
+    case GL_RGB8:
+    case GL_RGB16:
+    case GL_RGB:
+    case GL_RGB32F:
+    case GL_RGBA8:
+    case GL_RGBA16:
+    case GL_RGBA:
+    case GL_RGBA32F:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+struct GlMinMaxReducer
+{
+    GlMinMaxReducer()
+        : fbid(0)
+    {
+        valid = prog.AddShader(GlSlFragmentShader, source_reduce) && prog.Link();
+        if(valid) {
+            glGenFramebuffersEXT(1, &fbid);
+        }
+    }
+
+    ~GlMinMaxReducer()
+    {
+        if(fbid) {
+            glDeleteFramebuffersEXT(1, &fbid);
+        }
+    }
+
+    static GlMinMaxReducer& Instance()
+    {
+        // As with GlSlUtilities, tied to the thread rather than the context
+#ifndef PANGO_NO_THREADLOCAL
+        thread_local
+#else
+        static
+#endif
+        GlMinMaxReducer instance;
+        return instance;
+    }
+
+    bool valid;
+    GlSlProgram prog;
+    GLuint fbid;
+    // Intermediate (min,max) pairs, alternately read and written
+    GlTexture ping_pong[2];
+};
+
+}
+
+bool GlTextureMinMax(const GlTexture& tex, XYRangei roi, std::pair<float,float>& min_max)
+{
+    const int channels = ReduceChannels(tex.internal_format);
+    if(!tex.IsValid() || !channels) {
+        return false;
+    }
+
+    roi.Clamp(0, tex.width, 0, tex.height);
+    int w = roi.x.AbsSize();
+    int h = roi.y.AbsSize();
+    if(w <= 0 || h <= 0) {
+        return false;
+    }
+
+    GlMinMaxReducer& r = GlMinMaxReducer::Instance();
+    if(!r.valid) {
+        return false;
+    }
+
+    // The first pass writes the largest result
+    const GLint pass_w = (w + reduce_block - 1) / reduce_block;
+    const GLint pass_h = (h + reduce_block - 1) / reduce_block;
+    for(GlTexture& t : r.ping_pong) {
+        if(!t.IsValid() || t.width < pass_w || t.height < pass_h) {
+            t.Reinitialise(std::max(pass_w, t.width), std::max(pass_h, t.height), GL_RG32F, false, 0, GL_RG, GL_FLOAT);
+        }
+    }
+
+    GLint prev_fbid = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &prev_fbid);
+    glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_PIXEL_MODE_BIT);
+    GlStateCache::I().Disable(GL_DEPTH_TEST);
+    GlStateCache::I().Disable(GL_SCISSOR_TEST);
+    GlStateCache::I().Disable(GL_BLEND);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, r.fbid);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    r.prog.Bind();
+
+    GLfloat sq_vert[] = { -1,-1,  1,-1,  1, 1,  -1, 1 };
+    glVertexPointer(2, GL_FLOAT, 0, sq_vert);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    const GlTexture* src = &tex;
+    int origin_x = std::min(roi.x.min, roi.x.max);
+    int origin_y = std::min(roi.y.min, roi.y.max);
+    int src_channels = channels;
+    for(int pass = 0; ; ++pass) {
+        const int out_w = (w + reduce_block - 1) / reduce_block;
+        const int out_h = (h + reduce_block - 1) / reduce_block;
+        const GlTexture& dst = r.ping_pong[pass % 2];
+
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, dst.tid, 0);
+        GlStateCache::I().Viewport(0, 0, out_w, out_h);
+        r.prog.SetUniform("origin", origin_x, origin_y);
+        r.prog.SetUniform("size", w, h);
+        r.prog.SetUniform("channels", src_channels);
+        src->Bind();
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+        src = &dst;
+        origin_x = origin_y = 0;
+        w = out_w;
+        h = out_h;
+        src_channels = 0;
+        if(w == 1 && h == 1) break;
+    }
+
+    GLfloat mm[2];
+    glReadPixels(0, 0, 1, 1, GL_RG, GL_FLOAT, mm);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    src->Unbind();
+    r.prog.Unbind();
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, 0, 0);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, prev_fbid);
+
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    GlStateCache::I().PopAttrib();
+
+    min_max = std::pair<float,float>(mm[0], mm[1]);
+    return glGetError() == GL_NO_ERROR;
+}
+
+#else // HAVE_GLES
+
+bool GlTextureMinMax(const GlTexture& /*tex*/, XYRangei /*roi*/, std::pair<float,float>& /*min_max*/)
+{
+    return false;
+}
+
+#endif // HAVE_GLES
+
+}
@@ -30,9 +30,12 @@
 
 #ifdef BUILD_PANGOLIN_GUI
 #include <pangolin/display/display.h>
+#include <pangolin/display/display_internal.h>
 #include <pangolin/display/view.h>
 #endif
 
+#include <cstddef>
+
 namespace pangolin
 {
 
@@ -80,6 +83,23 @@ void GlText::Add(unsigned char c, const GlChar& glc)
     str.append(1,c);
 }
 
+void GlText::Append(const GlText& txt, GLfloat x, GLfloat y)
+{
+    if(!tex) tex = txt.tex;
+
+    vs.reserve(vs.size() + txt.vs.size());
+    for(const XYUV& p : txt.vs) {
+        vs.push_back(XYUV(p.x + x, p.y + y, p.tu, p.tv));
+    }
+
+    if(txt.vs.size()) {
+        ymin = std::min(ymin, txt.ymin + y);
+        ymax = std::max(ymax, txt.ymax + y);
+    }
+    width = std::max(width, x + txt.width);
+    str.append(txt.str);
+}
+
 void GlText::Clear()
 {
     str.clear();
@@ -100,9 +120,9 @@ void GlText::DrawGlSl() const
         glVertexAttribPointer(pangolin::DEFAULT_LOCATION_TEXCOORD, 2, GL_FLOAT, GL_FALSE, sizeof(XYUV), &vs[0].tu);
 
         tex->Bind();
-        glEnable(GL_TEXTURE_2D);
+        GlStateCache::I().Enable(GL_TEXTURE_2D);
         glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vs.size() );
-        glDisable(GL_TEXTURE_2D);
+        GlStateCache::I().Disable(GL_TEXTURE_2D);
 
         glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_POSITION);
         glDisableVertexAttribArray(pangolin::DEFAULT_LOCATION_TEXCOORD);
@@ -118,9 +138,9 @@ void GlText::Draw() const
         glTexCoordPointer(2, GL_FLOAT, sizeof(XYUV), &vs[0].tu);
         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
         tex->Bind();
-        glEnable(GL_TEXTURE_2D);
+        GlStateCache::I().Enable(GL_TEXTURE_2D);
         glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vs.size() );
-        glDisable(GL_TEXTURE_2D);
+        GlStateCache::I().Disable(GL_TEXTURE_2D);
         glDisableClientState(GL_VERTEX_ARRAY);
         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
     }
@@ -160,7 +180,7 @@ void GlText::Draw(GLfloat x, GLfloat y, GLfloat z) const
     Draw();
 
     // Restore viewport
-    glViewport(view[0],view[1],view[2],view[3]);
+    GlStateCache::I().Viewport(view[0],view[1],view[2],view[3]);
 
     // Restore modelview / project matrices
     glMatrixMode(GL_PROJECTION);
@@ -172,6 +192,16 @@ void GlText::Draw(GLfloat x, GLfloat y, GLfloat z) const
 // Render at (x,y) in window coordinates.
 void GlText::DrawWindow(GLfloat x, GLfloat y, GLfloat z) const
 {
+#ifndef HAVE_GLES
+    GlTextBatch& batch = GlTextBatch::I();
+    if(batch.Active()) {
+        GLfloat rgba[4];
+        glGetFloatv(GL_CURRENT_COLOR, rgba);
+        batch.Add(*this, std::floor(x), std::floor(y), z, rgba);
+        return;
+    }
+#endif
+
     // Backup viewport
     GLint    view[4];
     glGetIntegerv(GL_VIEWPORT, view );
@@ -187,7 +217,7 @@ void GlText::DrawWindow(GLfloat x, GLfloat y, GLfloat z) const
     Draw();
 
     // Restore viewport
-    glViewport(view[0],view[1],view[2],view[3]);
+    GlStateCache::I().Viewport(view[0],view[1],view[2],view[3]);
 
     // Restore modelview / project matrices
     glMatrixMode(GL_PROJECTION);
@@ -198,5 +228,101 @@ void GlText::DrawWindow(GLfloat x, GLfloat y, GLfloat z) const
 
 #endif // BUILD_PANGOLIN_GUI
 
+GlTextBatch& GlTextBatch::I()
+{
+#ifdef BUILD_PANGOLIN_GUI
+    PangolinGl* context = GetCurrentContext();
+    if(context) {
+        return context->text_batch;
+    }
+#endif
+    static GlTextBatch instance;
+    return instance;
+}
+
+GlTextBatch::GlTextBatch()
+    : depth(0), tex(nullptr), glyphs_drawn(0), draw_calls(0)
+{
+}
+
+void GlTextBatch::Begin()
+{
+    ++depth;
+}
+
+void GlTextBatch::End()
+{
+    if(depth > 0 && --depth == 0) {
+        Flush();
+    }
+}
+
+void GlTextBatch::Add(const GlText& txt, GLfloat x, GLfloat y, GLfloat z, const GLfloat rgba[4])
+{
+    if(txt.vs.empty() || !txt.tex) {
+        return;
+    }
+
+    if(tex != txt.tex) {
+        Flush();
+        tex = txt.tex;
+    }
+
+    const size_t start = vs.size();
+    vs.resize(start + txt.vs.size());
+    for(size_t i=0; i < txt.vs.size(); ++i) {
+        const XYUV& p = txt.vs[i];
+        vs[start+i] = { p.x + x, p.y + y, z, p.tu, p.tv, rgba[0], rgba[1], rgba[2], rgba[3] };
+    }
+}
+
+void GlTextBatch::Flush()
+{
+#if defined(BUILD_PANGOLIN_GUI) && !defined(HAVE_GLES)
+    if(vs.size() && tex) {
+        // Orphan the previous frame's storage rather than wait on it
+        const GLuint floats = (GLuint)(vs.size() * sizeof(Vertex) / sizeof(GLfloat));
+        vbo.Reinitialise(GlArrayBuffer, std::max(floats, vbo.num_elements), GL_FLOAT, 1, GL_STREAM_DRAW);
+        vbo.Upload(vs.data(), vs.size() * sizeof(Vertex));
+
+        GLint view[4];
+        glGetIntegerv(GL_VIEWPORT, view );
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        DisplayBase().ActivatePixelOrthographic();
+
+        vbo.Bind();
+        glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,x));
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,tu));
+        glColorPointer(4, GL_FLOAT, sizeof(Vertex), (GLvoid*)offsetof(Vertex,r));
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        vbo.Unbind();
+
+        tex->Bind();
+        GlStateCache::I().Enable(GL_TEXTURE_2D);
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vs.size() );
+        GlStateCache::I().Disable(GL_TEXTURE_2D);
+
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        GlStateCache::I().Viewport(view[0],view[1],view[2],view[3]);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+
+        glyphs_drawn += vs.size() / 6;
+        ++draw_calls;
+    }
+#endif
+    vs.clear();
+    tex = nullptr;
+}
 
 }
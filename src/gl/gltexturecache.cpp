@@ -26,13 +26,122 @@
 */
 
 #include <pangolin/gl/gltexturecache.h>
+#include <pangolin/display/display_internal.h>
 
 namespace pangolin
 {
-    
+
+namespace {
+
+// Approximate bytes per texel from the client format of the texture
+size_t TexelBytes(GLint glformat, GLenum gltype)
+{
+    size_t channels = 4;
+    if(glformat >= GL_RED && glformat <= GL_LUMINANCE_ALPHA) {
+        channels = GlFormatChannels(glformat);
+    }
+#ifndef HAVE_GLES
+    else if(glformat == GL_BGR) {
+        channels = 3;
+    }
+#endif
+    // GL_BYTE through GL_DOUBLE
+    const size_t bytes = (gltype >= GL_BYTE && gltype <= GL_BYTE + 10) ? GlDataTypeBytes(gltype) : 4;
+    return channels * bytes;
+}
+
+}
+
 TextureCache& TextureCache::I() {
+    PangolinGl* context = GetCurrentContext();
+    if(context) {
+        return context->texture_cache;
+    }
     static TextureCache instance;
     return instance;
 }
 
-}
\ No newline at end of file
+TextureCache::TextureCache(size_t budget_bytes)
+    : default_sampling_linear(true), budget_bytes(budget_bytes)
+{
+}
+
+GLsizei TextureCache::Bucket(GLsizei size)
+{
+    GLsizei pow2 = 1;
+    while(pow2 < size) pow2 <<= 1;
+    const GLsizei step = std::max<GLsizei>(16, pow2 / 8);
+    return ((size + step - 1) / step) * step;
+}
+
+GlTexture& TextureCache::GlTex(GLsizei w, GLsizei h, GLint internal_format, GLint glformat, GLenum gltype)
+{
+    const Key key(internal_format, glformat, gltype, Bucket(w), Bucket(h));
+
+    auto it = textures.find(key);
+    if(it != textures.end()) {
+        ++stats.hits;
+        lru.splice(lru.begin(), lru, it->second);
+        return *lru.front().tex;
+    }
+
+    ++stats.misses;
+    Entry entry;
+    entry.key = key;
+    entry.tex.reset(new GlTexture(
+        std::get<3>(key), std::get<4>(key), internal_format, default_sampling_linear, 0, glformat, gltype
+    ));
+    entry.bytes = std::get<3>(key) * std::get<4>(key) * TexelBytes(glformat, gltype);
+    lru.push_front(std::move(entry));
+    textures[key] = lru.begin();
+    stats.bytes += lru.front().bytes;
+    ++stats.textures;
+
+    Evict();
+    return *lru.front().tex;
+}
+
+void TextureCache::Evict()
+{
+    while(stats.bytes > budget_bytes && lru.size() > 1) {
+        const Entry& victim = lru.back();
+        stats.bytes -= victim.bytes;
+        --stats.textures;
+        ++stats.evictions;
+        textures.erase(victim.key);
+        lru.pop_back();
+    }
+}
+
+void TextureCache::SetBudgetBytes(size_t budget_bytes)
+{
+    this->budget_bytes = budget_bytes;
+    Evict();
+}
+
+size_t TextureCache::BudgetBytes() const
+{
+    return budget_bytes;
+}
+
+const TextureCacheStats& TextureCache::Stats() const
+{
+    return stats;
+}
+
+void TextureCache::ResetStats()
+{
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+}
+
+void TextureCache::Clear()
+{
+    textures.clear();
+    lru.clear();
+    stats.bytes = 0;
+    stats.textures = 0;
+}
+
+}
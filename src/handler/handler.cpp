@@ -114,6 +114,96 @@ void HandlerScroll::Special(View& d, InputSpecial inType, float x, float y, floa
     }
 }
 
+#ifndef HAVE_GLES
+// Reads a window of the depth buffer into pixel pack buffers, so that picking
+// can use the depth from the last frame without stalling the pipeline.
+struct AsyncDepthReader
+{
+    struct Read
+    {
+        GlBuffer pbo;
+        GLsync fence = 0;
+        int x = 0;
+        int y = 0;
+    };
+
+    AsyncDepthReader(int zl)
+        : zl(zl), next(0), valid(false), valid_x(0), valid_y(0), zs(zl*zl)
+    {
+        for(Read& r : reads) {
+            r.pbo.Reinitialise(GlPixelPackBuffer, zl*zl, GL_FLOAT, 1, GL_STREAM_READ);
+        }
+    }
+
+    ~AsyncDepthReader()
+    {
+        for(Read& r : reads) {
+            if(r.fence) glDeleteSync(r.fence);
+        }
+    }
+
+    // Only the window's own depth buffer is read ahead
+    static bool Available()
+    {
+        GLint fbo = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &fbo);
+        return fbo == 0;
+    }
+
+    // Start reading the depth window centred on (x,y)
+    void Request(int x, int y)
+    {
+        Read& r = reads[next];
+        next = (next + 1) % 2;
+        if(r.fence) glDeleteSync(r.fence);
+
+        r.x = x;
+        r.y = y;
+        r.pbo.Bind();
+        glReadBuffer(GL_FRONT);
+        glReadPixels(x-zl/2, y-zl/2, zl, zl, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+        r.pbo.Unbind();
+        r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    // Copy the newest finished read into out if it was centred on (x,y)
+    bool Fetch(int x, int y, GLfloat* out)
+    {
+        for(int i=0; i < 2; ++i) {
+            Read& r = reads[(next + i) % 2];
+            if(r.fence) {
+                const GLenum status = glClientWaitSync(r.fence, 0, 0);
+                if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                    r.pbo.Bind();
+                    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, zs.size()*sizeof(GLfloat), zs.data());
+                    r.pbo.Unbind();
+                    glDeleteSync(r.fence);
+                    r.fence = 0;
+                    valid = true;
+                    valid_x = r.x;
+                    valid_y = r.y;
+                }
+            }
+        }
+
+        if(valid && valid_x == x && valid_y == y) {
+            std::copy(zs.begin(), zs.end(), out);
+            return true;
+        }
+        return false;
+    }
+
+    const int zl;
+    Read reads[2];
+    int next;
+    bool valid;
+    int valid_x;
+    int valid_y;
+    std::vector<GLfloat> zs;
+};
+#endif // HAVE_GLES
+
 Handler3D::Handler3D(OpenGlRenderState& cam_state, AxisDirection enforce_up, float trans_scale, float zoom_fraction)
     : cam_state(&cam_state), enforce_up(enforce_up), tf(trans_scale), zf(zoom_fraction), cameraspec(CameraSpecOpenGl), last_z(0.8)
 {
@@ -146,8 +236,21 @@ void Handler3D::GetPosNormal(pangolin::View& view, int winx, int winy, GLprecisi
     GLfloat zs[zsize];
 
 #ifndef HAVE_GLES
-    glReadBuffer(GL_FRONT);
-    glReadPixels(winx-hwin,winy-hwin,zl,zl,GL_DEPTH_COMPONENT,GL_FLOAT,zs);
+    const bool async = AsyncDepthReader::Available();
+    if(async && !depth_reader) {
+        depth_reader = std::make_shared<AsyncDepthReader>(zl);
+    }
+
+    // Use the last frame's depth if it was read ahead, otherwise wait for it
+    if(!async || !depth_reader->Fetch(winx, winy, zs)) {
+        glReadBuffer(GL_FRONT);
+        glReadPixels(winx-hwin,winy-hwin,zl,zl,GL_DEPTH_COMPONENT,GL_FLOAT,zs);
+    }
+
+    // Scrolling will usually come back here again
+    if(async) {
+        depth_reader->Request(winx, winy);
+    }
 #else
     std::fill(zs,zs+zsize, 1);
 #endif
@@ -219,6 +322,20 @@ void Handler3D::Mouse(View& display, MouseButton button, int x, int y, bool pres
     }
 }
 
+void Handler3D::PassiveMouseMotion(View& display, int x, int y, int button_state)
+{
+#ifndef HAVE_GLES
+    // Read ahead where the user may click or scroll next
+    if(AsyncDepthReader::Available()) {
+        if(!depth_reader) {
+            depth_reader = std::make_shared<AsyncDepthReader>(hwin*2+1);
+        }
+        depth_reader->Request(x, y);
+    }
+#endif
+    Handler::PassiveMouseMotion(display, x, y, button_state);
+}
+
 void Handler3D::MouseMotion(View& display, int x, int y, int button_state)
 {
     const GLprecision rf = 0.01;
@@ -90,11 +90,11 @@ void ImageViewHandler::glRenderTexture(GLuint tex, GLint width, GLint height)
         const GLfloat sq_vert[]  = { l,t,  r,t,  r,b,  l,b };
         const GLfloat sq_tex[]  = { ln,tn,  rn,tn,  rn,bn,  ln,bn };
 
-        glBindTexture(GL_TEXTURE_2D, tex);
+        GlStateCache::I().BindTexture(GL_TEXTURE_2D, tex);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, UseNN() ? GL_NEAREST : GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, UseNN() ? GL_NEAREST : GL_LINEAR);
 
-        glEnable(GL_TEXTURE_2D);
+        GlStateCache::I().Enable(GL_TEXTURE_2D);
         glEnableClientState(GL_VERTEX_ARRAY);
         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
         glTexCoordPointer(2, GL_FLOAT, 0, sq_tex);
@@ -102,8 +102,8 @@ void ImageViewHandler::glRenderTexture(GLuint tex, GLint width, GLint height)
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
         glDisableClientState(GL_VERTEX_ARRAY);
-        glDisable(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        GlStateCache::I().Disable(GL_TEXTURE_2D);
+        GlStateCache::I().BindTexture(GL_TEXTURE_2D, 0);
     }
 }
 
@@ -135,8 +135,8 @@ void ImageViewHandler::glRenderOverlay()
         glGetBooleanv(GL_BLEND, &gl_blend_enabled);
 
         // Ensure that blending is enabled for rendering text.
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        GlStateCache::I().Enable(GL_BLEND);
+        GlStateCache::I().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
         pangolin::GlFont::I().Text(
             "%.2f x %.2f",
@@ -150,7 +150,7 @@ void ImageViewHandler::glRenderOverlay()
         ).DrawWindow(xpix, ypix - 1.0f * pangolin::GlFont::I().Height());
 
         // Restore previous value
-        if(!gl_blend_enabled) glDisable(GL_BLEND);
+        if(!gl_blend_enabled) GlStateCache::I().Disable(GL_BLEND);
     }
 }
 
@@ -13,7 +13,8 @@ std::ostream& operator<<(std::ostream& s, const Viewport& v)
 }
 
 OculusHud::OculusHud()
-    : post_unwarp(true), handler(*this)
+    : post_unwarp(true), stereo_mode(OculusStereoMultiPass),
+      mv_colour(0), mv_depth(0), mv_fbo(0), mv_read_fbo(0), handler(*this)
 {
     InitialiseOculus();
     InitialiseFramebuffer();
@@ -45,6 +46,11 @@ OculusHud::OculusHud()
     pangolin::SetFullscreen();
 }
 
+OculusHud::~OculusHud()
+{
+    ReleaseMultiview();
+}
+
 void OculusHud::SetHandler(Handler *h)
 {
     for(int i=0; i<2; ++i) {
@@ -148,6 +154,60 @@ void OculusHud::UnwarpPoint(unsigned int view, const float in[2], float out[2])
     out[1] = v.h * (LensCenter[1] + Scale[1] * theta1[1]);
 }
 
+bool OculusHud::SetStereoMode(OculusStereoMode mode)
+{
+    if(mode == stereo_mode) return true;
+
+    if(mode == OculusStereoMultiview) {
+#if defined(HAVE_GLEW) && defined(GL_OVR_multiview)
+        if(!GLEW_OVR_multiview || !InitialiseMultiview()) return false;
+#else
+        return false;
+#endif
+    }else{
+        ReleaseMultiview();
+    }
+    stereo_mode = mode;
+    return true;
+}
+
+OculusStereoMode OculusHud::StereoMode() const
+{
+    return stereo_mode;
+}
+
+void OculusHud::SetMultiviewUniform(GlSlProgram& prog, const std::string& name, const OpenGlMatrix& model)
+{
+    for(int i=0; i<2; ++i) {
+        const OpenGlMatrix m = default_cam.GetProjectionMatrix(i) * default_cam.GetModelViewMatrix(i) * model;
+        prog.SetUniform(name + "[" + std::to_string(i) + "]", m);
+    }
+}
+
+void OculusHud::RenderMultiview()
+{
+#if defined(HAVE_GLEW) && defined(GL_OVR_multiview)
+    const GLsizei hw = HMD.HResolution/2;
+    const GLsizei h = HMD.VResolution;
+
+    // One traversal of the scene, replicated to both layers by the driver
+    glBindFramebuffer(GL_FRAMEBUFFER, mv_fbo);
+    glViewport(0, 0, hw, h);
+    glClearColor(1,1,1,0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    this->extern_draw_function(*this);
+
+    // Lay the layers side by side for the distortion pass
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mv_read_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.fbid);
+    for(int i=0; i<2; ++i) {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mv_colour, 0, i);
+        glBlitFramebuffer(0, 0, hw, h, i*hw, 0, (i+1)*hw, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+#endif
+}
+
 void OculusHud::RenderFramebuffer()
 {    
     Activate();
@@ -191,7 +251,9 @@ void OculusHud::Render()
     if(show) {
         // If render function defined, use it to render left / right images
         // to framebuffer
-        if(this->extern_draw_function) {
+        if(this->extern_draw_function && stereo_mode == OculusStereoMultiview) {
+            RenderMultiview();
+        }else if(this->extern_draw_function) {
             framebuffer.Bind();
             glClearColor(1,1,1,0);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -322,6 +384,50 @@ void OculusHud::InitialiseShader()
     occ.Link();
 }
 
+bool OculusHud::InitialiseMultiview()
+{
+#if defined(HAVE_GLEW) && defined(GL_OVR_multiview)
+    ReleaseMultiview();
+    const GLsizei hw = HMD.HResolution/2;
+    const GLsizei h = HMD.VResolution;
+
+    // Multiview renders to array layers, so depth can't be a renderbuffer
+    glGenTextures(1, &mv_colour);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mv_colour);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, hw, h, 2);
+    glGenTextures(1, &mv_depth);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, mv_depth);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, hw, h, 2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &mv_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, mv_fbo);
+    glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mv_colour, 0, 0, 2);
+    glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, mv_depth, 0, 0, 2);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGenFramebuffers(1, &mv_read_fbo);
+
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        pango_print_error("Unable to create multiview framebuffer\n");
+        ReleaseMultiview();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OculusHud::ReleaseMultiview()
+{
+    if(mv_fbo) glDeleteFramebuffers(1, &mv_fbo);
+    if(mv_read_fbo) glDeleteFramebuffers(1, &mv_read_fbo);
+    if(mv_colour) glDeleteTextures(1, &mv_colour);
+    if(mv_depth) glDeleteTextures(1, &mv_depth);
+    mv_fbo = mv_read_fbo = mv_colour = mv_depth = 0;
+}
+
 HandlerOculus::HandlerOculus(OculusHud& oculus, pangolin::Handler* handler)
     : oculus(oculus), handler(handler)
 {
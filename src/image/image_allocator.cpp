@@ -0,0 +1,215 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/image/image_allocator.h>
+#include <pangolin/image/memcpy.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN_
+#  include <malloc.h>
+#endif
+
+#ifdef _LINUX_
+#  include <sys/mman.h>
+#endif
+
+namespace pangolin
+{
+
+namespace
+{
+const size_t cache_line_bytes = 64;
+const size_t page_bytes = 4096;
+const size_t huge_page_bytes = 2 * 1024 * 1024;
+
+size_t ClassAlignment(size_t class_bytes)
+{
+    return class_bytes >= huge_page_bytes ? huge_page_bytes :
+           class_bytes >= page_bytes ? page_bytes : cache_line_bytes;
+}
+}
+
+void* AllocateImageBuffer(size_t size_bytes, size_t alignment)
+{
+    alignment = std::max(alignment, sizeof(void*));
+    size_bytes = std::max<size_t>(size_bytes, 1);
+
+    void* ptr = nullptr;
+#ifdef _WIN_
+    ptr = _aligned_malloc(size_bytes, alignment);
+#else
+    if(posix_memalign(&ptr, alignment, size_bytes) != 0) {
+        ptr = nullptr;
+    }
+#endif
+    if(!ptr) {
+        throw std::bad_alloc();
+    }
+#if defined(_LINUX_) && defined(MADV_HUGEPAGE)
+    if(alignment >= huge_page_bytes && size_bytes >= huge_page_bytes) {
+        // Advisory only, ignore failure (e.g. THP disabled).
+        madvise(ptr, size_bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+}
+
+void FreeImageBuffer(void* ptr)
+{
+#ifdef _WIN_
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+ImageBufferPool& ImageBufferPool::I()
+{
+    // Intentionally never destroyed: images may be freed by static objects
+    // destructed after this function's statics would be.
+    static ImageBufferPool* pool = new ImageBufferPool();
+    return *pool;
+}
+
+ImageBufferPool& ImageBufferPool::Pinned()
+{
+    // Never destroyed, as above.
+    static ImageBufferPool* pool = new ImageBufferPool(true);
+    return *pool;
+}
+
+ImageBufferPool::ImageBufferPool(bool pinned, size_t budget_bytes)
+    : pinned(pinned), budget_bytes(budget_bytes), stats{0, 0, 0, 0}
+{
+}
+
+ImageBufferPool::~ImageBufferPool()
+{
+    Trim();
+}
+
+size_t ImageBufferPool::SizeClass(size_t size_bytes)
+{
+    size_bytes = std::max<size_t>(size_bytes, 1);
+    const size_t align = ClassAlignment(size_bytes);
+    return ((size_bytes + align - 1) / align) * align;
+}
+
+void* ImageBufferPool::Allocate(size_t size_bytes)
+{
+    const size_t bytes = SizeClass(size_bytes);
+
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        auto it = idle.find(bytes);
+        if(it != idle.end()) {
+            void* ptr = it->second;
+            idle.erase(it);
+            stats.bytes_idle -= bytes;
+            ++stats.hits;
+            return ptr;
+        }
+        ++stats.misses;
+    }
+
+    void* ptr = pinned ? AllocatePinned(bytes) : AllocateImageBuffer(bytes, ClassAlignment(bytes));
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        stats.bytes_allocated += bytes;
+    }
+    return ptr;
+}
+
+void ImageBufferPool::Release(void* ptr, size_t size_bytes)
+{
+    if(!ptr) return;
+    const size_t bytes = SizeClass(size_bytes);
+
+    std::lock_guard<std::mutex> l(mutex);
+    if(stats.bytes_idle + bytes > budget_bytes) {
+        // Make room by dropping idle buffers of other sizes first, as
+        // this one is the most likely to be needed again
+        TrimTo(budget_bytes > bytes ? budget_bytes - bytes : 0);
+        if(stats.bytes_idle + bytes > budget_bytes) {
+            Free(ptr, bytes);
+            return;
+        }
+    }
+    idle.insert(std::make_pair(bytes, ptr));
+    stats.bytes_idle += bytes;
+}
+
+void ImageBufferPool::SetBudgetBytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    budget_bytes = bytes;
+    TrimTo(budget_bytes);
+}
+
+size_t ImageBufferPool::BudgetBytes() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return budget_bytes;
+}
+
+void ImageBufferPool::Trim()
+{
+    std::lock_guard<std::mutex> l(mutex);
+    TrimTo(0);
+}
+
+ImageBufferPoolStats ImageBufferPool::Stats() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return stats;
+}
+
+void ImageBufferPool::TrimTo(size_t bytes)
+{
+    // Largest first, to free the fewest buffers
+    while(stats.bytes_idle > bytes && !idle.empty()) {
+        auto it = std::prev(idle.end());
+        Free(it->second, it->first);
+        stats.bytes_idle -= it->first;
+        idle.erase(it);
+    }
+}
+
+void ImageBufferPool::Free(void* ptr, size_t class_bytes)
+{
+    if(pinned) {
+        FreePinned(static_cast<unsigned char*>(ptr), class_bytes);
+    }else{
+        FreeImageBuffer(ptr);
+    }
+    stats.bytes_allocated -= class_bytes;
+}
+
+}
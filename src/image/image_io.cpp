@@ -26,38 +26,55 @@
  */
 
 #include <pangolin/image/image_io.h>
+#include <pangolin/image/image_io_exr.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 
 namespace pangolin {
 
 // PNG
 TypedImage LoadPng(std::istream& in);
+void LoadPng(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
 void SavePng(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first, int zlib_compression_level );
 
 // JPG
 TypedImage LoadJpg(std::istream& in);
+TypedImage LoadJpg(std::istream& in, size_t downscale);
+void LoadJpg(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
 void SaveJpg(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, float quality);
 
 // PPM
 TypedImage LoadPpm(std::istream& in);
+void LoadPpm(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
 void SavePpm(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first);
 
 // TGA
 TypedImage LoadTga(std::istream& in);
+void LoadTga(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
 
 // Pango
 TypedImage LoadPango(const std::string& filename);
 void SavePango(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, const std::string& filename, bool top_line_first);
 
-// EXR
-TypedImage LoadExr(std::istream& source);
-void SaveExr(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, const std::string& filename, bool top_line_first);
 
 // ZSTD (https://github.com/facebook/zstd)
 TypedImage LoadZstd(std::istream& in);
+void LoadZstd(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
 void SaveZstd(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, int compression_level);
 
+// Region decoders, which return only [x,x+w) x [y,y+h) clipped to the image
+TypedImage LoadPngRegion(std::istream& in, size_t x, size_t y, size_t w, size_t h);
+TypedImage LoadJpgRegion(std::istream& in, size_t x, size_t y, size_t w, size_t h);
+TypedImage LoadPpmRegion(std::istream& in, size_t x, size_t y, size_t w, size_t h);
+TypedImage LoadExrRegion(std::istream& in, size_t x, size_t y, size_t w, size_t h);
+
+// Depth (lossless 16 bit predictive codec)
+TypedImage LoadDepth(std::istream& in);
+void LoadDepth(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt);
+void SaveDepth(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out);
+
 TypedImage LoadImage(std::istream& in, ImageFileType file_type)
 {
     switch (file_type) {
@@ -71,6 +88,8 @@ TypedImage LoadImage(std::istream& in, ImageFileType file_type)
         return LoadTga(in);
     case ImageFileTypeZstd:
         return LoadZstd(in);
+    case ImageFileTypeDepth:
+        return LoadDepth(in);
     case ImageFileTypeExr:
         return LoadExr(in);
     default:
@@ -78,6 +97,40 @@ TypedImage LoadImage(std::istream& in, ImageFileType file_type)
     }
 }
 
+// Fallback for formats without a direct decoder
+void CopyImageInto(const TypedImage& img, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    const size_t row_bytes = dst.w * dst_fmt.bpp / 8;
+    if(img.w != dst.w || img.h != dst.h || img.fmt.bpp != dst_fmt.bpp) {
+        throw std::runtime_error("Decoded image does not match destination");
+    }
+    for(size_t row = 0; row < dst.h; ++row) {
+        std::memcpy(dst.ptr + row*dst.pitch, img.RowPtr(row), row_bytes);
+    }
+}
+
+void LoadImageInto(std::istream& in, ImageFileType file_type, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    switch (file_type) {
+    case ImageFileTypePng:
+        return LoadPng(in, dst, dst_fmt);
+    case ImageFileTypeJpg:
+        return LoadJpg(in, dst, dst_fmt);
+    case ImageFileTypePpm:
+        return LoadPpm(in, dst, dst_fmt);
+    case ImageFileTypeTga:
+        return LoadTga(in, dst, dst_fmt);
+    case ImageFileTypeZstd:
+        return LoadZstd(in, dst, dst_fmt);
+    case ImageFileTypeDepth:
+        return LoadDepth(in, dst, dst_fmt);
+    case ImageFileTypeExr:
+        return LoadExr(in, dst, dst_fmt);
+    default:
+        return CopyImageInto(LoadImage(in, file_type), dst, dst_fmt);
+    }
+}
+
 TypedImage LoadImage(const std::string& filename, ImageFileType file_type)
 {
     switch (file_type) {
@@ -86,6 +139,7 @@ TypedImage LoadImage(const std::string& filename, ImageFileType file_type)
     case ImageFileTypePpm:
     case ImageFileTypeTga:
     case ImageFileTypeZstd:
+    case ImageFileTypeDepth:
     case ImageFileTypeExr:
     {
         std::ifstream ifs(filename, std::ios_base::in|std::ios_base::binary);
@@ -98,6 +152,133 @@ TypedImage LoadImage(const std::string& filename, ImageFileType file_type)
     }
 }
 
+void LoadImageInto(const std::string& filename, ImageFileType file_type, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    switch (file_type) {
+    case ImageFileTypePng:
+    case ImageFileTypeJpg:
+    case ImageFileTypePpm:
+    case ImageFileTypeTga:
+    case ImageFileTypeZstd:
+    case ImageFileTypeDepth:
+    case ImageFileTypeExr:
+    {
+        std::ifstream ifs(filename, std::ios_base::in|std::ios_base::binary);
+        return LoadImageInto(ifs, file_type, dst, dst_fmt);
+    }
+    case ImageFileTypePango:
+        return CopyImageInto(LoadPango(filename), dst, dst_fmt);
+    default:
+        throw std::runtime_error("Unsupported image file type, '" + filename + "'");
+    }
+}
+
+void CheckDownscale(size_t downscale)
+{
+    if(downscale != 1 && downscale != 2 && downscale != 4 && downscale != 8) {
+        throw std::runtime_error("Images can only be downscaled by 1, 2, 4 or 8");
+    }
+}
+
+// Nearest pixel subsample for formats without a cheaper reduced decode
+TypedImage SubsampleImage(TypedImage&& img, size_t downscale)
+{
+    if(downscale == 1) {
+        return std::move(img);
+    }
+    if(img.fmt.bpp % 8) {
+        throw std::runtime_error("Unable to downscale images of format " + img.fmt.Name());
+    }
+
+    const size_t bytes = img.fmt.bpp / 8;
+    TypedImage out((img.w + downscale - 1) / downscale, (img.h + downscale - 1) / downscale, img.fmt);
+    for(size_t y=0; y < out.h; ++y) {
+        const unsigned char* src = img.RowPtr(y * downscale);
+        unsigned char* dst = out.RowPtr(y);
+        for(size_t x=0; x < out.w; ++x) {
+            std::memcpy(dst + x*bytes, src + x*downscale*bytes, bytes);
+        }
+    }
+    return out;
+}
+
+TypedImage LoadImage(std::istream& in, ImageFileType file_type, size_t downscale)
+{
+    CheckDownscale(downscale);
+    if(file_type == ImageFileTypeJpg) {
+        return LoadJpg(in, downscale);
+    }
+    return SubsampleImage(LoadImage(in, file_type), downscale);
+}
+
+TypedImage LoadImage(const std::string& filename, ImageFileType file_type, size_t downscale)
+{
+    CheckDownscale(downscale);
+    if(file_type == ImageFileTypeJpg) {
+        std::ifstream ifs(filename, std::ios_base::in|std::ios_base::binary);
+        return LoadJpg(ifs, downscale);
+    }
+    return SubsampleImage(LoadImage(filename, file_type), downscale);
+}
+
+// Crop for formats without a cheaper region decode
+TypedImage CropImage(const TypedImage& img, size_t x, size_t y, size_t w, size_t h)
+{
+    if(x >= img.w || y >= img.h) {
+        throw std::runtime_error("Image region lies outside of image");
+    }
+    if(img.fmt.bpp % 8) {
+        throw std::runtime_error("Unable to crop images of format " + img.fmt.Name());
+    }
+
+    const size_t bytes = img.fmt.bpp / 8;
+    TypedImage out(std::min(w, img.w - x), std::min(h, img.h - y), img.fmt);
+    for(size_t r=0; r < out.h; ++r) {
+        std::memcpy(out.RowPtr(r), img.RowPtr(y + r) + x*bytes, out.w*bytes);
+    }
+    return out;
+}
+
+TypedImage LoadImageRegion(std::istream& in, ImageFileType file_type, size_t x, size_t y, size_t w, size_t h)
+{
+    switch (file_type) {
+    case ImageFileTypePng:
+        return LoadPngRegion(in, x, y, w, h);
+    case ImageFileTypeJpg:
+        return LoadJpgRegion(in, x, y, w, h);
+    case ImageFileTypePpm:
+        return LoadPpmRegion(in, x, y, w, h);
+    case ImageFileTypeExr:
+        return LoadExrRegion(in, x, y, w, h);
+    default:
+        return CropImage(LoadImage(in, file_type), x, y, w, h);
+    }
+}
+
+TypedImage LoadImageRegion(const std::string& filename, ImageFileType file_type, size_t x, size_t y, size_t w, size_t h)
+{
+    switch (file_type) {
+    case ImageFileTypePng:
+    case ImageFileTypeJpg:
+    case ImageFileTypePpm:
+    case ImageFileTypeTga:
+    case ImageFileTypeZstd:
+    case ImageFileTypeDepth:
+    case ImageFileTypeExr:
+    {
+        std::ifstream ifs(filename, std::ios_base::in|std::ios_base::binary);
+        return LoadImageRegion(ifs, file_type, x, y, w, h);
+    }
+    default:
+        return CropImage(LoadImage(filename, file_type), x, y, w, h);
+    }
+}
+
+void LoadImageRegionInto(std::istream& in, ImageFileType file_type, size_t x, size_t y, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    CopyImageInto(LoadImageRegion(in, file_type, x, y, dst.w, dst.h), dst, dst_fmt);
+}
+
 TypedImage LoadImage(const std::string& filename)
 {
     ImageFileType file_type = FileType(filename);
@@ -116,6 +297,10 @@ void SaveImage(const Image<unsigned char>& image, const pangolin::PixelFormat& f
         return SavePpm(image,fmt,out,top_line_first);
     case ImageFileTypeZstd:
         return SaveZstd(image,fmt,out, quality);
+    case ImageFileTypeDepth:
+        return SaveDepth(image,fmt,out);
+    case ImageFileTypeExr:
+        return SaveExr(image,fmt,out,top_line_first);
     default:
         throw std::runtime_error("Unable to save image file-type through std::istream");
     }
@@ -129,12 +314,12 @@ void SaveImage(const Image<unsigned char>& image, const pangolin::PixelFormat& f
     case ImageFileTypeJpg:
     case ImageFileTypePpm:
     case ImageFileTypeZstd:
+    case ImageFileTypeDepth:
+    case ImageFileTypeExr:
     {
         std::ofstream ofs(filename, std::ios_base::binary);
         return SaveImage(image, fmt, ofs, file_type, top_line_first, quality);
     }
-    case ImageFileTypeExr:
-        return SaveExr(image, fmt, filename, top_line_first);
     case ImageFileTypePango:
         return SavePango(image, fmt, filename, top_line_first);
     default:
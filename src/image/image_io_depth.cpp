@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include <pangolin/image/typed_image.h>
+
+namespace pangolin {
+
+// Lossless codec for 16 bit single channel images such as depth maps.
+//
+// Each pixel is predicted from its left neighbour (the first pixel of a row
+// from the pixel above) and the zigzag encoded residual z is written as:
+//   0x00-0x7F          : z < 128, one byte
+//   0x80-0xBF, b       : z = 128 + ((code & 0x3F) << 8 | b)
+//   0xC0-0xFE          : run of (code - 0xC0 + 2) zero residuals
+//   0xFF, lo, hi       : any other z, little endian
+// Codes never span rows. Everything is byte aligned so that encode and
+// decode are a few well predicted branches per pixel.
+
+#pragma pack(push, 1)
+struct depth_image_header
+{
+    char magic[4];
+    char fmt[8];
+    uint32_t w, h;
+    uint64_t encoded_bytes;
+};
+#pragma pack(pop)
+
+namespace {
+
+const uint16_t depth_max_short = 128 + (1 << 14);
+const size_t depth_max_run = 64;
+
+inline uint16_t ZigZag(uint16_t value, uint16_t pred)
+{
+    const int16_t r = (int16_t)(uint16_t)(value - pred);
+    return (uint16_t)(((uint16_t)r << 1) ^ (uint16_t)(r >> 15));
+}
+
+inline uint16_t UnZigZag(uint16_t z, uint16_t pred)
+{
+    return (uint16_t)(pred + (uint16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1)));
+}
+
+void CheckDepthFormat(const PixelFormat& fmt)
+{
+    if(fmt.channels != 1 || fmt.bpp != 16) {
+        throw std::runtime_error("Depth codec only supports 16 bit single channel images, not " + fmt.Name());
+    }
+}
+
+unsigned char* EncodeDepthRow(const uint16_t* row, size_t w, uint16_t pred, unsigned char* out)
+{
+    size_t x = 0;
+    while(x < w) {
+        // Fast path: four one byte residuals and no run starting among them,
+        // decided with a single branch.
+        if(x + 5 <= w) {
+            const uint16_t z0 = ZigZag(row[x], pred);
+            const uint16_t z1 = ZigZag(row[x+1], row[x]);
+            const uint16_t z2 = ZigZag(row[x+2], row[x+1]);
+            const uint16_t z3 = ZigZag(row[x+3], row[x+2]);
+            const uint16_t z4 = ZigZag(row[x+4], row[x+3]);
+            const bool small = (z0 | z1 | z2 | z3) < 128;
+            const bool no_run = ((z0 | z1) != 0) & ((z1 | z2) != 0) & ((z2 | z3) != 0) & ((z3 | z4) != 0);
+            if(small & no_run) {
+                out[0] = (unsigned char)z0;
+                out[1] = (unsigned char)z1;
+                out[2] = (unsigned char)z2;
+                out[3] = (unsigned char)z3;
+                out += 4;
+                pred = row[x+3];
+                x += 4;
+                continue;
+            }
+        }
+
+        const uint16_t z = ZigZag(row[x], pred);
+        if(z == 0 && x + 1 < w && row[x + 1] == pred) {
+            // Residuals stay zero while pixels repeat the prediction. Isolated
+            // zeros, common in noisy valid depth, take the one byte path below.
+            size_t run = 2;
+            while(x + run < w && row[x + run] == pred) ++run;
+            x += run;
+            while(run >= 2) {
+                const size_t n = std::min(run, depth_max_run);
+                *out++ = (unsigned char)(0xC0 + n - 2);
+                run -= n;
+            }
+            if(run) *out++ = 0;
+            continue;
+        }
+
+        if(z < 128) {
+            *out++ = (unsigned char)z;
+        }else if(z < depth_max_short) {
+            const uint16_t v = z - 128;
+            *out++ = (unsigned char)(0x80 | (v >> 8));
+            *out++ = (unsigned char)(v & 0xFF);
+        }else{
+            *out++ = 0xFF;
+            *out++ = (unsigned char)(z & 0xFF);
+            *out++ = (unsigned char)(z >> 8);
+        }
+        pred = row[x];
+        ++x;
+    }
+    return out;
+}
+
+const unsigned char* DecodeDepthRow(const unsigned char* in, const unsigned char* in_end, uint16_t* row, size_t w, uint16_t pred)
+{
+    size_t x = 0;
+    while(x < w) {
+        if(in == in_end) {
+            throw std::runtime_error("Truncated depth image");
+        }
+        const unsigned char code = *in++;
+        if(code < 0x80) {
+            pred = UnZigZag(code, pred);
+            row[x++] = pred;
+        }else if(code < 0xC0) {
+            if(in == in_end) throw std::runtime_error("Truncated depth image");
+            const uint16_t z = 128 + (((code & 0x3F) << 8) | *in++);
+            pred = UnZigZag(z, pred);
+            row[x++] = pred;
+        }else if(code < 0xFF) {
+            const size_t run = code - 0xC0 + 2;
+            if(x + run > w) throw std::runtime_error("Corrupt depth image");
+            for(size_t i=0; i < run; ++i) row[x++] = pred;
+        }else{
+            if(in_end - in < 2) throw std::runtime_error("Truncated depth image");
+            const uint16_t z = (uint16_t)(in[0] | (in[1] << 8));
+            in += 2;
+            pred = UnZigZag(z, pred);
+            row[x++] = pred;
+        }
+    }
+    return in;
+}
+
+PixelFormat DepthReadHeader(std::istream& in, depth_image_header& header)
+{
+    in.read((char*)&header, sizeof(header));
+    if(!in || strncmp(header.magic, "PDEP", 4)) {
+        throw std::runtime_error("Not a depth image");
+    }
+    const PixelFormat fmt = PixelFormatFromString(std::string(header.fmt, strnlen(header.fmt, sizeof(header.fmt))));
+    CheckDepthFormat(fmt);
+    return fmt;
+}
+
+void DepthDecodeInto(std::istream& in, const depth_image_header& header, const Image<unsigned char>& dst)
+{
+    // Scratch reused between images where possible, avoiding fresh pages every frame
+#ifndef PANGO_NO_THREADLOCAL
+    thread_local
+#endif
+    std::vector<unsigned char> encoded;
+    encoded.resize(header.encoded_bytes);
+    in.read((char*)encoded.data(), header.encoded_bytes);
+    if(!in) {
+        throw std::runtime_error("Truncated depth image");
+    }
+
+    const unsigned char* p = encoded.data();
+    const unsigned char* end = p + header.encoded_bytes;
+    for(size_t y=0; y < dst.h; ++y) {
+        uint16_t* row = (uint16_t*)(dst.ptr + y*dst.pitch);
+        const uint16_t pred = y ? *(const uint16_t*)(dst.ptr + (y-1)*dst.pitch) : 0;
+        p = DecodeDepthRow(p, end, row, dst.w, pred);
+    }
+}
+
+}
+
+void SaveDepth(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out)
+{
+    CheckDepthFormat(fmt);
+
+    // Worst case is three bytes per pixel
+#ifndef PANGO_NO_THREADLOCAL
+    thread_local
+#endif
+    std::vector<unsigned char> encoded;
+    encoded.resize(3 * image.w * image.h);
+    unsigned char* p = encoded.data();
+    for(size_t y=0; y < image.h; ++y) {
+        const uint16_t* row = (const uint16_t*)image.RowPtr(y);
+        const uint16_t pred = y ? *(const uint16_t*)image.RowPtr(y-1) : 0;
+        p = EncodeDepthRow(row, image.w, pred, p);
+    }
+
+    depth_image_header header;
+    memcpy(header.magic, "PDEP", 4);
+    memset(header.fmt, 0, sizeof(header.fmt));
+    memcpy(header.fmt, fmt.Name().c_str(), std::min(fmt.Name().size(), sizeof(header.fmt)));
+    header.w = (uint32_t)image.w;
+    header.h = (uint32_t)image.h;
+    header.encoded_bytes = p - encoded.data();
+    out.write((char*)&header, sizeof(header));
+    out.write((char*)encoded.data(), header.encoded_bytes);
+}
+
+TypedImage LoadDepth(std::istream& in)
+{
+    depth_image_header header;
+    const PixelFormat fmt = DepthReadHeader(in, header);
+
+    TypedImage img(header.w, header.h, fmt);
+    DepthDecodeInto(in, header, img);
+    return img;
+}
+
+void LoadDepth(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    depth_image_header header;
+    const PixelFormat fmt = DepthReadHeader(in, header);
+
+    if(header.w != dst.w || header.h != dst.h || fmt.bpp != dst_fmt.bpp) {
+        throw std::runtime_error("Depth image does not match destination image");
+    }
+    DepthDecodeInto(in, header, dst);
+}
+
+}
@@ -1,16 +1,40 @@
 #include <pangolin/platform.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <pangolin/image/image_io_exr.h>
 #include <pangolin/image/typed_image.h>
+#include <pangolin/utils/memstreambuf.h>
+#include <pangolin/utils/file_utils.h>
+#include <vector>
 
 #ifdef HAVE_OPENEXR
 #include <ImfChannelList.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfThreading.h>
 #endif // HAVE_OPENEXR
 
 namespace pangolin {
 
+ExrCompression ExrCompressionFromString(const std::string& name)
+{
+    const std::string n = ToLowerCopy(name);
+    if(n == "none") return ExrCompression::None;
+    if(n == "rle") return ExrCompression::Rle;
+    if(n == "zips") return ExrCompression::Zips;
+    if(n == "zip") return ExrCompression::Zip;
+    if(n == "piz") return ExrCompression::Piz;
+    if(n == "pxr24") return ExrCompression::Pxr24;
+    if(n == "b44") return ExrCompression::B44;
+    if(n == "b44a") return ExrCompression::B44a;
+    if(n == "dwaa") return ExrCompression::Dwaa;
+    if(n == "dwab") return ExrCompression::Dwab;
+    throw std::runtime_error("Unknown OpenEXR compression '" + name + "'");
+}
+
 #ifdef HAVE_OPENEXR
 Imf::PixelType OpenEXRPixelType(int channel_bits)
 {
@@ -23,6 +47,23 @@ Imf::PixelType OpenEXRPixelType(int channel_bits)
     }
 }
 
+Imf::Compression OpenEXRCompression(ExrCompression compression)
+{
+    switch(compression) {
+    case ExrCompression::None:  return Imf::NO_COMPRESSION;
+    case ExrCompression::Rle:   return Imf::RLE_COMPRESSION;
+    case ExrCompression::Zips:  return Imf::ZIPS_COMPRESSION;
+    case ExrCompression::Zip:   return Imf::ZIP_COMPRESSION;
+    case ExrCompression::Piz:   return Imf::PIZ_COMPRESSION;
+    case ExrCompression::Pxr24: return Imf::PXR24_COMPRESSION;
+    case ExrCompression::B44:   return Imf::B44_COMPRESSION;
+    case ExrCompression::B44a:  return Imf::B44A_COMPRESSION;
+    case ExrCompression::Dwaa:  return Imf::DWAA_COMPRESSION;
+    case ExrCompression::Dwab:  return Imf::DWAB_COMPRESSION;
+    }
+    throw std::runtime_error("Unsupported OpenEXR compression.");
+}
+
 void SetOpenEXRChannels(Imf::ChannelList& ch, const pangolin::PixelFormat& fmt)
 {
     const char* CHANNEL_NAMES[] = {"R","G","B","A"};
@@ -31,13 +72,27 @@ void SetOpenEXRChannels(Imf::ChannelList& ch, const pangolin::PixelFormat& fmt)
     }
 }
 
+// OpenEXR's thread pool is process wide, so only ever grow it
+int OpenEXRThreads(size_t threads)
+{
+    static std::mutex lock;
+    std::lock_guard<std::mutex> l(lock);
+    if(threads > (size_t)Imf::globalThreadCount()) {
+        Imf::setGlobalThreadCount((int)threads);
+    }
+    return threads ? (int)threads : Imf::globalThreadCount();
+}
+
 class StdIStream: public Imf::IStream
 {
   public:
+    // Positions are relative to where the image starts within is
     StdIStream (std::istream &is):
         Imf::IStream ("stream"),
-        _is (&is)
+        _is (&is),
+        _start (is.tellg())
     {
+        if (_start < 0) _start = 0;
     }
 
     virtual bool read (char c[/*n*/], int n)
@@ -55,12 +110,12 @@ class StdIStream: public Imf::IStream
 
     virtual Imf::Int64 tellg ()
     {
-        return std::streamoff (_is->tellg());
+        return std::streamoff (_is->tellg()) - _start;
     }
 
     virtual void seekg (Imf::Int64 pos)
     {
-        _is->seekg (pos);
+        _is->seekg (_start + std::streamoff(pos));
     }
 
     virtual void clear ()
@@ -70,66 +125,268 @@ class StdIStream: public Imf::IStream
 
   private:
     std::istream *	_is;
+    std::streamoff  _start;
 };
 
+// Reads in place from the memory behind a memreadbuf, e.g. a video packet
+class MemIStream: public Imf::IStream
+{
+  public:
+    MemIStream (memreadbuf& buf):
+        Imf::IStream ("memory"),
+        _buf (&buf),
+        _data ((char*)buf.unread()),
+        _size (buf.unread_size()),
+        _pos (0),
+        _end (0)
+    {
+    }
+
+    // Leave the streambuf after the furthest byte OpenEXR read
+    ~MemIStream ()
+    {
+        _buf->consume(_end);
+    }
 
-#endif //HAVE_OPENEXR
+    virtual bool isMemoryMapped () const
+    {
+        return true;
+    }
 
-TypedImage LoadExr(std::istream& source)
+    virtual char* readMemoryMapped (int n)
+    {
+        char* p = _data + Advance(n);
+        return p;
+    }
+
+    virtual bool read (char c[/*n*/], int n)
+    {
+        std::memcpy(c, _data + Advance(n), n);
+        return _pos < _size;
+    }
+
+    virtual Imf::Int64 tellg ()
+    {
+        return _pos;
+    }
+
+    virtual void seekg (Imf::Int64 pos)
+    {
+        _pos = (size_t)pos;
+    }
+
+  private:
+    size_t Advance (int n)
+    {
+        if (n < 0 || _pos > _size || (size_t)n > _size - _pos)
+            throw std::runtime_error("Early end of file");
+        const size_t p = _pos;
+        _pos += n;
+        _end = std::max(_end, _pos);
+        return p;
+    }
+
+    memreadbuf* _buf;
+    char*       _data;
+    size_t      _size;
+    size_t      _pos;
+    size_t      _end;
+};
+
+// OpenEXR seeks back to fill in its line offset table, so encode to a
+// seekable buffer before handing the finished file to a std::ostream.
+class MemOStream: public Imf::OStream
 {
-#ifdef HAVE_OPENEXR
-    StdIStream istream(source);
-    Imf::InputFile file(istream);
-    Imath::Box2i dw = file.header().dataWindow();
-    int width = dw.max.x - dw.min.x + 1;
-    int height = dw.max.y - dw.min.y + 1;
+  public:
+    MemOStream ():
+        Imf::OStream ("memory"),
+        _pos (0)
+    {
+    }
+
+    virtual void write (const char c[/*n*/], int n)
+    {
+        if (_pos + n > _data.size())
+            _data.resize(_pos + n);
+        std::memcpy(_data.data() + _pos, c, n);
+        _pos += n;
+    }
+
+    virtual Imf::Int64 tellp ()
+    {
+        return _pos;
+    }
+
+    virtual void seekp (Imf::Int64 pos)
+    {
+        _pos = (size_t)pos;
+    }
+
+    const std::vector<char>& Data() const
+    {
+        return _data;
+    }
+
+  private:
+    std::vector<char> _data;
+    size_t _pos;
+};
+
+// Channels to load, in pixel order, and the matching float format
+PixelFormat ExrFormat(const Imf::Header& header, std::vector<std::string>& names)
+{
+    const Imf::ChannelList& ch = header.channels();
+    names.clear();
+    for(const char* n : {"R","G","B","A"}) {
+        if(ch.findChannel(n)) names.push_back(n);
+    }
+
+    if(names.size() == 1 || names.size() == 3 || names.size() == 4) {
+        // GRAY, RGB or RGBA as written by SaveExr
+    }else if(names.empty() && ch.begin() != ch.end() && ++ch.begin() == ch.end()) {
+        // A lone channel of another name, such as Y or Z
+        names.push_back(ch.begin().name());
+    }else{
+        // Anything else is loaded as RGBA with missing channels zeroed
+        names = {"R","G","B","A"};
+    }
 
-    // assume RGBA format for now
-    PixelFormat format = PixelFormatFromString("RGBA128F");
-    TypedImage img(width, height, format, width*sizeof(float)*4);
+    return PixelFormatFromString(
+        names.size() == 1 ? "GRAY32F" : names.size() == 3 ? "RGB96F" : "RGBA128F"
+    );
+}
 
-    char *imgBase = (char *) img.ptr - (dw.min.x + dw.min.y * width)*sizeof(float)*4;
+void ExrReadInto(Imf::InputFile& file, const std::vector<std::string>& names, const Image<unsigned char>& dst)
+{
+    const Imath::Box2i dw = file.header().dataWindow();
+    const size_t xstride = sizeof(float) * names.size();
+    char *base = (char *)dst.ptr - dw.min.x * xstride - dw.min.y * dst.pitch;
 
     Imf::FrameBuffer fb;
-    fb.insert("R", Imf::Slice(
-                    Imf::FLOAT, imgBase,
-                    sizeof(float) * 4,
-                    sizeof(float) * 4 * width,
-                    1, 1,
-                    0.0));
-
-    fb.insert("G", Imf::Slice(
-                    Imf::FLOAT, imgBase + sizeof(float),
-                    sizeof(float) * 4,
-                    sizeof(float) * 4 * width,
-                    1, 1,
-                    0.0));
-
-    fb.insert("B", Imf::Slice(
-                    Imf::FLOAT, imgBase + sizeof(float)*2,
-                    sizeof(float) * 4,
-                    sizeof(float) * 4 * width,
-                    1, 1,
-                    0.0));
-
-    fb.insert("A", Imf::Slice(
-                    Imf::FLOAT, imgBase + sizeof(float)*3,
-                    sizeof(float) * 4,
-                    sizeof(float) * 4 * width,
-                    1, 1,
-                    0.0));
+    for(size_t c=0; c < names.size(); ++c) {
+        fb.insert(names[c].c_str(), Imf::Slice(
+            Imf::FLOAT, base + sizeof(float)*c,
+            xstride, dst.pitch,
+            1, 1,
+            0.0));
+    }
 
     file.setFrameBuffer(fb);
     file.readPixels(dw.min.y, dw.max.y);
+}
+
+template<typename F>
+void WithExrInputFile(std::istream& source, F f)
+{
+    memreadbuf* buf = dynamic_cast<memreadbuf*>(source.rdbuf());
+    if(buf) {
+        MemIStream istream(*buf);
+        Imf::InputFile file(istream, Imf::globalThreadCount());
+        f(file);
+    }else{
+        StdIStream istream(source);
+        Imf::InputFile file(istream, Imf::globalThreadCount());
+        f(file);
+    }
+}
+
+#endif //HAVE_OPENEXR
+
+TypedImage LoadExr(std::istream& source)
+{
+#ifdef HAVE_OPENEXR
+    TypedImage img;
+    WithExrInputFile(source, [&](Imf::InputFile& file){
+        Imath::Box2i dw = file.header().dataWindow();
+        int width = dw.max.x - dw.min.x + 1;
+        int height = dw.max.y - dw.min.y + 1;
+
+        std::vector<std::string> names;
+        const PixelFormat format = ExrFormat(file.header(), names);
+        img.Reinitialise(width, height, format);
+        ExrReadInto(file, names, img);
+    });
+    return img;
+#else
+    PANGOLIN_UNUSED(source);
+    throw std::runtime_error("Rebuild Pangolin for EXR support.");
+#endif //HAVE_OPENEXR
+}
+
+void LoadExr(std::istream& source, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+#ifdef HAVE_OPENEXR
+    WithExrInputFile(source, [&](Imf::InputFile& file){
+        Imath::Box2i dw = file.header().dataWindow();
+        const size_t width = dw.max.x - dw.min.x + 1;
+        const size_t height = dw.max.y - dw.min.y + 1;
+
+        std::vector<std::string> names;
+        const PixelFormat format = ExrFormat(file.header(), names);
+        if(format.bpp != dst_fmt.bpp || width != dst.w || height != dst.h) {
+            throw std::runtime_error("EXR image does not match destination image");
+        }
+        // Decode straight into the destination
+        ExrReadInto(file, names, dst);
+    });
+#else
+    PANGOLIN_UNUSED(source);
+    PANGOLIN_UNUSED(dst);
+    PANGOLIN_UNUSED(dst_fmt);
+    throw std::runtime_error("Rebuild Pangolin for EXR support.");
+#endif //HAVE_OPENEXR
+}
+
+TypedImage LoadExrRegion(std::istream& source, size_t x, size_t y, size_t w, size_t h)
+{
+#ifdef HAVE_OPENEXR
+    TypedImage img;
+    WithExrInputFile(source, [&](Imf::InputFile& file){
+        const Imath::Box2i dw = file.header().dataWindow();
+        const size_t width = dw.max.x - dw.min.x + 1;
+        const size_t height = dw.max.y - dw.min.y + 1;
+        if(x >= width || y >= height) {
+            throw std::runtime_error("Image region lies outside of EXR image.");
+        }
+        w = std::min(w, width - x);
+        h = std::min(h, height - y);
+
+        // Only the lines (or tiles) covering rows [y, y+h) are read and
+        // decompressed. Slices span the full width, so crop afterwards.
+        std::vector<std::string> names;
+        const PixelFormat format = ExrFormat(file.header(), names);
+        const size_t bytes = format.bpp / 8;
+        TypedImage rows(width, h, format);
+
+        Imf::FrameBuffer fb;
+        char *base = (char *)rows.ptr - dw.min.x * bytes - (dw.min.y + y) * rows.pitch;
+        for(size_t c=0; c < names.size(); ++c) {
+            fb.insert(names[c].c_str(), Imf::Slice(
+                Imf::FLOAT, base + sizeof(float)*c,
+                bytes, rows.pitch,
+                1, 1,
+                0.0));
+        }
+        file.setFrameBuffer(fb);
+        file.readPixels(dw.min.y + (int)y, dw.min.y + (int)(y + h) - 1);
 
+        img.Reinitialise(w, h, format);
+        for(size_t r=0; r < h; ++r) {
+            std::memcpy(img.RowPtr(r), rows.RowPtr(r) + x * bytes, w * bytes);
+        }
+    });
     return img;
 #else
     PANGOLIN_UNUSED(source);
+    PANGOLIN_UNUSED(x);
+    PANGOLIN_UNUSED(y);
+    PANGOLIN_UNUSED(w);
+    PANGOLIN_UNUSED(h);
     throw std::runtime_error("Rebuild Pangolin for EXR support.");
 #endif //HAVE_OPENEXR
 }
 
-void SaveExr(const Image<unsigned char>& image_in, const pangolin::PixelFormat& fmt, const std::string& filename, bool top_line_first)
+void SaveExr(const Image<unsigned char>& image_in, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first, const ExrOptions& options)
 {
 #ifdef HAVE_OPENEXR
     ManagedImage<unsigned char> flip_image;
@@ -140,43 +397,55 @@ void SaveExr(const Image<unsigned char>& image_in, const pangolin::PixelFormat&
     }else{
         flip_image.Reinitialise(image_in.pitch,image_in.h);
         for(size_t y=0; y<image_in.h; ++y) {
-            std::memcpy(flip_image.RowPtr(y), image_in.RowPtr(y), image_in.pitch);
+            std::memcpy(flip_image.RowPtr(y), image_in.RowPtr(image_in.h-1-y), image_in.pitch);
         }
         image = flip_image;
+        image.w = image_in.w;
     }
 
 
     Imf::Header header (image.w, image.h);
+    header.compression() = OpenEXRCompression(options.compression);
     SetOpenEXRChannels(header.channels(), fmt);
 
-    Imf::OutputFile file (filename.c_str(), header);
-    Imf::FrameBuffer frameBuffer;
-
-    int ch=0;
-    size_t ch_bits = 0;
-    for(Imf::ChannelList::Iterator it = header.channels().begin(); it != header.channels().end(); ++it)
+    MemOStream ostream;
     {
-        frameBuffer.insert(
-            it.name(),
-            Imf::Slice(
-                it.channel().type,
-                (char*)image.ptr + ch_bits/8,
-                fmt.channel_bits[ch]/8,
-                image.pitch
-            )
-        );
+        Imf::OutputFile file (ostream, header, OpenEXRThreads(options.threads));
+        Imf::FrameBuffer frameBuffer;
 
-        ch_bits += fmt.channel_bits[ch++];
-    }
+        // Channel list iterates alphabetically, so place each by its name
+        const std::string CHANNEL_NAMES = "RGBA";
+        for(Imf::ChannelList::Iterator it = header.channels().begin(); it != header.channels().end(); ++it)
+        {
+            const size_t ch = CHANNEL_NAMES.find(it.name()[0]);
+            size_t ch_bits = 0;
+            for(size_t c=0; c < ch; ++c) ch_bits += fmt.channel_bits[c];
+
+            frameBuffer.insert(
+                it.name(),
+                Imf::Slice(
+                    it.channel().type,
+                    (char*)image.ptr + ch_bits/8,
+                    fmt.bpp/8,
+                    image.pitch
+                )
+            );
+        }
 
-    file.setFrameBuffer(frameBuffer);
-    file.writePixels(image.h);
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels(image.h);
+    }
 
+    out.write(ostream.Data().data(), ostream.Data().size());
+    if(!out) {
+        throw std::runtime_error("EXR Error: Unable to write image.");
+    }
 #else
     PANGOLIN_UNUSED(image_in);
     PANGOLIN_UNUSED(fmt);
-    PANGOLIN_UNUSED(filename);
+    PANGOLIN_UNUSED(out);
     PANGOLIN_UNUSED(top_line_first);
+    PANGOLIN_UNUSED(options);
     throw std::runtime_error("EXR Support not enabled. Please rebuild Pangolin.");
 #endif // HAVE_OPENEXR
 }
@@ -1,10 +1,13 @@
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <vector>
 
 
 #include <pangolin/platform.h>
 
 #include <pangolin/image/typed_image.h>
+#include <pangolin/utils/memstreambuf.h>
 
 #ifdef HAVE_JPEG
 #  include <jpeglib.h>
@@ -90,6 +93,69 @@ static void pango_jpeg_set_source_mgr(j_decompress_ptr cinfo, std::istream& is)
     src->pub.next_input_byte = 0;
 }
 
+// Reads straight from the memory behind a memreadbuf, e.g. a video packet
+// already in RAM, without copying through an intermediate buffer.
+struct pango_jpeg_memory_source_mgr {
+    struct jpeg_source_mgr pub;
+    memreadbuf*   buf;
+};
+
+static boolean pango_jpeg_fill_memory_buffer(j_decompress_ptr cinfo) {
+    // All input was presented up front, so the data is truncated.
+    static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+    cinfo->src->next_input_byte = fake_eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void pango_jpeg_skip_memory_data(j_decompress_ptr cinfo, long num_bytes) {
+    if (num_bytes > 0) {
+        if ((size_t)num_bytes > cinfo->src->bytes_in_buffer) {
+            pango_jpeg_fill_memory_buffer(cinfo);
+        } else {
+            cinfo->src->next_input_byte += num_bytes;
+            cinfo->src->bytes_in_buffer -= num_bytes;
+        }
+    }
+}
+
+static void pango_jpeg_term_memory_source(j_decompress_ptr cinfo) {
+    // Leave the streambuf positioned after the image.
+    pango_jpeg_memory_source_mgr* src = (pango_jpeg_memory_source_mgr*)cinfo->src;
+    const JOCTET* begin = src->buf->unread();
+    const JOCTET* end = begin + src->buf->unread_size();
+    if (begin <= src->pub.next_input_byte && src->pub.next_input_byte <= end) {
+        src->buf->consume(src->pub.next_input_byte - begin);
+    } else {
+        src->buf->consume(end - begin);
+    }
+}
+
+static void pango_jpeg_set_memory_source_mgr(j_decompress_ptr cinfo, memreadbuf& buf) {
+    pango_jpeg_memory_source_mgr* src = (pango_jpeg_memory_source_mgr*)(*cinfo->mem->alloc_small)
+            ((j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(pango_jpeg_memory_source_mgr));
+    cinfo->src = &src->pub;
+
+    src->buf = &buf;
+    src->pub.init_source = pango_jpeg_init_source;
+    src->pub.fill_input_buffer = pango_jpeg_fill_memory_buffer;
+    src->pub.skip_input_data = pango_jpeg_skip_memory_data;
+    src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
+    src->pub.term_source = pango_jpeg_term_memory_source;
+    src->pub.next_input_byte = buf.unread();
+    src->pub.bytes_in_buffer = buf.unread_size();
+}
+
+// Decode from memory when the stream is backed by it, otherwise read through a buffer.
+static void pango_jpeg_set_source(j_decompress_ptr cinfo, std::istream& is) {
+    memreadbuf* buf = dynamic_cast<memreadbuf*>(is.rdbuf());
+    if (buf) {
+        pango_jpeg_set_memory_source_mgr(cinfo, *buf);
+    } else {
+        pango_jpeg_set_source_mgr(cinfo, is);
+    }
+}
+
 struct pango_jpeg_destination_mgr {
     struct jpeg_destination_mgr pub; /* public fields */
     std::ostream* os; /* target stream */
@@ -150,35 +216,46 @@ void pango_jpeg_set_dest_mgr(j_compress_ptr cinfo, std::ostream& os) {
 
 #endif // HAVE_JPEG
 
-TypedImage LoadJpg(std::istream& is) {
+TypedImage LoadJpg(std::istream& is, size_t downscale) {
 #ifdef HAVE_JPEG
     TypedImage image;
 
+    if (downscale != 1 && downscale != 2 && downscale != 4 && downscale != 8) {
+        throw std::runtime_error("JPEG can only be downscaled by 1, 2, 4 or 8.");
+    }
+
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
 
     // Setup decompression structure
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
-    pango_jpeg_set_source_mgr(&cinfo, is);
+    pango_jpeg_set_source(&cinfo, is);
 
     // read info from header.
     int r = jpeg_read_header(&cinfo, TRUE);
     if (r != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
         throw std::runtime_error("Failed to read JPEG header.");
     } else if (cinfo.num_components != 3 && cinfo.num_components != 1) {
+        jpeg_destroy_decompress(&cinfo);
         throw std::runtime_error("Unsupported number of color components");
     } else {
+        // Reduced sizes come out of a smaller inverse DCT, skipping most of the
+        // decode work rather than throwing it away afterwards.
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = (unsigned int)downscale;
+        if (downscale > 1) {
+            cinfo.do_fancy_upsampling = FALSE;
+        }
         jpeg_start_decompress(&cinfo);
-        // resize storage if necessary
         PixelFormat fmt = PixelFormatFromString(cinfo.output_components == 3 ? "RGB24" : "GRAY8");
         image.Reinitialise(cinfo.output_width, cinfo.output_height, fmt);
-        JSAMPARRAY imageBuffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
-                                                            cinfo.output_width*cinfo.output_components, 1);
-        for (size_t y = 0; y < cinfo.output_height; y++) {
-            jpeg_read_scanlines(&cinfo, imageBuffer, 1);
-            uint8_t* dstRow = (uint8_t*)image.RowPtr(y);
-            memcpy(dstRow, imageBuffer[0], cinfo.output_width*cinfo.output_components);
+
+        // Decode straight into image rows
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW row = (JSAMPROW)image.RowPtr(cinfo.output_scanline);
+            jpeg_read_scanlines(&cinfo, &row, 1);
         }
         jpeg_finish_decompress(&cinfo);
     }
@@ -189,9 +266,119 @@ TypedImage LoadJpg(std::istream& is) {
     return image;
 #else
     PANGOLIN_UNUSED(is);
+    PANGOLIN_UNUSED(downscale);
+    throw std::runtime_error("Rebuild Pangolin for JPEG support.");
+#endif // HAVE_JPEG
+}
+
+TypedImage LoadJpg(std::istream& is) {
+    return LoadJpg(is, 1);
+}
+
+TypedImage LoadJpgRegion(std::istream& is, size_t x, size_t y, size_t w, size_t h) {
+#ifdef HAVE_JPEG
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    pango_jpeg_set_source(&cinfo, is);
+
+    int r = jpeg_read_header(&cinfo, TRUE);
+    if (r != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        throw std::runtime_error("Failed to read JPEG header.");
+    } else if (cinfo.num_components != 3 && cinfo.num_components != 1) {
+        jpeg_destroy_decompress(&cinfo);
+        throw std::runtime_error("Unsupported number of color components");
+    }
+
+    jpeg_start_decompress(&cinfo);
+    if (x >= cinfo.output_width || y >= cinfo.output_height) {
+        jpeg_destroy_decompress(&cinfo);
+        throw std::runtime_error("Image region lies outside of JPEG image.");
+    }
+    w = std::min<size_t>(w, cinfo.output_width - x);
+    h = std::min<size_t>(h, cinfo.output_height - y);
+
+    PixelFormat fmt = PixelFormatFromString(cinfo.output_components == 3 ? "RGB24" : "GRAY8");
+    TypedImage image(w, h, fmt);
+    const size_t bytes = cinfo.output_components;
+
+    // Decoded rows span [xoffset, xoffset + xwidth), which libjpeg-turbo can
+    // narrow to the iMCU columns covering the region. One extra iMCU either
+    // side keeps chroma upsampling at the region's edges as in a full decode.
+    JDIMENSION xoffset = 0;
+    JDIMENSION xwidth = cinfo.output_width;
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+    const size_t margin = cinfo.max_h_samp_factor * DCTSIZE;
+    xoffset = (JDIMENSION)(x > margin ? x - margin : 0);
+    xwidth = (JDIMENSION)(std::min<size_t>(x + w + margin, cinfo.output_width) - xoffset);
+    jpeg_crop_scanline(&cinfo, &xoffset, &xwidth);
+    // Rows above still need entropy decoding, but skip the IDCT and colour conversion
+    jpeg_skip_scanlines(&cinfo, (JDIMENSION)y);
+#endif
+
+    std::vector<JSAMPLE> row_buffer(xwidth * bytes);
+    JSAMPROW row = row_buffer.data();
+    while (cinfo.output_scanline < y + h) {
+        const size_t line = cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+        if (line >= y) {
+            std::memcpy(image.RowPtr(line - y), row + (x - xoffset) * bytes, w * bytes);
+        }
+    }
+
+    // Rows below the region are never decoded
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return image;
+#else
+    PANGOLIN_UNUSED(is);
+    PANGOLIN_UNUSED(x);
+    PANGOLIN_UNUSED(y);
+    PANGOLIN_UNUSED(w);
+    PANGOLIN_UNUSED(h);
     throw std::runtime_error("Rebuild Pangolin for JPEG support.");
 #endif // HAVE_JPEG
+}
+
+void LoadJpg(std::istream& is, const Image<unsigned char>& dst, const PixelFormat& dst_fmt) {
+#ifdef HAVE_JPEG
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    pango_jpeg_set_source(&cinfo, is);
+
+    int r = jpeg_read_header(&cinfo, TRUE);
+    if (r != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        throw std::runtime_error("Failed to read JPEG header.");
+    }
 
+    jpeg_start_decompress(&cinfo);
+    if( cinfo.output_width != dst.w || cinfo.output_height != dst.h ||
+        (size_t)cinfo.output_components != dst_fmt.channels || dst_fmt.bpp != 8 * dst_fmt.channels )
+    {
+        jpeg_destroy_decompress(&cinfo);
+        throw std::runtime_error("JPEG does not match destination image");
+    }
+
+    // Decode straight into destination rows
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = dst.ptr + cinfo.output_scanline*dst.pitch;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+#else
+    PANGOLIN_UNUSED(is);
+    PANGOLIN_UNUSED(dst);
+    PANGOLIN_UNUSED(dst_fmt);
+    throw std::runtime_error("Rebuild Pangolin for JPEG support.");
+#endif // HAVE_JPEG
 }
 
 TypedImage LoadJpg(const std::string& filename) {
@@ -1,13 +1,24 @@
 #include <pangolin/platform.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <memory>
 #include <pangolin/image/image_io.h>
+#include <pangolin/image/image_io_png.h>
+#include <pangolin/utils/parallel_for.h>
 #include <vector>
 
 #ifdef HAVE_PNG
 #  include <png.h>
+#  include <zlib.h>
 #endif // HAVE_PNG
 
+#ifdef HAVE_LIBDEFLATE
+#  include <libdeflate.h>
+#endif // HAVE_LIBDEFLATE
+
 namespace pangolin {
 
 #ifdef HAVE_PNG
@@ -68,6 +79,220 @@ void pango_png_stream_write_flush(png_structp pngPtr)
     s->flush();
 }
 
+namespace {
+
+const size_t png_window_bytes = 32768;
+const size_t png_max_chunk_bytes = 1 << 24;
+
+inline void PngPutBE32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)(v);
+}
+
+void PngWriteChunk(std::ostream& out, const char* type, const unsigned char* data, size_t size)
+{
+    unsigned char len[4];
+    PngPutBE32(len, (uint32_t)size);
+    uLong crc = crc32(0L, (const Bytef*)type, 4);
+    if(size) crc = crc32(crc, data, (uInt)size);
+    unsigned char crc_be[4];
+    PngPutBE32(crc_be, (uint32_t)crc);
+
+    out.write((const char*)len, 4);
+    out.write(type, 4);
+    out.write((const char*)data, size);
+    out.write((const char*)crc_be, 4);
+}
+
+inline unsigned char Paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+// Apply PNG filter type to row (n bytes, bpp bytes per pixel) given the
+// previous row prev (zeros for the first row), writing n residuals to out.
+void PngFilterRow(int type, const unsigned char* row, const unsigned char* prev, size_t n, size_t bpp, unsigned char* out)
+{
+    switch(type) {
+    case 0:
+        std::memcpy(out, row, n);
+        break;
+    case 1:
+        for(size_t i=0; i < bpp; ++i) out[i] = row[i];
+        for(size_t i=bpp; i < n; ++i) out[i] = row[i] - row[i-bpp];
+        break;
+    case 2:
+        for(size_t i=0; i < n; ++i) out[i] = row[i] - prev[i];
+        break;
+    case 3:
+        for(size_t i=0; i < bpp; ++i) out[i] = row[i] - (prev[i] >> 1);
+        for(size_t i=bpp; i < n; ++i) out[i] = row[i] - ((row[i-bpp] + prev[i]) >> 1);
+        break;
+    default:
+        for(size_t i=0; i < bpp; ++i) out[i] = row[i] - prev[i];
+        for(size_t i=bpp; i < n; ++i) out[i] = row[i] - Paeth(row[i-bpp], prev[i], prev[i-bpp]);
+        break;
+    }
+}
+
+// Sum of absolute residuals as signed bytes, libpng's filter heuristic
+size_t PngFilterCost(const unsigned char* f, size_t n)
+{
+    size_t sum = 0;
+    for(size_t i=0; i < n; ++i) {
+        sum += (f[i] < 128) ? f[i] : 256 - f[i];
+    }
+    return sum;
+}
+
+// Filter rows [y0, y1) of image into out, one filter type byte then the
+// residuals per row. 16 bit samples are converted to big endian first.
+void PngFilterRows(const Image<unsigned char>& image, const PixelFormat& fmt, bool top_line_first, bool fast, size_t y0, size_t y1, unsigned char* out)
+{
+    const size_t n = image.w * fmt.bpp / 8;
+    const size_t bpp = std::max<size_t>(1, fmt.bpp / 8);
+    const bool swap = fmt.channel_bits[0] == 16;
+
+    std::vector<unsigned char> scratch(2 * n + (fast ? 0 : 4 * n));
+    unsigned char* cur_be = scratch.data();
+    unsigned char* prev_be = cur_be + n;
+    unsigned char* trial = prev_be + n;
+
+    const auto row_bytes = [&](size_t y, unsigned char* be) -> const unsigned char* {
+        const unsigned char* row = image.RowPtr(top_line_first ? y : image.h - 1 - y);
+        if(!swap) return row;
+        for(size_t i=0; i + 1 < n; i += 2) {
+            be[i] = row[i+1];
+            be[i+1] = row[i];
+        }
+        return be;
+    };
+
+    std::vector<unsigned char> zeros;
+    const unsigned char* prev = nullptr;
+    if(y0 > 0) {
+        prev = row_bytes(y0 - 1, prev_be);
+    }else{
+        zeros.assign(n, 0);
+        prev = zeros.data();
+    }
+
+    for(size_t y = y0; y < y1; ++y) {
+        const unsigned char* row = row_bytes(y, cur_be);
+        unsigned char* dst = out + (y - y0) * (n + 1);
+
+        if(fast) {
+            // Up, except for the first row which has nothing above
+            const int type = (y == 0) ? 1 : 2;
+            dst[0] = (unsigned char)type;
+            PngFilterRow(type, row, prev, n, bpp, dst + 1);
+        }else{
+            // Try each filter, keeping the residuals which look cheapest to code
+            dst[0] = 0;
+            PngFilterRow(0, row, prev, n, bpp, dst + 1);
+            size_t best_cost = PngFilterCost(dst + 1, n);
+            for(int type=1; type <= 4; ++type) {
+                unsigned char* t = trial + (type - 1) * n;
+                PngFilterRow(type, row, prev, n, bpp, t);
+                const size_t cost = PngFilterCost(t, n);
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    dst[0] = (unsigned char)type;
+                    std::memcpy(dst + 1, t, n);
+                }
+            }
+        }
+
+        if(swap) {
+            std::swap(cur_be, prev_be);
+            prev = prev_be;
+        }else{
+            prev = row;
+        }
+    }
+}
+
+struct PngStrip
+{
+    const unsigned char* data;
+    size_t size;
+    std::vector<unsigned char> deflated;
+    uLong adler;
+};
+
+// Raw deflate of strip, primed with the window before it. All but the last
+// strip end on a byte aligned sync flush, so the outputs concatenate into
+// one deflate stream.
+void PngDeflateStrip(PngStrip& strip, const unsigned char* window, size_t window_size, int level, bool fast, bool last)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if(deflateInit2(&zs, level, Z_DEFLATED, -15, 8, fast ? Z_RLE : Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("PNG Error: Unable to initialise zlib.");
+    }
+    if(window_size) {
+        deflateSetDictionary(&zs, window, (uInt)window_size);
+    }
+
+    strip.deflated.resize(deflateBound(&zs, strip.size) + 16);
+    zs.next_in = const_cast<Bytef*>(strip.data);
+    zs.avail_in = (uInt)strip.size;
+    zs.next_out = strip.deflated.data();
+    zs.avail_out = (uInt)strip.deflated.size();
+    const int r = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip.deflated.resize(zs.total_out);
+    deflateEnd(&zs);
+    if(r != (last ? Z_STREAM_END : Z_OK) || zs.avail_in) {
+        throw std::runtime_error("PNG Error: zlib compression failed.");
+    }
+
+    strip.adler = adler32(adler32(0L, Z_NULL, 0), strip.data, (uInt)strip.size);
+}
+
+#ifdef HAVE_LIBDEFLATE
+struct LibdeflateCompressorDeleter
+{
+    void operator()(libdeflate_compressor* c) const { libdeflate_free_compressor(c); }
+};
+
+// Complete zlib stream of data from libdeflate, reusing the compressor per thread
+std::vector<unsigned char> PngLibdeflate(const unsigned char* data, size_t size, int level)
+{
+#ifndef PANGO_NO_THREADLOCAL
+    thread_local
+#endif
+    std::unique_ptr<libdeflate_compressor, LibdeflateCompressorDeleter> compressor;
+#ifndef PANGO_NO_THREADLOCAL
+    thread_local
+#endif
+    int compressor_level = -1;
+
+    if(!compressor || compressor_level != level) {
+        compressor.reset(libdeflate_alloc_compressor(level));
+        compressor_level = level;
+        if(!compressor) {
+            throw std::runtime_error("PNG Error: Unable to initialise libdeflate.");
+        }
+    }
+
+    std::vector<unsigned char> out(libdeflate_zlib_compress_bound(compressor.get(), size));
+    out.resize(libdeflate_zlib_compress(compressor.get(), data, size, out.data(), out.size()));
+    if(out.empty()) {
+        throw std::runtime_error("PNG Error: libdeflate compression failed.");
+    }
+    return out;
+}
+#endif // HAVE_LIBDEFLATE
+
+}
+
 #endif // HAVE_PNG
 
 
@@ -141,6 +366,140 @@ TypedImage LoadPng(std::istream& source)
 #endif // HAVE_PNG
 }
 
+void LoadPng(std::istream& source, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+#ifdef HAVE_PNG
+    if (!pango_png_validate(source)) {
+        throw std::runtime_error("Not valid PNG header");
+    }
+
+    png_structp png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, (png_voidp)NULL, NULL, &PngWarningsCallback);
+    if (!png_ptr) {
+        throw std::runtime_error( "PNG Init error 1" );
+    }
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr)  {
+        png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+        throw std::runtime_error( "PNG Init error 2" );
+    }
+
+    png_set_read_fn(png_ptr,(png_voidp)&source, pango_png_stream_read);
+    png_set_sig_bytes(png_ptr, PNGSIGSIZE);
+    png_read_info(png_ptr, info_ptr);
+
+    // Same transformations as LoadPng above
+    if( png_get_bit_depth(png_ptr, info_ptr) == 1)  {
+        png_set_packing(png_ptr);
+    } else if( png_get_bit_depth(png_ptr, info_ptr) < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+    if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+    if( png_get_bit_depth(png_ptr, info_ptr) == 16) {
+        png_set_swap(png_ptr);
+    }
+    png_read_update_info(png_ptr, info_ptr);
+
+    const bool matches =
+        png_get_interlace_type(png_ptr,info_ptr) == PNG_INTERLACE_NONE &&
+        png_get_image_width(png_ptr,info_ptr) == dst.w &&
+        png_get_image_height(png_ptr,info_ptr) == dst.h &&
+        png_get_rowbytes(png_ptr, info_ptr) == dst.w * dst_fmt.bpp / 8 &&
+        PngFormat(png_ptr, info_ptr).channels == dst_fmt.channels;
+
+    if(!matches) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+        throw std::runtime_error( "PNG does not match destination image" );
+    }
+
+    // Decode straight into destination rows
+    std::vector<png_bytep> rows(dst.h);
+    for( size_t r = 0; r < dst.h; r++) {
+        rows[r] = dst.ptr + r*dst.pitch;
+    }
+    png_read_image(png_ptr, rows.data());
+    png_read_end(png_ptr, NULL);
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+#else
+    PANGOLIN_UNUSED(source);
+    PANGOLIN_UNUSED(dst);
+    PANGOLIN_UNUSED(dst_fmt);
+    throw std::runtime_error("Rebuild Pangolin for PNG support.");
+#endif // HAVE_PNG
+}
+
+TypedImage LoadPngRegion(std::istream& source, size_t x, size_t y, size_t w, size_t h)
+{
+#ifdef HAVE_PNG
+    if (!pango_png_validate(source)) {
+        throw std::runtime_error("Not valid PNG header");
+    }
+
+    png_structp png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, (png_voidp)NULL, NULL, &PngWarningsCallback);
+    if (!png_ptr) {
+        throw std::runtime_error( "PNG Init error 1" );
+    }
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr)  {
+        png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+        throw std::runtime_error( "PNG Init error 2" );
+    }
+
+    png_set_read_fn(png_ptr,(png_voidp)&source, pango_png_stream_read);
+    png_set_sig_bytes(png_ptr, PNGSIGSIZE);
+    png_read_info(png_ptr, info_ptr);
+
+    // Same transformations as LoadPng above
+    if( png_get_bit_depth(png_ptr, info_ptr) == 1)  {
+        png_set_packing(png_ptr);
+    } else if( png_get_bit_depth(png_ptr, info_ptr) < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+    if(png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+    if( png_get_bit_depth(png_ptr, info_ptr) == 16) {
+        png_set_swap(png_ptr);
+    }
+    png_read_update_info(png_ptr, info_ptr);
+
+    const size_t img_w = png_get_image_width(png_ptr,info_ptr);
+    const size_t img_h = png_get_image_height(png_ptr,info_ptr);
+    if( png_get_interlace_type(png_ptr,info_ptr) != PNG_INTERLACE_NONE || x >= img_w || y >= img_h) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+        throw std::runtime_error( "Unable to load region of PNG image" );
+    }
+    w = std::min(w, img_w - x);
+    h = std::min(h, img_h - y);
+
+    const PixelFormat fmt = PngFormat(png_ptr, info_ptr);
+    const size_t bytes = fmt.bpp / 8;
+    TypedImage img(w, h, fmt);
+
+    // Rows must be inflated in order, but decoding stops after the last one
+    // needed and only the region is kept.
+    std::vector<png_byte> row(png_get_rowbytes(png_ptr, info_ptr));
+    for(size_t r = 0; r < y + h; ++r) {
+        png_read_row(png_ptr, row.data(), NULL);
+        if(r >= y) {
+            std::memcpy(img.RowPtr(r - y), row.data() + x * bytes, w * bytes);
+        }
+    }
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp)NULL);
+    return img;
+#else
+    PANGOLIN_UNUSED(source);
+    PANGOLIN_UNUSED(x);
+    PANGOLIN_UNUSED(y);
+    PANGOLIN_UNUSED(w);
+    PANGOLIN_UNUSED(h);
+    throw std::runtime_error("Rebuild Pangolin for PNG support.");
+#endif // HAVE_PNG
+}
+
 TypedImage LoadPng(const std::string& filename)
 {
     std::ifstream f(filename);
@@ -230,4 +589,111 @@ void SavePng(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt
 #endif // HAVE_PNG
 }
 
+void SavePng(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first, const PngOptions& options)
+{
+#ifdef HAVE_PNG
+    const unsigned int bit_depth = fmt.channel_bits[0];
+    for(unsigned int i=1; i < fmt.channels; ++i) {
+        if( fmt.channel_bits[i] != bit_depth ) {
+            throw std::runtime_error("PNG Saving only supported for images where each channel has the same bit depth.");
+        }
+    }
+    if(bit_depth != 8 && bit_depth != 16) {
+        // Packed low bit depths are left to libpng
+        return SavePng(image, fmt, out, top_line_first, options.compression_level);
+    }
+
+    unsigned char colour_type;
+    switch (fmt.channels) {
+    case 1: colour_type = PNG_COLOR_TYPE_GRAY; break;
+    case 2: colour_type = PNG_COLOR_TYPE_GRAY_ALPHA; break;
+    case 3: colour_type = PNG_COLOR_TYPE_RGB; break;
+    case 4: colour_type = PNG_COLOR_TYPE_RGBA; break;
+    default:
+        throw std::runtime_error( "PNG Error: unexpected image channel number");
+    }
+
+    const int level = std::max(0, std::min(options.compression_level, 9));
+    const size_t filtered_row = 1 + image.w * fmt.bpp / 8;
+
+    // Each strip keeps at least a window's worth of data, or the dictionary
+    // priming and flushes cost more than the threads save.
+    const size_t min_strip_rows = std::max<size_t>(1, png_window_bytes * 4 / filtered_row);
+    const size_t num_strips = std::max<size_t>(1, std::min(options.threads, image.h / min_strip_rows));
+
+    std::vector<unsigned char> filtered(filtered_row * image.h);
+    std::vector<PngStrip> strips(num_strips);
+    for(size_t s=0; s < num_strips; ++s) {
+        const size_t y0 = image.h * s / num_strips;
+        const size_t y1 = image.h * (s+1) / num_strips;
+        strips[s].data = filtered.data() + y0 * filtered_row;
+        strips[s].size = (y1 - y0) * filtered_row;
+    }
+
+    std::vector<unsigned char> idat;
+#ifdef HAVE_LIBDEFLATE
+    if(num_strips == 1) {
+        PngFilterRows(image, fmt, top_line_first, options.fast, 0, image.h, filtered.data());
+        idat = PngLibdeflate(filtered.data(), filtered.size(), level);
+    }
+#endif // HAVE_LIBDEFLATE
+
+    if(idat.empty()) {
+        ParallelFor(0, num_strips, num_strips, [&](size_t begin, size_t end){
+            for(size_t s=begin; s < end; ++s) {
+                const size_t y0 = (strips[s].data - filtered.data()) / filtered_row;
+                PngFilterRows(image, fmt, top_line_first, options.fast, y0, y0 + strips[s].size / filtered_row, const_cast<unsigned char*>(strips[s].data));
+            }
+        });
+        ParallelFor(0, num_strips, num_strips, [&](size_t begin, size_t end){
+            for(size_t s=begin; s < end; ++s) {
+                const size_t window = std::min(png_window_bytes, (size_t)(strips[s].data - filtered.data()));
+                PngDeflateStrip(strips[s], strips[s].data - window, window, level, options.fast, s + 1 == num_strips);
+            }
+        });
+
+        // zlib header, concatenated strips and the adler32 of them all
+        const unsigned char flevel = (level < 2) ? 0x01 : (level < 6) ? 0x5E : (level == 6) ? 0x9C : 0xDA;
+        idat.push_back(0x78);
+        idat.push_back(flevel);
+        uLong adler = adler32(0L, Z_NULL, 0);
+        for(const PngStrip& strip : strips) {
+            idat.insert(idat.end(), strip.deflated.begin(), strip.deflated.end());
+            adler = adler32_combine(adler, strip.adler, (z_off_t)strip.size);
+        }
+        idat.resize(idat.size() + 4);
+        PngPutBE32(&idat[idat.size() - 4], (uint32_t)adler);
+    }
+
+    png_byte sig[PNGSIGSIZE] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    out.write((const char*)sig, PNGSIGSIZE);
+
+    unsigned char ihdr[13];
+    PngPutBE32(ihdr, (uint32_t)image.w);
+    PngPutBE32(ihdr + 4, (uint32_t)image.h);
+    ihdr[8] = (unsigned char)bit_depth;
+    ihdr[9] = colour_type;
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // no interlace
+    PngWriteChunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+    for(size_t pos = 0; pos < idat.size(); pos += png_max_chunk_bytes) {
+        PngWriteChunk(out, "IDAT", idat.data() + pos, std::min(png_max_chunk_bytes, idat.size() - pos));
+    }
+    PngWriteChunk(out, "IEND", nullptr, 0);
+
+    if(!out) {
+        throw std::runtime_error("PNG Error: Unable to write image.");
+    }
+#else
+    PANGOLIN_UNUSED(image);
+    PANGOLIN_UNUSED(fmt);
+    PANGOLIN_UNUSED(out);
+    PANGOLIN_UNUSED(top_line_first);
+    PANGOLIN_UNUSED(options);
+    throw std::runtime_error("Rebuild Pangolin for PNG support.");
+#endif // HAVE_PNG
+}
+
 }
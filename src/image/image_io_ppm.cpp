@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <pangolin/image/typed_image.h>
 
@@ -26,13 +27,11 @@ void PpmConsumeWhitespaceAndComments(std::istream& in)
     while( in.peek() == '#' )  in.ignore(4096, '\n');
 }
 
-TypedImage LoadPpm(std::istream& in)
+// Parse header, leaving in positioned at the first row of pixel data
+bool PpmReadHeader(std::istream& in, int& w, int& h, PixelFormat& fmt)
 {
-    // Parse header
     std::string ppm_type = "";
     int num_colors = 0;
-    int w = 0;
-    int h = 0;
 
     in >> ppm_type;
     PpmConsumeWhitespaceAndComments(in);
@@ -44,7 +43,20 @@ TypedImage LoadPpm(std::istream& in)
     in.ignore(1,'\n');
 
     if(!in.fail() && w > 0 && h > 0) {
-        TypedImage img(w, h, PpmFormat(ppm_type, num_colors) );
+        fmt = PpmFormat(ppm_type, num_colors);
+        return true;
+    }
+    return false;
+}
+
+TypedImage LoadPpm(std::istream& in)
+{
+    int w = 0;
+    int h = 0;
+    PixelFormat fmt;
+
+    if(PpmReadHeader(in, w, h, fmt)) {
+        TypedImage img(w, h, fmt);
 
         // Read in data
         for(size_t r=0; r<img.h; ++r) {
@@ -58,6 +70,60 @@ TypedImage LoadPpm(std::istream& in)
     throw std::runtime_error("Unable to load PPM file.");
 }
 
+void LoadPpm(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    int w = 0;
+    int h = 0;
+    PixelFormat fmt;
+
+    if(!PpmReadHeader(in, w, h, fmt)) {
+        throw std::runtime_error("Unable to load PPM file.");
+    }
+
+    if((size_t)w != dst.w || (size_t)h != dst.h || fmt.bpp != dst_fmt.bpp) {
+        throw std::runtime_error("PPM does not match destination image");
+    }
+
+    // Rows are stored unpadded, so read each straight into dst
+    const size_t row_bytes = dst.w * dst_fmt.bpp / 8;
+    for(size_t r=0; r<dst.h; ++r) {
+        in.read( (char*)dst.ptr + r*dst.pitch, row_bytes );
+    }
+    if(in.fail()) {
+        throw std::runtime_error("Unable to load PPM file.");
+    }
+}
+
+TypedImage LoadPpmRegion(std::istream& in, size_t x, size_t y, size_t w, size_t h)
+{
+    int img_w = 0;
+    int img_h = 0;
+    PixelFormat fmt;
+
+    if(!PpmReadHeader(in, img_w, img_h, fmt)) {
+        throw std::runtime_error("Unable to load PPM file.");
+    }
+    if(x >= (size_t)img_w || y >= (size_t)img_h) {
+        throw std::runtime_error("Image region lies outside of PPM image.");
+    }
+    w = std::min(w, img_w - x);
+    h = std::min(h, img_h - y);
+
+    // Rows are stored unpadded, so seek straight to each part of the region
+    const size_t bytes = fmt.bpp / 8;
+    const size_t row_bytes = img_w * bytes;
+    const std::streamoff start = in.tellg();
+    TypedImage img(w, h, fmt);
+    for(size_t r=0; r < h; ++r) {
+        in.seekg(start + std::streamoff((y + r) * row_bytes + x * bytes));
+        in.read( (char*)img.RowPtr(r), w * bytes );
+    }
+    if(in.fail()) {
+        throw std::runtime_error("Unable to load PPM file.");
+    }
+    return img;
+}
+
 void SavePpm(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, bool top_line_first)
 {
     // Setup header variables
@@ -66,13 +132,13 @@ void SavePpm(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt
     int w = (int)image.w;
     int h = (int)image.h;
 
-    if(fmt.format == "GRAY8") {
+    if(fmt.id == PixelFormatId::GRAY8) {
         ppm_type = "P5";
         num_colors = 255;
-    }else if(fmt.format == "GRAY16LE") {
+    }else if(fmt.id == PixelFormatId::GRAY16LE) {
         ppm_type = "P5";
         num_colors = 65535;
-    }else if(fmt.format == "RGB24") {
+    }else if(fmt.id == PixelFormatId::RGB24) {
         ppm_type = "P6";
         num_colors = 255;
     }else{
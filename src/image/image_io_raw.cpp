@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <pangolin/image/typed_image.h>
 
@@ -22,4 +23,56 @@ TypedImage LoadImage(
     return img;
 }
 
+TypedImage LoadImageRegion(
+    const std::string& filename,
+    const PixelFormat& raw_fmt,
+    size_t raw_width, size_t raw_height, size_t raw_pitch,
+    size_t x, size_t y, size_t w, size_t h
+) {
+    if(x >= raw_width || y >= raw_height || raw_fmt.bpp % 8) {
+        throw std::runtime_error("Unable to load region of raw image");
+    }
+    w = std::min(w, raw_width - x);
+    h = std::min(h, raw_height - y);
+
+    // Seek to the part of each row within the region
+    const size_t bytes = raw_fmt.bpp / 8;
+    TypedImage img(w, h, raw_fmt);
+    std::ifstream bFile( filename.c_str(), std::ios::in | std::ios::binary );
+    for(size_t r=0; r<img.h; ++r) {
+        bFile.seekg( (y + r) * raw_pitch + x * bytes );
+        bFile.read( (char*)img.RowPtr(r), w * bytes );
+        if(bFile.fail()) {
+            pango_print_warn("Unable to read raw image file to completion.");
+            break;
+        }
+    }
+    return img;
+}
+
+void LoadImageInto(
+    const std::string& filename,
+    const PixelFormat& raw_fmt,
+    size_t raw_width, size_t raw_height, size_t raw_pitch,
+    const Image<unsigned char>& dst
+) {
+    if(dst.w != raw_width || dst.h != raw_height) {
+        throw std::runtime_error("Raw image does not match destination image");
+    }
+
+    // Read from file, row at a time, skipping any file row padding.
+    const size_t row_bytes = std::min(raw_pitch, raw_width * raw_fmt.bpp / 8);
+    std::ifstream bFile( filename.c_str(), std::ios::in | std::ios::binary );
+    for(size_t r=0; r<dst.h; ++r) {
+        bFile.read( (char*)dst.ptr + r*dst.pitch, row_bytes );
+        if(raw_pitch > row_bytes) {
+            bFile.ignore(raw_pitch - row_bytes);
+        }
+        if(bFile.fail()) {
+            pango_print_warn("Unable to read raw image file to completion.");
+            break;
+        }
+    }
+}
+
 }
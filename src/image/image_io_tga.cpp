@@ -26,7 +26,8 @@ PixelFormat TgaFormat(int depth, int color_type, int color_map)
     throw std::runtime_error("Unsupported TGA format");
 }
 
-TypedImage LoadTga(std::istream& in)
+// Parse header, leaving in positioned at the start of the pixel data
+bool TgaReadHeader(std::istream& in, int& width, int& height, PixelFormat& fmt)
 {
     unsigned char type[4];
     unsigned char info[6];
@@ -35,11 +36,24 @@ TypedImage LoadTga(std::istream& in)
     in.seekg(12);
     in.read((char*)info,6*sizeof(char));
 
-    const int width  = info[0] + (info[1] * 256);
-    const int height = info[2] + (info[3] * 256);
+    width  = info[0] + (info[1] * 256);
+    height = info[2] + (info[3] * 256);
 
     if(in.good()) {
-        TypedImage img(width, height, TgaFormat(info[4], type[2], type[1]) );
+        fmt = TgaFormat(info[4], type[2], type[1]);
+        return true;
+    }
+    return false;
+}
+
+TypedImage LoadTga(std::istream& in)
+{
+    int width = 0;
+    int height = 0;
+    PixelFormat fmt;
+
+    if(TgaReadHeader(in, width, height, fmt)) {
+        TypedImage img(width, height, fmt);
 
         //read in image data
         const size_t data_size = img.h * img.pitch;
@@ -50,4 +64,28 @@ TypedImage LoadTga(std::istream& in)
     throw std::runtime_error("Unable to load TGA file");
 }
 
+void LoadTga(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    int width = 0;
+    int height = 0;
+    PixelFormat fmt;
+
+    if(!TgaReadHeader(in, width, height, fmt)) {
+        throw std::runtime_error("Unable to load TGA file");
+    }
+
+    if((size_t)width != dst.w || (size_t)height != dst.h || fmt.bpp != dst_fmt.bpp) {
+        throw std::runtime_error("TGA does not match destination image");
+    }
+
+    const size_t row_bytes = dst.w * dst_fmt.bpp / 8;
+    if(dst.pitch == row_bytes) {
+        in.read((char*)dst.ptr, dst.h * row_bytes);
+    }else{
+        for(size_t r=0; r < dst.h; ++r) {
+            in.read((char*)dst.ptr + r*dst.pitch, row_bytes);
+        }
+    }
+}
+
 }
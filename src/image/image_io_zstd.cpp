@@ -1,11 +1,15 @@
-
+#include <cstring>
 #include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
 
+#include <pangolin/image/image_io_zstd.h>
 #include <pangolin/image/typed_image.h>
 
 #ifdef HAVE_ZSTD
 #  include <zstd.h>
+#  include <zdict.h>
 #endif
 
 namespace pangolin {
@@ -19,105 +23,381 @@ struct zstd_image_header
 };
 #pragma pack(pop)
 
-void SaveZstd(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, int compression_level)
+struct ZstdDictionary::Digested
+{
+#ifdef HAVE_ZSTD
+    Digested() : ddict(nullptr) {}
+
+    std::mutex mutex;
+    std::map<int, ZSTD_CDict*> cdicts;
+    ZSTD_DDict* ddict;
+#endif
+};
+
+ZstdDictionary::ZstdDictionary(const std::string& bytes)
+    : bytes(bytes), digested(new Digested)
+{
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+#ifdef HAVE_ZSTD
+    for(auto& c : digested->cdicts) {
+        ZSTD_freeCDict(c.second);
+    }
+    ZSTD_freeDDict(digested->ddict);
+#endif
+}
+
+#ifdef HAVE_ZSTD
+namespace {
+
+void ZstdCheck(size_t result, const char* what)
+{
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(FormatString("% error : %", what, ZSTD_getErrorName(result)));
+    }
+}
+
+ZSTD_CDict* ZstdGetCDict(const ZstdDictionary& dict, int compression_level)
+{
+    ZstdDictionary::Digested& d = dict.Digest();
+    std::lock_guard<std::mutex> l(d.mutex);
+    ZSTD_CDict*& cdict = d.cdicts[compression_level];
+    if(!cdict) {
+        cdict = ZSTD_createCDict(dict.Bytes().data(), dict.Bytes().size(), compression_level);
+        if(!cdict) {
+            throw std::runtime_error("ZSTD_createCDict() error");
+        }
+    }
+    return cdict;
+}
+
+ZSTD_DDict* ZstdGetDDict(const ZstdDictionary& dict)
+{
+    ZstdDictionary::Digested& d = dict.Digest();
+    std::lock_guard<std::mutex> l(d.mutex);
+    if(!d.ddict) {
+        d.ddict = ZSTD_createDDict(dict.Bytes().data(), dict.Bytes().size());
+        if(!d.ddict) {
+            throw std::runtime_error("ZSTD_createDDict() error");
+        }
+    }
+    return d.ddict;
+}
+
+// Contexts are costly to create, more so with compression workers which each
+// own a thread, so they are kept per thread and reset between images.
+struct ZstdContexts
+{
+    ZstdContexts() : cctx(nullptr), dctx(nullptr) {}
+    ~ZstdContexts()
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+
+    ZSTD_CCtx* CCtx()
+    {
+        if(!cctx && !(cctx = ZSTD_createCCtx())) {
+            throw std::runtime_error("ZSTD_createCCtx() error");
+        }
+        return cctx;
+    }
+
+    ZSTD_DCtx* DCtx()
+    {
+        if(!dctx && !(dctx = ZSTD_createDCtx())) {
+            throw std::runtime_error("ZSTD_createDCtx() error");
+        }
+        return dctx;
+    }
+
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+};
+
+// Per thread contexts where supported, otherwise a fresh context per image.
+#ifndef PANGO_NO_THREADLOCAL
+#  define PANGO_ZSTD_CONTEXTS thread_local ZstdContexts
+#else
+#  define PANGO_ZSTD_CONTEXTS ZstdContexts
+#endif
+
+ZSTD_CCtx* ZstdPrepareCCtx(ZstdContexts& contexts, int compression_level, const ZstdOptions& options)
+{
+    ZSTD_CCtx* cctx = contexts.CCtx();
+    ZstdCheck(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters), "ZSTD_CCtx_reset()");
+    ZstdCheck(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compression_level), "ZSTD_CCtx_setParameter()");
+
+    if(options.workers > 0 && ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, options.workers))) {
+        static std::once_flag warned;
+        std::call_once(warned, [](){
+            pango_print_warn("libzstd was built without multithreading, ignoring zstd workers.\n");
+        });
+    }
+
+    if(options.dictionary) {
+        ZstdCheck(ZSTD_CCtx_refCDict(cctx, ZstdGetCDict(*options.dictionary, compression_level)), "ZSTD_CCtx_refCDict()");
+    }
+    return cctx;
+}
+
+PixelFormat ZstdReadHeader(std::istream& in, zstd_image_header& header)
+{
+    in.read( (char*)&header, sizeof(header));
+    if(!in || strncmp(header.magic, "ZSTD", 4)) {
+        throw std::runtime_error("Not a zstd image");
+    }
+    // fmt isn't null terminated when the name fills it, e.g. GRAY16LE
+    return PixelFormatFromString(std::string(header.fmt, strnlen(header.fmt, sizeof(header.fmt))));
+}
+
+// Decompress the frame following the header into the rows of dst
+void ZstdDecompressInto(std::istream& in, const Image<unsigned char>& dst, size_t row_bytes, const ZstdOptions& options)
+{
+    PANGO_ZSTD_CONTEXTS contexts;
+    ZSTD_DCtx* dctx = contexts.DCtx();
+
+    size_t read_size_hint = ZSTD_initDStream(dctx);
+    ZstdCheck(read_size_hint, "ZSTD_initDStream()");
+    if(options.dictionary) {
+        ZstdCheck(ZSTD_DCtx_refDDict(dctx, ZstdGetDDict(*options.dictionary)), "ZSTD_DCtx_refDDict()");
+    }
+
+    const size_t input_buffer_size = ZSTD_DStreamInSize();
+    std::unique_ptr<char[]> input_buffer(new char[input_buffer_size]);
+
+    // A contiguous destination is filled in one go. Otherwise output is
+    // retargeted at the next row of dst each time a row completes.
+    const bool contiguous = dst.pitch == row_bytes;
+    size_t row = 0;
+    ZSTD_outBuffer output = { dst.ptr, contiguous ? dst.h * row_bytes : row_bytes, 0 };
+
+    while(read_size_hint)
+    {
+        // Reading no more than hinted never consumes bytes beyond the frame
+        const size_t read = in.readsome(input_buffer.get(), std::min(read_size_hint, input_buffer_size));
+        if(read == 0) {
+            throw std::runtime_error("Unexpected end of zstd image stream");
+        }
+        ZSTD_inBuffer input = { input_buffer.get(), read, 0 };
+        while (input.pos < input.size) {
+            if(output.pos == output.size && !contiguous && row+1 < dst.h) {
+                ++row;
+                output = { dst.ptr + row*dst.pitch, row_bytes, 0 };
+            }
+            const size_t in_pos = input.pos;
+            read_size_hint = ZSTD_decompressStream(dctx, &output , &input);
+            ZstdCheck(read_size_hint, "ZSTD_decompressStream()");
+            if(output.pos == output.size && input.pos == in_pos && (contiguous || row+1 >= dst.h)) {
+                throw std::runtime_error("zstd image larger than destination image");
+            }
+        }
+    }
+}
+
+}
+#endif // HAVE_ZSTD
+
+void SaveZstd(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, int compression_level, const ZstdOptions& options)
 {
 #ifdef HAVE_ZSTD
     // Write out header, uncompressed
     zstd_image_header header;
     strncpy(header.magic,"ZSTD",4);
-    strncpy(header.fmt, fmt.format.c_str(), sizeof(header.fmt));
+    strncpy(header.fmt, fmt.Name().c_str(), sizeof(header.fmt));
     header.w = image.w;
     header.h = image.h;
     out.write((char*)&header, sizeof(header));
 
-    // Write out image data
-    const size_t output_buffer_size = ZSTD_CStreamOutSize();
-    std::unique_ptr<char[]> output_buffer(new char[output_buffer_size]);
+    PANGO_ZSTD_CONTEXTS contexts;
+    ZSTD_CCtx* const cctx = ZstdPrepareCCtx(contexts, compression_level, options);
+    const size_t row_size_bytes = (fmt.bpp * image.w)/8;
 
-    ZSTD_CStream* const cstream = ZSTD_createCStream();
-    if (cstream==nullptr) {
-        throw std::runtime_error("ZSTD_createCStream() error");
-    }
+    if(image.pitch == row_size_bytes || image.h == 1) {
+        // Contiguous, so compress the whole image in one call
+        const size_t image_size_bytes = row_size_bytes * image.h;
+        const size_t output_buffer_size = ZSTD_compressBound(image_size_bytes);
+        std::unique_ptr<char[]> output_buffer(new char[output_buffer_size]);
 
-    size_t const initResult = ZSTD_initCStream(cstream, compression_level);
-    if (ZSTD_isError(initResult)) {
-        throw std::runtime_error(FormatString("ZSTD_initCStream() error : %", ZSTD_getErrorName(initResult)));
+        const size_t compressed = ZSTD_compress2(cctx, output_buffer.get(), output_buffer_size, image.ptr, image_size_bytes);
+        ZstdCheck(compressed, "ZSTD_compress2()");
+        out.write(output_buffer.get(), compressed);
+        return;
     }
 
-    const size_t row_size_bytes = (fmt.bpp * image.w)/8;
+    // Write out image data, row at a time
+    const size_t output_buffer_size = ZSTD_CStreamOutSize();
+    std::unique_ptr<char[]> output_buffer(new char[output_buffer_size]);
 
     for(size_t y=0; y < image.h; ++y) {
         ZSTD_inBuffer input = { image.RowPtr(y), row_size_bytes, 0 };
 
         while (input.pos < input.size) {
             ZSTD_outBuffer output = { output_buffer.get(), output_buffer_size, 0 };
-            size_t left_to_read = ZSTD_compressStream(cstream, &output , &input);
-            if (ZSTD_isError(left_to_read)) {
-                throw std::runtime_error(FormatString("ZSTD_compressStream() error : %", ZSTD_getErrorName(left_to_read)));
-            }
+            ZstdCheck(ZSTD_compressStream2(cctx, &output , &input, ZSTD_e_continue), "ZSTD_compressStream2()");
             out.write(output_buffer.get(), output.pos);
         }
     }
 
-    ZSTD_outBuffer output = { output_buffer.get(), output_buffer_size, 0 };
-    size_t const remainingToFlush = ZSTD_endStream(cstream, &output);   /* close frame */
-    if (remainingToFlush) {
-        throw std::runtime_error("not fully flushed");
-    }
-    out.write(output_buffer.get(), output.pos);
-
-    ZSTD_freeCStream(cstream);
+    // Close frame, which may take several calls with workers
+    ZSTD_inBuffer input = { nullptr, 0, 0 };
+    size_t remaining_to_flush;
+    do {
+        ZSTD_outBuffer output = { output_buffer.get(), output_buffer_size, 0 };
+        remaining_to_flush = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end);
+        ZstdCheck(remaining_to_flush, "ZSTD_compressStream2()");
+        out.write(output_buffer.get(), output.pos);
+    } while(remaining_to_flush);
 #else
     PANGOLIN_UNUSED(image);
     PANGOLIN_UNUSED(fmt);
     PANGOLIN_UNUSED(out);
     PANGOLIN_UNUSED(compression_level);
+    PANGOLIN_UNUSED(options);
+    throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
+#endif // HAVE_ZSTD
+}
+
+void SaveZstd(const Image<unsigned char>& image, const pangolin::PixelFormat& fmt, std::ostream& out, int compression_level)
+{
+    SaveZstd(image, fmt, out, compression_level, ZstdOptions());
+}
+
+TypedImage LoadZstd(std::istream& in, const ZstdOptions& options)
+{
+#ifdef HAVE_ZSTD
+    // Read in header, uncompressed
+    zstd_image_header header;
+    const PixelFormat fmt = ZstdReadHeader(in, header);
+
+    TypedImage img(header.w, header.h, fmt);
+    ZstdDecompressInto(in, img, img.pitch, options);
+    return img;
+#else
+    PANGOLIN_UNUSED(in);
+    PANGOLIN_UNUSED(options);
     throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
 #endif // HAVE_ZSTD
 }
 
 TypedImage LoadZstd(std::istream& in)
+{
+    return LoadZstd(in, ZstdOptions());
+}
+
+void LoadZstd(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt, const ZstdOptions& options)
 {
 #ifdef HAVE_ZSTD
     // Read in header, uncompressed
     zstd_image_header header;
-    in.read( (char*)&header, sizeof(header));
+    const PixelFormat fmt = ZstdReadHeader(in, header);
+    if(header.w != dst.w || header.h != dst.h || fmt.bpp != dst_fmt.bpp) {
+        throw std::runtime_error("zstd image does not match destination image");
+    }
 
-    TypedImage img(header.w, header.h, PixelFormatFromString(header.fmt));
+    ZstdDecompressInto(in, dst, dst.w * dst_fmt.bpp / 8, options);
+#else
+    PANGOLIN_UNUSED(in);
+    PANGOLIN_UNUSED(dst);
+    PANGOLIN_UNUSED(dst_fmt);
+    PANGOLIN_UNUSED(options);
+    throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
+#endif // HAVE_ZSTD
+}
 
-    const size_t input_buffer_size = ZSTD_DStreamInSize();
-    std::unique_ptr<char[]> input_buffer(new char[input_buffer_size]);
+void LoadZstd(std::istream& in, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    LoadZstd(in, dst, dst_fmt, ZstdOptions());
+}
+
+void ZstdCompress(const void* data, size_t size, std::string& out, int compression_level, const ZstdOptions& options)
+{
+#ifdef HAVE_ZSTD
+    PANGO_ZSTD_CONTEXTS contexts;
+    ZSTD_CCtx* const cctx = ZstdPrepareCCtx(contexts, compression_level, options);
+
+    out.resize(ZSTD_compressBound(size));
+    const size_t compressed = ZSTD_compress2(cctx, &out[0], out.size(), data, size);
+    ZstdCheck(compressed, "ZSTD_compress2()");
+    out.resize(compressed);
+#else
+    PANGOLIN_UNUSED(data);
+    PANGOLIN_UNUSED(size);
+    PANGOLIN_UNUSED(out);
+    PANGOLIN_UNUSED(compression_level);
+    PANGOLIN_UNUSED(options);
+    throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
+#endif // HAVE_ZSTD
+}
 
-    ZSTD_DStream* dstream = ZSTD_createDStream();
-    if(!dstream) {
-        throw std::runtime_error("ZSTD_createDStream() error");
+size_t ZstdDecompressedSize(const void* data, size_t size)
+{
+#ifdef HAVE_ZSTD
+    // ZSTD_compress2() always records the content size in the frame
+    const unsigned long long n = ZSTD_getFrameContentSize(data, size);
+    if(n == ZSTD_CONTENTSIZE_ERROR || n == ZSTD_CONTENTSIZE_UNKNOWN) {
+        throw std::runtime_error("Not a zstd frame of known size");
     }
+    return (size_t)n;
+#else
+    PANGOLIN_UNUSED(data);
+    PANGOLIN_UNUSED(size);
+    throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
+#endif // HAVE_ZSTD
+}
 
-    size_t read_size_hint = ZSTD_initDStream(dstream);
-    if (ZSTD_isError(read_size_hint)) {
-        throw std::runtime_error(FormatString("ZSTD_initDStream() error : % \n", ZSTD_getErrorName(read_size_hint)));
+void ZstdDecompress(const void* data, size_t size, void* dst, size_t dst_size, const ZstdOptions& options)
+{
+#ifdef HAVE_ZSTD
+    PANGO_ZSTD_CONTEXTS contexts;
+    ZSTD_DCtx* dctx = contexts.DCtx();
+    ZstdCheck(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters), "ZSTD_DCtx_reset()");
+    if(options.dictionary) {
+        ZstdCheck(ZSTD_DCtx_refDDict(dctx, ZstdGetDDict(*options.dictionary)), "ZSTD_DCtx_refDDict()");
     }
 
-    // Image represents our fixed buffer.
-    ZSTD_outBuffer output = { img.ptr, img.SizeBytes(), 0 };
+    const size_t decompressed = ZSTD_decompressDCtx(dctx, dst, dst_size, data, size);
+    ZstdCheck(decompressed, "ZSTD_decompressDCtx()");
+    if(decompressed != dst_size) {
+        throw std::runtime_error("zstd frame smaller than destination");
+    }
+#else
+    PANGOLIN_UNUSED(data);
+    PANGOLIN_UNUSED(size);
+    PANGOLIN_UNUSED(dst);
+    PANGOLIN_UNUSED(dst_size);
+    PANGOLIN_UNUSED(options);
+    throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
+#endif // HAVE_ZSTD
+}
 
-    while(read_size_hint)
-    {
-        const size_t read = in.readsome(input_buffer.get(), read_size_hint);
-        ZSTD_inBuffer input = { input_buffer.get(), read, 0 };
-        while (input.pos < input.size) {
-            read_size_hint = ZSTD_decompressStream(dstream, &output , &input);
-            if (ZSTD_isError(read_size_hint)) {
-                throw std::runtime_error(FormatString("ZSTD_decompressStream() error : %", ZSTD_getErrorName(read_size_hint)));
-            }
+std::string TrainZstdDictionary(const std::vector<Image<unsigned char>>& samples, const PixelFormat& fmt, size_t max_dict_bytes)
+{
+#ifdef HAVE_ZSTD
+    // zdict wants all samples back to back
+    std::vector<unsigned char> sample_data;
+    std::vector<size_t> sample_sizes;
+    for(const Image<unsigned char>& img : samples) {
+        const size_t row_bytes = img.w * fmt.bpp / 8;
+        for(size_t y=0; y < img.h; ++y) {
+            sample_data.insert(sample_data.end(), img.RowPtr(y), img.RowPtr(y) + row_bytes);
         }
+        sample_sizes.push_back(row_bytes * img.h);
     }
 
-    ZSTD_freeDStream(dstream);
-
-    return img;
+    std::string dict(max_dict_bytes, '\0');
+    const size_t dict_size = ZDICT_trainFromBuffer(&dict[0], dict.size(), sample_data.data(), sample_sizes.data(), (unsigned)sample_sizes.size());
+    if(ZDICT_isError(dict_size)) {
+        throw std::runtime_error(FormatString("ZDICT_trainFromBuffer() error : %", ZDICT_getErrorName(dict_size)));
+    }
+    dict.resize(dict_size);
+    return dict;
 #else
-    PANGOLIN_UNUSED(in);
+    PANGOLIN_UNUSED(samples);
+    PANGOLIN_UNUSED(fmt);
+    PANGOLIN_UNUSED(max_dict_bytes);
     throw std::runtime_error("Rebuild Pangolin for ZSTD support.");
 #endif // HAVE_ZSTD
 }
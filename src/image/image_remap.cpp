@@ -0,0 +1,388 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/image/image_remap.h>
+#include <pangolin/utils/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define REMAP_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define REMAP_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace pangolin
+{
+
+namespace
+{
+
+enum RemapSimdLevel
+{
+    RemapSimdScalar,
+    RemapSimdSSE2,
+    RemapSimdNEON
+};
+
+RemapSimdLevel DetectSimdLevel()
+{
+#if defined(REMAP_HAVE_X86_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) return RemapSimdSSE2;
+    return RemapSimdScalar;
+#elif defined(REMAP_HAVE_NEON)
+    return RemapSimdNEON;
+#else
+    return RemapSimdScalar;
+#endif
+}
+
+const RemapSimdLevel simd_level = DetectSimdLevel();
+
+// Product of the x and y fractions
+const int RemapWeightBits = 2 * RemapFracBits;
+
+void ToFixed(double s, size_t n, uint16_t& i, uint8_t& f)
+{
+    s = std::min(std::max(s, 0.0), double(n - 1));
+    const long fixed = std::lround(s * RemapFracOne);
+    const long i0 = std::min(fixed >> RemapFracBits, long(n) - 2);
+    i = uint16_t(i0);
+    f = uint8_t(fixed - (i0 << RemapFracBits));
+}
+
+// Each vector kernel handles a prefix of the row and returns the number of
+// pixels done, leaving any tail for the scalar loop.
+
+#if defined(REMAP_HAVE_X86_DISPATCH)
+
+// Four pixels at a time: the 2x2 neighbourhoods are gathered into 16 bit
+// lanes and weighted with pmaddwd, horizontally then vertically.
+__attribute__((target("sse2")))
+size_t RemapRowGray8SSE2(uint8_t* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t w)
+{
+    const int one = RemapFracOne;
+    const __m128i round = _mm_set1_epi32(1 << (RemapWeightBits - 1));
+    size_t x = 0;
+    for(; x + 4 <= w; x += 4) {
+        const RemapEntry* q = e + x;
+        const uint8_t* p0 = src + q[0].y * pitch + q[0].x;
+        const uint8_t* p1 = src + q[1].y * pitch + q[1].x;
+        const uint8_t* p2 = src + q[2].y * pitch + q[2].x;
+        const uint8_t* p3 = src + q[3].y * pitch + q[3].x;
+        const __m128i top = _mm_setr_epi16(p0[0], p0[1], p1[0], p1[1], p2[0], p2[1], p3[0], p3[1]);
+        const __m128i bot = _mm_setr_epi16(p0[pitch], p0[pitch+1], p1[pitch], p1[pitch+1], p2[pitch], p2[pitch+1], p3[pitch], p3[pitch+1]);
+        const __m128i wx = _mm_setr_epi16(one - q[0].fx, q[0].fx, one - q[1].fx, q[1].fx, one - q[2].fx, q[2].fx, one - q[3].fx, q[3].fx);
+        const __m128i wy = _mm_setr_epi16(one - q[0].fy, q[0].fy, one - q[1].fy, q[1].fy, one - q[2].fy, q[2].fy, one - q[3].fy, q[3].fy);
+        const __m128i valid = _mm_setr_epi32(-int(q[0].valid), -int(q[1].valid), -int(q[2].valid), -int(q[3].valid));
+
+        // Horizontal results fit in 15 bits, so pair top and bottom for the vertical pass
+        const __m128i tb = _mm_or_si128(_mm_madd_epi16(top, wx), _mm_slli_epi32(_mm_madd_epi16(bot, wx), 16));
+        __m128i v = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(tb, wy), round), RemapWeightBits);
+        v = _mm_and_si128(v, valid);
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        const int r = _mm_cvtsi128_si32(v);
+        std::memcpy(out + x, &r, 4);
+    }
+    return x;
+}
+
+// One pixel at a time, with its channels across lanes
+template<size_t CH>
+__attribute__((target("sse2")))
+size_t RemapRowPixel8SSE2(uint8_t* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t w)
+{
+    const int one = RemapFracOne;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (RemapWeightBits - 1));
+    for(size_t x = 0; x < w; ++x) {
+        const RemapEntry& q = e[x];
+        uint8_t* o = out + x * CH;
+        if(!q.valid) {
+            std::memset(o, 0, CH);
+            continue;
+        }
+        const uint8_t* p = src + q.y * pitch + q.x * CH;
+        uint64_t a = 0, b = 0;
+        std::memcpy(&a, p, 2 * CH);
+        std::memcpy(&b, p + pitch, 2 * CH);
+        const __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&a), zero);
+        const __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&b), zero);
+
+        // Pair each channel with its right neighbour
+        const __m128i top = _mm_unpacklo_epi16(va, _mm_srli_si128(va, 2 * CH));
+        const __m128i bot = _mm_unpacklo_epi16(vb, _mm_srli_si128(vb, 2 * CH));
+        const __m128i wx = _mm_set1_epi32((q.fx << 16) | (one - q.fx));
+        const __m128i wy = _mm_set1_epi32((q.fy << 16) | (one - q.fy));
+
+        const __m128i tb = _mm_or_si128(_mm_madd_epi16(top, wx), _mm_slli_epi32(_mm_madd_epi16(bot, wx), 16));
+        __m128i v = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(tb, wy), round), RemapWeightBits);
+        v = _mm_packs_epi32(v, v);
+        v = _mm_packus_epi16(v, v);
+        const int r = _mm_cvtsi128_si32(v);
+        std::memcpy(o, &r, CH);
+    }
+    return w;
+}
+
+#endif // REMAP_HAVE_X86_DISPATCH
+
+#if defined(REMAP_HAVE_NEON)
+
+// Eight pixels at a time, gathering the 2x2 neighbourhoods into byte vectors
+size_t RemapRowGray8NEON(uint8_t* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t w)
+{
+    size_t x = 0;
+    for(; x + 8 <= w; x += 8) {
+        uint8_t p00[8], p01[8], p10[8], p11[8], fx[8], fy[8], valid[8];
+        for(size_t i = 0; i < 8; ++i) {
+            const RemapEntry& q = e[x + i];
+            const uint8_t* p = src + q.y * pitch + q.x;
+            p00[i] = p[0];
+            p01[i] = p[1];
+            p10[i] = p[pitch];
+            p11[i] = p[pitch + 1];
+            fx[i] = q.fx;
+            fy[i] = q.fy;
+            valid[i] = q.valid ? 0xFF : 0;
+        }
+        const uint8x8_t vfx = vld1_u8(fx);
+        const uint8x8_t vfy = vld1_u8(fy);
+        const uint8x8_t one = vdup_n_u8(RemapFracOne);
+        const uint16x8_t top = vmlal_u8(vmull_u8(vld1_u8(p00), vsub_u8(one, vfx)), vld1_u8(p01), vfx);
+        const uint16x8_t bot = vmlal_u8(vmull_u8(vld1_u8(p10), vsub_u8(one, vfx)), vld1_u8(p11), vfx);
+        const uint16x8_t wy1 = vmovl_u8(vfy);
+        const uint16x8_t wy0 = vmovl_u8(vsub_u8(one, vfy));
+        const uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(top), vget_low_u16(wy0)), vget_low_u16(bot), vget_low_u16(wy1));
+        const uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(top), vget_high_u16(wy0)), vget_high_u16(bot), vget_high_u16(wy1));
+        const uint8x8_t v = vqmovn_u16(vcombine_u16(vrshrn_n_u32(lo, RemapWeightBits), vrshrn_n_u32(hi, RemapWeightBits)));
+        vst1_u8(out + x, vand_u8(v, vld1_u8(valid)));
+    }
+    return x;
+}
+
+// One pixel at a time, with its channels across lanes
+template<size_t CH>
+size_t RemapRowPixel8NEON(uint8_t* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t w)
+{
+    for(size_t x = 0; x < w; ++x) {
+        const RemapEntry& q = e[x];
+        uint8_t* o = out + x * CH;
+        if(!q.valid) {
+            std::memset(o, 0, CH);
+            continue;
+        }
+        const uint8_t* p = src + q.y * pitch + q.x * CH;
+        uint64_t a = 0, b = 0;
+        std::memcpy(&a, p, 2 * CH);
+        std::memcpy(&b, p + pitch, 2 * CH);
+        const uint8x8_t va = vcreate_u8(a);
+        const uint8x8_t vb = vcreate_u8(b);
+        const uint8x8_t fx0 = vdup_n_u8(uint8_t(RemapFracOne - q.fx));
+        const uint8x8_t fx1 = vdup_n_u8(q.fx);
+        const uint16x8_t top = vmlal_u8(vmull_u8(va, fx0), vext_u8(va, va, CH), fx1);
+        const uint16x8_t bot = vmlal_u8(vmull_u8(vb, fx0), vext_u8(vb, vb, CH), fx1);
+        const uint32x4_t v = vmlal_u16(vmull_u16(vget_low_u16(top), vdup_n_u16(uint16_t(RemapFracOne - q.fy))), vget_low_u16(bot), vdup_n_u16(q.fy));
+        const uint16x4_t n = vrshrn_n_u32(v, RemapWeightBits);
+        const uint8x8_t r = vqmovn_u16(vcombine_u16(n, n));
+        const uint32_t bytes = vget_lane_u32(vreinterpret_u32_u8(r), 0);
+        std::memcpy(o, &bytes, CH);
+    }
+    return w;
+}
+
+#endif // REMAP_HAVE_NEON
+
+// Overloads without vector kernels
+template<typename T, size_t CH>
+size_t RemapRowSimd(T*, const unsigned char*, size_t, const RemapEntry*, size_t) { return 0; }
+
+#if defined(REMAP_HAVE_X86_DISPATCH)
+#  define REMAP_SIMD_CASE(gray, pixel, CH, ...) case RemapSimdSSE2: return (CH == 1) ? gray ## SSE2(__VA_ARGS__) : pixel ## SSE2<CH>(__VA_ARGS__);
+#elif defined(REMAP_HAVE_NEON)
+#  define REMAP_SIMD_CASE(gray, pixel, CH, ...) case RemapSimdNEON: return (CH == 1) ? gray ## NEON(__VA_ARGS__) : pixel ## NEON<CH>(__VA_ARGS__);
+#else
+#  define REMAP_SIMD_CASE(gray, pixel, CH, ...)
+#endif
+
+#define REMAP_SIMD_OVERLOAD(CH) \
+    template<> size_t RemapRowSimd<uint8_t,CH>(uint8_t* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t w) { \
+        switch(simd_level) { \
+        REMAP_SIMD_CASE(RemapRowGray8, RemapRowPixel8, CH, out, src, pitch, e, w) \
+        default: return 0; \
+        } \
+    }
+
+REMAP_SIMD_OVERLOAD(1)
+REMAP_SIMD_OVERLOAD(2)
+REMAP_SIMD_OVERLOAD(3)
+REMAP_SIMD_OVERLOAD(4)
+
+#undef REMAP_SIMD_OVERLOAD
+
+// Fixed point, for integer channels
+template<size_t CH, typename T>
+void Interpolate(T* o, const T* p0, const T* p1, const RemapEntry& q)
+{
+    const uint32_t w00 = uint32_t(RemapFracOne - q.fx) * uint32_t(RemapFracOne - q.fy);
+    const uint32_t w01 = uint32_t(q.fx) * uint32_t(RemapFracOne - q.fy);
+    const uint32_t w10 = uint32_t(RemapFracOne - q.fx) * uint32_t(q.fy);
+    const uint32_t w11 = uint32_t(q.fx) * uint32_t(q.fy);
+    for(size_t c = 0; c < CH; ++c) {
+        o[c] = T((w00 * p0[c] + w01 * p0[CH + c] + w10 * p1[c] + w11 * p1[CH + c] + (1u << (RemapWeightBits - 1))) >> RemapWeightBits);
+    }
+}
+
+template<size_t CH>
+void Interpolate(float* o, const float* p0, const float* p1, const RemapEntry& q)
+{
+    const float fx = float(q.fx) / RemapFracOne;
+    const float fy = float(q.fy) / RemapFracOne;
+    for(size_t c = 0; c < CH; ++c) {
+        const float t = p0[c] + fx * (p0[CH + c] - p0[c]);
+        const float b = p1[c] + fx * (p1[CH + c] - p1[c]);
+        o[c] = t + fy * (b - t);
+    }
+}
+
+template<typename T, size_t CH>
+void RemapRowScalar(T* out, const unsigned char* src, size_t pitch, const RemapEntry* e, size_t x, size_t w)
+{
+    for(; x < w; ++x) {
+        const RemapEntry& q = e[x];
+        T* o = out + x * CH;
+        if(!q.valid) {
+            std::fill(o, o + CH, T(0));
+            continue;
+        }
+        const T* p0 = (const T*)(src + q.y * pitch) + q.x * CH;
+        const T* p1 = (const T*)((const unsigned char*)p0 + pitch);
+        Interpolate<CH>(o, p0, p1, q);
+    }
+}
+
+template<typename T, size_t CH>
+void RemapRows(const Image<unsigned char>& dst, const Image<unsigned char>& src, const RemapTable& table, size_t y0, size_t y1)
+{
+    for(size_t y = y0; y < y1; ++y) {
+        T* out = (T*)(dst.ptr + y * dst.pitch);
+        const RemapEntry* e = &table.entries[y * table.w];
+        const size_t x = RemapRowSimd<T,CH>(out, src.ptr, src.pitch, e, table.w);
+        RemapRowScalar<T,CH>(out, src.ptr, src.pitch, e, x, table.w);
+    }
+}
+
+template<typename T>
+void RemapTyped(const Image<unsigned char>& dst, const Image<unsigned char>& src, const RemapTable& table, size_t ch, size_t num_threads)
+{
+    ParallelFor(0, table.h, num_threads, [&](size_t y0, size_t y1) {
+        switch(ch) {
+        case 1: return RemapRows<T,1>(dst, src, table, y0, y1);
+        case 2: return RemapRows<T,2>(dst, src, table, y0, y1);
+        case 3: return RemapRows<T,3>(dst, src, table, y0, y1);
+        case 4: return RemapRows<T,4>(dst, src, table, y0, y1);
+        }
+    });
+}
+
+}
+
+RemapTable RemapTable::FromFunction(
+    size_t w, size_t h, size_t src_w, size_t src_h,
+    const std::function<bool(double x, double y, double& sx, double& sy)>& map
+) {
+    if(src_w < 2 || src_h < 2 || src_w > 65536 || src_h > 65536) {
+        throw std::runtime_error("RemapTable: Source must be 2 to 65536 pixels across");
+    }
+
+    RemapTable t;
+    t.w = w;
+    t.h = h;
+    t.src_w = src_w;
+    t.src_h = src_h;
+    t.entries.resize(w * h);
+
+    for(size_t y = 0; y < h; ++y) {
+        for(size_t x = 0; x < w; ++x) {
+            double sx, sy;
+            // Written so that NaN is also rejected
+            if(!map(double(x), double(y), sx, sy) ||
+               !(sx >= -0.5 && sx <= src_w - 0.5 && sy >= -0.5 && sy <= src_h - 0.5)) {
+                continue;
+            }
+            RemapEntry& q = t.entries[y * w + x];
+            ToFixed(sx, src_w, q.x, q.fx);
+            ToFixed(sy, src_h, q.y, q.fy);
+            q.valid = 1;
+        }
+    }
+    return t;
+}
+
+bool CanRemapPixelFormat(const PixelFormat& fmt)
+{
+    if(fmt.planar || fmt.channels == 0 || fmt.channels > 4) {
+        return false;
+    }
+    const unsigned int bits = fmt.channel_bits[0];
+    for(size_t c = 1; c < fmt.channels; ++c) {
+        if(fmt.channel_bits[c] != bits) return false;
+    }
+    // Excludes bit packed and chroma subsampled formats
+    const bool supported = fmt.IsFloat() ? bits == 32 : (bits == 8 || bits == 16);
+    return supported && fmt.channels * bits == fmt.bpp;
+}
+
+void RemapImage(
+    const Image<unsigned char>& dst, const Image<unsigned char>& src,
+    const PixelFormat& fmt, const RemapTable& table, size_t num_threads
+) {
+    if(!CanRemapPixelFormat(fmt)) {
+        throw std::runtime_error("RemapImage: Unable to remap " + fmt.Name());
+    }
+    if(dst.w != table.w || dst.h != table.h || src.w != table.src_w || src.h != table.src_h) {
+        throw std::runtime_error("RemapImage: Image sizes don't match table");
+    }
+
+    if(fmt.IsFloat()) {
+        RemapTyped<float>(dst, src, table, fmt.channels, num_threads);
+    }else if(fmt.channel_bits[0] == 8) {
+        RemapTyped<uint8_t>(dst, src, table, fmt.channels, num_threads);
+    }else{
+        RemapTyped<uint16_t>(dst, src, table, fmt.channels, num_threads);
+    }
+}
+
+}
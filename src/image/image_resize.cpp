@@ -0,0 +1,603 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/image/image_resize.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define RESIZE_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define RESIZE_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace pangolin
+{
+
+ResizeMethod ResizeMethodFromString(const std::string& str)
+{
+    if(!str.compare("area")) return ResizeMethodArea;
+    else if(!str.compare("bilinear")) return ResizeMethodBilinear;
+    else {
+        pango_print_error("Resize error, %s is not a valid method using area\n", str.c_str());
+        return ResizeMethodArea;
+    }
+}
+
+namespace
+{
+
+enum ResizeSimdLevel
+{
+    ResizeSimdScalar,
+    ResizeSimdSSE2,
+    ResizeSimdNEON
+};
+
+ResizeSimdLevel DetectSimdLevel()
+{
+#if defined(RESIZE_HAVE_X86_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) return ResizeSimdSSE2;
+    return ResizeSimdScalar;
+#elif defined(RESIZE_HAVE_NEON)
+    return ResizeSimdNEON;
+#else
+    return ResizeSimdScalar;
+#endif
+}
+
+const ResizeSimdLevel simd_level = DetectSimdLevel();
+
+// Contiguous range of source samples, and their weights, contributing to
+// each output sample along one axis
+struct Taps
+{
+    size_t max_count;
+    std::vector<size_t> begin;
+    std::vector<size_t> count;
+    std::vector<float> weights;     // max_count per output sample
+    bool halve;                     // area of exactly two samples each
+};
+
+Taps MakeTaps(size_t src_n, size_t dst_n, ResizeMethod method)
+{
+    Taps t;
+    const double s = double(src_n) / double(dst_n);
+    const bool area = method == ResizeMethodArea && src_n > dst_n;
+    t.max_count = area ? size_t(std::ceil(s)) + 1 : 2;
+    t.halve = area && src_n == 2 * dst_n;
+    t.begin.resize(dst_n);
+    t.count.resize(dst_n);
+    t.weights.assign(dst_n * t.max_count, 0.0f);
+
+    for(size_t i = 0; i < dst_n; ++i) {
+        float* w = &t.weights[i * t.max_count];
+        if(area) {
+            // Fraction of the output sample covered by each source sample
+            const double a = i * s;
+            const double b = std::min((i + 1) * s, double(src_n));
+            const size_t j0 = size_t(a);
+            const size_t j1 = std::min(size_t(std::ceil(b)), src_n);
+            t.begin[i] = j0;
+            t.count[i] = j1 - j0;
+            for(size_t j = j0; j < j1; ++j) {
+                w[j - j0] = float((std::min(b, double(j + 1)) - std::max(a, double(j))) / s);
+            }
+        }else{
+            // Centre of output sample in source samples
+            const double x = std::min(std::max((i + 0.5) * s - 0.5, 0.0), double(src_n - 1));
+            const size_t x0 = size_t(x);
+            const float f = float(x - x0);
+            t.begin[i] = x0;
+            if(x0 + 1 < src_n && f > 0.0f) {
+                t.count[i] = 2;
+                w[0] = 1.0f - f;
+                w[1] = f;
+            }else{
+                t.count[i] = 1;
+                w[0] = 1.0f;
+            }
+        }
+    }
+    return t;
+}
+
+// Intermediate type, single precision unless channels hold more
+template<typename T> struct Accum { using type = float; };
+template<> struct Accum<uint32_t> { using type = double; };
+template<> struct Accum<double> { using type = double; };
+
+// Each vector kernel processes a whole number of vectors from the start of
+// the row and returns the number of values done, leaving any tail for the
+// scalar path. Kernels and scalar paths evaluate identical expressions.
+
+#if defined(RESIZE_HAVE_X86_DISPATCH)
+
+__attribute__((target("sse2")))
+size_t LoadRowSSE2(float* out, const uint8_t* in, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i a = _mm_unpacklo_epi8(p, zero);
+        const __m128i b = _mm_unpackhi_epi8(p, zero);
+        _mm_storeu_ps(out + i +  0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero)));
+        _mm_storeu_ps(out + i +  4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero)));
+        _mm_storeu_ps(out + i +  8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero)));
+        _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(b, zero)));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t LoadRowSSE2(float* out, const uint16_t* in, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_ps(out + i + 0, _mm_cvtepi32_ps(_mm_unpacklo_epi16(p, zero)));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(p, zero)));
+    }
+    return i;
+}
+
+// Average pairs of pixels of 1, 2 or 4 channels, returning pixels done
+__attribute__((target("sse2")))
+size_t HalveRowSSE2(float* out, const float* in, size_t w, size_t ch)
+{
+    const __m128 half = _mm_set1_ps(0.5f);
+    size_t x = 0;
+    if(ch == 1) {
+        for(; x + 4 <= w; x += 4) {
+            const __m128 a = _mm_loadu_ps(in + 2 * x);
+            const __m128 b = _mm_loadu_ps(in + 2 * x + 4);
+            const __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+            const __m128 odd  = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+            _mm_storeu_ps(out + x, _mm_mul_ps(_mm_add_ps(even, odd), half));
+        }
+    }else if(ch == 2) {
+        for(; x + 2 <= w; x += 2) {
+            const __m128 a = _mm_loadu_ps(in + 4 * x);
+            const __m128 b = _mm_loadu_ps(in + 4 * x + 4);
+            const __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1,0,1,0));
+            const __m128 odd  = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,2,3,2));
+            _mm_storeu_ps(out + 2 * x, _mm_mul_ps(_mm_add_ps(even, odd), half));
+        }
+    }else if(ch == 4) {
+        for(; x < w; ++x) {
+            const __m128 a = _mm_loadu_ps(in + 8 * x);
+            const __m128 b = _mm_loadu_ps(in + 8 * x + 4);
+            _mm_storeu_ps(out + 4 * x, _mm_mul_ps(_mm_add_ps(a, b), half));
+        }
+    }
+    return x;
+}
+
+__attribute__((target("sse2")))
+size_t VerticalRowSSE2(float* out, const float* const* rows, const float* w, size_t count, size_t n)
+{
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m128 acc = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), _mm_set1_ps(w[0]));
+        for(size_t k = 1; k < count; ++k) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(w[k])));
+        }
+        _mm_storeu_ps(out + i, acc);
+    }
+    return i;
+}
+
+// Round to nearest (values are never negative) with saturation
+__attribute__((target("sse2")))
+size_t StoreRowSSE2(uint8_t* out, const float* in, size_t n)
+{
+    const __m128 h = _mm_set1_ps(0.5f);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i +  0), h));
+        const __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i +  4), h));
+        const __m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i +  8), h));
+        const __m128i d = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i + 12), h));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t StoreRowSSE2(uint16_t* out, const float* in, size_t n)
+{
+    // packs is signed, so pack about 0x8000 without SSE4.1
+    const __m128 h = _mm_set1_ps(0.5f);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i + 0), h)), bias);
+        const __m128i b = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(in + i + 4), h)), bias);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+    }
+    return i;
+}
+
+#endif // RESIZE_HAVE_X86_DISPATCH
+
+#if defined(RESIZE_HAVE_NEON)
+
+size_t LoadRowNEON(float* out, const uint8_t* in, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t p = vmovl_u8(vld1_u8(in + i));
+        vst1q_f32(out + i + 0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(p))));
+        vst1q_f32(out + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(p))));
+    }
+    return i;
+}
+
+size_t LoadRowNEON(float* out, const uint16_t* in, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t p = vld1q_u16(in + i);
+        vst1q_f32(out + i + 0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(p))));
+        vst1q_f32(out + i + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(p))));
+    }
+    return i;
+}
+
+size_t HalveRowNEON(float* out, const float* in, size_t w, size_t ch)
+{
+    size_t x = 0;
+    if(ch == 1) {
+        for(; x + 4 <= w; x += 4) {
+            const float32x4x2_t p = vld2q_f32(in + 2 * x);
+            vst1q_f32(out + x, vmulq_n_f32(vaddq_f32(p.val[0], p.val[1]), 0.5f));
+        }
+    }else if(ch == 2) {
+        for(; x + 4 <= w; x += 4) {
+            // Channels 0 and 1 of even pixels, then of odd pixels
+            const float32x4x4_t p = vld4q_f32(in + 4 * x);
+            float32x4x2_t o;
+            o.val[0] = vmulq_n_f32(vaddq_f32(p.val[0], p.val[2]), 0.5f);
+            o.val[1] = vmulq_n_f32(vaddq_f32(p.val[1], p.val[3]), 0.5f);
+            vst2q_f32(out + 2 * x, o);
+        }
+    }else if(ch == 4) {
+        for(; x < w; ++x) {
+            vst1q_f32(out + 4 * x, vmulq_n_f32(vaddq_f32(vld1q_f32(in + 8 * x), vld1q_f32(in + 8 * x + 4)), 0.5f));
+        }
+    }
+    return x;
+}
+
+size_t VerticalRowNEON(float* out, const float* const* rows, const float* w, size_t count, size_t n)
+{
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        float32x4_t acc = vmulq_n_f32(vld1q_f32(rows[0] + i), w[0]);
+        for(size_t k = 1; k < count; ++k) {
+            acc = vaddq_f32(acc, vmulq_n_f32(vld1q_f32(rows[k] + i), w[k]));
+        }
+        vst1q_f32(out + i, acc);
+    }
+    return i;
+}
+
+size_t StoreRowNEON(uint8_t* out, const float* in, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint32x4_t a = vcvtq_u32_f32(vaddq_f32(vld1q_f32(in + i + 0), vdupq_n_f32(0.5f)));
+        const uint32x4_t b = vcvtq_u32_f32(vaddq_f32(vld1q_f32(in + i + 4), vdupq_n_f32(0.5f)));
+        vst1_u8(out + i, vqmovn_u16(vcombine_u16(vqmovn_u32(a), vqmovn_u32(b))));
+    }
+    return i;
+}
+
+size_t StoreRowNEON(uint16_t* out, const float* in, size_t n)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint32x4_t a = vcvtq_u32_f32(vaddq_f32(vld1q_f32(in + i + 0), vdupq_n_f32(0.5f)));
+        const uint32x4_t b = vcvtq_u32_f32(vaddq_f32(vld1q_f32(in + i + 4), vdupq_n_f32(0.5f)));
+        vst1q_u16(out + i, vcombine_u16(vqmovn_u32(a), vqmovn_u32(b)));
+    }
+    return i;
+}
+
+#endif // RESIZE_HAVE_NEON
+
+// Overloads without vector kernels
+template<typename T, typename A> size_t LoadRowSimd(A*, const T*, size_t) { return 0; }
+template<typename T, typename A> size_t StoreRowSimd(T*, const A*, size_t) { return 0; }
+
+#define RESIZE_SIMD_OVERLOADS(T) \
+    template<> size_t LoadRowSimd<T,float>(float* out, const T* in, size_t n) { \
+        switch(simd_level) { \
+        RESIZE_SIMD_CASE(LoadRow, out, in, n) \
+        default: return 0; \
+        } \
+    } \
+    template<> size_t StoreRowSimd<T,float>(T* out, const float* in, size_t n) { \
+        switch(simd_level) { \
+        RESIZE_SIMD_CASE(StoreRow, out, in, n) \
+        default: return 0; \
+        } \
+    }
+
+#if defined(RESIZE_HAVE_X86_DISPATCH)
+#  define RESIZE_SIMD_CASE(f, ...) case ResizeSimdSSE2: return f ## SSE2(__VA_ARGS__);
+#elif defined(RESIZE_HAVE_NEON)
+#  define RESIZE_SIMD_CASE(f, ...) case ResizeSimdNEON: return f ## NEON(__VA_ARGS__);
+#else
+#  define RESIZE_SIMD_CASE(f, ...)
+#endif
+
+RESIZE_SIMD_OVERLOADS(uint8_t)
+RESIZE_SIMD_OVERLOADS(uint16_t)
+
+#undef RESIZE_SIMD_OVERLOADS
+
+template<typename T, typename A>
+void LoadRow(A* out, const T* in, size_t n)
+{
+    for(size_t i = LoadRowSimd<T,A>(out, in, n); i < n; ++i) {
+        out[i] = A(in[i]);
+    }
+}
+
+template<typename T, typename A>
+void StoreRow(T* out, const A* in, size_t n)
+{
+    size_t i = StoreRowSimd<T,A>(out, in, n);
+    if(std::numeric_limits<T>::is_integer) {
+        const A max = A(std::numeric_limits<T>::max());
+        for(; i < n; ++i) {
+            const A v = in[i] + A(0.5);
+            out[i] = v >= max ? std::numeric_limits<T>::max() : T(v);
+        }
+    }else{
+        for(; i < n; ++i) {
+            out[i] = T(in[i]);
+        }
+    }
+}
+
+template<typename A>
+size_t HalveRowSimd(A*, const A*, size_t, size_t) { return 0; }
+
+template<>
+size_t HalveRowSimd<float>(float* out, const float* in, size_t w, size_t ch)
+{
+    switch(simd_level) {
+    RESIZE_SIMD_CASE(HalveRow, out, in, w, ch)
+    default: return 0;
+    }
+}
+
+template<typename A>
+size_t VerticalRowSimd(A*, const A* const*, const float*, size_t, size_t) { return 0; }
+
+template<>
+size_t VerticalRowSimd<float>(float* out, const float* const* rows, const float* w, size_t count, size_t n)
+{
+    switch(simd_level) {
+    RESIZE_SIMD_CASE(VerticalRow, out, rows, w, count, n)
+    default: return 0;
+    }
+}
+
+#undef RESIZE_SIMD_CASE
+
+template<typename A, size_t CH>
+void HorizontalRowN(A* out, const A* in, const Taps& t, size_t w)
+{
+    for(size_t x = 0; x < w; ++x) {
+        const A* p = in + t.begin[x] * CH;
+        const float* wt = &t.weights[x * t.max_count];
+        A acc[CH] = {};
+        for(size_t k = 0; k < t.count[x]; ++k) {
+            for(size_t c = 0; c < CH; ++c) {
+                acc[c] += wt[k] * p[k * CH + c];
+            }
+        }
+        for(size_t c = 0; c < CH; ++c) {
+            out[x * CH + c] = acc[c];
+        }
+    }
+}
+
+template<typename A>
+void HorizontalRow(A* out, const A* in, const Taps& t, size_t w, size_t ch)
+{
+    if(t.halve) {
+        for(size_t i = ch * HalveRowSimd<A>(out, in, w, ch); i < w * ch; ++i) {
+            const size_t x = i / ch;
+            const size_t c = i % ch;
+            out[i] = (in[2 * x * ch + c] + in[(2 * x + 1) * ch + c]) * A(0.5);
+        }
+        return;
+    }
+
+    switch(ch) {
+    case 1: HorizontalRowN<A,1>(out, in, t, w); break;
+    case 2: HorizontalRowN<A,2>(out, in, t, w); break;
+    case 3: HorizontalRowN<A,3>(out, in, t, w); break;
+    case 4: HorizontalRowN<A,4>(out, in, t, w); break;
+    default:
+        for(size_t x = 0; x < w; ++x) {
+            const A* p = in + t.begin[x] * ch;
+            const float* wt = &t.weights[x * t.max_count];
+            for(size_t c = 0; c < ch; ++c) {
+                A acc = 0;
+                for(size_t k = 0; k < t.count[x]; ++k) {
+                    acc += wt[k] * p[k * ch + c];
+                }
+                out[x * ch + c] = acc;
+            }
+        }
+    }
+}
+
+template<typename A>
+void VerticalRow(A* out, const A* const* rows, const float* w, size_t count, size_t n)
+{
+    for(size_t i = VerticalRowSimd<A>(out, rows, w, count, n); i < n; ++i) {
+        A acc = rows[0][i] * w[0];
+        for(size_t k = 1; k < count; ++k) {
+            acc = acc + rows[k][i] * w[k];
+        }
+        out[i] = acc;
+    }
+}
+
+// Separable resampling of one plane of interleaved channels. Source rows are
+// resampled horizontally once each, into a ring holding those in use.
+template<typename T>
+void ResizePlane(const Image<unsigned char>& dst, const Image<unsigned char>& src, size_t ch, ResizeMethod method, size_t num_threads)
+{
+    using A = typename Accum<T>::type;
+    const Taps tx = MakeTaps(src.w, dst.w, method);
+    const Taps ty = MakeTaps(src.h, dst.h, method);
+    const size_t n = dst.w * ch;
+
+    ParallelFor(0, dst.h, num_threads, [&](size_t y_begin, size_t y_end){
+        std::vector<A> in(src.w * ch);
+        std::vector<A> acc(n);
+        std::vector<std::vector<A>> ring(ty.max_count, std::vector<A>(n));
+        std::vector<size_t> ring_row(ty.max_count, std::numeric_limits<size_t>::max());
+        std::vector<const A*> rows(ty.max_count);
+
+        for(size_t y = y_begin; y < y_end; ++y) {
+            // Rows in use are consecutive, so occupy distinct slots
+            for(size_t k = 0; k < ty.count[y]; ++k) {
+                const size_t r = ty.begin[y] + k;
+                const size_t slot = r % ty.max_count;
+                if(ring_row[slot] != r) {
+                    LoadRow(in.data(), (const T*)(src.ptr + r * src.pitch), src.w * ch);
+                    HorizontalRow(ring[slot].data(), in.data(), tx, dst.w, ch);
+                    ring_row[slot] = r;
+                }
+                rows[k] = ring[slot].data();
+            }
+            VerticalRow(acc.data(), rows.data(), &ty.weights[y * ty.max_count], ty.count[y], n);
+            StoreRow((T*)(dst.ptr + y * dst.pitch), acc.data(), n);
+        }
+    });
+}
+
+void ResizePlane(const Image<unsigned char>& dst, const Image<unsigned char>& src, unsigned int bits, bool floating, size_t ch, ResizeMethod method, size_t num_threads)
+{
+    if(dst.w == 0 || dst.h == 0) return;
+    if(src.w == 0 || src.h == 0) {
+        throw std::runtime_error("ResizeImage: Source image is empty");
+    }
+
+    if(floating) {
+        if(bits == 32) return ResizePlane<float>(dst, src, ch, method, num_threads);
+        if(bits == 64) return ResizePlane<double>(dst, src, ch, method, num_threads);
+    }else{
+        if(bits == 8)  return ResizePlane<uint8_t>(dst, src, ch, method, num_threads);
+        if(bits == 16) return ResizePlane<uint16_t>(dst, src, ch, method, num_threads);
+        if(bits == 32) return ResizePlane<uint32_t>(dst, src, ch, method, num_threads);
+    }
+    throw std::runtime_error("ResizeImage: Unsupported channel type");
+}
+
+bool IsPacked422(const PixelFormat& fmt)
+{
+    return fmt.id == PixelFormatId::YUYV422 || fmt.id == PixelFormatId::UYVY422;
+}
+
+// Chroma of planar formats, following the luma (see PANGOLIN_PIXEL_FORMATS)
+Image<unsigned char> ChromaPlane(const Image<unsigned char>& img, size_t plane, size_t pitch)
+{
+    const size_t cw = (img.w + 1) / 2;
+    const size_t ch = (img.h + 1) / 2;
+    return Image<unsigned char>(img.ptr + img.h * img.pitch + plane * ch * pitch, cw, ch, pitch);
+}
+
+}
+
+bool CanResizePixelFormat(const PixelFormat& fmt)
+{
+    if(fmt.planar || IsPacked422(fmt)) {
+        return true;
+    }
+    if(fmt.channels == 0) {
+        return false;
+    }
+    const unsigned int bits = fmt.channel_bits[0];
+    for(size_t c = 1; c < fmt.channels; ++c) {
+        if(fmt.channel_bits[c] != bits) return false;
+    }
+    const bool supported = fmt.IsFloat() ? (bits == 32 || bits == 64) : (bits == 8 || bits == 16 || bits == 32);
+    return supported && fmt.channels * bits == fmt.bpp;
+}
+
+void ResizeImage(
+    const Image<unsigned char>& dst, const Image<unsigned char>& src,
+    const PixelFormat& fmt, ResizeMethod method, size_t num_threads
+) {
+    if(!CanResizePixelFormat(fmt)) {
+        throw std::runtime_error("ResizeImage: Unable to resize " + fmt.Name());
+    }
+
+    if(IsPacked422(fmt)) {
+        // Resample Y0 U Y1 V quadruples, as 4 channels of pairs of pixels
+        if(src.w % 2 || dst.w % 2) {
+            throw std::runtime_error("ResizeImage: " + fmt.Name() + " width must be even");
+        }
+        const Image<unsigned char> d(dst.ptr, dst.w / 2, dst.h, dst.pitch);
+        const Image<unsigned char> s(src.ptr, src.w / 2, src.h, src.pitch);
+        ResizePlane(d, s, 8, false, 4, method, num_threads);
+    }else if(fmt.planar) {
+        ResizePlane(dst, src, 8, false, 1, method, num_threads);
+        if(fmt.id == PixelFormatId::NV12) {
+            ResizePlane(ChromaPlane(dst, 0, dst.pitch), ChromaPlane(src, 0, src.pitch), 8, false, 2, method, num_threads);
+        }else{
+            for(size_t p = 0; p < 2; ++p) {
+                ResizePlane(ChromaPlane(dst, p, dst.pitch / 2), ChromaPlane(src, p, src.pitch / 2), 8, false, 1, method, num_threads);
+            }
+        }
+    }else{
+        ResizePlane(dst, src, fmt.channel_bits[0], fmt.IsFloat(), fmt.channels, method, num_threads);
+    }
+}
+
+}
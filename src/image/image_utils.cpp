@@ -0,0 +1,260 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/image/image_utils.h>
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  define IMAGE_UTILS_HAVE_SSE2
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define IMAGE_UTILS_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace pangolin
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Elements [begin,end) of a row of interleaved channels. With 4 channels the
+// 4th is alpha and is ignored.
+template<typename T>
+void MinMaxScalar(const T* row, size_t begin, size_t end, size_t channels, float& lo, float& hi)
+{
+    for(size_t i = begin; i < end; ++i) {
+        if(channels == 4 && i % 4 == 3) continue;
+        if(row[i] < lo) lo = (float)row[i];
+        if(row[i] > hi) hi = (float)row[i];
+    }
+}
+
+template<typename T>
+std::pair<float,float> MinMaxScalar(const Image<T>& img, size_t channels)
+{
+    float lo = +FLT_MAX;
+    float hi = -FLT_MAX;
+    for(size_t y = 0; y < img.h; ++y) {
+        MinMaxScalar(img.RowPtr(y), 0, img.w * channels, channels, lo, hi);
+    }
+    return std::pair<float,float>(lo, hi);
+}
+
+#if defined(IMAGE_UTILS_HAVE_SSE2) || defined(IMAGE_UTILS_HAVE_NEON)
+
+// Vector types for MinMaxSimd. Rows are treated as flat arrays of
+// channels which, since lanes is a multiple of 4, keep alpha in fixed lanes.
+#if defined(IMAGE_UTILS_HAVE_SSE2)
+struct SimdU8
+{
+    typedef unsigned char T;
+    typedef __m128i V;
+    static const size_t lanes = 16;
+    static V Load(const T* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(T* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+    static V Alpha() { return _mm_set1_epi32((int)0xFF000000); }
+    static V None() { return _mm_setzero_si128(); }
+    static V Highest() { return _mm_set1_epi8(-1); }
+    static V Lowest() { return _mm_setzero_si128(); }
+    static V Select(V mask, V a, V b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    static V Min(V acc, V v) { return _mm_min_epu8(acc, v); }
+    static V Max(V acc, V v) { return _mm_max_epu8(acc, v); }
+};
+
+struct SimdU16
+{
+    typedef unsigned short T;
+    typedef __m128i V;
+    static const size_t lanes = 8;
+    static V Load(const T* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(T* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+    static V Alpha() { return _mm_set1_epi64x((long long)0xFFFF000000000000ull); }
+    static V None() { return _mm_setzero_si128(); }
+    static V Highest() { return _mm_set1_epi16(-1); }
+    static V Lowest() { return _mm_setzero_si128(); }
+    static V Select(V mask, V a, V b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    // SSE2 has no unsigned 16-bit min / max, so use saturating subtraction
+    static V Min(V acc, V v) { return _mm_sub_epi16(acc, _mm_subs_epu16(acc, v)); }
+    static V Max(V acc, V v) { return _mm_add_epi16(v, _mm_subs_epu16(acc, v)); }
+};
+
+struct SimdF32
+{
+    typedef float T;
+    typedef __m128 V;
+    static const size_t lanes = 4;
+    static V Load(const T* p) { return _mm_loadu_ps(p); }
+    static void Store(T* p, V v) { _mm_storeu_ps(p, v); }
+    static V Alpha() { return _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0)); }
+    static V None() { return _mm_setzero_ps(); }
+    static V Highest() { return _mm_set1_ps(+FLT_MAX); }
+    static V Lowest() { return _mm_set1_ps(-FLT_MAX); }
+    static V Select(V mask, V a, V b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    // minps / maxps return their second operand for NaN, so skip NaNs like the scalar path
+    static V Min(V acc, V v) { return _mm_min_ps(v, acc); }
+    static V Max(V acc, V v) { return _mm_max_ps(v, acc); }
+};
+#else
+struct SimdU8
+{
+    typedef unsigned char T;
+    typedef uint8x16_t V;
+    static const size_t lanes = 16;
+    static V Load(const T* p) { return vld1q_u8(p); }
+    static void Store(T* p, V v) { vst1q_u8(p, v); }
+    static V Alpha() { return vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000u)); }
+    static V None() { return vdupq_n_u8(0); }
+    static V Highest() { return vdupq_n_u8(0xFF); }
+    static V Lowest() { return vdupq_n_u8(0); }
+    static V Select(V mask, V a, V b) { return vbslq_u8(mask, a, b); }
+    static V Min(V acc, V v) { return vminq_u8(acc, v); }
+    static V Max(V acc, V v) { return vmaxq_u8(acc, v); }
+};
+
+struct SimdU16
+{
+    typedef unsigned short T;
+    typedef uint16x8_t V;
+    static const size_t lanes = 8;
+    static V Load(const T* p) { return vld1q_u16(p); }
+    static void Store(T* p, V v) { vst1q_u16(p, v); }
+    static V Alpha() { return vreinterpretq_u16_u64(vdupq_n_u64(0xFFFF000000000000ull)); }
+    static V None() { return vdupq_n_u16(0); }
+    static V Highest() { return vdupq_n_u16(0xFFFF); }
+    static V Lowest() { return vdupq_n_u16(0); }
+    static V Select(V mask, V a, V b) { return vbslq_u16(mask, a, b); }
+    static V Min(V acc, V v) { return vminq_u16(acc, v); }
+    static V Max(V acc, V v) { return vmaxq_u16(acc, v); }
+};
+
+struct SimdF32
+{
+    typedef float T;
+    typedef float32x4_t V;
+    static const size_t lanes = 4;
+    static V Load(const T* p) { return vld1q_f32(p); }
+    static void Store(T* p, V v) { vst1q_f32(p, v); }
+    static V Alpha() { return vreinterpretq_f32_u32(vsetq_lane_u32(0xFFFFFFFFu, vdupq_n_u32(0), 3)); }
+    static V None() { return vdupq_n_f32(0.0f); }
+    static V Highest() { return vdupq_n_f32(+FLT_MAX); }
+    static V Lowest() { return vdupq_n_f32(-FLT_MAX); }
+    static V Select(V mask, V a, V b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+    // The 'nm' variants return the number when one operand is NaN
+    static V Min(V acc, V v) { return vminnmq_f32(acc, v); }
+    static V Max(V acc, V v) { return vmaxnmq_f32(acc, v); }
+};
+#endif
+
+template<typename S>
+std::pair<float,float> MinMaxSimd(const Image<typename S::T>& img, size_t channels)
+{
+    typedef typename S::T T;
+    typedef typename S::V V;
+
+    const size_t n = img.w * channels;
+    const size_t simd_n = n - n % S::lanes;
+
+    // Alpha lanes are replaced so as not to affect the result
+    const V alpha = channels == 4 ? S::Alpha() : S::None();
+    const V highest = S::Highest();
+    const V lowest = S::Lowest();
+    V vlo = highest;
+    V vhi = lowest;
+
+    float lo = +FLT_MAX;
+    float hi = -FLT_MAX;
+    for(size_t y = 0; y < img.h; ++y) {
+        const T* row = img.RowPtr(y);
+        for(size_t i = 0; i < simd_n; i += S::lanes) {
+            const V v = S::Load(row + i);
+            vlo = S::Min(vlo, S::Select(alpha, highest, v));
+            vhi = S::Max(vhi, S::Select(alpha, lowest, v));
+        }
+        MinMaxScalar(row, simd_n, n, channels, lo, hi);
+    }
+
+    if(simd_n && img.h) {
+        T lane_lo[S::lanes];
+        T lane_hi[S::lanes];
+        S::Store(lane_lo, vlo);
+        S::Store(lane_hi, vhi);
+        MinMaxScalar(lane_lo, 0, S::lanes, channels, lo, hi);
+        MinMaxScalar(lane_hi, 0, S::lanes, channels, lo, hi);
+    }
+
+    return std::pair<float,float>(lo, hi);
+}
+
+#endif // IMAGE_UTILS_HAVE_SSE2 || IMAGE_UTILS_HAVE_NEON
+
+}
+
+#if defined(IMAGE_UTILS_HAVE_SSE2) || defined(IMAGE_UTILS_HAVE_NEON)
+
+std::pair<float,float> GetMinMax(const Image<unsigned char>& img, size_t channels)
+{
+    return MinMaxSimd<SimdU8>(img, channels);
+}
+
+std::pair<float,float> GetMinMax(const Image<unsigned short>& img, size_t channels)
+{
+    return MinMaxSimd<SimdU16>(img, channels);
+}
+
+std::pair<float,float> GetMinMax(const Image<float>& img, size_t channels)
+{
+    return MinMaxSimd<SimdF32>(img, channels);
+}
+
+#else
+
+std::pair<float,float> GetMinMax(const Image<unsigned char>& img, size_t channels)
+{
+    return MinMaxScalar(img, channels);
+}
+
+std::pair<float,float> GetMinMax(const Image<unsigned short>& img, size_t channels)
+{
+    return MinMaxScalar(img, channels);
+}
+
+std::pair<float,float> GetMinMax(const Image<float>& img, size_t channels)
+{
+    return MinMaxScalar(img, channels);
+}
+
+#endif
+
+} // internal
+
+}
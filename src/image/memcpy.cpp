@@ -0,0 +1,216 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2011 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/image/memcpy.h>
+#include <pangolin/utils/parallel_for.h>
+#include <pangolin/utils/thread_affinity.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN_
+#  include <malloc.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MEMCPY_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#endif
+
+namespace pangolin
+{
+
+namespace
+{
+
+#if defined(MEMCPY_HAVE_X86_DISPATCH)
+
+bool DetectStreamingStores()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+const bool have_streaming_stores = DetectStreamingStores();
+
+__attribute__((target("sse2")))
+void StreamCopySSE2(char* dst, const char* src, size_t n)
+{
+    // Streaming stores need an aligned destination
+    const size_t head = std::min(n, size_t(-uintptr_t(dst) & 15));
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    size_t i = 0;
+    for(; i + 64 <= n; i += 64) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        const __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_stream_si128((__m128i*)(dst + i), a);
+        _mm_stream_si128((__m128i*)(dst + i + 16), b);
+        _mm_stream_si128((__m128i*)(dst + i + 32), c);
+        _mm_stream_si128((__m128i*)(dst + i + 48), d);
+    }
+    for(; i + 16 <= n; i += 16) {
+        _mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+    std::memcpy(dst + i, src + i, n - i);
+
+    // Order the weakly ordered stores before whatever signals the copy is done
+    _mm_sfence();
+}
+
+#endif // MEMCPY_HAVE_X86_DISPATCH
+
+// Rows of at least this many bytes are worth streaming on their own
+const size_t min_stream_row_bytes = 256;
+
+// Contiguous copies are split into chunks of whole cache lines
+const size_t parallel_chunk_bytes = 64 * 1024;
+
+void CopyRows(char* dst, size_t dst_pitch_bytes, const char* src, size_t src_pitch_bytes, size_t width_bytes, size_t height, bool streaming)
+{
+    if(dst_pitch_bytes == width_bytes && src_pitch_bytes == width_bytes) {
+        width_bytes *= height;
+        height = 1;
+    }
+    streaming = streaming && width_bytes >= min_stream_row_bytes;
+    for(size_t row = 0; row < height; ++row) {
+        if(streaming) {
+            MemCopyStreaming(dst, src, width_bytes);
+        }else{
+            std::memcpy(dst, src, width_bytes);
+        }
+        dst += dst_pitch_bytes;
+        src += src_pitch_bytes;
+    }
+}
+
+}
+
+FrameCopySettings& FrameCopyConfig()
+{
+    static FrameCopySettings settings;
+    return settings;
+}
+
+void MemCopyStreaming(void* dst, const void* src, size_t size_bytes)
+{
+#if defined(MEMCPY_HAVE_X86_DISPATCH)
+    if(have_streaming_stores) {
+        StreamCopySSE2((char*)dst, (const char*)src, size_bytes);
+        return;
+    }
+#endif
+    std::memcpy(dst, src, size_bytes);
+}
+
+void PitchedCopyParallel(char* dst, size_t dst_pitch_bytes, const char* src, size_t src_pitch_bytes, size_t width_bytes, size_t height, size_t num_threads, bool streaming)
+{
+    if(height == 1 || (dst_pitch_bytes == width_bytes && src_pitch_bytes == width_bytes)) {
+        // Contiguous, so split by bytes rather than rows
+        const size_t size_bytes = width_bytes * height;
+        const size_t chunks = (size_bytes + parallel_chunk_bytes - 1) / parallel_chunk_bytes;
+        ParallelFor(0, chunks, num_threads, [&](size_t c0, size_t c1) {
+            const size_t b0 = c0 * parallel_chunk_bytes;
+            const size_t b1 = std::min(c1 * parallel_chunk_bytes, size_bytes);
+            CopyRows(dst + b0, b1 - b0, src + b0, b1 - b0, b1 - b0, 1, streaming);
+        });
+    }else{
+        ParallelFor(0, height, num_threads, [&](size_t y0, size_t y1) {
+            CopyRows(dst + y0 * dst_pitch_bytes, dst_pitch_bytes, src + y0 * src_pitch_bytes, src_pitch_bytes, width_bytes, y1 - y0, streaming);
+        });
+    }
+}
+
+void FrameCopy(void* dst, const void* src, size_t size_bytes)
+{
+    FramePitchedCopy((char*)dst, size_bytes, (const char*)src, size_bytes, size_bytes, 1);
+}
+
+void FramePitchedCopy(char* dst, size_t dst_pitch_bytes, const char* src, size_t src_pitch_bytes, size_t width_bytes, size_t height)
+{
+    const FrameCopySettings& config = FrameCopyConfig();
+    const size_t size_bytes = width_bytes * height;
+    const bool streaming = size_bytes >= config.stream_threshold;
+    if(size_bytes >= config.parallel_threshold && config.max_threads > 1) {
+        PitchedCopyParallel(dst, dst_pitch_bytes, src, src_pitch_bytes, width_bytes, height, config.max_threads, streaming);
+    }else{
+        CopyRows(dst, dst_pitch_bytes, src, src_pitch_bytes, width_bytes, height, streaming);
+    }
+}
+
+unsigned char* AllocatePinned(size_t size_bytes)
+{
+#ifdef HAVE_CUDA
+    void* ptr = nullptr;
+    if(cudaHostAlloc(&ptr, size_bytes, cudaHostAllocPortable) != cudaSuccess) {
+        cudaGetLastError();
+        throw std::bad_alloc();
+    }
+    return (unsigned char*)ptr;
+#else
+    const size_t page_bytes = 4096;
+    void* ptr = nullptr;
+#  ifdef _WIN_
+    ptr = _aligned_malloc(size_bytes, page_bytes);
+#  else
+    if(posix_memalign(&ptr, page_bytes, size_bytes) != 0) {
+        ptr = nullptr;
+    }
+#  endif
+    if(!ptr) {
+        throw std::bad_alloc();
+    }
+    // Still usable, only pageable, if the lock limit is exceeded
+    LockMemory(ptr, size_bytes);
+    return (unsigned char*)ptr;
+#endif
+}
+
+void FreePinned(unsigned char* ptr, size_t size_bytes)
+{
+    if(!ptr) return;
+#ifdef HAVE_CUDA
+    PANGOLIN_UNUSED(size_bytes);
+    cudaFreeHost(ptr);
+#else
+    UnlockMemory(ptr, size_bytes);
+#  ifdef _WIN_
+    _aligned_free(ptr);
+#  else
+    free(ptr);
+#  endif
+#endif
+}
+
+}
@@ -28,40 +28,47 @@
 #include <pangolin/image/pixel_format.h>
 
 #include <stdexcept>
-#include <vector>
+#include <unordered_map>
 
 namespace pangolin
 {
 
-// Not to exceed 8 byte Format code.
-const PixelFormat SupportedPixelFormats[] =
+namespace
 {
-    {"GRAY8", 1, {8}, 8, false},
-    {"GRAY10", 1, {10}, 10, false},
-    {"GRAY12", 1, {12}, 12, false},
-    {"GRAY16LE", 1, {16}, 16, false},
-    {"GRAY32", 1, {32}, 32, false},
-    {"Y400A", 2, {8,8}, 16, false},
-    {"RGB24", 3, {8,8,8}, 24, false},
-    {"BGR24", 3, {8,8,8}, 24, false},
-    {"RGB48", 3, {16,16,16}, 48, false},
-    {"BGR48", 3, {16,16,16}, 48, false},
-    {"YUYV422", 3, {4,2,2}, 16, false},
-    {"RGBA32",  4, {8,8,8,8}, 32, false},
-    {"BGRA32",  4, {8,8,8,8}, 32, false},
-    {"GRAY32F", 1, {32}, 32, false},
-    {"GRAY64F", 1, {64}, 64, false},
-    {"RGB96F",  3, {32,32,32}, 96, false},
-    {"RGBA128F",  4, {32,32,32,32}, 128, false},
-    {"",0,{0,0,0,0},0,0}
-};
+
+const std::string& PixelFormatName(PixelFormatId id)
+{
+    static const std::string names[] = {
+        "",
+#define PANGOLIN_PIXEL_FORMAT_NAME(name, ...) #name,
+        PANGOLIN_PIXEL_FORMATS(PANGOLIN_PIXEL_FORMAT_NAME)
+#undef PANGOLIN_PIXEL_FORMAT_NAME
+    };
+    return names[size_t(id) < size_t(PixelFormatId::Count) ? size_t(id) : 0];
+}
+
+}
+
+const std::string& PixelFormat::Name() const
+{
+    return PixelFormatName(id);
+}
 
 PixelFormat PixelFormatFromString(const std::string& format)
 {
-    for(int i=0; !SupportedPixelFormats[i].format.empty(); ++i)
-        if(!format.compare(SupportedPixelFormats[i].format))
-            return SupportedPixelFormats[i];
-    throw std::runtime_error( std::string("Unknown Format: ") + format);
+    static const std::unordered_map<std::string, PixelFormatId> ids = [](){
+        std::unordered_map<std::string, PixelFormatId> ids;
+        for(size_t i=1; i < size_t(PixelFormatId::Count); ++i) {
+            ids[PixelFormatName(PixelFormatId(i))] = PixelFormatId(i);
+        }
+        return ids;
+    }();
+
+    auto it = ids.find(format);
+    if(it == ids.end()) {
+        throw std::runtime_error( std::string("Unknown Format: ") + format);
+    }
+    return PixelFormat(it->second);
 }
 
 }
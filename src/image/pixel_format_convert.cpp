@@ -0,0 +1,768 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/image/pixel_format_convert.h>
+#include <pangolin/utils/parallel_for.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define CONVERT_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define CONVERT_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace pangolin
+{
+
+namespace
+{
+
+enum ConvertSimdLevel
+{
+    ConvertSimdScalar,
+    ConvertSimdSSE2,
+    ConvertSimdSSSE3,
+    ConvertSimdNEON
+};
+
+ConvertSimdLevel DetectSimdLevel()
+{
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")) return ConvertSimdSSSE3;
+    if(__builtin_cpu_supports("sse2")) return ConvertSimdSSE2;
+    return ConvertSimdScalar;
+#elif defined(CONVERT_HAVE_NEON)
+    return ConvertSimdNEON;
+#else
+    return ConvertSimdScalar;
+#endif
+}
+
+const ConvertSimdLevel simd_level = DetectSimdLevel();
+
+enum ConvertKind
+{
+    ConvertNone,
+    ConvertCopy,
+    ConvertYuvToRgb,
+    ConvertYuvToGray,
+    ConvertSwizzle,
+    ConvertGrayToFloat
+};
+
+// Arrangement of YUV in the source
+enum YuvLayout
+{
+    YuvLayoutYUYV,      // packed Y0 U Y1 V
+    YuvLayoutUYVY,      // packed U Y0 V Y1
+    YuvLayoutNV12,      // luma row, interleaved UV row
+    YuvLayoutI420       // luma row, U row, V row
+};
+
+// 8 bit colour pixels of 3 or 4 channels, red and blue swapped when bgr
+struct RgbLayout
+{
+    size_t channels;
+    bool bgr;
+};
+
+// Rows of the source planes holding one row of pixels. Only y is used by
+// packed formats, and v only by YUV420P.
+struct SourceRow
+{
+    const uint8_t* y;
+    const uint8_t* u;
+    const uint8_t* v;
+};
+
+struct ConvertPlan
+{
+    ConvertKind kind;
+    YuvLayout yuv;
+    RgbLayout in;
+    RgbLayout out;
+    size_t in_bytes;        // bytes per channel for ConvertGrayToFloat
+    size_t row_bytes;       // bytes per pixel for ConvertCopy of packed formats
+};
+
+bool RgbLayoutOf(PixelFormatId id, RgbLayout& l)
+{
+    switch(id) {
+    case PixelFormatId::RGB24:  l.channels = 3; l.bgr = false; return true;
+    case PixelFormatId::BGR24:  l.channels = 3; l.bgr = true;  return true;
+    case PixelFormatId::RGBA32: l.channels = 4; l.bgr = false; return true;
+    case PixelFormatId::BGRA32: l.channels = 4; l.bgr = true;  return true;
+    default: return false;
+    }
+}
+
+bool YuvLayoutOf(PixelFormatId id, YuvLayout& l)
+{
+    switch(id) {
+    case PixelFormatId::YUYV422: l = YuvLayoutYUYV; return true;
+    case PixelFormatId::UYVY422: l = YuvLayoutUYVY; return true;
+    case PixelFormatId::NV12:    l = YuvLayoutNV12; return true;
+    case PixelFormatId::YUV420P: l = YuvLayoutI420; return true;
+    default: return false;
+    }
+}
+
+ConvertPlan MakePlan(const PixelFormat& dst_fmt, const PixelFormat& src_fmt)
+{
+    ConvertPlan p = {};
+    p.kind = ConvertNone;
+    if(src_fmt.id == PixelFormatId::Unknown || dst_fmt.id == PixelFormatId::Unknown) {
+        return p;
+    }
+
+    if(src_fmt == dst_fmt) {
+        p.kind = ConvertCopy;
+        p.row_bytes = src_fmt.bpp / 8;
+    }else if(YuvLayoutOf(src_fmt.id, p.yuv)) {
+        if(RgbLayoutOf(dst_fmt.id, p.out)) {
+            p.kind = ConvertYuvToRgb;
+        }else if(dst_fmt.id == PixelFormatId::GRAY8) {
+            p.kind = ConvertYuvToGray;
+        }
+    }else if(RgbLayoutOf(src_fmt.id, p.in)) {
+        if(RgbLayoutOf(dst_fmt.id, p.out)) {
+            p.kind = ConvertSwizzle;
+        }
+    }else if(dst_fmt.id == PixelFormatId::GRAY32F) {
+        if(src_fmt.id == PixelFormatId::GRAY8 || src_fmt.id == PixelFormatId::GRAY16LE) {
+            p.kind = ConvertGrayToFloat;
+            p.in_bytes = src_fmt.bpp / 8;
+        }
+    }
+    return p;
+}
+
+////////////////////////////////////////////////////////////////////
+// Scalar
+
+inline uint8_t Clamp8(int v)
+{
+    return (uint8_t)std::min(std::max(v, 0), 255);
+}
+
+// BT.601 limited range, with coefficients in 6 bit fixed point so that the
+// vector kernels, working in 16 bit lanes, give identical results.
+inline void YuvToRgbPixel(uint8_t* out, int y, int u, int v, bool bgr)
+{
+    const int c = 74 * (y - 16) + 32;
+    const int d = u - 128;
+    const int e = v - 128;
+    const uint8_t r = Clamp8((c + 102 * e) >> 6);
+    const uint8_t g = Clamp8((c - 25 * d - 52 * e) >> 6);
+    const uint8_t b = Clamp8((c + 129 * d) >> 6);
+    out[bgr ? 2 : 0] = r;
+    out[1] = g;
+    out[bgr ? 0 : 2] = b;
+}
+
+inline void LoadYuvPixel(YuvLayout layout, const SourceRow& row, size_t x, int& y, int& u, int& v)
+{
+    const size_t pair = x / 2;
+    switch(layout) {
+    case YuvLayoutYUYV:
+        y = row.y[2 * x];
+        u = row.y[4 * pair + 1];
+        v = row.y[4 * pair + 3];
+        break;
+    case YuvLayoutUYVY:
+        y = row.y[2 * x + 1];
+        u = row.y[4 * pair];
+        v = row.y[4 * pair + 2];
+        break;
+    case YuvLayoutNV12:
+        y = row.y[x];
+        u = row.u[2 * pair];
+        v = row.u[2 * pair + 1];
+        break;
+    case YuvLayoutI420:
+        y = row.y[x];
+        u = row.u[pair];
+        v = row.v[pair];
+        break;
+    }
+}
+
+void YuvToRgbRowScalar(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t begin, size_t n, RgbLayout l)
+{
+    int y = 0, u = 0, v = 0;
+    for(size_t x = begin; x < n; ++x) {
+        LoadYuvPixel(layout, row, x, y, u, v);
+        uint8_t* o = out + l.channels * x;
+        YuvToRgbPixel(o, y, u, v, l.bgr);
+        if(l.channels == 4) o[3] = 255;
+    }
+}
+
+void YuvToGrayRowScalar(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t begin, size_t n)
+{
+    switch(layout) {
+    case YuvLayoutYUYV: for(size_t x = begin; x < n; ++x) out[x] = row.y[2 * x]; break;
+    case YuvLayoutUYVY: for(size_t x = begin; x < n; ++x) out[x] = row.y[2 * x + 1]; break;
+    default: std::memcpy(out + begin, row.y + begin, n - begin); break;
+    }
+}
+
+void SwizzleRowScalar(uint8_t* out, RgbLayout lo, const uint8_t* in, RgbLayout li, size_t begin, size_t n)
+{
+    const bool swap = lo.bgr != li.bgr;
+    for(size_t x = begin; x < n; ++x) {
+        const uint8_t* i = in + li.channels * x;
+        uint8_t* o = out + lo.channels * x;
+        o[0] = i[swap ? 2 : 0];
+        o[1] = i[1];
+        o[2] = i[swap ? 0 : 2];
+        if(lo.channels == 4) o[3] = li.channels == 4 ? i[3] : 255;
+    }
+}
+
+template<typename T>
+void GrayToFloatRowScalar(float* out, const T* in, size_t begin, size_t n, float scale)
+{
+    for(size_t x = begin; x < n; ++x) {
+        out[x] = scale * in[x];
+    }
+}
+
+// Byte shuffle taking 4 pixels of layout li to 4 pixels of layout lo. Bytes
+// beyond the output pixels, and alpha created from 3 channels, are zeroed.
+void SwizzleShuffle(uint8_t shuffle[16], RgbLayout lo, RgbLayout li)
+{
+    const bool swap = lo.bgr != li.bgr;
+    std::memset(shuffle, 0x80, 16);
+    for(size_t k = 0; k < 4; ++k) {
+        for(size_t c = 0; c < lo.channels; ++c) {
+            if(c == 3) {
+                if(li.channels == 4) shuffle[k * 4 + 3] = (uint8_t)(k * 4 + 3);
+            }else{
+                const size_t sc = (swap && c != 1) ? 2 - c : c;
+                shuffle[k * lo.channels + c] = (uint8_t)(k * li.channels + sc);
+            }
+        }
+    }
+}
+
+// Each vector kernel converts a whole number of vectors from the start of the
+// row and returns the number of pixels done, leaving any tail for the scalar path.
+
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+
+// Load 16 pixels of luma and their 8 chroma pairs (in the low halves of u, v)
+__attribute__((target("sse2")))
+inline void LoadYuv16SSE2(YuvLayout layout, const SourceRow& row, size_t i, __m128i& y, __m128i& u, __m128i& v)
+{
+    const __m128i lo = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i uv;
+    if(layout == YuvLayoutYUYV || layout == YuvLayoutUYVY) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(row.y + 2 * i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(row.y + 2 * i + 16));
+        if(layout == YuvLayoutYUYV) {
+            y = _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo));
+            uv = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        }else{
+            y = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            uv = _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo));
+        }
+    }else{
+        y = _mm_loadu_si128((const __m128i*)(row.y + i));
+        if(layout == YuvLayoutI420) {
+            u = _mm_loadl_epi64((const __m128i*)(row.u + i / 2));
+            v = _mm_loadl_epi64((const __m128i*)(row.v + i / 2));
+            return;
+        }
+        uv = _mm_loadu_si128((const __m128i*)(row.u + i));
+    }
+    u = _mm_packus_epi16(_mm_and_si128(uv, lo), zero);
+    v = _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero);
+}
+
+// 8 pixels of one colour channel from luma c and per pixel chroma term
+__attribute__((target("sse2")))
+inline __m128i YuvChannelSSE2(__m128i c, __m128i chroma)
+{
+    return _mm_srai_epi16(_mm_adds_epi16(c, chroma), 6);
+}
+
+__attribute__((target("sse2")))
+inline void YuvToRgb16SSE2(__m128i y, __m128i u, __m128i v, __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i d = _mm_sub_epi16(_mm_unpacklo_epi8(u, zero), _mm_set1_epi16(128));
+    const __m128i e = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), _mm_set1_epi16(128));
+
+    // Chroma terms of each pair, then repeated for both pixels of the pair
+    const __m128i cr = _mm_mullo_epi16(e, _mm_set1_epi16(102));
+    const __m128i cg = _mm_add_epi16(_mm_mullo_epi16(d, _mm_set1_epi16(-25)), _mm_mullo_epi16(e, _mm_set1_epi16(-52)));
+    const __m128i cb = _mm_mullo_epi16(d, _mm_set1_epi16(129));
+
+    const __m128i k74 = _mm_set1_epi16(74);
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i k32 = _mm_set1_epi16(32);
+    const __m128i c0 = _mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), k16), k74), k32);
+    const __m128i c1 = _mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), k16), k74), k32);
+
+    r = _mm_packus_epi16(YuvChannelSSE2(c0, _mm_unpacklo_epi16(cr, cr)), YuvChannelSSE2(c1, _mm_unpackhi_epi16(cr, cr)));
+    g = _mm_packus_epi16(YuvChannelSSE2(c0, _mm_unpacklo_epi16(cg, cg)), YuvChannelSSE2(c1, _mm_unpackhi_epi16(cg, cg)));
+    b = _mm_packus_epi16(YuvChannelSSE2(c0, _mm_unpacklo_epi16(cb, cb)), YuvChannelSSE2(c1, _mm_unpackhi_epi16(cb, cb)));
+}
+
+// Interleave 16 pixels of r, g, b into RGBA (or BGRA) with opaque alpha
+__attribute__((target("sse2")))
+inline void InterleaveRgba16SSE2(__m128i r, __m128i g, __m128i b, bool bgr, __m128i out[4])
+{
+    const __m128i a = _mm_set1_epi8((char)0xFF);
+    const __m128i c0 = bgr ? b : r;
+    const __m128i c2 = bgr ? r : b;
+    const __m128i lo01 = _mm_unpacklo_epi8(c0, g);
+    const __m128i hi01 = _mm_unpackhi_epi8(c0, g);
+    const __m128i lo23 = _mm_unpacklo_epi8(c2, a);
+    const __m128i hi23 = _mm_unpackhi_epi8(c2, a);
+    out[0] = _mm_unpacklo_epi16(lo01, lo23);
+    out[1] = _mm_unpackhi_epi16(lo01, lo23);
+    out[2] = _mm_unpacklo_epi16(hi01, hi23);
+    out[3] = _mm_unpackhi_epi16(hi01, hi23);
+}
+
+// Drop the alpha of 16 RGBA pixels, leaving 48 bytes of RGB
+__attribute__((target("ssse3")))
+inline void StoreRgb16SSSE3(uint8_t* out, const __m128i rgba[4])
+{
+    const __m128i drop = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+    const __m128i s0 = _mm_shuffle_epi8(rgba[0], drop);
+    const __m128i s1 = _mm_shuffle_epi8(rgba[1], drop);
+    const __m128i s2 = _mm_shuffle_epi8(rgba[2], drop);
+    const __m128i s3 = _mm_shuffle_epi8(rgba[3], drop);
+    _mm_storeu_si128((__m128i*)(out +  0), _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+    _mm_storeu_si128((__m128i*)(out + 16), _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+    _mm_storeu_si128((__m128i*)(out + 32), _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+}
+
+__attribute__((target("sse2")))
+size_t YuvToRgbaRowSSE2(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n, bool bgr)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i y, u, v, r, g, b, rgba[4];
+        LoadYuv16SSE2(layout, row, i, y, u, v);
+        YuvToRgb16SSE2(y, u, v, r, g, b);
+        InterleaveRgba16SSE2(r, g, b, bgr, rgba);
+        for(int k = 0; k < 4; ++k) {
+            _mm_storeu_si128((__m128i*)(out + 4 * i + 16 * k), rgba[k]);
+        }
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+size_t YuvToRgbRowSSSE3(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n, bool bgr)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i y, u, v, r, g, b, rgba[4];
+        LoadYuv16SSE2(layout, row, i, y, u, v);
+        YuvToRgb16SSE2(y, u, v, r, g, b);
+        InterleaveRgba16SSE2(r, g, b, bgr, rgba);
+        StoreRgb16SSSE3(out + 3 * i, rgba);
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t YuvToGrayRowSSE2(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i y, u, v;
+        LoadYuv16SSE2(layout, row, i, y, u, v);
+        _mm_storeu_si128((__m128i*)(out + i), y);
+    }
+    return i;
+}
+
+// 4 pixels at a time through a single shuffle. Loads and stores are 16 bytes
+// wide, so 3 channel rows stop short enough to stay within the row.
+__attribute__((target("ssse3")))
+size_t SwizzleRowSSSE3(uint8_t* out, RgbLayout lo, const uint8_t* in, RgbLayout li, size_t n)
+{
+    uint8_t s[16];
+    SwizzleShuffle(s, lo, li);
+    const __m128i shuffle = _mm_loadu_si128((const __m128i*)s);
+    const __m128i alpha = (lo.channels == 4 && li.channels == 3) ? _mm_set1_epi32((int)0xFF000000) : _mm_setzero_si128();
+    const size_t margin = (lo.channels == 3 || li.channels == 3) ? 6 : 4;
+    size_t i = 0;
+    for(; i + margin <= n; i += 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(in + li.channels * i));
+        _mm_storeu_si128((__m128i*)(out + lo.channels * i), _mm_or_si128(_mm_shuffle_epi8(p, shuffle), alpha));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t GrayToFloatRowSSE2(float* out, const uint8_t* in, size_t n, float scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 k = _mm_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i a = _mm_unpacklo_epi8(p, zero);
+        const __m128i b = _mm_unpackhi_epi8(p, zero);
+        _mm_storeu_ps(out + i +  0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero)), k));
+        _mm_storeu_ps(out + i +  4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero)), k));
+        _mm_storeu_ps(out + i +  8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero)), k));
+        _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(b, zero)), k));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t GrayToFloatRowSSE2(float* out, const uint16_t* in, size_t n, float scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 k = _mm_set1_ps(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_ps(out + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(p, zero)), k));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(p, zero)), k));
+    }
+    return i;
+}
+
+#endif // CONVERT_HAVE_X86_DISPATCH
+
+#if defined(CONVERT_HAVE_NEON)
+
+inline void LoadYuv16NEON(YuvLayout layout, const SourceRow& row, size_t i, uint8x16_t& y, uint8x8_t& u, uint8x8_t& v)
+{
+    uint8x16_t uv;
+    if(layout == YuvLayoutYUYV || layout == YuvLayoutUYVY) {
+        const uint8x16x2_t p = vld2q_u8(row.y + 2 * i);
+        y  = layout == YuvLayoutYUYV ? p.val[0] : p.val[1];
+        uv = layout == YuvLayoutYUYV ? p.val[1] : p.val[0];
+    }else{
+        y = vld1q_u8(row.y + i);
+        if(layout == YuvLayoutI420) {
+            u = vld1_u8(row.u + i / 2);
+            v = vld1_u8(row.v + i / 2);
+            return;
+        }
+        uv = vld1q_u8(row.u + i);
+    }
+    const uint8x8x2_t c = vuzp_u8(vget_low_u8(uv), vget_high_u8(uv));
+    u = c.val[0];
+    v = c.val[1];
+}
+
+inline uint8x16_t YuvChannelNEON(int16x8_t c0, int16x8_t c1, int16x8_t chroma)
+{
+    const int16x8x2_t t = vzipq_s16(chroma, chroma);
+    return vcombine_u8(
+        vqmovun_s16(vshrq_n_s16(vqaddq_s16(c0, t.val[0]), 6)),
+        vqmovun_s16(vshrq_n_s16(vqaddq_s16(c1, t.val[1]), 6))
+    );
+}
+
+size_t YuvToRgbRowNEON(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n, RgbLayout l)
+{
+    const uint8x8_t k16 = vdup_n_u8(16);
+    const uint8x8_t k128 = vdup_n_u8(128);
+    const int16x8_t k32 = vdupq_n_s16(32);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        uint8x16_t y;
+        uint8x8_t u, v;
+        LoadYuv16NEON(layout, row, i, y, u, v);
+
+        // Differences wrap in 16 bits, giving the signed values
+        const int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, k128));
+        const int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v, k128));
+        const int16x8_t cr = vmulq_n_s16(e, 102);
+        const int16x8_t cg = vmlaq_n_s16(vmulq_n_s16(d, -25), e, -52);
+        const int16x8_t cb = vmulq_n_s16(d, 129);
+        const int16x8_t c0 = vqaddq_s16(vmulq_n_s16(vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(y), k16)), 74), k32);
+        const int16x8_t c1 = vqaddq_s16(vmulq_n_s16(vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(y), k16)), 74), k32);
+
+        const uint8x16_t r = YuvChannelNEON(c0, c1, cr);
+        const uint8x16_t g = YuvChannelNEON(c0, c1, cg);
+        const uint8x16_t b = YuvChannelNEON(c0, c1, cb);
+        if(l.channels == 4) {
+            uint8x16x4_t o;
+            o.val[0] = l.bgr ? b : r;
+            o.val[1] = g;
+            o.val[2] = l.bgr ? r : b;
+            o.val[3] = vdupq_n_u8(255);
+            vst4q_u8(out + 4 * i, o);
+        }else{
+            uint8x16x3_t o;
+            o.val[0] = l.bgr ? b : r;
+            o.val[1] = g;
+            o.val[2] = l.bgr ? r : b;
+            vst3q_u8(out + 3 * i, o);
+        }
+    }
+    return i;
+}
+
+size_t YuvToGrayRowNEON(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n)
+{
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        uint8x16_t y;
+        uint8x8_t u, v;
+        LoadYuv16NEON(layout, row, i, y, u, v);
+        vst1q_u8(out + i, y);
+    }
+    return i;
+}
+
+size_t SwizzleRowNEON(uint8_t* out, RgbLayout lo, const uint8_t* in, RgbLayout li, size_t n)
+{
+    const bool swap = lo.bgr != li.bgr;
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        uint8x16x4_t p;
+        if(li.channels == 4) {
+            p = vld4q_u8(in + 4 * i);
+        }else{
+            const uint8x16x3_t q = vld3q_u8(in + 3 * i);
+            p.val[0] = q.val[0];
+            p.val[1] = q.val[1];
+            p.val[2] = q.val[2];
+            p.val[3] = vdupq_n_u8(255);
+        }
+        if(swap) std::swap(p.val[0], p.val[2]);
+        if(lo.channels == 4) {
+            vst4q_u8(out + 4 * i, p);
+        }else{
+            uint8x16x3_t q;
+            q.val[0] = p.val[0];
+            q.val[1] = p.val[1];
+            q.val[2] = p.val[2];
+            vst3q_u8(out + 3 * i, q);
+        }
+    }
+    return i;
+}
+
+size_t GrayToFloatRowNEON(float* out, const uint8_t* in, size_t n, float scale)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t p = vmovl_u8(vld1_u8(in + i));
+        vst1q_f32(out + i + 0, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(p))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(p))), scale));
+    }
+    return i;
+}
+
+size_t GrayToFloatRowNEON(float* out, const uint16_t* in, size_t n, float scale)
+{
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t p = vld1q_u16(in + i);
+        vst1q_f32(out + i + 0, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(p))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(p))), scale));
+    }
+    return i;
+}
+
+#endif // CONVERT_HAVE_NEON
+
+void YuvToRgbRow(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n, RgbLayout l)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+    case ConvertSimdSSSE3:
+        i = l.channels == 4 ? YuvToRgbaRowSSE2(out, layout, row, n, l.bgr) : YuvToRgbRowSSSE3(out, layout, row, n, l.bgr);
+        break;
+    case ConvertSimdSSE2:
+        if(l.channels == 4) i = YuvToRgbaRowSSE2(out, layout, row, n, l.bgr);
+        break;
+#elif defined(CONVERT_HAVE_NEON)
+    case ConvertSimdNEON: i = YuvToRgbRowNEON(out, layout, row, n, l); break;
+#endif
+    default: break;
+    }
+    YuvToRgbRowScalar(out, layout, row, i, n, l);
+}
+
+void YuvToGrayRow(uint8_t* out, YuvLayout layout, const SourceRow& row, size_t n)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+    case ConvertSimdSSSE3:
+    case ConvertSimdSSE2: i = YuvToGrayRowSSE2(out, layout, row, n); break;
+#elif defined(CONVERT_HAVE_NEON)
+    case ConvertSimdNEON: i = YuvToGrayRowNEON(out, layout, row, n); break;
+#endif
+    default: break;
+    }
+    YuvToGrayRowScalar(out, layout, row, i, n);
+}
+
+void SwizzleRow(uint8_t* out, RgbLayout lo, const uint8_t* in, RgbLayout li, size_t n)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+    case ConvertSimdSSSE3: i = SwizzleRowSSSE3(out, lo, in, li, n); break;
+#elif defined(CONVERT_HAVE_NEON)
+    case ConvertSimdNEON: i = SwizzleRowNEON(out, lo, in, li, n); break;
+#endif
+    default: break;
+    }
+    SwizzleRowScalar(out, lo, in, li, i, n);
+}
+
+template<typename T>
+void GrayToFloatRow(float* out, const T* in, size_t n, float scale)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(CONVERT_HAVE_X86_DISPATCH)
+    case ConvertSimdSSSE3:
+    case ConvertSimdSSE2: i = GrayToFloatRowSSE2(out, in, n, scale); break;
+#elif defined(CONVERT_HAVE_NEON)
+    case ConvertSimdNEON: i = GrayToFloatRowNEON(out, in, n, scale); break;
+#endif
+    default: break;
+    }
+    GrayToFloatRowScalar(out, in, i, n, scale);
+}
+
+void ConvertRow(const ConvertPlan& p, uint8_t* out, const SourceRow& row, size_t w, float scale)
+{
+    switch(p.kind) {
+    case ConvertCopy:
+        std::memcpy(out, row.y, w * p.row_bytes);
+        break;
+    case ConvertYuvToRgb:
+        YuvToRgbRow(out, p.yuv, row, w, p.out);
+        break;
+    case ConvertYuvToGray:
+        YuvToGrayRow(out, p.yuv, row, w);
+        break;
+    case ConvertSwizzle:
+        SwizzleRow(out, p.out, row.y, p.in, w);
+        break;
+    case ConvertGrayToFloat:
+        if(p.in_bytes == 1) {
+            GrayToFloatRow((float*)out, row.y, w, scale);
+        }else{
+            GrayToFloatRow((float*)out, (const uint16_t*)row.y, w, scale);
+        }
+        break;
+    default:
+        throw std::runtime_error("ConvertPixelFormat: Unsupported conversion");
+    }
+}
+
+// Copy the chroma planes following the luma of planar images
+void CopyChroma(const Image<unsigned char>& dst, const Image<unsigned char>& src, const PixelFormat& fmt)
+{
+    const size_t rows = (src.h + 1) / 2;
+    const unsigned char* s = src.ptr + src.h * src.pitch;
+    unsigned char* d = dst.ptr + dst.h * dst.pitch;
+    if(fmt.id == PixelFormatId::NV12) {
+        for(size_t r = 0; r < rows; ++r) {
+            std::memcpy(d + r * dst.pitch, s + r * src.pitch, 2 * ((src.w + 1) / 2));
+        }
+    }else{
+        // U rows followed by V rows, each of half pitch
+        for(size_t r = 0; r < 2 * rows; ++r) {
+            std::memcpy(d + r * (dst.pitch / 2), s + r * (src.pitch / 2), (src.w + 1) / 2);
+        }
+    }
+}
+
+}
+
+bool CanConvertPixelFormat(const PixelFormat& dst_fmt, const PixelFormat& src_fmt)
+{
+    return MakePlan(dst_fmt, src_fmt).kind != ConvertNone;
+}
+
+void ConvertPixelFormat(
+    const Image<unsigned char>& dst, const PixelFormat& dst_fmt,
+    const Image<unsigned char>& src, const PixelFormat& src_fmt,
+    float scale, size_t num_threads
+) {
+    const ConvertPlan p = MakePlan(dst_fmt, src_fmt);
+    if(p.kind == ConvertNone) {
+        throw std::runtime_error("ConvertPixelFormat: Unable to convert " + src_fmt.Name() + " to " + dst_fmt.Name());
+    }
+    if(dst.w != src.w || dst.h != src.h) {
+        throw std::runtime_error("ConvertPixelFormat: Image dimensions must match");
+    }
+
+    // Chroma planes follow the luma plane (see PANGOLIN_PIXEL_FORMATS)
+    const uint8_t* chroma = src.ptr + src.h * src.pitch;
+    const size_t chroma_rows = (src.h + 1) / 2;
+    const size_t chroma_pitch = src_fmt.id == PixelFormatId::YUV420P ? src.pitch / 2 : src.pitch;
+
+    ParallelFor(0, src.h, num_threads, [&](size_t begin, size_t end){
+        for(size_t y = begin; y < end; ++y) {
+            SourceRow row;
+            row.y = src.RowPtr(y);
+            row.u = chroma + (y / 2) * chroma_pitch;
+            row.v = row.u + chroma_rows * chroma_pitch;
+            ConvertRow(p, dst.ptr + y * dst.pitch, row, src.w, scale);
+        }
+    });
+
+    if(p.kind == ConvertCopy && src_fmt.planar) {
+        CopyChroma(dst, src, src_fmt);
+    }
+}
+
+void ConvertPixelFormatRow(
+    unsigned char* dst_row, const PixelFormat& dst_fmt,
+    const unsigned char* src_row, const PixelFormat& src_fmt,
+    size_t w, float scale
+) {
+    if(src_fmt.planar) {
+        throw std::runtime_error("ConvertPixelFormatRow: Planar formats must be converted whole");
+    }
+    const ConvertPlan p = MakePlan(dst_fmt, src_fmt);
+    SourceRow row = {src_row, nullptr, nullptr};
+    ConvertRow(p, dst_row, row, w, scale);
+}
+
+}
@@ -1,18 +1,31 @@
 #include <pangolin/log/packet.h>
+#include <pangolin/image/image_io_zstd.h>
 
 namespace pangolin {
 
+std::shared_ptr<std::vector<unsigned char>> DecompressPacket(const PacketStreamSource& src, const unsigned char* data, size_t size)
+{
+    ZstdOptions options;
+    options.dictionary = src.compression_dictionary;
+
+    const size_t decompressed_size = ZstdDecompressedSize(data, size);
+    PANGO_ENSURE(!src.data_size_bytes || decompressed_size == size_t(src.data_size_bytes), "Compressed packet of unexpected size. Stream may be corrupt.");
+    auto out = std::make_shared<std::vector<unsigned char>>(decompressed_size);
+    ZstdDecompress(data, size, out->data(), out->size(), options);
+    return out;
+}
 
-Packet::Packet(PacketStream& s, std::unique_lock<std::recursive_mutex>&& lock, std::vector<PacketStreamSource>& srcs)
-    : _stream(s), lock(std::move(lock))
+Packet::Packet(PacketStream& s, std::unique_lock<std::recursive_mutex>&& lock, std::vector<PacketStreamSource>& srcs,
+               const std::shared_ptr<MemoryMappedFile>& mapping)
+    : _stream(s), _mapping(mapping), lock(std::move(lock))
 {
     ParsePacketHeader(s, srcs);
 }
 
 Packet::Packet(Packet&& o)
     : src(o.src), time(o.time), size(o.size), sequence_num(o.sequence_num),
-      meta(std::move(o.meta)), frame_streampos(o.frame_streampos), _stream(o._stream),
-      lock(std::move(o.lock)), data_streampos(o.data_streampos), _data_len(o._data_len)
+      meta(std::move(o.meta)), binary_meta(std::move(o.binary_meta)), frame_streampos(o.frame_streampos), _stream(o._stream),
+      _mapping(std::move(o._mapping)), _decompressed(std::move(o._decompressed)), lock(std::move(o.lock)), data_streampos(o.data_streampos), _data_len(o._data_len)
 {
     o._data_len = 0;
 }
@@ -27,6 +40,26 @@ size_t Packet::BytesRead() const
     return _stream.tellg() - data_streampos;
 }
 
+unsigned char* Packet::Data() const
+{
+    if(_decompressed) {
+        return _decompressed->data();
+    }
+    return MappedData();
+}
+
+unsigned char* Packet::MappedData() const
+{
+    const size_t begin = (size_t)std::streamoff(data_streampos);
+    if(!_mapping || begin + _data_len > _mapping->size()) {
+        return nullptr;
+    }
+
+    // Let the OS fetch the next couple of packets whilst this one is consumed
+    _mapping->AdviseWillNeed(begin + _data_len, 2 * _data_len);
+    return _mapping->data() + begin;
+}
+
 int Packet::BytesRemaining() const
 {
     if(_data_len) {
@@ -41,10 +74,19 @@ void Packet::ParsePacketHeader(PacketStream& s, std::vector<PacketStreamSource>&
     size_t json_src = -1;
 
     frame_streampos = s.tellg();
+    if (s.peekTag() == TAG_SRC_META)
+    {
+        s.readTag(TAG_SRC_META);
+        json_src = s.readUINT();
+        binary_meta.resize(s.readUINT());
+        s.read(&binary_meta[0], binary_meta.size());
+    }
     if (s.peekTag() == TAG_SRC_JSON)
     {
         s.readTag(TAG_SRC_JSON);
-        json_src = s.readUINT();
+        const size_t src = s.readUINT();
+        PANGO_ENSURE(json_src == size_t(-1) || json_src == src, "Frame preceded by metadata for a mismatched source. Stream may be corrupt.");
+        json_src = src;
         picojson::parse(meta, s);
     }
 
@@ -56,7 +98,7 @@ void Packet::ParsePacketHeader(PacketStream& s, std::vector<PacketStreamSource>&
 
     PacketStreamSource& src_packet = srcs[src];
 
-    size = src_packet.data_size_bytes;
+    size = src_packet.StoredSizeBytes();
     if (!size) {
         size = s.readUINT();
     }
@@ -64,10 +106,27 @@ void Packet::ParsePacketHeader(PacketStream& s, std::vector<PacketStreamSource>&
 
     _data_len = size;
     data_streampos = s.tellg();
+
+    if (src_packet.Compressed()) {
+        if (const unsigned char* stored = MappedData()) {
+            _decompressed = DecompressPacket(src_packet, stored, _data_len);
+        } else {
+            std::vector<unsigned char> copy(_data_len);
+            s.read(reinterpret_cast<char*>(copy.data()), _data_len);
+            _decompressed = DecompressPacket(src_packet, copy.data(), _data_len);
+        }
+        size = _decompressed->size();
+    }
 }
 
 void Packet::ReadRemaining()
 {
+    if(_mapping && _data_len && Stream().seekable()) {
+        // Move past the data without pulling it through the stream buffer
+        Stream().seekg(data_streampos + std::streamoff(_data_len));
+        return;
+    }
+
     int bytes_left = BytesRemaining();
 
     while(bytes_left > 0 && Stream().good()) {
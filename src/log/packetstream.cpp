@@ -1,4 +1,5 @@
 #include <pangolin/log/packetstream.h>
+#include <cstdio>
 #include <stdexcept>
 
 namespace pangolin {
@@ -26,6 +27,24 @@ int64_t PacketStream::readTimestamp()
     return time_us;
 }
 
+std::string PacketStreamChunkFilename(const std::string& filename, size_t chunk)
+{
+    if(chunk == 0) {
+        return filename;
+    }
+
+    char seq[32];
+    snprintf(seq, sizeof(seq), ".%04zu", chunk);
+
+    // Only treat a dot within the final path component as an extension
+    const size_t slash = filename.find_last_of("/\\");
+    const size_t dot = filename.find_last_of('.');
+    if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return filename + seq;
+    }
+    return filename.substr(0, dot) + seq + filename.substr(dot);
+}
+
 pangoTagType PacketStream::readTag()
 {
     auto r = peekTag();
@@ -105,8 +124,11 @@ static bool valid(pangoTagType t)
     case TAG_PANGO_SYNC:
         case TAG_ADD_SOURCE:
         case TAG_SRC_JSON:
+        case TAG_SRC_META:
         case TAG_SRC_PACKET:
         case TAG_PANGO_STATS:
+        case TAG_PANGO_INDEX:
+        case TAG_PANGO_CHECKPOINT:
         case TAG_PANGO_FOOTER:
         case TAG_END:
         case TAG_PANGO_HDR:
@@ -128,7 +150,7 @@ pangoTagType PacketStream::syncToTag() //scan through chars one by one until the
     {
         buffer[0] = buffer[1];
         buffer[1] = buffer[2];
-        buffer[2] = get();
+        buffer[2] = Base::get();    // get() would clear _tag
     }
     while (good() && !valid(_tag));
 
@@ -25,6 +25,9 @@
 
 #include <pangolin/log/packetstream_reader.h>
 #include <pangolin/log/packetstream_writer.h>
+#include <pangolin/image/image_io_zstd.h>
+#include <pangolin/utils/base64.h>
+#include <pangolin/utils/parallel_for.h>
 
 using std::string;
 using std::istream;
@@ -35,7 +38,9 @@ using std::ios_base;
 using std::streampos;
 using std::streamoff;
 
-#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <future>
 
 #ifndef _WIN_
 #  include <unistd.h>
@@ -45,12 +50,12 @@ namespace pangolin
 {
 
 PacketStreamReader::PacketStreamReader()
-    : _pipe_fd(-1)
+    : _pipe_fd(-1), _memory_map(false), _chunk(0), _next_subscriber(0), _idle_generation(0), _clock_offset_us(0)
 {
 }
 
 PacketStreamReader::PacketStreamReader(const std::string& filename)
-    : _pipe_fd(-1)
+    : _pipe_fd(-1), _memory_map(false), _chunk(0), _next_subscriber(0), _idle_generation(0), _clock_offset_us(0)
 {
     Open(filename);
 }
@@ -66,8 +71,25 @@ void PacketStreamReader::Open(const std::string& filename)
 
     Close();
 
-    _filename = filename;
     _is_pipe = IsPipe(filename);
+    OpenFile(filename);
+
+    if(!SetupIndex()) {
+        FixFileIndex();
+    }
+
+    if(!_is_pipe && FindChunks()) {
+        IndexChunks();
+    }
+
+    if(_memory_map) {
+        MemoryMap();
+    }
+}
+
+void PacketStreamReader::OpenFile(const std::string& filename)
+{
+    _filename = filename;
     _stream.open(filename);
 
     if (!_stream.is_open())
@@ -88,9 +110,149 @@ void PacketStreamReader::Open(const std::string& filename)
         ParseNewSource();
     }
 
-    if(!SetupIndex()) {
-        FixFileIndex();
+    _data_start = _stream.tellg();
+}
+
+bool PacketStreamReader::FindChunks()
+{
+    const int64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(packet_stream_start.time_since_epoch()).count();
+
+    std::vector<Chunk> chunks = { {_filename, 0} };
+    for(size_t c = 1; ; ++c) {
+        const std::string filename = PacketStreamChunkFilename(_filename, c);
+        if(!FileExists(filename)) break;
+
+        // Only accept files which say they follow this one
+        PacketStream s(filename);
+        picojson::value header;
+        bool belongs = false;
+        try {
+            for (auto i : PANGO_MAGIC) {
+                if (s.get() != i) throw runtime_error("Unrecognised file header.");
+            }
+            s.readTag(TAG_PANGO_HDR);
+            picojson::parse(header, s);
+            belongs = header.get_value<int64_t>("chunk", 0) == (int64_t)c &&
+                      header.get_value<int64_t>("chunk_of", 0) == start_us;
+        }catch(const std::exception&) {
+        }
+        if(!belongs) break;
+
+        chunks.push_back({filename, 0});
+    }
+
+    if(chunks.size() == 1) {
+        return false;
+    }
+
+    _chunks = std::move(chunks);
+    _chunk = 0;
+    return true;
+}
+
+void PacketStreamReader::IndexChunks()
+{
+    const std::streampos pos = _stream.tellg();
+
+    _stream.clear();
+    _stream.seekg(0, ios_base::end);
+    std::streamoff base = _stream.tellg();
+    _stream.clear();
+    _stream.seekg(pos);
+
+    for(size_t c = 1; c < _chunks.size(); ++c) {
+        _chunks[c].base = base;
+
+        // Indexes (or repairs) each file on its own
+        PacketStreamReader chunk(_chunks[c].filename);
+        const std::vector<PacketStreamSource>& srcs = chunk.Sources();
+
+        if(_sources.size() < srcs.size()) {
+            for(size_t s = _sources.size(); s < srcs.size(); ++s) {
+                _sources.push_back(srcs[s]);
+                _sources.back().index.clear();
+                _sources.back().next_packet_id = 0;
+            }
+        }
+
+        for(size_t s = 0; s < srcs.size(); ++s) {
+            PacketStreamSource::PacketIndex& index = _sources[s].index;
+            for(size_t i = 0; i < srcs[s].index.size(); ++i) {
+                index.push_back({std::streampos(base + srcs[s].index.Pos(i)), srcs[s].index.Time(i)});
+            }
+        }
+
+        std::ifstream f(_chunks[c].filename, std::ios::binary | std::ios::ate);
+        base += std::streamoff(f.tellg());
+    }
+
+    pango_print_info("Reading '%s' and %zu rotated files as one log.\n", _filename.c_str(), _chunks.size() - 1);
+}
+
+void PacketStreamReader::OpenChunk(size_t chunk)
+{
+    // Keep the time of the set, not of this file
+    const SyncTime::TimePoint start = packet_stream_start;
+    const int64_t clock_offset_us = _clock_offset_us;
+
+    _mapping.reset();
+    _file_mapping.reset();
+    _chunk = chunk;
+    OpenFile(_chunks[chunk].filename);
+    packet_stream_start = start;
+    _clock_offset_us = clock_offset_us;
+
+    if(_memory_map) {
+        MemoryMap();
+    }
+}
+
+bool PacketStreamReader::NextChunk()
+{
+    if(_chunk + 1 < _chunks.size()) {
+        OpenChunk(_chunk + 1);
+        return true;
+    }
+    return false;
+}
+
+void PacketStreamReader::SeekIndexPos(int64_t pos)
+{
+    if(!_chunks.empty()) {
+        size_t c = _chunks.size() - 1;
+        while(c > 0 && _chunks[c].base > pos) --c;
+        if(c != _chunk) {
+            OpenChunk(c);
+        }
+        pos -= _chunks[c].base;
+    }
+
+    _stream.clear();
+    _stream.seekg(std::streampos(pos));
+}
+
+bool PacketStreamReader::MemoryMap()
+{
+    std::lock_guard<std::recursive_mutex> lg(_mutex);
+
+    _memory_map = true;
+    if(!_mapping) {
+        _mapping = FileMapping();
+        if(_mapping) _mapping->AdviseSequential();
+    }
+    return _mapping != nullptr;
+}
+
+std::shared_ptr<MemoryMappedFile> PacketStreamReader::FileMapping()
+{
+    if(!_file_mapping && _stream.seekable()) {
+        // Outstanding packets, leases and index views keep their own reference to the mapping.
+        auto mapping = std::make_shared<MemoryMappedFile>();
+        if(mapping->Open(_filename)) {
+            _file_mapping = mapping;
+        }
     }
+    return _file_mapping;
 }
 
 void PacketStreamReader::Close() {
@@ -98,6 +260,17 @@ void PacketStreamReader::Close() {
 
     _stream.close();
     _sources.clear();
+    _chunks.clear();
+    _chunk = 0;
+    _mapping.reset();
+    _file_mapping.reset();
+    ResetCursorLog();
+
+    for(auto& s : _subscribers) {
+        s.second.queue.clear();
+        s.second.next_id = 0;
+        s.second.read_id = 0;
+    }
 
 #ifndef _WIN_
     if (_pipe_fd != -1) {
@@ -117,6 +290,9 @@ void PacketStreamReader::ParseHeader()
     const int64_t start_us = json_header["time_us"].get<int64_t>();
     packet_stream_start = SyncTime::TimePoint() + std::chrono::microseconds(start_us);
 
+    // Written by nodes of a coordinated recording, 0 otherwise
+    _clock_offset_us = json_header.get_value<int64_t>("clock_offset_us", 0);
+
     _stream.get(); // consume newline
 }
 
@@ -143,6 +319,21 @@ void PacketStreamReader::ParseNewSource()
     pss.data_alignment_bytes = json[pss_src_packet][pss_pkt_alignment_bytes].get<int64_t>();
     pss.data_definitions = json[pss_src_packet][pss_pkt_definitions].get<string>();
     pss.data_size_bytes = json[pss_src_packet][pss_pkt_size_bytes].get<int64_t>();
+
+    const picojson::value& cmp = json[pss_src_packet][pss_pkt_compression];
+    if(cmp.is<picojson::object>()) {
+        pss.compression = cmp[pss_cmp_codec].get<string>();
+        if(pss.compression != "zstd") {
+            throw std::runtime_error("PacketStreamReader: unknown packet compression '" + pss.compression + "'");
+        }
+        pss.compression_level = (int)cmp[pss_cmp_level].get<int64_t>();
+        pss.data_size_bytes = cmp[pss_cmp_size_bytes].get<int64_t>();
+        if(cmp.contains(pss_cmp_dictionary)) {
+            pss.compression_dictionary = std::make_shared<ZstdDictionary>(
+                Base64Decode(cmp[pss_cmp_dictionary].get<string>())
+            );
+        }
+    }
 }
 
 bool PacketStreamReader::SetupIndex()
@@ -160,7 +351,7 @@ bool PacketStreamReader::SetupIndex()
         {
             //parsing the footer returns the index position
             _stream.seekg(ParseFooter());
-            if (_stream.peekTag() == TAG_PANGO_STATS) {
+            if (_stream.peekTag() == TAG_PANGO_STATS || _stream.peekTag() == TAG_PANGO_INDEX) {
                 // Read the pre-build index from the file
                 index_good = ParseIndex();
             }
@@ -184,6 +375,68 @@ streampos PacketStreamReader::ParseFooter() //returns position of index.
 }
 
 bool PacketStreamReader::ParseIndex()
+{
+    if(_stream.peekTag() == TAG_PANGO_INDEX) {
+        return ParseBinaryIndex();
+    }else{
+        // Older logs
+        return ParseJsonIndex();
+    }
+}
+
+bool PacketStreamReader::ParseBinaryIndex()
+{
+    _stream.readTag(TAG_PANGO_INDEX);
+
+    uint32_t version = 0;
+    uint32_t num_sources = 0;
+    _stream.read(reinterpret_cast<char*>(&version), sizeof(version));
+    _stream.read(reinterpret_cast<char*>(&num_sources), sizeof(num_sources));
+    if(!_stream.good() || version != PANGO_INDEX_VERSION) {
+        pango_print_warn("Unsupported packetstream index version %u.\n", version);
+        return false;
+    }
+
+    std::vector<uint64_t> num_packets(num_sources);
+    _stream.read(reinterpret_cast<char*>(num_packets.data()), num_sources * sizeof(uint64_t));
+
+    const uint64_t header_end = (uint64_t)std::streamoff(_stream.tellg());
+    _stream.skip((8 - header_end % 8) % 8);
+    const uint64_t columns_start = (uint64_t)std::streamoff(_stream.tellg());
+
+    uint64_t total_packets = 0;
+    for(uint64_t n : num_packets) total_packets += n;
+    const uint64_t columns_bytes = 2 * sizeof(int64_t) * total_packets;
+
+    // We shouldn't have seen more sources than exist in the index
+    PANGO_ENSURE(_sources.size() <= num_sources);
+    _sources.resize(num_sources);
+
+    std::shared_ptr<MemoryMappedFile> mapping = FileMapping();
+    const bool in_place = mapping && columns_start + columns_bytes <= mapping->size() &&
+        (reinterpret_cast<uintptr_t>(mapping->data() + columns_start) % alignof(int64_t)) == 0;
+
+    if(in_place) {
+        const int64_t* columns = reinterpret_cast<const int64_t*>(mapping->data() + columns_start);
+        for(size_t i=0; i < _sources.size(); ++i) {
+            _sources[i].index.SetView(columns, columns + num_packets[i], num_packets[i], mapping);
+            columns += 2 * num_packets[i];
+        }
+        _stream.seekg(std::streamoff(columns_start + columns_bytes), ios_base::beg);
+    }else{
+        for(size_t i=0; i < _sources.size(); ++i) {
+            std::vector<int64_t> pos(num_packets[i]);
+            std::vector<int64_t> time(num_packets[i]);
+            _stream.read(reinterpret_cast<char*>(pos.data()), pos.size() * sizeof(int64_t));
+            _stream.read(reinterpret_cast<char*>(time.data()), time.size() * sizeof(int64_t));
+            _sources[i].index.Assign(std::move(pos), std::move(time));
+        }
+    }
+
+    return _stream.good();
+}
+
+bool PacketStreamReader::ParseJsonIndex()
 {
     _stream.readTag(TAG_PANGO_STATS);
     picojson::value json;
@@ -206,11 +459,13 @@ bool PacketStreamReader::ParseIndex()
         // Populate index
         for(size_t i=0; i < _sources.size(); ++i) {
             PANGO_ENSURE(json_index[i].size() == json_times[i].size());
-            _sources[i].index.resize(json_index[i].size());
+            std::vector<int64_t> pos(json_index[i].size());
+            std::vector<int64_t> time(json_index[i].size());
             for(size_t f=0; f < json_index[i].size(); ++f) {
-                _sources[i].index[f].pos = json_index[i][f].get<int64_t>();
-                _sources[i].index[f].capture_time = json_times[i][f].get<int64_t>();
+                pos[f] = json_index[i][f].get<int64_t>();
+                time[f] = json_times[i][f].get<int64_t>();
             }
+            _sources[i].index.Assign(std::move(pos), std::move(time));
         }
     }
 
@@ -262,17 +517,35 @@ Packet PacketStreamReader::NextFrame()
         case TAG_PANGO_SYNC:
             SkipSync();
             break;
+        case TAG_PANGO_PAD:
+            SkipPadding();
+            break;
         case TAG_ADD_SOURCE:
             ParseNewSource();
             break;
+        case TAG_SRC_META:
         case TAG_SRC_JSON: //frames are sometimes preceded by metadata, but metadata must ALWAYS be followed by a frame from the same source.
         case TAG_SRC_PACKET:
-            return Packet(_stream, std::move(lock), _sources);
+            return Packet(_stream, std::move(lock), _sources, _mapping);
         case TAG_PANGO_STATS:
-            ParseIndex();
+        case TAG_PANGO_INDEX:
+            if(_chunks.empty()) {
+                ParseIndex();
+            }else if(!NextChunk()) {
+                // The set's index is already loaded, and covers every chunk
+                throw std::runtime_error("PacketStreamReader: end of stream");
+            }
+            break;
+        case TAG_PANGO_CHECKPOINT:
+        {
+            // Index is already complete up to here
+            uint64_t prev_pos;
+            ParseCheckpoint(prev_pos, false);
             break;
+        }
         case TAG_PANGO_FOOTER: //end of frames
         case TAG_END:
+            if(NextChunk()) break;
             throw std::runtime_error("PacketStreamReader: end of stream");
         case TAG_PANGO_HDR: //shoudln't encounter this
             ParseHeader();
@@ -303,44 +576,824 @@ Packet PacketStreamReader::NextFrame(PacketStreamSourceId src)
     }
 }
 
-void PacketStreamReader::RebuildIndex()
+size_t PacketStreamReader::Subscribe(PacketStreamSourceId src, size_t max_queue)
 {
     lock_guard<decltype(_mutex)> lg(_mutex);
+    PANGO_ASSERT(src < _sources.size());
 
-    if(_stream.seekable()) {
-        pango_print_warn("Index for '%s' bad / outdated. Rebuilding.\n", _filename.c_str());
+    Subscriber& sub = _subscribers[_next_subscriber];
+    sub.src = src;
+    sub.max_queue = std::max<size_t>(1, max_queue);
+    sub.next_id = _sources[src].next_packet_id;
+    sub.read_id = sub.next_id;
+    return _next_subscriber++;
+}
 
-        // Save current position
-        std::streampos pos = _stream.tellg();
+void PacketStreamReader::Unsubscribe(size_t subscriber)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+    _subscribers.erase(subscriber);
+}
 
-        // Clear existing index
-        for(PacketStreamSource& s : _sources) {
-            s.index.clear();
-            s.next_packet_id = 0;
+void PacketStreamReader::Dispatch(Packet& packet)
+{
+    QueuedPacket queued;
+    for(auto& s : _subscribers) {
+        Subscriber& sub = s.second;
+        // Packets before read_id were queued before a rewind, or seeked past
+        if(sub.src != packet.src || packet.sequence_num < sub.read_id) continue;
+
+        if(!queued.owner) {
+            queued.src = packet.src;
+            queued.time = packet.time;
+            queued.size = packet.size;
+            queued.sequence_num = packet.sequence_num;
+            queued.meta = packet.meta;
+            queued.binary_meta = packet.binary_meta;
+            if(unsigned char* data = packet.Data()) {
+                queued.data = data;
+                queued.owner = packet.Owner();
+            }else{
+                auto copy = std::make_shared<std::vector<unsigned char>>(packet.size);
+                packet.Stream().read(reinterpret_cast<char*>(copy->data()), packet.size);
+                queued.data = copy->data();
+                queued.owner = copy;
+            }
+        }
+
+        if(sub.queue.size() == sub.max_queue) {
+            sub.queue.pop_front();
+        }
+        sub.queue.push_back(queued);
+        sub.read_id = packet.sequence_num + 1;
+    }
+}
+
+QueuedPacket PacketStreamReader::NextSubscribedFrame(size_t subscriber)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+    Subscriber& sub = _subscribers.at(subscriber);
+
+    while(sub.queue.empty()) {
+        // This will throw if nothing is left.
+        Packet fi = NextFrame();
+        Dispatch(fi);
+    }
+
+    QueuedPacket queued = std::move(sub.queue.front());
+    sub.queue.pop_front();
+    sub.next_id = queued.sequence_num + 1;
+    return queued;
+}
+
+size_t PacketStreamReader::NextPacketId(size_t subscriber)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+    return _subscribers.at(subscriber).next_id;
+}
+
+struct PacketStreamCursorLog
+{
+    struct File
+    {
+        std::string filename;
+        int64_t base;       // position of the file within the index
+        std::shared_ptr<MemoryMappedFile> mapping;
+    };
+
+    std::vector<File> files;
+    std::vector<PacketStreamSource> sources;
+};
+
+PacketStreamCursor PacketStreamReader::Cursor(PacketStreamSourceId src)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+    PANGO_ASSERT(_stream.seekable());
+    PANGO_ASSERT(src < _sources.size());
+
+    if(!_cursor_log) {
+        auto log = std::make_shared<PacketStreamCursorLog>();
+        if(_chunks.empty()) {
+            log->files.push_back({_filename, 0, nullptr});
+        }else{
+            for(const Chunk& c : _chunks) {
+                log->files.push_back({c.filename, int64_t(c.base), nullptr});
+            }
+        }
+        for(PacketStreamCursorLog::File& f : log->files) {
+            auto mapping = std::make_shared<MemoryMappedFile>();
+            if(mapping->Open(f.filename)) {
+                f.mapping = mapping;
+            }
+        }
+        // Views of a mapped index are shared rather than copied
+        log->sources = _sources;
+        _cursor_log = log;
+    }
+
+    return PacketStreamCursor(_cursor_log, src);
+}
+
+void PacketStreamReader::ResetCursorLog()
+{
+    _cursor_log.reset();
+
+    std::lock_guard<std::mutex> l(_idle_mutex);
+    _idle_cursors.clear();
+    ++_idle_generation;
+}
+
+QueuedPacket PacketStreamReader::ReadPacket(PacketStreamSourceId src, size_t packet_id)
+{
+    std::unique_ptr<PacketStreamCursor> cursor;
+    size_t generation;
+    {
+        std::lock_guard<std::mutex> l(_idle_mutex);
+        generation = _idle_generation;
+        std::vector<std::unique_ptr<PacketStreamCursor>>& idle = _idle_cursors[src];
+        if(!idle.empty()) {
+            cursor = std::move(idle.back());
+            idle.pop_back();
+        }
+    }
+    if(!cursor) {
+        cursor.reset(new PacketStreamCursor(Cursor(src)));
+    }
+
+    QueuedPacket p = cursor->Read(packet_id);
+
+    // Cursors of an index replaced meanwhile are dropped
+    std::lock_guard<std::mutex> l(_idle_mutex);
+    if(generation == _idle_generation) {
+        _idle_cursors[src].push_back(std::move(cursor));
+    }
+    return p;
+}
+
+std::vector<QueuedPacket> PacketStreamReader::ReadPackets(PacketStreamSourceId src, const std::vector<size_t>& packet_ids)
+{
+    std::vector<size_t> order(packet_ids.size());
+    {
+        lock_guard<decltype(_mutex)> lg(_mutex);
+        PANGO_ASSERT(src < _sources.size());
+        const PacketStreamSource::PacketIndex& index = _sources[src].index;
+        for(size_t i=0; i < packet_ids.size(); ++i) {
+            if(packet_ids[i] >= index.size()) {
+                throw std::runtime_error("PacketStreamReader: no such packet");
+            }
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+            return index.Pos(packet_ids[a]) < index.Pos(packet_ids[b]);
+        });
+    }
+
+    std::vector<QueuedPacket> packets(packet_ids.size());
+    for(size_t i : order) {
+        packets[i] = ReadPacket(src, packet_ids[i]);
+    }
+    return packets;
+}
+
+namespace {
+
+// Packet header reading from a mapped file, as PacketStream reads a stream
+struct MappedPacketInput
+{
+    const unsigned char* pos;
+    const unsigned char* end;
+
+    void Need(size_t n)
+    {
+        if(size_t(end - pos) < n) {
+            throw std::runtime_error("PacketStreamCursor: packet runs past the end of the log");
+        }
+    }
+
+    pangoTagType PeekTag()
+    {
+        pangoTagType tag = 0;
+        if(size_t(end - pos) < TAG_LENGTH) return TAG_END;
+        std::memcpy(&tag, pos, TAG_LENGTH);
+        return tag;
+    }
+
+    void ReadTag(pangoTagType tag)
+    {
+        if(PeekTag() != tag) {
+            throw std::runtime_error("PacketStreamCursor: expected tag '" + tagName(tag) + "', found '" + tagName(PeekTag()) + "'");
+        }
+        pos += TAG_LENGTH;
+    }
+
+    size_t ReadUINT()
+    {
+        size_t n = 0;
+        uint32_t shift = 0;
+        while(true) {
+            Need(1);
+            const size_t v = *pos++;
+            n |= (v & 0x7F) << shift;
+            if(!(v & 0x80)) return n;
+            shift += 7;
+        }
+    }
+
+    int64_t ReadTimestamp()
+    {
+        int64_t time_us;
+        Read(reinterpret_cast<char*>(&time_us), sizeof(time_us));
+        return time_us;
+    }
+
+    void Read(char* target, size_t len)
+    {
+        Need(len);
+        std::memcpy(target, pos, len);
+        pos += len;
+    }
+
+    void ParseJson(picojson::value& v)
+    {
+        const char* p = reinterpret_cast<const char*>(pos);
+        const std::string err = picojson::parse(v, p, reinterpret_cast<const char*>(end));
+        if(!err.empty()) {
+            throw std::runtime_error("PacketStreamCursor: bad packet metadata: " + err);
+        }
+        pos = reinterpret_cast<const unsigned char*>(p);
+    }
+};
+
+// As above, through a cursor's own PacketStream
+struct StreamPacketInput
+{
+    PacketStream& s;
+
+    pangoTagType PeekTag() { return s.peekTag(); }
+    void ReadTag(pangoTagType tag) { s.readTag(tag); }
+    size_t ReadUINT() { return s.readUINT(); }
+    int64_t ReadTimestamp() { return s.readTimestamp(); }
+    void Read(char* target, size_t len) { s.read(target, len); }
+    void ParseJson(picojson::value& v) { picojson::parse(v, s); }
+};
+
+// Parse the header of a packet of src, as Packet::ParsePacketHeader()
+template<typename Input>
+void ParseCursorPacket(Input& in, PacketStreamSourceId src, int64_t stored_size, QueuedPacket& p)
+{
+    if(in.PeekTag() == TAG_SRC_META) {
+        in.ReadTag(TAG_SRC_META);
+        in.ReadUINT();
+        p.binary_meta.resize(in.ReadUINT());
+        in.Read(&p.binary_meta[0], p.binary_meta.size());
+    }
+    if(in.PeekTag() == TAG_SRC_JSON) {
+        in.ReadTag(TAG_SRC_JSON);
+        in.ReadUINT();
+        in.ParseJson(p.meta);
+    }
+
+    in.ReadTag(TAG_SRC_PACKET);
+    p.time = in.ReadTimestamp();
+    p.src = in.ReadUINT();
+    if(p.src != src) {
+        throw std::runtime_error("PacketStreamCursor: index doesn't match the log. Stream may be corrupt.");
+    }
+    p.size = stored_size ? size_t(stored_size) : in.ReadUINT();
+}
+
+}
+
+PacketStreamCursor::PacketStreamCursor(const std::shared_ptr<const PacketStreamCursorLog>& log, PacketStreamSourceId src)
+    : _log(log), _src(src), _next_id(0)
+{
+    _streams.resize(_log->files.size());
+}
+
+PacketStreamCursor::~PacketStreamCursor()
+{
+}
+
+size_t PacketStreamCursor::NumPackets() const
+{
+    return _log->sources[_src].index.size();
+}
+
+void PacketStreamCursor::Seek(size_t packet_id)
+{
+    _next_id = std::min(packet_id, NumPackets());
+}
+
+size_t PacketStreamCursor::Seek(SyncTime::TimePoint time)
+{
+    const int64_t time_us = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    _next_id = _log->sources[_src].index.LowerBoundTime(time_us);
+    return _next_id;
+}
+
+QueuedPacket PacketStreamCursor::Next()
+{
+    if(AtEnd()) {
+        throw std::runtime_error("PacketStreamCursor: end of stream");
+    }
+    QueuedPacket p = Read(_next_id);
+    ++_next_id;
+    return p;
+}
+
+QueuedPacket PacketStreamCursor::Read(size_t packet_id)
+{
+    const PacketStreamSource& source = _log->sources[_src];
+    const PacketStreamSource::PacketIndex& index = source.index;
+    if(packet_id >= index.size()) {
+        throw std::runtime_error("PacketStreamCursor: no such packet");
+    }
+
+    // Find the file of a rotated log holding the packet
+    int64_t pos = index.Pos(packet_id);
+    size_t f = _log->files.size() - 1;
+    while(f > 0 && _log->files[f].base > pos) --f;
+    const PacketStreamCursorLog::File& file = _log->files[f];
+    pos -= file.base;
+
+    QueuedPacket p;
+    p.sequence_num = packet_id;
+
+    if(file.mapping) {
+        const MemoryMappedFile& m = *file.mapping;
+        if(pos < 0 || size_t(pos) >= m.size()) {
+            throw std::runtime_error("PacketStreamCursor: index points outside of the log");
+        }
+        MappedPacketInput in = { m.data() + pos, m.data() + m.size() };
+        ParseCursorPacket(in, _src, source.StoredSizeBytes(), p);
+        in.Need(p.size);
+        m.AdviseWillNeed(size_t(in.pos - m.data()) + p.size, 2 * p.size);
+        if(source.Compressed()) {
+            auto decompressed = DecompressPacket(source, in.pos, p.size);
+            p.size = decompressed->size();
+            p.data = decompressed->data();
+            p.owner = decompressed;
+        }else{
+            p.data = const_cast<unsigned char*>(in.pos);
+            p.owner = file.mapping;
+        }
+    }else{
+        std::unique_ptr<PacketStream>& s = _streams[f];
+        if(!s) {
+            s.reset(new PacketStream(file.filename));
+            if(!s->is_open()) {
+                s.reset();
+                throw std::runtime_error("PacketStreamCursor: cannot open " + file.filename);
+            }
+        }
+        s->clear();
+        s->seekg(std::streampos(pos));
+        StreamPacketInput in = { *s };
+        ParseCursorPacket(in, _src, source.StoredSizeBytes(), p);
+
+        auto copy = std::make_shared<std::vector<unsigned char>>(p.size);
+        if(s->read(reinterpret_cast<char*>(copy->data()), p.size) != p.size) {
+            throw std::runtime_error("PacketStreamCursor: packet runs past the end of the log");
+        }
+        if(source.Compressed()) {
+            copy = DecompressPacket(source, copy->data(), copy->size());
+            p.size = copy->size();
+        }
+        p.data = copy->data();
+        p.owner = copy;
+    }
+
+    return p;
+}
+
+namespace {
+
+// A tag met scanning part of a log, in stream order
+struct ScanItem
+{
+    int64_t pos;
+    int64_t time;
+    size_t src;     // source of a packet, or one of the values below
+    static const size_t not_packet = size_t(-1);
+    static const size_t add_source = size_t(-2);
+};
+
+// Unbroken run of tags, each found by parsing the one before
+struct ScanResult
+{
+    std::vector<ScanItem> items;
+    int64_t stop;   // position of the first tag not scanned
+    bool at_end;    // no more packets follow
+};
+
+// Walk the tags of a log from 'from' until one at or after 'to'. If resync is set,
+// 'from' needn't be at a tag and the scan starts at the next thing which looks like one.
+// sizes holds the fixed packet size of each known source (0 if sent per packet, -1 if
+// unknown) and is extended by sources added along the way. The scan stops early at a
+// packet of an unknown source, or anything which doesn't parse.
+ScanResult ScanTags(PacketStream& s, int64_t from, int64_t to, bool resync, std::vector<int64_t>& sizes)
+{
+    ScanResult r = { {}, from, false };
+
+    s.clear();
+    if(resync) {
+        // syncToTag tests for a tag from one byte after where it starts
+        s.seekg(std::streampos(from - 1));
+        s.syncToTag();
+    }else{
+        s.seekg(std::streampos(from));
+    }
+
+    while(true) {
+        const pangoTagType t = s.peekTag();
+        if(t == TAG_END || !s.good()) {
+            r.at_end = true;
+            return r;
+        }
+
+        const int64_t pos = std::streamoff(s.tellg());
+        r.stop = pos;
+        if(pos >= to) {
+            return r;
         }
 
-        // Read through entire file, updating index
         try{
-            while (1)
+            switch(t)
+            {
+            case TAG_SRC_META:
+            case TAG_SRC_JSON:
+            case TAG_SRC_PACKET:
+            {
+                size_t json_src = ScanItem::not_packet;
+                if(s.peekTag() == TAG_SRC_META) {
+                    s.readTag(TAG_SRC_META);
+                    json_src = s.readUINT();
+                    const size_t meta_size = s.readUINT();
+                    s.seekg(s.tellg() + std::streamoff(meta_size));
+                }
+                if(s.peekTag() == TAG_SRC_JSON) {
+                    s.readTag(TAG_SRC_JSON);
+                    const size_t src = s.readUINT();
+                    if(json_src != ScanItem::not_packet && json_src != src) {
+                        return r;
+                    }
+                    json_src = src;
+                    picojson::value meta;
+                    picojson::parse(meta, s);
+                }
+                s.readTag(TAG_SRC_PACKET);
+                const int64_t time = s.readTimestamp();
+                const size_t src = s.readUINT();
+                if(!s.good()) {
+                    r.at_end = true;
+                    return r;
+                }
+                if(src >= sizes.size() || sizes[src] < 0 || (json_src != ScanItem::not_packet && json_src != src)) {
+                    return r;
+                }
+                const size_t size = sizes[src] ? (size_t)sizes[src] : s.readUINT();
+                r.items.push_back({pos, time, src});
+                // Jump over the data rather than reading it through
+                s.seekg(s.tellg() + std::streamoff(size));
+                break;
+            }
+            case TAG_ADD_SOURCE:
             {
-                // This will throw if we've run out of frames
-                auto fi = NextFrame();
-                PacketStreamSource& s = _sources[fi.src];
-                PANGO_ENSURE(s.index.size() == fi.sequence_num);
-                s.index.push_back({fi.frame_streampos, fi.time});
+                s.readTag(TAG_ADD_SOURCE);
+                picojson::value json;
+                picojson::parse(json, s);
+                s.get();
+                const size_t src_id = json[pss_src_id].get<int64_t>();
+                if(sizes.size() <= src_id) {
+                    sizes.resize(src_id + 1, -1);
+                }
+                sizes[src_id] = json[pss_src_packet][pss_pkt_size_bytes].get<int64_t>();
+                r.items.push_back({pos, 0, ScanItem::add_source});
+                break;
             }
-        }catch(...){
+            case TAG_PANGO_CHECKPOINT:
+            {
+                s.readTag(TAG_PANGO_CHECKPOINT);
+                uint32_t num_sources = 0;
+                s.skip(2 * sizeof(uint64_t));
+                s.read(reinterpret_cast<char*>(&num_sources), sizeof(num_sources));
+                std::vector<uint64_t> counts(2 * num_sources);
+                s.read(reinterpret_cast<char*>(counts.data()), counts.size() * sizeof(uint64_t));
+                uint64_t total_packets = 0;
+                for(uint32_t i = 0; i < num_sources; ++i) total_packets += counts[num_sources + i];
+                s.seekg(s.tellg() + std::streamoff(2 * sizeof(int64_t) * total_packets));
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            }
+            case TAG_PANGO_HDR:
+            {
+                s.readTag(TAG_PANGO_HDR);
+                picojson::value header;
+                picojson::parse(header, s);
+                s.get();
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            }
+            case TAG_PANGO_MAGIC:
+                s.readTag(TAG_PANGO_MAGIC);
+                s.skip(2);
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            case TAG_PANGO_SYNC:
+                s.readTag(TAG_PANGO_SYNC);
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            case TAG_PANGO_PAD:
+            {
+                s.readTag(TAG_PANGO_PAD);
+                const size_t pad = s.readUINT();
+                s.seekg(s.tellg() + std::streamoff(pad));
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            }
+            case TAG_PANGO_STATS:
+            case TAG_PANGO_INDEX:
+            case TAG_PANGO_FOOTER:
+                r.at_end = true;
+                return r;
+            default:
+                s.syncToTag();
+                r.items.push_back({pos, 0, ScanItem::not_packet});
+                break;
+            }
+        }catch(const std::exception&) {
+            return r;
         }
+    }
+}
 
-        // Reset Packet id's
-        for(PacketStreamSource& s : _sources) {
-            s.next_packet_id = 0;
+// Scan a byte range starting at an arbitrary position. Where a run of tags breaks off
+// (most likely having synced to something in packet data) resync after it, and so on
+// to the end of the range.
+std::vector<ScanResult> ScanRange(const std::string& filename, int64_t from, int64_t to, std::vector<int64_t> sizes)
+{
+    PacketStream s(filename);
+    std::vector<ScanResult> runs;
+    while(from < to) {
+        runs.push_back(ScanTags(s, from, to, true, sizes));
+        if(runs.back().stop >= to || !s.good()) break;
+        from = runs.back().stop + 1;
+    }
+    return runs;
+}
+
+}
+
+void PacketStreamReader::RebuildIndex(size_t num_threads)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+
+    // Rotated files are each indexed on their own
+    if(!_stream.seekable() || !_chunks.empty()) {
+        return;
+    }
+
+    pango_print_warn("Index for '%s' bad / outdated. Rebuilding.\n", _filename.c_str());
+    ResetCursorLog();
+
+    // Save current position
+    const std::streampos pos = _stream.tellg();
+
+    // Sources only named by a loaded index can't be parsed until their definition is met again
+    while(!_sources.empty() && _sources.back().id == size_t(-1)) {
+        _sources.pop_back();
+    }
+
+    // Clear existing index
+    for(PacketStreamSource& s : _sources) {
+        s.index.clear();
+        s.next_packet_id = 0;
+    }
+
+    // Only read through the file beyond the last checkpoint if there is one.
+    std::streampos resume_pos = LoadIndexCheckpoints();
+    if(resume_pos == std::streampos(-1)) {
+        resume_pos = _data_start;
+    }
+    const int64_t begin = std::streamoff(resume_pos);
+
+    _stream.clear();
+    _stream.seekg(0, ios_base::end);
+    const int64_t file_size = std::streamoff(_stream.tellg());
+
+    // Smaller ranges aren't worth a thread
+    const int64_t min_range_bytes = int64_t(64) << 20;
+    if(num_threads == 0) {
+        num_threads = ParallelConcurrency();
+    }
+    const size_t num_ranges = (size_t)std::max<int64_t>(1, std::min<int64_t>(num_threads, (file_size - begin) / min_range_bytes));
+
+    std::vector<int64_t> bounds(num_ranges + 1);
+    for(size_t r = 0; r <= num_ranges; ++r) {
+        bounds[r] = begin + (file_size - begin) * (int64_t)r / (int64_t)num_ranges;
+    }
+
+    auto source_sizes = [this]() {
+        std::vector<int64_t> sizes;
+        for(const PacketStreamSource& s : _sources) sizes.push_back(s.StoredSizeBytes());
+        return sizes;
+    };
+
+    // Every range but the first starts mid packet, so is scanned by a worker which
+    // resyncs to tags in the hope of joining up with the previous range. Workers only
+    // know the sources added before their range, and break off at packets of any others.
+    std::vector<std::vector<ScanResult>> ranges(num_ranges);
+    std::vector<std::future<void>> workers;
+    for(size_t r = 1; r < num_ranges; ++r) {
+        workers.push_back(ParallelAsync([&, r, sizes = source_sizes()]() {
+            ranges[r] = ScanRange(_filename, bounds[r], bounds[r+1], sizes);
+        }));
+    }
+
+    int64_t next = begin;
+    bool at_end = false;
+
+    // Add scanned items to the index, returning false at one which doesn't agree
+    // with the sources seen so far, with next left at it.
+    auto append = [&](const std::vector<ScanItem>& items, size_t first) {
+        for(size_t i = first; i < items.size(); ++i) {
+            const ScanItem& item = items[i];
+            if(item.src == ScanItem::add_source) {
+                _stream.clear();
+                _stream.seekg(std::streampos(item.pos));
+                ParseNewSource();
+            }else if(item.src != ScanItem::not_packet) {
+                if(item.src >= _sources.size()) {
+                    next = item.pos;
+                    return false;
+                }
+                _sources[item.src].index.push_back({std::streampos(item.pos), item.time});
+            }
         }
+        return true;
+    };
+
+    // Scan on this thread from a known tag to the end of range r
+    auto scan_to = [&](size_t r) {
+        while(!at_end && next < bounds[r+1]) {
+            std::vector<int64_t> sizes = source_sizes();
+            const ScanResult run = ScanTags(_stream, next, bounds[r+1], false, sizes);
+            append(run.items, 0);
+            // Anything which doesn't parse from a known tag ends the log, as it would reading sequentially
+            at_end = run.at_end || run.stop == next;
+            next = run.stop;
+        }
+    };
+
+    scan_to(0);
+
+    for(std::future<void>& w : workers) {
+        ParallelWait(w);
+    }
+
+    // Stitch ranges together where the index so far leads to a tag found by the worker,
+    // scanning here whatever the worker couldn't account for.
+    for(size_t r = 1; r < num_ranges && !at_end; ++r) {
+        for(const ScanResult& run : ranges[r]) {
+            if(next >= bounds[r+1] || run.stop <= next) continue;
+            auto it = std::lower_bound(run.items.begin(), run.items.end(), next,
+                [](const ScanItem& item, int64_t p) { return item.pos < p; });
+            if(it != run.items.end() && it->pos == next && append(run.items, it - run.items.begin())) {
+                next = run.stop;
+                at_end = run.at_end;
+            }
+            break;
+        }
+        scan_to(r);
+    }
+
+    // Reset Packet id's
+    for(PacketStreamSource& s : _sources) {
+        s.next_packet_id = 0;
+    }
+
+    // Restore previous location
+    _stream.clear();
+    _stream.seekg(pos);
+}
+
+bool PacketStreamReader::ParseCheckpoint(uint64_t& prev_pos, bool append)
+{
+    _stream.readTag(TAG_PANGO_CHECKPOINT);
+
+    uint64_t pos = 0;
+    uint32_t num_sources = 0;
+    _stream.read(reinterpret_cast<char*>(&pos), sizeof(pos));
+    _stream.read(reinterpret_cast<char*>(&prev_pos), sizeof(prev_pos));
+    _stream.read(reinterpret_cast<char*>(&num_sources), sizeof(num_sources));
+
+    std::vector<uint64_t> first_packet(num_sources);
+    std::vector<uint64_t> num_packets(num_sources);
+    _stream.read(reinterpret_cast<char*>(first_packet.data()), num_sources * sizeof(uint64_t));
+    _stream.read(reinterpret_cast<char*>(num_packets.data()), num_sources * sizeof(uint64_t));
+    if(!_stream.good()) return false;
+
+    if(!append) {
+        uint64_t total_packets = 0;
+        for(uint64_t n : num_packets) total_packets += n;
+        _stream.skip(2 * sizeof(int64_t) * total_packets);
+        return _stream.good();
+    }
+
+    // Sources introduced mid-stream would be missed by resuming past them.
+    if(num_sources > _sources.size()) return false;
+
+    for(size_t s=0; s < num_sources; ++s) {
+        PacketStreamSource::PacketIndex& index = _sources[s].index;
+        if(first_packet[s] != index.size()) return false;
+
+        std::vector<int64_t> pos(num_packets[s]);
+        std::vector<int64_t> time(num_packets[s]);
+        _stream.read(reinterpret_cast<char*>(pos.data()), pos.size() * sizeof(int64_t));
+        _stream.read(reinterpret_cast<char*>(time.data()), time.size() * sizeof(int64_t));
+        for(size_t i=0; i < pos.size(); ++i) {
+            index.push_back({std::streampos(pos[i]), time[i]});
+        }
+    }
+    return _stream.good();
+}
+
+std::streampos PacketStreamReader::FindLastCheckpoint()
+{
+    // Checkpoints are written at least every 64MB by default. Give up looking well beyond that.
+    const std::streamoff max_search = std::streamoff(1) << 30;
+    const std::streamoff chunk = 1 << 20;
+    const std::streamoff header = TAG_LENGTH + sizeof(uint64_t);
+
+    _stream.clear();
+    _stream.seekg(0, ios_base::end);
+    const std::streamoff file_size = _stream.tellg();
+
+    std::vector<char> buffer;
+    for(std::streamoff end = file_size; end > 0 && file_size - end < max_search; end -= chunk) {
+        // Overlap chunks so we find tags (and their self position) which straddle them
+        const std::streamoff begin = std::max<std::streamoff>(0, end - chunk);
+        const std::streamoff len = std::min(end + header, file_size) - begin;
+        buffer.resize(len);
 
-        // Restore previous location
         _stream.clear();
-        _stream.seekg(pos);
+        _stream.seekg(begin, ios_base::beg);
+        if(_stream.read(buffer.data(), len) != (size_t)len) break;
+
+        for(std::streamoff i = std::min(end - begin, len - header); i-- > 0; ) {
+            pangoTagType tag = 0;
+            std::memcpy(&tag, &buffer[i], TAG_LENGTH);
+            if(tag == TAG_PANGO_CHECKPOINT) {
+                uint64_t pos = 0;
+                std::memcpy(&pos, &buffer[i + TAG_LENGTH], sizeof(pos));
+                if(pos == uint64_t(begin + i)) {
+                    return std::streampos(begin + i);
+                }
+            }
+        }
+    }
+
+    return std::streampos(-1);
+}
+
+std::streampos PacketStreamReader::LoadIndexCheckpoints()
+{
+    const std::streampos last = FindLastCheckpoint();
+    if(last == std::streampos(-1)) {
+        return last;
+    }
+
+    // Walk back through the chain, then load it forwards.
+    std::vector<uint64_t> chain;
+    for(uint64_t pos = (uint64_t)std::streamoff(last); pos; ) {
+        chain.push_back(pos);
+        _stream.clear();
+        _stream.seekg(std::streampos(pos));
+        uint64_t prev_pos = 0;
+        if(_stream.peekTag() != TAG_PANGO_CHECKPOINT || !ParseCheckpoint(prev_pos, false) || prev_pos >= pos) {
+            return std::streampos(-1);
+        }
+        pos = prev_pos;
+    }
+
+    bool good = true;
+    for(auto it = chain.rbegin(); good && it != chain.rend(); ++it) {
+        _stream.clear();
+        _stream.seekg(std::streampos(*it));
+        uint64_t prev_pos = 0;
+        good = ParseCheckpoint(prev_pos, true);
+    }
+
+    if(!good) {
+        for(PacketStreamSource& s : _sources) {
+            s.index.clear();
+        }
+        _stream.clear();
+        return std::streampos(-1);
     }
+
+    pango_print_info("Recovered index of '%s' from %zu checkpoints.\n", _filename.c_str(), chain.size());
+    return _stream.tellg();
 }
 
 void PacketStreamReader::AppendIndex()
@@ -353,19 +1406,19 @@ void PacketStreamReader::AppendIndex()
         if(of.is_open()) {
             pango_print_warn("Appending new index to '%s'.\n", _filename.c_str());
             uint64_t indexpos = (uint64_t)of.tellp();
-            writeTag(of, TAG_PANGO_STATS);
-            SourceStats(_sources).serialize(std::ostream_iterator<char>(of), false);
+            writeBinaryIndex(of, _sources, indexpos);
             writeTag(of, TAG_PANGO_FOOTER);
             of.write(reinterpret_cast<char*>(&indexpos), sizeof(uint64_t));
         }
     }
 }
 
-void PacketStreamReader::FixFileIndex()
+void PacketStreamReader::FixFileIndex(size_t num_threads)
 {
-    if(_stream.seekable())
+    // Rotated files are each fixed as they're indexed on open
+    if(_stream.seekable() && _chunks.empty())
     {
-        RebuildIndex();
+        RebuildIndex(num_threads);
         AppendIndex();
     }
 }
@@ -379,39 +1432,90 @@ size_t PacketStreamReader::Seek(PacketStreamSourceId src, size_t framenum)
     PacketStreamSource& source = _sources[src];
     PANGO_ASSERT(framenum < source.index.size());
 
-    if(source.index[framenum].pos > 0) {
-        _stream.clear();
-        _stream.seekg(source.index[framenum].pos);
+    if(source.index.Pos(framenum) > 0) {
+        SeekIndexPos(source.index.Pos(framenum));
         source.next_packet_id = framenum;
     }
     return source.next_packet_id;
 }
 
+size_t PacketStreamReader::SeekSubscriber(size_t subscriber, size_t framenum)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+
+    PANGO_ASSERT(_stream.seekable());
+    Subscriber& sub = _subscribers.at(subscriber);
+    PANGO_ASSERT(framenum < _sources[sub.src].index.size());
+
+    sub.queue.clear();
+    sub.next_id = framenum;
+    sub.read_id = framenum;
+
+    // Rewind to the earliest packet any subscriber has still to queue
+    int64_t pos = -1;
+    for(const auto& s : _subscribers) {
+        const PacketStreamSource::PacketIndex& index = _sources[s.second.src].index;
+        if(s.second.read_id < index.size() && (pos < 0 || index.Pos(s.second.read_id) < pos)) {
+            pos = index.Pos(s.second.read_id);
+        }
+    }
+
+    const int64_t current = (_chunks.empty() ? 0 : _chunks[_chunk].base) + std::streamoff(_stream.tellg());
+    if(pos > 0 && pos != current) {
+        SeekIndexPos(pos);
+
+        // Renumber every source from the new position
+        for(PacketStreamSource& source : _sources) {
+            size_t lo = 0, hi = source.index.size();
+            while(lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                if(source.index.Pos(mid) < pos) lo = mid + 1; else hi = mid;
+            }
+            source.next_packet_id = lo;
+        }
+    }
+    return framenum;
+}
+
+size_t PacketStreamReader::SeekSubscriber(size_t subscriber, SyncTime::TimePoint time)
+{
+    lock_guard<decltype(_mutex)> lg(_mutex);
+    const Subscriber& sub = _subscribers.at(subscriber);
+    const PacketStreamSource& source = _sources[sub.src];
+
+    const int64_t time_us = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    const size_t frame_num = source.index.LowerBoundTime(time_us);
+
+    if(frame_num < source.index.size()) {
+        return SeekSubscriber(subscriber, frame_num);
+    }else{
+        return sub.next_id;
+    }
+}
+
 // Jumps to the first packet with time >= time
 size_t PacketStreamReader::Seek(PacketStreamSourceId src, SyncTime::TimePoint time)
 {
     PacketStreamSource& source = _sources[src];
 
-    PacketStreamSource::PacketInfo v = {
-        0, std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count()
-    };
+    const int64_t time_us = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
 
-    // Find time in indextime
-    auto lb = std::lower_bound(
-        source.index.begin(), source.index.end(), v,
-        [](const PacketStreamSource::PacketInfo& a, const PacketStreamSource::PacketInfo& b){
-            return a.capture_time < b.capture_time;
-        }
-    );
+    // Find time in index
+    const size_t frame_num = source.index.LowerBoundTime(time_us);
 
-    if(lb != source.index.end()) {
-        const size_t frame_num = lb - source.index.begin();
+    if(frame_num < source.index.size()) {
         return Seek(src, frame_num);
     }else{
         return source.next_packet_id;
     }
 }
 
+void PacketStreamReader::SkipPadding()
+{
+    _stream.readTag(TAG_PANGO_PAD);
+    _stream.skip(_stream.readUINT());
+}
+
 void PacketStreamReader::SkipSync()
 {
     //Assume we have just read PAN, read GO
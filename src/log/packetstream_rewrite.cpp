@@ -0,0 +1,177 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/log/packetstream_rewrite.h>
+#include <pangolin/log/packetstream_reader.h>
+#include <pangolin/log/packetstream_writer.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace pangolin
+{
+
+PacketStreamRewriteStats PacketStreamRewrite(
+    const std::string& filename_in, const std::string& filename_out,
+    const PacketStreamRewriteOptions& options)
+{
+    if(PathExpand(filename_in) == PathExpand(filename_out)) {
+        throw std::runtime_error("PacketStreamRewrite: input and output must differ");
+    }
+
+    PacketStreamRewriteStats stats;
+    PacketStreamReader reader(filename_in);
+    stats.memory_mapped = reader.MemoryMap();
+
+    const std::vector<PacketStreamSource>& sources = reader.Sources();
+    std::vector<PacketStreamSourceId> keep = options.sources;
+    if(keep.empty()) {
+        for(size_t s = 0; s < sources.size(); ++s) keep.push_back(s);
+    }
+
+    // Input source to output source, or -1 to drop its packets
+    std::vector<int> out_id(sources.size(), -1);
+    std::vector<size_t> first(sources.size(), 0);
+    std::vector<size_t> end(sources.size(), 0);
+
+    PacketStreamWriter writer(filename_out, options.buffer_size, options.direct_depth);
+    for(PacketStreamSourceId s : keep) {
+        if(s >= sources.size()) {
+            throw std::runtime_error("PacketStreamRewrite: no source " + std::to_string(s));
+        }
+        PacketStreamSource src = sources[s];
+
+        // Packets to keep, where the index tells us
+        const size_t n = src.index.size();
+        if(n) {
+            first[s] = std::max(options.first_packet, src.index.LowerBoundTime(options.start_time_us));
+            end[s] = std::min(options.end_packet, options.end_time_us == std::numeric_limits<int64_t>::max()
+                ? n : src.index.LowerBoundTime(options.end_time_us));
+        }else{
+            first[s] = options.first_packet;
+            end[s] = options.end_packet;
+        }
+
+        src.index.clear();
+        if(options.edit_source) options.edit_source(s, src);
+        out_id[s] = (int)writer.AddSource(src);
+    }
+    stats.packets_per_source.assign(keep.size(), 0);
+
+    // Start from the earliest packet kept, rather than reading from the top
+    PacketStreamSourceId seek_src = 0;
+    int64_t seek_pos = std::numeric_limits<int64_t>::max();
+    for(PacketStreamSourceId s : keep) {
+        const PacketStreamSource& src = sources[s];
+        if(first[s] < src.index.size() && src.index.Pos(first[s]) < seek_pos) {
+            seek_pos = src.index.Pos(first[s]);
+            seek_src = s;
+        }
+    }
+    // The reader only renumbers the source seeked, so packets of every
+    // source are counted here from the first at or after the new position
+    std::vector<size_t> next(sources.size(), 0);
+    if(seek_pos != std::numeric_limits<int64_t>::max()) {
+        reader.Seek(seek_src, first[seek_src]);
+        for(size_t s = 0; s < sources.size(); ++s) {
+            const PacketStreamSource::PacketIndex& index = sources[s].index;
+            size_t lo = 0, hi = index.size();
+            while(lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if(index.Pos(mid) < seek_pos) lo = mid + 1; else hi = mid;
+            }
+            next[s] = lo;
+        }
+    }
+
+    // Sources whose range is already known to be empty are done
+    size_t remaining = 0;
+    for(PacketStreamSourceId s : keep) {
+        if(sources[s].index.size() && first[s] >= end[s]) {
+            out_id[s] = -1;
+        }else{
+            ++remaining;
+        }
+    }
+
+    std::vector<char> buffer;
+    size_t packets = 0;
+    bool advised = false;
+
+    try {
+        while(remaining) {
+            Packet pkt = reader.NextFrame();
+            if(pkt.src >= out_id.size()) continue;
+            const size_t seq = next[pkt.src]++;
+            const int o = out_id[pkt.src];
+            if(o < 0) continue;
+
+            const bool in_time = options.start_time_us <= pkt.time && pkt.time < options.end_time_us;
+            if(seq >= end[pkt.src] || (!sources[pkt.src].index.size() && pkt.time >= options.end_time_us)) {
+                // Past the end of this source
+                if(out_id[pkt.src] >= 0) {
+                    out_id[pkt.src] = -1;
+                    --remaining;
+                }
+                continue;
+            }
+            if(seq < first[pkt.src] || !in_time) continue;
+
+            const char* data = (const char*)pkt.Data();
+            if(data) {
+                if(!advised && pkt.Mapping()) {
+                    pkt.Mapping()->AdviseSequential();
+                    advised = true;
+                }
+            }else{
+                buffer.resize(pkt.size);
+                pkt.Stream().read(buffer.data(), pkt.size);
+                data = buffer.data();
+            }
+
+            if(options.edit_meta) {
+                picojson::value meta = pkt.meta;
+                options.edit_meta(pkt.src, seq, meta);
+                writer.WriteSourcePacket(o, data, pkt.time, pkt.size, meta, pkt.binary_meta);
+            }else{
+                writer.WriteSourcePacket(o, data, pkt.time, pkt.size, pkt.meta, pkt.binary_meta);
+            }
+
+            ++stats.packets_per_source[o];
+            stats.payload_bytes += pkt.size;
+            ++packets;
+            if(options.progress) options.progress(packets);
+        }
+    }catch(const std::runtime_error&) {
+        // end of stream
+    }
+
+    writer.Close();
+    return stats;
+}
+
+}
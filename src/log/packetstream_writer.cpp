@@ -24,6 +24,8 @@
  */
 
 #include <pangolin/log/packetstream_writer.h>
+#include <pangolin/image/image_io_zstd.h>
+#include <pangolin/utils/base64.h>
 #include <pangolin/utils/file_utils.h>
 #include <pangolin/utils/timer.h>
 
@@ -51,10 +53,24 @@ void PacketStreamWriter::WriteHeader()
     SCOPED_LOCK;
     _stream.write(PANGO_MAGIC.c_str(), PANGO_MAGIC.size());
     picojson::value pango;
+    const int64_t time_us = Time_us(TimeNow());
     pango["pangolin_version"] = PANGOLIN_VERSION_STRING;
-    pango["time_us"] = Time_us(TimeNow());
+    pango["time_us"] = time_us;
     pango["date_created"] = CurrentTimeStr();
     pango["endian"] = "little_endian";
+    if(_header_properties.is<picojson::object>()) {
+        for(const auto& kv : _header_properties.get<picojson::object>()) {
+            pango[kv.first] = kv.second;
+        }
+    }
+
+    // Later files of a rotated log identify the set by the first file's time
+    if(_chunk == 0) {
+        _chunk_of_us = time_us;
+    }else{
+        pango["chunk"] = _chunk;
+        pango["chunk_of"] = _chunk_of_us;
+    }
 
     writeTag(_stream, TAG_PANGO_HDR);
     pango.serialize(std::ostream_iterator<char>(_stream), true);
@@ -74,7 +90,17 @@ void PacketStreamWriter::Write(const PacketStreamSource& source)
     serialize[pss_src_version] = source.version;
     serialize[pss_src_packet][pss_pkt_alignment_bytes] = source.data_alignment_bytes;
     serialize[pss_src_packet][pss_pkt_definitions] = source.data_definitions;
-    serialize[pss_src_packet][pss_pkt_size_bytes] = source.data_size_bytes;
+    serialize[pss_src_packet][pss_pkt_size_bytes] = source.StoredSizeBytes();
+    if (source.Compressed()) {
+        // Readers without compression support see variable sized packets
+        picojson::value& cmp = serialize[pss_src_packet][pss_pkt_compression];
+        cmp[pss_cmp_codec] = source.compression;
+        cmp[pss_cmp_level] = source.compression_level;
+        cmp[pss_cmp_size_bytes] = source.data_size_bytes;
+        if (source.compression_dictionary) {
+            cmp[pss_cmp_dictionary] = Base64Encode(source.compression_dictionary->Bytes());
+        }
+    }
 
     writeTag(_stream, TAG_ADD_SOURCE);
     serialize.serialize(std::ostream_iterator<char>(_stream), true);
@@ -91,6 +117,11 @@ PacketStreamSourceId PacketStreamWriter::AddSource(PacketStreamSource& source)
 PacketStreamSourceId PacketStreamWriter::AddSource(const PacketStreamSource& source)
 {
     SCOPED_LOCK;
+    if (source.Compressed() && source.compression != "zstd")
+        throw std::runtime_error("PacketStreamWriter: unknown packet compression '" + source.compression + "'");
+    if (source.data_alignment_bytes > (int64_t)PANGO_MAX_ALIGNMENT)
+        throw std::runtime_error("PacketStreamWriter: data_alignment_bytes exceeds PANGO_MAX_ALIGNMENT");
+
     PacketStreamSourceId r = _sources.size(); //source id is by vector position, so we must reassign.
     _sources.push_back(source);
     _sources.back().id = r;
@@ -101,36 +132,269 @@ PacketStreamSourceId PacketStreamWriter::AddSource(const PacketStreamSource& sou
     return _sources.back().id;
 }
 
-void PacketStreamWriter::WriteMeta(PacketStreamSourceId src, const picojson::value& data)
+void PacketStreamWriter::WriteMeta(PacketStreamSourceId src, const std::string& json)
 {
     SCOPED_LOCK;
     writeTag(_stream, TAG_SRC_JSON);
     writeCompressedUnsignedInt(_stream, src);
-    data.serialize(std::ostream_iterator<char>(_stream), false);
+    _stream.write(json.data(), json.size());
+}
+
+void PacketStreamWriter::WritePadding(size_t header_bytes, size_t alignment)
+{
+    SCOPED_LOCK;
+    const size_t min_pad = TAG_LENGTH + PANGO_PAD_LENGTH_BYTES;
+    const size_t data_pos = (size_t)std::streamoff(_stream.tellp()) + header_bytes;
+    size_t pad = (alignment - data_pos % alignment) % alignment;
+    if (!pad) return;
+    while (pad < min_pad) pad += alignment;
+
+    // Length as a varint of fixed width, so that the padding is of known size
+    const size_t n = pad - min_pad;
+    writeTag(_stream, TAG_PANGO_PAD);
+    for (unsigned int i = 0; i < PANGO_PAD_LENGTH_BYTES; ++i) {
+        const unsigned char b = (n >> (7*i)) & 0x7F;
+        _stream.put(i + 1 < PANGO_PAD_LENGTH_BYTES ? (0x80 | b) : b);
+    }
+
+    static const char zeros[4096] = {};
+    for (size_t left = n; left; ) {
+        const size_t len = std::min(left, sizeof(zeros));
+        _stream.write(zeros, len);
+        left -= len;
+    }
 }
 
-void PacketStreamWriter::WriteSourcePacket(PacketStreamSourceId src, const char* source, const int64_t receive_time_us, size_t sourcelen, const picojson::value& meta)
+void PacketStreamWriter::WriteSourcePacket(PacketStreamSourceId src, const char* source, const int64_t receive_time_us, size_t sourcelen, const picojson::value& meta, const std::string& binary_meta)
 {
 
     SCOPED_LOCK;
+    if(ShouldRotate(receive_time_us)) {
+        Rotate();
+    }
+    if(_chunk_start_us < 0) {
+        _chunk_start_us = receive_time_us;
+    }
+
+    const PacketStreamSource& pss = _sources[src];
+    if (pss.data_size_bytes && sourcelen != static_cast<size_t>(pss.data_size_bytes))
+        throw std::runtime_error("oPacketStream::writePacket --> Tried to write a fixed-size packet with bad size.");
+
+    if (pss.Compressed()) {
+        ZstdOptions options;
+        options.dictionary = pss.compression_dictionary;
+        ZstdCompress(source, sourcelen, _compressed, pss.compression_level, options);
+        source = _compressed.data();
+        sourcelen = _compressed.size();
+    }
+
+    const std::string json = meta.is<picojson::null>() ? std::string() : meta.serialize();
+
+    if (pss.data_alignment_bytes > 1) {
+        // Pad ahead of the packet, so that its data lands on the boundary
+        size_t header_bytes = TAG_LENGTH + sizeof(receive_time_us) + compressedUnsignedIntBytes(src);
+        if (!pss.StoredSizeBytes())
+            header_bytes += compressedUnsignedIntBytes(sourcelen);
+        if (!binary_meta.empty())
+            header_bytes += TAG_LENGTH + compressedUnsignedIntBytes(src) + compressedUnsignedIntBytes(binary_meta.size()) + binary_meta.size();
+        if (!json.empty())
+            header_bytes += TAG_LENGTH + compressedUnsignedIntBytes(src) + json.size();
+        WritePadding(header_bytes, pss.data_alignment_bytes);
+    }
+
     _sources[src].index.push_back({_stream.tellp(), receive_time_us});
 
-    if (!meta.is<picojson::null>())
-        WriteMeta(src, meta);
+    if (!binary_meta.empty()) {
+        writeTag(_stream, TAG_SRC_META);
+        writeCompressedUnsignedInt(_stream, src);
+        writeCompressedUnsignedInt(_stream, binary_meta.size());
+        _stream.write(binary_meta.data(), binary_meta.size());
+    }
+
+    if (!json.empty())
+        WriteMeta(src, json);
 
     writeTag(_stream, TAG_SRC_PACKET);
     writeTimestamp(_stream, receive_time_us);
     writeCompressedUnsignedInt(_stream, src);
 
-    if (_sources[src].data_size_bytes) {
-        if (sourcelen != static_cast<size_t>(_sources[src].data_size_bytes))
-            throw std::runtime_error("oPacketStream::writePacket --> Tried to write a fixed-size packet with bad size.");
-    } else {
+    if (!pss.StoredSizeBytes()) {
         writeCompressedUnsignedInt(_stream, sourcelen);
     }
 
     _stream.write(source, sourcelen);
     _bytes_written += sourcelen;
+
+    CheckpointIfDue();
+}
+
+char* PacketStreamWriter::ReserveSourcePacket(PacketStreamSourceId src, const int64_t receive_time_us, size_t max_bytes, const picojson::value& meta, const std::string& binary_meta)
+{
+    // Held until the packet is committed or cancelled
+    _lock.lock();
+
+    if(ShouldRotate(receive_time_us)) {
+        Rotate();
+    }
+    if(_chunk_start_us < 0) {
+        _chunk_start_us = receive_time_us;
+    }
+
+    const PacketStreamSource& pss = _sources[src];
+    if (pss.Compressed() || pss.data_alignment_bytes > 1) {
+        _lock.unlock();
+        return nullptr;
+    }
+
+    // Everything ahead of the data, with the length as a varint wide enough
+    // for max_bytes, to be filled in on commit
+    _header.clear();
+    std::ostream header(&_header);
+
+    if (!binary_meta.empty()) {
+        writeTag(header, TAG_SRC_META);
+        writeCompressedUnsignedInt(header, src);
+        writeCompressedUnsignedInt(header, binary_meta.size());
+        header.write(binary_meta.data(), binary_meta.size());
+    }
+
+    if (!meta.is<picojson::null>()) {
+        const std::string json = meta.serialize();
+        writeTag(header, TAG_SRC_JSON);
+        writeCompressedUnsignedInt(header, src);
+        header.write(json.data(), json.size());
+    }
+
+    writeTag(header, TAG_SRC_PACKET);
+    writeTimestamp(header, receive_time_us);
+    writeCompressedUnsignedInt(header, src);
+
+    _reserved_length_bytes = pss.StoredSizeBytes() ? 0 : compressedUnsignedIntBytes(max_bytes);
+    for (size_t i = 0; i < _reserved_length_bytes; ++i) {
+        header.put(0);
+    }
+
+    _reserved = _buffer.reserve(_header.size() + max_bytes);
+    if (!_reserved) {
+        _lock.unlock();
+        return nullptr;
+    }
+
+    std::copy(_header.data(), _header.data() + _header.size(), reinterpret_cast<unsigned char*>(_reserved));
+    _reserved_src = src;
+    _reserved_time_us = receive_time_us;
+    _reserved_pos = _stream.tellp();
+    _reserved_max_bytes = max_bytes;
+    return _reserved + _header.size();
+}
+
+void PacketStreamWriter::CommitSourcePacket(size_t sourcelen)
+{
+    std::lock_guard<decltype(_lock)> lg(_lock, std::adopt_lock);
+
+    const PacketStreamSource& pss = _sources[_reserved_src];
+    if (sourcelen > _reserved_max_bytes || (pss.data_size_bytes && sourcelen != static_cast<size_t>(pss.data_size_bytes))) {
+        _buffer.commit(0);
+        _reserved = nullptr;
+        throw std::runtime_error("oPacketStream::writePacket --> Tried to commit a packet with bad size.");
+    }
+
+    // Varint of fixed width, as for padding
+    unsigned char* length = reinterpret_cast<unsigned char*>(_reserved) + _header.size() - _reserved_length_bytes;
+    for (size_t i = 0; i < _reserved_length_bytes; ++i) {
+        const unsigned char b = (sourcelen >> (7*i)) & 0x7F;
+        length[i] = i + 1 < _reserved_length_bytes ? (0x80 | b) : b;
+    }
+
+    _sources[_reserved_src].index.push_back({_reserved_pos, _reserved_time_us});
+    _buffer.commit(_header.size() + sourcelen);
+    _reserved = nullptr;
+    _bytes_written += sourcelen;
+
+    CheckpointIfDue();
+}
+
+void PacketStreamWriter::CancelSourcePacket()
+{
+    std::lock_guard<decltype(_lock)> lg(_lock, std::adopt_lock);
+    _buffer.commit(0);
+    _reserved = nullptr;
+}
+
+void PacketStreamWriter::CheckpointIfDue()
+{
+    if(_indexable) {
+        size_t packets_since = 0;
+        for(size_t s=0; s < _sources.size(); ++s) {
+            packets_since += _sources[s].index.size() - (s < _checkpoint_first.size() ? _checkpoint_first[s] : 0);
+        }
+        if( (_checkpoint_packets && packets_since >= _checkpoint_packets) ||
+            (_checkpoint_bytes && _bytes_written - _checkpoint_last_bytes >= _checkpoint_bytes) )
+        {
+            WriteCheckpoint();
+        }
+    }
+}
+
+PacketStreamWriterStats PacketStreamWriter::Stats()
+{
+    SCOPED_LOCK;
+    PacketStreamWriterStats stats;
+    stats.buffer = _buffer.stats();
+    stats.packet_bytes = _bytes_written;
+    for(size_t s=0; s < _sources.size(); ++s) {
+        const size_t rotated = s < _rotated_packets.size() ? _rotated_packets[s] : 0;
+        stats.packets_per_source.push_back(rotated + _sources[s].index.size());
+    }
+    return stats;
+}
+
+bool PacketStreamWriter::ShouldRotate(int64_t time_us)
+{
+    if(!_indexable || _chunk_start_us < 0) {
+        return false;
+    }
+
+    return (_rotate_bytes && (uint64_t)_stream.tellp() >= _rotate_bytes) ||
+           (_rotate_us && time_us - _chunk_start_us >= _rotate_us);
+}
+
+void PacketStreamWriter::Rotate()
+{
+    SCOPED_LOCK;
+    WriteEnd();
+    _buffer.close();
+
+    // Positions in the index are relative to each file
+    _rotated_packets.resize(_sources.size(), 0);
+    for(size_t s=0; s < _sources.size(); ++s) {
+        _rotated_packets[s] += _sources[s].index.size();
+        _sources[s].index.clear();
+    }
+
+    ++_chunk;
+    _buffer.open(PacketStreamChunkFilename(_filename, _chunk), _buffer_size, _direct_depth, _lock_free);
+    _open = _stream.good();
+    _chunk_start_us = -1;
+    ResetCheckpoints();
+    _checkpoint_last_bytes = _bytes_written;
+
+    // Repeats every source, so each file stands alone
+    WriteHeader();
+}
+
+void PacketStreamWriter::WriteCheckpoint()
+{
+    SCOPED_LOCK;
+    const uint64_t pos = (uint64_t)_stream.tellp();
+    writeIndexCheckpoint(_stream, _sources, _checkpoint_first, pos, _checkpoint_last_pos);
+
+    _checkpoint_last_pos = pos;
+    _checkpoint_last_bytes = _bytes_written;
+    _checkpoint_first.resize(_sources.size());
+    for(size_t s=0; s < _sources.size(); ++s) {
+        _checkpoint_first[s] = _sources[s].index.size();
+    }
 }
 
 void PacketStreamWriter::WriteSync()
@@ -146,9 +410,8 @@ void PacketStreamWriter::WriteEnd()
     if (!_indexable)
         return;
 
-    auto indexpos = _stream.tellp();
-    writeTag(_stream, TAG_PANGO_STATS);
-    SourceStats(_sources).serialize(std::ostream_iterator<char>(_stream), false);
+    uint64_t indexpos = (uint64_t)_stream.tellp();
+    writeBinaryIndex(_stream, _sources, indexpos);
     writeTag(_stream, TAG_PANGO_FOOTER);
     _stream.write(reinterpret_cast<char*>(&indexpos), sizeof(uint64_t));
 }
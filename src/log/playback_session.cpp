@@ -1,26 +1,267 @@
 #include <pangolin/log/playback_session.h>
 #include <pangolin/utils/params.h>
 
+#include <queue>
+#include <stdexcept>
+
 namespace pangolin {
 
+struct PlaybackSessionIndex
+{
+    // Packets of each source before every rank_interval entries are
+    // recorded, to find where every source is at a position of the index
+    static const size_t rank_interval = 1024;
+
+    std::vector<std::shared_ptr<PacketStreamReader>> readers;
+    std::vector<size_t> slot_base;      // first slot of each reader, with a slot per source
+    std::vector<size_t> slot_packets;   // packets of the source of each slot
+    std::vector<PlaybackSessionPacket> packets;
+    std::vector<size_t> ranks;          // ranks[c*NumSlots() + slot] packets of slot before c*rank_interval
+
+    size_t NumSlots() const
+    {
+        return slot_packets.size();
+    }
+
+    size_t Slot(const PlaybackSessionPacket& p) const
+    {
+        return slot_base[p.reader] + p.src;
+    }
+
+    size_t LowerBound(int64_t time_us) const
+    {
+        return std::lower_bound(packets.begin(), packets.end(), time_us,
+            [](const PlaybackSessionPacket& p, int64_t t){ return p.time_us < t; }
+        ) - packets.begin();
+    }
+
+    // Next packet id of every slot at position pos
+    void Positions(size_t pos, std::vector<size_t>& next) const
+    {
+        next.assign(NumSlots(), 0);
+        if(ranks.empty()) return;
+
+        const size_t c = std::min(pos / rank_interval, ranks.size() / NumSlots() - 1);
+        std::copy(ranks.begin() + c*NumSlots(), ranks.begin() + (c+1)*NumSlots(), next.begin());
+        for(size_t i = c*rank_interval; i < pos; ++i) {
+            ++next[Slot(packets[i])];
+        }
+    }
+};
+
+namespace
+{
+std::shared_ptr<const PlaybackSessionIndex> BuildIndex(const std::vector<std::shared_ptr<PacketStreamReader>>& readers)
+{
+    auto index = std::make_shared<PlaybackSessionIndex>();
+    index->readers = readers;
+
+    struct Head
+    {
+        int64_t time_us;
+        size_t slot;
+        size_t id;
+        bool operator>(const Head& o) const { return time_us > o.time_us || (time_us == o.time_us && slot > o.slot); }
+    };
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::vector<const PacketStreamSource::PacketIndex*> slot_index;
+    std::vector<std::pair<uint32_t,uint32_t>> slot_source;
+    std::vector<int64_t> slot_offset_us;
+
+    for(size_t r=0; r < readers.size(); ++r) {
+        index->slot_base.push_back(slot_index.size());
+        const std::vector<PacketStreamSource>& sources = readers[r]->Sources();
+        // Logs of a coordinated recording are merged on its shared time base
+        const int64_t offset_us = readers[r]->ClockOffsetUs();
+        for(size_t s=0; s < sources.size(); ++s) {
+            const PacketStreamSource::PacketIndex& pi = sources[s].index;
+            if(!pi.empty()) {
+                heads.push({pi.Time(0) + offset_us, slot_index.size(), 0});
+            }
+            index->slot_packets.push_back(pi.size());
+            slot_index.push_back(&pi);
+            slot_source.push_back({uint32_t(r), uint32_t(s)});
+            slot_offset_us.push_back(offset_us);
+        }
+    }
+
+    // k-way merge of the (time ordered) index of every source
+    std::vector<size_t> count(slot_index.size(), 0);
+    while(!heads.empty()) {
+        const Head h = heads.top();
+        heads.pop();
+
+        if(index->packets.size() % PlaybackSessionIndex::rank_interval == 0) {
+            index->ranks.insert(index->ranks.end(), count.begin(), count.end());
+        }
+        index->packets.push_back({h.time_us, slot_source[h.slot].first, slot_source[h.slot].second, h.id});
+        ++count[h.slot];
+
+        if(h.id + 1 < slot_index[h.slot]->size()) {
+            heads.push({slot_index[h.slot]->Time(h.id + 1) + slot_offset_us[h.slot], h.slot, h.id + 1});
+        }
+    }
+
+    return index;
+}
+
+int64_t TimeUs(SyncTime::TimePoint time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+}
+
+PlaybackSessionCursor::PlaybackSessionCursor(const std::shared_ptr<const PlaybackSessionIndex>& index)
+    : _index(index), _next(0)
+{
+    _cursors.resize(_index->NumSlots());
+}
+
+PlaybackSessionCursor::~PlaybackSessionCursor()
+{
+}
+
+size_t PlaybackSessionCursor::NumPackets() const
+{
+    return _index->packets.size();
+}
+
+void PlaybackSessionCursor::Seek(size_t pos)
+{
+    _next = std::min(pos, NumPackets());
+}
+
+size_t PlaybackSessionCursor::Seek(SyncTime::TimePoint time)
+{
+    _next = _index->LowerBound(TimeUs(time));
+    return _next;
+}
+
+PlaybackSessionPacket PlaybackSessionCursor::Peek() const
+{
+    if(AtEnd()) {
+        throw std::runtime_error("PlaybackSessionCursor: end of session");
+    }
+    return _index->packets[_next];
+}
+
+QueuedPacket PlaybackSessionCursor::Next()
+{
+    const PlaybackSessionPacket p = Peek();
+    std::unique_ptr<PacketStreamCursor>& cursor = _cursors[_index->Slot(p)];
+    if(!cursor) {
+        cursor.reset(new PacketStreamCursor(_index->readers[p.reader]->Cursor(p.src)));
+    }
+    QueuedPacket packet = cursor->Read(p.packet_id);
+    ++_next;
+    return packet;
+}
+
 std::shared_ptr<PlaybackSession> PlaybackSession::Default()
 {
     static std::shared_ptr<PlaybackSession> instance = std::make_shared<PlaybackSession>();
     return instance;
 }
 
+size_t PlaybackSession::NumReaders() const
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    return opened.size();
+}
+
+std::shared_ptr<PacketStreamReader> PlaybackSession::Reader(size_t reader) const
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    return opened.at(reader);
+}
+
+const PlaybackSessionIndex& PlaybackSession::Index()
+{
+    if(!index) {
+        index = BuildIndex(opened);
+    }
+    return *index;
+}
+
+size_t PlaybackSession::NumIndexedPackets()
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    return Index().packets.size();
+}
+
+PlaybackSessionPacket PlaybackSession::IndexedPacket(size_t pos)
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    return Index().packets.at(pos);
+}
+
+size_t PlaybackSession::LowerBound(SyncTime::TimePoint time)
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    return Index().LowerBound(TimeUs(time));
+}
+
+const std::vector<size_t>& PlaybackSession::PositionsAtTime(int64_t time_us)
+{
+    const PlaybackSessionIndex& idx = Index();
+    if(positions.empty() || positions_time_us != time_us) {
+        idx.Positions(idx.LowerBound(time_us), positions);
+        positions_time_us = time_us;
+    }
+    return positions;
+}
+
+size_t PlaybackSession::PacketAtTime(const PacketStreamReader& reader, PacketStreamSourceId src, SyncTime::TimePoint time)
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    const PlaybackSessionIndex& idx = Index();
+    for(size_t r=0; r < idx.readers.size(); ++r) {
+        const size_t slot = idx.slot_base[r] + src;
+        const size_t slot_end = (r + 1 < idx.readers.size()) ? idx.slot_base[r+1] : idx.NumSlots();
+        if(idx.readers[r].get() == &reader && slot < slot_end) {
+            return PositionsAtTime(TimeUs(time))[slot];
+        }
+    }
+
+    // Sources which appeared after the index was built
+    return reader.Sources().at(src).index.LowerBoundTime(TimeUs(time) - reader.ClockOffsetUs());
+}
+
+void PlaybackSession::Seek(SyncTime::TimePoint t)
+{
+    {
+        // Position every source at once, for participants to pick up
+        std::lock_guard<std::mutex> l(index_mutex);
+        PositionsAtTime(TimeUs(t));
+    }
+    time.Seek(t);
+}
+
+PlaybackSessionCursor PlaybackSession::Cursor()
+{
+    std::lock_guard<std::mutex> l(index_mutex);
+    Index();
+    return PlaybackSessionCursor(index);
+}
+
 std::shared_ptr<PlaybackSession> PlaybackSession::ChooseFromParams(const Params& params)
 {
     bool use_ordered_playback = params.Get<bool>("OrderedPlayback", false);
     std::shared_ptr<pangolin::PlaybackSession> playback_session;
     if(use_ordered_playback)
     {
-        return Default();
+        playback_session = Default();
     }
     else
     {
-        return std::make_shared<PlaybackSession>();
+        playback_session = std::make_shared<PlaybackSession>();
+    }
+
+    // Multiple of recorded time to pace playback at. 0 plays as fast as possible.
+    if(params.Contains("PlaybackRate")) {
+        playback_session->Time().SetRate(params.Get<double>("PlaybackRate", 0.0));
     }
+    return playback_session;
 }
 
 }
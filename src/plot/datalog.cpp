@@ -26,68 +26,597 @@
  */
 
 #include <pangolin/plot/datalog.h>
+#include <pangolin/image/image_io_zstd.h>
+#include <pangolin/log/packetstream_writer.h>
+#include <pangolin/utils/memory_mapped_file.h>
+#include <pangolin/utils/timer.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <stdexcept>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#  define DATALOG_HAVE_SSE2
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define DATALOG_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
 namespace pangolin
 {
 
-void DataLogBlock::AddSamples(size_t num_samples, size_t dimensions, const float* data_dim_major )
+const std::string pango_datalog_type = "pango_datalog";
+
+namespace
+{
+
+#if defined(DATALOG_HAVE_SSE2) || defined(DATALOG_HAVE_NEON)
+
+// Accumulate stats for dimensions [d, d+4) of n rows of stride dim at once.
+void AddStats4(DimensionStats* stats, const float* rows, size_t n, size_t dim)
+{
+#if defined(DATALOG_HAVE_SSE2)
+    __m128 mn = _mm_set_ps(stats[3].min, stats[2].min, stats[1].min, stats[0].min);
+    __m128 mx = _mm_set_ps(stats[3].max, stats[2].max, stats[1].max, stats[0].max);
+    __m128 sum = _mm_set_ps(stats[3].sum, stats[2].sum, stats[1].sum, stats[0].sum);
+    __m128 sum_sq = _mm_set_ps(stats[3].sum_sq, stats[2].sum_sq, stats[1].sum_sq, stats[0].sum_sq);
+    __m128 decreased = _mm_setzero_ps();
+    for(size_t s=0; s < n; ++s, rows += dim) {
+        const __m128 v = _mm_loadu_ps(rows);
+        const __m128 valid = _mm_cmpord_ps(v, v);
+        const __m128 vz = _mm_and_ps(v, valid);
+        decreased = _mm_or_ps(decreased, _mm_andnot_ps(_mm_cmpge_ps(v, mx), valid));
+        // minps / maxps return their second operand for NaN, skipping it
+        mn = _mm_min_ps(v, mn);
+        mx = _mm_max_ps(v, mx);
+        sum = _mm_add_ps(sum, vz);
+        sum_sq = _mm_add_ps(sum_sq, _mm_mul_ps(vz, vz));
+    }
+    float a_mn[4], a_mx[4], a_sum[4], a_sum_sq[4];
+    _mm_storeu_ps(a_mn, mn);
+    _mm_storeu_ps(a_mx, mx);
+    _mm_storeu_ps(a_sum, sum);
+    _mm_storeu_ps(a_sum_sq, sum_sq);
+    const int dec = _mm_movemask_ps(decreased);
+#else
+    float32x4_t mn = {stats[0].min, stats[1].min, stats[2].min, stats[3].min};
+    float32x4_t mx = {stats[0].max, stats[1].max, stats[2].max, stats[3].max};
+    float32x4_t sum = {stats[0].sum, stats[1].sum, stats[2].sum, stats[3].sum};
+    float32x4_t sum_sq = {stats[0].sum_sq, stats[1].sum_sq, stats[2].sum_sq, stats[3].sum_sq};
+    uint32x4_t decreased = vdupq_n_u32(0);
+    for(size_t s=0; s < n; ++s, rows += dim) {
+        const float32x4_t v = vld1q_f32(rows);
+        const uint32x4_t valid = vceqq_f32(v, v);
+        const float32x4_t vz = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), valid));
+        decreased = vorrq_u32(decreased, vbicq_u32(valid, vcgeq_f32(v, mx)));
+        // fminnm / fmaxnm return the non-NaN operand
+        mn = vminnmq_f32(mn, v);
+        mx = vmaxnmq_f32(mx, v);
+        sum = vaddq_f32(sum, vz);
+        sum_sq = vmlaq_f32(sum_sq, vz, vz);
+    }
+    float a_mn[4], a_mx[4], a_sum[4], a_sum_sq[4];
+    uint32_t a_dec[4];
+    vst1q_f32(a_mn, mn);
+    vst1q_f32(a_mx, mx);
+    vst1q_f32(a_sum, sum);
+    vst1q_f32(a_sum_sq, sum_sq);
+    vst1q_u32(a_dec, decreased);
+    const int dec = (a_dec[0] ? 1 : 0) | (a_dec[1] ? 2 : 0) | (a_dec[2] ? 4 : 0) | (a_dec[3] ? 8 : 0);
+#endif
+    for(size_t i=0; i < 4; ++i) {
+        stats[i].isMonotonic = stats[i].isMonotonic && !(dec & (1 << i));
+        stats[i].min = a_mn[i];
+        stats[i].max = a_mx[i];
+        stats[i].sum = a_sum[i];
+        stats[i].sum_sq = a_sum_sq[i];
+    }
+}
+
+#endif // DATALOG_HAVE_SSE2 || DATALOG_HAVE_NEON
+
+// Marks a missing value of an DataLogInt64 dimension
+const int64_t int64_missing = std::numeric_limits<int64_t>::min();
+
+// IEEE 754 binary16, rounding to nearest even
+uint16_t FloatToHalf(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+
+    if(x >= 0x7f800000) {
+        // Inf, or NaN kept quiet
+        return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+    }
+    if(x >= 0x477ff000) {
+        // Rounds beyond 65504
+        return sign | 0x7c00;
+    }
+    if(x < 0x38800000) {
+        // Subnormal in half precision, in units of 2^-24
+        if(x < 0x33000000) return sign;
+        const uint32_t shift = 126 - (x >> 23);
+        const uint32_t m = (x & 0x7fffff) | 0x800000;
+        uint32_t h = m >> shift;
+        const uint32_t rem = m & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (h & 1))) ++h;
+        return sign | (uint16_t)h;
+    }
+
+    // Rebias the exponent, carrying any rounding into it
+    uint32_t h = (x - 0x38000000) >> 13;
+    const uint32_t rem = x & 0x1fff;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+    return sign | (uint16_t)h;
+}
+
+float HalfToFloat(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1f;
+    uint32_t m = h & 0x3ff;
+    uint32_t x;
+    if(e == 0x1f) {
+        x = sign | 0x7f800000 | (m << 13);
+    }else if(e) {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }else if(!m) {
+        x = sign;
+    }else{
+        // Normalise subnormals
+        uint32_t fe = 113;
+        while(!(m & 0x400)) { m <<= 1; --fe; }
+        x = sign | (fe << 23) | ((m & 0x3ff) << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+bool IsExact(DataLogType t)
 {
+    return t == DataLogFloat64 || t == DataLogInt64;
+}
+
+// Value v as held by a 64 bit dimension of type t
+int64_t ExactBits(DataLogType t, double v)
+{
+    if(t == DataLogInt64) {
+        return std::abs(v) < 9.2e18 ? (int64_t)std::llrint(v) : int64_missing;
+    }
+    int64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+int64_t ExactBits(DataLogType t, int64_t v)
+{
+    if(t == DataLogInt64) return v;
+    return ExactBits(t, v == int64_missing ? std::numeric_limits<double>::quiet_NaN() : (double)v);
+}
+
+double ExactDouble(DataLogType t, int64_t bits)
+{
+    if(t == DataLogInt64) {
+        return bits == int64_missing ? std::numeric_limits<double>::quiet_NaN() : (double)bits;
+    }
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+int64_t ExactInt64(DataLogType t, int64_t bits)
+{
+    return t == DataLogInt64 ? bits : ExactBits(DataLogInt64, ExactDouble(t, bits));
+}
+
+float ToFloat(double v)
+{
+    return (float)v;
+}
+
+float ToFloat(int64_t v)
+{
+    return v == int64_missing ? std::numeric_limits<float>::quiet_NaN() : (float)v;
+}
+
+size_t TypeBytes(DataLogType t)
+{
+    return t == DataLogFloat16 ? 2 : (t == DataLogFloat32 ? 4 : 8);
+}
+
+template<typename T>
+void Put(std::string& out, T v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+T Take(const unsigned char*& p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+}
+
+}
+
+
+size_t DataLogBlock::NextUid()
+{
+    static std::atomic<size_t> next_uid(0);
+    return next_uid++;
+}
+
+DataLogBlock::DataLogBlock(size_t dim, size_t samples, size_t start_id, float* storage,
+                           const std::shared_ptr<MemoryMappedFile>& mapping,
+                           const std::vector<DataLogType>& types, int64_t* exact)
+    : dim(dim), max_samples(samples), samples(samples),
+      start_id(start_id), uid(NextUid()), mapping(mapping), exact_data(exact),
+      sealed(false), packed_zstd(false), owner(nullptr), next(nullptr)
+{
+    SetStorage(storage);
+    stats = std::unique_ptr<DimensionStats[]>(new DimensionStats[dim]);
+    SetTypes(types);
+}
+
+void DataLogBlock::SetTypes(const std::vector<DataLogType>& new_types)
+{
+    types.assign(dim, DataLogFloat32);
+    std::copy(new_types.begin(), new_types.begin() + std::min(dim, new_types.size()), types.begin());
+
+    exact_col.assign(dim, 0);
+    num_exact = 0;
+    for(size_t d=0; d < dim; ++d) {
+        if(IsExact(types[d])) exact_col[d] = num_exact++;
+    }
+}
+
+double DataLogBlock::SampleDouble(size_t n, size_t d) const
+{
+    const DataLogBlock* b = Holding(n);
+    const size_t s = n - b->start_id;
+    if(d >= b->dim) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if(IsExact(b->types[d])) {
+        return ExactDouble(b->types[d], b->Exact(s, d));
+    }
+    return b->DimData(d)[s * b->dim];
+}
+
+int64_t DataLogBlock::SampleInt64(size_t n, size_t d) const
+{
+    const DataLogBlock* b = Holding(n);
+    const size_t s = n - b->start_id;
+    if(d >= b->dim) {
+        return int64_missing;
+    }
+    if(IsExact(b->types[d])) {
+        return ExactInt64(b->types[d], b->Exact(s, d));
+    }
+    return ExactBits(DataLogInt64, (double)b->DimData(d)[s * b->dim]);
+}
+
+void DataLogBlock::ApplyTypes(size_t first_sample, size_t end_sample, size_t dimensions, const int64_t* exact_dim_major)
+{
+    for(size_t d=0; d < dim; ++d) {
+        const DataLogType t = types[d];
+        float* v = sample_data + first_sample*dim + d;
+        if(t == DataLogFloat16) {
+            for(size_t s = first_sample; s < end_sample; ++s, v += dim) {
+                *v = HalfToFloat(FloatToHalf(*v));
+            }
+        }else if(IsExact(t)) {
+            // The float view is always derived from the exact value
+            int64_t* x = exact_data + exact_col[d] * max_samples;
+            for(size_t s = first_sample; s < end_sample; ++s, v += dim) {
+                x[s] = (exact_dim_major && d < dimensions) ?
+                    exact_dim_major[(s - first_sample)*dimensions + d] : ExactBits(t, (double)*v);
+                *v = (float)ExactDouble(t, x[s]);
+            }
+        }
+    }
+}
+
+void DataLogBlock::Seal()
+{
+    // Loaded blocks are already backed by their file
+    if(sealed || !buffer) return;
+
+    const size_t n = Samples();
+    size_t raw_bytes = 0;
+    for(DataLogType t : types) raw_bytes += n * TypeBytes(t);
+
+    // Each dimension at its own type. Successive floats are XOR'd and
+    // integers differenced, leaving runs of zero bits for slowly varying
+    // values that compress well.
+    std::string raw;
+    raw.reserve(raw_bytes);
+    for(size_t d=0; d < dim; ++d) {
+        const float* v = sample_data + d;
+        const int64_t* x = exact_data + exact_col[d] * max_samples;
+        switch(types[d]) {
+        case DataLogFloat16:
+            for(size_t s=0; s < n; ++s) Put(raw, FloatToHalf(v[s*dim]));
+            break;
+        case DataLogFloat32: {
+            uint32_t prev = 0;
+            for(size_t s=0; s < n; ++s) {
+                uint32_t bits;
+                std::memcpy(&bits, v + s*dim, sizeof(bits));
+                Put(raw, bits ^ prev);
+                prev = bits;
+            }
+            break;
+        }
+        case DataLogFloat64: {
+            uint64_t prev = 0;
+            for(size_t s=0; s < n; ++s) {
+                Put(raw, (uint64_t)x[s] ^ prev);
+                prev = (uint64_t)x[s];
+            }
+            break;
+        }
+        case DataLogInt64: {
+            uint64_t prev = 0;
+            for(size_t s=0; s < n; ++s) {
+                Put(raw, (uint64_t)x[s] - prev);
+                prev = (uint64_t)x[s];
+            }
+            break;
+        }
+        }
+    }
+
+#ifdef HAVE_ZSTD
+    if(!raw.empty()) {
+        ZstdCompress(raw.data(), raw.size(), packed, 1, ZstdOptions());
+        packed.shrink_to_fit();
+        packed_zstd = true;
+    }
+#endif
+    if(!packed_zstd) {
+        packed.swap(raw);
+    }
+
+    // Keep the LOD levels, which zoomed out plots draw from
+    const float* lod_begin = sample_data + dim * max_samples;
+    const size_t lod_floats = StorageFloats(dim, max_samples) - dim * max_samples;
+    lod_buffer = std::unique_ptr<float[]>(new float[lod_floats]);
+    std::copy(lod_begin, lod_begin + lod_floats, lod_buffer.get());
+    for(float*& level : lod) {
+        level = lod_buffer.get() + (level - lod_begin);
+    }
+
+    sealed = true;
+    Release();
+}
+
+void DataLogBlock::Unpack() const
+{
+    const size_t n = Samples();
+
+    std::vector<unsigned char> raw;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(packed.data());
+    if(packed_zstd) {
+        raw.resize(ZstdDecompressedSize(packed.data(), packed.size()));
+        ZstdDecompress(packed.data(), packed.size(), raw.data(), raw.size(), ZstdOptions());
+        p = raw.data();
+    }
+
+    std::unique_ptr<float[]> view(new float[dim * n]);
+    std::unique_ptr<int64_t[]> exact(num_exact ? new int64_t[num_exact * max_samples] : nullptr);
+    for(size_t d=0; d < dim; ++d) {
+        const DataLogType t = types[d];
+        float* v = view.get() + d;
+        int64_t* x = exact.get() + exact_col[d] * max_samples;
+        switch(t) {
+        case DataLogFloat16:
+            for(size_t s=0; s < n; ++s) v[s*dim] = HalfToFloat(Take<uint16_t>(p));
+            break;
+        case DataLogFloat32: {
+            uint32_t bits = 0;
+            for(size_t s=0; s < n; ++s) {
+                bits ^= Take<uint32_t>(p);
+                std::memcpy(v + s*dim, &bits, sizeof(bits));
+            }
+            break;
+        }
+        case DataLogFloat64: {
+            uint64_t bits = 0;
+            for(size_t s=0; s < n; ++s) {
+                bits ^= Take<uint64_t>(p);
+                x[s] = (int64_t)bits;
+                v[s*dim] = (float)ExactDouble(t, x[s]);
+            }
+            break;
+        }
+        case DataLogInt64: {
+            uint64_t bits = 0;
+            for(size_t s=0; s < n; ++s) {
+                bits += Take<uint64_t>(p);
+                x[s] = (int64_t)bits;
+                v[s*dim] = (float)ExactDouble(t, x[s]);
+            }
+            break;
+        }
+        }
+    }
+
+    buffer = std::move(view);
+    sample_data = buffer.get();
+    exact_buffer = std::move(exact);
+    exact_data = exact_buffer.get();
+
+    if(owner) {
+        owner->Unpacked(this);
+    }
+}
+
+void DataLogBlock::Release() const
+{
+    buffer.reset();
+    sample_data = nullptr;
+    exact_buffer.reset();
+    exact_data = nullptr;
+}
+
+size_t DataLogBlock::StorageFloats(size_t dim, size_t max_samples)
+{
+    size_t floats = dim * max_samples;
+    for(size_t f = lod_base; f <= max_samples; f *= lod_base) {
+        floats += 2 * dim * (max_samples / f);
+    }
+    return floats;
+}
+
+void DataLogBlock::SetStorage(float* storage)
+{
+    sample_data = storage;
+    storage += dim * max_samples;
+    lod.clear();
+    for(size_t f = lod_base; f <= max_samples; f *= lod_base) {
+        lod.push_back(storage);
+        storage += 2 * dim * (max_samples / f);
+    }
+}
+
+void DataLogBlock::Recycle(size_t new_start_id)
+{
+    ClearLinked();
+    start_id = new_start_id;
+    uid = NextUid();
+}
+
+void DataLogBlock::UpdateLod(size_t first_sample, size_t end_sample)
+{
+    // Each level only grows by whole runs, computed from the level below
+    for(size_t l=1; l <= lod.size(); ++l) {
+        const size_t f = LodFactor(l);
+        for(size_t r = first_sample / f; r < end_sample / f; ++r) {
+            float* mins = &lod[l-1][r*2*dim];
+            float* maxs = mins + dim;
+
+            for(size_t i=0; i < lod_base; ++i) {
+                // minimum and maximum rows of the i'th sub-run
+                const float* smin;
+                const float* smax;
+                if(l == 1) {
+                    smin = smax = sample_data + (r*lod_base + i)*dim;
+                }else{
+                    smin = &lod[l-2][(r*lod_base + i)*2*dim];
+                    smax = smin + dim;
+                }
+                for(size_t d=0; d < dim; ++d) {
+                    // fmin / fmax ignore NaN
+                    mins[d] = std::fmin(mins[d], smin[d]);
+                    maxs[d] = std::fmax(maxs[d], smax[d]);
+                }
+            }
+        }
+    }
+}
+
+void DataLogBlock::UpdateStats(size_t first_sample, size_t end_sample)
+{
+    const float* rows = sample_data + first_sample*dim;
+    const size_t n = end_sample - first_sample;
+
+    std::lock_guard<std::mutex> l(stats_mutex);
+    size_t d = 0;
+#if defined(DATALOG_HAVE_SSE2) || defined(DATALOG_HAVE_NEON)
+    for(; d + 4 <= dim; d += 4) {
+        AddStats4(&stats[d], rows + d, n, dim);
+    }
+#endif
+    for(; d < dim; ++d) {
+        DimensionStats& ds = stats[d];
+        for(size_t s=0; s < n; ++s) {
+            ds.Add(rows[s*dim + d]);
+        }
+    }
+}
+
+void DataLogBlock::AddSamples(size_t num_samples, size_t dimensions, const float* data_dim_major,
+                              const int64_t* exact_dim_major )
+{
+    // Only the writer changes these, so it can read them relaxed
+    const size_t first_sample = samples.load(std::memory_order_relaxed);
+
     if(nextBlock) {
         // If next block exists, add to it instead
-        nextBlock->AddSamples(num_samples, dimensions, data_dim_major);
+        nextBlock->AddSamples(num_samples, dimensions, data_dim_major, exact_dim_major);
     }else{
         if(dimensions > dim) {
             // If dimensions is too high for this block, start a new bigger one
-            nextBlock = std::unique_ptr<DataLogBlock>(new DataLogBlock(dimensions, max_samples, start_id + samples));
-            nextBlock->AddSamples(num_samples,dimensions,data_dim_major);
+            std::unique_ptr<DataLogBlock> block(new DataLogBlock(dimensions, max_samples, start_id + first_sample, types));
+            block->owner = owner;
+            block->AddSamples(num_samples,dimensions,data_dim_major,exact_dim_major);
+            nextBlock = std::move(block);
+            next.store(nextBlock.get(), std::memory_order_release);
         }else{
             // Try to copy samples to this block
-            const size_t samples_to_copy = std::min(num_samples, SampleSpaceLeft());
+            const size_t samples_to_copy = std::min(num_samples, max_samples - first_sample);
+            const size_t end_sample = first_sample + samples_to_copy;
 
             if(dimensions == dim) {
                 // Copy entire block all together
-                std::copy(data_dim_major, data_dim_major + samples_to_copy*dim, sample_buffer.get()+samples*dim);
-                samples += samples_to_copy;
+                std::copy(data_dim_major, data_dim_major + samples_to_copy*dim, sample_data+first_sample*dim);
                 data_dim_major += samples_to_copy*dim;
             }else{
                 // Copy sample at a time, filling with NaN's where needed.
-                float* dst = sample_buffer.get();
+                float* dst = sample_data + first_sample*dim;
                 for(size_t i=0; i< samples_to_copy; ++i) {
                     std::copy(data_dim_major, data_dim_major + dimensions, dst);
                     for(size_t ii = dimensions; ii < dim; ++ii) {
                         dst[ii] = std::numeric_limits<float>::quiet_NaN();
                     }
-                    dst += dimensions;
+                    dst += dim;
                     data_dim_major += dimensions;
                 }
-                samples += samples_to_copy;
             }
 
-//            // Update Stats
-//            for(size_t s=0; s < samples_to_copy; ++s) {
-//                for(size_t d = 0; d < dimensions; ++d) {
-//                    stats[d].Add(data_dim_major[s*dim + d]);
-//                }
-//            }
+            if(num_exact || std::count(types.begin(), types.end(), DataLogFloat16)) {
+                ApplyTypes(first_sample, end_sample, dimensions, exact_dim_major);
+            }
+            if(exact_dim_major) {
+                exact_dim_major += samples_to_copy*dimensions;
+            }
+
+            UpdateLod(first_sample, end_sample);
+            UpdateStats(first_sample, end_sample);
+
+            // Publish samples, and the LOD rows they complete, to readers
+            samples.store(end_sample, std::memory_order_release);
 
             // Copy remaining data to next block (this one is full)
             if(samples_to_copy < num_samples) {
-                nextBlock = std::unique_ptr<DataLogBlock>(new DataLogBlock(dim, max_samples, start_id + Samples()));
-                nextBlock->AddSamples(num_samples-samples_to_copy, dimensions, data_dim_major);
+                std::unique_ptr<DataLogBlock> block(new DataLogBlock(dim, max_samples, start_id + end_sample, types));
+                block->owner = owner;
+                block->AddSamples(num_samples-samples_to_copy, dimensions, data_dim_major, exact_dim_major);
+                nextBlock = std::move(block);
+                next.store(nextBlock.get(), std::memory_order_release);
             }
         }
     }
 }
 
-DataLog::DataLog(unsigned int buffer_size)
-    : block_samples_alloc(buffer_size), block0(nullptr), blockn(nullptr), record_stats(true)
+DataLog::DataLog(unsigned int buffer_size, bool single_writer)
+    : block_samples_alloc(buffer_size), single_writer(single_writer), max_blocks(0),
+      block0(nullptr), first(nullptr), blockn(nullptr), spill_src(-1),
+      types_version(0), block_types_version(0), compress_sealed(false), max_unpacked(4)
 {
 }
 
@@ -96,6 +625,20 @@ DataLog::~DataLog()
     Clear();
 }
 
+void DataLog::SetRollingWindow(size_t max_samples, const std::string& spill_filename)
+{
+    std::lock_guard<std::mutex> l(access_mutex);
+
+    // Complete blocks covering max_samples, plus the one being filled
+    max_blocks = max_samples ? std::max<size_t>(2, (max_samples + block_samples_alloc - 1) / block_samples_alloc + 1) : 0;
+
+    spill_src = -1;
+    spill.reset();
+    if(!spill_filename.empty()) {
+        spill = std::unique_ptr<PacketStreamWriter>(new PacketStreamWriter(spill_filename));
+    }
+}
+
 void DataLog::SetLabels(const std::vector<std::string> & new_labels)
 {
     std::lock_guard<std::mutex> l(access_mutex);
@@ -114,31 +657,228 @@ const std::vector<std::string>& DataLog::Labels() const
     return labels;
 }
 
+void DataLog::SetTypes(const std::vector<DataLogType>& new_types)
+{
+    std::lock_guard<std::mutex> l(access_mutex);
+    types = new_types;
+    ++types_version;
+}
+
+const std::vector<DataLogType>& DataLog::Types() const
+{
+    return types;
+}
+
+void DataLog::SetSealedCompression(bool enable, size_t max_unpacked_blocks)
+{
+    std::lock_guard<std::mutex> l(access_mutex);
+    compress_sealed = enable;
+    max_unpacked = std::max<size_t>(1, max_unpacked_blocks);
+
+    if(enable) {
+        // All but the block being written
+        for(size_t i=0; i + 1 < block_table.size(); ++i) {
+            block_table[i]->Seal();
+        }
+    }
+}
+
+void DataLog::Unpacked(const DataLogBlock* block) const
+{
+    unpacked.push_back(block);
+    while(unpacked.size() > max_unpacked) {
+        unpacked.front()->Release();
+        unpacked.pop_front();
+    }
+}
+
 void DataLog::Log(size_t dimension, const float* vals, unsigned int samples )
 {
-    if(!block0) {
-        // Create first block
-        block0 = std::unique_ptr<DataLogBlock>(new DataLogBlock(dimension, block_samples_alloc, 0));
-        blockn = block0.get();
+    if(single_writer) {
+        Append(dimension, vals, samples);
+    }else{
+        std::lock_guard<std::mutex> l(access_mutex);
+        Append(dimension, vals, samples);
     }
+}
 
-    if(record_stats) {
-        while(stats.size() < dimension) {
-            stats.push_back( DimensionStats() );
-        }
-        for(unsigned int d=0; d<dimension; ++d) {
-            DimensionStats& ds = stats[d];
-            for(unsigned int s=0; s<samples; ++s) {
-                ds.Add(vals[s*dimension+d]);
+void DataLog::Log(size_t dimension, const double* vals, unsigned int samples )
+{
+    if(single_writer) {
+        AppendTyped(dimension, vals, samples);
+    }else{
+        std::lock_guard<std::mutex> l(access_mutex);
+        AppendTyped(dimension, vals, samples);
+    }
+}
+
+void DataLog::Log(size_t dimension, const int64_t* vals, unsigned int samples )
+{
+    if(single_writer) {
+        AppendTyped(dimension, vals, samples);
+    }else{
+        std::lock_guard<std::mutex> l(access_mutex);
+        AppendTyped(dimension, vals, samples);
+    }
+}
+
+DataLogBlock* DataLog::WritableBlock(size_t dimension)
+{
+    DataLogBlock* last = blockn.load(std::memory_order_relaxed);
+    if(!last) {
+        return AddBlock(dimension, 0);
+    }
+    if(last->IsFull() || dimension > last->Dimensions() ||
+       block_types_version != types_version.load(std::memory_order_relaxed))
+    {
+        // Start a new block, big enough if dimension has grown
+        return AddBlock(std::max(dimension, last->Dimensions()), last->StartId() + last->Samples());
+    }
+    return last;
+}
+
+void DataLog::Append(size_t dimension, const float* vals, unsigned int samples )
+{
+    while(samples) {
+        DataLogBlock* last = WritableBlock(dimension);
+        const size_t n = std::min<size_t>(samples, last->SampleSpaceLeft());
+        last->AddSamples(n, dimension, vals);
+        vals += n * dimension;
+        samples -= (unsigned int)n;
+    }
+}
+
+template<typename T>
+void DataLog::AppendTyped(size_t dimension, const T* vals, unsigned int samples )
+{
+    while(samples) {
+        DataLogBlock* last = WritableBlock(dimension);
+        const size_t n = std::min<size_t>(samples, last->SampleSpaceLeft());
+
+        // Float view, and the exact values of 64 bit dimensions
+        typed_view.resize(n * dimension);
+        typed_exact.resize(n * dimension);
+        for(size_t d=0; d < dimension; ++d) {
+            const DataLogType t = last->Type(d);
+            for(size_t s=0; s < n; ++s) {
+                const size_t i = s*dimension + d;
+                typed_view[i] = ToFloat(vals[i]);
+                typed_exact[i] = IsExact(t) ? ExactBits(t, vals[i]) : 0;
             }
         }
+
+        last->AddSamples(n, dimension, typed_view.data(), typed_exact.data());
+        vals += n * dimension;
+        samples -= (unsigned int)n;
     }
+}
 
-    blockn->AddSamples(samples,dimension,vals);
+DataLogBlock* DataLog::AddBlock(size_t dimension, size_t start_id)
+{
+    // Log() already holds the lock unless single_writer. Readers of the
+    // block table and of evicted blocks hold it.
+    std::unique_lock<std::mutex> l(access_mutex, std::defer_lock);
+    if(single_writer) {
+        l.lock();
+    }
+
+    std::unique_ptr<DataLogBlock> block;
+    while(max_blocks && block_table.size() >= max_blocks) {
+        block = EvictFirstBlock();
+    }
+
+    bool same_types = true;
+    for(size_t d=0; block && d < block->Dimensions(); ++d) {
+        same_types = same_types && block->Type(d) == (d < types.size() ? types[d] : DataLogFloat32);
+    }
+    if(block && block->buffer && !block->IsSealed() && block->Dimensions() == dimension && same_types) {
+        block->Recycle(start_id);
+    }else{
+        block = std::unique_ptr<DataLogBlock>(new DataLogBlock(dimension, block_samples_alloc, start_id, types));
+        block->owner = this;
+    }
+    block_types_version = types_version.load(std::memory_order_relaxed);
+
+    DataLogBlock* b = block.get();
+    DataLogBlock* last = blockn.load(std::memory_order_relaxed);
+    if(last) {
+        last->nextBlock = std::move(block);
+        last->next.store(b, std::memory_order_release);
+        if(compress_sealed) {
+            last->Seal();
+        }
+    }else{
+        block0 = std::move(block);
+        first.store(b, std::memory_order_release);
+    }
+    block_table.push_back(b);
+    blockn.store(b, std::memory_order_release);
+    return b;
+}
+
+std::unique_ptr<DataLogBlock> DataLog::EvictFirstBlock()
+{
+    std::unique_ptr<DataLogBlock> old = std::move(block0);
+    block0 = std::move(old->nextBlock);
+    old->next.store(nullptr, std::memory_order_relaxed);
+    first.store(block0.get(), std::memory_order_release);
+    block_table.pop_front();
+    if(block_table.empty()) {
+        blockn.store(nullptr, std::memory_order_release);
+    }
 
-    // Update pointer to most recent block.
-    while(blockn->NextBlock()) {
-        blockn = blockn->NextBlock();
+    if(spill) {
+        Spill(*old);
+    }
+    unpacked.erase(std::remove(unpacked.begin(), unpacked.end(), old.get()), unpacked.end());
+    return old;
+}
+
+void DataLog::Spill(const DataLogBlock& block)
+{
+    if(!spill->IsOpen()) {
+        return;
+    }
+
+    if(spill_src < 0) {
+        PacketStreamSource pss;
+        pss.driver = pango_datalog_type;
+        pss.info["labels"] = picojson::value(picojson::array());
+        for(const std::string& label : labels) {
+            pss.info["labels"].push_back(picojson::value(label));
+        }
+        pss.data_size_bytes = 0;
+        spill_src = (int)spill->AddSource(pss);
+    }
+
+    // Each packet is one block of samples x dim floats, followed by a
+    // column of samples int64 for each 64 bit dimension of "types"
+    const size_t n = block.Samples();
+    const size_t dim = block.Dimensions();
+    picojson::value meta;
+    meta["start_id"] = picojson::value((int64_t)block.StartId());
+    meta["samples"] = picojson::value((int64_t)n);
+    meta["dim"] = picojson::value((int64_t)dim);
+    const char* data = (const char*)block.DimData(0);
+    if(std::count(block.types.begin(), block.types.end(), DataLogFloat32) == (std::ptrdiff_t)dim) {
+        spill->WriteSourcePacket(
+            (PacketStreamSourceId)spill_src, data, Time_us(TimeNow()),
+            n * dim * sizeof(float), meta
+        );
+    }else{
+        meta["types"] = picojson::value(picojson::array());
+        std::string packet(data, n * dim * sizeof(float));
+        for(size_t d=0; d < dim; ++d) {
+            meta["types"].push_back(picojson::value((int64_t)block.Type(d)));
+            if(IsExact(block.Type(d))) {
+                const int64_t* x = block.exact_data + block.exact_col[d] * block.max_samples;
+                packet.append((const char*)x, n * sizeof(int64_t));
+            }
+        }
+        spill->WriteSourcePacket(
+            (PacketStreamSourceId)spill_src, packet.data(), Time_us(TimeNow()),
+            packet.size(), meta
+        );
     }
 }
 
@@ -208,48 +948,327 @@ void DataLog::Clear()
 {
     std::lock_guard<std::mutex> l(access_mutex);
 
-    blockn = nullptr;
+    first.store(nullptr);
+    blockn.store(nullptr);
+    unpacked.clear();
     block0 = nullptr;
+    block_table.clear();
 
     stats.clear();
 }
 
-void DataLog::Save(std::string /*filename*/)
+// Saved logs hold, in host byte order:
+//   char magic[8], uint32 version, uint32 num_labels, {uint32 len, char label[len]}[num_labels]
+//   uint64 num_blocks, {uint64 start_id, uint64 dim, uint64 samples, uint64 offset}[num_blocks]
+// and at each 64 byte aligned offset, the block's DimensionStats as five
+// floats per dimension (min, max, sum, sum_sq, isMonotonic) followed by
+// its samples and LOD levels laid out as in DataLogBlock. Since version 2
+// these are followed by a DataLogType byte per dimension and, 8 byte
+// aligned, a column of samples int64 for each 64 bit dimension.
+namespace
+{
+const char datalog_magic[8] = {'P','A','N','G','O','L','O','G'};
+const uint32_t datalog_version = 2;
+const size_t datalog_align = 64;
+const size_t datalog_stats_floats = 5;
+
+template<typename T>
+void Write(std::ostream& out, const T& v)
+{
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+bool Read(const unsigned char*& p, const unsigned char* end, T& v)
+{
+    if(end - p < (std::ptrdiff_t)sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+size_t Align(size_t offset)
 {
-    // TODO: Implement
-    throw std::runtime_error("Method not implemented");
+    return (offset + datalog_align - 1) / datalog_align * datalog_align;
+}
+
+// Bytes of the stats, samples and LOD of a saved block
+size_t FloatBytes(size_t dim, size_t samples)
+{
+    return sizeof(float) * (datalog_stats_floats * dim + DataLogBlock::StorageFloats(dim, samples));
+}
+
+// Offset of the exact columns of a saved block from its start
+size_t ExactOffset(size_t dim, size_t samples)
+{
+    return (FloatBytes(dim, samples) + dim + sizeof(int64_t) - 1) / sizeof(int64_t) * sizeof(int64_t);
+}
+}
+
+void DataLog::Save(std::string filename)
+{
+    std::lock_guard<std::mutex> l(access_mutex);
+
+    std::vector<const DataLogBlock*> blocks;
+    for(const DataLogBlock* b = FirstBlock(); b; b = b->NextBlock()) {
+        if(b->Samples()) blocks.push_back(b);
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if(!out.is_open()) {
+        throw std::runtime_error("Unable to open '" + filename + "' for writing.");
+    }
+
+    out.write(datalog_magic, sizeof(datalog_magic));
+    Write(out, datalog_version);
+    Write(out, (uint32_t)labels.size());
+    size_t header_bytes = sizeof(datalog_magic) + 2*sizeof(uint32_t);
+    for(const std::string& label : labels) {
+        Write(out, (uint32_t)label.size());
+        out.write(label.data(), label.size());
+        header_bytes += sizeof(uint32_t) + label.size();
+    }
+    header_bytes += sizeof(uint64_t) + blocks.size() * 4 * sizeof(uint64_t);
+
+    // Sample counts are fixed here, since the log may still be growing
+    std::vector<size_t> samples(blocks.size());
+    std::vector<size_t> offsets(blocks.size());
+    size_t offset = Align(header_bytes);
+    Write(out, (uint64_t)blocks.size());
+    for(size_t i=0; i < blocks.size(); ++i) {
+        const DataLogBlock& b = *blocks[i];
+        samples[i] = b.Samples();
+        offsets[i] = offset;
+        Write(out, (uint64_t)b.StartId());
+        Write(out, (uint64_t)b.Dimensions());
+        Write(out, (uint64_t)samples[i]);
+        Write(out, (uint64_t)offset);
+        offset = Align(offset + ExactOffset(b.Dimensions(), samples[i]) + b.num_exact * samples[i] * sizeof(int64_t));
+    }
+
+    for(size_t i=0; i < blocks.size(); ++i) {
+        const DataLogBlock& b = *blocks[i];
+        const size_t dim = b.Dimensions();
+        const size_t n = samples[i];
+
+        const std::vector<char> pad(offsets[i] - (size_t)out.tellp(), 0);
+        out.write(pad.data(), pad.size());
+
+        for(size_t d=0; d < dim; ++d) {
+            const DimensionStats ds = b.Stats(d);
+            const float st[datalog_stats_floats] = {ds.min, ds.max, ds.sum, ds.sum_sq, ds.isMonotonic ? 1.0f : 0.0f};
+            out.write(reinterpret_cast<const char*>(st), sizeof(st));
+        }
+        out.write(reinterpret_cast<const char*>(b.DimData(0)), n * dim * sizeof(float));
+
+        // Only the complete runs of the samples saved
+        for(size_t l=1; l <= b.LodLevels() && DataLogBlock::LodFactor(l) <= n; ++l) {
+            const size_t rows = 2 * (n / DataLogBlock::LodFactor(l));
+            out.write(reinterpret_cast<const char*>(b.LodData(l)), rows * dim * sizeof(float));
+        }
+
+        std::vector<char> types(ExactOffset(dim, n) - FloatBytes(dim, n), 0);
+        for(size_t d=0; d < dim; ++d) {
+            types[d] = (char)b.Type(d);
+        }
+        out.write(types.data(), types.size());
+        for(size_t d=0; d < dim; ++d) {
+            if(IsExact(b.Type(d))) {
+                out.write(reinterpret_cast<const char*>(&b.exact_data[b.exact_col[d] * b.max_samples]), n * sizeof(int64_t));
+            }
+        }
+    }
+
+    if(!out.good()) {
+        throw std::runtime_error("Error writing '" + filename + "'.");
+    }
+}
+
+void DataLog::Load(const std::string& filename)
+{
+    std::shared_ptr<MemoryMappedFile> file = std::make_shared<MemoryMappedFile>();
+    if(!file->Open(filename)) {
+        throw std::runtime_error("Unable to map '" + filename + "'.");
+    }
+
+    const unsigned char* begin = file->data();
+    const unsigned char* end = begin + file->size();
+    const unsigned char* p = begin;
+    const std::runtime_error invalid("'" + filename + "' is not a valid DataLog file.");
+
+    char magic[sizeof(datalog_magic)];
+    uint32_t version, num_labels;
+    if(!Read(p, end, magic) || std::memcmp(magic, datalog_magic, sizeof(magic)) ||
+       !Read(p, end, version) || version < 1 || version > datalog_version || !Read(p, end, num_labels))
+    {
+        throw invalid;
+    }
+
+    std::vector<std::string> new_labels;
+    for(uint32_t i=0; i < num_labels; ++i) {
+        uint32_t len;
+        if(!Read(p, end, len) || end - p < (std::ptrdiff_t)len) throw invalid;
+        new_labels.emplace_back((const char*)p, len);
+        p += len;
+    }
+
+    uint64_t num_blocks;
+    if(!Read(p, end, num_blocks)) throw invalid;
+
+    std::vector<std::unique_ptr<DataLogBlock>> blocks;
+    for(uint64_t i=0; i < num_blocks; ++i) {
+        uint64_t start_id, dim, samples, offset;
+        if(!Read(p, end, start_id) || !Read(p, end, dim) || !Read(p, end, samples) || !Read(p, end, offset)) {
+            throw invalid;
+        }
+        if(!dim || !samples || offset % datalog_align || offset > file->size() ||
+           file->size() - offset < FloatBytes(dim, samples) + (version > 1 ? dim : 0))
+        {
+            throw invalid;
+        }
+
+        // Version 1 logs only held floats
+        std::vector<DataLogType> types(dim, DataLogFloat32);
+        int64_t* exact = nullptr;
+        if(version > 1) {
+            const unsigned char* t = file->data() + offset + FloatBytes(dim, samples);
+            size_t num_exact = 0;
+            for(size_t d=0; d < dim; ++d) {
+                if(t[d] > DataLogFloat16) throw invalid;
+                types[d] = (DataLogType)t[d];
+                num_exact += IsExact(types[d]) ? 1 : 0;
+            }
+            if(file->size() - offset < ExactOffset(dim, samples) ||
+               (file->size() - offset - ExactOffset(dim, samples)) / sizeof(int64_t) < num_exact * samples)
+            {
+                throw invalid;
+            }
+            exact = reinterpret_cast<int64_t*>(file->data() + offset + ExactOffset(dim, samples));
+        }
+
+        float* storage = reinterpret_cast<float*>(file->data() + offset);
+        blocks.emplace_back(new DataLogBlock(dim, samples, start_id, storage + datalog_stats_floats * dim, file, types, exact));
+        blocks.back()->owner = this;
+        for(size_t d=0; d < dim; ++d) {
+            const float* st = storage + datalog_stats_floats * d;
+            DimensionStats& ds = blocks.back()->stats[d];
+            ds.min = st[0];
+            ds.max = st[1];
+            ds.sum = st[2];
+            ds.sum_sq = st[3];
+            ds.isMonotonic = st[4] != 0.0f;
+        }
+    }
+
+    Clear();
+
+    std::lock_guard<std::mutex> l(access_mutex);
+    labels = new_labels;
+    types = blocks.empty() ? std::vector<DataLogType>() : blocks.back()->types;
+    block_types_version = ++types_version;
+    DataLogBlock* last = nullptr;
+    for(auto& block : blocks) {
+        DataLogBlock* b = block.get();
+        if(last) {
+            last->nextBlock = std::move(block);
+            last->next.store(b, std::memory_order_release);
+        }else{
+            block0 = std::move(block);
+        }
+        block_table.push_back(b);
+        last = b;
+    }
+    first.store(block0.get(), std::memory_order_release);
+    blockn.store(last, std::memory_order_release);
 }
 
 const DataLogBlock* DataLog::FirstBlock() const
 {
-    return block0.get();
+    return first.load(std::memory_order_acquire);
 }
 
 const DataLogBlock* DataLog::LastBlock() const
 {
-    return blockn;
+    return blockn.load(std::memory_order_acquire);
 }
 
 const DimensionStats& DataLog::Stats(size_t dim) const
 {
-    return stats[dim];
+    if(stats.size() <= dim) {
+        stats.resize(dim+1);
+    }
+
+    DimensionStats& ds = stats[dim];
+    ds.Reset();
+    for(const DataLogBlock* block = FirstBlock(); block; block = block->NextBlock()) {
+        if(dim < block->Dimensions()) {
+            ds.Merge(block->Stats(dim));
+        }
+    }
+    return ds;
 }
 
 size_t DataLog::Samples() const
 {
-    if(blockn) {
-        return blockn->StartId() + blockn->Samples();
+    if(const DataLogBlock* last = LastBlock()) {
+        return last->StartId() + last->Samples();
     }
     return 0;
 }
 
+const DataLogBlock* DataLog::FindBlock(size_t id) const
+{
+    if(block_table.empty()) {
+        return nullptr;
+    }
+
+    // Blocks are full, unless cut short by a change in dimension or type,
+    // so that the block holding id can usually be found directly.
+    const size_t first_id = block_table.front()->StartId();
+    if(id >= first_id) {
+        const size_t guess = std::min((id - first_id) / block_samples_alloc, block_table.size() - 1);
+        const DataLogBlock* b = block_table[guess];
+        if(b->StartId() <= id && id < b->StartId() + b->Samples()) {
+            return b;
+        }
+
+        auto it = std::upper_bound(block_table.begin(), block_table.end(), id,
+            [](size_t i, const DataLogBlock* blk){ return i < blk->StartId(); });
+        if(it != block_table.begin()) {
+            b = *(--it);
+            if(id < b->StartId() + b->Samples()) {
+                return b;
+            }
+        }
+    }
+    throw std::out_of_range("Index out of range.");
+}
+
 const float* DataLog::Sample(int n) const
 {
-    if(block0) {
-        return block0->Sample(n);
-    }else{
+    const DataLogBlock* b = FindBlock((size_t)n);
+    if(!b) {
         return 0;
     }
+    return b->DimData(0) + ((size_t)n - b->StartId()) * b->Dimensions();
+}
+
+double DataLog::SampleDouble(int n, size_t d) const
+{
+    const DataLogBlock* b = FindBlock((size_t)n);
+    if(!b) {
+        throw std::out_of_range("Index out of range.");
+    }
+    return b->SampleDouble((size_t)n, d);
+}
+
+int64_t DataLog::SampleInt64(int n, size_t d) const
+{
+    const DataLogBlock* b = FindBlock((size_t)n);
+    if(!b) {
+        throw std::out_of_range("Index out of range.");
+    }
+    return b->SampleInt64((size_t)n, d);
 }
 
 }
@@ -64,10 +64,63 @@ std::set<int> ConvertSequences(const std::string& str, char seq_char='$', char i
     return sequences;
 }
 
-Plotter::PlotSeries::PlotSeries()
-    : log(nullptr), drawing_mode(GL_LINE_STRIP)
+// Replace each $n of expr with the name given to n, and $i with si
+std::string RenameSequences(const std::string& expr, const std::map<int,std::string>& names)
+{
+    std::string ret;
+    for(size_t i=0; i<expr.length(); ++i) {
+        if(expr[i] == '$' && i+1 < expr.length() && expr[i+1] == 'i') {
+            ret += "si";
+            ++i;
+        }else if(expr[i] == '$') {
+            int v = 0;
+            size_t j = i+1;
+            for(; j < expr.length() && std::isdigit(expr[j]); ++j) {
+                v = v*10 + (expr[j] - '0');
+            }
+            ret += names.at(v);
+            i = j-1;
+        }else{
+            ret += expr[i];
+        }
+    }
+    return ret;
+}
+
+// Series and implicit plots with the same source share a program, per
+// thread as for GlSlUtilities since GL contexts are used by one thread.
+std::shared_ptr<GlSlProgram> CachedProgram(const std::string& vs, const std::string& fs, bool default_attribs = false)
 {
+#ifndef PANGO_NO_THREADLOCAL
+    thread_local
+#else
+    static
+#endif
+    std::map<std::string, std::weak_ptr<GlSlProgram>> cache;
+
+    const std::string key = vs + '\0' + fs + (default_attribs ? '1' : '0');
+    std::shared_ptr<GlSlProgram> prog = cache[key].lock();
+    if(!prog) {
+        for(auto it = cache.begin(); it != cache.end(); ) {
+            if(it->second.expired()) it = cache.erase(it); else ++it;
+        }
+        prog = std::make_shared<GlSlProgram>();
+        prog->AddShader( GlSlVertexShader, vs );
+        prog->AddShader( GlSlFragmentShader, fs );
+        if(default_attribs) {
+            prog->BindPangolinDefaultAttribLocationsAndLink();
+        }else{
+            prog->Link();
+        }
+        cache[key] = prog;
+    }
+    return prog;
+}
 
+Plotter::PlotSeries::PlotSeries()
+    : log(nullptr), drawing_mode(GL_LINE_STRIP), x_id(x_expression)
+{
+    for(int& d : batch_dims) d = -1;
 }
 
 // X-Y Plot given C-Code style (GLSL) expressions x and y.
@@ -96,7 +149,36 @@ void Plotter::PlotSeries::CreatePlot(const std::string &x, const std::string &y,
             "  gl_FragColor = v_color;\n"
             "}\n";
 
+    // Reads sequences from a texture buffer of the block, with the
+    // sequences and colour of each instance from PlotSeriesBlock.
+    static const std::string batch_vs_header =
+            "#version 140\n"
+            "uniform samplerBuffer u_samples;\n"
+            "uniform int u_dim;\n"
+            "uniform int u_lod_factor;\n"
+            "uniform float u_id_offset;\n"
+            "uniform vec2 u_scale;\n"
+            "uniform vec2 u_offset;\n"
+            "layout(std140) uniform PlotSeriesBlock {\n"
+            "    vec4 u_colours[" + std::to_string(max_batch) + "];\n"
+            "    ivec4 u_dims[" + std::to_string(max_batch) + "];\n"
+            "};\n"
+            "out vec4 v_color;\n"
+            "void main() {\n"
+            "    int row = gl_VertexID;\n"
+            "    ivec4 dims = u_dims[gl_InstanceID];\n"
+            "    float sn = float(u_lod_factor > 1 ? (row/2)*u_lod_factor + (row%2)*(u_lod_factor/2) : row);\n"
+            "    float si = sn + u_id_offset;\n";
+
+    static const std::string batch_vs_footer =
+            "    gl_Position = vec4(u_scale * (vec2(x, y) + u_offset),0,1);\n"
+            "    v_color = u_colours[gl_InstanceID];\n"
+            "}\n";
+
     attribs.clear();
+    batch_prog.reset();
+    batch_vs.clear();
+    for(int& d : batch_dims) d = -1;
 
     this->colour = colour;
     this->title  = GlFont::I().Text(title.c_str());
@@ -107,34 +189,60 @@ void Plotter::PlotSeries::CreatePlot(const std::string &x, const std::string &y,
     as.insert(ay.begin(), ay.end());
     contains_id = ( as.find(-1) != as.end() );
 
-    std::ostringstream oss_prog;
+    // Is x just one sequence?
+    x_id = x_expression;
+    if(ax.size() == 1) {
+        std::ostringstream oss;
+        oss << '$';
+        if(*ax.begin() < 0) oss << 'i'; else oss << *ax.begin();
+        std::string trimmed = x;
+        trimmed.erase(std::remove_if(trimmed.begin(), trimmed.end(), ::isspace), trimmed.end());
+        if(trimmed == oss.str()) x_id = *ax.begin();
+    }
 
+    // Name sequences by their order within the expressions rather than by
+    // index, so that series of the same form ('$i','$0'), ('$i','$1')... share
+    // one program, with each series binding its own sequences to it.
+    std::map<int,std::string> names;
+    std::ostringstream oss_prog;
+    std::ostringstream oss_batch;
     for(std::set<int>::const_iterator i=as.begin(); i != as.end(); ++i) {
-        std::ostringstream oss;
-        oss << "s" << *i;
-        const std::string name = *i >= 0 ? oss.str() : "sn";
-        attribs.push_back( PlotAttrib(name, *i) );
-        oss_prog << "attribute float " + name + ";\n";
+        if(*i < 0) {
+            attribs.push_back( PlotAttrib("sn", *i) );
+            oss_prog << "attribute float sn;\n";
+        }else{
+            const size_t k = names.size();
+            const std::string name = "a" + std::to_string(k);
+            names[*i] = name;
+            attribs.push_back( PlotAttrib(name, *i) );
+            oss_prog << "attribute float " + name + ";\n";
+            if(k < 4) {
+                batch_dims[k] = *i;
+                oss_batch << "    float " << name << " = texelFetch(u_samples, row*u_dim + dims[" << k << "]).r;\n";
+            }
+        }
     }
+    const std::string x_code = "float x = " + RenameSequences(x, names) + ";\n";
+    const std::string y_code = "float y = " + RenameSequences(y, names) + ";\n";
 
     oss_prog << vs_header;
     if(contains_id) {
         oss_prog << "float si = sn + u_id_offset;\n";
     }
-    oss_prog << "float x = " + ReplaceChar(x,'$','s') + ";\n";
-    oss_prog << "float y = " + ReplaceChar(y,'$','s') + ";\n";
+    oss_prog << x_code << y_code;
     oss_prog << vs_footer;
 
-    prog.AddShader( GlSlVertexShader, oss_prog.str() );
-    prog.AddShader( GlSlFragmentShader, fs );
-    prog.Link();
+    prog = CachedProgram(oss_prog.str(), fs);
 
     // Lookup attribute locations in compiled shader
-    prog.SaveBind();
     for(size_t i=0; i<attribs.size(); ++i) {
-        attribs[i].location = prog.GetAttributeHandle( attribs[i].name );
+        attribs[i].location = prog->GetAttributeHandle( attribs[i].name );
+    }
+
+    // Batched drawing is limited to four sequences, compiled once first used
+    if(names.size() <= 4) {
+        batch_vs = batch_vs_header + oss_batch.str() + "    " + x_code + "    " + y_code + batch_vs_footer;
     }
-    prog.Unbind();
 }
 
 void Plotter::PlotImplicit::CreatePlot(const std::string& code)
@@ -162,9 +270,7 @@ void Plotter::PlotImplicit::CreatePlot(const std::string& code)
             "   gl_FragColor = z;\n"
             "}\n";
 
-    prog.AddShader( GlSlVertexShader, vs );
-    prog.AddShader( GlSlFragmentShader, fs1 + code + fs2 );
-    prog.BindPangolinDefaultAttribLocationsAndLink();
+    prog = CachedProgram(vs, fs1 + code + fs2, true);
 }
 
 
@@ -202,7 +308,7 @@ Plotter::Plotter(
     Plotter* linked_plotter_x,
     Plotter* linked_plotter_y
 )   : default_log(log),
-      colour_wheel(0.6f),
+      colour_wheel(0.6f), render_count(0), batch_series(false), batch_tex(0), changed_samples(0),
       rview_default(left,right,bottom,top), rview(rview_default), target(rview),
       selection(0,0,0,0),
       track(false), track_x("$i"), track_y(""),
@@ -311,6 +417,12 @@ Plotter::Plotter(
 
 Plotter::~Plotter()
 {
+#ifndef HAVE_GLES
+    if(batch_tex) {
+        GlStateCache::I().TextureDeleted(batch_tex);
+        glDeleteTextures(1, &batch_tex);
+    }
+#endif
 
 }
 
@@ -321,19 +433,44 @@ template <typename T> int data_sgn(T val) {
 void Plotter::ComputeTrackValue( float track_val[2] )
 {
     if(trigger_edge) {
-        // Track last edge transition matching trigger_edge
-        const DataLogBlock* block = default_log->LastBlock();
-        if(block) {
-            int s = (int)block->StartId() + (int)block->Samples() - 1;
+        std::lock_guard<std::mutex> l(default_log->access_mutex);
+
+        // Blocks are only linked forwards
+        std::vector<const DataLogBlock*> blocks;
+        for(const DataLogBlock* b = default_log->FirstBlock(); b; b = b->NextBlock()) {
+            blocks.push_back(b);
+        }
+
+        // Track last edge transition matching trigger_edge, searching back
+        // from the newest sample. Blocks whose range doesn't straddle
+        // trigger_value contain no edge and are skipped by their stats.
+        int last_sgn = 0;
+        for(auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+            const DataLogBlock* block = *it;
+            const size_t samples = block->Samples();
+            if(!samples) continue;
+
+            const DimensionStats ds = block->Stats(0);
             const size_t dim = block->Dimensions();
-            const float* data = block->Sample(s);
-            int last_sgn = 0;
-            for(; s >= 0; --s, data -= dim )
-            {
-                const float val = data[0] - trigger_value;
+            const float* data = block->DimData(0);
+
+            if( !(ds.min < trigger_value && trigger_value < ds.max) ) {
+                // The edge may still fall between this block and the next
+                const int sgn = data_sgn(data[(samples-1)*dim] - trigger_value);
+                if(last_sgn * sgn == -1 && last_sgn == trigger_edge) {
+                    track_val[0] = (float)(block->StartId() + samples - 1);
+                    track_val[1] = 0.0f;
+                    return;
+                }
+                last_sgn = data_sgn(data[0] - trigger_value);
+                continue;
+            }
+
+            for(int s = (int)samples - 1; s >= 0; --s) {
+                const float val = data[s*dim] - trigger_value;
                 const int sgn = data_sgn(val);
                 if(last_sgn * sgn == -1 && last_sgn == trigger_edge) {
-                    track_val[0] = (float)s;
+                    track_val[0] = (float)(block->StartId() + s);
                     track_val[1] = 0.0f;
                     return;
                 }
@@ -352,6 +489,7 @@ XYRangef Plotter::ComputeAutoSelection()
     XYRangef range;
     range.x = target.x;
 
+    std::lock_guard<std::mutex> l(default_log->access_mutex);
     const DataLogBlock* block = default_log->FirstBlock();
 
     if(block) {
@@ -360,8 +498,11 @@ XYRangef Plotter::ComputeAutoSelection()
             if( plotseries[i].attribs.size() == 2 && plotseries[i].attribs[0].plot_id == -1) {
                 const int id = plotseries[i].attribs[1].plot_id;
                 if( 0<= id && id < (int)block->Dimensions()) {
-                    range.y.Insert(default_log->Stats(id).min);
-                    range.y.Insert(default_log->Stats(id).max);
+                    const DimensionStats& ds = default_log->Stats(id);
+                    if(ds.min <= ds.max) {
+                        range.y.Insert(ds.min);
+                        range.y.Insert(ds.max);
+                    }
                 }
             }
 
@@ -371,6 +512,225 @@ XYRangef Plotter::ComputeAutoSelection()
     return range;
 }
 
+Plotter::PlotBlock& Plotter::UploadBlock(const DataLogBlock& block)
+{
+    PlotBlock& pb = plotblocks[block.Uid()];
+    pb.last_render = render_count;
+
+    const size_t dim = block.Dimensions();
+    if(!pb.vbo.IsValid()) {
+        pb.vbo.Reinitialise(GlArrayBuffer, (GLuint)block.MaxSamples(), GL_FLOAT, (GLuint)dim, GL_DYNAMIC_DRAW);
+        pb.min.assign(dim, std::numeric_limits<float>::infinity());
+        pb.max.assign(dim, -std::numeric_limits<float>::infinity());
+        pb.uploaded = 0;
+    }
+
+    // The block may still be growing, so work from one snapshot of it
+    const size_t samples = block.Samples();
+    if(pb.uploaded < samples) {
+        // Samples are only ever appended to a block
+        const float* data = block.DimData(0) + pb.uploaded * dim;
+        const size_t n = samples - pb.uploaded;
+        pb.vbo.Upload(data, n * dim * sizeof(float), pb.uploaded * dim * sizeof(float));
+
+        for(size_t s=0; s < n; ++s) {
+            for(size_t d=0; d < dim; ++d) {
+                const float v = data[s*dim + d];
+                if(v < pb.min[d]) pb.min[d] = v;
+                if(v > pb.max[d]) pb.max[d] = v;
+            }
+        }
+        pb.uploaded = samples;
+    }
+
+    return pb;
+}
+
+bool Plotter::BlockInView(const PlotSeries& ps, const DataLogBlock& block, const PlotBlock& pb) const
+{
+    float xmin, xmax;
+    if(ps.x_id == -1) {
+        xmin = (float)block.StartId();
+        xmax = (float)(block.StartId() + block.Samples());
+    }else if(0 <= ps.x_id && ps.x_id < (int)block.Dimensions() && pb.min[ps.x_id] <= pb.max[ps.x_id]) {
+        xmin = pb.min[ps.x_id];
+        xmax = pb.max[ps.x_id];
+    }else{
+        return true;
+    }
+
+    const float view_min = std::min(rview.x.min, rview.x.max);
+    const float view_max = std::max(rview.x.min, rview.x.max);
+    return view_min <= xmax && xmin <= view_max;
+}
+
+size_t Plotter::SelectLod(const PlotSeries& ps, const DataLogBlock& block) const
+{
+    // Only sequences plotted against $i are evenly spaced in x, so only
+    // they can be swapped for their envelope.
+    if(ps.x_id != -1 || v.w <= 0) {
+        return 0;
+    }
+
+    const float samples_per_pixel = std::abs(rview.x.max - rview.x.min) / v.w;
+    size_t level = 0;
+    while(level < block.LodLevels() &&
+          DataLogBlock::LodFactor(level+1) <= samples_per_pixel &&
+          block.LodSamples(level+1) > 0)
+    {
+        ++level;
+    }
+    return level;
+}
+
+const GlBuffer& Plotter::UploadLod(const DataLogBlock& block, PlotBlock& pb, size_t level)
+{
+    if(level == 0) {
+        return pb.vbo;
+    }
+
+    if(pb.lod.size() < block.LodLevels()) {
+        pb.lod.resize(block.LodLevels());
+    }
+
+    PlotLevel& pl = pb.lod[level-1];
+    const size_t dim = block.Dimensions();
+    if(!pl.vbo.IsValid()) {
+        const size_t max_rows = 2 * (block.MaxSamples() / DataLogBlock::LodFactor(level));
+        pl.vbo.Reinitialise(GlArrayBuffer, (GLuint)max_rows, GL_FLOAT, (GLuint)dim, GL_DYNAMIC_DRAW);
+        pl.uploaded = 0;
+    }
+
+    const size_t rows = block.LodSamples(level);
+    if(pl.uploaded < rows) {
+        const float* data = block.LodData(level) + pl.uploaded * dim;
+        pl.vbo.Upload(data, (rows - pl.uploaded) * dim * sizeof(float), pl.uploaded * dim * sizeof(float));
+        pl.uploaded = rows;
+    }
+    return pl.vbo;
+}
+
+const GlBuffer& Plotter::PlotIds(const DataLogBlock& block, size_t level)
+{
+    if(plot_ids.size() <= level) {
+        plot_ids.resize(level+1);
+    }
+
+    // Rows of a level alternate between the min and max of each run, which
+    // are placed at the start and middle of the run.
+    const size_t factor = DataLogBlock::LodFactor(level);
+    const size_t rows = level ? 2 * (block.MaxSamples() / factor) : block.MaxSamples();
+    GlBuffer& ids_buffer = plot_ids[level];
+    if(ids_buffer.num_elements < rows ) {
+        std::vector<float> ids(rows);
+        for(size_t k=0; k < ids.size(); ++k) {
+            ids[k] = level ? (float)((k/2)*factor + (k%2)*(factor/2)) : (float)k;
+        }
+        ids_buffer.Reinitialise(GlArrayBuffer, (GLuint)ids.size(), GL_FLOAT, 1, GL_STATIC_DRAW);
+        ids_buffer.Upload(ids.data(), ids.size() * sizeof(float));
+    }
+    return ids_buffer;
+}
+
+namespace
+{
+const std::string batch_fs =
+        "#version 140\n"
+        "in vec4 v_color;\n"
+        "out vec4 frag_color;\n"
+        "void main() {\n"
+        "  frag_color = v_color;\n"
+        "}\n";
+}
+
+bool Plotter::BatchSupported() const
+{
+#if !defined(HAVE_GLES) && defined(HAVE_GLEW)
+    return GLEW_VERSION_3_1;
+#else
+    return false;
+#endif
+}
+
+void Plotter::RenderSeriesBatch(const std::vector<PlotSeries*>& batch, float sx, float sy, float ox, float oy)
+{
+#ifndef HAVE_GLES
+    const PlotSeries& first_ps = *batch[0];
+    GlSlProgram& prog = *first_ps.batch_prog;
+    DataLog* log = first_ps.log ? first_ps.log : default_log;
+
+    if(!batch_ubo.IsValid()) {
+        batch_ubo.Reinitialise(GlUniformBuffer, (GLuint)(2 * PlotSeries::max_batch), GL_FLOAT, 4, GL_DYNAMIC_DRAW);
+        glGenTextures(1, &batch_tex);
+    }
+
+    prog.SaveBind();
+    prog.SetUniform("u_scale",  sx, sy);
+    prog.SetUniform("u_offset", ox, oy);
+    prog.SetUniform("u_samples", 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, batch_ubo.bo);
+    GlStateCache::I().ActiveTexture(GL_TEXTURE0);
+    GlStateCache::I().BindTexture(GL_TEXTURE_BUFFER, batch_tex);
+
+    for(PlotSeries* ps : batch) ps->used = false;
+
+    std::lock_guard<std::mutex> l(log->access_mutex);
+
+    std::vector<float> colours;
+    std::vector<GLint> dims;
+    const DataLogBlock* block = log->FirstBlock();
+    for(; block; block = block->NextBlock()) {
+        PlotBlock& pb = UploadBlock(*block);
+
+        // Instances for the series this block has the sequences of, and
+        // which may be in view
+        colours.clear();
+        dims.clear();
+        for(PlotSeries* ps : batch) {
+            bool ok = true;
+            for(int d : ps->batch_dims) ok = ok && d < (int)block->Dimensions();
+            if(!ok) continue;
+            ps->used = true;
+            if(!BlockInView(*ps, *block, pb)) continue;
+            colours.insert(colours.end(), {ps->colour.r, ps->colour.g, ps->colour.b, ps->colour.a});
+            for(int d : ps->batch_dims) dims.push_back(std::max(d, 0));
+        }
+        const GLsizei instances = (GLsizei)(colours.size() / 4);
+        if(!instances) continue;
+
+        batch_ubo.Upload(colours.data(), colours.size() * sizeof(float));
+        batch_ubo.Upload(dims.data(), dims.size() * sizeof(GLint), PlotSeries::max_batch * 4 * sizeof(float));
+        prog.SetUniform("u_dim", (int)block->Dimensions());
+        prog.SetUniform("u_id_offset", (float)block->StartId());
+
+        // As for individual series, draw the envelope when zoomed out
+        // and the incomplete tail at full rate.
+        const size_t level = SelectLod(first_ps, *block);
+        size_t first = 0;
+        if(level) {
+            const GlBuffer& lod = UploadLod(*block, pb, level);
+            const size_t rows = pb.lod[level-1].uploaded;
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, lod.bo);
+            prog.SetUniform("u_lod_factor", (int)DataLogBlock::LodFactor(level));
+            glDrawArraysInstanced(first_ps.drawing_mode, 0, (GLsizei)rows, instances);
+            first = (rows / 2) * DataLogBlock::LodFactor(level);
+        }
+
+        if(first < pb.uploaded) {
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, pb.vbo.bo);
+            prog.SetUniform("u_lod_factor", 1);
+            glDrawArraysInstanced(first_ps.drawing_mode, (GLint)first, (GLsizei)(pb.uploaded - first), instances);
+        }
+    }
+
+    GlStateCache::I().BindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0);
+    prog.Unbind();
+#else
+    PANGOLIN_UNUSED(batch); PANGOLIN_UNUSED(sx); PANGOLIN_UNUSED(sy); PANGOLIN_UNUSED(ox); PANGOLIN_UNUSED(oy);
+#endif
+}
+
 void Plotter::Render()
 {
     // Animate scroll / zooming
@@ -398,14 +758,14 @@ void Plotter::Render()
     }
 
     // Try to create smooth lines
-    glDisable(GL_MULTISAMPLE);
+    GlStateCache::I().Disable(GL_MULTISAMPLE);
     glLineWidth(1.5);
-    glEnable(GL_LINE_SMOOTH);
+    GlStateCache::I().Enable(GL_LINE_SMOOTH);
     glHint( GL_LINE_SMOOTH_HINT, GL_NICEST );
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_LIGHTING);
-    glDisable( GL_DEPTH_TEST );
+    GlStateCache::I().Enable(GL_BLEND);
+    GlStateCache::I().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GlStateCache::I().Disable(GL_LIGHTING);
+    GlStateCache::I().Disable( GL_DEPTH_TEST );
 
     const float w = rview.x.AbsSize();
     const float h = rview.y.AbsSize();
@@ -489,29 +849,63 @@ void Plotter::Render()
 
     for(size_t i=0; i < plotimplicits.size(); ++i) {
         PlotImplicit& im = plotimplicits[i];
-        im.prog.SaveBind();
+        im.prog->SaveBind();
 
-        im.prog.SetUniform("u_scale",  sx, sy);
-        im.prog.SetUniform("u_offset", ox, oy);
+        im.prog->SetUniform("u_scale",  sx, sy);
+        im.prog->SetUniform("u_offset", ox, oy);
 
         glDrawRect(rview.x.min,rview.y.min,rview.x.max,rview.y.max);
 
-        im.prog.Unbind();
+        im.prog->Unbind();
     }
 
     //////////////////////////////////////////////////////////////////////////
     // Draw series
 
-    static size_t id_size = 0;
-    static float* id_array = 0;
+    ++render_count;
+
+    // Series of the same form from the same log are drawn together
+    std::vector<bool> batched(plotseries.size(), false);
+    if(batch_series && BatchSupported()) {
+        for(PlotSeries& ps : plotseries) {
+            if(!ps.batch_prog && !ps.batch_vs.empty()) {
+                ps.batch_prog = CachedProgram(ps.batch_vs, batch_fs);
+                ps.batch_prog->SetUniformBlock("PlotSeriesBlock", 0);
+            }
+        }
+
+        for(size_t i=0; i < plotseries.size(); ++i) {
+            const PlotSeries& ps = plotseries[i];
+            if(batched[i] || !ps.batch_prog || ps.drawing_mode == pangolin::DrawingModeNone) continue;
+
+            std::vector<size_t> ids(1, i);
+            for(size_t j=i+1; j < plotseries.size(); ++j) {
+                const PlotSeries& o = plotseries[j];
+                if(!batched[j] && o.batch_prog == ps.batch_prog && o.log == ps.log && o.drawing_mode == ps.drawing_mode) {
+                    ids.push_back(j);
+                }
+            }
+            if(ids.size() < 2) continue;
+
+            std::vector<PlotSeries*> batch;
+            for(size_t j : ids) {
+                batched[j] = true;
+                batch.push_back(&plotseries[j]);
+            }
+            for(size_t b=0; b < batch.size(); b += PlotSeries::max_batch) {
+                const size_t e = std::min(batch.size(), b + PlotSeries::max_batch);
+                RenderSeriesBatch(std::vector<PlotSeries*>(batch.begin()+b, batch.begin()+e), sx, sy, ox, oy);
+            }
+        }
+    }
 
     for(size_t i=0; i < plotseries.size(); ++i)
     {
         PlotSeries& ps = plotseries[i];
 
-        if(ps.drawing_mode != pangolin::DrawingModeNone)
+        if(ps.drawing_mode != pangolin::DrawingModeNone && !batched[i])
         {
-            GlSlProgram& prog = ps.prog;
+            GlSlProgram& prog = *ps.prog;
             ps.used = false;
 
             prog.SaveBind();
@@ -519,50 +913,72 @@ void Plotter::Render()
             prog.SetUniform("u_offset", ox, oy);
             prog.SetUniform("u_color", ps.colour );
 
-            // TODO: Try to skip drawing of blocks which aren't in view.
             DataLog* log = ps.log ? ps.log : default_log;
             std::lock_guard<std::mutex> l(log->access_mutex);
 
             const DataLogBlock* block = log->FirstBlock();
             while(block) {
+                // Full blocks are uploaded once, the last one as it grows
+                PlotBlock& pb = UploadBlock(*block);
+
+                if(!BlockInView(ps, *block, pb)) {
+                    ps.used = true;
+                    block = block->NextBlock();
+                    continue;
+                }
+
                 if(ps.contains_id ) {
-                    if(id_size < block->Samples() ) {
-                        // Create index array that we can bind
-                        delete[] id_array;
-                        id_size = block->MaxSamples();
-                        id_array = new float[id_size];
-                        for(size_t k=0; k < id_size; ++k) {
-                            id_array[k] = (float)k;
-                        }
-                    }
                     prog.SetUniform("u_id_offset",  (float)block->StartId() );
                 }
 
-                // Enable appropriate attributes
-                bool shouldRender = true;
-                for(size_t i=0; i< ps.attribs.size(); ++i) {
-                    if(0 <= ps.attribs[i].plot_id && ps.attribs[i].plot_id < (int)block->Dimensions() ) {
-                        glVertexAttribPointer(ps.attribs[i].location, 1, GL_FLOAT, GL_FALSE, (GLsizei)(block->Dimensions()*sizeof(float)), block->DimData(ps.attribs[i].plot_id) );
-                        glEnableVertexAttribArray(ps.attribs[i].location);
-                    }else if( ps.attribs[i].plot_id == -1 ){
-                        glVertexAttribPointer(ps.attribs[i].location, 1, GL_FLOAT, GL_FALSE, 0, id_array );
-                        glEnableVertexAttribArray(ps.attribs[i].location);
-                    }else{
-                        // bad id: don't render
-                        shouldRender = false;
-                        break;
+                // Enable appropriate attributes, returning false for bad ids
+                auto bind_attribs = [&](const GlBuffer& data, size_t level) {
+                    bool ok = true;
+                    for(size_t i=0; i< ps.attribs.size(); ++i) {
+                        if(0 <= ps.attribs[i].plot_id && ps.attribs[i].plot_id < (int)block->Dimensions() ) {
+                            data.Bind();
+                            glVertexAttribPointer(ps.attribs[i].location, 1, GL_FLOAT, GL_FALSE, (GLsizei)(block->Dimensions()*sizeof(float)), (GLvoid*)(ps.attribs[i].plot_id*sizeof(float)) );
+                            glEnableVertexAttribArray(ps.attribs[i].location);
+                        }else if( ps.attribs[i].plot_id == -1 ){
+                            PlotIds(*block, level).Bind();
+                            glVertexAttribPointer(ps.attribs[i].location, 1, GL_FLOAT, GL_FALSE, 0, 0 );
+                            glEnableVertexAttribArray(ps.attribs[i].location);
+                        }else{
+                            ok = false;
+                            break;
+                        }
                     }
+                    glBindBuffer(GL_ARRAY_BUFFER, 0);
+                    return ok;
+                };
+                auto unbind_attribs = [&]() {
+                    for(size_t i=0; i< ps.attribs.size(); ++i) {
+                        glDisableVertexAttribArray(ps.attribs[i].location);
+                    }
+                };
+
+                // When zoomed out further than a sample per pixel, draw the
+                // min/max envelope and only the incomplete tail at full rate.
+                const size_t level = SelectLod(ps, *block);
+                size_t first = 0;
+                if(level) {
+                    const GlBuffer& lod = UploadLod(*block, pb, level);
+                    const size_t rows = pb.lod[level-1].uploaded;
+                    if(bind_attribs(lod, level)) {
+                        glDrawArrays(ps.drawing_mode, 0, (GLsizei)rows);
+                        ps.used = true;
+                    }
+                    unbind_attribs();
+                    first = (rows / 2) * DataLogBlock::LodFactor(level);
                 }
 
-                if(shouldRender) {
-                    // Draw geometry
-                    glDrawArrays(ps.drawing_mode, 0, (GLsizei)block->Samples());
-                    ps.used = true;
-                }
-
-                // Disable enabled attributes
-                for(size_t i=0; i< ps.attribs.size(); ++i) {
-                    glDisableVertexAttribArray(ps.attribs[i].location);
+                if(first < pb.uploaded) {
+                    if(bind_attribs(pb.vbo, 0)) {
+                        // Draw geometry
+                        glDrawArrays(ps.drawing_mode, (GLint)first, (GLsizei)(pb.uploaded - first));
+                        ps.used = true;
+                    }
+                    unbind_attribs();
                 }
 
                 block = block->NextBlock();
@@ -571,6 +987,15 @@ void Plotter::Render()
         }
     }
 
+    // Forget blocks which no longer exist, or weren't drawn
+    for(auto it = plotblocks.begin(); it != plotblocks.end(); ) {
+        if(it->second.last_render != render_count) {
+            it = plotblocks.erase(it);
+        }else{
+            ++it;
+        }
+    }
+
     prog_lines.SaveBind();
 
     //////////////////////////////////////////////////////////////////////////
@@ -638,32 +1063,36 @@ void Plotter::Render()
 
     prog_text.SetUniform("u_scale",  2.0f / v.w, 2.0f / v.h);
     prog_text.SetUniform("u_color", colour_ax );
+    prog_text.SetUniform("u_offset", 0.0f, 0.0f );
+
+    // Tick labels share a colour so are drawn together
+    GlText labels;
 
     for( int i=tx[0]; i<tx[1]; ++i ) {
         std::ostringstream oss;
         oss << i*tdelta[0]*tick[0].factor << tick[0].symbol;
-        GlText txt = GlFont::I().Text(oss.str().c_str());
+        GlText txt = GlFont::I().Text(oss.str());
         float sx = v.w*((i)*tdelta[0]-rview.x.Mid())/w - txt.Width()/2.0f;
-        prog_text.SetUniform("u_offset", sx, 15 -v.h/2.0f );
-        txt.DrawGlSl();
+        labels.Append(txt, sx, 15 -v.h/2.0f );
     }
 
     for( int i=ty[0]; i<ty[1]; ++i ) {
         std::ostringstream oss;
         oss << i*tdelta[1]*tick[1].factor << tick[1].symbol;
-        GlText txt = GlFont::I().Text(oss.str().c_str());
+        GlText txt = GlFont::I().Text(oss.str());
         float sy = v.h*((i)*tdelta[1]-rview.y.Mid())/h - txt.Height()/2.0f;
-        prog_text.SetUniform("u_offset", 15 -v.w/2.0f, sy );
-        txt.DrawGlSl();
+        labels.Append(txt, 15 -v.w/2.0f, sy );
     }
 
+    labels.DrawGlSl();
+
     prog_text.Unbind();
 
 
     glLineWidth(1.0f);
 
 #ifndef HAVE_GLES
-    glPopAttrib();
+    GlStateCache::I().PopAttrib();
 #endif
 
 }
@@ -787,6 +1216,29 @@ void Plotter::FixSelection()
     }
 }
 
+static bool RangeMoving(const Rangef& from, const Rangef& to)
+{
+    const float eps = 1e-4f * std::max(from.AbsSize(), to.AbsSize());
+    return std::abs(to.min - from.min) > eps || std::abs(to.max - from.max) > eps;
+}
+
+bool Plotter::ContentChanged()
+{
+    size_t samples = 0;
+    for(const PlotSeries& ps : plotseries) {
+        if(ps.log) {
+            samples += ps.log->Samples();
+        }
+    }
+    const bool grown = samples != changed_samples;
+    changed_samples = samples;
+
+    // Views animate from rview toward target, or follow a linked plotter
+    const Rangef& want_x = linked_plotter_x ? linked_plotter_x->rview.x : target.x;
+    const Rangef& want_y = linked_plotter_y ? linked_plotter_y->rview.y : target.y;
+    return grown || RangeMoving(rview.x, want_x) || RangeMoving(rview.y, want_y);
+}
+
 void Plotter::UpdateView()
 {
     // Track value based on last log sample
@@ -1143,6 +1595,11 @@ std::string Plotter::PlotTitleFromExpr(const std::string& expr) const
     return exp_out.str();
 }
 
+void Plotter::SetBatchSeries(bool batch)
+{
+    batch_series = batch;
+}
+
 void Plotter::ClearSeries()
 {
     plotseries.clear();
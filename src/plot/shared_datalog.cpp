@@ -0,0 +1,298 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/plot/shared_datalog.h>
+#include <pangolin/utils/posix/shared_memory_buffer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+namespace pangolin
+{
+
+namespace
+{
+const size_t shared_datalog_align = 64;
+const uint64_t shared_datalog_recycling = std::numeric_limits<uint64_t>::max();
+
+size_t Align(size_t bytes)
+{
+    return (bytes + shared_datalog_align - 1) / shared_datalog_align * shared_datalog_align;
+}
+
+size_t SlotBytes(size_t dim, size_t block_samples)
+{
+    return Align(shared_datalog_align + sizeof(float) * DataLogBlock::StorageFloats(dim, block_samples));
+}
+
+shared_datalog_slot* Slot(shared_datalog_header* header, size_t i)
+{
+    return reinterpret_cast<shared_datalog_slot*>(reinterpret_cast<unsigned char*>(header) + header->header_bytes + i * header->slot_bytes);
+}
+
+const shared_datalog_slot* Slot(const shared_datalog_header* header, size_t i)
+{
+    return reinterpret_cast<const shared_datalog_slot*>(reinterpret_cast<const unsigned char*>(header) + header->header_bytes + i * header->slot_bytes);
+}
+
+float* SlotStorage(const shared_datalog_slot* slot)
+{
+    // The view only ever reads through the storage of its blocks
+    return reinterpret_cast<float*>(const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(slot)) + shared_datalog_align);
+}
+
+std::shared_ptr<SharedMemoryBufferInterface> CreateSegment(const std::string& name, size_t bytes)
+{
+#ifdef _WIN_
+    throw std::runtime_error("Shared DataLogs need POSIX shared memory.");
+#else
+    return create_named_shared_memory_buffer(name, bytes);
+#endif
+}
+
+std::shared_ptr<SharedMemoryBufferInterface> OpenSegment(const std::string& name)
+{
+#ifdef _WIN_
+    throw std::runtime_error("Shared DataLogs need POSIX shared memory.");
+#else
+    return open_named_shared_memory_buffer(name, false);
+#endif
+}
+}
+
+SharedDataLogWriter::SharedDataLogWriter(
+    const std::string& name, size_t dim, const std::vector<std::string>& labels,
+    size_t block_samples, size_t num_blocks
+    ) : name(name), header(nullptr), samples(0)
+{
+    if(!dim || !block_samples || num_blocks < 2) {
+        throw std::runtime_error("Shared DataLog needs dimensions, samples per block and at least 2 blocks.");
+    }
+
+    std::string label_text;
+    for(const std::string& l : labels) {
+        label_text += l + '\n';
+    }
+    if(label_text.size() >= shared_datalog_label_bytes) {
+        throw std::runtime_error("Shared DataLog labels don't fit in its header.");
+    }
+
+    const size_t header_bytes = Align(sizeof(shared_datalog_header));
+    const size_t slot_bytes = SlotBytes(dim, block_samples);
+    shm = CreateSegment(name, header_bytes + num_blocks * slot_bytes);
+    if(!shm) {
+        throw std::runtime_error("Unable to create shared memory '" + name + "'.");
+    }
+
+    std::memset(shm->ptr(), 0, header_bytes);
+    header = new (shm->ptr()) shared_datalog_header;
+    header->version = shared_datalog_version;
+    header->dim = (uint32_t)dim;
+    header->block_samples = block_samples;
+    header->num_blocks = num_blocks;
+    header->slot_bytes = slot_bytes;
+    header->header_bytes = header_bytes;
+    header->samples.store(0, std::memory_order_relaxed);
+    std::copy(label_text.begin(), label_text.end(), header->labels);
+
+    for(size_t i=0; i < num_blocks; ++i) {
+        shared_datalog_slot* slot = new (Slot(header, i)) shared_datalog_slot;
+        slot->start_id.store(shared_datalog_recycling, std::memory_order_relaxed);
+        blocks.emplace_back(new DataLogBlock(dim, block_samples, 0, SlotStorage(slot), nullptr));
+    }
+
+    // Readers check the magic before trusting the rest
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, shared_datalog_magic, sizeof(shared_datalog_magic));
+}
+
+SharedDataLogWriter::~SharedDataLogWriter()
+{
+}
+
+void SharedDataLogWriter::Log(size_t dimension, const float* vals, unsigned int num_samples)
+{
+    if(dimension > header->dim) {
+        throw std::runtime_error("Shared DataLog has fewer dimensions than logged.");
+    }
+
+    const size_t B = header->block_samples;
+    while(num_samples) {
+        const size_t k = samples / B;
+        const size_t s = samples % B;
+        DataLogBlock& block = *blocks[k % blocks.size()];
+
+        if(s == 0) {
+            // Take over the oldest slot, which readers keep hidden
+            shared_datalog_slot* slot = Slot(header, k % blocks.size());
+            slot->start_id.store(shared_datalog_recycling, std::memory_order_release);
+            block.Recycle(k * B);
+            slot->start_id.store(k * B, std::memory_order_release);
+        }
+
+        const size_t n = std::min<size_t>(num_samples, B - s);
+        block.AddSamples(n, dimension, vals);
+        vals += n * dimension;
+        num_samples -= (unsigned int)n;
+        samples += n;
+
+        // Publish the samples, and the LOD rows they complete
+        header->samples.store(samples, std::memory_order_release);
+    }
+}
+
+void SharedDataLogWriter::Log(const std::vector<float>& vals)
+{
+    Log(vals.size(), vals.data());
+}
+
+size_t SharedDataLogWriter::Dimensions() const
+{
+    return header->dim;
+}
+
+size_t SharedDataLogWriter::Samples() const
+{
+    return samples;
+}
+
+const std::string& SharedDataLogWriter::Name() const
+{
+    return name;
+}
+
+SharedDataLogView::SharedDataLogView(const std::string& name, int poll_ms)
+    : DataLog(0, true), header(nullptr), next_block(0), quit(false)
+{
+    shm = OpenSegment(name);
+    if(!shm) {
+        throw std::runtime_error("Unable to open shared memory '" + name + "'.");
+    }
+
+    header = reinterpret_cast<const shared_datalog_header*>(shm->ptr());
+    if(std::memcmp(header->magic, shared_datalog_magic, sizeof(shared_datalog_magic)) ||
+       header->version != shared_datalog_version)
+    {
+        throw std::runtime_error("'" + name + "' is not a shared DataLog.");
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    block_samples_alloc = (unsigned int)header->block_samples;
+
+    std::vector<std::string> new_labels;
+    const char* l = header->labels;
+    const char* end = header->labels + shared_datalog_label_bytes;
+    for(const char* nl; (nl = std::find(l, end, '\n')) != end; l = nl + 1) {
+        new_labels.emplace_back(l, nl);
+    }
+    SetLabels(new_labels);
+
+    Update();
+    thread = std::thread(&SharedDataLogView::Follow, this, poll_ms);
+}
+
+SharedDataLogView::~SharedDataLogView()
+{
+    quit = true;
+    if(thread.joinable()) thread.join();
+    Clear();
+}
+
+void SharedDataLogView::Follow(int poll_ms)
+{
+    while(!quit) {
+        Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+    }
+}
+
+void SharedDataLogView::Update()
+{
+    std::lock_guard<std::mutex> ul(update_mutex);
+
+    const size_t total = header->samples.load(std::memory_order_acquire);
+    if(!total) return;
+
+    const size_t B = header->block_samples;
+    const size_t N = header->num_blocks;
+    const size_t dim = header->dim;
+
+    // Hide the oldest slot, which the writer recycles next
+    const size_t last = (total - 1) / B;
+    const size_t first_visible = last + 2 > N ? last + 2 - N : 0;
+
+    // Only this thread writes, so can read the blocks without the lock
+    const auto publish = [&](DataLogBlock& block) {
+        const size_t n = std::min(B, total - block.StartId());
+        const size_t s = block.Samples();
+        if(n > s) {
+            block.UpdateStats(s, n);
+            block.samples.store(n, std::memory_order_release);
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> l(access_mutex);
+        while(!block_table.empty() && block_table.front()->StartId() < first_visible * B) {
+            EvictFirstBlock();
+        }
+    }
+
+    if(DataLogBlock* b = blockn.load(std::memory_order_relaxed)) {
+        publish(*b);
+    }
+
+    for(size_t k = std::max(next_block, first_visible); k <= last; ++k) {
+        // Skip blocks the writer has already lapped
+        const shared_datalog_slot* slot = Slot(header, k % N);
+        if(slot->start_id.load(std::memory_order_acquire) != k * B) continue;
+
+        std::unique_ptr<DataLogBlock> block(new DataLogBlock(dim, B, k * B, SlotStorage(slot), nullptr));
+        block->samples.store(0, std::memory_order_relaxed);
+        publish(*block);
+
+        std::lock_guard<std::mutex> l(access_mutex);
+        DataLogBlock* b = block.get();
+        DataLogBlock* prev = blockn.load(std::memory_order_relaxed);
+        if(prev) {
+            prev->nextBlock = std::move(block);
+            prev->next.store(b, std::memory_order_release);
+        }else{
+            block0 = std::move(block);
+            first.store(b, std::memory_order_release);
+        }
+        block_table.push_back(b);
+        blockn.store(b, std::memory_order_release);
+    }
+    next_block = std::max(next_block, last + 1);
+}
+
+}
@@ -17,18 +17,56 @@ void PyInterpreter::AttachPrefix(void* data, const std::string& name, VarValueGe
     const size_t dot = name.find_first_of('.');
     if(dot != std::string::npos) {
         const std::string base_prefix = name.substr(0,dot);
-        if( self->base_prefixes.find(base_prefix) == self->base_prefixes.end() ) {
-            self->base_prefixes.insert(base_prefix);
-            std::string cmd =
-                base_prefix + std::string(" = pangolin.Var('") +
-                base_prefix + std::string("')\n");
-            PyRun_SimpleString(cmd.c_str());
+        {
+            std::lock_guard<std::mutex> l(self->task_mutex);
+            if(!self->base_prefixes.insert(base_prefix).second) {
+                return;
+            }
         }
+
+        // Vars may be created on any thread, so bind them on the
+        // interpreter's own.
+        const std::string cmd =
+            base_prefix + std::string(" = pangolin.Var('") +
+            base_prefix + std::string("')\n");
+        self->Post([cmd](){
+            PyRun_SimpleString(cmd.c_str());
+        });
     }
 }
 
 PyInterpreter::PyInterpreter()
-    : pycompleter(0), pycomplete(0)
+    : pycompleter(0), pycomplete(0),
+      running_command(false), initialised(false), should_quit(false)
+{
+    interpreter_thread = std::thread(&PyInterpreter::Run, this);
+
+    // Completion needs the interpreter set up before we return
+    {
+        std::unique_lock<std::mutex> l(task_mutex);
+        task_cond.wait(l, [this](){ return initialised; });
+    }
+
+    // Hook namespace prefixes into Python
+    RegisterNewVarCallback(&PyInterpreter::AttachPrefix, (void*)this, "");
+    ProcessHistoricCallbacks(&PyInterpreter::AttachPrefix, (void*)this, "");
+}
+
+PyInterpreter::~PyInterpreter()
+{
+    {
+        std::lock_guard<std::mutex> l(task_mutex);
+        should_quit = true;
+        commands.clear();
+        if(running_command) {
+            PyErr_SetInterrupt();
+        }
+    }
+    task_cond.notify_all();
+    interpreter_thread.join();
+}
+
+void PyInterpreter::Initialise()
 {
 #if PY_MAJOR_VERSION >= 3
     PyImport_AppendInittab("pangolin", InitPangoModule);
@@ -37,15 +75,18 @@ PyInterpreter::PyInterpreter()
     Py_Initialize();
     InitPangoModule();
 #endif
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+#endif
 
     // Hook stdout, stderr to this interpreter
     PyObject* mod_sys = PyImport_ImportModule("sys");
     if (mod_sys) {
         PyModule_AddObject(mod_sys, "stdout", (PyObject*)new PyPangoIO(
-            &PyPangoIO::Py_type, line_queue, ConsoleLineTypeStdout
+            &PyPangoIO::Py_type, line_queue, line_mutex, ConsoleLineTypeStdout
             ));
         PyModule_AddObject(mod_sys, "stderr", (PyObject*)new PyPangoIO(
-            &PyPangoIO::Py_type, line_queue, ConsoleLineTypeStderr
+            &PyPangoIO::Py_type, line_queue, line_mutex, ConsoleLineTypeStderr
             ));
     } else {
         pango_print_error("Couldn't import module sys.\n");
@@ -75,18 +116,80 @@ PyInterpreter::PyInterpreter()
         pango_print_error("PyInterpreter: Unable to load module pangolin.\n");
     }
 
-    // Hook namespace prefixes into Python
-    RegisterNewVarCallback(&PyInterpreter::AttachPrefix, (void*)this, "");
-    ProcessHistoricCallbacks(&PyInterpreter::AttachPrefix, (void*)this, "");
-
     CheckPrintClearError();
 }
 
-PyInterpreter::~PyInterpreter()
+void PyInterpreter::Run()
 {
+    // The interpreter belongs to this thread, which makes it Python's main
+    // thread: KeyboardInterrupt from Cancel() is delivered here.
+    Initialise();
+    PyThreadState* thread_state = PyEval_SaveThread();
+
+    {
+        std::lock_guard<std::mutex> l(task_mutex);
+        initialised = true;
+    }
+    task_cond.notify_all();
+
+    while(true) {
+        std::function<void()> task;
+        std::string cmd;
+        {
+            std::unique_lock<std::mutex> l(task_mutex);
+            task_cond.wait(l, [this](){
+                return should_quit || !tasks.empty() || !commands.empty();
+            });
+            if(!tasks.empty()) {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }else if(!commands.empty()) {
+                cmd = std::move(commands.front());
+                commands.pop_front();
+                running_command = true;
+            }else{
+                break;
+            }
+        }
+
+        // The GIL is only held whilst running, leaving it free for Complete()
+        PyEval_RestoreThread(thread_state);
+        if(task) {
+            task();
+        }else{
+            PyUniqueObj obj = EvalExec(cmd);
+            if(obj && obj != Py_None) {
+                PushLine(ConsoleLine(ToString(obj), ConsoleLineTypeOutput));
+            }
+        }
+        CheckPrintClearError();
+        thread_state = PyEval_SaveThread();
+
+        std::lock_guard<std::mutex> l(task_mutex);
+        running_command = false;
+    }
+
+    PyEval_RestoreThread(thread_state);
+    Py_XDECREF(pycomplete);
+    Py_XDECREF(pycompleter);
     Py_Finalize();
 }
 
+void PyInterpreter::Post(const std::function<void()>& task)
+{
+    {
+        std::lock_guard<std::mutex> l(task_mutex);
+        tasks.push_back(task);
+    }
+    task_cond.notify_one();
+}
+
+void PyInterpreter::PushLine(const ConsoleLine& line)
+{
+    std::lock_guard<std::mutex> l(line_mutex);
+    line_queue.push(line);
+}
+
 std::string PyInterpreter::ToString(PyObject* py)
 {
     PyUniqueObj pystr = PyObject_Repr(py);
@@ -159,49 +262,70 @@ PyUniqueObj PyInterpreter::EvalExec(const std::string& cmd)
 std::vector<std::string> PyInterpreter::Complete(const std::string& cmd, int max_options)
 {
     std::vector<std::string> ret;
+
+    // Don't stall the caller behind a long running command
+    if(!pycomplete || Busy()) {
+        return ret;
+    }
+
+    PyGILState_STATE gil = PyGILState_Ensure();
     PyErr_Clear();
 
-    if(pycomplete) {
-        for(int i=0; i < max_options; ++i) {
+    for(int i=0; i < max_options; ++i) {
 #if PY_MAJOR_VERSION >= 3
-            PyUniqueObj args = PyTuple_Pack( 2, PyUnicode_FromString(cmd.c_str()), PyLong_FromSize_t(i) );
-            PyUniqueObj result = PyObject_CallObject(pycomplete, args);
-            if (result && PyUnicode_Check(result)) {
-                std::string res_str(PyUnicode_AsUTF8(result));
+        PyUniqueObj args = PyTuple_Pack( 2, PyUnicode_FromString(cmd.c_str()), PyLong_FromSize_t(i) );
+        PyUniqueObj result = PyObject_CallObject(pycomplete, args);
+        if (result && PyUnicode_Check(result)) {
+            std::string res_str(PyUnicode_AsUTF8(result));
 #else
-            PyUniqueObj args = PyTuple_Pack(2, PyString_FromString(cmd.c_str()), PyInt_FromSize_t(i));
-            PyUniqueObj result = PyObject_CallObject(pycomplete, args);
-            if (result && PyString_Check(result)) {
-                std::string res_str(PyString_AsString(result));
+        PyUniqueObj args = PyTuple_Pack(2, PyString_FromString(cmd.c_str()), PyInt_FromSize_t(i));
+        PyUniqueObj result = PyObject_CallObject(pycomplete, args);
+        if (result && PyString_Check(result)) {
+            std::string res_str(PyString_AsString(result));
 #endif
-                if( res_str.find("__")==std::string::npos ||
-                    cmd.find("__")!=std::string::npos ||
-                    (cmd.size() > 0 && cmd[cmd.size()-1] == '_')
-                ) {
-                    ret.push_back( res_str );
-                }
-            }else{
-                break;
+            if( res_str.find("__")==std::string::npos ||
+                cmd.find("__")!=std::string::npos ||
+                (cmd.size() > 0 && cmd[cmd.size()-1] == '_')
+            ) {
+                ret.push_back( res_str );
             }
+        }else{
+            break;
         }
     }
 
+    PyErr_Clear();
+    PyGILState_Release(gil);
     return ret;
 }
 
 void PyInterpreter::PushCommand(const std::string& cmd)
 {
-    PyUniqueObj obj = EvalExec(cmd);
-    if(obj && obj != Py_None) {
-        const std::string output = ToString(obj);
-        line_queue.push(
-            ConsoleLine(output, ConsoleLineTypeOutput)
-        );
+    {
+        std::lock_guard<std::mutex> l(task_mutex);
+        commands.push_back(cmd);
     }
+    task_cond.notify_one();
+}
+
+void PyInterpreter::Cancel()
+{
+    std::lock_guard<std::mutex> l(task_mutex);
+    commands.clear();
+    if(running_command) {
+        PyErr_SetInterrupt();
+    }
+}
+
+bool PyInterpreter::Busy() const
+{
+    std::lock_guard<std::mutex> l(task_mutex);
+    return running_command || !commands.empty();
 }
 
 bool PyInterpreter::PullLine(ConsoleLine& line)
 {
+    std::lock_guard<std::mutex> l(line_mutex);
     if(line_queue.size()) {
         line = line_queue.front();
         line_queue.pop();
@@ -1,5 +1,7 @@
 #include <pangolin/tools/video_viewer.h>
 
+#include <pangolin/display/frame_pacing.h>
+#include <pangolin/display/image_grid_view.h>
 #include <pangolin/display/image_view.h>
 #include <pangolin/gl/glpixformat.h>
 #include <pangolin/gl/gltexturecache.h>
@@ -10,10 +12,23 @@
 #include <pangolin/utils/timer.h>
 #include <pangolin/video/video_input.h>
 
+#include <chrono>
 
 namespace pangolin
 {
 
+// True iff every stream shares the size and format of the first
+bool StreamsShareLayout(const std::vector<StreamInfo>& streams)
+{
+    for(const StreamInfo& si : streams) {
+        if(si.Width() != streams[0].Width() || si.Height() != streams[0].Height() ||
+           !(si.PixFormat() == streams[0].PixFormat())) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void videoviewer_signal_quit(int) {
     pango_print_info("Caught signal. Program will exit after any IO is complete.\n");
     pangolin::QuitAll();
@@ -21,8 +36,12 @@ void videoviewer_signal_quit(int) {
 
 VideoViewer::VideoViewer(const std::string& window_name, const std::string& input_uri, const std::string& output_uri)
     : window_name(window_name),
+      capturing(false),
+      mailbox_seq(0),
       video_playback(nullptr),
+      video_thumbnails(nullptr),
       video_interface(nullptr),
+      seek_request(-1),
       output_uri(output_uri),
       current_frame(-1),
       grab_until(std::numeric_limits<int>::max()),
@@ -31,6 +50,8 @@ VideoViewer::VideoViewer(const std::string& window_name, const std::string& inpu
       video_grab_wait(true),
       video_grab_newest(false),
       should_run(true),
+      show_stats(false),
+      late_latch(false),
       active_cam(0)
 {
     pangolin::Var<int>::Attach("ui.frame", current_frame);
@@ -84,7 +105,8 @@ void VideoViewer::Run()
     /// Register pangolin variables
     /////////////////////////////////////////////////////////////////////////
 
-    std::unique_ptr<unsigned char[]> buffer(new unsigned char[video.SizeBytes()+1]);
+    std::vector<unsigned char> buffer;
+    std::vector<PixelFormat> formats;
 
     const int slider_size = (TotalFrames() < std::numeric_limits<int>::max() ? 20 : 0);
 
@@ -97,6 +119,7 @@ void VideoViewer::Run()
     glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     pangolin::Var<int> frame("ui.frame");
+    pangolin::Var<std::string> video_uri("ui.video_uri", video.VideoUri().full_uri);
     pangolin::Slider frame_slider("frame", frame.Ref() );
 
     if(video_playback && TotalFrames() < std::numeric_limits<int>::max())
@@ -110,7 +133,14 @@ void VideoViewer::Run()
     container.SetLayout(pangolin::LayoutEqual)
              .SetBounds(pangolin::Attach::Pix(slider_size), 1.0, 0.0, 1.0);
 
-    std::vector<ImageView> stream_views(video.Streams().size());
+    // Beyond the streams with key shortcuts, draw same format streams as one
+    // grid, rather than paying for a view per stream.
+    const bool use_grid = video.Streams().size() > 9 && StreamsShareLayout(video.Streams()) && ImageGridView::Supported();
+    ImageGridView grid_view;
+    std::vector<ImageView> stream_views(use_grid ? 0 : video.Streams().size());
+    if(use_grid) {
+        container.AddDisplay(grid_view);
+    }
     for(auto& sv : stream_views) {
         container.AddDisplay(sv);
     }
@@ -124,6 +154,40 @@ void VideoViewer::Run()
         }
     };
 
+    // Frames lost and capture-to-display latency
+    pangolin::View& stats_graphic = pangolin::Display("stats").
+            SetBounds(pangolin::Attach::Pix(-64),1.0f, 0.0f, pangolin::Attach::Pix(480));
+    stats_graphic.extern_draw_function = [&](pangolin::View& v){
+        if(show_stats) {
+            const VideoInputStats stats = video.Stats();
+            const pangolin::LatencyHistogram& l = stats.latency_us;
+            const float h = pangolin::GlFont::I().Height();
+            v.ActivatePixelOrthographic();
+            glColor3f(1.0f, 1.0f, 0.0f);
+            pangolin::GlFont::I().Text(
+                "frames %llu  dropped %llu  overwritten %llu  rejected %llu",
+                (unsigned long long)stats.frames, (unsigned long long)stats.dropped,
+                (unsigned long long)stats.overwritten, (unsigned long long)stats.rejected
+            ).Draw(4.0f, v.v.h - h);
+            if(l.Count()) {
+                pangolin::GlFont::I().Text(
+                    "latency p50 %.1fms  p99 %.1fms  max %.1fms",
+                    l.Percentile(0.5) / 1e3, l.Percentile(0.99) / 1e3, l.Max() / 1e3
+                ).Draw(4.0f, v.v.h - 2.0f * h);
+            }else{
+                pangolin::GlFont::I().Text("latency unknown").Draw(4.0f, v.v.h - 2.0f * h);
+            }
+            if(pangolin::FramePacingEnabled()) {
+                const pangolin::FramePacingStats p = pangolin::GetFramePacingStats();
+                pangolin::GlFont::I().Text(
+                    "latch %.1fms before vsync (%.1fms work, %.1fms refresh)  missed %llu",
+                    p.latch_to_vsync_ms, p.work_ms, p.refresh_ms, (unsigned long long)p.missed
+                ).Draw(4.0f, v.v.h - 3.0f * h);
+            }
+            glColor3f(1.0f, 1.0f, 1.0f);
+        }
+    };
+
     std::vector<pangolin::Image<unsigned char> > images;
 
     /////////////////////////////////////////////////////////////////////////
@@ -156,35 +220,67 @@ void VideoViewer::Run()
 
     video.Start();
 
-    // Stream and display video
+    // Buffers handed between threads are sized by the capture thread
+    mailbox_buffer.clear();
+    mailbox_images.clear();
+    mailbox_formats.clear();
+    capturing = true;
+    capture_thread = std::thread(&VideoViewer::Capture, this);
+
+    // Display the newest frame each time around
+    uint64_t shown_seq = mailbox_seq;
     while(should_run && !pangolin::ShouldQuit())
     {
+        if(late_latch != pangolin::FramePacingEnabled()) {
+            pangolin::EnableFramePacing(late_latch);
+            if(late_latch) pangolin::SetSwapInterval(1);
+        }
+
+        // Everything from here to the swap is timed as this frame's work
+        pangolin::WaitForLatchPoint();
+
         glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
         glColor3f(1.0f, 1.0f, 1.0f);
 
-        {
-            std::lock_guard<std::mutex> lock(control_mutex);
+        if(video_uri.GuiChanged()) {
+            ReconfigureInput(video_uri);
+        }
 
-            if(frame.GuiChanged()) {
-                if(video_playback) {
-                    frame = video_playback->Seek(frame) -1;
+        if(frame.GuiChanged()) {
+            // Whilst the capture thread seeks and decodes, show the nearest thumbnail
+            seek_request = frame;
+            std::vector<TypedImage> thumbs;
+            if(video_thumbnails && video_thumbnails->GetThumbnails(frame, thumbs) != size_t(-1)) {
+                for(size_t i=0; i < thumbs.size() && i < stream_views.size(); ++i) {
+                    if(thumbs[i].ptr) stream_views[i].SetImage(thumbs[i]);
+                }
+                bool grid_thumbs = use_grid && !thumbs.empty();
+                for(const TypedImage& t : thumbs) {
+                    grid_thumbs = grid_thumbs && t.ptr && t.w == thumbs[0].w && t.h == thumbs[0].h;
+                }
+                if(grid_thumbs) {
+                    grid_view.SetImages(std::vector<Image<unsigned char>>(thumbs.begin(), thumbs.end()), GlPixFormat(thumbs[0].fmt));
                 }
-                grab_until = frame + 1;
             }
+        }
 
-            if ( frame < grab_until && video.Grab(&buffer[0], images, video_grab_wait, video_grab_newest)) {
-                frame = frame +1;
-
-                if(frame_changed_callback) {
-                    frame_changed_callback(buffer.get(), images, GetVideoFrameProperties(video_interface));
-                }
+        bool new_frame = false;
+        {
+            std::lock_guard<std::mutex> lock(mailbox_mutex);
+            if(mailbox_seq != shown_seq) {
+                std::swap(buffer, mailbox_buffer);
+                std::swap(images, mailbox_images);
+                std::swap(formats, mailbox_formats);
+                shown_seq = mailbox_seq;
+                new_frame = true;
+            }
+        }
 
-                // Update images
-                if((frame-1) % draw_nth_frame == 0) {
-                    for(unsigned int i=0; i<images.size(); ++i) {
-                        stream_views[i].SetImage(images[i], pangolin::GlPixFormat(video.Streams()[i].PixFormat() ));
-                    }
-                }
+        if(new_frame && use_grid) {
+            grid_view.SetImages(images, pangolin::GlPixFormat(formats[0]));
+        }else if(new_frame) {
+            for(unsigned int i=0; i<images.size() && i<stream_views.size(); ++i) {
+                stream_views[i].SetImage(images[i], pangolin::GlPixFormat(formats[i]));
             }
         }
 
@@ -193,9 +289,76 @@ void VideoViewer::Run()
         pangolin::FinishFrame();
     }
 
+    capturing = false;
+    capture_thread.join();
+
+    pangolin::EnableFramePacing(false);
+
     pangolin::DestroyWindow(window_name);
 }
 
+void VideoViewer::Capture()
+{
+    std::vector<unsigned char> buffer;
+    std::vector<pangolin::Image<unsigned char> > images;
+    std::vector<PixelFormat> formats;
+
+    while(capturing && should_run)
+    {
+        bool grabbed = false;
+        bool publish = false;
+        {
+            std::lock_guard<std::mutex> lock(control_mutex);
+
+            // Only the latest of several seeks made whilst busy is carried out
+            const int seek_to = seek_request.exchange(-1);
+            if(seek_to >= 0) {
+                current_frame = video_playback ? (int)video_playback->Seek(seek_to) - 1 : seek_to;
+                grab_until = current_frame + 1;
+            }
+
+            // The input may have been reconfigured since the last frame
+            const bool open = !video.InputStreams().empty();
+            if(open && buffer.size() < video.SizeBytes() + 1) {
+                buffer.resize(video.SizeBytes() + 1);
+            }
+
+            if ( open && current_frame < grab_until && video.Grab(&buffer[0], images, video_grab_wait, video_grab_newest)) {
+                grabbed = true;
+                current_frame = current_frame +1;
+
+                formats.clear();
+                for(const StreamInfo& si : video.Streams()) {
+                    formats.push_back(si.PixFormat());
+                }
+
+                if(frame_changed_callback) {
+                    frame_changed_callback(buffer.data(), images, GetVideoFrameProperties(video_interface));
+                }
+
+                publish = (current_frame-1) % draw_nth_frame == 0;
+            }
+        }
+
+        if(publish) {
+            // Replace whatever the render thread hasn't picked up yet
+            {
+                std::lock_guard<std::mutex> lock(mailbox_mutex);
+                std::swap(buffer, mailbox_buffer);
+                std::swap(images, mailbox_images);
+                std::swap(formats, mailbox_formats);
+                ++mailbox_seq;
+            }
+            pangolin::PostRedisplay();
+        }
+
+        if(!grabbed) {
+            // Paused, or no frame ready without waiting
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
 void VideoViewer::RegisterDefaultKeyShortcutsAndPangoVariables()
 {
     pangolin::RegisterKeyPressCallback(' ', [this](){TogglePlay();} );
@@ -212,19 +375,43 @@ void VideoViewer::RegisterDefaultKeyShortcutsAndPangoVariables()
     pangolin::RegisterKeyPressCallback('G', [this](){ChangeGain(1);} );
     pangolin::RegisterKeyPressCallback('g', [this](){ChangeGain(-1);} );
     pangolin::RegisterKeyPressCallback('c', [this](){SetActiveCamera(+1);} );
+    pangolin::RegisterKeyPressCallback('i', [this](){ToggleShowStats();} );
+    pangolin::RegisterKeyPressCallback('l', [this](){ToggleLateLatch();} );
 }
 
 void VideoViewer::OpenInput(const std::string& input_uri)
 {
     std::lock_guard<std::mutex> lock(control_mutex);
     video.Open(input_uri, output_uri);
+    InputOpened();
+}
 
+void VideoViewer::ReconfigureInput(const std::string& input_uri)
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    try {
+        video.Reconfigure(input_uri);
+    }catch(const std::exception& e) {
+        pango_print_error("Unable to reconfigure video: %s\n", e.what());
+        if(video.InputStreams().empty()) {
+            // Not even the previous input could be reopened
+            video_playback = nullptr;
+            video_thumbnails = nullptr;
+            video_interface = nullptr;
+            return;
+        }
+    }
+    InputOpened();
+}
+
+void VideoViewer::InputOpened()
+{
     // Output details of video stream
     for(size_t s = 0; s < video.Streams().size(); ++s) {
         const pangolin::StreamInfo& si = video.Streams()[s];
         std::cout << FormatString(
             "Stream %: % x % % (pitch: % bytes)",
-            s, si.Width(), si.Height(), si.PixFormat().format, si.Pitch()
+            s, si.Width(), si.Height(), si.PixFormat().Name(), si.Pitch()
         ) << std::endl;
     }
 
@@ -234,8 +421,15 @@ void VideoViewer::OpenInput(const std::string& input_uri)
     }
 
     video_playback = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoPlaybackInterface>(video);
+    video_thumbnails = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoThumbnailInterface>(video);
     video_interface = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoInterface>(video);
 
+    // Make stepping back and forth over recent frames cheap
+    pangolin::VideoFrameCacheInterface* video_cache = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoFrameCacheInterface>(video);
+    if(video_cache && video_cache->FrameCacheBudget() == 0) {
+        video_cache->SetFrameCache(FRAME_CACHE_MB * 1024 * 1024, FRAME_CACHE_AHEAD);
+    }
+
     if(TotalFrames() < std::numeric_limits<int>::max() ) {
         std::cout << "Video length: " << TotalFrames() << " frames" << std::endl;
         grab_until = 0;
@@ -250,6 +444,9 @@ void VideoViewer::CloseInput()
 {
     std::lock_guard<std::mutex> lock(control_mutex);
     video.Close();
+    video_playback = nullptr;
+    video_thumbnails = nullptr;
+    video_interface = nullptr;
 }
 
 void VideoViewer::Record()
@@ -314,6 +511,26 @@ void VideoViewer::ToggleWaitForFrames()
     }
 }
 
+void VideoViewer::ToggleShowStats()
+{
+    show_stats = !show_stats;
+}
+
+void VideoViewer::ToggleLateLatch()
+{
+    SetLateLatch(!late_latch);
+}
+
+void VideoViewer::SetLateLatch(bool new_state)
+{
+    late_latch = new_state;
+    if(late_latch) {
+        pango_print_info("Latching the newest frame just before vsync.\n");
+    }else{
+        pango_print_info("Drawing frames as soon as possible.\n");
+    }
+}
+
 void VideoViewer::SetDiscardBufferedFrames(bool new_state)
 {
     std::lock_guard<std::mutex> lock(control_mutex);
@@ -0,0 +1,106 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/base64.h>
+
+#include <stdexcept>
+
+namespace pangolin
+{
+
+namespace
+{
+const char* base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int Base64Value(char c)
+{
+    if('A' <= c && c <= 'Z') return c - 'A';
+    if('a' <= c && c <= 'z') return c - 'a' + 26;
+    if('0' <= c && c <= '9') return c - '0' + 52;
+    if(c == '+') return 62;
+    if(c == '/') return 63;
+    return -1;
+}
+}
+
+std::string Base64Encode(const std::string& bytes)
+{
+    std::string text;
+    text.reserve(4 * ((bytes.size() + 2) / 3));
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data());
+    size_t i = 0;
+    for(; i + 2 < bytes.size(); i += 3) {
+        const unsigned v = (p[i] << 16) | (p[i+1] << 8) | p[i+2];
+        text += base64_chars[(v >> 18) & 63];
+        text += base64_chars[(v >> 12) & 63];
+        text += base64_chars[(v >> 6) & 63];
+        text += base64_chars[v & 63];
+    }
+
+    const size_t remaining = bytes.size() - i;
+    if(remaining) {
+        const unsigned v = (p[i] << 16) | (remaining > 1 ? p[i+1] << 8 : 0);
+        text += base64_chars[(v >> 18) & 63];
+        text += base64_chars[(v >> 12) & 63];
+        text += remaining > 1 ? base64_chars[(v >> 6) & 63] : '=';
+        text += '=';
+    }
+    return text;
+}
+
+std::string Base64Decode(const std::string& text)
+{
+    if(text.size() % 4) {
+        throw std::runtime_error("Invalid base64 length");
+    }
+
+    std::string bytes;
+    bytes.reserve(3 * (text.size() / 4));
+
+    for(size_t i = 0; i < text.size(); i += 4) {
+        const bool last = i + 4 == text.size();
+        const size_t padding = last ? (text[i+3] == '=') + (text[i+2] == '=') : 0;
+
+        unsigned v = 0;
+        for(size_t j = 0; j < 4 - padding; ++j) {
+            const int d = Base64Value(text[i+j]);
+            if(d < 0) {
+                throw std::runtime_error("Invalid base64 character");
+            }
+            v = (v << 6) | d;
+        }
+        v <<= 6 * padding;
+
+        bytes += char((v >> 16) & 0xff);
+        if(padding < 2) bytes += char((v >> 8) & 0xff);
+        if(padding < 1) bytes += char(v & 0xff);
+    }
+    return bytes;
+}
+
+}
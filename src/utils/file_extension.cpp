@@ -56,6 +56,10 @@ std::string ImageFileTypeToName(ImageFileType t)
         return "pango";
     case ImageFileTypePvn:
         return "pvn";
+    case ImageFileTypeZstd:
+        return "zstd";
+    case ImageFileTypeDepth:
+        return "depth";
     case ImageFileTypeUnknown:
     default:
         return "unknown";
@@ -88,6 +92,8 @@ ImageFileType NameToImageFileType(const std::string& name)
         return ImageFileTypePvn;
     else if ("zstd" == name)
         return ImageFileTypeZstd;
+    else if ("depth" == name)
+        return ImageFileTypeDepth;
 
     return ImageFileTypeUnknown;
 }
@@ -114,6 +120,8 @@ ImageFileType FileTypeExtension(const std::string& ext)
         return ImageFileTypePango;
     } else if( ext == ".zstd"  ) {
         return ImageFileTypeZstd;
+    } else if( ext == ".depth"  ) {
+        return ImageFileTypeDepth;
     } else {
         return ImageFileTypeUnknown;
     }
@@ -145,6 +153,7 @@ ImageFileType FileTypeMagic(const unsigned char data[], size_t bytes)
         const unsigned char magic_exr[]   = "\x76\x2F\x31\x01";
         const unsigned char magic_pango[] = "PANGO";
         const unsigned char magic_pango_zstd[] = "ZSTD";
+        const unsigned char magic_pango_depth[] = "PDEP";
 
         if( !strncmp((char*)data, (char*)magic_png, 8) ) {
             return ImageFileTypePng;
@@ -163,6 +172,8 @@ ImageFileType FileTypeMagic(const unsigned char data[], size_t bytes)
             return ImageFileTypePango;
         }else if( !strncmp((char*)data, (char*)magic_pango_zstd,4) ) {
             return ImageFileTypeZstd;
+        }else if( !strncmp((char*)data, (char*)magic_pango_depth,4) ) {
+            return ImageFileTypeDepth;
         }else if( data[0] == 'P' && '0' < data[1] && data[1] < '9') {
             return ImageFileTypePpm;
         }
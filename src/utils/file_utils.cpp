@@ -220,11 +220,9 @@ std::string PathExpand(const std::string& sPath)
 }
 
 // Based on http://www.codeproject.com/Articles/188256/A-Simple-Wildcard-Matching-Function
-bool MatchesWildcard(const std::string& str, const std::string& wildcard)
+// Operate on raw strings so recursion on '*' doesn't allocate
+static bool MatchesWildcard(const char* psQuery, const char* psWildcard)
 {
-    const char* psQuery = str.c_str();
-    const char* psWildcard = wildcard.c_str();
-    
     while(*psWildcard)
     {
         if(*psWildcard=='?')
@@ -255,6 +253,11 @@ bool MatchesWildcard(const std::string& str, const std::string& wildcard)
     return !*psQuery && !*psWildcard;
 }
 
+bool MatchesWildcard(const std::string& str, const std::string& wildcard)
+{
+    return MatchesWildcard(str.c_str(), wildcard.c_str());
+}
+
 std::string MakeUniqueFilename(const std::string& filename)
 {
     if( FileExists(filename) ) {
@@ -436,6 +439,19 @@ bool FileExists(const std::string& filename)
     return exists;
 }
 
+bool MakeDirectories(const std::string& path)
+{
+    for(size_t i = path.find_first_of("/\\", 1); ; i = path.find_first_of("/\\", i+1)) {
+        const std::string parent = path.substr(0, i);
+        if(!parent.empty() && !FileExists(parent)) {
+            CreateDirectory(s2ws(parent).c_str(), NULL);
+        }
+        if(i == std::string::npos) break;
+    }
+    const DWORD attribs = GetFileAttributes(s2ws(path).c_str());
+    return attribs != INVALID_FILE_ATTRIBUTES && (attribs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
 #else // _WIN_
 
 bool FilesMatchingWildcard(const std::string& wildcard, std::vector<std::string>& file_vec)
@@ -455,23 +471,27 @@ bool FilesMatchingWildcard(const std::string& wildcard, std::vector<std::string>
     
     sPath = PathExpand(sPath);
         
-    struct dirent **namelist;
-    int n = scandir(sPath.c_str(), &namelist, 0, alphasort ); // sort alpha-numeric
-//    int n = scandir(sPath.c_str(), &namelist, 0, versionsort ); // sort aa1 < aa10 < aa100 etc.
-    if (n >= 0){
-        std::list<std::string> file_list;
-        while( n-- ){
-            const std::string sName(namelist[n]->d_name);
-            if( sName != "." && sName != ".." && MatchesWildcard(sName, sFileWc) ) {
-                const std::string sFullName = sPath + "/" + sName;
-                file_list.push_front( sFullName );
+    // Single pass over the directory. Only matching names are kept and no
+    // entry is stat'd, which matters for directories of millions of files.
+    DIR* dir = opendir(sPath.c_str());
+    if (dir){
+        std::vector<std::string> files;
+        while(const struct dirent* ent = readdir(dir)) {
+            const char* name = ent->d_name;
+#ifdef _DIRENT_HAVE_D_TYPE
+            if(ent->d_type == DT_DIR) continue;
+#endif
+            if( strcmp(name,".") && strcmp(name,"..") && MatchesWildcard(name, sFileWc.c_str()) ) {
+                files.push_back( sPath + "/" + name );
             }
-            free(namelist[n]);
         }
-        free(namelist);
-        
-        file_vec.reserve(file_list.size());
-        file_vec.insert(file_vec.begin(), file_list.begin(), file_list.end());
+        closedir(dir);
+
+        // Byte-wise order, matching alphasort in the C locale.
+        std::sort(files.begin(), files.end());
+
+        file_vec.reserve(file_vec.size() + files.size());
+        file_vec.insert(file_vec.begin(), files.begin(), files.end());
         return file_vec.size() > 0;
     }
     return false;
@@ -483,6 +503,19 @@ bool FileExists(const std::string& filename)
     return stat(filename.c_str(), &buf) != -1;
 }
 
+bool MakeDirectories(const std::string& path)
+{
+    for(size_t i = path.find('/', 1); ; i = path.find('/', i+1)) {
+        const std::string parent = path.substr(0, i);
+        if(!parent.empty() && mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+        if(i == std::string::npos) break;
+    }
+    struct stat buf;
+    return stat(path.c_str(), &buf) == 0 && S_ISDIR(buf.st_mode);
+}
+
 #endif //_WIN_
 
 }
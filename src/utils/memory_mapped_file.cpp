@@ -0,0 +1,122 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/memory_mapped_file.h>
+
+#include <algorithm>
+
+#ifndef _WIN_
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace pangolin
+{
+
+MemoryMappedFile::MemoryMappedFile()
+    : ptr(nullptr), size_bytes(0)
+{
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    Close();
+}
+
+bool MemoryMappedFile::Open(const std::string& filename)
+{
+    Close();
+
+#ifndef _WIN_
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    // The mapping holds its own reference to the file
+    ::close(fd);
+
+    if(p == MAP_FAILED) {
+        return false;
+    }
+
+    ptr = static_cast<unsigned char*>(p);
+    size_bytes = (size_t)st.st_size;
+    return true;
+#else
+    PANGOLIN_UNUSED(filename);
+    return false;
+#endif
+}
+
+void MemoryMappedFile::Close()
+{
+#ifndef _WIN_
+    if(ptr) {
+        munmap(ptr, size_bytes);
+    }
+#endif
+    ptr = nullptr;
+    size_bytes = 0;
+}
+
+void MemoryMappedFile::AdviseSequential() const
+{
+#ifndef _WIN_
+    if(ptr) {
+        madvise(ptr, size_bytes, MADV_SEQUENTIAL);
+    }
+#endif
+}
+
+void MemoryMappedFile::AdviseWillNeed(size_t offset, size_t len) const
+{
+#ifndef _WIN_
+    if(ptr && offset < size_bytes) {
+        // madvise needs a page aligned start
+        static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t begin = offset - (offset % page);
+        const size_t end = std::min(offset + len, size_bytes);
+        madvise(ptr + begin, end - begin, MADV_WILLNEED);
+    }
+#else
+    PANGOLIN_UNUSED(offset);
+    PANGOLIN_UNUSED(len);
+#endif
+}
+
+}
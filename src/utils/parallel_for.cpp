@@ -0,0 +1,309 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/parallel_for.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pangolin
+{
+
+namespace
+{
+
+std::mutex settings_mutex;
+ParallelPoolSettings settings;
+bool pool_started = false;
+
+// Thread pool with a task queue per worker plus one for other threads.
+// Workers run their own tasks most recent first (those of nested
+// ParallelFor calls, whose data is likely still in cache) and when out of
+// work take the oldest tasks of the other queues.
+class WorkerPool
+{
+public:
+    static WorkerPool& I()
+    {
+        // Intentionally never destroyed so that workers outlive static destructors.
+        static WorkerPool* pool = Create();
+        return *pool;
+    }
+
+    size_t NumWorkers() const
+    {
+        return num_workers;
+    }
+
+    void Push(std::function<void()>&& task)
+    {
+        Queue& q = *queues[CurrentIndex() < 0 ? num_workers : size_t(CurrentIndex())];
+        // Counted first so that pending never undercounts queued tasks
+        ++pending;
+        {
+            std::lock_guard<std::mutex> l(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            // Pairs with the check in WorkLoop, so that the wakeup can't be missed
+            std::lock_guard<std::mutex> l(sleep_mutex);
+        }
+        cv.notify_one();
+    }
+
+    // Run one queued task on the calling thread if any are waiting.
+    bool TryRunOne()
+    {
+        std::function<void()> task;
+        if(!Pop(task)) return false;
+        task();
+        return true;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static WorkerPool* Create()
+    {
+        std::lock_guard<std::mutex> l(settings_mutex);
+        pool_started = true;
+        const size_t n = settings.num_workers >= 0 ? size_t(settings.num_workers) :
+            size_t(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return new WorkerPool(n, settings.placement);
+    }
+
+    WorkerPool(size_t num_workers, const ThreadPlacement& placement)
+        : num_workers(num_workers), pending(0)
+    {
+        for(size_t i=0; i <= num_workers; ++i) {
+            queues.emplace_back(new Queue());
+        }
+        for(size_t i=0; i < num_workers; ++i) {
+            ThreadPlacement p = placement;
+            if(!p.cpus.empty()) {
+                p.cpus = std::vector<int>(1, placement.cpus[i % placement.cpus.size()]);
+            }
+            std::thread([this, i, p](){
+                if(!p.IsDefault()) ApplyThreadPlacement(p);
+                CurrentIndex() = int(i);
+                WorkLoop();
+            }).detach();
+        }
+    }
+
+    // Queue of the calling worker, or -1 for other threads
+    static int& CurrentIndex()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    bool PopFront(Queue& q, std::function<void()>& task)
+    {
+        std::lock_guard<std::mutex> l(q.mutex);
+        if(q.tasks.empty()) return false;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool Pop(std::function<void()>& task)
+    {
+        if(pending == 0) return false;
+
+        const int self = CurrentIndex();
+        if(self >= 0) {
+            Queue& q = *queues[self];
+            std::lock_guard<std::mutex> l(q.mutex);
+            if(!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                --pending;
+                return true;
+            }
+        }
+
+        // Steal, starting after our own queue to spread contention
+        const size_t n = queues.size();
+        const size_t start = self >= 0 ? size_t(self) + 1 : n - 1;
+        for(size_t k = 0; k < n; ++k) {
+            const size_t v = (start + k) % n;
+            if(int(v) != self && PopFront(*queues[v], task)) {
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkLoop()
+    {
+        for(;;) {
+            std::function<void()> task;
+            if(Pop(task)) {
+                task();
+            }else{
+                std::unique_lock<std::mutex> l(sleep_mutex);
+                cv.wait(l, [this](){ return pending > 0; });
+            }
+        }
+    }
+
+    const size_t num_workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> pending;
+    std::mutex sleep_mutex;
+    std::condition_variable cv;
+};
+
+}
+
+bool ConfigureParallelPool(const ParallelPoolSettings& new_settings)
+{
+    std::lock_guard<std::mutex> l(settings_mutex);
+    if(pool_started) return false;
+    settings = new_settings;
+    return true;
+}
+
+size_t ParallelConcurrency()
+{
+    return WorkerPool::I().NumWorkers() + 1;
+}
+
+void ParallelSubmit(std::function<void()>&& task)
+{
+    WorkerPool::I().Push(std::move(task));
+}
+
+bool ParallelRunOne()
+{
+    return WorkerPool::I().TryRunOne();
+}
+
+void ParallelForTiles(size_t w, size_t h, size_t tile_w, size_t tile_h, size_t num_tasks, const std::function<void(size_t,size_t,size_t,size_t)>& f)
+{
+    if(w == 0 || h == 0) return;
+    tile_w = std::max<size_t>(tile_w, 1);
+    tile_h = std::max<size_t>(tile_h, 1);
+    const size_t tiles_x = (w + tile_w - 1) / tile_w;
+    const size_t tiles_y = (h + tile_h - 1) / tile_h;
+    ParallelFor(0, tiles_x * tiles_y, num_tasks, [&](size_t t0, size_t t1) {
+        for(size_t t = t0; t < t1; ++t) {
+            const size_t x0 = (t % tiles_x) * tile_w;
+            const size_t y0 = (t / tiles_x) * tile_h;
+            f(x0, y0, std::min(x0 + tile_w, w), std::min(y0 + tile_h, h));
+        }
+    });
+}
+
+void ParallelFor(size_t begin, size_t end, size_t num_tasks, const std::function<void(size_t,size_t)>& f)
+{
+    if(end <= begin) return;
+
+    const size_t n = end - begin;
+    if(num_tasks == 0) num_tasks = ParallelConcurrency();
+    num_tasks = std::min(num_tasks, n);
+
+    if(num_tasks <= 1) {
+        f(begin, end);
+        return;
+    }
+
+    WorkerPool& pool = WorkerPool::I();
+
+    struct Shared {
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+    shared->remaining = num_tasks - 1;
+
+    auto range = [&](size_t i, size_t& b, size_t& e) {
+        b = begin + (n * i) / num_tasks;
+        e = begin + (n * (i+1)) / num_tasks;
+    };
+
+    for(size_t i=1; i < num_tasks; ++i) {
+        size_t b, e;
+        range(i, b, e);
+        pool.Push([shared,&f,b,e](){
+            try {
+                f(b, e);
+            }catch(...) {
+                std::lock_guard<std::mutex> l(shared->mutex);
+                shared->error = std::current_exception();
+            }
+            if(--shared->remaining == 0) {
+                std::lock_guard<std::mutex> l(shared->mutex);
+                shared->cv.notify_all();
+            }
+        });
+    }
+
+    size_t b, e;
+    range(0, b, e);
+    std::exception_ptr error;
+    try {
+        f(b, e);
+    }catch(...) {
+        // Other ranges still reference f, so wait for them before rethrowing.
+        error = std::current_exception();
+    }
+
+    // Help with outstanding work rather than block, so that nested calls
+    // can't starve the pool.
+    while(shared->remaining > 0) {
+        if(!pool.TryRunOne()) {
+            std::unique_lock<std::mutex> l(shared->mutex);
+            shared->cv.wait_for(l, std::chrono::milliseconds(1), [&](){ return shared->remaining == 0; });
+        }
+    }
+
+    if(!error) {
+        std::lock_guard<std::mutex> l(shared->mutex);
+        error = shared->error;
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}
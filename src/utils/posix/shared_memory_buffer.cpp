@@ -124,8 +124,13 @@ std::shared_ptr<SharedMemoryBufferInterface> open_named_shared_memory_buffer(con
   }
 
   size_t size = sbuf.st_size;
-  unsigned char *buffer = reinterpret_cast<unsigned char *>(mmap(NULL, size,
-      PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0));
+  void *mapped = mmap(NULL, size,
+      readwrite ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == mapped) {
+    close(fd);
+    return ptr;
+  }
+  unsigned char *buffer = reinterpret_cast<unsigned char *>(mapped);
 
   ptr.reset(new PosixSharedMemoryBuffer(fd, buffer, size, false, name));
   return ptr;
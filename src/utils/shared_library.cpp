@@ -0,0 +1,117 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/shared_library.h>
+
+#ifdef _WIN_
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <dlfcn.h>
+#endif
+
+namespace pangolin
+{
+
+SharedLibrary::SharedLibrary()
+    : handle(nullptr)
+{
+}
+
+SharedLibrary::~SharedLibrary()
+{
+    Close();
+}
+
+SharedLibrary::SharedLibrary(SharedLibrary&& o)
+    : handle(o.handle), error(std::move(o.error))
+{
+    o.handle = nullptr;
+}
+
+SharedLibrary& SharedLibrary::operator=(SharedLibrary&& o)
+{
+    if(this != &o) {
+        Close();
+        handle = o.handle;
+        error = std::move(o.error);
+        o.handle = nullptr;
+    }
+    return *this;
+}
+
+bool SharedLibrary::Open(const std::string& path)
+{
+    Close();
+#ifdef _WIN_
+    handle = (void*)LoadLibraryA(path.c_str());
+    if(!handle) {
+        error = "LoadLibrary failed with error " + std::to_string(GetLastError());
+    }
+#else
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!handle) {
+        const char* e = dlerror();
+        error = e ? e : "dlopen failed";
+    }
+#endif
+    return handle != nullptr;
+}
+
+void SharedLibrary::Close()
+{
+    if(handle) {
+#ifdef _WIN_
+        FreeLibrary((HMODULE)handle);
+#else
+        dlclose(handle);
+#endif
+        handle = nullptr;
+    }
+}
+
+void* SharedLibrary::Symbol(const std::string& name) const
+{
+    if(!handle) return nullptr;
+#ifdef _WIN_
+    return (void*)GetProcAddress((HMODULE)handle, name.c_str());
+#else
+    return dlsym(handle, name.c_str());
+#endif
+}
+
+std::string SharedLibrary::FileName(const std::string& name)
+{
+#ifdef _WIN_
+    return name + ".dll";
+#else
+    // Also the CMake default for modules on macOS
+    return name + ".so";
+#endif
+}
+
+}
@@ -0,0 +1,144 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/thread_affinity.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/format_string.h>
+#include <pangolin/utils/log.h>
+
+#include <fstream>
+#include <cstdlib>
+
+#ifdef _LINUX_
+#  include <pthread.h>
+#  include <sched.h>
+#  include <sys/mman.h>
+#endif
+
+namespace pangolin
+{
+
+std::vector<int> ParseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    for(const std::string& range : Split(list, ',')) {
+        if(range.empty()) continue;
+        const size_t dash = range.find('-');
+        const int first = std::atoi(range.substr(0,dash).c_str());
+        const int last  = dash == std::string::npos ? first : std::atoi(range.substr(dash+1).c_str());
+        for(int c = first; c <= last; ++c) {
+            cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> NumaNodeCpus(int node)
+{
+    std::ifstream f(FormatString("/sys/devices/system/node/node%/cpulist", node));
+    std::string list;
+    if(f.is_open() && std::getline(f, list)) {
+        return ParseCpuList(list);
+    }
+    return std::vector<int>();
+}
+
+#ifdef _LINUX_
+
+bool SetCurrentThreadAffinity(const std::vector<int>& cpus)
+{
+    if(cpus.empty()) return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int c : cpus) {
+        if(c >= 0 && c < CPU_SETSIZE) CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool SetCurrentThreadRealtimePriority(int priority)
+{
+    sched_param param;
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+bool LockMemory(const void* ptr, size_t size_bytes)
+{
+    return mlock(ptr, size_bytes) == 0;
+}
+
+bool UnlockMemory(const void* ptr, size_t size_bytes)
+{
+    return munlock(ptr, size_bytes) == 0;
+}
+
+#else // _LINUX_
+
+bool SetCurrentThreadAffinity(const std::vector<int>& /*cpus*/)
+{
+    return false;
+}
+
+bool SetCurrentThreadRealtimePriority(int /*priority*/)
+{
+    return false;
+}
+
+bool LockMemory(const void* /*ptr*/, size_t /*size_bytes*/)
+{
+    return false;
+}
+
+bool UnlockMemory(const void* /*ptr*/, size_t /*size_bytes*/)
+{
+    return false;
+}
+
+#endif // _LINUX_
+
+void ApplyThreadPlacement(const ThreadPlacement& placement)
+{
+    std::vector<int> cpus = placement.cpus;
+    if(cpus.empty() && placement.numa_node >= 0) {
+        cpus = NumaNodeCpus(placement.numa_node);
+        if(cpus.empty()) {
+            pango_print_warn("Unable to find CPUs for NUMA node %d.\n", placement.numa_node);
+        }
+    }
+
+    if(!cpus.empty() && !SetCurrentThreadAffinity(cpus)) {
+        pango_print_warn("Unable to set thread CPU affinity.\n");
+    }
+
+    if(placement.rt_priority > 0 && !SetCurrentThreadRealtimePriority(placement.rt_priority)) {
+        pango_print_warn("Unable to set SCHED_FIFO priority %d (insufficient permissions?).\n", placement.rt_priority);
+    }
+}
+
+}
@@ -27,54 +27,236 @@
 
 #include <pangolin/utils/threadedfilebuf.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
 #include <pangolin/utils/sigstate.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/utils/trace.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <stdexcept>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
 using namespace std;
 
 namespace pangolin
 {
 
+namespace
+{
+// O_DIRECT transfer size, and the alignment of buffers and file offsets
+const std::streamsize direct_block_bytes = 1024*1024;
+const size_t direct_alignment = 4096;
+
+// Lock free mode wakes the write thread at least this often
+const std::chrono::milliseconds lock_free_timeout(10);
+
+// Lock free mode wakes the write thread early once this much is pending
+const std::streamsize lock_free_wake_bytes = 4*1024*1024;
+
+bool sigpipe_raised()
+{
+    try
+    {
+        return SigState::I().sig_callbacks.at(SIGPIPE).value;
+    } catch(std::out_of_range&)
+    {
+//        std::cout << "Please register a SIGPIPE handler for your writer" << std::endl;
+        return false;
+    }
+}
+
+#ifdef __linux__
+// Size and alignment of (transparent) huge pages on common platforms
+const size_t huge_page_bytes = 2*1024*1024;
+const size_t small_page_bytes = 4096;
+
+// Map size bytes for the ring, setting mapped to the length of the mapping.
+// Large rings come from reserved huge pages if there are enough, otherwise
+// from huge page aligned memory which may be backed by transparent huge
+// pages, so that the writers and write thread don't thrash the TLB.
+char* map_ring(size_t size, size_t& mapped)
+{
+    if(size >= huge_page_bytes) {
+        mapped = (size + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+        void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if(p != MAP_FAILED) {
+            return static_cast<char*>(p);
+        }
+
+        // Over allocate, then trim either side of the aligned ring
+        const size_t len = mapped + huge_page_bytes;
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* base = static_cast<char*>(p);
+        char* ring = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + huge_page_bytes - 1) & ~(uintptr_t)(huge_page_bytes - 1));
+        if(ring > base) {
+            munmap(base, static_cast<size_t>(ring - base));
+        }
+        if(base + len > ring + mapped) {
+            munmap(ring + mapped, static_cast<size_t>(base + len - (ring + mapped)));
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(ring, mapped, MADV_HUGEPAGE);
+#endif
+        // Fault the ring in now, rather than on the writers' first pass
+        for(size_t i=0; i < mapped; i += small_page_bytes) {
+            ring[i] = 0;
+        }
+        return ring;
+    }
+
+    mapped = std::max<size_t>(1, (size + small_page_bytes - 1) / small_page_bytes) * small_page_bytes;
+    void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return static_cast<char*>(p);
+}
+
+void unmap_ring(char* ring, size_t mapped)
+{
+    munmap(ring, mapped);
+}
+
+bool pwrite_all(int fd, const char* data, size_t size, off_t offset)
+{
+    while(size > 0) {
+        const ssize_t n = ::pwrite(fd, data, size, offset);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+#endif
+}
+
 threadedfilebuf::threadedfilebuf()
-    : mem_buffer(0), mem_size(0), mem_max_size(0), mem_start(0), mem_end(0), should_run(false), is_pipe(false)
+    : mem_buffer(0), mem_mapped(0), mem_size(0), mem_max_size(0), mem_start(0), mem_end(0), should_run(false), is_pipe(false),
+      direct_fd(-1), direct_block(0), direct_claim(0), direct_claimed(0), direct_file_pos(0),
+      lock_free(false), lf_head(0), lf_tail(0), lf_writer_sleeping(false), lf_producer_waiting(false), lf_discard(false), lf_wake_bytes(0),
+      wb_interval(0), wb_fd(-1), wb_written(0), wb_started(0), wb_dropped(0),
+      stat_open_us(0), stat_buffer_bytes(0), stat_high_water(0), stat_written(0), stat_blocked_us(0), stat_blocked_writes(0)
 {
 }
 
-threadedfilebuf::threadedfilebuf(const std::string& filename, size_t buffer_size_bytes )
-    : mem_buffer(0), mem_size(0), mem_max_size(0), mem_start(0), mem_end(0), should_run(false), is_pipe(pangolin::IsPipe(filename))
+threadedfilebuf::threadedfilebuf(const std::string& filename, size_t buffer_size_bytes, size_t direct_depth, bool lock_free_ring)
+    : mem_buffer(0), mem_mapped(0), mem_size(0), mem_max_size(0), mem_start(0), mem_end(0), should_run(false), is_pipe(pangolin::IsPipe(filename)),
+      direct_fd(-1), direct_block(0), direct_claim(0), direct_claimed(0), direct_file_pos(0),
+      lock_free(false), lf_head(0), lf_tail(0), lf_writer_sleeping(false), lf_producer_waiting(false), lf_discard(false), lf_wake_bytes(0),
+      wb_interval(0), wb_fd(-1), wb_written(0), wb_started(0), wb_dropped(0),
+      stat_open_us(0), stat_buffer_bytes(0), stat_high_water(0), stat_written(0), stat_blocked_us(0), stat_blocked_writes(0)
 {
-    open(filename, buffer_size_bytes);
+    open(filename, buffer_size_bytes, direct_depth, lock_free_ring);
 }
 
-void threadedfilebuf::open(const std::string& filename, size_t buffer_size_bytes)
+void threadedfilebuf::open(const std::string& filename, size_t buffer_size_bytes, size_t direct_depth, bool lock_free_ring)
 {
     is_pipe = pangolin::IsPipe(filename);
 
-    if (file.is_open()) {
+    if (file.is_open() || direct_fd >= 0) {
         close();
     }
 
-    file.open(filename.c_str(), ios::out | ios::binary);
-    if(!file.is_open()) {
-        throw std::runtime_error("Unable to open '" + filename + "' for writing.");
+#ifdef __linux__
+    if(direct_depth > 0 && !is_pipe) {
+        direct_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if(direct_fd < 0) {
+            if(errno != EINVAL) {
+                throw std::runtime_error("Unable to open '" + filename + "' for writing.");
+            }
+            pango_print_warn("'%s' does not support O_DIRECT, using buffered writes.\n", filename.c_str());
+        }
     }
+#else
+    if(direct_depth > 0) {
+        pango_print_warn("O_DIRECT writes are not supported on this platform, using buffered writes.\n");
+    }
+#endif
+
+    if(direct_fd < 0) {
+        file.open(filename.c_str(), ios::out | ios::binary);
+        if(!file.is_open()) {
+            throw std::runtime_error("Unable to open '" + filename + "' for writing.");
+        }
+#ifdef __linux__
+        if(!is_pipe) {
+            wb_fd = ::open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+        }
+#endif
+    }
+    wb_written = 0;
+    wb_started = 0;
+    wb_dropped = 0;
 
     mem_buffer = 0;
     mem_size = 0;
     mem_start = 0;
     mem_end = 0;
-    mem_max_size = static_cast<std::streamsize>(buffer_size_bytes);
-    mem_buffer = new char[static_cast<size_t>(mem_max_size)];
+    input_pos = 0;
 
     should_run = true;
-    write_thread = std::thread(std::ref(*this));
+    lock_free = false;
+
+    stat_open_us = TimeNow_us();
+    stat_high_water = 0;
+    stat_written = 0;
+    stat_blocked_us = 0;
+    stat_blocked_writes = 0;
+
+    if(direct_fd >= 0) {
+        // Whole number of blocks, with room to fill one while the rest are written
+        direct_block = direct_block_bytes;
+        const std::streamsize blocks = std::max<std::streamsize>(
+            (static_cast<std::streamsize>(buffer_size_bytes) + direct_block - 1) / direct_block,
+            static_cast<std::streamsize>(direct_depth) + 1
+        );
+        direct_claim = 0;
+        direct_claimed = 0;
+        direct_file_pos = 0;
+        direct_error.clear();
+        allocate_buffer(blocks * direct_block);
+
+        for(size_t i=0; i < direct_depth; ++i) {
+            direct_threads.emplace_back(&threadedfilebuf::direct_write_loop, this);
+        }
+    }else if(lock_free_ring) {
+        allocate_buffer(static_cast<std::streamsize>(buffer_size_bytes));
+        lock_free = true;
+        lf_head = 0;
+        lf_tail = 0;
+        lf_writer_sleeping = false;
+        lf_producer_waiting = false;
+        lf_discard = false;
+        lf_wake_bytes = std::max<std::streamsize>(1, std::min(mem_max_size / 4, lock_free_wake_bytes));
+        write_thread = std::thread(&threadedfilebuf::lock_free_write_loop, this);
+    }else{
+        allocate_buffer(static_cast<std::streamsize>(buffer_size_bytes));
+        write_thread = std::thread(std::ref(*this));
+    }
 }
 
 void threadedfilebuf::close()
 {
-    should_run = false;
+    {
+        std::unique_lock<std::mutex> lock(update_mutex);
+        should_run = false;
+    }
 
     cond_queued.notify_all();
 
@@ -83,19 +265,147 @@ void threadedfilebuf::close()
         write_thread.join();
     }
 
+    for(auto& t : direct_threads) {
+        t.join();
+    }
+    direct_threads.clear();
+
+    if(direct_fd >= 0) {
+        direct_finish();
+    }
+
+    free_buffer();
+
+    file.close();
+
+#ifdef __linux__
+    if(wb_fd >= 0) {
+        ::close(wb_fd);
+        wb_fd = -1;
+    }
+#endif
+}
+
+bool threadedfilebuf::is_direct() const
+{
+    return direct_fd >= 0;
+}
+
+void threadedfilebuf::set_writeback(size_t interval_bytes)
+{
+    wb_interval = interval_bytes;
+}
+
+void threadedfilebuf::writeback(std::streamsize bytes_written)
+{
+#ifdef __linux__
+    const int64_t interval = static_cast<int64_t>(wb_interval.load(std::memory_order_relaxed));
+    wb_written += bytes_written;
+    if(wb_fd < 0 || interval <= 0 || wb_written - wb_started < interval) {
+        return;
+    }
+
+    PANGO_TRACE_SCOPE("threadedfilebuf::writeback", "io");
+
+    // Hand anything std::filebuf holds to the kernel, and start writing it back
+    file.pubsync();
+    bool ok = sync_file_range(wb_fd, wb_started, wb_written - wb_started, SYNC_FILE_RANGE_WRITE) == 0;
+
+    // By now the previous interval should be written, so this rarely waits
+    if(ok && wb_started > wb_dropped) {
+        ok = sync_file_range(wb_fd, wb_dropped, wb_started - wb_dropped,
+                             SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == 0;
+        posix_fadvise(wb_fd, wb_dropped, wb_started - wb_dropped, POSIX_FADV_DONTNEED);
+        wb_dropped = wb_started;
+    }
+    wb_started = wb_written;
+
+    if(!ok) {
+        pango_print_warn("threadedfilebuf: Leaving writeback to the kernel: %s\n", strerror(errno));
+        ::close(wb_fd);
+        wb_fd = -1;
+    }
+#else
+    (void)bytes_written;
+#endif
+}
+
+threadedfilebuf::Stats threadedfilebuf::stats() const
+{
+    Stats s;
+
+    if(lock_free) {
+        s.queued_bytes = static_cast<size_t>(lf_head.load() - lf_tail.load());
+    }else{
+        std::unique_lock<std::mutex> lock(update_mutex);
+        s.queued_bytes = static_cast<size_t>(mem_size);
+    }
+
+    s.buffer_bytes = static_cast<size_t>(stat_buffer_bytes.load());
+    s.high_water_bytes = static_cast<size_t>(stat_high_water.load());
+    s.written_bytes = stat_written.load();
+    s.blocked_s = stat_blocked_us.load() / 1E6;
+    s.blocked_writes = stat_blocked_writes.load();
+
+    const double elapsed_s = (TimeNow_us() - stat_open_us.load()) / 1E6;
+    s.write_mb_per_s = elapsed_s > 0.0 ? s.written_bytes / (1024.0 * 1024.0) / elapsed_s : 0.0;
+    return s;
+}
+
+void threadedfilebuf::note_queued(std::streamsize queued)
+{
+    // Only writers update the high water mark
+    if(queued > stat_high_water.load(std::memory_order_relaxed)) {
+        stat_high_water.store(queued, std::memory_order_relaxed);
+    }
+}
+
+void threadedfilebuf::note_blocked(int64_t start_us)
+{
+    const int64_t now_us = TimeNow_us();
+    stat_blocked_us += now_us - start_us;
+    ++stat_blocked_writes;
+    if(TraceEnabled()) {
+        TraceEvent("threadedfilebuf::blocked", "io", start_us * 1000, (now_us - start_us) * 1000);
+    }
+}
+
+void threadedfilebuf::allocate_buffer(std::streamsize size)
+{
+    mem_max_size = size;
+    stat_buffer_bytes = size;
+#ifdef __linux__
+    // Mappings are page aligned, as O_DIRECT needs
+    static_assert(small_page_bytes % direct_alignment == 0, "O_DIRECT buffers must be aligned");
+    mem_buffer = map_ring(static_cast<size_t>(size), mem_mapped);
+    if(direct_fd >= 0) {
+        direct_done.assign(static_cast<size_t>(size / direct_block), 0);
+    }
+#else
+    mem_buffer = new char[static_cast<size_t>(size)];
+#endif
+}
+
+void threadedfilebuf::free_buffer()
+{
     if(mem_buffer)
     {
-        delete mem_buffer;
+#ifdef __linux__
+        unmap_ring(mem_buffer, mem_mapped);
+#else
+        delete[] mem_buffer;
+#endif
         mem_buffer = 0;
+        mem_mapped = 0;
     }
-
-    file.close();
+    direct_done.clear();
 }
 
 void threadedfilebuf::soft_close()
 {
     // Forces sputn to write no bytes and exit early, results in lost data
     mem_size = 0;
+    lf_discard = true;
 }
 
 void threadedfilebuf::force_close()
@@ -111,27 +421,66 @@ threadedfilebuf::~threadedfilebuf()
 
 std::streamsize threadedfilebuf::xsputn(const char* data, std::streamsize num_bytes)
 {
-    if( num_bytes > mem_max_size ) {
+    if(lock_free) {
+        return lock_free_put(data, num_bytes);
+    }
+
+    // In direct mode, up to a block may be held back waiting to be filled
+    const std::streamsize held_back = direct_fd >= 0 ? direct_block : 0;
+
+    if( num_bytes > mem_max_size - held_back ) {
         std::unique_lock<std::mutex> lock(update_mutex);
-        // Wait until queue is empty
-        while( mem_size > 0 ) {
-            cond_dequeued.wait(lock);
-        }
 
-        // Allocate bigger buffer
-        delete mem_buffer;
-        mem_start = 0;
-        mem_end = 0;
-        mem_max_size = num_bytes * 4;
-        mem_buffer = new char[static_cast<size_t>(mem_max_size)];
+        if(direct_fd >= 0) {
+            // Wait for whole blocks to drain, then carry the partial one over
+            while( mem_size >= direct_block ) {
+                cond_dequeued.wait(lock);
+            }
+
+            const std::streamsize blocks = (num_bytes * 4 + direct_block - 1) / direct_block;
+            char* old_buffer = mem_buffer;
+            const size_t old_mapped = mem_mapped;
+            const std::streamsize old_start = mem_start;
+            mem_buffer = 0;
+            allocate_buffer(blocks * direct_block);
+            memcpy(mem_buffer, old_buffer + old_start, static_cast<size_t>(mem_size));
+#ifdef __linux__
+            unmap_ring(old_buffer, old_mapped);
+#else
+            (void)old_mapped;
+            delete[] old_buffer;
+#endif
+            mem_start = 0;
+            mem_end = mem_size;
+            direct_claim = 0;
+        }else{
+            // Wait until queue is empty
+            while( mem_size > 0 ) {
+                cond_dequeued.wait(lock);
+            }
+
+            // Allocate bigger buffer
+            free_buffer();
+            mem_start = 0;
+            mem_end = 0;
+            allocate_buffer(num_bytes * 4);
+        }
     }
 
     {
         std::unique_lock<std::mutex> lock(update_mutex);
-        
+
+        if(!direct_error.empty()) {
+            throw std::runtime_error(direct_error);
+        }
+
         // wait until there is space to write into buffer
-        while( mem_size + num_bytes > mem_max_size ) {
-            cond_dequeued.wait(lock);
+        if( mem_size + num_bytes > mem_max_size ) {
+            const int64_t start_us = TimeNow_us();
+            while( mem_size + num_bytes > mem_max_size ) {
+                cond_dequeued.wait(lock);
+            }
+            note_blocked(start_us);
         }
         
         // add image to end of mem_buffer
@@ -154,24 +503,35 @@ std::streamsize threadedfilebuf::xsputn(const char* data, std::streamsize num_by
         
         if(mem_end == mem_max_size)
             mem_end = 0;
+
+        note_queued(mem_size);
     }
     
-    cond_queued.notify_one();
+    cond_queued.notify_all();
     
     input_pos += num_bytes;
     return num_bytes;
 }
-
 int threadedfilebuf::overflow(int c)
 {
     const std::streamsize num_bytes = 1;
 
+    if(lock_free) {
+        const char ch = static_cast<char>(c);
+        lock_free_put(&ch, num_bytes);
+        return num_bytes;
+    }
+
     {
         std::unique_lock<std::mutex> lock(update_mutex);
 
         // wait until there is space to write into buffer
-        while( mem_size + num_bytes > mem_max_size ) {
-            cond_dequeued.wait(lock);
+        if( mem_size + num_bytes > mem_max_size ) {
+            const int64_t start_us = TimeNow_us();
+            while( mem_size + num_bytes > mem_max_size ) {
+                cond_dequeued.wait(lock);
+            }
+            note_blocked(start_us);
         }
 
         // add image to end of mem_buffer
@@ -181,6 +541,8 @@ int threadedfilebuf::overflow(int c)
 
         if(mem_end == mem_max_size)
             mem_end = 0;
+
+        note_queued(mem_size);
     }
 
     cond_queued.notify_one();
@@ -202,23 +564,15 @@ std::streampos threadedfilebuf::seekoff(
 
 void threadedfilebuf::operator()()
 {
+    TraceSetThreadName("threadedfilebuf");
     std::streamsize data_to_write = 0;
     
     while(true)
     {
-        if(is_pipe)
+        if(is_pipe && sigpipe_raised())
         {
-            try
-            {
-                if(SigState::I().sig_callbacks.at(SIGPIPE).value)
-                {
-                    soft_close();
-                    return;
-                }
-            } catch(std::out_of_range&)
-            {
-//                std::cout << "Please register a SIGPIPE handler for your writer" << std::endl;
-            }
+            soft_close();
+            return;
         }
 
         {
@@ -235,8 +589,13 @@ void threadedfilebuf::operator()()
                         mem_max_size - mem_start;
         }
 
-        std::streamsize bytes_written =
-                file.sputn(mem_buffer + mem_start, data_to_write );
+        std::streamsize bytes_written;
+        {
+            PANGO_TRACE_SCOPE("threadedfilebuf::write", "io");
+            bytes_written = file.sputn(mem_buffer + mem_start, data_to_write );
+        }
+        stat_written += static_cast<uint64_t>(bytes_written);
+        writeback(bytes_written);
 
         {
             std::unique_lock<std::mutex> lock(update_mutex);
@@ -252,4 +611,258 @@ void threadedfilebuf::operator()()
     }
 }
 
+void threadedfilebuf::lock_free_wait_for_space(int64_t head, std::streamsize bytes)
+{
+    if(head - lf_tail.load() + bytes <= mem_max_size) return;
+
+    const int64_t start_us = TimeNow_us();
+    for(int spin = 0; head - lf_tail.load() + bytes > mem_max_size; ++spin) {
+        if(spin < 64) {
+            std::this_thread::yield();
+        }else{
+            std::unique_lock<std::mutex> lock(update_mutex);
+            lf_producer_waiting = true;
+            while(head - lf_tail.load() + bytes > mem_max_size) {
+                cond_dequeued.wait(lock);
+            }
+            lf_producer_waiting = false;
+        }
+    }
+    note_blocked(start_us);
+}
+
+std::streamsize threadedfilebuf::lock_free_put(const char* data, std::streamsize num_bytes)
+{
+    // Only this thread moves lf_head
+    const int64_t head = lf_head.load(std::memory_order_relaxed);
+
+    if( num_bytes > mem_max_size ) {
+        // The write thread doesn't touch the buffer once it has drained
+        lock_free_wait_for_space(head, mem_max_size);
+        free_buffer();
+        allocate_buffer(num_bytes * 4);
+    }
+
+    lock_free_wait_for_space(head, num_bytes);
+
+    const std::streamsize start = static_cast<std::streamsize>(head % mem_max_size);
+    const std::streamsize array_a_size = std::min(num_bytes, mem_max_size - start);
+    memcpy(mem_buffer + start, data, static_cast<size_t>(array_a_size));
+    memcpy(mem_buffer, data + array_a_size, static_cast<size_t>(num_bytes - array_a_size));
+
+    // Commit, and only wake the write thread once there is enough to be worth it
+    lf_head.store(head + num_bytes);
+    note_queued(head + num_bytes - lf_tail.load());
+    if(lf_writer_sleeping.load() && head + num_bytes - lf_tail.load() >= lf_wake_bytes) {
+        { std::lock_guard<std::mutex> lock(update_mutex); }
+        cond_queued.notify_one();
+    }
+
+    input_pos += num_bytes;
+    return num_bytes;
+}
+
+char* threadedfilebuf::reserve(std::streamsize num_bytes)
+{
+    if(!mem_buffer || direct_fd >= 0 || num_bytes > mem_max_size) {
+        return nullptr;
+    }
+
+    if(lock_free) {
+        const int64_t head = lf_head.load(std::memory_order_relaxed);
+        const std::streamsize start = static_cast<std::streamsize>(head % mem_max_size);
+        if(num_bytes > mem_max_size - start) {
+            return nullptr;
+        }
+        lock_free_wait_for_space(head, num_bytes);
+        return mem_buffer + start;
+    }
+
+    std::unique_lock<std::mutex> lock(update_mutex);
+
+    if(mem_size == 0) {
+        // The write thread is idle, so start again from the front
+        mem_start = 0;
+        mem_end = 0;
+    }
+
+    // Only the space before the ring wraps can be handed out in one piece
+    const std::streamsize contiguous =
+            (mem_start <= mem_end) ? (mem_max_size - mem_end) : (mem_start - mem_end);
+    if(num_bytes > contiguous) {
+        return nullptr;
+    }
+
+    if( mem_size + num_bytes > mem_max_size ) {
+        const int64_t start_us = TimeNow_us();
+        while( mem_size + num_bytes > mem_max_size ) {
+            cond_dequeued.wait(lock);
+        }
+        note_blocked(start_us);
+    }
+
+    return mem_buffer + mem_end;
+}
+
+void threadedfilebuf::commit(std::streamsize num_bytes)
+{
+    if(num_bytes <= 0) {
+        return;
+    }
+
+    if(lock_free) {
+        const int64_t head = lf_head.load(std::memory_order_relaxed);
+        lf_head.store(head + num_bytes);
+        note_queued(head + num_bytes - lf_tail.load());
+        if(lf_writer_sleeping.load() && head + num_bytes - lf_tail.load() >= lf_wake_bytes) {
+            { std::lock_guard<std::mutex> lock(update_mutex); }
+            cond_queued.notify_one();
+        }
+    }else{
+        {
+            std::unique_lock<std::mutex> lock(update_mutex);
+            mem_end += num_bytes;
+            mem_size += num_bytes;
+            if(mem_end == mem_max_size)
+                mem_end = 0;
+            note_queued(mem_size);
+        }
+        cond_queued.notify_all();
+    }
+
+    input_pos += num_bytes;
+}
+
+void threadedfilebuf::lock_free_write_loop()
+{
+    // Only this thread moves lf_tail
+    int64_t tail = lf_tail.load(std::memory_order_relaxed);
+    TraceSetThreadName("threadedfilebuf");
+
+    while(true)
+    {
+        if(is_pipe && sigpipe_raised())
+        {
+            // Keep consuming so that writers don't block, but write nothing
+            soft_close();
+        }
+
+        int64_t head = lf_head.load();
+
+        if(head - tail < lf_wake_bytes) {
+            std::unique_lock<std::mutex> lock(update_mutex);
+            lf_writer_sleeping = true;
+            cond_queued.wait_for(lock, lock_free_timeout, [&](){
+                return !should_run || lf_head.load() - tail >= lf_wake_bytes;
+            });
+            lf_writer_sleeping = false;
+
+            head = lf_head.load();
+            if(head == tail) {
+                if(!should_run) return;
+                continue;
+            }
+        }
+
+        if(lf_discard) {
+            tail = head;
+        }else{
+            const std::streamsize start = static_cast<std::streamsize>(tail % mem_max_size);
+            const std::streamsize data_to_write = std::min<std::streamsize>(head - tail, mem_max_size - start);
+            PANGO_TRACE_SCOPE("threadedfilebuf::write", "io");
+            const std::streamsize bytes_written = file.sputn(mem_buffer + start, data_to_write);
+            stat_written += static_cast<uint64_t>(bytes_written);
+            writeback(bytes_written);
+            tail += bytes_written;
+        }
+
+        lf_tail.store(tail);
+        if(lf_producer_waiting.load()) {
+            { std::lock_guard<std::mutex> lock(update_mutex); }
+            cond_dequeued.notify_all();
+        }
+    }
+}
+
+void threadedfilebuf::direct_write_loop()
+{
+#ifdef __linux__
+    TraceSetThreadName("threadedfilebuf");
+    while(true)
+    {
+        std::streamsize pos;
+        std::streamoff file_pos;
+
+        {
+            std::unique_lock<std::mutex> lock(update_mutex);
+
+            // Partial blocks are left for direct_finish
+            while( mem_size - direct_claimed < direct_block ) {
+                if(!should_run) return;
+                cond_queued.wait(lock);
+            }
+
+            pos = direct_claim;
+            file_pos = direct_file_pos;
+            direct_claim += direct_block;
+            if(direct_claim == mem_max_size) direct_claim = 0;
+            direct_file_pos += direct_block;
+            direct_claimed += direct_block;
+        }
+
+        // Blocks are written concurrently, and may complete out of order
+        bool ok;
+        int err;
+        {
+            PANGO_TRACE_SCOPE("threadedfilebuf::write", "io");
+            ok = pwrite_all(direct_fd, mem_buffer + pos, static_cast<size_t>(direct_block), file_pos);
+            err = errno;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(update_mutex);
+
+            if(ok) {
+                stat_written += static_cast<uint64_t>(direct_block);
+            }else if(direct_error.empty()) {
+                direct_error = std::string("O_DIRECT write failed: ") + strerror(err);
+            }
+
+            // Release the ring buffer in order
+            direct_done[static_cast<size_t>(pos / direct_block)] = 1;
+            while(direct_claimed > 0 && direct_done[static_cast<size_t>(mem_start / direct_block)]) {
+                direct_done[static_cast<size_t>(mem_start / direct_block)] = 0;
+                mem_start += direct_block;
+                if(mem_start == mem_max_size) mem_start = 0;
+                mem_size -= direct_block;
+                direct_claimed -= direct_block;
+            }
+        }
+
+        cond_dequeued.notify_all();
+    }
+#endif
+}
+
+void threadedfilebuf::direct_finish()
+{
+#ifdef __linux__
+    // The tail isn't a whole block and starts on a block boundary, so it is
+    // contiguous in the ring. Write it without O_DIRECT since its length isn't aligned.
+    if(mem_size > 0) {
+        const int flags = fcntl(direct_fd, F_GETFL);
+        if(flags == -1 || fcntl(direct_fd, F_SETFL, flags & ~O_DIRECT) == -1 ||
+           !pwrite_all(direct_fd, mem_buffer + mem_start, static_cast<size_t>(mem_size), direct_file_pos))
+        {
+            pango_print_warn("Unable to write end of file: %s\n", strerror(errno));
+        }else{
+            stat_written += static_cast<uint64_t>(mem_size);
+        }
+    }
+    mem_size = 0;
+    ::close(direct_fd);
+#endif
+    direct_fd = -1;
+}
+
 }
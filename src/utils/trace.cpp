@@ -0,0 +1,264 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/utils/trace.h>
+#include <pangolin/utils/picojson.h>
+#include <pangolin/utils/timer.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace pangolin
+{
+
+namespace detail {
+std::atomic<bool> trace_enabled(false);
+}
+
+namespace {
+
+struct TraceRecord
+{
+    const char* name;
+    const char* category;
+    int64_t start_ns;
+    int64_t value;      // duration of complete events, or the counter value
+    bool counter;
+};
+
+// Written only by its thread. Export may read the oldest records while they
+// are overwritten if the thread laps its ring meanwhile, just garbling them.
+struct ThreadTrace
+{
+    ThreadTrace(size_t capacity, uint32_t tid)
+        : records(std::max<size_t>(capacity, 1)), tid(tid), written(0), cleared(0)
+    {
+    }
+
+    void Push(const TraceRecord& r)
+    {
+        const uint64_t n = written.load(std::memory_order_relaxed);
+        records[n % records.size()] = r;
+        written.store(n + 1, std::memory_order_release);
+    }
+
+    std::vector<TraceRecord> records;
+    const uint32_t tid;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> cleared;
+
+    std::mutex name_mutex;
+    std::string name;
+};
+
+struct TraceRegistry
+{
+    static TraceRegistry& I()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    std::shared_ptr<ThreadTrace> Register()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        threads.push_back(std::make_shared<ThreadTrace>(events_per_thread, (uint32_t)threads.size() + 1));
+        return threads.back();
+    }
+
+    std::vector<std::shared_ptr<ThreadTrace>> Threads()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        return threads;
+    }
+
+    std::mutex mutex;
+    size_t events_per_thread = 1 << 16;
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+};
+
+ThreadTrace& LocalTrace()
+{
+    // Outlives the thread within the registry, so its events can be exported
+    thread_local std::shared_ptr<ThreadTrace> local = TraceRegistry::I().Register();
+    return *local;
+}
+
+void AppendJsonString(std::ostream& os, const std::string& s)
+{
+    os << picojson::value(s).serialize();
+}
+
+// Written at exit when PANGOLIN_TRACE names a file
+struct TraceFromEnvironment
+{
+    TraceFromEnvironment()
+    {
+        const char* env = std::getenv("PANGOLIN_TRACE");
+        if(env && *env) {
+            filename = env;
+            TraceRegistry::I();
+            TraceEnable(true);
+        }
+    }
+
+    ~TraceFromEnvironment()
+    {
+        if(!filename.empty()) {
+            TraceEnable(false);
+            if(!TraceWriteChrome(filename)) {
+                std::fprintf(stderr, "Unable to write trace to '%s'\n", filename.c_str());
+            }
+        }
+    }
+
+    std::string filename;
+};
+
+TraceFromEnvironment trace_from_environment;
+
+}
+
+int64_t TraceNow_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(TimeNow().time_since_epoch()).count();
+}
+
+void TraceEnable(bool enable, size_t events_per_thread)
+{
+    if(enable) {
+        std::lock_guard<std::mutex> l(TraceRegistry::I().mutex);
+        TraceRegistry::I().events_per_thread = events_per_thread;
+    }
+    detail::trace_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void TraceClear()
+{
+    for(const auto& t : TraceRegistry::I().Threads()) {
+        t->cleared.store(t->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+void TraceSetThreadName(const std::string& name)
+{
+    ThreadTrace& t = LocalTrace();
+    std::lock_guard<std::mutex> l(t.name_mutex);
+    t.name = name;
+}
+
+void TraceEvent(const char* name, const char* category, int64_t start_ns, int64_t duration_ns)
+{
+    LocalTrace().Push(TraceRecord{name, category, start_ns, duration_ns, false});
+}
+
+void TraceCounter(const char* name, int64_t value)
+{
+    if(TraceEnabled()) {
+        LocalTrace().Push(TraceRecord{name, "counter", TraceNow_ns(), value, true});
+    }
+}
+
+std::string TraceChromeJson()
+{
+    struct Span
+    {
+        const ThreadTrace* thread;
+        std::string name;
+        std::vector<TraceRecord> records;
+    };
+
+    // Copy out each thread's retained records, oldest first
+    std::vector<Span> spans;
+    int64_t origin_ns = std::numeric_limits<int64_t>::max();
+    for(const auto& t : TraceRegistry::I().Threads()) {
+        const uint64_t end = t->written.load(std::memory_order_acquire);
+        const uint64_t cap = t->records.size();
+        const uint64_t begin = std::max<uint64_t>(t->cleared.load(std::memory_order_relaxed), end > cap ? end - cap : 0);
+
+        Span span;
+        span.thread = t.get();
+        {
+            std::lock_guard<std::mutex> l(t->name_mutex);
+            span.name = t->name;
+        }
+        for(uint64_t i = begin; i < end; ++i) {
+            span.records.push_back(t->records[i % cap]);
+            origin_ns = std::min(origin_ns, span.records.back().start_ns);
+        }
+        spans.push_back(std::move(span));
+    }
+
+    // Timestamps are in microseconds, kept relative to the first event so
+    // that doubles hold them to the nanosecond
+    std::ostringstream os;
+    os.precision(3);
+    os << std::fixed;
+    os << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"origin_us\":" << origin_ns / 1000 << "},\"traceEvents\":[";
+    bool first = true;
+    auto sep = [&]() { if(!first) os << ",\n"; first = false; };
+
+    for(const Span& s : spans) {
+        if(s.records.empty()) continue;
+        sep();
+        os << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << s.thread->tid << ",\"args\":{\"name\":";
+        AppendJsonString(os, s.name.empty() ? "thread " + std::to_string(s.thread->tid) : s.name);
+        os << "}}";
+
+        for(const TraceRecord& r : s.records) {
+            sep();
+            os << "{\"name\":";
+            AppendJsonString(os, r.name);
+            os << ",\"cat\":";
+            AppendJsonString(os, r.category);
+            os << ",\"pid\":1,\"tid\":" << s.thread->tid << ",\"ts\":" << (r.start_ns - origin_ns) / 1e3;
+            if(r.counter) {
+                os << ",\"ph\":\"C\",\"args\":{\"value\":" << r.value << "}}";
+            }else{
+                os << ",\"ph\":\"X\",\"dur\":" << r.value / 1e3 << "}";
+            }
+        }
+    }
+    os << "]}\n";
+    return os.str();
+}
+
+bool TraceWriteChrome(const std::string& filename)
+{
+    std::ofstream f(filename, std::ios::binary);
+    f << TraceChromeJson();
+    return f.good();
+}
+
+}
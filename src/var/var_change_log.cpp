@@ -0,0 +1,247 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/var/var_change_log.h>
+#include <pangolin/var/varextra.h>
+#include <pangolin/utils/timer.h>
+
+#include <cstring>
+#include <limits>
+#include <map>
+
+namespace pangolin
+{
+
+const std::string pango_var_changes_type = "pango_vars";
+
+namespace
+{
+
+// Packets hold, in host byte order:
+//   uint32 num_names,   {uint32 len, char name[len]}[num_names]
+//   uint32 num_changes, {uint32 name_index, int64 time_us, uint32 len, char value[len]}[num_changes]
+template<typename T>
+void Append(std::vector<char>& buf, const T& v)
+{
+    const char* p = reinterpret_cast<const char*>(&v);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+void AppendString(std::vector<char>& buf, const std::string& s)
+{
+    Append(buf, (uint32_t)s.size());
+    buf.insert(buf.end(), s.begin(), s.end());
+}
+
+template<typename T>
+bool Take(const char*& p, const char* end, T& v)
+{
+    if(end - p < (std::ptrdiff_t)sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+bool TakeString(const char*& p, const char* end, std::string& s)
+{
+    uint32_t len;
+    if(!Take(p, end, len) || end - p < (std::ptrdiff_t)len) return false;
+    s.assign(p, len);
+    p += len;
+    return true;
+}
+
+}
+
+VarChangeRecorder::VarChangeRecorder(PacketStreamWriter& writer, const std::string& prefix, int64_t batch_us, size_t batch_bytes)
+    : writer(writer), prefix(prefix), batch_us(batch_us), batch_bytes(batch_bytes),
+      batch_count(0), batch_start_us(0)
+{
+    PacketStreamSource pss;
+    pss.driver = pango_var_changes_type;
+    pss.info["prefix"] = prefix;
+    pss.data_size_bytes = 0;
+    src_id = writer.AddSource(pss);
+
+    RegisterGuiVarChangedCallback(&VarChangeRecorder::GuiVarChanged, (void*)this, prefix);
+}
+
+VarChangeRecorder::~VarChangeRecorder()
+{
+    UnregisterGuiVarChangedCallbacks((void*)this);
+    Flush();
+}
+
+void VarChangeRecorder::Record(const std::string& name, const std::string& value, int64_t time_us)
+{
+    std::lock_guard<std::mutex> l(lock);
+
+    if(batch_count && (time_us - batch_start_us >= batch_us || batch_changes.size() >= batch_bytes)) {
+        FlushLocked();
+    }
+    if(!batch_count) {
+        batch_start_us = time_us;
+    }
+
+    uint32_t name_index = 0;
+    while(name_index < batch_names.size() && batch_names[name_index] != name) {
+        ++name_index;
+    }
+    if(name_index == batch_names.size()) {
+        batch_names.push_back(name);
+    }
+
+    Append(batch_changes, name_index);
+    Append(batch_changes, time_us);
+    AppendString(batch_changes, value);
+    ++batch_count;
+}
+
+void VarChangeRecorder::Record(const std::string& name)
+{
+    Var<std::string> var(name);
+    Record(name, var.Get(), Time_us(TimeNow()));
+}
+
+void VarChangeRecorder::Flush()
+{
+    std::lock_guard<std::mutex> l(lock);
+    FlushLocked();
+}
+
+void VarChangeRecorder::FlushLocked()
+{
+    if(!batch_count || !writer.IsOpen()) {
+        return;
+    }
+
+    std::vector<char> packet;
+    Append(packet, (uint32_t)batch_names.size());
+    for(const std::string& name : batch_names) {
+        AppendString(packet, name);
+    }
+    Append(packet, (uint32_t)batch_count);
+    packet.insert(packet.end(), batch_changes.begin(), batch_changes.end());
+
+    writer.WriteSourcePacket(src_id, packet.data(), batch_start_us, packet.size());
+
+    batch_names.clear();
+    batch_changes.clear();
+    batch_count = 0;
+}
+
+void VarChangeRecorder::GuiVarChanged(void* data, const std::string& name, VarValueGeneric& var)
+{
+    VarChangeRecorder* self = (VarChangeRecorder*)data;
+    self->Record(name, var.str->Get(), Time_us(TimeNow()));
+}
+
+VarChangePlayer::VarChangePlayer(const std::string& filename)
+    : reader(filename), src_id(-1), time_us(std::numeric_limits<int64_t>::min())
+{
+    for(const PacketStreamSource& src : reader.Sources()) {
+        if(src.driver == pango_var_changes_type && !src.index.empty()) {
+            src_id = (int)src.id;
+            break;
+        }
+    }
+}
+
+bool VarChangePlayer::IsValid() const
+{
+    return src_id >= 0;
+}
+
+void VarChangePlayer::ReadPacket()
+{
+    Packet fi = reader.NextFrame(src_id);
+    std::vector<char> data(fi.size);
+    if(fi.Data()) {
+        std::memcpy(data.data(), fi.Data(), fi.size);
+    }else{
+        fi.Stream().read(data.data(), fi.size);
+    }
+
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint32_t num_names = 0;
+    uint32_t num_changes = 0;
+    std::vector<std::string> names;
+    bool ok = Take(p, end, num_names);
+    for(uint32_t i = 0; ok && i < num_names; ++i) {
+        names.emplace_back();
+        ok = TakeString(p, end, names.back());
+    }
+    ok = ok && Take(p, end, num_changes);
+    for(uint32_t i = 0; ok && i < num_changes; ++i) {
+        Change c;
+        uint32_t name_index;
+        ok = Take(p, end, name_index) && name_index < names.size() &&
+             Take(p, end, c.time_us) && TakeString(p, end, c.value);
+        if(ok) {
+            c.name = names[name_index];
+            pending.push_back(std::move(c));
+        }
+    }
+    if(!ok) {
+        pango_print_warn("VarChangePlayer: ignoring malformed var change packet.\n");
+    }
+}
+
+void VarChangePlayer::PlayUntil(int64_t until_us)
+{
+    if(src_id < 0) {
+        return;
+    }
+
+    if(until_us < time_us) {
+        reader.Seek(src_id, 0);
+        pending.clear();
+    }
+    time_us = until_us;
+
+    // Only the latest value of each var is applied
+    std::map<std::string, std::string> latest;
+    const PacketStreamSource& src = reader.Sources()[src_id];
+    for(;;) {
+        while(!pending.empty() && pending.front().time_us <= until_us) {
+            latest[pending.front().name] = pending.front().value;
+            pending.pop_front();
+        }
+        if(!pending.empty() || src.next_packet_id >= src.index.size() || src.NextPacketTime() > until_us) {
+            break;
+        }
+        ReadPacket();
+    }
+
+    for(const auto& kv : latest) {
+        Var<std::string> var(kv.first);
+        var = kv.second;
+    }
+}
+
+}
@@ -31,6 +31,7 @@
 #include <pangolin/utils/picojson.h>
 #include <pangolin/utils/transform.h>
 
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -46,7 +47,7 @@ VarState& VarState::I() {
 }
 
 VarState::VarState()
-    : varHasChanged(false)
+    : gui_change_count(0), gui_change_seen(0), change_count(0), generation(0), batch_depth(0)
 {
 }
 
@@ -55,15 +56,19 @@ VarState::~VarState() {
 }
 
 void VarState::Clear() {
+    std::lock_guard<std::recursive_mutex> l(mutex);
+    ++generation;
     //for(VarStoreContainer::iterator i = vars.begin(); i != vars.end(); ++i) {
     //    delete i->second;
     //}
     vars.clear();
     var_adds.clear();
+    deferred_new_vars.clear();
 }
 
 void ProcessHistoricCallbacks(NewVarCallbackFn callback, void* data, const std::string& filter)
 {
+    std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
     for (VarState::VarStoreAdditions::const_iterator i = VarState::I().var_adds.begin(); i != VarState::I().var_adds.end(); ++i)
     {
         const std::string& name = *i;
@@ -75,20 +80,30 @@ void ProcessHistoricCallbacks(NewVarCallbackFn callback, void* data, const std::
 
 void RegisterNewVarCallback(NewVarCallbackFn callback, void* data, const std::string& filter)
 {
-    VarState::I().new_var_callbacks.push_back(NewVarCallback(filter,callback,data));
+    VarState::I().AddNewVarCallback(NewVarCallback(filter,callback,data));
 }
 
 void RegisterGuiVarChangedCallback(GuiVarChangedCallbackFn callback, void* data, const std::string& filter)
 {
-    VarState::I().gui_var_changed_callbacks.push_back(GuiVarChangedCallback(filter,callback,data));
+    VarState::I().AddGuiVarChangedCallback(GuiVarChangedCallback(filter,callback,data));
+}
+
+void UnregisterGuiVarChangedCallbacks(void* data)
+{
+    VarState::I().RemoveGuiVarChangedCallbacks(data);
 }
 
 // Recursively expand val
 string ProcessVal(const string& val )
 {
+    if(val.find('$') == string::npos) {
+        return val;
+    }
     return Transform(val, [](const std::string& k) -> std::string {
-        if( VarState::I().Exists(k) ) {
-             return VarState::I()[k]->str->Get();
+        std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
+        VarState::VarStoreContainer::const_iterator v = VarState::I().vars.find(k);
+        if( v != VarState::I().vars.end() && v->second ) {
+             return v->second->str->Get();
         }else{
             return std::string("#");
         }
@@ -97,6 +112,7 @@ string ProcessVal(const string& val )
 
 void AddVar(const std::string& name, const string& val )
 {
+    std::lock_guard<std::recursive_mutex> l(VarState::I().mutex);
     const std::string full = ProcessVal(val);
 
     VarValueGeneric*& v = VarState::I()[name];
@@ -108,6 +124,33 @@ void AddVar(const std::string& name, const string& val )
     v->str->Set(full);
 }
 
+namespace {
+
+// Whole file in one read, or false if it can't be opened
+bool ReadFile(const std::string& filename, std::string& contents)
+{
+    ifstream f(filename.c_str(), ios::binary);
+    if(!f.is_open()) {
+        return false;
+    }
+    f.seekg(0, ios::end);
+    const std::streamoff size = f.tellg();
+    if(size > 0) {
+        contents.resize((size_t)size);
+        f.seekg(0, ios::beg);
+        f.read(&contents[0], size);
+        contents.resize((size_t)f.gcount());
+    }else{
+        // Not seekable
+        f.clear();
+        f.seekg(0, ios::beg);
+        contents.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+    }
+    return true;
+}
+
+}
+
 #ifdef ALIAS
 void AddAlias(const string& alias, const string& name)
 {
@@ -128,50 +171,53 @@ void AddAlias(const string& alias, const string& name)
 
 void ParseVarsFile(const string& filename)
 {
-    ifstream f(filename.c_str());
-    
-    if( f.is_open() )
+    string contents;
+    if( !ReadFile(filename, contents) )
+    {
+        cerr << "Unable to open '" << filename << "' for configuration data" << endl;
+        return;
+    }
+
+    // Register everything before any new var callbacks run
+    VarState::Batch batch;
+
+    const char* p = contents.data();
+    const char* end = p + contents.size();
+    while( p != end )
     {
-        while( !f.bad() && !f.eof())
+        if( isspace((unsigned char)*p) )
+        {
+            // ignore leading whitespace
+            ++p;
+        }else if( *p == '#' || *p == '%' )
         {
-            const int c = f.peek();
-            
-            if( isspace(c) )
+            // ignore lines starting # or %
+            const char* eol = (const char*)memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+        }else{
+            // Otherwise, find name and value, seperated by '=' and ';'
+            const char* eq = (const char*)memchr(p, '=', end - p);
+            const char* name_end = eq ? eq : end;
+            const char* val_begin = eq ? eq + 1 : end;
+            const char* semi = (const char*)memchr(val_begin, ';', end - val_begin);
+            const char* val_end = semi ? semi : end;
+
+            const string name = Trim(string(p, name_end), " \t\n\r");
+            const string val = Trim(string(val_begin, val_end), " \t\n\r");
+            p = semi ? semi + 1 : end;
+
+            if( name.size() >0 && val.size() > 0 )
             {
-                // ignore leading whitespace
-                f.get();
-            }else{
-                if( c == '#' || c == '%' )
+                if( !val.substr(0,1).compare("@") )
                 {
-                    // ignore lines starting # or %
-                    string comment;
-                    getline(f,comment);
-                }else{
-                    // Otherwise, find name and value, seperated by '=' and ';'
-                    string name;
-                    string val;
-                    getline(f,name,'=');
-                    getline(f,val,';');
-                    name = Trim(name, " \t\n\r");
-                    val = Trim(val, " \t\n\r");
-                    
-                    if( name.size() >0 && val.size() > 0 )
-                    {
-                        if( !val.substr(0,1).compare("@") )
-                        {
 #ifdef ALIAS
-                            AddAlias(name,val.substr(1));
+                    AddAlias(name,val.substr(1));
 #endif
-                        }else{
-                            AddVar(name,val);
-                        }
-                    }
+                }else{
+                    AddVar(name,val);
                 }
             }
         }
-        f.close();
-    }else{
-        cerr << "Unable to open '" << filename << "' for configuration data" << endl;
     }
 }
 
@@ -180,22 +226,23 @@ void LoadJsonFile(const std::string& filename, const string &prefix)
 {
     bool some_change = false;
 
-    picojson::value file_json(picojson::object_type,true);
-    std::ifstream f(filename);
-    if(f.is_open()) {
-        const std::string err = picojson::parse(file_json,f);
+    // Parsing from memory is much faster than through an istream
+    string contents;
+    if(ReadFile(filename, contents)) {
+        picojson::value file_json;
+        std::string err;
+        picojson::parse(file_json, contents.data(), contents.data() + contents.size(), &err);
         if(err.empty()) {
             if(file_json.contains("vars") ) {
-                picojson::value vars = file_json["vars"];
+                const picojson::value& vars = static_cast<const picojson::value&>(file_json)["vars"];
                 if(vars.is<picojson::object>()) {
-                    for(picojson::object::iterator
-                        i = vars.get<picojson::object>().begin();
-                        i!= vars.get<picojson::object>().end();
-                        ++i)
+                    // Register everything before any new var callbacks run
+                    VarState::Batch batch;
+                    for(const auto& kv : vars.get<picojson::object>())
                     {
-                        const std::string& name = i->first;
+                        const std::string& name = kv.first;
                         if(pangolin::StartsWith(name, prefix)) {
-                            const std::string& val = i->second.get<std::string>();
+                            const std::string& val = kv.second.get<std::string>();
 
                             VarValueGeneric*& v = VarState::I()[name];
                             if(!v) {
@@ -228,6 +275,7 @@ void SaveJsonFile(const std::string& filename, const string &prefix)
 {
     picojson::value vars(picojson::object_type,true);
 
+    std::unique_lock<std::recursive_mutex> l(VarState::I().mutex);
     for(VarState::VarStoreAdditions::const_iterator
         i  = VarState::I().var_adds.begin();
         i != VarState::I().var_adds.end();
@@ -244,6 +292,7 @@ void SaveJsonFile(const std::string& filename, const string &prefix)
             }
         }
     }
+    l.unlock();
 
     picojson::value file_json(picojson::object_type,true);
     file_json["pangolin_version"] = PANGOLIN_VERSION_STRING;
@@ -0,0 +1,123 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/video/clock_model.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace pangolin
+{
+
+ClockModel::ClockModel(size_t window, int64_t reset_us)
+    : window(std::max<size_t>(window, 2)), reset_us(reset_us), resets(0)
+{
+    Reset();
+}
+
+void ClockModel::Reset()
+{
+    samples.clear();
+    origin_device = 0.0;
+    origin_host_us = 0;
+    valid = false;
+    skew = 1.0;
+    offset_us = 0.0;
+    jitter_us = 0.0;
+}
+
+int64_t ClockModel::Update(double device_time, int64_t host_time_us)
+{
+    if(!samples.empty()) {
+        const double x = device_time - origin_device;
+        const double residual = (double)(host_time_us - origin_host_us) - (skew * x + offset_us);
+        if(x < samples.back().first || (valid && std::abs(residual) > (double)reset_us)) {
+            // Device restarted or jumped
+            Reset();
+            ++resets;
+        }
+    }
+
+    if(samples.empty()) {
+        origin_device = device_time;
+        origin_host_us = host_time_us;
+    }
+
+    samples.emplace_back(device_time - origin_device, (double)(host_time_us - origin_host_us));
+    while(samples.size() > window) {
+        samples.pop_front();
+    }
+
+    Fit();
+    return ToHost(device_time);
+}
+
+int64_t ClockModel::ToHost(double device_time) const
+{
+    return origin_host_us + (int64_t)std::llround(skew * (device_time - origin_device) + offset_us);
+}
+
+void ClockModel::Fit()
+{
+    const double n = (double)samples.size();
+
+    double mx = 0.0, my = 0.0;
+    for(const auto& s : samples) {
+        mx += s.first;
+        my += s.second;
+    }
+    mx /= n;
+    my /= n;
+
+    double sxx = 0.0, sxy = 0.0;
+    for(const auto& s : samples) {
+        sxx += (s.first - mx) * (s.first - mx);
+        sxy += (s.first - mx) * (s.second - my);
+    }
+
+    // Counters have no meaningful skew until two have been seen, whereas
+    // device microseconds start out as host microseconds.
+    valid = sxx > 0.0;
+    if(valid) {
+        skew = sxy / sxx;
+    }
+
+    // Lower envelope: the least delayed sample sets the offset
+    double lowest = std::numeric_limits<double>::max();
+    double sum = 0.0;
+    for(const auto& s : samples) {
+        const double r = s.second - skew * s.first;
+        lowest = std::min(lowest, r);
+        sum += r;
+    }
+    offset_us = lowest;
+    jitter_us = sum / n - lowest;
+}
+
+}
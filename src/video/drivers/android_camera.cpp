@@ -0,0 +1,521 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/video/drivers/android_camera.h>
+#include <pangolin/video/iostream_operators.h>
+
+#include <android/hardware_buffer.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+namespace pangolin
+{
+
+namespace
+{
+
+// Extensions for importing AHardwareBuffers, resolved once
+struct EglImportFunctions
+{
+    EglImportFunctions()
+        : GetNativeClientBuffer((PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC)eglGetProcAddress("eglGetNativeClientBufferANDROID")),
+          CreateImage((PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR")),
+          DestroyImage((PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR")),
+          ImageTargetTexture2D((PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES"))
+    {
+    }
+
+    static const EglImportFunctions& I()
+    {
+        static EglImportFunctions fns;
+        return fns;
+    }
+
+    bool Available() const
+    {
+        return GetNativeClientBuffer && CreateImage && DestroyImage && ImageTargetTexture2D;
+    }
+
+    PFNEGLGETNATIVECLIENTBUFFERANDROIDPROC GetNativeClientBuffer;
+    PFNEGLCREATEIMAGEKHRPROC CreateImage;
+    PFNEGLDESTROYIMAGEKHRPROC DestroyImage;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC ImageTargetTexture2D;
+};
+
+void OnCameraDisconnected(void* /*context*/, ACameraDevice* /*device*/)
+{
+    pango_print_warn("AndroidCameraVideo: camera disconnected\n");
+}
+
+void OnCameraError(void* /*context*/, ACameraDevice* /*device*/, int error)
+{
+    pango_print_error("AndroidCameraVideo: camera error %d\n", error);
+}
+
+void OnSessionState(void* /*context*/, ACameraCaptureSession* /*session*/)
+{
+}
+
+}
+
+AndroidCameraVideo::AndroidCameraVideo(int camera, const std::string& facing, int width, int height,
+                                       const AndroidCameraOptions& options)
+    : size_bytes(0), options(options),
+      manager(nullptr), device(nullptr), reader(nullptr), window(nullptr),
+      outputs(nullptr), output(nullptr), target(nullptr), request(nullptr), session(nullptr),
+      is_streaming(false), available(0), egl_display(EGL_NO_DISPLAY)
+{
+    if(width <= 0 || height <= 0 || width % 2 || height % 2) {
+        throw VideoException("AndroidCameraVideo: size must be positive and even");
+    }
+
+    manager = ACameraManager_create();
+    if(!manager) {
+        throw VideoException("AndroidCameraVideo: Unable to create ACameraManager");
+    }
+
+    try {
+        OpenCamera(camera, facing);
+
+        // Buffers the GPU may sample directly, but which the CPU reads only
+        // when a consumer asks for host memory.
+        const uint64_t usage = options.gpu
+            ? (AHARDWAREBUFFER_USAGE_GPU_SAMPLED_IMAGE | AHARDWAREBUFFER_USAGE_CPU_READ_RARELY)
+            : AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN;
+        if(AImageReader_newWithUsage(width, height, AIMAGE_FORMAT_YUV_420_888, usage,
+                                     (int32_t)std::max<size_t>(2, options.max_images), &reader) != AMEDIA_OK) {
+            throw VideoException("AndroidCameraVideo: Unable to create AImageReader");
+        }
+
+        AImageReader_ImageListener listener = { this, &AndroidCameraVideo::OnImageAvailable };
+        AImageReader_setImageListener(reader, &listener);
+        AImageReader_getWindow(reader, &window);
+
+        CreateSession();
+    }catch(...) {
+        DestroySession();
+        if(reader) AImageReader_delete(reader);
+        if(device) ACameraDevice_close(device);
+        ACameraManager_delete(manager);
+        throw;
+    }
+
+    const PixelFormat fmt = PixelFormatFromString("NV12");
+    streams.push_back(StreamInfo(fmt, width, height, width, 0));
+    size_bytes = streams[0].SizeBytes();
+
+    device_properties[PANGO_HAS_TIMING_DATA] = true;
+
+    Start();
+}
+
+AndroidCameraVideo::~AndroidCameraVideo()
+{
+    Stop();
+    DestroySession();
+    if(device) ACameraDevice_close(device);
+
+    // EGLImages only need the display, but textures need a current context
+    const bool have_context = eglGetCurrentContext() != EGL_NO_CONTEXT;
+    for(auto& i : imported) {
+        EglImportFunctions::I().DestroyImage(egl_display, i.second.image);
+        if(have_context) {
+            glDeleteTextures(1, &i.second.texture);
+        }
+        AHardwareBuffer_release(i.second.buffer);
+    }
+    imported.clear();
+
+    if(reader) AImageReader_delete(reader);
+    if(manager) ACameraManager_delete(manager);
+}
+
+void AndroidCameraVideo::OpenCamera(int camera, const std::string& facing)
+{
+    ACameraIdList* ids = nullptr;
+    if(ACameraManager_getCameraIdList(manager, &ids) != ACAMERA_OK || !ids) {
+        throw VideoException("AndroidCameraVideo: Unable to list cameras");
+    }
+
+    uint8_t want_facing = ACAMERA_LENS_FACING_BACK;
+    if(facing == "front") {
+        want_facing = ACAMERA_LENS_FACING_FRONT;
+    }else if(facing == "external") {
+        want_facing = ACAMERA_LENS_FACING_EXTERNAL;
+    }else if(facing != "back") {
+        ACameraManager_deleteCameraIdList(ids);
+        throw VideoException("AndroidCameraVideo: facing must be back, front or external, not " + facing);
+    }
+
+    std::string id;
+    if(camera >= 0) {
+        if(camera < ids->numCameras) {
+            id = ids->cameraIds[camera];
+        }
+    }else{
+        for(int c = 0; c < ids->numCameras && id.empty(); ++c) {
+            ACameraMetadata* meta = nullptr;
+            if(ACameraManager_getCameraCharacteristics(manager, ids->cameraIds[c], &meta) != ACAMERA_OK) {
+                continue;
+            }
+            ACameraMetadata_const_entry entry;
+            if(ACameraMetadata_getConstEntry(meta, ACAMERA_LENS_FACING, &entry) == ACAMERA_OK &&
+               entry.count > 0 && entry.data.u8[0] == want_facing) {
+                id = ids->cameraIds[c];
+            }
+            ACameraMetadata_free(meta);
+        }
+    }
+    ACameraManager_deleteCameraIdList(ids);
+
+    if(id.empty()) {
+        throw VideoException("AndroidCameraVideo: No matching camera");
+    }
+
+    static ACameraDevice_StateCallbacks callbacks = { nullptr, &OnCameraDisconnected, &OnCameraError };
+    if(ACameraManager_openCamera(manager, id.c_str(), &callbacks, &device) != ACAMERA_OK) {
+        throw VideoException("AndroidCameraVideo: Unable to open camera " + id + " (is the CAMERA permission granted?)");
+    }
+    device_properties["CameraId"] = id;
+}
+
+void AndroidCameraVideo::CreateSession()
+{
+    if(ACaptureSessionOutputContainer_create(&outputs) != ACAMERA_OK ||
+       ACaptureSessionOutput_create(window, &output) != ACAMERA_OK ||
+       ACaptureSessionOutputContainer_add(outputs, output) != ACAMERA_OK ||
+       ACameraOutputTarget_create(window, &target) != ACAMERA_OK ||
+       ACameraDevice_createCaptureRequest(device, TEMPLATE_RECORD, &request) != ACAMERA_OK ||
+       ACaptureRequest_addTarget(request, target) != ACAMERA_OK)
+    {
+        throw VideoException("AndroidCameraVideo: Unable to create capture request");
+    }
+
+    static ACameraCaptureSession_stateCallbacks callbacks = { nullptr, &OnSessionState, &OnSessionState, &OnSessionState };
+    if(ACameraDevice_createCaptureSession(device, outputs, &callbacks, &session) != ACAMERA_OK) {
+        throw VideoException("AndroidCameraVideo: Unable to create capture session");
+    }
+}
+
+void AndroidCameraVideo::DestroySession()
+{
+    if(session) ACameraCaptureSession_close(session);
+    if(request) ACaptureRequest_free(request);
+    if(target) ACameraOutputTarget_free(target);
+    if(outputs) ACaptureSessionOutputContainer_free(outputs);
+    if(output) ACaptureSessionOutput_free(output);
+    session = nullptr;
+    request = nullptr;
+    target = nullptr;
+    outputs = nullptr;
+    output = nullptr;
+}
+
+void AndroidCameraVideo::Start()
+{
+    if(!is_streaming && session) {
+        if(ACameraCaptureSession_setRepeatingRequest(session, nullptr, 1, &request, nullptr) != ACAMERA_OK) {
+            throw VideoException("AndroidCameraVideo: Unable to start capture");
+        }
+        is_streaming = true;
+    }
+}
+
+void AndroidCameraVideo::Stop()
+{
+    if(is_streaming && session) {
+        ACameraCaptureSession_stopRepeating(session);
+    }
+    is_streaming = false;
+}
+
+size_t AndroidCameraVideo::SizeBytes() const
+{
+    return size_bytes;
+}
+
+const std::vector<StreamInfo>& AndroidCameraVideo::Streams() const
+{
+    return streams;
+}
+
+void AndroidCameraVideo::OnImageAvailable(void* context, AImageReader* /*reader*/)
+{
+    AndroidCameraVideo* self = static_cast<AndroidCameraVideo*>(context);
+    std::lock_guard<std::mutex> lock(self->available_mutex);
+    ++self->available;
+    self->available_cond.notify_all();
+}
+
+AImage* AndroidCameraVideo::AcquireImage(bool newest, bool wait)
+{
+    std::unique_lock<std::mutex> lock(available_mutex);
+    if(wait && !available) {
+        available_cond.wait_for(lock, std::chrono::seconds(1), [this](){ return available > 0; });
+    }
+    if(!available) {
+        if(wait) {
+            pango_print_debug("AndroidCameraVideo: No frame data\n");
+        }
+        return nullptr;
+    }
+
+    AImage* image = nullptr;
+    const media_status_t status = newest
+        ? AImageReader_acquireLatestImage(reader, &image)
+        : AImageReader_acquireNextImage(reader, &image);
+
+    if(status == AMEDIA_OK) {
+        available = newest ? 0 : available - 1;
+        return image;
+    }else if(status == AMEDIA_IMGREADER_MAX_IMAGES_ACQUIRED) {
+        // Leave the frame for when consumers release theirs
+        pango_print_warn("AndroidCameraVideo: all %zu images are leased\n", options.max_images);
+    }else{
+        available = 0;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<AImage> AndroidCameraVideo::Hold(AImage* image)
+{
+    return std::shared_ptr<AImage>(image, &AImage_delete);
+}
+
+void AndroidCameraVideo::SetFrameProperties(AImage* image)
+{
+    int64_t timestamp_ns = 0;
+    AImage_getTimestamp(image, &timestamp_ns);
+    frame_properties[PANGO_CAPTURE_TIME_US] = picojson::value(timestamp_ns / 1000);
+}
+
+void AndroidCameraVideo::CopyToHost(AImage* image, unsigned char* dst) const
+{
+    const size_t w = streams[0].Width();
+    const size_t h = streams[0].Height();
+
+    uint8_t* y = nullptr;
+    uint8_t* u = nullptr;
+    uint8_t* v = nullptr;
+    int len = 0;
+    int32_t y_stride = 0, uv_stride = 0, uv_step = 0;
+    if(AImage_getPlaneData(image, 0, &y, &len) != AMEDIA_OK ||
+       AImage_getPlaneData(image, 1, &u, &len) != AMEDIA_OK ||
+       AImage_getPlaneData(image, 2, &v, &len) != AMEDIA_OK) {
+        throw VideoException("AndroidCameraVideo: frame isn't CPU readable");
+    }
+    AImage_getPlaneRowStride(image, 0, &y_stride);
+    AImage_getPlaneRowStride(image, 1, &uv_stride);
+    AImage_getPlanePixelStride(image, 1, &uv_step);
+
+    for(size_t r = 0; r < h; ++r) {
+        std::memcpy(dst + r * w, y + r * y_stride, w);
+    }
+
+    unsigned char* uv = dst + h * w;
+    const bool interleaved = (uv_step == 2 && v == u + 1);
+    for(size_t r = 0; r < h / 2; ++r) {
+        const uint8_t* ur = u + r * uv_stride;
+        const uint8_t* vr = v + r * uv_stride;
+        unsigned char* out = uv + r * w;
+        if(interleaved) {
+            // Already NV12, as most devices produce
+            std::memcpy(out, ur, w);
+        }else{
+            for(size_t x = 0; x < w / 2; ++x) {
+                out[2*x]   = ur[x * uv_step];
+                out[2*x+1] = vr[x * uv_step];
+            }
+        }
+    }
+}
+
+bool AndroidCameraVideo::GrabNext( unsigned char* image, bool wait )
+{
+    AImage* img = AcquireImage(false, wait);
+    if(!img) return false;
+    std::shared_ptr<AImage> hold = Hold(img);
+    SetFrameProperties(img);
+    CopyToHost(img, image);
+    return true;
+}
+
+bool AndroidCameraVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    AImage* img = AcquireImage(true, wait);
+    if(!img) return false;
+    std::shared_ptr<AImage> hold = Hold(img);
+    SetFrameProperties(img);
+    CopyToHost(img, image);
+    return true;
+}
+
+FrameLease AndroidCameraVideo::GrabNextLease( bool wait )
+{
+    // Host memory can't alias the camera's buffer, so copy it out and
+    // return the buffer to the reader straight away.
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+    if(!GrabNext(buffer->get(), wait)) {
+        return FrameLease();
+    }
+    return FrameLease(buffer->get(), size_bytes, [buffer](){});
+}
+
+FrameLease AndroidCameraVideo::GrabNewestLease( bool wait )
+{
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+    if(!GrabNewest(buffer->get(), wait)) {
+        return FrameLease();
+    }
+    return FrameLease(buffer->get(), size_bytes, [buffer](){});
+}
+
+AndroidCameraTexture AndroidCameraVideo::Import(AImage* image)
+{
+    std::shared_ptr<AImage> hold = Hold(image);
+
+    AHardwareBuffer* buffer = nullptr;
+    if(AImage_getHardwareBuffer(image, &buffer) != AMEDIA_OK || !buffer) {
+        throw VideoException("AndroidCameraVideo: frame has no hardware buffer");
+    }
+
+    // The reader cycles through a fixed set of buffers, so each is imported
+    // once and its texture reused whenever it comes round again.
+    auto i = imported.find(buffer);
+    if(i == imported.end()) {
+        const EglImportFunctions& egl = EglImportFunctions::I();
+        if(!egl.Available()) {
+            throw VideoException("AndroidCameraVideo: EGL_ANDROID_get_native_client_buffer / GL_OES_EGL_image_external unavailable");
+        }
+        if(egl_display == EGL_NO_DISPLAY) {
+            egl_display = eglGetCurrentDisplay();
+        }
+
+        const EGLint attribs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+        EGLImageKHR egl_image = egl.CreateImage(
+            egl_display, EGL_NO_CONTEXT, EGL_NATIVE_BUFFER_ANDROID,
+            egl.GetNativeClientBuffer(buffer), attribs
+        );
+        if(egl_image == EGL_NO_IMAGE_KHR) {
+            throw VideoException("AndroidCameraVideo: Unable to create EGLImage");
+        }
+
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, texture);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        egl.ImageTargetTexture2D(GL_TEXTURE_EXTERNAL_OES, (GLeglImageOES)egl_image);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+
+        AHardwareBuffer_acquire(buffer);
+        i = imported.insert(std::make_pair(buffer, ImportedBuffer{buffer, egl_image, texture})).first;
+    }
+
+    int64_t timestamp_ns = 0;
+    AImage_getTimestamp(image, &timestamp_ns);
+    frame_properties[PANGO_CAPTURE_TIME_US] = picojson::value(timestamp_ns / 1000);
+
+    return AndroidCameraTexture(
+        i->second.texture, GL_TEXTURE_EXTERNAL_OES,
+        (int)streams[0].Width(), (int)streams[0].Height(),
+        timestamp_ns / 1000, hold
+    );
+}
+
+AndroidCameraTexture AndroidCameraVideo::GrabNextTexture( bool wait )
+{
+    AImage* image = AcquireImage(false, wait);
+    return image ? Import(image) : AndroidCameraTexture();
+}
+
+AndroidCameraTexture AndroidCameraVideo::GrabNewestTexture( bool wait )
+{
+    AImage* image = AcquireImage(true, wait);
+    return image ? Import(image) : AndroidCameraTexture();
+}
+
+void AndroidCameraVideo::ReleaseTextures()
+{
+    for(auto& i : imported) {
+        EglImportFunctions::I().DestroyImage(egl_display, i.second.image);
+        glDeleteTextures(1, &i.second.texture);
+        AHardwareBuffer_release(i.second.buffer);
+    }
+    imported.clear();
+}
+
+uint32_t AndroidCameraVideo::AvailableFrames() const
+{
+    std::lock_guard<std::mutex> lock(available_mutex);
+    return (uint32_t)available;
+}
+
+bool AndroidCameraVideo::DropNFrames(uint32_t n)
+{
+    for(uint32_t i = 0; i < n; ++i) {
+        AImage* image = AcquireImage(false, false);
+        if(!image) return false;
+        AImage_delete(image);
+    }
+    return true;
+}
+
+const picojson::value& AndroidCameraVideo::DeviceProperties() const
+{
+    return device_properties;
+}
+
+const picojson::value& AndroidCameraVideo::FrameProperties() const
+{
+    return frame_properties;
+}
+
+PANGOLIN_REGISTER_FACTORY(AndroidCameraVideo)
+{
+    struct AndroidCameraVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            const int camera = uri.url.empty() ? -1 : std::atoi(uri.url.c_str());
+            const std::string facing = uri.Get<std::string>("facing", "back");
+            const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(1280,720));
+            AndroidCameraOptions options;
+            options.max_images = uri.Get<size_t>("images", options.max_images);
+            options.gpu = uri.Get<bool>("gpu", options.gpu);
+            return std::unique_ptr<VideoInterface>( new AndroidCameraVideo(camera, facing, dim.x, dim.y, options) );
+        }
+    };
+
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<AndroidCameraVideoFactory>(), 10, "camera2");
+}
+
+}
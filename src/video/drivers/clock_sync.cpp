@@ -0,0 +1,207 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/video/drivers/clock_sync.h>
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/timer.h>
+
+namespace pangolin
+{
+
+ClockSyncVideo::ClockSyncVideo(std::unique_ptr<VideoInterface>& src_, const ClockSyncOptions& options)
+    : src(std::move(src_)), options(options), model(options.window, options.reset_us),
+      native_metadata(false), warned_untimed(false), properties_stale(false)
+{
+    if(!src) {
+        throw VideoException("ClockSyncVideo: VideoInterface in must not be null");
+    }
+    videoin.push_back(src.get());
+
+    device_properties = GetVideoDeviceProperties(src.get());
+    if(!device_properties.is<picojson::object>()) {
+        device_properties = picojson::value(picojson::object());
+    }
+    device_properties[PANGO_HAS_TIMING_DATA] = true;
+}
+
+ClockSyncVideo::~ClockSyncVideo()
+{
+}
+
+ClockSyncSource ClockSyncVideo::ClockSyncSourceFromString(const std::string& str)
+{
+    if(!str.compare("auto")) return ClockSyncAuto;
+    else if(!str.compare("capture")) return ClockSyncCaptureTime;
+    else if(!str.compare("counter")) return ClockSyncFrameCounter;
+    else {
+        throw VideoException("ClockSyncVideo: unknown source '" + str + "'", "Use auto, capture or counter");
+    }
+}
+
+//! Implement VideoInput::Start()
+void ClockSyncVideo::Start()
+{
+    videoin[0]->Start();
+}
+
+//! Implement VideoInput::Stop()
+void ClockSyncVideo::Stop()
+{
+    videoin[0]->Stop();
+}
+
+//! Implement VideoInput::SizeBytes()
+size_t ClockSyncVideo::SizeBytes() const
+{
+    return videoin[0]->SizeBytes();
+}
+
+//! Implement VideoInput::Streams()
+const std::vector<StreamInfo>& ClockSyncVideo::Streams() const
+{
+    return videoin[0]->Streams();
+}
+
+void ClockSyncVideo::UpdateTiming()
+{
+    const int64_t now_us = Time_us(TimeNow());
+
+    native_metadata = HasVideoFrameMetadata(videoin[0]);
+    if(native_metadata) {
+        metadata = GetVideoFrameMetadata(videoin[0]);
+        properties_stale = true;
+    }else{
+        frame_properties = GetVideoFrameProperties(videoin[0]);
+        metadata = FrameMetadata::FromJson(frame_properties);
+        properties_stale = false;
+    }
+
+    const bool use_capture = metadata.Has(FrameMetadata::CaptureTime) && options.source != ClockSyncFrameCounter;
+    const bool use_counter = !use_capture && metadata.Has(FrameMetadata::FrameCounter) && options.source != ClockSyncCaptureTime;
+    if(!use_capture && !use_counter) {
+        if(!warned_untimed) {
+            pango_print_warn("ClockSyncVideo: input frames have no device timestamp or counter, passing through.\n");
+            warned_untimed = true;
+        }
+        return;
+    }
+
+    const double device_time = use_capture ? (double)metadata.capture_time_us : (double)metadata.frame_counter;
+    const int64_t host_us = metadata.Has(FrameMetadata::HostReceptionTime) ? metadata.host_reception_time_us : now_us;
+
+    int64_t center_us = model.Update(device_time, host_us) - options.latency_us;
+    if(options.half_exposure && metadata.Has(FrameMetadata::Exposure)) {
+        center_us -= metadata.exposure_us / 2;
+    }
+    metadata.SetEstimatedCenterCaptureTime(center_us);
+
+    if(!native_metadata) {
+        frame_properties[PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US] = picojson::value(center_us);
+    }
+}
+
+//! Implement VideoInput::GrabNext()
+bool ClockSyncVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if(videoin[0]->GrabNext(image, wait)) {
+        UpdateTiming();
+        return true;
+    }
+    return false;
+}
+
+//! Implement VideoInput::GrabNewest()
+bool ClockSyncVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    if(videoin[0]->GrabNewest(image, wait)) {
+        UpdateTiming();
+        return true;
+    }
+    return false;
+}
+
+std::vector<VideoInterface*>& ClockSyncVideo::InputStreams()
+{
+    return videoin;
+}
+
+const picojson::value& ClockSyncVideo::DeviceProperties() const
+{
+    return device_properties;
+}
+
+const picojson::value& ClockSyncVideo::FrameProperties() const
+{
+    if(properties_stale) {
+        frame_properties = picojson::value();
+        metadata.AddToJson(frame_properties);
+        properties_stale = false;
+    }
+
+    picojson::value fit;
+    fit["skew"] = model.Skew();
+    fit["jitter_us"] = model.JitterUs();
+    fit["samples"] = (int64_t)model.Samples();
+    fit["resets"] = (int64_t)model.Resets();
+    fit["valid"] = model.Valid();
+    frame_properties["clock_sync"] = fit;
+    return frame_properties;
+}
+
+//! Implement VideoFrameMetadataInterface::Metadata()
+const FrameMetadata& ClockSyncVideo::Metadata() const
+{
+    return metadata;
+}
+
+//! Implement VideoFrameMetadataInterface::HasNativeMetadata()
+bool ClockSyncVideo::HasNativeMetadata() const
+{
+    return native_metadata;
+}
+
+PANGOLIN_REGISTER_FACTORY(ClockSyncVideo)
+{
+    struct ClockSyncVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            ClockSyncOptions options;
+            options.source = ClockSyncVideo::ClockSyncSourceFromString(uri.Get<std::string>("source", "auto"));
+            options.window = uri.Get<size_t>("window", options.window);
+            options.reset_us = uri.Get<int64_t>("reset_us", options.reset_us);
+            options.latency_us = uri.Get<int64_t>("latency_us", options.latency_us);
+            options.half_exposure = uri.Get<bool>("half_exposure", options.half_exposure);
+
+            std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
+            return std::unique_ptr<VideoInterface>(new ClockSyncVideo(subvid, options));
+        }
+    };
+
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<ClockSyncVideoFactory>(), 10, "clocksync");
+}
+
+}
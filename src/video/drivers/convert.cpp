@@ -0,0 +1,247 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/drivers/convert.h>
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/pixel_format_convert.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/video/iostream_operators.h>
+
+namespace pangolin
+{
+
+ConvertVideo::ConvertVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fmt, float scale, size_t threads)
+    : VideoStageTimer("convert"), src(std::move(src_)), size_bytes(0), scale(scale), threads(threads)
+{
+    if(!src) {
+        throw VideoException("ConvertVideo: VideoInterface in must not be null");
+    }
+    videoin.push_back(src.get());
+
+    for(size_t s=0; s< src->Streams().size(); ++s) {
+        const StreamInfo& in = src->Streams()[s];
+        if(!CanConvertPixelFormat(out_fmt, in.PixFormat())) {
+            throw VideoException("ConvertVideo: Unable to convert " + in.PixFormat().Name() + " to " + out_fmt.Name());
+        }
+        if(!in.PixFormat().planar && in.PixFormat().channel_bits[0] == 4 && in.Width() % 2) {
+            throw VideoException("ConvertVideo: Packed 4:2:2 input must be of even width");
+        }
+
+        const size_t w = in.Width();
+        const size_t h = in.Height();
+        const StreamInfo out(out_fmt, w, h, (w*out_fmt.bpp) / 8, (unsigned char*)0 + size_bytes);
+        streams.push_back(out);
+        size_bytes += out.SizeBytes();
+    }
+
+    fused = std::unique_ptr<FusedRowFilter>(new FusedRowFilter(*this));
+}
+
+ConvertVideo::~ConvertVideo()
+{
+}
+
+bool ConvertVideo::CanConvert(const VideoInterface& videoin, PixelFormat out_fmt)
+{
+    for(const StreamInfo& si : videoin.Streams()) {
+        if(!CanConvertPixelFormat(out_fmt, si.PixFormat())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Implement VideoInput::Start()
+void ConvertVideo::Start()
+{
+    videoin[0]->Start();
+}
+
+//! Implement VideoInput::Stop()
+void ConvertVideo::Stop()
+{
+    videoin[0]->Stop();
+}
+
+//! Implement VideoInput::SizeBytes()
+size_t ConvertVideo::SizeBytes() const
+{
+    return size_bytes;
+}
+
+//! Implement VideoInput::Streams()
+const std::vector<StreamInfo>& ConvertVideo::Streams() const
+{
+    return streams;
+}
+
+void ConvertVideo::Process(unsigned char* image, const unsigned char* buffer)
+{
+    for(size_t s=0; s<streams.size(); ++s) {
+        const StreamInfo& si_in = videoin[0]->Streams()[s];
+        ConvertPixelFormat(
+            streams[s].StreamImage(image), streams[s].PixFormat(),
+            si_in.StreamImage(buffer), si_in.PixFormat(),
+            scale, threads
+        );
+    }
+}
+
+//! Implement VideoRowFilterInterface::RowFilterInputRow()
+size_t ConvertVideo::RowFilterInputRow(size_t /*stream*/, size_t y) const
+{
+    return y;
+}
+
+//! Implement VideoRowFilterInterface::RowFilterProcess()
+void ConvertVideo::RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    ConvertPixelFormatRow(
+        out_row, streams[stream].PixFormat(),
+        in_row, videoin[0]->Streams()[stream].PixFormat(),
+        streams[stream].Width(), scale
+    );
+}
+
+//! Implement VideoRowFilterInterface::RowFilterSupported()
+bool ConvertVideo::RowFilterSupported() const
+{
+    // Planar chroma isn't within the luma row, and fusing would forgo threads
+    if(threads != 1) return false;
+    for(const StreamInfo& si : videoin[0]->Streams()) {
+        if(si.PixFormat().planar) return false;
+    }
+    return true;
+}
+
+//! Implement VideoInput::GrabNext()
+bool ConvertVideo::GrabNext( unsigned char* image, bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNext(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+//! Implement VideoInput::GrabNewest()
+bool ConvertVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNewest(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+std::vector<VideoInterface*>& ConvertVideo::InputStreams()
+{
+    return videoin;
+}
+
+uint32_t ConvertVideo::AvailableFrames() const
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Convert: child interface is not buffer aware.");
+        return 0;
+    }
+    else
+    {
+        return vpi->AvailableFrames();
+    }
+}
+
+bool ConvertVideo::DropNFrames(uint32_t n)
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Convert: child interface is not buffer aware.");
+        return false;
+    }
+    else
+    {
+        return vpi->DropNFrames(n);
+    }
+}
+
+PANGOLIN_REGISTER_FACTORY(ConvertVideo)
+{
+    struct ConvertVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            std::string fmt = uri.Get<std::string>("fmt", "RGB24");
+            ToUpper(fmt);
+            PixelFormat out_fmt;
+            try {
+                out_fmt = PixelFormatFromString(fmt);
+            }catch(const std::runtime_error&) {
+                // Possibly a format only FFMPEG knows
+                return std::unique_ptr<VideoInterface>();
+            }
+            const float scale = uri.Get<float>("scale", 1.0f);
+            const size_t threads = uri.Get<size_t>("threads", 1);
+
+            std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
+            if(!ConvertVideo::CanConvert(*subvid, out_fmt)) {
+                // Leave conversions this doesn't support to FFMPEG, if available
+                return std::unique_ptr<VideoInterface>();
+            }
+            return std::unique_ptr<VideoInterface>(
+                new ConvertVideo(subvid, out_fmt, scale, threads)
+            );
+        }
+    };
+
+    // Ahead of the FFMPEG converter registered with the same scheme
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<ConvertVideoFactory>(), 10, "convert");
+}
+
+}
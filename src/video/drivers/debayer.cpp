@@ -28,6 +28,13 @@
 #include <pangolin/video/drivers/debayer.h>
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
+#include <pangolin/utils/parallel_for.h>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#   include <arm_neon.h>
+#endif
 
 #ifdef HAVE_DC1394
 #   include <dc1394/conversions.h>
@@ -58,8 +65,8 @@ pangolin::StreamInfo BayerOutputFormat( const StreamInfo& stream_in, bayer_metho
     return pangolin::StreamInfo( fmt, w, h, w*fmt.bpp / 8, (unsigned char*)0 + start_offset );
 }
 
-DebayerVideo::DebayerVideo(std::unique_ptr<VideoInterface> &src_, const std::vector<bayer_method_t>& bayer_method, color_filter_t tile)
-    : src(std::move(src_)), size_bytes(0), methods(bayer_method), tile(tile)
+DebayerVideo::DebayerVideo(std::unique_ptr<VideoInterface> &src_, const std::vector<bayer_method_t>& bayer_method, color_filter_t tile, size_t threads)
+    : VideoStageTimer("debayer"), src(std::move(src_)), size_bytes(0), methods(bayer_method), tile(tile), threads(threads)
 {
     if(!src.get()) {
         throw VideoException("DebayerVideo: VideoInterface in must not be null");
@@ -80,8 +87,6 @@ DebayerVideo::DebayerVideo(std::unique_ptr<VideoInterface> &src_, const std::vec
         streams.push_back(BayerOutputFormat(stin, methods[s], size_bytes));
         size_bytes += streams.back().SizeBytes();
     }
-
-    buffer = std::unique_ptr<unsigned char[]>(new unsigned char[src->SizeBytes()]);
 }
 
 DebayerVideo::~DebayerVideo()
@@ -212,6 +217,246 @@ void DownsampleDebayer(Image<Tout>& out, const Image<Tin>& in, color_filter_t ti
     }
 }
 
+namespace
+{
+
+// Demosaic candidates for a pixel, from the 3x3 neighbourhood in rows a (above),
+// c (centre) and b (below) of the raw image:
+enum BayerSource
+{
+    BayerSrcCentre,     // c[x]
+    BayerSrcHoriz,      // mean of c[x-1], c[x+1]
+    BayerSrcVert,       // mean of a[x], b[x]
+    BayerSrcDiag,       // mean of a[x-1], a[x+1], b[x-1], b[x+1]
+    BayerSrcCross,      // mean of horizontal and vertical
+    BayerSrcEdge        // horizontal or vertical, whichever has lower gradient
+};
+
+// Colour (0=R, 1=G, 2=B) of raw pixel with parity (xo,yo)
+int TileColor(color_filter_t tile, size_t xo, size_t yo)
+{
+    static const int pattern[4][4] = {
+        {0,1,1,2}, // RGGB
+        {1,2,0,1}, // GBRG
+        {1,0,2,1}, // GRBG
+        {2,1,1,0}  // BGGR
+    };
+    return pattern[tile - DC1394_COLOR_FILTER_RGGB][2*yo + xo];
+}
+
+struct BayerRowPlan
+{
+    // src[xo][channel]
+    BayerSource src[2][3];
+};
+
+BayerRowPlan PlanBayerRow(color_filter_t tile, size_t yo, bool edge_aware)
+{
+    BayerRowPlan plan;
+    for(size_t xo=0; xo < 2; ++xo) {
+        const int site = TileColor(tile, xo, yo);
+        BayerSource* s = plan.src[xo];
+        if(site == 1) {
+            const int horiz = TileColor(tile, xo^1, yo);
+            s[0] = horiz == 0 ? BayerSrcHoriz : BayerSrcVert;
+            s[1] = BayerSrcCentre;
+            s[2] = horiz == 2 ? BayerSrcHoriz : BayerSrcVert;
+        }else{
+            s[site] = BayerSrcCentre;
+            s[1] = edge_aware ? BayerSrcEdge : BayerSrcCross;
+            s[2-site] = BayerSrcDiag;
+        }
+    }
+    return plan;
+}
+
+template<typename T>
+inline T BayerAvg(T a, T b)
+{
+    return T((uint32_t(a) + uint32_t(b) + 1) >> 1);
+}
+
+template<typename T>
+inline T BayerSample(BayerSource src, const T* a, const T* c, const T* b, size_t xl, size_t x, size_t xr)
+{
+    switch(src) {
+    case BayerSrcCentre: return c[x];
+    case BayerSrcHoriz:  return BayerAvg(c[xl], c[xr]);
+    case BayerSrcVert:   return BayerAvg(a[x], b[x]);
+    case BayerSrcDiag:   return BayerAvg(BayerAvg(a[xl], a[xr]), BayerAvg(b[xl], b[xr]));
+    case BayerSrcCross:  return BayerAvg(BayerAvg(c[xl], c[xr]), BayerAvg(a[x], b[x]));
+    case BayerSrcEdge: {
+        const T dh = c[xl] > c[xr] ? T(c[xl] - c[xr]) : T(c[xr] - c[xl]);
+        const T dv = a[x] > b[x] ? T(a[x] - b[x]) : T(b[x] - a[x]);
+        const T h = BayerAvg(c[xl], c[xr]);
+        const T v = BayerAvg(a[x], b[x]);
+        return dh < dv ? h : (dv < dh ? v : BayerAvg(h, v));
+    }
+    }
+    return 0;
+}
+
+// Vector helpers over lanes of T. Lanes == 0 when no implementation exists
+// for the target, leaving everything to the scalar path.
+template<typename T> struct BayerVec { static const size_t lanes = 0; };
+
+#if defined(__SSE2__)
+struct BayerVecSSE2Base
+{
+    typedef __m128i V;
+    static V Load(const void* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void Store(void* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+    static V Select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+    static V Not(V m) { return _mm_xor_si128(m, _mm_set1_epi32(-1)); }
+};
+
+template<> struct BayerVec<uint8_t> : BayerVecSSE2Base
+{
+    static const size_t lanes = 16;
+    static V Avg(V a, V b) { return _mm_avg_epu8(a, b); }
+    static V AbsDiff(V a, V b) { return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)); }
+    static V Greater(V a, V b) { return Not(_mm_cmpeq_epi8(_mm_subs_epu8(a, b), _mm_setzero_si128())); }
+    static V OddLanes() { return _mm_set1_epi16((short)0xFF00); }
+};
+
+template<> struct BayerVec<uint16_t> : BayerVecSSE2Base
+{
+    static const size_t lanes = 8;
+    static V Avg(V a, V b) { return _mm_avg_epu16(a, b); }
+    static V AbsDiff(V a, V b) { return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a)); }
+    static V Greater(V a, V b) { return Not(_mm_cmpeq_epi16(_mm_subs_epu16(a, b), _mm_setzero_si128())); }
+    static V OddLanes() { return _mm_set1_epi32((int)0xFFFF0000); }
+};
+#elif defined(__ARM_NEON)
+template<> struct BayerVec<uint8_t>
+{
+    typedef uint8x16_t V;
+    static const size_t lanes = 16;
+    static V Load(const void* p) { return vld1q_u8((const uint8_t*)p); }
+    static void Store(void* p, V v) { vst1q_u8((uint8_t*)p, v); }
+    static V Select(V m, V a, V b) { return vbslq_u8(m, a, b); }
+    static V Avg(V a, V b) { return vrhaddq_u8(a, b); }
+    static V AbsDiff(V a, V b) { return vabdq_u8(a, b); }
+    static V Greater(V a, V b) { return vcgtq_u8(a, b); }
+    static V OddLanes() { return vreinterpretq_u8_u16(vdupq_n_u16(0xFF00)); }
+};
+
+template<> struct BayerVec<uint16_t>
+{
+    typedef uint16x8_t V;
+    static const size_t lanes = 8;
+    static V Load(const void* p) { return vld1q_u16((const uint16_t*)p); }
+    static void Store(void* p, V v) { vst1q_u16((uint16_t*)p, v); }
+    static V Select(V m, V a, V b) { return vbslq_u16(m, a, b); }
+    static V Avg(V a, V b) { return vrhaddq_u16(a, b); }
+    static V AbsDiff(V a, V b) { return vabdq_u16(a, b); }
+    static V Greater(V a, V b) { return vcgtq_u16(a, b); }
+    static V OddLanes() { return vreinterpretq_u16_u32(vdupq_n_u32(0xFFFF0000)); }
+};
+#endif
+
+template<typename T, bool HaveVec = (BayerVec<T>::lanes > 0)>
+struct BayerVecKernel
+{
+    static void Run(const BayerRowPlan&, const T*, const T*, const T*, size_t, T**) {}
+};
+
+template<typename T>
+struct BayerVecKernel<T, true>
+{
+    typedef BayerVec<T> VecT;
+    typedef typename VecT::V V;
+
+    // Compute lanes pixels [x, x+lanes) of each planar output channel.
+    // x must be even, x >= 1 and x + lanes < w.
+    static void Run(const BayerRowPlan& plan, const T* a, const T* c, const T* b, size_t x, T** planes)
+    {
+        const V a0 = VecT::Load(a + x), b0 = VecT::Load(b + x);
+        const V cl = VecT::Load(c + x - 1), cr = VecT::Load(c + x + 1);
+        const V h = VecT::Avg(cl, cr);
+        const V v = VecT::Avg(a0, b0);
+
+        V cand[6];
+        cand[BayerSrcCentre] = VecT::Load(c + x);
+        cand[BayerSrcHoriz] = h;
+        cand[BayerSrcVert] = v;
+        cand[BayerSrcDiag] = VecT::Avg(
+            VecT::Avg(VecT::Load(a + x - 1), VecT::Load(a + x + 1)),
+            VecT::Avg(VecT::Load(b + x - 1), VecT::Load(b + x + 1))
+        );
+        cand[BayerSrcCross] = VecT::Avg(h, v);
+
+        const V dh = VecT::AbsDiff(cl, cr);
+        const V dv = VecT::AbsDiff(a0, b0);
+        cand[BayerSrcEdge] = VecT::Select(VecT::Greater(dv, dh), h,
+                             VecT::Select(VecT::Greater(dh, dv), v, cand[BayerSrcCross]));
+
+        const V odd = VecT::OddLanes();
+        for(int ch=0; ch < 3; ++ch) {
+            VecT::Store(planes[ch] + x, VecT::Select(odd, cand[plan.src[1][ch]], cand[plan.src[0][ch]]));
+        }
+    }
+};
+
+// Full resolution demosaic of rows [y_begin, y_end) into interleaved RGB.
+template<typename T>
+void DemosaicRows(Image<T>& out, const Image<T>& in, color_filter_t tile, bool edge_aware, size_t y_begin, size_t y_end)
+{
+    const size_t w = in.w;
+    const size_t lanes = BayerVec<T>::lanes;
+
+    std::vector<T> plane_storage(3*w);
+    T* planes[3] = {&plane_storage[0], &plane_storage[w], &plane_storage[2*w]};
+
+    const BayerRowPlan plans[2] = {
+        PlanBayerRow(tile, 0, edge_aware), PlanBayerRow(tile, 1, edge_aware)
+    };
+
+    for(size_t y=y_begin; y < y_end; ++y) {
+        // Mirror at borders, which preserves the bayer pattern.
+        const T* a = in.RowPtr(y > 0 ? y-1 : std::min<size_t>(1, in.h-1));
+        const T* c = in.RowPtr(y);
+        const T* b = in.RowPtr(y+1 < in.h ? y+1 : (in.h > 1 ? in.h-2 : 0));
+        const BayerRowPlan& plan = plans[y % 2];
+
+        size_t x = 0;
+        auto scalar = [&](size_t x) {
+            const size_t xl = x > 0 ? x-1 : std::min<size_t>(1, w-1);
+            const size_t xr = x+1 < w ? x+1 : (w > 1 ? w-2 : 0);
+            for(int ch=0; ch < 3; ++ch) {
+                planes[ch][x] = BayerSample(plan.src[x%2][ch], a, c, b, xl, x, xr);
+            }
+        };
+
+        if(lanes > 0 && w > lanes + 2) {
+            scalar(0);
+            scalar(1);
+            for(x = 2; x + lanes < w; x += lanes) {
+                BayerVecKernel<T>::Run(plan, a, c, b, x, planes);
+            }
+        }
+        for(; x < w; ++x) {
+            scalar(x);
+        }
+
+        T* pout = out.RowPtr(y);
+        for(size_t x=0; x < w; ++x) {
+            *(pout++) = planes[0][x];
+            *(pout++) = planes[1][x];
+            *(pout++) = planes[2][x];
+        }
+    }
+}
+
+// Rows [b,e) of img as an image
+template<typename T>
+Image<T> ImageRows(const Image<T>& img, size_t b, size_t e)
+{
+    return Image<T>(img.w, e - b, img.pitch, (T*)img.RowPtr(b));
+}
+
+}
+
 template<typename T>
 void PitchedImageCopy( Image<T>& img_out, const Image<T>& img_in ) {
     if( img_out.w != img_in.w || img_out.h != img_in.h || sizeof(T) * img_in.w > img_out.pitch) {
@@ -224,18 +469,27 @@ void PitchedImageCopy( Image<T>& img_out, const Image<T>& img_in ) {
 }
 
 template<typename Tout, typename Tin>
-void ProcessImage(Image<Tout>& img_out, const Image<Tin>& img_in, bayer_method_t method, color_filter_t tile)
+void ProcessImage(Image<Tout>& img_out, const Image<Tin>& img_in, bayer_method_t method, color_filter_t tile, size_t threads)
 {
     if(method == BAYER_METHOD_NONE) {
         PitchedImageCopy(img_out, img_in.template UnsafeReinterpret<Tout>() );
-    }else if(method == BAYER_METHOD_DOWNSAMPLE_MONO) {
-        if( sizeof(Tout) == 1) {
-            DownsampleToMono<int,Tout, Tin>(img_out, img_in);
-        }else{
-            DownsampleToMono<double,Tout, Tin>(img_out, img_in);
-        }
-    }else if(method == BAYER_METHOD_DOWNSAMPLE) {
-        DownsampleDebayer(img_out, img_in, tile);
+    }else if(method == BAYER_METHOD_DOWNSAMPLE_MONO || method == BAYER_METHOD_DOWNSAMPLE) {
+        ParallelFor(0, img_out.h, threads, [&](size_t b, size_t e){
+            Image<Tout> out_rows = ImageRows(img_out, b, e);
+            const Image<Tin> in_rows = ImageRows(img_in, 2*b, 2*e);
+            if(method == BAYER_METHOD_DOWNSAMPLE) {
+                DownsampleDebayer(out_rows, in_rows, tile);
+            }else if( sizeof(Tout) == 1) {
+                DownsampleToMono<int,Tout, Tin>(out_rows, in_rows);
+            }else{
+                DownsampleToMono<double,Tout, Tin>(out_rows, in_rows);
+            }
+        });
+    }else if(method == BAYER_METHOD_LINEAR || method == BAYER_METHOD_EDGEAWARE) {
+        const Image<Tout> img_in_t = img_in.template UnsafeReinterpret<Tout>();
+        ParallelFor(0, img_out.h, threads, [&](size_t b, size_t e){
+            DemosaicRows(img_out, img_in_t, tile, method == BAYER_METHOD_EDGEAWARE, b, e);
+        });
     }else{
 #ifdef HAVE_DC1394
         if(sizeof(Tout) == 1) {
@@ -267,13 +521,13 @@ void DebayerVideo::ProcessStreams(unsigned char* out, const unsigned char *in)
                 std::memcpy(img_out.RowPtr((int)y), img_in.RowPtr((int)y), num_bytes);
             }
         }else if(stin.PixFormat().bpp == 8) {
-            ProcessImage(img_out, img_in, methods[s], tile);
+            ProcessImage(img_out, img_in, methods[s], tile, threads);
         }else if(stin.PixFormat().bpp == 16){
             Image<uint16_t> img_in16  = img_in.UnsafeReinterpret<uint16_t>();
             Image<uint16_t> img_out16 = img_out.UnsafeReinterpret<uint16_t>();
-            ProcessImage(img_out16, img_in16, methods[s], tile);
+            ProcessImage(img_out16, img_in16, methods[s], tile, threads);
         }else {
-            throw std::runtime_error("debayer: unhandled format combination: " + stin.PixFormat().format );
+            throw std::runtime_error("debayer: unhandled format combination: " + stin.PixFormat().Name() );
         }
     }
 }
@@ -281,8 +535,12 @@ void DebayerVideo::ProcessStreams(unsigned char* out, const unsigned char *in)
 //! Implement VideoInput::GrabNext()
 bool DebayerVideo::GrabNext( unsigned char* image, bool wait )
 {    
-    if(videoin[0]->GrabNext(buffer.get(),wait)) {
-        ProcessStreams(image, buffer.get());
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        ProcessStreams(image, in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -292,8 +550,12 @@ bool DebayerVideo::GrabNext( unsigned char* image, bool wait )
 //! Implement VideoInput::GrabNewest()
 bool DebayerVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    if(videoin[0]->GrabNewest(buffer.get(),wait)) {
-        ProcessStreams(image, buffer.get());
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        ProcessStreams(image, in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -329,6 +591,8 @@ bayer_method_t DebayerVideo::BayerMethodFromString(std::string str)
   else if(!str.compare("ahd")) return BAYER_METHOD_AHD;
   else if(!str.compare("mono")) return BAYER_METHOD_DOWNSAMPLE_MONO;
   else if(!str.compare("none")) return BAYER_METHOD_NONE;
+  else if(!str.compare("linear")) return BAYER_METHOD_LINEAR;
+  else if(!str.compare("edgeaware")) return BAYER_METHOD_EDGEAWARE;
   else {
      pango_print_error("Debayer error, %s is not a valid debayer method using downsample\n", str.c_str());
      return BAYER_METHOD_DOWNSAMPLE;
@@ -343,6 +607,7 @@ PANGOLIN_REGISTER_FACTORY(DebayerVideo)
             const std::string tile_string = uri.Get<std::string>("tile","rggb");
             const std::string method = uri.Get<std::string>("method","none");
             const color_filter_t tile = DebayerVideo::ColorFilterFromString(tile_string);
+            const size_t threads = uri.Get<size_t>("threads", 1);
 
             std::vector<bayer_method_t> methods;
             for(size_t s=0; s < subvid->Streams().size(); ++s) {
@@ -350,7 +615,7 @@ PANGOLIN_REGISTER_FACTORY(DebayerVideo)
                 std::string method_s = uri.Get<std::string>(key, method);
                 methods.push_back(DebayerVideo::BayerMethodFromString(method_s));
             }
-            return std::unique_ptr<VideoInterface>( new DebayerVideo(subvid, methods, tile) );
+            return std::unique_ptr<VideoInterface>( new DebayerVideo(subvid, methods, tile, threads) );
         }
     };
 
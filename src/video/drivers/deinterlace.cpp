@@ -27,77 +27,399 @@
 
 #include <pangolin/video/drivers/deinterlace.h>
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/parallel_for.h>
 #include <pangolin/video/iostream_operators.h>
-#include <dc1394/conversions.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  define DEINTERLACE_HAVE_SSE2
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define DEINTERLACE_HAVE_NEON
+#  include <arm_neon.h>
+#endif
 
 namespace pangolin
 {
 
-DeinterlaceVideo::DeinterlaceVideo(std::unique_ptr<VideoInterface> &videoin_)
-    : videoin(std::move(videoin_)), buffer(0)
+DeinterlaceMethod DeinterlaceMethodFromString(const std::string& str)
+{
+    if(!str.compare("stereo")) return DeinterlaceStereo;
+    else if(!str.compare("fields")) return DeinterlaceFields;
+    else if(!str.compare("double")) return DeinterlaceDouble;
+    else if(!str.compare("bob")) return DeinterlaceBob;
+    else if(!str.compare("weave")) return DeinterlaceWeave;
+    else {
+        pango_print_error("Deinterlace error, %s is not a valid method using stereo\n", str.c_str());
+        return DeinterlaceStereo;
+    }
+}
+
+namespace
+{
+
+// Bytes of the channels bob averages, or 0 if it can't average fmt
+size_t BobChannelBytes(const PixelFormat& fmt)
+{
+    if(fmt.IsFloat() || fmt.bpp % 8) return 0;
+    if(fmt.channel_bits[0] <= 8) return 1;
+    if(fmt.channel_bits[0] == 16) return 2;
+    return 0;
+}
+
+// Take pixel k of each pair of pixels in a row of 2*w pixels
+template<typename T>
+void UninterleaveRowScalar(T* out, const T* in, size_t w, size_t k)
 {
-    if(videoin->Streams().size() != 1)
-        throw VideoException("FirewireDeinterlace input must have exactly one stream");
-    
-    const StreamInfo& stmin = videoin->Streams()[0];
+    for(size_t x=0; x < w; ++x) {
+        out[x] = in[2*x + k];
+    }
+}
+
+void UninterleaveRow(uint8_t* out, const uint8_t* in, size_t w, size_t k)
+{
+    size_t x = 0;
+#if defined(DEINTERLACE_HAVE_SSE2)
+    const __m128i lo = _mm_set1_epi16(0x00ff);
+    for(; x + 16 <= w; x += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(in + 2*x));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(in + 2*x + 16));
+        const __m128i ka = k ? _mm_srli_epi16(a, 8) : _mm_and_si128(a, lo);
+        const __m128i kb = k ? _mm_srli_epi16(b, 8) : _mm_and_si128(b, lo);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(ka, kb));
+    }
+#elif defined(DEINTERLACE_HAVE_NEON)
+    for(; x + 16 <= w; x += 16) {
+        const uint8x16x2_t v = vld2q_u8(in + 2*x);
+        vst1q_u8(out + x, k ? v.val[1] : v.val[0]);
+    }
+#endif
+    UninterleaveRowScalar(out + x, in + 2*x, w - x, k);
+}
+
+void UninterleaveRow(uint16_t* out, const uint16_t* in, size_t w, size_t k)
+{
+    size_t x = 0;
+#if defined(DEINTERLACE_HAVE_SSE2)
+    for(; x + 8 <= w; x += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(in + 2*x));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(in + 2*x + 8));
+        // Sign extend the wanted half of each 32 bits, so that the saturating
+        // pack returns it unchanged
+        const __m128i ka = k ? _mm_srai_epi32(a, 16) : _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        const __m128i kb = k ? _mm_srai_epi32(b, 16) : _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packs_epi32(ka, kb));
+    }
+#elif defined(DEINTERLACE_HAVE_NEON)
+    for(; x + 8 <= w; x += 8) {
+        const uint16x8x2_t v = vld2q_u16(in + 2*x);
+        vst1q_u16(out + x, k ? v.val[1] : v.val[0]);
+    }
+#endif
+    UninterleaveRowScalar(out + x, in + 2*x, w - x, k);
+}
 
-    StreamInfo stm1(PixelFormatFromString("GRAY8"), stmin.Width(), stmin.Height(), stmin.Width(), 0);
-    StreamInfo stm2(PixelFormatFromString("GRAY8"), stmin.Width(), stmin.Height(), stmin.Width(), (unsigned char*)0 + stmin.Width()*stmin.Height());
-    streams.push_back(stm1);
-    streams.push_back(stm2);
+// out = (a + b + 1) / 2 for n channels
+void AverageRow(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t n)
+{
+    size_t i = 0;
+#if defined(DEINTERLACE_HAVE_SSE2)
+    for(; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_avg_epu8(va, vb));
+    }
+#elif defined(DEINTERLACE_HAVE_NEON)
+    for(; i + 16 <= n; i += 16) {
+        vst1q_u8(out + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#endif
+    for(; i < n; ++i) {
+        out[i] = (uint8_t)((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+void AverageRow(uint16_t* out, const uint16_t* a, const uint16_t* b, size_t n)
+{
+    size_t i = 0;
+#if defined(DEINTERLACE_HAVE_SSE2)
+    for(; i + 8 <= n; i += 8) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_avg_epu16(va, vb));
+    }
+#elif defined(DEINTERLACE_HAVE_NEON)
+    for(; i + 8 <= n; i += 8) {
+        vst1q_u16(out + i, vrhaddq_u16(vld1q_u16(a + i), vld1q_u16(b + i)));
+    }
+#endif
+    for(; i < n; ++i) {
+        out[i] = (uint16_t)((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+}
+
+DeinterlaceVideo::DeinterlaceVideo(std::unique_ptr<VideoInterface>& src_, DeinterlaceMethod method, size_t field, size_t threads)
+    : VideoStageTimer("deinterlace"), src(std::move(src_)), method(method), field(field % 2), threads(threads), size_bytes(0)
+{
+    if(!src) {
+        throw VideoException("DeinterlaceVideo: VideoInterface in must not be null");
+    }
+    videoin.push_back(src.get());
+
+    for(const StreamInfo& in : src->Streams()) {
+        const PixelFormat& fmt = in.PixFormat();
+        if(fmt.planar) {
+            throw VideoException("DeinterlaceVideo: Planar " + fmt.Name() + " can't be deinterlaced");
+        }
+
+        const size_t w = in.Width();
+        const size_t h = in.Height();
+        std::vector<StreamInfo> out;
+
+        switch(method) {
+        case DeinterlaceStereo: {
+            if(fmt.bpp != 16 && fmt.bpp != 32) {
+                throw VideoException("DeinterlaceVideo: Stereo pixels must be of 16 or 32 bits, not " + fmt.Name());
+            }
+            const PixelFormat out_fmt = PixelFormatFromString(fmt.bpp == 16 ? "GRAY8" : "GRAY16LE");
+            const StreamInfo camera(out_fmt, w, h, (w*out_fmt.bpp) / 8, 0);
+            out.push_back(camera);
+            out.push_back(camera);
+            break;
+        }
+        case DeinterlaceFields:
+            // Even rows then odd rows
+            out.push_back(StreamInfo(fmt, w, (h+1) / 2, (w*fmt.bpp + 7) / 8, 0));
+            out.push_back(StreamInfo(fmt, w, h / 2, (w*fmt.bpp + 7) / 8, 0));
+            break;
+        case DeinterlaceBob:
+            if(!BobChannelBytes(fmt)) {
+                throw VideoException("DeinterlaceVideo: Bob needs channels of 8 or 16 bits, not " + fmt.Name());
+            }
+            // fallthrough
+        case DeinterlaceDouble:
+        case DeinterlaceWeave:
+            if(h < 2) {
+                throw VideoException("DeinterlaceVideo: Streams must be at least two rows high");
+            }
+            out.push_back(StreamInfo(fmt, w, h, (w*fmt.bpp + 7) / 8, 0));
+            break;
+        }
 
-    buffer = new unsigned char[videoin->SizeBytes()];
+        for(const StreamInfo& si : out) {
+            streams.push_back(StreamInfo(si.PixFormat(), si.Width(), si.Height(), si.Pitch(), (unsigned char*)0 + size_bytes));
+            size_bytes += si.SizeBytes();
+        }
+    }
 
-    std::cout << videoin->Streams()[0].Width() << ", " << videoin->Streams()[0].Height() << std::endl;
+    fused = std::unique_ptr<FusedRowFilter>(new FusedRowFilter(*this));
 }
 
 DeinterlaceVideo::~DeinterlaceVideo()
 {
-    delete[] buffer;
 }
 
+//! Implement VideoInput::Start()
+void DeinterlaceVideo::Start()
+{
+    videoin[0]->Start();
+}
+
+//! Implement VideoInput::Stop()
+void DeinterlaceVideo::Stop()
+{
+    videoin[0]->Stop();
+}
+
+//! Implement VideoInput::SizeBytes()
 size_t DeinterlaceVideo::SizeBytes() const
 {
-    return videoin->SizeBytes();
+    return size_bytes;
 }
 
+//! Implement VideoInput::Streams()
 const std::vector<StreamInfo>& DeinterlaceVideo::Streams() const
 {
     return streams;
 }
 
-void DeinterlaceVideo::Start()
+void DeinterlaceVideo::Process(unsigned char* image, const unsigned char* buffer)
 {
-    videoin->Start();
+    for(size_t s=0; s<streams.size(); ++s) {
+        const StreamInfo& si_in = videoin[0]->Streams()[RowFilterInputStream(s)];
+        const Image<unsigned char> img_in = si_in.StreamImage(buffer);
+        Image<unsigned char> img_out = streams[s].StreamImage(image);
+
+        if(method == DeinterlaceBob) {
+            const size_t n = (streams[s].Width() * streams[s].PixFormat().bpp) / 8;
+            const bool wide = BobChannelBytes(streams[s].PixFormat()) == 2;
+            ParallelFor(0, img_out.h, threads, [&](size_t y0, size_t y1) {
+                for(size_t y=y0; y < y1; ++y) {
+                    unsigned char* out_row = img_out.RowPtr((int)y);
+                    if(y % 2 == field) {
+                        std::memcpy(out_row, img_in.RowPtr((int)y), n);
+                        continue;
+                    }
+                    // Rows either side belong to field, repeating at the edges
+                    const size_t a = (y > 0) ? y - 1 : y + 1;
+                    const size_t b = (y + 1 < img_in.h) ? y + 1 : y - 1;
+                    if(wide) {
+                        AverageRow((uint16_t*)out_row, (const uint16_t*)img_in.RowPtr((int)a), (const uint16_t*)img_in.RowPtr((int)b), n / 2);
+                    }else{
+                        AverageRow(out_row, img_in.RowPtr((int)a), img_in.RowPtr((int)b), n);
+                    }
+                }
+            });
+        }else{
+            ParallelFor(0, img_out.h, threads, [&](size_t y0, size_t y1) {
+                for(size_t y=y0; y < y1; ++y) {
+                    RowFilterProcess(s, img_out.RowPtr((int)y), img_in.RowPtr((int)RowFilterInputRow(s, y)));
+                }
+            });
+        }
+    }
 }
 
-void DeinterlaceVideo::Stop()
+//! Implement VideoRowFilterInterface::RowFilterInputStream()
+size_t DeinterlaceVideo::RowFilterInputStream(size_t stream) const
 {
-    videoin->Stop();
+    const bool splits = method == DeinterlaceStereo || method == DeinterlaceFields;
+    return splits ? stream / 2 : stream;
 }
 
+//! Implement VideoRowFilterInterface::RowFilterInputRow()
+size_t DeinterlaceVideo::RowFilterInputRow(size_t stream, size_t y) const
+{
+    const size_t h = streams[stream].Height();
+    switch(method) {
+    case DeinterlaceFields:
+        return 2*y + stream % 2;
+    case DeinterlaceDouble: {
+        // The last row of field 1 may be missing from streams of odd height
+        const size_t r = 2*(y/2) + field;
+        return r < h ? r : r - 2;
+    }
+    case DeinterlaceWeave:
+        // Field 0 is stored in the first (h+1)/2 rows
+        return (y % 2) ? (h+1)/2 + y/2 : y/2;
+    default:
+        return y;
+    }
+}
+
+//! Implement VideoRowFilterInterface::RowFilterProcess()
+void DeinterlaceVideo::RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    const StreamInfo& si = streams[stream];
+    if(method == DeinterlaceStereo) {
+        if(si.PixFormat().bpp == 8) {
+            UninterleaveRow(out_row, in_row, si.Width(), stream % 2);
+        }else{
+            UninterleaveRow((uint16_t*)out_row, (const uint16_t*)in_row, si.Width(), stream % 2);
+        }
+    }else{
+        std::memcpy(out_row, in_row, (si.Width() * si.PixFormat().bpp + 7) / 8);
+    }
+}
+
+//! Implement VideoRowFilterInterface::RowFilterSupported()
+bool DeinterlaceVideo::RowFilterSupported() const
+{
+    // Bob reads two input rows for every other output row, and fusing would
+    // forgo threads
+    return method != DeinterlaceBob && threads == 1;
+}
+
+//! Implement VideoInput::GrabNext()
 bool DeinterlaceVideo::GrabNext( unsigned char* image, bool wait )
 {
-    if(videoin->GrabNext(buffer, wait)) {
-        return ( dc1394_deinterlace_stereo(buffer,image, videoin->Streams()[0].Width(), 2*videoin->Streams()[0].Height() ) == DC1394_SUCCESS );
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNext(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
     }
-    return false;
 }
 
+//! Implement VideoInput::GrabNewest()
 bool DeinterlaceVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    if(videoin->GrabNewest(buffer, wait)) {
-        return ( dc1394_deinterlace_stereo(buffer,image, videoin->Streams()[0].Width(), 2*videoin->Streams()[0].Height() ) == DC1394_SUCCESS );
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNewest(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+std::vector<VideoInterface*>& DeinterlaceVideo::InputStreams()
+{
+    return videoin;
+}
+
+uint32_t DeinterlaceVideo::AvailableFrames() const
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Deinterlace: child interface is not buffer aware.");
+        return 0;
+    }
+    else
+    {
+        return vpi->AvailableFrames();
+    }
+}
+
+bool DeinterlaceVideo::DropNFrames(uint32_t n)
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Deinterlace: child interface is not buffer aware.");
+        return false;
+    }
+    else
+    {
+        return vpi->DropNFrames(n);
     }
-    return false;
 }
 
 PANGOLIN_REGISTER_FACTORY(DeinterlaceVideo)
 {
     struct DeinterlaceVideoFactory : public FactoryInterface<VideoInterface> {
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            const DeinterlaceMethod method = DeinterlaceMethodFromString(uri.Get<std::string>("method", "stereo"));
+            const size_t field = uri.Get<size_t>("field", 0);
+            const size_t threads = uri.Get<size_t>("threads", 1);
             std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
-            return std::unique_ptr<VideoInterface>( new DeinterlaceVideo(subvid) );
+            return std::unique_ptr<VideoInterface>( new DeinterlaceVideo(subvid, method, field, threads) );
         }
     };
 
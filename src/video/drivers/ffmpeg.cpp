@@ -25,10 +25,14 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <array>
+#include <fstream>
+#include <limits>
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
 #include <pangolin/video/drivers/ffmpeg.h>
 
 // Some versions of FFMPEG define this horrid macro in global scope.
@@ -38,8 +42,16 @@ extern "C"
 {
 #include <libavformat/avio.h>
 #include <libavutil/mathematics.h>
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#endif
 }
 
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+#  include <sys/stat.h>
+#endif
+
 namespace pangolin
 {
 
@@ -139,13 +151,66 @@ std::string FfmpegFmtToString(const AVPixelFormat fmt)
 
 #undef TEST_PIX_FMT_RETURN
 
-FfmpegVideo::FfmpegVideo(const std::string filename, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream)
+FfmpegVideo::FfmpegVideo(const std::string filename, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream, const std::string hwaccel, int threads, const std::string index_filename)
     :pFormatCtx(0)
 {
-    InitUrl(filename, strfmtout, codec_hint, dump_info, user_video_stream);
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    video_url = filename;
+    index_file = index_filename;
+    index_built = false;
+    index_has_pts = false;
+    next_frame_id = 0;
+    have_pending = false;
+#else
+    (void)index_filename;
+#endif
+    InitUrl(filename, strfmtout, codec_hint, dump_info, user_video_stream, hwaccel, threads);
+}
+
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+AVPixelFormat FfmpegVideo::GetHwFormat(AVCodecContext* ctx, const AVPixelFormat* fmts)
+{
+    const FfmpegVideo* self = (const FfmpegVideo*)ctx->opaque;
+    for(const AVPixelFormat* p = fmts; *p != AV_PIX_FMT_NONE; ++p) {
+        if(*p == self->hw_pix_fmt) return *p;
+    }
+    // Device can't decode this stream, fall back to the software format
+    pango_print_warn("FfmpegVideo: hardware decode unavailable for stream, decoding in software\n");
+    return fmts[0];
 }
 
-void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream)
+void FfmpegVideo::InitHwAccel(const std::string& hwaccel)
+{
+    if(hwaccel == "none") return;
+
+#if LIBAVCODEC_VERSION_MAJOR >= 58
+    for(int i = 0;; ++i) {
+        const AVCodecHWConfig* config = avcodec_get_hw_config(pVidCodec, i);
+        if(!config) break;
+        if(!(config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)) continue;
+        if(hwaccel != "auto" && config->device_type != av_hwdevice_find_type_by_name(hwaccel.c_str())) continue;
+
+        if(av_hwdevice_ctx_create(&hw_device_ctx, config->device_type, nullptr, nullptr, 0) == 0) {
+            hw_pix_fmt = config->pix_fmt;
+            pVidCodecCtx->hw_device_ctx = av_buffer_ref(hw_device_ctx);
+            pVidCodecCtx->opaque = this;
+            pVidCodecCtx->get_format = &FfmpegVideo::GetHwFormat;
+            return;
+        }
+    }
+
+    if(hwaccel != "auto") {
+        throw VideoException("Unable to decode " + std::string(pVidCodec->name) + " with hwaccel", hwaccel);
+    }
+#else
+    if(hwaccel != "auto") {
+        throw VideoException("hwaccel requires FFmpeg 4.0 or later");
+    }
+#endif
+}
+#endif // PANGO_FFMPEG_SEND_RECEIVE
+
+void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream, const std::string hwaccel, int threads)
 {
     if( url.find('*') != url.npos )
         throw VideoException("Wildcards not supported. Please use ffmpegs printf style formatting for image sequences. e.g. img-000000%04d.ppm");
@@ -202,10 +267,15 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     
     for(unsigned i=0; i<pFormatCtx->nb_streams; i++)
     {
-        if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO)
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+        const AVMediaType type = pFormatCtx->streams[i]->codecpar->codec_type;
+#else
+        const AVMediaType type = pFormatCtx->streams[i]->codec->codec_type;
+#endif
+        if(type==AVMEDIA_TYPE_VIDEO)
         {
             videoStreams.push_back(i);
-        }else if(pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_AUDIO)
+        }else if(type==AVMEDIA_TYPE_AUDIO)
         {
             audioStreams.push_back(i);
         }
@@ -220,6 +290,36 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
         videoStream = videoStreams[0];
     }
     
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    const AVCodecParameters* par = pFormatCtx->streams[videoStream]->codecpar;
+
+    // Find the decoder for the video stream
+    pVidCodec=(AVCodec*)avcodec_find_decoder(par->codec_id);
+    if(pVidCodec==0)
+        throw VideoException("Codec not found");
+
+    pVidCodecCtx = avcodec_alloc_context3(pVidCodec);
+    if(!pVidCodecCtx || avcodec_parameters_to_context(pVidCodecCtx, par) < 0)
+        throw VideoException("Could not allocate codec context");
+    pVidCodecCtx->pkt_timebase = pFormatCtx->streams[videoStream]->time_base;
+
+    // Frame threading adds latency but scales with cores for playback
+    pVidCodecCtx->thread_count = threads;
+    pVidCodecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    pSwFrame = 0;
+    hw_device_ctx = 0;
+    hw_pix_fmt = AV_PIX_FMT_NONE;
+    draining = false;
+    InitHwAccel(hwaccel);
+
+    if(avcodec_open2(pVidCodecCtx, pVidCodec,0)<0)
+        throw VideoException("Could not open codec");
+#else
+    if(hwaccel != "none")
+        throw VideoException("hwaccel requires FFmpeg 3.2 or later");
+    (void)threads;
+
     // Get a pointer to the codec context for the video stream
     pVidCodecCtx = pFormatCtx->streams[videoStream]->codec;
     
@@ -235,6 +335,7 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     if(avcodec_open(pVidCodecCtx, pVidCodec)<0)
 #endif
         throw VideoException("Could not open codec");
+#endif // PANGO_FFMPEG_SEND_RECEIVE
     
     // Hack to correct wrong frame rates that seem to be generated by some codecs
     if(pVidCodecCtx->time_base.num>1000 && pVidCodecCtx->time_base.den==1)
@@ -260,7 +361,26 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     // Image dimensions
     const int w = pVidCodecCtx->width;
     const int h = pVidCodecCtx->height;
-    
+
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    // Frames are converted straight into the caller's image, with the scaler
+    // created on demand for whatever format comes out of the decoder.
+    pSwFrame = av_frame_alloc();
+    if(!pSwFrame)
+        throw VideoException("Couldn't allocate frames");
+    buffer = 0;
+    img_convert_ctx = 0;
+    numBytesOut = av_image_get_buffer_size(fmtout, w, h, 1);
+
+    if(fmtout == AV_PIX_FMT_NV12) {
+        // Luma and interleaved chroma planes, as from V4L for NV12 devices
+        const int cw = (w+1)/2;
+        const int ch = (h+1)/2;
+        streams.push_back(StreamInfo(PixelFormatFromString("GRAY8"), w, h, w, 0));
+        streams.push_back(StreamInfo(PixelFormatFromString("Y400A"), cw, ch, 2*cw, (unsigned char*)0 + w*h));
+        return;
+    }
+#else
     // Determine required buffer size and allocate buffer
     numBytesOut=avpicture_get_size(fmtout, w, h);
     
@@ -277,6 +397,7 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     if(img_convert_ctx == NULL) {
         throw VideoException("Cannot initialize the conversion context");
     }
+#endif // PANGO_FFMPEG_SEND_RECEIVE
     
     // Populate stream info for users to query
     const PixelFormat strm_fmt = PixelFormatFromString(FfmpegFmtToString(fmtout));
@@ -294,7 +415,13 @@ FfmpegVideo::~FfmpegVideo()
     av_free(pFrame);
     
     // Close the codec
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+    av_frame_free(&pSwFrame);
+    avcodec_free_context(&pVidCodecCtx);
+    av_buffer_unref(&hw_device_ctx);
+#else
     avcodec_close(pVidCodecCtx);
+#endif
     
     // Close the video file
 #if (LIBAVFORMAT_VERSION_MAJOR >= 54 || (LIBAVFORMAT_VERSION_MAJOR >= 53 && LIBAVFORMAT_VERSION_MINOR >= 21) )
@@ -326,6 +453,283 @@ void FfmpegVideo::Stop()
 {
 }
 
+#ifdef PANGO_FFMPEG_SEND_RECEIVE
+void FfmpegVideo::OutputFrame(unsigned char* image)
+{
+    AVFrame* src = pFrame;
+    if(pFrame->format == hw_pix_fmt) {
+        // Download from the device, normally as NV12
+        av_frame_unref(pSwFrame);
+        if(av_hwframe_transfer_data(pSwFrame, pFrame, 0) < 0)
+            throw VideoException("Unable to download decoded frame");
+        src = pSwFrame;
+    }
+
+    const int w = pVidCodecCtx->width;
+    const int h = pVidCodecCtx->height;
+    uint8_t* dst[4];
+    int dst_linesize[4];
+    av_image_fill_arrays(dst, dst_linesize, image, fmtout, w, h, 1);
+
+    if(src->format == fmtout) {
+        av_image_copy(dst, dst_linesize, (const uint8_t**)src->data, src->linesize, fmtout, w, h);
+    }else{
+        img_convert_ctx = sws_getCachedContext(img_convert_ctx, src->width, src->height, (AVPixelFormat)src->format,
+                                               w, h, fmtout, FFMPEG_POINT, NULL, NULL, NULL);
+        if(img_convert_ctx == NULL)
+            throw VideoException("Cannot initialize the conversion context");
+        sws_scale(img_convert_ctx, src->data, src->linesize, 0, src->height, dst, dst_linesize);
+    }
+
+    av_frame_unref(pSwFrame);
+    av_frame_unref(pFrame);
+}
+
+bool FfmpegVideo::DecodeFrame()
+{
+    for(;;) {
+        const int r = avcodec_receive_frame(pVidCodecCtx, pFrame);
+        if(r == 0) {
+            return true;
+        }else if(r == AVERROR_EOF) {
+            return false;
+        }else if(r != AVERROR(EAGAIN)) {
+            throw VideoException("Error decoding video frame");
+        }
+
+        // Decoder needs more input
+        if(draining) {
+            return false;
+        }else if(av_read_frame(pFormatCtx, &packet) >= 0) {
+            if(packet.stream_index==videoStream) {
+                // Corrupt packets are skipped, as with avcodec_decode_video2
+                avcodec_send_packet(pVidCodecCtx, &packet);
+            }
+            av_packet_unref(&packet);
+        }else{
+            // End of file, flush frames held by frame threads
+            avcodec_send_packet(pVidCodecCtx, NULL);
+            draining = true;
+        }
+    }
+}
+
+bool FfmpegVideo::GrabNext(unsigned char* image, bool /*wait*/)
+{
+    // Seek may have already decoded the next frame
+    if(!have_pending && !DecodeFrame()) {
+        return false;
+    }
+    have_pending = false;
+    OutputFrame(image);
+    ++next_frame_id;
+    return true;
+}
+
+namespace {
+const char* ffmpeg_index_magic = "pangolin_ffmpeg_index 1";
+
+// Size and modification time identify the file an index was built from
+std::string FfmpegIndexFileStamp(const std::string& url)
+{
+    struct stat buf;
+    if(stat(url.c_str(), &buf) != 0) return "-1 -1";
+    return std::to_string((int64_t)buf.st_size) + " " + std::to_string((int64_t)buf.st_mtime);
+}
+}
+
+bool FfmpegVideo::LoadIndex() const
+{
+    std::ifstream f(index_file);
+    if(index_file.empty() || !f.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if(!std::getline(f, line) || line != ffmpeg_index_magic) {
+        pango_print_warn("Ignoring '%s', not an ffmpeg index.\n", index_file.c_str());
+        return false;
+    }
+    if(!std::getline(f, line) || line != video_url) {
+        return false;
+    }
+    int stream;
+    size_t count;
+    f >> stream >> count >> index_has_pts;
+    f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    if(!std::getline(f, line) || !f || stream != videoStream || line != FfmpegIndexFileStamp(video_url)) {
+        // File has changed since the index was written.
+        return false;
+    }
+
+    std::vector<IndexEntry> entries(count);
+    for(IndexEntry& e : entries) {
+        f >> e.pts >> e.dts >> e.keyframe;
+    }
+    if(!f) {
+        index_has_pts = false;
+        return false;
+    }
+    index = std::move(entries);
+    return true;
+}
+
+void FfmpegVideo::SaveIndex() const
+{
+    if(index_file.empty()) return;
+
+    // Write to a temporary first so a concurrent open never sees a partial index.
+    const std::string tmp = index_file + ".tmp";
+    {
+        std::ofstream f(tmp);
+        f << ffmpeg_index_magic << "\n" << video_url << "\n"
+          << videoStream << " " << index.size() << " " << index_has_pts << "\n"
+          << FfmpegIndexFileStamp(video_url) << "\n";
+        for(const IndexEntry& e : index) {
+            f << e.pts << " " << e.dts << " " << e.keyframe << "\n";
+        }
+        if(!f) {
+            pango_print_warn("Unable to write ffmpeg index '%s'.\n", index_file.c_str());
+            return;
+        }
+    }
+    if(std::rename(tmp.c_str(), index_file.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        pango_print_warn("Unable to write ffmpeg index '%s'.\n", index_file.c_str());
+    }
+}
+
+void FfmpegVideo::BuildIndex() const
+{
+    index_built = true;
+    if(LoadIndex()) {
+        return;
+    }
+
+    // Live and network streams can't be scanned ahead of playback
+    if(!pFormatCtx->pb || !(pFormatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        return;
+    }
+
+    // Demux (without decoding) the whole file through a second context,
+    // leaving playback where it is.
+    AVFormatContext* ctx = 0;
+    if(avformat_open_input(&ctx, video_url.c_str(), (AVInputFormat*)pFormatCtx->iformat, NULL) < 0) {
+        return;
+    }
+    AVPacket* pkt = av_packet_alloc();
+    if(avformat_find_stream_info(ctx, 0) >= 0 && pkt) {
+        while(av_read_frame(ctx, pkt) >= 0) {
+            if(pkt->stream_index == videoStream) {
+                const IndexEntry e = {pkt->pts, pkt->dts, (pkt->flags & AV_PKT_FLAG_KEY) != 0};
+                index.push_back(e);
+            }
+            av_packet_unref(pkt);
+        }
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&ctx);
+
+    // Frames are numbered in presentation order. Without timestamps (e.g.
+    // raw elementary streams) we can still count them.
+    index_has_pts = !index.empty() && std::none_of(index.begin(), index.end(), [](const IndexEntry& e){
+        return e.pts == AV_NOPTS_VALUE;
+    });
+    if(index_has_pts) {
+        std::stable_sort(index.begin(), index.end(), [](const IndexEntry& a, const IndexEntry& b){
+            return a.pts < b.pts;
+        });
+    }
+
+    SaveIndex();
+}
+
+bool FfmpegVideo::SeekToKeyframe(int64_t ts, int flags)
+{
+    if(av_seek_frame(pFormatCtx, videoStream, ts, flags) < 0) {
+        return false;
+    }
+    avcodec_flush_buffers(pVidCodecCtx);
+    av_frame_unref(pFrame);
+    draining = false;
+    have_pending = false;
+    return true;
+}
+
+size_t FfmpegVideo::GetCurrentFrameId() const
+{
+    return next_frame_id;
+}
+
+size_t FfmpegVideo::GetTotalFrames() const
+{
+    if(!index_built) BuildIndex();
+    return index.size();
+}
+
+size_t FfmpegVideo::Seek(size_t frameid)
+{
+    if(!index_built) BuildIndex();
+
+    if(frameid >= index.size() || frameid == next_frame_id) {
+        return next_frame_id;
+    }
+
+    if(!index_has_pts) {
+        // Decode forward, from the start if the frame has already passed
+        if(frameid < next_frame_id) {
+            if(!SeekToKeyframe(0, AVSEEK_FLAG_BYTE | AVSEEK_FLAG_BACKWARD)) return next_frame_id;
+            next_frame_id = 0;
+        }
+        if(have_pending) {
+            av_frame_unref(pFrame);
+            have_pending = false;
+            ++next_frame_id;
+        }
+        while(next_frame_id < frameid && DecodeFrame()) {
+            av_frame_unref(pFrame);
+            ++next_frame_id;
+        }
+        return next_frame_id;
+    }
+
+    // Decode forward from the last keyframe at or before the target. If the
+    // demuxer lands beyond the target, start from an earlier keyframe.
+    const int64_t target = index[frameid].pts;
+    size_t k = frameid;
+    for(;;) {
+        while(k > 0 && !index[k].keyframe) --k;
+        const IndexEntry& key = index[k];
+        if(!SeekToKeyframe(key.dts != AV_NOPTS_VALUE ? key.dts : key.pts)) {
+            return next_frame_id;
+        }
+
+        int64_t pts = AV_NOPTS_VALUE;
+        while(DecodeFrame()) {
+            pts = pFrame->best_effort_timestamp;
+            if(pts != AV_NOPTS_VALUE && pts >= target) break;
+            av_frame_unref(pFrame);
+        }
+        if(pts == AV_NOPTS_VALUE || pts < target) {
+            // Ran out of frames
+            next_frame_id = index.size();
+            return next_frame_id;
+        }
+
+        if(pts > target && k > 0) {
+            --k;
+            continue;
+        }
+
+        const auto it = std::lower_bound(index.begin(), index.end(), pts, [](const IndexEntry& e, int64_t t){
+            return e.pts < t;
+        });
+        have_pending = true;
+        next_frame_id = it - index.begin();
+        return next_frame_id;
+    }
+}
+#else
 bool FfmpegVideo::GrabNext(unsigned char* image, bool /*wait*/)
 {
     int gotFrame = 0;
@@ -351,6 +755,7 @@ bool FfmpegVideo::GrabNext(unsigned char* image, bool /*wait*/)
     
     return gotFrame;
 }
+#endif // PANGO_FFMPEG_SEND_RECEIVE
 
 bool FfmpegVideo::GrabNewest(unsigned char *image, bool wait)
 {
@@ -834,7 +1239,10 @@ PANGOLIN_REGISTER_FACTORY(FfmpegVideo)
                 std::string outfmt = uri.Get<std::string>("fmt","RGB24");
                 ToUpper(outfmt);
                 const int video_stream = uri.Get<int>("stream",-1);
-                return std::unique_ptr<VideoInterface>( new FfmpegVideo(uri.url.c_str(), outfmt, "", false, video_stream) );
+                const std::string hwaccel = uri.Get<std::string>("hwaccel","none");
+                const int threads = uri.Get<int>("threads",0);
+                const std::string index_file = uri.Get<std::string>("index","");
+                return std::unique_ptr<VideoInterface>( new FfmpegVideo(uri.url.c_str(), outfmt, "", false, video_stream, hwaccel, threads, index_file) );
             }else if( !uri.scheme.compare("mjpeg")) {
                 return std::unique_ptr<VideoInterface>( new FfmpegVideo(uri.url.c_str(),"RGB24", "MJPEG" ) );
             }else if( !uri.scheme.compare("convert") ) {
@@ -0,0 +1,520 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/drivers/ffmpeg.h>
+#include <pangolin/video/drivers/ffmpeg_codec.h>
+#include <pangolin/video/video_exception.h>
+
+// Some versions of FFMPEG define this horrid macro in global scope.
+#undef PixelFormat
+
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Encode / decode through avcodec_send_* and avcodec_receive_*
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 64, 100)
+#  define PANGO_FFMPEG_STREAM_CODEC
+extern "C"
+{
+#include <libavutil/hwcontext.h>
+}
+#endif
+
+namespace pangolin
+{
+
+#ifdef PANGO_FFMPEG_STREAM_CODEC
+
+// Each encoded frame of a stream is prefixed by this header, which lets
+// decoding restart cleanly at a keyframe after a seek.
+#pragma pack(push, 1)
+struct ffmpeg_stream_frame_header
+{
+    uint32_t bytes;
+    uint8_t keyframe;
+};
+#pragma pack(pop)
+
+namespace {
+
+AVCodecID FfmpegCodecId(const std::string& codec)
+{
+    if(codec == "h264") {
+        return AV_CODEC_ID_H264;
+    }else if(codec == "h265" || codec == "hevc") {
+        return AV_CODEC_ID_HEVC;
+#if LIBAVCODEC_VERSION_MAJOR >= 58
+    }else if(codec == "av1") {
+        return AV_CODEC_ID_AV1;
+#endif
+    }
+    throw VideoException("Unsupported stream codec '" + codec + "'");
+}
+
+// Encoders to try for codec, most preferred first. hwaccel is one of auto,
+// none (software only), nvenc, qsv or vaapi.
+std::vector<std::string> FfmpegEncoderNames(const std::string& codec, const std::string& hwaccel)
+{
+    if(hwaccel != "auto" && hwaccel != "none" && hwaccel != "nvenc" && hwaccel != "qsv" && hwaccel != "vaapi") {
+        throw VideoException("Unknown hwaccel '" + hwaccel + "', expected auto, none, nvenc, qsv or vaapi");
+    }
+
+    const std::string prefix = (codec == "h264") ? "h264" : (codec == "av1") ? "av1" : "hevc";
+    std::vector<std::string> names;
+    for(const std::string hw : {"nvenc", "qsv", "vaapi"}) {
+        if(hwaccel == "auto" || hwaccel == hw) {
+            names.push_back(prefix + "_" + hw);
+        }
+    }
+    if(hwaccel == "auto" || hwaccel == "none") {
+        if(prefix == "h264") {
+            names.push_back("libx264");
+        }else if(prefix == "hevc") {
+            names.push_back("libx265");
+        }else{
+            names.push_back("libsvtav1");
+            names.push_back("libaom-av1");
+        }
+    }
+    return names;
+}
+
+bool EndsWith(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size() && !str.compare(str.size() - suffix.size(), suffix.size(), suffix);
+}
+
+AVPixelFormat ChooseEncoderFormat(const AVCodec* encoder)
+{
+    if(!encoder->pix_fmts) {
+        return AV_PIX_FMT_YUV420P;
+    }
+    for(const AVPixelFormat* p = encoder->pix_fmts; *p != AV_PIX_FMT_NONE; ++p) {
+        if(*p == AV_PIX_FMT_YUV420P || *p == AV_PIX_FMT_NV12) return *p;
+    }
+    return encoder->pix_fmts[0];
+}
+
+// Options which make each frame come straight back out of the encoder,
+// and forced I frames IDR. Unknown keys are ignored by avcodec_open2.
+void SetLowLatencyOptions(const std::string& name, AVDictionary** opts)
+{
+    if(name == "libx264" || name == "libx265") {
+        av_dict_set(opts, "tune", "zerolatency", 0);
+        av_dict_set(opts, "forced-idr", "1", 0);
+    }else if(EndsWith(name, "_nvenc")) {
+        av_dict_set(opts, "zerolatency", "1", 0);
+        av_dict_set(opts, "delay", "0", 0);
+        av_dict_set(opts, "forced-idr", "1", 0);
+    }else if(EndsWith(name, "_qsv")) {
+        av_dict_set(opts, "async_depth", "1", 0);
+        av_dict_set(opts, "forced_idr", "1", 0);
+    }else if(EndsWith(name, "_vaapi")) {
+        av_dict_set(opts, "async_depth", "1", 0);
+    }else if(name == "libsvtav1") {
+        av_dict_set(opts, "svtav1-params", "pred-struct=1:lookahead=0", 0);
+    }else if(name == "libaom-av1") {
+        av_dict_set(opts, "lag-in-frames", "0", 0);
+    }
+}
+
+class FfmpegStreamEncoderState
+{
+public:
+    FfmpegStreamEncoderState(const std::string& codec, const PixelFormat& fmt, const picojson::value& params)
+        : codec(codec),
+          input_fmt(FfmpegFmtFromString(fmt.Name())),
+          hwaccel(params.get_value<std::string>("hwaccel", "auto")),
+          vaapi_device(params.get_value<std::string>("vaapi_device", "")),
+          keyframe_interval(StreamEncoderFactory::KeyframeInterval(params)),
+          bit_rate(params.get_value<int64_t>("bitrate", 0)),
+          encoder_fmt(AV_PIX_FMT_NONE),
+          ctx(nullptr), frame(nullptr), hw_frame(nullptr), packet(nullptr),
+          hw_device(nullptr), sws(nullptr), frame_count(0)
+    {
+        FfmpegCodecId(codec);
+        FfmpegEncoderNames(codec, hwaccel);
+        if(input_fmt == AV_PIX_FMT_NONE || fmt.bpp != 8 * fmt.channels) {
+            throw VideoException("Unable to encode " + fmt.Name() + " streams with " + codec);
+        }
+    }
+
+    ~FfmpegStreamEncoderState()
+    {
+        Close();
+        sws_freeContext(sws);
+    }
+
+    void Encode(std::ostream& os, const Image<unsigned char>& img)
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        if(!ctx) {
+            Open(img.w, img.h);
+        }else if((size_t)ctx->width != img.w || (size_t)ctx->height != img.h) {
+            throw VideoException("Stream size changed while encoding with " + encoder_name);
+        }
+
+        // The encoder may still reference the last frame
+        if(av_frame_make_writable(frame) < 0) {
+            throw VideoException("Unable to allocate frame for " + encoder_name);
+        }
+
+        sws = sws_getCachedContext(sws, img.w, img.h, input_fmt, img.w, img.h, encoder_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if(!sws) {
+            throw VideoException("Unable to convert stream for " + encoder_name);
+        }
+        const uint8_t* src[4] = { img.ptr, nullptr, nullptr, nullptr };
+        const int src_stride[4] = { (int)img.pitch, 0, 0, 0 };
+        sws_scale(sws, src, src_stride, 0, img.h, frame->data, frame->linesize);
+
+        AVFrame* input = frame;
+        if(hw_frame) {
+            av_frame_unref(hw_frame);
+            if(av_hwframe_get_buffer(ctx->hw_frames_ctx, hw_frame, 0) < 0 ||
+               av_hwframe_transfer_data(hw_frame, frame, 0) < 0) {
+                throw VideoException("Unable to upload frame for " + encoder_name);
+            }
+            input = hw_frame;
+        }
+
+        const bool keyframe = (frame_count % keyframe_interval) == 0;
+        input->pts = frame_count++;
+        input->pict_type = keyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+        if(avcodec_send_frame(ctx, input) < 0) {
+            throw VideoException("Error encoding frame with " + encoder_name);
+        }
+
+        encoded.clear();
+        while(true) {
+            const int r = avcodec_receive_packet(ctx, packet);
+            if(r == AVERROR(EAGAIN) || r == AVERROR_EOF) break;
+            if(r < 0) {
+                throw VideoException("Error encoding frame with " + encoder_name);
+            }
+            encoded.insert(encoded.end(), packet->data, packet->data + packet->size);
+            av_packet_unref(packet);
+        }
+
+        if(encoded.empty()) {
+            // Frames must decode from their own packet for seeking to work
+            throw VideoException(encoder_name + " delayed a frame, which pango streams do not support");
+        }
+
+        ffmpeg_stream_frame_header header;
+        header.bytes = (uint32_t)encoded.size();
+        header.keyframe = keyframe ? 1 : 0;
+        os.write((const char*)&header, sizeof(header));
+        os.write((const char*)encoded.data(), encoded.size());
+    }
+
+private:
+    void Open(size_t w, size_t h)
+    {
+        std::string tried;
+        for(const std::string& name : FfmpegEncoderNames(codec, hwaccel)) {
+            const AVCodec* encoder = avcodec_find_encoder_by_name(name.c_str());
+            if(encoder && TryOpen(encoder, name, w, h)) {
+                return;
+            }
+            tried += " " + name;
+        }
+
+        // Whatever software encoder this FFmpeg has for the codec
+        if(hwaccel == "auto" || hwaccel == "none") {
+            const AVCodec* encoder = avcodec_find_encoder(FfmpegCodecId(codec));
+            if(encoder && TryOpen(encoder, encoder->name, w, h)) {
+                return;
+            }
+        }
+        throw VideoException("No usable " + codec + " encoder, tried" + tried);
+    }
+
+    bool TryOpen(const AVCodec* encoder, const std::string& name, size_t w, size_t h)
+    {
+        ctx = avcodec_alloc_context3(encoder);
+        if(!ctx) return false;
+
+        ctx->width = (int)w;
+        ctx->height = (int)h;
+        ctx->time_base.num = 1;
+        ctx->time_base.den = 30;
+        ctx->framerate.num = 30;
+        ctx->framerate.den = 1;
+        ctx->gop_size = (int)keyframe_interval;
+        ctx->max_b_frames = 0;
+        if(bit_rate > 0) {
+            ctx->bit_rate = bit_rate;
+        }
+
+        const bool vaapi = EndsWith(name, "_vaapi");
+        encoder_fmt = vaapi ? AV_PIX_FMT_NV12 : ChooseEncoderFormat(encoder);
+        ctx->pix_fmt = encoder_fmt;
+
+        if(vaapi) {
+            // Frames are uploaded to the device before encoding
+            if(av_hwdevice_ctx_create(&hw_device, AV_HWDEVICE_TYPE_VAAPI, vaapi_device.empty() ? nullptr : vaapi_device.c_str(), nullptr, 0) < 0) {
+                Close();
+                return false;
+            }
+            AVBufferRef* frames_ref = av_hwframe_ctx_alloc(hw_device);
+            if(!frames_ref) {
+                Close();
+                return false;
+            }
+            AVHWFramesContext* frames = (AVHWFramesContext*)frames_ref->data;
+            frames->format = AV_PIX_FMT_VAAPI;
+            frames->sw_format = AV_PIX_FMT_NV12;
+            frames->width = (int)w;
+            frames->height = (int)h;
+            frames->initial_pool_size = 4;
+            if(av_hwframe_ctx_init(frames_ref) < 0) {
+                av_buffer_unref(&frames_ref);
+                Close();
+                return false;
+            }
+            ctx->hw_frames_ctx = frames_ref;
+            ctx->pix_fmt = AV_PIX_FMT_VAAPI;
+        }
+
+        AVDictionary* opts = nullptr;
+        SetLowLatencyOptions(name, &opts);
+        const int r = avcodec_open2(ctx, encoder, &opts);
+        av_dict_free(&opts);
+        if(r < 0) {
+            Close();
+            return false;
+        }
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if(!frame || !packet) {
+            Close();
+            return false;
+        }
+        frame->format = encoder_fmt;
+        frame->width = (int)w;
+        frame->height = (int)h;
+        if(av_frame_get_buffer(frame, 0) < 0) {
+            Close();
+            return false;
+        }
+        if(vaapi) {
+            hw_frame = av_frame_alloc();
+            if(!hw_frame) {
+                Close();
+                return false;
+            }
+        }
+
+        encoder_name = name;
+        return true;
+    }
+
+    void Close()
+    {
+        avcodec_free_context(&ctx);
+        av_frame_free(&frame);
+        av_frame_free(&hw_frame);
+        av_packet_free(&packet);
+        av_buffer_unref(&hw_device);
+    }
+
+    const std::string codec;
+    const AVPixelFormat input_fmt;
+    const std::string hwaccel;
+    const std::string vaapi_device;
+    const size_t keyframe_interval;
+    const int64_t bit_rate;
+
+    std::mutex lock;
+    std::string encoder_name;
+    AVPixelFormat encoder_fmt;
+    AVCodecContext* ctx;
+    AVFrame* frame;
+    AVFrame* hw_frame;
+    AVPacket* packet;
+    AVBufferRef* hw_device;
+    SwsContext* sws;
+    size_t frame_count;
+    std::vector<uint8_t> encoded;
+};
+
+class FfmpegStreamDecoderState
+{
+public:
+    FfmpegStreamDecoderState(const std::string& codec, const PixelFormat& fmt)
+        : codec(codec), output_fmt(FfmpegFmtFromString(fmt.Name())),
+          ctx(nullptr), frame(nullptr), packet(nullptr), sws(nullptr)
+    {
+        if(output_fmt == AV_PIX_FMT_NONE) {
+            throw VideoException("Unable to decode " + codec + " streams to " + fmt.Name());
+        }
+
+        const AVCodecID id = FfmpegCodecId(codec);
+        const AVCodec* decoder = nullptr;
+        if(codec == "av1") {
+            decoder = avcodec_find_decoder_by_name("libdav1d");
+        }
+        if(!decoder) {
+            decoder = avcodec_find_decoder(id);
+        }
+        if(!decoder) {
+            throw VideoException("No " + codec + " decoder available");
+        }
+
+        ctx = avcodec_alloc_context3(decoder);
+        if(!ctx) {
+            throw VideoException("Unable to allocate " + codec + " decoder");
+        }
+        // Frame threading holds frames back, slice threading doesn't
+        ctx->thread_type = FF_THREAD_SLICE;
+        ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+        AVDictionary* opts = nullptr;
+        av_dict_set(&opts, "max_frame_delay", "1", 0);
+        const int r = avcodec_open2(ctx, decoder, &opts);
+        av_dict_free(&opts);
+
+        frame = av_frame_alloc();
+        packet = av_packet_alloc();
+        if(r < 0 || !frame || !packet) {
+            Close();
+            throw VideoException("Unable to open " + codec + " decoder");
+        }
+    }
+
+    ~FfmpegStreamDecoderState()
+    {
+        Close();
+        sws_freeContext(sws);
+    }
+
+    void Decode(std::istream& is, const Image<unsigned char>& dst)
+    {
+        std::lock_guard<std::mutex> l(lock);
+
+        ffmpeg_stream_frame_header header;
+        is.read((char*)&header, sizeof(header));
+        if(is) {
+            data.resize(header.bytes + AV_INPUT_BUFFER_PADDING_SIZE);
+            is.read((char*)data.data(), header.bytes);
+        }
+        if(!is) {
+            throw VideoException("Truncated " + codec + " frame");
+        }
+        std::memset(data.data() + header.bytes, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+        if(header.keyframe) {
+            // Drop references to frames from before a seek
+            avcodec_flush_buffers(ctx);
+        }
+
+        packet->data = data.data();
+        packet->size = (int)header.bytes;
+        const int r = avcodec_send_packet(ctx, packet);
+        packet->data = nullptr;
+        packet->size = 0;
+        if(r < 0 || avcodec_receive_frame(ctx, frame) < 0) {
+            throw VideoException("Error decoding " + codec + " frame");
+        }
+
+        if((size_t)frame->width != dst.w || (size_t)frame->height != dst.h) {
+            av_frame_unref(frame);
+            throw VideoException("Decoded " + codec + " frame does not match stream size");
+        }
+
+        sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format, dst.w, dst.h, output_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if(!sws) {
+            av_frame_unref(frame);
+            throw VideoException("Unable to convert decoded " + codec + " frame");
+        }
+        uint8_t* out[4] = { dst.ptr, nullptr, nullptr, nullptr };
+        const int out_stride[4] = { (int)dst.pitch, 0, 0, 0 };
+        sws_scale(sws, frame->data, frame->linesize, 0, frame->height, out, out_stride);
+        av_frame_unref(frame);
+    }
+
+private:
+    void Close()
+    {
+        avcodec_free_context(&ctx);
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+    }
+
+    const std::string codec;
+    const AVPixelFormat output_fmt;
+
+    std::mutex lock;
+    AVCodecContext* ctx;
+    AVFrame* frame;
+    AVPacket* packet;
+    SwsContext* sws;
+    std::vector<uint8_t> data;
+};
+
+}
+
+ImageEncoderFunc FfmpegStreamEncoder(const std::string& codec, const PixelFormat& fmt, const picojson::value& params)
+{
+    auto state = std::make_shared<FfmpegStreamEncoderState>(codec, fmt, params);
+    return [state](std::ostream& os, const Image<unsigned char>& img){
+        state->Encode(os, img);
+    };
+}
+
+ImageDecoderIntoFunc FfmpegStreamDecoder(const std::string& codec, const PixelFormat& fmt)
+{
+    auto state = std::make_shared<FfmpegStreamDecoderState>(codec, fmt);
+    return [state](std::istream& is, const Image<unsigned char>& dst){
+        state->Decode(is, dst);
+    };
+}
+
+#else // PANGO_FFMPEG_STREAM_CODEC
+
+ImageEncoderFunc FfmpegStreamEncoder(const std::string& codec, const PixelFormat&, const picojson::value&)
+{
+    throw VideoException("'" + codec + "' streams require FFmpeg 3.2 or later");
+}
+
+ImageDecoderIntoFunc FfmpegStreamDecoder(const std::string& codec, const PixelFormat&)
+{
+    throw VideoException("'" + codec + "' streams require FFmpeg 3.2 or later");
+}
+
+#endif // PANGO_FFMPEG_STREAM_CODEC
+
+}
@@ -35,16 +35,24 @@
 #include <stdlib.h>
 #include <inttypes.h>
 
+#include <algorithm>
+#include <cmath>
+
 using namespace std;
 
 namespace pangolin
 {
 
+// Isochronous bandwidth units of each 125us bus cycle which may be allocated
+// (IEEE 1394: 6144 units per cycle, 80% of them isochronous)
+const uint32_t max_iso_bandwidth_units = 4915;
+
 void FirewireVideo::init_camera(
         uint64_t guid, int dma_frames,
         dc1394speed_t iso_speed,
         dc1394video_mode_t video_mode,
-        dc1394framerate_t framerate
+        dc1394framerate_t framerate,
+        int bus_cameras
         ) {
     
     if(video_mode>=DC1394_VIDEO_MODE_FORMAT7_0)
@@ -87,6 +95,16 @@ void FirewireVideo::init_camera(
     if( err != DC1394_SUCCESS )
         throw VideoException("Could not set framerate");
     
+    // Fixed modes take a set share of each bus cycle, so all we can do is warn
+    uint32_t bandwidth = 0;
+    if( bus_cameras > 1 && dc1394_video_get_bandwidth_usage(camera, &bandwidth) == DC1394_SUCCESS &&
+        bandwidth * bus_cameras > max_iso_bandwidth_units )
+    {
+        pango_print_warn("FirewireVideo: %d cameras in this mode need %u%% of the bus, choose a lower framerate.\n",
+                         bus_cameras, (unsigned)(100 * bandwidth * bus_cameras / max_iso_bandwidth_units));
+    }
+    
+    this->dma_frames = dma_frames;
     err=dc1394_capture_setup(camera,dma_frames, DC1394_CAPTURE_FLAGS_DEFAULT);
     if( err != DC1394_SUCCESS )
         throw VideoException("Could not setup camera - check settings");
@@ -110,7 +128,8 @@ void FirewireVideo::init_format7_camera(
         dc1394video_mode_t video_mode,
         float framerate,
         uint32_t width, uint32_t height,
-        uint32_t left, uint32_t top, bool reset_at_boot
+        uint32_t left, uint32_t top, bool reset_at_boot,
+        int bus_cameras
         ) {
     
     if(video_mode< DC1394_VIDEO_MODE_FORMAT7_0)
@@ -200,9 +219,13 @@ void FirewireVideo::init_format7_camera(
     //  setup frame rate
     //-----------------------------------------------------------------------
     
-    err=dc1394_format7_set_packet_size(camera,video_mode, format7_info.max_packet_size);
+    // Packets are sent once per bus cycle, so their size sets both the
+    // framerate achievable and the share of the bus left to other cameras
+    const uint32_t packet_size = format7_packet_size(format7_info, iso_speed, framerate, bus_cameras);
+    err=dc1394_format7_set_packet_size(camera,video_mode, packet_size);
     if( err != DC1394_SUCCESS )
         throw VideoException("Could not set format7 packet size");
+    cout<<"packet size: "<<packet_size<<" of "<<format7_info.max_packet_size<<"  ";
     
     if((framerate != MAX_FR) && (framerate != EXT_TRIG)){
         //set the framerate by using the absolute feature as suggested by the
@@ -233,6 +256,7 @@ void FirewireVideo::init_format7_camera(
     //  setup capture
     //-----------------------------------------------------------------------
     
+    this->dma_frames = dma_frames;
     err=dc1394_capture_setup(camera,dma_frames, DC1394_CAPTURE_FLAGS_DEFAULT);
     if( err != DC1394_SUCCESS )
         throw VideoException("Could not setup camera - check settings");
@@ -422,14 +446,15 @@ FirewireVideo::FirewireVideo(
         dc1394video_mode_t video_mode,
         dc1394framerate_t framerate,
         dc1394speed_t iso_speed,
-        int dma_buffers
-        ) :running(false),top(0),left(0)
+        int dma_buffers,
+        int bus_cameras
+        ) :dma_frames(dma_buffers),leased_frames(0),running(false),top(0),left(0)
 {
     d = dc1394_new ();
     if (!d)
         throw VideoException("Failed to get 1394 bus");
     
-    init_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate);
+    init_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate,bus_cameras);
 }
 
 FirewireVideo::FirewireVideo(
@@ -439,14 +464,15 @@ FirewireVideo::FirewireVideo(
         uint32_t width, uint32_t height,
         uint32_t left, uint32_t top,
         dc1394speed_t iso_speed,
-        int dma_buffers, bool reset_at_boot
-        ) :running(false)
+        int dma_buffers, bool reset_at_boot,
+        int bus_cameras
+        ) :dma_frames(dma_buffers),leased_frames(0),running(false)
 {
     d = dc1394_new ();
     if (!d)
         throw VideoException("Failed to get 1394 bus");
     
-    init_format7_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot);
+    init_format7_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot, bus_cameras);
 }
 
 FirewireVideo::FirewireVideo(
@@ -454,8 +480,9 @@ FirewireVideo::FirewireVideo(
         dc1394video_mode_t video_mode,
         dc1394framerate_t framerate,
         dc1394speed_t iso_speed,
-        int dma_buffers
-        ) :running(false),top(0),left(0)
+        int dma_buffers,
+        int bus_cameras
+        ) :dma_frames(dma_buffers),leased_frames(0),running(false),top(0),left(0)
 {
     d = dc1394_new ();
     if (!d)
@@ -475,7 +502,7 @@ FirewireVideo::FirewireVideo(
     
     dc1394_camera_free_list (list);
     
-    init_camera(guid,dma_buffers,iso_speed,video_mode,framerate);
+    init_camera(guid,dma_buffers,iso_speed,video_mode,framerate,bus_cameras);
     
 }
 
@@ -486,8 +513,9 @@ FirewireVideo::FirewireVideo(
         uint32_t width, uint32_t height,
         uint32_t left, uint32_t top,
         dc1394speed_t iso_speed,
-        int dma_buffers, bool reset_at_boot
-        ) :running(false)
+        int dma_buffers, bool reset_at_boot,
+        int bus_cameras
+        ) :dma_frames(dma_buffers),leased_frames(0),running(false)
 {
     d = dc1394_new ();
     if (!d)
@@ -507,7 +535,7 @@ FirewireVideo::FirewireVideo(
     
     dc1394_camera_free_list (list);
     
-    init_format7_camera(guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot);
+    init_format7_camera(guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot, bus_cameras);
     
 }
 
@@ -530,7 +558,7 @@ bool FirewireVideo::GrabNext( unsigned char* image, bool wait )
     return false;
 }
 
-bool FirewireVideo::GrabNewest( unsigned char* image, bool wait )
+dc1394video_frame_t* FirewireVideo::dequeue_newest(bool wait)
 {
     dc1394video_frame_t *f;
     err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &f);
@@ -553,15 +581,66 @@ bool FirewireVideo::GrabNewest( unsigned char* image, bool wait )
                 break;
             }
         }
+    }else if(wait){
+        err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, &f);
+        if( err != DC1394_SUCCESS)
+            throw VideoException("Could not capture frame", dc1394_error_get_string(err) );
+    }
+    return f;
+}
+
+bool FirewireVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    dc1394video_frame_t *f = dequeue_newest(wait);
+    if( f ) {
         memcpy(image,f->image,f->image_bytes);
         err=dc1394_capture_enqueue(camera,f);
         return true;
-    }else if(wait){
-        return GrabNext(image,true);
     }
     return false;
 }
 
+FrameLease FirewireVideo::lease_frame(dc1394video_frame_t* frame)
+{
+    if( !frame )
+        return FrameLease();
+    
+    // Leave the camera at least two buffers to fill whilst frames are held
+    if( leased_frames + 2 >= dma_frames )
+    {
+        std::shared_ptr<FramePool::Buffer> copy = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(frame->image_bytes));
+        memcpy(copy->get(),frame->image,frame->image_bytes);
+        dc1394_capture_enqueue(camera,frame);
+        return FrameLease(copy->get(), frame_size_bytes, [copy](){});
+    }
+    
+    ++leased_frames;
+    return FrameLease(frame->image, frame_size_bytes, [this,frame](){
+        if( dc1394_capture_enqueue(camera,frame) != DC1394_SUCCESS ) {
+            pango_print_warn("FirewireVideo: Unable to re-enqueue leased DMA buffer.\n");
+        }
+        --leased_frames;
+    });
+}
+
+FrameLease FirewireVideo::GrabNextLease( bool wait )
+{
+    const dc1394capture_policy_t policy =
+            wait ? DC1394_CAPTURE_POLICY_WAIT : DC1394_CAPTURE_POLICY_POLL;
+    
+    dc1394video_frame_t *frame;
+    err = dc1394_capture_dequeue(camera, policy, &frame);
+    if( err != DC1394_SUCCESS)
+        throw VideoException("Could not capture frame", dc1394_error_get_string(err) );
+    
+    return lease_frame(frame);
+}
+
+FrameLease FirewireVideo::GrabNewestLease( bool wait )
+{
+    return lease_frame(dequeue_newest(wait));
+}
+
 FirewireFrame FirewireVideo::GetNext(bool wait)
 {
     const dc1394capture_policy_t policy =
@@ -574,32 +653,7 @@ FirewireFrame FirewireVideo::GetNext(bool wait)
 
 FirewireFrame FirewireVideo::GetNewest(bool wait)
 {
-    dc1394video_frame_t *f;
-    err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &f);
-    if( err != DC1394_SUCCESS)
-        throw VideoException("Could not capture frame", dc1394_error_get_string(err) );
-    
-    if( f ) {
-        while( true )
-        {
-            dc1394video_frame_t *nf;
-            err = dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_POLL, &nf);
-            if( err != DC1394_SUCCESS)
-                throw VideoException("Could not capture frame", dc1394_error_get_string(err) );
-            
-            if( nf )
-            {
-                err=dc1394_capture_enqueue(camera,f);
-                f = nf;
-            }else{
-                break;
-            }
-        }
-        return FirewireFrame(f);
-    }else if(wait){
-        return GetNext(true);
-    }
-    return FirewireFrame(0);
+    return FirewireFrame(dequeue_newest(wait));
 }
 
 void FirewireVideo::PutFrame(FirewireFrame& f)
@@ -837,6 +891,29 @@ int FirewireVideo::nearest_value(int value, int step, int min, int max)
         return high;
 }
 
+uint32_t FirewireVideo::format7_packet_size(const dc1394format7mode_t& info, dc1394speed_t iso_speed, float framerate, int bus_cameras)
+{
+    const uint32_t unit = std::max<uint32_t>(info.unit_packet_size, 1);
+    const uint32_t max_size = std::max(unit, info.max_packet_size - info.max_packet_size % unit);
+    
+    // Fair share of the bus
+    uint32_t size = max_size / std::max(bus_cameras, 1);
+    
+    if( framerate > 0 ) {
+        // No larger than needed to send each frame within the frame period
+        const double packets_per_frame = std::max(1.0, std::floor(1.0 / (bus_period_from_iso_speed(iso_speed) * framerate)));
+        const uint32_t needed = (uint32_t)std::ceil(info.total_bytes / packets_per_frame);
+        if( needed > size ) {
+            pango_print_warn("FirewireVideo: %d cameras can't share the bus at %g fps, packets need %u of %u bytes.\n",
+                             bus_cameras, framerate, needed, max_size);
+        }
+        size = std::min(size, needed);
+    }
+    
+    size = ((size + unit - 1) / unit) * unit;
+    return std::min(std::max(size, unit), max_size);
+}
+
 double FirewireVideo::bus_period_from_iso_speed(dc1394speed_t iso_speed)
 {
     double bus_period;
@@ -926,6 +1003,7 @@ PANGOLIN_REGISTER_FACTORY(FirewireVideo)
             const int desired_iso = uri.Get<int>("iso", 400);
             const float desired_fps = uri.Get<float>("fps", 30);
             const bool deinterlace = uri.Get<bool>("deinterlace", 0);
+            const int bus_cameras = uri.Get<int>("bus_cameras", 1);
 
             Guid guid = 0;
             unsigned deviceid = 0;
@@ -938,17 +1016,19 @@ PANGOLIN_REGISTER_FACTORY(FirewireVideo)
             if( StartsWith(desired_format, "FORMAT7") )
             {
                 dc1394video_mode_t video_mode = get_firewire_format7_mode(desired_format);
+                // Without an explicit fps, run as fast as the bus share allows
+                const float format7_fps = uri.Contains("fps") ? desired_fps : (float)FirewireVideo::MAX_FR;
                 if( guid.guid == 0 ) {
-                    video_raw = new FirewireVideo(deviceid,video_mode,FirewireVideo::MAX_FR, desired_dim.x, desired_dim.y, desired_xy.x, desired_xy.y, iso_speed, dma_buffers,true);
+                    video_raw = new FirewireVideo(deviceid,video_mode,format7_fps, desired_dim.x, desired_dim.y, desired_xy.x, desired_xy.y, iso_speed, dma_buffers,true,bus_cameras);
                 }else{
-                    video_raw = new FirewireVideo(guid,video_mode,FirewireVideo::MAX_FR, desired_dim.x, desired_dim.y, desired_xy.x, desired_xy.y, iso_speed, dma_buffers,true);
+                    video_raw = new FirewireVideo(guid,video_mode,format7_fps, desired_dim.x, desired_dim.y, desired_xy.x, desired_xy.y, iso_speed, dma_buffers,true,bus_cameras);
                 }
             }else{
                 dc1394video_mode_t video_mode = get_firewire_mode(desired_dim.x, desired_dim.y,desired_format);
                 if( guid.guid == 0 ) {
-                    video_raw = new FirewireVideo(deviceid,video_mode,framerate,iso_speed,dma_buffers);
+                    video_raw = new FirewireVideo(deviceid,video_mode,framerate,iso_speed,dma_buffers,bus_cameras);
                 }else{
-                    video_raw = new FirewireVideo(guid,video_mode,framerate,iso_speed,dma_buffers);
+                    video_raw = new FirewireVideo(guid,video_mode,framerate,iso_speed,dma_buffers,bus_cameras);
                 }
             }
 
@@ -26,27 +26,303 @@
  */
 
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/file_extension.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/memory_mapped_file.h>
+#include <pangolin/utils/memstreambuf.h>
+#include <pangolin/utils/parallel_for.h>
 #include <pangolin/video/drivers/images.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <limits>
 
 namespace pangolin
 {
 
+// Uncompressed tar archive, mapped into memory where possible
+class ImageArchiveFile
+{
+public:
+    explicit ImageArchiveFile(const std::string& filename)
+        : filename(filename)
+    {
+        if(mapping.Open(filename)) {
+            size_bytes = mapping.size();
+        }else{
+            std::ifstream f(filename, std::ios::in | std::ios::binary | std::ios::ate);
+            if(!f.is_open()) {
+                throw VideoException("Unable to open image archive '" + filename + "'");
+            }
+            size_bytes = (uint64_t)f.tellg();
+        }
+    }
+
+    uint64_t Size() const
+    {
+        return size_bytes;
+    }
+
+    // Bytes [offset, offset+size) of the archive, in place if it's mapped
+    // and otherwise read into scratch
+    const unsigned char* Read(uint64_t offset, uint64_t size, std::vector<unsigned char>& scratch) const
+    {
+        if(offset > size_bytes || size > size_bytes - offset) {
+            throw VideoException("Image archive '" + filename + "' is truncated");
+        }
+        if(mapping.IsOpen()) {
+            return mapping.data() + offset;
+        }
+
+        // Opened per read so that prefetch threads needn't share a stream
+        scratch.resize(size);
+        std::ifstream f(filename, std::ios::in | std::ios::binary);
+        f.seekg((std::streamoff)offset);
+        f.read((char*)scratch.data(), (std::streamsize)size);
+        if(!f) {
+            throw VideoException("Unable to read image archive '" + filename + "'");
+        }
+        return scratch.data();
+    }
+
+private:
+    std::string filename;
+    MemoryMappedFile mapping;
+    uint64_t size_bytes;
+};
+
+namespace
+{
+const size_t tar_block = 512;
+const char* archive_index_name = "pangolin_images_index";
+const char* archive_index_magic = "pangolin_images_archive 1";
+
+struct ArchiveMember
+{
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+};
+
+uint64_t TarBlocks(uint64_t bytes)
+{
+    return (bytes + tar_block - 1) / tar_block * tar_block;
+}
+
+std::string TarString(const unsigned char* p, size_t n)
+{
+    return std::string((const char*)p, strnlen((const char*)p, n));
+}
+
+uint64_t TarNumber(const unsigned char* p, size_t n)
+{
+    uint64_t v = 0;
+    if(p[0] & 0x80) {
+        // base-256, for sizes beyond the 8GB octal fields hold
+        for(size_t i=1; i < n; ++i) v = (v << 8) | p[i];
+        return v;
+    }
+    for(size_t i=0; i < n && p[i]; ++i) {
+        if(p[i] >= '0' && p[i] <= '7') v = (v << 3) | (uint64_t)(p[i] - '0');
+    }
+    return v;
+}
+
+// Regular files of a tar archive in the order stored, up to max_members
+std::vector<ArchiveMember> ScanTarMembers(const ImageArchiveFile& archive, size_t max_members = size_t(-1))
+{
+    std::vector<ArchiveMember> members;
+    std::vector<unsigned char> scratch;
+    std::string long_name;
+
+    uint64_t pos = 0;
+    while(members.size() < max_members && pos + tar_block <= archive.Size()) {
+        const unsigned char* h = archive.Read(pos, tar_block, scratch);
+        if(std::all_of(h, h + tar_block, [](unsigned char b){ return b == 0; })) {
+            break;
+        }
+
+        const char type = (char)h[156];
+        const uint64_t size = TarNumber(h + 124, 12);
+        const uint64_t data = pos + tar_block;
+
+        if(type == 'L') {
+            // GNU long name of the member following
+            std::vector<unsigned char> name_scratch;
+            long_name = TarString(archive.Read(data, size, name_scratch), (size_t)size);
+        }else{
+            if(type == '0' || type == '\0' || type == '7') {
+                std::string name = TarString(h, 100);
+                if(!long_name.empty()) {
+                    name = long_name;
+                }else if(!std::memcmp(h + 257, "ustar", 5) && h[345]) {
+                    name = TarString(h + 345, 155) + "/" + name;
+                }
+                members.push_back({name, data, size});
+            }
+            long_name.clear();
+        }
+        pos = data + TarBlocks(size);
+    }
+    return members;
+}
+
+// Channels listed by the index leading a WriteImageArchive() archive
+bool ReadArchiveIndex(const ImageArchiveFile& archive, const ArchiveMember& index, std::vector<std::vector<ArchiveMember>>& channels)
+{
+    std::vector<unsigned char> scratch;
+    memreadbuf buf(archive.Read(index.offset, index.size, scratch), (size_t)index.size);
+    std::istream is(&buf);
+
+    std::string line;
+    size_t num_channels = 0;
+    if(!std::getline(is, line) || line != archive_index_magic || !(is >> num_channels)) {
+        return false;
+    }
+
+    channels.resize(num_channels);
+    for(auto& members : channels) {
+        size_t count = 0;
+        is >> count;
+        members.resize(count);
+        for(ArchiveMember& m : members) {
+            is >> m.offset >> m.size;
+            is.ignore(1);
+            std::getline(is, m.name);
+        }
+    }
+    return (bool)is;
+}
+
+// Files of type Unknown are raw images when asked, read from memory
+TypedImage LoadRawImage(const unsigned char* data, size_t size, const PixelFormat& fmt, size_t w, size_t h)
+{
+    const size_t row_bytes = fmt.bpp * w / 8;
+    PANGO_ENSURE(size >= row_bytes * h);
+    TypedImage img(w, h, fmt);
+    for(size_t y=0; y < h; ++y) {
+        std::memcpy(img.RowPtr(y), data + y*row_bytes, row_bytes);
+    }
+    return img;
+}
+
+ImageFileType ArchiveFileType(const std::string& name, const unsigned char* data, size_t size)
+{
+    const size_t magic_bytes = 8;
+    if(size >= magic_bytes) {
+        const ImageFileType magic_type = FileTypeMagic(data, magic_bytes);
+        if(magic_type != ImageFileTypeUnknown) {
+            return magic_type;
+        }
+    }
+    return FileTypeExtension(FileLowercaseExtention(name));
+}
+}
+
+TypedImage ImagesVideo::LoadChannel(size_t i, size_t c)
+{
+    const std::string& filename = Filename(i,c);
+
+    if(archive) {
+        std::vector<unsigned char> scratch;
+        const std::pair<uint64_t,uint64_t>& m = archive_members[c][i];
+        const unsigned char* data = archive->Read(m.first, m.second, scratch);
+        const ImageFileType file_type = ArchiveFileType(filename, data, (size_t)m.second);
+        if(file_type == ImageFileTypeUnknown && unknowns_are_raw) {
+            return LoadRawImage(data, (size_t)m.second, raw_fmt, raw_width, raw_height);
+        }
+        memreadbuf buf(data, (size_t)m.second);
+        std::istream is(&buf);
+        return LoadImage(is, file_type);
+    }
+
+    const ImageFileType file_type = FileType(filename);
+    if(file_type == ImageFileTypeUnknown && unknowns_are_raw) {
+        return LoadImage( filename, raw_fmt, raw_width, raw_height, raw_fmt.bpp * raw_width / 8);
+    }else{
+        return LoadImage( filename, file_type );
+    }
+}
+
+void ImagesVideo::LoadChannelInto(size_t i, size_t c, const Image<unsigned char>& dst, const PixelFormat& dst_fmt)
+{
+    const std::string& filename = Filename(i,c);
+
+    if(archive) {
+        std::vector<unsigned char> scratch;
+        const std::pair<uint64_t,uint64_t>& m = archive_members[c][i];
+        const unsigned char* data = archive->Read(m.first, m.second, scratch);
+        const ImageFileType file_type = ArchiveFileType(filename, data, (size_t)m.second);
+        if(file_type == ImageFileTypeUnknown && unknowns_are_raw) {
+            const size_t row_bytes = raw_fmt.bpp * raw_width / 8;
+            PANGO_ENSURE(m.second >= row_bytes * raw_height && dst.w * dst_fmt.bpp / 8 >= row_bytes && dst.h >= raw_height);
+            for(size_t y=0; y < raw_height; ++y) {
+                std::memcpy(dst.ptr + y*dst.pitch, data + y*row_bytes, row_bytes);
+            }
+            return;
+        }
+        memreadbuf buf(data, (size_t)m.second);
+        std::istream is(&buf);
+        LoadImageInto(is, file_type, dst, dst_fmt);
+        return;
+    }
+
+    const ImageFileType file_type = FileType(filename);
+    if(file_type == ImageFileTypeUnknown && unknowns_are_raw) {
+        LoadImageInto( filename, raw_fmt, raw_width, raw_height, raw_fmt.bpp * raw_width / 8, dst);
+    }else{
+        LoadImageInto( filename, file_type, dst, dst_fmt );
+    }
+}
+
+void ImagesVideo::DecodeFrame(size_t i, Frame& frame)
+{
+    for(size_t c=0; c< num_channels; ++c) {
+        frame.push_back( LoadChannel(i, c) );
+    }
+}
+
 bool ImagesVideo::LoadFrame(size_t i)
 {
     if( i < num_files) {
-        Frame& frame = loaded[i];
-        for(size_t c=0; c< num_channels; ++c) {
-            const std::string& filename = Filename(i,c);
-            const ImageFileType file_type = FileType(filename);
+        DecodeFrame(i, loaded[i]);
+        return true;
+    }
+    return false;
+}
 
-            if(file_type == ImageFileTypeUnknown && unknowns_are_raw) {
-                frame.push_back( LoadImage( filename, raw_fmt, raw_width, raw_height, raw_fmt.bpp * raw_width / 8) );
-            }else{
-                frame.push_back( LoadImage( filename, file_type ) );
+bool ImagesVideo::CopyFrame(const Frame& frame, unsigned char* image) const
+{
+    if(frame.size() != num_channels) {
+        return false;
+    }
+    for(size_t c=0; c < num_channels; ++c){
+        const TypedImage& img = frame[c];
+        if(!img.ptr || img.w != streams[c].Width() || img.h != streams[c].Height() ) {
+            return false;
+        }
+        const StreamInfo& si = streams[c];
+        std::memcpy(image + (size_t)si.Offset(), img.ptr, si.SizeBytes());
+    }
+    return true;
+}
+
+bool ImagesVideo::LoadFrameInto(size_t i, unsigned char* image)
+{
+    if( i < num_files) {
+        for(size_t c=0; c< num_channels; ++c) {
+            const StreamInfo& si = streams[c];
+            try {
+                LoadChannelInto(i, c, si.StreamImage(image), si.PixFormat());
+            }catch(const std::exception& e) {
+                pango_print_warn("Unable to load '%s': %s\n", Filename(i,c).c_str(), e.what());
+                return false;
             }
         }
         return true;
@@ -81,6 +357,333 @@ void ImagesVideo::PopulateFilenames(const std::string& wildcard_path)
     loaded.resize(num_files);
 }
 
+void ImagesVideo::PopulateArchiveMembers(const std::string& wildcard_path)
+{
+    std::vector<std::vector<ArchiveMember>> channels;
+    const std::vector<ArchiveMember> first = ScanTarMembers(*archive, 1);
+    const bool indexed = !first.empty() && first[0].name == archive_index_name &&
+                         ReadArchiveIndex(*archive, first[0], channels);
+
+    if(!wildcard_path.empty()) {
+        // Match members of the archive as files of the file system would be
+        std::vector<ArchiveMember> all;
+        if(indexed) {
+            for(const auto& members : channels) all.insert(all.end(), members.begin(), members.end());
+        }else{
+            all = ScanTarMembers(*archive);
+        }
+
+        channels.clear();
+        for(const std::string& wildcard : Expand(wildcard_path, '[', ']', ',')) {
+            std::vector<ArchiveMember> matched;
+            for(const ArchiveMember& m : all) {
+                if(MatchesWildcard(m.name, wildcard)) matched.push_back(m);
+            }
+            std::sort(matched.begin(), matched.end(), [](const ArchiveMember& a, const ArchiveMember& b){
+                return a.name < b.name;
+            });
+            channels.push_back(std::move(matched));
+        }
+    }else if(!indexed) {
+        channels.assign(1, ScanTarMembers(*archive));
+        std::sort(channels[0].begin(), channels[0].end(), [](const ArchiveMember& a, const ArchiveMember& b){
+            return a.name < b.name;
+        });
+    }
+
+    num_channels = channels.size();
+    num_files = channels.empty() ? 0 : channels[0].size();
+    for(const auto& members : channels) {
+        if(members.size() != num_files) {
+            pango_print_warn("Image archive channels have unequal numbers of files.\n");
+        }
+        num_files = std::min(num_files, members.size());
+    }
+    if(num_files == 0) {
+        throw VideoException("No images found in archive for '" + wildcard_path + "'");
+    }
+
+    filenames.assign(num_channels, std::vector<std::string>());
+    archive_members.assign(num_channels, std::vector<std::pair<uint64_t,uint64_t>>());
+    for(size_t c=0; c < num_channels; ++c) {
+        for(size_t i=0; i < num_files; ++i) {
+            filenames[c].push_back(channels[c][i].name);
+            archive_members[c].emplace_back(channels[c][i].offset, channels[c][i].size);
+        }
+    }
+
+    loaded.resize(num_files);
+}
+
+size_t WriteImageArchive(const std::string& wildcard_path, const std::string& archive_filename)
+{
+    const std::vector<std::string> wildcards = Expand(wildcard_path, '[', ']', ',');
+
+    std::vector<std::vector<std::string>> files(wildcards.size());
+    size_t num_files = size_t(-1);
+    for(size_t c=0; c < wildcards.size(); ++c) {
+        FilesMatchingWildcard(PathExpand(wildcards[c]), files[c]);
+        num_files = std::min(num_files, files[c].size());
+    }
+    if(files.empty() || num_files == 0) {
+        throw VideoException("No files found for wildcard '" + wildcard_path + "'");
+    }
+
+    // Members are named beneath the directory common to every channel
+    std::string root = PathParent(PathExpand(wildcards[0]));
+    for(const std::string& w : wildcards) {
+        const std::string dir = PathParent(PathExpand(w));
+        while(!root.empty() && !(dir == root || StartsWith(dir, root + "/"))) {
+            root = PathParent(root);
+        }
+    }
+    const size_t root_chars = root.empty() ? 0 : root.size() + 1;
+
+    struct Entry { std::string path; std::string name; uint64_t size; uint64_t offset; };
+    std::vector<std::vector<Entry>> entries(files.size());
+    for(size_t c=0; c < files.size(); ++c) {
+        for(size_t i=0; i < num_files; ++i) {
+            struct stat buf;
+            if(stat(files[c][i].c_str(), &buf) != 0) {
+                throw VideoException("Unable to read '" + files[c][i] + "'");
+            }
+            entries[c].push_back({files[c][i], files[c][i].substr(root_chars), (uint64_t)buf.st_size, 0});
+        }
+    }
+
+    // Header blocks of a member, with a GNU long name block where ustar's
+    // name and prefix fields aren't enough
+    const auto split_name = [](const std::string& name, std::string& prefix, std::string& rest) {
+        if(name.size() <= 100) { prefix.clear(); rest = name; return true; }
+        const size_t slash = name.find_last_of('/', 155);
+        if(slash == std::string::npos || name.size() - slash - 1 > 100) return false;
+        prefix = name.substr(0, slash);
+        rest = name.substr(slash + 1);
+        return true;
+    };
+    const auto header_bytes = [&](const std::string& name) -> uint64_t {
+        std::string prefix, rest;
+        return split_name(name, prefix, rest) ? tar_block : 2*tar_block + TarBlocks(name.size() + 1);
+    };
+
+    // Offsets are written at fixed width, so the index's size is known before them
+    uint64_t index_bytes = std::string(archive_index_magic).size() + 1 + std::to_string(files.size()).size() + 1;
+    for(const auto& channel : entries) {
+        index_bytes += std::to_string(channel.size()).size() + 1;
+        for(const Entry& e : channel) index_bytes += 43 + e.name.size();
+    }
+
+    uint64_t pos = header_bytes(archive_index_name) + TarBlocks(index_bytes);
+    for(auto& channel : entries) {
+        for(Entry& e : channel) {
+            pos += header_bytes(e.name);
+            e.offset = pos;
+            pos += TarBlocks(e.size);
+        }
+    }
+
+    std::string index;
+    index.reserve((size_t)index_bytes);
+    index += std::string(archive_index_magic) + "\n" + std::to_string(files.size()) + "\n";
+    for(const auto& channel : entries) {
+        index += std::to_string(channel.size()) + "\n";
+        for(const Entry& e : channel) {
+            char offsets[64];
+            snprintf(offsets, sizeof(offsets), "%020llu %020llu ", (unsigned long long)e.offset, (unsigned long long)e.size);
+            index += offsets + e.name + "\n";
+        }
+    }
+    PANGO_ENSURE(index.size() == index_bytes);
+
+    std::ofstream out(archive_filename, std::ios::out | std::ios::binary);
+    if(!out.is_open()) {
+        throw VideoException("Unable to open '" + archive_filename + "' for writing");
+    }
+
+    const char zeros[tar_block] = {0};
+    const auto write_header = [&](const std::string& name, uint64_t size, char type) {
+        std::string prefix, rest;
+        if(!split_name(name, prefix, rest)) {
+            const std::string long_name = name + '\0';
+            const char long_link[] = "././@LongLink";
+            unsigned char h[tar_block] = {0};
+            std::memcpy(h, long_link, sizeof(long_link));
+            snprintf((char*)h + 124, 12, "%011llo", (unsigned long long)long_name.size());
+            h[156] = 'L';
+            std::memcpy(h + 100, "0000644", 8);
+            std::memset(h + 148, ' ', 8);
+            std::memcpy(h + 257, "ustar", 6);
+            std::memcpy(h + 263, "00", 2);
+            unsigned sum = 0;
+            for(unsigned char b : h) sum += b;
+            snprintf((char*)h + 148, 8, "%06o", sum);
+            out.write((const char*)h, tar_block);
+            out.write(long_name.data(), long_name.size());
+            out.write(zeros, TarBlocks(long_name.size()) - long_name.size());
+            prefix.clear();
+            rest = name.substr(0, 100);
+        }
+
+        unsigned char h[tar_block] = {0};
+        std::memcpy(h, rest.data(), rest.size());
+        std::memcpy(h + 100, "0000644", 8);
+        std::memcpy(h + 108, "0000000", 8);
+        std::memcpy(h + 116, "0000000", 8);
+        snprintf((char*)h + 124, 12, "%011llo", (unsigned long long)size);
+        std::memcpy(h + 136, "00000000000", 12);
+        std::memset(h + 148, ' ', 8);
+        h[156] = type;
+        std::memcpy(h + 257, "ustar", 6);
+        std::memcpy(h + 263, "00", 2);
+        std::memcpy(h + 345, prefix.data(), prefix.size());
+        unsigned sum = 0;
+        for(unsigned char b : h) sum += b;
+        snprintf((char*)h + 148, 8, "%06o", sum);
+        out.write((const char*)h, tar_block);
+    };
+
+    write_header(archive_index_name, index.size(), '0');
+    out.write(index.data(), index.size());
+    out.write(zeros, TarBlocks(index.size()) - index.size());
+
+    std::vector<char> copy(1 << 20);
+    for(const auto& channel : entries) {
+        for(const Entry& e : channel) {
+            write_header(e.name, e.size, '0');
+            PANGO_ENSURE((uint64_t)out.tellp() == e.offset);
+
+            std::ifstream in(e.path, std::ios::in | std::ios::binary);
+            uint64_t remaining = e.size;
+            while(in && remaining) {
+                in.read(copy.data(), (std::streamsize)std::min<uint64_t>(remaining, copy.size()));
+                out.write(copy.data(), in.gcount());
+                remaining -= (uint64_t)in.gcount();
+            }
+            if(remaining) {
+                throw VideoException("Unable to read '" + e.path + "'");
+            }
+            out.write(zeros, TarBlocks(e.size) - e.size);
+        }
+    }
+
+    // End of archive
+    out.write(zeros, tar_block);
+    out.write(zeros, tar_block);
+    if(!out) {
+        throw VideoException("Unable to write '" + archive_filename + "'");
+    }
+    return num_files;
+}
+
+namespace
+{
+const char* manifest_magic = "pangolin_images_manifest 1";
+
+// Modification time of the directory holding channel_wildcard, which changes
+// whenever files are added to or removed from it.
+int64_t WildcardDirModifiedTime(const std::string& channel_wildcard)
+{
+    const size_t last_slash = channel_wildcard.find_last_of("/\\");
+    const std::string dir = last_slash == std::string::npos ? "." : channel_wildcard.substr(0, last_slash);
+    struct stat buf;
+    return stat(dir.c_str(), &buf) == 0 ? (int64_t)buf.st_mtime : -1;
+}
+}
+
+bool ImagesVideo::LoadManifest(const std::string& manifest, const std::string& wildcard_path)
+{
+    std::ifstream f(manifest);
+    if(!f.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    if(!std::getline(f, line) || line != manifest_magic) {
+        pango_print_warn("Ignoring '%s', not an image manifest.\n", manifest.c_str());
+        return false;
+    }
+    if(!std::getline(f, line) || line != wildcard_path) {
+        return false;
+    }
+
+    const std::vector<std::string> wildcards = Expand(wildcard_path, '[', ']', ',');
+    size_t manifest_channels = 0;
+    f >> manifest_channels;
+    if(!f || manifest_channels != wildcards.size()) {
+        return false;
+    }
+
+    std::vector<StreamInfo> manifest_streams;
+    std::vector<std::vector<std::string>> manifest_filenames(manifest_channels);
+    size_t manifest_bytes = 0;
+
+    for(size_t c=0; c < manifest_channels; ++c) {
+        int64_t mtime;
+        std::string fmt;
+        size_t w, h, pitch, count;
+        f >> mtime >> fmt >> w >> h >> pitch >> count;
+        f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        if(!f || mtime != WildcardDirModifiedTime(PathExpand(wildcards[c])) || count == 0) {
+            // Directory has changed since the manifest was written.
+            return false;
+        }
+
+        manifest_streams.push_back(StreamInfo(PixelFormatFromString(fmt), w, h, pitch, (unsigned char*)0 + manifest_bytes));
+        manifest_bytes += h*pitch;
+
+        std::vector<std::string>& names = manifest_filenames[c];
+        names.resize(count);
+        for(size_t i=0; i < count; ++i) {
+            if(!std::getline(f, names[i])) {
+                return false;
+            }
+        }
+    }
+
+    num_channels = manifest_channels;
+    num_files = manifest_filenames[0].size();
+    for(const auto& names : manifest_filenames) {
+        num_files = std::min(num_files, names.size());
+    }
+    filenames = std::move(manifest_filenames);
+    streams = std::move(manifest_streams);
+    size_bytes = manifest_bytes;
+    loaded.resize(num_files);
+    return true;
+}
+
+void ImagesVideo::SaveManifest(const std::string& manifest, const std::string& wildcard_path) const
+{
+    // Write to a temporary first so a concurrent open never sees a partial manifest.
+    const std::string tmp = manifest + ".tmp";
+    {
+        std::ofstream f(tmp);
+        if(!f.is_open()) {
+            pango_print_warn("Unable to write image manifest '%s'.\n", manifest.c_str());
+            return;
+        }
+
+        const std::vector<std::string> wildcards = Expand(wildcard_path, '[', ']', ',');
+        f << manifest_magic << "\n" << wildcard_path << "\n" << num_channels << "\n";
+        for(size_t c=0; c < num_channels; ++c) {
+            const StreamInfo& si = streams[c];
+            f << WildcardDirModifiedTime(PathExpand(wildcards[c])) << " " << si.PixFormat().Name() << " "
+              << si.Width() << " " << si.Height() << " " << si.Pitch() << " " << filenames[c].size() << "\n";
+            for(const std::string& name : filenames[c]) {
+                f << name << "\n";
+            }
+        }
+        if(!f) {
+            pango_print_warn("Unable to write image manifest '%s'.\n", manifest.c_str());
+            return;
+        }
+    }
+    if(std::rename(tmp.c_str(), manifest.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        pango_print_warn("Unable to write image manifest '%s'.\n", manifest.c_str());
+    }
+}
+
 void ImagesVideo::ConfigureStreamSizes()
 {
     size_bytes = 0;
@@ -92,28 +695,45 @@ void ImagesVideo::ConfigureStreamSizes()
     }
 }
 
-ImagesVideo::ImagesVideo(const std::string& wildcard_path)
+ImagesVideo::ImagesVideo(const std::string& wildcard_path, const PrefetchOptions& prefetch, const std::string& manifest, const std::string& archive)
     : num_files(-1), num_channels(0), next_frame_id(0),
-      unknowns_are_raw(false)
+      unknowns_are_raw(false),
+      prefetch_next_load(0), prefetch_bytes(0), prefetch_generation(0), prefetch_quit(false)
 {
-    // Work out which files to sequence
-    PopulateFilenames(wildcard_path);
-
-    // Load first image in order to determine stream sizes etc
-    LoadFrame(next_frame_id);
-
-    ConfigureStreamSizes();
-
-    // TODO: Queue frames in another thread.
+    Open(wildcard_path, manifest, archive);
+    StartPrefetch(prefetch);
 }
 
 ImagesVideo::ImagesVideo(const std::string& wildcard_path,
                          const PixelFormat& raw_fmt,
-                         size_t raw_width, size_t raw_height
+                         size_t raw_width, size_t raw_height,
+                         const PrefetchOptions& prefetch,
+                         const std::string& manifest,
+                         const std::string& archive
 )   : num_files(-1), num_channels(0), next_frame_id(0),
       unknowns_are_raw(true), raw_fmt(raw_fmt),
-      raw_width(raw_width), raw_height(raw_height)
+      raw_width(raw_width), raw_height(raw_height),
+      prefetch_next_load(0), prefetch_bytes(0), prefetch_generation(0), prefetch_quit(false)
 {
+    Open(wildcard_path, manifest, archive);
+    StartPrefetch(prefetch);
+}
+
+void ImagesVideo::Open(const std::string& wildcard_path, const std::string& manifest, const std::string& archive_filename)
+{
+    if(!archive_filename.empty()) {
+        // The archive's own index stands in for a manifest
+        archive = std::make_shared<ImageArchiveFile>(archive_filename);
+        PopulateArchiveMembers(wildcard_path);
+        LoadFrame(next_frame_id);
+        ConfigureStreamSizes();
+        return;
+    }
+
+    if(!manifest.empty() && LoadManifest(manifest, wildcard_path)) {
+        return;
+    }
+
     // Work out which files to sequence
     PopulateFilenames(wildcard_path);
 
@@ -122,11 +742,112 @@ ImagesVideo::ImagesVideo(const std::string& wildcard_path,
 
     ConfigureStreamSizes();
 
-    // TODO: Queue frames in another thread.
+    if(!manifest.empty()) {
+        SaveManifest(manifest, wildcard_path);
+    }
 }
 
 ImagesVideo::~ImagesVideo()
 {
+    StopPrefetch();
+}
+
+void ImagesVideo::StartPrefetch(const PrefetchOptions& options)
+{
+    prefetch = options;
+    if(!prefetch.frames) {
+        return;
+    }
+
+    // The first frame may already be decoded; hand it to the prefetch window.
+    if(loaded[0].size() == num_channels) {
+        prefetch_ready[0] = std::move(loaded[0]);
+        loaded[0].clear();
+        prefetch_next_load = 1;
+        prefetch_bytes = size_bytes;
+    }
+
+    const size_t num_threads = prefetch.threads ? prefetch.threads :
+        std::max<size_t>(1, std::min(prefetch.frames, ParallelConcurrency()));
+    for(size_t i=0; i < num_threads; ++i) {
+        prefetch_threads.emplace_back(&ImagesVideo::PrefetchLoop, this);
+    }
+}
+
+void ImagesVideo::StopPrefetch()
+{
+    {
+        std::lock_guard<std::mutex> l(prefetch_mutex);
+        prefetch_quit = true;
+    }
+    prefetch_cv.notify_all();
+    for(auto& t : prefetch_threads) {
+        t.join();
+    }
+    prefetch_threads.clear();
+}
+
+void ImagesVideo::PrefetchLoop()
+{
+    const auto can_load = [this](){
+        // Always allow the frame being waited on, so the byte cap can't stall playback.
+        const bool within_bytes = !prefetch.max_bytes || prefetch_next_load == next_frame_id ||
+            prefetch_bytes + size_bytes <= prefetch.max_bytes;
+        return prefetch_quit || (prefetch_next_load < num_files &&
+            prefetch_next_load < next_frame_id + prefetch.frames && within_bytes);
+    };
+
+    while(true) {
+        size_t i;
+        size_t generation;
+        {
+            std::unique_lock<std::mutex> l(prefetch_mutex);
+            prefetch_cv.wait(l, can_load);
+            if(prefetch_quit) return;
+            i = prefetch_next_load++;
+            generation = prefetch_generation;
+            prefetch_bytes += size_bytes;
+        }
+
+        Frame frame;
+        try {
+            DecodeFrame(i, frame);
+        }catch(const std::exception& e) {
+            pango_print_warn("Unable to load frame %zu: %s\n", i, e.what());
+            frame.clear();
+        }
+
+        std::lock_guard<std::mutex> l(prefetch_mutex);
+        if(generation == prefetch_generation) {
+            prefetch_ready[i] = std::move(frame);
+            prefetch_cv.notify_all();
+        }
+    }
+}
+
+bool ImagesVideo::GrabPrefetched(unsigned char* image)
+{
+    std::unique_lock<std::mutex> l(prefetch_mutex);
+    if(next_frame_id >= num_files) {
+        return false;
+    }
+
+    prefetch_cv.wait(l, [this](){
+        return prefetch_ready.count(next_frame_id) > 0;
+    });
+
+    // A frame which failed to load or changed size stays in the window, ending playback.
+    auto it = prefetch_ready.find(next_frame_id);
+    if(!CopyFrame(it->second, image)) {
+        return false;
+    }
+
+    prefetch_ready.erase(it);
+    prefetch_bytes -= std::min(prefetch_bytes, size_bytes);
+    next_frame_id++;
+    l.unlock();
+    prefetch_cv.notify_all();
+    return true;
 }
 
 //! Implement VideoInput::Start()
@@ -156,21 +877,24 @@ const std::vector<StreamInfo>& ImagesVideo::Streams() const
 //! Implement VideoInput::GrabNext()
 bool ImagesVideo::GrabNext( unsigned char* image, bool /*wait*/ )
 {
+    if(prefetch.frames) {
+        return GrabPrefetched(image);
+    }
+
     if(next_frame_id < loaded.size()) {
         Frame& frame = loaded[next_frame_id];
 
         if(frame.size() != num_channels) {
-            LoadFrame(next_frame_id);
-        }
-
-        for(size_t c=0; c < num_channels; ++c){
-            TypedImage& img = frame[c];
-            if(!img.ptr || img.w != streams[c].Width() || img.h != streams[c].Height() ) {
+            // Nothing cached, so decode straight into the caller's buffer
+            if(!LoadFrameInto(next_frame_id, image)) {
                 return false;
             }
-            const StreamInfo& si = streams[c];
-            std::memcpy(image + (size_t)si.Offset(), img.ptr, si.SizeBytes());
-            img.Deallocate();
+            next_frame_id++;
+            return true;
+        }
+
+        if(!CopyFrame(frame, image)) {
+            return false;
         }
         frame.clear();
 
@@ -199,7 +923,17 @@ size_t ImagesVideo::GetTotalFrames() const
 
 size_t ImagesVideo::Seek(size_t frameid)
 {
+    std::lock_guard<std::mutex> l(prefetch_mutex);
     next_frame_id = std::max(size_t(0), std::min(frameid, num_files));
+
+    if(prefetch.frames) {
+        // Discard the old window; frames still decoding are dropped when they finish.
+        ++prefetch_generation;
+        prefetch_ready.clear();
+        prefetch_next_load = next_frame_id;
+        prefetch_bytes = 0;
+        prefetch_cv.notify_all();
+    }
     return next_frame_id;
 }
 
@@ -208,15 +942,26 @@ PANGOLIN_REGISTER_FACTORY(ImagesVideo)
     struct ImagesVideoVideoFactory : public FactoryInterface<VideoInterface> {
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             const bool raw = uri.Contains("fmt");
-            const std::string path = PathExpand(uri.url);
+
+            // tar://file.tar reads the archive's own channels, and
+            // images:[archive=file.tar]//wildcard those members matching
+            const bool tar = uri.scheme == "tar";
+            const std::string archive = PathExpand(tar ? uri.url : uri.Get<std::string>("archive", ""));
+            const std::string path = tar ? std::string() : (archive.empty() ? PathExpand(uri.url) : uri.url);
+            const ImagesVideo::PrefetchOptions prefetch(
+                uri.Get<size_t>("prefetch", 0),
+                uri.Get<size_t>("threads", 0),
+                uri.Get<size_t>("prefetch_mb", 1024) << 20
+            );
+            const std::string manifest = uri.Get<std::string>("manifest", "");
 
             if(raw) {
                 const std::string sfmt = uri.Get<std::string>("fmt", "GRAY8");
                 const PixelFormat fmt = PixelFormatFromString(sfmt);
                 const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(640,480));
-                return std::unique_ptr<VideoInterface>( new ImagesVideo(path, fmt, dim.x, dim.y) );
+                return std::unique_ptr<VideoInterface>( new ImagesVideo(path, fmt, dim.x, dim.y, prefetch, PathExpand(manifest), archive) );
             }else{
-                return std::unique_ptr<VideoInterface>( new ImagesVideo(path) );
+                return std::unique_ptr<VideoInterface>( new ImagesVideo(path, prefetch, PathExpand(manifest), archive) );
             }
         }
     };
@@ -226,6 +971,7 @@ PANGOLIN_REGISTER_FACTORY(ImagesVideo)
     FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 20, "files");
     FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 10, "image");
     FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 10, "images");
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 10, "tar");
 }
 
 }
@@ -29,13 +29,25 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/image/image_io.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/parallel_for.h>
 #include <pangolin/video/drivers/images_out.h>
 
+#include <cstring>
+
 namespace pangolin {
 
-ImagesVideoOutput::ImagesVideoOutput(const std::string& image_folder, const std::string& json_file_out)
+struct ImagesVideoOutput::WriteJob
+{
+    FramePool::Buffer frame;
+    std::vector<std::string> filenames;
+    size_t streams_done;
+};
+
+ImagesVideoOutput::ImagesVideoOutput(const std::string& image_folder, const std::string& json_file_out, size_t threads, size_t queue)
     : json_frames(picojson::array_type,true),
-      image_index(0), image_folder( PathExpand(image_folder) )
+      image_index(0), image_folder( PathExpand(image_folder) ),
+      write_queue(queue ? queue : 2*threads), frames_written(0), write_quit(false)
 {
     if(!json_file_out.empty()) {
         file.open(json_file_out);
@@ -43,10 +55,24 @@ ImagesVideoOutput::ImagesVideoOutput(const std::string& image_folder, const std:
             throw std::runtime_error("Unable to open json file for writing, " + json_file_out);
         }
     }
+
+    for(size_t i=0; i < threads; ++i) {
+        write_workers.emplace_back(&ImagesVideoOutput::WriteLoop, this);
+    }
 }
 
 ImagesVideoOutput::~ImagesVideoOutput()
 {
+    StopWorkers();
+    if(write_error) {
+        try {
+            std::rethrow_exception(write_error);
+        }catch(const std::exception& e) {
+            pango_print_warn("ImagesVideoOutput: failed writing images: %s\n", e.what());
+        }catch(...) {
+        }
+    }
+
     if(file.is_open())
     {
         std::string video_uri = "images://" + image_folder + "/image_*_[0";
@@ -77,17 +103,127 @@ void ImagesVideoOutput::SetStreams(const std::vector<StreamInfo>& streams, const
     this->device_properties = device_properties;
 }
 
+void ImagesVideoOutput::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> l(write_mutex);
+        write_quit = true;
+    }
+    write_cv.notify_all();
+
+    // Workers finish everything already queued before exiting
+    for(auto& t : write_workers) t.join();
+    write_workers.clear();
+}
+
+void ImagesVideoOutput::RethrowError()
+{
+    // Called with write_mutex held
+    if(write_error) {
+        std::exception_ptr e = write_error;
+        write_error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void ImagesVideoOutput::WriteLoop()
+{
+    while(true) {
+        std::shared_ptr<WriteJob> job;
+        size_t s;
+        {
+            std::unique_lock<std::mutex> l(write_mutex);
+            write_cv.wait(l, [this](){ return write_quit || !write_tasks.empty(); });
+            if(write_tasks.empty()) return;
+            job = write_tasks.front().first;
+            s = write_tasks.front().second;
+            write_tasks.pop_front();
+        }
+
+        std::exception_ptr error;
+        try {
+            const StreamInfo& si = streams[s];
+            pangolin::SaveImage(si.StreamImage(job->frame.get()), si.PixFormat(), job->filenames[s]);
+        }catch(...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> l(write_mutex);
+            if(error && !write_error) write_error = error;
+            if(++job->streams_done == streams.size()) {
+                job->frame.Reset();
+            }
+
+            // Frames complete in order once all before them are
+            while(!write_jobs.empty() && write_jobs.front()->streams_done == streams.size()) {
+                write_jobs.pop_front();
+                ++frames_written;
+            }
+        }
+        done_cv.notify_all();
+    }
+}
+
+size_t ImagesVideoOutput::FramesWritten() const
+{
+    std::lock_guard<std::mutex> l(write_mutex);
+    return write_workers.empty() ? image_index : frames_written;
+}
+
+void ImagesVideoOutput::Flush()
+{
+    std::unique_lock<std::mutex> l(write_mutex);
+    done_cv.wait(l, [this](){ return write_jobs.empty(); });
+    RethrowError();
+}
+
 int ImagesVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
 {
     picojson::value json_filenames(picojson::array_type, true);
+    std::vector<std::string> filenames;
 
-    // Write each stream image to file.
     for(size_t s=0; s < streams.size(); ++s) {
-        const pangolin::StreamInfo& si = streams[s];
         const std::string filename = pangolin::FormatString("%/image_%%%_%.png", image_folder ,std::setfill('0'),std::setw(10),image_index, s);
         json_filenames.push_back(filename);
-        const Image<unsigned char> img = si.StreamImage(data);
-        pangolin::SaveImage(img, si.PixFormat(), filename);
+        filenames.push_back(filename);
+    }
+
+    if(write_workers.empty()) {
+        // Write each stream image to file.
+        for(size_t s=0; s < streams.size(); ++s) {
+            const pangolin::StreamInfo& si = streams[s];
+            const Image<unsigned char> img = si.StreamImage(data);
+            pangolin::SaveImage(img, si.PixFormat(), filenames[s]);
+        }
+    }else{
+        size_t frame_bytes = 0;
+        for(const StreamInfo& si : streams) {
+            frame_bytes = std::max(frame_bytes, (size_t)si.Offset() + si.SizeBytes());
+        }
+
+        {
+            // Back-pressure: wait for the oldest frame in flight to be written
+            std::unique_lock<std::mutex> l(write_mutex);
+            done_cv.wait(l, [this](){ return write_jobs.size() < write_queue; });
+            RethrowError();
+        }
+
+        // data is only valid for this call, so take a copy for the workers
+        auto job = std::make_shared<WriteJob>();
+        job->frame = FramePool::I().Acquire(frame_bytes);
+        std::memcpy(job->frame.get(), data, frame_bytes);
+        job->filenames = std::move(filenames);
+        job->streams_done = 0;
+
+        {
+            std::lock_guard<std::mutex> l(write_mutex);
+            write_jobs.push_back(job);
+            for(size_t s=0; s < streams.size(); ++s) {
+                write_tasks.emplace_back(job, s);
+            }
+        }
+        write_cv.notify_all();
     }
 
     // Add frame_properties to json file.
@@ -111,9 +247,11 @@ PANGOLIN_REGISTER_FACTORY(ImagesVideoOutput)
         std::unique_ptr<VideoOutputInterface> Open(const Uri& uri) override {
             const std::string images_folder = PathExpand(uri.url);
             const std::string json_filename = images_folder + "/archive.json";
+            const size_t threads = uri.Get<size_t>("threads", ParallelConcurrency());
+            const size_t queue = uri.Get<size_t>("queue", 0);
 
             return std::unique_ptr<VideoOutputInterface>(
-                new ImagesVideoOutput(images_folder, json_filename)
+                new ImagesVideoOutput(images_folder, json_filename, threads, queue)
             );
         }
     };
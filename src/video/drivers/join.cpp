@@ -26,9 +26,18 @@
  */
 
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/video/drivers/clock_sync.h>
+#include <pangolin/image/memcpy.h>
+#include <pangolin/utils/trace.h>
 #include <pangolin/video/drivers/join.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 //#define DEBUGJOIN
 
 #ifdef DEBUGJOIN
@@ -44,8 +53,79 @@
 
 namespace pangolin
 {
+
+// Dedicated thread running one job at a time on behalf of a source. Sources
+// usually block in their grab, so they get a thread each rather than sharing
+// a pool.
+struct JoinVideo::GrabWorker
+{
+    GrabWorker()
+        : has_job(false), quit(false), thread([this](){ Loop(); })
+    {
+    }
+
+    ~GrabWorker()
+    {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    void Run(const std::function<void()>& f)
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        job = f;
+        error = nullptr;
+        has_job = true;
+        cv.notify_all();
+    }
+
+    // Wait for the current job, rethrowing anything it threw.
+    void Wait()
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        cv.wait(l, [this](){ return !has_job; });
+        if(error) {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+private:
+    void Loop()
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        while(true) {
+            cv.wait(l, [this](){ return has_job || quit; });
+            if(quit) return;
+            l.unlock();
+            try {
+                job();
+            }catch(...) {
+                error = std::current_exception();
+            }
+            l.lock();
+            has_job = false;
+            cv.notify_all();
+        }
+    }
+
+    std::function<void()> job;
+    std::exception_ptr error;
+    bool has_job;
+    bool quit;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
+
 JoinVideo::JoinVideo(std::vector<std::unique_ptr<VideoInterface> > &src_)
-    : storage(std::move(src_)), size_bytes(0), sync_tolerance_us(0)
+    : VideoStageTimer("join"), storage(std::move(src_)), size_bytes(0), sync_tolerance_us(0), transfer_bandwidth_bytes_per_us(0),
+      match_depth(0), frames_matched(0), frames_dropped(0), skew_sum_us(0.0), last_skew_us(0)
 {
     for(auto& p : storage) {
         src.push_back(p.get());
@@ -68,6 +148,8 @@ JoinVideo::JoinVideo(std::vector<std::unique_ptr<VideoInterface> > &src_)
 
 JoinVideo::~JoinVideo()
 {
+    workers.clear();
+
     for(size_t s=0; s< src.size(); ++s) {
         src[s]->Stop();
     }
@@ -127,49 +209,291 @@ bool JoinVideo::Sync(int64_t tolerance_us, double transfer_bandwidth_gbps)
     return true;
 }
 
-// Assuming that src_index supports VideoPropertiesInterface and has a valid PANGO_HOST_RECEPTION_TIME_US, or PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US
+void JoinVideo::SetParallelGrab(bool parallel)
+{
+    workers.clear();
+    if(parallel) {
+        for(size_t s=0; s < src.size(); ++s) {
+            workers.emplace_back(new GrabWorker());
+        }
+    }
+}
+
+void JoinVideo::ForEachSource(const std::vector<size_t>& sources, const std::function<void(size_t)>& grab)
+{
+    if(workers.empty()) {
+        for(size_t s : sources) grab(s);
+        return;
+    }
+
+    for(size_t s : sources) {
+        workers[s]->Run([&grab,s](){ grab(s); });
+    }
+
+    // Wait for all before propagating any error, since jobs reference grab.
+    std::exception_ptr error;
+    for(size_t s : sources) {
+        try {
+            workers[s]->Wait();
+        }catch(...) {
+            if(!error) error = std::current_exception();
+        }
+    }
+    if(error) std::rethrow_exception(error);
+}
+
+// Assuming that src_index has a valid host reception time, or estimated center capture time,
 // returns a capture time adjusted for transfer time and when possible also for exposure.
 int64_t JoinVideo::GetAdjustedCaptureTime(size_t src_index)
 {
-    picojson::value props = GetVideoFrameProperties(src[src_index]);
-    if(props.contains(PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US)) {
+    return GetAdjustedCaptureTime(GetVideoFrameMetadata(src[src_index]), src_index);
+}
+
+int64_t JoinVideo::GetAdjustedCaptureTime(const FrameMetadata& metadata, size_t src_index) const
+{
+    if(metadata.Has(FrameMetadata::EstimatedCenterCaptureTime)) {
         // great, the driver already gave us an estimated center of capture
-        return props[PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US].get<int64_t>();
+        return metadata.estimated_center_capture_time_us;
+    }else if(metadata.Has(FrameMetadata::HostReceptionTime)) {
+        int64_t transfer_time_us = 0;
+        if( transfer_bandwidth_bytes_per_us > 0 ) {
+            transfer_time_us = src[src_index]->SizeBytes() / transfer_bandwidth_bytes_per_us;
+        }
+        return metadata.host_reception_time_us - transfer_time_us;
+    }
 
-    } else {
-        if(props.contains(PANGO_HOST_RECEPTION_TIME_US)) {
-            int64_t transfer_time_us = 0;
-            if( transfer_bandwidth_bytes_per_us > 0 ) {
-                transfer_time_us = src[src_index]->SizeBytes() / transfer_bandwidth_bytes_per_us;
+    PANGO_ENSURE(false, "JoinVideo: Stream % does contain any timestamp info.\n", src_index);
+    return 0;
+}
+
+void JoinVideo::SetMatchDepth(size_t depth)
+{
+    match_depth = depth;
+    pending = std::vector<std::deque<PendingFrame>>(depth ? src.size() : 0);
+    matched.clear();
+    frames_matched = 0;
+    frames_dropped = 0;
+    skew_sum_us = 0.0;
+    last_skew_us = 0;
+}
+
+// Grab one frame from src_index onto the back of its pending queue.
+bool JoinVideo::PullFrame(size_t src_index, bool wait)
+{
+    PendingFrame frame;
+    frame.buffer = FramePool::I().Acquire(src[src_index]->SizeBytes());
+    if(!src[src_index]->GrabNext(frame.buffer.get(), wait)) {
+        return false;
+    }
+    if(HasVideoFrameMetadata(src[src_index])) {
+        frame.metadata = GetVideoFrameMetadata(src[src_index]);
+    }else{
+        frame.frame_properties = GetVideoFrameProperties(src[src_index]);
+        frame.metadata = FrameMetadata::FromJson(frame.frame_properties);
+    }
+    frame.capture_us = GetAdjustedCaptureTime(frame.metadata, src_index);
+    pending[src_index].push_back(std::move(frame));
+    return true;
+}
+
+// Queue whatever src_index already has buffered without blocking, up to match_depth.
+void JoinVideo::TopUpFrames(size_t src_index)
+{
+    BufferAwareVideoInterface* bai = dynamic_cast<BufferAwareVideoInterface*>(src[src_index]);
+    if(!bai) return;
+
+    size_t n = bai->AvailableFrames();
+    while(n-- > 0 && pending[src_index].size() < match_depth) {
+        if(!PullFrame(src_index, false)) break;
+    }
+}
+
+// Arrange for the front of every pending queue to form the best aligned tuple
+// within sync_tolerance_us, discarding frames which can no longer be matched.
+bool JoinVideo::MatchPending(bool wait)
+{
+    const auto head_range = [this](){
+        int64_t oldest = std::numeric_limits<int64_t>::max();
+        int64_t newest = std::numeric_limits<int64_t>::min();
+        for(const auto& q : pending) {
+            oldest = std::min(oldest, q.front().capture_us);
+            newest = std::max(newest, q.front().capture_us);
+        }
+        return std::make_pair(oldest, newest);
+    };
+
+    std::vector<size_t> all(src.size());
+    for(size_t s=0; s<src.size(); ++s) all[s] = s;
+    ForEachSource(all, [this](size_t s){ TopUpFrames(s); });
+
+    // Every pass drops at least one frame, so this bounds added latency to a few queue lengths.
+    const size_t max_rounds = 4 * match_depth * src.size();
+    for(size_t n=0; ; ++n) {
+        std::vector<size_t> empty;
+        for(size_t s=0; s<src.size(); ++s) {
+            if(pending[s].empty()) empty.push_back(s);
+        }
+        if(!empty.empty()) {
+            std::vector<char> grabbed(src.size(), 1);
+            ForEachSource(empty, [&](size_t s){
+                grabbed[s] = PullFrame(s, wait);
+            });
+            if(std::find(grabbed.begin(), grabbed.end(), 0) != grabbed.end()) return false;
+        }
+
+        const auto range = head_range();
+        if(range.second - range.first <= sync_tolerance_us) {
+            break;
+        }
+        if(n == max_rounds) {
+            TGRABANDPRINT("NOT IN SYNC oldest:%ld newest:%ld delta:%ld", range.first, range.second, (range.second - range.first));
+            return false;
+        }
+
+        // Frames older than the newest head by more than the tolerance can't be part of any future tuple.
+        for(auto& q : pending) {
+            while(!q.empty() && q.front().capture_us < range.second - sync_tolerance_us) {
+                q.pop_front();
+                ++frames_dropped;
+                StageRejected(1);
             }
-            return props[PANGO_HOST_RECEPTION_TIME_US].get<int64_t>() - transfer_time_us;
-        } else {
-            if (props.contains("streams")) {
-                picojson::value streams = props["streams"];
-
-                if(streams.size()>0){
-                     if(streams[0].contains(PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US)) {
-                         // great, the driver already gave us an estimated center of capture
-                         return streams[0][PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US].get<int64_t>();
-                     }
-                     else if( streams[0].contains(PANGO_HOST_RECEPTION_TIME_US)) {
-                         int64_t transfer_time_us = 0;
-                         if( transfer_bandwidth_bytes_per_us > 0 ) {
-                             transfer_time_us = src[src_index]->SizeBytes() / transfer_bandwidth_bytes_per_us;
-                         }
-                        return streams[0][PANGO_HOST_RECEPTION_TIME_US].get<int64_t>() - transfer_time_us;
-                    }
-                }
-           }
-       }
+        }
+    }
 
-       PANGO_ENSURE(false, "JoinVideo: Stream % does contain any timestamp info.\n", src_index);
-       return 0;
-   }
+    // Heads are within tolerance, but a source may hold a later frame which is closer still.
+    for(size_t s=0; s<src.size(); ++s) {
+        while(pending[s].size() > 1) {
+            const auto before = head_range();
+            PendingFrame head = std::move(pending[s].front());
+            pending[s].pop_front();
+            const auto after = head_range();
+            if(after.second - after.first >= before.second - before.first) {
+                pending[s].push_front(std::move(head));
+                break;
+            }
+            ++frames_dropped;
+            StageRejected(1);
+        }
+    }
+    return true;
+}
+
+bool JoinVideo::GrabNextMatched(unsigned char* image, bool wait)
+{
+    if(!MatchPending(wait)) {
+        return false;
+    }
+
+    matched.resize(src.size());
+    int64_t oldest = std::numeric_limits<int64_t>::max();
+    int64_t newest = std::numeric_limits<int64_t>::min();
+    for(size_t s=0, offset=0; s<src.size(); ++s) {
+        PendingFrame& frame = pending[s].front();
+        FrameCopy(image + offset, frame.buffer.get(), src[s]->SizeBytes());
+        offset += src[s]->SizeBytes();
+        oldest = std::min(oldest, frame.capture_us);
+        newest = std::max(newest, frame.capture_us);
+        matched[s] = std::move(frame);
+        matched[s].buffer.Reset();
+        pending[s].pop_front();
+    }
+
+    ++frames_matched;
+    last_skew_us = newest - oldest;
+    skew_sum_us += (double)last_skew_us;
+
+    TGRABANDPRINT("    MATCHED oldest:%ld newest:%ld delta:%ld", oldest, newest, last_skew_us);
+    return true;
+}
+
+bool JoinVideo::GrabNextParallel(unsigned char* image, bool wait)
+{
+    std::vector<size_t> offsets(src.size(), 0);
+    std::vector<size_t> all(src.size());
+    for(size_t s=0, offset=0; s<src.size(); ++s) {
+        offsets[s] = offset;
+        offset += src[s]->SizeBytes();
+        all[s] = s;
+    }
+
+    // capture_us[s] == 0 records that source s didn't return an image.
+    std::vector<int64_t> capture_us(src.size(), 0);
+
+    TSTART()
+    DBGPRINT("Entering GrabNextParallel:")
+    ForEachSource(all, [&](size_t s){
+        if( src[s]->GrabNext(image+offsets[s],wait) ) {
+            capture_us[s] = (sync_tolerance_us > 0) ? GetAdjustedCaptureTime(s) : std::numeric_limits<int64_t>::max();
+        }
+    });
+    TGRABANDPRINT("Parallel grab of %ld streams took ", src.size());
+
+    if( std::any_of(capture_us.begin(), capture_us.end(), [](int64_t v){return v == 0;}) ){
+        return false;
+    }
+
+    if(sync_tolerance_us <= 0) {
+        return true;
+    }
+
+    // Each lagging source catches up towards the newest timestamp
+    // independently, as its own frames arrive, rather than in lockstep.
+    for(size_t n=0; n<10; ++n) {
+        const int64_t newest = *std::max_element(capture_us.begin(), capture_us.end());
+        std::vector<size_t> behind;
+        for(size_t s=0; s<src.size(); ++s) {
+            if(capture_us[s] < newest - sync_tolerance_us) behind.push_back(s);
+        }
+        if(behind.empty()) {
+            TGRABANDPRINT("    IN SYNC after %ld rounds", n);
+            return true;
+        }
+        if(n == 0) {
+            pango_print_warn("JoinVideo: Source timestamps not within %lu us. Ignoring frames, trying to sync...\n", (unsigned long)sync_tolerance_us);
+        }
+
+        ForEachSource(behind, [&](size_t s){
+            for(size_t i=0; i<10 && capture_us[s] < newest - sync_tolerance_us; ++i) {
+                if(!src[s]->GrabNext(image+offsets[s],true)) break;
+                capture_us[s] = GetAdjustedCaptureTime(s);
+            }
+        });
+    }
+
+    const auto range = std::minmax_element(capture_us.begin(), capture_us.end());
+    TGRABANDPRINT("NOT IN SYNC oldest:%ld newest:%ld delta:%ld", *range.first, *range.second, (*range.second - *range.first));
+    return (*range.second - *range.first) <= sync_tolerance_us;
 }
 
 bool JoinVideo::GrabNext(unsigned char* image, bool wait)
 {
+    // Time is spent almost entirely on the inputs, so counts as waiting
+    PANGO_TRACE_SCOPE("JoinVideo::GrabNext", "video");
+    VideoStageTimer::Grab timing(*this);
+    const bool ok = GrabNextJoined(image, wait);
+    if(ok) timing.Frame(StageWait);
+    return ok;
+}
+
+bool JoinVideo::GrabNewest(unsigned char* image, bool wait)
+{
+    PANGO_TRACE_SCOPE("JoinVideo::GrabNewest", "video");
+    VideoStageTimer::Grab timing(*this);
+    const bool ok = GrabNewestJoined(image, wait);
+    if(ok) timing.Frame(StageWait);
+    return ok;
+}
+
+bool JoinVideo::GrabNextJoined(unsigned char* image, bool wait)
+{
+    if(match_depth > 0 && sync_tolerance_us > 0) {
+        return GrabNextMatched(image, wait);
+    }
+
+    if(!workers.empty()) {
+        return GrabNextParallel(image, wait);
+    }
+
     size_t offset = 0;
     std::vector<size_t> offsets(src.size(), 0);
     std::vector<int64_t> capture_us(src.size(), 0);
@@ -210,6 +534,7 @@ bool JoinVideo::GrabNext(unsigned char* image, bool wait)
                     {
                         if(src[s]->GrabNext(image+offsets[s],true)) {
                             capture_us[s] = GetAdjustedCaptureTime(s);
+                            StageRejected(1);
                         }
                     }
                 }
@@ -219,6 +544,7 @@ bool JoinVideo::GrabNext(unsigned char* image, bool wait)
         // Check sync again
         range = std::minmax_element(capture_us.begin(), capture_us.end());
         if( (*range.second - *range.first) > sync_tolerance_us) {
+            StageRejected(src.size());
             TGRABANDPRINT("NOT IN SYNC oldest:%ld newest:%ld delta:%ld", *range.first, *range.second, (*range.second - *range.first));
             return false;
         } else {
@@ -237,12 +563,28 @@ bool AllInterfacesAreBufferAware(std::vector<VideoInterface*>& src){
   return true;
 }
 
-bool JoinVideo::GrabNewest( unsigned char* image, bool wait )
+bool JoinVideo::GrabNewestJoined( unsigned char* image, bool wait )
 {
   // TODO: Tidy to correspond to GrabNext()
   TSTART()
   DBGPRINT("Entering GrabNewest:");
-  if(AllInterfacesAreBufferAware(src)) {
+  if(match_depth > 0 && sync_tolerance_us > 0) {
+      // Only the newest tuple is wanted, so give up on frames older than the
+      // newest each source can offer by more than the tolerance.
+      for(size_t s=0; s<src.size(); ++s) TopUpFrames(s);
+      int64_t oldest_newest = std::numeric_limits<int64_t>::max();
+      for(const auto& q : pending) {
+          if(!q.empty()) oldest_newest = std::min(oldest_newest, q.back().capture_us);
+      }
+      for(auto& q : pending) {
+          while(q.size() > 1 && q.front().capture_us < oldest_newest - sync_tolerance_us) {
+              q.pop_front();
+              ++frames_dropped;
+              StageRejected(1);
+          }
+      }
+      return GrabNextMatched(image, wait);
+  }else if(AllInterfacesAreBufferAware(src)) {
      DBGPRINT("All interfaces are BufferAwareVideoInterface.")
      unsigned int minN = std::numeric_limits<unsigned int>::max();
      //Find smallest number of frames it is safe to drop.
@@ -266,7 +608,7 @@ bool JoinVideo::GrabNewest( unsigned char* image, bool wait )
          }
          TGRABANDPRINT("Dropping %u frames on each interface took ",(minN -1));
      }
-     return GrabNext(image, wait);
+     return GrabNextJoined(image, wait);
   } else {
       DBGPRINT("NOT all interfaces are BufferAwareVideoInterface.")
       // Simply calling GrabNewest on the child streams might cause loss of sync,
@@ -318,6 +660,11 @@ bool JoinVideo::GrabNewest( unsigned char* image, bool wait )
       }
       TGRABANDPRINT("Stream >=1 grab took ");
 
+      // All but the last frame of each backlog were skipped over
+      if(first_stream_backlog > 1) {
+          StageDropped((uint64_t)(first_stream_backlog - 1) * src.size());
+      }
+
       if(sync_tolerance_us > 0) {
           if(std::abs(newest - oldest) > sync_tolerance_us){
               pango_print_warn("Join timestamps not within %lu us trying to sync\n", (unsigned long)sync_tolerance_us);
@@ -327,6 +674,7 @@ bool JoinVideo::GrabNewest( unsigned char* image, bool wait )
                       if(reception_times[s] < (newest - sync_tolerance_us)) {
                           VideoInterface& vid = *src[s];
                           if(vid.GrabNewest(image+offsets[s],false)) {
+                              StageRejected(1);
                               rt = GetAdjustedCaptureTime(s);
                               if(newest < rt) newest = rt;
                               if(oldest > rt) oldest = rt;
@@ -338,6 +686,7 @@ bool JoinVideo::GrabNewest( unsigned char* image, bool wait )
           }
 
           if(std::abs(newest - oldest) > sync_tolerance_us ) {
+              StageRejected(src.size());
               TGRABANDPRINT("NOT IN SYNC newest:%ld oldest:%ld delta:%ld syncing took ", newest, oldest, (newest - oldest));
               return false;
           } else {
@@ -356,6 +705,90 @@ std::vector<VideoInterface*>& JoinVideo::InputStreams()
     return src;
 }
 
+const picojson::value& JoinVideo::DeviceProperties() const
+{
+    // Same aggregate as GetVideoDeviceProperties() would build for a plain filter
+    picojson::value streams;
+    for(size_t s=0; s < src.size(); ++s) {
+        const picojson::value dev_props = GetVideoDeviceProperties(src[s]);
+        if(dev_props.contains("streams")) {
+            const picojson::value& dev_streams = dev_props["streams"];
+            for(size_t i=0; i < dev_streams.size(); ++i) {
+                streams.push_back(dev_streams[i]);
+            }
+        }else{
+            streams.push_back(dev_props);
+        }
+    }
+
+    device_properties = streams.size() ? streams[0] : picojson::value();
+    if(streams.size() > 1) {
+        device_properties["streams"] = streams;
+    }
+    return device_properties;
+}
+
+const picojson::value& JoinVideo::FrameProperties() const
+{
+    if(match_depth > 0 && sync_tolerance_us > 0) {
+        // Of the frames matched in GrabNextMatched
+        picojson::value streams;
+        for(const PendingFrame& frame : matched) {
+            const picojson::value frame_props = frame.frame_properties.is<picojson::null>() ?
+                frame.metadata.ToJson() : frame.frame_properties;
+            if(frame_props.contains("streams")) {
+                const picojson::value& frame_streams = frame_props["streams"];
+                for(size_t i=0; i < frame_streams.size(); ++i) {
+                    streams.push_back(frame_streams[i]);
+                }
+            }else{
+                streams.push_back(frame_props);
+            }
+        }
+
+        frame_properties = streams.size() ? streams[0] : picojson::value();
+        if(streams.size() > 1) {
+            frame_properties["streams"] = streams;
+        }
+
+        const uint64_t frames_total = frames_dropped + frames_matched * src.size();
+        picojson::value stats;
+        stats["matched"] = frames_matched;
+        stats["dropped"] = frames_dropped;
+        stats["drop_rate"] = frames_total ? (double)frames_dropped / (double)frames_total : 0.0;
+        stats["skew_us"] = last_skew_us;
+        stats["mean_skew_us"] = frames_matched ? skew_sum_us / (double)frames_matched : 0.0;
+        frame_properties["join"] = stats;
+
+        if(StageStatsEnabled()) {
+            frame_properties[PANGO_STAGE_TIMING] = VideoStageStatsJson(GetVideoStageStats(const_cast<JoinVideo*>(this), true));
+        }
+        return frame_properties;
+    }
+
+    picojson::value streams;
+    for(size_t s=0; s < src.size(); ++s) {
+        const picojson::value frame_props = GetVideoFrameProperties(src[s]);
+        if(frame_props.contains("streams")) {
+            const picojson::value& frame_streams = frame_props["streams"];
+            for(size_t i=0; i < frame_streams.size(); ++i) {
+                streams.push_back(frame_streams[i]);
+            }
+        }else{
+            streams.push_back(frame_props);
+        }
+    }
+
+    frame_properties = streams.size() ? streams[0] : picojson::value();
+    if(streams.size() > 1) {
+        frame_properties["streams"] = streams;
+    }
+    if(StageStatsEnabled()) {
+        frame_properties[PANGO_STAGE_TIMING] = VideoStageStatsJson(GetVideoStageStats(const_cast<JoinVideo*>(this), true));
+    }
+    return frame_properties;
+}
+
 std::vector<std::string> SplitBrackets(const std::string src, char open = '{', char close = '}')
 {
     std::vector<std::string> splits;
@@ -395,6 +828,15 @@ PANGOLIN_REGISTER_FACTORY(JoinVideo)
             // Bandwidth used to compute exposure end time from reception time for sync logic
             const double transfer_bandwidth_gbps = uri.Get<double>("transfer_bandwidth_gbps", 0.0);
 
+            // Grab from each source concurrently
+            const bool parallel = uri.Get<bool>("parallel", false);
+
+            // Number of frames per source to hold for timestamp matching (needs sync_tolerance_us)
+            const size_t match_depth = uri.Get<size_t>("match_depth", 0);
+
+            // Sync on capture times estimated from each source's device clock
+            const bool clock_sync = uri.Get<bool>("clock_sync", false);
+
             if(uris.size() == 0) {
                 throw VideoException("No VideoSources found in join URL.", "Specify videos to join with curly braces, e.g. join://{test://}{test://}");
             }
@@ -402,13 +844,19 @@ PANGOLIN_REGISTER_FACTORY(JoinVideo)
             std::vector<std::unique_ptr<VideoInterface>> src;
             for(size_t i=0; i<uris.size(); ++i) {
                 src.push_back( pangolin::OpenVideo(uris[i]) );
+                if(clock_sync) {
+                    src.back().reset( new ClockSyncVideo(src.back()) );
+                }
             }
 
             JoinVideo* video_raw = new JoinVideo(src);
+            video_raw->SetParallelGrab(parallel);
 
             if(sync_tol_us>0) {
                 if(!video_raw->Sync(sync_tol_us, transfer_bandwidth_gbps)) {
                     pango_print_error("WARNING: not all streams in join support sync_tolerance_us option. Not using tolerance.\n");
+                }else{
+                    video_raw->SetMatchDepth(match_depth);
                 }
             }
 
@@ -27,6 +27,7 @@
 
 #include <pangolin/video/drivers/merge.h>
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/memcpy.h>
 #include <pangolin/video/iostream_operators.h>
 #include <pangolin/plot/range.h>
 #include <assert.h> // assert()
@@ -36,8 +37,8 @@
 namespace pangolin
 {
 
-MergeVideo::MergeVideo(std::unique_ptr<VideoInterface>& src_, const std::vector<Point>& stream_pos, size_t w = 0, size_t h = 0 )
-    : src( std::move(src_) ), buffer(new uint8_t[src->SizeBytes()]), stream_pos(stream_pos)
+MergeVideo::MergeVideo(std::unique_ptr<VideoInterface>& src_, const std::vector<Point>& stream_pos, size_t w = 0, size_t h = 0, bool view_requested )
+    : VideoStageTimer("merge"), src( std::move(src_) ), stream_pos(stream_pos), view(false)
 {
     videoin.push_back(src.get());
 
@@ -47,7 +48,7 @@ MergeVideo::MergeVideo(std::unique_ptr<VideoInterface>& src_, const std::vector<
     assert(src->Streams().size() > 0);
     const PixelFormat fmt = src->Streams()[0].PixFormat();
     for(size_t i=1; i < src->Streams().size(); ++i) {
-        assert(src->Streams()[i].PixFormat().format == fmt.format);
+        assert(src->Streams()[i].PixFormat() == fmt);
     }
 
     // Compute buffer regions for data copying.
@@ -66,8 +67,55 @@ MergeVideo::MergeVideo(std::unique_ptr<VideoInterface>& src_, const std::vector<
         h = r.y.max;
     }
 
-    size_bytes = w*h*fmt.bpp/8;
-    streams.emplace_back(fmt,w,h,w*fmt.bpp/8,(unsigned char*)0);
+    StreamInfo layout;
+    if(view_requested) {
+        view = ViewLayout(fmt, w, h, layout);
+        if(!view) {
+            pango_print_warn("MergeVideo: source streams can't be viewed in place, copying instead.\n");
+        }
+    }
+
+    if(view) {
+        size_bytes = src->SizeBytes();
+        streams.push_back(layout);
+    }else{
+        size_bytes = w*h*fmt.bpp/8;
+        streams.emplace_back(fmt,w,h,w*fmt.bpp/8,(unsigned char*)0);
+    }
+}
+
+// The merged image can be described over the source buffer when every
+// stream shares one pitch and sits at the same origin once its position
+// within the merged image is subtracted.
+bool MergeVideo::ViewLayout(const PixelFormat& fmt, size_t w, size_t h, StreamInfo& layout) const
+{
+    const std::vector<StreamInfo>& in = src->Streams();
+    const size_t pitch = in[0].Pitch();
+    if(w*fmt.bpp > 8*pitch) {
+        return false;
+    }
+
+    size_t origin = 0;
+    for(size_t i=0; i < in.size(); ++i) {
+        const size_t offset = (size_t)in[i].Offset();
+        const size_t x_bits = stream_pos[i].x * fmt.bpp;
+        const size_t rel = stream_pos[i].y * pitch + x_bits / 8;
+        if(in[i].Pitch() != pitch || x_bits % 8 || offset < rel) {
+            return false;
+        }
+        if(i == 0) {
+            origin = offset - rel;
+        }else if(offset - rel != origin) {
+            return false;
+        }
+    }
+
+    if(origin + (h-1)*pitch + (w*fmt.bpp+7)/8 > src->SizeBytes()) {
+        return false;
+    }
+
+    layout = StreamInfo(fmt, w, h, pitch, (unsigned char*)0 + origin);
+    return true;
 }
 
 MergeVideo::~MergeVideo()
@@ -108,30 +156,55 @@ void MergeVideo::CopyBuffer(unsigned char* dst_bytes, unsigned char* src_bytes)
         const StreamInfo& src_stream = src->Streams()[i];
         const Image<unsigned char> src_image = src_stream.StreamImage(src_bytes);
         const Point& p = stream_pos[i];
-        for(size_t y=0; y < src_stream.Height(); ++y) {
-            // Copy row from src to dst
-            std::memcpy(
-                dst_image.RowPtr(y + p.y) + p.x * dst_pix_bytes,
-                src_image.RowPtr(y), src_stream.RowBytes()
-            );
-        }
+        FramePitchedCopy(
+            (char*)dst_image.RowPtr(p.y) + p.x * dst_pix_bytes, dst_image.pitch,
+            (const char*)src_image.ptr, src_image.pitch,
+            src_stream.RowBytes(), src_stream.Height()
+        );
     }
 }
 
+FrameLease MergeVideo::CopyLease(const FrameLease& in)
+{
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+    CopyBuffer(buffer->get(), in.data());
+    return FrameLease(buffer->get(), size_bytes, [buffer](){});
+}
+
 //! Implement VideoInput::GrabNext()
 bool MergeVideo::GrabNext( unsigned char* image, bool wait )
 {
-    const bool success = src->GrabNext(buffer.get(), wait);
-    if(success) CopyBuffer(image, buffer.get());
-    return success;
+    VideoStageTimer::Grab timing(*this);
+    if(view) {
+        const bool success = src->GrabNext(image, wait);
+        if(success) timing.Frame(StageWait);
+        return success;
+    }
+    const FrameLease in = pangolin::GrabNextLease(*src, wait);
+    timing.Mark(StageWait);
+    if(in) {
+        CopyBuffer(image, in.data());
+        timing.Frame(StageCopy);
+    }
+    return in.IsValid();
 }
 
 //! Implement VideoInput::GrabNewest()
 bool MergeVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    const bool success = src->GrabNewest(buffer.get(), wait);
-    if(success) CopyBuffer(image, buffer.get());
-    return success;
+    VideoStageTimer::Grab timing(*this);
+    if(view) {
+        const bool success = src->GrabNewest(image, wait);
+        if(success) timing.Frame(StageWait);
+        return success;
+    }
+    const FrameLease in = pangolin::GrabNewestLease(*src, wait);
+    timing.Mark(StageWait);
+    if(in) {
+        CopyBuffer(image, in.data());
+        timing.Frame(StageCopy);
+    }
+    return in.IsValid();
 }
 
 std::vector<VideoInterface*>& MergeVideo::InputStreams()
@@ -139,11 +212,42 @@ std::vector<VideoInterface*>& MergeVideo::InputStreams()
     return videoin;
 }
 
+//! Implement VideoLeaseInterface::GrabNextLease()
+FrameLease MergeVideo::GrabNextLease( bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    FrameLease in = pangolin::GrabNextLease(*src, wait);
+    timing.Mark(StageWait);
+    if(in && !view) {
+        in = CopyLease(in);
+        timing.Frame(StageCopy);
+    }else if(in) {
+        timing.Frame(StageWait);
+    }
+    return in;
+}
+
+//! Implement VideoLeaseInterface::GrabNewestLease()
+FrameLease MergeVideo::GrabNewestLease( bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    FrameLease in = pangolin::GrabNewestLease(*src, wait);
+    timing.Mark(StageWait);
+    if(in && !view) {
+        in = CopyLease(in);
+        timing.Frame(StageCopy);
+    }else if(in) {
+        timing.Frame(StageWait);
+    }
+    return in;
+}
+
 PANGOLIN_REGISTER_FACTORY(MergeVideo)
 {
     struct MergeVideoFactory : public FactoryInterface<VideoInterface> {
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(0,0));
+            const bool view = uri.Get<bool>("view", false);
 
             std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
             std::vector<Point> points;
@@ -155,7 +259,7 @@ PANGOLIN_REGISTER_FACTORY(MergeVideo)
                 p.x += si.Width();
             }
 
-            return std::unique_ptr<VideoInterface>(new MergeVideo(subvid, points, dim.x, dim.y));
+            return std::unique_ptr<VideoInterface>(new MergeVideo(subvid, points, dim.x, dim.y, view));
         }
     };
 
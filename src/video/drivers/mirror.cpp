@@ -29,11 +29,29 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  define MIRROR_HAVE_SSE2
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define MIRROR_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
 namespace pangolin
 {
 
+namespace
+{
+bool SwapsAxes(MirrorOptions option)
+{
+    return option == MirrorOptionsTranspose || option == MirrorOptionsRotate90 || option == MirrorOptionsRotate270;
+}
+}
+
 MirrorVideo::MirrorVideo(std::unique_ptr<VideoInterface>& src, const std::vector<MirrorOptions>& flips)
-    : videoin(std::move(src)), flips(flips), size_bytes(0),buffer(0)
+    : VideoStageTimer("mirror"), videoin(std::move(src)), flips(flips), size_bytes(0)
 {
     if(!videoin) {
         throw VideoException("MirrorVideo: VideoInterface in must not be null");
@@ -43,12 +61,26 @@ MirrorVideo::MirrorVideo(std::unique_ptr<VideoInterface>& src, const std::vector
 
     streams = videoin->Streams();
     size_bytes = videoin->SizeBytes();
-    buffer = new unsigned char[size_bytes];
+
+    if(std::any_of(flips.begin(), flips.end(), SwapsAxes)) {
+        // Lay streams out afresh, as some swap width and height
+        size_bytes = 0;
+        for(size_t s=0; s < streams.size(); ++s) {
+            const StreamInfo& si = videoin->Streams()[s];
+            const bool swap = s < flips.size() && SwapsAxes(flips[s]);
+            const size_t w = swap ? si.Height() : si.Width();
+            const size_t h = swap ? si.Width() : si.Height();
+            const size_t pitch = w * si.PixFormat().bpp / 8;
+            streams[s] = StreamInfo(si.PixFormat(), w, h, pitch, (unsigned char*)0 + size_bytes);
+            size_bytes += h * pitch;
+        }
+    }
+
+    fused = std::unique_ptr<FusedRowFilter>(new FusedRowFilter(*this));
 }
 
 MirrorVideo::~MirrorVideo()
 {
-    delete[] buffer;
 }
 
 //! Implement VideoInput::Start()
@@ -104,19 +136,226 @@ void FlipY(
     }
 }
 
+namespace
+{
+
+// Pixel of B bytes, so that copies are specialised on size at compile time
+template<size_t B>
+struct Pixel
+{
+    unsigned char b[B];
+};
+
+template<size_t B>
+void FlipXRow(unsigned char* out, const unsigned char* in, size_t w)
+{
+    Pixel<B>* po = (Pixel<B>*)out + w;
+    const Pixel<B>* pi = (const Pixel<B>*)in;
+    for(size_t x=0; x < w; ++x) {
+        *(--po) = pi[x];
+    }
+}
+
+void FlipXRow(unsigned char* out, const unsigned char* in, size_t w, size_t bytes_per_pixel)
+{
+    switch(bytes_per_pixel) {
+    case 1:  FlipXRow<1>(out, in, w); break;
+    case 2:  FlipXRow<2>(out, in, w); break;
+    case 3:  FlipXRow<3>(out, in, w); break;
+    case 4:  FlipXRow<4>(out, in, w); break;
+    case 6:  FlipXRow<6>(out, in, w); break;
+    case 8:  FlipXRow<8>(out, in, w); break;
+    case 12: FlipXRow<12>(out, in, w); break;
+    case 16: FlipXRow<16>(out, in, w); break;
+    default:
+        for(size_t x=0; x < w; ++x) {
+            std::memcpy(out + (w-1-x)*bytes_per_pixel, in + x*bytes_per_pixel, bytes_per_pixel);
+        }
+    }
+}
+
+#if defined(MIRROR_HAVE_SSE2) || defined(MIRROR_HAVE_NEON)
+
+// In register transposes, written once in terms of interleaving the low or high
+// halves of two vectors with element sizes of 8 to 64 bits.
+#if defined(MIRROR_HAVE_SSE2)
+typedef __m128i V;
+inline V Load(const unsigned char* p)         { return _mm_loadu_si128((const __m128i*)p); }
+inline V LoadLo(const unsigned char* p)       { return _mm_loadl_epi64((const __m128i*)p); }
+inline void Store(unsigned char* p, V v)      { _mm_storeu_si128((__m128i*)p, v); }
+inline void StoreLo(unsigned char* p, V v)    { _mm_storel_epi64((__m128i*)p, v); }
+inline void StoreHi(unsigned char* p, V v)    { _mm_storel_epi64((__m128i*)p, _mm_unpackhi_epi64(v, v)); }
+inline V Lo8(V a, V b)  { return _mm_unpacklo_epi8(a, b); }
+inline V Lo16(V a, V b) { return _mm_unpacklo_epi16(a, b); }
+inline V Hi16(V a, V b) { return _mm_unpackhi_epi16(a, b); }
+inline V Lo32(V a, V b) { return _mm_unpacklo_epi32(a, b); }
+inline V Hi32(V a, V b) { return _mm_unpackhi_epi32(a, b); }
+inline V Lo64(V a, V b) { return _mm_unpacklo_epi64(a, b); }
+inline V Hi64(V a, V b) { return _mm_unpackhi_epi64(a, b); }
+#else
+typedef uint8x16_t V;
+inline V Load(const unsigned char* p)         { return vld1q_u8(p); }
+inline V LoadLo(const unsigned char* p)       { return vcombine_u8(vld1_u8(p), vdup_n_u8(0)); }
+inline void Store(unsigned char* p, V v)      { vst1q_u8(p, v); }
+inline void StoreLo(unsigned char* p, V v)    { vst1_u8(p, vget_low_u8(v)); }
+inline void StoreHi(unsigned char* p, V v)    { vst1_u8(p, vget_high_u8(v)); }
+inline V Lo8(V a, V b)  { return vzip1q_u8(a, b); }
+inline V Lo16(V a, V b) { return vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b))); }
+inline V Hi16(V a, V b) { return vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b))); }
+inline V Lo32(V a, V b) { return vreinterpretq_u8_u32(vzip1q_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b))); }
+inline V Hi32(V a, V b) { return vreinterpretq_u8_u32(vzip2q_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b))); }
+inline V Lo64(V a, V b) { return vreinterpretq_u8_u64(vzip1q_u64(vreinterpretq_u64_u8(a), vreinterpretq_u64_u8(b))); }
+inline V Hi64(V a, V b) { return vreinterpretq_u8_u64(vzip2q_u64(vreinterpretq_u64_u8(a), vreinterpretq_u64_u8(b))); }
+#endif
+
+// Transpose a square block of N x N pixels of B bytes, returning N, or 0 if
+// there's no vector kernel for B.
+template<size_t B> struct TransposeBlock
+{
+    static const size_t N = 0;
+    static void Run(unsigned char*, ptrdiff_t, const unsigned char*, ptrdiff_t) {}
+};
+
+template<> struct TransposeBlock<1>
+{
+    static const size_t N = 8;
+    static void Run(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch)
+    {
+        const V t0 = Lo8(LoadLo(in + 0*in_pitch), LoadLo(in + 1*in_pitch));
+        const V t1 = Lo8(LoadLo(in + 2*in_pitch), LoadLo(in + 3*in_pitch));
+        const V t2 = Lo8(LoadLo(in + 4*in_pitch), LoadLo(in + 5*in_pitch));
+        const V t3 = Lo8(LoadLo(in + 6*in_pitch), LoadLo(in + 7*in_pitch));
+        const V u0 = Lo16(t0, t1), u1 = Hi16(t0, t1);
+        const V u2 = Lo16(t2, t3), u3 = Hi16(t2, t3);
+        const V o01 = Lo32(u0, u2), o23 = Hi32(u0, u2);
+        const V o45 = Lo32(u1, u3), o67 = Hi32(u1, u3);
+        StoreLo(out + 0*out_pitch, o01); StoreHi(out + 1*out_pitch, o01);
+        StoreLo(out + 2*out_pitch, o23); StoreHi(out + 3*out_pitch, o23);
+        StoreLo(out + 4*out_pitch, o45); StoreHi(out + 5*out_pitch, o45);
+        StoreLo(out + 6*out_pitch, o67); StoreHi(out + 7*out_pitch, o67);
+    }
+};
+
+template<> struct TransposeBlock<2>
+{
+    static const size_t N = 8;
+    static void Run(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch)
+    {
+        V r[8];
+        for(int i=0; i < 8; ++i) r[i] = Load(in + i*in_pitch);
+        const V t0 = Lo16(r[0], r[1]), t1 = Hi16(r[0], r[1]);
+        const V t2 = Lo16(r[2], r[3]), t3 = Hi16(r[2], r[3]);
+        const V t4 = Lo16(r[4], r[5]), t5 = Hi16(r[4], r[5]);
+        const V t6 = Lo16(r[6], r[7]), t7 = Hi16(r[6], r[7]);
+        const V u0 = Lo32(t0, t2), u1 = Hi32(t0, t2), u2 = Lo32(t1, t3), u3 = Hi32(t1, t3);
+        const V u4 = Lo32(t4, t6), u5 = Hi32(t4, t6), u6 = Lo32(t5, t7), u7 = Hi32(t5, t7);
+        Store(out + 0*out_pitch, Lo64(u0, u4)); Store(out + 1*out_pitch, Hi64(u0, u4));
+        Store(out + 2*out_pitch, Lo64(u1, u5)); Store(out + 3*out_pitch, Hi64(u1, u5));
+        Store(out + 4*out_pitch, Lo64(u2, u6)); Store(out + 5*out_pitch, Hi64(u2, u6));
+        Store(out + 6*out_pitch, Lo64(u3, u7)); Store(out + 7*out_pitch, Hi64(u3, u7));
+    }
+};
+
+template<> struct TransposeBlock<4>
+{
+    static const size_t N = 4;
+    static void Run(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch)
+    {
+        const V r0 = Load(in + 0*in_pitch), r1 = Load(in + 1*in_pitch);
+        const V r2 = Load(in + 2*in_pitch), r3 = Load(in + 3*in_pitch);
+        const V t0 = Lo32(r0, r1), t1 = Hi32(r0, r1);
+        const V t2 = Lo32(r2, r3), t3 = Hi32(r2, r3);
+        Store(out + 0*out_pitch, Lo64(t0, t2)); Store(out + 1*out_pitch, Hi64(t0, t2));
+        Store(out + 2*out_pitch, Lo64(t1, t3)); Store(out + 3*out_pitch, Hi64(t1, t3));
+    }
+};
+
+#else
+
+template<size_t B> struct TransposeBlock
+{
+    static const size_t N = 0;
+    static void Run(unsigned char*, ptrdiff_t, const unsigned char*, ptrdiff_t) {}
+};
+
+#endif // MIRROR_HAVE_SSE2 || MIRROR_HAVE_NEON
+
+// Transpose w x h pixels of in into h x w pixels of out, one element at a time
+template<size_t B>
+void TransposeScalar(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch, size_t w, size_t h)
+{
+    for(size_t x=0; x < w; ++x) {
+        Pixel<B>* po = (Pixel<B>*)(out + (ptrdiff_t)x*out_pitch);
+        const unsigned char* pi = in + x*B;
+        for(size_t y=0; y < h; ++y) {
+            po[y] = *(const Pixel<B>*)(pi + (ptrdiff_t)y*in_pitch);
+        }
+    }
+}
+
+// Transpose in tiles small enough that the rows read and written all stay in
+// cache, using in register transposes of blocks within each tile where we can.
+// Pitches may be negative to read or write rows bottom up.
+template<size_t B>
+void TransposeTiled(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch, size_t w, size_t h)
+{
+    const size_t tile = 32;
+    const size_t n = TransposeBlock<B>::N;
+
+    for(size_t ty=0; ty < h; ty += tile) {
+        const size_t th = std::min(tile, h - ty);
+        for(size_t tx=0; tx < w; tx += tile) {
+            const size_t tw = std::min(tile, w - tx);
+            unsigned char* tout = out + (ptrdiff_t)tx*out_pitch + ty*B;
+            const unsigned char* tin = in + (ptrdiff_t)ty*in_pitch + tx*B;
+
+            size_t bw = 0, bh = 0;
+            if(n) {
+                bw = tw - tw % n;
+                bh = th - th % n;
+                for(size_t y=0; y < bh; y += n) {
+                    for(size_t x=0; x < bw; x += n) {
+                        TransposeBlock<B>::Run(tout + (ptrdiff_t)x*out_pitch + y*B, out_pitch, tin + (ptrdiff_t)y*in_pitch + x*B, in_pitch);
+                    }
+                }
+            }
+
+            // Right and bottom edges of the tile not covered by whole blocks
+            TransposeScalar<B>(tout + (ptrdiff_t)bw*out_pitch, out_pitch, tin + bw*B, in_pitch, tw - bw, th);
+            TransposeScalar<B>(tout + bh*B, out_pitch, tin + (ptrdiff_t)bh*in_pitch, in_pitch, bw, th - bh);
+        }
+    }
+}
+
+void Transpose(unsigned char* out, ptrdiff_t out_pitch, const unsigned char* in, ptrdiff_t in_pitch, size_t w, size_t h, size_t bytes_per_pixel)
+{
+    switch(bytes_per_pixel) {
+    case 1:  TransposeTiled<1>(out, out_pitch, in, in_pitch, w, h); break;
+    case 2:  TransposeTiled<2>(out, out_pitch, in, in_pitch, w, h); break;
+    case 3:  TransposeTiled<3>(out, out_pitch, in, in_pitch, w, h); break;
+    case 4:  TransposeTiled<4>(out, out_pitch, in, in_pitch, w, h); break;
+    case 6:  TransposeTiled<6>(out, out_pitch, in, in_pitch, w, h); break;
+    case 8:  TransposeTiled<8>(out, out_pitch, in, in_pitch, w, h); break;
+    case 12: TransposeTiled<12>(out, out_pitch, in, in_pitch, w, h); break;
+    case 16: TransposeTiled<16>(out, out_pitch, in, in_pitch, w, h); break;
+    default:
+        for(size_t x=0; x < w; ++x) {
+            for(size_t y=0; y < h; ++y) {
+                std::memcpy(out + (ptrdiff_t)x*out_pitch + y*bytes_per_pixel, in + (ptrdiff_t)y*in_pitch + x*bytes_per_pixel, bytes_per_pixel);
+            }
+        }
+    }
+}
+
+}
+
 void FlipX(
     Image<unsigned char>& img_out,
     const Image<unsigned char>& img_in,
     size_t bytes_per_pixel
 ) {
     for(size_t y=0; y < img_out.h; ++y) {
-        for(size_t x=0; x < img_out.w; ++x) {
-            memcpy(
-                img_out.RowPtr((int)y) + (img_out.w-1-x)*bytes_per_pixel,
-                img_in.RowPtr((int)y)  + x*bytes_per_pixel,
-                bytes_per_pixel
-            );
-        }
+        FlipXRow(img_out.RowPtr((int)y), img_in.RowPtr((int)y), img_out.w, bytes_per_pixel);
     }
 }
 
@@ -126,14 +365,8 @@ void FlipXY(
     size_t bytes_per_pixel
 ) {
     for(size_t y_out=0; y_out < img_out.h; ++y_out) {
-        for(size_t x=0; x < img_out.w; ++x) {
-            const size_t y_in = (img_in.h-1) - y_out;
-            memcpy(
-                img_out.RowPtr((int)y_out) + (img_out.w-1-x)*bytes_per_pixel,
-                img_in.RowPtr((int)y_in)   + x*bytes_per_pixel,
-                bytes_per_pixel
-            );
-        }
+        const size_t y_in = (img_in.h-1) - y_out;
+        FlipXRow(img_out.RowPtr((int)y_out), img_in.RowPtr((int)y_in), img_out.w, bytes_per_pixel);
     }
 }
 
@@ -154,6 +387,17 @@ void MirrorVideo::Process(unsigned char* buffer_out, const unsigned char* buffer
         case MirrorOptionsFlipXY:
             FlipXY(img_out, img_in, bytes_per_pixel);
             break;
+        case MirrorOptionsTranspose:
+            Transpose(img_out.ptr, img_out.pitch, img_in.ptr, img_in.pitch, img_in.w, img_in.h, bytes_per_pixel);
+            break;
+        case MirrorOptionsRotate90:
+            // Transpose of the input read bottom up
+            Transpose(img_out.ptr, img_out.pitch, img_in.RowPtr((int)img_in.h-1), -(ptrdiff_t)img_in.pitch, img_in.w, img_in.h, bytes_per_pixel);
+            break;
+        case MirrorOptionsRotate270:
+            // Transpose of the input written bottom up
+            Transpose(img_out.RowPtr((int)img_out.h-1), -(ptrdiff_t)img_out.pitch, img_in.ptr, img_in.pitch, img_in.w, img_in.h, bytes_per_pixel);
+            break;
         default:
             pango_print_warn("MirrorVideo::Process(): Invalid enum %i.\n", flips[s]);
         case MirrorOptionsNone:
@@ -163,11 +407,50 @@ void MirrorVideo::Process(unsigned char* buffer_out, const unsigned char* buffer
     }
 }
 
+//! Implement VideoRowFilterInterface::RowFilterInputRow()
+size_t MirrorVideo::RowFilterInputRow(size_t stream, size_t y) const
+{
+    const bool flip_y = flips[stream] == MirrorOptionsFlipY || flips[stream] == MirrorOptionsFlipXY;
+    return flip_y ? (streams[stream].Height()-1) - y : y;
+}
+
+//! Implement VideoRowFilterInterface::RowFilterProcess()
+void MirrorVideo::RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    const StreamInfo& si = streams[stream];
+    const Image<unsigned char> img_in(si.Width(), 1, si.Pitch(), (unsigned char*)in_row);
+    Image<unsigned char> img_out(si.Width(), 1, si.Pitch(), out_row);
+    const size_t bytes_per_pixel = si.PixFormat().bpp / 8;
+
+    if(flips[stream] == MirrorOptionsFlipX || flips[stream] == MirrorOptionsFlipXY) {
+        FlipX(img_out, img_in, bytes_per_pixel);
+    }else{
+        PitchedImageCopy(img_out, img_in, bytes_per_pixel);
+    }
+}
+
+//! Implement VideoRowFilterInterface::RowFilterSupported()
+bool MirrorVideo::RowFilterSupported() const
+{
+    return !std::any_of(flips.begin(), flips.end(), SwapsAxes);
+}
+
 //! Implement VideoInput::GrabNext()
 bool MirrorVideo::GrabNext( unsigned char* image, bool wait )
 {    
-    if(videoin->GrabNext(buffer,wait)) {
-        Process(image, buffer);
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNext(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNextLease(*videoin, wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -177,8 +460,19 @@ bool MirrorVideo::GrabNext( unsigned char* image, bool wait )
 //! Implement VideoInput::GrabNewest()
 bool MirrorVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    if(videoin->GrabNewest(buffer,wait)) {
-        Process(image, buffer);
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNewest(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNewestLease(*videoin, wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -232,6 +526,12 @@ std::istream& operator>> (std::istream &is, MirrorOptions &mirror)
         mirror = MirrorOptionsFlipY;
     }else if(!str_mirror.compare("FLIPXY")) {
         mirror = MirrorOptionsFlipXY;
+    }else if(!str_mirror.compare("TRANSPOSE")) {
+        mirror = MirrorOptionsTranspose;
+    }else if(!str_mirror.compare("ROTATE90")) {
+        mirror = MirrorOptionsRotate90;
+    }else if(!str_mirror.compare("ROTATE270")) {
+        mirror = MirrorOptionsRotate270;
     }else{
         pango_print_warn("Unknown mirror option %s.", str_mirror.c_str());
         mirror = MirrorOptionsNone;
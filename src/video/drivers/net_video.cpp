@@ -0,0 +1,529 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/memstreambuf.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/drivers/net_video.h>
+#include <pangolin/video/iostream_operators.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace pangolin
+{
+
+// Largest message accepted, guarding against garbage on the wire
+const uint64_t net_video_max_message_bytes = uint64_t(1) << 31;
+
+NetVideo::NetVideo(const std::string& address, bool udp, size_t queue, double timeout_s, size_t rcvbuf_bytes, const std::string& multicast_iface)
+    : _udp(udp), _queue(std::max<size_t>(1, queue)), _fd(-1), _disconnected(false),
+      _partial(false), _partial_id(0), _partial_received(0),
+      _size_bytes(0), _inter_frame(false), _dropped_frames(0), _closed(false), _quit(false)
+{
+    if(_udp) {
+        OpenUdp(address, rcvbuf_bytes, multicast_iface);
+    }else{
+        OpenTcp(address);
+    }
+
+    // Nothing can be decoded before the stream description arrives. Over udp
+    // it is repeated every second, so frames before it are skipped.
+    const basetime start = TimeNow();
+    while(_header_json.empty()) {
+        const double remaining_s = timeout_s - TimeDiff_s(start, TimeNow());
+        if(remaining_s <= 0.0 || _disconnected) {
+            close(_fd);
+            throw VideoException("NetVideo: no stream received from '" + address + "'");
+        }
+        if(ReceiveMessage((int)(remaining_s * 1000) + 1)) {
+            const net_video_msg_header& h = *reinterpret_cast<const net_video_msg_header*>(_msg.data());
+            if(h.type == NetVideoMsgHeader) {
+                const unsigned char* payload = _msg.data() + sizeof(h) + h.props_bytes;
+                _header_json.assign(reinterpret_cast<const char*>(payload), h.payload_bytes);
+            }
+        }
+    }
+
+    picojson::value json_header;
+    std::string err;
+    picojson::parse(json_header, _header_json.begin(), _header_json.end(), &err);
+    if(!err.empty() || !json_header["streams"].is<picojson::array>()) {
+        close(_fd);
+        throw VideoException("NetVideo: invalid stream description", err);
+    }
+    SetupStreams(json_header);
+
+    _thread = std::thread(&NetVideo::ReceiveLoop, this);
+}
+
+NetVideo::~NetVideo()
+{
+    {
+        std::lock_guard<std::mutex> l(_mutex);
+        _quit = true;
+    }
+    if(!_udp) shutdown(_fd, SHUT_RDWR);
+    if(_thread.joinable()) _thread.join();
+    close(_fd);
+}
+
+void NetVideo::OpenTcp(const std::string& address)
+{
+    sockaddr_storage addr;
+    const socklen_t len = NetVideoResolve(address, SOCK_STREAM, false, addr);
+    _fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if(_fd < 0) {
+        throw VideoException("NetVideo: unable to create socket", strerror(errno));
+    }
+    if(connect(_fd, reinterpret_cast<const sockaddr*>(&addr), len) != 0) {
+        const std::string err = strerror(errno);
+        close(_fd);
+        throw VideoException("NetVideo: unable to connect to '" + address + "'", err);
+    }
+}
+
+void NetVideo::OpenUdp(const std::string& address, size_t rcvbuf_bytes, const std::string& multicast_iface)
+{
+    sockaddr_storage addr;
+    const socklen_t len = NetVideoResolve(address, SOCK_DGRAM, true, addr);
+    const bool multicast = NetVideoIsMulticast(addr);
+
+    _fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+    if(_fd < 0) {
+        throw VideoException("NetVideo: unable to create socket", strerror(errno));
+    }
+
+    // Several receivers on one machine may listen to the same group
+    const int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // Frames arrive as bursts of datagrams, which mustn't overflow the socket
+    const int rcvbuf = (int)rcvbuf_bytes;
+    setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    // Bind multicast receivers to the group's port on any address
+    sockaddr_storage bind_addr = addr;
+    if(multicast) {
+        if(addr.ss_family == AF_INET) {
+            reinterpret_cast<sockaddr_in&>(bind_addr).sin_addr.s_addr = htonl(INADDR_ANY);
+        }else{
+            reinterpret_cast<sockaddr_in6&>(bind_addr).sin6_addr = in6addr_any;
+        }
+    }
+
+    int err = bind(_fd, reinterpret_cast<const sockaddr*>(&bind_addr), len);
+    if(!err && multicast) {
+        if(addr.ss_family == AF_INET) {
+            ip_mreq mreq;
+            mreq.imr_multiaddr = reinterpret_cast<const sockaddr_in&>(addr).sin_addr;
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if(!multicast_iface.empty() && inet_pton(AF_INET, multicast_iface.c_str(), &mreq.imr_interface) != 1) {
+                close(_fd);
+                throw VideoException("NetVideo: invalid multicast interface address", multicast_iface);
+            }
+            err = setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+        }else{
+            ipv6_mreq mreq;
+            mreq.ipv6mr_multiaddr = reinterpret_cast<const sockaddr_in6&>(addr).sin6_addr;
+            mreq.ipv6mr_interface = multicast_iface.empty() ? 0 : if_nametoindex(multicast_iface.c_str());
+            err = setsockopt(_fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+        }
+    }
+    if(err) {
+        const std::string msg = strerror(errno);
+        close(_fd);
+        throw VideoException("NetVideo: unable to listen on '" + address + "'", msg);
+    }
+
+    _datagram.resize(65536);
+}
+
+bool NetVideo::ValidMessage() const
+{
+    if(_msg.size() < sizeof(net_video_msg_header)) return false;
+    const net_video_msg_header& h = *reinterpret_cast<const net_video_msg_header*>(_msg.data());
+    return !std::memcmp(h.magic, net_video_magic, sizeof(net_video_magic)) && h.version == net_video_version;
+}
+
+bool NetVideo::ReceiveMessage(int timeout_ms)
+{
+    return _udp ? ReceiveDatagrams(timeout_ms) : ReceiveStreamMessage(timeout_ms);
+}
+
+bool NetVideo::ReceiveStreamMessage(int timeout_ms)
+{
+    if(!NetVideoPoll(_fd, timeout_ms)) {
+        return false;
+    }
+
+    _msg.resize(sizeof(net_video_msg_header));
+    if(!NetVideoRecvAll(_fd, _msg.data(), _msg.size())) {
+        _disconnected = true;
+        return false;
+    }
+    const net_video_msg_header h = *reinterpret_cast<const net_video_msg_header*>(_msg.data());
+    const uint64_t body_bytes = h.props_bytes + h.payload_bytes;
+    if(!ValidMessage() || body_bytes > net_video_max_message_bytes) {
+        // Out of step with the sender, there's no way to recover
+        pango_print_warn("NetVideo: invalid message received, closing connection.\n");
+        _disconnected = true;
+        return false;
+    }
+
+    _msg.resize(sizeof(h) + body_bytes);
+    if(!NetVideoRecvAll(_fd, _msg.data() + sizeof(h), body_bytes)) {
+        _disconnected = true;
+        return false;
+    }
+    return true;
+}
+
+bool NetVideo::ReceiveDatagrams(int timeout_ms)
+{
+    const basetime start = TimeNow();
+    while(true) {
+        const int remaining_ms = timeout_ms - (int)(TimeDiff_s(start, TimeNow()) * 1000);
+        if(remaining_ms <= 0 || !NetVideoPoll(_fd, remaining_ms)) {
+            return false;
+        }
+
+        const ssize_t n = recv(_fd, _datagram.data(), _datagram.size(), 0);
+        if(n < (ssize_t)sizeof(net_video_fragment_header)) {
+            continue;
+        }
+        const net_video_fragment_header fh = *reinterpret_cast<const net_video_fragment_header*>(_datagram.data());
+        const size_t bytes = n - sizeof(fh);
+        if(std::memcmp(fh.magic, net_video_magic, sizeof(net_video_magic)) ||
+           fh.msg_bytes < sizeof(net_video_msg_header) || fh.msg_bytes > net_video_max_message_bytes ||
+           fh.offset + bytes > fh.msg_bytes) {
+            continue;
+        }
+
+        if(!_partial || fh.msg_id != _partial_id) {
+            if(_partial && (int32_t)(fh.msg_id - _partial_id) < 0) {
+                // Straggler from a message we've given up on
+                continue;
+            }
+            if(_partial) {
+                // Lost part of the previous message, which is dropped
+                std::lock_guard<std::mutex> l(_mutex);
+                ++_dropped_frames;
+            }
+            _partial = true;
+            _partial_id = fh.msg_id;
+            _partial_received = 0;
+            _msg.resize(fh.msg_bytes);
+        }
+
+        std::memcpy(_msg.data() + fh.offset, _datagram.data() + sizeof(fh), bytes);
+        _partial_received += bytes;
+        if(_partial_received >= _msg.size()) {
+            _partial = false;
+            const net_video_msg_header& h = *reinterpret_cast<const net_video_msg_header*>(_msg.data());
+            if(ValidMessage() && sizeof(h) + h.props_bytes + h.payload_bytes == _msg.size()) {
+                return true;
+            }
+        }
+    }
+}
+
+void NetVideo::SetupStreams(const picojson::value& json_header)
+{
+    _device_properties = json_header["device"];
+    const picojson::value& json_streams = json_header["streams"];
+
+    for(size_t i = 0; i < json_streams.size(); ++i) {
+        const picojson::value& json_stream = json_streams[i];
+        std::string encoding = json_stream["encoding"].get<std::string>();
+
+        if(json_stream.contains("decoded")) {
+            const std::string compressed_encoding = encoding;
+            encoding = json_stream["decoded"].get<std::string>();
+            _stream_decoders.push_back(StreamEncoderFactory::I().GetDecoderInto(compressed_encoding, PixelFormatFromString(encoding), json_stream));
+            _inter_frame |= StreamEncoderFactory::IsInterFrame(compressed_encoding);
+        }else{
+            _stream_decoders.push_back(nullptr);
+        }
+
+        const StreamInfo si(
+            PixelFormatFromString(encoding),
+            json_stream["width"].get<int64_t>(),
+            json_stream["height"].get<int64_t>(),
+            json_stream["pitch"].get<int64_t>(),
+            (unsigned char*) 0 + json_stream["offset"].get<int64_t>()
+        );
+        _size_bytes = std::max(_size_bytes, (size_t)si.Offset() + si.SizeBytes());
+        _streams.push_back(si);
+    }
+}
+
+void NetVideo::DecodeStreams(const unsigned char* data, size_t size, unsigned char* image)
+{
+    memreadbuf buf(data, size);
+    std::istream is(&buf);
+    is.exceptions(std::ios::failbit | std::ios::badbit);
+
+    for(size_t s=0; s < _streams.size(); ++s) {
+        const StreamInfo& si = _streams[s];
+        const Image<unsigned char> dst = si.StreamImage(image);
+
+        if(_stream_decoders[s]) {
+            _stream_decoders[s](is, dst);
+        }else{
+            for(size_t row =0; row < dst.h; ++row) {
+                is.read((char*)dst.ptr + row*dst.pitch, si.RowBytes());
+            }
+        }
+    }
+}
+
+void NetVideo::ReceiveLoop()
+{
+    bool have_seq = false;
+    uint64_t next_seq = 0;
+    bool need_keyframe = false;
+    bool warned_header = false;
+
+    while(true) {
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            if(_quit) break;
+        }
+
+        if(!ReceiveMessage(100)) {
+            if(_disconnected) break;
+            continue;
+        }
+
+        const net_video_msg_header& h = *reinterpret_cast<const net_video_msg_header*>(_msg.data());
+        const unsigned char* props = _msg.data() + sizeof(h);
+        const unsigned char* payload = props + h.props_bytes;
+
+        if(h.type == NetVideoMsgHeader) {
+            if(!warned_header && _header_json.compare(0, std::string::npos, reinterpret_cast<const char*>(payload), h.payload_bytes)) {
+                pango_print_warn("NetVideo: sender's streams have changed, reopen to receive them.\n");
+                warned_header = true;
+            }
+            continue;
+        }else if(h.type != NetVideoMsgFrame) {
+            continue;
+        }
+
+        // Inter-frame streams can't decode past a lost frame until the next keyframe
+        if(have_seq && h.seq != next_seq) {
+            std::lock_guard<std::mutex> l(_mutex);
+            if(h.seq > next_seq) _dropped_frames += h.seq - next_seq;
+            need_keyframe = _inter_frame;
+        }
+        have_seq = true;
+        next_seq = h.seq + 1;
+        if(need_keyframe && !h.keyframe) {
+            std::lock_guard<std::mutex> l(_mutex);
+            ++_dropped_frames;
+            continue;
+        }
+        need_keyframe = false;
+
+        Frame frame;
+        frame.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+        try {
+            DecodeStreams(payload, h.payload_bytes, frame.buffer->get());
+        }catch(const std::exception& e) {
+            pango_print_warn("NetVideo: unable to decode frame %lu: %s\n", (unsigned long)h.seq, e.what());
+            need_keyframe = _inter_frame;
+            std::lock_guard<std::mutex> l(_mutex);
+            ++_dropped_frames;
+            continue;
+        }
+
+        frame.frame_properties = picojson::value(picojson::object());
+        if(h.props_bytes) {
+            picojson::value v;
+            std::string err;
+            const char* json = reinterpret_cast<const char*>(props);
+            picojson::parse(v, json, json + h.props_bytes, &err);
+            if(err.empty() && v.is<picojson::object>()) {
+                frame.frame_properties = v;
+            }
+        }
+        if(!frame.frame_properties.contains(PANGO_HOST_RECEPTION_TIME_US)) {
+            frame.frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(h.time_us);
+        }
+
+        {
+            std::lock_guard<std::mutex> l(_mutex);
+            _ready.push_back(std::move(frame));
+            while(_ready.size() > _queue) {
+                _ready.pop_front();
+                ++_dropped_frames;
+            }
+        }
+        _cv.notify_all();
+    }
+
+    std::lock_guard<std::mutex> l(_mutex);
+    _closed = true;
+    _cv.notify_all();
+}
+
+bool NetVideo::PopFrame(Frame& frame, bool newest, bool wait)
+{
+    std::unique_lock<std::mutex> l(_mutex);
+    if(wait) {
+        _cv.wait(l, [this](){ return !_ready.empty() || _closed; });
+    }
+    if(_ready.empty()) {
+        return false;
+    }
+
+    if(newest) {
+        _dropped_frames += _ready.size() - 1;
+        frame = std::move(_ready.back());
+        _ready.clear();
+    }else{
+        frame = std::move(_ready.front());
+        _ready.pop_front();
+    }
+    _frame_properties = frame.frame_properties;
+    return true;
+}
+
+size_t NetVideo::DroppedFrames() const
+{
+    std::lock_guard<std::mutex> l(_mutex);
+    return _dropped_frames;
+}
+
+bool NetVideo::SendInput(const picojson::value& event)
+{
+    if(_udp) {
+        return false;
+    }
+
+    const std::string props = event.serialize();
+    if(props.size() > net_video_max_input_bytes) {
+        return false;
+    }
+
+    net_video_msg_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, net_video_magic, sizeof(net_video_magic));
+    h.type = (uint8_t)NetVideoMsgInput;
+    h.version = net_video_version;
+    h.props_bytes = (uint32_t)props.size();
+    h.time_us = Time_us(TimeNow());
+
+    std::lock_guard<std::mutex> l(_send_mutex);
+    return NetVideoSendAll(_fd, reinterpret_cast<const unsigned char*>(&h), sizeof(h), true) &&
+           NetVideoSendAll(_fd, reinterpret_cast<const unsigned char*>(props.data()), props.size());
+}
+
+size_t NetVideo::SizeBytes() const
+{
+    return _size_bytes;
+}
+
+const std::vector<StreamInfo>& NetVideo::Streams() const
+{
+    return _streams;
+}
+
+void NetVideo::Start()
+{
+}
+
+void NetVideo::Stop()
+{
+}
+
+bool NetVideo::GrabNext(unsigned char* image, bool wait)
+{
+    Frame frame;
+    if(!PopFrame(frame, false, wait)) {
+        return false;
+    }
+    std::memcpy(image, frame.buffer->get(), _size_bytes);
+    return true;
+}
+
+bool NetVideo::GrabNewest(unsigned char* image, bool wait)
+{
+    Frame frame;
+    if(!PopFrame(frame, true, wait)) {
+        return false;
+    }
+    std::memcpy(image, frame.buffer->get(), _size_bytes);
+    return true;
+}
+
+FrameLease NetVideo::GrabNextLease(bool wait)
+{
+    Frame frame;
+    if(!PopFrame(frame, false, wait)) {
+        return FrameLease();
+    }
+    std::shared_ptr<FramePool::Buffer> buffer = frame.buffer;
+    return FrameLease(buffer->get(), _size_bytes, [buffer](){});
+}
+
+FrameLease NetVideo::GrabNewestLease(bool wait)
+{
+    Frame frame;
+    if(!PopFrame(frame, true, wait)) {
+        return FrameLease();
+    }
+    std::shared_ptr<FramePool::Buffer> buffer = frame.buffer;
+    return FrameLease(buffer->get(), _size_bytes, [buffer](){});
+}
+
+PANGOLIN_REGISTER_FACTORY(NetVideo)
+{
+    struct NetVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            return std::unique_ptr<VideoInterface>(new NetVideo(
+                uri.url, uri.scheme == "udp",
+                uri.Get<size_t>("queue", 2),
+                uri.Get<double>("timeout_s", 5.0),
+                uri.Get<size_t>("rcvbuf_mb", 8) * 1024 * 1024,
+                uri.Get<std::string>("iface", "")
+            ));
+        }
+    };
+
+    auto factory = std::make_shared<NetVideoFactory>();
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 10, "tcp");
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(factory, 10, "udp");
+}
+
+}
@@ -0,0 +1,585 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/drivers/net_video_output.h>
+#include <pangolin/video/iostream_operators.h>
+#include <pangolin/video/video_exception.h>
+#include <pangolin/video/video_interface.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+
+namespace pangolin
+{
+
+// Input events held for PopInputEvent, oldest dropped beyond this
+const size_t net_video_max_input_events = 1024;
+
+struct NetVideoOutput::Receiver
+{
+    Receiver(int fd) : fd(fd), need_keyframe(false), closed(false) {}
+
+    int fd;
+    std::deque<std::shared_ptr<const NetVideoMessage>> queue;
+    bool need_keyframe;
+    bool closed;
+    std::thread thread;
+    std::thread input_thread;
+};
+
+NetVideoOutput::NetVideoOutput(
+    const std::string& address, bool udp, const std::map<size_t, std::string>& stream_encoder_uris,
+    size_t queue, size_t datagram_bytes, int multicast_ttl, const std::string& multicast_iface, bool accept_input
+    )
+    : address(address), udp(udp), queue_frames(std::max<size_t>(1, queue)),
+      datagram_bytes(datagram_bytes), accept_input(accept_input), fd(-1), dest_len(0), next_msg_id(0),
+      total_frame_size(0), stream_encoder_uris(stream_encoder_uris),
+      inter_frame(false), frames_since_reset(0), seq(0), header_sent_us(0),
+      reset_encoders(false), dropped_frames(0), quit(false)
+{
+    if(datagram_bytes <= sizeof(net_video_fragment_header)) {
+        throw VideoException("NetVideoOutput: datagram size too small");
+    }
+
+    // Bind / resolve now so that bad addresses fail when opening the output
+    dest_len = NetVideoResolve(address, udp ? SOCK_DGRAM : SOCK_STREAM, !udp, dest);
+    fd = socket(dest.ss_family, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if(fd < 0) {
+        throw VideoException("NetVideoOutput: unable to create socket", strerror(errno));
+    }
+
+    if(udp) {
+        if(NetVideoIsMulticast(dest)) {
+            if(dest.ss_family == AF_INET) {
+                const unsigned char ttl = (unsigned char)multicast_ttl;
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+                if(!multicast_iface.empty()) {
+                    in_addr iface;
+                    if(inet_pton(AF_INET, multicast_iface.c_str(), &iface) != 1 ||
+                       setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) != 0) {
+                        close(fd);
+                        throw VideoException("NetVideoOutput: invalid multicast interface address", multicast_iface);
+                    }
+                }
+            }else{
+                const int hops = multicast_ttl;
+                setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+                if(!multicast_iface.empty()) {
+                    const unsigned int index = if_nametoindex(multicast_iface.c_str());
+                    if(!index || setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &index, sizeof(index)) != 0) {
+                        close(fd);
+                        throw VideoException("NetVideoOutput: invalid multicast interface name", multicast_iface);
+                    }
+                }
+            }
+        }
+    }else{
+        const int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(fd, reinterpret_cast<const sockaddr*>(&dest), dest_len) != 0 || listen(fd, 8) != 0) {
+            const std::string err = strerror(errno);
+            close(fd);
+            throw VideoException("NetVideoOutput: unable to listen on '" + address + "'", err);
+        }
+    }
+}
+
+NetVideoOutput::~NetVideoOutput()
+{
+    std::vector<std::shared_ptr<Receiver>> rs;
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        quit = true;
+        rs.swap(receivers);
+    }
+    cv.notify_all();
+
+    if(accept_thread.joinable()) accept_thread.join();
+    for(auto& r : rs) {
+        CloseReceiver(*r);
+    }
+    close(fd);
+}
+
+void NetVideoOutput::CloseReceiver(Receiver& r)
+{
+    // Unblock senders stuck on a receiver that stopped reading, and the
+    // input thread waiting on it
+    if(!udp) shutdown(r.fd, SHUT_RDWR);
+    if(r.thread.joinable()) r.thread.join();
+    if(r.input_thread.joinable()) r.input_thread.join();
+    if(!udp) close(r.fd);
+}
+
+const std::vector<StreamInfo>& NetVideoOutput::Streams() const
+{
+    return streams;
+}
+
+bool NetVideoOutput::IsPipe() const
+{
+    return false;
+}
+
+void NetVideoOutput::SetStreamEncoderParams(size_t i, const picojson::value& params)
+{
+    if(header) {
+        throw VideoException("Encoder parameters must be set before SetStreams");
+    }
+    stream_encoder_params[i] = params;
+}
+
+size_t NetVideoOutput::NumReceivers() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return receivers.size();
+}
+
+size_t NetVideoOutput::DroppedFrames() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return dropped_frames;
+}
+
+bool NetVideoOutput::PopInputEvent(picojson::value& event)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    if(input_events.empty()) {
+        return false;
+    }
+    event = std::move(input_events.front());
+    input_events.pop_front();
+    return true;
+}
+
+void NetVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::string& uri, const picojson::value& device_properties)
+{
+    if(header) {
+        throw std::runtime_error("Unable to add new streams");
+    }
+    streams = st;
+
+    // Same description as a pango log's video source
+    picojson::value json_header(picojson::object_type, false);
+    picojson::value& json_streams = json_header["streams"];
+    json_header["device"] = device_properties;
+    json_header["uri"] = uri;
+
+    stream_encoders.resize(streams.size());
+    keyframe_intervals.assign(streams.size(), 0);
+    total_frame_size = 0;
+    for(size_t i=0; i < streams.size(); ++i) {
+        const StreamInfo& si = streams[i];
+        total_frame_size = std::max(total_frame_size, (size_t) si.Offset() + si.SizeBytes());
+
+        picojson::value& json_stream = json_streams.push_back();
+        std::string encoder_name = si.PixFormat().Name();
+        if(stream_encoder_uris.find(i) != stream_encoder_uris.end() && !stream_encoder_uris[i].empty() ) {
+            json_stream["decoded"] = si.PixFormat().Name();
+            encoder_name = stream_encoder_uris[i];
+            const picojson::value& params = stream_encoder_params[i];
+            stream_encoders[i] = StreamEncoderFactory::I().GetEncoder(encoder_name, si.PixFormat(), params);
+            if(params.contains("zstd_dictionary")) {
+                json_stream["zstd_dictionary"] = params["zstd_dictionary"];
+            }
+            if(StreamEncoderFactory::IsInterFrame(encoder_name)) {
+                inter_frame = true;
+                keyframe_intervals[i] = StreamEncoderFactory::KeyframeInterval(params);
+                json_stream["keyframe_interval"] = keyframe_intervals[i];
+            }
+        }
+
+        json_stream["encoding"] = encoder_name;
+        json_stream["width"] = si.Width();
+        json_stream["height"] = si.Height();
+        json_stream["pitch"] = si.Pitch();
+        json_stream["offset"] = (size_t) si.Offset();
+    }
+
+    auto msg = std::make_shared<NetVideoMessage>();
+    {
+        std::ostream os(&msg->payload);
+        os << json_header.serialize();
+    }
+    FinishMessage(*msg, NetVideoMsgHeader, "", Time_us(TimeNow()));
+    header = msg;
+
+    if(udp) {
+        // A single receiver standing in for everyone listening on address.
+        AddReceiver(fd);
+        header_sent_us = Time_us(TimeNow());
+    }else{
+        accept_thread = std::thread(&NetVideoOutput::AcceptLoop, this);
+    }
+}
+
+void NetVideoOutput::AddReceiver(int rfd)
+{
+    auto r = std::make_shared<Receiver>(rfd);
+    std::lock_guard<std::mutex> l(mutex);
+    r->queue.push_back(header);
+
+    // Encoders restart so that the new receiver can begin decoding from the
+    // next frame, which the others take in their stride.
+    if(inter_frame && !udp) {
+        reset_encoders = true;
+        r->need_keyframe = true;
+    }
+    r->thread = std::thread(&NetVideoOutput::SendLoop, this, r);
+    if(!udp) {
+        r->input_thread = std::thread(&NetVideoOutput::InputLoop, this, r);
+    }
+    receivers.push_back(r);
+}
+
+void NetVideoOutput::AcceptLoop()
+{
+    while(true) {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if(quit) return;
+        }
+        if(!NetVideoPoll(fd, 100)) continue;
+
+        const int rfd = accept(fd, nullptr, nullptr);
+        if(rfd < 0) continue;
+
+        const int on = 1;
+        setsockopt(rfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        AddReceiver(rfd);
+    }
+}
+
+void NetVideoOutput::Queue(Receiver& r, const std::shared_ptr<const NetVideoMessage>& msg, bool frame)
+{
+    // Called with mutex held
+    if(frame) {
+        if(r.need_keyframe && !msg->keyframe) {
+            ++dropped_frames;
+            return;
+        }
+        r.need_keyframe = false;
+
+        // Drop the oldest frames beyond queue_frames, keeping header messages
+        const auto is_frame = [](const std::shared_ptr<const NetVideoMessage>& m){
+            return m->type == NetVideoMsgFrame;
+        };
+        while((size_t)std::count_if(r.queue.begin(), r.queue.end(), is_frame) >= queue_frames) {
+            auto it = r.queue.erase(std::find_if(r.queue.begin(), r.queue.end(), is_frame));
+            ++dropped_frames;
+
+            // Frames up to the next keyframe can't be decoded without it
+            if(inter_frame) {
+                while(it != r.queue.end() && is_frame(*it) && !(*it)->keyframe) {
+                    it = r.queue.erase(it);
+                    ++dropped_frames;
+                }
+                if(it == r.queue.end() && !msg->keyframe) {
+                    r.need_keyframe = true;
+                    ++dropped_frames;
+                    return;
+                }
+            }
+        }
+    }
+    r.queue.push_back(msg);
+}
+
+void NetVideoOutput::SendLoop(std::shared_ptr<Receiver> r)
+{
+    while(true) {
+        std::shared_ptr<const NetVideoMessage> msg;
+        {
+            std::unique_lock<std::mutex> l(mutex);
+            cv.wait(l, [&](){ return quit || !r->queue.empty(); });
+            if(quit) return;
+            msg = r->queue.front();
+            r->queue.pop_front();
+        }
+
+        if(udp) {
+            SendDatagrams(*msg);
+        }else if(!NetVideoSendAll(r->fd, msg->head.data(), msg->head.size(), true) ||
+                 !NetVideoSendAll(r->fd, msg->payload.data(), msg->payload.size()) ) {
+            std::lock_guard<std::mutex> l(mutex);
+            r->closed = true;
+            r->queue.clear();
+            return;
+        }
+    }
+}
+
+void NetVideoOutput::InputLoop(std::shared_ptr<Receiver> r)
+{
+    std::vector<unsigned char> props;
+    while(true) {
+        // Returns once the receiver disconnects, or CloseReceiver shuts it down
+        net_video_msg_header h;
+        if(!NetVideoRecvAll(r->fd, reinterpret_cast<unsigned char*>(&h), sizeof(h))) {
+            return;
+        }
+        if(std::memcmp(h.magic, net_video_magic, sizeof(net_video_magic)) || h.version != net_video_version ||
+           h.type != NetVideoMsgInput || h.payload_bytes || h.props_bytes > net_video_max_input_bytes) {
+            // Out of step with the receiver, ignore it from now on
+            pango_print_warn("NetVideoOutput: invalid input message received, ignoring receiver input.\n");
+            return;
+        }
+        props.resize(h.props_bytes);
+        if(!NetVideoRecvAll(r->fd, props.data(), props.size())) {
+            return;
+        }
+        if(!accept_input) {
+            continue;
+        }
+
+        picojson::value event;
+        std::string err;
+        picojson::parse(event, props.begin(), props.end(), &err);
+        if(!err.empty() || !event.is<picojson::object>()) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> l(mutex);
+        if(input_events.size() >= net_video_max_input_events) {
+            input_events.pop_front();
+        }
+        input_events.push_back(std::move(event));
+    }
+}
+
+void NetVideoOutput::SendDatagrams(const NetVideoMessage& msg)
+{
+    const size_t head_bytes = msg.head.size();
+    const size_t total = msg.SizeBytes();
+    const size_t fragment_bytes = datagram_bytes - sizeof(net_video_fragment_header);
+
+    net_video_fragment_header fh;
+    std::memcpy(fh.magic, net_video_magic, sizeof(net_video_magic));
+    fh.msg_id = next_msg_id++;
+    fh.msg_bytes = (uint32_t)total;
+
+    for(size_t offset = 0; offset < total; offset += fragment_bytes) {
+        const size_t end = std::min(total, offset + fragment_bytes);
+        fh.offset = (uint32_t)offset;
+
+        iovec iov[3];
+        size_t n = 0;
+        iov[n].iov_base = &fh;
+        iov[n++].iov_len = sizeof(fh);
+        if(offset < head_bytes) {
+            iov[n].iov_base = const_cast<unsigned char*>(msg.head.data() + offset);
+            iov[n++].iov_len = std::min(end, head_bytes) - offset;
+        }
+        if(end > head_bytes) {
+            const size_t start = std::max(offset, head_bytes) - head_bytes;
+            iov[n].iov_base = const_cast<unsigned char*>(msg.payload.data() + start);
+            iov[n++].iov_len = end - head_bytes - start;
+        }
+
+        msghdr m;
+        std::memset(&m, 0, sizeof(m));
+        m.msg_name = &dest;
+        m.msg_namelen = dest_len;
+        m.msg_iov = iov;
+        m.msg_iovlen = n;
+
+        // Unicast to a port nobody is listening on reports a (harmless) error
+        while(sendmsg(fd, &m, MSG_NOSIGNAL) < 0) {
+            if(errno == ENOBUFS) {
+                std::this_thread::yield();
+            }else if(errno != EINTR) {
+                break;
+            }
+        }
+    }
+}
+
+void NetVideoOutput::FinishMessage(NetVideoMessage& msg, NetVideoMsgType type, const std::string& props, int64_t time_us) const
+{
+    net_video_msg_header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, net_video_magic, sizeof(net_video_magic));
+    msg.type = type;
+    h.type = (uint8_t)type;
+    h.keyframe = msg.keyframe ? 1 : 0;
+    h.version = net_video_version;
+    h.props_bytes = (uint32_t)props.size();
+    h.seq = seq;
+    h.time_us = time_us;
+    h.payload_bytes = msg.payload.size();
+
+    msg.head.resize(sizeof(h) + props.size());
+    std::memcpy(msg.head.data(), &h, sizeof(h));
+    std::memcpy(msg.head.data() + sizeof(h), props.data(), props.size());
+}
+
+void NetVideoOutput::ResetInterFrameEncoders()
+{
+    for(size_t i=0; i < streams.size(); ++i) {
+        if(keyframe_intervals[i]) {
+            stream_encoders[i] = StreamEncoderFactory::I().GetEncoder(stream_encoder_uris[i], streams[i].PixFormat(), stream_encoder_params[i]);
+        }
+    }
+    frames_since_reset = 0;
+}
+
+void NetVideoOutput::EncodeStream(size_t i, const unsigned char* data, std::ostream& os)
+{
+    const StreamInfo& si = streams[i];
+    const Image<unsigned char> stream_image = si.StreamImage(data);
+
+    if(stream_encoders[i]) {
+        stream_encoders[i](os, stream_image);
+    }else if(stream_image.IsContiguous()) {
+        os.write((char*)stream_image.ptr, si.SizeBytes());
+    }else{
+        for(size_t row=0; row < stream_image.h; ++row) {
+            os.write((char*)stream_image.RowPtr(row), si.RowBytes());
+        }
+    }
+}
+
+int NetVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
+{
+    if(!header) {
+        throw VideoException("NetVideoOutput: SetStreams must be called first");
+    }
+
+    std::vector<std::shared_ptr<Receiver>> closed;
+    bool reset;
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        auto it = std::stable_partition(receivers.begin(), receivers.end(),
+            [](const std::shared_ptr<Receiver>& r){ return !r->closed; });
+        closed.assign(it, receivers.end());
+        receivers.erase(it, receivers.end());
+        reset = reset_encoders;
+        reset_encoders = false;
+    }
+    for(auto& r : closed) {
+        CloseReceiver(*r);
+    }
+
+    // Nobody to encode for
+    if(NumReceivers() == 0) {
+        return 0;
+    }
+
+    if(reset) {
+        ResetInterFrameEncoders();
+    }
+
+    const int64_t time_us = frame_properties.get_value(PANGO_HOST_RECEPTION_TIME_US, Time_us(TimeNow()));
+    auto msg = std::make_shared<NetVideoMessage>(total_frame_size);
+    for(size_t i=0; i < streams.size(); ++i) {
+        if(keyframe_intervals[i] && frames_since_reset % keyframe_intervals[i]) {
+            msg->keyframe = false;
+        }
+    }
+    {
+        std::ostream os(&msg->payload);
+        for(size_t i=0; i < streams.size(); ++i) {
+            EncodeStream(i, data, os);
+        }
+    }
+    FinishMessage(*msg, NetVideoMsgFrame, frame_properties.is<picojson::object>() ? frame_properties.serialize() : "", time_us);
+
+    const int64_t now_us = Time_us(TimeNow());
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        for(auto& r : receivers) {
+            // Let udp receivers joining late find out what they're receiving
+            if(udp && now_us - header_sent_us > 1000000) {
+                Queue(*r, header, false);
+                header_sent_us = now_us;
+            }
+            Queue(*r, msg, true);
+        }
+    }
+    cv.notify_all();
+
+    ++frames_since_reset;
+    return (int)(seq++);
+}
+
+PANGOLIN_REGISTER_FACTORY(NetVideoOutput)
+{
+    struct NetVideoOutputFactory : public FactoryInterface<VideoOutputInterface> {
+        std::unique_ptr<VideoOutputInterface> Open(const Uri& uri) override {
+            const bool udp = uri.scheme == "udp";
+
+            std::map<size_t, std::string> stream_encoder_uris;
+            const std::string default_encoder = uri.Get<std::string>("encoder", "");
+            for(size_t i=0; i<100; ++i)
+            {
+                const std::string encoder_key = pangolin::FormatString("encoder%",i+1);
+                stream_encoder_uris[i] = uri.Get<std::string>(encoder_key, default_encoder);
+            }
+
+            auto output = std::unique_ptr<NetVideoOutput>(new NetVideoOutput(
+                uri.url, udp, stream_encoder_uris,
+                uri.Get<size_t>("queue", 4),
+                uri.Get<size_t>("datagram", net_video_default_datagram_bytes),
+                uri.Get<int>("ttl", 1),
+                uri.Get<std::string>("iface", ""),
+                uri.Get<bool>("input", false)
+            ));
+
+            picojson::value codec_params(picojson::object_type, false);
+            for(const std::string key : {"keyframe_interval", "bitrate"}) {
+                if(uri.Contains(key)) codec_params[key] = uri.Get<int64_t>(key, 0);
+            }
+            for(const std::string key : {"hwaccel", "vaapi_device"}) {
+                if(uri.Contains(key)) codec_params[key] = uri.Get<std::string>(key, "");
+            }
+            if(!codec_params.get<picojson::object>().empty()) {
+                for(size_t i=0; i<100; ++i) {
+                    output->SetStreamEncoderParams(i, codec_params);
+                }
+            }
+            return output;
+        }
+    };
+
+    auto factory = std::make_shared<NetVideoOutputFactory>();
+    FactoryRegistry<VideoOutputInterface>::I().RegisterFactory(factory, 10, "tcp");
+    FactoryRegistry<VideoOutputInterface>::I().RegisterFactory(factory, 10, "udp");
+}
+
+}
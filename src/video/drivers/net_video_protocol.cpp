@@ -0,0 +1,145 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/drivers/net_video_protocol.h>
+#include <pangolin/video/video_exception.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace pangolin
+{
+
+void NetVideoParseAddress(const std::string& address, std::string& host, std::string& port)
+{
+    if(!address.empty() && address[0] == '[') {
+        const size_t close = address.find(']');
+        if(close == std::string::npos || close + 1 >= address.size() || address[close+1] != ':') {
+            throw VideoException("Invalid network address, expected [host]:port", address);
+        }
+        host = address.substr(1, close - 1);
+        port = address.substr(close + 2);
+    }else{
+        const size_t colon = address.rfind(':');
+        if(colon == std::string::npos) {
+            host = "";
+            port = address;
+        }else{
+            host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+    }
+
+    if(port.empty()) {
+        throw VideoException("Network address requires a port", address);
+    }
+}
+
+socklen_t NetVideoResolve(const std::string& address, int socktype, bool passive, sockaddr_storage& addr)
+{
+    std::string host, port;
+    NetVideoParseAddress(address, host, port);
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    addrinfo* res = nullptr;
+    const int err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if(err || !res) {
+        throw VideoException("Unable to resolve '" + address + "'", gai_strerror(err));
+    }
+
+    const socklen_t len = res->ai_addrlen;
+    std::memset(&addr, 0, sizeof(addr));
+    std::memcpy(&addr, res->ai_addr, len);
+    freeaddrinfo(res);
+    return len;
+}
+
+bool NetVideoIsMulticast(const sockaddr_storage& addr)
+{
+    if(addr.ss_family == AF_INET) {
+        const sockaddr_in& a = reinterpret_cast<const sockaddr_in&>(addr);
+        return IN_MULTICAST(ntohl(a.sin_addr.s_addr));
+    }else if(addr.ss_family == AF_INET6) {
+        const sockaddr_in6& a = reinterpret_cast<const sockaddr_in6&>(addr);
+        return IN6_IS_ADDR_MULTICAST(&a.sin6_addr);
+    }
+    return false;
+}
+
+bool NetVideoPoll(int fd, int timeout_ms)
+{
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r;
+    do {
+        r = poll(&pfd, 1, timeout_ms);
+    } while(r < 0 && errno == EINTR);
+    return r > 0;
+}
+
+bool NetVideoSendAll(int fd, const unsigned char* data, size_t size, bool more)
+{
+    const int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    while(size) {
+        const ssize_t n = send(fd, data, size, flags);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool NetVideoRecvAll(int fd, unsigned char* data, size_t size)
+{
+    while(size) {
+        const ssize_t n = recv(fd, data, size, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
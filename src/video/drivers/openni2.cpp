@@ -28,6 +28,7 @@
 
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/drivers/openni2.h>
+#include <pangolin/utils/timer.h>
 
 #include <OniVersion.h>
 #include <PS1080.h>
@@ -74,7 +75,7 @@ void OpenNi2Video::PrintOpenNI2Modes(openni::SensorType sensorType)
     for(int i = 0; i < modes.getSize(); i++) {
         std::string sfmt = "PangolinUnknown";
         try{
-            sfmt = VideoFormatFromOpenNI2(modes[i].getPixelFormat()).format;
+            sfmt = VideoFormatFromOpenNI2(modes[i].getPixelFormat()).Name();
         }catch(VideoException){}
         pango_print_info( "  %dx%d, %d fps, %s\n",
             modes[i].getResolutionX(), modes[i].getResolutionY(),
@@ -210,6 +211,8 @@ void OpenNi2Video::InitialiseOpenNI()
     numStreams = 0;
     current_frame_index = 0;
     total_frames = std::numeric_limits<size_t>::max();
+    queue_frames = 2;
+    std::fill(clock_offset_valid, clock_offset_valid + ONI_MAX_SENSORS, false);
 
     openni::Status rc = openni::STATUS_OK;
 
@@ -505,6 +508,11 @@ void OpenNi2Video::SetPlaybackRepeat(bool enabled)
     }
 }
 
+void OpenNi2Video::SetQueueFrames(size_t frames)
+{
+    queue_frames = std::max<size_t>(1, frames);
+}
+
 OpenNi2Video::~OpenNi2Video()
 {
     Stop();
@@ -539,6 +547,7 @@ void OpenNi2Video::Stop()
 {
     for(unsigned int i=0; i<Streams().size(); ++i) {
         video_stream[i].stop();
+        frame_queue[i].clear();
     }
 }
 
@@ -551,7 +560,108 @@ openni::VideoStream * OpenNi2Video::GetVideoStream(int stream){
     }
 }
 
-bool OpenNi2Video::GrabNext( unsigned char* image, bool /*wait*/ )
+void OpenNi2Video::SetStreamProperties(size_t i, const QueuedFrame& queued)
+{
+    const int64_t devtime_us = (int64_t)queued.frame.getTimestamp();
+    const int64_t delay_us = queued.host_reception_time_us - devtime_us;
+
+    // Reception delay only varies upwards from the true offset (transfer and
+    // scheduling jitter). Let the estimate creep up slowly to follow drift.
+    if(!clock_offset_valid[i] || delay_us < clock_offset_us[i] + 1) {
+        clock_offset_us[i] = delay_us;
+        clock_offset_valid[i] = true;
+    }else{
+        clock_offset_us[i] += 1;
+    }
+
+    picojson::value& props = (*streams_properties)[i];
+    props["devtime_us"] = devtime_us;
+    props[PANGO_CAPTURE_TIME_US] = devtime_us;
+    props[PANGO_HOST_RECEPTION_TIME_US] = queued.host_reception_time_us;
+    props[PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US] = devtime_us + clock_offset_us[i];
+}
+
+bool OpenNi2Video::ReadAnyStream(int timeout_ms)
+{
+    openni::VideoStream* ready[ONI_MAX_SENSORS];
+    size_t stream_index[ONI_MAX_SENSORS];
+    int num_ready = 0;
+    for(size_t i=0; i<Streams().size(); ++i) {
+        if(sensor_type[i].sensor_type != OpenNiUnassigned && video_stream[i].isValid()) {
+            stream_index[num_ready] = i;
+            ready[num_ready++] = &video_stream[i];
+        }
+    }
+
+    int index = -1;
+    openni::Status rc = openni::OpenNI::waitForAnyStream(ready, num_ready, &index, timeout_ms);
+    if(rc != openni::STATUS_OK || index < 0) {
+        if(rc != openni::STATUS_TIME_OUT) {
+            pango_print_error("Error waiting for frame:\n%s", openni::OpenNI::getExtendedError() );
+        }
+        return false;
+    }
+
+    const size_t i = stream_index[index];
+    QueuedFrame queued;
+    rc = video_stream[i].readFrame(&queued.frame);
+    queued.host_reception_time_us = pangolin::Time_us(pangolin::TimeNow());
+    if(rc != openni::STATUS_OK) {
+        pango_print_error("Error reading frame:\n%s", openni::OpenNI::getExtendedError() );
+        return false;
+    }
+
+    std::deque<QueuedFrame>& q = frame_queue[i];
+    if(q.size() >= queue_frames) {
+        q.pop_front();
+    }
+    q.push_back(queued);
+    return true;
+}
+
+bool OpenNi2Video::GrabQueued( unsigned char* image, bool wait, bool newest )
+{
+    const int timeout_ms = wait ? 2000 : 0;
+
+    // Collect frames in whatever order the devices deliver them, until every
+    // stream has at least one.
+    for(size_t i=0; i<Streams().size(); ++i) {
+        if(sensor_type[i].sensor_type == OpenNiUnassigned || !video_stream[i].isValid()) {
+            continue;
+        }
+        while(frame_queue[i].empty()) {
+            if(!ReadAnyStream(timeout_ms)) return false;
+        }
+    }
+
+    if(newest) {
+        // Pick up anything else which has already arrived
+        while(ReadAnyStream(0)) {}
+    }
+
+    unsigned char* out_img = image;
+    for(size_t i=0; i<Streams().size(); ++i) {
+        std::deque<QueuedFrame>& q = frame_queue[i];
+        if(!q.empty()) {
+            const QueuedFrame& queued = newest ? q.back() : q.front();
+            memcpy(out_img, queued.frame.getData(), streams[i].SizeBytes());
+            SetStreamProperties(i, queued);
+            if(i == 0) {
+                current_frame_index = queued.frame.getFrameIndex();
+            }
+            if(newest) {
+                q.clear();
+            }else{
+                q.pop_front();
+            }
+        }
+        out_img += streams[i].SizeBytes();
+    }
+
+    return true;
+}
+
+bool OpenNi2Video::GrabSequential( unsigned char* image )
 {
     unsigned char* out_img = image;
 
@@ -568,46 +678,37 @@ bool OpenNi2Video::GrabNext( unsigned char* image, bool /*wait*/ )
             continue;
         }
 
-        if(use_ir_and_rgb) video_stream[i].start();
+        video_stream[i].start();
 
-        rc = video_stream[i].readFrame(&video_frame[i]);
-        video_frame[0].getFrameIndex();
+        QueuedFrame queued;
+        rc = video_stream[i].readFrame(&queued.frame);
+        queued.host_reception_time_us = pangolin::Time_us(pangolin::TimeNow());
         if(rc != openni::STATUS_OK) {
             pango_print_error("Error reading frame:\n%s", openni::OpenNI::getExtendedError() );
-        }
-
-        const bool toGreyscale = false;
-        if(toGreyscale) {
-            const int w = streams[i].Width();
-            const int h = streams[i].Height();
-
-            openni::RGB888Pixel* pColour = (openni::RGB888Pixel*)video_frame[i].getData();
-            for(int i = 0 ; i  < w*h;i++){
-                openni::RGB888Pixel rgb = pColour[i];
-                int grey = ((int)(rgb.r&0xFF) +  (int)(rgb.g&0xFF) + (int)(rgb.b&0xFF))/3;
-                grey = std::min(255,std::max(0,grey));
-                out_img[i] = grey;
-            }
         }else{
-            memcpy(out_img, video_frame[i].getData(), streams[i].SizeBytes());
+            memcpy(out_img, queued.frame.getData(), streams[i].SizeBytes());
+            SetStreamProperties(i, queued);
+            if(i == 0) {
+                current_frame_index = queued.frame.getFrameIndex();
+            }
         }
 
-        // update frame properties
-        (*streams_properties)[i]["devtime_us"] = video_frame[i].getTimestamp();
-
-        if(use_ir_and_rgb) video_stream[i].stop();
+        video_stream[i].stop();
 
         out_img += streams[i].SizeBytes();
     }
 
-    current_frame_index = video_frame[0].getFrameIndex();
-
     return rc == openni::STATUS_OK;
 }
 
+bool OpenNi2Video::GrabNext( unsigned char* image, bool wait )
+{
+    return use_ir_and_rgb ? GrabSequential(image) : GrabQueued(image, wait, false);
+}
+
 bool OpenNi2Video::GrabNewest( unsigned char* image, bool wait )
 {
-    return GrabNext(image,wait);
+    return use_ir_and_rgb ? GrabSequential(image) : GrabQueued(image, wait, true);
 }
 
 size_t OpenNi2Video::GetCurrentFrameId() const
@@ -664,6 +765,7 @@ PANGOLIN_REGISTER_FACTORY(OpenNi2Video)
             nivid->SetDepthHoleFilter( uri.Get<bool>("holefilter",false) );
             nivid->SetDepthColorSyncEnabled( uri.Get<bool>("coloursync",false) );
             nivid->SetFastCrop( uri.Get<bool>("fastcrop",false) );
+            nivid->SetQueueFrames( uri.Get<size_t>("queue",2) );
             nivid->SetPlaybackSpeed(realtime ? 1.0f : -1.0f);
             nivid->SetAutoExposure(true);
             nivid->SetAutoWhiteBalance(true);
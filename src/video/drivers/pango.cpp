@@ -26,13 +26,18 @@
  */
 
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/image_io.h>
 #include <pangolin/log/playback_session.h>
 #include <pangolin/utils/file_extension.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/memstreambuf.h>
+#include <pangolin/utils/parallel_for.h>
 #include <pangolin/utils/signal_slot.h>
+#include <pangolin/utils/trace.h>
 #include <pangolin/video/drivers/pango.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <algorithm>
 #include <functional>
 
 namespace pangolin
@@ -40,91 +45,742 @@ namespace pangolin
 
 const std::string pango_video_type = "raw_video";
 
-PangoVideo::PangoVideo(const std::string& filename, std::shared_ptr<PlaybackSession> playback_session)
+// Variable size packets end with the uint64 offset of each stream within the packet
+const std::string pango_stream_offsets = "stream_offsets";
+
+// Source of JPEG thumbnails of the video source named by pango_thumbnail_of
+const std::string pango_thumbnail_type = "video_thumbnails";
+const std::string pango_thumbnail_of = "video_source";
+
+PangoVideo::PangoVideo(const std::string& filename, std::shared_ptr<PlaybackSession> playback_session, bool memory_map, size_t readahead,
+                       bool demux, int src, size_t cache_bytes, size_t cache_ahead)
     : _filename(filename),
       _playback_session(playback_session),
       _reader(_playback_session->Open(filename)),
       _event_promise(_playback_session->Time()),
-      _src_id(FindPacketStreamSource()),
-      _source(nullptr)
+      _src_id(FindPacketStreamSource(src)),
+      _source(nullptr),
+      _demux(demux), _subscriber(0),
+      _properties_stale(false), _metadata_stale(false), _native_metadata(false),
+      _stream_offsets(false),
+      _inter_frame(false),
+      _readahead(0), _readahead_packet_id(0),
+      _readahead_next_read(0), _readahead_next_grab(0),
+      _readahead_generation(0), _readahead_quit(false),
+      _thumb_src_id(-1),
+      _decoded_packet_id(0),
+      _cache(cache_bytes), _cacheable(false), _cache_last_id(size_t(-1)),
+      _spec_ahead(cache_ahead), _spec_from(0), _spec_forward(true),
+      _spec_generation(0), _spec_quit(false)
 {
     PANGO_ENSURE(_src_id != -1, "No appropriate video streams found in log.");
 
+    if(memory_map && !_reader->MemoryMap()) {
+        pango_print_warn("PangoVideo: Unable to memory map '%s', reading through stream.\n", filename.c_str());
+    }
+
     _source = &_reader->Sources()[_src_id];
     SetupStreams(*_source);
+    _thumb_src_id = FindThumbnailSource();
+    _cacheable = !_source->index.empty() && (!_fixed_size || _source->Compressed());
+
+    if(_demux) {
+        _subscriber = _reader->Subscribe(_src_id);
+    }
 
     // Make sure we time-seek with other playback devices
     session_seek = _playback_session->Time().OnSeek.Connect(
         [&](SyncTime::TimePoint t){
             _event_promise.Cancel();
-            _reader->Seek(_src_id, t);
-            _event_promise.WaitAndRenew(_source->NextPacketTime());
+            std::unique_lock<std::mutex> rl(_readahead_read_mutex, std::defer_lock);
+            if(_readahead) {
+                rl.lock();
+                ResetReadAhead();
+            }
+            // Found with one search of the session's merged index for all participants
+            const size_t packet_id = _playback_session->PacketAtTime(*_reader, _src_id, t);
+            if(packet_id < _source->index.size()) {
+                if(_demux) {
+                    _reader->SeekSubscriber(_subscriber, packet_id);
+                }else{
+                    _reader->Seek(_src_id, packet_id);
+                }
+            }
+            // Without readahead, decoders catch up on the next grab, if it isn't cached
+            if(_inter_frame && _readahead) {
+                DecodeFromKeyframe();
+            }
+            _readahead_packet_id = NextPacketId();
+            if(rl) rl.unlock();
+            _event_promise.WaitAndRenew(NextPacketTime());
         }
     );
 
-    _event_promise.WaitAndRenew(_source->NextPacketTime());
+    _event_promise.WaitAndRenew(NextPacketTime());
+
+    if(readahead) {
+        StartReadAhead(readahead);
+    }
 }
 
 PangoVideo::~PangoVideo()
 {
+    StopSpeculation();
+    StopReadAhead();
+    if(_demux) {
+        _reader->Unsubscribe(_subscriber);
+    }
 }
 
-size_t PangoVideo::SizeBytes() const
+size_t PangoVideo::NextPacketId() const
 {
-    return _size_bytes;
+    return _demux ? _reader->NextPacketId(_subscriber) : _source->next_packet_id;
 }
 
-const std::vector<StreamInfo>& PangoVideo::Streams() const
+int64_t PangoVideo::NextPacketTime() const
 {
-    return _streams;
+    const size_t packet_id = NextPacketId();
+    // On the session's time base, which is shared by coordinated recordings
+    return packet_id < _source->index.size() ? _source->index.Time(packet_id) + _reader->ClockOffsetUs() : 0;
 }
 
-void PangoVideo::Start()
+void PangoVideo::SeekPacket(size_t packet_id)
+{
+    if(_demux) {
+        _reader->SeekSubscriber(_subscriber, packet_id);
+    }else{
+        _reader->Seek(_src_id, packet_id);
+    }
+}
+
+void PangoVideo::StartReadAhead(size_t frames)
 {
+    _readahead = frames;
+    _readahead_packet_id = NextPacketId();
+
+    // Reading is serial, so extra workers only pay off when there is decoding to do,
+    // and inter-frame streams must be decoded in order.
+    const bool decodes = std::any_of(stream_decoder.begin(), stream_decoder.end(),
+        [](const ImageDecoderIntoFunc& f){ return (bool)f; });
+    const size_t num_threads = (decodes && !_inter_frame) ? std::max<size_t>(1, std::min(frames, ParallelConcurrency())) : 1;
 
+    for(size_t i=0; i < num_threads; ++i) {
+        _readahead_threads.emplace_back(&PangoVideo::ReadAheadLoop, this);
+    }
 }
 
-void PangoVideo::Stop()
+void PangoVideo::StopReadAhead()
 {
+    {
+        std::lock_guard<std::mutex> l(_readahead_mutex);
+        _readahead_quit = true;
+    }
+    _readahead_cv.notify_all();
+    for(auto& t : _readahead_threads) {
+        t.join();
+    }
+    _readahead_threads.clear();
+}
 
+void PangoVideo::ResetReadAhead()
+{
+    std::lock_guard<std::mutex> l(_readahead_mutex);
+    ++_readahead_generation;
+    _readahead_ready.clear();
+    _readahead_next_read = 0;
+    _readahead_next_grab = 0;
+    _readahead_cv.notify_all();
 }
 
-bool PangoVideo::GrabNext(unsigned char* image, bool /*wait*/)
+void PangoVideo::ReadAheadLoop()
 {
-    try
+    TraceSetThreadName("PangoVideo readahead");
+    while(true) {
+        size_t order;
+        size_t generation;
+        ReadAheadFrame frame;
+        std::vector<unsigned char> packet;
+        QueuedPacket queued;
+
+        const auto can_read = [this](){
+            return _readahead_quit || _readahead_next_read - _readahead_next_grab < _readahead;
+        };
+
+        // Wait for space without blocking seeks, which need the read mutex.
+        {
+            std::unique_lock<std::mutex> l(_readahead_mutex);
+            _readahead_cv.wait(l, can_read);
+            if(_readahead_quit) return;
+        }
+
+        std::unique_lock<std::mutex> rl(_readahead_read_mutex);
+        {
+            std::unique_lock<std::mutex> l(_readahead_mutex);
+            if(_readahead_quit) return;
+            if(!can_read()) continue;
+            order = _readahead_next_read++;
+            generation = _readahead_generation;
+        }
+
+        try
+        {
+            frame.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+            if(_demux) {
+                queued = _reader->NextSubscribedFrame(_subscriber);
+                frame.frame_properties = queued.meta;
+                frame.binary_meta = queued.binary_meta;
+                frame.packet_id = queued.sequence_num;
+                if(_fixed_size) {
+                    std::memcpy(frame.buffer->get(), queued.data, _size_bytes);
+                }
+            }else{
+                Packet fi = _reader->NextFrame(_src_id);
+                frame.frame_properties = fi.meta;
+                frame.binary_meta = fi.binary_meta;
+                frame.packet_id = fi.sequence_num;
+
+                const unsigned char* data = fi.Data();
+                if(_fixed_size) {
+                    if(data) {
+                        std::memcpy(frame.buffer->get(), data, _size_bytes);
+                    }else{
+                        fi.Stream().read(reinterpret_cast<char*>(frame.buffer->get()), _size_bytes);
+                    }
+                }else if(data) {
+                    packet.assign(data, data + fi.size);
+                }else{
+                    packet.resize(fi.size);
+                    fi.Stream().read(reinterpret_cast<char*>(packet.data()), fi.size);
+                }
+            }
+            frame.valid = true;
+        }
+        catch(...)
+        {
+        }
+        frame.next_packet_time = NextPacketTime();
+
+        // Decode concurrently with other workers reading and decoding, except
+        // for inter-frame streams which decode in read order, excluding seeks
+        if(!_inter_frame) {
+            rl.unlock();
+        }
+        if(frame.valid && !_fixed_size) {
+            try {
+                if(queued.data) {
+                    DecodePacket(queued.data, queued.size, frame.buffer->get(), stream_decoder);
+                }else{
+                    DecodePacket(packet.data(), packet.size(), frame.buffer->get(), stream_decoder);
+                }
+            }catch(...) {
+                frame.valid = false;
+            }
+        }
+        if(_inter_frame) {
+            // Still holding the read mutex
+            _decoded_packet_id = frame.valid ? frame.packet_id + 1 : size_t(-1);
+        }
+
+        std::lock_guard<std::mutex> l(_readahead_mutex);
+        if(generation == _readahead_generation) {
+            _readahead_ready[order] = std::move(frame);
+            _readahead_cv.notify_all();
+        }
+    }
+}
+
+PangoVideo::ReadAheadFrame PangoVideo::NextReadAheadFrame()
+{
+    ReadAheadFrame frame;
     {
-        Packet fi = _reader->NextFrame(_src_id);
-        _frame_properties = fi.meta;
+        std::unique_lock<std::mutex> l(_readahead_mutex);
+        _readahead_cv.wait(l, [this](){
+            return _readahead_ready.count(_readahead_next_grab) > 0;
+        });
+        auto it = _readahead_ready.find(_readahead_next_grab);
+        frame = std::move(it->second);
+        _readahead_ready.erase(it);
+        ++_readahead_next_grab;
+    }
+    _readahead_cv.notify_all();
+
+    if(frame.valid) {
+        SetFrameMeta(frame.frame_properties, frame.binary_meta);
+    }else{
+        SetFrameMeta(picojson::value(), std::string());
+    }
+    if(frame.valid) {
+        _readahead_packet_id = frame.packet_id + 1;
+        _event_promise.WaitAndRenew(frame.next_packet_time);
+    }
+    return frame;
+}
+
+void PangoVideo::DecodePacket(const unsigned char* data, size_t size, unsigned char* image, const std::vector<ImageDecoderIntoFunc>& decoders)
+{
+    PANGO_TRACE_SCOPE("PangoVideo::Decode", "video");
+    const size_t num_streams = _streams.size();
+    const size_t trailer_bytes = num_streams * sizeof(uint64_t);
+
+    std::vector<uint64_t> offsets;
+    if(_stream_offsets && num_streams > 1 && size >= trailer_bytes) {
+        offsets.resize(num_streams + 1);
+        std::memcpy(offsets.data(), data + size - trailer_bytes, trailer_bytes);
+        offsets[num_streams] = size - trailer_bytes;
+        for(size_t s=0; s < num_streams; ++s) {
+            if(offsets[s] > offsets[s+1]) {
+                offsets.clear();
+                break;
+            }
+        }
+    }
+
+    if(offsets.empty()) {
+        memreadbuf buf(data, size);
+        std::istream is(&buf);
+        DecodeStreams(is, image, decoders);
+        return;
+    }
+
+    ParallelFor(0, num_streams, num_streams, [&](size_t begin, size_t end){
+        for(size_t s=begin; s < end; ++s) {
+            memreadbuf buf(data + offsets[s], offsets[s+1] - offsets[s]);
+            std::istream is(&buf);
+
+            const StreamInfo& si = _streams[s];
+            const Image<unsigned char> dst = si.StreamImage(image);
+            if(decoders[s]) {
+                decoders[s](is, dst);
+            }else{
+                PANGO_ENSURE(offsets[s+1] - offsets[s] >= si.RowBytes() * dst.h);
+                for(size_t row =0; row < dst.h; ++row) {
+                    std::memcpy(dst.ptr + row*dst.pitch, data + offsets[s] + row*si.RowBytes(), si.RowBytes());
+                }
+            }
+        }
+    });
+}
+
+void PangoVideo::DecodeStreams(std::istream& is, unsigned char* image, const std::vector<ImageDecoderIntoFunc>& decoders)
+{
+    for(size_t s=0; s < _streams.size(); ++s) {
+        const StreamInfo& si = _streams[s];
+        const Image<unsigned char> dst = si.StreamImage(image);
+
+        if(decoders[s]) {
+            decoders[s](is, dst);
+        }else{
+            for(size_t row =0; row < dst.h; ++row) {
+                is.read((char*)dst.ptr + row*dst.pitch, si.RowBytes());
+            }
+        }
+    }
+}
+
+void PangoVideo::SetFrameMeta(const picojson::value& meta, const std::string& binary_meta)
+{
+    _frame_properties = meta;
+    const bool has_binary = !binary_meta.empty() && _metadata.Deserialize(binary_meta.data(), binary_meta.size());
+    _properties_stale = has_binary;
+    _metadata_stale = !has_binary;
+    _native_metadata = has_binary && meta.is<picojson::null>();
+}
+
+const picojson::value& PangoVideo::FrameProperties() const
+{
+    if(_properties_stale) {
+        _metadata.AddToJson(_frame_properties);
+        _properties_stale = false;
+    }
+    return _frame_properties;
+}
+
+const FrameMetadata& PangoVideo::Metadata() const
+{
+    if(_metadata_stale) {
+        _metadata = FrameMetadata::FromJson(_frame_properties);
+        _metadata_stale = false;
+    }
+    return _metadata;
+}
+
+bool PangoVideo::HasNativeMetadata() const
+{
+    return _native_metadata;
+}
+
+void PangoVideo::ReadFrame(unsigned char* image, picojson::value& meta, std::string& binary_meta)
+{
+    PANGO_TRACE_SCOPE("PangoVideo::ReadFrame", "video");
+    _decoded_packet_id = size_t(-1);
 
+    if(_demux) {
+        QueuedPacket queued = _reader->NextSubscribedFrame(_subscriber);
+        meta = queued.meta;
+        binary_meta = queued.binary_meta;
         if(_fixed_size) {
-            fi.Stream().read(reinterpret_cast<char*>(image), _size_bytes);
+            std::memcpy(image, queued.data, _size_bytes);
         }else{
-            for(size_t s=0; s < _streams.size(); ++s) {
-                StreamInfo& si = _streams[s];
-                pangolin::Image<unsigned char> dst = si.StreamImage(image);
+            DecodePacket(queued.data, queued.size, image, stream_decoder);
+        }
+        _decoded_packet_id = queued.sequence_num + 1;
+        return;
+    }
 
-                if(stream_decoder[s]) {
-                    pangolin::TypedImage img = stream_decoder[s](fi.Stream());
-                    PANGO_ENSURE(img.IsValid());
+    Packet fi = _reader->NextFrame(_src_id);
+    meta = fi.meta;
+    binary_meta = fi.binary_meta;
 
-                    // TODO: We can avoid this copy by decoding directly into img
-                    for(size_t row =0; row < dst.h; ++row) {
-                        std::memcpy(dst.RowPtr(row), img.RowPtr(row), si.RowBytes());
-                    }
+    const unsigned char* data = fi.Data();
+
+    if(_fixed_size) {
+        if(data) {
+            std::memcpy(image, data, _size_bytes);
+        }else{
+            fi.Stream().read(reinterpret_cast<char*>(image), _size_bytes);
+        }
+    }else if(data) {
+        DecodePacket(data, fi.size, image, stream_decoder);
+    }else if(_stream_offsets) {
+        // Pull the packet into memory so that its streams can be decoded concurrently
+        std::vector<unsigned char> packet(fi.size);
+        fi.Stream().read(reinterpret_cast<char*>(packet.data()), fi.size);
+        DecodePacket(packet.data(), packet.size(), image, stream_decoder);
+    }else{
+        DecodeStreams(fi.Stream(), image, stream_decoder);
+    }
+    _decoded_packet_id = fi.sequence_num + 1;
+}
+
+bool PangoVideo::IsKeyframe(size_t packet_id) const
+{
+    for(size_t interval : _keyframe_intervals) {
+        if(interval && packet_id % interval) return false;
+    }
+    return true;
+}
+
+void PangoVideo::DecodeFromKeyframe()
+{
+    const size_t target = NextPacketId();
+    size_t keyframe = target;
+    while(!IsKeyframe(keyframe)) --keyframe;
+    const size_t from = (keyframe <= _decoded_packet_id && _decoded_packet_id <= target) ? _decoded_packet_id : keyframe;
+    if(from == target) return;
+
+    // Bring decoders up to date with the frames in between, which are
+    // discarded, or kept in the cache so stepping back over them is free
+    const bool cache = UseCache();
+    SeekPacket(from);
+    FrameCache::Frame frame;
+    try {
+        while(NextPacketId() < target) {
+            const size_t packet_id = NextPacketId();
+            if(!frame.buffer) {
+                frame.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+            }
+            ReadFrame(frame.buffer->get(), frame.frame_properties, frame.binary_meta);
+            if(cache) {
+                _cache.Insert(packet_id, frame, _size_bytes);
+                frame.buffer.reset();
+            }
+        }
+    }catch(...) {
+        if(NextPacketId() != target) SeekPacket(target);
+    }
+}
+
+bool PangoVideo::UseCache() const
+{
+    return _cacheable && !_readahead && _cache.Budget() > 0;
+}
+
+std::shared_ptr<FramePool::Buffer> PangoVideo::GrabCached()
+{
+    const size_t packet_id = NextPacketId();
+    FrameCache::Frame frame;
+
+    // Move past a cached packet as though it had been read, leaving any
+    // inter-frame decoders behind until a frame needs decoding. The last
+    // packet is read regardless, since there is no seeking past it.
+    if(packet_id + 1 < _source->index.size() && _cache.Find(packet_id, frame)) {
+        SeekPacket(packet_id + 1);
+    }else{
+        try {
+            if(_inter_frame) {
+                DecodeFromKeyframe();
+            }
+            frame.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+            ReadFrame(frame.buffer->get(), frame.frame_properties, frame.binary_meta);
+        }catch(...) {
+            SetFrameMeta(picojson::value(), std::string());
+            return nullptr;
+        }
+        _cache.Insert(packet_id, frame, _size_bytes);
+    }
+
+    SetFrameMeta(frame.frame_properties, frame.binary_meta);
+    _event_promise.WaitAndRenew(NextPacketTime());
+    Speculate(packet_id);
+    return frame.buffer;
+}
+
+void PangoVideo::Speculate(size_t packet_id)
+{
+    const bool forward = _cache_last_id == size_t(-1) || packet_id >= _cache_last_id;
+    _cache_last_id = packet_id;
+
+    {
+        std::lock_guard<std::mutex> l(_spec_mutex);
+        if(!_spec_ahead) return;
+        _spec_from = packet_id;
+        _spec_forward = forward;
+        ++_spec_generation;
+
+        if(!_spec_thread.joinable()) {
+            // Made here, since the reader isn't safe to use from the thread
+            _spec_cursor.reset(new PacketStreamCursor(_reader->Cursor(_src_id)));
+            _spec_decoders = CreateStreamDecoders(*_source);
+            _spec_thread = std::thread(&PangoVideo::SpeculateLoop, this);
+        }
+    }
+    _spec_cv.notify_all();
+}
+
+void PangoVideo::StopSpeculation()
+{
+    {
+        std::lock_guard<std::mutex> l(_spec_mutex);
+        _spec_quit = true;
+    }
+    _spec_cv.notify_all();
+    if(_spec_thread.joinable()) {
+        _spec_thread.join();
+    }
+}
+
+void PangoVideo::SpeculateLoop()
+{
+    TraceSetThreadName("PangoVideo cache");
+
+    // Next packet _spec_decoders are ready for, or -1 if unknown
+    size_t decoded_id = size_t(-1);
+    size_t generation = 0;
+
+    const auto superseded = [&](){
+        std::lock_guard<std::mutex> l(_spec_mutex);
+        return _spec_quit || _spec_generation != generation;
+    };
+
+    while(true) {
+        size_t from, ahead;
+        bool forward;
+        {
+            std::unique_lock<std::mutex> l(_spec_mutex);
+            _spec_cv.wait(l, [&](){ return _spec_quit || _spec_generation != generation; });
+            if(_spec_quit) return;
+            generation = _spec_generation;
+            from = _spec_from;
+            forward = _spec_forward;
+            ahead = _spec_ahead;
+        }
+
+        // Keep at least half of the budget for frames actually shown
+        const size_t num_packets = _spec_cursor->NumPackets();
+        ahead = std::min(ahead, _cache.Budget() / (2 * std::max<size_t>(1, _size_bytes)));
+        const size_t begin = forward ? std::min(from + 1, num_packets) : from - std::min(from, ahead);
+        const size_t end = forward ? std::min(from + 1 + ahead, num_packets) : from;
+
+        std::vector<size_t> ids;
+        if(_inter_frame) {
+            // Decode in order from the keyframe, or from where the decoders are, if nearer
+            bool missing = false;
+            for(size_t id = begin; id < end; ++id) {
+                missing = missing || !_cache.Contains(id);
+            }
+            if(!missing) continue;
+            size_t id = begin;
+            while(!IsKeyframe(id)) --id;
+            if(id <= decoded_id && decoded_id <= begin) id = decoded_id;
+            for(; id < end; ++id) ids.push_back(id);
+        }else{
+            // Nearest first
+            for(size_t i = 0; i < end - begin; ++i) {
+                const size_t id = forward ? begin + i : end - 1 - i;
+                if(!_cache.Contains(id)) ids.push_back(id);
+            }
+        }
+
+        for(size_t id : ids) {
+            if(superseded()) break;
+            try {
+                const QueuedPacket packet = _spec_cursor->Read(id);
+                FrameCache::Frame frame;
+                frame.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+                frame.frame_properties = packet.meta;
+                frame.binary_meta = packet.binary_meta;
+                if(_fixed_size) {
+                    std::memcpy(frame.buffer->get(), packet.data, _size_bytes);
                 }else{
-                    for(size_t row =0; row < dst.h; ++row) {
-                        fi.Stream().read((char*)dst.RowPtr(row), si.RowBytes());
-                    }
+                    DecodePacket(packet.data, packet.size, frame.buffer->get(), _spec_decoders);
                 }
+                decoded_id = id + 1;
+                _cache.Insert(id, frame, _size_bytes);
+            }catch(...) {
+                decoded_id = size_t(-1);
+                break;
             }
         }
+    }
+}
+
+size_t PangoVideo::FrameCacheBudget() const
+{
+    return _cache.Budget();
+}
+
+void PangoVideo::SetFrameCache(size_t max_bytes, size_t ahead)
+{
+    _cache.SetBudget(max_bytes);
+    std::lock_guard<std::mutex> l(_spec_mutex);
+    _spec_ahead = ahead;
+}
+
+std::vector<ImageDecoderIntoFunc> PangoVideo::AcquireRandomDecoders()
+{
+    {
+        std::lock_guard<std::mutex> l(_random_mutex);
+        if(!_random_decoders.empty()) {
+            std::vector<ImageDecoderIntoFunc> decoders = std::move(_random_decoders.back());
+            _random_decoders.pop_back();
+            return decoders;
+        }
+    }
+    return CreateStreamDecoders(*_source);
+}
+
+void PangoVideo::ReleaseRandomDecoders(std::vector<ImageDecoderIntoFunc>&& decoders)
+{
+    std::lock_guard<std::mutex> l(_random_mutex);
+    _random_decoders.push_back(std::move(decoders));
+}
+
+bool PangoVideo::ReadFrame(size_t frameid, unsigned char* image, picojson::value* frame_properties)
+{
+    PANGO_TRACE_SCOPE("PangoVideo::RandomRead", "video");
+    if(frameid >= _source->index.size()) {
+        return false;
+    }
+
+    // Inter-frame streams are decoded up from the keyframe before
+    size_t from = frameid;
+    while(!IsKeyframe(from)) --from;
+
+    std::vector<ImageDecoderIntoFunc> decoders = AcquireRandomDecoders();
+
+    // Decoders left part way through a frame by an exception aren't reused
+    for(size_t id = from; id <= frameid; ++id) {
+        const QueuedPacket packet = _reader->ReadPacket(_src_id, id);
+        if(_fixed_size) {
+            PANGO_ENSURE(packet.size >= _size_bytes);
+            std::memcpy(image, packet.data, _size_bytes);
+        }else{
+            DecodePacket(packet.data, packet.size, image, decoders);
+        }
+
+        if(frame_properties && id == frameid) {
+            *frame_properties = packet.meta;
+            FrameMetadata metadata;
+            if(!packet.binary_meta.empty() && metadata.Deserialize(packet.binary_meta.data(), packet.binary_meta.size())) {
+                metadata.AddToJson(*frame_properties);
+            }
+        }
+    }
+    ReleaseRandomDecoders(std::move(decoders));
+    return true;
+}
+
+void PangoVideo::ReadFrames(const std::vector<size_t>& frameids, const std::vector<unsigned char*>& images, std::vector<picojson::value>* frame_properties)
+{
+    PANGO_ENSURE(frameids.size() == images.size());
+    if(frame_properties) {
+        frame_properties->resize(frameids.size());
+    }
+
+    // Read in the order frames lie within the log
+    std::vector<size_t> order(frameids.size());
+    for(size_t i=0; i < order.size(); ++i) {
+        if(frameids[i] >= _source->index.size()) {
+            throw std::out_of_range("PangoVideo: no such frame");
+        }
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b){
+        return _source->index.Pos(frameids[a]) < _source->index.Pos(frameids[b]);
+    });
+
+    ParallelFor(0, order.size(), ParallelConcurrency(), [&](size_t begin, size_t end){
+        for(size_t o = begin; o < end; ++o) {
+            const size_t i = order[o];
+            ReadFrame(frameids[i], images[i], frame_properties ? &(*frame_properties)[i] : nullptr);
+        }
+    });
+}
+
+size_t PangoVideo::SizeBytes() const
+{
+    return _size_bytes;
+}
+
+const std::vector<StreamInfo>& PangoVideo::Streams() const
+{
+    return _streams;
+}
+
+void PangoVideo::Start()
+{
+
+}
+
+void PangoVideo::Stop()
+{
+
+}
+
+bool PangoVideo::GrabNext(unsigned char* image, bool /*wait*/)
+{
+    PANGO_TRACE_SCOPE("PangoVideo::GrabNext", "video");
+    if(_readahead) {
+        ReadAheadFrame frame = NextReadAheadFrame();
+        if(frame.valid) {
+            std::memcpy(image, frame.buffer->get(), _size_bytes);
+        }
+        return frame.valid;
+    }
+
+    if(UseCache()) {
+        const std::shared_ptr<FramePool::Buffer> buffer = GrabCached();
+        if(buffer) {
+            std::memcpy(image, buffer->get(), _size_bytes);
+        }
+        return (bool)buffer;
+    }
 
-        _event_promise.WaitAndRenew(_source->NextPacketTime());
+    try
+    {
+        if(_inter_frame) {
+            DecodeFromKeyframe();
+        }
+        picojson::value meta;
+        std::string binary_meta;
+        ReadFrame(image, meta, binary_meta);
+        SetFrameMeta(meta, binary_meta);
+        _event_promise.WaitAndRenew(NextPacketTime());
         return true;
     }
     catch(...)
     {
-        _frame_properties = picojson::value();
+        SetFrameMeta(picojson::value(), std::string());
         return false;
     }
 }
@@ -134,9 +790,83 @@ bool PangoVideo::GrabNewest( unsigned char* image, bool wait )
     return GrabNext(image, wait);
 }
 
+FrameLease PangoVideo::GrabNextLease( bool wait )
+{
+    PANGO_TRACE_SCOPE("PangoVideo::GrabNextLease", "video");
+    if(_readahead) {
+        ReadAheadFrame frame = NextReadAheadFrame();
+        if(frame.valid) {
+            std::shared_ptr<FramePool::Buffer> buffer = frame.buffer;
+            return FrameLease(buffer->get(), _size_bytes, [buffer](){});
+        }
+        return FrameLease();
+    }
+
+    if(UseCache()) {
+        // Shared with the cache, which never writes to a frame once added
+        std::shared_ptr<FramePool::Buffer> buffer = GrabCached();
+        if(buffer) {
+            return FrameLease(buffer->get(), _size_bytes, [buffer](){});
+        }
+        return FrameLease();
+    }
+
+    if(!_fixed_size || (!_demux && !_reader->IsMemoryMapped())) {
+        std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+        if(GrabNext(buffer->get(), wait)) {
+            return FrameLease(buffer->get(), _size_bytes, [buffer](){});
+        }
+        return FrameLease();
+    }
+
+    try
+    {
+        if(_demux) {
+            // Lease the packet in place, whether in the mapping or copied out of the stream
+            QueuedPacket queued = _reader->NextSubscribedFrame(_subscriber);
+            SetFrameMeta(queued.meta, queued.binary_meta);
+            std::shared_ptr<void> owner = queued.owner;
+            FrameLease lease(queued.data, _size_bytes, [owner](){});
+            _event_promise.WaitAndRenew(NextPacketTime());
+            return lease;
+        }
+
+        Packet fi = _reader->NextFrame(_src_id);
+        SetFrameMeta(fi.meta, fi.binary_meta);
+
+        FrameLease lease;
+        if(unsigned char* data = fi.Data()) {
+            // Lease straight out of the (copy on write) mapping.
+            std::shared_ptr<void> owner = fi.Owner();
+            lease = FrameLease(data, _size_bytes, [owner](){});
+        }else{
+            // Packet is beyond the extent of the mapping (file has grown since)
+            std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_size_bytes));
+            fi.Stream().read(reinterpret_cast<char*>(buffer->get()), _size_bytes);
+            lease = FrameLease(buffer->get(), _size_bytes, [buffer](){});
+        }
+
+        _event_promise.WaitAndRenew(NextPacketTime());
+        return lease;
+    }
+    catch(...)
+    {
+        SetFrameMeta(picojson::value(), std::string());
+        return FrameLease();
+    }
+}
+
+FrameLease PangoVideo::GrabNewestLease( bool wait )
+{
+    return GrabNextLease(wait);
+}
+
 size_t PangoVideo::GetCurrentFrameId() const
 {
-    return (int)(_reader->Sources()[_src_id].next_packet_id);
+    if(_readahead) {
+        return _readahead_packet_id;
+    }
+    return NextPacketId();
 }
 
 size_t PangoVideo::GetTotalFrames() const
@@ -148,19 +878,19 @@ size_t PangoVideo::Seek(size_t next_frame_id)
 {
     // Get time for seek
     if(next_frame_id < _source->index.size()) {
-        const int64_t capture_time = _source->index[next_frame_id].capture_time;
-        _playback_session->Time().Seek(SyncTime::TimePoint(std::chrono::microseconds(capture_time)));
+        const int64_t capture_time = _source->index[next_frame_id].capture_time + _reader->ClockOffsetUs();
+        _playback_session->Seek(SyncTime::TimePoint(std::chrono::microseconds(capture_time)));
         return next_frame_id;
     }else{
-        return _source->next_packet_id;
+        return NextPacketId();
     }
 }
 
-int PangoVideo::FindPacketStreamSource()
+int PangoVideo::FindPacketStreamSource(int src_id)
 {
     for(const auto& src : _reader->Sources())
     {
-        if (!src.driver.compare(pango_video_type))
+        if (!src.driver.compare(pango_video_type) && (src_id < 0 || src_id == (int)src.id))
         {
             return static_cast<int>(src.id);
         }
@@ -169,15 +899,78 @@ int PangoVideo::FindPacketStreamSource()
     return -1;
 }
 
+int PangoVideo::FindThumbnailSource() const
+{
+    for(const auto& src : _reader->Sources())
+    {
+        if (!src.driver.compare(pango_thumbnail_type) && src.info.get_value<int64_t>(pango_thumbnail_of, -1) == _src_id)
+        {
+            return static_cast<int>(src.id);
+        }
+    }
+
+    return -1;
+}
+
+size_t PangoVideo::ThumbnailInterval() const
+{
+    if(_thumb_src_id < 0) return 0;
+    return (size_t)_reader->Sources()[_thumb_src_id].info.get_value<int64_t>("interval", 0);
+}
+
+size_t PangoVideo::GetThumbnails(size_t frameid, std::vector<TypedImage>& thumbs)
+{
+    // Thumbnails are found through the index, so aren't available for pipes
+    if(_thumb_src_id < 0 || frameid >= _source->index.size() || _reader->Sources()[_thumb_src_id].index.empty()) {
+        return size_t(-1);
+    }
+
+    std::lock_guard<std::mutex> l(_thumb_mutex);
+    if(!_thumb_cursor) {
+        _thumb_cursor.reset(new PacketStreamCursor(_reader->Cursor(_thumb_src_id)));
+    }
+
+    // Last thumbnail at or before the frame, matched by capture time
+    const int64_t frame_time = _source->index.Time(frameid);
+    const size_t after = _thumb_cursor->Seek(SyncTime::TimePoint(std::chrono::microseconds(frame_time + 1)));
+    if(after == 0) {
+        return size_t(-1);
+    }
+    const QueuedPacket packet = _thumb_cursor->Read(after - 1);
+
+    const picojson::value& json_streams = _reader->Sources()[_thumb_src_id].info["streams"];
+    const size_t num_streams = json_streams.size();
+    const size_t trailer_bytes = num_streams * sizeof(uint64_t);
+    PANGO_ENSURE(packet.size >= trailer_bytes);
+
+    std::vector<uint64_t> offsets(num_streams + 1);
+    std::memcpy(offsets.data(), packet.data + packet.size - trailer_bytes, trailer_bytes);
+    offsets[num_streams] = packet.size - trailer_bytes;
+
+    thumbs.clear();
+    thumbs.resize(num_streams);
+    for(size_t s=0; s < num_streams; ++s) {
+        if(offsets[s] < offsets[s+1] && offsets[s+1] <= offsets[num_streams]) {
+            memreadbuf buf(packet.data + offsets[s], offsets[s+1] - offsets[s]);
+            std::istream is(&buf);
+            thumbs[s] = LoadImage(is, ImageFileTypeJpg);
+        }
+    }
+
+    return _source->index.LowerBoundTime(packet.time);
+}
+
 void PangoVideo::SetupStreams(const PacketStreamSource& src)
 {
     // Read sources header
     _fixed_size = src.data_size_bytes != 0;
     _size_bytes = src.data_size_bytes;
+    _stream_offsets = src.info.get_value(pango_stream_offsets, false);
 
     _device_properties = src.info["device"];
     const picojson::value& json_streams = src.info["streams"];
     const size_t num_streams = json_streams.size();
+    stream_decoder = CreateStreamDecoders(src);
 
     for (size_t i = 0; i < num_streams; ++i)
     {
@@ -189,10 +982,14 @@ void PangoVideo::SetupStreams(const PacketStreamSource& src)
         if(json_stream.contains("decoded")) {
             const std::string compressed_encoding = encoding;
             encoding = json_stream["decoded"].get<std::string>();
-            const PixelFormat decoded_fmt = PixelFormatFromString(encoding);
-            stream_decoder.push_back(StreamEncoderFactory::I().GetDecoder(compressed_encoding, decoded_fmt));
+            if(StreamEncoderFactory::IsInterFrame(compressed_encoding)) {
+                _inter_frame = true;
+                _keyframe_intervals.push_back(StreamEncoderFactory::KeyframeInterval(json_stream));
+            }else{
+                _keyframe_intervals.push_back(0);
+            }
         }else{
-            stream_decoder.push_back(nullptr);
+            _keyframe_intervals.push_back(0);
         }
 
         StreamInfo si(
@@ -211,6 +1008,23 @@ void PangoVideo::SetupStreams(const PacketStreamSource& src)
     }
 }
 
+std::vector<ImageDecoderIntoFunc> PangoVideo::CreateStreamDecoders(const PacketStreamSource& src)
+{
+    std::vector<ImageDecoderIntoFunc> decoders;
+    const picojson::value& json_streams = src.info["streams"];
+    for (size_t i = 0; i < json_streams.size(); ++i)
+    {
+        const picojson::value& json_stream = json_streams[i];
+        if(json_stream.contains("decoded")) {
+            const PixelFormat decoded_fmt = PixelFormatFromString(json_stream["decoded"].get<std::string>());
+            decoders.push_back(StreamEncoderFactory::I().GetDecoderInto(json_stream["encoding"].get<std::string>(), decoded_fmt, json_stream));
+        }else{
+            decoders.push_back(nullptr);
+        }
+    }
+    return decoders;
+}
+
 PANGOLIN_REGISTER_FACTORY(PangoVideo)
 {
     struct PangoVideoFactory : public FactoryInterface<VideoInterface> {
@@ -218,7 +1032,13 @@ PANGOLIN_REGISTER_FACTORY(PangoVideo)
             const std::string path = PathExpand(uri.url);
 
             if( !uri.scheme.compare("pango") || FileType(uri.url) == ImageFileTypePango ) {
-                return std::unique_ptr<VideoInterface>(new PangoVideo(path.c_str(), PlaybackSession::ChooseFromParams(uri)));
+                const bool memory_map = uri.Get<bool>("mmap", false);
+                const size_t readahead = uri.Get<size_t>("readahead", 0);
+                const bool demux = uri.Get<bool>("demux", true);
+                const int src = uri.Get<int>("src", -1);
+                const size_t cache_bytes = uri.Get<size_t>("cache_mb", 0) * 1024 * 1024;
+                const size_t cache_ahead = uri.Get<size_t>("cache_ahead", 8);
+                return std::unique_ptr<VideoInterface>(new PangoVideo(path.c_str(), PlaybackSession::ChooseFromParams(uri), memory_map, readahead, demux, src, cache_bytes, cache_ahead));
             }
             return std::unique_ptr<VideoInterface>();
         }
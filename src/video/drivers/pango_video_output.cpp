@@ -26,14 +26,30 @@
  */
 
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/image_io.h>
+#include <pangolin/image/image_resize.h>
+#include <pangolin/image/pixel_format_convert.h>
+#include <pangolin/utils/base64.h>
 #include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
 #include <pangolin/utils/memstreambuf.h>
 #include <pangolin/utils/picojson.h>
 #include <pangolin/utils/sigstate.h>
 #include <pangolin/utils/timer.h>
+#include <pangolin/utils/trace.h>
 #include <pangolin/video/drivers/pango_video_output.h>
 #include <pangolin/video/iostream_operators.h>
 #include <pangolin/video/video_interface.h>
+#include <pangolin/video/video_exception.h>
+
+#ifdef BUILD_PANGOLIN_VARS
+#  include <pangolin/var/var.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <set>
 
 #ifndef _WIN_
@@ -45,23 +61,64 @@ namespace pangolin
 
 const std::string pango_video_type = "raw_video";
 
+// Variable size packets end with the uint64 offset of each stream within the packet
+const std::string pango_stream_offsets = "stream_offsets";
+
+// Source of JPEG thumbnails of the video source named by pango_thumbnail_of
+const std::string pango_thumbnail_type = "video_thumbnails";
+const std::string pango_thumbnail_of = "video_source";
+
 void SigPipeHandler(int sig)
 {
     SigState::I().sig_callbacks.at(sig).value = true;
 }
 
-PangoVideoOutput::PangoVideoOutput(const std::string& filename, size_t buffer_size_bytes, const std::map<size_t, std::string> &stream_encoder_uris)
+struct PangoVideoOutput::EncodeJob
+{
+    FramePool::Buffer frame;
+    int64_t time_us;
+    picojson::value frame_properties;
+    std::string binary_meta;
+    std::vector<std::unique_ptr<memstreambuf>> encoded;
+    size_t level;
+    size_t streams_started;
+    size_t streams_done;
+};
+
+PangoVideoOutput::PangoVideoOutput(
+    const std::string& filename, size_t buffer_size_bytes, const std::map<size_t, std::string> &stream_encoder_uris,
+    size_t encode_threads, size_t encode_queue, EncodeDropPolicy drop_policy,
+    size_t direct_depth, bool lock_free, const picojson::value& header_properties
+    )
     : filename(filename),
       packetstream_buffer_size_bytes(buffer_size_bytes),
+      packetstream_direct_depth(direct_depth),
+      packetstream_lock_free(lock_free),
       packetstreamsrcid(-1),
+      packet_alignment(1),
+      thumbnail_interval(0), thumbnail_max_dim(160), thumbnail_quality(75.0f),
+      thumbnail_srcid(-1), thumbnail_countdown(0),
       total_frame_size(0),
       is_pipe(pangolin::IsPipe(filename)),
       fixed_size(true),
-      stream_encoder_uris(stream_encoder_uris)
+      stream_encoder_uris(stream_encoder_uris),
+      worker_streams(0),
+      encode_threads(encode_threads),
+      encode_queue(encode_queue ? encode_queue : 2*encode_threads),
+      drop_policy(drop_policy),
+      dropped_frames(0),
+      encode_quit(false),
+      adapt_high(0.5), adapt_low(0.1), adapt_dwell(30),
+      adapt_max_level(0), adapt_countdown(0), adapt_level(0),
+      stats_published_us(0),
+      encode_scratch(0),
+      packet_scratch(0)
 {
+    packetstream.SetHeaderProperties(header_properties);
+
     if(!is_pipe)
     {
-        packetstream.Open(filename, packetstream_buffer_size_bytes);
+        packetstream.Open(filename, packetstream_buffer_size_bytes, packetstream_direct_depth, packetstream_lock_free);
     }
     else
     {
@@ -73,6 +130,220 @@ PangoVideoOutput::PangoVideoOutput(const std::string& filename, size_t buffer_si
 
 PangoVideoOutput::~PangoVideoOutput()
 {
+    StopPipeline();
+}
+
+void PangoVideoOutput::StopPipeline()
+{
+    {
+        std::lock_guard<std::mutex> l(encode_mutex);
+        encode_quit = true;
+    }
+    encode_cv.notify_all();
+    write_cv.notify_all();
+
+    // Workers drain everything already queued before exiting
+    for(auto& t : encode_workers) t.join();
+    encode_workers.clear();
+    if(write_worker.joinable()) write_worker.join();
+}
+
+size_t PangoVideoOutput::DroppedFrames() const
+{
+    std::lock_guard<std::mutex> l(encode_mutex);
+    return dropped_frames;
+}
+
+PacketStreamWriterStats PangoVideoOutput::Stats()
+{
+    return packetstream.Stats();
+}
+
+void PangoVideoOutput::SetRotation(size_t max_bytes, int64_t max_duration_us)
+{
+    packetstream.SetRotation(max_bytes, max_duration_us);
+}
+
+void PangoVideoOutput::SetWriteback(size_t interval_bytes)
+{
+    packetstream.SetWriteback(interval_bytes);
+}
+
+void PangoVideoOutput::SetPacketAlignment(size_t bytes)
+{
+    packet_alignment = std::max<size_t>(bytes, 1);
+}
+
+void PangoVideoOutput::SetThumbnails(size_t interval, size_t max_dim, float quality)
+{
+    thumbnail_interval = interval;
+    thumbnail_max_dim = std::max<size_t>(max_dim, 1);
+    thumbnail_quality = quality;
+}
+
+void PangoVideoOutput::AddThumbnailSource()
+{
+    picojson::value json_header(picojson::object_type, false);
+    json_header[pango_thumbnail_of] = packetstreamsrcid;
+    json_header["interval"] = thumbnail_interval;
+    picojson::value& json_streams = json_header["streams"];
+    json_streams = picojson::value(picojson::array_type, false);
+
+    thumbnail_streams.clear();
+    for(const StreamInfo& si : streams) {
+        // JPEG takes greyscale or RGB, after reducing in the stream's own format
+        ThumbnailStream t = { 0, 0, PixelFormat(si.PixFormat().channels == 1 ? PixelFormatId::GRAY8 : PixelFormatId::RGB24) };
+        if(CanResizePixelFormat(si.PixFormat()) && (t.fmt == si.PixFormat() || CanConvertPixelFormat(t.fmt, si.PixFormat()))) {
+            const double scale = std::min(1.0, (double)thumbnail_max_dim / std::max(si.Width(), si.Height()));
+            t.w = std::max<size_t>(1, (size_t)(si.Width() * scale + 0.5));
+            t.h = std::max<size_t>(1, (size_t)(si.Height() * scale + 0.5));
+            // YUYV422 / UYVY422 resample in pairs of pixels
+            if(t.w % 2 && si.PixFormat().channel_bits[0] == 4 && !si.PixFormat().planar) ++t.w;
+        }
+        thumbnail_streams.push_back(t);
+
+        picojson::value& json_stream = json_streams.push_back();
+        json_stream["encoding"] = "jpg";
+        json_stream["format"] = t.fmt.Name();
+        json_stream["width"] = t.w;
+        json_stream["height"] = t.h;
+    }
+
+    PacketStreamSource pss;
+    pss.driver = pango_thumbnail_type;
+    pss.uri = input_uri;
+    pss.info = json_header;
+    pss.data_definitions = "struct Thumbnails{ uint8 jpg_data[]; uint64 stream_offsets[" + pangolin::Convert<std::string, size_t>::Do(streams.size()) + "];};";
+    thumbnail_srcid = (int)packetstream.AddSource(pss);
+    thumbnail_countdown = 0;
+}
+
+void PangoVideoOutput::WriteThumbnail(const unsigned char* data, int64_t time_us)
+{
+    PANGO_TRACE_SCOPE("PangoVideoOutput::WriteThumbnail", "video");
+    memstreambuf packet(0);
+    std::ostream packet_stream(&packet);
+    std::vector<uint64_t> stream_offsets(streams.size());
+
+    try {
+        for(size_t i=0; i < streams.size(); ++i) {
+            packet_stream.flush();
+            stream_offsets[i] = packet.size();
+
+            const ThumbnailStream& t = thumbnail_streams[i];
+            const StreamInfo& si = streams[i];
+            if(!t.w) continue;
+
+            TypedImage reduced(t.w, t.h, si.PixFormat());
+            ResizeImage(reduced, si.StreamImage(data), si.PixFormat(), ResizeMethodArea);
+            if(t.fmt == si.PixFormat()) {
+                SaveImage(reduced, t.fmt, packet_stream, ImageFileTypeJpg, true, thumbnail_quality);
+            }else{
+                TypedImage converted(t.w, t.h, t.fmt);
+                ConvertPixelFormat(converted, t.fmt, reduced, si.PixFormat());
+                SaveImage(converted, t.fmt, packet_stream, ImageFileTypeJpg, true, thumbnail_quality);
+            }
+        }
+    }catch(const std::exception& e) {
+        // Most likely built without JPEG support. The video itself is unaffected.
+        pango_print_warn("PangoVideoOutput: Unable to write thumbnails (%s), disabling them.\n", e.what());
+        thumbnail_interval = 0;
+        return;
+    }
+
+    packet_stream.write(reinterpret_cast<const char*>(stream_offsets.data()), stream_offsets.size() * sizeof(uint64_t));
+    packet_stream.flush();
+    packetstream.WriteSourcePacket(thumbnail_srcid, reinterpret_cast<const char*>(packet.data()), time_us, packet.size());
+}
+
+void PangoVideoOutput::SetStreamEncoderParams(size_t i, const picojson::value& params)
+{
+    if(packetstreamsrcid != -1) {
+        throw VideoException("Encoder parameters must be set before SetStreams");
+    }
+    stream_encoder_params[i] = params;
+}
+
+void PangoVideoOutput::PublishStatsAsVars(const std::string& prefix)
+{
+#ifndef BUILD_PANGOLIN_VARS
+    if(!prefix.empty()) {
+        pango_print_warn("Pangolin built without Vars, recording statistics will not be published.\n");
+    }
+#endif
+    stats_vars = prefix;
+}
+
+void PangoVideoOutput::SetAdaptiveQuality(double high, double low, size_t dwell_frames)
+{
+    adapt_high = high;
+    adapt_low = std::min(low, high);
+    adapt_dwell = dwell_frames;
+}
+
+size_t PangoVideoOutput::QualityLevel() const
+{
+    return adapt_level;
+}
+
+void PangoVideoOutput::UpdateQualityLevel()
+{
+    if(adapt_max_level == 0) {
+        return;
+    }
+
+    // Whichever of the log's buffer and the encode queue is backing up
+    const threadedfilebuf::Stats s = packetstream.BufferStats();
+    double occupancy = s.buffer_bytes ? (double)s.queued_bytes / s.buffer_bytes : 0.0;
+    if(!encode_workers.empty()) {
+        std::lock_guard<std::mutex> l(encode_mutex);
+        occupancy = std::max(occupancy, (double)encode_jobs.size() / encode_queue);
+    }
+
+    if(adapt_countdown) --adapt_countdown;
+
+    const size_t level = adapt_level;
+    const bool urgent = occupancy > (1.0 + adapt_high) / 2.0;
+    if(occupancy > adapt_high && level < adapt_max_level && (!adapt_countdown || urgent)) {
+        adapt_level = level + 1;
+        adapt_countdown = adapt_dwell;
+    }else if(occupancy < adapt_low && level > 0 && !adapt_countdown) {
+        adapt_level = level - 1;
+        adapt_countdown = adapt_dwell;
+    }
+}
+
+void PangoVideoOutput::PublishStats()
+{
+#ifdef BUILD_PANGOLIN_VARS
+    // Buffer stats don't wait on the writer, so this is safe while it is blocked
+    const threadedfilebuf::Stats s = packetstream.BufferStats();
+    const double mb = 1024.0 * 1024.0;
+
+    size_t in_flight, dropped;
+    {
+        std::lock_guard<std::mutex> l(encode_mutex);
+        in_flight = encode_jobs.size();
+        dropped = dropped_frames;
+    }
+
+    const auto publish = [this](const std::string& name, double value) {
+        Var<double> var(stats_vars + "." + name, value);
+        var = value;
+    };
+    publish("queued_mb", s.queued_bytes / mb);
+    publish("buffer_mb", s.buffer_bytes / mb);
+    publish("high_water_mb", s.high_water_bytes / mb);
+    publish("written_mb", s.written_bytes / mb);
+    publish("write_mb_per_s", s.write_mb_per_s);
+    publish("blocked_s", s.blocked_s);
+    publish("blocked_writes", (double)s.blocked_writes);
+    publish("encode_in_flight", (double)in_flight);
+    publish("dropped_frames", (double)dropped);
+    if(adapt_max_level) {
+        publish("quality_level", (double)adapt_level);
+    }
+#endif
 }
 
 const std::vector<StreamInfo>& PangoVideoOutput::Streams() const
@@ -107,6 +378,9 @@ void PangoVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::
         json_header["device"] = device_properties;
 
         stream_encoders.resize(streams.size());
+        stream_levels.assign(streams.size(), std::vector<ImageEncoderFunc>());
+        stream_inter_frame.assign(streams.size(), false);
+        adapt_max_level = 0;
 
         fixed_size = true;
 
@@ -118,12 +392,40 @@ void PangoVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::
 
             picojson::value& json_stream = json_streams.push_back();
 
-            std::string encoder_name = si.PixFormat().format;
+            std::string encoder_name = si.PixFormat().Name();
             if(stream_encoder_uris.find(i) != stream_encoder_uris.end() && !stream_encoder_uris[i].empty() ) {
                 // instantiate encoder and write it's name to the stream properties
-                json_stream["decoded"] = si.PixFormat().format;
+                json_stream["decoded"] = si.PixFormat().Name();
                 encoder_name = stream_encoder_uris[i];
-                stream_encoders[i] = StreamEncoderFactory::I().GetEncoder(encoder_name, si.PixFormat());
+                const picojson::value& params = stream_encoder_params[i];
+                if(StreamEncoderFactory::IsAdaptive(encoder_name)) {
+                    // The level of each frame is recorded with it, for the decoder
+                    const std::vector<std::string> levels = StreamEncoderFactory::AdaptiveLevels(encoder_name);
+                    picojson::value& json_levels = json_stream["levels"];
+                    json_levels = picojson::value(picojson::array_type, false);
+                    for(const std::string& level : levels) {
+                        if(StreamEncoderFactory::IsInterFrame(level) || levels.size() > 256) {
+                            throw VideoException("Unable to adapt encoder '" + encoder_name + "'", "Use up to 256 levels of intra-frame encoders");
+                        }
+                        stream_levels[i].push_back(StreamEncoderFactory::I().GetEncoder(level, si.PixFormat(), params));
+                        json_levels.push_back(level);
+                    }
+                    adapt_max_level = std::max(adapt_max_level, levels.size() - 1);
+                    encoder_name = "adaptive";
+                }else{
+                    stream_encoders[i] = StreamEncoderFactory::I().GetEncoder(encoder_name, si.PixFormat(), params);
+                }
+
+                // Decoders need the same dictionary, stored once with the stream
+                if(params.contains("zstd_dictionary")) {
+                    json_stream["zstd_dictionary"] = params["zstd_dictionary"];
+                }
+
+                // Readers restart decoding from keyframes when seeking
+                if(StreamEncoderFactory::IsInterFrame(encoder_name)) {
+                    stream_inter_frame[i] = true;
+                    json_stream["keyframe_interval"] = StreamEncoderFactory::KeyframeInterval(params);
+                }
                 fixed_size = false;
             }
 
@@ -139,9 +441,31 @@ void PangoVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::
         pss.uri = input_uri;
         pss.info = json_header;
         pss.data_size_bytes = fixed_size ? total_frame_size : 0;
+        pss.data_alignment_bytes = packet_alignment;
         pss.data_definitions = "struct Frame{ uint8 stream_data[" + pangolin::Convert<std::string, size_t>::Do(total_frame_size) + "];};";
 
+        if(!fixed_size) {
+            // Readers which know about it can then decode streams concurrently
+            pss.info[pango_stream_offsets] = true;
+        }
+
         packetstreamsrcid = (int)packetstream.AddSource(pss);
+
+        if(thumbnail_interval) {
+            AddThumbnailSource();
+        }
+
+        // Inter-frame streams are encoded in order by the writer, leaving the rest to the workers
+        worker_streams = std::count(stream_inter_frame.begin(), stream_inter_frame.end(), false);
+
+        // Only encoded streams benefit from the pipeline. Pipes are excluded
+        // since the capture thread may close the writer under us.
+        if(!fixed_size && !is_pipe && encode_threads > 0) {
+            for(size_t i=0; i < encode_threads; ++i) {
+                encode_workers.emplace_back(&PangoVideoOutput::EncodeLoop, this);
+            }
+            write_worker = std::thread(&PangoVideoOutput::WriteLoop, this);
+        }
     } else {
         throw std::runtime_error("Unable to add new streams");
     }
@@ -150,6 +474,18 @@ void PangoVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::
 int PangoVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
 {
     const int64_t host_reception_time_us = frame_properties.get_value(PANGO_HOST_RECEPTION_TIME_US, Time_us(TimeNow()));
+    return WriteFrame(data, host_reception_time_us, frame_properties, std::string());
+}
+
+int PangoVideoOutput::WriteStreams(const unsigned char* data, const FrameMetadata& metadata)
+{
+    const int64_t host_reception_time_us = metadata.Has(FrameMetadata::HostReceptionTime) ? metadata.host_reception_time_us : Time_us(TimeNow());
+    return WriteFrame(data, host_reception_time_us, picojson::value(), metadata.Serialize());
+}
+
+int PangoVideoOutput::WriteFrame(const unsigned char* data, int64_t host_reception_time_us, const picojson::value& frame_properties, const std::string& binary_meta)
+{
+    PANGO_TRACE_SCOPE("PangoVideoOutput::WriteStreams", "video");
 
 #ifndef _WIN_
     if (is_pipe)
@@ -168,8 +504,11 @@ int PangoVideoOutput::WriteStreams(const unsigned char* data, const picojson::va
         {
             if (fd != -1)
             {
-                packetstream.Open(filename, packetstream_buffer_size_bytes);
+                packetstream.Open(filename, packetstream_buffer_size_bytes, 0, packetstream_lock_free);
                 close(fd);
+
+                // The new reader starts from our next packet, which must be a keyframe
+                ResetInterFrameEncoders();
             }
         }
         else
@@ -199,36 +538,320 @@ int PangoVideoOutput::WriteStreams(const unsigned char* data, const picojson::va
     }
 #endif
 
-    if(!fixed_size) {
-        memstreambuf encoded(total_frame_size);
-        std::ostream encode_stream(&encoded);
+    if(!stats_vars.empty()) {
+        const int64_t now_us = Time_us(TimeNow());
+        if(now_us - stats_published_us > 500000) {
+            PublishStats();
+            stats_published_us = now_us;
+        }
+    }
 
-        for(size_t i=0; i < streams.size(); ++i) {
-            const StreamInfo& si = streams[i];
-            const Image<unsigned char> stream_image = si.StreamImage(data);
+    UpdateQualityLevel();
 
-            if(stream_encoders[i]) {
-                // Encode to buffer
-                stream_encoders[i](encode_stream, stream_image);
-            }else{
-                if(stream_image.IsContiguous()) {
-                    encode_stream.write((char*)stream_image.ptr, streams[i].SizeBytes());
-                }else{
-                    for(size_t row=0; row < stream_image.h; ++row) {
-                        encode_stream.write((char*)stream_image.RowPtr(row), si.RowBytes());
-                    }
-                }
+    // Thumbnails are matched to frames by time, so may be written ahead of
+    // a frame still being encoded
+    if(thumbnail_interval) {
+        if(thumbnail_countdown == 0) {
+            WriteThumbnail(data, host_reception_time_us);
+            thumbnail_countdown = thumbnail_interval;
+        }
+        --thumbnail_countdown;
+    }
+
+    if(!encode_workers.empty()) {
+        QueueFrame(data, host_reception_time_us, frame_properties, binary_meta);
+    }else if(!fixed_size) {
+        if(!EncodeInPlace(data, host_reception_time_us, frame_properties, binary_meta)) {
+            encode_scratch.clear();
+            std::ostream encode_stream(&encode_scratch);
+            std::vector<uint64_t> stream_offsets(streams.size());
+
+            for(size_t i=0; i < streams.size(); ++i) {
+                encode_stream.flush();
+                stream_offsets[i] = encode_scratch.size();
+                EncodeStream(i, data, encode_stream, adapt_level);
             }
+            encode_stream.write(reinterpret_cast<const char*>(stream_offsets.data()), stream_offsets.size() * sizeof(uint64_t));
+            encode_stream.flush();
+            packetstream.WriteSourcePacket(packetstreamsrcid, reinterpret_cast<const char*>(encode_scratch.data()), host_reception_time_us, encode_scratch.size(), frame_properties, binary_meta);
         }
-        encode_stream.flush();
-        packetstream.WriteSourcePacket(packetstreamsrcid, reinterpret_cast<const char*>(encoded.data()), host_reception_time_us, encoded.size(), frame_properties);
     }else{
-        packetstream.WriteSourcePacket(packetstreamsrcid, reinterpret_cast<const char*>(data), host_reception_time_us, total_frame_size, frame_properties);
+        packetstream.WriteSourcePacket(packetstreamsrcid, reinterpret_cast<const char*>(data), host_reception_time_us, total_frame_size, frame_properties, binary_meta);
     }
 
     return 0;
 }
 
+void PangoVideoOutput::ResetInterFrameEncoders()
+{
+    for(size_t i=0; i < streams.size(); ++i) {
+        if(stream_inter_frame[i]) {
+            stream_encoders[i] = StreamEncoderFactory::I().GetEncoder(stream_encoder_uris[i], streams[i].PixFormat(), stream_encoder_params[i]);
+        }
+    }
+}
+
+void PangoVideoOutput::EncodeStream(size_t i, const unsigned char* data, std::ostream& os, size_t level)
+{
+    PANGO_TRACE_SCOPE("PangoVideoOutput::Encode", "video");
+    const StreamInfo& si = streams[i];
+    const Image<unsigned char> stream_image = si.StreamImage(data);
+
+    if(!stream_levels[i].empty()) {
+        // Ladders may be shorter than the longest
+        const size_t l = std::min(level, stream_levels[i].size() - 1);
+        os.put((char)l);
+        stream_levels[i][l](os, stream_image);
+    }else if(stream_encoders[i]) {
+        // Encode to buffer
+        stream_encoders[i](os, stream_image);
+    }else{
+        if(stream_image.IsContiguous()) {
+            os.write((char*)stream_image.ptr, si.SizeBytes());
+        }else{
+            for(size_t row=0; row < stream_image.h; ++row) {
+                os.write((char*)stream_image.RowPtr(row), si.RowBytes());
+            }
+        }
+    }
+}
+
+bool PangoVideoOutput::EncodeInPlace(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta)
+{
+    // A frame which doesn't fit is encoded again into scratch, which
+    // encoders holding state between frames can't allow
+    if(std::find(stream_inter_frame.begin(), stream_inter_frame.end(), true) != stream_inter_frame.end()) {
+        return false;
+    }
+
+    // Room for the frame to grow a little under encoding, as raw streams or
+    // incompressible images do
+    const size_t offsets_bytes = streams.size() * sizeof(uint64_t);
+    const size_t max_bytes = total_frame_size + total_frame_size / 8 + 4096 + offsets_bytes;
+    char* dst = packetstream.ReserveSourcePacket(packetstreamsrcid, time_us, max_bytes, frame_properties, binary_meta);
+    if(!dst) {
+        return false;
+    }
+
+    memwritebuf packet(reinterpret_cast<unsigned char*>(dst), max_bytes);
+    try {
+        std::ostream encode_stream(&packet);
+        std::vector<uint64_t> stream_offsets(streams.size());
+        const size_t level = adapt_level;
+        for(size_t i=0; i < streams.size() && !packet.overflowed(); ++i) {
+            encode_stream.flush();
+            stream_offsets[i] = packet.size();
+            EncodeStream(i, data, encode_stream, level);
+        }
+        encode_stream.write(reinterpret_cast<const char*>(stream_offsets.data()), offsets_bytes);
+        encode_stream.flush();
+    }catch(...) {
+        packetstream.CancelSourcePacket();
+        if(!packet.overflowed()) throw;
+        return false;
+    }
+
+    if(packet.overflowed()) {
+        packetstream.CancelSourcePacket();
+        return false;
+    }
+
+    packetstream.CommitSourcePacket(packet.size());
+    return true;
+}
+
+void PangoVideoOutput::WritePacket(const std::vector<std::unique_ptr<memstreambuf>>& encoded, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta)
+{
+    PANGO_TRACE_SCOPE("PangoVideoOutput::WritePacket", "video");
+    const size_t offsets_bytes = streams.size() * sizeof(uint64_t);
+    size_t total = offsets_bytes;
+    for(const auto& e : encoded) total += e->size();
+
+    std::vector<uint64_t> stream_offsets(streams.size());
+    uint64_t offset = 0;
+    for(size_t i=0; i < encoded.size(); ++i) {
+        stream_offsets[i] = offset;
+        offset += encoded[i]->size();
+    }
+
+    // Gather the streams straight into the log's buffer where there's room
+    char* dst = packetstream.ReserveSourcePacket(packetstreamsrcid, time_us, total, frame_properties, binary_meta);
+    if(dst) {
+        for(size_t i=0; i < encoded.size(); ++i) {
+            std::memcpy(dst + stream_offsets[i], encoded[i]->data(), encoded[i]->size());
+        }
+        std::memcpy(dst + offset, stream_offsets.data(), offsets_bytes);
+        packetstream.CommitSourcePacket(total);
+        return;
+    }
+
+    packet_scratch.clear();
+    std::ostream packet_stream(&packet_scratch);
+    for(size_t i=0; i < encoded.size(); ++i) {
+        packet_stream.write(reinterpret_cast<const char*>(encoded[i]->data()), encoded[i]->size());
+    }
+    packet_stream.write(reinterpret_cast<const char*>(stream_offsets.data()), offsets_bytes);
+    packet_stream.flush();
+    packetstream.WriteSourcePacket(packetstreamsrcid, reinterpret_cast<const char*>(packet_scratch.data()), time_us, packet_scratch.size(), frame_properties, binary_meta);
+}
+
+void PangoVideoOutput::QueueFrame(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta)
+{
+    {
+        std::unique_lock<std::mutex> l(encode_mutex);
+        if(encode_error) {
+            std::exception_ptr e = encode_error;
+            encode_error = nullptr;
+            std::rethrow_exception(e);
+        }
+
+        const auto has_space = [this](){ return encode_jobs.size() < encode_queue; };
+        if(!has_space()) {
+            if(drop_policy == EncodeDropPolicy::DropNewest) {
+                ++dropped_frames;
+                return;
+            }else if(drop_policy == EncodeDropPolicy::DropOldest && DropOldestFrame()) {
+                ++dropped_frames;
+            }
+            space_cv.wait(l, has_space);
+        }
+    }
+
+    // data is only valid for this call, so take a copy for the workers
+    auto job = std::make_shared<EncodeJob>();
+    job->frame = FramePool::I().Acquire(total_frame_size);
+    std::memcpy(job->frame.get(), data, total_frame_size);
+    job->time_us = time_us;
+    job->level = adapt_level;
+    job->frame_properties = frame_properties;
+    job->binary_meta = binary_meta;
+    {
+        // Reuse the buffers of written frames, which have grown to size
+        std::lock_guard<std::mutex> l(encode_mutex);
+        while(job->encoded.size() < streams.size() && !spare_encoded.empty()) {
+            job->encoded.push_back(std::move(spare_encoded.back()));
+            spare_encoded.pop_back();
+        }
+    }
+    for(size_t i=job->encoded.size(); i < streams.size(); ++i) {
+        job->encoded.emplace_back(new memstreambuf(streams[i].SizeBytes()));
+    }
+    job->streams_started = 0;
+    job->streams_done = 0;
+
+    {
+        std::lock_guard<std::mutex> l(encode_mutex);
+        encode_jobs.push_back(job);
+        for(size_t i=0; i < streams.size(); ++i) {
+            if(!stream_inter_frame[i]) {
+                encode_tasks.emplace_back(job, i);
+            }
+        }
+    }
+    encode_cv.notify_all();
+}
+
+bool PangoVideoOutput::DropOldestFrame()
+{
+    // Called with encode_mutex held. Frames already being encoded are kept.
+    for(auto it = encode_jobs.begin(); it != encode_jobs.end(); ++it) {
+        if((*it)->streams_started == 0) {
+            const std::shared_ptr<EncodeJob> job = *it;
+            encode_jobs.erase(it);
+            encode_tasks.erase(
+                std::remove_if(encode_tasks.begin(), encode_tasks.end(),
+                    [&](const std::pair<std::shared_ptr<EncodeJob>, size_t>& t){ return t.first == job; }),
+                encode_tasks.end()
+            );
+            write_cv.notify_all();
+            return true;
+        }
+    }
+    return false;
+}
+
+void PangoVideoOutput::EncodeLoop()
+{
+    TraceSetThreadName("PangoVideoOutput encode");
+    while(true) {
+        std::shared_ptr<EncodeJob> job;
+        size_t i;
+        {
+            std::unique_lock<std::mutex> l(encode_mutex);
+            encode_cv.wait(l, [this](){ return encode_quit || !encode_tasks.empty(); });
+            if(encode_tasks.empty()) return;
+            job = encode_tasks.front().first;
+            i = encode_tasks.front().second;
+            encode_tasks.pop_front();
+            ++job->streams_started;
+        }
+
+        std::exception_ptr error;
+        try {
+            std::ostream os(job->encoded[i].get());
+            EncodeStream(i, job->frame.get(), os, job->level);
+            os.flush();
+        }catch(...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> l(encode_mutex);
+        if(error && !encode_error) encode_error = error;
+        if(++job->streams_done == worker_streams) {
+            if(worker_streams == streams.size()) {
+                job->frame.Reset();
+            }
+            write_cv.notify_all();
+        }
+    }
+}
+
+void PangoVideoOutput::WriteLoop()
+{
+    TraceSetThreadName("PangoVideoOutput write");
+    while(true) {
+        std::shared_ptr<EncodeJob> job;
+        {
+            std::unique_lock<std::mutex> l(encode_mutex);
+            write_cv.wait(l, [this](){
+                return (!encode_jobs.empty() && encode_jobs.front()->streams_done == worker_streams) ||
+                       (encode_quit && encode_jobs.empty());
+            });
+            if(encode_jobs.empty()) return;
+            job = encode_jobs.front();
+            // Frames being written are never dropped
+            ++job->streams_started;
+        }
+
+        // Packets are written in capture order, only ever from this thread
+        try {
+            if(worker_streams < streams.size()) {
+                for(size_t i=0; i < streams.size(); ++i) {
+                    if(stream_inter_frame[i]) {
+                        std::ostream os(job->encoded[i].get());
+                        EncodeStream(i, job->frame.get(), os, job->level);
+                        os.flush();
+                    }
+                }
+                job->frame.Reset();
+            }
+            WritePacket(job->encoded, job->time_us, job->frame_properties, job->binary_meta);
+        }catch(...) {
+            std::lock_guard<std::mutex> l(encode_mutex);
+            if(!encode_error) encode_error = std::current_exception();
+        }
+
+        for(auto& e : job->encoded) e->clear();
+
+        {
+            std::lock_guard<std::mutex> l(encode_mutex);
+            encode_jobs.pop_front();
+            for(auto& e : job->encoded) spare_encoded.push_back(std::move(e));
+        }
+        space_cv.notify_all();
+    }
+}
+
 PANGOLIN_REGISTER_FACTORY(PangoVideoOutput)
 {
     struct PangoVideoFactory : public FactoryInterface<VideoOutputInterface> {
@@ -256,9 +879,97 @@ PANGOLIN_REGISTER_FACTORY(PangoVideoOutput)
                 stream_encoder_uris[i] = uri.Get<std::string>(encoder_key, default_encoder);
             }
 
-            return std::unique_ptr<VideoOutputInterface>(
-                new PangoVideoOutput(filename, buffer_size_bytes, stream_encoder_uris)
+            // Pipelined encoding
+            const size_t encode_threads = uri.Get<size_t>("encode_threads", 0);
+            const size_t encode_queue = uri.Get<size_t>("encode_queue", 0);
+            const std::string drop = uri.Get<std::string>("drop", "block");
+
+            EncodeDropPolicy drop_policy;
+            if(drop == "block") {
+                drop_policy = EncodeDropPolicy::Block;
+            }else if(drop == "newest") {
+                drop_policy = EncodeDropPolicy::DropNewest;
+            }else if(drop == "oldest") {
+                drop_policy = EncodeDropPolicy::DropOldest;
+            }else{
+                throw VideoException("Unknown drop policy '" + drop + "', expected block, newest or oldest");
+            }
+
+            // Blocks in flight for O_DIRECT writes, 0 to write through the page cache
+            const size_t direct_depth = uri.Get<size_t>("direct", 0);
+            const bool lock_free = uri.Get<bool>("lock_free", false);
+
+            // Placement of this recording on the time base of a coordinated
+            // recording of several machines, see RecordCoordinator
+            picojson::value header_properties;
+            if(uri.Contains("clock_offset_us")) {
+                header_properties["clock_offset_us"] = uri.Get<int64_t>("clock_offset_us", 0);
+            }
+            for(const char* key : {"clock_session", "clock_node"}) {
+                if(uri.Contains(key)) header_properties[key] = uri.Get<std::string>(key, "");
+            }
+
+            auto output = std::unique_ptr<PangoVideoOutput>(
+                new PangoVideoOutput(filename, buffer_size_bytes, stream_encoder_uris, encode_threads, encode_queue, drop_policy, direct_depth, lock_free, header_properties)
+            );
+            output->PublishStatsAsVars(uri.Get<std::string>("vars", ""));
+
+            // Back-pressure at which streams given a ladder of encoders (e.g.
+            // encoder=png|jpg90|jpg70) step down and back up it
+            output->SetAdaptiveQuality(
+                uri.Get<double>("adapt_high", 0.5), uri.Get<double>("adapt_low", 0.1),
+                uri.Get<size_t>("adapt_frames", 30)
+            );
+
+            // Inter-frame codec settings for all streams
+            picojson::value codec_params(picojson::object_type, false);
+            for(const std::string key : {"keyframe_interval", "bitrate"}) {
+                if(uri.Contains(key)) codec_params[key] = uri.Get<int64_t>(key, 0);
+            }
+            for(const std::string key : {"hwaccel", "vaapi_device"}) {
+                if(uri.Contains(key)) codec_params[key] = uri.Get<std::string>(key, "");
+            }
+
+            // zstd workers and trained dictionaries, for all / the Nth stream
+            const int64_t zstd_workers = uri.Get<int64_t>("zstd_workers", 0);
+            const std::string default_zstd_dict = uri.Get<std::string>("zstd_dict", "");
+            for(size_t i=0; i<100; ++i)
+            {
+                const std::string dict_file = PathExpand(uri.Get<std::string>(pangolin::FormatString("zstd_dict%",i+1), default_zstd_dict));
+                picojson::value params = codec_params;
+                if(zstd_workers > 0) {
+                    params["zstd_workers"] = zstd_workers;
+                }
+                if(!dict_file.empty()) {
+                    std::ifstream f(dict_file, std::ios::in | std::ios::binary);
+                    if(!f.is_open()) {
+                        throw VideoException("Unable to open zstd dictionary '" + dict_file + "'");
+                    }
+                    const std::string dict((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+                    params["zstd_dictionary"] = Base64Encode(dict);
+                }
+                if(!params.get<picojson::object>().empty()) {
+                    output->SetStreamEncoderParams(i, params);
+                }
+            }
+
+            // Rotate to a new file by size and / or duration
+            const size_t rotate_mb = uri.Get<size_t>("rotate_mb", 0);
+            const double rotate_s = uri.Get<double>("rotate_s", 0.0);
+            output->SetRotation(rotate_mb * mb, (int64_t)(rotate_s * 1E6));
+
+            // Bound dirty pages, rather than stall on bursts of writeback
+            output->SetWriteback(uri.Get<size_t>("writeback_mb", 0) * mb);
+
+            // Page (4096) or cache line (64) aligned frames within the log
+            output->SetPacketAlignment(uri.Get<size_t>("align", 1));
+
+            // Thumbnails every N frames for scrubbing
+            output->SetThumbnails(
+                uri.Get<size_t>("thumbnails", 0), uri.Get<size_t>("thumbnail_size", 160),
+                uri.Get<float>("thumbnail_quality", 75.0f)
             );
+            return output;
         }
     };
 
@@ -28,6 +28,7 @@
 #include <pangolin/video/drivers/pleora.h>
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
+#include <algorithm>
 #include <thread>
 
 #ifdef DEBUGPLEORA
@@ -156,7 +157,7 @@ PixelFormat PleoraFormat(const PvGenEnum* pfmt)
 }
 
 PleoraVideo::PleoraVideo(const Params& p): size_bytes(0), lPvSystem(0), lDevice(0), lStream(0), lDeviceParams(0), lStart(0), lStop(0),
-    lTemperatureCelcius(0), getTemp(false), lStreamParams(0), validGrabbedBuffers(0)
+    lTemperatureCelcius(0), getTemp(false), lStreamParams(0), validGrabbedBuffers(0), streaming(false)
 {
     std::string sn;
     std::string mn;
@@ -192,6 +193,7 @@ PleoraVideo::PleoraVideo(const Params& p): size_bytes(0), lPvSystem(0), lDevice(
 
     InitDevice(mn.empty() ? 0 : mn.c_str(), sn.empty() ? 0 : sn.c_str(), index);
     SetDeviceParams(device_params);
+    readout = QueryReadout();
     InitStream();
 
     InitPangoStreams();
@@ -431,6 +433,7 @@ bool PleoraVideo::DropNFrames(uint32_t n)
 {
     if(n > validGrabbedBuffers) return false;
 
+    std::lock_guard<std::mutex> lock(lease_mutex);
     while(n > 0) {
        lStream->QueueBuffer(lGrabbedBuffList.front().buff);
        lGrabbedBuffList.pop_front();
@@ -444,13 +447,17 @@ bool PleoraVideo::DropNFrames(uint32_t n)
 
 void PleoraVideo::Start()
 {
-    if(lStream->GetQueuedBufferCount() == 0) {
-        // Queue all buffers in the stream
+    std::lock_guard<std::mutex> lock(lease_mutex);
+    if(!streaming) {
+        // Queue all buffers in the stream, except those still leased out
         for( BufferList::iterator lIt = lBufferList.begin(); lIt != lBufferList.end(); lIt++ ) {
-            lStream->QueueBuffer( *lIt );
+            if(leased_buffers.find(*lIt) == leased_buffers.end()) {
+                lStream->QueueBuffer( *lIt );
+            }
         }
         lDevice->StreamEnable();
         lStart->Execute();
+        streaming = true;
     } else {
 //        // It isn't an error to repeatedly start
 //        pango_print_warn("PleoraVideo: Already started.\n");
@@ -459,8 +466,10 @@ void PleoraVideo::Start()
 
 void PleoraVideo::Stop()
 {
+    std::lock_guard<std::mutex> lock(lease_mutex);
     // stop grab thread
-    if(lStream->GetQueuedBufferCount() > 0) {
+    if(streaming) {
+        streaming = false;
         lStop->Execute();
         lDevice->StreamDisable();
 
@@ -471,6 +480,10 @@ void PleoraVideo::Stop()
             PvResult lOperationResult;
             lStream->RetrieveBuffer( &lBuffer, &lOperationResult );
         }
+
+        // Retrieved frames are requeued along with the rest on Start()
+        lGrabbedBuffList.clear();
+        validGrabbedBuffers = 0;
     } else {
 //        // It isn't an error to repeatedly stop
 //        pango_print_warn("PleoraVideo: Already stopped.\n");
@@ -487,14 +500,10 @@ const std::vector<StreamInfo>& PleoraVideo::Streams() const
     return streams;
 }
 
-bool PleoraVideo::ParseBuffer(PvBuffer* lBuffer,  unsigned char* image)
+bool PleoraVideo::ParseBuffer(PvBuffer* lBuffer)
 {
   TSTART()
   if ( lBuffer->GetPayloadType() == PvPayloadTypeImage ) {
-      PvImage *lImage = lBuffer->GetImage();
-      TGRABANDPRINT("GetImage took ")
-      std::memcpy(image, lImage->GetDataPointer(), size_bytes);
-      TGRABANDPRINT("memcpy took ")
       // Required frame properties
       frame_properties[PANGO_CAPTURE_TIME_US] = picojson::value(lBuffer->GetTimestamp());
       frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(lBuffer->GetReceptionTime());
@@ -518,68 +527,84 @@ bool PleoraVideo::ParseBuffer(PvBuffer* lBuffer,  unsigned char* image)
 
 }
 
-bool PleoraVideo::GrabNext( unsigned char* image, bool wait)
+// Take the oldest retrieved buffer off the list and lease it out, or queue
+// it straight back to the stream if it doesn't hold a good image.
+FrameLease PleoraVideo::LeaseFront()
 {
-    const uint32_t timeout = wait ? 1000 : 0;
-    bool good = false;
-    TSTART()
-    DBGPRINT("GrabNext no thread:")
+    PvBuffer* lBuffer = lGrabbedBuffList.front().buff;
+    const bool ok = lGrabbedBuffList.front().res.IsOK() && ParseBuffer(lBuffer);
+    lGrabbedBuffList.pop_front();
+    --validGrabbedBuffers;
 
-    RetriveAllAvailableBuffers((validGrabbedBuffers==0) ? timeout : 0);
-    TGRABANDPRINT("Retriving all available buffers (valid frames in queue=%d, queue size=%ld) took ",validGrabbedBuffers ,lGrabbedBuffList.size())
+    std::lock_guard<std::mutex> lock(lease_mutex);
+    if(!ok) {
+        if(streaming) lStream->QueueBuffer(lBuffer);
+        return FrameLease();
+    }
 
-    if(validGrabbedBuffers == 0) return false;
+    leased_buffers.insert(lBuffer);
+    return FrameLease(lBuffer->GetImage()->GetDataPointer(), size_bytes, [this,lBuffer](){
+        ReleaseBuffer(lBuffer);
+    });
+}
 
-    // Retrieve next buffer from list and parse it
-    GrabbedBufferList::iterator front = lGrabbedBuffList.begin();
-    if ( front->res.IsOK() ) {
-        good = ParseBuffer(front->buff, image);
+void PleoraVideo::ReleaseBuffer(PvBuffer* lBuffer)
+{
+    std::lock_guard<std::mutex> lock(lease_mutex);
+    leased_buffers.erase(lBuffer);
+    if(streaming) {
+        lStream->QueueBuffer(lBuffer);
     }
-    TGRABANDPRINT("Parsing buffer took ")
+}
 
-    lStream->QueueBuffer(front->buff);
-    TGRABANDPRINT("\tPLEORA:QueueBuffer: ")
+FrameLease PleoraVideo::GrabNextLease( bool wait )
+{
+    const uint32_t timeout = wait ? 1000 : 0;
+    TSTART()
+    DBGPRINT("GrabNextLease no thread:")
 
-    // Remove used buffer from list.
-    lGrabbedBuffList.pop_front();
-    --validGrabbedBuffers;
+    RetriveAllAvailableBuffers((validGrabbedBuffers==0) ? timeout : 0);
+    TGRABANDPRINT("Retriving all available buffers (valid frames in queue=%d, queue size=%ld) took ",validGrabbedBuffers ,lGrabbedBuffList.size())
 
-    return good;
+    if(validGrabbedBuffers == 0) return FrameLease();
+    return LeaseFront();
 }
 
-
-bool PleoraVideo::GrabNewest( unsigned char* image, bool wait )
+FrameLease PleoraVideo::GrabNewestLease( bool wait )
 {
     const uint32_t timeout = wait ? 0xFFFFFFFF : 0;
-    bool good = false;
-
     TSTART()
-    DBGPRINT("GrabNewest no thread:")
+    DBGPRINT("GrabNewestLease no thread:")
+
     RetriveAllAvailableBuffers((validGrabbedBuffers==0) ? timeout : 0);
     TGRABANDPRINT("Retriving all available buffers (valid frames in queue=%d, queue size=%ld) took ",validGrabbedBuffers ,lGrabbedBuffList.size())
 
     if(validGrabbedBuffers == 0) {
         DBGPRINT("No valid buffers, returning.")
-        return false;
+        return FrameLease();
     }
     if(validGrabbedBuffers > 1) DropNFrames(validGrabbedBuffers-1);
     TGRABANDPRINT("Dropping %d frames took ", (validGrabbedBuffers-1))
 
-    // Retrieve next buffer from list and parse it
-    GrabbedBufferList::iterator front = lGrabbedBuffList.begin();
-    if ( front->res.IsOK() ) {
-        good = ParseBuffer(front->buff, image);
-    }
-    TGRABANDPRINT("Parsing buffer took ")
-
-    lStream->QueueBuffer(front->buff);
-    TGRABANDPRINT("Requeueing buffer took ")
+    return LeaseFront();
+}
 
-    // Remove used buffer from list.
-    lGrabbedBuffList.pop_front();
-    --validGrabbedBuffers;
+bool PleoraVideo::GrabNext( unsigned char* image, bool wait)
+{
+    const FrameLease lease = GrabNextLease(wait);
+    if(lease) {
+        std::memcpy(image, lease.data(), size_bytes);
+    }
+    return lease.IsValid();
+}
 
-    return good;
+bool PleoraVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    const FrameLease lease = GrabNewestLease(wait);
+    if(lease) {
+        std::memcpy(image, lease.data(), size_bytes);
+    }
+    return lease.IsValid();
 }
 
 void PleoraVideo::RetriveAllAvailableBuffers(uint32_t timeout){
@@ -700,6 +725,115 @@ void PleoraVideo::SetupTrigger(bool triggerActive, int64_t triggerSource, int64_
     }
 }
 
+int64_t PleoraVideo::SetAlignedParam(const char* name, int64_t val, bool round_up)
+{
+    PvGenInteger* param = lDeviceParams->GetInteger(name);
+    if(!param || !param->IsWritable()) {
+        return -1;
+    }
+
+    int64_t vmin = 0, vmax = val, inc = 1;
+    param->GetMin(vmin);
+    param->GetMax(vmax);
+    param->GetIncrement(inc);
+    inc = std::max<int64_t>(inc, 1);
+
+    int64_t v = vmin + ((val - vmin) / inc) * inc;
+    if(round_up && v < val) v += inc;
+    v = std::max(vmin, std::min(vmax, v));
+
+    if(param->SetValue(v).IsFailure()) {
+        return -1;
+    }
+    param->GetValue(v);
+    return v;
+}
+
+int64_t PleoraVideo::DeviceParamOr(const char* name, int64_t def)
+{
+    PvGenInteger* param = lDeviceParams->GetInteger(name);
+    int64_t v = def;
+    if(!param || param->GetValue(v).IsFailure()) {
+        return def;
+    }
+    return v;
+}
+
+VideoReadout PleoraVideo::SetReadout(const VideoReadout& want)
+{
+    {
+        std::lock_guard<std::mutex> lock(lease_mutex);
+        if(!leased_buffers.empty()) {
+            throw VideoException("PleoraVideo: Unable to change readout whilst frames are leased");
+        }
+    }
+
+    const bool was_streaming = streaming;
+    const size_t buffer_count = lBufferList.size();
+    Stop();
+    DeinitBuffers();
+
+    // Binning and decimation first, since the window is given in their units
+    for(const char* name : {"BinningHorizontal", "BinningVertical"}) {
+        SetAlignedParam(name, (int64_t)want.binning, false);
+    }
+    for(const char* name : {"DecimationHorizontal", "DecimationVertical"}) {
+        SetAlignedParam(name, (int64_t)want.decimation, false);
+    }
+
+    const int64_t f = DeviceParamOr("BinningHorizontal", 1) * DeviceParamOr("DecimationHorizontal", 1);
+
+    // Make room for the window before moving it, growing it to stay aligned
+    SetAlignedParam("OffsetX", 0, false);
+    SetAlignedParam("OffsetY", 0, false);
+    if(want.IsFullSensor()) {
+        SetAlignedParam("Width", DeviceParamOr("WidthMax", 0), false);
+        SetAlignedParam("Height", DeviceParamOr("HeightMax", 0), false);
+    }else{
+        const int64_t x = (int64_t)want.x / f;
+        const int64_t y = (int64_t)want.y / f;
+        SetAlignedParam("Width", ((int64_t)(want.x + want.w) + f - 1) / f - x, true);
+        SetAlignedParam("Height", ((int64_t)(want.y + want.h) + f - 1) / f - y, true);
+        SetAlignedParam("OffsetX", x, false);
+        SetAlignedParam("OffsetY", y, false);
+    }
+
+    readout = QueryReadout();
+
+    streams.clear();
+    InitPangoStreams();
+    InitPangoDeviceProperties();
+    InitBuffers(buffer_count);
+
+    if(was_streaming) {
+        Start();
+    }
+    return readout;
+}
+
+VideoReadout PleoraVideo::GetReadout() const
+{
+    return readout;
+}
+
+VideoReadout PleoraVideo::QueryReadout()
+{
+    VideoReadout r;
+    r.binning = (size_t)DeviceParamOr("BinningHorizontal", 1);
+    r.decimation = (size_t)DeviceParamOr("DecimationHorizontal", 1);
+    const int64_t f = (int64_t)r.Factor();
+
+    const int64_t w = DeviceParamOr("Width", 0);
+    const int64_t h = DeviceParamOr("Height", 0);
+    if(w != DeviceParamOr("WidthMax", w) || h != DeviceParamOr("HeightMax", h)) {
+        r.x = (size_t)(DeviceParamOr("OffsetX", 0) * f);
+        r.y = (size_t)(DeviceParamOr("OffsetY", 0) * f);
+        r.w = (size_t)(w * f);
+        r.h = (size_t)(h * f);
+    }
+    return r;
+}
+
 template<typename T>
 T PleoraVideo::DeviceParam(const char* name)
 {
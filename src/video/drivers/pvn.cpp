@@ -37,17 +37,37 @@ using namespace std;
 namespace pangolin
 {
 
-PvnVideo::PvnVideo(const std::string& filename, bool realtime )
-    : frame_size_bytes(0), realtime(realtime), last_frame(TimeNow())
+PvnVideo::PvnVideo(const std::string& filename, bool realtime, bool memory_map, size_t prefetch_frames )
+    : frame_size_bytes(0), header_bytes(0), total_frames(0), next_frame(0), prefetch_frames(prefetch_frames),
+      realtime(realtime), last_frame(TimeNow())
 {
-    file.open( PathExpand(filename).c_str(), ios::binary );
+    const std::string path = PathExpand(filename);
+    file.open( path.c_str(), ios::binary );
 
     if(!file.is_open() )
         throw VideoException("Cannot open file - does not exist or bad permissions.");
 
     ReadFileHeader();
-}
+    header_bytes = (size_t)file.tellg();
+
+    if(memory_map) {
+        mapping = std::make_shared<MemoryMappedFile>();
+        if(mapping->Open(path)) {
+            total_frames = (mapping->size() - std::min(header_bytes, mapping->size())) / frame_size_bytes;
+            mapping->AdviseSequential();
+            Prefetch(0);
+            file.close();
+        }else{
+            mapping.reset();
+        }
+    }
 
+    if(!mapping) {
+        file.seekg(0, ios::end);
+        total_frames = ((size_t)file.tellg() - header_bytes) / frame_size_bytes;
+        file.seekg(header_bytes);
+    }
+}
 PvnVideo::~PvnVideo()
 {
 }
@@ -95,18 +115,42 @@ const std::vector<StreamInfo>& PvnVideo::Streams() const
     return streams;
 }
 
-bool PvnVideo::GrabNext( unsigned char* image, bool /*wait*/ )
+void PvnVideo::Prefetch(size_t frameid) const
 {
-    file.read((char*)image, frame_size_bytes);
+    if(mapping && prefetch_frames && frameid < total_frames) {
+        const size_t n = std::min(prefetch_frames, total_frames - frameid);
+        mapping->AdviseWillNeed(FrameOffset(frameid), n * frame_size_bytes);
+    }
+}
 
-    const basetime next_frame = TimeAdd(last_frame, frame_interval);
+void PvnVideo::WaitForFrameTime()
+{
+    const basetime next_frame_time = TimeAdd(last_frame, frame_interval);
 
     if( realtime ) {
-        WaitUntil(next_frame);
+        WaitUntil(next_frame_time);
     }
 
     last_frame = TimeNow();
-    return file.good();
+}
+
+bool PvnVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if(mapping) {
+        const FrameLease lease = GrabNextLease(wait);
+        if(lease) {
+            std::memcpy(image, lease.data(), frame_size_bytes);
+        }
+        return lease.IsValid();
+    }
+
+    file.read((char*)image, frame_size_bytes);
+    WaitForFrameTime();
+    if(file.good()) {
+        ++next_frame;
+        return true;
+    }
+    return false;
 }
 
 bool PvnVideo::GrabNewest( unsigned char* image, bool wait )
@@ -114,6 +158,63 @@ bool PvnVideo::GrabNewest( unsigned char* image, bool wait )
     return GrabNext(image,wait);
 }
 
+FrameLease PvnVideo::GrabNextLease( bool wait )
+{
+    if(!mapping) {
+        std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(frame_size_bytes));
+        if(GrabNext(buffer->get(), wait)) {
+            return FrameLease(buffer->get(), frame_size_bytes, [buffer](){});
+        }
+        return FrameLease();
+    }
+
+    if(next_frame >= total_frames) {
+        return FrameLease();
+    }
+
+    // Lease straight out of the (copy on write) mapping.
+    unsigned char* data = mapping->data() + FrameOffset(next_frame);
+    ++next_frame;
+    Prefetch(next_frame);
+    WaitForFrameTime();
+
+    std::shared_ptr<MemoryMappedFile> m = mapping;
+    return FrameLease(data, frame_size_bytes, [m](){});
+}
+
+FrameLease PvnVideo::GrabNewestLease( bool wait )
+{
+    return GrabNextLease(wait);
+}
+
+size_t PvnVideo::GetCurrentFrameId() const
+{
+    return next_frame;
+}
+
+size_t PvnVideo::GetTotalFrames() const
+{
+    return total_frames;
+}
+
+size_t PvnVideo::Seek(size_t frameid)
+{
+    if(frameid >= total_frames) {
+        return next_frame;
+    }
+
+    if(mapping) {
+        Prefetch(frameid);
+    }else{
+        file.clear();
+        file.seekg(FrameOffset(frameid));
+        if(!file.good()) return next_frame;
+    }
+
+    next_frame = frameid;
+    return next_frame;
+}
+
 PANGOLIN_REGISTER_FACTORY(PvnVideo)
 {
     struct PvnVideoFactory : public FactoryInterface<VideoInterface> {
@@ -122,7 +223,9 @@ PANGOLIN_REGISTER_FACTORY(PvnVideo)
 
             if( !uri.scheme.compare("pvn") || FileType(uri.url) == ImageFileTypePvn ) {
                 const bool realtime = uri.Contains("realtime");
-                return std::unique_ptr<VideoInterface>(new PvnVideo(path.c_str(), realtime));
+                const bool memory_map = uri.Get<bool>("mmap", true);
+                const size_t prefetch = uri.Get<size_t>("prefetch", 4);
+                return std::unique_ptr<VideoInterface>(new PvnVideo(path.c_str(), realtime, memory_map, prefetch));
             }
             return std::unique_ptr<VideoInterface>();
         }
@@ -0,0 +1,424 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2011 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/utils/trace.h>
+#include <pangolin/video/drivers/raw_files_output.h>
+#include <pangolin/video/video_exception.h>
+#include <pangolin/video/video_interface.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pangolin
+{
+
+// Read back by PangoVideo, as for PangoVideoOutput
+const std::string pango_video_type = "raw_video";
+const std::string pango_stream_offsets = "stream_offsets";
+
+// Stream encoding whose packets hold the uint64 offset of the frame within
+// the stream's file, see StreamEncoderFactory::GetDecoderInto
+const std::string raw_file_encoding = "raw_file";
+
+// O_DIRECT transfer size, and the alignment of slots and file offsets
+const size_t raw_direct_alignment = 4096;
+
+struct RawFilesVideoOutput::StreamFile
+{
+    StreamFile()
+        : fd(-1), direct(false), offset(0), size_bytes(0), frame_bytes(0), allocated(0), preallocate(true), frames_written(0)
+    {
+    }
+
+    ~StreamFile()
+    {
+        for(unsigned char* s : slots) std::free(s);
+    }
+
+    std::string filename;
+    int fd;
+    bool direct;
+    // Offset of the stream within frames given to WriteStreams
+    size_t offset;
+    size_t size_bytes;
+    // Space for each frame within the file, size_bytes rounded up for O_DIRECT
+    size_t frame_bytes;
+
+    // Writer thread only
+    uint64_t allocated;
+    bool preallocate;
+
+    // Block aligned frame copies, and which of them are free or waiting to
+    // be written with the index of their frame. Guarded by write_mutex.
+    std::vector<unsigned char*> slots;
+    std::vector<size_t> free_slots;
+    std::deque<std::pair<size_t,uint64_t>> pending;
+    size_t frames_written;
+
+    std::thread thread;
+};
+
+RawFilesVideoOutput::RawFilesVideoOutput(const std::string& index_filename, const std::vector<std::string>& dirs, size_t prealloc_frames, bool direct, size_t queue)
+    : index_filename(PathExpand(index_filename)), dirs(dirs), prealloc_frames(prealloc_frames), direct(direct),
+      queue(std::max<size_t>(1, queue)), index_srcid(-1), frames(0), write_quit(false)
+{
+    // Frames are written elsewhere, so the index only needs a small buffer
+    index.Open(this->index_filename, 4*1024*1024);
+    if(!index.IsOpen()) {
+        throw VideoException("Unable to open index '" + this->index_filename + "' for writing");
+    }
+}
+
+RawFilesVideoOutput::~RawFilesVideoOutput()
+{
+    StopWriters();
+    if(write_error) {
+        try {
+            std::rethrow_exception(write_error);
+        }catch(const std::exception& e) {
+            pango_print_warn("RawFilesVideoOutput: failed writing frames: %s\n", e.what());
+        }catch(...) {
+        }
+    }
+
+    for(auto& f : files) {
+        if(f->fd >= 0) {
+            // Give back space preallocated beyond the last frame
+            if(ftruncate(f->fd, (off_t)(f->frames_written * f->frame_bytes)) != 0) {
+                pango_print_warn("RawFilesVideoOutput: unable to truncate '%s'\n", f->filename.c_str());
+            }
+            ::close(f->fd);
+        }
+    }
+}
+
+const std::vector<StreamInfo>& RawFilesVideoOutput::Streams() const
+{
+    return streams;
+}
+
+bool RawFilesVideoOutput::IsPipe() const
+{
+    return false;
+}
+
+inline std::string AbsoluteDirectory(const std::string& dir)
+{
+    MakeDirectories(dir);
+    char resolved[PATH_MAX];
+    if(!realpath(dir.c_str(), resolved)) {
+        throw VideoException("Unable to find directory '" + dir + "'", strerror(errno));
+    }
+    return resolved;
+}
+
+inline int OpenStreamFile(const std::string& filename, bool& direct)
+{
+    int fd = -1;
+#ifdef __linux__
+    if(direct) {
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if(fd == -1 && errno == EINVAL) {
+            pango_print_warn("'%s' does not support O_DIRECT, using buffered writes.\n", filename.c_str());
+            direct = false;
+        }
+    }
+#else
+    if(direct) {
+        pango_print_warn("O_DIRECT writes are not supported on this platform, using buffered writes.\n");
+        direct = false;
+    }
+#endif
+    if(!direct) {
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if(fd == -1) {
+        throw VideoException("Unable to open '" + filename + "' for writing", strerror(errno));
+    }
+    return fd;
+}
+
+void RawFilesVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::string& uri, const picojson::value& device_properties)
+{
+    if(index_srcid != -1) {
+        throw std::runtime_error("Unable to add new streams");
+    }
+
+    streams = st;
+
+    // 'name' of 'dir/name.pango'
+    const std::string index_dir = PathParent(index_filename);
+    std::string name = index_filename.substr(index_dir.empty() ? 0 : index_dir.size() + 1);
+    const size_t dot = name.find_last_of('.');
+    if(dot != std::string::npos && dot > 0) name = name.substr(0, dot);
+
+    picojson::value json_header(picojson::object_type, false);
+    picojson::value& json_streams = json_header["streams"];
+    json_header["device"] = device_properties;
+
+    for(size_t i=0; i < streams.size(); ++i) {
+        const StreamInfo& si = streams[i];
+        const std::string dir = AbsoluteDirectory(dirs.empty() ? (index_dir.empty() ? "." : index_dir) : dirs[i % dirs.size()]);
+
+        files.emplace_back(new StreamFile());
+        StreamFile& f = *files.back();
+        f.filename = FormatString("%/%.%.raw", dir, name, i);
+        f.direct = direct;
+        f.fd = OpenStreamFile(f.filename, f.direct);
+        f.offset = (size_t)si.Offset();
+        f.size_bytes = si.SizeBytes();
+        f.frame_bytes = f.direct ? (f.size_bytes + raw_direct_alignment - 1) / raw_direct_alignment * raw_direct_alignment : f.size_bytes;
+
+        for(size_t q=0; q < queue; ++q) {
+            void* slot = nullptr;
+            if(posix_memalign(&slot, raw_direct_alignment, f.frame_bytes) != 0) {
+                throw std::bad_alloc();
+            }
+            // Padding is written as zeros
+            std::memset(slot, 0, f.frame_bytes);
+            f.slots.push_back((unsigned char*)slot);
+            f.free_slots.push_back(q);
+        }
+
+        picojson::value& json_stream = json_streams.push_back();
+        json_stream["encoding"] = raw_file_encoding;
+        json_stream["decoded"] = si.PixFormat().Name();
+        json_stream["width"] = si.Width();
+        json_stream["height"] = si.Height();
+        json_stream["pitch"] = si.Pitch();
+        json_stream["offset"] = (size_t)si.Offset();
+        json_stream["file"] = f.filename;
+        json_stream["size_bytes"] = f.size_bytes;
+        json_stream["frame_bytes"] = f.frame_bytes;
+    }
+
+    // Each packet gives the file offset of each stream's frame, then where
+    // each of those lies within the packet so they're read concurrently.
+    json_header[pango_stream_offsets] = true;
+    packet.assign(2 * streams.size(), 0);
+    for(size_t s=0; s < streams.size(); ++s) {
+        packet[streams.size() + s] = s * sizeof(uint64_t);
+    }
+
+    PacketStreamSource pss;
+    pss.driver = pango_video_type;
+    pss.uri = uri;
+    pss.info = json_header;
+    pss.data_size_bytes = 0;
+    pss.data_definitions = "struct Frame{ uint64 file_offsets[" + pangolin::Convert<std::string, size_t>::Do(streams.size()) +
+                           "]; uint64 stream_offsets[" + pangolin::Convert<std::string, size_t>::Do(streams.size()) + "];};";
+    index_srcid = (int)index.AddSource(pss);
+
+    for(auto& f : files) {
+        f->thread = std::thread(&RawFilesVideoOutput::WriteLoop, this, std::ref(*f));
+    }
+}
+
+int RawFilesVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
+{
+    const int64_t host_reception_time_us = frame_properties.get_value(PANGO_HOST_RECEPTION_TIME_US, Time_us(TimeNow()));
+    return WriteFrame(data, host_reception_time_us, frame_properties, std::string());
+}
+
+int RawFilesVideoOutput::WriteStreams(const unsigned char* data, const FrameMetadata& metadata)
+{
+    const int64_t host_reception_time_us = metadata.Has(FrameMetadata::HostReceptionTime) ? metadata.host_reception_time_us : Time_us(TimeNow());
+    return WriteFrame(data, host_reception_time_us, picojson::value(), metadata.Serialize());
+}
+
+int RawFilesVideoOutput::WriteFrame(const unsigned char* data, int64_t time_us, const picojson::value& frame_properties, const std::string& binary_meta)
+{
+    PANGO_TRACE_SCOPE("RawFilesVideoOutput::WriteFrame", "video");
+    if(index_srcid == -1) {
+        throw VideoException("RawFilesVideoOutput: SetStreams must be called before WriteStreams");
+    }
+
+    for(size_t s=0; s < files.size(); ++s) {
+        StreamFile& f = *files[s];
+
+        // data is only valid for this call, so copy it into a free slot
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> l(write_mutex);
+            done_cv.wait(l, [&](){ return !f.free_slots.empty() || write_error; });
+            if(write_error) {
+                std::exception_ptr e = write_error;
+                write_error = nullptr;
+                std::rethrow_exception(e);
+            }
+            slot = f.free_slots.back();
+            f.free_slots.pop_back();
+        }
+
+        std::memcpy(f.slots[slot], data + f.offset, f.size_bytes);
+
+        {
+            std::lock_guard<std::mutex> l(write_mutex);
+            f.pending.emplace_back(slot, frames);
+        }
+        packet[s] = frames * f.frame_bytes;
+    }
+    write_cv.notify_all();
+
+    index.WriteSourcePacket(index_srcid, reinterpret_cast<const char*>(packet.data()), time_us,
+                            packet.size() * sizeof(uint64_t), frame_properties, binary_meta);
+    ++frames;
+    return 0;
+}
+
+void RawFilesVideoOutput::WriteLoop(StreamFile& f)
+{
+    TraceSetThreadName("RawFilesVideoOutput writer");
+
+    while(true) {
+        std::pair<size_t,uint64_t> job;
+        {
+            std::unique_lock<std::mutex> l(write_mutex);
+            write_cv.wait(l, [&](){ return write_quit || !f.pending.empty(); });
+            if(f.pending.empty()) return;
+            job = f.pending.front();
+        }
+
+        std::exception_ptr error;
+        try {
+            const uint64_t offset = job.second * f.frame_bytes;
+
+            // Allocate ahead of time, rather than as each write extends the file
+            if(f.preallocate && offset + f.frame_bytes > f.allocated) {
+                const uint64_t grow = std::max<size_t>(1, prealloc_frames) * f.frame_bytes;
+#ifdef __linux__
+                const int err = fallocate(f.fd, 0, (off_t)f.allocated, (off_t)grow) == 0 ? 0 : errno;
+#else
+                const int err = EOPNOTSUPP;
+#endif
+                if(err == 0) {
+                    f.allocated += grow;
+                }else{
+                    pango_print_warn("Unable to preallocate '%s' (%s), growing as written.\n", f.filename.c_str(), strerror(err));
+                    f.preallocate = false;
+                }
+            }
+
+            const unsigned char* src = f.slots[job.first];
+            size_t done = 0;
+            while(done < f.frame_bytes) {
+                const ssize_t n = pwrite(f.fd, src + done, f.frame_bytes - done, (off_t)(offset + done));
+                if(n < 0) {
+                    if(errno == EINTR) continue;
+                    throw std::runtime_error("Write to '" + f.filename + "' failed: " + strerror(errno));
+                }
+                done += (size_t)n;
+            }
+        }catch(...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> l(write_mutex);
+            if(error && !write_error) write_error = error;
+            f.pending.pop_front();
+            f.free_slots.push_back(job.first);
+            ++f.frames_written;
+        }
+        done_cv.notify_all();
+    }
+}
+
+void RawFilesVideoOutput::StopWriters()
+{
+    {
+        std::lock_guard<std::mutex> l(write_mutex);
+        write_quit = true;
+    }
+    write_cv.notify_all();
+
+    // Writers finish everything already queued before exiting
+    for(auto& f : files) {
+        if(f->thread.joinable()) f->thread.join();
+    }
+}
+
+size_t RawFilesVideoOutput::FramesWritten() const
+{
+    std::lock_guard<std::mutex> l(write_mutex);
+    size_t n = frames;
+    for(const auto& f : files) n = std::min(n, f->frames_written);
+    return n;
+}
+
+void RawFilesVideoOutput::Flush()
+{
+    std::unique_lock<std::mutex> l(write_mutex);
+    done_cv.wait(l, [this](){
+        for(const auto& f : files) if(!f->pending.empty()) return false;
+        return true;
+    });
+    if(write_error) {
+        std::exception_ptr e = write_error;
+        write_error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+PANGOLIN_REGISTER_FACTORY(RawFilesVideoOutput)
+{
+    struct RawFilesVideoFactory : public FactoryInterface<VideoOutputInterface> {
+        std::unique_ptr<VideoOutputInterface> Open(const Uri& uri) override {
+            std::string filename = uri.url;
+            if(uri.Contains("unique_filename")) {
+                filename = MakeUniqueFilename(filename);
+            }
+
+            // Directories to spread streams over, dir1, dir2, ...
+            std::vector<std::string> dirs;
+            for(size_t i=1; uri.Contains(pangolin::FormatString("dir%",i)); ++i) {
+                dirs.push_back(PathExpand(uri.Get<std::string>(pangolin::FormatString("dir%",i), "")));
+            }
+
+            return std::unique_ptr<VideoOutputInterface>(
+                new RawFilesVideoOutput(filename, dirs, uri.Get<size_t>("prealloc", 256),
+                                        uri.Get<bool>("direct", true), uri.Get<size_t>("queue", 8))
+            );
+        }
+    };
+
+    auto factory = std::make_shared<RawFilesVideoFactory>();
+    FactoryRegistry<VideoOutputInterface>::I().RegisterFactory(factory, 10, "rawfiles");
+}
+
+}
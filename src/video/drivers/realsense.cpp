@@ -1,46 +1,182 @@
 #include <librealsense/rs.hpp>
 #include <pangolin/video/drivers/realsense.h>
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/timer.h>
+
+#include <algorithm>
+#include <limits>
 
 namespace pangolin {
 
-RealSenseVideo::RealSenseVideo(ImageDim dim, int fps) 
-  : dim_(dim), fps_(fps) {
+namespace {
+
+// Devices lag the host clock by at most this much drift (PPM) between frames
+const double realsense_max_drift = 1E-4;
+
+const char* TimestampDomainName(rs_timestamp_domain domain) {
+  switch(domain) {
+  case RS_TIMESTAMP_DOMAIN_CAMERA: return "camera";
+  case RS_TIMESTAMP_DOMAIN_MICROCONTROLLER: return "microcontroller";
+  default: return "unknown";
+  }
+}
+
+}
+
+int64_t RealSenseVideo::DeviceClock::ToHost(int64_t hw_us, int64_t host_us) {
+  const double diff = double(host_us - hw_us);
+  if(!valid || diff < offset_us) {
+    offset_us = diff;
+    valid = true;
+  }else{
+    // Let the offset creep up so that it follows the device's clock drift
+    offset_us = std::min(diff, offset_us + realsense_max_drift * std::max<int64_t>(0, hw_us - last_hw_us));
+  }
+  last_hw_us = hw_us;
+  return hw_us + int64_t(offset_us);
+}
+
+RealSenseVideo::RealSenseVideo(ImageDim dim, int fps, const std::vector<std::string>& devices, bool native, size_t queue)
+  : dim_(dim), fps_(fps), queue_(std::max<size_t>(1, queue)), dropped_(0) {
   ctx_ = new rs::context();
   sizeBytes = 0;
+
   for (int32_t i=0; i<ctx_->get_device_count(); ++i) {
-    devs_.push_back(ctx_->get_device(i));
+    rs::device* dev = ctx_->get_device(i);
+    const std::string serial = dev->get_serial();
+    if(!devices.empty() && std::find(devices.begin(), devices.end(), serial) == devices.end() &&
+       std::find(devices.begin(), devices.end(), std::to_string(i)) == devices.end()) {
+      continue;
+    }
+    devs_.push_back(dev);
+  }
+  if(devs_.empty()) {
+    delete ctx_;
+    throw VideoException("RealSenseVideo: no matching devices found");
+  }
 
-    devs_[i]->enable_stream(rs::stream::depth, dim_.x, dim_.y, rs::format::z16, fps_);
-    StreamInfo streamD(PixelFormatFromString("GRAY16LE"), dim_.x, dim_.y, dim_.x*2, 0);
-    streams.push_back(streamD);
+  // Native buffers skip librealsense's host side conversion and unpadding
+  const rs::output_buffer_format buffer_format = native ? rs::output_buffer_format::native : rs::output_buffer_format::continous;
+  const rs::format color_format = native ? rs::format::yuyv : rs::format::rgb8;
+  const PixelFormat color_pix_fmt = PixelFormatFromString(native ? "YUYV422" : "RGB24");
 
+  picojson::value json_streams(picojson::array_type, false);
+  captured_.resize(2*devs_.size());
+  clocks_.resize(devs_.size());
+
+  for (size_t i=0; i<devs_.size(); ++i) {
+    rs::device* dev = devs_[i];
+
+    dev->enable_stream(rs::stream::depth, dim_.x, dim_.y, rs::format::z16, fps_, buffer_format);
+    StreamInfo streamD(PixelFormatFromString("GRAY16LE"), dim_.x, dim_.y, dim_.x*2, (uint8_t*)0+sizeBytes);
+    streams.push_back(streamD);
     sizeBytes += streamD.SizeBytes();
-    devs_[i]->enable_stream(rs::stream::color, dim_.x, dim_.y, rs::format::rgb8, fps_);
-    StreamInfo streamRGB(PixelFormatFromString("RGB24"), dim_.x, dim_.y, dim_.x*3, (uint8_t*)0+sizeBytes);
+
+    dev->enable_stream(rs::stream::color, dim_.x, dim_.y, color_format, fps_, buffer_format);
+    StreamInfo streamRGB(color_pix_fmt, dim_.x, dim_.y, dim_.x*color_pix_fmt.bpp/8, (uint8_t*)0+sizeBytes);
     streams.push_back(streamRGB);
     sizeBytes += streamRGB.SizeBytes();
 
-    devs_[i]->start();
+    for(const std::string name : {"depth", "color"}) {
+      picojson::value& json_stream = json_streams.push_back();
+      json_stream["device"] = dev->get_name();
+      json_stream["serial"] = dev->get_serial();
+      json_stream["firmware"] = dev->get_firmware_version();
+      json_stream["stream"] = name;
+      json_stream[PANGO_HAS_TIMING_DATA] = true;
+      if(name == "depth") {
+        json_stream["depth_scale"] = dev->get_depth_scale();
+      }
+    }
+
   }
+
+  device_properties[PANGO_HAS_TIMING_DATA] = true;
+  device_properties["streams"] = json_streams;
+
+  frame_properties["streams"] = picojson::value(picojson::array_type, false);
+  streams_properties = &frame_properties["streams"];
+  streams_properties->get<picojson::array>().resize(streams.size());
+
+  current_frame_index = 0;
   total_frames = std::numeric_limits<int>::max();
+
+  // Frames arrive on librealsense's threads, independently per device and stream
+  for (size_t i=0; i<devs_.size(); ++i) {
+    devs_[i]->set_frame_callback(rs::stream::depth, [this,i](rs::frame f){ OnFrame(2*i, i, f); });
+    devs_[i]->set_frame_callback(rs::stream::color, [this,i](rs::frame f){ OnFrame(2*i+1, i, f); });
+    devs_[i]->start();
+  }
 }
 
 RealSenseVideo::~RealSenseVideo() {
+  for (rs::device* dev : devs_) {
+    dev->stop();
+  }
   delete ctx_;
 }
 
+void RealSenseVideo::OnFrame(size_t stream, size_t dev, rs::frame& f) {
+  const int64_t host_us = Time_us(TimeNow());
+  const StreamInfo& si = streams[stream];
+
+  Capture c;
+  c.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(si.SizeBytes()));
+  c.frame_number = f.get_frame_number();
+  c.hw_time_us = int64_t(f.get_timestamp() * 1000.0);
+  c.host_time_us = host_us;
+
+  const unsigned char* src = static_cast<const unsigned char*>(f.get_data());
+  const size_t row_bytes = si.RowBytes();
+  const size_t src_pitch = std::max<size_t>(row_bytes, f.get_stride());
+  if(src_pitch == row_bytes) {
+    memcpy(c.buffer->get(), src, si.SizeBytes());
+  }else{
+    for(size_t y=0; y < si.Height(); ++y) {
+      memcpy(c.buffer->get() + y*row_bytes, src + y*src_pitch, row_bytes);
+    }
+  }
+
+  c.metadata = picojson::value(picojson::object_type, false);
+  c.metadata["timestamp_domain"] = TimestampDomainName(f.get_frame_timestamp_domain());
+  if(f.supports_frame_metadata(RS_FRAME_METADATA_ACTUAL_EXPOSURE)) {
+    c.metadata["actual_exposure"] = f.get_frame_metadata(RS_FRAME_METADATA_ACTUAL_EXPOSURE);
+  }
+  if(f.supports_frame_metadata(RS_FRAME_METADATA_ACTUAL_FPS)) {
+    c.metadata["actual_fps"] = f.get_frame_metadata(RS_FRAME_METADATA_ACTUAL_FPS);
+  }
+
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    c.capture_time_us = clocks_[dev].ToHost(c.hw_time_us, host_us);
+    std::deque<Capture>& q = captured_[stream];
+    q.push_back(std::move(c));
+    while(q.size() > queue_) {
+      q.pop_front();
+      ++dropped_;
+    }
+  }
+  cv_.notify_all();
+}
+
 void RealSenseVideo::Start() {
-  for (int32_t i=0; i<ctx_->get_device_count(); ++i) {
-    devs_[i]->stop();
-    devs_[i]->start();
+  for (rs::device* dev : devs_) {
+    dev->stop();
+  }
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    for(std::deque<Capture>& q : captured_) q.clear();
+  }
+  for (rs::device* dev : devs_) {
+    dev->start();
   }
   current_frame_index = 0;
 }
 
 void RealSenseVideo::Stop() {
-  for (int32_t i=0; i<ctx_->get_device_count(); ++i) {
-    devs_[i]->stop();
+  for (rs::device* dev : devs_) {
+    dev->stop();
   }
 }
 
@@ -52,23 +188,69 @@ const std::vector<StreamInfo>& RealSenseVideo::Streams() const {
   return streams;
 }
 
-bool RealSenseVideo::GrabNext(unsigned char* image, bool wait) {
+bool RealSenseVideo::PopFrames(std::vector<Capture>& frames, bool newest, bool wait) {
+  std::unique_lock<std::mutex> l(mutex_);
+  const auto ready = [this](){
+    return std::all_of(captured_.begin(), captured_.end(), [](const std::deque<Capture>& q){ return !q.empty(); });
+  };
+  if(wait) {
+    cv_.wait(l, ready);
+  }else if(!ready()) {
+    return false;
+  }
 
-  unsigned char* out_img = image;
-  for (int32_t i=0; i<ctx_->get_device_count(); ++i) {
-    if (wait) {
-      devs_[i]->wait_for_frames();
+  frames.resize(captured_.size());
+  for(size_t s=0; s < captured_.size(); ++s) {
+    std::deque<Capture>& q = captured_[s];
+    if(newest) {
+      dropped_ += q.size() - 1;
+      frames[s] = std::move(q.back());
+      q.clear();
+    }else{
+      frames[s] = std::move(q.front());
+      q.pop_front();
     }
-    memcpy(out_img, devs_[i]->get_frame_data(rs::stream::depth), streams[i*2].SizeBytes());
-    out_img += streams[i*2].SizeBytes();
-    memcpy(out_img, devs_[i]->get_frame_data(rs::stream::color), streams[i*2+1].SizeBytes());
-    out_img += streams[i*2+1].SizeBytes();
   }
   return true;
 }
 
+bool RealSenseVideo::GrabFrames(unsigned char* image, bool newest, bool wait) {
+  std::vector<Capture> frames;
+  if(!PopFrames(frames, newest, wait)) {
+    return false;
+  }
+
+  for(size_t s=0; s < frames.size(); ++s) {
+    const Capture& c = frames[s];
+    memcpy(image + (size_t)streams[s].Offset(), c.buffer->get(), streams[s].SizeBytes());
+
+    picojson::value& props = (*streams_properties)[s];
+    props = c.metadata;
+    props["devtime_us"] = c.hw_time_us;
+    props[PANGO_FRAME_COUNTER] = (int64_t)c.frame_number;
+    props[PANGO_HOST_RECEPTION_TIME_US] = c.host_time_us;
+    props[PANGO_CAPTURE_TIME_US] = c.capture_time_us;
+  }
+
+  // The first device's depth stream times the whole frame for JoinVideo
+  frame_properties[PANGO_HOST_RECEPTION_TIME_US] = frames[0].host_time_us;
+  frame_properties[PANGO_CAPTURE_TIME_US] = frames[0].capture_time_us;
+  frame_properties[PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US] = frames[0].capture_time_us;
+  {
+    std::lock_guard<std::mutex> l(mutex_);
+    frame_properties["dropped_frames"] = (int64_t)dropped_;
+  }
+
+  ++current_frame_index;
+  return true;
+}
+
+bool RealSenseVideo::GrabNext(unsigned char* image, bool wait) {
+  return GrabFrames(image, false, wait);
+}
+
 bool RealSenseVideo::GrabNewest(unsigned char* image, bool wait) {
-  return GrabNext(image, wait);
+  return GrabFrames(image, true, wait);
 }
 
 size_t RealSenseVideo::GetCurrentFrameId() const {
@@ -79,7 +261,7 @@ size_t RealSenseVideo::GetTotalFrames() const {
   return total_frames;
 }
 
-size_t RealSenseVideo::Seek(size_t frameid) {
+size_t RealSenseVideo::Seek(size_t /*frameid*/) {
   // TODO
   return -1;
 }
@@ -90,7 +272,10 @@ PANGOLIN_REGISTER_FACTORY(RealSenseVideo)
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(640,480));
             const unsigned int fps = uri.Get<unsigned int>("fps", 30);
-            return std::unique_ptr<VideoInterface>( new RealSenseVideo(dim, fps) );
+            const bool native = uri.Get<bool>("native", false);
+            const size_t queue = uri.Get<size_t>("queue", 4);
+            const std::vector<std::string> devices = uri.url.empty() ? std::vector<std::string>() : Split(uri.url, ',');
+            return std::unique_ptr<VideoInterface>( new RealSenseVideo(dim, fps, devices, native, queue) );
         }
     };
 
@@ -0,0 +1,368 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/picojson.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/drivers/net_video_protocol.h>
+#include <pangolin/video/drivers/record_coordinator.h>
+#include <pangolin/video/video_exception.h>
+#include <pangolin/video/video_input.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace pangolin
+{
+
+namespace
+{
+// Pings per clock estimate, of which the quickest round trip is kept
+const size_t record_clock_samples = 16;
+const int record_reply_timeout_ms = 1000;
+// Largest message accepted, to bound what a peer can make us allocate
+const uint32_t record_max_message_bytes = 64 * 1024;
+
+bool SendMessage(int fd, const std::string& msg)
+{
+    const uint32_t size = (uint32_t)msg.size();
+    return NetVideoSendAll(fd, reinterpret_cast<const unsigned char*>(&size), sizeof(size), true) &&
+           NetVideoSendAll(fd, reinterpret_cast<const unsigned char*>(msg.data()), msg.size());
+}
+
+bool SendMessage(int fd, const picojson::value& msg)
+{
+    return SendMessage(fd, msg.serialize());
+}
+
+// Wait up to timeout_ms for the next message, false on timeout, error or a
+// malformed message
+bool RecvMessage(int fd, picojson::value& msg, int timeout_ms)
+{
+    if(!NetVideoPoll(fd, timeout_ms)) return false;
+
+    uint32_t size = 0;
+    if(!NetVideoRecvAll(fd, reinterpret_cast<unsigned char*>(&size), sizeof(size)) || size > record_max_message_bytes) {
+        return false;
+    }
+    std::string json(size, '\0');
+    if(size && !NetVideoRecvAll(fd, reinterpret_cast<unsigned char*>(&json[0]), size)) {
+        return false;
+    }
+    std::string::const_iterator pos = json.begin();
+    const std::string err = picojson::parse(msg, pos, json.cend());
+    return err.empty() && msg.is<picojson::object>();
+}
+
+void SetNoDelay(int fd)
+{
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+}
+
+struct RecordCoordinator::Connection
+{
+    Connection(int fd) : fd(fd) {}
+    ~Connection() { close(fd); }
+
+    int fd;
+    RecordNodeInfo info;
+};
+
+RecordCoordinator::RecordCoordinator(const std::string& address)
+    : fd(-1), quit(false)
+{
+    sockaddr_storage addr;
+    const socklen_t len = NetVideoResolve(address, SOCK_STREAM, true, addr);
+    fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if(fd < 0) {
+        throw VideoException("RecordCoordinator: unable to create socket", strerror(errno));
+    }
+
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(fd, reinterpret_cast<const sockaddr*>(&addr), len) != 0 || listen(fd, 8) != 0) {
+        const std::string err = strerror(errno);
+        close(fd);
+        throw VideoException("RecordCoordinator: unable to listen on '" + address + "'", err);
+    }
+
+    accept_thread = std::thread(&RecordCoordinator::AcceptLoop, this);
+}
+
+RecordCoordinator::~RecordCoordinator()
+{
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        quit = true;
+    }
+    if(accept_thread.joinable()) accept_thread.join();
+    nodes.clear();
+    close(fd);
+}
+
+void RecordCoordinator::AcceptLoop()
+{
+    while(true) {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if(quit) return;
+        }
+        if(!NetVideoPoll(fd, 100)) continue;
+
+        const int nfd = accept(fd, nullptr, nullptr);
+        if(nfd < 0) continue;
+        SetNoDelay(nfd);
+        std::unique_ptr<Connection> node(new Connection(nfd));
+
+        picojson::value hello;
+        if(!RecvMessage(nfd, hello, record_reply_timeout_ms) || hello.get_value<std::string>("cmd", "") != "hello") {
+            pango_print_warn("RecordCoordinator: ignoring connection which didn't introduce itself\n");
+            continue;
+        }
+        node->info.name = hello.get_value<std::string>("node", "");
+
+        if(!Measure(nfd, node->info)) {
+            pango_print_warn("RecordCoordinator: node '%s' didn't answer\n", node->info.name.c_str());
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            nodes.push_back(std::move(node));
+        }
+        cv.notify_all();
+    }
+}
+
+bool RecordCoordinator::Measure(int fd, RecordNodeInfo& info)
+{
+    picojson::value ping;
+    ping["cmd"] = "ping";
+    const std::string msg = ping.serialize();
+
+    int64_t best_rtt = std::numeric_limits<int64_t>::max();
+    for(size_t i=0; i < record_clock_samples; ++i) {
+        const int64_t t0 = TimeNow_us();
+        picojson::value pong;
+        if(!SendMessage(fd, msg) || !RecvMessage(fd, pong, record_reply_timeout_ms) ||
+           pong.get_value<std::string>("cmd", "") != "pong" || !pong["time_us"].is<int64_t>()) {
+            return false;
+        }
+        const int64_t t1 = TimeNow_us();
+
+        // Assume the node read its clock halfway through the round trip
+        if(t1 - t0 < best_rtt) {
+            best_rtt = t1 - t0;
+            info.rtt_us = best_rtt;
+            info.clock_offset_us = t0 + (t1 - t0) / 2 - pong["time_us"].get<int64_t>();
+        }
+    }
+    return true;
+}
+
+void RecordCoordinator::Broadcast(picojson::value msg)
+{
+    for(auto it = nodes.begin(); it != nodes.end();) {
+        msg["clock_offset_us"] = (*it)->info.clock_offset_us;
+        if(SendMessage((*it)->fd, msg)) {
+            ++it;
+        }else{
+            pango_print_warn("RecordCoordinator: lost node '%s'\n", (*it)->info.name.c_str());
+            it = nodes.erase(it);
+        }
+    }
+}
+
+bool RecordCoordinator::WaitForNodes(size_t n, double timeout_s)
+{
+    std::unique_lock<std::mutex> l(mutex);
+    return cv.wait_for(l, std::chrono::microseconds((int64_t)(timeout_s * 1e6)), [&](){ return nodes.size() >= n; });
+}
+
+std::vector<RecordNodeInfo> RecordCoordinator::Nodes() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    std::vector<RecordNodeInfo> infos;
+    for(const auto& node : nodes) {
+        infos.push_back(node->info);
+    }
+    return infos;
+}
+
+int64_t RecordCoordinator::Record(double lead_s)
+{
+    std::lock_guard<std::mutex> l(mutex);
+
+    // Clocks drift, so estimate them afresh for each recording
+    for(auto it = nodes.begin(); it != nodes.end();) {
+        if(Measure((*it)->fd, (*it)->info)) {
+            ++it;
+        }else{
+            pango_print_warn("RecordCoordinator: lost node '%s'\n", (*it)->info.name.c_str());
+            it = nodes.erase(it);
+        }
+    }
+
+    const int64_t start_us = TimeNow_us() + (int64_t)(lead_s * 1e6);
+    session = std::to_string(start_us);
+
+    picojson::value record;
+    record["cmd"] = "record";
+    record["start_us"] = start_us;
+    record["session"] = session;
+    Broadcast(record);
+    return start_us;
+}
+
+int64_t RecordCoordinator::Stop(double lead_s)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    const int64_t stop_us = TimeNow_us() + (int64_t)(lead_s * 1e6);
+
+    picojson::value stop;
+    stop["cmd"] = "stop";
+    stop["stop_us"] = stop_us;
+    Broadcast(stop);
+    return stop_us;
+}
+
+std::string RecordCoordinator::Session() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return session;
+}
+
+RecordNode::RecordNode(VideoInput& video, const std::string& address, const std::string& name)
+    : video(video), address(address), name(name), fd(-1), quit(false)
+{
+    thread = std::thread(&RecordNode::Run, this);
+}
+
+RecordNode::~RecordNode()
+{
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        quit = true;
+        if(fd >= 0) shutdown(fd, SHUT_RDWR);
+    }
+    cv.notify_all();
+    if(thread.joinable()) thread.join();
+}
+
+bool RecordNode::Connected() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return fd >= 0;
+}
+
+void RecordNode::Run()
+{
+    while(true) {
+        int nfd = -1;
+        try {
+            sockaddr_storage addr;
+            const socklen_t len = NetVideoResolve(address, SOCK_STREAM, false, addr);
+            nfd = socket(addr.ss_family, SOCK_STREAM, 0);
+            if(nfd >= 0 && connect(nfd, reinterpret_cast<const sockaddr*>(&addr), len) != 0) {
+                close(nfd);
+                nfd = -1;
+            }
+        }catch(const VideoException&) {
+            nfd = -1;
+        }
+
+        if(nfd >= 0) {
+            SetNoDelay(nfd);
+            {
+                std::lock_guard<std::mutex> l(mutex);
+                if(quit) {
+                    close(nfd);
+                    return;
+                }
+                fd = nfd;
+            }
+            Serve(nfd);
+            {
+                std::lock_guard<std::mutex> l(mutex);
+                fd = -1;
+            }
+            close(nfd);
+        }
+
+        // Retry until the coordinator is (back) up
+        std::unique_lock<std::mutex> l(mutex);
+        if(cv.wait_for(l, std::chrono::seconds(1), [&](){ return quit; })) return;
+    }
+}
+
+void RecordNode::Serve(int nfd)
+{
+    picojson::value hello;
+    hello["cmd"] = "hello";
+    hello["node"] = name;
+    if(!SendMessage(nfd, hello)) return;
+
+    while(true) {
+        {
+            std::lock_guard<std::mutex> l(mutex);
+            if(quit) return;
+        }
+        if(!NetVideoPoll(nfd, 100)) continue;
+
+        picojson::value msg;
+        if(!RecvMessage(nfd, msg, 0)) return;
+        const std::string cmd = msg.get_value<std::string>("cmd", "");
+
+        if(cmd == "ping") {
+            picojson::value pong;
+            pong["cmd"] = "pong";
+            pong["time_us"] = TimeNow_us();
+            if(!SendMessage(nfd, pong)) return;
+        }else if(cmd == "record") {
+            // Coordinator times onto our clock
+            const int64_t offset_us = msg.get_value<int64_t>("clock_offset_us", 0);
+            video.ScheduleRecording(
+                msg.get_value<int64_t>("start_us", 0) - offset_us, std::numeric_limits<int64_t>::max(),
+                offset_us, msg.get_value<std::string>("session", ""), name
+            );
+        }else if(cmd == "stop") {
+            video.ScheduleStop(msg.get_value<int64_t>("stop_us", 0) - msg.get_value<int64_t>("clock_offset_us", 0));
+        }
+    }
+}
+
+}
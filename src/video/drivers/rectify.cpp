@@ -0,0 +1,359 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/video/drivers/rectify.h>
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/video/iostream_operators.h>
+
+#include <cmath>
+#include <fstream>
+
+namespace pangolin
+{
+
+CameraCalibration::CameraCalibration()
+    : width(0), height(0), fx(1), fy(1), cx(0), cy(0), model(DistortionNone),
+      dist{0, 0, 0, 0, 0}, R{1, 0, 0, 0, 1, 0, 0, 0, 1}
+{
+}
+
+CameraCalibration::DistortionModel CameraCalibration::DistortionModelFromString(const std::string& str)
+{
+    if(!str.compare("none")) return DistortionNone;
+    else if(!str.compare("radtan")) return DistortionRadTan;
+    else if(!str.compare("equidistant") || !str.compare("fisheye")) return DistortionEquidistant;
+    else throw VideoException("Unknown distortion model", str);
+}
+
+CameraCalibration CameraCalibration::Scaled(size_t w, size_t h) const
+{
+    CameraCalibration c = *this;
+    if(width && height && (width != w || height != h)) {
+        // Pixel centres lie on integer coordinates
+        const double sx = double(w) / width;
+        const double sy = double(h) / height;
+        c.fx *= sx;
+        c.fy *= sy;
+        c.cx = (cx + 0.5) * sx - 0.5;
+        c.cy = (cy + 0.5) * sy - 0.5;
+    }
+    c.width = w;
+    c.height = h;
+    return c;
+}
+
+void CameraCalibration::Distort(double x, double y, double& xd, double& yd) const
+{
+    switch(model) {
+    case DistortionRadTan: {
+        const double r2 = x*x + y*y;
+        const double radial = 1.0 + r2 * (dist[0] + r2 * (dist[1] + r2 * dist[4]));
+        xd = x * radial + 2.0 * dist[2] * x * y + dist[3] * (r2 + 2.0 * x * x);
+        yd = y * radial + dist[2] * (r2 + 2.0 * y * y) + 2.0 * dist[3] * x * y;
+        break;
+    }
+    case DistortionEquidistant: {
+        const double r = std::sqrt(x*x + y*y);
+        const double theta = std::atan(r);
+        const double t2 = theta * theta;
+        const double theta_d = theta * (1.0 + t2 * (dist[0] + t2 * (dist[1] + t2 * (dist[2] + t2 * dist[3]))));
+        const double s = r > 1e-8 ? theta_d / r : 1.0;
+        xd = x * s;
+        yd = y * s;
+        break;
+    }
+    default:
+        xd = x;
+        yd = y;
+    }
+}
+
+namespace
+{
+
+CameraCalibration CalibrationFromJson(const picojson::value& json)
+{
+    CameraCalibration c;
+    c.width = (size_t)json.get_value<double>("width", 0.0);
+    c.height = (size_t)json.get_value<double>("height", 0.0);
+    c.fx = json.get_value<double>("fx", 1.0);
+    c.fy = json.get_value<double>("fy", c.fx);
+    c.cx = json.get_value<double>("cx", 0.0);
+    c.cy = json.get_value<double>("cy", 0.0);
+    c.model = CameraCalibration::DistortionModelFromString(json.get_value<std::string>("model", "radtan"));
+    if(json.contains("distortion")) {
+        const picojson::array& d = json["distortion"].get<picojson::array>();
+        for(size_t i = 0; i < d.size() && i < 5; ++i) c.dist[i] = d[i].get<double>();
+    }
+    if(json.contains("R")) {
+        const picojson::array& r = json["R"].get<picojson::array>();
+        if(r.size() != 9) {
+            throw VideoException("RectifyVideo: R must hold 9 values");
+        }
+        for(size_t i = 0; i < 9; ++i) c.R[i] = r[i].get<double>();
+    }
+    return c;
+}
+
+}
+
+std::vector<CameraCalibration> RectifyVideo::LoadCalibration(const std::string& filename)
+{
+    const std::string path = PathExpand(filename);
+    std::ifstream f(path);
+    if(!f.is_open()) {
+        throw VideoException("RectifyVideo: Unable to open calibration", path);
+    }
+    picojson::value json;
+    const std::string err = picojson::parse(json, f);
+    if(!err.empty()) {
+        throw VideoException("RectifyVideo: Unable to parse calibration", err);
+    }
+
+    const picojson::value& cams = json.contains("cameras") ? json["cameras"] : json;
+    std::vector<CameraCalibration> calib;
+    if(cams.is<picojson::array>()) {
+        for(const picojson::value& c : cams.get<picojson::array>()) {
+            calib.push_back(CalibrationFromJson(c));
+        }
+    }else{
+        calib.push_back(CalibrationFromJson(cams));
+    }
+    return calib;
+}
+
+RectifyVideo::RectifyVideo(std::unique_ptr<VideoInterface> &src_, const std::vector<CameraCalibration>& calib, double zoom, size_t threads, bool gpu)
+    : VideoStageTimer("rectify"), src(std::move(src_)), size_bytes(0), threads(threads), gpu(gpu)
+{
+    if(!src) {
+        throw VideoException("RectifyVideo: VideoInterface in must not be null");
+    }
+    if(calib.empty() || (calib.size() != 1 && calib.size() != src->Streams().size())) {
+        throw VideoException("RectifyVideo: Expected one calibration, or one per stream");
+    }
+    videoin.push_back(src.get());
+
+    for(size_t s=0; s< src->Streams().size(); ++s) {
+        const StreamInfo& in = src->Streams()[s];
+        if(!gpu && !CanRemapPixelFormat(in.PixFormat())) {
+            throw VideoException("RectifyVideo: Unable to rectify " + in.PixFormat().Name() + ", convert it first");
+        }
+
+        const size_t w = in.Width();
+        const size_t h = in.Height();
+        const CameraCalibration c = calib[calib.size() == 1 ? 0 : s].Scaled(w, h);
+        const double* R = c.R;
+        const double ofx = c.fx * zoom;
+        const double ofy = c.fy * zoom;
+
+        // Rectified pixel -> ray in the camera frame -> distorted pixel
+        tables.push_back(RemapTable::FromFunction(w, h, w, h, [&](double u, double v, double& su, double& sv) {
+            const double xr = (u - c.cx) / ofx;
+            const double yr = (v - c.cy) / ofy;
+            const double x = R[0] * xr + R[3] * yr + R[6];
+            const double y = R[1] * xr + R[4] * yr + R[7];
+            const double z = R[2] * xr + R[5] * yr + R[8];
+            if(z <= 0.0) return false;
+            double xd, yd;
+            c.Distort(x / z, y / z, xd, yd);
+            su = c.fx * xd + c.cx;
+            sv = c.fy * yd + c.cy;
+            return true;
+        }));
+
+        if(gpu) {
+            streams.push_back(in);
+        }else{
+            const StreamInfo out(in.PixFormat(), w, h, (w*in.PixFormat().bpp) / 8, (unsigned char*)0 + size_bytes);
+            streams.push_back(out);
+            size_bytes += out.SizeBytes();
+        }
+    }
+
+    if(gpu) {
+        size_bytes = src->SizeBytes();
+    }
+}
+
+RectifyVideo::~RectifyVideo()
+{
+}
+
+const RemapTable& RectifyVideo::Table(size_t stream) const
+{
+    return tables[stream];
+}
+
+bool RectifyVideo::GpuRemap() const
+{
+    return gpu;
+}
+
+//! Implement VideoInput::Start()
+void RectifyVideo::Start()
+{
+    videoin[0]->Start();
+}
+
+//! Implement VideoInput::Stop()
+void RectifyVideo::Stop()
+{
+    videoin[0]->Stop();
+}
+
+//! Implement VideoInput::SizeBytes()
+size_t RectifyVideo::SizeBytes() const
+{
+    return size_bytes;
+}
+
+//! Implement VideoInput::Streams()
+const std::vector<StreamInfo>& RectifyVideo::Streams() const
+{
+    return streams;
+}
+
+void RectifyVideo::Process(unsigned char* image, const unsigned char* buffer)
+{
+    for(size_t s=0; s<streams.size(); ++s) {
+        const StreamInfo& si_in = videoin[0]->Streams()[s];
+        RemapImage(streams[s].StreamImage(image), si_in.StreamImage(buffer), si_in.PixFormat(), tables[s], threads);
+    }
+}
+
+//! Implement VideoInput::GrabNext()
+bool RectifyVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if(gpu) {
+        return videoin[0]->GrabNext(image, wait);
+    }
+
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+//! Implement VideoInput::GrabNewest()
+bool RectifyVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    if(gpu) {
+        return videoin[0]->GrabNewest(image, wait);
+    }
+
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+std::vector<VideoInterface*>& RectifyVideo::InputStreams()
+{
+    return videoin;
+}
+
+uint32_t RectifyVideo::AvailableFrames() const
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Rectify: child interface is not buffer aware.");
+        return 0;
+    }
+    else
+    {
+        return vpi->AvailableFrames();
+    }
+}
+
+bool RectifyVideo::DropNFrames(uint32_t n)
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Rectify: child interface is not buffer aware.");
+        return false;
+    }
+    else
+    {
+        return vpi->DropNFrames(n);
+    }
+}
+
+PANGOLIN_REGISTER_FACTORY(RectifyVideo)
+{
+    struct RectifyVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            std::vector<CameraCalibration> calib;
+            if(uri.Contains("calib")) {
+                calib = RectifyVideo::LoadCalibration(uri.Get<std::string>("calib", ""));
+            }else if(uri.Contains("fx")) {
+                CameraCalibration c;
+                c.fx = uri.Get<double>("fx", 1.0);
+                c.fy = uri.Get<double>("fy", c.fx);
+                c.cx = uri.Get<double>("cx", 0.0);
+                c.cy = uri.Get<double>("cy", 0.0);
+                c.model = CameraCalibration::DistortionModelFromString(uri.Get<std::string>("model", "radtan"));
+                const char* keys[2][5] = {
+                    {"k1", "k2", "p1", "p2", "k3"},
+                    {"k1", "k2", "k3", "k4", ""}
+                };
+                const size_t set = c.model == CameraCalibration::DistortionEquidistant ? 1 : 0;
+                for(size_t i = 0; i < 5; ++i) {
+                    if(*keys[set][i]) c.dist[i] = uri.Get<double>(keys[set][i], 0.0);
+                }
+                calib.push_back(c);
+            }else{
+                throw VideoException("RectifyVideo: Specify calib=file.json or fx,fy,cx,cy");
+            }
+            const double zoom = uri.Get<double>("zoom", 1.0);
+            const size_t threads = uri.Get<size_t>("threads", 1);
+            const bool gpu = uri.Get<bool>("gpu", false);
+
+            std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
+            return std::unique_ptr<VideoInterface>(
+                new RectifyVideo(subvid, calib, zoom, threads, gpu)
+            );
+        }
+    };
+
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<RectifyVideoFactory>(), 10, "rectify");
+}
+
+}
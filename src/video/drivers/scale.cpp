@@ -0,0 +1,222 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/drivers/scale.h>
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/video/iostream_operators.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace pangolin
+{
+
+// Bin (or decimate) src on the device by as much as the smallest scaling of
+// its streams to w x h allows, leaving the rest to be resampled
+inline void ReduceOnDevice(VideoInterface& src, size_t w, size_t h, ResizeMethod method)
+{
+    VideoReadoutInterface* vr = GetVideoReadoutInterface(src);
+    if(!vr) return;
+
+    VideoReadout readout = vr->GetReadout();
+    if(readout.Factor() != 1) return;
+
+    size_t factor = std::numeric_limits<size_t>::max();
+    for(const StreamInfo& si : src.Streams()) {
+        if(w) factor = std::min(factor, si.Width() / w);
+        if(h) factor = std::min(factor, si.Height() / h);
+    }
+    if(factor < 2) return;
+
+    // Binning averages like area resampling, skipping is a cheaper approximation otherwise
+    if(method == ResizeMethodArea) {
+        readout.binning = factor;
+    }else{
+        readout.decimation = factor;
+    }
+    vr->SetReadout(readout);
+}
+
+ScaleVideo::ScaleVideo(std::unique_ptr<VideoInterface> &src_, size_t w, size_t h, ResizeMethod method, size_t threads)
+    : VideoStageTimer("scale"), src(std::move(src_)), size_bytes(0), method(method), threads(threads)
+{
+    if(!src) {
+        throw VideoException("ScaleVideo: VideoInterface in must not be null");
+    }
+    if(!w && !h) {
+        throw VideoException("ScaleVideo: Specify at least one of width and height");
+    }
+    videoin.push_back(src.get());
+
+    for(size_t s=0; s< src->Streams().size(); ++s) {
+        const StreamInfo& in = src->Streams()[s];
+        const PixelFormat fmt = in.PixFormat();
+        if(!CanResizePixelFormat(fmt)) {
+            throw VideoException("ScaleVideo: Unable to resize " + fmt.Name() + ", unpack it first");
+        }
+
+        size_t ow = w ? w : std::max<size_t>(1, (size_t)std::lround(double(in.Width()) * h / in.Height()));
+        const size_t oh = h ? h : std::max<size_t>(1, (size_t)std::lround(double(in.Height()) * w / in.Width()));
+        if(fmt.id == PixelFormatId::YUYV422 || fmt.id == PixelFormatId::UYVY422) {
+            // Resampled in pairs of pixels
+            ow = std::max<size_t>(2, ow & ~size_t(1));
+        }
+
+        // Planar chroma planes are half the pitch of luma, which must be even
+        const size_t pitch = fmt.planar ? (ow + 1) & ~size_t(1) : (ow * fmt.bpp) / 8;
+        const StreamInfo out(fmt, ow, oh, pitch, (unsigned char*)0 + size_bytes);
+        streams.push_back(out);
+        size_bytes += out.SizeBytes();
+    }
+}
+
+ScaleVideo::~ScaleVideo()
+{
+}
+
+//! Implement VideoInput::Start()
+void ScaleVideo::Start()
+{
+    videoin[0]->Start();
+}
+
+//! Implement VideoInput::Stop()
+void ScaleVideo::Stop()
+{
+    videoin[0]->Stop();
+}
+
+//! Implement VideoInput::SizeBytes()
+size_t ScaleVideo::SizeBytes() const
+{
+    return size_bytes;
+}
+
+//! Implement VideoInput::Streams()
+const std::vector<StreamInfo>& ScaleVideo::Streams() const
+{
+    return streams;
+}
+
+void ScaleVideo::Process(unsigned char* image, const unsigned char* buffer)
+{
+    for(size_t s=0; s<streams.size(); ++s) {
+        const StreamInfo& si_in = videoin[0]->Streams()[s];
+        ResizeImage(streams[s].StreamImage(image), si_in.StreamImage(buffer), si_in.PixFormat(), method, threads);
+    }
+}
+
+//! Implement VideoInput::GrabNext()
+bool ScaleVideo::GrabNext( unsigned char* image, bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+//! Implement VideoInput::GrabNewest()
+bool ScaleVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    VideoStageTimer::Grab timing(*this);
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image, in.data());
+        timing.Frame(StageProcess);
+        return true;
+    }else{
+        return false;
+    }
+}
+
+std::vector<VideoInterface*>& ScaleVideo::InputStreams()
+{
+    return videoin;
+}
+
+uint32_t ScaleVideo::AvailableFrames() const
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Scale: child interface is not buffer aware.");
+        return 0;
+    }
+    else
+    {
+        return vpi->AvailableFrames();
+    }
+}
+
+bool ScaleVideo::DropNFrames(uint32_t n)
+{
+    BufferAwareVideoInterface* vpi = dynamic_cast<BufferAwareVideoInterface*>(videoin[0]);
+    if(!vpi)
+    {
+        pango_print_warn("Scale: child interface is not buffer aware.");
+        return false;
+    }
+    else
+    {
+        return vpi->DropNFrames(n);
+    }
+}
+
+PANGOLIN_REGISTER_FACTORY(ScaleVideo)
+{
+    struct ScaleVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            size_t w = uri.Get<size_t>("w", 0);
+            size_t h = uri.Get<size_t>("h", 0);
+            if(uri.Contains("size")) {
+                const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(0,0));
+                w = dim.x;
+                h = dim.y;
+            }
+            const ResizeMethod method = ResizeMethodFromString(uri.Get<std::string>("method", "area"));
+            const size_t threads = uri.Get<size_t>("threads", 1);
+
+            std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
+            if(uri.Get<bool>("device", true)) {
+                ReduceOnDevice(*subvid, w, h, method);
+            }
+            return std::unique_ptr<VideoInterface>(
+                new ScaleVideo(subvid, w, h, method, threads)
+            );
+        }
+    };
+
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<ScaleVideoFactory>(), 10, "scale");
+}
+
+}
@@ -2,6 +2,10 @@
 #include <pangolin/video/drivers/shared_memory.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 using namespace std;
 
 namespace pangolin
@@ -13,17 +17,108 @@ SharedMemoryVideo::SharedMemoryVideo(size_t w, size_t h, std::string pix_fmt,
     _fmt(PixelFormatFromString(pix_fmt)),
     _frame_size(w*h*_fmt.bpp/8),
     _shared_memory(shared_memory),
-    _buffer_full(buffer_full)
+    _buffer_full(buffer_full),
+    _ring(false),
+    _next_seq(0),
+    _device_leases(false),
+    _cuda_slot_bytes(0)
 {
     const size_t pitch = w * _fmt.bpp/8;
     const StreamInfo stream(_fmt, w, h, pitch, 0);
     _streams.push_back(stream);
 }
 
+SharedMemoryVideo::SharedMemoryVideo(
+    const std::shared_ptr<SharedMemoryBufferInterface>& shared_memory,
+    const std::shared_ptr<ConditionVariableInterface>& buffer_full,
+    bool device_leases) :
+    _shared_memory(shared_memory),
+    _buffer_full(buffer_full),
+    _ring(true),
+    _device_leases(device_leases),
+    _cuda_slot_bytes(0)
+{
+    unsigned char* base = _shared_memory->ptr();
+    const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(base);
+    _frame_size = header->frame_bytes;
+
+    picojson::value layout;
+    std::string err;
+    const char* layout_json = (const char*)base + sizeof(shmem_ring_header);
+    picojson::parse(layout, layout_json, layout_json + header->layout_bytes, &err);
+    if(!err.empty() || !layout["streams"].is<picojson::array>()) {
+        throw VideoException("Invalid shared memory ring layout", err);
+    }
+
+    for(const picojson::value& s : layout["streams"].get<picojson::array>()) {
+        const PixelFormat fmt = PixelFormatFromString(s["format"].get<std::string>());
+        _streams.push_back(StreamInfo(fmt,
+            s["width"].get<int64_t>(), s["height"].get<int64_t>(), s["pitch"].get<int64_t>(),
+            (unsigned char*)0 + s["offset"].get<int64_t>()));
+    }
+    _fmt = _streams.empty() ? PixelFormat() : _streams[0].PixFormat();
+    _device_properties = layout["device"];
+
+    if(header->version == shmem_ring_version_cuda) {
+        OpenDeviceFrames(layout);
+    }
+
+    // Start from the newest frame rather than replaying the whole ring
+    const uint64_t written = header->write_seq.load(std::memory_order_acquire);
+    _next_seq = written ? written - 1 : 0;
+}
+
 SharedMemoryVideo::~SharedMemoryVideo()
 {
 }
 
+void SharedMemoryVideo::OpenDeviceFrames(const picojson::value& layout)
+{
+#ifdef HAVE_CUDA
+    cudaIpcMemHandle_t handle;
+    if(!layout["cuda_handle"].is<std::string>() || !ShmemRingDecodeHandle(layout["cuda_handle"].get<std::string>(), handle)) {
+        throw VideoException("Invalid shared memory ring layout", "no CUDA IPC handle");
+    }
+
+    void* frames = nullptr;
+    if(cudaIpcOpenMemHandle(&frames, handle, cudaIpcMemLazyEnablePeerAccess) != cudaSuccess) {
+        cudaGetLastError();
+        throw VideoException("Unable to open device memory of shared memory ring");
+    }
+
+    // Leases keep the mapping as they keep the segment
+    _cuda_frames = std::shared_ptr<unsigned char>((unsigned char*)frames, [](unsigned char* p){
+        cudaIpcCloseMemHandle(p);
+    });
+    _cuda_slot_bytes = layout["cuda_slot_bytes"].get<int64_t>();
+#else
+    PANGOLIN_UNUSED(layout);
+    throw VideoException("Shared memory ring holds device memory, which needs Pangolin built with CUDA");
+#endif
+}
+
+unsigned char* SharedMemoryVideo::SlotFrame(uint64_t frame_seq, shmem_ring_slot* slot) const
+{
+    if(_cuda_frames) {
+        const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(_shared_memory->ptr());
+        return _cuda_frames.get() + (frame_seq % header->num_slots) * _cuda_slot_bytes;
+    }
+    return ShmemRingSlotData(_shared_memory->ptr(), slot);
+}
+
+void SharedMemoryVideo::CopyFrame(unsigned char* image, const unsigned char* frame) const
+{
+#ifdef HAVE_CUDA
+    if(_cuda_frames) {
+        // Device to device copies don't block the host otherwise
+        cudaMemcpy(image, frame, _frame_size, cudaMemcpyDefault);
+        cudaStreamSynchronize(0);
+        return;
+    }
+#endif
+    memcpy(image, frame, _frame_size);
+}
+
 void SharedMemoryVideo::Start()
 {
 }
@@ -42,7 +137,17 @@ const std::vector<StreamInfo>& SharedMemoryVideo::Streams() const
     return _streams;
 }
 
-bool SharedMemoryVideo::GrabNext(unsigned char* image, bool wait)
+const picojson::value& SharedMemoryVideo::DeviceProperties() const
+{
+    return _device_properties;
+}
+
+const picojson::value& SharedMemoryVideo::FrameProperties() const
+{
+    return _frame_properties;
+}
+
+bool SharedMemoryVideo::WaitForFrame(bool wait)
 {
     // If a condition variable exists, try waiting on it.
     if(_buffer_full) {
@@ -55,20 +160,191 @@ bool SharedMemoryVideo::GrabNext(unsigned char* image, bool wait)
             return false;
         }
     }
+    return true;
+}
 
-    // Read the buffer.
-    _shared_memory->lock();
-    memcpy(image, _shared_memory->ptr(), _frame_size);
-    _shared_memory->unlock();
+bool SharedMemoryVideo::WaitForRingFrame(bool wait)
+{
+    const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(_shared_memory->ptr());
+    while(header->write_seq.load(std::memory_order_acquire) <= _next_seq) {
+        if(!wait) {
+            return false;
+        }
+
+        // The condition has no predicate under its mutex, so a broadcast can
+        // be missed between checking write_seq and waiting. Bound the wait.
+        if(_buffer_full) {
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10000000;
+            if(ts.tv_nsec >= 1000000000) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000;
+            }
+            _buffer_full->wait(ts);
+        }else{
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+    return true;
+}
+
+uint64_t SharedMemoryVideo::NextRingFrame(bool newest) const
+{
+    const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(_shared_memory->ptr());
+    const uint64_t written = header->write_seq.load(std::memory_order_acquire);
+    if(newest) {
+        return written - 1;
+    }
+    // The producer may already be overwriting the slot of the oldest frame
+    const uint64_t oldest = written + 1 > header->num_slots ? written + 1 - header->num_slots : 0;
+    return std::max(_next_seq, oldest);
+}
+
+void SharedMemoryVideo::ReadRingProperties(const std::string& props, int64_t timestamp_us)
+{
+    _frame_properties = picojson::value(picojson::object());
+    if(!props.empty()) {
+        picojson::value v;
+        std::string err;
+        picojson::parse(v, props.begin(), props.end(), &err);
+        if(err.empty() && v.is<picojson::object>()) {
+            _frame_properties = v;
+        }
+    }
+    if(!_frame_properties.contains(PANGO_HOST_RECEPTION_TIME_US)) {
+        _frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(timestamp_us);
+    }
+}
+
+std::string SharedMemoryVideo::RingSlotProperties(shmem_ring_slot* slot) const
+{
+    const shmem_ring_header* header = reinterpret_cast<const shmem_ring_header*>(_shared_memory->ptr());
+    return std::string(ShmemRingSlotProps(slot), std::min<uint64_t>(slot->props_size, header->props_bytes));
+}
+
+bool SharedMemoryVideo::ReadRing(unsigned char* image, bool newest, bool wait)
+{
+    unsigned char* base = _shared_memory->ptr();
+
+    for(;;) {
+        if(!WaitForRingFrame(wait)) {
+            return false;
+        }
+
+        const uint64_t n = NextRingFrame(newest);
+        shmem_ring_slot* slot = ShmemRingSlot(base, n);
+        _next_seq = n + 1;
+
+        const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if(seq != 2*n + 2) {
+            // Already overwritten, try the next frame
+            continue;
+        }
+        const int64_t timestamp_us = slot->timestamp_us;
+        const std::string props = RingSlotProperties(slot);
+        CopyFrame(image, SlotFrame(n, slot));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->seq.load(std::memory_order_relaxed) != seq) {
+            // Producer lapped us mid copy
+            continue;
+        }
+
+        ReadRingProperties(props, timestamp_us);
+        return true;
+    }
+}
+
+FrameLease SharedMemoryVideo::LeaseRing(bool newest, bool wait)
+{
+    unsigned char* base = _shared_memory->ptr();
+
+    for(;;) {
+        if(!WaitForRingFrame(wait)) {
+            return FrameLease();
+        }
+
+        const uint64_t n = NextRingFrame(newest);
+        shmem_ring_slot* slot = ShmemRingSlot(base, n);
+        _next_seq = n + 1;
+
+        // Pin the slot, then check the producer hadn't started on it. Both
+        // sides use sequentially consistent operations so that either we see
+        // its odd seq or it sees our pin.
+        slot->readers.fetch_add(1);
+        if(slot->seq.load() != 2*n + 2) {
+            slot->readers.fetch_sub(1);
+            continue;
+        }
+
+        ReadRingProperties(RingSlotProperties(slot), slot->timestamp_us);
+
+        if(_cuda_frames && !_device_leases) {
+            // Consumers expecting host memory get a copy, and the slot back at once
+            std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(_frame_size));
+            CopyFrame(buffer->get(), SlotFrame(n, slot));
+            slot->readers.fetch_sub(1, std::memory_order_release);
+            return FrameLease(buffer->get(), _frame_size, [buffer](){});
+        }
 
+        std::shared_ptr<SharedMemoryBufferInterface> shared_memory = _shared_memory;
+        std::shared_ptr<unsigned char> cuda_frames = _cuda_frames;
+        return FrameLease(SlotFrame(n, slot), _frame_size, [shared_memory, cuda_frames, slot](){
+            slot->readers.fetch_sub(1, std::memory_order_release);
+        });
+    }
+}
+
+bool SharedMemoryVideo::GrabNext(unsigned char* image, bool wait)
+{
+    if(_ring) {
+        return ReadRing(image, false, wait);
+    }
+
+    FrameLease lease = GrabNextLease(wait);
+    if(!lease) {
+        return false;
+    }
+
+    // Read the buffer.
+    memcpy(image, lease.data(), _frame_size);
     return true;
 }
 
 bool SharedMemoryVideo::GrabNewest(unsigned char* image, bool wait)
 {
+    if(_ring) {
+        return ReadRing(image, true, wait);
+    }
     return GrabNext(image,wait);
 }
 
+FrameLease SharedMemoryVideo::GrabNextLease(bool wait)
+{
+    if(_ring) {
+        return LeaseRing(false, wait);
+    }
+
+    if(!WaitForFrame(wait)) {
+        return FrameLease();
+    }
+
+    _shared_memory->lock();
+    std::shared_ptr<SharedMemoryBufferInterface> shared_memory = _shared_memory;
+    return FrameLease(_shared_memory->ptr(), _frame_size, [shared_memory](){
+        shared_memory->unlock();
+    });
+}
+
+FrameLease SharedMemoryVideo::GrabNewestLease(bool wait)
+{
+    if(_ring) {
+        return LeaseRing(true, wait);
+    }
+    return GrabNextLease(wait);
+}
+
 PANGOLIN_REGISTER_FACTORY(SharedMemoryVideo)
 {
     struct SharedMemoryVideoFactory : public FactoryInterface<VideoInterface> {
@@ -79,7 +355,7 @@ PANGOLIN_REGISTER_FACTORY(SharedMemoryVideo)
             const std::string shmem_name = std::string("/") + uri.url;
             std::shared_ptr<SharedMemoryBufferInterface> shmem_buffer =
                 open_named_shared_memory_buffer(shmem_name, true);
-            if (dim.x == 0 || dim.y == 0 || !shmem_buffer) {
+            if (!shmem_buffer) {
                 throw VideoException("invalid shared memory parameters");
             }
 
@@ -87,6 +363,16 @@ PANGOLIN_REGISTER_FACTORY(SharedMemoryVideo)
             std::shared_ptr<ConditionVariableInterface> buffer_full =
                 open_named_condition_variable(cond_name);
 
+            if(IsSharedMemoryRing(*shmem_buffer)) {
+                return std::unique_ptr<VideoInterface>(
+                    new SharedMemoryVideo(shmem_buffer,buffer_full, uri.Get<bool>("device", false))
+                );
+            }
+
+            if (dim.x == 0 || dim.y == 0) {
+                throw VideoException("invalid shared memory parameters");
+            }
+
             return std::unique_ptr<VideoInterface>(
                 new SharedMemoryVideo(dim.x, dim.y, fmt, shmem_buffer,buffer_full)
             );
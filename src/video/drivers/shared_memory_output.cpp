@@ -0,0 +1,253 @@
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/memcpy.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/drivers/shared_memory_output.h>
+#include <pangolin/video/video_exception.h>
+#include <pangolin/video/video_interface.h>
+
+#include <cstring>
+#include <thread>
+
+namespace pangolin
+{
+
+SharedMemoryVideoOutput::SharedMemoryVideoOutput(const std::string& name, size_t num_slots, size_t props_bytes, double pin_timeout_s, bool cuda)
+    : _name(name), _num_slots(num_slots), _props_bytes(props_bytes), _pin_timeout_s(pin_timeout_s),
+      _frame_size(0), _write_seq(0), _writing(false), _warned_props(false),
+      _cuda(cuda), _cuda_frames(nullptr), _cuda_slot_bytes(0)
+{
+    if(_num_slots < 2) {
+        throw VideoException("SharedMemoryVideoOutput: at least 2 slots are required");
+    }
+#ifndef HAVE_CUDA
+    if(_cuda) {
+        throw VideoException("SharedMemoryVideoOutput: device memory rings need Pangolin built with CUDA");
+    }
+#endif
+}
+
+SharedMemoryVideoOutput::~SharedMemoryVideoOutput()
+{
+#ifdef HAVE_CUDA
+    if(_cuda_frames) {
+        cudaFree(_cuda_frames);
+    }
+#endif
+}
+
+const std::vector<StreamInfo>& SharedMemoryVideoOutput::Streams() const
+{
+    return _streams;
+}
+
+bool SharedMemoryVideoOutput::IsPipe() const
+{
+    return false;
+}
+
+void SharedMemoryVideoOutput::SetStreams(const std::vector<StreamInfo>& streams, const std::string& /*uri*/, const picojson::value& properties)
+{
+    if(_shared_memory) {
+        throw VideoException("SharedMemoryVideoOutput: streams already set");
+    }
+    _streams = streams;
+
+    picojson::value layout;
+    layout["device"] = properties;
+    layout["streams"] = picojson::value(picojson::array());
+    _frame_size = 0;
+    for(const StreamInfo& si : _streams) {
+        picojson::value json_stream;
+        json_stream["format"] = si.PixFormat().Name();
+        json_stream["width"] = si.Width();
+        json_stream["height"] = si.Height();
+        json_stream["pitch"] = si.Pitch();
+        json_stream["offset"] = (size_t) si.Offset();
+        layout["streams"].push_back(json_stream);
+        _frame_size = std::max(_frame_size, (size_t)si.Offset() + si.SizeBytes());
+    }
+    if(_cuda) {
+        AllocateDeviceFrames(layout);
+    }
+    const std::string layout_json = layout.serialize();
+
+    // Frames of a CUDA ring aren't held in the segment
+    const uint64_t slots_offset = ShmemRingAlign(sizeof(shmem_ring_header) + layout_json.size());
+    const uint64_t slot_bytes = ShmemRingSlotBytes(_cuda ? 0 : _frame_size, _props_bytes);
+    _shared_memory = create_named_shared_memory_buffer(_name, slots_offset + _num_slots * slot_bytes);
+    if(!_shared_memory) {
+        throw VideoException("SharedMemoryVideoOutput: unable to create shared memory", _name);
+    }
+    _buffer_full = create_named_condition_variable(_name + "_cond");
+
+    // Consumers only look at the rest once magic is in place
+    unsigned char* base = _shared_memory->ptr();
+    shmem_ring_header* header = reinterpret_cast<shmem_ring_header*>(base);
+    std::memset(base, 0, slots_offset + _num_slots * slot_bytes);
+    header->version = _cuda ? shmem_ring_version_cuda : shmem_ring_version;
+    header->num_slots = (uint32_t)_num_slots;
+    header->frame_bytes = _frame_size;
+    header->props_bytes = _props_bytes;
+    header->slot_bytes = slot_bytes;
+    header->layout_bytes = layout_json.size();
+    header->slots_offset = slots_offset;
+    header->write_seq.store(0, std::memory_order_relaxed);
+    std::memcpy(base + sizeof(shmem_ring_header), layout_json.data(), layout_json.size());
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, shmem_ring_magic, sizeof(shmem_ring_magic));
+}
+
+void SharedMemoryVideoOutput::AllocateDeviceFrames(picojson::value& layout)
+{
+#ifdef HAVE_CUDA
+    // Slots on texture friendly boundaries
+    _cuda_slot_bytes = (_frame_size + 255) & ~size_t(255);
+
+    int device = 0;
+    void* frames = nullptr;
+    if(cudaGetDevice(&device) != cudaSuccess || cudaMalloc(&frames, _num_slots * _cuda_slot_bytes) != cudaSuccess) {
+        cudaGetLastError();
+        throw VideoException("SharedMemoryVideoOutput: unable to allocate device memory for", _name);
+    }
+    _cuda_frames = (unsigned char*)frames;
+
+    cudaIpcMemHandle_t handle;
+    if(cudaIpcGetMemHandle(&handle, frames) != cudaSuccess) {
+        cudaGetLastError();
+        throw VideoException("SharedMemoryVideoOutput: unable to export device memory for", _name);
+    }
+
+    layout["memory"] = "cuda";
+    layout["cuda_device"] = (int64_t)device;
+    layout["cuda_handle"] = ShmemRingEncodeHandle(handle);
+    layout["cuda_slot_bytes"] = (int64_t)_cuda_slot_bytes;
+#else
+    PANGOLIN_UNUSED(layout);
+#endif
+}
+
+unsigned char* SharedMemoryVideoOutput::SlotFrame(uint64_t frame_seq, shmem_ring_slot* slot)
+{
+    if(_cuda) {
+        return _cuda_frames + (frame_seq % _num_slots) * _cuda_slot_bytes;
+    }
+    return ShmemRingSlotData(_shared_memory->ptr(), slot);
+}
+
+void SharedMemoryVideoOutput::WaitForReaders(shmem_ring_slot* slot)
+{
+    // Consumers leasing this slot in place still hold the previous frame. If
+    // one died holding a lease, give up on it rather than stall forever.
+    if(slot->readers.load() == 0) {
+        return;
+    }
+
+    const basetime start = TimeNow();
+    while(slot->readers.load() != 0) {
+        if(TimeDiff_s(start, TimeNow()) > _pin_timeout_s) {
+            pango_print_warn("SharedMemoryVideoOutput: '%s' reader held a frame for more than %gs, overwriting it.\n", _name.c_str(), _pin_timeout_s);
+            slot->readers.store(0);
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+unsigned char* SharedMemoryVideoOutput::BeginFrame()
+{
+    if(!_shared_memory) {
+        throw VideoException("SharedMemoryVideoOutput: SetStreams must be called first");
+    }
+    if(_writing) {
+        throw VideoException("SharedMemoryVideoOutput: previous frame not yet published");
+    }
+
+    unsigned char* base = _shared_memory->ptr();
+    const uint64_t n = _write_seq;
+    shmem_ring_slot* slot = ShmemRingSlot(base, n);
+
+    // Odd while writing. Sequentially consistent against the readers' pin
+    slot->seq.store(2*n + 1);
+    WaitForReaders(slot);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    _writing = true;
+    return SlotFrame(n, slot);
+}
+
+int SharedMemoryVideoOutput::PublishFrame(const picojson::value& frame_properties)
+{
+    if(!_writing) {
+        throw VideoException("SharedMemoryVideoOutput: BeginFrame must be called first");
+    }
+
+    unsigned char* base = _shared_memory->ptr();
+    shmem_ring_header* header = reinterpret_cast<shmem_ring_header*>(base);
+    const uint64_t n = _write_seq++;
+    shmem_ring_slot* slot = ShmemRingSlot(base, n);
+
+    std::string props;
+    if(frame_properties.is<picojson::object>()) {
+        props = frame_properties.serialize();
+        if(props.size() > _props_bytes) {
+            if(!_warned_props) {
+                pango_print_warn("SharedMemoryVideoOutput: frame properties exceed %zu bytes and are dropped.\n", _props_bytes);
+                _warned_props = true;
+            }
+            props.clear();
+        }
+    }
+    slot->timestamp_us = frame_properties.get_value<int64_t>(PANGO_HOST_RECEPTION_TIME_US, Time_us(TimeNow()));
+    slot->props_size = (uint32_t)props.size();
+    std::memcpy(ShmemRingSlotProps(slot), props.data(), props.size());
+
+#ifdef HAVE_CUDA
+    if(_cuda) {
+        // Kernels or copies writing the frame may be on any stream
+        cudaDeviceSynchronize();
+    }
+#endif
+
+    slot->seq.store(2*n + 2, std::memory_order_release);
+    header->write_seq.store(n + 1, std::memory_order_release);
+    _writing = false;
+    if(_buffer_full) {
+        _buffer_full->broadcast();
+    }
+    return (int)n;
+}
+
+int SharedMemoryVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
+{
+    unsigned char* frame = BeginFrame();
+    if(_cuda) {
+        // From host or device memory
+        MemCopy(frame, data, _frame_size);
+    }else{
+        std::memcpy(frame, data, _frame_size);
+    }
+    return PublishFrame(frame_properties);
+}
+
+PANGOLIN_REGISTER_FACTORY(SharedMemoryVideoOutput)
+{
+    struct SharedMemoryVideoOutputFactory : public FactoryInterface<VideoOutputInterface> {
+        std::unique_ptr<VideoOutputInterface> Open(const Uri& uri) override {
+            const size_t num_slots = uri.Get<size_t>("slots", 4);
+            const size_t props_bytes = uri.Get<size_t>("props_bytes", 4096);
+            const double pin_timeout_s = uri.Get<double>("pin_timeout_s", 1.0);
+            const std::string memory = uri.Get<std::string>("memory", "host");
+            if(memory != "host" && memory != "cuda") {
+                throw VideoException("SharedMemoryVideoOutput: memory must be host or cuda, not", memory);
+            }
+            return std::unique_ptr<VideoOutputInterface>(
+                new SharedMemoryVideoOutput(std::string("/") + uri.url, num_slots, props_bytes, pin_timeout_s, memory == "cuda")
+            );
+        }
+    };
+
+    FactoryRegistry<VideoOutputInterface>::I().RegisterFactory(std::make_shared<SharedMemoryVideoOutputFactory>(), 10, "shmem");
+}
+
+}
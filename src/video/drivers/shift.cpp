@@ -29,11 +29,35 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SHIFT_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define SHIFT_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
 namespace pangolin
 {
 
 ShiftVideo::ShiftVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fmt, int shift_right_bits, unsigned int mask)
-    : src(std::move(src_)), size_bytes(0), buffer(0), shift_right_bits(shift_right_bits), mask(mask)
+    : VideoStageTimer("shift"), src(std::move(src_)), size_bytes(0)
+{
+    options.shift_right_bits = shift_right_bits;
+    options.mask = mask;
+    Init(out_fmt);
+}
+
+ShiftVideo::ShiftVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fmt, const ShiftOptions& options)
+    : VideoStageTimer("shift"), src(std::move(src_)), size_bytes(0), options(options)
+{
+    Init(out_fmt);
+}
+
+void ShiftVideo::Init(PixelFormat out_fmt)
 {
     if(!src) {
         throw VideoException("ShiftVideo: VideoInterface in must not be null");
@@ -56,14 +80,32 @@ ShiftVideo::ShiftVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fm
 
         streams.push_back(pangolin::StreamInfo( out_fmt, w, h, w*out_fmt.bpp / 8, (unsigned char*)0 + size_bytes ));
         size_bytes += w*h*out_fmt.bpp / 8;
+
+        StreamMap map;
+        map.lo = (uint16_t)std::min(std::max(options.min, 0), 0xFFFF);
+        map.hi = (uint16_t)std::min(std::max(options.max, 0), 0xFFFF);
+        map.row = 0;
+        maps.push_back(map);
+        UpdateMap(s);
     }
 
-    buffer = new unsigned char[src->SizeBytes()];
+    fused = std::unique_ptr<FusedRowFilter>(new FusedRowFilter(*this));
 }
 
 ShiftVideo::~ShiftVideo()
 {
-    delete[] buffer;
+}
+
+ShiftMode ShiftVideo::ShiftModeFromString(const std::string& str)
+{
+    if(!str.compare("shift")) return ShiftModeShift;
+    else if(!str.compare("linear")) return ShiftModeLinear;
+    else if(!str.compare("gamma")) return ShiftModeGamma;
+    else if(!str.compare("equalize")) return ShiftModeEqualize;
+    else {
+        pango_print_error("ShiftVideo error, %s is not a valid mode using shift\n", str.c_str());
+        return ShiftModeShift;
+    }
 }
 
 //! Implement VideoInput::Start()
@@ -90,29 +132,327 @@ const std::vector<StreamInfo>& ShiftVideo::Streams() const
     return streams;
 }
 
-void DoShift16to8(
-    Image<unsigned char>& out,
-    const Image<unsigned char>& in,
-    int shift_right_bits,
-    unsigned int mask
-) {
-    for(size_t y=0; y<out.h; ++y) {
-        for(size_t x=0; x<out.w; ++x) {
-            const unsigned short vin = ((unsigned short*)(in.ptr + y * in.pitch))[x];
-            out.ptr[y*out.pitch+x] = (vin >> shift_right_bits) & mask;
+namespace
+{
+
+enum ShiftSimdLevel
+{
+    ShiftSimdScalar,
+    ShiftSimdSSE2,
+    ShiftSimdAVX2,
+    ShiftSimdNEON
+};
+
+ShiftSimdLevel DetectSimdLevel()
+{
+#if defined(SHIFT_HAVE_X86_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return ShiftSimdAVX2;
+    if(__builtin_cpu_supports("sse2")) return ShiftSimdSSE2;
+    return ShiftSimdScalar;
+#elif defined(SHIFT_HAVE_NEON)
+    return ShiftSimdNEON;
+#else
+    return ShiftSimdScalar;
+#endif
+}
+
+const ShiftSimdLevel simd_level = DetectSimdLevel();
+
+// Scale factor (16.16 fixed point) mapping a window of range+1 values onto [0,255]
+uint32_t ScaleForRange(uint32_t range)
+{
+    return (255u << 16) / std::max<uint32_t>(range, 1);
+}
+
+// Each vector kernel converts a whole number of vectors from the start of the
+// row and returns the number of pixels done, leaving any tail for the scalar path.
+// Shift outputs the low byte of (in >> shift) & mask, Scale outputs
+// min(255, (sat(in - lo) * k) >> 16).
+
+#if defined(SHIFT_HAVE_X86_DISPATCH)
+
+__attribute__((target("sse2")))
+size_t ShiftRowSSE2(uint8_t* out, const uint16_t* in, size_t n, int shift, unsigned int mask)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i m = _mm_set1_epi16((short)(mask & 0xFF));
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_and_si128(_mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + i)), count), m);
+        const __m128i b = _mm_and_si128(_mm_srl_epi16(_mm_loadu_si128((const __m128i*)(in + i + 8)), count), m);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+size_t ScaleRowSSE2(uint8_t* out, const uint16_t* in, size_t n, uint16_t lo, uint16_t k)
+{
+    const __m128i vlo = _mm_set1_epi16((short)lo);
+    const __m128i vk = _mm_set1_epi16((short)k);
+    const __m128i v255 = _mm_set1_epi16(255);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m128i a = _mm_mulhi_epu16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)(in + i)), vlo), vk);
+        __m128i b = _mm_mulhi_epu16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)(in + i + 8)), vlo), vk);
+        // min(x, 255) without SSE4.1, as packus treats its input as signed
+        a = _mm_subs_epu16(a, _mm_subs_epu16(a, v255));
+        b = _mm_subs_epu16(b, _mm_subs_epu16(b, v255));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t ShiftRowAVX2(uint8_t* out, const uint16_t* in, size_t n, int shift, unsigned int mask)
+{
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i m = _mm256_set1_epi16((short)(mask & 0xFF));
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(in + i)), count), m);
+        const __m256i b = _mm256_and_si256(_mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(in + i + 16)), count), m);
+        // packus works within 128 bit lanes
+        const __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3,1,2,0));
+        _mm256_storeu_si256((__m256i*)(out + i), r);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t ScaleRowAVX2(uint8_t* out, const uint16_t* in, size_t n, uint16_t lo, uint16_t k)
+{
+    const __m256i vlo = _mm256_set1_epi16((short)lo);
+    const __m256i vk = _mm256_set1_epi16((short)k);
+    const __m256i v255 = _mm256_set1_epi16(255);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_mulhi_epu16(_mm256_subs_epu16(_mm256_loadu_si256((const __m256i*)(in + i)), vlo), vk);
+        __m256i b = _mm256_mulhi_epu16(_mm256_subs_epu16(_mm256_loadu_si256((const __m256i*)(in + i + 16)), vlo), vk);
+        a = _mm256_min_epu16(a, v255);
+        b = _mm256_min_epu16(b, v255);
+        const __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3,1,2,0));
+        _mm256_storeu_si256((__m256i*)(out + i), r);
+    }
+    return i;
+}
+
+#endif // SHIFT_HAVE_X86_DISPATCH
+
+#if defined(SHIFT_HAVE_NEON)
+
+size_t ShiftRowNEON(uint8_t* out, const uint16_t* in, size_t n, int shift, unsigned int mask)
+{
+    const int16x8_t count = vdupq_n_s16((int16_t)-shift);
+    const uint16x8_t m = vdupq_n_u16((uint16_t)(mask & 0xFF));
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t v = vandq_u16(vshlq_u16(vld1q_u16(in + i), count), m);
+        vst1_u8(out + i, vmovn_u16(v));
+    }
+    return i;
+}
+
+size_t ScaleRowNEON(uint8_t* out, const uint16_t* in, size_t n, uint16_t lo, uint16_t k)
+{
+    const uint16x8_t vlo = vdupq_n_u16(lo);
+    const uint16x4_t vk = vdup_n_u16(k);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const uint16x8_t d = vqsubq_u16(vld1q_u16(in + i), vlo);
+        const uint16x4_t a = vshrn_n_u32(vmull_u16(vget_low_u16(d), vk), 16);
+        const uint16x4_t b = vshrn_n_u32(vmull_u16(vget_high_u16(d), vk), 16);
+        vst1_u8(out + i, vqmovn_u16(vcombine_u16(a, b)));
+    }
+    return i;
+}
+
+#endif // SHIFT_HAVE_NEON
+
+void ShiftRow(uint8_t* out, const uint16_t* in, size_t n, int shift, unsigned int mask)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(SHIFT_HAVE_X86_DISPATCH)
+    case ShiftSimdAVX2: i = ShiftRowAVX2(out, in, n, shift, mask); break;
+    case ShiftSimdSSE2: i = ShiftRowSSE2(out, in, n, shift, mask); break;
+#elif defined(SHIFT_HAVE_NEON)
+    case ShiftSimdNEON: i = ShiftRowNEON(out, in, n, shift, mask); break;
+#endif
+    default: break;
+    }
+    for(; i < n; ++i) {
+        out[i] = (in[i] >> shift) & mask;
+    }
+}
+
+void ScaleRow(uint8_t* out, const uint16_t* in, size_t n, uint16_t lo, uint32_t k)
+{
+    size_t i = 0;
+    switch(simd_level) {
+#if defined(SHIFT_HAVE_X86_DISPATCH)
+    case ShiftSimdAVX2: i = ScaleRowAVX2(out, in, n, lo, (uint16_t)k); break;
+    case ShiftSimdSSE2: i = ScaleRowSSE2(out, in, n, lo, (uint16_t)k); break;
+#elif defined(SHIFT_HAVE_NEON)
+    case ShiftSimdNEON: i = ScaleRowNEON(out, in, n, lo, (uint16_t)k); break;
+#endif
+    default: break;
+    }
+    for(; i < n; ++i) {
+        const uint32_t d = in[i] > lo ? in[i] - lo : 0;
+        out[i] = (uint8_t)std::min<uint32_t>(255, (d * k) >> 16);
+    }
+}
+
+void LutRow(uint8_t* out, const uint16_t* in, size_t n, const uint8_t* lut)
+{
+    for(size_t i = 0; i < n; ++i) {
+        out[i] = lut[in[i]];
+    }
+}
+
+}
+
+void ShiftVideo::UpdateMap(size_t stream)
+{
+    StreamMap& map = maps[stream];
+    const size_t num_values = 1 << 16;
+
+    const bool use_hist = options.mode == ShiftModeEqualize ||
+        (options.auto_range && (options.mode == ShiftModeLinear || options.mode == ShiftModeGamma));
+
+    double total = 0.0;
+    if(use_hist) {
+        if(map.hist.empty()) {
+            map.hist.assign(num_values, 0.0f);
+            map.frame_hist.assign(num_values, 0);
+        }
+        for(size_t v = 0; v < num_values; ++v) {
+            map.hist[v] = options.decay * map.hist[v] + (float)map.frame_hist[v];
+            map.frame_hist[v] = 0;
+            total += map.hist[v];
+        }
+    }
+
+    if(options.auto_range && total > 0.0) {
+        // Window spanning low_fraction to high_fraction of the histogram
+        const double lo_count = options.low_fraction * total;
+        const double hi_count = options.high_fraction * total;
+        double sum = 0.0;
+        size_t v = 0;
+        for(; v < num_values && sum + map.hist[v] <= lo_count; ++v) sum += map.hist[v];
+        map.lo = (uint16_t)std::min(v, num_values - 1);
+        for(; v < num_values && sum + map.hist[v] < hi_count; ++v) sum += map.hist[v];
+        map.hi = (uint16_t)std::min(v, num_values - 1);
+    }
+    if(map.hi <= map.lo) {
+        map.hi = (uint16_t)std::min<int>(map.lo + 1, 0xFFFF);
+        map.lo = (uint16_t)(map.hi - 1);
+    }
+
+    // Linear windows of 256 or more values are scaled directly, with the scale in 16 bits
+    const uint32_t range = map.hi - map.lo;
+    if(options.mode == ShiftModeShift || (options.mode == ShiftModeLinear && range >= 256)) {
+        map.lut.clear();
+        return;
+    }
+
+    map.lut.resize(num_values);
+    if(options.mode == ShiftModeLinear) {
+        const uint32_t k = ScaleForRange(range);
+        for(uint32_t v = 0; v < num_values; ++v) {
+            const uint32_t d = v > map.lo ? v - map.lo : 0;
+            map.lut[v] = (uint8_t)std::min<uint32_t>(255, (d * k) >> 16);
+        }
+    }else if(options.mode == ShiftModeGamma) {
+        const double inv_gamma = 1.0 / std::max(options.gamma, 1e-3f);
+        for(uint32_t v = 0; v < num_values; ++v) {
+            const double t = std::min(std::max(((double)v - map.lo) / range, 0.0), 1.0);
+            map.lut[v] = (uint8_t)std::lround(255.0 * std::pow(t, inv_gamma));
+        }
+    }else{
+        // Equalization. Linear over the whole range until anything has been seen.
+        if(total > 0.0) {
+            double sum = 0.0;
+            for(size_t v = 0; v < num_values; ++v) {
+                sum += map.hist[v];
+                map.lut[v] = (uint8_t)std::lround(255.0 * sum / total);
+            }
+        }else{
+            for(size_t v = 0; v < num_values; ++v) {
+                map.lut[v] = (uint8_t)(v >> 8);
+            }
+        }
+    }
+}
+
+void ShiftVideo::ProcessRow(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    StreamMap& map = maps[stream];
+    const size_t w = streams[stream].Width();
+    const uint16_t* in = (const uint16_t*)in_row;
+
+    if(options.mode == ShiftModeShift) {
+        ShiftRow(out_row, in, w, options.shift_right_bits, options.mask);
+        return;
+    }
+
+    if(map.lut.empty()) {
+        ScaleRow(out_row, in, w, map.lo, ScaleForRange(map.hi - map.lo));
+    }else{
+        LutRow(out_row, in, w, map.lut.data());
+    }
+
+    // Sample every other row into the histogram, and remap once the frame is done
+    if(!map.frame_hist.empty() && map.row % 2 == 0) {
+        uint32_t* hist = map.frame_hist.data();
+        for(size_t x = 0; x < w; ++x) {
+            ++hist[in[x]];
+        }
+    }
+    if(++map.row == streams[stream].Height()) {
+        map.row = 0;
+        if(!map.frame_hist.empty()) {
+            UpdateMap(stream);
         }
     }
 }
 
+//! Implement VideoRowFilterInterface::RowFilterInputRow()
+size_t ShiftVideo::RowFilterInputRow(size_t /*stream*/, size_t y) const
+{
+    return y;
+}
+
+//! Implement VideoRowFilterInterface::RowFilterProcess()
+void ShiftVideo::RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    ProcessRow(stream, out_row, in_row);
+}
+
 //! Implement VideoInput::GrabNext()
 bool ShiftVideo::GrabNext( unsigned char* image, bool wait )
 {    
-    if(videoin[0]->GrabNext(buffer,wait)) {
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNext(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
         for(size_t s=0; s<streams.size(); ++s) {
-            Image<unsigned char> img_in  = videoin[0]->Streams()[s].StreamImage(buffer);
+            Image<unsigned char> img_in  = videoin[0]->Streams()[s].StreamImage(in.data());
             Image<unsigned char> img_out = Streams()[s].StreamImage(image);
-            DoShift16to8(img_out, img_in, shift_right_bits, mask);
+            for(size_t y=0; y < img_out.h; ++y) {
+                ProcessRow(s, img_out.RowPtr(y), img_in.RowPtr(y));
+            }
         }
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -122,12 +462,25 @@ bool ShiftVideo::GrabNext( unsigned char* image, bool wait )
 //! Implement VideoInput::GrabNewest()
 bool ShiftVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    if(videoin[0]->GrabNewest(buffer,wait)) {
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNewest(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
         for(size_t s=0; s<streams.size(); ++s) {
-            Image<unsigned char> img_in  = videoin[0]->Streams()[s].StreamImage(buffer);
+            Image<unsigned char> img_in  = videoin[0]->Streams()[s].StreamImage(in.data());
             Image<unsigned char> img_out = Streams()[s].StreamImage(image);
-            DoShift16to8(img_out, img_in, shift_right_bits, mask);
+            for(size_t y=0; y < img_out.h; ++y) {
+                ProcessRow(s, img_out.RowPtr(y), img_in.RowPtr(y));
+            }
         }
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -143,12 +496,22 @@ PANGOLIN_REGISTER_FACTORY(ShiftVideo)
 {
     struct ShiftVideoFactory : public FactoryInterface<VideoInterface> {
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
-            const int shift_right = uri.Get<int>("shift", 0);
-            const int mask = uri.Get<int>("mask",  0xffff);
+            ShiftOptions options;
+            options.mode = ShiftVideo::ShiftModeFromString(uri.Get<std::string>("mode", "shift"));
+            options.shift_right_bits = uri.Get<int>("shift", 0);
+            options.mask = uri.Get<int>("mask",  0xffff);
+            // Range the window automatically unless it's given
+            options.auto_range = !uri.Contains("min") && !uri.Contains("max");
+            options.min = uri.Get<int>("min", 0);
+            options.max = uri.Get<int>("max", 0xffff);
+            options.low_fraction = uri.Get<float>("low", 0.01f);
+            options.high_fraction = uri.Get<float>("high", 0.99f);
+            options.gamma = uri.Get<float>("gamma", 2.2f);
+            options.decay = uri.Get<float>("decay", 0.9f);
 
             std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
             return std::unique_ptr<VideoInterface>(
-                new ShiftVideo(subvid, PixelFormatFromString("GRAY8"), shift_right, mask)
+                new ShiftVideo(subvid, PixelFormatFromString("GRAY8"), options)
             );
         }
     };
@@ -32,6 +32,36 @@
 namespace pangolin
 {
 
+// Crop roi of the only stream of src on the device if it can, leaving stream
+// to select roi from what is then transferred
+inline void CropOnDevice(VideoInterface& src, const ImageRoi& roi, StreamInfo& stream)
+{
+    VideoReadoutInterface* vr = GetVideoReadoutInterface(src);
+    if(!vr) return;
+
+    // Only then are stream pixels sensor pixels
+    const VideoReadout full = vr->GetReadout();
+    if(!full.IsFullSensor() || full.Factor() != 1) return;
+
+    VideoReadout want;
+    want.x = roi.x;
+    want.y = roi.y;
+    want.w = roi.w;
+    want.h = roi.h;
+    const VideoReadout got = vr->SetReadout(want);
+    if(got.IsFullSensor() || got.Factor() != 1 ||
+       got.x > roi.x || got.y > roi.y ||
+       got.x + got.w < roi.x + roi.w || got.y + got.h < roi.y + roi.h) {
+        // The window doesn't hold roi, so read out everything as before
+        vr->SetReadout(full);
+        return;
+    }
+
+    const StreamInfo& st = src.Streams()[0];
+    const size_t start = (size_t)st.Offset() + (roi.y - got.y) * st.Pitch() + st.PixFormat().bpp * (roi.x - got.x) / 8;
+    stream = StreamInfo(st.PixFormat(), roi.w, roi.h, st.Pitch(), (unsigned char*)0 + start);
+}
+
 SplitVideo::SplitVideo(std::unique_ptr<VideoInterface> &src_, const std::vector<StreamInfo>& streams)
     : src(std::move(src_)), streams(streams)
 {
@@ -85,6 +115,16 @@ std::vector<VideoInterface*>& SplitVideo::InputStreams()
     return videoin;
 }
 
+FrameLease SplitVideo::GrabNextLease( bool wait )
+{
+    return pangolin::GrabNextLease(*videoin[0], wait);
+}
+
+FrameLease SplitVideo::GrabNewestLease( bool wait )
+{
+    return pangolin::GrabNewestLease(*videoin[0], wait);
+}
+
 PANGOLIN_REGISTER_FACTORY(SplitVideo)
 {
     struct SplitVideoFactory : public FactoryInterface<VideoInterface> {
@@ -108,7 +148,7 @@ PANGOLIN_REGISTER_FACTORY(SplitVideo)
                     if(roi.w == 0 || roi.h == 0) {
                         throw VideoException("split: empty ROI.");
                     }
-                    const size_t start1 = roi.y * st1.Pitch() + st1.PixFormat().bpp * roi.x / 8;
+                    const size_t start1 = (size_t)st1.Offset() + roi.y * st1.Pitch() + st1.PixFormat().bpp * roi.x / 8;
                     streams.push_back( StreamInfo( st1.PixFormat(), roi.w, roi.h, st1.Pitch(), (unsigned char*)0 + start1 ) );
                 }else if(uri.Contains(key_mem)) {
                     const StreamInfo& info = uri.Get<StreamInfo>(key_mem, subvid->Streams()[0] );
@@ -142,12 +182,17 @@ PANGOLIN_REGISTER_FACTORY(SplitVideo)
                     roi2 = ImageRoi(0,subh/2, subw, subh/2 );
                 }
 
-                const size_t start1 = roi1.y * st1.Pitch() + st1.PixFormat().bpp * roi1.x / 8;
-                const size_t start2 = roi2.y * st1.Pitch() + st1.PixFormat().bpp * roi2.x / 8;
+                const size_t start1 = (size_t)st1.Offset() + roi1.y * st1.Pitch() + st1.PixFormat().bpp * roi1.x / 8;
+                const size_t start2 = (size_t)st1.Offset() + roi2.y * st1.Pitch() + st1.PixFormat().bpp * roi2.x / 8;
                 streams.push_back( StreamInfo( st1.PixFormat(), roi1.w, roi1.h, st1.Pitch(), (unsigned char*)0 + start1 ) );
                 streams.push_back( StreamInfo( st1.PixFormat(), roi2.w, roi2.h, st1.Pitch(), (unsigned char*)0 + start2 ) );
             }
 
+            // A lone window of a lone stream needn't be transferred whole
+            if(streams.size() == 1 && uri.Contains("roi1") && subvid->Streams().size() == 1 && uri.Get<bool>("device", true)) {
+                CropOnDevice(*subvid, uri.Get<ImageRoi>("roi1", ImageRoi()), streams[0]);
+            }
+
             return std::unique_ptr<VideoInterface>( new SplitVideo(subvid,streams) );
         }
     };
@@ -0,0 +1,407 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/memcpy.h>
+#include <pangolin/utils/trace.h>
+#include <pangolin/video/drivers/tee.h>
+#include <pangolin/video/iostream_operators.h>
+
+#include <algorithm>
+#include <map>
+
+namespace pangolin
+{
+
+const uint64_t tee_grab_fail_sleep_us = 1000;
+const uint64_t tee_capture_timeout_ms = 5000;
+
+namespace
+{
+std::mutex& NamedHubsMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, std::weak_ptr<TeeHub>>& NamedHubs()
+{
+    static std::map<std::string, std::weak_ptr<TeeHub>> hubs;
+    return hubs;
+}
+}
+
+TeeHub::TeeHub(std::unique_ptr<VideoInterface>& src_)
+    : src(std::move(src_)), started_consumers(0), quit_grab_thread(true)
+{
+    if(!src) {
+        throw VideoException("TeeHub: VideoInterface in must not be null");
+    }
+}
+
+TeeHub::~TeeHub()
+{
+    quit_grab_thread = true;
+    if(grab_thread.joinable()) {
+        grab_thread.join();
+        src->Stop();
+    }
+}
+
+std::unique_ptr<TeeVideo> TeeHub::AddConsumer(size_t depth)
+{
+    return std::unique_ptr<TeeVideo>(new TeeVideo(shared_from_this(), depth));
+}
+
+VideoInterface& TeeHub::Source()
+{
+    return *src;
+}
+
+std::shared_ptr<TeeHub> TeeHub::Named(const std::string& name)
+{
+    std::lock_guard<std::mutex> l(NamedHubsMutex());
+    auto it = NamedHubs().find(name);
+    return it != NamedHubs().end() ? it->second.lock() : std::shared_ptr<TeeHub>();
+}
+
+void TeeHub::SetNamed(const std::string& name, const std::shared_ptr<TeeHub>& hub)
+{
+    std::lock_guard<std::mutex> l(NamedHubsMutex());
+    NamedHubs()[name] = hub;
+}
+
+void TeeHub::ConsumerStarted()
+{
+    std::lock_guard<std::mutex> l(thread_mutex);
+    if(started_consumers++ == 0) {
+        src->Start();
+        quit_grab_thread = false;
+        grab_thread = std::thread(&TeeHub::GrabLoop, this);
+    }
+}
+
+void TeeHub::ConsumerStopped()
+{
+    std::lock_guard<std::mutex> l(thread_mutex);
+    if(started_consumers && --started_consumers == 0) {
+        quit_grab_thread = true;
+        if(grab_thread.joinable()) {
+            grab_thread.join();
+        }
+        src->Stop();
+    }
+}
+
+void TeeHub::Attach(TeeVideo* consumer)
+{
+    std::lock_guard<std::mutex> l(consumers_mutex);
+    consumers.push_back(consumer);
+}
+
+void TeeHub::Detach(TeeVideo* consumer)
+{
+    std::lock_guard<std::mutex> l(consumers_mutex);
+    consumers.erase(std::remove(consumers.begin(), consumers.end(), consumer), consumers.end());
+}
+
+void TeeHub::GrabLoop()
+{
+    TraceSetThreadName("TeeHub");
+
+    while(!quit_grab_thread) {
+        std::shared_ptr<TeeFrame> frame = std::make_shared<TeeFrame>();
+
+        // Leased from src when possible, otherwise copied once into a pooled buffer
+        {
+            PANGO_TRACE_SCOPE("TeeHub::Capture", "video");
+            frame->lease = pangolin::GrabNextLease(*src, true);
+        }
+
+        if(!frame->lease) {
+            std::this_thread::sleep_for(std::chrono::microseconds(tee_grab_fail_sleep_us));
+            continue;
+        }
+
+        frame->native_metadata = HasVideoFrameMetadata(src.get());
+        if(frame->native_metadata) {
+            frame->metadata = GetVideoFrameMetadata(src.get());
+        }else{
+            frame->frame_properties = GetVideoFrameProperties(src.get());
+        }
+
+        std::lock_guard<std::mutex> l(consumers_mutex);
+        for(TeeVideo* c : consumers) {
+            c->Push(frame);
+        }
+    }
+}
+
+TeeVideo::TeeVideo(const std::shared_ptr<TeeHub>& hub, size_t depth)
+    : VideoStageTimer("tee"), hub(hub), depth(std::max<size_t>(depth, 1)), started(false),
+      native_metadata(false), metadata_stale(false), properties_stale(false)
+{
+    if(!hub) {
+        throw VideoException("TeeVideo: TeeHub must not be null");
+    }
+    videoin.push_back(&hub->Source());
+    hub->Attach(this);
+}
+
+TeeVideo::~TeeVideo()
+{
+    Stop();
+    hub->Detach(this);
+}
+
+std::shared_ptr<TeeHub> TeeVideo::Hub() const
+{
+    return hub;
+}
+
+//! Implement VideoInput::Start()
+void TeeVideo::Start()
+{
+    {
+        std::lock_guard<std::mutex> l(queue_mutex);
+        if(started) return;
+        started = true;
+    }
+    hub->ConsumerStarted();
+}
+
+//! Implement VideoInput::Stop()
+void TeeVideo::Stop()
+{
+    {
+        std::lock_guard<std::mutex> l(queue_mutex);
+        if(!started) return;
+        started = false;
+        queue.clear();
+    }
+    hub->ConsumerStopped();
+}
+
+//! Implement VideoInput::SizeBytes()
+size_t TeeVideo::SizeBytes() const
+{
+    return videoin[0]->SizeBytes();
+}
+
+//! Implement VideoInput::Streams()
+const std::vector<StreamInfo>& TeeVideo::Streams() const
+{
+    return videoin[0]->Streams();
+}
+
+void TeeVideo::Push(const std::shared_ptr<TeeFrame>& frame)
+{
+    {
+        std::lock_guard<std::mutex> l(queue_mutex);
+        if(!started) return;
+        queue.push_back(frame);
+        if(queue.size() > depth) {
+            queue.pop_front();
+            StageOverwritten(1);
+        }
+    }
+    queue_cond.notify_all();
+}
+
+bool TeeVideo::WaitForFrame(std::unique_lock<std::mutex>& l, bool wait)
+{
+    if(queue.empty() && wait) {
+        if(!queue_cond.wait_for(l, std::chrono::milliseconds(tee_capture_timeout_ms), [this](){ return !queue.empty(); })) {
+            throw std::runtime_error("TeeVideo: GrabNext blocking read for frames reached timeout.");
+        }
+    }
+    return !queue.empty();
+}
+
+FrameLease TeeVideo::LeaseFrame(const std::shared_ptr<TeeFrame>& frame)
+{
+    native_metadata = frame->native_metadata;
+    if(native_metadata) {
+        metadata = frame->metadata;
+        properties_stale = true;
+    }else{
+        frame_properties = frame->frame_properties;
+        metadata_stale = true;
+    }
+
+    // The frame is shared with the other consumers, and held until all release it
+    return FrameLease(frame->lease.data(), frame->lease.SizeBytes(), [frame](){});
+}
+
+//! Implement VideoLeaseInterface::GrabNextLease()
+FrameLease TeeVideo::GrabNextLease( bool wait )
+{
+    PANGO_TRACE_SCOPE("TeeVideo::GrabNext", "video");
+    VideoStageTimer::Grab timing(*this);
+    std::shared_ptr<TeeFrame> frame;
+    {
+        std::unique_lock<std::mutex> l(queue_mutex);
+        StageQueueDepth(queue.size());
+        if(!WaitForFrame(l, wait)) {
+            return FrameLease();
+        }
+        frame = std::move(queue.front());
+        queue.pop_front();
+    }
+    FrameLease lease = LeaseFrame(frame);
+    timing.Frame(StageWait);
+    return lease;
+}
+
+//! Implement VideoLeaseInterface::GrabNewestLease()
+FrameLease TeeVideo::GrabNewestLease( bool wait )
+{
+    PANGO_TRACE_SCOPE("TeeVideo::GrabNewest", "video");
+    VideoStageTimer::Grab timing(*this);
+    std::shared_ptr<TeeFrame> frame;
+    {
+        std::unique_lock<std::mutex> l(queue_mutex);
+        StageQueueDepth(queue.size());
+        if(!WaitForFrame(l, wait)) {
+            return FrameLease();
+        }
+        frame = std::move(queue.back());
+        StageDropped(queue.size() - 1);
+        queue.clear();
+    }
+    FrameLease lease = LeaseFrame(frame);
+    timing.Frame(StageWait);
+    return lease;
+}
+
+//! Implement VideoInput::GrabNext()
+bool TeeVideo::GrabNext( unsigned char* image, bool wait )
+{
+    FrameLease lease = GrabNextLease(wait);
+    if(lease) {
+        const int64_t copy_start = StageNow();
+        FrameCopy(image, lease.data(), lease.SizeBytes());
+        StageAdd(StageCopy, copy_start);
+    }
+    return lease.IsValid();
+}
+
+//! Implement VideoInput::GrabNewest()
+bool TeeVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    FrameLease lease = GrabNewestLease(wait);
+    if(lease) {
+        const int64_t copy_start = StageNow();
+        FrameCopy(image, lease.data(), lease.SizeBytes());
+        StageAdd(StageCopy, copy_start);
+    }
+    return lease.IsValid();
+}
+
+const picojson::value& TeeVideo::DeviceProperties() const
+{
+    device_properties = GetVideoDeviceProperties(videoin[0]);
+    return device_properties;
+}
+
+const picojson::value& TeeVideo::FrameProperties() const
+{
+    if(properties_stale) {
+        frame_properties = picojson::value();
+        metadata.AddToJson(frame_properties);
+        properties_stale = false;
+    }
+    return frame_properties;
+}
+
+const FrameMetadata& TeeVideo::Metadata() const
+{
+    if(metadata_stale) {
+        metadata = FrameMetadata::FromJson(frame_properties);
+        metadata_stale = false;
+    }
+    return metadata;
+}
+
+bool TeeVideo::HasNativeMetadata() const
+{
+    return native_metadata;
+}
+
+uint32_t TeeVideo::AvailableFrames() const
+{
+    std::lock_guard<std::mutex> l(queue_mutex);
+    return (uint32_t)queue.size();
+}
+
+bool TeeVideo::DropNFrames(uint32_t n)
+{
+    std::lock_guard<std::mutex> l(queue_mutex);
+    if(n > queue.size()) {
+        return false;
+    }
+    queue.erase(queue.begin(), queue.begin() + n);
+    StageDropped(n);
+    return true;
+}
+
+std::vector<VideoInterface*>& TeeVideo::InputStreams()
+{
+    return videoin;
+}
+
+PANGOLIN_REGISTER_FACTORY(TeeVideo)
+{
+    struct TeeVideoFactory : public FactoryInterface<VideoInterface> {
+        std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
+            // Consumers of the same named hub share one capture of uri.url
+            const std::string name = uri.Get<std::string>("name", "");
+            const size_t depth = uri.Get<size_t>("depth", 2);
+
+            std::shared_ptr<TeeHub> hub;
+            if(!name.empty()) {
+                hub = TeeHub::Named(name);
+            }
+            if(!hub) {
+                if(uri.url.empty()) {
+                    throw VideoException("TeeVideo: No hub named '" + name + "' is open, and no video to open is given");
+                }
+                std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
+                hub = std::make_shared<TeeHub>(subvid);
+                if(!name.empty()) {
+                    TeeHub::SetNamed(name, hub);
+                }
+            }
+
+            return std::unique_ptr<VideoInterface>(hub->AddConsumer(depth));
+        }
+    };
+
+    FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<TeeVideoFactory>(), 10, "tee");
+}
+
+}
@@ -494,6 +494,11 @@ bool TeliVideo::GrabNext(unsigned char* image, bool /*wait*/)
 //! Implement VideoInput::GrabNewest()
 bool TeliVideo::GrabNewest(unsigned char* image, bool wait)
 {
+    // Skip queued frames rather than copying each of them out in turn
+    const uint32_t available = AvailableFrames();
+    if(available > 1) {
+        DropNFrames(available-1);
+    }
     return GrabNext(image,wait);
 }
 
@@ -27,29 +27,146 @@
 
 #include <pangolin/video/drivers/test.h>
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/timer.h>
 #include <pangolin/video/iostream_operators.h>
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
 namespace pangolin
 {
 
-void setRandomData(unsigned char * arr, size_t size){
-  for(size_t i = 0 ; i < size;i++) {
-//      arr[i] = (unsigned char)(i * 255.0 / size);
-      arr[i] = (unsigned char)(rand()/(RAND_MAX/255.0));
-  }
+namespace {
+
+// Stateless generator, so that any frame's content and jitter can be
+// reproduced from the seed and frame number alone.
+inline uint64_t SplitMix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+inline double UniformFromHash(uint64_t x)
+{
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool IsFloatFormat(const PixelFormat& fmt)
+{
+    return fmt.IsFloat();
+}
+
+// Pattern colour in [0,1] at (x,y) of a w x h image
+void PatternColour(TestPattern pattern, size_t x, size_t y, size_t w, size_t h, double rgb[3])
+{
+    if(pattern == TestPattern::Bars) {
+        // White, yellow, cyan, green, magenta, red, blue, black
+        static const int bars[8] = {7, 3, 6, 2, 5, 1, 4, 0};
+        const int bar = bars[std::min<size_t>(7, (x * 8) / w)];
+        rgb[0] = (bar & 1) ? 0.75 : 0.0;
+        rgb[1] = (bar & 2) ? 0.75 : 0.0;
+        rgb[2] = (bar & 4) ? 0.75 : 0.0;
+    }else{
+        const double t = double(x) / w + double(y) / h;
+        for(int c=0; c < 3; ++c) {
+            rgb[c] = std::fmod(t * 0.5 + c / 3.0, 1.0);
+        }
+    }
+}
+
+// Channel index (0 red, 1 green, 2 blue) of the bayer tile at (x,y)
+int BayerChannel(const std::string& tile, size_t x, size_t y)
+{
+    const char c = tile[(y % 2) * 2 + (x % 2)];
+    return c == 'R' ? 0 : (c == 'G' ? 1 : 2);
+}
+
+// Write channel values v in [0,1] for pixel x of a row in fmt
+void WritePixel(unsigned char* row, size_t x, const PixelFormat& fmt, const double* v)
+{
+    const size_t channels = fmt.channels;
+    const size_t bits = fmt.channel_bits[0];
+
+    if(IsFloatFormat(fmt)) {
+        for(size_t c=0; c < channels; ++c) {
+            if(bits == 64) {
+                reinterpret_cast<double*>(row)[x*channels + c] = v[c];
+            }else{
+                reinterpret_cast<float*>(row)[x*channels + c] = (float)v[c];
+            }
+        }
+    }else if(fmt.bpp == 8*channels) {
+        for(size_t c=0; c < channels; ++c) {
+            row[x*channels + c] = (unsigned char)(v[c] * 255.0 + 0.5);
+        }
+    }else if(fmt.bpp == 16*channels) {
+        for(size_t c=0; c < channels; ++c) {
+            reinterpret_cast<uint16_t*>(row)[x*channels + c] = (uint16_t)(v[c] * 65535.0 + 0.5);
+        }
+    }else if(channels == 1 && bits < 16) {
+        // Packed little endian bit stream, as read by the unpack filter
+        const uint32_t val = (uint32_t)(v[0] * ((1u << bits) - 1) + 0.5);
+        const size_t bit = x * bits;
+        for(size_t b=0; b < bits; ++b) {
+            unsigned char& byte = row[(bit + b) / 8];
+            const unsigned char mask = (unsigned char)(1u << ((bit + b) % 8));
+            byte = (val >> b) & 1 ? (byte | mask) : (byte & ~mask);
+        }
+    }else{
+        // e.g. YUYV422: luma in every other byte, neutral chroma in between
+        const size_t bytes = fmt.bpp / 8;
+        for(size_t b=0; b < bytes; ++b) {
+            row[x*bytes + b] = (b % 2) ? 128 : (unsigned char)(v[0] * 255.0 + 0.5);
+        }
+    }
+}
+
 }
 
 TestVideo::TestVideo(size_t w, size_t h, size_t n, std::string pix_fmt)
+    : TestVideo([&](){
+        const PixelFormat pfmt = PixelFormatFromString(pix_fmt);
+        const size_t pitch = (w*pfmt.bpp + 7)/8;
+        std::vector<StreamInfo> streams;
+        for(size_t c=0; c < n; ++c) {
+            streams.push_back(StreamInfo(pfmt, w, h, pitch, (unsigned char*)0 + c*pitch*h));
+        }
+        return streams;
+      }())
 {
-    const PixelFormat pfmt = PixelFormatFromString(pix_fmt);
-    
-    size_bytes = 0;
-    
-    for(size_t c=0; c < n; ++c) {
-        const StreamInfo stream_info(pfmt, w, h, (w*pfmt.bpp)/8, 0);
-        streams.push_back(stream_info);        
-        size_bytes += w*h*(pfmt.bpp)/8;
+}
+
+TestVideo::TestVideo(
+    const std::vector<StreamInfo>& streams, TestPattern pattern, const std::string& bayer,
+    double fps, double jitter_us, double latency_us, double offset_us, bool realtime, uint64_t seed)
+    : streams(streams), size_bytes(0), pattern(pattern), bayer(bayer),
+      period_us(fps > 0.0 ? 1E6 / fps : 0.0), jitter_us(jitter_us), latency_us(latency_us), offset_us(offset_us),
+      realtime(realtime), seed(seed), frame(0), properties_stale(false)
+{
+    if(!bayer.empty() && (bayer.size() != 4 || bayer.find_first_not_of("RGB") != std::string::npos)) {
+        throw VideoException("TestVideo: bayer tile must be 4 of R, G or B, e.g. RGGB");
     }
+
+    for(const StreamInfo& si : streams) {
+        size_bytes = std::max(size_bytes, (size_t)si.Offset() + si.SizeBytes());
+    }
+
+    templates.resize(streams.size());
+    if(pattern != TestPattern::Random) {
+        for(size_t s=0; s < streams.size(); ++s) {
+            RenderTemplate(s);
+        }
+    }
+
+    device_properties = picojson::value(picojson::object_type, false);
+    device_properties[PANGO_HAS_TIMING_DATA] = true;
+    if(fps > 0.0) device_properties["fps"] = fps;
+
+    start_us = Time_us(TimeNow());
 }
 
 TestVideo::~TestVideo()
@@ -57,10 +174,95 @@ TestVideo::~TestVideo()
     
 }
 
+void TestVideo::RenderTemplate(size_t s)
+{
+    const StreamInfo& si = streams[s];
+    const PixelFormat& fmt = si.PixFormat();
+    const size_t w = si.Width();
+    const size_t h = si.Height();
+    const bool mosaic = !bayer.empty() && fmt.channels == 1;
+
+    std::vector<unsigned char>& t = templates[s];
+    t.assign(2 * h * si.Pitch(), 0);
+
+    for(size_t y=0; y < 2*h; ++y) {
+        unsigned char* row = t.data() + y * si.Pitch();
+        for(size_t x=0; x < w; ++x) {
+            double rgb[3];
+            PatternColour(pattern, x, y % h, w, h, rgb);
+            if(fmt.IsBgr()) std::swap(rgb[0], rgb[2]);
+
+            double v[4];
+            if(mosaic) {
+                v[0] = rgb[BayerChannel(bayer, x, y)];
+            }else if(fmt.channels < 3) {
+                v[0] = 0.299*rgb[0] + 0.587*rgb[1] + 0.114*rgb[2];
+                v[1] = 1.0;
+            }else{
+                v[0] = rgb[0]; v[1] = rgb[1]; v[2] = rgb[2]; v[3] = 1.0;
+            }
+            WritePixel(row, x, fmt, v);
+        }
+    }
+}
+
+void TestVideo::RenderFrame(unsigned char* image)
+{
+    for(size_t s=0; s < streams.size(); ++s) {
+        const StreamInfo& si = streams[s];
+        Image<unsigned char> img = si.StreamImage(image);
+
+        if(pattern == TestPattern::Random) {
+            uint64_t state = SplitMix64(seed ^ SplitMix64(frame * streams.size() + s));
+            if(IsFloatFormat(si.PixFormat())) {
+                const size_t values = si.Width() * si.PixFormat().channels;
+                for(size_t y=0; y < img.h; ++y) {
+                    for(size_t i=0; i < values; ++i) {
+                        const double v = UniformFromHash(state = SplitMix64(state));
+                        if(si.PixFormat().channel_bits[0] == 64) {
+                            reinterpret_cast<double*>(img.RowPtr(y))[i] = v;
+                        }else{
+                            reinterpret_cast<float*>(img.RowPtr(y))[i] = (float)v;
+                        }
+                    }
+                }
+            }else{
+                for(size_t y=0; y < img.h; ++y) {
+                    unsigned char* row = img.RowPtr(y);
+                    for(size_t i=0; i < si.RowBytes(); i += 8) {
+                        const uint64_t r = state = SplitMix64(state);
+                        std::memcpy(row + i, &r, std::min<size_t>(8, si.RowBytes() - i));
+                    }
+                }
+            }
+        }else{
+            // Scroll by whole bayer tiles so that the mosaic keeps its phase
+            const size_t step = bayer.empty() ? 1 : 2;
+            const size_t rows = std::max<size_t>(step, img.h - img.h % step);
+            const size_t first = (frame * step) % rows;
+            for(size_t y=0; y < img.h; ++y) {
+                std::memcpy(img.RowPtr(y), templates[s].data() + (first + y) * si.Pitch(), si.RowBytes());
+            }
+        }
+    }
+}
+
+int64_t TestVideo::CaptureTime(uint64_t f) const
+{
+    return start_us + (int64_t)(offset_us + f * period_us);
+}
+
+int64_t TestVideo::ReceptionTime(uint64_t f) const
+{
+    const double jitter = jitter_us * UniformFromHash(SplitMix64(~seed ^ SplitMix64(f)));
+    return CaptureTime(f) + (int64_t)(latency_us + jitter);
+}
+
 //! Implement VideoInput::Start()
 void TestVideo::Start()
 {
-    
+    start_us = Time_us(TimeNow());
+    frame = 0;
 }
 
 //! Implement VideoInput::Stop()
@@ -82,15 +284,46 @@ const std::vector<StreamInfo>& TestVideo::Streams() const
 }
 
 //! Implement VideoInput::GrabNext()
-bool TestVideo::GrabNext( unsigned char* image, bool /*wait*/ )
+bool TestVideo::GrabNext( unsigned char* image, bool wait )
 {
-    setRandomData(image, size_bytes);
+    int64_t capture_us, reception_us;
+    if(period_us > 0.0) {
+        capture_us = CaptureTime(frame);
+        reception_us = ReceptionTime(frame);
+        if(realtime) {
+            const int64_t now_us = Time_us(TimeNow());
+            if(now_us < reception_us) {
+                if(!wait) return false;
+                std::this_thread::sleep_for(std::chrono::microseconds(reception_us - now_us));
+            }
+        }
+    }else{
+        capture_us = reception_us = Time_us(TimeNow());
+    }
+
+    RenderFrame(image);
+
+    metadata.Clear();
+    metadata.SetCaptureTime(capture_us);
+    metadata.SetEstimatedCenterCaptureTime(capture_us);
+    metadata.SetHostReceptionTime(reception_us);
+    metadata.SetFrameCounter((int64_t)frame);
+    properties_stale = true;
+    ++frame;
     return true;
 }
 
 //! Implement VideoInput::GrabNewest()
 bool TestVideo::GrabNewest( unsigned char* image, bool wait )
 {
+    if(period_us > 0.0 && realtime) {
+        // Skip the frames a camera would already have delivered
+        const int64_t now_us = Time_us(TimeNow());
+        const double elapsed_us = now_us - start_us - offset_us - latency_us;
+        uint64_t latest = elapsed_us > 0.0 ? (uint64_t)(elapsed_us / period_us) : 0;
+        while(latest > frame && ReceptionTime(latest) > now_us) --latest;
+        frame = std::max(frame, latest);
+    }
     return GrabNext(image,wait);
 }
 
@@ -101,7 +334,39 @@ PANGOLIN_REGISTER_FACTORY(TestVideo)
             const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(640,480));
             const int n = uri.Get<int>("n", 1);
             std::string fmt  = uri.Get<std::string>("fmt","RGB24");
-            return std::unique_ptr<VideoInterface>(new TestVideo(dim.x,dim.y,n,fmt));
+
+            // Streams one after another, each of which may override size and format
+            std::vector<StreamInfo> streams;
+            size_t offset = 0;
+            for(int i=0; i < n; ++i) {
+                const ImageDim sdim = uri.Get<ImageDim>(FormatString("size%", i+1), dim);
+                const PixelFormat pfmt = PixelFormatFromString(uri.Get<std::string>(FormatString("fmt%", i+1), fmt));
+                const size_t pitch = (sdim.x * pfmt.bpp + 7) / 8;
+                streams.push_back(StreamInfo(pfmt, sdim.x, sdim.y, pitch, (unsigned char*)0 + offset));
+                offset += pitch * sdim.y;
+            }
+
+            const std::string pattern_name = uri.Get<std::string>("pattern", "random");
+            TestPattern pattern;
+            if(pattern_name == "random") {
+                pattern = TestPattern::Random;
+            }else if(pattern_name == "gradient") {
+                pattern = TestPattern::Gradient;
+            }else if(pattern_name == "bars") {
+                pattern = TestPattern::Bars;
+            }else{
+                throw VideoException("TestVideo: unknown pattern '" + pattern_name + "', expected random, gradient or bars");
+            }
+
+            return std::unique_ptr<VideoInterface>(new TestVideo(
+                streams, pattern, uri.Get<std::string>("bayer", ""),
+                uri.Get<double>("fps", 0.0),
+                uri.Get<double>("jitter_us", 0.0),
+                uri.Get<double>("latency_us", 0.0),
+                uri.Get<double>("offset_us", 0.0),
+                uri.Get<bool>("realtime", true),
+                uri.Get<uint64_t>("seed", 0)
+            ));
         }
     };
 
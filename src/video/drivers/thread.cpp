@@ -26,6 +26,8 @@
  */
 
 #include <pangolin/factory/factory_registry.h>
+#include <pangolin/image/memcpy.h>
+#include <pangolin/utils/trace.h>
 #include <pangolin/video/drivers/thread.h>
 #include <pangolin/video/iostream_operators.h>
 
@@ -45,21 +47,27 @@ namespace pangolin
 
 const uint64_t grab_fail_thread_sleep_us = 1000;
 const uint64_t capture_timout_ms = 5000;
+const uint64_t free_buffer_wait_ms = 10;
 
-ThreadVideo::ThreadVideo(std::unique_ptr<VideoInterface> &src_, size_t num_buffers)
-    : src(std::move(src_)), quit_grab_thread(true)
+ThreadVideo::ThreadVideo(std::unique_ptr<VideoInterface> &src_, size_t num_buffers, const ThreadPlacement& placement_, bool pinned)
+    : VideoStageTimer("thread"), src(std::move(src_)), quit_grab_thread(true), buffer_pool(pinned), queue(num_buffers), placement(placement_),
+      native_metadata(false), metadata_stale(false), properties_stale(false)
 {
     if(!src) {
         throw VideoException("ThreadVideo: VideoInterface in must not be null");
     }
     videoin.push_back(src.get());
 
-//    // queue init allocates buffers.
-//    queue.init(num_buffers, (unsigned int)videoin[0]->SizeBytes());
-
-    for(size_t i=0; i < num_buffers; ++i)
-    {
-        queue.returnOrAddUsedBuffer( GrabResult(videoin[0]->SizeBytes()) );
+    if(placement.cpus.empty() && placement.numa_node < 0) {
+        AllocateBuffers(num_buffers);
+    }else{
+        // Rely on first-touch policy: allocate and touch the buffers from a
+        // thread pinned like the grab thread so pages land on its node.
+        std::thread t([&](){
+            ApplyThreadPlacement(this->placement);
+            AllocateBuffers(num_buffers);
+        });
+        t.join();
     }
 }
 
@@ -67,9 +75,34 @@ ThreadVideo::~ThreadVideo()
 {
     Stop();
 
+    for(unsigned char* buffer : locked_buffers) {
+        UnlockMemory(buffer, videoin[0]->SizeBytes());
+    }
+
     src.reset();
 }
 
+void ThreadVideo::AllocateBuffers(size_t num_buffers)
+{
+    const size_t size_bytes = videoin[0]->SizeBytes();
+
+    for(size_t i=0; i < num_buffers; ++i)
+    {
+        GrabResult grab(buffer_pool.Acquire(size_bytes));
+        if(!placement.IsDefault()) {
+            std::memset(grab.buffer.get(), 0, size_bytes);
+        }
+        if(placement.lock_memory && !buffer_pool.IsPinned()) {
+            if(LockMemory(grab.buffer.get(), size_bytes)) {
+                locked_buffers.push_back(grab.buffer.get());
+            }else{
+                pango_print_warn("ThreadVideo: Unable to lock frame buffer into memory (check RLIMIT_MEMLOCK).\n");
+            }
+        }
+        queue.returnOrAddUsedBuffer( std::move(grab) );
+    }
+}
+
 //! Implement VideoInput::Start()
 void ThreadVideo::Start()
 {
@@ -111,9 +144,27 @@ const picojson::value& ThreadVideo::DeviceProperties() const
 
 const picojson::value& ThreadVideo::FrameProperties() const
 {
+    if(properties_stale) {
+        metadata.AddToJson(frame_properties);
+        properties_stale = false;
+    }
     return frame_properties;
 }
 
+const FrameMetadata& ThreadVideo::Metadata() const
+{
+    if(metadata_stale) {
+        metadata = FrameMetadata::FromJson(frame_properties);
+        metadata_stale = false;
+    }
+    return metadata;
+}
+
+bool ThreadVideo::HasNativeMetadata() const
+{
+    return native_metadata;
+}
+
 uint32_t ThreadVideo::AvailableFrames() const
 {
     return (uint32_t)queue.AvailableFrames();
@@ -121,102 +172,174 @@ uint32_t ThreadVideo::AvailableFrames() const
 
 bool ThreadVideo::DropNFrames(uint32_t n)
 {
-    return queue.DropNFrames(n);
+    if(!queue.DropNFrames(n)) {
+        return false;
+    }
+    StageDropped(n);
+    return true;
 }
 
-//! Implement VideoInput::GrabNext()
-bool ThreadVideo::GrabNext( unsigned char* image, bool wait )
+bool ThreadVideo::WaitForFrame(bool wait)
 {
-    TSTART()
     if(queue.AvailableFrames() == 0 && !wait) {
         // No frames available, no wait, simply return false.
         DBGPRINT("GrabNext no available frames no wait.");
         return false;
-    }else{
-        if(queue.AvailableFrames() == 0 && wait) {
-            // Must return a frame so block on notification from grab thread.
-            std::unique_lock<std::mutex> lk(cvMtx);
-            DBGPRINT("GrabNext no available frames wait for notification.");
-            if(cv.wait_for(lk, std::chrono::milliseconds(capture_timout_ms)) == std::cv_status::timeout)
-                throw std::runtime_error("ThreadVideo: GrabNext blocking read for frames reached timeout.");
-        }
+    }
 
-        // At least one valid frame in queue, return it.
-        GrabResult grab = queue.getNext();
-        if(grab.return_status) {
-            DBGPRINT("GrabNext at least one frame available.");
-            std::memcpy(image, grab.buffer.get(), videoin[0]->SizeBytes());
-            frame_properties = grab.frame_properties;
-        }else{
-            DBGPRINT("GrabNext returned false")
-        }
+    if(queue.AvailableFrames() == 0 && wait) {
+        // Must return a frame so block on notification from grab thread.
+        DBGPRINT("GrabNext no available frames wait for notification.");
+        if(!queue.waitForValidBuffer(std::chrono::milliseconds(capture_timout_ms)))
+            throw std::runtime_error("ThreadVideo: GrabNext blocking read for frames reached timeout.");
+    }
+
+    return true;
+}
+
+FrameLease ThreadVideo::LeaseSlot(GrabResult&& grab)
+{
+    if(!grab.return_status) {
+        DBGPRINT("GrabNext returned false")
         queue.returnOrAddUsedBuffer(std::move(grab));
+        return FrameLease();
+    }
+
+    native_metadata = grab.native_metadata;
+    if(native_metadata) {
+        metadata = grab.metadata;
+        frame_properties = grab.frame_properties;
+        properties_stale = true;
+    }else{
+        frame_properties = grab.frame_properties;
+        metadata_stale = true;
+    }
+
+    // The slot stays out of the queue until the last reference to the lease is dropped.
+    std::shared_ptr<GrabResult> slot = std::make_shared<GrabResult>(std::move(grab));
+    return FrameLease(slot->buffer.get(), videoin[0]->SizeBytes(), [this,slot](){
+        queue.returnOrAddUsedBuffer(std::move(*slot));
+    });
+}
 
-        TGRABANDPRINT("GrabNext took")
-        return grab.return_status;
+//! Implement VideoLeaseInterface::GrabNextLease()
+FrameLease ThreadVideo::GrabNextLease( bool wait )
+{
+    PANGO_TRACE_SCOPE("ThreadVideo::GrabNext", "video");
+    VideoStageTimer::Grab timing(*this);
+    StageQueueDepth(queue.AvailableFrames());
+    if(!WaitForFrame(wait)) {
+        return FrameLease();
     }
+
+    // At least one valid frame in queue, return it.
+    GrabResult grab;
+    if(!queue.getNext(grab)) {
+        // Frame was taken by another consumer.
+        return FrameLease();
+    }
+    DBGPRINT("GrabNext at least one frame available.");
+    FrameLease lease = LeaseSlot(std::move(grab));
+    if(lease) timing.Frame(StageWait);
+    return lease;
+}
+
+//! Implement VideoLeaseInterface::GrabNewestLease()
+FrameLease ThreadVideo::GrabNewestLease( bool wait )
+{
+    PANGO_TRACE_SCOPE("ThreadVideo::GrabNewest", "video");
+    VideoStageTimer::Grab timing(*this);
+    StageQueueDepth(queue.AvailableFrames());
+    if(!WaitForFrame(wait)) {
+        return FrameLease();
+    }
+
+    // At least one valid frame in queue, return it.
+    GrabResult grab;
+    size_t dropped = 0;
+    const bool got = queue.getNewest(grab, &dropped);
+    StageDropped(dropped);
+    if(!got) {
+        // Frame was taken by another consumer.
+        return FrameLease();
+    }
+    DBGPRINT("GrabNewest at least one frame available.");
+    FrameLease lease = LeaseSlot(std::move(grab));
+    if(lease) timing.Frame(StageWait);
+    return lease;
+}
+
+//! Implement VideoInput::GrabNext()
+bool ThreadVideo::GrabNext( unsigned char* image, bool wait )
+{
+    TSTART()
+    FrameLease lease = GrabNextLease(wait);
+    if(lease) {
+        const int64_t copy_start = StageNow();
+        FrameCopy(image, lease.data(), lease.SizeBytes());
+        StageAdd(StageCopy, copy_start);
+    }
+    TGRABANDPRINT("GrabNext took")
+    return lease.IsValid();
 }
 
 //! Implement VideoInput::GrabNewest()
 bool ThreadVideo::GrabNewest( unsigned char* image, bool wait )
 {
     TSTART()
-    if(queue.AvailableFrames() == 0 && !wait) {
-        // No frames available, no wait, simply return false.
-        DBGPRINT("GrabNext no available frames no wait.");
-        return false;
-    }else{
-        if(queue.AvailableFrames() == 0 && wait) {
-            // Must return a frame so block on notification from grab thread.
-            std::unique_lock<std::mutex> lk(cvMtx);
-            DBGPRINT("GrabNewest no available frames wait for notification.");
-            if(cv.wait_for(lk, std::chrono::milliseconds(capture_timout_ms)) == std::cv_status::timeout)
-                throw std::runtime_error("ThreadVideo: GrabNext blocking read for frames reached timeout.");
-        }
-
-        // At least one valid frame in queue, return it.
-        DBGPRINT("GrabNewest at least one frame available.");
-        GrabResult grab = queue.getNewest();
-        const bool success = grab.return_status;
-        if(success) {
-            std::memcpy(image, grab.buffer.get(), videoin[0]->SizeBytes());
-            frame_properties = grab.frame_properties;
-        }
-        queue.returnOrAddUsedBuffer(std::move(grab));
-        TGRABANDPRINT("GrabNewest memcpy of available frame took")
-
-        return success;
+    FrameLease lease = GrabNewestLease(wait);
+    if(lease) {
+        const int64_t copy_start = StageNow();
+        FrameCopy(image, lease.data(), lease.SizeBytes());
+        StageAdd(StageCopy, copy_start);
     }
+    TGRABANDPRINT("GrabNewest memcpy of available frame took")
+    return lease.IsValid();
 }
 
 void ThreadVideo::operator()()
 {
     DBGPRINT("Grab thread Started.")
+    ApplyThreadPlacement(placement);
+    TraceSetThreadName("ThreadVideo");
+
     // Spinning thread attempting to read from videoin[0] as fast as possible
     // relying on the videoin[0] blocking grab.
     while(!quit_grab_thread) {
-        // Get a buffer from the queue;
-
-        if(queue.EmptyBuffers() > 0) {
-            GrabResult grab = queue.getFreeBuffer();
+        // Get a buffer from the queue, waiting for a consumer to release
+        // one if none are free.
+        GrabResult grab;
+        if(!queue.waitForFreeBuffer(grab, std::chrono::milliseconds(free_buffer_wait_ms))) {
+            continue;
+        }
 
-            // Blocking grab (i.e. GrabNext with wait = true).
+        // Blocking grab (i.e. GrabNext with wait = true).
+        {
+            PANGO_TRACE_SCOPE("ThreadVideo::Capture", "video");
             grab.return_status = videoin[0]->GrabNext(grab.buffer.get(), true);
+        }
 
-            if(grab.return_status){
-                grab.frame_properties = GetVideoFrameProperties(videoin[0]);
+        if(grab.return_status){
+            grab.native_metadata = HasVideoFrameMetadata(videoin[0]);
+            if(grab.native_metadata) {
+                grab.metadata = GetVideoFrameMetadata(videoin[0]);
+                grab.frame_properties = picojson::value();
             }else{
-                std::this_thread::sleep_for(std::chrono::microseconds(grab_fail_thread_sleep_us) );
+                grab.frame_properties = GetVideoFrameProperties(videoin[0]);
+            }
+            if(StageStatsEnabled()) {
+                // Timings of the stages behind the queue, for this frame
+                grab.frame_properties[PANGO_STAGE_TIMING] = VideoStageStatsJson(GetVideoStageStats(videoin[0], true));
             }
-            queue.addValidBuffer(std::move(grab));
-
-            DBGPRINT("Grab thread got frame. valid:%d free:%d",queue.AvailableFrames(),queue.EmptyBuffers())
-            // Let listening threads know we got a frame in case they are waiting.
-            cv.notify_all();
         }else{
             std::this_thread::sleep_for(std::chrono::microseconds(grab_fail_thread_sleep_us) );
         }
-        std::this_thread::yield();
+
+        // Publishing wakes any consumer waiting on a frame.
+        queue.addValidBuffer(std::move(grab));
+        TraceCounter("ThreadVideo queue", (int64_t)queue.AvailableFrames());
+
+        DBGPRINT("Grab thread got frame. valid:%d free:%d",queue.AvailableFrames(),queue.EmptyBuffers())
     }
     DBGPRINT("Grab thread Stopped.")
 
@@ -234,7 +357,15 @@ PANGOLIN_REGISTER_FACTORY(ThreadVideo)
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
             const int num_buffers = uri.Get<int>("num_buffers", 30);
-            return std::unique_ptr<VideoInterface>(new ThreadVideo(subvid, num_buffers));
+
+            ThreadPlacement placement;
+            placement.cpus = ParseCpuList(uri.Get<std::string>("cpu", ""));
+            placement.numa_node = uri.Get<int>("numa_node", -1);
+            placement.rt_priority = uri.Get<int>("rt_priority", 0);
+            placement.lock_memory = uri.Get<bool>("mlock", false);
+            const bool pinned = uri.Get<bool>("pinned", false);
+
+            return std::unique_ptr<VideoInterface>(new ThreadVideo(subvid, num_buffers, placement, pinned));
         }
     };
 
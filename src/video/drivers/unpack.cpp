@@ -28,6 +28,7 @@
 #include <pangolin/video/drivers/unpack.h>
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/iostream_operators.h>
+#include <pangolin/utils/parallel_for.h>
 
 #ifdef DEBUGUNPACK
   #include <pangolin/utils/timer.h>
@@ -40,11 +41,19 @@
   #define DBGPRINT(...)
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define UNPACK_HAVE_X86_DISPATCH
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define UNPACK_HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
 namespace pangolin
 {
 
-UnpackVideo::UnpackVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fmt)
-    : src(std::move(src_)), size_bytes(0), buffer(0)
+UnpackVideo::UnpackVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_fmt, size_t threads)
+    : VideoStageTimer("unpack"), src(std::move(src_)), size_bytes(0), threads(threads)
 {
     if( !src || out_fmt.channels != 1) {
         throw VideoException("UnpackVideo: Only supports single channel output.");
@@ -67,12 +76,11 @@ UnpackVideo::UnpackVideo(std::unique_ptr<VideoInterface> &src_, PixelFormat out_
         size_bytes += h*pitch;
     }
 
-    buffer = new unsigned char[src->SizeBytes()];
+    fused = std::unique_ptr<FusedRowFilter>(new FusedRowFilter(*this));
 }
 
 UnpackVideo::~UnpackVideo()
 {
-    delete[] buffer;
 }
 
 //! Implement VideoInput::Start()
@@ -99,60 +107,322 @@ const std::vector<StreamInfo>& UnpackVideo::Streams() const
     return streams;
 }
 
+namespace
+{
+
+enum UnpackSimdLevel
+{
+    UnpackSimdScalar,
+    UnpackSimdSSSE3,
+    UnpackSimdAVX2,
+    UnpackSimdNEON
+};
+
+UnpackSimdLevel DetectSimdLevel()
+{
+#if defined(UNPACK_HAVE_X86_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))  return UnpackSimdAVX2;
+    if(__builtin_cpu_supports("ssse3")) return UnpackSimdSSSE3;
+    return UnpackSimdScalar;
+#elif defined(UNPACK_HAVE_NEON)
+    return UnpackSimdNEON;
+#else
+    return UnpackSimdScalar;
+#endif
+}
+
+const UnpackSimdLevel simd_level = DetectSimdLevel();
+
+// Each vector kernel unpacks whole pixel groups from in and returns the number
+// of input bytes consumed. It never reads past in + in_bytes, leaving any tail
+// for the scalar path.
+
+#if defined(UNPACK_HAVE_X86_DISPATCH)
+
+__attribute__((target("ssse3")))
+size_t Unpack10bitSSSE3(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    // 2 groups of 5 bytes -> 8 pixels. Lane j of a group takes bytes j, j+1,
+    // then is shifted right by 2j using a multiply and fixed shift.
+    const __m128i shuf = _mm_setr_epi8(0,1,1,2,2,3,3,4, 5,6,6,7,7,8,8,9);
+    const __m128i mul  = _mm_setr_epi16(64,16,4,1, 64,16,4,1);
+    size_t i = 0;
+    for(; i + 16 <= in_bytes; i += 10, out += 8) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + i)), shuf);
+        v = _mm_srli_epi16(_mm_mullo_epi16(v, mul), 6);
+        _mm_storeu_si128((__m128i*)out, v);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t Unpack10bitAVX2(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    const __m256i shuf = _mm256_setr_epi8(0,1,1,2,2,3,3,4, 5,6,6,7,7,8,8,9, 0,1,1,2,2,3,3,4, 5,6,6,7,7,8,8,9);
+    const __m256i mul  = _mm256_setr_epi16(64,16,4,1, 64,16,4,1, 64,16,4,1, 64,16,4,1);
+    size_t i = 0;
+    for(; i + 26 <= in_bytes; i += 20, out += 16) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(in + i + 10));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        v = _mm256_srli_epi16(_mm256_mullo_epi16(v, mul), 6);
+        _mm256_storeu_si256((__m256i*)out, v);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+size_t Unpack12bitSSSE3(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    // 4 groups of 3 bytes -> 8 pixels. Even lanes take bytes 0,1 masked to
+    // 12 bits, odd lanes take bytes 1,2 shifted right by 4.
+    const __m128i shuf = _mm_setr_epi8(0,1,1,2, 3,4,4,5, 6,7,7,8, 9,10,10,11);
+    const __m128i even = _mm_setr_epi16(0x0FFF,0,0x0FFF,0,0x0FFF,0,0x0FFF,0);
+    const __m128i odd  = _mm_setr_epi16(0,-1,0,-1,0,-1,0,-1);
+    size_t i = 0;
+    for(; i + 16 <= in_bytes; i += 12, out += 8) {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + i)), shuf);
+        const __m128i r = _mm_or_si128(_mm_and_si128(v, even), _mm_and_si128(_mm_srli_epi16(v, 4), odd));
+        _mm_storeu_si128((__m128i*)out, r);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t Unpack12bitAVX2(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    const __m256i shuf = _mm256_setr_epi8(0,1,1,2, 3,4,4,5, 6,7,7,8, 9,10,10,11, 0,1,1,2, 3,4,4,5, 6,7,7,8, 9,10,10,11);
+    const __m256i even = _mm256_setr_epi16(0x0FFF,0,0x0FFF,0,0x0FFF,0,0x0FFF,0, 0x0FFF,0,0x0FFF,0,0x0FFF,0,0x0FFF,0);
+    const __m256i odd  = _mm256_setr_epi16(0,-1,0,-1,0,-1,0,-1, 0,-1,0,-1,0,-1,0,-1);
+    size_t i = 0;
+    for(; i + 28 <= in_bytes; i += 24, out += 16) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(in + i));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        const __m256i r = _mm256_or_si256(_mm256_and_si256(v, even), _mm256_and_si256(_mm256_srli_epi16(v, 4), odd));
+        _mm256_storeu_si256((__m256i*)out, r);
+    }
+    return i;
+}
+
+#endif // UNPACK_HAVE_X86_DISPATCH
+
+#if defined(UNPACK_HAVE_NEON)
+
+size_t Unpack10bitNEON(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    static const uint8_t shuf_bytes[16] = {0,1,1,2,2,3,3,4, 5,6,6,7,7,8,8,9};
+    static const uint16_t mul_vals[8] = {64,16,4,1, 64,16,4,1};
+    const uint8x16_t shuf = vld1q_u8(shuf_bytes);
+    const uint16x8_t mul = vld1q_u16(mul_vals);
+    size_t i = 0;
+    for(; i + 16 <= in_bytes; i += 10, out += 8) {
+        const uint16x8_t v = vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(in + i), shuf));
+        vst1q_u16(out, vshrq_n_u16(vmulq_u16(v, mul), 6));
+    }
+    return i;
+}
+
+size_t Unpack12bitNEON(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    static const uint8_t shuf_bytes[16] = {0,1,1,2, 3,4,4,5, 6,7,7,8, 9,10,10,11};
+    static const uint16_t even_vals[8] = {0xFFFF,0,0xFFFF,0,0xFFFF,0,0xFFFF,0};
+    const uint8x16_t shuf = vld1q_u8(shuf_bytes);
+    const uint16x8_t even = vld1q_u16(even_vals);
+    const uint16x8_t mask12 = vdupq_n_u16(0x0FFF);
+    size_t i = 0;
+    for(; i + 16 <= in_bytes; i += 12, out += 8) {
+        const uint16x8_t v = vreinterpretq_u16_u8(vqtbl1q_u8(vld1q_u8(in + i), shuf));
+        vst1q_u16(out, vbslq_u16(even, vandq_u16(v, mask12), vshrq_n_u16(v, 4)));
+    }
+    return i;
+}
+
+#endif // UNPACK_HAVE_NEON
+
+size_t Unpack10bitSimd(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    switch(simd_level) {
+#if defined(UNPACK_HAVE_X86_DISPATCH)
+    case UnpackSimdAVX2:  return Unpack10bitAVX2(out, in, in_bytes);
+    case UnpackSimdSSSE3: return Unpack10bitSSSE3(out, in, in_bytes);
+#elif defined(UNPACK_HAVE_NEON)
+    case UnpackSimdNEON:  return Unpack10bitNEON(out, in, in_bytes);
+#endif
+    default: return 0;
+    }
+}
+
+size_t Unpack12bitSimd(uint16_t* out, const uint8_t* in, size_t in_bytes)
+{
+    switch(simd_level) {
+#if defined(UNPACK_HAVE_X86_DISPATCH)
+    case UnpackSimdAVX2:  return Unpack12bitAVX2(out, in, in_bytes);
+    case UnpackSimdSSSE3: return Unpack12bitSSSE3(out, in, in_bytes);
+#elif defined(UNPACK_HAVE_NEON)
+    case UnpackSimdNEON:  return Unpack12bitNEON(out, in, in_bytes);
+#endif
+    default: return 0;
+    }
+}
+
 template<typename T>
-void ConvertFrom8bit(
+void ConvertFrom8bitRow(T* pout, const uint8_t* pin, const uint8_t* pin_end)
+{
+    while(pin != pin_end) {
+        *(pout++) = *(pin++);
+    }
+}
+
+template<typename T>
+void ConvertFrom10bitRowScalar(T* pout, const uint8_t* pin, const uint8_t* pin_end)
+{
+    while(pin != pin_end) {
+        uint64_t val = *(pin++);
+        val |= uint64_t(*(pin++)) << 8;
+        val |= uint64_t(*(pin++)) << 16;
+        val |= uint64_t(*(pin++)) << 24;
+        val |= uint64_t(*(pin++)) << 32;
+        *(pout++) = T( val & 0x00000003FF);
+        *(pout++) = T((val & 0x00000FFC00) >> 10);
+        *(pout++) = T((val & 0x003FF00000) >> 20);
+        *(pout++) = T((val & 0xFFC0000000) >> 30);
+    }
+}
+
+template<typename T>
+void ConvertFrom12bitRowScalar(T* pout, const uint8_t* pin, const uint8_t* pin_end)
+{
+    while(pin != pin_end) {
+        uint32_t val = *(pin++);
+        val |= uint32_t(*(pin++)) << 8;
+        val |= uint32_t(*(pin++)) << 16;
+        *(pout++) = T( val & 0x000FFF);
+        *(pout++) = T((val & 0xFFF000) >> 12);
+    }
+}
+
+typedef size_t (*UnpackSimdFn)(uint16_t*, const uint8_t*, size_t);
+
+// Vector path straight into the output row, scalar for the tail.
+template<size_t GroupBytes, size_t GroupPixels>
+void ConvertPackedRow(uint16_t* pout, const uint8_t* pin, const uint8_t* pin_end, UnpackSimdFn simd, void (*scalar)(uint16_t*, const uint8_t*, const uint8_t*))
+{
+    const size_t done = simd(pout, pin, pin_end - pin);
+    scalar(pout + (done / GroupBytes) * GroupPixels, pin + done, pin_end);
+}
+
+// Vector path to uint16 in cache sized chunks, then widen to the output type.
+template<size_t GroupBytes, size_t GroupPixels, typename T>
+void ConvertPackedRow(T* pout, const uint8_t* pin, const uint8_t* pin_end, UnpackSimdFn simd, void (*scalar)(T*, const uint8_t*, const uint8_t*))
+{
+    const size_t chunk_groups = 64;
+    uint16_t tmp[chunk_groups * GroupPixels];
+    while(size_t(pin_end - pin) >= chunk_groups * GroupBytes) {
+        const size_t done = simd(tmp, pin, chunk_groups * GroupBytes);
+        const size_t px = (done / GroupBytes) * GroupPixels;
+        for(size_t i=0; i < px; ++i) pout[i] = T(tmp[i]);
+        if(done == 0) break;
+        pout += px;
+        pin += done;
+    }
+    scalar(pout, pin, pin_end);
+}
+
+template<typename T>
+void ConvertFrom10bitRow(T* pout, const uint8_t* pin, const uint8_t* pin_end)
+{
+    if(simd_level == UnpackSimdScalar) {
+        ConvertFrom10bitRowScalar<T>(pout, pin, pin_end);
+    }else{
+        ConvertPackedRow<5,4>(pout, pin, pin_end, &Unpack10bitSimd, &ConvertFrom10bitRowScalar<T>);
+    }
+}
+
+template<typename T>
+void ConvertFrom12bitRow(T* pout, const uint8_t* pin, const uint8_t* pin_end)
+{
+    if(simd_level == UnpackSimdScalar) {
+        ConvertFrom12bitRowScalar<T>(pout, pin, pin_end);
+    }else{
+        ConvertPackedRow<3,2>(pout, pin, pin_end, &Unpack12bitSimd, &ConvertFrom12bitRowScalar<T>);
+    }
+}
+
+template<typename T>
+void ConvertRows(
     Image<unsigned char>& out,
-    const Image<unsigned char>& in
+    const Image<unsigned char>& in,
+    void (*convert_row)(T*, const uint8_t*, const uint8_t*),
+    size_t threads
 ) {
-    for(size_t r=0; r<out.h; ++r) {
-        T* pout = (T*)(out.ptr + r*out.pitch);
-        uint8_t* pin = in.ptr + r*in.pitch;
-        const uint8_t* pin_end = in.ptr + (r+1)*in.pitch;
-        while(pin != pin_end) {
-            *(pout++) = *(pin++);
+    ParallelFor(0, out.h, threads, [&](size_t r_begin, size_t r_end){
+        for(size_t r=r_begin; r<r_end; ++r) {
+            T* pout = (T*)(out.ptr + r*out.pitch);
+            const uint8_t* pin = in.ptr + r*in.pitch;
+            const uint8_t* pin_end = in.ptr + (r+1)*in.pitch;
+            convert_row(pout, pin, pin_end);
         }
-    }
+    });
+}
+
+}
+
+template<typename T>
+void ConvertFrom8bit(
+    Image<unsigned char>& out,
+    const Image<unsigned char>& in,
+    size_t threads = 1
+) {
+    ConvertRows<T>(out, in, &ConvertFrom8bitRow<T>, threads);
 }
 
 template<typename T>
 void ConvertFrom10bit(
     Image<unsigned char>& out,
-    const Image<unsigned char>& in
+    const Image<unsigned char>& in,
+    size_t threads = 1
 ) {
-    for(size_t r=0; r<out.h; ++r) {
-        T* pout = (T*)(out.ptr + r*out.pitch);
-        uint8_t* pin = in.ptr + r*in.pitch;
-        const uint8_t* pin_end = in.ptr + (r+1)*in.pitch;
-        while(pin != pin_end) {
-            uint64_t val = *(pin++);
-            val |= uint64_t(*(pin++)) << 8;
-            val |= uint64_t(*(pin++)) << 16;
-            val |= uint64_t(*(pin++)) << 24;
-            val |= uint64_t(*(pin++)) << 32;
-            *(pout++) = T( val & 0x00000003FF);
-            *(pout++) = T((val & 0x00000FFC00) >> 10);
-            *(pout++) = T((val & 0x003FF00000) >> 20);
-            *(pout++) = T((val & 0xFFC0000000) >> 30);
-        }
-    }
+    ConvertRows<T>(out, in, &ConvertFrom10bitRow<T>, threads);
 }
 
 template<typename T>
 void ConvertFrom12bit(
     Image<unsigned char>& out,
-    const Image<unsigned char>& in
+    const Image<unsigned char>& in,
+    size_t threads = 1
 ) {
-    for(size_t r=0; r<out.h; ++r) {
-        T* pout = (T*)(out.ptr + r*out.pitch);
-        uint8_t* pin = in.ptr + r*in.pitch;
-        const uint8_t* pin_end = in.ptr + (r+1)*in.pitch;
-        while(pin != pin_end) {
-            uint32_t val = *(pin++);
-            val |= uint32_t(*(pin++)) << 8;
-            val |= uint32_t(*(pin++)) << 16;
-            *(pout++) = T( val & 0x000FFF);
-            *(pout++) = T((val & 0xFFF000) >> 12);
+    ConvertRows<T>(out, in, &ConvertFrom12bitRow<T>, threads);
+}
+
+void UnpackVideo::ProcessStream(size_t s, Image<unsigned char>& img_out, const Image<unsigned char>& img_in, size_t threads)
+{
+    const int bits_in  = videoin[0]->Streams()[s].PixFormat().bpp;
+
+    if(Streams()[s].PixFormat().id == PixelFormatId::GRAY32F) {
+        if( bits_in == 8) {
+            ConvertFrom8bit<float>(img_out, img_in, threads);
+        }else if( bits_in == 10) {
+            ConvertFrom10bit<float>(img_out, img_in, threads);
+        }else if( bits_in == 12){
+            ConvertFrom12bit<float>(img_out, img_in, threads);
+        }else{
+            throw pangolin::VideoException("Unsupported bitdepths.");
+        }
+    }else if(Streams()[s].PixFormat().id == PixelFormatId::GRAY16LE) {
+        if( bits_in == 8) {
+            ConvertFrom8bit<uint16_t>(img_out, img_in, threads);
+        }else if( bits_in == 10) {
+            ConvertFrom10bit<uint16_t>(img_out, img_in, threads);
+        }else if( bits_in == 12){
+            ConvertFrom12bit<uint16_t>(img_out, img_in, threads);
+        }else{
+            throw pangolin::VideoException("Unsupported bitdepths.");
         }
+    }else{
     }
 }
 
@@ -162,40 +432,43 @@ void UnpackVideo::Process(unsigned char* image, const unsigned char* buffer)
     for(size_t s=0; s<streams.size(); ++s) {
         const Image<unsigned char> img_in  = videoin[0]->Streams()[s].StreamImage(buffer);
         Image<unsigned char> img_out = Streams()[s].StreamImage(image);
-
-        const int bits_in  = videoin[0]->Streams()[s].PixFormat().bpp;
-
-        if(Streams()[s].PixFormat().format == "GRAY32F") {
-            if( bits_in == 8) {
-                ConvertFrom8bit<float>(img_out, img_in);
-            }else if( bits_in == 10) {
-                ConvertFrom10bit<float>(img_out, img_in);
-            }else if( bits_in == 12){
-                ConvertFrom12bit<float>(img_out, img_in);
-            }else{
-                throw pangolin::VideoException("Unsupported bitdepths.");
-            }
-        }else if(Streams()[s].PixFormat().format == "GRAY16LE") {
-            if( bits_in == 8) {
-                ConvertFrom8bit<uint16_t>(img_out, img_in);
-            }else if( bits_in == 10) {
-                ConvertFrom10bit<uint16_t>(img_out, img_in);
-            }else if( bits_in == 12){
-                ConvertFrom12bit<uint16_t>(img_out, img_in);
-            }else{
-                throw pangolin::VideoException("Unsupported bitdepths.");
-            }
-        }else{
-        }
+        ProcessStream(s, img_out, img_in, threads);
     }
     TGRABANDPRINT("Unpacking took ")
 }
 
+//! Implement VideoRowFilterInterface::RowFilterInputRow()
+size_t UnpackVideo::RowFilterInputRow(size_t /*stream*/, size_t y) const
+{
+    return y;
+}
+
+//! Implement VideoRowFilterInterface::RowFilterProcess()
+void UnpackVideo::RowFilterProcess(size_t stream, unsigned char* out_row, const unsigned char* in_row)
+{
+    const StreamInfo& si_in = videoin[0]->Streams()[stream];
+    const StreamInfo& si_out = Streams()[stream];
+    const Image<unsigned char> img_in(si_in.Width(), 1, si_in.Pitch(), (unsigned char*)in_row);
+    Image<unsigned char> img_out(si_out.Width(), 1, si_out.Pitch(), out_row);
+    ProcessStream(stream, img_out, img_in, 1);
+}
+
 //! Implement VideoInput::GrabNext()
 bool UnpackVideo::GrabNext( unsigned char* image, bool wait )
 {    
-    if(videoin[0]->GrabNext(buffer,wait)) {
-        Process(image,buffer);
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNext(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNextLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image,in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -205,8 +478,19 @@ bool UnpackVideo::GrabNext( unsigned char* image, bool wait )
 //! Implement VideoInput::GrabNewest()
 bool UnpackVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    if(videoin[0]->GrabNewest(buffer,wait)) {
-        Process(image,buffer);
+    VideoStageTimer::Grab timing(*this);
+    if(fused->IsFused()) {
+        // Fused filters grab their input row by row along with processing
+        const bool ok = fused->GrabNewest(image, wait);
+        if(ok) timing.Frame(StageProcess);
+        return ok;
+    }
+
+    const FrameLease in = GrabNewestLease(*videoin[0], wait);
+    timing.Mark(StageWait);
+    if(in) {
+        Process(image,in.data());
+        timing.Frame(StageProcess);
         return true;
     }else{
         return false;
@@ -252,8 +536,9 @@ PANGOLIN_REGISTER_FACTORY(UnpackVideo)
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             std::unique_ptr<VideoInterface> subvid = pangolin::OpenVideo(uri.url);
             const std::string fmt = uri.Get("fmt", std::string("GRAY16LE") );
+            const size_t threads = uri.Get<size_t>("threads", 1);
             return std::unique_ptr<VideoInterface>(
-                new UnpackVideo(subvid, PixelFormatFromString(fmt) )
+                new UnpackVideo(subvid, PixelFormatFromString(fmt), threads )
             );
         }
     };
@@ -28,17 +28,25 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/drivers/uvc.h>
 #include <pangolin/video/iostream_operators.h>
+#include <pangolin/image/image_io.h>
+#include <pangolin/utils/memstreambuf.h>
 
 namespace pangolin
 {
 
-UvcVideo::UvcVideo(int vendor_id, int product_id, const char* sn, int device_id, int width, int height, int fps)
-    : ctx_(NULL),
+UvcVideo::UvcVideo(int vendor_id, int product_id, const char* sn, int device_id, int width, int height, int fps,
+                   const UvcOptions& options)
+    : size_bytes(0),
+      options(options),
+      decode_mjpeg(false),
+      ctx_(NULL),
       dev_(NULL),
       devh_(NULL),
-      frame_(NULL),
-      is_streaming(false)
+      is_streaming(false),
+      quit_decode(false)
 {
+    this->options.queue_frames = std::max<size_t>(1, options.queue_frames);
+
     uvc_init(&ctx_, NULL);
     if(!ctx_) {
         throw VideoException("Unable to open UVC Context");
@@ -165,23 +173,33 @@ void UvcVideo::InitDevice(int vid, int pid, const char* sn, int device_id, int w
         throw VideoException("Unable to open device stream.");
     }
 
+    // Fewer bytes per packet lets libuvc pick a lower bandwidth alternate
+    // setting, so more cameras can share one controller.
+    if(options.max_payload_bytes && options.max_payload_bytes < ctrl_.dwMaxPayloadTransferSize) {
+        ctrl_.dwMaxPayloadTransferSize = options.max_payload_bytes;
+    }
+
     // Default to greyscale.
     PixelFormat pfmt = PixelFormatFromString("GRAY8");
 
     const uvc_format_desc_t* uvc_fmt = uvc_get_format_descs(devh_);
-    while( uvc_fmt->bFormatIndex != ctrl_.bFormatIndex && uvc_fmt ) {
+    while( uvc_fmt && uvc_fmt->bFormatIndex != ctrl_.bFormatIndex ) {
         uvc_fmt = uvc_fmt->next;
     }
 
     if(uvc_fmt) {
         // TODO: Use uvc_fmt->fourccFormat
-        if( uvc_fmt->bBitsPerPixel == 16 ) {
+        if( uvc_fmt->bDescriptorSubtype == UVC_VS_FORMAT_MJPEG ) {
+            pfmt = PixelFormatFromString("RGB24");
+            decode_mjpeg = true;
+        }else if( uvc_fmt->bBitsPerPixel == 16 ) {
             pfmt = PixelFormatFromString("GRAY16LE");
         }
     }
     
     const StreamInfo stream_info(pfmt, width, height, (width*pfmt.bpp)/8, 0);
     streams.push_back(stream_info);
+    size_bytes = decode_mjpeg ? stream_info.SizeBytes() : ctrl_.dwMaxVideoFrameSize;
 }
 
 void UvcVideo::InitPangoDeviceProperties()
@@ -195,36 +213,27 @@ void UvcVideo::InitPangoDeviceProperties()
 void UvcVideo::DeinitDevice()
 {
     Stop();
-    
-    if (frame_) {
-        uvc_free_frame(frame_);
-        frame_ = 0;
-    }
 }
 
 void UvcVideo::Start()
 {
     if(!is_streaming) {
-        uvc_error_t stream_err = uvc_stream_start(strm_, NULL, this, 0);
+        if(decode_mjpeg) {
+            quit_decode = false;
+            decode_thread = std::thread(&UvcVideo::DecodeLoop, this);
+        }
+
+        uvc_error_t stream_err = uvc_stream_start(strm_, &UvcVideo::FrameCallback, this, 0);
 
         if (stream_err != UVC_SUCCESS) {
             uvc_perror(stream_err, "uvc_stream_start");
+            Stop();
             uvc_close(devh_);
             uvc_unref_device(dev_);
             throw VideoException("Unable to start streaming.");
         }else{
             is_streaming = true;
         }
-
-        if (frame_) {
-            uvc_free_frame(frame_);
-        }
-
-        size_bytes = ctrl_.dwMaxVideoFrameSize;
-        frame_ = uvc_allocate_frame(size_bytes);
-        if(!frame_) {
-            throw VideoException("Unable to allocate frame.");
-        }
     }
 }
 
@@ -234,6 +243,88 @@ void UvcVideo::Stop()
         uvc_stop_streaming(devh_);
     }
     is_streaming = false;
+
+    if(decode_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            quit_decode = true;
+        }
+        queue_cond.notify_all();
+        decode_thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    compressed.clear();
+    ready.clear();
+}
+
+// Called on libuvc's transfer thread once per completed frame. libuvc reuses
+// its frame buffer, so the frame is copied out into a pooled buffer here.
+void UvcVideo::FrameCallback(uvc_frame_t* frame, void* user_ptr)
+{
+    UvcVideo* self = static_cast<UvcVideo*>(user_ptr);
+    if(!frame || !frame->data || !frame->data_bytes) {
+        return;
+    }
+
+    const size_t max_bytes = self->ctrl_.dwMaxVideoFrameSize;
+    const size_t bytes = std::min<size_t>(frame->data_bytes, max_bytes);
+
+    QueuedFrame queued;
+    queued.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(std::max(max_bytes, self->size_bytes)));
+    queued.size_bytes = bytes;
+    // This is a hack, this ts sould come from the device.
+    queued.host_reception_time_us = pangolin::Time_us(pangolin::TimeNow());
+    std::memcpy(queued.buffer->get(), frame->data, bytes);
+
+    std::lock_guard<std::mutex> lock(self->queue_mutex);
+    self->Push(self->decode_mjpeg ? self->compressed : self->ready, std::move(queued));
+    self->queue_cond.notify_all();
+}
+
+void UvcVideo::Push(std::deque<QueuedFrame>& queue, QueuedFrame&& frame)
+{
+    while(queue.size() >= options.queue_frames) {
+        queue.pop_front();
+    }
+    queue.push_back(std::move(frame));
+}
+
+void UvcVideo::DecodeLoop()
+{
+    const StreamInfo& si = streams[0];
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while(true) {
+        queue_cond.wait(lock, [this](){ return quit_decode || !compressed.empty(); });
+        if(quit_decode) break;
+
+        QueuedFrame in = std::move(compressed.front());
+        compressed.pop_front();
+        lock.unlock();
+
+        QueuedFrame out;
+        out.buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+        out.size_bytes = size_bytes;
+        out.host_reception_time_us = in.host_reception_time_us;
+
+        bool decoded = true;
+        try {
+            memreadbuf sb(in.buffer->get(), in.size_bytes);
+            std::istream is(&sb);
+            LoadImageInto(is, ImageFileTypeJpg, si.StreamImage(out.buffer->get()), si.PixFormat());
+        }catch(const std::exception& e) {
+            pango_print_warn("UvcVideo: Unable to decode MJPEG frame (%s).\n", e.what());
+            decoded = false;
+        }
+        in.buffer.reset();
+
+        lock.lock();
+        if(decoded) {
+            Push(ready, std::move(out));
+            queue_cond.notify_all();
+        }
+    }
 }
 
 size_t UvcVideo::SizeBytes() const
@@ -246,32 +337,77 @@ const std::vector<StreamInfo>& UvcVideo::Streams() const
     return streams;
 }
 
-bool UvcVideo::GrabNext( unsigned char* image, bool wait )
+bool UvcVideo::WaitForFrame(std::unique_lock<std::mutex>& lock, bool wait)
 {
-    uvc_frame_t* frame = NULL;
-    uvc_error_t err = uvc_stream_get_frame(strm_, &frame, wait ? 0 : -1);
-    
-    if(err!= UVC_SUCCESS) {
-        pango_print_error("UvcVideo Error: %s", uvc_strerror(err) );
-        return false;
-    }else{
-        if(frame) {
-            memcpy(image, frame->data, frame->data_bytes );
-            // This is a hack, this ts sould come from the device.
-            frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(pangolin::Time_us(pangolin::TimeNow()));
-            return true;
-        }else{
-            if(wait) {
-                pango_print_debug("UvcVideo: No frame data");
-            }
-            return false;
+    if(wait && ready.empty()) {
+        queue_cond.wait_for(lock, std::chrono::seconds(1), [this](){ return !ready.empty(); });
+    }
+    return !ready.empty();
+}
+
+FrameLease UvcVideo::PopFront()
+{
+    QueuedFrame frame = std::move(ready.front());
+    ready.pop_front();
+    frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(frame.host_reception_time_us);
+    std::shared_ptr<FramePool::Buffer> buffer = frame.buffer;
+    return FrameLease(buffer->get(), frame.size_bytes, [buffer](){});
+}
+
+FrameLease UvcVideo::GrabNextLease( bool wait )
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if(!WaitForFrame(lock, wait)) {
+        if(wait) {
+            pango_print_debug("UvcVideo: No frame data");
         }
+        return FrameLease();
+    }
+    return PopFront();
+}
+
+FrameLease UvcVideo::GrabNewestLease( bool wait )
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if(!WaitForFrame(lock, wait)) {
+        return FrameLease();
+    }
+    while(ready.size() > 1) {
+        ready.pop_front();
+    }
+    return PopFront();
+}
+
+bool UvcVideo::GrabNext( unsigned char* image, bool wait )
+{
+    const FrameLease lease = GrabNextLease(wait);
+    if(lease) {
+        std::memcpy(image, lease.data(), lease.SizeBytes());
     }
+    return lease.IsValid();
 }
 
 bool UvcVideo::GrabNewest( unsigned char* image, bool wait )
 {
-    return GrabNext(image, wait);
+    const FrameLease lease = GrabNewestLease(wait);
+    if(lease) {
+        std::memcpy(image, lease.data(), lease.SizeBytes());
+    }
+    return lease.IsValid();
+}
+
+uint32_t UvcVideo::AvailableFrames() const
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return (uint32_t)ready.size();
+}
+
+bool UvcVideo::DropNFrames(uint32_t n)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if(n > ready.size()) return false;
+    ready.erase(ready.begin(), ready.begin() + n);
+    return true;
 }
 
 int UvcVideo::IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, UvcRequestCode req_code)
@@ -306,7 +442,10 @@ PANGOLIN_REGISTER_FACTORY(UvcVideo)
             const unsigned int dev_id = uri.Get<int>("num",0);
             const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(640,480));
             const unsigned int fps = uri.Get<unsigned int>("fps", 0); // 0 means unspecified.
-            return std::unique_ptr<VideoInterface>( new UvcVideo(vid,pid,0,dev_id,dim.x,dim.y,fps) );
+            UvcOptions options;
+            options.queue_frames = uri.Get<size_t>("queue", options.queue_frames);
+            options.max_payload_bytes = uri.Get<uint32_t>("payload", options.max_payload_bytes);
+            return std::unique_ptr<VideoInterface>( new UvcVideo(vid,pid,0,dev_id,dim.x,dim.y,fps,options) );
         }
     };
 
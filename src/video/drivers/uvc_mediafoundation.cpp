@@ -7,6 +7,9 @@
 #include <mfidl.h>
 #include <mfreadwrite.h>
 
+#include <d3d10.h>
+#include <d3d11.h>
+
 #include <dshow.h>
 #include <ks.h>
 #include <ksmedia.h>
@@ -16,6 +19,7 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/utils/timer.h>
 #include <pangolin/video/drivers/uvc_mediafoundation.h>
+#include <pangolin/video/frame_pool.h>
 #include <pangolin/video/iostream_operators.h>
 
 namespace pangolin
@@ -26,13 +30,89 @@ static constexpr DWORD KS_CONTROL_NODE_ID_INVALID = ~0;
 const GUID GUID_EXTENSION_UNIT_DESCRIPTOR_OV580{
         0x2ccb0bda, 0x6331, 0x4fdb, 0x85, 0x0e, 0x79, 0x05, 0x4d, 0xbd, 0x56, 0x71};
 
-UvcMediaFoundationVideo::UvcMediaFoundationVideo(int vendorId, int productId, int deviceId, size_t width, size_t height, int fps)
+// Receives the results of asynchronous ReadSample calls on Media Foundation
+// work queue threads and hands them to the video. Owned by the source reader
+// through COM reference counting.
+class UvcMediaFoundationVideo::ReaderCallback : public IMFSourceReaderCallback
+{
+  public:
+    ReaderCallback(UvcMediaFoundationVideo* video)
+        : refs(1), video(video)
+    {
+    }
+
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppv) override
+    {
+        if(!ppv)
+        {
+            return E_POINTER;
+        }
+        if(iid == __uuidof(IUnknown) || iid == __uuidof(IMFSourceReaderCallback))
+        {
+            *ppv = static_cast<IMFSourceReaderCallback*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef() override
+    {
+        return InterlockedIncrement(&refs);
+    }
+
+    STDMETHODIMP_(ULONG) Release() override
+    {
+        const ULONG count = InterlockedDecrement(&refs);
+        if(count == 0)
+        {
+            delete this;
+        }
+        return count;
+    }
+
+    STDMETHODIMP OnReadSample(HRESULT status, DWORD /*streamIndex*/, DWORD flags, LONGLONG /*timeStamp*/, IMFSample* sample) override
+    {
+        video->OnSample(status, flags, sample);
+        return S_OK;
+    }
+
+    STDMETHODIMP OnFlush(DWORD /*streamIndex*/) override
+    {
+        video->OnFlushed();
+        return S_OK;
+    }
+
+    STDMETHODIMP OnEvent(DWORD /*streamIndex*/, IMFMediaEvent* /*event*/) override
+    {
+        return S_OK;
+    }
+
+  private:
+    virtual ~ReaderCallback() {}
+
+    volatile ULONG refs;
+    UvcMediaFoundationVideo* video;
+};
+
+UvcMediaFoundationVideo::UvcMediaFoundationVideo(int vendorId, int productId, int deviceId, size_t width, size_t height, int fps,
+                                                 const UvcMediaFoundationOptions& options)
     : size_bytes(0),
+      options(options),
       mediaSource(nullptr),
       sourceReader(nullptr),
+      readerCallback(nullptr),
+      d3dDevice(nullptr),
+      dxgiManager(nullptr),
       baseFilter(nullptr),
       ksControl(nullptr),
-      ksControlNodeId(KS_CONTROL_NODE_ID_INVALID)
+      ksControlNodeId(KS_CONTROL_NODE_ID_INVALID),
+      streaming(false),
+      read_pending(false),
+      flushing(false),
+      end_of_stream(false),
+      frame_counter(0)
 {
     if(FAILED(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED)))
     {
@@ -51,10 +131,13 @@ UvcMediaFoundationVideo::UvcMediaFoundationVideo(int vendorId, int productId, in
     InitDevice(width, height, fps);
 
     device_properties[PANGO_HAS_TIMING_DATA] = true;
+
+    Start();
 }
 
 UvcMediaFoundationVideo::~UvcMediaFoundationVideo()
 {
+    Stop();
     DeinitDevice();
     HRESULT hr = MFShutdown();
     if(FAILED(hr))
@@ -66,11 +149,55 @@ UvcMediaFoundationVideo::~UvcMediaFoundationVideo()
 
 void UvcMediaFoundationVideo::Start()
 {
+    if(!options.async || !sourceReader)
+    {
+        return;
+    }
 
+    std::lock_guard<std::mutex> l(queue_mutex);
+    if(streaming)
+    {
+        return;
+    }
+    streaming = true;
+    end_of_stream = false;
+    if(!read_pending)
+    {
+        RequestSample();
+    }
 }
 
 void UvcMediaFoundationVideo::Stop()
 {
+    if(!options.async || !sourceReader)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(queue_mutex);
+    if(!streaming)
+    {
+        return;
+    }
+    streaming = false;
+
+    if(read_pending)
+    {
+        // Cancel the outstanding read. Callbacks take queue_mutex, so it is
+        // released while the reader flushes.
+        flushing = true;
+        l.unlock();
+        const HRESULT hr = sourceReader->Flush(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+        l.lock();
+        if(SUCCEEDED(hr))
+        {
+            queue_cond.wait(l, [this]() { return !flushing; });
+        }
+        flushing = false;
+        read_pending = false;
+    }
+
+    queue_cond.notify_all();
 }
 
 size_t UvcMediaFoundationVideo::SizeBytes() const
@@ -83,33 +210,121 @@ const std::vector<pangolin::StreamInfo>& UvcMediaFoundationVideo::Streams() cons
     return streams;
 }
 
-bool UvcMediaFoundationVideo::GrabNext(unsigned char* image, bool wait)
+void UvcMediaFoundationVideo::RequestSample()
 {
-    IMFSample* sample = nullptr;
-    DWORD streamIndex = 0;
-    DWORD flags = 0;
-    LONGLONG timeStamp;
-
-    HRESULT hr = sourceReader->ReadSample(
-            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timeStamp, &sample);
+    // queue_mutex is held
+    const HRESULT hr = sourceReader->ReadSample(
+            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, nullptr, nullptr, nullptr, nullptr);
     if(SUCCEEDED(hr))
     {
-        if((flags & MF_SOURCE_READERF_ENDOFSTREAM) != 0)
+        read_pending = true;
+    }
+    else
+    {
+        pango_print_error("UVC ReadSample failed with result %X", hr);
+        end_of_stream = true;
+        queue_cond.notify_all();
+    }
+}
+
+void UvcMediaFoundationVideo::OnSample(HRESULT status, DWORD flags, IMFSample* sample)
+{
+    const int64_t host_time_us = pangolin::Time_us(pangolin::TimeNow());
+
+    std::lock_guard<std::mutex> l(queue_mutex);
+    read_pending = false;
+
+    if(FAILED(status) || (flags & (MF_SOURCE_READERF_ENDOFSTREAM | MF_SOURCE_READERF_ERROR)) != 0)
+    {
+        if(FAILED(status))
         {
-            return false;
+            pango_print_error("UVC asynchronous read failed with result %X", status);
         }
+        end_of_stream = true;
+        queue_cond.notify_all();
+        return;
+    }
 
-        if(!sample)
+    // No sample accompanies stream ticks (gaps in the stream)
+    if(sample)
+    {
+        if(queue.size() >= options.queue)
         {
+            // Nobody is keeping up, so keep the newest frames
+            queue.front().sample->Release();
+            queue.pop_front();
+        }
+        sample->AddRef();
+        queue.push_back(QueuedSample{sample, host_time_us, frame_counter++});
+        queue_cond.notify_one();
+    }
+
+    if(streaming && !flushing)
+    {
+        RequestSample();
+    }
+}
+
+void UvcMediaFoundationVideo::OnFlushed()
+{
+    std::lock_guard<std::mutex> l(queue_mutex);
+    flushing = false;
+    queue_cond.notify_all();
+}
+
+bool UvcMediaFoundationVideo::NextSample(QueuedSample& next, bool newest, bool wait)
+{
+    if(!options.async)
+    {
+        IMFSample* sample = nullptr;
+        DWORD streamIndex = 0;
+        DWORD flags = 0;
+        LONGLONG timeStamp;
+
+        const HRESULT hr = sourceReader->ReadSample(
+                (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timeStamp, &sample);
+        if(FAILED(hr) || (flags & MF_SOURCE_READERF_ENDOFSTREAM) != 0 || !sample)
+        {
+            if(sample)
+            {
+                sample->Release();
+            }
             return false;
         }
+
+        next = QueuedSample{sample, pangolin::Time_us(pangolin::TimeNow()), frame_counter++};
+        return true;
     }
 
-    IMFMediaBuffer* mediaBuffer = nullptr;
-    if(SUCCEEDED(hr))
+    std::unique_lock<std::mutex> l(queue_mutex);
+    if(wait)
     {
-        hr = sample->ConvertToContiguousBuffer(&mediaBuffer);
+        queue_cond.wait(l, [this]() { return !queue.empty() || !streaming || end_of_stream; });
     }
+
+    if(queue.empty())
+    {
+        return false;
+    }
+
+    if(newest)
+    {
+        while(queue.size() > 1)
+        {
+            queue.front().sample->Release();
+            queue.pop_front();
+        }
+    }
+
+    next = queue.front();
+    queue.pop_front();
+    return true;
+}
+
+bool UvcMediaFoundationVideo::CopySample(IMFSample* sample, unsigned char* image)
+{
+    IMFMediaBuffer* mediaBuffer = nullptr;
+    HRESULT hr = sample->ConvertToContiguousBuffer(&mediaBuffer);
     if(SUCCEEDED(hr))
     {
         // Use the 2D buffer interface if it's available
@@ -136,30 +351,156 @@ bool UvcMediaFoundationVideo::GrabNext(unsigned char* image, bool wait)
         }
     }
 
+    if(mediaBuffer)
+    {
+        mediaBuffer->Release();
+        mediaBuffer = nullptr;
+    }
+
+    return SUCCEEDED(hr);
+}
+
+FrameLease UvcMediaFoundationVideo::LeaseSample(const QueuedSample& s)
+{
+    IMFSample* sample = s.sample;
+
+    IMFMediaBuffer* mediaBuffer = nullptr;
+    IMF2DBuffer* mediaBuffer2d = nullptr;
+    HRESULT hr = sample->ConvertToContiguousBuffer(&mediaBuffer);
+    if(SUCCEEDED(hr))
+    {
+        hr = mediaBuffer->QueryInterface(&mediaBuffer2d);
+    }
+
+    BYTE* scan0 = nullptr;
+    LONG pitch = 0;
+    if(SUCCEEDED(hr))
+    {
+        hr = mediaBuffer2d->Lock2D(&scan0, &pitch);
+    }
+
     if(SUCCEEDED(hr))
     {
-        using namespace std::chrono;
-        frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(pangolin::Time_us(pangolin::TimeNow()));
+        // The locked buffer is only usable in place if its rows and planes
+        // sit where streams[0] says. A matching contiguous length means the
+        // buffer has the stream's dimensions, and a matching pitch that it
+        // carries no padding (nor is bottom up).
+        DWORD contiguousLength = 0;
+        if(pitch == (LONG)streams[0].Pitch() &&
+           SUCCEEDED(mediaBuffer2d->GetContiguousLength(&contiguousLength)) &&
+           contiguousLength == size_bytes)
+        {
+            // The reader recycles the sample once the lease lets go of it
+            return FrameLease(scan0, size_bytes, [sample, mediaBuffer, mediaBuffer2d]() {
+                mediaBuffer2d->Unlock2D();
+                mediaBuffer2d->Release();
+                mediaBuffer->Release();
+                sample->Release();
+            });
+        }
+        mediaBuffer2d->Unlock2D();
     }
 
+    if(mediaBuffer2d)
+    {
+        mediaBuffer2d->Release();
+    }
     if(mediaBuffer)
     {
         mediaBuffer->Release();
-        mediaBuffer = nullptr;
     }
 
-    if(sample)
+    std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+    const bool copied = CopySample(sample, buffer->get());
+    sample->Release();
+    if(!copied)
     {
-        sample->Release();
-        sample = nullptr;
+        return FrameLease();
     }
+    return FrameLease(buffer->get(), size_bytes, [buffer]() {});
+}
 
-    return SUCCEEDED(hr);
+void UvcMediaFoundationVideo::SetFrameProperties(const QueuedSample& s)
+{
+    frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(s.host_time_us);
+    frame_properties[PANGO_FRAME_COUNTER] = picojson::value((int64_t)s.frame_counter);
+}
+
+bool UvcMediaFoundationVideo::GrabNext(unsigned char* image, bool wait)
+{
+    QueuedSample s;
+    if(!NextSample(s, false, wait))
+    {
+        return false;
+    }
+
+    const bool copied = CopySample(s.sample, image);
+    if(copied)
+    {
+        SetFrameProperties(s);
+    }
+    s.sample->Release();
+    return copied;
 }
 
 bool UvcMediaFoundationVideo::GrabNewest(unsigned char* image, bool wait)
 {
-    return GrabNext(image, wait);
+    QueuedSample s;
+    if(!NextSample(s, true, wait))
+    {
+        return false;
+    }
+
+    const bool copied = CopySample(s.sample, image);
+    if(copied)
+    {
+        SetFrameProperties(s);
+    }
+    s.sample->Release();
+    return copied;
+}
+
+FrameLease UvcMediaFoundationVideo::GrabNextLease(bool wait)
+{
+    QueuedSample s;
+    if(!NextSample(s, false, wait))
+    {
+        return FrameLease();
+    }
+    SetFrameProperties(s);
+    return LeaseSample(s);
+}
+
+FrameLease UvcMediaFoundationVideo::GrabNewestLease(bool wait)
+{
+    QueuedSample s;
+    if(!NextSample(s, true, wait))
+    {
+        return FrameLease();
+    }
+    SetFrameProperties(s);
+    return LeaseSample(s);
+}
+
+uint32_t UvcMediaFoundationVideo::AvailableFrames() const
+{
+    std::lock_guard<std::mutex> l(queue_mutex);
+    return (uint32_t)queue.size();
+}
+
+bool UvcMediaFoundationVideo::DropNFrames(uint32_t n)
+{
+    std::lock_guard<std::mutex> l(queue_mutex);
+    if(n > queue.size())
+    {
+        return false;
+    }
+    for(uint32_t i = 0; i < n; ++i)
+    {
+        queue.front().sample->Release();
+        queue.pop_front();
+    }
+    return true;
 }
 
 int UvcMediaFoundationVideo::IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, UvcRequestCode req_code)
@@ -439,16 +780,89 @@ bool UvcMediaFoundationVideo::FindDevice(int vendorId, int productId, int device
     return SUCCEEDED(hr);
 }
 
+bool UvcMediaFoundationVideo::CreateDxgiManager()
+{
+    HRESULT hr = D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, D3D11_CREATE_DEVICE_VIDEO_SUPPORT,
+                                   nullptr, 0, D3D11_SDK_VERSION, &d3dDevice, nullptr, nullptr);
+
+    if(SUCCEEDED(hr))
+    {
+        // The reader's decoder and lease holders use the device from different threads
+        ID3D10Multithread* multithread = nullptr;
+        if(SUCCEEDED(d3dDevice->QueryInterface(IID_PPV_ARGS(&multithread))))
+        {
+            multithread->SetMultithreadProtected(TRUE);
+            multithread->Release();
+        }
+    }
+
+    UINT resetToken = 0;
+    if(SUCCEEDED(hr))
+    {
+        hr = MFCreateDXGIDeviceManager(&resetToken, &dxgiManager);
+    }
+    if(SUCCEEDED(hr))
+    {
+        hr = dxgiManager->ResetDevice(d3dDevice, resetToken);
+    }
+
+    if(FAILED(hr))
+    {
+        pango_print_warn("Unable to create D3D11 device for UVC hardware decoding (%X), decoding in software", hr);
+        if(dxgiManager)
+        {
+            dxgiManager->Release();
+            dxgiManager = nullptr;
+        }
+        if(d3dDevice)
+        {
+            d3dDevice->Release();
+            d3dDevice = nullptr;
+        }
+        return false;
+    }
+    return true;
+}
+
 void UvcMediaFoundationVideo::InitDevice(size_t width, size_t height, int fps)
 {
-    HRESULT hr = MFCreateSourceReaderFromMediaSource(mediaSource, nullptr, &sourceReader);
+    IMFAttributes* readerAttributes = nullptr;
+    HRESULT hr = MFCreateAttributes(&readerAttributes, 3);
+
+    if(SUCCEEDED(hr) && options.async)
+    {
+        readerCallback = new ReaderCallback(this);
+        hr = readerAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, readerCallback);
+    }
+
+    if(SUCCEEDED(hr) && options.hw_decode)
+    {
+        // Let the reader pick DXVA decoders for compressed formats. Without a
+        // D3D manager these still decode into system memory.
+        hr = readerAttributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+        if(SUCCEEDED(hr) && CreateDxgiManager())
+        {
+            hr = readerAttributes->SetUnknown(MF_SOURCE_READER_D3D_MANAGER, dxgiManager);
+        }
+    }
+
+    if(SUCCEEDED(hr))
+    {
+        hr = MFCreateSourceReaderFromMediaSource(mediaSource, readerAttributes, &sourceReader);
+    }
     if(FAILED(hr))
     {
         pango_print_error("Unable to create source reader from UVC media source");
     }
 
+    if(readerAttributes)
+    {
+        readerAttributes->Release();
+        readerAttributes = nullptr;
+    }
+
     // Find the closest supported resolution
-    UINT32 stride;
+    UINT32 stride = 0;
     PixelFormat pixelFormat;
     if(SUCCEEDED(hr))
     {
@@ -524,6 +938,60 @@ void UvcMediaFoundationVideo::InitDevice(size_t width, size_t height, int fps)
                 {
                     pixelFormat = PixelFormatFromString("GRAY8");
                 }
+                else if(bestGuid == MFVideoFormat_NV12)
+                {
+                    pixelFormat = PixelFormatFromString("NV12");
+                    stride = bestWidth;
+                }
+                else if(bestGuid == MFVideoFormat_MJPG || bestGuid == MFVideoFormat_H264)
+                {
+                    // Ask for NV12 on top of the native type, which has the
+                    // reader insert a decoder between the two. The Microsoft
+                    // MJPEG decoder only offers YUY2 on older systems.
+                    const GUID decodedGuids[] = {MFVideoFormat_NV12, MFVideoFormat_YUY2};
+                    HRESULT decodeHr = E_FAIL;
+                    for(const GUID& decodedGuid : decodedGuids)
+                    {
+                        IMFMediaType* decodedType = nullptr;
+                        decodeHr = MFCreateMediaType(&decodedType);
+                        if(SUCCEEDED(decodeHr))
+                        {
+                            decodeHr = decodedType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+                        }
+                        if(SUCCEEDED(decodeHr))
+                        {
+                            decodeHr = decodedType->SetGUID(MF_MT_SUBTYPE, decodedGuid);
+                        }
+                        if(SUCCEEDED(decodeHr))
+                        {
+                            decodeHr = sourceReader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, decodedType);
+                        }
+                        if(decodedType)
+                        {
+                            decodedType->Release();
+                        }
+                        if(SUCCEEDED(decodeHr))
+                        {
+                            if(decodedGuid == MFVideoFormat_NV12)
+                            {
+                                pixelFormat = PixelFormatFromString("NV12");
+                                stride = bestWidth;
+                            }
+                            else
+                            {
+                                pixelFormat = PixelFormatFromString("YUYV422");
+                                stride = 2 * bestWidth;
+                            }
+                            break;
+                        }
+                    }
+                    if(FAILED(decodeHr))
+                    {
+                        pango_print_error("Unable to decode UVC %s stream",
+                                          bestGuid == MFVideoFormat_MJPG ? "MJPEG" : "H.264");
+                        hr = decodeHr;
+                    }
+                }
                 else
                 {
                     pango_print_warn("Unexpected MFVideoFormat with FOURCC %c%c%c%c",
@@ -543,13 +1011,22 @@ void UvcMediaFoundationVideo::InitDevice(size_t width, size_t height, int fps)
         }
     }
 
-    size_bytes = stride * height;
-
     streams.emplace_back(pixelFormat, width, height, stride);
+
+    size_bytes = std::max((size_t)stride * height, streams[0].SizeBytes());
+
+    device_properties["async"] = options.async;
+    device_properties["hw_decode"] = dxgiManager != nullptr;
 }
 
 void UvcMediaFoundationVideo::DeinitDevice()
 {
+    for(QueuedSample& s : queue)
+    {
+        s.sample->Release();
+    }
+    queue.clear();
+
     if(ksControl)
     {
         ksControl->Release();
@@ -570,6 +1047,24 @@ void UvcMediaFoundationVideo::DeinitDevice()
         sourceReader = nullptr;
     }
 
+    if(readerCallback)
+    {
+        readerCallback->Release();
+        readerCallback = nullptr;
+    }
+
+    if(dxgiManager)
+    {
+        dxgiManager->Release();
+        dxgiManager = nullptr;
+    }
+
+    if(d3dDevice)
+    {
+        d3dDevice->Release();
+        d3dDevice = nullptr;
+    }
+
     if(mediaSource)
     {
         mediaSource->Shutdown();
@@ -626,10 +1121,15 @@ PANGOLIN_REGISTER_FACTORY(UvcMediaFoundationVideo)
             const unsigned int deviceId = uri.Get<int>("num", 0);
             const ImageDim dim = uri.Get<ImageDim>("size", ImageDim(640, 480));
             const unsigned int fps = uri.Get<unsigned int>("fps", 0);  // 0 means unspecified
-            return std::unique_ptr<VideoInterface>(new UvcMediaFoundationVideo(vendorId, productId, deviceId, dim.x, dim.y, fps));
+
+            UvcMediaFoundationOptions options;
+            options.async = uri.Get<bool>("async", options.async);
+            options.queue = std::max<size_t>(1, uri.Get<size_t>("queue", options.queue));
+            options.hw_decode = uri.Get<std::string>("decode", "hw") == "hw";
+            return std::unique_ptr<VideoInterface>(new UvcMediaFoundationVideo(vendorId, productId, deviceId, dim.x, dim.y, fps, options));
         }
     };
 
     FactoryRegistry<VideoInterface>::I().RegisterFactory(std::make_shared<UvcVideoFactory>(), 10, "uvc");
 }
-}
\ No newline at end of file
+}
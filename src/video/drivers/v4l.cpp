@@ -33,7 +33,10 @@
 
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
+#include <memory>
 #include <stdint.h>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,10 +46,12 @@
 #include <linux/usb/video.h>
 #include <linux/uvcvideo.h>
 #include <malloc.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -57,31 +62,17 @@ using namespace std;
 namespace pangolin
 {
 
-static int xioctl(int fd, int request, void* arg)
+inline bool V4lIsMultiPlanar(v4l2_buf_type type)
 {
-    int r;
-    do r = ioctl (fd, request, arg);
-    while (-1 == r && EINTR == errno);
-    return r;
-}
-
-inline std::string V4lToString(int32_t v)
-{
-    //	v = ((__u32)(a) | ((__u32)(b) << 8) | ((__u32)(c) << 16) | ((__u32)(d) << 24))
-    char cc[5];
-    cc[0] = v       & 0xff;
-    cc[1] = (v>>8)  & 0xff;
-    cc[2] = (v>>16) & 0xff;
-    cc[3] = (v>>24) & 0xff;
-    cc[4] = 0;
-    return std::string(cc);
+    return type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 }
 
-V4lVideo::V4lVideo(const char* dev_name, io_method io, unsigned iwidth, unsigned iheight)
-    : io(io), fd(-1), buffers(0), n_buffers(0), running(false)
+V4lVideo::V4lVideo(const char* dev_name, io_method io, unsigned iwidth, unsigned iheight, unsigned v4l_format, unsigned num_buffers)
+    : io(io), fd(-1), epoll_fd(-1), buf_type(V4L2_BUF_TYPE_VIDEO_CAPTURE), buffers(0), n_buffers(0), num_planes(1), requested_buffers(num_buffers),
+      running(false), properties_stale(false)
 {
     open_device(dev_name);
-    init_device(dev_name,iwidth,iheight,0);
+    init_device(dev_name,iwidth,iheight,0, v4l_format ? v4l_format : V4L2_PIX_FMT_YUYV, V4L2_FIELD_INTERLACED, num_buffers);
     InitPangoDeviceProperties();
 
     Start();
@@ -114,33 +105,63 @@ size_t V4lVideo::SizeBytes() const
     return image_size;
 }
 
-bool V4lVideo::GrabNext( unsigned char* image, bool /*wait*/ )
+bool V4lVideo::WaitForFrame(bool wait)
 {
     for (;;) {
-        fd_set fds;
-        struct timeval tv;
-        int r;
-        
-        FD_ZERO (&fds);
-        FD_SET (fd, &fds);
-        
+        struct epoll_event event;
+
         /* Timeout. */
-        tv.tv_sec = 2;
-        tv.tv_usec = 0;
-        
-        r = select (fd + 1, &fds, NULL, NULL, &tv);
-        
+        const int r = epoll_wait (epoll_fd, &event, 1, wait ? 2000 : 0);
+
         if (-1 == r) {
             if (EINTR == errno)
                 continue;
-            
-            throw VideoException ("select", strerror(errno));
+
+            throw VideoException ("epoll_wait", strerror(errno));
         }
-        
+
         if (0 == r) {
-            throw VideoException("select Timeout", strerror(errno));
+            if (!wait)
+                return false;
+            throw VideoException("epoll_wait Timeout", strerror(errno));
         }
-        
+
+        return true;
+    }
+}
+
+// Driver timestamps are CLOCK_MONOTONIC, translated here to the TimeNow()
+// clock shared with other drivers. End of frame timestamps are taken in the
+// kernel as the frame arrives, so also replace the later userspace
+// reception time which JoinVideo synchronises on.
+void V4lVideo::SetFrameTiming(const v4l2_buffer& buf)
+{
+    const int64_t now_us = pangolin::Time_us(pangolin::TimeNow());
+    metadata.Clear();
+    metadata.SetHostReceptionTime(now_us);
+    metadata.SetFrameCounter((int64_t)buf.sequence);
+    properties_stale = true;
+
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        struct timespec mono;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        const int64_t mono_now_us = (int64_t)mono.tv_sec * 1000000 + mono.tv_nsec / 1000;
+        const int64_t stamp_us = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+        const int64_t capture_us = now_us - (mono_now_us - stamp_us);
+
+        metadata.SetCaptureTime(capture_us);
+        if ((buf.flags & V4L2_BUF_FLAG_TSTAMP_SRC_MASK) == V4L2_BUF_FLAG_TSTAMP_SRC_EOF) {
+            metadata.SetHostReceptionTime(capture_us);
+        }
+    }
+}
+
+bool V4lVideo::GrabNext( unsigned char* image, bool wait )
+{
+    for (;;) {
+        if (!WaitForFrame(wait))
+            return false;
+
         if (ReadFrame(image))
             break;
         
@@ -156,11 +177,140 @@ bool V4lVideo::GrabNewest( unsigned char* image, bool wait )
     return GrabNext(image,wait);
 }
 
+FrameLease V4lVideo::GrabNextLease( bool wait )
+{
+    if(num_planes > 1) {
+        // Memory planes are separate driver allocations, so copy out a
+        // contiguous frame as laid out by Streams()
+        auto copy = std::make_shared<std::vector<unsigned char>>(image_size);
+        if (!GrabNext(copy->data(), wait))
+            return FrameLease();
+        return FrameLease(copy->data(), image_size, [copy](){});
+    }
+
+    struct v4l2_buffer buf;
+    unsigned char* ptr = 0;
+
+    for (;;) {
+        if (!WaitForFrame(wait))
+            return FrameLease();
+
+        if (DequeueFrame(buf, ptr))
+            break;
+
+        /* EAGAIN - continue select loop. */
+    }
+
+    // Driver buffer is handed back to the device once the lease is released.
+    return FrameLease(ptr, image_size, [this,buf]() mutable {
+        if(running && -1 == EnqueueFrame(buf)) {
+            pango_print_warn("V4lVideo: Unable to requeue leased buffer (%s).\n", strerror(errno));
+        }
+    });
+}
+
+FrameLease V4lVideo::GrabNewestLease( bool wait )
+{
+    // TODO: Implement
+    return GrabNextLease(wait);
+}
+
+V4lDmaBufFrame V4lVideo::GrabNextDmaBuf( bool wait )
+{
+    if(io != IO_METHOD_MMAP) {
+        throw VideoException("V4lVideo: DMABUF export requires method=mmap");
+    }
+    if(dmabuf_fds.empty()) {
+        ExportDmaBufs();
+    }
+
+    struct v4l2_buffer buf;
+    unsigned char* ptr = 0;
+
+    for (;;) {
+        if (!WaitForFrame(wait))
+            return V4lDmaBufFrame();
+
+        if (DequeueFrame(buf, ptr))
+            break;
+    }
+
+    V4lDmaBufFrame frame;
+    const size_t first = buf.index * num_planes;
+    frame.lease = FrameLease(ptr, plane_bytes[0], [this,buf]() mutable {
+        if(running && -1 == EnqueueFrame(buf)) {
+            pango_print_warn("V4lVideo: Unable to requeue leased buffer (%s).\n", strerror(errno));
+        }
+    });
+
+    // One plane per stream. Streams either have a memory plane each or
+    // share the first at their offset within the frame.
+    for(size_t i=0; i < streams.size(); ++i) {
+        const StreamInfo& si = streams[i];
+        const size_t p = (num_planes > 1) ? i : 0;
+        const size_t offset = (num_planes > 1) ? 0 : (size_t)si.Offset();
+        frame.planes.push_back({dmabuf_fds[first + p], offset, si.Pitch(), si.SizeBytes()});
+    }
+    return frame;
+}
+
+void V4lVideo::ExportDmaBufs()
+{
+#ifdef VIDIOC_EXPBUF
+    for (unsigned int i = 0; i < n_buffers * num_planes; ++i) {
+        struct v4l2_exportbuffer expbuf;
+        CLEAR (expbuf);
+        expbuf.type = buf_type;
+        expbuf.index = i / num_planes;
+        expbuf.plane = i % num_planes;
+        expbuf.flags = O_CLOEXEC | O_RDONLY;
+
+        if (-1 == V4lIoctl(fd, VIDIOC_EXPBUF, &expbuf)) {
+            const int err = errno;
+            for (int f : dmabuf_fds) close (f);
+            dmabuf_fds.clear();
+            throw VideoException ("VIDIOC_EXPBUF", strerror(err));
+        }
+        dmabuf_fds.push_back(expbuf.fd);
+    }
+#else
+    throw VideoException("V4lVideo: DMABUF export needs Linux 3.8 headers or later");
+#endif
+}
+
 int V4lVideo::ReadFrame(unsigned char* image)
 {
     struct v4l2_buffer buf;
+    unsigned char* ptr = 0;
+
+    if(!DequeueFrame(buf, ptr)) {
+        return 0;
+    }
+
+    if(num_planes > 1) {
+        // Pack memory planes one after another, as described by Streams()
+        for(unsigned int p = 0; p < num_planes; ++p) {
+            memcpy(image, buffers[buf.index * num_planes + p].start, plane_bytes[p]);
+            image += plane_bytes[p];
+        }
+    }else{
+        memcpy(image, ptr, image_size);
+    }
+
+    if (-1 == EnqueueFrame(buf))
+        throw VideoException("VIDIOC_QBUF", strerror(errno));
+
+    return 1;
+}
+
+int V4lVideo::DequeueFrame(v4l2_buffer& buf, unsigned char*& ptr)
+{
     unsigned int i;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
     
+    CLEAR (buf);
+    CLEAR (planes);
+
     switch (io) {
     case IO_METHOD_READ:
         if (-1 == read (fd, buffers[0].start, buffers[0].length)) {
@@ -178,20 +328,22 @@ int V4lVideo::ReadFrame(unsigned char* image)
             }
         }
         // This is a hack, this ts sould come from the device.
-        frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(pangolin::Time_us(pangolin::TimeNow()));
+        metadata.Clear();
+        metadata.SetHostReceptionTime(pangolin::Time_us(pangolin::TimeNow()));
+        properties_stale = true;
 
-        //            process_image(buffers[0].start);
-        memcpy(image,buffers[0].start,buffers[0].length);
-        
+        ptr = (unsigned char*)buffers[0].start;
         break;
         
     case IO_METHOD_MMAP:
-        CLEAR (buf);
-        
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.type = buf_type;
         buf.memory = V4L2_MEMORY_MMAP;
+        if (V4lIsMultiPlanar(buf_type)) {
+            buf.m.planes = planes;
+            buf.length = num_planes;
+        }
         
-        if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
+        if (-1 == V4lIoctl(fd, VIDIOC_DQBUF, &buf)) {
             switch (errno) {
             case EAGAIN:
                 return 0;
@@ -205,27 +357,20 @@ int V4lVideo::ReadFrame(unsigned char* image)
                 throw VideoException("VIDIOC_DQBUF", strerror(errno));
             }
         }
-        // This is a hack, this ts sould come from the device.
-        frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(pangolin::Time_us(pangolin::TimeNow()));
+        SetFrameTiming(buf);
 
         assert (buf.index < n_buffers);
         
-        //            process_image (buffers[buf.index].start);
-        memcpy(image,buffers[buf.index].start,buffers[buf.index].length);
-        
-        
-        if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-            throw VideoException("VIDIOC_QBUF", strerror(errno));
-        
+        // Plane array is local, EnqueueFrame provides its own
+        buf.m.planes = 0;
+        ptr = (unsigned char*)buffers[buf.index * num_planes].start;
         break;
         
     case IO_METHOD_USERPTR:
-        CLEAR (buf);
-        
         buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory = V4L2_MEMORY_USERPTR;
         
-        if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
+        if (-1 == V4lIoctl(fd, VIDIOC_DQBUF, &buf)) {
             switch (errno) {
             case EAGAIN:
                 return 0;
@@ -239,8 +384,7 @@ int V4lVideo::ReadFrame(unsigned char* image)
                 throw VideoException("VIDIOC_DQBUF", strerror(errno));
             }
         }
-        // This is a hack, this ts sould come from the device.
-        frame_properties[PANGO_HOST_RECEPTION_TIME_US] = picojson::value(pangolin::Time_us(pangolin::TimeNow()));
+        SetFrameTiming(buf);
 
         for (i = 0; i < n_buffers; ++i)
             if (buf.m.userptr == (unsigned long) buffers[i].start
@@ -249,19 +393,34 @@ int V4lVideo::ReadFrame(unsigned char* image)
         
         assert (i < n_buffers);
         
-        //            process_image ((void *) buf.m.userptr);
-        memcpy(image,(void *)buf.m.userptr,buf.length);
-        
-        
-        if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-            throw VideoException("VIDIOC_QBUF", strerror(errno));
-        
+        ptr = (unsigned char*)buf.m.userptr;
         break;
     }
     
     return 1;
 }
 
+int V4lVideo::EnqueueFrame(v4l2_buffer& buf)
+{
+    if(io == IO_METHOD_READ) {
+        // Single read buffer is simply reused.
+        return 0;
+    }
+
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    if (V4lIsMultiPlanar(buf_type)) {
+        CLEAR (planes);
+        buf.m.planes = planes;
+        buf.length = num_planes;
+    }
+
+    const int r = V4lIoctl(fd, VIDIOC_QBUF, &buf);
+    if (V4lIsMultiPlanar(buf_type)) {
+        buf.m.planes = 0;
+    }
+    return r;
+}
+
 void V4lVideo::Stop()
 {
     if(running) {
@@ -274,9 +433,9 @@ void V4lVideo::Stop()
 
         case IO_METHOD_MMAP:
         case IO_METHOD_USERPTR:
-            type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            type = buf_type;
 
-            if (-1 == xioctl (fd, VIDIOC_STREAMOFF, &type))
+            if (-1 == V4lIoctl(fd, VIDIOC_STREAMOFF, &type))
                 throw VideoException("VIDIOC_STREAMOFF", strerror(errno));
 
             break;
@@ -303,17 +462,17 @@ void V4lVideo::Start()
 
                 CLEAR (buf);
 
-                buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                buf.type        = buf_type;
                 buf.memory      = V4L2_MEMORY_MMAP;
                 buf.index       = i;
 
-                if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
+                if (-1 == EnqueueFrame (buf))
                     throw VideoException("VIDIOC_QBUF", strerror(errno));
             }
 
-            type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            type = buf_type;
 
-            if (-1 == xioctl (fd, VIDIOC_STREAMON, &type))
+            if (-1 == V4lIoctl(fd, VIDIOC_STREAMON, &type))
                 throw VideoException("VIDIOC_STREAMON", strerror(errno));
 
             break;
@@ -330,13 +489,13 @@ void V4lVideo::Start()
                 buf.m.userptr   = (unsigned long) buffers[i].start;
                 buf.length      = buffers[i].length;
 
-                if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
+                if (-1 == V4lIoctl(fd, VIDIOC_QBUF, &buf))
                     throw VideoException("VIDIOC_QBUF", strerror(errno));
             }
 
             type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-            if (-1 == xioctl (fd, VIDIOC_STREAMON, &type))
+            if (-1 == V4lIoctl(fd, VIDIOC_STREAMON, &type))
                 throw VideoException ("VIDIOC_STREAMON", strerror(errno));
 
             break;
@@ -356,7 +515,10 @@ void V4lVideo::uninit_device()
         break;
         
     case IO_METHOD_MMAP:
-        for (i = 0; i < n_buffers; ++i)
+        for (int f : dmabuf_fds)
+            close (f);
+        dmabuf_fds.clear();
+        for (i = 0; i < n_buffers * num_planes; ++i)
             if (-1 == munmap (buffers[i].start, buffers[i].length))
                 throw VideoException ("munmap");
         break;
@@ -386,17 +548,17 @@ void V4lVideo::init_read(unsigned int buffer_size)
     }
 }
 
-void V4lVideo::init_mmap(const char* /*dev_name*/)
+void V4lVideo::init_mmap(const char* /*dev_name*/, unsigned int num_buffers)
 {
     struct v4l2_requestbuffers req;
     
     CLEAR (req);
     
-    req.count               = 4;
-    req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.count               = num_buffers;
+    req.type                = buf_type;
     req.memory              = V4L2_MEMORY_MMAP;
     
-    if (-1 == xioctl (fd, VIDIOC_REQBUFS, &req)) {
+    if (-1 == V4lIoctl(fd, VIDIOC_REQBUFS, &req)) {
         if (EINVAL == errno) {
             throw VideoException("does not support memory mapping", strerror(errno));
         } else {
@@ -408,7 +570,7 @@ void V4lVideo::init_mmap(const char* /*dev_name*/)
         throw VideoException("Insufficient buffer memory");
     }
     
-    buffers = (buffer*)calloc(req.count, sizeof(buffer));
+    buffers = (buffer*)calloc(req.count * num_planes, sizeof(buffer));
     
     if (!buffers) {
         throw VideoException( "Out of memory\n");
@@ -416,30 +578,40 @@ void V4lVideo::init_mmap(const char* /*dev_name*/)
     
     for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
         struct v4l2_buffer buf;
+        struct v4l2_plane planes[VIDEO_MAX_PLANES];
         
         CLEAR (buf);
+        CLEAR (planes);
         
-        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.type        = buf_type;
         buf.memory      = V4L2_MEMORY_MMAP;
         buf.index       = n_buffers;
+        if (V4lIsMultiPlanar(buf_type)) {
+            buf.m.planes = planes;
+            buf.length = num_planes;
+        }
         
-        if (-1 == xioctl (fd, VIDIOC_QUERYBUF, &buf))
+        if (-1 == V4lIoctl(fd, VIDIOC_QUERYBUF, &buf))
             throw VideoException ("VIDIOC_QUERYBUF", strerror(errno));
         
-        buffers[n_buffers].length = buf.length;
-        buffers[n_buffers].start =
-                mmap (NULL /* start anywhere */,
-                      buf.length,
-                      PROT_READ | PROT_WRITE /* required */,
-                      MAP_SHARED /* recommended */,
-                      fd, buf.m.offset);
-        
-        if (MAP_FAILED == buffers[n_buffers].start)
-            throw VideoException ("mmap");
+        for (unsigned int p = 0; p < num_planes; ++p) {
+            buffer& b = buffers[n_buffers * num_planes + p];
+            const bool mp = V4lIsMultiPlanar(buf_type);
+            b.length = mp ? planes[p].length : buf.length;
+            b.start =
+                    mmap (NULL /* start anywhere */,
+                          b.length,
+                          PROT_READ | PROT_WRITE /* required */,
+                          MAP_SHARED /* recommended */,
+                          fd, mp ? planes[p].m.mem_offset : buf.m.offset);
+            
+            if (MAP_FAILED == b.start)
+                throw VideoException ("mmap");
+        }
     }
 }
 
-void V4lVideo::init_userp(const char* /*dev_name*/, unsigned int buffer_size)
+void V4lVideo::init_userp(const char* /*dev_name*/, unsigned int buffer_size, unsigned int num_buffers)
 {
     struct v4l2_requestbuffers req;
     unsigned int page_size;
@@ -449,11 +621,11 @@ void V4lVideo::init_userp(const char* /*dev_name*/, unsigned int buffer_size)
     
     CLEAR (req);
     
-    req.count               = 4;
+    req.count               = num_buffers;
     req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory              = V4L2_MEMORY_USERPTR;
     
-    if (-1 == xioctl (fd, VIDIOC_REQBUFS, &req)) {
+    if (-1 == V4lIoctl(fd, VIDIOC_REQBUFS, &req)) {
         if (EINVAL == errno) {
             throw VideoException( "Does not support user pointer i/o", strerror(errno));
         } else {
@@ -461,13 +633,14 @@ void V4lVideo::init_userp(const char* /*dev_name*/, unsigned int buffer_size)
         }
     }
     
-    buffers = (buffer*)calloc(4, sizeof(buffer));
+    // The driver may adjust the count
+    buffers = (buffer*)calloc(req.count, sizeof(buffer));
     
     if (!buffers) {
         throw VideoException( "Out of memory\n");
     }
     
-    for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
+    for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
         buffers[n_buffers].length = buffer_size;
         buffers[n_buffers].start = memalign (/* boundary */ page_size,
                                              buffer_size);
@@ -478,7 +651,7 @@ void V4lVideo::init_userp(const char* /*dev_name*/, unsigned int buffer_size)
     }
 }
 
-void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheight, unsigned ifps, unsigned v4l_format, v4l2_field field)
+void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheight, unsigned ifps, unsigned v4l_format, v4l2_field field, unsigned num_buffers)
 {
     struct v4l2_capability cap;
     struct v4l2_cropcap cropcap;
@@ -486,9 +659,7 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
     struct v4l2_format fmt;
     struct v4l2_streamparm strm;
     
-    unsigned int min;
-    
-    if (-1 == xioctl (fd, VIDIOC_QUERYCAP, &cap)) {
+    if (-1 == V4lIoctl(fd, VIDIOC_QUERYCAP, &cap)) {
         if (EINVAL == errno) {
             throw VideoException("Not a V4L2 device", strerror(errno));
         } else {
@@ -496,7 +667,16 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
         }
     }
     
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    const uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+        buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        // e.g. ISP pipelines, which tend to offer only planar YUV
+        buf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        if (io != IO_METHOD_MMAP) {
+            throw VideoException("Multi-planar capture requires method=mmap");
+        }
+    } else {
         throw VideoException("Not a video capture device");
     }
     
@@ -522,13 +702,13 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
     
     CLEAR (cropcap);
     
-    cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    cropcap.type = buf_type;
     
-    if (0 == xioctl (fd, VIDIOC_CROPCAP, &cropcap)) {
-        crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (0 == V4lIoctl(fd, VIDIOC_CROPCAP, &cropcap)) {
+        crop.type = buf_type;
         crop.c = cropcap.defrect; /* reset to default */
         
-        if (-1 == xioctl (fd, VIDIOC_S_CROP, &crop)) {
+        if (-1 == V4lIoctl(fd, VIDIOC_S_CROP, &crop)) {
             switch (errno) {
             case EINVAL:
                 /* Cropping not supported. */
@@ -543,46 +723,38 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
     }    
     
     CLEAR (fmt);
+    fmt.type = buf_type;
 
     if(iwidth!=0 && iheight!=0) {
-        fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        fmt.fmt.pix.width       = iwidth;
-        fmt.fmt.pix.height      = iheight;
-        fmt.fmt.pix.pixelformat = v4l_format;
-        fmt.fmt.pix.field       = field;
+        if (V4lIsMultiPlanar(buf_type)) {
+            fmt.fmt.pix_mp.width       = iwidth;
+            fmt.fmt.pix_mp.height      = iheight;
+            fmt.fmt.pix_mp.pixelformat = v4l_format;
+            fmt.fmt.pix_mp.field       = field;
+        } else {
+            fmt.fmt.pix.width       = iwidth;
+            fmt.fmt.pix.height      = iheight;
+            fmt.fmt.pix.pixelformat = v4l_format;
+            fmt.fmt.pix.field       = field;
+        }
         
-        if (-1 == xioctl (fd, VIDIOC_S_FMT, &fmt))
+        if (-1 == V4lIoctl(fd, VIDIOC_S_FMT, &fmt))
             throw VideoException("VIDIOC_S_FMT", strerror(errno));
     }else{
-        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        
         /* Preserve original settings as set by v4l2-ctl for example */
-        if (-1 == xioctl(fd, VIDIOC_G_FMT, &fmt))
+        if (-1 == V4lIoctl(fd, VIDIOC_G_FMT, &fmt))
             throw VideoException("VIDIOC_G_FMT", strerror(errno));
     }
     
-    /* Buggy driver paranoia. */
-    min = fmt.fmt.pix.width * 2;
-    if (fmt.fmt.pix.bytesperline < min)
-        fmt.fmt.pix.bytesperline = min;
-    min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-    if (fmt.fmt.pix.sizeimage < min)
-        fmt.fmt.pix.sizeimage = min;
-    
-    /* Note VIDIOC_S_FMT may change width and height. */
-    width = fmt.fmt.pix.width;
-    height = fmt.fmt.pix.height;
-    image_size = fmt.fmt.pix.sizeimage;
-    
     if(ifps!=0)
     {
         CLEAR(strm);
-        strm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        strm.type = buf_type;
         strm.parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
         strm.parm.capture.timeperframe.numerator = 1;
         strm.parm.capture.timeperframe.denominator = ifps;
         
-        if (-1 == xioctl (fd, VIDIOC_S_PARM, &fmt))
+        if (-1 == V4lIoctl(fd, VIDIOC_S_PARM, &fmt))
             throw VideoException("VIDIOC_S_PARM", strerror(errno));
         
         fps = (float)strm.parm.capture.timeperframe.denominator / strm.parm.capture.timeperframe.numerator;
@@ -590,32 +762,211 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
         fps = 0;    
     }
     
+    requested_buffers = num_buffers;
+    init_format(fmt);
+}
+
+void V4lVideo::init_format(v4l2_format& fmt)
+{
+    unsigned int min;
+
+    unsigned pixelformat;
+    unsigned bytesperline[VIDEO_MAX_PLANES];
+    unsigned sizeimage[VIDEO_MAX_PLANES];
+
+    if (V4lIsMultiPlanar(buf_type)) {
+        num_planes = std::max<unsigned>(1, fmt.fmt.pix_mp.num_planes);
+        pixelformat = fmt.fmt.pix_mp.pixelformat;
+        width = fmt.fmt.pix_mp.width;
+        height = fmt.fmt.pix_mp.height;
+        for (unsigned int p = 0; p < num_planes; ++p) {
+            bytesperline[p] = fmt.fmt.pix_mp.plane_fmt[p].bytesperline;
+            sizeimage[p] = fmt.fmt.pix_mp.plane_fmt[p].sizeimage;
+        }
+    } else {
+        /* Buggy driver paranoia. */
+        min = fmt.fmt.pix.width * 2;
+        if (fmt.fmt.pix.bytesperline < min)
+            fmt.fmt.pix.bytesperline = min;
+        min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
+        if (fmt.fmt.pix.sizeimage < min)
+            fmt.fmt.pix.sizeimage = min;
+
+        /* Note VIDIOC_S_FMT may change width and height. */
+        num_planes = 1;
+        pixelformat = fmt.fmt.pix.pixelformat;
+        width = fmt.fmt.pix.width;
+        height = fmt.fmt.pix.height;
+        bytesperline[0] = fmt.fmt.pix.bytesperline;
+        sizeimage[0] = fmt.fmt.pix.sizeimage;
+    }
+
     switch (io) {
     case IO_METHOD_READ:
-        init_read (fmt.fmt.pix.sizeimage);
+        init_read (sizeimage[0]);
         break;
         
     case IO_METHOD_MMAP:
-        init_mmap (dev_name );
+        init_mmap (0, requested_buffers);
         break;
         
     case IO_METHOD_USERPTR:
-        init_userp (dev_name, fmt.fmt.pix.sizeimage);
+        init_userp (0, sizeimage[0], requested_buffers);
         break;
     }
     
+    init_streams(pixelformat, bytesperline, sizeimage);
+}
+
+VideoReadout V4lVideo::SetReadout(const VideoReadout& want)
+{
+    const bool was_running = running;
+    Stop();
+    uninit_device();
+
+    if (io != IO_METHOD_READ) {
+        // The format can't change whilst buffers are allocated
+        struct v4l2_requestbuffers req;
+        CLEAR (req);
+        req.type = buf_type;
+        req.memory = (io == IO_METHOD_MMAP) ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
+        V4lIoctl(fd, VIDIOC_REQBUFS, &req);
+    }
+
+    // Window of the sensor, through the selection API where supported.
+    // Selection takes the single planar type for multi-planar devices too.
+    VideoReadout got;
+    size_t window_w = width * readout.Factor();
+    size_t window_h = height * readout.Factor();
+
+    struct v4l2_selection sel;
+    CLEAR (sel);
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    if (0 == V4lIoctl(fd, VIDIOC_G_SELECTION, &sel)) {
+        const v4l2_rect full = sel.r;
+        sel.target = V4L2_SEL_TGT_CROP;
+        if (!want.IsFullSensor()) {
+            sel.r.left = full.left + (int32_t)want.x;
+            sel.r.top = full.top + (int32_t)want.y;
+            sel.r.width = (uint32_t)want.w;
+            sel.r.height = (uint32_t)want.h;
+            // Grow rather than shrink the window to meet alignment constraints
+            sel.flags = V4L2_SEL_FLAG_GE;
+        }
+        if (0 == V4lIoctl(fd, VIDIOC_S_SELECTION, &sel)) {
+            if (sel.r.left != full.left || sel.r.top != full.top || sel.r.width != full.width || sel.r.height != full.height) {
+                got.x = sel.r.left - full.left;
+                got.y = sel.r.top - full.top;
+                got.w = sel.r.width;
+                got.h = sel.r.height;
+            }
+            window_w = sel.r.width;
+            window_h = sel.r.height;
+        }
+    }
+
+    // Bin or skip by asking for a smaller format than the window, which the
+    // driver scales to if it can
+    struct v4l2_format fmt;
+    CLEAR (fmt);
+    fmt.type = buf_type;
+    if (-1 == V4lIoctl(fd, VIDIOC_G_FMT, &fmt))
+        throw VideoException("VIDIOC_G_FMT", strerror(errno));
+
+    const bool mp = V4lIsMultiPlanar(buf_type);
+    const size_t factor = std::max<size_t>(1, want.Factor());
+    (mp ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width) = (uint32_t)(window_w / factor);
+    (mp ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height) = (uint32_t)(window_h / factor);
+    if (-1 == V4lIoctl(fd, VIDIOC_S_FMT, &fmt) && -1 == V4lIoctl(fd, VIDIOC_G_FMT, &fmt))
+        throw VideoException("VIDIOC_G_FMT", strerror(errno));
+
+    const size_t got_width = mp ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width;
+    const size_t got_factor = got_width ? std::max<size_t>(1, (window_w + got_width / 2) / got_width) : 1;
+    if (want.decimation > 1 && want.binning == 1) {
+        got.decimation = got_factor;
+    } else {
+        got.binning = got_factor;
+    }
+
+    init_format(fmt);
+    readout = got;
+
+    if (was_running) {
+        Start();
+    }
+    return got;
+}
+
+VideoReadout V4lVideo::GetReadout() const
+{
+    return readout;
+}
+
+void V4lVideo::init_streams(unsigned pixelformat, const unsigned* bytesperline, const unsigned* plane_sizes)
+{
+    streams.clear();
+    plane_bytes.clear();
+
+    // Semi-planar YUV (NV12: 4:2:0, NV16: 4:2:2) is presented as a GRAY8 luma
+    // stream followed by a Y400A stream of interleaved half width chroma.
+    unsigned chroma_rows = 0;
+    bool semi_planar = true;
+    switch (pixelformat) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+    case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_NV21M:
+        chroma_rows = (height + 1) / 2;
+        break;
+    case V4L2_PIX_FMT_NV16:
+    case V4L2_PIX_FMT_NV16M:
+    case V4L2_PIX_FMT_NV61:
+    case V4L2_PIX_FMT_NV61M:
+        chroma_rows = height;
+        break;
+    default:
+        semi_planar = false;
+        break;
+    }
+
+    if (semi_planar) {
+        const size_t luma_pitch = bytesperline[0];
+        const size_t chroma_pitch = (num_planes > 1) ? bytesperline[1] : luma_pitch;
+        const size_t luma_bytes = luma_pitch * height;
+        const size_t chroma_bytes = chroma_pitch * chroma_rows;
+
+        streams.push_back(StreamInfo(PixelFormatFromString("GRAY8"), width, height, luma_pitch, 0));
+        streams.push_back(StreamInfo(PixelFormatFromString("Y400A"), (width + 1) / 2, chroma_rows, chroma_pitch, (unsigned char*)0 + luma_bytes));
+
+        if (num_planes > 1) {
+            plane_bytes.push_back(luma_bytes);
+            plane_bytes.push_back(chroma_bytes);
+        } else {
+            plane_bytes.push_back(std::max<size_t>(plane_sizes[0], luma_bytes + chroma_bytes));
+        }
+        image_size = (num_planes > 1) ? luma_bytes + chroma_bytes : plane_bytes[0];
+        return;
+    }
+
+    if (num_planes > 1) {
+        throw VideoException("V4L Format " + V4lToString(pixelformat) + " with several memory planes is not supported");
+    }
+
     std::string spix="GRAY8";
-    if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY) {
+    if(pixelformat == V4L2_PIX_FMT_GREY) {
         spix="GRAY8";
-    }else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
+    }else if(pixelformat == V4L2_PIX_FMT_YUYV) {
         spix="YUYV422";
-    }else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_Y16) {
+    }else if(pixelformat == V4L2_PIX_FMT_UYVY) {
+        spix="UYVY422";
+    }else if(pixelformat == V4L2_PIX_FMT_Y16) {
         spix="GRAY16LE";
-    }else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_Y10) {
+    }else if(pixelformat == V4L2_PIX_FMT_Y10) {
         spix="GRAY10";
     }else{
         // TODO: Add method to translate from V4L to FFMPEG type.
-        std::cerr << "V4L Format " << V4lToString(fmt.fmt.pix.pixelformat)
+        std::cerr << "V4L Format " << V4lToString(pixelformat)
                   << " not recognised. Defaulting to '" << spix << std::endl;
     }
 
@@ -623,6 +974,8 @@ void V4lVideo::init_device(const char* dev_name, unsigned iwidth, unsigned iheig
     const StreamInfo stream_info(pfmt, width, height, (width*pfmt.bpp)/8, 0);
 
     streams.push_back(stream_info);
+    plane_bytes.push_back(plane_sizes[0]);
+    image_size = plane_sizes[0];
 }
 
 void V4lVideo::SetExposureUs(int exposure_us)
@@ -632,7 +985,7 @@ void V4lVideo::SetExposureUs(int exposure_us)
     // v4l specifies exposure in 100us units
     control.value = exposure_us / 100;
 
-    if (-1 == xioctl (fd, VIDIOC_S_CTRL, &control))
+    if (-1 == V4lIoctl(fd, VIDIOC_S_CTRL, &control))
         pango_print_warn("V4lVideo::SetExposureUs() ioctl error: %s\n", strerror(errno));
 
 }
@@ -643,13 +996,17 @@ void V4lVideo::SetGain(double gain)
     control.id = V4L2_CID_GAIN;
     control.value = gain;
 
-    if (-1 == xioctl (fd, VIDIOC_S_CTRL, &control))
+    if (-1 == V4lIoctl(fd, VIDIOC_S_CTRL, &control))
         pango_print_warn("V4lVideo::SetGain() ioctl error: %s\n", strerror(errno));
 
 }
 
 void V4lVideo::close_device()
 {
+    if (epoll_fd != -1)
+        close (epoll_fd);
+    epoll_fd = -1;
+
     if (-1 == close (fd))
         throw VideoException("close");
     
@@ -673,6 +1030,15 @@ void V4lVideo::open_device(const char* dev_name)
     if (-1 == fd) {
         throw VideoException("Cannot open device");
     }
+
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    struct epoll_event event;
+    CLEAR (event);
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (-1 == epoll_fd || -1 == epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        throw VideoException("Cannot wait on device", strerror(errno));
+    }
 }
 
 int V4lVideo::IoCtrl(uint8_t unit, uint8_t ctrl, unsigned char* data, int len, UvcRequestCode req_code)
@@ -701,15 +1067,30 @@ const picojson::value& V4lVideo::DeviceProperties() const
 //! Access JSON properties of most recently captured frame
 const picojson::value& V4lVideo::FrameProperties() const
 {
+    if(properties_stale) {
+        frame_properties = picojson::value();
+        metadata.AddToJson(frame_properties);
+        properties_stale = false;
+    }
     return frame_properties;
 }
 
+const FrameMetadata& V4lVideo::Metadata() const
+{
+    return metadata;
+}
+
 PANGOLIN_REGISTER_FACTORY(V4lVideo)
 {
     struct V4lVideoFactory : public FactoryInterface<VideoInterface> {
         std::unique_ptr<VideoInterface> Open(const Uri& uri) override {
             const std::string smethod = uri.Get<std::string>("method","mmap");
             const ImageDim desired_dim = uri.Get<ImageDim>("size", ImageDim(0,0));
+            const std::string sformat = uri.Get<std::string>("format", "");
+            if(!sformat.empty() && sformat.size() != 4) {
+                throw VideoException("V4lVideo: format should be a four character code, e.g. NV12");
+            }
+            const unsigned v4l_format = sformat.empty() ? 0 : v4l2_fourcc(sformat[0], sformat[1], sformat[2], sformat[3]);
 
             io_method method = IO_METHOD_MMAP;
 
@@ -721,7 +1102,12 @@ PANGOLIN_REGISTER_FACTORY(V4lVideo)
                 method = IO_METHOD_USERPTR;
             }
 
-            V4lVideo* video_raw = new V4lVideo(uri.url.c_str(), method, desired_dim.x, desired_dim.y );
+            const unsigned num_buffers = uri.Get<unsigned>("buffers", 4);
+            if(num_buffers < 2) {
+                throw VideoException("V4lVideo: at least 2 buffers are required");
+            }
+
+            V4lVideo* video_raw = new V4lVideo(uri.url.c_str(), method, desired_dim.x, desired_dim.y, v4l_format, num_buffers );
             if(video_raw  && uri.Contains("ExposureTime")) {
                 static_cast<V4lVideo*>(video_raw)->SetExposureUs(uri.Get<int>("ExposureTime", 10000));
             }
@@ -0,0 +1,352 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/timer.h>
+#include <pangolin/video/drivers/v4l_output.h>
+#include <pangolin/video/frame_metadata.h>
+#include <pangolin/video/video_exception.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+
+namespace pangolin
+{
+
+namespace
+{
+// V4L2 pixel format written for a single stream, 0 if there is none
+unsigned V4lFormatFromPixelFormat(const PixelFormat& fmt)
+{
+    if(fmt.Name() == "GRAY8") return V4L2_PIX_FMT_GREY;
+    if(fmt.Name() == "GRAY16LE") return V4L2_PIX_FMT_Y16;
+    if(fmt.Name() == "YUYV422") return V4L2_PIX_FMT_YUYV;
+    if(fmt.Name() == "UYVY422") return V4L2_PIX_FMT_UYVY;
+    if(fmt.Name() == "RGB24") return V4L2_PIX_FMT_RGB24;
+    if(fmt.Name() == "BGR24") return V4L2_PIX_FMT_BGR24;
+    return 0;
+}
+
+// The luma and interleaved chroma streams V4lVideo presents NV12 frames as
+bool IsNv12Pair(const std::vector<StreamInfo>& st)
+{
+    return st.size() == 2 &&
+           st[0].PixFormat().Name() == "GRAY8" && st[1].PixFormat().Name() == "Y400A" &&
+           st[1].Width() == (st[0].Width() + 1) / 2 && st[1].Height() == (st[0].Height() + 1) / 2;
+}
+}
+
+V4lVideoOutput::V4lVideoOutput(const std::string& dev_name, unsigned num_buffers, double fps, int timeout_ms)
+    : dev_name(dev_name), fd(-1), requested_buffers(num_buffers), fps(fps), timeout_ms(timeout_ms),
+      next_unqueued(0), streaming(false), dropped_frames(0)
+{
+    std::memset(&fmt, 0, sizeof(fmt));
+
+    struct stat st;
+    if(-1 == stat(dev_name.c_str(), &st) || !S_ISCHR(st.st_mode)) {
+        throw VideoException("V4lVideoOutput: not a device", dev_name);
+    }
+
+    // Non-blocking, so that waiting for buffers can time out
+    fd = open(dev_name.c_str(), O_RDWR | O_NONBLOCK, 0);
+    if(-1 == fd) {
+        throw VideoException("V4lVideoOutput: cannot open device " + dev_name, strerror(errno));
+    }
+
+    v4l2_capability cap;
+    std::memset(&cap, 0, sizeof(cap));
+    if(-1 == V4lIoctl(fd, VIDIOC_QUERYCAP, &cap)) {
+        close(fd);
+        throw VideoException("V4lVideoOutput: " + dev_name + " is not a V4L2 device", strerror(errno));
+    }
+    const unsigned caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if(!(caps & V4L2_CAP_VIDEO_OUTPUT) || !(caps & V4L2_CAP_STREAMING)) {
+        close(fd);
+        throw VideoException("V4lVideoOutput: " + dev_name + " is not a streaming output device, e.g. of v4l2loopback");
+    }
+}
+
+V4lVideoOutput::~V4lVideoOutput()
+{
+    UninitBuffers();
+    close(fd);
+}
+
+const std::vector<StreamInfo>& V4lVideoOutput::Streams() const
+{
+    return streams;
+}
+
+bool V4lVideoOutput::IsPipe() const
+{
+    return false;
+}
+
+size_t V4lVideoOutput::DroppedFrames() const
+{
+    return dropped_frames;
+}
+
+void V4lVideoOutput::SetStreams(const std::vector<StreamInfo>& st, const std::string& /*uri*/, const picojson::value& /*device_properties*/)
+{
+    UninitBuffers();
+    SetFormat(st);
+    streams = st;
+    InitBuffers();
+}
+
+unsigned V4lVideoOutput::SetFormat(const std::vector<StreamInfo>& st)
+{
+    if(st.empty()) {
+        throw VideoException("V4lVideoOutput: no streams to write");
+    }
+
+    const bool nv12 = IsNv12Pair(st);
+    const unsigned pixelformat = nv12 ? (unsigned)V4L2_PIX_FMT_NV12 : (st.size() == 1 ? V4lFormatFromPixelFormat(st[0].PixFormat()) : 0);
+    if(!pixelformat) {
+        throw VideoException(
+            "V4lVideoOutput: can't write " + std::to_string(st.size()) + " stream(s) of " + st[0].PixFormat().Name() +
+            ", convert to a single GRAY8, GRAY16LE, YUYV422, UYVY422, RGB24 or BGR24 stream first"
+        );
+    }
+
+    const unsigned width = (unsigned)st[0].Width();
+    const unsigned height = (unsigned)st[0].Height();
+    const unsigned row_bytes = (unsigned)st[0].RowBytes();
+    const unsigned chroma_rows = nv12 ? (height + 1) / 2 : 0;
+
+    std::memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = pixelformat;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix.bytesperline = row_bytes;
+    fmt.fmt.pix.sizeimage = row_bytes * (height + chroma_rows);
+    fmt.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+
+    if(-1 == V4lIoctl(fd, VIDIOC_S_FMT, &fmt)) {
+        throw VideoException("V4lVideoOutput: VIDIOC_S_FMT", strerror(errno));
+    }
+    if(fmt.fmt.pix.pixelformat != pixelformat || fmt.fmt.pix.width != width || fmt.fmt.pix.height != height) {
+        throw VideoException(
+            "V4lVideoOutput: " + dev_name + " doesn't accept " + V4lToString(pixelformat) + " " +
+            std::to_string(width) + "x" + std::to_string(height)
+        );
+    }
+
+    // Drivers may pad rows
+    const size_t pitch = std::max<size_t>(fmt.fmt.pix.bytesperline, row_bytes);
+    fmt.fmt.pix.sizeimage = std::max<unsigned>(fmt.fmt.pix.sizeimage, (unsigned)(pitch * (height + chroma_rows)));
+    plane_offset.assign(1, 0);
+    plane_pitch.assign(1, pitch);
+    if(nv12) {
+        plane_offset.push_back(pitch * height);
+        plane_pitch.push_back(pitch);
+    }
+
+    if(fps > 0.0) {
+        v4l2_streamparm parm;
+        std::memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        parm.parm.output.timeperframe.numerator = 1000;
+        parm.parm.output.timeperframe.denominator = (unsigned)std::lround(fps * 1000.0);
+        if(-1 == V4lIoctl(fd, VIDIOC_S_PARM, &parm)) {
+            pango_print_warn("V4lVideoOutput: unable to set %g fps on %s\n", fps, dev_name.c_str());
+        }
+    }
+
+    return pixelformat;
+}
+
+void V4lVideoOutput::InitBuffers()
+{
+    v4l2_requestbuffers req;
+    std::memset(&req, 0, sizeof(req));
+    req.count = requested_buffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+    if(-1 == V4lIoctl(fd, VIDIOC_REQBUFS, &req)) {
+        throw VideoException("V4lVideoOutput: does not support memory mapping", strerror(errno));
+    }
+    if(req.count < 2) {
+        throw VideoException("V4lVideoOutput: Insufficient buffer memory");
+    }
+
+    for(unsigned i=0; i < req.count; ++i) {
+        v4l2_buffer buf;
+        std::memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if(-1 == V4lIoctl(fd, VIDIOC_QUERYBUF, &buf)) {
+            throw VideoException("V4lVideoOutput: VIDIOC_QUERYBUF", strerror(errno));
+        }
+        if(buf.length < fmt.fmt.pix.sizeimage) {
+            throw VideoException("V4lVideoOutput: driver buffers are smaller than a frame");
+        }
+
+        buffer b;
+        b.length = buf.length;
+        b.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if(MAP_FAILED == b.start) {
+            throw VideoException("V4lVideoOutput: mmap", strerror(errno));
+        }
+        buffers.push_back(b);
+    }
+    next_unqueued = 0;
+}
+
+void V4lVideoOutput::UninitBuffers()
+{
+    if(streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        V4lIoctl(fd, VIDIOC_STREAMOFF, &type);
+        streaming = false;
+    }
+
+    for(buffer& b : buffers) {
+        munmap(b.start, b.length);
+    }
+    if(!buffers.empty()) {
+        // Free the driver's buffers, so that the format can change
+        v4l2_requestbuffers req;
+        std::memset(&req, 0, sizeof(req));
+        req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        req.memory = V4L2_MEMORY_MMAP;
+        V4lIoctl(fd, VIDIOC_REQBUFS, &req);
+    }
+    buffers.clear();
+}
+
+int V4lVideoOutput::FreeBuffer()
+{
+    if(next_unqueued < buffers.size()) {
+        return (int)next_unqueued++;
+    }
+
+    // Every buffer is with the device, wait for one to be displayed (read)
+    pollfd p;
+    p.fd = fd;
+    p.events = POLLOUT;
+    p.revents = 0;
+    if(poll(&p, 1, timeout_ms) <= 0) {
+        return -1;
+    }
+
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if(-1 == V4lIoctl(fd, VIDIOC_DQBUF, &buf)) {
+        if(EAGAIN == errno) {
+            return -1;
+        }
+        throw VideoException("V4lVideoOutput: VIDIOC_DQBUF", strerror(errno));
+    }
+    return (int)buf.index;
+}
+
+int V4lVideoOutput::WriteStreams(const unsigned char* data, const picojson::value& frame_properties)
+{
+    if(buffers.empty()) {
+        throw VideoException("V4lVideoOutput: SetStreams must be called before WriteStreams");
+    }
+
+    const int index = FreeBuffer();
+    if(index < 0) {
+        ++dropped_frames;
+        return 0;
+    }
+
+    unsigned char* frame = (unsigned char*)buffers[index].start;
+    for(size_t s=0; s < streams.size(); ++s) {
+        const StreamInfo& si = streams[s];
+        const unsigned char* src = data + (size_t)si.Offset();
+        unsigned char* dst = frame + plane_offset[s];
+        if(si.Pitch() == plane_pitch[s]) {
+            std::memcpy(dst, src, si.SizeBytes());
+        }else{
+            for(size_t r=0; r < si.Height(); ++r) {
+                std::memcpy(dst + r * plane_pitch[s], src + r * si.Pitch(), si.RowBytes());
+            }
+        }
+    }
+
+    // Pass capture times through to readers
+    const FrameMetadata meta = FrameMetadata::FromJson(frame_properties);
+    const int64_t time_us = meta.Has(FrameMetadata::CaptureTime) ? meta.capture_time_us : TimeNow_us();
+
+    v4l2_buffer buf;
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = (unsigned)index;
+    buf.bytesused = fmt.fmt.pix.sizeimage;
+    buf.field = V4L2_FIELD_NONE;
+    buf.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+    buf.timestamp.tv_sec = time_us / 1000000;
+    buf.timestamp.tv_usec = time_us % 1000000;
+    if(-1 == V4lIoctl(fd, VIDIOC_QBUF, &buf)) {
+        throw VideoException("V4lVideoOutput: VIDIOC_QBUF", strerror(errno));
+    }
+
+    if(!streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        if(-1 == V4lIoctl(fd, VIDIOC_STREAMON, &type)) {
+            throw VideoException("V4lVideoOutput: VIDIOC_STREAMON", strerror(errno));
+        }
+        streaming = true;
+    }
+    return 0;
+}
+
+PANGOLIN_REGISTER_FACTORY(V4lVideoOutput)
+{
+    struct V4lVideoOutputFactory : public FactoryInterface<VideoOutputInterface> {
+        std::unique_ptr<VideoOutputInterface> Open(const Uri& uri) override {
+            const unsigned num_buffers = uri.Get<unsigned>("buffers", 4);
+            if(num_buffers < 2) {
+                throw VideoException("V4lVideoOutput: at least 2 buffers are required");
+            }
+            return std::unique_ptr<VideoOutputInterface>(
+                new V4lVideoOutput(uri.url, num_buffers, uri.Get<double>("fps", 0.0), uri.Get<int>("timeout_ms", 100))
+            );
+        }
+    };
+
+    FactoryRegistry<VideoOutputInterface>::I().RegisterFactory(std::make_shared<V4lVideoOutputFactory>(), 10, "v4l");
+}
+
+}
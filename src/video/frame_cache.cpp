@@ -0,0 +1,114 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/frame_cache.h>
+
+namespace pangolin
+{
+
+FrameCache::FrameCache(size_t max_bytes)
+    : budget(max_bytes), bytes_used(0)
+{
+}
+
+void FrameCache::SetBudget(size_t max_bytes)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    budget = max_bytes;
+    Evict(budget);
+}
+
+size_t FrameCache::Budget() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return budget;
+}
+
+size_t FrameCache::BytesUsed() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return bytes_used;
+}
+
+bool FrameCache::Contains(size_t id) const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return entries.count(id) > 0;
+}
+
+bool FrameCache::Find(size_t id, Frame& frame)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    auto it = entries.find(id);
+    if(it == entries.end()) {
+        return false;
+    }
+    lru.splice(lru.begin(), lru, it->second.lru);
+    frame = it->second.frame;
+    return true;
+}
+
+void FrameCache::Insert(size_t id, const Frame& frame, size_t size_bytes)
+{
+    std::lock_guard<std::mutex> l(mutex);
+
+    auto it = entries.find(id);
+    if(it != entries.end()) {
+        bytes_used -= it->second.size_bytes;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    if(size_bytes > budget) {
+        return;
+    }
+
+    Evict(budget - size_bytes);
+    lru.push_front(id);
+    entries[id] = Entry{frame, size_bytes, lru.begin()};
+    bytes_used += size_bytes;
+}
+
+void FrameCache::Clear()
+{
+    std::lock_guard<std::mutex> l(mutex);
+    entries.clear();
+    lru.clear();
+    bytes_used = 0;
+}
+
+void FrameCache::Evict(size_t max_bytes)
+{
+    while(bytes_used > max_bytes && !lru.empty()) {
+        auto it = entries.find(lru.back());
+        bytes_used -= it->second.size_bytes;
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
+
+}
@@ -0,0 +1,199 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/frame_metadata.h>
+#include <pangolin/video/video_interface.h>
+
+#include <cstring>
+
+namespace pangolin
+{
+
+namespace {
+
+const uint8_t frame_metadata_version = 1;
+
+// Order in which fields follow the mask in the binary encoding
+const FrameMetadata::Field int_fields[] = {
+    FrameMetadata::CaptureTime, FrameMetadata::HostReceptionTime, FrameMetadata::EstimatedCenterCaptureTime,
+    FrameMetadata::Exposure, FrameMetadata::FrameCounter
+};
+
+const FrameMetadata::Field real_fields[] = {
+    FrameMetadata::AnalogGain, FrameMetadata::AnalogBlackLevel, FrameMetadata::Gamma, FrameMetadata::SensorTemperature
+};
+
+template<typename M>
+auto IntField(M& m, FrameMetadata::Field f) -> decltype((m.capture_time_us))
+{
+    switch(f) {
+    case FrameMetadata::CaptureTime: return m.capture_time_us;
+    case FrameMetadata::HostReceptionTime: return m.host_reception_time_us;
+    case FrameMetadata::EstimatedCenterCaptureTime: return m.estimated_center_capture_time_us;
+    case FrameMetadata::Exposure: return m.exposure_us;
+    default: return m.frame_counter;
+    }
+}
+
+template<typename M>
+auto RealField(M& m, FrameMetadata::Field f) -> decltype((m.analog_gain))
+{
+    switch(f) {
+    case FrameMetadata::AnalogGain: return m.analog_gain;
+    case FrameMetadata::AnalogBlackLevel: return m.analog_black_level;
+    case FrameMetadata::Gamma: return m.gamma;
+    default: return m.sensor_temperature_C;
+    }
+}
+
+const char* JsonKey(FrameMetadata::Field f)
+{
+    switch(f) {
+    case FrameMetadata::CaptureTime: return PANGO_CAPTURE_TIME_US;
+    case FrameMetadata::HostReceptionTime: return PANGO_HOST_RECEPTION_TIME_US;
+    case FrameMetadata::EstimatedCenterCaptureTime: return PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US;
+    case FrameMetadata::Exposure: return PANGO_EXPOSURE_US;
+    case FrameMetadata::FrameCounter: return PANGO_FRAME_COUNTER;
+    case FrameMetadata::AnalogGain: return PANGO_ANALOG_GAIN;
+    case FrameMetadata::AnalogBlackLevel: return PANGO_ANALOG_BLACK_LEVEL;
+    case FrameMetadata::Gamma: return PANGO_GAMMA;
+    case FrameMetadata::SensorTemperature: return PANGO_SENSOR_TEMPERATURE_C;
+    default: return "";
+    }
+}
+
+template<typename T>
+void Append(std::string& out, const T& v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+bool Extract(const unsigned char*& p, const unsigned char* end, T& v)
+{
+    if(size_t(end - p) < sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+}
+
+void FrameMetadata::AddToJson(picojson::value& json) const
+{
+    if(!json.is<picojson::object>()) {
+        json = picojson::value(picojson::object_type, false);
+    }
+    for(Field f : int_fields) {
+        if(Has(f)) json[JsonKey(f)] = picojson::value(IntField(*this, f));
+    }
+    for(Field f : real_fields) {
+        if(Has(f)) json[JsonKey(f)] = picojson::value(RealField(*this, f));
+    }
+}
+
+FrameMetadata FrameMetadata::FromJson(const picojson::value& json)
+{
+    FrameMetadata m;
+    if(!json.is<picojson::object>()) {
+        return m;
+    }
+
+    const bool timed = json.contains(PANGO_CAPTURE_TIME_US) || json.contains(PANGO_HOST_RECEPTION_TIME_US) ||
+                       json.contains(PANGO_ESTIMATED_CENTER_CAPTURE_TIME_US);
+    const picojson::value& src = (!timed && json.contains("streams") && json["streams"].size()) ? json["streams"][0] : json;
+
+    for(Field f : int_fields) {
+        if(src.contains(JsonKey(f))) {
+            const picojson::value& v = src[JsonKey(f)];
+            if(v.is<int64_t>()) {
+                IntField(m, f) = v.get<int64_t>();
+                m.fields |= f;
+            }else if(v.is<double>()) {
+                IntField(m, f) = (int64_t)v.get<double>();
+                m.fields |= f;
+            }
+        }
+    }
+    for(Field f : real_fields) {
+        if(src.contains(JsonKey(f)) && src[JsonKey(f)].is<double>()) {
+            RealField(m, f) = src[JsonKey(f)].get<double>();
+            m.fields |= f;
+        }
+    }
+    return m;
+}
+
+void FrameMetadata::Serialize(std::string& out) const
+{
+    const uint32_t mask = fields & ~(extension.empty() ? uint32_t(Extension) : 0u);
+
+    out.clear();
+    Append(out, frame_metadata_version);
+    Append(out, mask);
+
+    for(Field f : int_fields) {
+        if(mask & f) Append(out, IntField(*this, f));
+    }
+    for(Field f : real_fields) {
+        if(mask & f) Append(out, RealField(*this, f));
+    }
+    if(mask & Extension) {
+        Append(out, (uint32_t)extension.size());
+        out.append(extension);
+    }
+}
+
+bool FrameMetadata::Deserialize(const void* data, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    Clear();
+
+    uint8_t version;
+    uint32_t mask;
+    if(!Extract(p, end, version) || version != frame_metadata_version || !Extract(p, end, mask)) {
+        return false;
+    }
+
+    for(Field f : int_fields) {
+        if((mask & f) && !Extract(p, end, IntField(*this, f))) return false;
+    }
+    for(Field f : real_fields) {
+        if((mask & f) && !Extract(p, end, RealField(*this, f))) return false;
+    }
+    if(mask & Extension) {
+        uint32_t n;
+        if(!Extract(p, end, n) || size_t(end - p) < n) return false;
+        extension.assign(reinterpret_cast<const char*>(p), n);
+    }
+
+    fields = mask;
+    return true;
+}
+
+}
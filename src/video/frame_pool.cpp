@@ -0,0 +1,178 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/image/memcpy.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+
+#ifdef _WIN_
+#  include <malloc.h>
+#endif
+
+#ifdef _LINUX_
+#  include <sys/mman.h>
+#endif
+
+namespace pangolin
+{
+
+namespace
+{
+const size_t page_bytes = 4096;
+const size_t huge_page_bytes = 2 * 1024 * 1024;
+
+// Round up to whole pages, or whole huge pages for large frames.
+size_t SizeClass(size_t size_bytes)
+{
+    const size_t align = size_bytes >= huge_page_bytes ? huge_page_bytes : page_bytes;
+    return ((size_bytes + align - 1) / align) * align;
+}
+}
+
+FramePool& FramePool::I()
+{
+    // Intentionally never destroyed: buffers may be returned from static
+    // objects destructed after this function's statics would be.
+    static FramePool* pool = new FramePool();
+    return *pool;
+}
+
+FramePool& FramePool::Pinned()
+{
+    // Never destroyed, as above.
+    static FramePool* pool = new FramePool(true);
+    return *pool;
+}
+
+FramePool::FramePool(bool pinned)
+    : pinned(pinned), bytes_allocated(0), bytes_idle(0)
+{
+}
+
+FramePool::~FramePool()
+{
+    Trim();
+}
+
+FramePool::Buffer FramePool::Acquire(size_t size_bytes)
+{
+    const size_t bytes = SizeClass(std::max<size_t>(size_bytes, 1));
+
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        auto it = idle.find(bytes);
+        if(it != idle.end()) {
+            unsigned char* ptr = it->second;
+            idle.erase(it);
+            bytes_idle -= bytes;
+            return Buffer(this, ptr, bytes);
+        }
+    }
+
+    unsigned char* ptr = Allocate(bytes);
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        bytes_allocated += bytes;
+    }
+    return Buffer(this, ptr, bytes);
+}
+
+void FramePool::Release(unsigned char* ptr, size_t size_bytes)
+{
+    std::lock_guard<std::mutex> l(mutex);
+    idle.insert(std::make_pair(size_bytes, ptr));
+    bytes_idle += size_bytes;
+}
+
+void FramePool::Trim()
+{
+    std::lock_guard<std::mutex> l(mutex);
+    for(auto& b : idle) {
+        Free(b.second, b.first);
+        bytes_allocated -= b.first;
+    }
+    idle.clear();
+    bytes_idle = 0;
+}
+
+size_t FramePool::BytesAllocated() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return bytes_allocated;
+}
+
+size_t FramePool::BytesIdle() const
+{
+    std::lock_guard<std::mutex> l(mutex);
+    return bytes_idle;
+}
+
+unsigned char* FramePool::Allocate(size_t size_bytes)
+{
+    if(pinned) {
+        return AllocatePinned(size_bytes);
+    }
+
+    const size_t align = size_bytes >= huge_page_bytes ? huge_page_bytes : page_bytes;
+    void* ptr = nullptr;
+#ifdef _WIN_
+    ptr = _aligned_malloc(size_bytes, align);
+#else
+    if(posix_memalign(&ptr, align, size_bytes) != 0) {
+        ptr = nullptr;
+    }
+#endif
+    if(!ptr) {
+        throw std::bad_alloc();
+    }
+#if defined(_LINUX_) && defined(MADV_HUGEPAGE)
+    if(align == huge_page_bytes) {
+        // Advisory only, ignore failure (e.g. THP disabled).
+        madvise(ptr, size_bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return (unsigned char*)ptr;
+}
+
+void FramePool::Free(unsigned char* ptr, size_t size_bytes)
+{
+    if(pinned) {
+        FreePinned(ptr, size_bytes);
+        return;
+    }
+
+#ifdef _WIN_
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+}
@@ -0,0 +1,132 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/fused_row_filter.h>
+
+namespace pangolin
+{
+
+namespace
+{
+// Return video as a fusible one-input row filter, or nullptr
+VideoRowFilterInterface* AsRowFilter(VideoInterface& video, VideoInterface*& input)
+{
+    VideoRowFilterInterface* row_filter = dynamic_cast<VideoRowFilterInterface*>(&video);
+    VideoFilterInterface* filter = dynamic_cast<VideoFilterInterface*>(&video);
+    if(!row_filter || !filter || !row_filter->RowFilterSupported() || filter->InputStreams().size() != 1) {
+        return nullptr;
+    }
+
+    input = filter->InputStreams()[0];
+    for(size_t s=0; s < video.Streams().size(); ++s) {
+        if(row_filter->RowFilterInputStream(s) >= input->Streams().size()) {
+            return nullptr;
+        }
+    }
+    return row_filter;
+}
+}
+
+FusedRowFilter::FusedRowFilter(VideoInterface& outer)
+    : source(nullptr)
+{
+    VideoInterface* video = &outer;
+    VideoInterface* input = nullptr;
+    while(VideoRowFilterInterface* filter = AsRowFilter(*video, input)) {
+        stages.push_back({video, filter});
+        video = input;
+    }
+    source = video;
+
+    for(size_t i=1; i < stages.size(); ++i) {
+        std::vector<std::unique_ptr<unsigned char[]>> stage_rows;
+        for(const StreamInfo& si : stages[i].video->Streams()) {
+            stage_rows.emplace_back(new unsigned char[si.Pitch()]);
+        }
+        rows.push_back(std::move(stage_rows));
+    }
+}
+
+bool FusedRowFilter::IsFused() const
+{
+    return stages.size() > 1;
+}
+
+void FusedRowFilter::Process(unsigned char* image, const unsigned char* src_image)
+{
+    const std::vector<StreamInfo>& out_streams = stages.front().video->Streams();
+    const size_t num_stages = stages.size();
+
+    // stream[i] is the output stream of stages[i] feeding the final stream
+    std::vector<size_t> stream(num_stages + 1);
+
+    for(size_t s=0; s < out_streams.size(); ++s) {
+        stream[0] = s;
+        for(size_t i=0; i < num_stages; ++i) {
+            stream[i+1] = stages[i].filter->RowFilterInputStream(stream[i]);
+        }
+
+        const Image<unsigned char> img_in = source->Streams()[stream[num_stages]].StreamImage(src_image);
+        Image<unsigned char> img_out = out_streams[s].StreamImage(image);
+
+        for(size_t y=0; y < img_out.h; ++y) {
+            // Trace the row back through each stage to the source row
+            size_t r = y;
+            for(size_t i=0; i < num_stages; ++i) {
+                r = stages[i].filter->RowFilterInputRow(stream[i], r);
+            }
+
+            // Push it forward through every stage, innermost first
+            const unsigned char* in_row = img_in.RowPtr((int)r);
+            for(size_t i=num_stages; i-- > 0; ) {
+                unsigned char* out_row = (i == 0) ? img_out.RowPtr((int)y) : rows[i-1][stream[i]].get();
+                stages[i].filter->RowFilterProcess(stream[i], out_row, in_row);
+                in_row = out_row;
+            }
+        }
+    }
+}
+
+bool FusedRowFilter::GrabNext(unsigned char* image, bool wait)
+{
+    const FrameLease in = GrabNextLease(*source, wait);
+    if(in) {
+        Process(image, in.data());
+    }
+    return in.IsValid();
+}
+
+bool FusedRowFilter::GrabNewest(unsigned char* image, bool wait)
+{
+    const FrameLease in = GrabNewestLease(*source, wait);
+    if(in) {
+        Process(image, in.data());
+    }
+    return in.IsValid();
+}
+
+}
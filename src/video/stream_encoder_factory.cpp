@@ -1,9 +1,19 @@
 #include <pangolin/video/stream_encoder_factory.h>
 
+#include <algorithm>
 #include <cctype>
+#include <fstream>
+#include <pangolin/image/image_io_exr.h>
+#include <pangolin/image/image_io_png.h>
+#include <pangolin/image/image_io_zstd.h>
+#include <pangolin/utils/base64.h>
 #include <pangolin/utils/file_utils.h>
 #include <pangolin/utils/type_convert.h>
 
+#ifdef HAVE_FFMPEG
+#  include <pangolin/video/drivers/ffmpeg_codec.h>
+#endif
+
 namespace pangolin {
 
 StreamEncoderFactory& StreamEncoderFactory::I()
@@ -17,25 +27,48 @@ struct EncoderDetails
     std::string encoder_name;
     ImageFileType file_type;
     float quality;
+    bool has_quality;
+    bool fast;
+    size_t threads;
+    std::string compression;
 };
 
+// codec[quality][:option]*, where options are 'fast', 'tN' for N threads
+// and, for exr, the compression scheme. e.g. jpg90, png:fast:t8, exr:piz:t4
 inline EncoderDetails EncoderDetailsFromString(const std::string& encoder_spec)
 {
-    std::string::const_reverse_iterator rit = encoder_spec.rbegin();
-    for(; std::isdigit(*rit) && rit != encoder_spec.rend(); ++rit );
+    const std::vector<std::string> parts = Split(encoder_spec, ':');
+    const std::string codec = parts.empty() ? std::string() : parts[0];
+
+    std::string::const_reverse_iterator rit = codec.rbegin();
+    for(; rit != codec.rend() && std::isdigit(*rit); ++rit );
 
     // png, tga, ...
-    std::string encoder_name(encoder_spec.begin(), rit.base());
+    std::string encoder_name(codec.begin(), rit.base());
     ToLower(encoder_name);
 
     // Quality of encoding for lossy encoders [0..100]
-    float quality = 100.0;
-    if(rit != encoder_spec.rbegin()) {
-        quality = pangolin::Convert<float,std::string>::Do(std::string(rit.base(),encoder_spec.end()));
+    EncoderDetails details = { encoder_name, NameToImageFileType(encoder_name), 100.0f, false, false, 1, "" };
+    if(rit != codec.rbegin()) {
+        details.quality = pangolin::Convert<float,std::string>::Do(std::string(rit.base(),codec.end()));
+        details.has_quality = true;
     }
 
+    for(size_t i=1; i < parts.size(); ++i) {
+        const std::string option = ToLowerCopy(parts[i]);
+        if(option == "fast") {
+            details.fast = true;
+        }else if(option.size() > 1 && option[0] == 't' && std::all_of(option.begin()+1, option.end(), ::isdigit)) {
+            details.threads = std::max<size_t>(1, pangolin::Convert<size_t,std::string>::Do(option.substr(1)));
+        }else if(details.file_type == ImageFileTypeExr) {
+            ExrCompressionFromString(option);
+            details.compression = option;
+        }else{
+            throw std::runtime_error("Unknown option '" + parts[i] + "' in encoder '" + encoder_spec + "'");
+        }
+    }
 
-    return { encoder_name, NameToImageFileType(encoder_name), quality};
+    return details;
 }
 
 ImageEncoderFunc StreamEncoderFactory::GetEncoder(const std::string& encoder_spec, const PixelFormat& fmt)
@@ -43,6 +76,26 @@ ImageEncoderFunc StreamEncoderFactory::GetEncoder(const std::string& encoder_spe
     const EncoderDetails encdet = EncoderDetailsFromString(encoder_spec);
     PANGO_ENSURE(encdet.file_type != ImageFileTypeUnknown);
 
+    if(encdet.file_type == ImageFileTypePng && (encdet.fast || encdet.threads > 1)) {
+        PngOptions options;
+        options.fast = encdet.fast;
+        options.threads = encdet.threads;
+        // Fast mode favours speed unless a level is asked for
+        options.compression_level = (encdet.fast && !encdet.has_quality) ? 1 : int(encdet.quality*0.09);
+        return [fmt,options](std::ostream& os, const Image<unsigned char>& img){
+            SavePng(img, fmt, os, true, options);
+        };
+    }
+
+    if(encdet.file_type == ImageFileTypeExr) {
+        ExrOptions options;
+        if(!encdet.compression.empty()) options.compression = ExrCompressionFromString(encdet.compression);
+        options.threads = encdet.threads > 1 ? encdet.threads : 0;
+        return [fmt,options](std::ostream& os, const Image<unsigned char>& img){
+            SaveExr(img, fmt, os, true, options);
+        };
+    }
+
     return [fmt,encdet](std::ostream& os, const Image<unsigned char>& img){
         SaveImage(img,fmt,os,encdet.file_type,true,encdet.quality);
     };
@@ -58,4 +111,139 @@ ImageDecoderFunc StreamEncoderFactory::GetDecoder(const std::string& encoder_spe
     };
 }
 
+ImageDecoderIntoFunc StreamEncoderFactory::GetDecoderInto(const std::string& encoder_spec, const PixelFormat& fmt)
+{
+    const EncoderDetails encdet = EncoderDetailsFromString(encoder_spec);
+    PANGO_ENSURE(encdet.file_type != ImageFileTypeUnknown);
+
+    return [fmt,encdet](std::istream& is, const Image<unsigned char>& dst){
+        LoadImageInto(is,encdet.file_type,dst,fmt);
+    };
+}
+
+inline ZstdOptions ZstdOptionsFromParams(const picojson::value& params)
+{
+    ZstdOptions options;
+    options.workers = (int)params.get_value<int64_t>("zstd_workers", 0);
+    if(params.contains("zstd_dictionary")) {
+        options.dictionary = std::make_shared<ZstdDictionary>(
+            Base64Decode(params["zstd_dictionary"].get<std::string>())
+        );
+    }
+    return options;
+}
+
+bool StreamEncoderFactory::IsInterFrame(const std::string& encoder_spec)
+{
+    const std::string name = ToLowerCopy(encoder_spec);
+    return name == "h264" || name == "h265" || name == "hevc" || name == "av1";
+}
+
+size_t StreamEncoderFactory::KeyframeInterval(const picojson::value& params)
+{
+    return (size_t)std::max<int64_t>(1, params.get_value<int64_t>("keyframe_interval", 30));
+}
+
+bool StreamEncoderFactory::IsAdaptive(const std::string& encoder_spec)
+{
+    return encoder_spec.find('|') != std::string::npos;
+}
+
+std::vector<std::string> StreamEncoderFactory::AdaptiveLevels(const std::string& encoder_spec)
+{
+    return Split(encoder_spec, '|');
+}
+
+ImageEncoderFunc StreamEncoderFactory::GetEncoder(const std::string& encoder_spec, const PixelFormat& fmt, const picojson::value& params)
+{
+    if(IsInterFrame(encoder_spec)) {
+#ifdef HAVE_FFMPEG
+        return FfmpegStreamEncoder(ToLowerCopy(encoder_spec), fmt, params);
+#else
+        throw std::runtime_error("Rebuild Pangolin with FFmpeg for '" + encoder_spec + "' streams.");
+#endif
+    }
+
+    const EncoderDetails encdet = EncoderDetailsFromString(encoder_spec);
+    PANGO_ENSURE(encdet.file_type != ImageFileTypeUnknown);
+
+    if(encdet.file_type == ImageFileTypeZstd) {
+        ZstdOptions options = ZstdOptionsFromParams(params);
+        if(encdet.threads > 1) options.workers = (int)encdet.threads;
+        return [fmt,encdet,options](std::ostream& os, const Image<unsigned char>& img){
+            SaveZstd(img, fmt, os, (int)encdet.quality, options);
+        };
+    }
+    return GetEncoder(encoder_spec, fmt);
+}
+
+// Streams written by RawFilesVideoOutput to files of their own, whose
+// packets hold the uint64 offset of the frame within the file
+inline ImageDecoderIntoFunc RawFileDecoder(const picojson::value& params)
+{
+    const std::string filename = params["file"].get<std::string>();
+    const size_t size_bytes = (size_t)params["size_bytes"].get<int64_t>();
+    auto file = std::make_shared<std::ifstream>(filename, std::ios::in | std::ios::binary);
+    if(!file->is_open()) {
+        throw std::runtime_error("Unable to open raw stream file '" + filename + "'");
+    }
+
+    return [file,filename,size_bytes](std::istream& is, const Image<unsigned char>& dst){
+        uint64_t offset = 0;
+        is.read(reinterpret_cast<char*>(&offset), sizeof(offset));
+        file->clear();
+        file->seekg((std::streamoff)offset);
+        file->read(reinterpret_cast<char*>(dst.ptr), size_bytes);
+        if((size_t)file->gcount() != size_bytes) {
+            throw std::runtime_error("Raw stream file '" + filename + "' is truncated");
+        }
+    };
+}
+
+// Adaptive streams, whose frames each start with the index of the level
+// they were encoded with
+inline ImageDecoderIntoFunc AdaptiveDecoder(const PixelFormat& fmt, const picojson::value& params)
+{
+    std::vector<ImageDecoderIntoFunc> levels;
+    for(const picojson::value& level : params["levels"].get<picojson::array>()) {
+        levels.push_back(StreamEncoderFactory::I().GetDecoderInto(level.get<std::string>(), fmt, params));
+    }
+
+    return [levels](std::istream& is, const Image<unsigned char>& dst){
+        const int level = is.get();
+        if(level < 0 || (size_t)level >= levels.size()) {
+            throw std::runtime_error("Adaptive stream frame has an unknown encoder level");
+        }
+        levels[level](is, dst);
+    };
+}
+
+ImageDecoderIntoFunc StreamEncoderFactory::GetDecoderInto(const std::string& encoder_spec, const PixelFormat& fmt, const picojson::value& params)
+{
+    if(encoder_spec == "raw_file") {
+        return RawFileDecoder(params);
+    }else if(encoder_spec == "adaptive") {
+        return AdaptiveDecoder(fmt, params);
+    }
+
+    if(IsInterFrame(encoder_spec)) {
+#ifdef HAVE_FFMPEG
+        return FfmpegStreamDecoder(ToLowerCopy(encoder_spec), fmt);
+#else
+        throw std::runtime_error("Rebuild Pangolin with FFmpeg for '" + encoder_spec + "' streams.");
+#endif
+    }
+
+    const EncoderDetails encdet = EncoderDetailsFromString(encoder_spec);
+    PANGO_ENSURE(encdet.file_type != ImageFileTypeUnknown);
+
+    if(encdet.file_type == ImageFileTypeZstd) {
+        const ZstdOptions options = ZstdOptionsFromParams(params);
+        return [fmt,options](std::istream& is, const Image<unsigned char>& dst){
+            LoadZstd(is, dst, fmt, options);
+        };
+    }
+    return GetDecoderInto(encoder_spec, fmt);
+}
+
 }
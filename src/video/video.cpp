@@ -28,7 +28,9 @@
 #include <pangolin/factory/factory_registry.h>
 #include <pangolin/video/video.h>
 #include <pangolin/video/video_output.h>
+#include <pangolin/video/video_source_pool.h>
 #include <pangolin/video_drivers.h>
+#include <pangolin/video_plugins.h>
 
 namespace pangolin
 {
@@ -43,7 +45,14 @@ std::unique_ptr<VideoInterface> OpenVideo(const std::string& str_uri)
 std::unique_ptr<VideoInterface> OpenVideo(const Uri& uri)
 {
     if(!one_time_init) {
-        one_time_init = LoadBuiltInVideoDrivers();
+        one_time_init = LoadBuiltInVideoDrivers() && LoadVideoPluginIndex();
+    }
+
+    // Drivers kept open across reconfiguration (see VideoInput::Reconfigure)
+    VideoSourcePool* pool = VideoSourcePool::Current();
+    if(pool) {
+        std::unique_ptr<VideoInterface> shared = pool->Reuse(uri);
+        if(shared) return shared;
     }
 
     std::unique_ptr<VideoInterface> video =
@@ -53,6 +62,10 @@ std::unique_ptr<VideoInterface> OpenVideo(const Uri& uri)
         throw VideoExceptionNoKnownHandler(uri.scheme);
     }
 
+    if(pool) {
+        video = pool->Share(uri, std::move(video));
+    }
+
     return video;
 }
 
@@ -64,7 +77,7 @@ std::unique_ptr<VideoOutputInterface> OpenVideoOutput(const std::string& str_uri
 std::unique_ptr<VideoOutputInterface> OpenVideoOutput(const Uri& uri)
 {
     if(!one_time_init) {
-        one_time_init = LoadBuiltInVideoDrivers();
+        one_time_init = LoadBuiltInVideoDrivers() && LoadVideoPluginIndex();
     }
 
     std::unique_ptr<VideoOutputInterface> video =
@@ -76,5 +89,40 @@ std::unique_ptr<VideoOutputInterface> OpenVideoOutput(const Uri& uri)
 
     return video;
 }
+#ifdef HAVE_CUDA
+namespace
+{
+void CUDART_CB ReleaseUploadedFrame(cudaStream_t, cudaError_t, void* user)
+{
+    // Only returns the frame to its driver, which makes no CUDA calls
+    delete (FrameLease*)user;
+}
+}
+
+bool UploadFrameAsync(const FrameLease& lease, unsigned char* device_image, cudaStream_t stream)
+{
+    if(!lease || !MemCopyAsync(device_image, lease.data(), lease.SizeBytes(), stream)) {
+        return false;
+    }
+
+    FrameLease* held = new FrameLease(lease);
+    if(cudaStreamAddCallback(stream, ReleaseUploadedFrame, held, 0) != cudaSuccess) {
+        // Can't tell when the copy completes, so wait for it here
+        cudaStreamSynchronize(stream);
+        delete held;
+    }
+    return true;
+}
+
+bool GrabNextAsync(VideoInterface& video, unsigned char* device_image, cudaStream_t stream, bool wait)
+{
+    return UploadFrameAsync(GrabNextLease(video, wait, FramePool::Pinned()), device_image, stream);
+}
+
+bool GrabNewestAsync(VideoInterface& video, unsigned char* device_image, cudaStream_t stream, bool wait)
+{
+    return UploadFrameAsync(GrabNewestLease(video, wait, FramePool::Pinned()), device_image, stream);
+}
+#endif
 
 }
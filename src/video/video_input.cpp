@@ -25,21 +25,43 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <pangolin/utils/memstreambuf.h>
+#include <pangolin/utils/timer.h>
 #include <pangolin/video/video_input.h>
 #include <pangolin/video/video_output.h>
 
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
 namespace pangolin
 {
 
+// Capture times further in the past are assumed not to be on the host clock
+const int64_t max_latency_us = 60 * 1000000;
+
+const int64_t no_schedule_us = std::numeric_limits<int64_t>::max();
+
 VideoInput::VideoInput()
-    : frame_num(0), record_frame_skip(1), record_once(false), record_continuous(false)
+    : frame_num(0), record_frame_skip(1), record_once(false), record_continuous(false),
+      pinned_memory(false), preroll_seconds(0.0), preroll_max_bytes(0), preroll_bytes(0),
+      record_max_queued(0), record_policy(RecordQueueDrop), record_quit(false), record_dropped(0),
+      schedule_pending(false), schedule_start_us(no_schedule_us), schedule_stop_us(no_schedule_us),
+      schedule_clock_offset_us(0), schedule_starting(false),
+      frames_grabbed(0), untimed_frames(0)
 {
 }
 
 VideoInput::VideoInput(
     const std::string& input_uri,
     const std::string& output_uri
-    ) : frame_num(0), record_frame_skip(1), record_once(false), record_continuous(false)
+    ) : frame_num(0), record_frame_skip(1), record_once(false), record_continuous(false),
+        pinned_memory(false), preroll_seconds(0.0), preroll_max_bytes(0), preroll_bytes(0),
+        record_max_queued(0), record_policy(RecordQueueDrop), record_quit(false), record_dropped(0),
+        schedule_pending(false), schedule_start_us(no_schedule_us), schedule_stop_us(no_schedule_us),
+        schedule_clock_offset_us(0), schedule_starting(false),
+        frames_grabbed(0), untimed_frames(0)
 {
     Open(input_uri, output_uri);
 }
@@ -57,22 +79,78 @@ void VideoInput::Open(
         uri_output.scheme = "pango";
     }
 
-    // Start off playing from video_src
-    video_src = OpenVideo(input_uri);
+    // Start off playing from video_src, pooling its drivers for Reconfigure()
+    {
+        VideoSourcePool::Scope scope(source_pool);
+        video_src = OpenVideo(input_uri);
+    }
 
     // Reset state
     frame_num = 0;
     videos.resize(1);
     videos[0] = video_src.get();
+    ClearPreRoll();
+    ResetStats();
 }
 
 void VideoInput::Close()
 {
     // Reset this first so that recording data gets written out to disk ASAP.
+    StopRecordThread();
+    video_recorder.reset();
+
+    video_src.reset();
+    source_pool.Clear();
+    videos.clear();
+    ClearPreRoll();
+
+    std::lock_guard<std::mutex> l(schedule_mutex);
+    schedule_start_us = no_schedule_us;
+    schedule_stop_us = no_schedule_us;
+    schedule_pending = false;
+}
+
+void VideoInput::Reconfigure(const std::string& input_uri)
+{
+    if(!video_src) {
+        Open(input_uri, uri_output.full_uri);
+        return;
+    }
+
+    // Streams may change under the recorder
+    StopRecordThread();
     video_recorder.reset();
+    record_continuous = false;
+    record_once = false;
 
+    // Tear down the current chain without stopping the drivers under it
+    const std::string previous_uri = uri_input.full_uri;
+    source_pool.Detach();
     video_src.reset();
     videos.clear();
+
+    try {
+        VideoSourcePool::Scope scope(source_pool);
+        video_src = OpenVideo(input_uri);
+        uri_input = ParseUri(input_uri);
+    }catch(...) {
+        source_pool.Detach();
+        {
+            VideoSourcePool::Scope scope(source_pool);
+            video_src = OpenVideo(previous_uri);
+        }
+        source_pool.Prune();
+        videos.assign(1, video_src.get());
+        throw;
+    }
+
+    // Close drivers the new chain doesn't use
+    source_pool.Prune();
+
+    frame_num = 0;
+    videos.assign(1, video_src.get());
+    ClearPreRoll();
+    ResetStats();
 }
 
 VideoInput::~VideoInput()
@@ -114,8 +192,18 @@ bool VideoInput::Grab( unsigned char* buffer, std::vector<Image<unsigned char> >
 
 void VideoInput::InitialiseRecorder()
 {
+    StopRecordThread();
     video_recorder.reset();
-    video_recorder = OpenVideoOutput(uri_output);
+
+    Uri uri = uri_output;
+    if(schedule_starting) {
+        std::lock_guard<std::mutex> l(schedule_mutex);
+        uri.Set("clock_offset_us", schedule_clock_offset_us);
+        if(!schedule_session.empty()) uri.Set("clock_session", schedule_session);
+        if(!schedule_node.empty()) uri.Set("clock_node", schedule_node);
+    }
+
+    video_recorder = OpenVideoOutput(uri);
     video_recorder->SetStreams(
         video_src->Streams(), uri_input.full_uri,
         GetVideoDeviceProperties(video_src.get())
@@ -130,11 +218,78 @@ void VideoInput::Record()
 
     // Initialise recorder and ensure src is started
     InitialiseRecorder();
+    WritePreRoll();
     video_src->Start();
     frame_num = 0;
     record_continuous = true;
 }
 
+void VideoInput::ScheduleRecording(int64_t start_us, int64_t stop_us, int64_t clock_offset_us, const std::string& session, const std::string& node)
+{
+    std::lock_guard<std::mutex> l(schedule_mutex);
+    schedule_start_us = start_us;
+    schedule_stop_us = stop_us;
+    schedule_clock_offset_us = clock_offset_us;
+    schedule_session = session;
+    schedule_node = node;
+    schedule_pending = true;
+}
+
+void VideoInput::ScheduleStop(int64_t stop_us)
+{
+    std::lock_guard<std::mutex> l(schedule_mutex);
+    schedule_stop_us = stop_us;
+    schedule_pending = true;
+}
+
+bool VideoInput::ScheduledRecord(const FrameMetadata& meta, int64_t now_us, bool should_record)
+{
+    if(!schedule_pending) return should_record;
+
+    // Frame time on the host clock, as for latency
+    int64_t frame_us = now_us;
+    if(meta.Has(FrameMetadata::CaptureTime) && std::abs(now_us - meta.capture_time_us) < max_latency_us) {
+        frame_us = meta.capture_time_us;
+    }else if(meta.Has(FrameMetadata::HostReceptionTime)) {
+        frame_us = meta.host_reception_time_us;
+    }
+
+    bool start = false;
+    bool stop = false;
+    {
+        std::lock_guard<std::mutex> l(schedule_mutex);
+        if(schedule_stop_us <= frame_us) {
+            // A start already past its stop is dropped with it
+            stop = true;
+            schedule_start_us = no_schedule_us;
+            schedule_stop_us = no_schedule_us;
+        }else if(schedule_start_us <= frame_us) {
+            start = true;
+            schedule_start_us = no_schedule_us;
+        }
+        schedule_pending = schedule_start_us != no_schedule_us || schedule_stop_us != no_schedule_us;
+    }
+
+    if(stop) {
+        StopRecordThread();
+        video_recorder.reset();
+        record_continuous = false;
+        record_once = false;
+        return false;
+    }else if(start) {
+        schedule_starting = true;
+        try {
+            Record();
+        }catch(...) {
+            schedule_starting = false;
+            throw;
+        }
+        schedule_starting = false;
+        return true;
+    }
+    return should_record;
+}
+
 void VideoInput::RecordOneFrame()
 {
     // Append to existing video.
@@ -168,6 +323,7 @@ void VideoInput::Start()
 void VideoInput::Stop()
 {
     if(IsRecording()) {
+        StopRecordThread();
         video_recorder.reset();
     }else{
         video_src->Stop();
@@ -182,9 +338,8 @@ bool VideoInput::GrabNext( unsigned char* image, bool wait )
 
     const bool success = video_src->GrabNext(image, wait);
 
-    if( should_record && video_recorder != 0 && success) {
-        video_recorder->WriteStreams(image, GetVideoFrameProperties(video_src.get()) );
-        record_once = false;
+    if(success) {
+        GrabbedFrame(image, should_record);
     }
 
     return success;
@@ -197,15 +352,51 @@ bool VideoInput::GrabNewest( unsigned char* image, bool wait )
     const bool should_record = (record_continuous && !(frame_num % record_frame_skip)) || record_once;
     const bool success = video_src->GrabNewest(image,wait);
 
-    if( should_record && video_recorder != 0 && success)
-    {
-        video_recorder->WriteStreams(image, GetVideoFrameProperties(video_src.get()) );
-        record_once = false;
+    if(success) {
+        GrabbedFrame(image, should_record);
     }
 
     return success;
 }
 
+FrameLease VideoInput::GrabNextLease( bool wait )
+{
+    frame_num++;
+
+    const bool should_record = (record_continuous && !(frame_num % record_frame_skip)) || record_once;
+    FrameLease lease = pangolin::GrabNextLease(*video_src, wait, LeasePool());
+
+    if(lease) {
+        GrabbedFrame(lease.data(), should_record, lease);
+    }
+
+    return lease;
+}
+
+FrameLease VideoInput::GrabNewestLease( bool wait )
+{
+    frame_num++;
+
+    const bool should_record = (record_continuous && !(frame_num % record_frame_skip)) || record_once;
+    FrameLease lease = pangolin::GrabNewestLease(*video_src, wait, LeasePool());
+
+    if(lease) {
+        GrabbedFrame(lease.data(), should_record, lease);
+    }
+
+    return lease;
+}
+
+void VideoInput::SetPinnedMemory(bool pinned)
+{
+    pinned_memory = pinned;
+}
+
+FramePool& VideoInput::LeasePool() const
+{
+    return pinned_memory ? FramePool::Pinned() : FramePool::I();
+}
+
 void VideoInput::SetTimelapse(size_t one_in_n_frames)
 {
     record_frame_skip = one_in_n_frames;
@@ -216,5 +407,290 @@ bool VideoInput::IsRecording() const
     return video_recorder != 0;
 }
 
+void VideoInput::GrabbedFrame(const unsigned char* image, bool grab_record, const FrameLease& lease)
+{
+    const int64_t now_us = TimeNow_us();
+    // Drivers with fixed layout metadata needn't build JSON properties at all
+    const bool typed = HasVideoFrameMetadata(video_src.get());
+    picojson::value props;
+    FrameMetadata meta;
+    if(typed) {
+        meta = GetVideoFrameMetadata(video_src.get());
+    }else{
+        props = GetVideoFrameProperties(video_src.get());
+        meta = FrameMetadata::FromJson(props);
+    }
+
+    int64_t latency = -1;
+    if(meta.Has(FrameMetadata::CaptureTime)) {
+        latency = now_us - meta.capture_time_us;
+    }else if(meta.Has(FrameMetadata::HostReceptionTime)) {
+        latency = now_us - meta.host_reception_time_us;
+    }
+
+    const bool should_record = ScheduledRecord(meta, now_us, grab_record);
+
+    {
+        std::lock_guard<std::mutex> l(stats_mutex);
+        ++frames_grabbed;
+        // Device clocks (and played back logs) give latencies way out
+        if(0 <= latency && latency < max_latency_us) {
+            latency_us.Add(latency);
+        }else{
+            ++untimed_frames;
+        }
+    }
+
+    if( should_record && video_recorder != 0) {
+        if(record_max_queued) {
+            QueueRecordFrame(image, lease, typed, meta, props);
+        }else if(typed) {
+            video_recorder->WriteStreams(image, meta);
+        }else{
+            video_recorder->WriteStreams(image, props);
+        }
+        record_once = false;
+    }else if(preroll_seconds > 0.0 && !record_continuous) {
+        HoldPreRoll(image, typed, meta, props, now_us);
+    }
+}
+
+void VideoInput::SetPreRoll(double seconds, size_t max_bytes, const std::string& encoder)
+{
+    if(!encoder.empty() && StreamEncoderFactory::IsInterFrame(encoder)) {
+        throw VideoException("VideoInput: Pre-roll drops its oldest frames, so needs an intra-frame encoder, not " + encoder);
+    }
+    ClearPreRoll();
+    preroll_seconds = seconds;
+    preroll_max_bytes = max_bytes;
+    preroll_encoder = encoder;
+}
+
+size_t VideoInput::PreRollFrames() const
+{
+    return preroll.size();
+}
+
+size_t VideoInput::PreRollBytes() const
+{
+    return preroll_bytes;
+}
+
+void VideoInput::ClearPreRoll()
+{
+    preroll.clear();
+    preroll_spare.clear();
+    preroll_encoders.clear();
+    preroll_decoders.clear();
+    preroll_bytes = 0;
+}
+
+void VideoInput::HoldPreRoll(const unsigned char* image, bool typed, const FrameMetadata& meta, const picojson::value& props, int64_t time_us)
+{
+    const std::vector<StreamInfo>& streams = video_src->Streams();
+    if(!preroll_encoder.empty() && preroll_encoders.size() != streams.size()) {
+        for(const StreamInfo& si : streams) {
+            preroll_encoders.push_back(StreamEncoderFactory::I().GetEncoder(preroll_encoder, si.PixFormat()));
+            preroll_decoders.push_back(StreamEncoderFactory::I().GetDecoderInto(preroll_encoder, si.PixFormat()));
+        }
+    }
+
+    PreRollFrame f;
+    f.time_us = time_us;
+    f.typed = typed;
+    if(typed) {
+        f.meta = meta;
+    }else{
+        f.props = props;
+    }
+    if(!preroll_spare.empty()) {
+        f.data = std::move(preroll_spare.back());
+        preroll_spare.pop_back();
+    }
+
+    if(preroll_encoders.empty()) {
+        f.data.assign(image, image + video_src->SizeBytes());
+    }else{
+        memstreambuf encoded(f.data.capacity());
+        std::ostream os(&encoded);
+        for(size_t s=0; s < streams.size(); ++s) {
+            const size_t start = encoded.size();
+            preroll_encoders[s](os, streams[s].StreamImage(image));
+            f.stream_bytes.push_back(encoded.size() - start);
+        }
+        f.data.assign(encoded.data(), encoded.data() + encoded.size());
+    }
+
+    preroll_bytes += f.data.size();
+    preroll.push_back(std::move(f));
+
+    const int64_t oldest_us = time_us - (int64_t)(preroll_seconds * 1e6);
+    while(!preroll.empty() && (preroll_bytes > preroll_max_bytes || preroll.front().time_us < oldest_us)) {
+        preroll_bytes -= preroll.front().data.size();
+        if(preroll_spare.size() < 2) {
+            preroll_spare.push_back(std::move(preroll.front().data));
+        }
+        preroll.pop_front();
+    }
+}
+
+void VideoInput::WritePreRoll()
+{
+    const std::vector<StreamInfo>& streams = video_src->Streams();
+    std::vector<unsigned char> decoded;
+
+    for(const PreRollFrame& f : preroll) {
+        const unsigned char* image = f.data.data();
+        if(!f.stream_bytes.empty()) {
+            decoded.resize(video_src->SizeBytes());
+            size_t offset = 0;
+            for(size_t s=0; s < streams.size(); ++s) {
+                memreadbuf buf(f.data.data() + offset, f.stream_bytes[s]);
+                std::istream is(&buf);
+                preroll_decoders[s](is, streams[s].StreamImage(decoded.data()));
+                offset += f.stream_bytes[s];
+            }
+            image = decoded.data();
+        }
+
+        if(f.typed) {
+            video_recorder->WriteStreams(image, f.meta);
+        }else{
+            video_recorder->WriteStreams(image, f.props);
+        }
+    }
+
+    preroll.clear();
+    preroll_bytes = 0;
+}
+
+void VideoInput::SetAsyncRecording(size_t max_queued, RecordQueuePolicy policy)
+{
+    // Writes must stay in order, so finish those queued before switching
+    StopRecordThread();
+    record_max_queued = max_queued;
+    record_policy = policy;
+}
+
+void VideoInput::QueueRecordFrame(const unsigned char* image, const FrameLease& lease, bool typed, const FrameMetadata& meta, const picojson::value& props)
+{
+    if(!record_thread.joinable()) {
+        record_quit = false;
+        record_thread = std::thread(&VideoInput::RecordThread, this);
+    }
+
+    {
+        std::unique_lock<std::mutex> l(record_mutex);
+        if(record_queue.size() >= record_max_queued) {
+            if(record_policy == RecordQueueDrop) {
+                ++record_dropped;
+                return;
+            }
+            record_cond.wait(l, [this](){ return record_queue.size() < record_max_queued; });
+        }
+    }
+
+    // Only this thread adds frames, so there is still room once copied
+    RecordFrame f;
+    if(lease) {
+        f.frame = lease;
+    }else{
+        const size_t size_bytes = video_src->SizeBytes();
+        std::shared_ptr<FramePool::Buffer> buffer = std::make_shared<FramePool::Buffer>(FramePool::I().Acquire(size_bytes));
+        std::memcpy(buffer->get(), image, size_bytes);
+        f.frame = FrameLease(buffer->get(), size_bytes, [buffer](){});
+    }
+    f.typed = typed;
+    if(typed) {
+        f.meta = meta;
+    }else{
+        f.props = props;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(record_mutex);
+        record_queue.push_back(std::move(f));
+    }
+    record_cond.notify_all();
+}
+
+void VideoInput::RecordThread()
+{
+    std::unique_lock<std::mutex> l(record_mutex);
+    while(true) {
+        record_cond.wait(l, [this](){ return record_quit || !record_queue.empty(); });
+        if(record_queue.empty()) {
+            // Asked to quit, and everything queued is written
+            return;
+        }
+
+        RecordFrame f = std::move(record_queue.front());
+        record_queue.pop_front();
+        l.unlock();
+        record_cond.notify_all();
+
+        try {
+            if(f.typed) {
+                video_recorder->WriteStreams(f.frame.data(), f.meta);
+            }else{
+                video_recorder->WriteStreams(f.frame.data(), f.props);
+            }
+        }catch(const std::exception& e) {
+            pango_print_error("VideoInput: Unable to record frame: %s\n", e.what());
+        }
+        f.frame.Release();
+
+        l.lock();
+    }
+}
+
+void VideoInput::StopRecordThread()
+{
+    if(record_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> l(record_mutex);
+            record_quit = true;
+        }
+        record_cond.notify_all();
+        record_thread.join();
+    }
+}
+
+VideoInputStats VideoInput::Stats() const
+{
+    VideoInputStats stats;
+    {
+        std::lock_guard<std::mutex> l(stats_mutex);
+        stats.frames = frames_grabbed;
+        stats.untimed_frames = untimed_frames;
+        stats.latency_us = latency_us;
+    }
+    {
+        std::lock_guard<std::mutex> l(record_mutex);
+        stats.record_queued = record_queue.size();
+        stats.record_dropped = record_dropped;
+    }
+
+    if(video_src) {
+        stats.stages = GetVideoStageStats(video_src.get());
+        for(const VideoStageStats& s : stats.stages) {
+            stats.dropped += s.dropped;
+            stats.overwritten += s.overwritten;
+            stats.rejected += s.rejected;
+        }
+    }
+    return stats;
+}
+
+void VideoInput::ResetStats()
+{
+    std::lock_guard<std::mutex> l(stats_mutex);
+    frames_grabbed = 0;
+    untimed_frames = 0;
+    latency_us.Clear();
+    std::lock_guard<std::mutex> lr(record_mutex);
+    record_dropped = 0;
+}
+
 }
 
@@ -84,6 +84,11 @@ int VideoOutput::WriteStreams(const unsigned char* data, const picojson::value&
     return recorder->WriteStreams(data, frame_properties);
 }
 
+int VideoOutput::WriteStreams(const unsigned char* data, const FrameMetadata& metadata)
+{
+    return recorder->WriteStreams(data, metadata);
+}
+
 bool VideoOutput::IsPipe() const
 {
     return recorder->IsPipe();
@@ -0,0 +1,136 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2018 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/video_plugin.h>
+#include <pangolin/factory/factory_registry.h>
+#include <pangolin/utils/file_utils.h>
+#include <pangolin/utils/log.h>
+#include <pangolin/utils/shared_library.h>
+#include <pangolin/video/video_interface.h>
+#include <pangolin/video/video_output_interface.h>
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+namespace pangolin
+{
+
+namespace
+{
+
+struct PluginState
+{
+    std::mutex mutex;
+    std::vector<std::string> paths;
+    // Never unloaded, since registered factories point into them
+    std::map<std::string, SharedLibrary> loaded;
+};
+
+PluginState& State()
+{
+    // Intentionally never destroyed, as above.
+    static PluginState* state = new PluginState();
+    return *state;
+}
+
+std::vector<std::string> SearchPaths(const std::vector<std::string>& added)
+{
+    std::vector<std::string> paths;
+    const char* env = std::getenv("PANGOLIN_PLUGIN_PATH");
+    if(env) {
+#ifdef _WIN_
+        const char sep = ';';
+#else
+        const char sep = ':';
+#endif
+        for(const std::string& p : Split(env, sep)) {
+            if(!p.empty()) paths.push_back(p);
+        }
+    }
+    paths.insert(paths.end(), added.begin(), added.end());
+    return paths;
+}
+
+typedef void (*PluginEntry)();
+
+}
+
+void AddVideoPluginPath(const std::string& dir)
+{
+    PluginState& state = State();
+    std::lock_guard<std::mutex> l(state.mutex);
+    state.paths.push_back(dir);
+}
+
+bool LoadVideoPlugin(const std::string& name)
+{
+    PluginState& state = State();
+    std::unique_lock<std::mutex> l(state.mutex);
+    if(state.loaded.count(name)) return true;
+
+    const std::string file = SharedLibrary::FileName(name);
+    std::vector<std::string> candidates;
+    for(const std::string& dir : SearchPaths(state.paths)) {
+        candidates.push_back(PathExpand(dir) + "/" + file);
+    }
+    candidates.push_back(file);
+
+    SharedLibrary lib;
+    std::string errors;
+    for(const std::string& path : candidates) {
+        if(lib.Open(path)) break;
+        errors += "\n  " + lib.Error();
+    }
+    if(!lib.IsOpen()) {
+        pango_print_warn("Unable to load video plugin '%s':%s\n", name.c_str(), errors.c_str());
+        return false;
+    }
+
+    PluginEntry entry = (PluginEntry)lib.Symbol("PangolinRegisterVideoPlugin");
+    if(!entry) {
+        pango_print_warn("'%s' is not a video plugin.\n", name.c_str());
+        return false;
+    }
+    state.loaded[name] = std::move(lib);
+
+    // Registration doesn't touch plugin state, but may in turn open video
+    l.unlock();
+    entry();
+    return true;
+}
+
+void RegisterVideoPlugin(const std::string& name, const std::vector<std::string>& schemes)
+{
+    const std::function<void()> load = [name](){ LoadVideoPlugin(name); };
+    for(const std::string& scheme : schemes) {
+        FactoryRegistry<VideoInterface>::I().RegisterLoader(scheme, load);
+        FactoryRegistry<VideoOutputInterface>::I().RegisterLoader(scheme, load);
+    }
+}
+
+}
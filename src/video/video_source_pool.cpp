@@ -0,0 +1,311 @@
+/* This file is part of the Pangolin Project.
+ * http://github.com/stevenlovegrove/Pangolin
+ *
+ * Copyright (c) 2014 Steven Lovegrove
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_source_pool.h>
+
+#include <type_traits>
+
+namespace pangolin
+{
+
+namespace
+{
+
+thread_local VideoSourcePool* current_pool = nullptr;
+
+// Interfaces of the driver which a view also offers, forwarded to it
+
+template<int N>
+struct NoInterface
+{
+    NoInterface(VideoInterface*) {}
+};
+
+struct ForwardLease : public VideoLeaseInterface
+{
+    ForwardLease(VideoInterface* video)
+        : vl(dynamic_cast<VideoLeaseInterface*>(video))
+    {
+    }
+
+    FrameLease GrabNextLease(bool wait) override
+    {
+        return vl->GrabNextLease(wait);
+    }
+
+    FrameLease GrabNewestLease(bool wait) override
+    {
+        return vl->GrabNewestLease(wait);
+    }
+
+    VideoLeaseInterface* vl;
+};
+
+struct ForwardBufferAware : public BufferAwareVideoInterface
+{
+    ForwardBufferAware(VideoInterface* video)
+        : ba(dynamic_cast<BufferAwareVideoInterface*>(video))
+    {
+    }
+
+    uint32_t AvailableFrames() const override
+    {
+        return ba->AvailableFrames();
+    }
+
+    bool DropNFrames(uint32_t n) override
+    {
+        return ba->DropNFrames(n);
+    }
+
+    BufferAwareVideoInterface* ba;
+};
+
+struct ForwardReadout : public VideoReadoutInterface
+{
+    ForwardReadout(VideoInterface* video)
+        : vr(dynamic_cast<VideoReadoutInterface*>(video))
+    {
+    }
+
+    VideoReadout SetReadout(const VideoReadout& readout) override
+    {
+        return vr->SetReadout(readout);
+    }
+
+    VideoReadout GetReadout() const override
+    {
+        return vr->GetReadout();
+    }
+
+    VideoReadoutInterface* vr;
+};
+
+struct SharedVideoBase
+{
+    virtual ~SharedVideoBase() {}
+    virtual VideoInterface* Driver() = 0;
+};
+
+// A chain's view of a pooled driver. As a filter over the driver, properties,
+// metadata, stage timings and the driver's other interfaces are found through
+// it as before.
+template<bool Lease, bool Aware, bool Readout>
+class SharedVideo
+    : public VideoInterface, public VideoFilterInterface, public SharedVideoBase,
+      public std::conditional<Lease, ForwardLease, NoInterface<0>>::type,
+      public std::conditional<Aware, ForwardBufferAware, NoInterface<1>>::type,
+      public std::conditional<Readout, ForwardReadout, NoInterface<2>>::type
+{
+public:
+    SharedVideo(const std::shared_ptr<VideoInterface>& video, const std::shared_ptr<bool>& detached)
+        : std::conditional<Lease, ForwardLease, NoInterface<0>>::type(video.get()),
+          std::conditional<Aware, ForwardBufferAware, NoInterface<1>>::type(video.get()),
+          std::conditional<Readout, ForwardReadout, NoInterface<2>>::type(video.get()),
+          video(video), detached(detached)
+    {
+        videoin.push_back(video.get());
+    }
+
+    size_t SizeBytes() const override
+    {
+        return video->SizeBytes();
+    }
+
+    const std::vector<StreamInfo>& Streams() const override
+    {
+        return video->Streams();
+    }
+
+    void Start() override
+    {
+        if(!*detached) video->Start();
+    }
+
+    void Stop() override
+    {
+        if(!*detached) video->Stop();
+    }
+
+    bool GrabNext(unsigned char* image, bool wait) override
+    {
+        return video->GrabNext(image, wait);
+    }
+
+    bool GrabNewest(unsigned char* image, bool wait) override
+    {
+        return video->GrabNewest(image, wait);
+    }
+
+    std::vector<VideoInterface*>& InputStreams() override
+    {
+        return videoin;
+    }
+
+    VideoInterface* Driver() override
+    {
+        return video.get();
+    }
+
+private:
+    std::shared_ptr<VideoInterface> video;
+    std::shared_ptr<bool> detached;
+    std::vector<VideoInterface*> videoin;
+};
+
+template<bool Lease, bool Aware, bool Readout>
+std::unique_ptr<VideoInterface> MakeView(const std::shared_ptr<VideoInterface>& video, const std::shared_ptr<bool>& detached)
+{
+    return std::unique_ptr<VideoInterface>(new SharedVideo<Lease, Aware, Readout>(video, detached));
+}
+
+bool SameReadout(const VideoReadout& a, const VideoReadout& b)
+{
+    return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h &&
+           a.binning == b.binning && a.decimation == b.decimation;
+}
+
+}
+
+VideoSourcePool::Scope::Scope(VideoSourcePool& pool)
+    : previous(current_pool)
+{
+    current_pool = &pool;
+}
+
+VideoSourcePool::Scope::~Scope()
+{
+    current_pool = previous;
+}
+
+VideoSourcePool::VideoSourcePool()
+    : detached(std::make_shared<bool>(false))
+{
+}
+
+VideoSourcePool::~VideoSourcePool()
+{
+    Clear();
+}
+
+std::unique_ptr<VideoInterface> VideoSourcePool::View(Entry& entry)
+{
+    typedef std::unique_ptr<VideoInterface> (*ViewMaker)(const std::shared_ptr<VideoInterface>&, const std::shared_ptr<bool>&);
+    static const ViewMaker makers[8] = {
+        MakeView<false, false, false>, MakeView<false, false, true>,
+        MakeView<false, true, false>,  MakeView<false, true, true>,
+        MakeView<true, false, false>,  MakeView<true, false, true>,
+        MakeView<true, true, false>,   MakeView<true, true, true>
+    };
+
+    VideoInterface* video = entry.video.get();
+    const int lease = dynamic_cast<VideoLeaseInterface*>(video) ? 4 : 0;
+    const int aware = dynamic_cast<BufferAwareVideoInterface*>(video) ? 2 : 0;
+    const int readout = entry.has_readout ? 1 : 0;
+
+    entry.claimed = true;
+    return makers[lease + aware + readout](entry.video, detached);
+}
+
+std::unique_ptr<VideoInterface> VideoSourcePool::Reuse(const Uri& uri)
+{
+    auto it = entries.find(uri.full_uri);
+    if(it == entries.end() || it->second.claimed) {
+        return std::unique_ptr<VideoInterface>();
+    }
+
+    Entry& entry = it->second;
+    if(entry.has_readout) {
+        // Undo readout asked for by filters of the previous chain
+        VideoReadoutInterface* vr = GetVideoReadoutInterface(*entry.video);
+        if(!SameReadout(vr->GetReadout(), entry.readout)) {
+            vr->SetReadout(entry.readout);
+        }
+    }
+    return View(entry);
+}
+
+std::unique_ptr<VideoInterface> VideoSourcePool::Share(const Uri& uri, std::unique_ptr<VideoInterface> video)
+{
+    if(!video || uri.full_uri.empty() || dynamic_cast<VideoFilterInterface*>(video.get()) ||
+       entries.count(uri.full_uri))
+    {
+        return video;
+    }
+
+    Entry& entry = entries[uri.full_uri];
+    entry.video = std::shared_ptr<VideoInterface>(std::move(video));
+    VideoReadoutInterface* vr = GetVideoReadoutInterface(*entry.video);
+    entry.has_readout = vr != nullptr;
+    if(vr) entry.readout = vr->GetReadout();
+    return View(entry);
+}
+
+void VideoSourcePool::Detach()
+{
+    *detached = true;
+    detached = std::make_shared<bool>(false);
+    for(auto& e : entries) {
+        e.second.claimed = false;
+    }
+}
+
+void VideoSourcePool::Prune()
+{
+    for(auto it = entries.begin(); it != entries.end(); ) {
+        if(it->second.video.use_count() == 1) {
+            it = entries.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+void VideoSourcePool::Clear()
+{
+    entries.clear();
+}
+
+size_t VideoSourcePool::Size() const
+{
+    return entries.size();
+}
+
+VideoSourcePool* VideoSourcePool::Current()
+{
+    return current_pool;
+}
+
+VideoInterface* VideoSourcePool::Driver(VideoInterface* video)
+{
+    SharedVideoBase* view = dynamic_cast<SharedVideoBase*>(video);
+    return view ? view->Driver() : nullptr;
+}
+
+}
@@ -0,0 +1,372 @@
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <pangolin/display/display.h>
+#include <pangolin/display/view.h>
+#include <pangolin/display/widgets/widgets.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/gldraw.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/gl/gltexturecache.h>
+#include <pangolin/image/managed_image.h>
+#include <pangolin/plot/plotter.h>
+#include <pangolin/scene/renderable.h>
+#include <pangolin/scene/scene_draw_list.h>
+#include <pangolin/utils/argagg.hpp>
+#include <pangolin/utils/picojson.h>
+#include <pangolin/var/var.h>
+
+using namespace std;
+using namespace pangolin;
+
+// Per frame cost of Pangolin's rendering paths: texture upload, plotting,
+// widget panels, scene graphs and cached texture blits. Best run on the
+// headless EGL backend (BUILD_PANGOLIN_EGL_HEADLESS), though any window
+// will do. Each case prints one JSON object per line to stdout, with the
+// CPU time spent issuing a frame and, where GL timer queries are
+// available, the GPU time spent drawing it.
+
+typedef chrono::steady_clock Clock;
+
+double Seconds(Clock::time_point a, Clock::time_point b)
+{
+    return chrono::duration<double>(b - a).count();
+}
+
+// GPU time of the commands between Begin() and End(), read back straight
+// away, since waiting doesn't matter here
+class GpuTimer
+{
+public:
+    GpuTimer()
+        : query(0)
+    {
+#ifndef HAVE_GLES
+        if(GLEW_ARB_timer_query) glGenQueries(1, &query);
+#endif
+    }
+
+    ~GpuTimer()
+    {
+#ifndef HAVE_GLES
+        if(query) glDeleteQueries(1, &query);
+#endif
+    }
+
+    bool Supported() const { return query != 0; }
+
+    void Begin()
+    {
+#ifndef HAVE_GLES
+        if(query) glBeginQuery(GL_TIME_ELAPSED, query);
+#endif
+    }
+
+    // Seconds, or 0 if unsupported
+    double End()
+    {
+#ifndef HAVE_GLES
+        if(query) {
+            glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            return 1e-9 * (double)ns;
+        }
+#endif
+        return 0.0;
+    }
+
+private:
+    GLuint query;
+};
+
+struct Config
+{
+    int w, h;
+    double min_seconds;
+};
+
+// Run frame until min_seconds of CPU time have passed, timing each frame
+// on the CPU up to the end of submission and on the GPU to completion.
+void Bench(const Config& c, picojson::value result, function<void()> frame, size_t bytes_per_frame = 0)
+{
+    try {
+        GpuTimer gpu;
+        frame();
+        glFinish();
+
+        double cpu_s = 0.0, gpu_s = 0.0;
+        size_t n = 0;
+        do {
+            gpu.Begin();
+            const Clock::time_point start = Clock::now();
+            frame();
+            cpu_s += Seconds(start, Clock::now());
+            gpu_s += gpu.End();
+            ++n;
+        }while(cpu_s + gpu_s < c.min_seconds || n < 3);
+        glFinish();
+
+        const GLenum err = glGetError();
+        if(err != GL_NO_ERROR) {
+            cerr << result.serialize() << ": GL error " << err << endl;
+            return;
+        }
+
+        result["frames"] = n;
+        result["cpu_ms"] = 1e3 * cpu_s / n;
+        result["gpu_ms"] = gpu.Supported() ? 1e3 * gpu_s / n : -1.0;
+        if(bytes_per_frame) {
+            const double s = max(cpu_s, gpu_s);
+            result["mb_per_s"] = bytes_per_frame * n / (s * 1024.0 * 1024.0);
+        }
+        cout << result.serialize() << endl;
+    }catch(const exception& e) {
+        cerr << result.serialize() << ": " << e.what() << endl;
+    }
+}
+
+ManagedImage<unsigned char> Pattern(size_t w, size_t h, size_t pixel_bytes)
+{
+    ManagedImage<unsigned char> img(w * pixel_bytes, h);
+    for(size_t y=0; y < h; ++y) {
+        unsigned char* row = img.RowPtr(y);
+        for(size_t x=0; x < w * pixel_bytes; ++x) row[x] = (unsigned char)(x ^ y);
+    }
+    return img;
+}
+
+void BenchUpload(const Config& c, int w, int h, const string& fmt_name)
+{
+    const PixelFormat pf = PixelFormatFromString(fmt_name);
+    const GlPixFormat fmt(pf);
+    const size_t pixel_bytes = pf.bpp / 8;
+    ManagedImage<unsigned char> img = Pattern(w, h, pixel_bytes);
+    GlTexture tex(w, h, fmt.scalable_internal_format, true, 0, fmt.glformat, fmt.gltype);
+
+    picojson::value result;
+    result["bench"] = "upload";
+    result["format"] = fmt_name;
+    result["width"] = w;
+    result["height"] = h;
+    Bench(c, result, [&]() {
+        tex.Upload(img.ptr, fmt.glformat, fmt.gltype);
+    }, w * h * pixel_bytes);
+}
+
+void BenchRenderToViewport(const Config& c, int w, int h, const string& fmt_name)
+{
+    const PixelFormat pf = PixelFormatFromString(fmt_name);
+    const GlPixFormat fmt(pf);
+    ManagedImage<unsigned char> img = Pattern(w, h, pf.bpp / 8);
+    Image<unsigned char> image(img.ptr, w * pf.bpp / 8, h, img.pitch);
+    image.w = w;
+
+    picojson::value result;
+    result["bench"] = "render_to_viewport";
+    result["format"] = fmt_name;
+    result["width"] = w;
+    result["height"] = h;
+    Bench(c, result, [&]() {
+        glViewport(0, 0, c.w, c.h);
+        RenderToViewport(image, fmt);
+    }, w * h * pf.bpp / 8);
+}
+
+void BenchPlotter(const Config& c, size_t series, size_t samples)
+{
+    DataLog log;
+    vector<float> vals(series);
+    for(size_t i=0; i < samples; ++i) {
+        for(size_t s=0; s < series; ++s) vals[s] = sin(0.01f * i + s);
+        log.Log(series, vals.data());
+    }
+
+    Plotter plotter(&log, 0.0f, (float)samples, -1.5f, 1.5f, samples / 10.0f, 0.5f);
+    plotter.SetBounds(0.0, 1.0, 0.0, 1.0);
+    plotter.Resize(Viewport(0, 0, c.w, c.h));
+
+    picojson::value result;
+    result["bench"] = "plotter";
+    result["series"] = series;
+    result["samples"] = samples;
+    Bench(c, result, [&]() { plotter.Render(); });
+}
+
+void BenchPanel(const Config& c, size_t num_vars)
+{
+    const string name = "bench" + to_string(num_vars);
+    vector<unique_ptr<Var<double>>> vars;
+    for(size_t i=0; i < num_vars; ++i) {
+        switch(i % 3) {
+        case 0: vars.emplace_back(new Var<double>(name + ".slider" + to_string(i), 0.5, 0.0, 1.0)); break;
+        case 1: vars.emplace_back(new Var<double>(name + ".value" + to_string(i), (double)i)); break;
+        default: Var<bool>(name + ".check" + to_string(i), false, true); break;   // lives on in VarState
+        }
+    }
+
+    View& panel = CreatePanel(name).SetBounds(0.0, 1.0, 0.0, Attach::Pix(180));
+    panel.Resize(Viewport(0, 0, c.w, c.h));
+
+    picojson::value result;
+    result["bench"] = "panel";
+    result["vars"] = num_vars;
+
+    // Rendered without the panel's cache, as after a change to any var
+    size_t frame = 0;
+    Bench(c, result, [&]() {
+        if(!vars.empty()) *vars.front() = (frame++ % 100) / 100.0;
+        panel.Render();
+    });
+
+    panel.Show(false);
+}
+
+// Scene node drawing a small triad, then its children
+struct BenchNode : public Renderable
+{
+    void Render(const RenderParams& params) override
+    {
+        glDrawAxis(0.1f);
+        RenderChildren(params);
+    }
+};
+
+void AddChildren(Renderable& node, size_t depth, size_t branching)
+{
+    if(depth == 0) return;
+    for(size_t i=0; i < branching; ++i) {
+        auto child = make_shared<BenchNode>();
+        child->T_pc = OpenGlMatrix::Translate((double)i - 0.5 * branching, 1.0, 0.0);
+        child->bounds = BoundingSphere(0, 0, 0, 0.2);
+        AddChildren(*child, depth - 1, branching);
+        node.Add(child);
+    }
+}
+
+void BenchScene(const Config& c, size_t depth, size_t branching, bool cull)
+{
+    Renderable root;
+    AddChildren(root, depth, branching);
+
+    OpenGlRenderState cam(
+        ProjectionMatrix(c.w, c.h, 420, 420, c.w / 2, c.h / 2, 0.1, 1000),
+        ModelViewLookAt(0, -2, 4, 0, 2, 0, AxisY)
+    );
+    RenderParams params;
+    if(cull) params.CullTo(cam);
+
+    size_t nodes = 0;
+    for(size_t d=1, n=branching; d <= depth; ++d, n *= branching) nodes += n;
+
+    picojson::value result;
+    result["bench"] = "scene";
+    result["nodes"] = nodes;
+    result["depth"] = depth;
+    result["cull"] = cull;
+    Bench(c, result, [&]() {
+        glViewport(0, 0, c.w, c.h);
+        cam.Apply();
+        root.Render(params);
+    });
+}
+
+// One scene drawn from several cameras, traversed per view or recorded
+// once per frame into a SceneDrawList and replayed per view
+void BenchSceneViews(const Config& c, size_t depth, size_t views, bool replay)
+{
+    Renderable root;
+    AddChildren(root, depth, 4);
+
+    vector<OpenGlRenderState> cams;
+    for(size_t i=0; i < views; ++i) {
+        const double a = 2.0 * M_PI * i / views;
+        cams.emplace_back(
+            ProjectionMatrix(c.w, c.h, 420, 420, c.w / 2, c.h / 2, 0.1, 1000),
+            ModelViewLookAt(4 * sin(a), -2, 4 * cos(a), 0, 2, 0, AxisY)
+        );
+    }
+
+    SceneDrawList draw_list;
+
+    picojson::value result;
+    result["bench"] = "scene_views";
+    result["depth"] = depth;
+    result["views"] = views;
+    result["replay"] = replay;
+    Bench(c, result, [&]() {
+        if(replay) draw_list.Record(root);
+        for(size_t i=0; i < views; ++i) {
+            const GLint w = c.w / (GLint)views;
+            glViewport((GLint)i * w, 0, w, c.h);
+            if(replay) {
+                draw_list.Replay(cams[i]);
+            }else{
+                cams[i].Apply();
+                root.Render();
+            }
+        }
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "seconds", {"-s", "--seconds"}, "Minimum time per case (default: 0.5)", 1},
+        { "quick", {"-q", "--quick"}, "Only run the smallest size of each case", 0},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+    if(args["help"]) {
+        cerr << "Usage: BenchGL [options]" << endl << argparser << endl;
+        return 0;
+    }
+
+    const Config c = {1280, 720, args["seconds"].as<double>(0.5)};
+    const bool quick = args["quick"];
+
+    CreateWindowAndBind("BenchGL", c.w, c.h);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    const vector<pair<int,int>> sizes = quick ? vector<pair<int,int>>{{640, 480}} :
+        vector<pair<int,int>>{{640, 480}, {1920, 1080}, {4096, 3072}};
+
+    for(const auto& sz : sizes) {
+        for(const char* fmt : {"GRAY8", "GRAY16LE", "RGB24", "RGBA32", "GRAY32F"}) {
+            BenchUpload(c, sz.first, sz.second, fmt);
+        }
+        for(const char* fmt : {"GRAY8", "RGB24"}) {
+            BenchRenderToViewport(c, sz.first, sz.second, fmt);
+        }
+    }
+
+    for(size_t series : {1, 8, 32}) {
+        for(size_t samples : quick ? vector<size_t>{1000} : vector<size_t>{1000, 100000, 1000000}) {
+            BenchPlotter(c, series, samples);
+        }
+    }
+
+    for(size_t vars : quick ? vector<size_t>{10} : vector<size_t>{10, 100, 1000}) {
+        BenchPanel(c, vars);
+    }
+
+    // branching 4: 4^depth leaves
+    for(size_t depth : quick ? vector<size_t>{3} : vector<size_t>{3, 5, 7}) {
+        for(bool cull : {false, true}) {
+            BenchScene(c, depth, 4, cull);
+        }
+    }
+
+    for(size_t views : {1, 4}) {
+        for(bool replay : {false, true}) {
+            BenchSceneViews(c, quick ? 3 : 5, views, replay);
+        }
+    }
+
+    return 0;
+}
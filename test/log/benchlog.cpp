@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <pangolin/log/packetstream_reader.h>
+#include <pangolin/log/packetstream_writer.h>
+#include <pangolin/utils/argagg.hpp>
+#include <pangolin/utils/timer.h>
+
+using namespace std;
+using namespace pangolin;
+
+// Throughput and latency of writing and reading packetstream logs. Each
+// case prints one JSON object per line to stdout, with progress on stderr.
+// Reads are mostly served from the page cache unless the log exceeds memory.
+
+typedef chrono::steady_clock Clock;
+
+double Seconds(Clock::time_point a, Clock::time_point b)
+{
+    return chrono::duration<double>(b - a).count();
+}
+
+double MB(double bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+void AddPercentiles(picojson::value& result, vector<double>& latency_us)
+{
+    if(latency_us.empty()) return;
+    sort(latency_us.begin(), latency_us.end());
+    auto at = [&](double p) { return latency_us[(size_t)(p * (latency_us.size() - 1))]; };
+    result["p50_us"] = at(0.5);
+    result["p90_us"] = at(0.9);
+    result["p99_us"] = at(0.99);
+    result["p999_us"] = at(0.999);
+    result["max_us"] = latency_us.back();
+}
+
+void Report(const picojson::value& result)
+{
+    cout << result.serialize() << endl;
+}
+
+// Each source is written from its own thread, as by a recorder with a
+// capture thread per device. Latency is that of WriteSourcePacket, which
+// blocks once the buffer is full.
+picojson::value BenchWrite(const string& filename, size_t packet_bytes, size_t num_sources, size_t buffer_mb, size_t total_bytes)
+{
+    const size_t packets = max<size_t>(1, total_bytes / packet_bytes / num_sources);
+    const vector<char> payload(packet_bytes, 'p');
+    vector<vector<double>> latency(num_sources, vector<double>(packets));
+
+    const Clock::time_point start = Clock::now();
+    PacketStreamWriter writer(filename, buffer_mb * 1024 * 1024);
+    vector<PacketStreamSourceId> ids;
+    for(size_t s = 0; s < num_sources; ++s) {
+        PacketStreamSource source;
+        source.driver = "benchlog";
+        source.uri = "benchlog://" + to_string(s);
+        ids.push_back(writer.AddSource(source));
+    }
+
+    vector<thread> threads;
+    for(size_t s = 0; s < num_sources; ++s) {
+        threads.emplace_back([&, s]() {
+            for(size_t i = 0; i < packets; ++i) {
+                const Clock::time_point t = Clock::now();
+                writer.WriteSourcePacket(ids[s], payload.data(), Time_us(TimeNow()), packet_bytes);
+                latency[s][i] = 1e6 * Seconds(t, Clock::now());
+            }
+        });
+    }
+    for(thread& t : threads) t.join();
+
+    const Clock::time_point accepted = Clock::now();
+    const threadedfilebuf::Stats stats = writer.BufferStats();
+    writer.Close();
+    const Clock::time_point end = Clock::now();
+
+    vector<double> all;
+    for(const vector<double>& l : latency) all.insert(all.end(), l.begin(), l.end());
+    const double bytes = (double)packet_bytes * packets * num_sources;
+
+    picojson::value result;
+    result["bench"] = "write";
+    result["packet_bytes"] = packet_bytes;
+    result["sources"] = num_sources;
+    result["buffer_mb"] = buffer_mb;
+    result["packets"] = packets * num_sources;
+    result["accept_mb_per_s"] = MB(bytes) / Seconds(start, accepted);
+    result["mb_per_s"] = MB(bytes) / Seconds(start, end);
+    result["blocked_writes"] = (double)stats.blocked_writes;
+    result["blocked_s"] = stats.blocked_s;
+    result["high_water_mb"] = MB((double)stats.high_water_bytes);
+    AddPercentiles(result, all);
+    return result;
+}
+
+// threadedfilebuf alone, without packet framing or the writer's lock
+picojson::value BenchFileBuf(const string& filename, size_t write_bytes, size_t buffer_mb, size_t total_bytes)
+{
+    const size_t writes = max<size_t>(1, total_bytes / write_bytes);
+    const vector<char> payload(write_bytes, 'b');
+    vector<double> latency(writes);
+
+    const Clock::time_point start = Clock::now();
+    threadedfilebuf buffer(filename, buffer_mb * 1024 * 1024);
+    for(size_t i = 0; i < writes; ++i) {
+        const Clock::time_point t = Clock::now();
+        buffer.sputn(payload.data(), (streamsize)write_bytes);
+        latency[i] = 1e6 * Seconds(t, Clock::now());
+    }
+    const Clock::time_point accepted = Clock::now();
+    const threadedfilebuf::Stats stats = buffer.stats();
+    buffer.close();
+    const Clock::time_point end = Clock::now();
+
+    const double bytes = (double)write_bytes * writes;
+
+    picojson::value result;
+    result["bench"] = "filebuf";
+    result["write_bytes"] = write_bytes;
+    result["buffer_mb"] = buffer_mb;
+    result["writes"] = writes;
+    result["accept_mb_per_s"] = MB(bytes) / Seconds(start, accepted);
+    result["mb_per_s"] = MB(bytes) / Seconds(start, end);
+    result["blocked_writes"] = (double)stats.blocked_writes;
+    result["blocked_s"] = stats.blocked_s;
+    AddPercentiles(result, latency);
+    return result;
+}
+
+size_t ReadPacket(Packet& packet, vector<char>& data)
+{
+    data.resize(packet.size);
+    if(const unsigned char* in_place = packet.Data()) {
+        copy(in_place, in_place + packet.size, data.begin());
+        return packet.size;
+    }
+    return packet.Stream().read(data.data(), packet.size);
+}
+
+// Opening (which loads the index), reading every packet in order, then
+// reading packets of the first source from random positions.
+picojson::value BenchRead(const string& filename, bool memory_map, size_t seeks)
+{
+    vector<char> data;
+
+    Clock::time_point t = Clock::now();
+    PacketStreamReader reader(filename);
+    const double open_s = Seconds(t, Clock::now());
+    if(memory_map && !reader.MemoryMap()) {
+        return picojson::value();
+    }
+
+    t = Clock::now();
+    size_t packets = 0;
+    double bytes = 0;
+    try {
+        for(;;) {
+            Packet packet = reader.NextFrame();
+            bytes += ReadPacket(packet, data);
+            ++packets;
+        }
+    }catch(const runtime_error&) {
+        // end of stream
+    }
+    const double sequential_s = Seconds(t, Clock::now());
+
+    vector<double> latency;
+    const size_t frames = reader.Sources().empty() ? 0 : reader.Sources()[0].index.size();
+    if(frames) {
+        mt19937 rng(0);
+        uniform_int_distribution<size_t> frame(0, frames - 1);
+        latency.resize(seeks);
+        t = Clock::now();
+        for(size_t i = 0; i < seeks; ++i) {
+            const Clock::time_point s = Clock::now();
+            reader.Seek(0, frame(rng));
+            Packet packet = reader.NextFrame(0);
+            ReadPacket(packet, data);
+            latency[i] = 1e6 * Seconds(s, Clock::now());
+        }
+    }
+    const double random_s = Seconds(t, Clock::now());
+
+    picojson::value result;
+    result["bench"] = "read";
+    result["memory_mapped"] = memory_map;
+    result["packets"] = packets;
+    result["open_ms"] = 1e3 * open_s;
+    result["sequential_mb_per_s"] = MB(bytes) / sequential_s;
+    result["sequential_packets_per_s"] = packets / sequential_s;
+    if(frames) {
+        result["random_packets_per_s"] = seeks / random_s;
+        AddPercentiles(result, latency);
+    }
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "dir", {"-d", "--dir"}, "Directory to write logs to (default: '.')", 1},
+        { "mb", {"-m", "--mb"}, "MB written per case (default: 256)", 1},
+        { "seeks", {"-s", "--seeks"}, "Random reads per read case (default: 1000)", 1},
+        { "quick", {"-q", "--quick"}, "Run fewer packet sizes, source counts and buffer sizes", 0},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+    if(args["help"]) {
+        cerr << "Usage: BenchLog [options]" << endl << argparser << endl;
+        return 0;
+    }
+
+    const string filename = args["dir"].as<string>(".") + "/benchlog.pango";
+    const size_t total_bytes = args["mb"].as<size_t>(256) * 1024 * 1024;
+    const size_t seeks = args["seeks"].as<size_t>(1000);
+    const bool quick = args["quick"];
+
+    const vector<size_t> packet_sizes = quick ? vector<size_t>{4096, 1 << 20} : vector<size_t>{256, 4096, 64 << 10, 1 << 20, 8 << 20};
+    const vector<size_t> source_counts = quick ? vector<size_t>{1} : vector<size_t>{1, 4};
+    const vector<size_t> buffer_sizes_mb = quick ? vector<size_t>{100} : vector<size_t>{16, 100};
+
+    for(size_t buffer_mb : buffer_sizes_mb) {
+        for(size_t packet_bytes : packet_sizes) {
+            cerr << "filebuf: " << packet_bytes << " byte writes, " << buffer_mb << "MB buffer" << endl;
+            Report(BenchFileBuf(filename, packet_bytes, buffer_mb, total_bytes));
+        }
+    }
+
+    for(size_t buffer_mb : buffer_sizes_mb) {
+        for(size_t num_sources : source_counts) {
+            for(size_t packet_bytes : packet_sizes) {
+                cerr << "write: " << packet_bytes << " byte packets, " << num_sources << " sources, " << buffer_mb << "MB buffer" << endl;
+                picojson::value result = BenchWrite(filename, packet_bytes, num_sources, buffer_mb, total_bytes);
+                Report(result);
+
+                // Read back each log written with the largest buffer
+                if(buffer_mb == buffer_sizes_mb.back()) {
+                    for(bool memory_map : {false, true}) {
+                        cerr << "read: " << packet_bytes << " byte packets, " << num_sources << " sources" << (memory_map ? ", mapped" : "") << endl;
+                        picojson::value read = BenchRead(filename, memory_map, seeks);
+                        if(read.is<picojson::object>()) {
+                            read["packet_bytes"] = packet_bytes;
+                            read["sources"] = num_sources;
+                            Report(read);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    remove(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <pangolin/utils/argagg.hpp>
+#include <pangolin/video/drivers/debayer.h>
+#include <pangolin/video/drivers/merge.h>
+#include <pangolin/video/drivers/mirror.h>
+#include <pangolin/video/drivers/shift.h>
+#include <pangolin/video/drivers/unpack.h>
+#include <pangolin/video/drivers/convert.h>
+#include <pangolin/video/drivers/scale.h>
+#include <pangolin/video/drivers/rectify.h>
+#include <pangolin/video/stream_encoder_factory.h>
+#include <pangolin/video/video.h>
+
+using namespace std;
+using namespace pangolin;
+
+// Throughput of the per-pixel video filters and stream codecs over frames
+// from the test: driver. Each case prints one JSON object per line to
+// stdout, with MB/s of input and ns per input pixel.
+
+typedef chrono::steady_clock Clock;
+
+double Seconds(Clock::time_point a, Clock::time_point b)
+{
+    return chrono::duration<double>(b - a).count();
+}
+
+// Hands out one frame from the test: driver, copying it only when the
+// destination changes, so that timings are of the filter alone.
+class StillVideo : public VideoInterface
+{
+public:
+    StillVideo(const string& test_uri)
+        : src(OpenVideo(test_uri)), frame(src->SizeBytes()), last(nullptr)
+    {
+        src->Start();
+        src->GrabNext(frame.data(), true);
+        src->Stop();
+    }
+
+    size_t SizeBytes() const override { return frame.size(); }
+    const vector<StreamInfo>& Streams() const override { return src->Streams(); }
+    void Start() override {}
+    void Stop() override {}
+
+    bool GrabNext(unsigned char* image, bool) override
+    {
+        if(image != last) {
+            memcpy(image, frame.data(), frame.size());
+            last = image;
+        }
+        return true;
+    }
+
+    bool GrabNewest(unsigned char* image, bool wait) override
+    {
+        return GrabNext(image, wait);
+    }
+
+    const unsigned char* Frame() const { return frame.data(); }
+
+private:
+    unique_ptr<VideoInterface> src;
+    vector<unsigned char> frame;
+    unsigned char* last;
+};
+
+struct Config
+{
+    size_t w, h;
+    double min_seconds;
+};
+
+string TestUri(const Config& c, const string& fmt, const string& extra = "")
+{
+    return "test:[size=" + to_string(c.w) + "x" + to_string(c.h) + ",fmt=" + fmt + ",realtime=0" + extra + "]//";
+}
+
+void Report(picojson::value result, const Config& c, const string& fmt, size_t bytes, size_t pixels, size_t frames, double seconds)
+{
+    result["width"] = c.w;
+    result["height"] = c.h;
+    result["format"] = fmt;
+    result["frames"] = frames;
+    result["mb_per_s"] = bytes * frames / (seconds * 1024.0 * 1024.0);
+    result["ns_per_pixel"] = 1e9 * seconds / ((double)pixels * frames);
+    cout << result.serialize() << endl;
+}
+
+template<typename F>
+size_t Repeat(double min_seconds, double& seconds, F f)
+{
+    f();
+    size_t n = 0;
+    const Clock::time_point start = Clock::now();
+    do {
+        f();
+        ++n;
+        seconds = Seconds(start, Clock::now());
+    }while(seconds < min_seconds || n < 3);
+    return n;
+}
+
+void BenchFilter(const Config& c, const string& filter, const string& method, const string& fmt, size_t threads,
+                 function<unique_ptr<VideoInterface>(unique_ptr<VideoInterface>&)> make, const string& extra = "")
+{
+    try {
+        unique_ptr<VideoInterface> src(new StillVideo(TestUri(c, fmt, extra)));
+        const size_t bytes = src->SizeBytes();
+        size_t pixels = 0;
+        for(const StreamInfo& si : src->Streams()) pixels += si.Width() * si.Height();
+
+        unique_ptr<VideoInterface> video = make(src);
+        vector<unsigned char> out(video->SizeBytes());
+        video->Start();
+        double seconds = 0;
+        const size_t frames = Repeat(c.min_seconds, seconds, [&]() { video->GrabNext(out.data(), true); });
+        video->Stop();
+
+        picojson::value result;
+        result["bench"] = filter;
+        result["method"] = method;
+        result["threads"] = threads;
+        Report(result, c, fmt, bytes, pixels, frames, seconds);
+    }catch(const exception& e) {
+        cerr << filter << " " << method << " " << fmt << ": " << e.what() << endl;
+    }
+}
+
+void BenchCodec(const Config& c, const string& codec, const string& fmt)
+{
+    try {
+        StillVideo src(TestUri(c, fmt, ",pattern=gradient"));
+        const StreamInfo& si = src.Streams()[0];
+        const Image<unsigned char> image((unsigned char*)src.Frame(), si.Width(), si.Height(), si.Pitch());
+        const size_t bytes = si.SizeBytes();
+        const size_t pixels = si.Width() * si.Height();
+
+        ImageEncoderFunc encoder = StreamEncoderFactory::I().GetEncoder(codec, si.PixFormat());
+        ImageDecoderIntoFunc decoder = StreamEncoderFactory::I().GetDecoderInto(codec, si.PixFormat());
+
+        string encoded;
+        double seconds = 0;
+        size_t frames = Repeat(c.min_seconds, seconds, [&]() {
+            ostringstream os;
+            encoder(os, image);
+            encoded = os.str();
+        });
+
+        picojson::value result;
+        result["bench"] = "encode";
+        result["method"] = codec;
+        result["ratio"] = (double)bytes / encoded.size();
+        Report(result, c, fmt, bytes, pixels, frames, seconds);
+
+        vector<unsigned char> decoded(bytes);
+        const Image<unsigned char> out(decoded.data(), si.Width(), si.Height(), si.Pitch());
+        frames = Repeat(c.min_seconds, seconds, [&]() {
+            istringstream is(encoded);
+            decoder(is, out);
+        });
+        result["bench"] = "decode";
+        Report(result, c, fmt, bytes, pixels, frames, seconds);
+    }catch(const exception& e) {
+        cerr << codec << " " << fmt << ": " << e.what() << endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "seconds", {"-s", "--seconds"}, "Minimum time per case (default: 0.5)", 1},
+        { "quick", {"-q", "--quick"}, "Only run at 1920x1080", 0},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+    if(args["help"]) {
+        cerr << "Usage: BenchVideo [options]" << endl << argparser << endl;
+        return 0;
+    }
+
+    const double min_seconds = args["seconds"].as<double>(0.5);
+    vector<Config> configs = {{1920, 1080, min_seconds}};
+    if(!args["quick"]) {
+        configs.insert(configs.begin(), {640, 480, min_seconds});
+        configs.push_back({4096, 3072, min_seconds});
+    }
+
+    const size_t hw = max(1u, thread::hardware_concurrency());
+    const vector<size_t> thread_counts = hw > 1 ? vector<size_t>{1, hw} : vector<size_t>{1};
+
+    for(const Config& c : configs) {
+        cerr << "Frames of " << c.w << "x" << c.h << endl;
+
+        for(const char* fmt : {"GRAY10", "GRAY12"}) {
+            for(size_t threads : thread_counts) {
+                BenchFilter(c, "unpack", "GRAY16LE", fmt, threads, [&](unique_ptr<VideoInterface>& src) {
+                    return unique_ptr<VideoInterface>(new UnpackVideo(src, PixelFormatFromString("GRAY16LE"), threads));
+                });
+            }
+        }
+
+        for(const char* method : {"downsample", "mono", "nearest", "simple", "bilinear", "hqlinear", "edgesense", "linear", "edgeaware"}) {
+            for(const char* fmt : {"GRAY8", "GRAY16LE"}) {
+                for(size_t threads : thread_counts) {
+                    BenchFilter(c, "debayer", method, fmt, threads, [&](unique_ptr<VideoInterface>& src) {
+                        const vector<bayer_method_t> methods(1, DebayerVideo::BayerMethodFromString(method));
+                        return unique_ptr<VideoInterface>(new DebayerVideo(src, methods, DC1394_COLOR_FILTER_RGGB, threads));
+                    }, ",bayer=rggb");
+                }
+            }
+        }
+
+        const vector<pair<const char*, const char*>> conversions = {
+            {"YUYV422", "RGB24"}, {"YUYV422", "RGBA32"}, {"YUYV422", "GRAY8"},
+            {"RGB24", "BGRA32"}, {"GRAY16LE", "GRAY32F"}
+        };
+        for(const auto& conv : conversions) {
+            for(size_t threads : thread_counts) {
+                BenchFilter(c, "convert", conv.second, conv.first, threads, [&](unique_ptr<VideoInterface>& src) {
+                    return unique_ptr<VideoInterface>(new ConvertVideo(src, PixelFormatFromString(conv.second), 1.0f, threads));
+                });
+            }
+        }
+
+        for(const char* method : {"area", "bilinear"}) {
+            for(const char* fmt : {"GRAY8", "RGB24", "YUYV422"}) {
+                for(size_t threads : thread_counts) {
+                    BenchFilter(c, "scale", method, fmt, threads, [&](unique_ptr<VideoInterface>& src) {
+                        return unique_ptr<VideoInterface>(new ScaleVideo(src, c.w / 2, c.h / 2, ResizeMethodFromString(method), threads));
+                    });
+                }
+            }
+        }
+
+        for(const char* fmt : {"GRAY8", "RGB24", "GRAY16LE"}) {
+            for(size_t threads : thread_counts) {
+                BenchFilter(c, "rectify", "radtan", fmt, threads, [&](unique_ptr<VideoInterface>& src) {
+                    CameraCalibration calib;
+                    calib.fx = calib.fy = 0.8 * c.w;
+                    calib.cx = 0.5 * c.w;
+                    calib.cy = 0.5 * c.h;
+                    calib.model = CameraCalibration::DistortionRadTan;
+                    calib.dist[0] = -0.28;
+                    calib.dist[1] = 0.07;
+                    return unique_ptr<VideoInterface>(new RectifyVideo(src, {calib}, 1.0, threads));
+                });
+            }
+        }
+
+        BenchFilter(c, "shift", "GRAY8", "GRAY16LE", 1, [](unique_ptr<VideoInterface>& src) {
+            return unique_ptr<VideoInterface>(new ShiftVideo(src, PixelFormatFromString("GRAY8"), 8));
+        });
+
+        for(const char* mode : {"linear", "gamma", "equalize"}) {
+            BenchFilter(c, "shift", mode, "GRAY16LE", 1, [&](unique_ptr<VideoInterface>& src) {
+                ShiftOptions options;
+                options.mode = ShiftVideo::ShiftModeFromString(mode);
+                options.auto_range = true;
+                return unique_ptr<VideoInterface>(new ShiftVideo(src, PixelFormatFromString("GRAY8"), options));
+            });
+        }
+
+        const vector<pair<string, MirrorOptions>> flips = {
+            {"flipx", MirrorOptionsFlipX}, {"flipy", MirrorOptionsFlipY}, {"flipxy", MirrorOptionsFlipXY},
+            {"transpose", MirrorOptionsTranspose}, {"rotate90", MirrorOptionsRotate90}, {"rotate270", MirrorOptionsRotate270}
+        };
+        for(const auto& flip : flips) {
+            for(const char* fmt : {"GRAY8", "GRAY16LE", "RGB24", "RGBA32"}) {
+                BenchFilter(c, "mirror", flip.first, fmt, 1, [&](unique_ptr<VideoInterface>& src) {
+                    return unique_ptr<VideoInterface>(new MirrorVideo(src, vector<MirrorOptions>(1, flip.second)));
+                });
+            }
+        }
+
+        for(const char* fmt : {"GRAY8", "RGB24"}) {
+            BenchFilter(c, "merge", "side_by_side", fmt, 1, [&](unique_ptr<VideoInterface>& src) {
+                const vector<Point> pos = {Point(0, 0), Point(c.w, 0)};
+                return unique_ptr<VideoInterface>(new MergeVideo(src, pos, 2 * c.w, c.h));
+            }, ",n=2");
+        }
+
+        for(const char* codec : {"ppm", "tga", "png", "png:fast", "jpg90", "zstd", "exr", "h264"}) {
+            for(const char* fmt : {"GRAY8", "GRAY16LE", "RGB24"}) {
+                BenchCodec(c, codec, fmt);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,25 @@
+#include <pangolin/video/drivers/images.h>
+
+#include <iostream>
+
+// Pack an image sequence into a single uncompressed tar, led by an index of
+// each channel's members so that tar:// opens it without scanning. Any tar
+// reader can still unpack it.
+int main(int argc, char* argv[])
+{
+    if(argc != 3) {
+        std::cerr << "Usage: ImageArchive <images wildcard> <archive.tar>" << std::endl;
+        std::cerr << "  e.g. ImageArchive \"~/data/dataset/img_[left,right]_*.png\" ~/data/dataset.tar" << std::endl;
+        return 1;
+    }
+
+    try {
+        const size_t frames = pangolin::WriteImageArchive(argv[1], argv[2]);
+        std::cout << "Wrote " << frames << " frames to " << argv[2] << std::endl;
+    }catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
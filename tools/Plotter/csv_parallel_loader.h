@@ -0,0 +1,178 @@
+#pragma once
+
+#include <pangolin/plot/datalog.h>
+#include <pangolin/utils/memory_mapped_file.h>
+#include <pangolin/utils/parallel_for.h>
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "csv_parse.h"
+
+// Loads whole CSV files into a DataLog, memory mapping them and parsing
+// chunks of rows on all cores. Files are joined column-wise, as by
+// CsvStreamLoader, which remains for pipes such as stdin.
+class CsvParallelLoader
+{
+public:
+    CsvParallelLoader(const std::vector<std::string>& csv_files, char delim = ',')
+        : delim(delim)
+    {
+        for(const auto& f : csv_files) {
+            std::unique_ptr<File> file(new File);
+            if(f != "-" && file->map.Open(f)) {
+                file->pos = (const char*)file->map.data();
+                file->end = file->pos + file->map.size();
+                file->map.AdviseSequential();
+            }
+            files.push_back(std::move(file));
+        }
+    }
+
+    // False if any file can't be mapped, for instance if it is a pipe
+    bool IsOpen() const
+    {
+        for(const auto& f : files) {
+            if(!f->map.IsOpen()) return false;
+        }
+        return !files.empty();
+    }
+
+    bool ReadHeader(std::vector<std::string>& labels)
+    {
+        labels.clear();
+        for(auto& f : files) {
+            if(f->pos == f->end) return false;
+            const char* eol = CsvEndOfLine(f->pos, f->end);
+            CsvForEachCell(f->pos, eol, delim, [&](const char* c, const char* e){
+                labels.emplace_back(c, e);
+            });
+            f->pos = CsvNextLine(eol, f->end);
+        }
+        return true;
+    }
+
+    bool SkipStreamRows(const std::vector<size_t>& rows_to_skip)
+    {
+        if(rows_to_skip.size()) {
+            PANGO_ASSERT(rows_to_skip.size() == files.size());
+            for(size_t i=0; i < files.size(); ++i) {
+                for(size_t r=0; r < rows_to_skip[i]; ++r) {
+                    if(files[i]->pos == files[i]->end) return false;
+                    files[i]->pos = CsvNextLine(CsvEndOfLine(files[i]->pos, files[i]->end), files[i]->end);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Parse all remaining rows into log, until keep_loading is cleared.
+    void Load(pangolin::DataLog& log, const bool& keep_loading)
+    {
+        const size_t tasks = pangolin::ParallelConcurrency();
+        std::vector<float> batch;
+        size_t batch_width = 0;
+
+        while(keep_loading) {
+            // Parse the next few chunks of each file at once
+            std::vector<Job> jobs;
+            for(size_t i=0; i < files.size(); ++i) {
+                File& f = *files[i];
+                for(size_t t=0; t < tasks && f.pos != f.end; ++t) {
+                    const char* chunk_end = f.end;
+                    if((size_t)(f.end - f.pos) > chunk_bytes) {
+                        chunk_end = CsvNextLine(CsvEndOfLine(f.pos + chunk_bytes, f.end), f.end);
+                    }
+                    jobs.push_back(Job{i, f.pos, chunk_end, CsvChunk()});
+                    f.pos = chunk_end;
+                }
+            }
+
+            std::atomic<size_t> bad_cells(0);
+            pangolin::ParallelFor(0, jobs.size(), jobs.size(), [&](size_t b, size_t e){
+                for(size_t j=b; j < e; ++j) {
+                    bad_cells += CsvParseRows(jobs[j].begin, jobs[j].end, delim, jobs[j].chunk);
+                }
+            });
+            if(bad_cells) {
+                std::cerr << "Warning: couldn't parse " << bad_cells << " cells as numeric data (use -H option to include header)" << std::endl;
+            }
+            for(Job& j : jobs) {
+                files[j.file]->pending.push_back(std::move(j.chunk));
+            }
+
+            // Join rows across files, logging runs of equal width together
+            std::vector<float> row;
+            while(NextRow(row)) {
+                if(row.size() != batch_width || batch.size() >= batch_floats) {
+                    Flush(log, batch, batch_width);
+                    batch_width = row.size();
+                }
+                batch.insert(batch.end(), row.begin(), row.end());
+            }
+            Flush(log, batch, batch_width);
+
+            // Rows stop with the shortest file
+            bool finished = jobs.empty();
+            for(const auto& f : files) {
+                finished = finished || (f->pos == f->end && f->pending.empty());
+            }
+            if(finished) break;
+        }
+    }
+
+private:
+    static const size_t chunk_bytes = 4 << 20;
+    static const size_t batch_floats = 1 << 20;
+
+    struct File
+    {
+        pangolin::MemoryMappedFile map;
+        const char* pos = nullptr;
+        const char* end = nullptr;
+        std::deque<CsvChunk> pending;
+    };
+
+    struct Job
+    {
+        size_t file;
+        const char* begin;
+        const char* end;
+        CsvChunk chunk;
+    };
+
+    bool NextRow(std::vector<float>& row)
+    {
+        for(auto& f : files) {
+            while(!f->pending.empty() && f->pending.front().row == f->pending.front().widths.size()) {
+                f->pending.pop_front();
+            }
+            if(f->pending.empty()) return false;
+        }
+
+        row.clear();
+        for(auto& f : files) {
+            CsvChunk& c = f->pending.front();
+            const float* v = c.values.data() + c.value;
+            row.insert(row.end(), v, v + c.widths[c.row]);
+            c.value += c.widths[c.row];
+            ++c.row;
+        }
+        return true;
+    }
+
+    static void Flush(pangolin::DataLog& log, std::vector<float>& batch, size_t width)
+    {
+        if(width && batch.size()) {
+            log.Log(width, batch.data(), (unsigned int)(batch.size() / width));
+        }
+        batch.clear();
+    }
+
+    char delim;
+    std::vector<std::unique_ptr<File>> files;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Rows of cells parsed from CSV text, with the number of cells of each row
+struct CsvChunk
+{
+    std::vector<float> values;
+    std::vector<size_t> widths;
+    size_t row = 0;
+    size_t value = 0;
+};
+
+inline const char* CsvEndOfLine(const char* p, const char* end)
+{
+    const char* eol = (const char*)std::memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+inline const char* CsvNextLine(const char* eol, const char* end)
+{
+    return eol < end ? eol + 1 : end;
+}
+
+// As std::getline, an empty line or trailing delimiter is an empty cell
+template<typename F>
+inline void CsvForEachCell(const char* p, const char* eol, char delim, F f)
+{
+    for(;;) {
+        const char* c = (const char*)std::memchr(p, delim, eol - p);
+        if(!c) {
+            f(p, eol);
+            return;
+        }
+        f(p, c);
+        p = c + 1;
+    }
+}
+
+// Parse the leading number of [p,end) as std::strtof would, but without
+// needing a terminated string or locale. Forms other than plain decimal
+// (hex, inf, nan) are passed on to strtof.
+inline bool CsvParseFloat(const char* p, const char* end, float& v)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    while(p < end && (*p == ' ' || *p == '\t')) ++p;
+    const char* s = p;
+
+    bool neg = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        ++p;
+    }
+
+    // Up to 19 significant digits fit the mantissa, more than a float needs
+    uint64_t m = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    for(; p < end && '0' <= *p && *p <= '9'; ++p) {
+        any = true;
+        if(digits < 19) {
+            m = m * 10 + (*p - '0');
+            if(m) ++digits;
+        }else{
+            ++exp10;
+        }
+    }
+    if(p < end && *p == '.') {
+        for(++p; p < end && '0' <= *p && *p <= '9'; ++p) {
+            any = true;
+            if(digits < 19) {
+                m = m * 10 + (*p - '0');
+                if(m) ++digits;
+                --exp10;
+            }
+        }
+    }
+
+    if(!any || (p < end && (*p == 'x' || *p == 'X'))) {
+        char buf[64];
+        const size_t len = std::min<size_t>(end - s, sizeof(buf) - 1);
+        std::memcpy(buf, s, len);
+        buf[len] = '\0';
+        char* parsed;
+        v = std::strtof(buf, &parsed);
+        return parsed != buf;
+    }
+
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool eneg = false;
+        if(e < end && (*e == '-' || *e == '+')) {
+            eneg = (*e == '-');
+            ++e;
+        }
+        if(e < end && '0' <= *e && *e <= '9') {
+            int x = 0;
+            for(; e < end && '0' <= *e && *e <= '9'; ++e) {
+                if(x < 10000) x = x * 10 + (*e - '0');
+            }
+            exp10 += eneg ? -x : x;
+        }
+    }
+
+    double d = (double)m;
+    if(m && exp10) {
+        if(0 < exp10 && exp10 <= 22) {
+            d *= pow10[exp10];
+        }else if(-22 <= exp10 && exp10 < 0) {
+            d /= pow10[-exp10];
+        }else{
+            d *= std::pow(10.0, exp10);
+        }
+    }
+    v = (float)(neg ? -d : d);
+    return true;
+}
+
+// Parse the rows of [p,end) into chunk, returning the number of cells
+// which weren't numeric. These are logged as NaN.
+inline size_t CsvParseRows(const char* p, const char* end, char delim, CsvChunk& chunk)
+{
+    size_t bad = 0;
+    while(p < end) {
+        const char* eol = CsvEndOfLine(p, end);
+        const size_t first = chunk.values.size();
+        CsvForEachCell(p, eol, delim, [&](const char* c, const char* e){
+            float v;
+            if(!CsvParseFloat(c, e, v)) {
+                v = std::numeric_limits<float>::quiet_NaN();
+                ++bad;
+            }
+            chunk.values.push_back(v);
+        });
+        chunk.widths.push_back(chunk.values.size() - first);
+        p = CsvNextLine(eol, end);
+    }
+    return bad;
+}
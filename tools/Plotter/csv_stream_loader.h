@@ -0,0 +1,327 @@
+#pragma once
+
+#include <pangolin/platform.h>
+#include <pangolin/plot/datalog.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+#include "csv_parse.h"
+
+// Loads CSV, or rows of raw floats, from pipes such as stdin and from files
+// which can't be mapped. Each input is read and parsed on its own thread
+// while rows are joined column-wise and logged in batches.
+class CsvStreamLoader
+{
+public:
+    // For binary_columns > 0, each input is rows of that many native float32
+    CsvStreamLoader(const std::vector<std::string>& csv_files, char delim = ',', size_t binary_columns = 0)
+        : delim(delim), binary_columns(binary_columns)
+    {
+        for(const auto& f : csv_files) {
+            std::shared_ptr<Input> in = std::make_shared<Input>();
+            if(f == "-") {
+                in->fd = 0;
+#ifdef _WIN32
+                _setmode(0, _O_BINARY);
+#endif
+            }else{
+#ifdef _WIN32
+                in->fd = _open(f.c_str(), _O_RDONLY | _O_BINARY);
+#else
+                in->fd = ::open(f.c_str(), O_RDONLY);
+#endif
+                in->owned = true;
+            }
+            inputs.push_back(in);
+        }
+    }
+
+    ~CsvStreamLoader()
+    {
+        // Readers may be blocked on a pipe which never closes, so are left
+        // to finish on their own.
+        Stop();
+        for(auto& t : threads) t.detach();
+    }
+
+    bool IsOpen() const
+    {
+        for(const auto& in : inputs) {
+            if(in->fd < 0) return false;
+        }
+        return !inputs.empty();
+    }
+
+    bool ReadHeader(std::vector<std::string>& labels)
+    {
+        labels.clear();
+        if(binary_columns) return false;
+
+        std::string line;
+        for(auto& in : inputs) {
+            if(!TakeLine(*in, line)) return false;
+            if(line.size() && line.back() == '\r') line.pop_back();
+            const char* b = line.data();
+            CsvForEachCell(b, b + line.size(), delim, [&](const char* c, const char* e){
+                labels.emplace_back(c, e);
+            });
+        }
+        return true;
+    }
+
+    bool SkipStreamRows(const std::vector<size_t>& rows_to_skip)
+    {
+        if(rows_to_skip.size()) {
+            PANGO_ASSERT(rows_to_skip.size() == inputs.size());
+            std::string line;
+            for(size_t i=0; i < inputs.size(); ++i) {
+                Input& in = *inputs[i];
+                if(binary_columns) {
+                    const size_t bytes = rows_to_skip[i] * binary_columns * sizeof(float);
+                    while(in.size < bytes) {
+                        if(!Fill(in)) return false;
+                    }
+                    Drop(in, bytes);
+                }else{
+                    for(size_t r=0; r < rows_to_skip[i]; ++r) {
+                        if(!TakeLine(in, line)) return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    // Log rows until an input ends or keep_loading is cleared.
+    void Load(pangolin::DataLog& log, const bool& keep_loading)
+    {
+        for(auto& in : inputs) {
+            threads.emplace_back(&CsvStreamLoader::ReadRows, in, delim, binary_columns);
+        }
+
+        std::vector<CsvChunk> current(inputs.size());
+        std::vector<float> batch;
+        size_t batch_width = 0;
+
+        while(keep_loading && NextChunks(current, keep_loading)) {
+            // Join rows until an input runs out, logging runs of equal
+            // width together
+            for(;;) {
+                size_t width = 0;
+                bool complete = true;
+                for(const CsvChunk& c : current) {
+                    complete = complete && c.row < c.widths.size();
+                    if(complete) width += c.widths[c.row];
+                }
+                if(!complete) break;
+
+                if(width != batch_width) {
+                    Flush(log, batch, batch_width);
+                    batch_width = width;
+                }
+                for(CsvChunk& c : current) {
+                    const float* v = c.values.data() + c.value;
+                    batch.insert(batch.end(), v, v + c.widths[c.row]);
+                    c.value += c.widths[c.row];
+                    ++c.row;
+                }
+            }
+            Flush(log, batch, batch_width);
+        }
+        Stop();
+    }
+
+private:
+    static const size_t read_bytes = 1 << 18;
+    static const size_t max_chunks = 64;
+
+    struct Input
+    {
+        ~Input()
+        {
+            if(owned && fd >= 0) {
+#ifdef _WIN32
+                _close(fd);
+#else
+                ::close(fd);
+#endif
+            }
+        }
+
+        int fd = -1;
+        bool owned = false;
+
+        // Bytes read but not yet parsed, such as a partial row
+        std::vector<char> buffer;
+        size_t size = 0;
+
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable space;
+        std::deque<CsvChunk> chunks;
+        bool finished = false;
+        std::atomic<bool> stop{false};
+    };
+
+    static bool Fill(Input& in)
+    {
+        if(in.buffer.size() < in.size + read_bytes) {
+            in.buffer.resize(in.size + read_bytes);
+        }
+        // Returns as soon as anything is available, so that rows from an
+        // interactive producer show up straight away
+#ifdef _WIN32
+        const int n = _read(in.fd, in.buffer.data() + in.size, (unsigned int)read_bytes);
+#else
+        ssize_t n;
+        do {
+            n = ::read(in.fd, in.buffer.data() + in.size, read_bytes);
+        }while(n < 0 && errno == EINTR);
+#endif
+        if(n <= 0) return false;
+        in.size += (size_t)n;
+        return true;
+    }
+
+    static void Drop(Input& in, size_t bytes)
+    {
+        std::memmove(in.buffer.data(), in.buffer.data() + bytes, in.size - bytes);
+        in.size -= bytes;
+    }
+
+    // Read a line before the input's thread has started
+    static bool TakeLine(Input& in, std::string& line)
+    {
+        size_t scanned = 0;
+        for(;;) {
+            const char* b = in.buffer.data();
+            const char* eol = scanned < in.size ? (const char*)std::memchr(b + scanned, '\n', in.size - scanned) : nullptr;
+            if(eol) {
+                line.assign(b, eol);
+                Drop(in, eol - b + 1);
+                return true;
+            }
+            scanned = in.size;
+            if(!Fill(in)) {
+                line.assign(in.buffer.data(), in.size);
+                Drop(in, in.size);
+                return !line.empty();
+            }
+        }
+    }
+
+    static void ReadRows(std::shared_ptr<Input> in, char delim, size_t binary_columns)
+    {
+        const size_t row_bytes = binary_columns * sizeof(float);
+
+        bool more = true;
+        while(more) {
+            more = !in->stop && Fill(*in);
+
+            // Parse complete rows, keeping any partial row for the next read
+            const char* b = in->buffer.data();
+            size_t complete = 0;
+            if(binary_columns) {
+                complete = in->size - in->size % row_bytes;
+            }else if(!more) {
+                complete = in->size;
+            }else{
+                for(size_t i = in->size; i > 0; --i) {
+                    if(b[i-1] == '\n') {
+                        complete = i;
+                        break;
+                    }
+                }
+            }
+            if(!complete) continue;
+
+            CsvChunk chunk;
+            if(binary_columns) {
+                chunk.values.resize(complete / sizeof(float));
+                std::memcpy(chunk.values.data(), b, complete);
+                chunk.widths.assign(complete / row_bytes, binary_columns);
+            }else{
+                const size_t bad = CsvParseRows(b, b + complete, delim, chunk);
+                if(bad) {
+                    std::cerr << "Warning: couldn't parse " << bad << " cells as numeric data (use -H option to include header)" << std::endl;
+                }
+            }
+            Drop(*in, complete);
+
+            std::unique_lock<std::mutex> l(in->mutex);
+            in->space.wait(l, [&](){ return in->chunks.size() < max_chunks || in->stop; });
+            if(in->stop) break;
+            in->chunks.push_back(std::move(chunk));
+            in->ready.notify_one();
+        }
+
+        std::lock_guard<std::mutex> l(in->mutex);
+        in->finished = true;
+        in->ready.notify_one();
+    }
+
+    // False once the input has ended, or keep_loading is cleared
+    static bool Pop(Input& in, CsvChunk& chunk, const bool& keep_loading)
+    {
+        std::unique_lock<std::mutex> l(in.mutex);
+        while(in.chunks.empty() && !in.finished) {
+            if(!keep_loading) return false;
+            in.ready.wait_for(l, std::chrono::milliseconds(100));
+        }
+        if(in.chunks.empty()) return false;
+        chunk = std::move(in.chunks.front());
+        in.chunks.pop_front();
+        in.space.notify_one();
+        return true;
+    }
+
+    // Wait for rows from every input
+    bool NextChunks(std::vector<CsvChunk>& current, const bool& keep_loading)
+    {
+        for(size_t i=0; i < inputs.size(); ++i) {
+            while(current[i].row == current[i].widths.size()) {
+                if(!Pop(*inputs[i], current[i], keep_loading)) return false;
+            }
+        }
+        return true;
+    }
+
+    void Stop()
+    {
+        for(auto& in : inputs) {
+            std::lock_guard<std::mutex> l(in->mutex);
+            in->stop = true;
+            in->space.notify_one();
+        }
+    }
+
+    static void Flush(pangolin::DataLog& log, std::vector<float>& batch, size_t width)
+    {
+        if(width && batch.size()) {
+            log.Log(width, batch.data(), (unsigned int)(batch.size() / width));
+        }
+        batch.clear();
+    }
+
+    char delim;
+    size_t binary_columns;
+    std::vector<std::shared_ptr<Input>> inputs;
+    std::vector<std::thread> threads;
+};
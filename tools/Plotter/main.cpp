@@ -1,11 +1,13 @@
 #include <pangolin/pangolin.h>
+#include <pangolin/plot/shared_datalog.h>
 #include <pangolin/utils/argagg.hpp>
 #include <pangolin/utils/file_utils.h>
 
 #include <functional>
 #include <thread>
 
-#include "csv_data_loader.h"
+#include "csv_parallel_loader.h"
+#include "csv_stream_loader.h"
 
 namespace argagg{ namespace convert {
 
@@ -31,11 +33,16 @@ int main( int argc, char* argv[] )
         { "xrange", {"-X","--x-range"}, "X-Axis min:max view (default: '0:100')", 1},
         { "yrange", {"-Y","--y-range"}, "Y-Axis min:max view (default: '0:100')", 1},
         { "skip", {"-s","--skip"}, "Skip n rows of file, seperated by commas per file (default: '0,...')", 1},
+        { "binary", {"-b","--binary"}, "Read rows of n raw float32 values per file rather than CSV, eg. from stdin", 1},
+        { "shm", {"--shm"}, "Plot the shared memory DataLog of another process (see SharedDataLogWriter), eg. /telemetry", 1},
     }};
 
     argagg::parser_results args = argparser.parse(argc, argv);
-    if ( (bool)args["help"] || !args.pos.size()) {
+    const bool shared = args["shm"];
+    if ( (bool)args["help"] || (!args.pos.size() && !shared)) {
         std::cerr << "Usage: Plotter [options] file1.csv [fileN.csv]*" << std::endl
+                  << "       Plotter [options] file.pangolog" << std::endl
+                  << "       Plotter [options] --shm /name" << std::endl
                   << argparser << std::endl
                   << "    where: $i is a placeholder for the datum index," << std::endl
                   << "           $0, $1, ... are placeholders for the 0th, 1st, ... sequential datum values over the input files" << std::endl;
@@ -48,6 +55,7 @@ int main( int argc, char* argv[] )
     const char delim = args["delim"].as<char>(',');
     const pangolin::Rangef xrange = args["xrange"].as<>(pangolin::Rangef(0.0f,100.0f));
     const pangolin::Rangef yrange = args["yrange"].as<>(pangolin::Rangef(0.0f,100.0f));
+    const size_t binary_columns = args["binary"].as<size_t>(0);
     const std::string skips = args["skip"].as<std::string>("");
     const std::vector<std::string> skipvecstr = pangolin::Split(skips,',');
     std::vector<size_t> skipvec;
@@ -60,35 +68,58 @@ int main( int argc, char* argv[] )
         return -1;
     }
 
-    pangolin::DataLog log;
+    // Shared logs are mapped in place and followed as the writer appends
+    std::unique_ptr<pangolin::DataLog> log_ptr;
+    try {
+        log_ptr.reset(shared ? new pangolin::SharedDataLogView(args["shm"].as<std::string>()) : new pangolin::DataLog());
+    }catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+    pangolin::DataLog& log = *log_ptr;
+    const std::vector<std::string> files = shared ? std::vector<std::string>() : args.all_as<std::string>();
+
+    // Logs saved by DataLog::Save are mapped rather than parsed
+    if(files.size() == 1 && pangolin::FileLowercaseExtention(files[0]) == ".pangolog") {
+        log.Load(files[0]);
+    }
 
-    CsvDataLoader csv_loader(args.all_as<std::string>(), delim);
+    // Whole CSV files can be parsed in parallel, pipes are streamed
+    CsvParallelLoader parallel_loader(log.Samples() || binary_columns ? std::vector<std::string>() : files, delim);
+    const bool parallel = parallel_loader.IsOpen();
+    CsvStreamLoader stream_loader(parallel || log.Samples() ? std::vector<std::string>() : files, delim, binary_columns);
+    if(!shared && !parallel && !log.Samples() && !stream_loader.IsOpen()) {
+        std::cerr << "Unable to open input files" << std::endl;
+        return -1;
+    }
 
-    if(args["header"]) {
+    if(args["header"] && !shared) {
         std::vector<std::string> labels;
-        csv_loader.ReadRow(labels);
+        if(parallel) {
+            parallel_loader.ReadHeader(labels);
+        }else if(binary_columns) {
+            std::cerr << "Binary input has no header row to read" << std::endl;
+        }else{
+            stream_loader.ReadHeader(labels);
+        }
         log.SetLabels(labels);
     }
 
     // Load asynchronously incase the file is large or is being read interactively from stdin
     bool keep_loading = true;
     std::thread data_thread([&](){
-        if(!csv_loader.SkipStreamRows(skipvec)) {
+        if(shared) {
             return;
         }
-
-        std::vector<std::string> row;
-
-        while(keep_loading && csv_loader.ReadRow(row)) {
-            std::vector<float> row_num(row.size(), std::numeric_limits<float>::quiet_NaN() );
-            for(size_t i=0; i< row_num.size(); ++i) {
-                try{
-                    row_num[i] = std::stof(row[i]);
-                }catch(const std::invalid_argument& e){
-                    std::cerr << "Warning: couldn't parse '" << row[i] << "' as numeric data (use -H option to include header)" << std::endl;
-                }
+        if(parallel) {
+            if(parallel_loader.SkipStreamRows(skipvec)) {
+                parallel_loader.Load(log, keep_loading);
             }
-            log.Log(row_num);
+            return;
+        }
+
+        if(stream_loader.SkipStreamRows(skipvec)) {
+            stream_loader.Load(log, keep_loading);
         }
     });
 
@@ -0,0 +1,141 @@
+#include <pangolin/pangolin.h>
+#include <pangolin/gl/gl.h>
+#include <pangolin/gl/glpixformat.h>
+#include <pangolin/handler/handler.h>
+#include <pangolin/video/drivers/net_video.h>
+#include <pangolin/video/video_input.h>
+#include <pangolin/utils/argagg.hpp>
+
+#include <iostream>
+#include <memory>
+
+// Watch and operate a window streamed by View::RecordOnRender to a tcp://
+// output opened with input=1. Mouse, scroll and keyboard input over the
+// picture is sent back and replayed on the remote window.
+
+// Forwards input over the view to the NetVideo sender, in pixels of the
+// frame with rows counted as sent.
+struct RemoteHandler : public pangolin::Handler
+{
+    RemoteHandler(pangolin::NetVideo& net, size_t frame_w, size_t frame_h, bool top_down)
+        : net(net), frame_w(frame_w), frame_h(frame_h), top_down(top_down)
+    {
+    }
+
+    void Keyboard(pangolin::View& v, unsigned char key, int x, int y, bool pressed) override
+    {
+        picojson::value e = Event("key", v, x, y);
+        e["key"] = (int64_t)key;
+        e["pressed"] = pressed;
+        net.SendInput(e);
+    }
+
+    void Mouse(pangolin::View& v, pangolin::MouseButton button, int x, int y, bool pressed, int /*button_state*/) override
+    {
+        int index = 0;
+        while(index < 7 && !(button & (1 << index))) ++index;
+
+        picojson::value e = Event("mouse", v, x, y);
+        e["button"] = (int64_t)index;
+        e["pressed"] = pressed;
+        net.SendInput(e);
+    }
+
+    void MouseMotion(pangolin::View& v, int x, int y, int /*button_state*/) override
+    {
+        net.SendInput(Event("motion", v, x, y));
+    }
+
+    void PassiveMouseMotion(pangolin::View& v, int x, int y, int /*button_state*/) override
+    {
+        net.SendInput(Event("motion", v, x, y));
+    }
+
+    void Special(pangolin::View& v, pangolin::InputSpecial type, float x, float y, float p1, float p2, float /*p3*/, float /*p4*/, int /*button_state*/) override
+    {
+        if(type == pangolin::InputSpecialScroll) {
+            picojson::value e = Event("scroll", v, (int)x, (int)y);
+            e["dx"] = (double)p1;
+            e["dy"] = (double)p2;
+            net.SendInput(e);
+        }
+    }
+
+    // x, y are window coordinates from the bottom left
+    picojson::value Event(const char* type, const pangolin::View& v, int x, int y) const
+    {
+        const double fx = (x - v.v.l) * (double)frame_w / v.v.w;
+        double fy = (y - v.v.b) * (double)frame_h / v.v.h;
+        if(top_down) fy = frame_h - 1 - fy;
+
+        picojson::value e;
+        e["event"] = type;
+        e["x"] = fx;
+        e["y"] = fy;
+        return e;
+    }
+
+    pangolin::NetVideo& net;
+    size_t frame_w;
+    size_t frame_h;
+    bool top_down;
+};
+
+int main(int argc, char* argv[])
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "top_down", {"-t", "--top-down"}, "Frames are top down images rather than framebuffer captures", 0},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+    if(args["help"] || args.pos.size() != 1) {
+        std::cerr << "Usage: RemoteView [options] tcp://host:port" << std::endl << argparser << std::endl;
+        return args["help"] ? 0 : 1;
+    }
+
+    try {
+        pangolin::VideoInput video(args.as<std::string>(0));
+        pangolin::NetVideo* net = pangolin::FindFirstMatchingVideoInterface<pangolin::NetVideo>(video);
+        if(!net || video.Streams().size() != 1) {
+            std::cerr << "RemoteView needs a tcp:// video of a single stream" << std::endl;
+            return 1;
+        }
+
+        const pangolin::StreamInfo& si = video.Streams()[0];
+        const bool top_down = args["top_down"];
+
+        pangolin::CreateWindowAndBind("RemoteView", (int)si.Width(), (int)si.Height());
+        RemoteHandler handler(*net, si.Width(), si.Height(), top_down);
+        pangolin::View& view = pangolin::CreateDisplay()
+            .SetAspect((double)si.Width() / si.Height())
+            .SetHandler(&handler);
+
+        const pangolin::GlPixFormat fmt(si.PixFormat());
+        pangolin::GlTexture tex((GLint)si.Width(), (GLint)si.Height(), fmt.scalable_internal_format, true, 0, fmt.glformat, fmt.gltype);
+        std::unique_ptr<unsigned char[]> buffer(new unsigned char[video.SizeBytes()]);
+
+        while(!pangolin::ShouldQuit()) {
+            if(video.GrabNewest(buffer.get(), false)) {
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(si.Pitch() * 8 / si.PixFormat().bpp));
+                tex.Upload(buffer.get() + (size_t)si.Offset(), fmt.glformat, fmt.gltype);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            }
+
+            glClear(GL_COLOR_BUFFER_BIT);
+            view.Activate();
+            glColor3f(1.0f, 1.0f, 1.0f);
+            if(top_down) {
+                tex.RenderToViewportFlipY();
+            }else{
+                tex.RenderToViewport();
+            }
+            pangolin::FinishFrame();
+        }
+    }catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include <pangolin/pangolin.h>
+#include <pangolin/video/drivers/pango_video_output.h>
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_output.h>
+#include <pangolin/utils/argagg.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN_
+#  include <sys/resource.h>
+#endif
+
+// Runs a capture pipeline, input (through any filters) to an optional
+// output, and reports what it sustains. Frames are grabbed on one thread
+// and written on another through a bounded queue, as VideoConvert does, so
+// that a slow output shows up as queueing and, at a target rate, as drops.
+
+struct BenchOptions
+{
+    std::vector<std::string> filters;
+    double fps = 0.0;                       // 0 for as fast as possible
+    size_t frames = std::numeric_limits<size_t>::max();
+    double seconds = 10.0;
+    size_t queue = 8;
+    bool drop = false;                      // drop rather than wait when the queue is full
+    bool json = false;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchFrame
+{
+    pangolin::FramePool::Buffer data;
+    picojson::value properties;
+    Clock::time_point grabbed;
+};
+
+// Latencies of one stage, in ms
+class StageTimes
+{
+public:
+    void Add(double ms) { times.push_back(ms); }
+
+    size_t Count() const { return times.size(); }
+
+    // p in [0,1], by nearest rank
+    double Percentile(double p)
+    {
+        if(times.empty()) return 0.0;
+        if(!sorted) {
+            std::sort(times.begin(), times.end());
+            sorted = true;
+        }
+        const size_t i = std::min(times.size() - 1, (size_t)(p * times.size()));
+        return times[i];
+    }
+
+    picojson::value Summary()
+    {
+        picojson::value s;
+        s["p50_ms"] = Percentile(0.5);
+        s["p90_ms"] = Percentile(0.9);
+        s["p99_ms"] = Percentile(0.99);
+        s["max_ms"] = Percentile(1.0);
+        return s;
+    }
+
+private:
+    std::vector<double> times;
+    bool sorted = false;
+};
+
+// Bounded queue between the grabber and writer, closed by either end
+class BenchQueue
+{
+public:
+    BenchQueue(size_t capacity)
+        : capacity(capacity), closed(false), high_water(0)
+    {
+    }
+
+    // False if the queue was full and wait is false, or it is closed
+    bool Push(BenchFrame&& frame, bool wait)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        if(!wait && frames.size() >= capacity) return false;
+        space.wait(l, [this](){ return frames.size() < capacity || closed; });
+        if(closed) return false;
+        frames.push_back(std::move(frame));
+        high_water = std::max(high_water, frames.size());
+        ready.notify_one();
+        return true;
+    }
+
+    bool Pop(BenchFrame& frame)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        ready.wait(l, [this](){ return !frames.empty() || closed; });
+        if(frames.empty()) return false;
+        frame = std::move(frames.front());
+        frames.pop_front();
+        space.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        closed = true;
+        ready.notify_all();
+        space.notify_all();
+    }
+
+    bool IsClosed()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        return closed;
+    }
+
+    size_t HighWater()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        return high_water;
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    size_t high_water;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::deque<BenchFrame> frames;
+};
+
+double Seconds(Clock::time_point a, Clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+double Ms(Clock::time_point a, Clock::time_point b)
+{
+    return 1e3 * Seconds(a, b);
+}
+
+// CPU seconds used by the process so far, and its peak resident size in MB
+void ProcessUsage(double& cpu_s, double& max_rss_mb)
+{
+#ifndef _WIN_
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    cpu_s = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + 1e-6 * (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+#  ifdef __APPLE__
+    max_rss_mb = ru.ru_maxrss / (1024.0 * 1024.0);
+#  else
+    max_rss_mb = ru.ru_maxrss / 1024.0;
+#  endif
+#else
+    cpu_s = -1.0;
+    max_rss_mb = -1.0;
+#endif
+}
+
+std::string FilteredUri(const std::string& input_uri, const std::vector<std::string>& filters)
+{
+    // Each filter wraps everything before it
+    std::string uri = input_uri;
+    for(const std::string& f : filters) {
+        uri = f + uri;
+    }
+    return uri;
+}
+
+void VideoBench(const std::string& input_uri, const std::string& output_uri, const BenchOptions& opts)
+{
+    double cpu_start_s, rss_mb;
+    ProcessUsage(cpu_start_s, rss_mb);
+
+    const std::string uri = FilteredUri(input_uri, opts.filters);
+    std::unique_ptr<pangolin::VideoInterface> video = pangolin::OpenVideo(uri);
+    const size_t frame_bytes = video->SizeBytes();
+
+    std::unique_ptr<pangolin::VideoOutputInterface> output;
+    if(!output_uri.empty()) {
+        output = pangolin::OpenVideoOutput(output_uri);
+        output->SetStreams(video->Streams(), uri, pangolin::GetVideoDeviceProperties(video.get()));
+    }
+    pangolin::PangoVideoOutput* pango_output = dynamic_cast<pangolin::PangoVideoOutput*>(output.get());
+
+    if(!opts.json) {
+        std::cerr << "Benchmarking " << uri << (output ? " -> " + output_uri : "") << std::endl;
+    }
+
+    BenchQueue queue(std::max<size_t>(1, opts.queue));
+    StageTimes grab_times, queue_times, write_times, total_times;
+    std::atomic<size_t> grabbed(0), dropped(0), late(0);
+    std::exception_ptr grab_error;
+
+    const Clock::time_point start = Clock::now();
+
+    std::thread grabber([&]() {
+        try {
+            const Clock::duration period = opts.fps > 0.0 ?
+                std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opts.fps)) : Clock::duration::zero();
+            Clock::time_point due = Clock::now();
+
+            video->Start();
+            while(grabbed < opts.frames && Seconds(start, Clock::now()) < opts.seconds && !queue.IsClosed()) {
+                if(period != Clock::duration::zero()) {
+                    // Frames more than a period behind schedule are late
+                    const Clock::time_point now = Clock::now();
+                    if(now < due) {
+                        std::this_thread::sleep_until(due);
+                    }else if(now - due > period) {
+                        ++late;
+                    }
+                    due += period;
+                }
+
+                BenchFrame frame;
+                frame.data = pangolin::FramePool::I().Acquire(std::max<size_t>(1, frame_bytes));
+
+                const Clock::time_point t0 = Clock::now();
+                if(!video->GrabNext(frame.data.get(), true)) break;
+                frame.properties = pangolin::GetVideoFrameProperties(video.get());
+                frame.grabbed = Clock::now();
+                grab_times.Add(Ms(t0, frame.grabbed));
+                ++grabbed;
+
+                if(!queue.Push(std::move(frame), !opts.drop)) {
+                    if(queue.IsClosed()) break;
+                    ++dropped;
+                }
+            }
+        }catch(...) {
+            grab_error = std::current_exception();
+        }
+        queue.Close();
+    });
+
+    size_t written = 0;
+    try {
+        BenchFrame frame;
+        while(queue.Pop(frame)) {
+            const Clock::time_point t0 = Clock::now();
+            queue_times.Add(Ms(frame.grabbed, t0));
+            if(output) {
+                output->WriteStreams(frame.data.get(), frame.properties);
+            }
+            frame.data.Reset();
+            const Clock::time_point t1 = Clock::now();
+            write_times.Add(Ms(t0, t1));
+            total_times.Add(Ms(frame.grabbed, t1));
+            ++written;
+        }
+    }catch(...) {
+        queue.Close();
+        grabber.join();
+        throw;
+    }
+    grabber.join();
+    video->Stop();
+
+    // Frames still being encoded count towards the run
+    size_t output_dropped = 0;
+    picojson::value log_buffer;
+    if(pango_output) {
+        output_dropped = pango_output->DroppedFrames();
+        const pangolin::threadedfilebuf::Stats b = pango_output->Stats().buffer;
+        log_buffer["size_mb"] = b.buffer_bytes / (1024.0 * 1024.0);
+        log_buffer["high_water_mb"] = b.high_water_bytes / (1024.0 * 1024.0);
+        log_buffer["blocked_s"] = b.blocked_s;
+        log_buffer["blocked_writes"] = (double)b.blocked_writes;
+    }
+    output.reset();
+    const double seconds = Seconds(start, Clock::now());
+
+    double cpu_end_s;
+    ProcessUsage(cpu_end_s, rss_mb);
+
+    picojson::value result;
+    result["input"] = uri;
+    result["output"] = output_uri;
+    result["seconds"] = seconds;
+    result["frames_grabbed"] = (size_t)grabbed;
+    result["frames_written"] = written;
+    result["frames_dropped"] = (size_t)dropped + output_dropped;
+    result["frames_late"] = (size_t)late;
+    result["fps"] = seconds > 0.0 ? written / seconds : 0.0;
+    result["mb_per_s"] = seconds > 0.0 ? written * frame_bytes / (seconds * 1024.0 * 1024.0) : 0.0;
+    result["queue_high_water"] = queue.HighWater();
+    result["cpu_percent"] = cpu_start_s >= 0.0 && seconds > 0.0 ? 100.0 * (cpu_end_s - cpu_start_s) / seconds : -1.0;
+    result["max_rss_mb"] = rss_mb;
+    result["grab"] = grab_times.Summary();
+    result["queue"] = queue_times.Summary();
+    result["write"] = write_times.Summary();
+    result["total"] = total_times.Summary();
+    if(pango_output) result["log_buffer"] = log_buffer;
+
+    if(opts.json) {
+        std::cout << result.serialize() << std::endl;
+    }else{
+        std::cout << written << " frames in " << seconds << "s: "
+                  << result["fps"].get<double>() << " fps, "
+                  << result["mb_per_s"].get<double>() << " MB/s" << std::endl;
+        std::cout << "Dropped: " << result["frames_dropped"].get<double>()
+                  << ", late: " << (size_t)late
+                  << ", queue high water: " << queue.HighWater() << " / " << opts.queue << std::endl;
+        std::cout << "CPU: " << result["cpu_percent"].get<double>() << "%, max RSS: " << rss_mb << " MB" << std::endl;
+        for(const char* stage : {"grab", "queue", "write", "total"}) {
+            const picojson::value& s = result[stage];
+            std::cout << "  " << stage << " ms: p50 " << s["p50_ms"].get<double>()
+                      << ", p90 " << s["p90_ms"].get<double>()
+                      << ", p99 " << s["p99_ms"].get<double>()
+                      << ", max " << s["max_ms"].get<double>() << std::endl;
+        }
+        if(pango_output) {
+            std::cout << "Log buffer high water: " << log_buffer["high_water_mb"].get<double>()
+                      << " / " << log_buffer["size_mb"].get<double>() << " MB, writers blocked for "
+                      << log_buffer["blocked_s"].get<double>() << "s" << std::endl;
+        }
+    }
+
+    if(grab_error) std::rethrow_exception(grab_error);
+}
+
+int main( int argc, char* argv[] )
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "filter", {"-f", "--filter"}, "Filter uri prefix applied to the input, such as 'debayer://'. May be repeated, innermost first.", 1},
+        { "fps", {"-r", "--rate"}, "Grab at this rate rather than as fast as possible", 1},
+        { "frames", {"-n", "--frames"}, "Stop after this many frames (default: unlimited)", 1},
+        { "seconds", {"-t", "--seconds"}, "Stop after this long (default: 10)", 1},
+        { "queue", {"-q", "--queue"}, "Frames grabbed ahead of the writer (default: 8)", 1},
+        { "drop", {"-d", "--drop"}, "Drop frames when the queue is full, rather than wait", 0},
+        { "json", {"-j", "--json"}, "Print the results as one JSON object", 0},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+
+    if( !args["help"] && args.pos.size() > 0 ) {
+        BenchOptions opts;
+        for(const argagg::option_result& f : args["filter"].all) {
+            opts.filters.push_back(f.as<std::string>());
+        }
+        opts.fps = args["fps"].as<double>(0.0);
+        opts.frames = args["frames"].as<size_t>(std::numeric_limits<size_t>::max());
+        opts.seconds = args["seconds"].as<double>(10.0);
+        opts.queue = args["queue"].as<size_t>(8);
+        opts.drop = args["drop"];
+        opts.json = args["json"];
+
+        const std::string input_uri = args.pos[0];
+        const std::string output_uri = args.pos.size() > 1 ? std::string(args.pos[1]) : std::string();
+
+        try{
+            VideoBench(input_uri, output_uri, opts);
+        } catch (const pangolin::VideoException& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }else{
+        std::cout << "Usage  : VideoBench [options] video-in-uri [video-out-uri]" << std::endl << std::endl;
+        std::cout << argparser << std::endl;
+        std::cout << "Without an output, frames are grabbed and discarded." << std::endl << std::endl;
+        std::cout << "For example, to check a rig records four debayered 30 fps streams:" << std::endl;
+        std::cout << "\tVideoBench -r 30 -d -f debayer:// 'join:[sync_tolerance_us=1000]//v4l:///dev/video0//v4l:///dev/video1' 'pango:[encode_threads=4]///tmp/bench.pango'" << std::endl;
+        std::cout << "or how fast a codec runs over synthetic frames:" << std::endl;
+        std::cout << "\tVideoBench -t 5 'test:[size=1920x1080,fmt=RGB24,realtime=0]//' 'pango:[encoder=png,encode_threads=8]///tmp/bench.pango'" << std::endl;
+        std::cout << std::endl;
+    }
+
+    return 0;
+}
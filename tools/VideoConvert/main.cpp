@@ -1,46 +1,216 @@
 #include <pangolin/pangolin.h>
-#include <pangolin/video/video_input.h>
+#include <pangolin/video/frame_pool.h>
+#include <pangolin/video/video.h>
+#include <pangolin/video/video_output.h>
+#include <pangolin/utils/argagg.hpp>
 #include <pangolin/utils/file_utils.h>
 #include <pangolin/utils/timer.h>
 
-void VideoViewer(const std::string& input_uri, const std::string& output_uri)
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+// Frames are read (and decoded) on one thread and written in order from
+// another, through a bounded queue. Encoding is spread over the output's
+// own workers: encode_threads for pango: outputs and threads for images:.
+
+struct ConvertOptions
+{
+    size_t start = 0;
+    size_t end = std::numeric_limits<size_t>::max();
+    size_t step = 1;
+    std::vector<size_t> streams;
+    size_t jobs = 0;
+    size_t queue = 8;
+};
+
+struct ConvertFrame
+{
+    size_t index;
+    pangolin::FramePool::Buffer data;
+    picojson::value properties;
+};
+
+// Bounded queue between the reader and writer, closed by either end
+class ConvertQueue
+{
+public:
+    ConvertQueue(size_t capacity)
+        : capacity(capacity), closed(false)
+    {
+    }
+
+    bool Push(ConvertFrame&& frame)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        space.wait(l, [this](){ return frames.size() < capacity || closed; });
+        if(closed) return false;
+        frames.push_back(std::move(frame));
+        ready.notify_one();
+        return true;
+    }
+
+    bool Pop(ConvertFrame& frame)
+    {
+        std::unique_lock<std::mutex> l(mutex);
+        ready.wait(l, [this](){ return !frames.empty() || closed; });
+        if(frames.empty()) return false;
+        frame = std::move(frames.front());
+        frames.pop_front();
+        space.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> l(mutex);
+        closed = true;
+        ready.notify_all();
+        space.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::deque<ConvertFrame> frames;
+};
+
+std::vector<size_t> ParseIndices(const std::string& list)
+{
+    std::vector<size_t> indices;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(!item.empty()) indices.push_back(std::stoul(item));
+    }
+    return indices;
+}
+
+// Pass the job count on to outputs which encode in parallel, unless given
+std::string OutputUriWithJobs(const std::string& output_uri, size_t jobs)
 {
-    pangolin::Var<bool> video_wait("video.wait", true);
-    pangolin::Var<bool> video_newest("video.newest", false);
+    if(!jobs) return output_uri;
+    pangolin::Uri uri = pangolin::ParseUri(output_uri);
+    const std::string key = uri.scheme == "pango" ? "encode_threads" : uri.scheme == "images" ? "threads" : "";
+    if(key.empty() || uri.Contains(key)) return output_uri;
+
+    std::ostringstream os;
+    os << uri.scheme << ":[" << key << "=" << jobs;
+    for(const auto& p : uri.params) os << "," << p.first << "=" << p.second;
+    os << "]//" << uri.url;
+    return os.str();
+}
 
-    // Open Video by URI
-    pangolin::VideoInput video(input_uri, output_uri);
-    const size_t num_streams = video.Streams().size();
+void VideoConvert(const std::string& input_uri, const std::string& output_uri, const ConvertOptions& opts)
+{
+    std::unique_ptr<pangolin::VideoInterface> video = pangolin::OpenVideo(input_uri);
+    const std::vector<pangolin::StreamInfo>& in_streams = video->Streams();
 
-    pangolin::VideoPlaybackInterface* playback = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoPlaybackInterface>(video);
+    pangolin::VideoPlaybackInterface* playback = pangolin::FindFirstMatchingVideoInterface<pangolin::VideoPlaybackInterface>(*video);
 
     // Output details of video stream
-    for(size_t s = 0; s < num_streams; ++s)
+    for(size_t s = 0; s < in_streams.size(); ++s)
     {
-        const pangolin::StreamInfo& si = video.Streams()[s];
+        const pangolin::StreamInfo& si = in_streams[s];
         std::cout << "Stream " << s << ": " << si.Width() << " x " << si.Height()
-                  << " " << si.PixFormat().format << " (pitch: " << si.Pitch() << " bytes)" << std::endl;
+                  << " " << si.PixFormat().Name() << " (pitch: " << si.Pitch() << " bytes)" << std::endl;
     }
 
-    // Image buffers
-    std::vector<pangolin::Image<unsigned char> > images;
-    std::vector<unsigned char> buffer;
-    buffer.resize(video.SizeBytes()+1);
+    // Selected streams, packed one after another
+    std::vector<size_t> selected = opts.streams;
+    if(selected.empty()) {
+        for(size_t s = 0; s < in_streams.size(); ++s) selected.push_back(s);
+    }
+    std::vector<pangolin::StreamInfo> out_streams;
+    size_t out_bytes = 0;
+    for(size_t s : selected) {
+        if(s >= in_streams.size()) {
+            throw pangolin::VideoException("VideoConvert: no stream " + std::to_string(s));
+        }
+        const pangolin::StreamInfo& si = in_streams[s];
+        out_streams.push_back(pangolin::StreamInfo(si.PixFormat(), si.Width(), si.Height(), si.Pitch(), (unsigned char*)0 + out_bytes));
+        out_bytes += si.SizeBytes();
+    }
+    const bool repack = selected.size() != in_streams.size() || out_bytes != video->SizeBytes();
 
-    // Record all frames
-    video.Record();
+    std::unique_ptr<pangolin::VideoOutputInterface> output = pangolin::OpenVideoOutput(OutputUriWithJobs(output_uri, opts.jobs));
+    output->SetStreams(out_streams, input_uri, pangolin::GetVideoDeviceProperties(video.get()));
 
-    // Stream and display video
-    while(true)
-    {
-        if( !video.Grab(&buffer[0], images, video_wait, video_newest) ) {
-            break;
+    size_t first = 0;
+    if(playback && opts.start) {
+        first = playback->Seek(opts.start);
+    }
+    const size_t total = playback ? std::min(playback->GetTotalFrames(), opts.end) : opts.end;
+
+    ConvertQueue queue(std::max<size_t>(1, opts.queue));
+    std::exception_ptr read_error;
+
+    std::thread reader([&]() {
+        try {
+            std::vector<unsigned char> buffer(video->SizeBytes());
+            video->Start();
+            for(size_t i = first; i < opts.end; ++i) {
+                if(!video->GrabNext(buffer.data(), true)) break;
+                if(i < opts.start || (i - opts.start) % opts.step) continue;
+
+                ConvertFrame frame;
+                frame.index = i;
+                frame.properties = pangolin::GetVideoFrameProperties(video.get());
+                frame.data = pangolin::FramePool::I().Acquire(std::max<size_t>(1, out_bytes));
+                if(repack) {
+                    for(size_t o = 0; o < selected.size(); ++o) {
+                        const pangolin::StreamInfo& si = in_streams[selected[o]];
+                        std::memcpy(frame.data.get() + (size_t)out_streams[o].Offset(), buffer.data() + (size_t)si.Offset(), si.SizeBytes());
+                    }
+                }else{
+                    std::memcpy(frame.data.get(), buffer.data(), out_bytes);
+                }
+                if(!queue.Push(std::move(frame))) break;
+            }
+        }catch(...) {
+            read_error = std::current_exception();
         }
-        if( playback ) {
-            std::cout << "Frames complete: " << playback->GetCurrentFrameId() << " / " << playback->GetTotalFrames() << '\r';
+        queue.Close();
+    });
+
+    const pangolin::basetime start = pangolin::TimeNow();
+    size_t written = 0;
+    try {
+        ConvertFrame frame;
+        while(queue.Pop(frame)) {
+            output->WriteStreams(frame.data.get(), frame.properties);
+            frame.data.Reset();
+            ++written;
+            if(total != std::numeric_limits<size_t>::max()) {
+                std::cout << "Frames complete: " << frame.index + 1 << " / " << total << '\r';
+            }else{
+                std::cout << "Frames complete: " << written << '\r';
+            }
             std::cout.flush();
         }
-   }
+    }catch(...) {
+        queue.Close();
+        reader.join();
+        throw;
+    }
+    reader.join();
+    video->Stop();
+
+    // Let any encoder workers finish before reporting
+    output.reset();
+    const double seconds = pangolin::TimeDiff_s(start, pangolin::TimeNow());
+    std::cout << std::endl << written << " frames in " << seconds << "s ("
+              << (seconds > 0 ? written / seconds : 0.0) << " fps)" << std::endl;
+
+    if(read_error) std::rethrow_exception(read_error);
 }
 
 
@@ -48,16 +218,38 @@ int main( int argc, char* argv[] )
 {
     const std::string dflt_output_uri = "pango:[unique_filename]//video.pango";
 
-    if( argc > 1 ) {
-        const std::string input_uri = std::string(argv[1]);
-        const std::string output_uri = (argc > 2) ? std::string(argv[2]) : dflt_output_uri;
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "start", {"-s", "--start"}, "First frame to convert (default: 0)", 1},
+        { "end", {"-e", "--end"}, "Frame to stop before (default: all)", 1},
+        { "step", {"-n", "--nth"}, "Convert every nth frame (default: 1)", 1},
+        { "streams", {"-S", "--streams"}, "Streams to convert, seperated by commas (default: all)", 1},
+        { "jobs", {"-j", "--jobs"}, "Encoder threads for pango: and images: outputs (default: as output uri)", 1},
+        { "queue", {"-q", "--queue"}, "Frames read ahead of the writer (default: 8)", 1},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+
+    if( !args["help"] && args.pos.size() > 0 ) {
+        const std::string input_uri = args.pos[0];
+        const std::string output_uri = (args.pos.size() > 1) ? std::string(args.pos[1]) : dflt_output_uri;
+
+        ConvertOptions opts;
+        opts.start = args["start"].as<size_t>(0);
+        opts.end = args["end"].as<size_t>(std::numeric_limits<size_t>::max());
+        opts.step = std::max<size_t>(1, args["step"].as<size_t>(1));
+        opts.streams = ParseIndices(args["streams"].as<std::string>(""));
+        opts.jobs = args["jobs"].as<size_t>(0);
+        opts.queue = args["queue"].as<size_t>(8);
+
         try{
-            VideoViewer(input_uri, output_uri);
-        } catch (pangolin::VideoException e) {
+            VideoConvert(input_uri, output_uri, opts);
+        } catch (const pangolin::VideoException& e) {
             std::cout << e.what() << std::endl;
         }
     }else{
-        std::cout << "Usage  : VideoConvert [video-in-uri] [video-out-uri]" << std::endl << std::endl;
+        std::cout << "Usage  : VideoConvert [options] [video-in-uri] [video-out-uri]" << std::endl << std::endl;
+        std::cout << argparser << std::endl;
         std::cout << "Where video-in-uri describes a stream or file resource, e.g." << std::endl;
         std::cout << "\tfile:[realtime=1]///home/user/video/movie.pvn" << std::endl;
         std::cout << "\tfile:///home/user/video/movie.avi" << std::endl;
@@ -69,6 +261,9 @@ int main( int argc, char* argv[] )
         std::cout << "\tmjpeg://http://127.0.0.1/?action=stream" << std::endl;
         std::cout << "\topenni:[img1=rgb]//" << std::endl;
         std::cout << std::endl;
+        std::cout << "For example, to write frames 100 to 199 of stream 1 as PNGs on 8 threads:" << std::endl;
+        std::cout << "\tVideoConvert -s 100 -e 200 -S 1 -j 8 video.pango images:///tmp/frames" << std::endl;
+        std::cout << std::endl;
     }
 
     return 0;
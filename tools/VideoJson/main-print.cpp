@@ -23,7 +23,12 @@ int main( int argc, char* argv[] )
             for(size_t framenum=0; framenum < src.index.size(); ++framenum) {
                 reader.Seek(src.id, framenum);
                 pangolin::Packet pkt = reader.NextFrame();
-                source_props["frame_properties"].push_back(pkt.meta);
+                picojson::value meta = pkt.meta;
+                pangolin::FrameMetadata binary;
+                if(!pkt.binary_meta.empty() && binary.Deserialize(pkt.binary_meta.data(), pkt.binary_meta.size())) {
+                    binary.AddToJson(meta);
+                }
+                source_props["frame_properties"].push_back(meta);
             }
 
             all_properties.push_back(source_props);
@@ -0,0 +1,89 @@
+#include <pangolin/log/packetstream_rewrite.h>
+#include <pangolin/utils/argagg.hpp>
+#include <pangolin/utils/timer.h>
+
+#include <iostream>
+#include <sstream>
+
+// Trim a .pango log to a range of frames or times and a selection of
+// sources, copying packets without decoding them.
+
+bool ParseRange(const std::string& range, double& begin, double& end)
+{
+    const size_t colon = range.find(':');
+    if(colon == std::string::npos) return false;
+    const std::string b = range.substr(0, colon);
+    const std::string e = range.substr(colon + 1);
+    if(!b.empty()) begin = std::stod(b);
+    if(!e.empty()) end = std::stod(e);
+    return true;
+}
+
+int main( int argc, char* argv[] )
+{
+    argagg::parser argparser {{
+        { "help", {"-h", "--help"}, "Print usage information and exit.", 0},
+        { "sources", {"-s", "--sources"}, "Sources to keep, seperated by commas (default: all)", 1},
+        { "frames", {"-f", "--frames"}, "Range of frames of each source to keep, as first:end (eg. '100:200')", 1},
+        { "time", {"-t", "--time"}, "Range of packet times to keep in seconds, as start:end", 1},
+        { "direct", {"-d", "--direct"}, "Write with O_DIRECT, with n blocks in flight", 1},
+    }};
+
+    argagg::parser_results args = argparser.parse(argc, argv);
+    if(args["help"] || args.pos.size() != 2) {
+        std::cout << "Usage: VideoRewrite [options] file_in.pango file_out.pango" << std::endl << argparser << std::endl;
+        return args["help"] ? 0 : 1;
+    }
+
+    pangolin::PacketStreamRewriteOptions options;
+
+    std::stringstream ss(args["sources"].as<std::string>(""));
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(!item.empty()) options.sources.push_back(std::stoul(item));
+    }
+
+    if(args["frames"]) {
+        double begin = 0.0, end = -1.0;
+        if(!ParseRange(args["frames"].as<std::string>(), begin, end)) {
+            std::cerr << "Expected a frame range of the form first:end" << std::endl;
+            return 1;
+        }
+        options.first_packet = (size_t)begin;
+        if(end >= 0.0) options.end_packet = (size_t)end;
+    }
+
+    if(args["time"]) {
+        double begin = -1e300, end = 1e300;
+        if(!ParseRange(args["time"].as<std::string>(), begin, end)) {
+            std::cerr << "Expected a time range of the form start:end" << std::endl;
+            return 1;
+        }
+        if(begin > -1e300) options.start_time_us = (int64_t)(begin * 1e6);
+        if(end < 1e300) options.end_time_us = (int64_t)(end * 1e6);
+    }
+
+    options.direct_depth = args["direct"].as<size_t>(0);
+    options.progress = [](size_t packets) {
+        if(packets % 100 == 0) {
+            std::cout << "Packets complete: " << packets << '\r';
+            std::cout.flush();
+        }
+    };
+
+    try {
+        const pangolin::basetime start = pangolin::TimeNow();
+        const pangolin::PacketStreamRewriteStats stats = pangolin::PacketStreamRewrite(args.pos[0], args.pos[1], options);
+        const double seconds = pangolin::TimeDiff_s(start, pangolin::TimeNow());
+
+        size_t packets = 0;
+        for(size_t n : stats.packets_per_source) packets += n;
+        std::cout << "Wrote " << packets << " packets (" << stats.payload_bytes / (1024.0 * 1024.0) << "MB) in "
+                  << seconds << "s" << (stats.memory_mapped ? "" : ", copied through the stream as the input isn't mappable") << std::endl;
+    }catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,7 +1,7 @@
 #include <pangolin/pangolin.h>
 
 #include <pangolin/log/packetstream_reader.h>
-#include <pangolin/log/packetstream_writer.h>
+#include <pangolin/log/packetstream_rewrite.h>
 #include <pangolin/video/video.h>
 
 int main( int argc, char* argv[] )
@@ -11,9 +11,6 @@ int main( int argc, char* argv[] )
         const std::string fileout = std::string(argv[2]);
         PANGO_ASSERT(filein != fileout);
 
-        pangolin::PacketStreamReader reader(filein);
-        pangolin::PacketStreamWriter writer(fileout);
-
         // Read new JSON from command line
         picojson::value all_properties;
 
@@ -21,40 +18,35 @@ int main( int argc, char* argv[] )
         std::cin >> all_properties;
         std::cout << "+ done" << std::endl;
 
-        PANGO_ASSERT(all_properties.size() == reader.Sources().size());
-
-        for(size_t i=0; i < reader.Sources().size(); ++i) {
-            const picojson::value& src_json = all_properties[i];
-            pangolin::PacketStreamSource src = reader.Sources()[i];
-
-            PANGO_ASSERT(src_json.contains("frame_properties"));
-            PANGO_ASSERT(src_json.contains("device_properties"));
-            PANGO_ASSERT(src_json["frame_properties"].size() == src.index.size());
-
-            // Ensure the index gets rewritten, and update the device properties.
-            src.index.clear();
-            src.info["device_properties"] = src_json["device_properties"];
-            writer.AddSource(src);
+        size_t total_frames = 0;
+        {
+            pangolin::PacketStreamReader reader(filein);
+            PANGO_ASSERT(all_properties.size() == reader.Sources().size());
+
+            for(size_t i=0; i < reader.Sources().size(); ++i) {
+                const picojson::value& src_json = all_properties[i];
+                PANGO_ASSERT(src_json.contains("frame_properties"));
+                PANGO_ASSERT(src_json.contains("device_properties"));
+                PANGO_ASSERT(src_json["frame_properties"].size() == reader.Sources()[i].index.size());
+                total_frames += reader.Sources()[i].index.size();
+            }
         }
 
+        // Payloads are copied as they are, only the JSON changes
+        pangolin::PacketStreamRewriteOptions options;
+        options.edit_source = [&](pangolin::PacketStreamSourceId src, pangolin::PacketStreamSource& source) {
+            source.info["device_properties"] = all_properties[src]["device_properties"];
+        };
+        options.edit_meta = [&](pangolin::PacketStreamSourceId src, size_t packet, picojson::value& meta) {
+            meta = all_properties[src]["frame_properties"][packet];
+        };
+        options.progress = [&](size_t packets) {
+            std::cout << "Frames complete: " << packets << " / " << total_frames << '\r';
+            std::cout.flush();
+        };
+
         std::cout << "Writing video with new JSON to '" << fileout << "'" << std::endl;
-        try{
-            std::vector<char> buffer;
-
-            while(true)
-            {
-                pangolin::Packet pkt = reader.NextFrame();
-                buffer.resize(pkt.BytesRemaining());
-                pkt.Stream().read(buffer.data(), buffer.size());
-
-                const picojson::value& new_frame_json = all_properties[pkt.src]["frame_properties"][pkt.sequence_num];
-                writer.WriteSourcePacket(pkt.src, buffer.data(), pkt.time, buffer.size(), new_frame_json);
-                std::cout << "Frames complete: " << pkt.sequence_num << " / " << reader.Sources()[pkt.src].index.size() << '\r';
-                std::cout.flush();
-            }
-        }catch(std::runtime_error)
-        {
-        }
+        pangolin::PacketStreamRewrite(filein, fileout, options);
         std::cout << std::endl << "+ done" << std::endl;
 
     }else{